@@ -328,19 +328,43 @@ static void free_host_info(struct host_info *hi) {
         free(hi);
 }
 
-static int acquire_time_data(sd_bus *bus, struct unit_times **out) {
+/* Fills in the derived fields, returns 0 if the unit never started */
+static int unit_times_finish(struct unit_times *t, const struct boot_times *boot_times, const char *name) {
+        assert(t);
+        assert(boot_times);
+        assert(name);
+
+        subtract_timestamp(&t->activating, boot_times->reverse_offset);
+        subtract_timestamp(&t->activated, boot_times->reverse_offset);
+        subtract_timestamp(&t->deactivating, boot_times->reverse_offset);
+        subtract_timestamp(&t->deactivated, boot_times->reverse_offset);
+
+        if (t->activated >= t->activating)
+                t->time = t->activated - t->activating;
+        else if (t->deactivated >= t->activating)
+                t->time = t->deactivated - t->activating;
+        else
+                t->time = 0;
+
+        if (t->activating == 0)
+                return 0;
+
+        t->name = strdup(name);
+        if (t->name == NULL)
+                return log_oom();
+
+        return 1;
+}
+
+/* Fallback for managers that lack ListUnitTimestamps() */
+static int acquire_time_data_by_unit(sd_bus *bus, struct boot_times *boot_times, struct unit_times **out) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         int r, c = 0;
-        struct boot_times *boot_times = NULL;
         struct unit_times *unit_times = NULL;
         size_t size = 0;
         UnitInfo u;
 
-        r = acquire_boot_times(bus, &boot_times);
-        if (r < 0)
-                goto fail;
-
         r = sd_bus_call_method(
                         bus,
                         "org.freedesktop.systemd1",
@@ -393,27 +417,82 @@ static int acquire_time_data(sd_bus *bus, struct unit_times **out) {
                         goto fail;
                 }
 
-                subtract_timestamp(&t->activating, boot_times->reverse_offset);
-                subtract_timestamp(&t->activated, boot_times->reverse_offset);
-                subtract_timestamp(&t->deactivating, boot_times->reverse_offset);
-                subtract_timestamp(&t->deactivated, boot_times->reverse_offset);
+                r = unit_times_finish(t, boot_times, u.id);
+                if (r < 0)
+                        goto fail;
+                if (r > 0)
+                        c++;
+        }
+        if (r < 0) {
+                bus_log_parse_error(r);
+                goto fail;
+        }
 
-                if (t->activated >= t->activating)
-                        t->time = t->activated - t->activating;
-                else if (t->deactivated >= t->activating)
-                        t->time = t->deactivated - t->activating;
-                else
-                        t->time = 0;
+        *out = unit_times;
+        return c;
 
-                if (t->activating == 0)
-                        continue;
+fail:
+        if (unit_times)
+                free_unit_times(unit_times, (unsigned) c);
+        return r;
+}
+
+static int acquire_time_data(sd_bus *bus, struct unit_times **out) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r, c = 0;
+        struct boot_times *boot_times = NULL;
+        struct unit_times *unit_times = NULL;
+        size_t size = 0;
+        const char *id;
+        usec_t activating, activated, deactivating, deactivated;
+
+        r = acquire_boot_times(bus, &boot_times);
+        if (r < 0)
+                goto fail;
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "ListUnitTimestamps",
+                        &error, &reply,
+                        NULL);
+        if (r < 0) {
+                if (sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD))
+                        return acquire_time_data_by_unit(bus, boot_times, out);
+
+                log_error("Failed to list unit timestamps: %s", bus_error_message(&error, -r));
+                goto fail;
+        }
+
+        r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(stttt)");
+        if (r < 0) {
+                bus_log_parse_error(r);
+                goto fail;
+        }
+
+        while ((r = sd_bus_message_read(reply, "(stttt)", &id, &activating, &activated, &deactivating, &deactivated)) > 0) {
+                struct unit_times *t;
 
-                t->name = strdup(u.id);
-                if (t->name == NULL) {
+                if (!GREEDY_REALLOC(unit_times, size, c+1)) {
                         r = log_oom();
                         goto fail;
                 }
-                c++;
+
+                t = unit_times+c;
+                t->name = NULL;
+                t->activating = activating;
+                t->activated = activated;
+                t->deactivating = deactivating;
+                t->deactivated = deactivated;
+
+                r = unit_times_finish(t, boot_times, id);
+                if (r < 0)
+                        goto fail;
+                if (r > 0)
+                        c++;
         }
         if (r < 0) {
                 bus_log_parse_error(r);
@@ -1230,6 +1309,103 @@ static int dump(sd_bus *bus, char **args) {
         return 0;
 }
 
+static void json_print_string(FILE *f, const char *s) {
+        const char *p;
+
+        fputc('"', f);
+
+        for (p = s; *p; p++) {
+                if (*p == '"' || *p == '\\')
+                        fprintf(f, "\\%c", *p);
+                else if ((unsigned char) *p < ' ')
+                        fprintf(f, "\\u%04x", (unsigned char) *p);
+                else
+                        fputc(*p, f);
+        }
+
+        fputc('"', f);
+}
+
+static int analyze_trace(sd_bus *bus, char **args) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_strv_free_ char **phases = NULL;
+        const char *phase, *unit;
+        uint64_t begin, duration;
+        bool first = true;
+        char **i;
+        int r;
+
+        if (!strv_isempty(args)) {
+                log_error("Too many arguments.");
+                return -E2BIG;
+        }
+
+        r = sd_bus_call_method(
+                        bus,
+                       "org.freedesktop.systemd1",
+                       "/org/freedesktop/systemd1",
+                       "org.freedesktop.systemd1.Manager",
+                       "GetTrace",
+                       &error,
+                       &reply,
+                       "");
+        if (r < 0) {
+                log_error("Failed issue method call: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        r = sd_bus_message_enter_container(reply, 'a', "(sstt)");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        /* Output the Chrome trace event format, as understood by
+         * chrome://tracing and most flame graph tools, with one
+         * thread per phase */
+        fputs("{\"traceEvents\":[\n", stdout);
+
+        while ((r = sd_bus_message_read(reply, "(sstt)", &phase, &unit, &begin, &duration)) > 0) {
+                unsigned tid = 0;
+
+                while (phases && phases[tid] && !streq(phases[tid], phase))
+                        tid++;
+
+                if (!phases || !phases[tid]) {
+                        r = strv_extend(&phases, phase);
+                        if (r < 0)
+                                return log_oom();
+                }
+
+                printf("%s{\"name\":", first ? "" : ",\n");
+                json_print_string(stdout, unit);
+                fputs(",\"cat\":", stdout);
+                json_print_string(stdout, phase);
+                printf(",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 "}",
+                       tid + 1, begin, duration);
+
+                first = false;
+        }
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        r = sd_bus_message_exit_container(reply);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        STRV_FOREACH(i, phases) {
+                printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                       first ? "" : ",\n", (unsigned) (i - phases) + 1);
+                json_print_string(stdout, *i);
+                fputs("}}", stdout);
+
+                first = false;
+        }
+
+        fputs("\n]}\n", stdout);
+
+        return 0;
+}
+
 static int set_log_level(sd_bus *bus, char **args) {
         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         int r;
@@ -1287,6 +1463,8 @@ static void help(void) {
                "  dot                     Output dependency graph in dot(1) format\n"
                "  set-log-level LEVEL     Set logging threshold for systemd\n"
                "  dump                    Output state serialization of service manager\n"
+               "  trace                   Output trace of internal manager phases in\n"
+               "                          Chrome trace event format\n"
                "  verify FILE...          Check unit files for correctness\n"
                , program_invocation_short_name);
 
@@ -1452,6 +1630,8 @@ int main(int argc, char *argv[]) {
                         r = dot(bus, argv+optind+1);
                 else if (streq(argv[optind], "dump"))
                         r = dump(bus, argv+optind+1);
+                else if (streq(argv[optind], "trace"))
+                        r = analyze_trace(bus, argv+optind+1);
                 else if (streq(argv[optind], "set-log-level"))
                         r = set_log_level(bus, argv+optind+1);
                 else
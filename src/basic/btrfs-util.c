@@ -267,6 +267,21 @@ int btrfs_clone_range(int infd, uint64_t in_offset, int outfd, uint64_t out_offs
         return 0;
 }
 
+int btrfs_get_fsid_fd(int fd, sd_id128_t *ret) {
+        struct btrfs_ioctl_fs_info_args fsi = {};
+
+        assert(fd >= 0);
+        assert(ret);
+
+        if (ioctl(fd, BTRFS_IOC_FS_INFO, &fsi) < 0)
+                return -errno;
+
+        assert_cc(sizeof(fsi.fsid) == sizeof(ret->bytes));
+        memcpy(ret->bytes, fsi.fsid, sizeof(ret->bytes));
+
+        return 0;
+}
+
 int btrfs_get_block_device_fd(int fd, dev_t *dev) {
         struct btrfs_ioctl_fs_info_args fsi = {};
         uint64_t id;
@@ -622,6 +637,120 @@ finish:
         return 0;
 }
 
+int btrfs_quota_get_all_fd(int fd, Hashmap **ret) {
+
+        struct btrfs_ioctl_search_args args = {
+                /* Tree of quota items */
+                .key.tree_id = BTRFS_QUOTA_TREE_OBJECTID,
+
+                /* The object ID is always 0 */
+                .key.min_objectid = 0,
+                .key.max_objectid = 0,
+
+                /* Look precisely for the quota items */
+                .key.min_type = BTRFS_QGROUP_INFO_KEY,
+                .key.max_type = BTRFS_QGROUP_LIMIT_KEY,
+
+                /* No restrictions on the other components */
+                .key.min_offset = 0,
+                .key.max_offset = (uint64_t) -1,
+
+                .key.min_transid = 0,
+                .key.max_transid = (uint64_t) -1,
+        };
+
+        _cleanup_hashmap_free_free_ Hashmap *h = NULL;
+        int r;
+
+        assert(fd >= 0);
+        assert(ret);
+
+        /* Like btrfs_subvol_get_quota_fd(), but returns the quota
+         * of all subvolumes of the file system at once, with a
+         * single pass over the quota tree, in a hashmap indexed by
+         * the subvolume id */
+
+        h = hashmap_new(&uint64_hash_ops);
+        if (!h)
+                return -ENOMEM;
+
+        while (btrfs_ioctl_search_args_compare(&args) <= 0) {
+                const struct btrfs_ioctl_search_header *sh;
+                unsigned i;
+
+                args.key.nr_items = 256;
+                if (ioctl(fd, BTRFS_IOC_TREE_SEARCH, &args) < 0)
+                        return -errno;
+
+                if (args.key.nr_items <= 0)
+                        break;
+
+                FOREACH_BTRFS_IOCTL_SEARCH_HEADER(i, sh, args) {
+                        BtrfsQuotaEntry *e;
+
+                        /* Make sure we start the next search at least from this entry */
+                        btrfs_ioctl_search_args_set(&args, sh);
+
+                        if (sh->objectid != 0)
+                                continue;
+                        if (!IN_SET(sh->type, BTRFS_QGROUP_INFO_KEY, BTRFS_QGROUP_LIMIT_KEY))
+                                continue;
+
+                        /* Only level 0 qgroups correspond to subvolumes */
+                        if ((sh->offset >> 48) != 0)
+                                continue;
+
+                        e = hashmap_get(h, &sh->offset);
+                        if (!e) {
+                                e = new(BtrfsQuotaEntry, 1);
+                                if (!e)
+                                        return -ENOMEM;
+
+                                e->subvol_id = sh->offset;
+                                e->quota = (BtrfsQuotaInfo) {
+                                        .referenced = (uint64_t) -1,
+                                        .exclusive = (uint64_t) -1,
+                                        .referenced_max = (uint64_t) -1,
+                                        .exclusive_max = (uint64_t) -1,
+                                };
+
+                                r = hashmap_put(h, &e->subvol_id, e);
+                                if (r < 0) {
+                                        free(e);
+                                        return r;
+                                }
+                        }
+
+                        if (sh->type == BTRFS_QGROUP_INFO_KEY) {
+                                const struct btrfs_qgroup_info_item *qii = BTRFS_IOCTL_SEARCH_HEADER_BODY(sh);
+
+                                e->quota.referenced = le64toh(qii->rfer);
+                                e->quota.exclusive = le64toh(qii->excl);
+
+                        } else {
+                                const struct btrfs_qgroup_limit_item *qli = BTRFS_IOCTL_SEARCH_HEADER_BODY(sh);
+
+                                e->quota.referenced_max = le64toh(qli->max_rfer);
+                                e->quota.exclusive_max = le64toh(qli->max_excl);
+
+                                if (e->quota.referenced_max == 0)
+                                        e->quota.referenced_max = (uint64_t) -1;
+                                if (e->quota.exclusive_max == 0)
+                                        e->quota.exclusive_max = (uint64_t) -1;
+                        }
+                }
+
+                /* Increase search key by one, to read the next item, if we can. */
+                if (!btrfs_ioctl_search_args_inc(&args))
+                        break;
+        }
+
+        *ret = h;
+        h = NULL;
+
+        return 0;
+}
+
 int btrfs_defrag_fd(int fd) {
         struct stat st;
 
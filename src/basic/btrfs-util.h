@@ -25,6 +25,7 @@
 #include <sys/types.h>
 
 #include "time-util.h"
+#include "hashmap.h"
 
 typedef struct BtrfsSubvolInfo {
         uint64_t subvol_id;
@@ -43,6 +44,11 @@ typedef struct BtrfsQuotaInfo {
         uint64_t exclusive_max;
 } BtrfsQuotaInfo;
 
+typedef struct BtrfsQuotaEntry {
+        uint64_t subvol_id;
+        BtrfsQuotaInfo quota;
+} BtrfsQuotaEntry;
+
 typedef enum BtrfsSnapshotFlags {
         BTRFS_SNAPSHOT_FALLBACK_COPY = 1,
         BTRFS_SNAPSHOT_READ_ONLY = 2,
@@ -65,10 +71,12 @@ int btrfs_subvol_get_id(int fd, const char *subvolume, uint64_t *ret);
 int btrfs_subvol_get_id_fd(int fd, uint64_t *ret);
 int btrfs_subvol_get_info_fd(int fd, BtrfsSubvolInfo *info);
 int btrfs_subvol_get_quota_fd(int fd, BtrfsQuotaInfo *quota);
+int btrfs_quota_get_all_fd(int fd, Hashmap **ret);
 
 int btrfs_reflink(int infd, int outfd);
 int btrfs_clone_range(int infd, uint64_t in_offset, int ofd, uint64_t out_offset, uint64_t sz);
 
+int btrfs_get_fsid_fd(int fd, sd_id128_t *ret);
 int btrfs_get_block_device_fd(int fd, dev_t *dev);
 int btrfs_get_block_device(const char *path, dev_t *dev);
 
@@ -26,6 +26,9 @@
 
 #define BITS_WEEKDAYS   127
 
+/* We don't look further into the future than this */
+#define YEAR_MAX 9999
+
 static void free_chain(CalendarComponent *c) {
         CalendarComponent *n;
 
@@ -119,6 +122,31 @@ static void fix_year(CalendarComponent *c) {
         }
 }
 
+static uint64_t chain_bits(const CalendarComponent *c, int from, int to) {
+        uint64_t bits = 0;
+
+        assert(from >= 0);
+        assert(to < 64);
+
+        /* No chain means any value matches */
+        if (!c)
+                return ((UINT64_C(2) << (to - from)) - 1) << from;
+
+        for (; c; c = c->next) {
+                int v;
+
+                for (v = c->value; v <= to; v += c->repeat) {
+                        if (v >= from)
+                                bits |= UINT64_C(1) << v;
+
+                        if (c->repeat <= 0)
+                                break;
+                }
+        }
+
+        return bits;
+}
+
 int calendar_spec_normalize(CalendarSpec *c) {
         assert(c);
 
@@ -134,6 +162,12 @@ int calendar_spec_normalize(CalendarSpec *c) {
         sort_chain(&c->minute);
         sort_chain(&c->second);
 
+        c->month_bits = (uint16_t) chain_bits(c->month, 1, 12);
+        c->day_bits = (uint32_t) chain_bits(c->day, 1, 31);
+        c->hour_bits = (uint32_t) chain_bits(c->hour, 0, 23);
+        c->minute_bits = chain_bits(c->minute, 0, 59);
+        c->second_bits = chain_bits(c->second, 0, 59);
+
         return 0;
 }
 
@@ -859,38 +893,104 @@ static int find_matching_component(const CalendarComponent *c, int *val) {
         return r;
 }
 
-static bool tm_out_of_bounds(const struct tm *tm) {
-        struct tm t;
-        assert(tm);
+static int find_next_bit(uint64_t bits, int val) {
+        assert(val >= 0);
 
-        t = *tm;
+        /* Returns the lowest set bit at or above val */
 
-        if (mktime(&t) == (time_t) -1)
-                return true;
+        if (val >= 64)
+                return -ENOENT;
 
-        /* Did any normalization take place? If so, it was out of bounds before */
-        return
-                t.tm_year != tm->tm_year ||
-                t.tm_mon != tm->tm_mon ||
-                t.tm_mday != tm->tm_mday ||
-                t.tm_hour != tm->tm_hour ||
-                t.tm_min != tm->tm_min ||
-                t.tm_sec != tm->tm_sec;
+        bits &= UINT64_MAX << val;
+        if (bits == 0)
+                return -ENOENT;
+
+        return __builtin_ctzll(bits);
 }
 
-static bool matches_weekday(int weekdays_bits, const struct tm *tm) {
-        struct tm t;
-        int k;
+static bool is_leap_year(int year) {
+        return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
 
-        if (weekdays_bits < 0 || weekdays_bits >= BITS_WEEKDAYS)
-                return true;
+static int days_in_month(int year, int month) {
+        static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
 
-        t = *tm;
-        if (mktime(&t) == (time_t) -1)
-                return false;
+        assert(month >= 1 && month <= 12);
+
+        if (month == 2 && is_leap_year(year))
+                return 29;
+
+        return days[month - 1];
+}
 
-        k = t.tm_wday == 0 ? 6 : t.tm_wday - 1;
-        return (weekdays_bits & (1 << k));
+static int weekday(int year, int month, int day) {
+        static const int offset[] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+
+        /* Sakamoto's method, counting from Monday = 0 */
+
+        if (month < 3)
+                year--;
+
+        return (year + year/4 - year/100 + year/400 + offset[month - 1] + day + 6) % 7;
+}
+
+static uint32_t month_day_bits(const CalendarSpec *spec, int year, int month) {
+        uint64_t week, bits;
+        int first;
+
+        /* The days of the month that exist, match the day chain and
+         * fall on one of the selected weekdays */
+
+        bits = spec->day_bits & (((UINT64_C(1) << days_in_month(year, month)) - 1) << 1);
+
+        if (spec->weekdays_bits < 0 || spec->weekdays_bits >= BITS_WEEKDAYS)
+                return (uint32_t) bits;
+
+        /* Rotate the weekday mask so that bit 0 corresponds to the
+         * 1st of the month, and repeat it for the following weeks */
+        first = weekday(year, month, 1);
+        week = ((spec->weekdays_bits >> first) | (spec->weekdays_bits << (7 - first))) & BITS_WEEKDAYS;
+        week |= week << 7;
+        week |= week << 14;
+        week |= week << 28;
+
+        return (uint32_t) (bits & (week << 1));
+}
+
+static void tm_carry(struct tm *tm) {
+        assert(tm);
+
+        /* Propagate the increments of find_next() to the higher
+         * fields, on plain calendar dates without consulting the time
+         * zone */
+
+        if (tm->tm_sec >= 60) {
+                tm->tm_min += tm->tm_sec / 60;
+                tm->tm_sec %= 60;
+        }
+
+        if (tm->tm_min >= 60) {
+                tm->tm_hour += tm->tm_min / 60;
+                tm->tm_min %= 60;
+        }
+
+        if (tm->tm_hour >= 24) {
+                tm->tm_mday += tm->tm_hour / 24;
+                tm->tm_hour %= 24;
+        }
+
+        for (;;) {
+                if (tm->tm_mon >= 12) {
+                        tm->tm_year += tm->tm_mon / 12;
+                        tm->tm_mon %= 12;
+                }
+
+                if (tm->tm_mday <= days_in_month(tm->tm_year + 1900, tm->tm_mon + 1))
+                        break;
+
+                tm->tm_mday -= days_in_month(tm->tm_year + 1900, tm->tm_mon + 1);
+                tm->tm_mon++;
+        }
 }
 
 static int find_next(const CalendarSpec *spec, struct tm *tm) {
@@ -900,106 +1000,171 @@ static int find_next(const CalendarSpec *spec, struct tm *tm) {
         assert(spec);
         assert(tm);
 
+        /* Finds the first point in local calendar time at or after
+         * *tm matching the spec. Each field is looked up in the
+         * compiled bitmaps, falling back to the next higher field if
+         * there's nothing left. Whether that local time actually
+         * exists is checked by the caller. */
+
         c = *tm;
 
         for (;;) {
-                /* Normalize the current date */
-                mktime(&c);
-                c.tm_isdst = -1;
+                int year;
 
-                c.tm_year += 1900;
-                r = find_matching_component(spec->year, &c.tm_year);
-                c.tm_year -= 1900;
+                tm_carry(&c);
 
+                year = c.tm_year + 1900;
+                if (year > YEAR_MAX)
+                        return -ENOENT;
+
+                r = find_matching_component(spec->year, &year);
+                if (r < 0)
+                        return r;
                 if (r > 0) {
+                        if (year > YEAR_MAX)
+                                return -ENOENT;
+
+                        c.tm_year = year - 1900;
                         c.tm_mon = 0;
                         c.tm_mday = 1;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                 }
-                if (r < 0 || tm_out_of_bounds(&c))
-                        return r;
-
-                c.tm_mon += 1;
-                r = find_matching_component(spec->month, &c.tm_mon);
-                c.tm_mon -= 1;
 
-                if (r > 0) {
+                r = find_next_bit(spec->month_bits, c.tm_mon + 1);
+                if (r < 0) {
+                        c.tm_year++;
+                        c.tm_mon = 0;
                         c.tm_mday = 1;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
+                        continue;
                 }
-                if (r < 0 || tm_out_of_bounds(&c)) {
-                        c.tm_year ++;
-                        c.tm_mon = 0;
+                if (r != c.tm_mon + 1) {
+                        c.tm_mon = r - 1;
                         c.tm_mday = 1;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
-                        continue;
                 }
 
-                r = find_matching_component(spec->day, &c.tm_mday);
-                if (r > 0)
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c)) {
-                        c.tm_mon ++;
+                r = find_next_bit(month_day_bits(spec, year, c.tm_mon + 1), c.tm_mday);
+                if (r < 0) {
+                        c.tm_mon++;
                         c.tm_mday = 1;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                         continue;
                 }
+                if (r != c.tm_mday) {
+                        c.tm_mday = r;
+                        c.tm_hour = c.tm_min = c.tm_sec = 0;
+                }
 
-                if (!matches_weekday(spec->weekdays_bits, &c)) {
+                r = find_next_bit(spec->hour_bits, c.tm_hour);
+                if (r < 0) {
                         c.tm_mday++;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                         continue;
                 }
-
-                r = find_matching_component(spec->hour, &c.tm_hour);
-                if (r > 0)
+                if (r != c.tm_hour) {
+                        c.tm_hour = r;
                         c.tm_min = c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c)) {
-                        c.tm_mday ++;
-                        c.tm_hour = c.tm_min = c.tm_sec = 0;
-                        continue;
                 }
 
-                r = find_matching_component(spec->minute, &c.tm_min);
-                if (r > 0)
-                        c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c)) {
-                        c.tm_hour ++;
+                r = find_next_bit(spec->minute_bits, c.tm_min);
+                if (r < 0) {
+                        c.tm_hour++;
                         c.tm_min = c.tm_sec = 0;
                         continue;
                 }
+                if (r != c.tm_min) {
+                        c.tm_min = r;
+                        c.tm_sec = 0;
+                }
 
-                r = find_matching_component(spec->second, &c.tm_sec);
-                if (r < 0 || tm_out_of_bounds(&c)) {
-                        c.tm_min ++;
+                r = find_next_bit(spec->second_bits, c.tm_sec);
+                if (r < 0) {
+                        c.tm_min++;
                         c.tm_sec = 0;
                         continue;
                 }
-
+                c.tm_sec = r;
 
                 *tm = c;
                 return 0;
         }
 }
 
+static bool tm_same_fields(const struct tm *a, const struct tm *b) {
+        return
+                a->tm_year == b->tm_year &&
+                a->tm_mon == b->tm_mon &&
+                a->tm_mday == b->tm_mday &&
+                a->tm_hour == b->tm_hour &&
+                a->tm_min == b->tm_min &&
+                a->tm_sec == b->tm_sec;
+}
+
+static bool tm_later(const struct tm *a, const struct tm *b) {
+        if (a->tm_year != b->tm_year)
+                return a->tm_year > b->tm_year;
+        if (a->tm_mon != b->tm_mon)
+                return a->tm_mon > b->tm_mon;
+        if (a->tm_mday != b->tm_mday)
+                return a->tm_mday > b->tm_mday;
+        if (a->tm_hour != b->tm_hour)
+                return a->tm_hour > b->tm_hour;
+        if (a->tm_min != b->tm_min)
+                return a->tm_min > b->tm_min;
+        return a->tm_sec > b->tm_sec;
+}
+
 int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next) {
-        struct tm tm;
-        time_t t;
+        struct tm tm, c;
+        time_t t, after;
         int r;
 
         assert(spec);
         assert(next);
 
-        t = (time_t) (usec / USEC_PER_SEC) + 1;
-        assert_se(localtime_r(&t, &tm));
+        after = (time_t) (usec / USEC_PER_SEC) + 1;
+        assert_se(localtime_r(&after, &tm));
 
-        r = find_next(spec, &tm);
-        if (r < 0)
-                return r;
+        for (;;) {
+                r = find_next(spec, &tm);
+                if (r < 0)
+                        return r;
 
-        t = mktime(&tm);
-        if (t == (time_t) -1)
-                return -EINVAL;
+                c = tm;
+                c.tm_isdst = -1;
+                t = mktime(&c);
+                if (t == (time_t) -1)
+                        return -EINVAL;
+
+                if (!tm_same_fields(&c, &tm)) {
+                        /* This local time doesn't exist, because
+                         * we are in a DST gap. Continue after it. */
+                        if (tm_later(&c, &tm))
+                                tm = c;
+                        else
+                                tm.tm_sec++;
+                        continue;
+                }
+
+                if (t < after) {
+                        /* The local time exists twice, and the
+                         * first instance is already past. Try the
+                         * second one. */
+                        c = tm;
+                        c.tm_isdst = 0;
+                        t = mktime(&c);
+                        if (t == (time_t) -1)
+                                return -EINVAL;
+
+                        if (t < after || !tm_same_fields(&c, &tm)) {
+                                tm.tm_sec++;
+                                continue;
+                        }
+                }
+
+                break;
+        }
 
         *next = (usec_t) t * USEC_PER_SEC;
         return 0;
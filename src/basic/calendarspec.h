@@ -44,6 +44,14 @@ typedef struct CalendarSpec {
         CalendarComponent *hour;
         CalendarComponent *minute;
         CalendarComponent *second;
+
+        /* The chains above compiled into one bit per matching value,
+         * by calendar_spec_normalize() */
+        uint16_t month_bits;
+        uint32_t day_bits;
+        uint32_t hour_bits;
+        uint64_t minute_bits;
+        uint64_t second_bits;
 } CalendarSpec;
 
 void calendar_spec_free(CalendarSpec *c);
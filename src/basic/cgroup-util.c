@@ -794,80 +794,128 @@ int cg_set_task_access(
         return 0;
 }
 
-int cg_pid_get_path(const char *controller, pid_t pid, char **path) {
-        _cleanup_fclose_ FILE *f = NULL;
-        char line[LINE_MAX];
-        const char *fs;
-        size_t cs = 0;
+static int cg_controller_length(const char **controller, size_t *ret) {
         int unified;
 
-        assert(path);
-        assert(pid >= 0);
+        assert(controller);
+        assert(ret);
 
         unified = cg_unified();
         if (unified < 0)
                 return unified;
         if (unified == 0) {
-                if (controller) {
-                        if (!cg_controller_is_valid(controller))
+                if (*controller) {
+                        if (!cg_controller_is_valid(*controller))
                                 return -EINVAL;
                 } else
-                        controller = SYSTEMD_CGROUP_CONTROLLER;
+                        *controller = SYSTEMD_CGROUP_CONTROLLER;
+
+                *ret = strlen(*controller);
+        } else
+                *ret = 0;
 
-                cs = strlen(controller);
+        return unified;
+}
+
+/* Returns 1 and the path if the line of /proc/<pid>/cgroup is
+ * about the controller, 0 otherwise. Modifies the line. */
+static int cg_parse_proc_cgroup_line(char *line, int unified, const char *controller, size_t cs, char **path) {
+        char *e, *p;
+
+        truncate_nl(line);
+
+        if (unified) {
+                e = startswith(line, "0:");
+                if (!e)
+                        return 0;
+
+                e = strchr(e, ':');
+                if (!e)
+                        return 0;
+        } else {
+                char *l;
+                size_t k;
+                const char *word, *state;
+                bool found = false;
+
+                l = strchr(line, ':');
+                if (!l)
+                        return 0;
+
+                l++;
+                e = strchr(l, ':');
+                if (!e)
+                        return 0;
+
+                *e = 0;
+                FOREACH_WORD_SEPARATOR(word, k, l, ",", state) {
+                        if (k == cs && memcmp(word, controller, cs) == 0) {
+                                found = true;
+                                break;
+                        }
+                }
+
+                if (!found)
+                        return 0;
         }
 
+        p = strdup(e + 1);
+        if (!p)
+                return -ENOMEM;
+
+        *path = p;
+        return 1;
+}
+
+int cg_pid_get_path(const char *controller, pid_t pid, char **path) {
+        _cleanup_fclose_ FILE *f = NULL;
+        char line[LINE_MAX];
+        const char *fs;
+        size_t cs;
+        int unified, r;
+
+        assert(path);
+        assert(pid >= 0);
+
+        unified = cg_controller_length(&controller, &cs);
+        if (unified < 0)
+                return unified;
+
         fs = procfs_file_alloca(pid, "cgroup");
         f = fopen(fs, "re");
         if (!f)
                 return errno == ENOENT ? -ESRCH : -errno;
 
         FOREACH_LINE(line, f, return -errno) {
-                char *e, *p;
-
-                truncate_nl(line);
-
-                if (unified) {
-                        e = startswith(line, "0:");
-                        if (!e)
-                                continue;
+                r = cg_parse_proc_cgroup_line(line, unified, controller, cs, path);
+                if (r != 0)
+                        return r < 0 ? r : 0;
+        }
 
-                        e = strchr(e, ':');
-                        if (!e)
-                                continue;
-                } else {
-                        char *l;
-                        size_t k;
-                        const char *word, *state;
-                        bool found = false;
-
-                        l = strchr(line, ':');
-                        if (!l)
-                                continue;
+        return -ENODATA;
+}
 
-                        l++;
-                        e = strchr(l, ':');
-                        if (!e)
-                                continue;
+int cg_get_path_from_proc_cgroup(const char *controller, const char *contents, char **path) {
+        _cleanup_free_ char *copy = NULL;
+        char *line, *state;
+        size_t cs;
+        int unified, r;
 
-                        *e = 0;
-                        FOREACH_WORD_SEPARATOR(word, k, l, ",", state) {
-                                if (k == cs && memcmp(word, controller, cs) == 0) {
-                                        found = true;
-                                        break;
-                                }
-                        }
+        assert(contents);
+        assert(path);
 
-                        if (!found)
-                                continue;
-                }
+        unified = cg_controller_length(&controller, &cs);
+        if (unified < 0)
+                return unified;
 
-                p = strdup(e + 1);
-                if (!p)
-                        return -ENOMEM;
+        copy = strdup(contents);
+        if (!copy)
+                return -ENOMEM;
 
-                *path = p;
-                return 0;
+        for (line = strtok_r(copy, "\n", &state); line; line = strtok_r(NULL, "\n", &state)) {
+                r = cg_parse_proc_cgroup_line(line, unified, controller, cs, path);
+                if (r != 0)
+                        return r < 0 ? r : 0;
         }
 
         return -ENODATA;
@@ -993,9 +1041,34 @@ int cg_is_empty_recursive(const char *controller, const char *path) {
 
         if (unified > 0) {
                 _cleanup_free_ char *populated = NULL, *t = NULL;
+                const char *v;
 
                 /* On the unified hierarchy we can check empty state
-                 * via the "cgroup.populated" attribute. */
+                 * via the "populated" field of "cgroup.events", or
+                 * the "cgroup.populated" attribute on older
+                 * kernels. */
+
+                r = cg_get_path(controller, path, "cgroup.events", &populated);
+                if (r < 0)
+                        return r;
+
+                r = read_full_file(populated, &t, NULL);
+                if (r >= 0) {
+                        v = startswith(t, "populated ");
+                        if (!v) {
+                                v = strstr(t, "\npopulated ");
+                                if (!v)
+                                        return -EBADMSG;
+
+                                v += strlen("\npopulated ");
+                        }
+
+                        return v[0] == '0';
+                }
+                if (r != -ENOENT)
+                        return r;
+
+                populated = mfree(populated);
 
                 r = cg_get_path(controller, path, "cgroup.populated", &populated);
                 if (r < 0)
@@ -32,9 +32,33 @@
 #include "strv.h"
 #include "path-util.h"
 #include "hashmap.h"
+#include "dir-cache.h"
 #include "conf-files.h"
 
-static int files_add(Hashmap *h, const char *root, const char *path, const char *suffix) {
+static int file_add(Hashmap *h, const char *dirpath, const char *name) {
+        char *p;
+        int r;
+
+        p = strjoin(dirpath, "/", name, NULL);
+        if (!p)
+                return -ENOMEM;
+
+        r = hashmap_put(h, basename(p), p);
+        if (r == -EEXIST) {
+                log_debug("Skipping overridden file: %s.", p);
+                free(p);
+        } else if (r < 0) {
+                free(p);
+                return r;
+        } else if (r == 0) {
+                log_debug("Duplicate file %s", p);
+                free(p);
+        }
+
+        return 0;
+}
+
+static int files_add(Hashmap *h, const char *root, const char *path, const char *suffix, DirCache *cache) {
         _cleanup_closedir_ DIR *dir = NULL;
         const char *dirpath;
         int r;
@@ -44,6 +68,26 @@ static int files_add(Hashmap *h, const char *root, const char *path, const char
 
         dirpath = prefix_roota(root, path);
 
+        if (cache) {
+                const DirCacheEntry *entries;
+                size_t n, i;
+
+                r = dir_cache_get(cache, dirpath, &entries, &n);
+                if (r <= 0)
+                        return r;
+
+                for (i = 0; i < n; i++) {
+                        if (!dirent_name_is_file_with_suffix(entries[i].name, entries[i].type, suffix))
+                                continue;
+
+                        r = file_add(h, dirpath, entries[i].name);
+                        if (r < 0)
+                                return r;
+                }
+
+                return 0;
+        }
+
         dir = opendir(dirpath);
         if (!dir) {
                 if (errno == ENOENT)
@@ -53,7 +97,6 @@ static int files_add(Hashmap *h, const char *root, const char *path, const char
 
         for (;;) {
                 struct dirent *de;
-                char *p;
 
                 errno = 0;
                 de = readdir(dir);
@@ -66,21 +109,9 @@ static int files_add(Hashmap *h, const char *root, const char *path, const char
                 if (!dirent_is_file_with_suffix(de, suffix))
                         continue;
 
-                p = strjoin(dirpath, "/", de->d_name, NULL);
-                if (!p)
-                        return -ENOMEM;
-
-                r = hashmap_put(h, basename(p), p);
-                if (r == -EEXIST) {
-                        log_debug("Skipping overridden file: %s.", p);
-                        free(p);
-                } else if (r < 0) {
-                        free(p);
+                r = file_add(h, dirpath, de->d_name);
+                if (r < 0)
                         return r;
-                } else if (r == 0) {
-                        log_debug("Duplicate file %s", p);
-                        free(p);
-                }
         }
 
         return 0;
@@ -94,7 +125,7 @@ static int base_cmp(const void *a, const void *b) {
         return strcmp(basename(s1), basename(s2));
 }
 
-static int conf_files_list_strv_internal(char ***strv, const char *suffix, const char *root, char **dirs) {
+static int conf_files_list_strv_internal(char ***strv, const char *suffix, const char *root, char **dirs, DirCache *cache) {
         _cleanup_hashmap_free_ Hashmap *fh = NULL;
         char **files, **p;
         int r;
@@ -111,7 +142,7 @@ static int conf_files_list_strv_internal(char ***strv, const char *suffix, const
                 return -ENOMEM;
 
         STRV_FOREACH(p, dirs) {
-                r = files_add(fh, root, *p, suffix);
+                r = files_add(fh, root, *p, suffix, cache);
                 if (r == -ENOMEM) {
                         return r;
                 } else if (r < 0)
@@ -131,6 +162,10 @@ static int conf_files_list_strv_internal(char ***strv, const char *suffix, const
 }
 
 int conf_files_list_strv(char ***strv, const char *suffix, const char *root, const char* const* dirs) {
+        return conf_files_list_strv_cached(strv, suffix, root, dirs, NULL);
+}
+
+int conf_files_list_strv_cached(char ***strv, const char *suffix, const char *root, const char* const* dirs, DirCache *cache) {
         _cleanup_strv_free_ char **copy = NULL;
 
         assert(strv);
@@ -140,7 +175,7 @@ int conf_files_list_strv(char ***strv, const char *suffix, const char *root, con
         if (!copy)
                 return -ENOMEM;
 
-        return conf_files_list_strv_internal(strv, suffix, root, copy);
+        return conf_files_list_strv_internal(strv, suffix, root, copy, cache);
 }
 
 int conf_files_list(char ***strv, const char *suffix, const char *root, const char *dir, ...) {
@@ -157,7 +192,7 @@ int conf_files_list(char ***strv, const char *suffix, const char *root, const ch
         if (!dirs)
                 return -ENOMEM;
 
-        return conf_files_list_strv_internal(strv, suffix, root, dirs);
+        return conf_files_list_strv_internal(strv, suffix, root, dirs, NULL);
 }
 
 int conf_files_list_nulstr(char ***strv, const char *suffix, const char *root, const char *d) {
@@ -170,5 +205,5 @@ int conf_files_list_nulstr(char ***strv, const char *suffix, const char *root, c
         if (!dirs)
                 return -ENOMEM;
 
-        return conf_files_list_strv_internal(strv, suffix, root, dirs);
+        return conf_files_list_strv_internal(strv, suffix, root, dirs, NULL);
 }
@@ -22,6 +22,9 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "dir-cache.h"
+
 int conf_files_list(char ***ret, const char *suffix, const char *root, const char *dir, ...);
 int conf_files_list_strv(char ***ret, const char *suffix, const char *root, const char* const* dirs);
+int conf_files_list_strv_cached(char ***ret, const char *suffix, const char *root, const char* const* dirs, DirCache *cache);
 int conf_files_list_nulstr(char ***ret, const char *suffix, const char *root, const char *dirs);
@@ -29,8 +29,12 @@
 
 #define COPY_BUFFER_SIZE (16*1024)
 
+/* The kernel side copy methods don't need a buffer of ours, hence let
+ * them move larger chunks per call */
+#define COPY_KERNEL_CHUNK_SIZE (8*1024*1024)
+
 int copy_bytes(int fdf, int fdt, uint64_t max_bytes, bool try_reflink) {
-        bool try_sendfile = true, try_splice = true;
+        bool try_cfr = true, try_sendfile = true, try_splice = true, copied = false;
         int r;
 
         assert(fdf >= 0);
@@ -44,7 +48,7 @@ int copy_bytes(int fdf, int fdt, uint64_t max_bytes, bool try_reflink) {
         }
 
         for (;;) {
-                size_t m = COPY_BUFFER_SIZE;
+                size_t m = COPY_KERNEL_CHUNK_SIZE;
                 ssize_t n;
 
                 if (max_bytes != (uint64_t) -1) {
@@ -56,7 +60,32 @@ int copy_bytes(int fdf, int fdt, uint64_t max_bytes, bool try_reflink) {
                                 m = (size_t) max_bytes;
                 }
 
-                /* First try sendfile(), unless we already tried */
+                /* First try copy_file_range(), which lets the file
+                 * system share or copy the data internally, unless we
+                 * already tried */
+                if (try_cfr) {
+                        n = copy_file_range(fdf, NULL, fdt, NULL, m, 0u);
+                        if (n < 0) {
+                                if (!IN_SET(errno, EINVAL, ENOSYS, EXDEV, EBADF, EOPNOTSUPP))
+                                        return -errno;
+
+                                try_cfr = false;
+                                /* use fallback below */
+                        } else if (n == 0) {
+                                /* EOF, unless this is the first call:
+                                 * virtual files such as the ones in
+                                 * /proc report a size of zero, and
+                                 * need to be read for real */
+                                if (copied)
+                                        break;
+
+                                try_cfr = false;
+                        } else
+                                /* Success! */
+                                goto next;
+                }
+
+                /* Then try sendfile(), unless we already tried */
                 if (try_sendfile) {
 
                         n = sendfile(fdt, fdf, NULL, m);
@@ -91,7 +120,10 @@ int copy_bytes(int fdf, int fdt, uint64_t max_bytes, bool try_reflink) {
 
                 /* As a fallback just copy bits by hand */
                 {
-                        char buf[m];
+                        char buf[COPY_BUFFER_SIZE];
+
+                        if (m > sizeof(buf))
+                                m = sizeof(buf);
 
                         n = read(fdf, buf, m);
                         if (n < 0)
@@ -105,6 +137,8 @@ int copy_bytes(int fdf, int fdt, uint64_t max_bytes, bool try_reflink) {
                 }
 
         next:
+                copied = true;
+
                 if (max_bytes != (uint64_t) -1) {
                         assert(max_bytes >= (uint64_t) n);
                         max_bytes -= n;
@@ -135,6 +169,53 @@ static int fd_copy_symlink(int df, const char *from, const struct stat *st, int
         return 0;
 }
 
+static int copy_data_sparse(int fdf, int fdt, uint64_t size) {
+        off_t offset = 0;
+        int r;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* Copies only the data ranges of the file, and leaves holes
+         * in the destination where the source has them */
+
+        while ((uint64_t) offset < size) {
+                off_t data, hole;
+
+                data = lseek(fdf, offset, SEEK_DATA);
+                if (data < 0) {
+                        if (errno == ENXIO) /* Only a hole is left */
+                                break;
+
+                        return -errno;
+                }
+
+                hole = lseek(fdf, data, SEEK_HOLE);
+                if (hole < 0)
+                        return -errno;
+
+                if (lseek(fdf, data, SEEK_SET) < 0)
+                        return -errno;
+                if (lseek(fdt, data, SEEK_SET) < 0)
+                        return -errno;
+
+                /* copy_bytes() returns -EFBIG once it copied the
+                 * requested number of bytes and more data follows,
+                 * which is exactly what we want here */
+                r = copy_bytes(fdf, fdt, hole - data, false);
+                if (r < 0 && r != -EFBIG)
+                        return r;
+
+                offset = hole;
+        }
+
+        /* Make sure a trailing hole is part of the copy too */
+        if (ftruncate(fdt, size) < 0)
+                return -errno;
+
+        return 0;
+}
+
 static int fd_copy_regular(int df, const char *from, const struct stat *st, int dt, const char *to) {
         _cleanup_close_ int fdf = -1, fdt = -1;
         struct timespec ts[2];
@@ -152,7 +233,20 @@ static int fd_copy_regular(int df, const char *from, const struct stat *st, int
         if (fdt < 0)
                 return -errno;
 
-        r = copy_bytes(fdf, fdt, (uint64_t) -1, true);
+        r = btrfs_reflink(fdf, fdt);
+        if (r < 0) {
+                r = copy_data_sparse(fdf, fdt, st->st_size);
+                if (r == -EINVAL) {
+                        /* SEEK_DATA is not supported by the file
+                         * system, copy everything then */
+                        if (lseek(fdf, 0, SEEK_SET) < 0 ||
+                            lseek(fdt, 0, SEEK_SET) < 0 ||
+                            ftruncate(fdt, 0) < 0)
+                                r = -errno;
+                        else
+                                r = copy_bytes(fdf, fdt, (uint64_t) -1, false);
+                }
+        }
         if (r < 0) {
                 unlinkat(dt, to, 0);
                 return r;
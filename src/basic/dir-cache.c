@@ -0,0 +1,223 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "hashmap.h"
+#include "strv.h"
+#include "time-util.h"
+#include "dir-cache.h"
+
+typedef struct DirCacheDirectory {
+        char *path;
+
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+
+        /* Whether the directory was untouched for long enough before
+         * it was read that an unchanged mtime proves it unchanged */
+        bool settled;
+
+        DirCacheEntry *entries;
+        size_t n_entries, n_allocated;
+} DirCacheDirectory;
+
+struct DirCache {
+        Hashmap *directories;
+};
+
+static void directory_clear_entries(DirCacheDirectory *d) {
+        size_t i;
+
+        for (i = 0; i < d->n_entries; i++)
+                free(d->entries[i].name);
+
+        d->n_entries = 0;
+}
+
+static DirCacheDirectory *directory_free(DirCacheDirectory *d) {
+        if (!d)
+                return NULL;
+
+        directory_clear_entries(d);
+        free(d->entries);
+        free(d->path);
+        free(d);
+
+        return NULL;
+}
+
+DirCache *dir_cache_new(void) {
+        DirCache *c;
+
+        c = new0(DirCache, 1);
+        if (!c)
+                return NULL;
+
+        c->directories = hashmap_new(&string_hash_ops);
+        if (!c->directories)
+                return mfree(c);
+
+        return c;
+}
+
+DirCache *dir_cache_free(DirCache *c) {
+        DirCacheDirectory *d;
+
+        if (!c)
+                return NULL;
+
+        while ((d = hashmap_steal_first(c->directories)))
+                directory_free(d);
+
+        hashmap_free(c->directories);
+        free(c);
+
+        return NULL;
+}
+
+static int directory_read(DirCacheDirectory *d) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        struct stat st;
+
+        assert(d);
+
+        directory_clear_entries(d);
+
+        dir = opendir(d->path);
+        if (!dir)
+                return -errno;
+
+        /* Take the timestamp before reading, so that any change made
+         * while we read is noticed the next time. A change within the
+         * granularity of the file system timestamps is not, hence
+         * only trust directories that were left alone for a while. */
+        if (fstat(dirfd(dir), &st) < 0)
+                return -errno;
+
+        d->dev = st.st_dev;
+        d->ino = st.st_ino;
+        d->mtime = st.st_mtim;
+        d->settled = timespec_load(&st.st_mtim) + USEC_PER_SEC < now(CLOCK_REALTIME);
+
+        for (;;) {
+                struct dirent *de;
+                char *name;
+
+                errno = 0;
+                de = readdir(dir);
+                if (!de && errno != 0)
+                        return -errno;
+
+                if (!de)
+                        break;
+
+                if (STR_IN_SET(de->d_name, ".", ".."))
+                        continue;
+
+                if (!GREEDY_REALLOC(d->entries, d->n_allocated, d->n_entries + 1))
+                        return -ENOMEM;
+
+                name = strdup(de->d_name);
+                if (!name)
+                        return -ENOMEM;
+
+                d->entries[d->n_entries].name = name;
+                d->entries[d->n_entries].type = de->d_type;
+                d->n_entries++;
+        }
+
+        return 0;
+}
+
+int dir_cache_get(DirCache *c, const char *path, const DirCacheEntry **ret, size_t *ret_n) {
+        DirCacheDirectory *d;
+        struct stat st;
+        int r;
+
+        assert(c);
+        assert(path);
+        assert(ret);
+        assert(ret_n);
+
+        d = hashmap_get(c->directories, path);
+
+        if (stat(path, &st) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        if (!S_ISDIR(st.st_mode)) {
+                r = -ENOTDIR;
+                goto fail;
+        }
+
+        if (d &&
+            d->settled &&
+            d->dev == st.st_dev &&
+            d->ino == st.st_ino &&
+            d->mtime.tv_sec == st.st_mtim.tv_sec &&
+            d->mtime.tv_nsec == st.st_mtim.tv_nsec)
+                goto finish;
+
+        if (!d) {
+                d = new0(DirCacheDirectory, 1);
+                if (!d)
+                        return -ENOMEM;
+
+                d->path = strdup(path);
+                if (!d->path) {
+                        free(d);
+                        return -ENOMEM;
+                }
+
+                r = hashmap_put(c->directories, d->path, d);
+                if (r < 0) {
+                        directory_free(d);
+                        return r;
+                }
+        }
+
+        r = directory_read(d);
+        if (r < 0)
+                goto fail;
+
+finish:
+        *ret = d->entries;
+        *ret_n = d->n_entries;
+        return 1;
+
+fail:
+        if (d) {
+                hashmap_remove(c->directories, d->path);
+                directory_free(d);
+        }
+
+        if (r == -ENOENT) {
+                *ret = NULL;
+                *ret_n = 0;
+                return 0;
+        }
+
+        return r;
+}
@@ -0,0 +1,45 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "macro.h"
+
+/* A DirCache remembers the entries of directories it was asked about,
+ * and only reads a directory again after its modification time
+ * changed. A lookup hence costs a stat() instead of an opendir() and
+ * a full readdir() loop. */
+typedef struct DirCache DirCache;
+
+typedef struct DirCacheEntry {
+        char *name;
+        unsigned char type; /* DT_*, as returned by readdir() */
+} DirCacheEntry;
+
+DirCache *dir_cache_new(void);
+DirCache *dir_cache_free(DirCache *c);
+
+/* Returns 0 if the directory does not exist, 1 and the entries
+ * otherwise, excluding "." and "..". The entries are owned by the
+ * cache and stay valid until the same directory is looked up
+ * again. */
+int dir_cache_get(DirCache *c, const char *path, const DirCacheEntry **ret, size_t *ret_n);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(DirCache*, dir_cache_free);
+#define _cleanup_dir_cache_free_ _cleanup_(dir_cache_freep)
@@ -65,12 +65,36 @@ static int write_string_file_atomic(const char *fn, const char *line, bool enfor
         return r;
 }
 
+static bool file_has_contents(const char *fn, const char *line, bool enforce_newline) {
+        _cleanup_free_ char *old = NULL;
+        size_t size, l;
+
+        if (read_full_file(fn, &old, &size) < 0)
+                return false;
+
+        l = strlen(line);
+        if (enforce_newline && !endswith(line, "\n")) {
+                if (size != l + 1 || old[l] != '\n')
+                        return false;
+        } else if (size != l)
+                return false;
+
+        return memcmp(old, line, l) == 0;
+}
+
 int write_string_file(const char *fn, const char *line, WriteStringFileFlags flags) {
         _cleanup_fclose_ FILE *f = NULL;
 
         assert(fn);
         assert(line);
 
+        /* Rewriting a file with what it already contains is not
+         * free: watchers get woken up, and atomic replacement gives
+         * the file a new inode. Hence, optionally check first. */
+        if ((flags & WRITE_STRING_FILE_ONLY_IF_CHANGED) &&
+            file_has_contents(fn, line, !(flags & WRITE_STRING_FILE_AVOID_NEWLINE)))
+                return 0;
+
         if (flags & WRITE_STRING_FILE_ATOMIC) {
                 assert(flags & WRITE_STRING_FILE_CREATE);
 
@@ -220,13 +244,13 @@ static int parse_env_file_internal(
                 const char *fname,
                 const char *newline,
                 int (*push) (const char *filename, unsigned line,
-                             const char *key, char *value, void *userdata, int *n_pushed),
+                             const char *key, const char *value, void *userdata, int *n_pushed),
                 void *userdata,
                 int *n_pushed) {
 
-        _cleanup_free_ char *contents = NULL, *key = NULL;
-        size_t key_alloc = 0, n_key = 0, value_alloc = 0, n_value = 0, last_value_whitespace = (size_t) -1, last_key_whitespace = (size_t) -1;
-        char *p, *value = NULL;
+        _cleanup_free_ char *contents = NULL;
+        size_t n_key = 0, n_value = 0, last_value_whitespace = (size_t) -1, last_key_whitespace = (size_t) -1;
+        char *p, *key = NULL, *value = NULL;
         int r;
         unsigned line = 1;
 
@@ -253,6 +277,13 @@ static int parse_env_file_internal(
         if (r < 0)
                 return r;
 
+        /* Keys and values are unquoted and unescaped in place: what
+         * we write never gets ahead of what we have read, hence both
+         * simply point into the buffer, and callbacks copy what they
+         * want to keep. The key starts where we read its first
+         * character, the value right after the NUL terminating the
+         * key. */
+
         for (p = contents; *p; p++) {
                 char c = *p;
 
@@ -265,12 +296,8 @@ static int parse_env_file_internal(
                                 state = KEY;
                                 last_key_whitespace = (size_t) -1;
 
-                                if (!GREEDY_REALLOC(key, key_alloc, n_key+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
-                                key[n_key++] = c;
+                                key = p;
+                                n_key = 1;
                         }
                         break;
 
@@ -282,17 +309,20 @@ static int parse_env_file_internal(
                         } else if (c == '=') {
                                 state = PRE_VALUE;
                                 last_value_whitespace = (size_t) -1;
+
+                                /* strip trailing whitespace from key */
+                                if (last_key_whitespace != (size_t) -1)
+                                        n_key = last_key_whitespace;
+
+                                key[n_key] = 0;
+                                value = key + n_key + 1;
+                                n_value = 0;
                         } else {
                                 if (!strchr(WHITESPACE, c))
                                         last_key_whitespace = (size_t) -1;
                                 else if (last_key_whitespace == (size_t) -1)
                                          last_key_whitespace = n_key;
 
-                                if (!GREEDY_REALLOC(key, key_alloc, n_key+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
                                 key[n_key++] = c;
                         }
 
@@ -302,22 +332,14 @@ static int parse_env_file_internal(
                         if (strchr(newline, c)) {
                                 state = PRE_KEY;
                                 line ++;
-                                key[n_key] = 0;
 
-                                if (value)
-                                        value[n_value] = 0;
+                                value[n_value] = 0;
 
-                                /* strip trailing whitespace from key */
-                                if (last_key_whitespace != (size_t) -1)
-                                        key[last_key_whitespace] = 0;
-
-                                r = push(fname, line, key, value, userdata, n_pushed);
+                                r = push(fname, line, key, n_value > 0 ? value : NULL, userdata, n_pushed);
                                 if (r < 0)
-                                        goto fail;
+                                        return r;
 
                                 n_key = 0;
-                                value = NULL;
-                                value_alloc = n_value = 0;
 
                         } else if (c == '\'')
                                 state = SINGLE_QUOTE_VALUE;
@@ -328,11 +350,6 @@ static int parse_env_file_internal(
                         else if (!strchr(WHITESPACE, c)) {
                                 state = VALUE;
 
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
                                 value[n_value++] = c;
                         }
 
@@ -343,26 +360,14 @@ static int parse_env_file_internal(
                                 state = PRE_KEY;
                                 line ++;
 
-                                key[n_key] = 0;
-
-                                if (value)
-                                        value[n_value] = 0;
-
                                 /* Chomp off trailing whitespace from value */
-                                if (last_value_whitespace != (size_t) -1)
-                                        value[last_value_whitespace] = 0;
-
-                                /* strip trailing whitespace from key */
-                                if (last_key_whitespace != (size_t) -1)
-                                        key[last_key_whitespace] = 0;
+                                value[last_value_whitespace != (size_t) -1 ? last_value_whitespace : n_value] = 0;
 
-                                r = push(fname, line, key, value, userdata, n_pushed);
+                                r = push(fname, line, key, n_value > 0 ? value : NULL, userdata, n_pushed);
                                 if (r < 0)
-                                        goto fail;
+                                        return r;
 
                                 n_key = 0;
-                                value = NULL;
-                                value_alloc = n_value = 0;
 
                         } else if (c == '\\') {
                                 state = VALUE_ESCAPE;
@@ -373,11 +378,6 @@ static int parse_env_file_internal(
                                 else if (last_value_whitespace == (size_t) -1)
                                         last_value_whitespace = n_value;
 
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
                                 value[n_value++] = c;
                         }
 
@@ -386,15 +386,9 @@ static int parse_env_file_internal(
                 case VALUE_ESCAPE:
                         state = VALUE;
 
-                        if (!strchr(newline, c)) {
-                                /* Escaped newlines we eat up entirely */
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
+                        /* Escaped newlines we eat up entirely */
+                        if (!strchr(newline, c))
                                 value[n_value++] = c;
-                        }
                         break;
 
                 case SINGLE_QUOTE_VALUE:
@@ -402,28 +396,16 @@ static int parse_env_file_internal(
                                 state = PRE_VALUE;
                         else if (c == '\\')
                                 state = SINGLE_QUOTE_VALUE_ESCAPE;
-                        else {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
+                        else
                                 value[n_value++] = c;
-                        }
 
                         break;
 
                 case SINGLE_QUOTE_VALUE_ESCAPE:
                         state = SINGLE_QUOTE_VALUE;
 
-                        if (!strchr(newline, c)) {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
+                        if (!strchr(newline, c))
                                 value[n_value++] = c;
-                        }
                         break;
 
                 case DOUBLE_QUOTE_VALUE:
@@ -431,28 +413,16 @@ static int parse_env_file_internal(
                                 state = PRE_VALUE;
                         else if (c == '\\')
                                 state = DOUBLE_QUOTE_VALUE_ESCAPE;
-                        else {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
+                        else
                                 value[n_value++] = c;
-                        }
 
                         break;
 
                 case DOUBLE_QUOTE_VALUE_ESCAPE:
                         state = DOUBLE_QUOTE_VALUE;
 
-                        if (!strchr(newline, c)) {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
+                        if (!strchr(newline, c))
                                 value[n_value++] = c;
-                        }
                         break;
 
                 case COMMENT:
@@ -478,56 +448,28 @@ static int parse_env_file_internal(
             state == DOUBLE_QUOTE_VALUE ||
             state == DOUBLE_QUOTE_VALUE_ESCAPE) {
 
-                key[n_key] = 0;
-
-                if (value)
+                if (state == VALUE && last_value_whitespace != (size_t) -1)
+                        value[last_value_whitespace] = 0;
+                else
                         value[n_value] = 0;
 
-                if (state == VALUE)
-                        if (last_value_whitespace != (size_t) -1)
-                                value[last_value_whitespace] = 0;
-
-                /* strip trailing whitespace from key */
-                if (last_key_whitespace != (size_t) -1)
-                        key[last_key_whitespace] = 0;
-
-                r = push(fname, line, key, value, userdata, n_pushed);
+                r = push(fname, line, key, n_value > 0 ? value : NULL, userdata, n_pushed);
                 if (r < 0)
-                        goto fail;
+                        return r;
         }
 
         return 0;
-
-fail:
-        free(value);
-        return r;
 }
 
 static int parse_env_file_push(
                 const char *filename, unsigned line,
-                const char *key, char *value,
+                const char *key, const char *value,
                 void *userdata,
                 int *n_pushed) {
 
         const char *k;
         va_list aq, *ap = userdata;
 
-        if (!utf8_is_valid(key)) {
-                _cleanup_free_ char *p;
-
-                p = utf8_escape_invalid(key);
-                log_error("%s:%u: invalid UTF-8 in key '%s', ignoring.", strna(filename), line, p);
-                return -EINVAL;
-        }
-
-        if (value && !utf8_is_valid(value)) {
-                _cleanup_free_ char *p;
-
-                p = utf8_escape_invalid(value);
-                log_error("%s:%u: invalid UTF-8 value for key %s: '%s', ignoring.", strna(filename), line, key, p);
-                return -EINVAL;
-        }
-
         va_copy(aq, *ap);
 
         while ((k = va_arg(aq, const char *))) {
@@ -536,9 +478,29 @@ static int parse_env_file_push(
                 v = va_arg(aq, char **);
 
                 if (streq(key, k)) {
+                        char *t = NULL;
+
                         va_end(aq);
+
+                        /* Only the keys we were asked for are
+                         * validated and copied, the key itself equals
+                         * one of ours and hence is valid */
+                        if (value && !utf8_is_valid(value)) {
+                                _cleanup_free_ char *p;
+
+                                p = utf8_escape_invalid(value);
+                                log_error("%s:%u: invalid UTF-8 value for key %s: '%s', ignoring.", strna(filename), line, key, p);
+                                return -EINVAL;
+                        }
+
+                        if (value) {
+                                t = strdup(value);
+                                if (!t)
+                                        return -ENOMEM;
+                        }
+
                         free(*v);
-                        *v = value;
+                        *v = t;
 
                         if (n_pushed)
                                 (*n_pushed)++;
@@ -548,7 +510,6 @@ static int parse_env_file_push(
         }
 
         va_end(aq);
-        free(value);
 
         return 0;
 }
@@ -572,7 +533,7 @@ int parse_env_file(
 
 static int load_env_file_push(
                 const char *filename, unsigned line,
-                const char *key, char *value,
+                const char *key, const char *value,
                 void *userdata,
                 int *n_pushed) {
         char ***m = userdata;
@@ -604,7 +565,6 @@ static int load_env_file_push(
         if (n_pushed)
                 (*n_pushed)++;
 
-        free(value);
         return 0;
 }
 
@@ -627,39 +587,36 @@ int load_env_file(FILE *f, const char *fname, const char *newline, char ***rl) {
 
 static int load_env_file_push_pairs(
                 const char *filename, unsigned line,
-                const char *key, char *value,
+                const char *key, const char *value,
                 void *userdata,
                 int *n_pushed) {
         char ***m = userdata;
         int r;
 
+        /* Skip just the broken assignment, the rest of the file is
+         * still good */
+
         if (!utf8_is_valid(key)) {
                 _cleanup_free_ char *t = utf8_escape_invalid(key);
 
-                log_error("%s:%u: invalid UTF-8 for key '%s', ignoring.", strna(filename), line, t);
-                return -EINVAL;
+                log_warning("%s:%u: invalid UTF-8 for key '%s', ignoring.", strna(filename), line, t);
+                return 0;
         }
 
         if (value && !utf8_is_valid(value)) {
                 _cleanup_free_ char *t = utf8_escape_invalid(value);
 
-                log_error("%s:%u: invalid UTF-8 value for key %s: '%s', ignoring.", strna(filename), line, key, t);
-                return -EINVAL;
+                log_warning("%s:%u: invalid UTF-8 value for key %s: '%s', ignoring.", strna(filename), line, key, t);
+                return 0;
         }
 
         r = strv_extend(m, key);
         if (r < 0)
                 return -ENOMEM;
 
-        if (!value) {
-                r = strv_extend(m, "");
-                if (r < 0)
-                        return -ENOMEM;
-        } else {
-                r = strv_push(m, value);
-                if (r < 0)
-                        return r;
-        }
+        r = strv_extend(m, strempty(value));
+        if (r < 0)
+                return -ENOMEM;
 
         if (n_pushed)
                 (*n_pushed)++;
@@ -780,8 +737,6 @@ int executable_is_script(const char *path, char **interpreter) {
  */
 int get_status_field(const char *filename, const char *pattern, char **field) {
         _cleanup_free_ char *status = NULL;
-        char *t, *f;
-        size_t len;
         int r;
 
         assert(filename);
@@ -792,6 +747,18 @@ int get_status_field(const char *filename, const char *pattern, char **field) {
         if (r < 0)
                 return r;
 
+        return parse_status_field(status, pattern, field);
+}
+
+int parse_status_field(const char *status, const char *pattern, char **field) {
+        const char *t;
+        char *f;
+        size_t len;
+
+        assert(status);
+        assert(pattern);
+        assert(field);
+
         t = strstr(status, pattern);
         if (!t)
                 return -ENOENT;
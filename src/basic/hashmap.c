@@ -223,7 +223,6 @@ struct HashmapBase {
         bool has_indirect:1;         /* whether indirect storage is used */
         unsigned n_direct_entries:3; /* Number of entries in direct storage.
                                       * Only valid if !has_indirect. */
-        bool from_pool:1;            /* whether was allocated from mempool */
         HASHMAP_DEBUG_FIELDS         /* optional hashmap_debug_info */
 };
 
@@ -243,15 +242,15 @@ struct Set {
         struct HashmapBase b;
 };
 
-DEFINE_MEMPOOL(hashmap_pool,         Hashmap,        8);
-DEFINE_MEMPOOL(ordered_hashmap_pool, OrderedHashmap, 8);
+DEFINE_MEMPOOL_THREADED(hashmap_pool,         Hashmap,        8);
+DEFINE_MEMPOOL_THREADED(ordered_hashmap_pool, OrderedHashmap, 8);
 /* No need for a separate Set pool */
 assert_cc(sizeof(Hashmap) == sizeof(Set));
 
 struct hashmap_type_info {
         size_t head_size;
         size_t entry_size;
-        struct mempool *mempool;
+        struct mempool_threaded *mempool;
         unsigned n_direct_buckets;
 };
 
@@ -291,6 +290,17 @@ const struct hash_ops string_hash_ops = {
         .compare = string_compare_func
 };
 
+unsigned long fast_string_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        uint64_t u;
+        siphash13((uint8_t*) &u, p, strlen(p), hash_key);
+        return (unsigned long) u;
+}
+
+const struct hash_ops fast_string_hash_ops = {
+        .hash = fast_string_hash_func,
+        .compare = string_compare_func
+};
+
 unsigned long trivial_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
         uint64_t u;
         siphash24((uint8_t*) &u, &p, sizeof(p), hash_key);
@@ -379,7 +389,18 @@ static uint8_t *hash_key(HashmapBase *h) {
 }
 
 static unsigned base_bucket_hash(HashmapBase *h, const void *p) {
-        return (unsigned) (h->hash_ops->hash(p, hash_key(h)) % n_buckets(h));
+        uint64_t full = h->hash_ops->hash(p, hash_key(h));
+        uint32_t hash;
+
+        /* Map the hash onto [0, n_buckets) with a multiply and a shift
+         * rather than a division. The shift only looks at the high
+         * bits of the product, so first fold the upper half in and
+         * spread the low bits upwards with a Fibonacci multiply, so
+         * that hash functions with little entropy at the top do not
+         * pile everything up in the first buckets. */
+        hash = (uint32_t) (full ^ (full >> 32)) * UINT32_C(0x9E3779B9);
+
+        return (unsigned) (((uint64_t) hash * n_buckets(h)) >> 32);
 }
 #define bucket_hash(h, p) base_bucket_hash(HASHMAP_BASE(h), p)
 
@@ -526,12 +547,14 @@ static void bucket_move_entry(HashmapBase *h, struct swap_entries *swap,
         }
 }
 
+/* Called for every probe, hence avoid the division */
 static unsigned next_idx(HashmapBase *h, unsigned idx) {
-        return (idx + 1U) % n_buckets(h);
+        idx++;
+        return idx < n_buckets(h) ? idx : 0;
 }
 
 static unsigned prev_idx(HashmapBase *h, unsigned idx) {
-        return (n_buckets(h) + idx - 1U) % n_buckets(h);
+        return idx > 0 ? idx - 1U : n_buckets(h) - 1U;
 }
 
 static void *entry_value(HashmapBase *h, struct hashmap_base_entry *e) {
@@ -782,17 +805,12 @@ static void reset_direct_storage(HashmapBase *h) {
 static struct HashmapBase *hashmap_base_new(const struct hash_ops *hash_ops, enum HashmapType type HASHMAP_DEBUG_PARAMS) {
         HashmapBase *h;
         const struct hashmap_type_info *hi = &hashmap_type_info[type];
-        bool use_pool;
-
-        use_pool = is_main_thread();
-
-        h = use_pool ? mempool_alloc0_tile(hi->mempool) : malloc0(hi->head_size);
 
+        h = mempool_threaded_alloc0_tile(hi->mempool);
         if (!h)
                 return NULL;
 
         h->type = type;
-        h->from_pool = use_pool;
         h->hash_ops = hash_ops ? hash_ops : &trivial_hash_ops;
 
         if (type == HASHMAP_TYPE_ORDERED) {
@@ -870,10 +888,7 @@ static void hashmap_free_no_clear(HashmapBase *h) {
         assert_se(pthread_mutex_unlock(&hashmap_debug_list_mutex) == 0);
 #endif
 
-        if (h->from_pool)
-                mempool_free_tile(hashmap_type_info[h->type].mempool, h);
-        else
-                free(h);
+        mempool_threaded_free_tile(hashmap_type_info[h->type].mempool, h);
 }
 
 HashmapBase *internal_hashmap_free(HashmapBase *h) {
@@ -1225,20 +1240,27 @@ static unsigned base_bucket_scan(HashmapBase *h, unsigned idx, const void *key)
         struct hashmap_base_entry *e;
         unsigned dib, distance;
         dib_raw_t *dibs = dib_raw_ptr(h);
+        bool trivial = h->hash_ops == &trivial_hash_ops;
 
         assert(idx < n_buckets(h));
 
         for (distance = 0; ; distance++) {
-                if (dibs[idx] == DIB_RAW_FREE)
+                dib_raw_t raw_dib = dibs[idx];
+
+                if (raw_dib == DIB_RAW_FREE)
                         return IDX_NIL;
 
-                dib = bucket_calculate_dib(h, idx, dibs[idx]);
+                /* Only overflowed DIBs need the entry to be looked at */
+                dib = _likely_(raw_dib < DIB_RAW_OVERFLOW) ? raw_dib : bucket_calculate_dib(h, idx, raw_dib);
 
                 if (dib < distance)
                         return IDX_NIL;
                 if (dib == distance) {
                         e = bucket_at(h, idx);
-                        if (h->hash_ops->compare(e->key, key) == 0)
+
+                        /* Sets of pointers are the most common kind,
+                         * spare them the indirect call */
+                        if (trivial ? e->key == key : h->hash_ops->compare(e->key, key) == 0)
                                 return idx;
                 }
 
@@ -1617,15 +1639,44 @@ unsigned internal_hashmap_buckets(HashmapBase *h) {
         return n_buckets(h);
 }
 
+size_t internal_hashmap_memory_usage(HashmapBase *h) {
+        const struct hashmap_type_info *hi;
+        size_t sz;
+
+        if (!h)
+                return 0;
+
+        hi = &hashmap_type_info[h->type];
+        sz = hi->head_size;
+
+        /* Indirect storage is always allocated in powers of two, see
+         * resize_buckets() */
+        if (h->has_indirect)
+                sz += (size_t) 1U << log2u_round_up(h->indirect.n_buckets * (hi->entry_size + sizeof(dib_raw_t)));
+
+        return sz;
+}
+
 int internal_hashmap_merge(Hashmap *h, Hashmap *other) {
         Iterator i;
         unsigned idx;
+        int r;
 
         assert(h);
 
+        /* Callers pass other unconditionally, e.g. when merging a
+         * unit that failed to load, so NULL means nothing to do */
+        if (!other)
+                return 0;
+
+        /* Size for the worst case once, instead of growing (and
+         * rehashing) step by step while inserting */
+        r = resize_buckets(HASHMAP_BASE(h), n_entries(HASHMAP_BASE(other)));
+        if (r < 0)
+                return r;
+
         HASHMAP_FOREACH_IDX(idx, HASHMAP_BASE(other), i) {
                 struct plain_hashmap_entry *pe = plain_bucket_at(other, idx);
-                int r;
 
                 r = hashmap_put(h, pe->b.key, pe->value);
                 if (r < 0 && r != -EEXIST)
@@ -1638,12 +1689,19 @@ int internal_hashmap_merge(Hashmap *h, Hashmap *other) {
 int set_merge(Set *s, Set *other) {
         Iterator i;
         unsigned idx;
+        int r;
 
         assert(s);
 
+        if (!other)
+                return 0;
+
+        r = resize_buckets(HASHMAP_BASE(s), n_entries(HASHMAP_BASE(other)));
+        if (r < 0)
+                return r;
+
         HASHMAP_FOREACH_IDX(idx, HASHMAP_BASE(other), i) {
                 struct set_entry *se = set_bucket_at(other, idx);
-                int r;
 
                 r = set_put(s, se->b.key);
                 if (r < 0)
@@ -1653,6 +1711,28 @@ int set_merge(Set *s, Set *other) {
         return 0;
 }
 
+int set_put_many(Set *s, void * const *keys, unsigned n_keys) {
+        unsigned i;
+        int n = 0, r;
+
+        assert(s);
+        assert(keys || n_keys == 0);
+
+        r = resize_buckets(HASHMAP_BASE(s), n_keys);
+        if (r < 0)
+                return r;
+
+        for (i = 0; i < n_keys; i++) {
+                r = set_put(s, keys[i]);
+                if (r < 0)
+                        return r;
+
+                n += r;
+        }
+
+        return n;
+}
+
 int internal_hashmap_reserve(HashmapBase *h, unsigned entries_add) {
         int r;
 
@@ -1850,6 +1930,10 @@ int set_put_strdupv(Set *s, char **l) {
         int n = 0, r;
         char **i;
 
+        r = set_reserve(s, strv_length(l));
+        if (r < 0)
+                return r;
+
         STRV_FOREACH(i, l) {
                 r = set_put_strdup(s, *i);
                 if (r < 0)
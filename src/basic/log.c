@@ -28,6 +28,7 @@
 #include <sys/un.h>
 #include <stddef.h>
 #include <printf.h>
+#include <pthread.h>
 
 #include "sd-messages.h"
 #include "log.h"
@@ -178,7 +179,208 @@ fail:
         return r;
 }
 
+/* In buffered mode, datagrams for the journal are queued in a ring
+ * and sent in batches, without blocking: whenever the ring is full,
+ * when the caller is about to go idle and calls log_flush(), when a
+ * critical message is logged, and on exit. */
+#define LOG_RING_SLOTS 64
+#define LOG_RING_SLOT_MAX (2*LINE_MAX)
+
+static char *log_ring = NULL;
+static size_t log_ring_sizes[LOG_RING_SLOTS];
+static unsigned log_ring_first = 0, log_ring_n = 0;
+static unsigned log_ring_dropped = 0;
+static pid_t log_ring_pid = 0;
+
+static void log_ring_free(void) {
+        log_ring = mfree(log_ring);
+        log_ring_first = log_ring_n = log_ring_dropped = 0;
+}
+
+static bool log_ring_owned(void) {
+        if (!log_ring)
+                return false;
+
+        /* After fork() the queued messages belong to the parent,
+         * and the child may exec() any moment, hence log
+         * synchronously there */
+        if (log_ring_pid != getpid()) {
+                log_ring_free();
+                return false;
+        }
+
+        return true;
+}
+
+static int log_ring_send_dropped(bool wait) {
+        char buf[LINE_MAX];
+
+        snprintf(buf, sizeof(buf),
+                 "PRIORITY=%i\n"
+                 "SYSLOG_FACILITY=%i\n"
+                 "SYSLOG_IDENTIFIER=%s\n"
+                 "MESSAGE=Dropped %u log messages, the journal was not accepting them.\n",
+                 LOG_WARNING,
+                 LOG_FAC(log_facility),
+                 program_invocation_short_name,
+                 log_ring_dropped);
+
+        if (send(journal_fd, buf, strlen(buf), MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT)) < 0)
+                return -errno;
+
+        log_ring_dropped = 0;
+        return 0;
+}
+
+static int log_ring_flush(bool wait) {
+        struct mmsghdr mh[LOG_RING_SLOTS] = {};
+        struct iovec iovec[LOG_RING_SLOTS];
+        unsigned i;
+        int n;
+
+        if (!log_ring_owned())
+                return 0;
+
+        if (log_ring_n == 0 && log_ring_dropped == 0)
+                return 0;
+
+        if (journal_fd < 0) {
+                log_ring_dropped += log_ring_n;
+                log_ring_first = log_ring_n = 0;
+                return -ENOTCONN;
+        }
+
+        while (log_ring_n > 0) {
+                for (i = 0; i < log_ring_n; i++) {
+                        unsigned k = (log_ring_first + i) % LOG_RING_SLOTS;
+
+                        iovec[i].iov_base = log_ring + k * LOG_RING_SLOT_MAX;
+                        iovec[i].iov_len = log_ring_sizes[k];
+                        mh[i].msg_hdr.msg_iov = iovec + i;
+                        mh[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                n = sendmmsg(journal_fd, mh, log_ring_n, MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT));
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN)
+                                return -EAGAIN;
+
+                        /* The journal went away, the caller falls
+                         * back to other targets */
+                        log_ring_dropped += log_ring_n;
+                        log_ring_first = log_ring_n = 0;
+                        return -errno;
+                }
+
+                log_ring_first = (log_ring_first + n) % LOG_RING_SLOTS;
+                log_ring_n -= n;
+        }
+
+        if (log_ring_dropped > 0)
+                return log_ring_send_dropped(wait);
+
+        return 0;
+}
+
+/* Returns 1 if the datagram was queued, 0 if it has to be sent
+ * directly, either because we are not buffering or because it is too
+ * large for a slot. */
+static int log_ring_push(int level, const struct iovec *iovec, unsigned n) {
+        size_t size = 0;
+        unsigned i, k;
+        int r;
+        char *p;
+
+        if (!log_ring_owned())
+                return 0;
+
+        for (i = 0; i < n; i++)
+                size += iovec[i].iov_len;
+
+        if (size > LOG_RING_SLOT_MAX) {
+                /* Keep the order */
+                (void) log_ring_flush(true);
+                return 0;
+        }
+
+        if (log_ring_n >= LOG_RING_SLOTS) {
+                r = log_ring_flush(false);
+                if (r < 0 && r != -EAGAIN)
+                        return r;
+        }
+
+        if (log_ring_n >= LOG_RING_SLOTS)
+                log_ring_dropped++;
+        else {
+                k = (log_ring_first + log_ring_n) % LOG_RING_SLOTS;
+                p = log_ring + k * LOG_RING_SLOT_MAX;
+
+                for (i = 0; i < n; i++)
+                        p = mempcpy(p, iovec[i].iov_base, iovec[i].iov_len);
+
+                log_ring_sizes[k] = size;
+                log_ring_n++;
+        }
+
+        /* Critical messages usually come right before we abort, and
+         * errors should not wait for the next idle point */
+        if (LOG_PRI(level) <= LOG_CRIT)
+                r = log_ring_flush(true);
+        else if (LOG_PRI(level) <= LOG_ERR || log_ring_n >= LOG_RING_SLOTS)
+                r = log_ring_flush(false);
+        else
+                r = 0;
+        if (r < 0 && r != -EAGAIN)
+                return r;
+
+        return 1;
+}
+
+static void log_ring_exit(void) {
+        (void) log_ring_flush(true);
+}
+
+static void log_ring_atfork(void) {
+        /* The child logs synchronously, hence send what we queued
+         * before, so that its messages don't overtake ours. Don't
+         * block though, we might be about to fork off the journal
+         * itself. */
+        (void) log_ring_flush(false);
+}
+
+void log_set_buffered(bool b) {
+        static bool registered = false, registered_atfork = false;
+
+        if (!b) {
+                (void) log_ring_flush(true);
+                log_ring_free();
+                return;
+        }
+
+        if (log_ring_owned())
+                return;
+
+        log_ring = malloc(LOG_RING_SLOTS * LOG_RING_SLOT_MAX);
+        if (!log_ring)
+                return;
+
+        log_ring_pid = getpid();
+
+        if (!registered && atexit(log_ring_exit) == 0)
+                registered = true;
+
+        if (!registered_atfork && pthread_atfork(log_ring_atfork, NULL, NULL) == 0)
+                registered_atfork = true;
+}
+
+int log_flush(void) {
+        return log_ring_flush(false);
+}
+
 void log_close_journal(void) {
+        (void) log_ring_flush(true);
         journal_fd = safe_close(journal_fd);
 }
 
@@ -296,6 +498,9 @@ void log_close(void) {
 }
 
 void log_forget_fds(void) {
+        /* Whatever is still queued would never be sent after this */
+        (void) log_ring_flush(true);
+
         console_fd = kmsg_fd = syslog_fd = journal_fd = -1;
 }
 
@@ -516,6 +721,7 @@ static int write_to_journal(
         char header[LINE_MAX];
         struct iovec iovec[4] = {};
         struct msghdr mh = {};
+        int r;
 
         if (journal_fd < 0)
                 return 0;
@@ -527,6 +733,10 @@ static int write_to_journal(
         IOVEC_SET_STRING(iovec[2], buffer);
         IOVEC_SET_STRING(iovec[3], "\n");
 
+        r = log_ring_push(level, iovec, ELEMENTSOF(iovec));
+        if (r != 0)
+                return r < 0 ? r : 1;
+
         mh.msg_iov = iovec;
         mh.msg_iovlen = ELEMENTSOF(iovec);
 
@@ -770,11 +980,13 @@ static void log_assert(
 
 noreturn void log_assert_failed(const char *text, const char *file, int line, const char *func) {
         log_assert(LOG_CRIT, text, file, line, func, "Assertion '%s' failed at %s:%u, function %s(). Aborting.");
+        (void) log_ring_flush(true);
         abort();
 }
 
 noreturn void log_assert_failed_unreachable(const char *text, const char *file, int line, const char *func) {
         log_assert(LOG_CRIT, text, file, line, func, "Code should not be reached '%s' at %s:%u, function %s(). Aborting.");
+        (void) log_ring_flush(true);
         abort();
 }
 
@@ -865,7 +1077,8 @@ int log_struct_internal(
 
                 mh.msg_iovlen = n;
 
-                (void) sendmsg(journal_fd, &mh, MSG_NOSIGNAL);
+                if (log_ring_push(level, iovec, n) == 0)
+                        (void) sendmsg(journal_fd, &mh, MSG_NOSIGNAL);
 
         finish:
                 va_end(ap);
@@ -1062,6 +1275,11 @@ static const char *const log_target_table[_LOG_TARGET_MAX] = {
 DEFINE_STRING_TABLE_LOOKUP(log_target, LogTarget);
 
 void log_received_signal(int level, const struct signalfd_siginfo *si) {
+        /* Don't bother with /proc for a message that is dropped
+         * anyway, PID 1 gets one of these for every SIGCHLD */
+        if (log_get_max_level() < LOG_PRI(level))
+                return;
+
         if (si->ssi_pid > 0) {
                 _cleanup_free_ char *p = NULL;
 
@@ -68,6 +68,9 @@ int log_open(void);
 void log_close(void);
 void log_forget_fds(void);
 
+void log_set_buffered(bool b);
+int log_flush(void);
+
 void log_close_syslog(void);
 void log_close_journal(void);
 void log_close_kmsg(void);
@@ -20,6 +20,8 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pthread.h>
+
 #include "mempool.h"
 #include "macro.h"
 #include "util.h"
@@ -88,8 +90,6 @@ void mempool_free_tile(struct mempool *mp, void *p) {
         mp->freelist = p;
 }
 
-#ifdef VALGRIND
-
 void mempool_drop(struct mempool *mp) {
         struct pool *p = mp->first_pool;
         while (p) {
@@ -98,6 +98,267 @@ void mempool_drop(struct mempool *mp) {
                 free(p);
                 p = n;
         }
+
+        mp->first_pool = NULL;
+        mp->freelist = NULL;
+}
+
+struct magazine {
+        struct magazine *next;
+        unsigned n_tiles;
+        void *tiles[MEMPOOL_MAGAZINE_SIZE];
+};
+
+/* A thread's magazines for one pool */
+struct mempool_cache {
+        struct magazine *loaded;
+        struct magazine *previous;
+};
+
+/* Pools get a slot in the per-thread tables when first used. There
+ * are only a handful of pools, those beyond the limit simply always
+ * take the locked path. */
+#define MEMPOOL_THREADED_MAX 16U
+
+struct mempool_thread {
+        struct mempool_cache caches[MEMPOOL_THREADED_MAX];
+};
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mempool_threaded *registry[MEMPOOL_THREADED_MAX];
+static unsigned n_registered = 0;
+
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static bool thread_key_initialized = false;
+
+static thread_local struct mempool_thread *current_thread = NULL;
+
+static void magazine_return(struct mempool_threaded *tp, struct magazine *m) {
+        struct magazine **l;
+
+        if (!m)
+                return;
+
+        l = m->n_tiles > 0 ? &tp->full : &tp->empty;
+        m->next = *l;
+        *l = m;
+}
+
+static void thread_destroy(void *p) {
+        struct mempool_thread *t = p;
+        unsigned i, n;
+
+        /* Hand the magazines of an exiting thread to the depots, so
+         * that their tiles can be used by others */
+
+        assert_se(pthread_mutex_lock(&registry_mutex) == 0);
+        n = n_registered;
+        assert_se(pthread_mutex_unlock(&registry_mutex) == 0);
+
+        for (i = 0; i < n; i++) {
+                struct mempool_threaded *tp = registry[i];
+                struct mempool_cache *c = t->caches + i;
+
+                if (!c->loaded && !c->previous)
+                        continue;
+
+                assert_se(pthread_mutex_lock(&tp->mutex) == 0);
+                magazine_return(tp, c->loaded);
+                magazine_return(tp, c->previous);
+                assert_se(pthread_mutex_unlock(&tp->mutex) == 0);
+        }
+
+        current_thread = NULL;
+        free(t);
+}
+
+static void thread_key_init(void) {
+        thread_key_initialized = pthread_key_create(&thread_key, thread_destroy) == 0;
+}
+
+/* We may be part of a shared library that is dlclose()d while other
+ * threads live on, make sure they don't call into unmapped code when
+ * they exit. Their magazines are lost then, as is the rest of the
+ * pools anyway. */
+static void _destructor_ thread_key_done(void) {
+        if (thread_key_initialized)
+                pthread_key_delete(thread_key);
+}
+
+/* Another thread may hold a depot mutex while we fork, which would
+ * leave it locked forever in the child. Hence take all of them
+ * across fork(), registry first, like thread_destroy() does. */
+static void atfork_prepare(void) {
+        unsigned i;
+
+        assert_se(pthread_mutex_lock(&registry_mutex) == 0);
+
+        for (i = 0; i < n_registered; i++)
+                assert_se(pthread_mutex_lock(&registry[i]->mutex) == 0);
+}
+
+static void atfork_release(void) {
+        unsigned i;
+
+        for (i = n_registered; i > 0; i--)
+                assert_se(pthread_mutex_unlock(&registry[i - 1]->mutex) == 0);
+
+        assert_se(pthread_mutex_unlock(&registry_mutex) == 0);
+}
+
+static void atfork_init(void) {
+        assert_se(pthread_atfork(atfork_prepare, atfork_release, atfork_release) == 0);
 }
 
-#endif
+static unsigned pool_register(struct mempool_threaded *tp) {
+        static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+        unsigned id;
+
+        assert_se(pthread_once(&atfork_once, atfork_init) == 0);
+
+        assert_se(pthread_mutex_lock(&registry_mutex) == 0);
+
+        id = tp->id;
+        if (id == 0 && n_registered < MEMPOOL_THREADED_MAX) {
+                registry[n_registered++] = tp;
+                id = n_registered;
+                __atomic_store_n(&tp->id, id, __ATOMIC_RELEASE);
+        }
+
+        assert_se(pthread_mutex_unlock(&registry_mutex) == 0);
+
+        return id;
+}
+
+static struct mempool_cache *cache_get(struct mempool_threaded *tp) {
+        unsigned id;
+
+        id = __atomic_load_n(&tp->id, __ATOMIC_ACQUIRE);
+        if (_unlikely_(id == 0)) {
+                id = pool_register(tp);
+                if (id == 0)
+                        return NULL;
+        }
+
+        if (_unlikely_(!current_thread)) {
+                struct mempool_thread *t;
+
+                assert_se(pthread_once(&thread_key_once, thread_key_init) == 0);
+                if (!thread_key_initialized)
+                        return NULL;
+
+                t = new0(struct mempool_thread, 1);
+                if (!t)
+                        return NULL;
+
+                if (pthread_setspecific(thread_key, t) != 0) {
+                        free(t);
+                        return NULL;
+                }
+
+                current_thread = t;
+        }
+
+        return current_thread->caches + id - 1;
+}
+
+void* mempool_threaded_alloc_tile(struct mempool_threaded *tp) {
+        struct mempool_cache *c;
+        void *p;
+
+        c = cache_get(tp);
+        if (c) {
+                if (c->loaded && c->loaded->n_tiles > 0)
+                        return c->loaded->tiles[--c->loaded->n_tiles];
+
+                if (c->previous && c->previous->n_tiles > 0) {
+                        struct magazine *m = c->previous;
+
+                        c->previous = c->loaded;
+                        c->loaded = m;
+
+                        return m->tiles[--m->n_tiles];
+                }
+        }
+
+        assert_se(pthread_mutex_lock(&tp->mutex) == 0);
+
+        if (c && tp->full) {
+                /* Trade our empty magazines for a full one */
+                struct magazine *m = tp->full;
+
+                tp->full = m->next;
+
+                magazine_return(tp, c->previous);
+                c->previous = c->loaded;
+                c->loaded = m;
+
+                p = m->tiles[--m->n_tiles];
+        } else
+                p = mempool_alloc_tile(&tp->pool);
+
+        assert_se(pthread_mutex_unlock(&tp->mutex) == 0);
+
+        return p;
+}
+
+void* mempool_threaded_alloc0_tile(struct mempool_threaded *tp) {
+        void *p;
+
+        p = mempool_threaded_alloc_tile(tp);
+        if (p)
+                memzero(p, tp->pool.tile_size);
+        return p;
+}
+
+void mempool_threaded_free_tile(struct mempool_threaded *tp, void *p) {
+        struct mempool_cache *c;
+
+        c = cache_get(tp);
+        if (c) {
+                if (c->loaded && c->loaded->n_tiles < MEMPOOL_MAGAZINE_SIZE) {
+                        c->loaded->tiles[c->loaded->n_tiles++] = p;
+                        return;
+                }
+
+                if (c->previous && c->previous->n_tiles < MEMPOOL_MAGAZINE_SIZE) {
+                        struct magazine *m = c->previous;
+
+                        c->previous = c->loaded;
+                        c->loaded = m;
+
+                        m->tiles[m->n_tiles++] = p;
+                        return;
+                }
+        }
+
+        assert_se(pthread_mutex_lock(&tp->mutex) == 0);
+
+        if (c) {
+                struct magazine *m;
+
+                /* Trade our full magazines for an empty one */
+                m = tp->empty;
+                if (m)
+                        tp->empty = m->next;
+                else
+                        m = new(struct magazine, 1);
+
+                if (m) {
+                        magazine_return(tp, c->previous);
+                        c->previous = c->loaded;
+                        c->loaded = m;
+
+                        m->n_tiles = 1;
+                        m->tiles[0] = p;
+
+                        assert_se(pthread_mutex_unlock(&tp->mutex) == 0);
+                        return;
+                }
+        }
+
+        mempool_free_tile(&tp->pool, p);
+
+        assert_se(pthread_mutex_unlock(&tp->mutex) == 0);
+}
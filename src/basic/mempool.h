@@ -22,6 +22,7 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pthread.h>
 #include <stddef.h>
 
 struct pool;
@@ -43,7 +44,36 @@ struct mempool pool_name = { \
         .at_least = alloc_at_least, \
 }
 
-
-#ifdef VALGRIND
 void mempool_drop(struct mempool *mp);
-#endif
+
+/* A mempool that may be used from any thread, and tiles may be freed
+ * in another thread than the one that allocated them. Every thread
+ * keeps two magazines of free tiles per pool, which it allocates from
+ * and frees into without locking. Only when both are exhausted (or
+ * full) they are traded in at the pool's depot, under its mutex.
+ * Pools must have static storage duration. */
+
+#define MEMPOOL_MAGAZINE_SIZE 32U
+
+struct magazine;
+
+struct mempool_threaded {
+        pthread_mutex_t mutex;
+        struct mempool pool;
+        struct magazine *full;
+        struct magazine *empty;
+        unsigned id;
+};
+
+void* mempool_threaded_alloc_tile(struct mempool_threaded *tp);
+void* mempool_threaded_alloc0_tile(struct mempool_threaded *tp);
+void mempool_threaded_free_tile(struct mempool_threaded *tp, void *p);
+
+#define DEFINE_MEMPOOL_THREADED(pool_name, tile_type, alloc_at_least) \
+struct mempool_threaded pool_name = { \
+        .mutex = PTHREAD_MUTEX_INITIALIZER, \
+        .pool = { \
+                .tile_size = sizeof(tile_type), \
+                .at_least = alloc_at_least, \
+        }, \
+}
@@ -1036,6 +1036,31 @@ static inline int kcmp(pid_t pid1, pid_t pid2, int type, unsigned long idx1, uns
 #define KCMP_FILE 0
 #endif
 
+#if !HAVE_DECL_COPY_FILE_RANGE
+#  ifndef __NR_copy_file_range
+#    if defined __x86_64__
+#      define __NR_copy_file_range 326
+#    elif defined __i386__
+#      define __NR_copy_file_range 377
+#    elif defined __arm__
+#      define __NR_copy_file_range 391
+#    elif defined __aarch64__
+#      define __NR_copy_file_range 285
+#    elif defined __s390__
+#      define __NR_copy_file_range 375
+#    elif defined __powerpc__
+#      define __NR_copy_file_range 379
+#    else
+#      warning "__NR_copy_file_range unknown for your architecture"
+#      define __NR_copy_file_range 0xffffffff
+#    endif
+#  endif
+
+static inline ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned flags) {
+        return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, flags);
+}
+#endif
+
 #ifndef INPUT_PROP_POINTING_STICK
 #define INPUT_PROP_POINTING_STICK 0x05
 #endif
@@ -22,16 +22,31 @@
 #include "util.h"
 #include "prioq.h"
 
+/* A 4-ary heap: it is half as deep as a binary one, and the four
+ * children of a node are laid out to share one cache line, so going
+ * down a level costs about as much as it does in a binary heap. */
+#define PRIOQ_ARITY 4U
+#define PRIOQ_CACHE_LINE 64U
+
+#define PARENT(k) (((k) - 1U) / PRIOQ_ARITY)
+#define FIRST_CHILD(k) ((k) * PRIOQ_ARITY + 1U)
+
 struct prioq_item {
         void *data;
         unsigned *idx;
 };
 
+/* items[] starts this many items into the allocation, which puts
+ * every group of siblings, items[4k+1]...items[4k+4], at the beginning
+ * of a cache line (or of a half of one, on 32bit archs) */
+#define PRIOQ_PAD (PRIOQ_CACHE_LINE / sizeof(struct prioq_item) - 1U)
+
 struct Prioq {
         compare_func_t compare_func;
         unsigned n_items, n_allocated;
 
         struct prioq_item *items;
+        void *buffer;
 };
 
 Prioq *prioq_new(compare_func_t compare_func) {
@@ -49,7 +64,7 @@ Prioq* prioq_free(Prioq *q) {
         if (!q)
                 return NULL;
 
-        free(q->items);
+        free(q->buffer);
         free(q);
 
         return NULL;
@@ -68,107 +83,113 @@ int prioq_ensure_allocated(Prioq **q, compare_func_t compare_func) {
         return 0;
 }
 
-static void swap(Prioq *q, unsigned j, unsigned k) {
-        void *saved_data;
-        unsigned *saved_idx;
+static int prioq_grow(Prioq *q, unsigned n_add) {
+        void *buffer;
+        unsigned n;
 
         assert(q);
-        assert(j < q->n_items);
-        assert(k < q->n_items);
 
-        assert(!q->items[j].idx || *(q->items[j].idx) == j);
-        assert(!q->items[k].idx || *(q->items[k].idx) == k);
+        if (q->n_items + n_add <= q->n_allocated)
+                return 0;
+
+        if (n_add > UINT_MAX / 4 - q->n_items)
+                return -ENOMEM;
+
+        n = MAX((q->n_items + n_add) * 2, 16u);
 
-        saved_data = q->items[j].data;
-        saved_idx = q->items[j].idx;
-        q->items[j].data = q->items[k].data;
-        q->items[j].idx = q->items[k].idx;
-        q->items[k].data = saved_data;
-        q->items[k].idx = saved_idx;
+        /* realloc() wouldn't keep the alignment, hence copy by hand */
+        if (posix_memalign(&buffer, PRIOQ_CACHE_LINE, (n + PRIOQ_PAD) * sizeof(struct prioq_item)) != 0)
+                return -ENOMEM;
+
+        if (q->n_items > 0)
+                memcpy((struct prioq_item*) buffer + PRIOQ_PAD, q->items, q->n_items * sizeof(struct prioq_item));
 
-        if (q->items[j].idx)
-                *q->items[j].idx = j;
+        free(q->buffer);
+        q->buffer = buffer;
+        q->items = (struct prioq_item*) buffer + PRIOQ_PAD;
+        q->n_allocated = n;
 
-        if (q->items[k].idx)
-                *q->items[k].idx = k;
+        return 0;
 }
 
+static void item_move(Prioq *q, unsigned k, const struct prioq_item *i) {
+        q->items[k] = *i;
+
+        if (i->idx)
+                *i->idx = k;
+}
+
+/* Both shuffle functions move a hole rather than swapping, and only
+ * write the item itself (and its idx) once, at its final place */
 static unsigned shuffle_up(Prioq *q, unsigned idx) {
+        struct prioq_item item;
+
         assert(q);
+        assert(idx < q->n_items);
+
+        item = q->items[idx];
 
         while (idx > 0) {
                 unsigned k;
 
-                k = (idx-1)/2;
+                k = PARENT(idx);
 
-                if (q->compare_func(q->items[k].data, q->items[idx].data) < 0)
+                if (q->compare_func(q->items[k].data, item.data) < 0)
                         break;
 
-                swap(q, idx, k);
+                item_move(q, idx, q->items + k);
                 idx = k;
         }
 
+        item_move(q, idx, &item);
+
         return idx;
 }
 
 static unsigned shuffle_down(Prioq *q, unsigned idx) {
+        struct prioq_item item;
+
         assert(q);
+        assert(idx < q->n_items);
+
+        item = q->items[idx];
 
         for (;;) {
                 unsigned j, k, s;
 
-                k = (idx+1)*2; /* right child */
-                j = k-1;       /* left child */
-
+                j = FIRST_CHILD(idx);
                 if (j >= q->n_items)
                         break;
 
-                if (q->compare_func(q->items[j].data, q->items[idx].data) < 0)
-
-                        /* So our left child is smaller than we are, let's
-                         * remember this fact */
-                        s = j;
-                else
-                        s = idx;
-
-                if (k < q->n_items &&
-                    q->compare_func(q->items[k].data, q->items[s].data) < 0)
+                /* Find the smallest of the children */
+                k = MIN(j + PRIOQ_ARITY, q->n_items);
+                for (s = j++; j < k; j++)
+                        if (q->compare_func(q->items[j].data, q->items[s].data) < 0)
+                                s = j;
 
-                        /* So our right child is smaller than we are, let's
-                         * remember this fact */
-                        s = k;
-
-                /* s now points to the smallest of the three items */
-
-                if (s == idx)
-                        /* No swap necessary, we're done */
+                if (q->compare_func(q->items[s].data, item.data) >= 0)
+                        /* None is smaller than we are, we're done */
                         break;
 
-                swap(q, idx, s);
+                item_move(q, idx, q->items + s);
                 idx = s;
         }
 
+        item_move(q, idx, &item);
+
         return idx;
 }
 
 int prioq_put(Prioq *q, void *data, unsigned *idx) {
         struct prioq_item *i;
         unsigned k;
+        int r;
 
         assert(q);
 
-        if (q->n_items >= q->n_allocated) {
-                unsigned n;
-                struct prioq_item *j;
-
-                n = MAX((q->n_items+1) * 2, 16u);
-                j = realloc(q->items, sizeof(struct prioq_item) * n);
-                if (!j)
-                        return -ENOMEM;
-
-                q->items = j;
-                q->n_allocated = n;
-        }
+        r = prioq_grow(q, 1);
+        if (r < 0)
+                return r;
 
         k = q->n_items++;
         i = q->items + k;
@@ -220,7 +241,7 @@ _pure_ static struct prioq_item* find_item(Prioq *q, void *data, unsigned *idx)
 
         if (idx) {
                 if (*idx == PRIOQ_IDX_NULL ||
-                    *idx > q->n_items)
+                    *idx >= q->n_items)
                         return NULL;
 
                 i = q->items + *idx;
@@ -0,0 +1,439 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "fileio.h"
+#include "cgroup-util.h"
+#include "process-util.h"
+#include "proc-snapshot.h"
+
+typedef enum ProcFile {
+        PROC_FILE_STAT,
+        PROC_FILE_STATUS,
+        PROC_FILE_COMM,
+        PROC_FILE_CMDLINE,
+        PROC_FILE_ENVIRON,
+        PROC_FILE_CGROUP,
+        _PROC_FILE_MAX,
+} ProcFile;
+
+static const char* const proc_file_table[_PROC_FILE_MAX] = {
+        [PROC_FILE_STAT] = "stat",
+        [PROC_FILE_STATUS] = "status",
+        [PROC_FILE_COMM] = "comm",
+        [PROC_FILE_CMDLINE] = "cmdline",
+        [PROC_FILE_ENVIRON] = "environ",
+        [PROC_FILE_CGROUP] = "cgroup",
+};
+
+typedef struct ProcSnapshotFile {
+        /* The buffer is kept across proc_snapshot_open() calls */
+        char *data;
+        size_t size, allocated;
+
+        bool read;
+        int error;
+} ProcSnapshotFile;
+
+struct ProcSnapshot {
+        pid_t pid;
+        int dir_fd;
+
+        ProcSnapshotFile files[_PROC_FILE_MAX];
+
+        char *exe;
+        bool exe_read;
+        int exe_error;
+};
+
+static void proc_snapshot_reset(ProcSnapshot *s) {
+        ProcFile f;
+
+        assert(s);
+
+        s->dir_fd = safe_close(s->dir_fd);
+
+        for (f = 0; f < _PROC_FILE_MAX; f++) {
+                s->files[f].size = 0;
+                s->files[f].read = false;
+                s->files[f].error = 0;
+        }
+
+        s->exe = mfree(s->exe);
+        s->exe_read = false;
+        s->exe_error = 0;
+}
+
+int proc_snapshot_open(ProcSnapshot *s, pid_t pid) {
+        const char *p;
+
+        assert(s);
+        assert(pid >= 0);
+
+        proc_snapshot_reset(s);
+
+        p = procfs_file_alloca(pid, "");
+
+        s->dir_fd = open(p, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (s->dir_fd < 0)
+                return errno == ENOENT ? -ESRCH : -errno;
+
+        s->pid = pid;
+        return 0;
+}
+
+int proc_snapshot_new(pid_t pid, ProcSnapshot **ret) {
+        ProcSnapshot *s;
+        int r;
+
+        assert(pid >= 0);
+        assert(ret);
+
+        s = new0(ProcSnapshot, 1);
+        if (!s)
+                return -ENOMEM;
+
+        s->dir_fd = -1;
+
+        r = proc_snapshot_open(s, pid);
+        if (r < 0) {
+                proc_snapshot_free(s);
+                return r;
+        }
+
+        *ret = s;
+        return 0;
+}
+
+ProcSnapshot *proc_snapshot_free(ProcSnapshot *s) {
+        ProcFile f;
+
+        if (!s)
+                return NULL;
+
+        proc_snapshot_reset(s);
+
+        for (f = 0; f < _PROC_FILE_MAX; f++)
+                free(s->files[f].data);
+
+        free(s);
+
+        return NULL;
+}
+
+pid_t proc_snapshot_get_pid(ProcSnapshot *s) {
+        assert(s);
+
+        return s->pid;
+}
+
+static int proc_snapshot_read(ProcSnapshot *s, ProcFile f, const char **ret, size_t *ret_size) {
+        _cleanup_close_ int fd = -1;
+        ProcSnapshotFile *b;
+
+        assert(s);
+        assert(f >= 0 && f < _PROC_FILE_MAX);
+
+        b = s->files + f;
+
+        if (b->error < 0)
+                return b->error;
+
+        if (!b->read) {
+                if (s->dir_fd < 0)
+                        return -EBADF;
+
+                fd = openat(s->dir_fd, proc_file_table[f], O_RDONLY|O_CLOEXEC|O_NOCTTY);
+                if (fd < 0) {
+                        /* Once the process is gone, the directory is
+                         * empty */
+                        b->error = errno == ENOENT ? -ESRCH : -errno;
+                        return b->error;
+                }
+
+                b->size = 0;
+
+                for (;;) {
+                        ssize_t n;
+
+                        if (!GREEDY_REALLOC(b->data, b->allocated, b->size + LINE_MAX + 1))
+                                return -ENOMEM;
+
+                        n = pread(fd, b->data + b->size, b->allocated - b->size - 1, b->size);
+                        if (n < 0) {
+                                b->error = errno == ESRCH ? -ESRCH : -errno;
+                                return b->error;
+                        }
+                        if (n == 0)
+                                break;
+
+                        b->size += n;
+                }
+
+                b->data[b->size] = 0;
+                b->read = true;
+        }
+
+        if (ret)
+                *ret = b->data;
+        if (ret_size)
+                *ret_size = b->size;
+
+        return 0;
+}
+
+int proc_snapshot_get_starttime(ProcSnapshot *s, uint64_t *ret) {
+        unsigned long long starttime;
+        const char *p;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        r = proc_snapshot_read(s, PROC_FILE_STAT, &p, NULL);
+        if (r < 0)
+                return r;
+
+        /* The comm field may contain anything, hence continue after
+         * the last closing parenthesis */
+        p = strrchr(p, ')');
+        if (!p)
+                return -EIO;
+
+        if (sscanf(p + 1,
+                   " %*c "                /* state */
+                   "%*d %*d %*d %*d %*d " /* ppid, pgrp, session, tty_nr, tpgid */
+                   "%*u %*u %*u %*u %*u " /* flags, minflt, cminflt, majflt, cmajflt */
+                   "%*u %*u %*d %*d "     /* utime, stime, cutime, cstime */
+                   "%*d %*d %*d %*d "     /* priority, nice, num_threads, itrealvalue */
+                   "%llu",                /* starttime */
+                   &starttime) != 1)
+                return -EIO;
+
+        *ret = starttime;
+        return 0;
+}
+
+static int proc_snapshot_get_status_field(ProcSnapshot *s, const char *pattern, char **ret) {
+        const char *p;
+        int r;
+
+        assert(s);
+        assert(pattern);
+        assert(ret);
+
+        r = proc_snapshot_read(s, PROC_FILE_STATUS, &p, NULL);
+        if (r < 0)
+                return r;
+
+        r = parse_status_field(p, pattern, ret);
+        if (r == -ENOENT)
+                return -EIO;
+
+        return r;
+}
+
+int proc_snapshot_get_uid(ProcSnapshot *s, uid_t *ret) {
+        _cleanup_free_ char *field = NULL;
+        int r;
+
+        assert(ret);
+
+        r = proc_snapshot_get_status_field(s, "\nUid:", &field);
+        if (r < 0)
+                return r;
+
+        return parse_uid(field, ret);
+}
+
+int proc_snapshot_get_gid(ProcSnapshot *s, gid_t *ret) {
+        _cleanup_free_ char *field = NULL;
+        int r;
+
+        assert_cc(sizeof(uid_t) == sizeof(gid_t));
+        assert(ret);
+
+        r = proc_snapshot_get_status_field(s, "\nGid:", &field);
+        if (r < 0)
+                return r;
+
+        return parse_uid(field, ret);
+}
+
+int proc_snapshot_get_capeff(ProcSnapshot *s, char **ret) {
+        return proc_snapshot_get_status_field(s, "\nCapEff:", ret);
+}
+
+int proc_snapshot_get_comm(ProcSnapshot *s, const char **ret) {
+        ProcSnapshotFile *b;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        b = s->files + PROC_FILE_COMM;
+
+        if (!b->read) {
+                r = proc_snapshot_read(s, PROC_FILE_COMM, NULL, NULL);
+                if (r < 0)
+                        return r;
+
+                truncate_nl(b->data);
+        }
+
+        *ret = b->data;
+        return 0;
+}
+
+int proc_snapshot_get_exe(ProcSnapshot *s, const char **ret) {
+        char *d;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        if (s->exe_error < 0)
+                return s->exe_error;
+
+        if (!s->exe_read) {
+                if (s->dir_fd < 0)
+                        return -EBADF;
+
+                r = readlinkat_malloc(s->dir_fd, "exe", &s->exe);
+                if (r == -ENOMEM)
+                        return r;
+                if (r < 0) {
+                        s->exe_error = r == -ENOENT ? -ESRCH : r;
+                        return s->exe_error;
+                }
+
+                d = endswith(s->exe, " (deleted)");
+                if (d)
+                        *d = '\0';
+
+                s->exe_read = true;
+        }
+
+        *ret = s->exe;
+        return 0;
+}
+
+int proc_snapshot_get_cmdline(ProcSnapshot *s, char **ret) {
+        const char *p;
+        size_t size, i;
+        char *c;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        r = proc_snapshot_read(s, PROC_FILE_CMDLINE, &p, &size);
+        if (r < 0)
+                return r;
+
+        /* Kernel threads have no argv[] */
+        if (size <= 1)
+                return -ENOENT;
+
+        c = new(char, size);
+        if (!c)
+                return -ENOMEM;
+
+        /* Like get_process_cmdline() without a length limit: the
+         * arguments separated by spaces */
+        for (i = 0; i < size - 1; i++)
+                c[i] = isprint((unsigned char) p[i]) ? p[i] : ' ';
+        c[size - 1] = 0;
+
+        *ret = c;
+        return 0;
+}
+
+int proc_snapshot_get_environ(ProcSnapshot *s, char **ret) {
+        const char *p;
+        size_t size, i, n = 0;
+        char *e;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        r = proc_snapshot_read(s, PROC_FILE_ENVIRON, &p, &size);
+        if (r < 0)
+                return r;
+
+        e = new(char, size * 4 + 1);
+        if (!e)
+                return -ENOMEM;
+
+        for (i = 0; i < size; i++) {
+                if (p[i] == 0)
+                        e[n++] = '\n';
+                else
+                        n += cescape_char(p[i], e + n);
+        }
+        e[n] = 0;
+
+        *ret = e;
+        return 0;
+}
+
+int proc_snapshot_get_cgroup(ProcSnapshot *s, const char *controller, char **ret) {
+        const char *p;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        r = proc_snapshot_read(s, PROC_FILE_CGROUP, &p, NULL);
+        if (r < 0)
+                return r;
+
+        return cg_get_path_from_proc_cgroup(controller, p, ret);
+}
+
+static int proc_snapshot_get_link(ProcSnapshot *s, const char *name, char **ret) {
+        int r;
+
+        assert(s);
+        assert(name);
+        assert(ret);
+
+        if (s->dir_fd < 0)
+                return -EBADF;
+
+        r = readlinkat_malloc(s->dir_fd, name, ret);
+        if (r == -ENOENT)
+                return -ESRCH;
+
+        return r;
+}
+
+int proc_snapshot_get_cwd(ProcSnapshot *s, char **ret) {
+        return proc_snapshot_get_link(s, "cwd", ret);
+}
+
+int proc_snapshot_get_root(ProcSnapshot *s, char **ret) {
+        return proc_snapshot_get_link(s, "root", ret);
+}
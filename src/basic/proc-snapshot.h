@@ -0,0 +1,61 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "macro.h"
+
+/* A ProcSnapshot holds /proc/<pid> open, and reads each file below it
+ * at most once, when it is first asked for. As the directory stays
+ * bound to the process it was opened for, everything read refers to
+ * that process, even if the PID is reused meanwhile: once the process
+ * is gone, all further reads fail with -ESRCH.
+ *
+ * The getters follow their get_process_*() counterparts in what they
+ * return. Strings returned as const are owned by the snapshot. */
+typedef struct ProcSnapshot ProcSnapshot;
+
+int proc_snapshot_new(pid_t pid, ProcSnapshot **ret);
+ProcSnapshot *proc_snapshot_free(ProcSnapshot *s);
+
+/* Switches the snapshot to another process, reusing its buffers */
+int proc_snapshot_open(ProcSnapshot *s, pid_t pid);
+
+pid_t proc_snapshot_get_pid(ProcSnapshot *s);
+
+/* The start time of the process, in clock ticks since boot, which
+ * tells apart different processes that had the same PID */
+int proc_snapshot_get_starttime(ProcSnapshot *s, uint64_t *ret);
+
+int proc_snapshot_get_uid(ProcSnapshot *s, uid_t *ret);
+int proc_snapshot_get_gid(ProcSnapshot *s, gid_t *ret);
+int proc_snapshot_get_capeff(ProcSnapshot *s, char **ret);
+int proc_snapshot_get_comm(ProcSnapshot *s, const char **ret);
+int proc_snapshot_get_exe(ProcSnapshot *s, const char **ret);
+int proc_snapshot_get_cmdline(ProcSnapshot *s, char **ret);
+int proc_snapshot_get_environ(ProcSnapshot *s, char **ret);
+int proc_snapshot_get_cgroup(ProcSnapshot *s, const char *controller, char **ret);
+int proc_snapshot_get_cwd(ProcSnapshot *s, char **ret);
+int proc_snapshot_get_root(ProcSnapshot *s, char **ret);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(ProcSnapshot*, proc_snapshot_free);
+#define _cleanup_proc_snapshot_free_ _cleanup_(proc_snapshot_freep)
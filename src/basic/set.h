@@ -69,6 +69,9 @@ int set_remove_and_put(Set *s, const void *old_key, const void *new_key);
 /* no set_remove_and_replace */
 int set_merge(Set *s, Set *other);
 
+/* Reserves room for all keys first, returns the number of keys added */
+int set_put_many(Set *s, void * const *keys, unsigned n_keys);
+
 static inline int set_reserve(Set *h, unsigned entries_add) {
         return internal_hashmap_reserve(HASHMAP_BASE(h), entries_add);
 }
@@ -93,6 +96,10 @@ static inline unsigned set_buckets(Set *s) {
         return internal_hashmap_buckets(HASHMAP_BASE(s));
 }
 
+static inline size_t set_memory_usage(Set *s) {
+        return internal_hashmap_memory_usage(HASHMAP_BASE(s));
+}
+
 bool set_iterate(Set *s, Iterator *i, void **value);
 
 static inline void set_clear(Set *s) {
@@ -52,8 +52,9 @@ typedef uint8_t u8;
     v2 += v1; v1=ROTL(v1,17); v1 ^= v2; v2=ROTL(v2,32); \
   } while(0)
 
-/* SipHash-2-4 */
-void siphash24(uint8_t out[8], const void *_in, size_t inlen, const uint8_t k[16])
+/* SipHash-c-d, c and d are constant at all call sites, so that the
+ * rounds get unrolled */
+static inline __attribute__((always_inline)) void siphash(uint8_t out[8], const void *_in, size_t inlen, const uint8_t k[16], unsigned c, unsigned d)
 {
   /* "somepseudorandomlygeneratedbytes" */
   u64 v0 = 0x736f6d6570736575ULL;
@@ -67,6 +68,7 @@ void siphash24(uint8_t out[8], const void *_in, size_t inlen, const uint8_t k[16
   const u8 *in = _in;
   const u8 *end = in + inlen - ( inlen % sizeof( u64 ) );
   const int left = inlen & 7;
+  unsigned i;
   b = ( ( u64 )inlen ) << 56;
   v3 ^= k1;
   v2 ^= k0;
@@ -84,8 +86,8 @@ void siphash24(uint8_t out[8], const void *_in, size_t inlen, const uint8_t k[16
     printf( "(%3d) compress %08x %08x\n", ( int )inlen, ( u32 )( m >> 32 ), ( u32 )m );
 #endif
     v3 ^= m;
-    SIPROUND;
-    SIPROUND;
+    for ( i = 0; i < c; i++ )
+      SIPROUND;
     v0 ^= m;
   }
 
@@ -116,8 +118,8 @@ void siphash24(uint8_t out[8], const void *_in, size_t inlen, const uint8_t k[16
   printf( "(%3d) padding   %08x %08x\n", ( int )inlen, ( u32 )( b >> 32 ), ( u32 )b );
 #endif
   v3 ^= b;
-  SIPROUND;
-  SIPROUND;
+  for ( i = 0; i < c; i++ )
+    SIPROUND;
   v0 ^= b;
 #ifdef DEBUG
   printf( "(%3d) v0 %08x %08x\n", ( int )inlen, ( u32 )( v0 >> 32 ), ( u32 )v0 );
@@ -126,10 +128,22 @@ void siphash24(uint8_t out[8], const void *_in, size_t inlen, const uint8_t k[16
   printf( "(%3d) v3 %08x %08x\n", ( int )inlen, ( u32 )( v3 >> 32 ), ( u32 )v3 );
 #endif
   v2 ^= 0xff;
-  SIPROUND;
-  SIPROUND;
-  SIPROUND;
-  SIPROUND;
+  for ( i = 0; i < d; i++ )
+    SIPROUND;
   b = v0 ^ v1 ^ v2  ^ v3;
   U64TO8_LE( out, b );
 }
+
+/* SipHash-2-4 */
+void siphash24(uint8_t out[8], const void *in, size_t inlen, const uint8_t k[16])
+{
+  siphash(out, in, inlen, k, 2, 4);
+}
+
+/* SipHash-1-3, with half the rounds per block and one less in the
+ * finalization. Still keyed, but a weaker PRF than SipHash-2-4; good
+ * enough to make hash table collisions unpredictable. */
+void siphash13(uint8_t out[8], const void *in, size_t inlen, const uint8_t k[16])
+{
+  siphash(out, in, inlen, k, 1, 3);
+}
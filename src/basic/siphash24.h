@@ -4,3 +4,4 @@
 #include <sys/types.h>
 
 void siphash24(uint8_t out[8], const void *in, size_t inlen, const uint8_t k[16]);
+void siphash13(uint8_t out[8], const void *in, size_t inlen, const uint8_t k[16]);
@@ -0,0 +1,131 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "set.h"
+#include "strintern.h"
+
+/* The string immediately follows its reference counter in the same
+ * allocation, hence interning costs no more memory than strdup(). */
+typedef struct InternedString {
+        unsigned n_ref;
+        char s[];
+} InternedString;
+
+#define INTERNED(p) container_of((char*) (p), InternedString, s[0])
+
+static Set *table = NULL;
+
+const char *strintern_lookup(const char *s) {
+        if (!s)
+                return NULL;
+
+        return set_get(table, (char*) s);
+}
+
+const char *strintern(const char *s) {
+        InternedString *i;
+        const char *found;
+        size_t l;
+
+        if (!s)
+                return NULL;
+
+        found = strintern_lookup(s);
+        if (found)
+                return strintern_ref(found);
+
+        if (set_ensure_allocated(&table, &fast_string_hash_ops) < 0)
+                return NULL;
+
+        l = strlen(s);
+        i = malloc(offsetof(InternedString, s) + l + 1);
+        if (!i)
+                return NULL;
+
+        i->n_ref = 1;
+        memcpy(i->s, s, l + 1);
+
+        if (set_put(table, i->s) < 0) {
+                free(i);
+                return NULL;
+        }
+
+        return i->s;
+}
+
+const char *strintern_ref(const char *s) {
+        if (!s)
+                return NULL;
+
+        assert(INTERNED(s)->n_ref > 0);
+        INTERNED(s)->n_ref++;
+
+        return s;
+}
+
+const char *strintern_unref(const char *s) {
+        InternedString *i;
+
+        if (!s)
+                return NULL;
+
+        i = INTERNED(s);
+        assert(i->n_ref > 0);
+
+        if (--i->n_ref > 0)
+                return NULL;
+
+        assert_se(set_remove(table, i->s) == i->s);
+        free(i);
+
+        if (set_isempty(table))
+                table = set_free(table);
+
+        return NULL;
+}
+
+unsigned strintern_size(void) {
+        return set_size(table);
+}
+
+int strintern_replace(const char **p, const char *s) {
+        const char *n;
+
+        assert(p);
+
+        /* Like free_and_strdup(), for interned strings */
+
+        n = strintern(s);
+        if (s && !n)
+                return -ENOMEM;
+
+        if (*p == n) {
+                strintern_unref(n);
+                return 0;
+        }
+
+        strintern_unref(*p);
+        *p = n;
+
+        return 1;
+}
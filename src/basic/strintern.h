@@ -0,0 +1,40 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "macro.h"
+
+/* A process-wide table of reference counted strings. Interning equal
+ * strings yields the same pointer, so that a single copy is kept, and
+ * interned strings may be compared by pointer. They must never be
+ * modified or passed to free(). Not thread-safe. */
+
+const char *strintern(const char *s);
+const char *strintern_ref(const char *s);
+const char *strintern_unref(const char *s);
+int strintern_replace(const char **p, const char *s);
+
+const char *strintern_lookup(const char *s);
+unsigned strintern_size(void);
+
+static inline void strintern_unrefp(const char **s) {
+        strintern_unref(*s);
+}
+#define _cleanup_strintern_unref_ _cleanup_(strintern_unrefp)
@@ -141,6 +141,33 @@ int utf8_encoded_to_unichar(const char *str) {
         return unichar;
 }
 
+/* Word-at-a-time helpers for the plain ASCII fast paths below. Runs
+ * of ASCII make up the vast majority of what we validate, and eight
+ * bytes can be checked at the price of one. */
+#define WORD_ONES ((size_t) -1 / 0xFF)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+
+static inline size_t load_word(const char *p) {
+        size_t w;
+
+        memcpy(&w, p, sizeof(w));
+        return w;
+}
+
+/* 0x01…0x7F in every byte: no high bit set, and subtracting one from
+ * every byte doesn't set one either, which it would for NUL */
+static inline bool word_is_ascii_nonzero(size_t w) {
+        return ((w | (w - WORD_ONES)) & WORD_HIGHS) == 0;
+}
+
+/* ' '…'~' in every byte, i.e. ASCII that is neither a control
+ * character nor DEL */
+static inline bool word_is_ascii_printable(size_t w) {
+        return (w & WORD_HIGHS) == 0 &&
+                ((w + WORD_ONES * (0x80 - ' ')) & WORD_HIGHS) == WORD_HIGHS &&
+                ((w + WORD_ONES) & WORD_HIGHS) == 0;
+}
+
 bool utf8_is_printable_newline(const char* str, size_t length, bool newline) {
         const char *p;
 
@@ -149,6 +176,12 @@ bool utf8_is_printable_newline(const char* str, size_t length, bool newline) {
         for (p = str; length;) {
                 int encoded_len, val;
 
+                if (length >= sizeof(size_t) && word_is_ascii_printable(load_word(p))) {
+                        p += sizeof(size_t);
+                        length -= sizeof(size_t);
+                        continue;
+                }
+
                 encoded_len = utf8_encoded_valid_unichar(p);
                 if (encoded_len < 0 ||
                     (size_t) encoded_len > length)
@@ -167,24 +200,49 @@ bool utf8_is_printable_newline(const char* str, size_t length, bool newline) {
         return true;
 }
 
-const char *utf8_is_valid(const char *str) {
-        const uint8_t *p;
+const char *utf8_is_valid_n(const char *str, size_t length) {
+        const char *p;
 
-        assert(str);
+        assert(str || length == 0);
 
-        for (p = (const uint8_t*) str; *p; ) {
+        /* Checks that the first length bytes of str are valid UTF-8
+         * and contain no NUL byte. */
+
+        for (p = str; length > 0; ) {
                 int len;
 
-                len = utf8_encoded_valid_unichar((const char *)p);
+                if (length >= sizeof(size_t) && word_is_ascii_nonzero(load_word(p))) {
+                        p += sizeof(size_t);
+                        length -= sizeof(size_t);
+                        continue;
+                }
+
+                if (*p == 0)
+                        return NULL;
+
+                if ((size_t) utf8_encoded_expected_len(p) > length)
+                        return NULL;
+
+                len = utf8_encoded_valid_unichar(p);
                 if (len < 0)
                         return NULL;
 
                 p += len;
+                length -= len;
         }
 
         return str;
 }
 
+const char *utf8_is_valid(const char *str) {
+        assert(str);
+
+        /* strlen() is about as fast as memory bandwidth permits, so
+         * finding the end first and then validating a word at a time
+         * beats walking the string character by character. */
+        return utf8_is_valid_n(str, strlen(str));
+}
+
 char *utf8_escape_invalid(const char *str) {
         char *p, *s;
 
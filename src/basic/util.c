@@ -2863,24 +2863,91 @@ bool dirent_is_file(const struct dirent *de) {
         return true;
 }
 
-bool dirent_is_file_with_suffix(const struct dirent *de, const char *suffix) {
-        assert(de);
+bool dirent_name_is_file_with_suffix(const char *name, unsigned char type, const char *suffix) {
+        assert(name);
 
-        if (de->d_type != DT_REG &&
-            de->d_type != DT_LNK &&
-            de->d_type != DT_UNKNOWN)
+        if (type != DT_REG &&
+            type != DT_LNK &&
+            type != DT_UNKNOWN)
                 return false;
 
-        if (hidden_file_allow_backup(de->d_name))
+        if (hidden_file_allow_backup(name))
                 return false;
 
-        return endswith(de->d_name, suffix);
+        return endswith(name, suffix);
+}
+
+bool dirent_is_file_with_suffix(const struct dirent *de, const char *suffix) {
+        assert(de);
+
+        return dirent_name_is_file_with_suffix(de->d_name, de->d_type, suffix);
+}
+
+typedef struct ExecuteChild {
+        char *path;
+        usec_t begin;
+} ExecuteChild;
+
+static ExecuteChild *execute_child_free(ExecuteChild *c) {
+        if (!c)
+                return NULL;
+
+        free(c->path);
+        free(c);
+
+        return NULL;
+}
+
+static int execute_reap_one(Hashmap *pids, int report_fd) {
+        ExecuteChild *c;
+        struct rusage ru;
+        usec_t n;
+        int status;
+        pid_t pid;
+
+        /* Waits for whichever binary finishes first */
+        pid = wait4(-1, &status, 0, &ru);
+        if (pid < 0) {
+                if (errno == EINTR)
+                        return 0;
+
+                return log_error_errno(errno, "Failed to wait for children: %m");
+        }
+
+        n = now(CLOCK_MONOTONIC);
+
+        c = hashmap_remove(pids, UINT_TO_PTR(pid));
+        if (!c)
+                return 0;
+
+        if (WIFEXITED(status)) {
+                if (WEXITSTATUS(status) != 0)
+                        log_warning("%s failed with error code %i.", c->path, WEXITSTATUS(status));
+                else
+                        log_debug("%s succeeded.", c->path);
+        } else if (WIFSIGNALED(status))
+                log_warning("%s terminated by signal %s.", c->path, signal_to_string(WTERMSIG(status)));
+        else
+                log_warning("%s failed due to unknown reason.", c->path);
+
+        if (report_fd >= 0)
+                dprintf(report_fd, USEC_FMT " " USEC_FMT " " USEC_FMT " %s\n",
+                        c->begin,
+                        n - c->begin,
+                        timeval_load(&ru.ru_utime) + timeval_load(&ru.ru_stime),
+                        c->path);
+
+        execute_child_free(c);
+        return 0;
 }
 
-static int do_execute(char **directories, usec_t timeout, char *argv[]) {
-        _cleanup_hashmap_free_free_ Hashmap *pids = NULL;
+static int do_execute(char **directories, usec_t timeout, unsigned max_parallel, int report_fd, char *argv[]) {
+        _cleanup_hashmap_free_ Hashmap *pids = NULL;
         _cleanup_set_free_free_ Set *seen = NULL;
-        char **directory;
+        _cleanup_strv_free_ char **paths = NULL;
+        ExecuteChild *c;
+        char **directory, **path;
+        int r;
 
         /* We fork this all off from a child process so that we can
          * somewhat cleanly make use of SIGALRM to set a time limit */
@@ -2911,9 +2978,7 @@ static int do_execute(char **directories, usec_t timeout, char *argv[]) {
                 }
 
                 FOREACH_DIRENT(de, d, break) {
-                        _cleanup_free_ char *path = NULL;
-                        pid_t pid;
-                        int r;
+                        char *p;
 
                         if (!dirent_is_file(de))
                                 continue;
@@ -2927,41 +2992,19 @@ static int do_execute(char **directories, usec_t timeout, char *argv[]) {
                         if (r < 0)
                                 return log_oom();
 
-                        path = strjoin(*directory, "/", de->d_name, NULL);
-                        if (!path)
+                        p = strjoin(*directory, "/", de->d_name, NULL);
+                        if (!p)
                                 return log_oom();
 
-                        if (null_or_empty_path(path)) {
-                                log_debug("%s is empty (a mask).", path);
+                        if (null_or_empty_path(p)) {
+                                log_debug("%s is empty (a mask).", p);
+                                free(p);
                                 continue;
                         }
 
-                        pid = fork();
-                        if (pid < 0) {
-                                log_error_errno(errno, "Failed to fork: %m");
-                                continue;
-                        } else if (pid == 0) {
-                                char *_argv[2];
-
-                                assert_se(prctl(PR_SET_PDEATHSIG, SIGTERM) == 0);
-
-                                if (!argv) {
-                                        _argv[0] = path;
-                                        _argv[1] = NULL;
-                                        argv = _argv;
-                                } else
-                                        argv[0] = path;
-
-                                execv(path, argv);
-                                return log_error_errno(errno, "Failed to execute %s: %m", path);
-                        }
-
-                        log_debug("Spawned %s as " PID_FMT ".", path, pid);
-
-                        r = hashmap_put(pids, UINT_TO_PTR(pid), path);
+                        r = strv_consume(&paths, p);
                         if (r < 0)
                                 return log_oom();
-                        path = NULL;
                 }
         }
 
@@ -2972,23 +3015,76 @@ static int do_execute(char **directories, usec_t timeout, char *argv[]) {
         if (timeout != USEC_INFINITY)
                 alarm((timeout + USEC_PER_SEC - 1) / USEC_PER_SEC);
 
-        while (!hashmap_isempty(pids)) {
-                _cleanup_free_ char *path = NULL;
+        STRV_FOREACH(path, paths) {
                 pid_t pid;
 
-                pid = PTR_TO_UINT(hashmap_first_key(pids));
-                assert(pid > 0);
+                while (max_parallel > 0 && hashmap_size(pids) >= max_parallel) {
+                        r = execute_reap_one(pids, report_fd);
+                        if (r < 0)
+                                return r;
+                }
+
+                c = new0(ExecuteChild, 1);
+                if (!c)
+                        return log_oom();
+
+                c->path = strdup(*path);
+                if (!c->path) {
+                        execute_child_free(c);
+                        return log_oom();
+                }
+
+                c->begin = now(CLOCK_MONOTONIC);
+
+                pid = fork();
+                if (pid < 0) {
+                        log_error_errno(errno, "Failed to fork: %m");
+                        execute_child_free(c);
+                        continue;
+                } else if (pid == 0) {
+                        char *_argv[2];
+
+                        assert_se(prctl(PR_SET_PDEATHSIG, SIGTERM) == 0);
+
+                        if (!argv) {
+                                _argv[0] = c->path;
+                                _argv[1] = NULL;
+                                argv = _argv;
+                        } else
+                                argv[0] = c->path;
+
+                        execv(c->path, argv);
+                        return log_error_errno(errno, "Failed to execute %s: %m", c->path);
+                }
 
-                path = hashmap_remove(pids, UINT_TO_PTR(pid));
-                assert(path);
+                log_debug("Spawned %s as " PID_FMT ".", c->path, pid);
 
-                wait_for_terminate_and_warn(path, pid, true);
+                r = hashmap_put(pids, UINT_TO_PTR(pid), c);
+                if (r < 0) {
+                        execute_child_free(c);
+                        return log_oom();
+                }
+        }
+
+        while (!hashmap_isempty(pids)) {
+                r = execute_reap_one(pids, report_fd);
+                if (r < 0)
+                        return r;
         }
 
         return 0;
 }
 
-void execute_directories(const char* const* directories, usec_t timeout, char *argv[]) {
+void execute_directories_full(
+                const char* const* directories,
+                usec_t timeout,
+                unsigned max_parallel,
+                char *argv[],
+                execute_done_t done,
+                void *userdata) {
+
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        _cleanup_fclose_ FILE *f = NULL;
         pid_t executor_pid;
         int r;
         char *name;
@@ -2999,10 +3095,15 @@ void execute_directories(const char* const* directories, usec_t timeout, char *a
         name = basename(dirs[0]);
         assert(!isempty(name));
 
-        /* Executes all binaries in the directories in parallel and waits
-         * for them to finish. Optionally a timeout is applied. If a file
-         * with the same name exists in more than one directory, the
-         * earliest one wins. */
+        /* Executes all binaries in the directories in parallel, at
+         * most max_parallel at a time, unless 0, and waits for them
+         * to finish. Optionally a timeout is applied. If a file with
+         * the same name exists in more than one directory, the
+         * earliest one wins. The executor reports the timing of each
+         * binary through a pipe, if requested. */
+
+        if (done && pipe2(pair, O_CLOEXEC) < 0)
+                log_warning_errno(errno, "Failed to create pipe, not reporting timing: %m");
 
         executor_pid = fork();
         if (executor_pid < 0) {
@@ -3010,13 +3111,48 @@ void execute_directories(const char* const* directories, usec_t timeout, char *a
                 return;
 
         } else if (executor_pid == 0) {
-                r = do_execute(dirs, timeout, argv);
+                pair[0] = safe_close(pair[0]);
+
+                r = do_execute(dirs, timeout, max_parallel, pair[1], argv);
                 _exit(r < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
         }
 
+        pair[1] = safe_close(pair[1]);
+
+        if (pair[0] >= 0) {
+                f = fdopen(pair[0], "re");
+                if (!f)
+                        log_warning_errno(errno, "Failed to open pipe, not reporting timing: %m");
+                else
+                        pair[0] = -1;
+        }
+
+        /* We get EOF once the executor is gone */
+        while (f) {
+                char line[LINE_MAX];
+                uint64_t begin, wall, cpu;
+                int k = 0;
+
+                if (!fgets(line, sizeof(line), f))
+                        break;
+
+                truncate_nl(line);
+
+                if (sscanf(line, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %n", &begin, &wall, &cpu, &k) != 3 || k == 0) {
+                        log_debug("Failed to parse timing report, ignoring: %s", line);
+                        continue;
+                }
+
+                done(line + k, begin, wall, cpu, userdata);
+        }
+
         wait_for_terminate_and_warn(name, executor_pid, true);
 }
 
+void execute_directories(const char* const* directories, usec_t timeout, char *argv[]) {
+        execute_directories_full(directories, timeout, 0, argv, NULL, NULL);
+}
+
 bool nulstr_contains(const char*nulstr, const char *needle) {
         const char *i;
 
@@ -273,6 +273,7 @@ char *xescape(const char *s, const char *bad);
 char *ascii_strlower(char *path);
 
 bool dirent_is_file(const struct dirent *de) _pure_;
+bool dirent_name_is_file_with_suffix(const char *name, unsigned char type, const char *suffix) _pure_;
 bool dirent_is_file_with_suffix(const struct dirent *de, const char *suffix) _pure_;
 
 bool hidden_file(const char *filename) _pure_;
@@ -399,6 +400,9 @@ char *fstab_node_to_udev_node(const char *p);
 
 void execute_directories(const char* const* directories, usec_t timeout, char *argv[]);
 
+typedef void (*execute_done_t)(const char *path, usec_t begin, usec_t wall, usec_t cpu, void *userdata);
+void execute_directories_full(const char* const* directories, usec_t timeout, unsigned max_parallel, char *argv[], execute_done_t done, void *userdata);
+
 bool nulstr_contains(const char*nulstr, const char *needle);
 
 bool plymouth_running(void);
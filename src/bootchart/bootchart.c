@@ -495,23 +495,16 @@ int main(int argc, char *argv[]) {
                 struct ps_struct *old;
 
                 old = ps;
-                old->sample = ps->first;
                 ps = ps->next_ps;
-                while (old->sample->next) {
-                        struct ps_sched_struct *oldsample = old->sample;
-
-                        old->sample = old->sample->next;
-                        free(oldsample);
-                }
                 free(old->cgroup);
-                free(old->sample);
                 free(old);
         }
 
         free(ps->cgroup);
-        free(ps->sample);
         free(ps);
 
+        ps_sched_free_all();
+
         sampledata = head;
         while (sampledata->link_prev) {
                 struct list_sample_data *old_sampledata = sampledata;
@@ -47,6 +47,25 @@
 static char smaps_buf[4096];
 static int skip = 0;
 
+/*
+ * Per-process sample records are carved out of large blocks, instead of
+ * being allocated one by one for every process on every sample, which
+ * at high sampling frequencies is a noticeable part of our overhead.
+ */
+#define PS_SCHED_BLOCK_SIZE 4096
+
+struct ps_sched_block {
+        struct ps_sched_block *next;
+        unsigned n_used;
+        struct ps_sched_struct samples[PS_SCHED_BLOCK_SIZE];
+};
+
+static struct ps_sched_block *ps_sched_blocks = NULL;
+
+/* Finding the record of a pid used to mean walking the whole process
+ * list, for every pid on every sample */
+static struct ps_struct *ps_by_pid[MAXPIDS];
+
 double gettime_ns(void) {
         struct timespec n;
 
@@ -68,6 +87,54 @@ static char *bufgetline(char *buf) {
         return c;
 }
 
+static struct ps_sched_struct *ps_sched_new(void) {
+        struct ps_sched_block *b = ps_sched_blocks;
+
+        if (!b || b->n_used >= PS_SCHED_BLOCK_SIZE) {
+                b = new0(struct ps_sched_block, 1);
+                if (!b)
+                        return NULL;
+
+                b->next = ps_sched_blocks;
+                ps_sched_blocks = b;
+        }
+
+        return b->samples + b->n_used++;
+}
+
+void ps_sched_free_all(void) {
+        while (ps_sched_blocks) {
+                struct ps_sched_block *b = ps_sched_blocks;
+
+                ps_sched_blocks = b->next;
+                free(b);
+        }
+}
+
+static int pread_all(int fd, char **buf, size_t *allocated) {
+        size_t n = 0;
+
+        /* Reads a whole /proc file through an fd we keep open, into a
+         * buffer that is reused across samples */
+        for (;;) {
+                ssize_t k;
+
+                if (!GREEDY_REALLOC(*buf, *allocated, n + 4096 + 1))
+                        return -ENOMEM;
+
+                k = pread(fd, *buf + n, *allocated - n - 1, n);
+                if (k < 0)
+                        return -errno;
+                if (k == 0)
+                        break;
+
+                n += k;
+        }
+
+        (*buf)[n] = '\0';
+        return 0;
+}
+
 static int pid_cmdline_strscpy(int procfd, char *buffer, size_t buf_len, int pid) {
         char filename[PATH_MAX];
         _cleanup_close_ int fd = -1;
@@ -98,7 +165,9 @@ int log_sample(DIR *proc,
                int *cpus) {
 
         static int vmstat = -1;
-        _cleanup_free_ char *buf_schedstat = NULL;
+        static int schedstat = -1;
+        static char *buf_schedstat = NULL;
+        static size_t buf_schedstat_allocated = 0;
         char buf[4096];
         char key[256];
         char val[256];
@@ -116,6 +185,7 @@ int log_sample(DIR *proc,
         int fd;
         struct list_sample_data *sampledata;
         struct ps_sched_struct *ps_prev = NULL;
+        static struct ps_struct *ps_last = NULL;
         int procfd;
         int taskfd = -1;
 
@@ -159,9 +229,17 @@ vmstat_next:
         }
 
         /* Parse "/proc/schedstat" for overall CPU utilization */
-        r = read_full_file("/proc/schedstat", &buf_schedstat, NULL);
-        if (r < 0)
-            return log_error_errno(r, "Unable to read schedstat: %m");
+        if (schedstat < 0) {
+                schedstat = openat(procfd, "schedstat", O_RDONLY|O_CLOEXEC);
+                if (schedstat < 0)
+                        return log_error_errno(errno, "Failed to open /proc/schedstat: %m");
+        }
+
+        r = pread_all(schedstat, &buf_schedstat, &buf_schedstat_allocated);
+        if (r < 0) {
+                schedstat = safe_close(schedstat);
+                return log_error_errno(r, "Unable to read schedstat: %m");
+        }
 
         m = buf_schedstat;
         while (m) {
@@ -214,29 +292,32 @@ schedstat_next:
                 if (pid >= MAXPIDS)
                         continue;
 
-                ps = ps_first;
-                while (ps->next_ps) {
-                        ps = ps->next_ps;
-                        if (ps->pid == pid)
-                                break;
-                }
+                ps = ps_by_pid[pid];
 
-                /* end of our LL? then append a new record */
-                if (ps->pid != pid) {
+                /* not seen yet? then append a new record */
+                if (!ps) {
                         _cleanup_fclose_ FILE *st = NULL;
                         char t[32];
                         struct ps_struct *parent;
 
-                        ps->next_ps = new0(struct ps_struct, 1);
-                        if (!ps->next_ps)
+                        ps = new0(struct ps_struct, 1);
+                        if (!ps)
                                 return log_oom();
 
-                        ps = ps->next_ps;
+                        /* the list is kept in the order the processes
+                         * were found in, which is what we draw them in */
+                        if (ps_last)
+                                ps_last->next_ps = ps;
+                        else
+                                ps_first->next_ps = ps;
+                        ps_last = ps;
+                        ps_by_pid[pid] = ps;
+
                         ps->pid = pid;
                         ps->sched = -1;
                         ps->schedstat = -1;
 
-                        ps->sample = new0(struct ps_sched_struct, 1);
+                        ps->sample = ps_sched_new();
                         if (!ps->sample)
                                 return log_oom();
 
@@ -326,11 +407,8 @@ schedstat_next:
                         if (ps->ppid == 0)
                                 ps->ppid = 1;
 
-                        parent = ps_first;
-                        while ((parent->next_ps && parent->pid != ps->ppid))
-                                parent = parent->next_ps;
-
-                        if (parent->pid != ps->ppid) {
+                        parent = ps->ppid < MAXPIDS ? ps_by_pid[ps->ppid] : NULL;
+                        if (!parent) {
                                 /* orphan */
                                 ps->ppid = 1;
                                 parent = ps_first->next_ps;
@@ -379,7 +457,7 @@ schedstat_next:
                 if (!sscanf(buf, "%s %s %*s", rt, wt))
                         continue;
 
-                ps->sample->next = new0(struct ps_sched_struct, 1);
+                ps->sample->next = ps_sched_new();
                 if (!ps->sample->next)
                         return log_oom();
 
@@ -445,7 +523,7 @@ schedstat_next:
                                 r = safe_atolli(rt, &delta_rt);
                                 if (r < 0)
                                     continue;
-                                r = safe_atolli(rt, &delta_wt);
+                                r = safe_atolli(wt, &delta_wt);
                                 if (r < 0)
                                     continue;
                                 ps->sample->runtime  += delta_rt;
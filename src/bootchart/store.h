@@ -29,6 +29,7 @@
 
 double gettime_ns(void);
 void log_uptime(void);
+void ps_sched_free_all(void);
 int log_sample(DIR *proc,
                int sample,
                struct ps_struct *ps_first,
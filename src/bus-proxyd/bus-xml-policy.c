@@ -756,7 +756,150 @@ static int check_policy_items(PolicyItem *items, const struct policy_check_filte
         return verdict;
 }
 
-static int policy_check(Policy *p, const struct policy_check_filter *filter) {
+/* Most traffic through the proxy repeats the same few (credentials,
+ * message) tuples, hence remember the verdicts of the most recently
+ * checked ones. The cache belongs to a Policy object, and a reload
+ * replaces that wholesale, so entries never outlive their rules. */
+#define POLICY_CACHE_MAX 4096
+
+typedef struct PolicyCacheEntry PolicyCacheEntry;
+
+struct PolicyCacheEntry {
+        int verdict;
+        LIST_FIELDS(PolicyCacheEntry, lru);
+        char key[];
+};
+
+struct PolicyCache {
+        /* Policy objects are used by many threads at once, under
+         * the read lock of the SharedPolicy */
+        pthread_mutex_t lock;
+        Hashmap *entries;
+        LIST_HEAD(PolicyCacheEntry, lru);
+        PolicyCacheEntry *lru_tail;
+};
+
+static PolicyCache *policy_cache_new(void) {
+        PolicyCache *c;
+        int r;
+
+        c = new0(PolicyCache, 1);
+        if (!c)
+                return NULL;
+
+        c->entries = hashmap_new(&string_hash_ops);
+        if (!c->entries) {
+                free(c);
+                return NULL;
+        }
+
+        r = pthread_mutex_init(&c->lock, NULL);
+        if (r != 0) {
+                hashmap_free(c->entries);
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+static PolicyCache *policy_cache_free(PolicyCache *c) {
+        PolicyCacheEntry *e;
+
+        if (!c)
+                return NULL;
+
+        while ((e = c->lru)) {
+                LIST_REMOVE(lru, c->lru, e);
+                free(e);
+        }
+
+        hashmap_free(c->entries);
+        pthread_mutex_destroy(&c->lock);
+        free(c);
+
+        return NULL;
+}
+
+static void policy_cache_unlink(PolicyCache *c, PolicyCacheEntry *e) {
+        if (c->lru_tail == e)
+                c->lru_tail = e->lru_prev;
+
+        LIST_REMOVE(lru, c->lru, e);
+}
+
+static void policy_cache_link(PolicyCache *c, PolicyCacheEntry *e) {
+        LIST_PREPEND(lru, c->lru, e);
+
+        if (!c->lru_tail)
+                c->lru_tail = e;
+}
+
+static bool policy_cache_get(PolicyCache *c, const char *key, int *verdict) {
+        PolicyCacheEntry *e;
+
+        assert(c);
+        assert(key);
+        assert(verdict);
+
+        pthread_mutex_lock(&c->lock);
+
+        e = hashmap_get(c->entries, key);
+        if (e) {
+                policy_cache_unlink(c, e);
+                policy_cache_link(c, e);
+                *verdict = e->verdict;
+        }
+
+        pthread_mutex_unlock(&c->lock);
+
+        return !!e;
+}
+
+static void policy_cache_put(PolicyCache *c, const char *key, int verdict) {
+        PolicyCacheEntry *e;
+        size_t l;
+
+        assert(c);
+        assert(key);
+
+        l = strlen(key);
+
+        pthread_mutex_lock(&c->lock);
+
+        /* Another thread might have been faster */
+        if (hashmap_get(c->entries, key))
+                goto finish;
+
+        if (hashmap_size(c->entries) >= POLICY_CACHE_MAX) {
+                e = c->lru_tail;
+
+                policy_cache_unlink(c, e);
+                hashmap_remove(c->entries, e->key);
+                free(e);
+        }
+
+        /* The cache is best effort, if we can't add an entry, we
+         * simply check the rules again next time */
+        e = malloc(offsetof(PolicyCacheEntry, key) + l + 1);
+        if (!e)
+                goto finish;
+
+        memcpy(e->key, key, l + 1);
+        e->verdict = verdict;
+
+        if (hashmap_put(c->entries, e->key, e) < 0) {
+                free(e);
+                goto finish;
+        }
+
+        policy_cache_link(c, e);
+
+finish:
+        pthread_mutex_unlock(&c->lock);
+}
+
+static int policy_check_uncached(Policy *p, const struct policy_check_filter *filter, bool on_console) {
 
         PolicyItem *items;
         int verdict, v;
@@ -798,7 +941,7 @@ static int policy_check(Policy *p, const struct policy_check_filter *filter) {
                 }
         }
 
-        if (filter->uid != UID_INVALID && sd_uid_get_seats(filter->uid, -1, NULL) > 0)
+        if (on_console)
                 v = check_policy_items(p->on_console_items, filter);
         else
                 v = check_policy_items(p->no_console_items, filter);
@@ -812,6 +955,42 @@ static int policy_check(Policy *p, const struct policy_check_filter *filter) {
         return verdict;
 }
 
+static int policy_check(Policy *p, const struct policy_check_filter *filter) {
+        char prefix[DECIMAL_STR_MAX(int) * 2 + DECIMAL_STR_MAX(uid_t) + DECIMAL_STR_MAX(gid_t) + 6];
+        bool on_console = false;
+        const char *key;
+        int verdict;
+
+        assert(p);
+        assert(filter);
+
+        /* Looking at the seats means reading a file in /run, avoid
+         * it if the answer couldn't change the verdict anyway */
+        if (filter->uid != UID_INVALID && (p->on_console_items || p->no_console_items))
+                on_console = sd_uid_get_seats(filter->uid, -1, NULL) > 0;
+
+        if (!p->cache || !IN_SET(filter->class, POLICY_ITEM_SEND, POLICY_ITEM_RECV))
+                return policy_check_uncached(p, filter, on_console);
+
+        /* None of names, paths, interfaces and members may contain a
+         * newline, and none may be empty, hence this is unique. */
+        xsprintf(prefix, "%i %i " UID_FMT " " GID_FMT " %i",
+                 filter->class, on_console, filter->uid, filter->gid, filter->message_type);
+        key = strjoina(prefix,
+                       "\n", strempty(filter->name),
+                       "\n", strempty(filter->path),
+                       "\n", strempty(filter->interface),
+                       "\n", strempty(filter->member));
+
+        if (policy_cache_get(p->cache, key, &verdict))
+                return verdict;
+
+        verdict = policy_check_uncached(p, filter, on_console);
+        policy_cache_put(p->cache, key, verdict);
+
+        return verdict;
+}
+
 bool policy_check_own(Policy *p, uid_t uid, gid_t gid, const char *name) {
 
         struct policy_check_filter filter = {
@@ -1012,6 +1191,12 @@ int policy_load(Policy *p, char **files) {
 
         assert(p);
 
+        if (!p->cache) {
+                p->cache = policy_cache_new();
+                if (!p->cache)
+                        return log_oom();
+        }
+
         STRV_FOREACH(i, files) {
 
                 r = file_load(p, *i);
@@ -1079,6 +1264,8 @@ void policy_free(Policy *p) {
         hashmap_free(p->group_items);
 
         p->user_items = p->group_items = NULL;
+
+        p->cache = policy_cache_free(p->cache);
 }
 
 static void dump_items(PolicyItem *items, const char *prefix) {
@@ -66,6 +66,8 @@ struct PolicyItem {
         LIST_FIELDS(PolicyItem, items);
 };
 
+typedef struct PolicyCache PolicyCache;
+
 typedef struct Policy {
         LIST_HEAD(PolicyItem, default_items);
         LIST_HEAD(PolicyItem, mandatory_items);
@@ -73,6 +75,9 @@ typedef struct Policy {
         LIST_HEAD(PolicyItem, no_console_items);
         Hashmap *user_items;
         Hashmap *group_items;
+
+        /* Verdicts of recent send/recv checks, dies with the policy */
+        PolicyCache *cache;
 } Policy;
 
 typedef struct SharedPolicy {
@@ -63,6 +63,7 @@ static int show_policy(const char *fn) {
 int main(int argc, char *argv[]) {
 
         Policy p = {};
+        unsigned i;
 
         printf("Showing session policy BEGIN\n");
         show_policy("/etc/dbus-1/session.conf");
@@ -108,6 +109,19 @@ int main(int argc, char *argv[]) {
 
         assert_se(policy_check_one_recv(&p, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test3", "/an/object/path", "org.test.int3", "Member111") == true);
 
+        /* Push the verdicts above out of the decision cache, and
+         * make sure they come out the same afterwards */
+        for (i = 0; i < 5000; i++) {
+                char member[DECIMAL_STR_MAX(unsigned) + 7];
+
+                xsprintf(member, "Member%u", i);
+                assert_se(policy_check_one_send(&p, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test1", "/an/object/path", "bli.bla.blubb", member) == false);
+        }
+
+        assert_se(policy_check_one_send(&p, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test1", "/an/object/path", "bli.bla.blubb", "Member") == false);
+        assert_se(policy_check_one_send(&p, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test1", "/an/object/path", "org.test.int1", "Member") == true);
+        assert_se(policy_check_one_recv(&p, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.test.test3", "/an/object/path", "org.test.int3", "Member111") == true);
+
         policy_free(&p);
 
         /* User and groups */
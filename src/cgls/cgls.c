@@ -44,6 +44,7 @@ static bool arg_kernel_threads = false;
 static bool arg_all = false;
 static int arg_full = -1;
 static char* arg_machine = NULL;
+static unsigned arg_depth = (unsigned) -1;
 
 static void help(void) {
         printf("%s [OPTIONS...] [CGROUP...]\n\n"
@@ -55,6 +56,7 @@ static void help(void) {
                "  -l --full           Do not ellipsize output\n"
                "  -k                  Include kernel threads in output\n"
                "  -M --machine=       Show container\n"
+               "     --depth=DEPTH    Maximum depth of groups to expand\n"
                , program_invocation_short_name);
 }
 
@@ -63,6 +65,7 @@ static int parse_argv(int argc, char *argv[]) {
         enum {
                 ARG_NO_PAGER = 0x100,
                 ARG_VERSION,
+                ARG_DEPTH,
         };
 
         static const struct option options[] = {
@@ -72,10 +75,11 @@ static int parse_argv(int argc, char *argv[]) {
                 { "all",       no_argument,       NULL, 'a'          },
                 { "full",      no_argument,       NULL, 'l'          },
                 { "machine",   required_argument, NULL, 'M'          },
+                { "depth",     required_argument, NULL, ARG_DEPTH    },
                 {}
         };
 
-        int c;
+        int c, r;
 
         assert(argc >= 1);
         assert(argv);
@@ -113,6 +117,20 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_machine = optarg;
                         break;
 
+                case ARG_DEPTH: {
+                        unsigned depth;
+
+                        r = safe_atou(optarg, &depth);
+                        if (r < 0 || depth >= (unsigned) -1) {
+                                log_error("Failed to parse depth parameter.");
+                                return -EINVAL;
+                        }
+
+                        /* The group we start from is always expanded */
+                        arg_depth = depth + 1;
+                        break;
+                }
+
                 case '?':
                         return -EINVAL;
 
@@ -201,7 +219,7 @@ int main(int argc, char *argv[]) {
                                 printf("Directory %s:\n", argv[i]);
                                 fflush(stdout);
 
-                                q = show_cgroup_by_path(argv[i], NULL, 0, arg_kernel_threads, output_flags);
+                                q = show_cgroup_by_path(argv[i], NULL, 0, arg_kernel_threads, arg_depth, output_flags);
                         } else {
                                 _cleanup_free_ char *c = NULL, *p = NULL, *j = NULL;
                                 const char *controller, *path;
@@ -231,7 +249,7 @@ int main(int argc, char *argv[]) {
                                         printf("Controller %s; control group %s:\n", controller, path);
                                 fflush(stdout);
 
-                                q = show_cgroup(controller, path, NULL, 0, arg_kernel_threads, output_flags);
+                                q = show_cgroup(controller, path, NULL, 0, arg_kernel_threads, arg_depth, output_flags);
                         }
 
                         if (q < 0)
@@ -254,7 +272,7 @@ int main(int argc, char *argv[]) {
                                 printf("Working directory %s:\n", cwd);
                                 fflush(stdout);
 
-                                r = show_cgroup_by_path(cwd, NULL, 0, arg_kernel_threads, output_flags);
+                                r = show_cgroup_by_path(cwd, NULL, 0, arg_kernel_threads, arg_depth, output_flags);
                                 done = true;
                         }
                 }
@@ -269,7 +287,7 @@ int main(int argc, char *argv[]) {
                         printf("Control group %s:\n", isempty(root) ? "/" : root);
                         fflush(stdout);
 
-                        r = show_cgroup(SYSTEMD_CGROUP_CONTROLLER, root, NULL, 0, arg_kernel_threads, output_flags);
+                        r = show_cgroup(SYSTEMD_CGROUP_CONTROLLER, root, NULL, 0, arg_kernel_threads, arg_depth, output_flags);
                 }
         }
 
@@ -27,6 +27,8 @@
 #include <alloca.h>
 #include <getopt.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 
 #include "path-util.h"
 #include "terminal-util.h"
@@ -58,6 +60,12 @@ typedef struct Group {
         uint64_t io_input, io_output;
         nsec_t io_timestamp;
         uint64_t io_input_bps, io_output_bps;
+
+        /* The attribute files we read, kept open across iterations */
+        int tasks_fd;
+        int cpu_fd;
+        int memory_fd;
+        int io_fd;
 } Group;
 
 static unsigned arg_depth = 3;
@@ -86,9 +94,20 @@ static enum {
         CPU_TIME,
 } arg_cpu_type = CPU_PERCENT;
 
+static enum {
+        OUTPUT_TABLE,
+        OUTPUT_CSV,
+        OUTPUT_JSON,
+} arg_output = OUTPUT_TABLE;
+
 static void group_free(Group *g) {
         assert(g);
 
+        safe_close(g->tasks_fd);
+        safe_close(g->cpu_fd);
+        safe_close(g->memory_fd);
+        safe_close(g->io_fd);
+
         free(g->path);
         free(g);
 }
@@ -115,6 +134,70 @@ static const char *maybe_format_bytes(char *buf, size_t l, bool is_valid, uint64
         return format_bytes(buf, l, t);
 }
 
+static int read_attribute(
+                int *fd,
+                const char *controller,
+                const char *path,
+                const char *attribute,
+                char **ret) {
+
+        _cleanup_free_ char *buf = NULL;
+        size_t allocated = 0, n = 0;
+        int r;
+
+        assert(fd);
+        assert(ret);
+
+        /* Reads an attribute file of a cgroup. The file is kept open,
+         * so that later iterations only need a pread() instead of
+         * resolving the path and opening the file again. */
+
+        if (*fd < 0) {
+                _cleanup_free_ char *p = NULL;
+
+                r = cg_get_path(controller, path, attribute, &p);
+                if (r < 0)
+                        return r;
+
+                *fd = open(p, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+                if (*fd < 0) {
+                        /* Out of file descriptors, read it the
+                         * old way then */
+                        if (errno == EMFILE)
+                                return read_full_file(p, ret, NULL);
+
+                        return -errno;
+                }
+        }
+
+        for (;;) {
+                ssize_t k;
+
+                if (!GREEDY_REALLOC(buf, allocated, n + LINE_MAX + 1))
+                        return -ENOMEM;
+
+                k = pread(*fd, buf + n, allocated - n - 1, n);
+                if (k < 0) {
+                        /* The cgroup went away, if it is created
+                         * again it needs to be opened again */
+                        r = -errno;
+                        *fd = safe_close(*fd);
+                        return r == -ENODEV ? -ENOENT : r;
+                }
+                if (k == 0)
+                        break;
+
+                n += k;
+        }
+
+        buf[n] = 0;
+
+        *ret = buf;
+        buf = NULL;
+
+        return 0;
+}
+
 static int process(
                 const char *controller,
                 const char *path,
@@ -138,6 +221,8 @@ static int process(
                         if (!g)
                                 return -ENOMEM;
 
+                        g->tasks_fd = g->cpu_fd = g->memory_fd = g->io_fd = -1;
+
                         g->path = strdup(path);
                         if (!g->path) {
                                 group_free(g);
@@ -181,19 +266,15 @@ static int process(
                         g->n_tasks_valid = true;
 
         } else if (streq(controller, "pids") && arg_count == COUNT_PIDS) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
-
-                r = cg_get_path(controller, path, "pids.current", &p);
-                if (r < 0)
-                        return r;
+                _cleanup_free_ char *v = NULL;
 
-                r = read_one_line_file(p, &v);
+                r = read_attribute(&g->tasks_fd, controller, path, "pids.current", &v);
                 if (r == -ENOENT)
                         return 0;
                 if (r < 0)
                         return r;
 
-                r = safe_atou64(v, &g->n_tasks);
+                r = safe_atou64(truncate_nl(v), &g->n_tasks);
                 if (r < 0)
                         return r;
 
@@ -201,21 +282,17 @@ static int process(
                         g->n_tasks_valid = true;
 
         } else if (streq(controller, "cpuacct") && cg_unified() <= 0) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
+                _cleanup_free_ char *v = NULL;
                 uint64_t new_usage;
                 nsec_t timestamp;
 
-                r = cg_get_path(controller, path, "cpuacct.usage", &p);
-                if (r < 0)
-                        return r;
-
-                r = read_one_line_file(p, &v);
+                r = read_attribute(&g->cpu_fd, controller, path, "cpuacct.usage", &v);
                 if (r == -ENOENT)
                         return 0;
                 if (r < 0)
                         return r;
 
-                r = safe_atou64(v, &new_usage);
+                r = safe_atou64(truncate_nl(v), &new_usage);
                 if (r < 0)
                         return r;
 
@@ -240,22 +317,17 @@ static int process(
                 g->cpu_iteration = iteration;
 
         } else if (streq(controller, "memory")) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
-
-                if (cg_unified() <= 0)
-                        r = cg_get_path(controller, path, "memory.usage_in_bytes", &p);
-                else
-                        r = cg_get_path(controller, path, "memory.current", &p);
-                if (r < 0)
-                        return r;
+                _cleanup_free_ char *v = NULL;
 
-                r = read_one_line_file(p, &v);
+                r = read_attribute(&g->memory_fd, controller, path,
+                                   cg_unified() <= 0 ? "memory.usage_in_bytes" : "memory.current",
+                                   &v);
                 if (r == -ENOENT)
                         return 0;
                 if (r < 0)
                         return r;
 
-                r = safe_atou64(v, &g->memory);
+                r = safe_atou64(truncate_nl(v), &g->memory);
                 if (r < 0)
                         return r;
 
@@ -263,28 +335,24 @@ static int process(
                         g->memory_valid = true;
 
         } else if (streq(controller, "blkio") && cg_unified() <= 0) {
-                _cleanup_fclose_ FILE *f = NULL;
-                _cleanup_free_ char *p = NULL;
+                _cleanup_free_ char *v = NULL;
                 uint64_t wr = 0, rd = 0;
                 nsec_t timestamp;
+                char *line, *next;
 
-                r = cg_get_path(controller, path, "blkio.io_service_bytes", &p);
+                r = read_attribute(&g->io_fd, controller, path, "blkio.io_service_bytes", &v);
+                if (r == -ENOENT)
+                        return 0;
                 if (r < 0)
                         return r;
 
-                f = fopen(p, "re");
-                if (!f) {
-                        if (errno == ENOENT)
-                                return 0;
-                        return -errno;
-                }
-
-                for (;;) {
-                        char line[LINE_MAX], *l;
+                for (line = v; line; line = next) {
                         uint64_t k, *q;
+                        char *l;
 
-                        if (!fgets(line, sizeof(line), f))
-                                break;
+                        next = strchr(line, '\n');
+                        if (next)
+                                *(next++) = 0;
 
                         l = strstrip(line);
                         l += strcspn(l, WHITESPACE);
@@ -526,6 +594,109 @@ static int group_compare(const void*a, const void *b) {
 #define ON ANSI_HIGHLIGHT_ON
 #define OFF ANSI_HIGHLIGHT_OFF
 
+static void print_json_string(const char *s) {
+        const char *c;
+
+        putchar('"');
+
+        for (c = s; *c; c++) {
+                if (*c == '"' || *c == '\\')
+                        printf("\\%c", *c);
+                else if ((unsigned char) *c < ' ')
+                        printf("\\u%04x", (unsigned char) *c);
+                else
+                        putchar(*c);
+        }
+
+        putchar('"');
+}
+
+static void print_csv_string(const char *s) {
+        const char *c;
+
+        putchar('"');
+
+        for (c = s; *c; c++) {
+                /* Quotes are escaped by doubling them */
+                if (*c == '"')
+                        putchar('"');
+
+                putchar(*c);
+        }
+
+        putchar('"');
+}
+
+static void display_machine(Group **array, unsigned n) {
+        unsigned j;
+
+        /* Output for other programs: raw numbers only, one line per
+         * group, and no limit on the number of lines */
+
+        if (arg_output == OUTPUT_CSV)
+                puts("path,tasks,cpu_usage_nsec,cpu_percent,memory_bytes,io_input_bps,io_output_bps");
+
+        for (j = 0; j < n; j++) {
+                const Group *g = array[j];
+                const char *path;
+
+                path = isempty(g->path) ? "/" : g->path;
+
+                if (arg_output == OUTPUT_JSON) {
+                        fputs("{\"path\":", stdout);
+                        print_json_string(path);
+
+                        if (g->n_tasks_valid)
+                                printf(",\"tasks\":%" PRIu64, g->n_tasks);
+                        else
+                                fputs(",\"tasks\":null", stdout);
+
+                        printf(",\"cpu_usage_nsec\":%" PRIu64, (uint64_t) g->cpu_usage);
+
+                        if (g->cpu_valid)
+                                printf(",\"cpu_percent\":%.1f", g->cpu_fraction*100);
+                        else
+                                fputs(",\"cpu_percent\":null", stdout);
+
+                        if (g->memory_valid)
+                                printf(",\"memory_bytes\":%" PRIu64, g->memory);
+                        else
+                                fputs(",\"memory_bytes\":null", stdout);
+
+                        if (g->io_valid)
+                                printf(",\"io_input_bps\":%" PRIu64 ",\"io_output_bps\":%" PRIu64 "}\n",
+                                       g->io_input_bps, g->io_output_bps);
+                        else
+                                fputs(",\"io_input_bps\":null,\"io_output_bps\":null}\n", stdout);
+
+                } else {
+                        print_csv_string(path);
+
+                        if (g->n_tasks_valid)
+                                printf(",%" PRIu64, g->n_tasks);
+                        else
+                                putchar(',');
+
+                        printf(",%" PRIu64, (uint64_t) g->cpu_usage);
+
+                        if (g->cpu_valid)
+                                printf(",%.1f", g->cpu_fraction*100);
+                        else
+                                putchar(',');
+
+                        if (g->memory_valid)
+                                printf(",%" PRIu64, g->memory);
+                        else
+                                putchar(',');
+
+                        if (g->io_valid)
+                                printf(",%" PRIu64 ",%" PRIu64 "\n", g->io_input_bps, g->io_output_bps);
+                        else
+                                fputs(",,\n", stdout);
+                }
+        }
+}
+
 static void display(Hashmap *a) {
         Iterator i;
         Group *g;
@@ -536,11 +707,6 @@ static void display(Hashmap *a) {
 
         assert(a);
 
-        /* Set cursor to top left corner and clear screen */
-        if (on_tty())
-                fputs("\033[H"
-                      "\033[2J", stdout);
-
         array = alloca(sizeof(Group*) * hashmap_size(a));
 
         HASHMAP_FOREACH(g, a, i)
@@ -549,6 +715,16 @@ static void display(Hashmap *a) {
 
         qsort_safe(array, n, sizeof(Group*), group_compare);
 
+        if (arg_output != OUTPUT_TABLE) {
+                display_machine(array, n);
+                return;
+        }
+
+        /* Set cursor to top left corner and clear screen */
+        if (on_tty())
+                fputs("\033[H"
+                      "\033[2J", stdout);
+
         /* Find the longest names in one run */
         for (j = 0; j < n; j++) {
                 unsigned cputlen, pathtlen;
@@ -645,6 +821,7 @@ static void help(void) {
                "  -n --iterations=N   Run for N iterations before exiting\n"
                "  -b --batch          Run in batch mode, accepting no input\n"
                "     --depth=DEPTH    Maximum traversal depth (default: %u)\n"
+               "     --output=MODE    Output format: table (default), csv, json\n"
                , program_invocation_short_name, arg_depth);
 }
 
@@ -656,6 +833,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CPU_TYPE,
                 ARG_ORDER,
                 ARG_RECURSIVE,
+                ARG_OUTPUT,
         };
 
         static const struct option options[] = {
@@ -669,6 +847,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "cpu",          optional_argument, NULL, ARG_CPU_TYPE  },
                 { "order",        required_argument, NULL, ARG_ORDER     },
                 { "recursive",    required_argument, NULL, ARG_RECURSIVE },
+                { "output",       required_argument, NULL, ARG_OUTPUT    },
                 {}
         };
 
@@ -797,6 +976,19 @@ static int parse_argv(int argc, char *argv[]) {
                         recursive_unset = r == 0;
                         break;
 
+                case ARG_OUTPUT:
+                        if (streq(optarg, "table"))
+                                arg_output = OUTPUT_TABLE;
+                        else if (streq(optarg, "csv"))
+                                arg_output = OUTPUT_CSV;
+                        else if (streq(optarg, "json"))
+                                arg_output = OUTPUT_JSON;
+                        else {
+                                log_error("Invalid argument to --output=: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -814,6 +1006,11 @@ static int parse_argv(int argc, char *argv[]) {
                 return -EINVAL;
         }
 
+        /* Machine readable output is meant for other programs,
+         * which won't send us keys */
+        if (arg_output != OUTPUT_TABLE)
+                arg_batch = true;
+
         return 1;
 }
 
@@ -834,6 +1031,7 @@ int main(int argc, char *argv[]) {
         bool quit = false, immediate_refresh = false;
         _cleanup_free_ char *root = NULL;
         CGroupMask mask;
+        struct rlimit rl;
 
         log_parse_environment();
         log_open();
@@ -863,6 +1061,12 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        /* We keep a few files open per cgroup, make sure we can */
+        if (getrlimit(RLIMIT_NOFILE, &rl) >= 0 && rl.rlim_cur < rl.rlim_max) {
+                rl.rlim_cur = rl.rlim_max;
+                (void) setrlimit(RLIMIT_NOFILE, &rl);
+        }
+
         signal(SIGWINCH, columns_lines_cache_reset);
 
         if (arg_iterations == (unsigned) -1)
@@ -899,7 +1103,7 @@ int main(int argc, char *argv[]) {
                 if (arg_iterations && iteration >= arg_iterations)
                         break;
 
-                if (!on_tty()) /* non-TTY: Empty newline as delimiter between polls */
+                if (!on_tty() && arg_output != OUTPUT_JSON) /* non-TTY: Empty newline as delimiter between polls */
                         fputs("\n", stdout);
                 fflush(stdout);
 
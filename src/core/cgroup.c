@@ -21,6 +21,7 @@
 
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <sys/resource.h>
 
 #include "cgroup-util.h"
 #include "path-util.h"
@@ -31,6 +32,11 @@
 
 #define CGROUP_CPU_QUOTA_PERIOD_USEC ((usec_t) 100 * USEC_PER_MSEC)
 
+/* How many cgroup attribute files to keep open at most, across all
+ * units. Never more than a quarter of RLIMIT_NOFILE though, which is
+ * much lower for user instances than for PID 1. */
+#define CGROUP_METRIC_FDS_MAX 16384U
+
 void cgroup_context_init(CGroupContext *c) {
         assert(c);
 
@@ -787,11 +793,22 @@ int unit_watch_cgroup(Unit *u) {
         if (r < 0)
                 return log_oom();
 
-        r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, "cgroup.populated", &populated);
+        /* Newer kernels report this in "cgroup.events", older
+         * ones in "cgroup.populated" */
+        r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, "cgroup.events", &populated);
         if (r < 0)
                 return log_oom();
 
         u->cgroup_inotify_wd = inotify_add_watch(u->manager->cgroup_inotify_fd, populated, IN_MODIFY);
+        if (u->cgroup_inotify_wd < 0 && errno == ENOENT) {
+                populated = mfree(populated);
+
+                r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, "cgroup.populated", &populated);
+                if (r < 0)
+                        return log_oom();
+
+                u->cgroup_inotify_wd = inotify_add_watch(u->manager->cgroup_inotify_fd, populated, IN_MODIFY);
+        }
         if (u->cgroup_inotify_wd < 0) {
 
                 if (errno == ENOENT) /* If the directory is already
@@ -895,7 +912,8 @@ static bool unit_has_mask_realized(Unit *u, CGroupMask target_mask) {
  *
  * Returns 0 on success and < 0 on failure. */
 static int unit_realize_cgroup_now(Unit *u, ManagerState state) {
-        CGroupMask target_mask, enable_mask;
+        CGroupMask target_mask, enable_mask, apply_mask;
+        usec_t ts;
         int r;
 
         assert(u);
@@ -916,14 +934,27 @@ static int unit_realize_cgroup_now(Unit *u, ManagerState state) {
                         return r;
         }
 
+        /* The attributes of controllers that stayed realized are
+         * still in place, only write those that were invalidated or
+         * newly added. This matters when a sibling pulls in a new
+         * controller, or for a single property change, where we'd
+         * otherwise redo every attribute of every controller. */
+        apply_mask = target_mask;
+        if (u->cgroup_realized)
+                apply_mask &= ~u->cgroup_realized_mask;
+
         /* And then do the real work */
+        ts = now(CLOCK_MONOTONIC);
+
         enable_mask = unit_get_enable_mask(u);
         r = unit_create_cgroup(u, target_mask, enable_mask);
         if (r < 0)
                 return r;
 
         /* Finally, apply the necessary attributes. */
-        cgroup_context_apply(unit_get_cgroup_context(u), target_mask, u->cgroup_path, state);
+        cgroup_context_apply(unit_get_cgroup_context(u), apply_mask, u->cgroup_path, state);
+
+        manager_trace(u->manager, TRACE_PHASE_CGROUP_REALIZE, u->id, ts);
 
         return 0;
 }
@@ -1020,6 +1051,23 @@ int unit_realize_cgroup(Unit *u) {
         return unit_realize_cgroup_now(u, manager_state(u->manager));
 }
 
+static void unit_close_metrics(Unit *u) {
+        CGroupMetric i;
+
+        assert(u);
+
+        for (i = 0; i < _CGROUP_METRIC_MAX; i++) {
+                CGroupMetricCache *c = u->cgroup_metrics + i;
+
+                if (c->fd >= 0) {
+                        c->fd = safe_close(c->fd);
+                        u->manager->n_cgroup_metric_fds--;
+                }
+
+                c->timestamp = 0;
+        }
+}
+
 void unit_release_cgroup(Unit *u) {
         assert(u);
 
@@ -1037,6 +1085,8 @@ void unit_release_cgroup(Unit *u) {
                 (void) hashmap_remove(u->manager->cgroup_inotify_wd_unit, INT_TO_PTR(u->cgroup_inotify_wd));
                 u->cgroup_inotify_wd = -1;
         }
+
+        unit_close_metrics(u);
 }
 
 void unit_prune_cgroup(Unit *u) {
@@ -1196,6 +1246,44 @@ int unit_notify_cgroup_empty(Unit *u) {
         return 0;
 }
 
+static void unit_add_to_cgroup_empty_queue(Unit *u) {
+        assert(u);
+
+        /* Notifications come in bursts, when a whole subtree goes
+         * away, and the same cgroup may be reported more than once.
+         * Collect them, and check each cgroup only once per main
+         * loop iteration. */
+
+        if (u->in_cgroup_empty_queue)
+                return;
+
+        LIST_PREPEND(cgroup_empty_queue, u->manager->cgroup_empty_queue, u);
+        u->in_cgroup_empty_queue = true;
+}
+
+unsigned manager_dispatch_cgroup_empty_queue(Manager *m) {
+        unsigned n = 0;
+        Unit *u;
+        int r;
+
+        assert(m);
+
+        while ((u = m->cgroup_empty_queue)) {
+                assert(u->in_cgroup_empty_queue);
+
+                LIST_REMOVE(cgroup_empty_queue, m->cgroup_empty_queue, u);
+                u->in_cgroup_empty_queue = false;
+
+                r = unit_notify_cgroup_empty(u);
+                if (r < 0)
+                        log_unit_debug_errno(u, r, "Failed to check whether cgroup is empty, ignoring: %m");
+
+                n++;
+        }
+
+        return n;
+}
+
 static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         Manager *m = userdata;
 
@@ -1235,7 +1323,7 @@ static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents,
                                  * this here safely. */
                                 continue;
 
-                        (void) unit_notify_cgroup_empty(u);
+                        unit_add_to_cgroup_empty_queue(u);
                 }
         }
 }
@@ -1458,89 +1546,154 @@ int manager_notify_cgroup_empty(Manager *m, const char *cgroup) {
         if (!u)
                 return 0;
 
-        return unit_notify_cgroup_empty(u);
+        unit_add_to_cgroup_empty_queue(u);
+        return 0;
 }
 
-int unit_get_memory_current(Unit *u, uint64_t *ret) {
-        _cleanup_free_ char *v = NULL;
-        int r;
+static const CGroupMask cgroup_metric_mask[_CGROUP_METRIC_MAX] = {
+        [CGROUP_METRIC_MEMORY_CURRENT] = CGROUP_MASK_MEMORY,
+        [CGROUP_METRIC_TASKS_CURRENT] = CGROUP_MASK_PIDS,
+        [CGROUP_METRIC_CPU_USAGE] = CGROUP_MASK_CPUACCT,
+};
 
-        assert(u);
-        assert(ret);
+static bool manager_may_keep_metric_fd(Manager *m) {
+        struct rlimit rl;
 
-        if (!u->cgroup_path)
-                return -ENODATA;
+        assert(m);
 
-        if ((u->cgroup_realized_mask & CGROUP_MASK_MEMORY) == 0)
-                return -ENODATA;
+        if (m->n_cgroup_metric_fds >= CGROUP_METRIC_FDS_MAX)
+                return false;
 
-        if (cg_unified() <= 0)
-                r = cg_get_attribute("memory", u->cgroup_path, "memory.usage_in_bytes", &v);
-        else
-                r = cg_get_attribute("memory", u->cgroup_path, "memory.current", &v);
-        if (r == -ENOENT)
-                return -ENODATA;
-        if (r < 0)
-                return r;
+        if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+                return false;
 
-        return safe_atou64(v, ret);
+        return rl.rlim_cur == RLIM_INFINITY || m->n_cgroup_metric_fds < rl.rlim_cur / 4;
 }
 
-int unit_get_tasks_current(Unit *u, uint64_t *ret) {
-        _cleanup_free_ char *v = NULL;
-        int r;
+static int unit_open_metric(Unit *u, CGroupMetric metric) {
+        _cleanup_free_ char *fs = NULL;
+        const char *controller, *attribute;
+        int fd, r;
 
         assert(u);
-        assert(ret);
 
-        if (!u->cgroup_path)
-                return -ENODATA;
+        switch (metric) {
 
-        if ((u->cgroup_realized_mask & CGROUP_MASK_PIDS) == 0)
-                return -ENODATA;
+        case CGROUP_METRIC_MEMORY_CURRENT:
+                controller = "memory";
+                attribute = cg_unified() <= 0 ? "memory.usage_in_bytes" : "memory.current";
+                break;
 
-        r = cg_get_attribute("pids", u->cgroup_path, "pids.current", &v);
-        if (r == -ENOENT)
-                return -ENODATA;
+        case CGROUP_METRIC_TASKS_CURRENT:
+                controller = "pids";
+                attribute = "pids.current";
+                break;
+
+        case CGROUP_METRIC_CPU_USAGE:
+                controller = "cpuacct";
+                attribute = "cpuacct.usage";
+                break;
+
+        default:
+                assert_not_reached("Unknown cgroup metric");
+        }
+
+        r = cg_get_path(controller, u->cgroup_path, attribute, &fs);
         if (r < 0)
                 return r;
 
-        return safe_atou64(v, ret);
+        fd = open(fs, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        return fd;
 }
 
-static int unit_get_cpu_usage_raw(Unit *u, nsec_t *ret) {
-        _cleanup_free_ char *v = NULL;
-        uint64_t ns;
+static int unit_read_metric(Unit *u, CGroupMetric metric, bool allow_cached, uint64_t *ret) {
+        char buf[DECIMAL_STR_MAX(uint64_t) + 2];
+        CGroupMetricCache *c;
+        _cleanup_close_ int fd = -1;
+        usec_t n;
+        ssize_t l;
         int r;
 
         assert(u);
+        assert(metric >= 0);
+        assert(metric < _CGROUP_METRIC_MAX);
         assert(ret);
 
         if (!u->cgroup_path)
                 return -ENODATA;
 
-        if ((u->cgroup_realized_mask & CGROUP_MASK_CPUACCT) == 0)
+        if ((u->cgroup_realized_mask & cgroup_metric_mask[metric]) == 0)
                 return -ENODATA;
 
-        r = cg_get_attribute("cpuacct", u->cgroup_path, "cpuacct.usage", &v);
-        if (r == -ENOENT)
+        c = u->cgroup_metrics + metric;
+        n = now(CLOCK_MONOTONIC);
+
+        /* Monitoring tools tend to ask for the same counters of many
+         * units in quick succession, hence optionally hand out the
+         * last value read for a short while */
+        if (allow_cached &&
+            c->timestamp > 0 &&
+            c->timestamp + u->manager->accounting_cache_usec > n) {
+                *ret = c->value;
+                return 0;
+        }
+
+        /* Keep the attribute file open, so that the next read is a
+         * single pread() instead of a path lookup, open() and
+         * close(). If the cgroup was replaced under us the old fd
+         * reports ENODEV, in which case we open the file again. */
+        if (c->fd >= 0) {
+                l = pread(c->fd, buf, sizeof(buf) - 1, 0);
+                if (l >= 0)
+                        goto parse;
+
+                c->fd = safe_close(c->fd);
+                u->manager->n_cgroup_metric_fds--;
+        }
+
+        fd = unit_open_metric(u, metric);
+        if (fd == -ENOENT)
                 return -ENODATA;
-        if (r < 0)
-                return r;
+        if (fd < 0)
+                return fd;
+
+        l = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (l < 0)
+                return errno == ENODEV ? -ENODATA : -errno;
+
+        if (manager_may_keep_metric_fd(u->manager)) {
+                c->fd = fd;
+                fd = -1;
+                u->manager->n_cgroup_metric_fds++;
+        }
 
-        r = safe_atou64(v, &ns);
+parse:
+        buf[l] = 0;
+        r = safe_atou64(strstrip(buf), &c->value);
         if (r < 0)
                 return r;
 
-        *ret = ns;
+        c->timestamp = n;
+        *ret = c->value;
         return 0;
 }
 
+int unit_get_memory_current(Unit *u, uint64_t *ret) {
+        return unit_read_metric(u, CGROUP_METRIC_MEMORY_CURRENT, true, ret);
+}
+
+int unit_get_tasks_current(Unit *u, uint64_t *ret) {
+        return unit_read_metric(u, CGROUP_METRIC_TASKS_CURRENT, true, ret);
+}
+
 int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
         nsec_t ns;
         int r;
 
-        r = unit_get_cpu_usage_raw(u, &ns);
+        r = unit_read_metric(u, CGROUP_METRIC_CPU_USAGE, true, &ns);
         if (r < 0)
                 return r;
 
@@ -1559,7 +1712,7 @@ int unit_reset_cpu_usage(Unit *u) {
 
         assert(u);
 
-        r = unit_get_cpu_usage_raw(u, &ns);
+        r = unit_read_metric(u, CGROUP_METRIC_CPU_USAGE, false, &ns);
         if (r < 0) {
                 u->cpuacct_usage_base = 0;
                 return r;
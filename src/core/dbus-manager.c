@@ -41,6 +41,7 @@
 #include "dbus-execute.h"
 #include "bus-common-errors.h"
 #include "formats-util.h"
+#include "event-util.h"
 
 static int property_get_version(
                 sd_bus *bus,
@@ -297,6 +298,27 @@ static int property_get_progress(
         return sd_bus_message_append(reply, "d", d);
 }
 
+static int property_get_timer_wakeups(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Manager *m = userdata;
+        uint64_t wakeups, elapses;
+
+        assert(bus);
+        assert(reply);
+        assert(m);
+
+        event_get_timer_statistics(m->event, &wakeups, &elapses);
+
+        return sd_bus_message_append(reply, "t", streq(property, "NTimerWakeups") ? wakeups : elapses);
+}
+
 static int property_get_system_state(
                 sd_bus *bus,
                 const char *path,
@@ -637,13 +659,15 @@ static int transient_unit_from_message(
         if (r < 0)
                 return r;
 
+        /* From here on the unit is ours, also if setting the
+         * properties fails, so that the caller may drop it again */
+        *unit = u;
+
         /* Set our properties */
         r = bus_unit_set_properties(u, message, UNIT_RUNTIME, false, error);
         if (r < 0)
                 return r;
 
-        *unit = u;
-
         return 0;
 }
 
@@ -747,6 +771,158 @@ static int method_start_transient_unit(sd_bus_message *message, void *userdata,
         return bus_unit_queue_job(message, u, JOB_START, mode, false, error);
 }
 
+static int method_start_transient_units(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_free_ Unit **units = NULL;
+        _cleanup_free_ Job **jobs = NULL;
+        size_t n_units = 0, n_allocated = 0, i;
+        Manager *m = userdata;
+        const char *smode;
+        JobMode mode;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Like StartTransientUnit(), but for many units at once, so
+         * that clients spawning lots of scopes need only a single
+         * round-trip and authorization check for all of them. The
+         * start jobs are enqueued in a single transaction, and if
+         * anything fails, all units created here are dropped
+         * again. */
+
+        r = mac_selinux_access_check(message, "start", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read(message, "s", &smode);
+        if (r < 0)
+                return r;
+
+        mode = job_mode_from_string(smode);
+        if (mode < 0)
+                return sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "Job mode %s is invalid.", smode);
+
+        r = bus_verify_manage_units_async(m, message, error);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return 1; /* No authorization for now, but the async polkit stuff will call us again when it has it */
+
+        r = sd_bus_message_enter_container(message, 'a', "(sa(sv))");
+        if (r < 0)
+                return r;
+
+        while ((r = sd_bus_message_enter_container(message, 'r', "sa(sv)")) > 0) {
+                const char *name;
+                Unit *u = NULL;
+                UnitType t;
+
+                r = sd_bus_message_read(message, "s", &name);
+                if (r < 0)
+                        goto fail;
+
+                t = unit_name_to_type(name);
+                if (t < 0) {
+                        r = sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "Invalid unit type.");
+                        goto fail;
+                }
+
+                if (!unit_vtable[t]->can_transient) {
+                        r = sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "Unit type %s does not support transient units.", unit_type_to_string(t));
+                        goto fail;
+                }
+
+                if (!GREEDY_REALLOC(units, n_allocated, n_units + 1)) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                r = transient_unit_from_message(m, message, name, &u, error);
+                if (u)
+                        units[n_units++] = u;
+                if (r < 0)
+                        goto fail;
+
+                r = sd_bus_message_exit_container(message);
+                if (r < 0)
+                        goto fail;
+        }
+        if (r < 0)
+                goto fail;
+
+        r = sd_bus_message_exit_container(message);
+        if (r < 0)
+                goto fail;
+
+        if (n_units == 0)
+                return sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "No units specified.");
+
+        r = transient_aux_units_from_message(m, message, error);
+        if (r < 0)
+                goto fail;
+
+        /* And load these stubs fully */
+        for (i = 0; i < n_units; i++) {
+                r = unit_load(units[i]);
+                if (r < 0)
+                        goto fail;
+        }
+
+        manager_dispatch_load_queue(m);
+
+        jobs = new0(Job*, n_units);
+        if (!jobs) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        /* Finally, start them */
+        r = bus_unit_enqueue_jobs(message, units, n_units, JOB_START, mode, jobs, error);
+        if (r < 0)
+                goto fail;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                goto fail;
+
+        r = sd_bus_message_open_container(reply, 'a', "o");
+        if (r < 0)
+                goto fail;
+
+        for (i = 0; i < n_units; i++) {
+                _cleanup_free_ char *path = NULL;
+
+                /* Freshly created units are inactive, hence a start
+                 * job is never redundant for them */
+                assert(jobs[i]);
+
+                path = job_dbus_path(jobs[i]);
+                if (!path) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                r = sd_bus_message_append(reply, "o", path);
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                goto fail;
+
+        return sd_bus_send(NULL, reply, NULL);
+
+fail:
+        /* Unloading a unit also removes its transient files and
+         * uninstalls its job */
+        for (i = 0; i < n_units; i++)
+                unit_free(units[i]);
+
+        return r;
+}
+
 static int method_get_job(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         _cleanup_free_ char *path = NULL;
         Manager *m = userdata;
@@ -842,6 +1018,56 @@ static int method_reset_failed(sd_bus_message *message, void *userdata, sd_bus_e
         return sd_bus_reply_method_return(message, NULL);
 }
 
+static bool unit_matches_filter(Unit *u, char **states, char **patterns, char **types) {
+        assert(u);
+
+        if (!strv_isempty(types) &&
+            !strv_contains(types, unit_type_to_string(u->type)))
+                return false;
+
+        if (!strv_isempty(states) &&
+            !strv_contains(states, unit_load_state_to_string(u->load_state)) &&
+            !strv_contains(states, unit_active_state_to_string(unit_active_state(u))) &&
+            !strv_contains(states, unit_sub_state_to_string(u)))
+                return false;
+
+        /* Matched on the name only, like systemctl always did it */
+        return strv_fnmatch_or_empty(patterns, u->id, FNM_NOESCAPE);
+}
+
+static int append_unit(sd_bus_message *reply, Unit *u) {
+        _cleanup_free_ char *unit_path = NULL, *job_path = NULL;
+        Unit *following;
+
+        assert(reply);
+        assert(u);
+
+        following = unit_following(u);
+
+        unit_path = unit_dbus_path(u);
+        if (!unit_path)
+                return -ENOMEM;
+
+        if (u->job) {
+                job_path = job_dbus_path(u->job);
+                if (!job_path)
+                        return -ENOMEM;
+        }
+
+        return sd_bus_message_append(
+                        reply, "(ssssssouso)",
+                        u->id,
+                        unit_description(u),
+                        unit_load_state_to_string(u->load_state),
+                        unit_active_state_to_string(unit_active_state(u)),
+                        unit_sub_state_to_string(u),
+                        following ? following->id : "",
+                        unit_path,
+                        u->job ? u->job->id : 0,
+                        u->job ? job_type_to_string(u->job->type) : "",
+                        job_path ? job_path : "/");
+}
+
 static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_error *error, char **states) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         Manager *m = userdata;
@@ -868,42 +1094,13 @@ static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_e
                 return r;
 
         HASHMAP_FOREACH_KEY(u, k, m->units, i) {
-                _cleanup_free_ char *unit_path = NULL, *job_path = NULL;
-                Unit *following;
-
                 if (k != u->id)
                         continue;
 
-                following = unit_following(u);
-
-                if (!strv_isempty(states) &&
-                    !strv_contains(states, unit_load_state_to_string(u->load_state)) &&
-                    !strv_contains(states, unit_active_state_to_string(unit_active_state(u))) &&
-                    !strv_contains(states, unit_sub_state_to_string(u)))
+                if (!unit_matches_filter(u, states, NULL, NULL))
                         continue;
 
-                unit_path = unit_dbus_path(u);
-                if (!unit_path)
-                        return -ENOMEM;
-
-                if (u->job) {
-                        job_path = job_dbus_path(u->job);
-                        if (!job_path)
-                                return -ENOMEM;
-                }
-
-                r = sd_bus_message_append(
-                                reply, "(ssssssouso)",
-                                u->id,
-                                unit_description(u),
-                                unit_load_state_to_string(u->load_state),
-                                unit_active_state_to_string(unit_active_state(u)),
-                                unit_sub_state_to_string(u),
-                                following ? following->id : "",
-                                unit_path,
-                                u->job ? u->job->id : 0,
-                                u->job ? job_type_to_string(u->job->type) : "",
-                                job_path ? job_path : "/");
+                r = append_unit(reply, u);
                 if (r < 0)
                         return r;
         }
@@ -930,6 +1127,216 @@ static int method_list_units_filtered(sd_bus_message *message, void *userdata, s
         return list_units_filtered(message, userdata, error, states);
 }
 
+static int unit_compare_id(const void *a, const void *b) {
+        Unit * const *x = a, * const *y = b;
+
+        return strcmp((*x)->id, (*y)->id);
+}
+
+static int method_list_units_by_patterns(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **states = NULL, **patterns = NULL, **types = NULL;
+        _cleanup_free_ Unit **units = NULL;
+        size_t n_units = 0, n_allocated = 0, j = 0, end;
+        Manager *m = userdata;
+        const char *cursor, *k;
+        uint64_t limit;
+        char **t;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &states);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &patterns);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &types);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read(message, "st", &cursor, &limit);
+        if (r < 0)
+                return r;
+
+        STRV_FOREACH(t, types)
+                if (unit_type_from_string(*t) < 0)
+                        return sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "Unknown unit type %s.", *t);
+
+        /* Only pointers are collected here, the strings are copied
+         * straight from the units into the reply, once */
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                if (k != u->id)
+                        continue;
+
+                if (!unit_matches_filter(u, states, patterns, types))
+                        continue;
+
+                if (!GREEDY_REALLOC(units, n_allocated, n_units + 1))
+                        return -ENOMEM;
+
+                units[n_units++] = u;
+        }
+
+        /* The hashmap order changes whenever units come and go, so
+         * for paging the matches are ordered by name, and the cursor
+         * is the name of the last unit returned. Units added between
+         * two calls show up if they sort after the cursor. */
+        if (limit > 0 || !isempty(cursor)) {
+                qsort_safe(units, n_units, sizeof(Unit*), unit_compare_id);
+
+                if (!isempty(cursor))
+                        while (j < n_units && strcmp(units[j]->id, cursor) <= 0)
+                                j++;
+        }
+
+        end = limit > 0 && limit < n_units - j ? j + limit : n_units;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(ssssssouso)");
+        if (r < 0)
+                return r;
+
+        for (; j < end; j++) {
+                r = append_unit(reply, units[j]);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        /* An empty cursor means there is nothing more to get */
+        r = sd_bus_message_append(reply, "s", end < n_units ? units[end - 1]->id : "");
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
+static int method_list_unit_timestamps(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        Manager *m = userdata;
+        const char *k;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        /* The same monotonic timestamps as exposed by the unit
+         * properties, for all units in one go, so that
+         * "systemd-analyze blame" and friends don't need four
+         * property calls per unit */
+        r = sd_bus_message_open_container(reply, 'a', "(stttt)");
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                if (k != u->id)
+                        continue;
+
+                r = sd_bus_message_append(
+                                reply, "(stttt)",
+                                u->id,
+                                u->inactive_exit_timestamp.monotonic,
+                                u->active_enter_timestamp.monotonic,
+                                u->active_exit_timestamp.monotonic,
+                                u->inactive_enter_timestamp.monotonic);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
+static int method_list_unit_resource_usage(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        Manager *m = userdata;
+        const char *k;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        /* The MemoryCurrent, TasksCurrent and CPUUsageNSec properties
+         * of all units with a cgroup in one go, so that monitoring
+         * tools don't need three property calls per unit. Counters
+         * that are not available are reported as (uint64_t) -1, like
+         * the properties do. */
+        r = sd_bus_message_open_container(reply, 'a', "(sttt)");
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                uint64_t memory = (uint64_t) -1, tasks = (uint64_t) -1;
+                nsec_t cpu = NSEC_INFINITY;
+
+                if (k != u->id)
+                        continue;
+
+                if (!u->cgroup_path)
+                        continue;
+
+                (void) unit_get_memory_current(u, &memory);
+                (void) unit_get_tasks_current(u, &tasks);
+                (void) unit_get_cpu_usage(u, &cpu);
+
+                r = sd_bus_message_append(reply, "(sttt)", u->id, memory, tasks, (uint64_t) cpu);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 static int method_list_jobs(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         Manager *m = userdata;
@@ -984,6 +1391,48 @@ static int method_list_jobs(sd_bus_message *message, void *userdata, sd_bus_erro
         return sd_bus_send(NULL, reply, NULL);
 }
 
+static int method_get_trace(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        Manager *m = userdata;
+        TraceEvent *e;
+        unsigned i;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(sstt)");
+        if (r < 0)
+                return r;
+
+        for (i = 0; (e = trace_ring_get(&m->trace, i)); i++) {
+                r = sd_bus_message_append(
+                                reply, "(sstt)",
+                                trace_phase_to_string(e->phase),
+                                e->unit,
+                                e->begin,
+                                e->duration);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 static int method_subscribe(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         Manager *m = userdata;
         int r;
@@ -1922,6 +2371,8 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_PROPERTY("NJobs", "u", property_get_n_jobs, 0, 0),
         SD_BUS_PROPERTY("NInstalledJobs", "u", bus_property_get_unsigned, offsetof(Manager, n_installed_jobs), 0),
         SD_BUS_PROPERTY("NFailedJobs", "u", bus_property_get_unsigned, offsetof(Manager, n_failed_jobs), 0),
+        SD_BUS_PROPERTY("NTimerWakeups", "t", property_get_timer_wakeups, 0, 0),
+        SD_BUS_PROPERTY("NTimerElapses", "t", property_get_timer_wakeups, 0, 0),
         SD_BUS_PROPERTY("Progress", "d", property_get_progress, 0, 0),
         SD_BUS_PROPERTY("Environment", "as", NULL, offsetof(Manager, environment), 0),
         SD_BUS_PROPERTY("ConfirmSpawn", "b", bus_property_get_bool, offsetof(Manager, confirm_spawn), SD_BUS_VTABLE_PROPERTY_CONST),
@@ -1949,13 +2400,18 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_METHOD("ResetFailedUnit", "s", NULL, method_reset_failed_unit, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("SetUnitProperties", "sba(sv)", NULL, method_set_unit_properties, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("StartTransientUnit", "ssa(sv)a(sa(sv))", "o", method_start_transient_unit, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("StartTransientUnits", "sa(sa(sv))a(sa(sv))", "ao", method_start_transient_units, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("GetJob", "u", "o", method_get_job, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("CancelJob", "u", NULL, method_cancel_job, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ClearJobs", NULL, NULL, method_clear_jobs, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ResetFailed", NULL, NULL, method_reset_failed, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnits", NULL, "a(ssssssouso)", method_list_units, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnitsFiltered", "as", "a(ssssssouso)", method_list_units_filtered, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitsByPatterns", "asasasst", "a(ssssssouso)s", method_list_units_by_patterns, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitTimestamps", NULL, "a(stttt)", method_list_unit_timestamps, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitResourceUsage", NULL, "a(sttt)", method_list_unit_resource_usage, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListJobs", NULL, "a(usssoo)", method_list_jobs, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("GetTrace", NULL, "a(sstt)", method_get_trace, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Subscribe", NULL, NULL, method_subscribe, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Unsubscribe", NULL, NULL, method_unsubscribe, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Dump", NULL, "s", method_dump, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -945,15 +945,58 @@ void bus_unit_send_removed_signal(Unit *u) {
                 log_unit_debug_errno(u, r, "Failed to send unit remove signal for %s: %m", u->id);
 }
 
-int bus_unit_queue_job(
+static int bus_unit_check_job(
+                sd_bus_message *message,
+                Unit *u,
+                JobType type,
+                sd_bus_error *error) {
+
+        int r;
+
+        r = mac_selinux_unit_access_check(
+                        u, message,
+                        (type == JOB_START || type == JOB_RESTART || type == JOB_TRY_RESTART) ? "start" :
+                        type == JOB_STOP ? "stop" : "reload", error);
+        if (r < 0)
+                return r;
+
+        if (type == JOB_STOP &&
+            (u->load_state == UNIT_NOT_FOUND || u->load_state == UNIT_ERROR) &&
+            unit_active_state(u) == UNIT_INACTIVE)
+                return sd_bus_error_setf(error, BUS_ERROR_NO_SUCH_UNIT, "Unit %s not loaded.", u->id);
+
+        if ((type == JOB_START && u->refuse_manual_start) ||
+            (type == JOB_STOP && u->refuse_manual_stop) ||
+            ((type == JOB_RESTART || type == JOB_TRY_RESTART) && (u->refuse_manual_start || u->refuse_manual_stop)))
+                return sd_bus_error_setf(error, BUS_ERROR_ONLY_BY_DEPENDENCY, "Operation refused, unit %s may be requested by dependency only.", u->id);
+
+        return 0;
+}
+
+static int bus_job_track_sender(sd_bus_message *message, Job *j) {
+        int r;
+
+        if (sd_bus_message_get_bus(message) != j->manager->api_bus)
+                return 0;
+
+        if (!j->clients) {
+                r = sd_bus_track_new(sd_bus_message_get_bus(message), &j->clients, NULL, NULL);
+                if (r < 0)
+                        return r;
+        }
+
+        return sd_bus_track_add_sender(j->clients, message);
+}
+
+int bus_unit_enqueue_job(
                 sd_bus_message *message,
                 Unit *u,
                 JobType type,
                 JobMode mode,
                 bool reload_if_possible,
+                Job **ret,
                 sd_bus_error *error) {
 
-        _cleanup_free_ char *path = NULL;
         Job *j;
         int r;
 
@@ -961,6 +1004,7 @@ int bus_unit_queue_job(
         assert(u);
         assert(type >= 0 && type < _JOB_TYPE_MAX);
         assert(mode >= 0 && mode < _JOB_MODE_MAX);
+        assert(ret);
 
         if (reload_if_possible && unit_can_reload(u)) {
                 if (type == JOB_RESTART)
@@ -969,39 +1013,82 @@ int bus_unit_queue_job(
                         type = JOB_RELOAD;
         }
 
-        r = mac_selinux_unit_access_check(
-                        u, message,
-                        (type == JOB_START || type == JOB_RESTART || type == JOB_TRY_RESTART) ? "start" :
-                        type == JOB_STOP ? "stop" : "reload", error);
+        r = bus_unit_check_job(message, u, type, error);
         if (r < 0)
                 return r;
 
-        if (type == JOB_STOP &&
-            (u->load_state == UNIT_NOT_FOUND || u->load_state == UNIT_ERROR) &&
-            unit_active_state(u) == UNIT_INACTIVE)
-                return sd_bus_error_setf(error, BUS_ERROR_NO_SUCH_UNIT, "Unit %s not loaded.", u->id);
+        r = manager_add_job(u->manager, type, u, mode, true, error, &j);
+        if (r < 0)
+                return r;
 
-        if ((type == JOB_START && u->refuse_manual_start) ||
-            (type == JOB_STOP && u->refuse_manual_stop) ||
-            ((type == JOB_RESTART || type == JOB_TRY_RESTART) && (u->refuse_manual_start || u->refuse_manual_stop)))
-                return sd_bus_error_setf(error, BUS_ERROR_ONLY_BY_DEPENDENCY, "Operation refused, unit %s may be requested by dependency only.", u->id);
+        r = bus_job_track_sender(message, j);
+        if (r < 0)
+                return r;
 
-        r = manager_add_job(u->manager, type, u, mode, true, error, &j);
+        *ret = j;
+        return 0;
+}
+
+int bus_unit_enqueue_jobs(
+                sd_bus_message *message,
+                Unit **units,
+                unsigned n_units,
+                JobType type,
+                JobMode mode,
+                Job **jobs,
+                sd_bus_error *error) {
+
+        unsigned i;
+        int r;
+
+        assert(message);
+        assert(units);
+        assert(n_units > 0);
+        assert(type >= 0 && type < _JOB_TYPE_MAX);
+        assert(mode >= 0 && mode < _JOB_MODE_MAX);
+        assert(jobs);
+
+        /* All or nothing: check every unit first, then enqueue all
+         * jobs in one transaction */
+
+        for (i = 0; i < n_units; i++) {
+                r = bus_unit_check_job(message, units[i], type, error);
+                if (r < 0)
+                        return r;
+        }
+
+        r = manager_add_jobs(units[0]->manager, type, units, n_units, mode, true, error, jobs);
         if (r < 0)
                 return r;
 
-        if (sd_bus_message_get_bus(message) == u->manager->api_bus) {
-                if (!j->clients) {
-                        r = sd_bus_track_new(sd_bus_message_get_bus(message), &j->clients, NULL, NULL);
-                        if (r < 0)
-                                return r;
-                }
+        for (i = 0; i < n_units; i++) {
+                if (!jobs[i])
+                        continue;
 
-                r = sd_bus_track_add_sender(j->clients, message);
+                r = bus_job_track_sender(message, jobs[i]);
                 if (r < 0)
                         return r;
         }
 
+        return 0;
+}
+
+int bus_unit_queue_job(
+                sd_bus_message *message,
+                Unit *u,
+                JobType type,
+                JobMode mode,
+                bool reload_if_possible,
+                sd_bus_error *error) {
+
+        _cleanup_free_ char *path = NULL;
+        Job *j;
+        int r;
+
+        r = bus_unit_enqueue_job(message, u, type, mode, reload_if_possible, &j, error);
+        if (r < 0)
+                return r;
+
         path = job_dbus_path(j);
         if (!path)
                 return -ENOMEM;
@@ -34,6 +34,8 @@ int bus_unit_method_start_generic(sd_bus_message *message, Unit *u, JobType job_
 int bus_unit_method_kill(sd_bus_message *message, void *userdata, sd_bus_error *error);
 int bus_unit_method_reset_failed(sd_bus_message *message, void *userdata, sd_bus_error *error);
 
+int bus_unit_enqueue_job(sd_bus_message *message, Unit *u, JobType type, JobMode mode, bool reload_if_possible, Job **ret, sd_bus_error *error);
+int bus_unit_enqueue_jobs(sd_bus_message *message, Unit **units, unsigned n_units, JobType type, JobMode mode, Job **jobs, sd_bus_error *error);
 int bus_unit_queue_job(sd_bus_message *message, Unit *u, JobType type, JobMode mode, bool reload_if_possible, sd_bus_error *error);
 int bus_unit_set_properties(Unit *u, sd_bus_message *message, UnitSetPropertiesMode mode, bool commit, sd_bus_error *error);
 int bus_unit_method_set_properties(sd_bus_message *message, void *userdata, sd_bus_error *error);
@@ -675,6 +675,10 @@ static int bus_on_connection(sd_event_source *s, int fd, uint32_t revents, void
                 return 0;
         }
 
+        r = sd_bus_set_statistics(bus, true);
+        if (r < 0)
+                log_warning_errno(r, "Failed to enable statistics for new connection, ignoring: %m");
+
         r = sd_bus_start(bus);
         if (r < 0) {
                 log_warning_errno(r, "Failed to start new connection bus: %m");
@@ -772,6 +776,10 @@ static int bus_setup_api(Manager *m, sd_bus *bus) {
         if (r < 0)
                 log_warning_errno(r, "Failed to enable credential passing, ignoring: %m");
 
+        r = sd_bus_set_statistics(bus, true);
+        if (r < 0)
+                log_warning_errno(r, "Failed to enable bus statistics, ignoring: %m");
+
         r = bus_setup_api_vtables(m, bus);
         if (r < 0)
                 return r;
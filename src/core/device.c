@@ -32,6 +32,9 @@
 #include "swap.h"
 #include "device.h"
 
+/* Maximum number of udev events we read from the monitor in one go */
+#define DEVICE_EVENTS_BATCH_MAX 256U
+
 static const UnitActiveState state_translation_table[_DEVICE_STATE_MAX] = {
         [DEVICE_DEAD] = UNIT_INACTIVE,
         [DEVICE_TENTATIVE] = UNIT_ACTIVATING,
@@ -679,41 +682,23 @@ fail:
         return r;
 }
 
-static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
-        Manager *m = userdata;
+static void device_process_event(Manager *m, struct udev_device *dev) {
         const char *action, *sysfs;
         int r;
 
         assert(m);
-
-        if (revents != EPOLLIN) {
-                static RATELIMIT_DEFINE(limit, 10*USEC_PER_SEC, 5);
-
-                if (!ratelimit_test(&limit))
-                        log_error_errno(errno, "Failed to get udev event: %m");
-                if (!(revents & EPOLLIN))
-                        return 0;
-        }
-
-        /*
-         * libudev might filter-out devices which pass the bloom
-         * filter, so getting NULL here is not necessarily an error.
-         */
-        dev = udev_monitor_receive_device(m->udev_monitor);
-        if (!dev)
-                return 0;
+        assert(dev);
 
         sysfs = udev_device_get_syspath(dev);
         if (!sysfs) {
                 log_error("Failed to get udev sys path.");
-                return 0;
+                return;
         }
 
         action = udev_device_get_action(dev);
         if (!action) {
                 log_error("Failed to get udev action string.");
-                return 0;
+                return;
         }
 
         if (streq(action, "remove"))  {
@@ -746,6 +731,75 @@ static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
 
                 device_update_found_by_sysfs(m, sysfs, false, DEVICE_FOUND_UDEV, true);
         }
+}
+
+static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        struct udev_device *devs[DEVICE_EVENTS_BATCH_MAX];
+        bool superseded[DEVICE_EVENTS_BATCH_MAX] = {};
+        _cleanup_hashmap_free_ Hashmap *later = NULL;
+        Manager *m = userdata;
+        unsigned n = 0, i;
+
+        assert(m);
+
+        if (revents != EPOLLIN) {
+                static RATELIMIT_DEFINE(limit, 10*USEC_PER_SEC, 5);
+
+                if (!ratelimit_test(&limit))
+                        log_error_errno(errno, "Failed to get udev event: %m");
+                if (!(revents & EPOLLIN))
+                        return 0;
+        }
+
+        /* Take everything that is queued, up to a limit, so that
+         * during coldplug and similar storms we can skip events
+         * that are obsoleted by later ones for the same device.
+         *
+         * libudev might filter-out devices which pass the bloom
+         * filter, so getting NULL here is not necessarily an error,
+         * nor does it mean that nothing is queued anymore. If there
+         * is, we are called again. */
+        while (n < DEVICE_EVENTS_BATCH_MAX) {
+                devs[n] = udev_monitor_receive_device(m->udev_monitor);
+                if (!devs[n])
+                        break;
+
+                n++;
+        }
+
+        if (n > 1) {
+                later = hashmap_new(&string_hash_ops);
+
+                /* An add or change event carries the complete state
+                 * of the device, hence if it is followed by another
+                 * such event for the same device, it can be skipped.
+                 * Removals are always processed, since they reset more
+                 * than the udev state. */
+                for (i = n; later && i > 0; i--) {
+                        const char *sysfs, *action;
+                        bool remove;
+
+                        sysfs = udev_device_get_syspath(devs[i-1]);
+                        action = udev_device_get_action(devs[i-1]);
+                        if (!sysfs || !action)
+                                continue;
+
+                        remove = streq(action, "remove");
+
+                        if (!remove && hashmap_get(later, sysfs) == INT_TO_PTR(1))
+                                superseded[i-1] = true;
+
+                        if (hashmap_replace(later, sysfs, INT_TO_PTR(remove ? 2 : 1)) < 0)
+                                later = hashmap_free(later);
+                }
+        }
+
+        for (i = 0; i < n; i++) {
+                if (!superseded[i])
+                        device_process_event(m, devs[i]);
+
+                udev_device_unref(devs[i]);
+        }
 
         return 0;
 }
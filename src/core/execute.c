@@ -33,6 +33,9 @@
 #include <glob.h>
 #include <utmpx.h>
 #include <sys/personality.h>
+#include <sys/mman.h>
+#include <sys/statfs.h>
+#include <linux/magic.h>
 
 #ifdef HAVE_PAM
 #include <security/pam_appl.h>
@@ -44,6 +47,8 @@
 
 #ifdef HAVE_SECCOMP
 #include <seccomp.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
 #endif
 
 #ifdef HAVE_APPARMOR
@@ -984,7 +989,7 @@ static void rename_process_from_path(const char *path) {
 
 #ifdef HAVE_SECCOMP
 
-static int apply_seccomp(const ExecContext *c) {
+static int build_seccomp(const ExecContext *c, scmp_filter_ctx **ret) {
         uint32_t negative_action, action;
         scmp_filter_ctx *seccomp;
         Iterator i;
@@ -992,6 +997,7 @@ static int apply_seccomp(const ExecContext *c) {
         int r;
 
         assert(c);
+        assert(ret);
 
         negative_action = c->syscall_errno == 0 ? SCMP_ACT_KILL : SCMP_ACT_ERRNO(c->syscall_errno);
 
@@ -1026,19 +1032,21 @@ static int apply_seccomp(const ExecContext *c) {
         if (r < 0)
                 goto finish;
 
-        r = seccomp_load(seccomp);
+        *ret = seccomp;
+        return 0;
 
 finish:
         seccomp_release(seccomp);
         return r;
 }
 
-static int apply_address_families(const ExecContext *c) {
+static int build_address_families(const ExecContext *c, scmp_filter_ctx **ret) {
         scmp_filter_ctx *seccomp;
         Iterator i;
         int r;
 
         assert(c);
+        assert(ret);
 
         seccomp = seccomp_init(SCMP_ACT_ALLOW);
         if (!seccomp)
@@ -1147,13 +1155,111 @@ static int apply_address_families(const ExecContext *c) {
         if (r < 0)
                 goto finish;
 
-        r = seccomp_load(seccomp);
+        *ret = seccomp;
+        return 0;
+
+finish:
+        seccomp_release(seccomp);
+        return r;
+}
+
+static int compile_filter(int (*build)(const ExecContext *c, scmp_filter_ctx **ret), const ExecContext *c, void **ret, size_t *ret_size) {
+        _cleanup_free_ void *bpf = NULL;
+        _cleanup_close_ int fd = -1;
+        scmp_filter_ctx *seccomp;
+        struct stat st;
+        ssize_t n;
+        int r;
+
+        r = build(c, &seccomp);
+        if (r < 0)
+                return r;
+
+        fd = memfd_create("seccomp", MFD_CLOEXEC);
+        if (fd < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        r = seccomp_export_bpf(seccomp, fd);
+        if (r < 0)
+                goto finish;
+
+        if (fstat(fd, &st) < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        if (st.st_size <= 0 || st.st_size % sizeof(struct sock_filter) != 0 ||
+            st.st_size / sizeof(struct sock_filter) > BPF_MAXINSNS) {
+                r = -EBADMSG;
+                goto finish;
+        }
+
+        bpf = malloc(st.st_size);
+        if (!bpf) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        n = pread(fd, bpf, st.st_size, 0);
+        if (n < 0) {
+                r = -errno;
+                goto finish;
+        }
+        if (n != st.st_size) {
+                r = -EIO;
+                goto finish;
+        }
+
+        *ret = bpf;
+        *ret_size = st.st_size;
+        bpf = NULL;
 
 finish:
         seccomp_release(seccomp);
         return r;
 }
 
+static int apply_filter(int (*build)(const ExecContext *c, scmp_filter_ctx **ret), const ExecContext *c, const void *bpf, size_t bpf_size) {
+        scmp_filter_ctx *seccomp;
+        int r;
+
+        if (bpf) {
+                struct sock_fprog prog = {
+                        .len = bpf_size / sizeof(struct sock_filter),
+                        .filter = (struct sock_filter*) bpf,
+                };
+
+                /* This is what seccomp_load() ends up doing too */
+                if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
+                        return -errno;
+
+                return 0;
+        }
+
+        r = build(c, &seccomp);
+        if (r < 0)
+                return r;
+
+        r = seccomp_load(seccomp);
+        seccomp_release(seccomp);
+
+        return r;
+}
+
+static int apply_seccomp(const ExecContext *c) {
+        assert(c);
+
+        return apply_filter(build_seccomp, c, c->syscall_filter_bpf, c->syscall_filter_bpf_size);
+}
+
+static int apply_address_families(const ExecContext *c) {
+        assert(c);
+
+        return apply_filter(build_address_families, c, c->address_families_bpf, c->address_families_bpf_size);
+}
+
 #endif
 
 static void do_idle_pipe_dance(int idle_pipe[4]) {
@@ -1889,6 +1995,7 @@ int exec_spawn(Unit *unit,
         int socket_fd, r;
         char **argv;
         pid_t pid;
+        usec_t ts;
 
         assert(unit);
         assert(command);
@@ -1897,6 +2004,8 @@ int exec_spawn(Unit *unit,
         assert(params);
         assert(params->fds || params->n_fds <= 0);
 
+        ts = now(CLOCK_MONOTONIC);
+
         if (context->std_input == EXEC_INPUT_SOCKET ||
             context->std_output == EXEC_OUTPUT_SOCKET ||
             context->std_error == EXEC_OUTPUT_SOCKET) {
@@ -1971,6 +2080,8 @@ int exec_spawn(Unit *unit,
 
         exec_status_start(&command->exec_status, pid);
 
+        manager_trace(unit->manager, TRACE_PHASE_SPAWN, unit->id, ts);
+
         *ret = pid;
         return 0;
 }
@@ -2031,12 +2142,48 @@ void exec_context_done(ExecContext *c) {
         c->syscall_archs = set_free(c->syscall_archs);
         c->address_families = set_free(c->address_families);
 
+        c->syscall_filter_bpf = mfree(c->syscall_filter_bpf);
+        c->syscall_filter_bpf_size = 0;
+        c->address_families_bpf = mfree(c->address_families_bpf);
+        c->address_families_bpf_size = 0;
+
         c->runtime_directory = strv_free(c->runtime_directory);
 
         bus_endpoint_free(c->bus_endpoint);
         c->bus_endpoint = NULL;
 }
 
+int exec_context_compile_seccomp(ExecContext *c) {
+#ifdef HAVE_SECCOMP
+        int r;
+
+        assert(c);
+
+        /* Building the filters with libseccomp is not cheap, and
+         * would otherwise be redone in every single child */
+
+        c->syscall_filter_bpf = mfree(c->syscall_filter_bpf);
+        c->address_families_bpf = mfree(c->address_families_bpf);
+
+        if (c->address_families_whitelist ||
+            !set_isempty(c->address_families)) {
+                r = compile_filter(build_address_families, c, &c->address_families_bpf, &c->address_families_bpf_size);
+                if (r < 0)
+                        return r;
+        }
+
+        if (c->syscall_whitelist ||
+            !set_isempty(c->syscall_filter) ||
+            !set_isempty(c->syscall_archs)) {
+                r = compile_filter(build_seccomp, c, &c->syscall_filter_bpf, &c->syscall_filter_bpf_size);
+                if (r < 0)
+                        return r;
+        }
+#endif
+
+        return 0;
+}
+
 int exec_context_destroy_runtime_directory(ExecContext *c, const char *runtime_prefix) {
         char **i;
 
@@ -2106,6 +2253,183 @@ static void invalid_env(const char *p, void *userdata) {
         log_unit_error(info->unit, "Ignoring invalid environment assignment '%s': %s", p, info->path);
 }
 
+/* Parsed EnvironmentFile= files, shared by all units of the manager
+ * and revalidated with a stat() on every use. */
+#define ENV_FILE_CACHE_MAX 512U
+
+typedef struct EnvFileCacheEntry {
+        char *path;
+
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime, ctime;
+
+        char **env;
+} EnvFileCacheEntry;
+
+static EnvFileCacheEntry *env_file_cache_entry_free(EnvFileCacheEntry *e) {
+        if (!e)
+                return NULL;
+
+        free(e->path);
+        strv_free(e->env);
+        free(e);
+
+        return NULL;
+}
+
+Hashmap *exec_env_file_cache_free(Hashmap *h) {
+        EnvFileCacheEntry *e;
+
+        while ((e = hashmap_steal_first(h)))
+                env_file_cache_entry_free(e);
+
+        return hashmap_free(h);
+}
+
+static bool env_file_cache_entry_matches(EnvFileCacheEntry *e, const struct stat *st) {
+        return e->dev == st->st_dev &&
+                e->ino == st->st_ino &&
+                e->size == st->st_size &&
+                e->mtime.tv_sec == st->st_mtim.tv_sec &&
+                e->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+                e->ctime.tv_sec == st->st_ctim.tv_sec &&
+                e->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+static void env_file_cache_put(Hashmap **cache, const char *path, const struct stat *st, char **env) {
+        _cleanup_strv_free_ char **copy = NULL;
+        EnvFileCacheEntry *e;
+        usec_t changed;
+
+        /* A file changed within the granularity of the timestamps
+         * might change again without us noticing, hence only
+         * remember files that were left alone for a while */
+        changed = MAX(timespec_load(&st->st_mtim), timespec_load(&st->st_ctim));
+        if (changed + USEC_PER_SEC >= now(CLOCK_REALTIME))
+                return;
+
+        copy = strv_copy(env);
+        if (!copy)
+                return;
+
+        e = hashmap_get(*cache, path);
+        if (!e) {
+                if (hashmap_size(*cache) >= ENV_FILE_CACHE_MAX)
+                        *cache = exec_env_file_cache_free(*cache);
+
+                if (hashmap_ensure_allocated(cache, &string_hash_ops) < 0)
+                        return;
+
+                e = new0(EnvFileCacheEntry, 1);
+                if (!e)
+                        return;
+
+                e->path = strdup(path);
+                if (!e->path || hashmap_put(*cache, e->path, e) < 0) {
+                        env_file_cache_entry_free(e);
+                        return;
+                }
+        }
+
+        e->dev = st->st_dev;
+        e->ino = st->st_ino;
+        e->size = st->st_size;
+        e->mtime = st->st_mtim;
+        e->ctime = st->st_ctim;
+
+        strv_free(e->env);
+        e->env = copy;
+        copy = NULL;
+}
+
+static bool env_file_cacheable(int fd, const struct stat *st) {
+        struct statfs sfs;
+
+        assert(fd >= 0);
+        assert(st);
+
+        /* Files in pseudo file systems report no size, or a bogus
+         * one, and their timestamps don't change with the contents,
+         * hence they need to be read every time */
+
+        if (st->st_size <= 0)
+                return false;
+
+        if (fstatfs(fd, &sfs) < 0)
+                return false;
+
+        return !F_TYPE_EQUAL(sfs.f_type, PROC_SUPER_MAGIC) &&
+               !F_TYPE_EQUAL(sfs.f_type, SYSFS_MAGIC);
+}
+
+static int load_env_file_cached(Unit *unit, const char *path, char ***ret) {
+        _cleanup_fclose_ FILE *f = NULL;
+        Hashmap **cache = NULL;
+        EnvFileCacheEntry *e;
+        struct stat st;
+        char **p;
+        int r;
+
+        assert(path);
+        assert(ret);
+
+        if (unit && unit->manager)
+                cache = &unit->manager->env_file_cache;
+
+        if (cache) {
+                e = hashmap_get(*cache, path);
+                if (e) {
+                        if (stat(path, &st) >= 0 && env_file_cache_entry_matches(e, &st)) {
+                                if (e->env) {
+                                        p = strv_copy(e->env);
+                                        if (!p)
+                                                return -ENOMEM;
+                                } else
+                                        p = NULL;
+
+                                *ret = p;
+                                return 0;
+                        }
+
+                        hashmap_remove(*cache, path);
+                        env_file_cache_entry_free(e);
+                }
+        }
+
+        f = fopen(path, "re");
+        if (!f)
+                return -errno;
+
+        /* Take the timestamps before reading, so that a change while
+         * we read does not go unnoticed */
+        if (fstat(fileno(f), &st) < 0)
+                return -errno;
+
+        r = load_env_file(f, path, NULL, &p);
+        if (r < 0)
+                return r;
+
+        /* Log invalid environment variables with filename. They are
+         * dropped before the result is cached, hence only logged for
+         * the unit that read the file first. */
+        if (p) {
+                InvalidEnvInfo info = {
+                        .unit = unit,
+                        .path = path,
+                };
+
+                p = strv_env_clean_with_callback(p, invalid_env, &info);
+        }
+
+        if (cache && env_file_cacheable(fileno(f), &st))
+                env_file_cache_put(cache, path, &st, p);
+
+        *ret = p;
+        return 0;
+}
+
 int exec_context_load_environment(Unit *unit, const ExecContext *c, char ***l) {
         char **i, **r = NULL;
 
@@ -2153,7 +2477,7 @@ int exec_context_load_environment(Unit *unit, const ExecContext *c, char ***l) {
                         return -EINVAL;
                 }
                 for (n = 0; n < count; n++) {
-                        k = load_env_file(NULL, pglob.gl_pathv[n], NULL, &p);
+                        k = load_env_file_cached(unit, pglob.gl_pathv[n], &p);
                         if (k < 0) {
                                 if (ignore)
                                         continue;
@@ -2161,15 +2485,6 @@ int exec_context_load_environment(Unit *unit, const ExecContext *c, char ***l) {
                                 strv_free(r);
                                 return k;
                         }
-                        /* Log invalid environment variables with filename */
-                        if (p) {
-                                InvalidEnvInfo info = {
-                                        .unit = unit,
-                                        .path = pglob.gl_pathv[n]
-                                };
-
-                                p = strv_env_clean_with_callback(p, invalid_env, &info);
-                        }
 
                         if (r == NULL)
                                 r = p;
@@ -189,6 +189,13 @@ struct ExecContext {
         Set *address_families;
         bool address_families_whitelist:1;
 
+        /* The two seccomp filters above, compiled once at load time,
+         * so that the forked children just have to install them */
+        void *syscall_filter_bpf;
+        size_t syscall_filter_bpf_size;
+        void *address_families_bpf;
+        size_t address_families_bpf_size;
+
         char **runtime_directory;
         mode_t runtime_directory_mode;
 
@@ -247,11 +254,13 @@ int exec_command_append(ExecCommand *c, const char *path, ...);
 
 void exec_context_init(ExecContext *c);
 void exec_context_done(ExecContext *c);
+int exec_context_compile_seccomp(ExecContext *c);
 void exec_context_dump(ExecContext *c, FILE* f, const char *prefix);
 
 int exec_context_destroy_runtime_directory(ExecContext *c, const char *runtime_root);
 
 int exec_context_load_environment(Unit *unit, const ExecContext *c, char ***l);
+Hashmap *exec_env_file_cache_free(Hashmap *h);
 
 bool exec_context_may_touch_console(ExecContext *c);
 bool exec_context_maintains_privileges(ExecContext *c);
@@ -34,6 +34,11 @@
 #include "virt.h"
 #include "dbus.h"
 #include "terminal-util.h"
+#include "mempool.h"
+
+/* Transactions create and drop lots of these */
+static DEFINE_MEMPOOL_THREADED(job_pool, Job, 64);
+static DEFINE_MEMPOOL_THREADED(job_dependency_pool, JobDependency, 256);
 
 Job* job_new_raw(Unit *unit) {
         Job *j;
@@ -42,7 +47,7 @@ Job* job_new_raw(Unit *unit) {
 
         assert(unit);
 
-        j = new0(Job, 1);
+        j = mempool_threaded_alloc0_tile(&job_pool);
         if (!j)
                 return NULL;
 
@@ -89,7 +94,7 @@ void job_free(Job *j) {
         sd_bus_track_unref(j->clients);
         strv_free(j->deserialized_clients);
 
-        free(j);
+        mempool_threaded_free_tile(&job_pool, j);
 }
 
 static void job_set_state(Job *j, JobState state) {
@@ -262,7 +267,8 @@ JobDependency* job_dependency_new(Job *subject, Job *object, bool matters, bool
          * this means the 'anchor' job (i.e. the one the user
          * explicitly asked for) is the requester. */
 
-        if (!(l = new0(JobDependency, 1)))
+        l = mempool_threaded_alloc0_tile(&job_dependency_pool);
+        if (!l)
                 return NULL;
 
         l->subject = subject;
@@ -286,7 +292,7 @@ void job_dependency_free(JobDependency *l) {
 
         LIST_REMOVE(object, l->object->object_list, l);
 
-        free(l);
+        mempool_threaded_free_tile(&job_dependency_pool, l);
 }
 
 void job_dump(Job *j, FILE*f, const char *prefix) {
@@ -536,6 +542,8 @@ static int job_perform_on_unit(Job **j) {
 }
 
 int job_run_and_invalidate(Job *j) {
+        Unit *u;
+        usec_t ts;
         int r;
 
         assert(j);
@@ -555,6 +563,9 @@ int job_run_and_invalidate(Job *j) {
         job_set_state(j, JOB_RUNNING);
         job_add_to_dbus_queue(j);
 
+        /* The job might be gone once performed, the unit is not */
+        u = j->unit;
+        ts = now(CLOCK_MONOTONIC);
 
         switch (j->type) {
 
@@ -592,6 +603,8 @@ int job_run_and_invalidate(Job *j) {
                         assert_not_reached("Unknown job type");
         }
 
+        manager_trace(u->manager, TRACE_PHASE_JOB_RUN, u->id, ts);
+
         if (j) {
                 if (r == -EALREADY)
                         r = job_finish_and_invalidate(j, JOB_DONE, true);
@@ -30,22 +30,26 @@
 #include "formats-util.h"
 #include "process-util.h"
 #include "terminal-util.h"
+#include "proc-snapshot.h"
 
 #define TIMEOUT_USEC (10 * USEC_PER_SEC)
 
-static bool ignore_proc(pid_t pid) {
-        _cleanup_fclose_ FILE *f = NULL;
-        char c;
-        const char *p;
-        size_t count;
+/* Processes that are not our children do not wake us up when they
+ * exit, hence we look after them at these intervals, starting short,
+ * since most of them exit right after being signalled */
+#define POLL_MIN_USEC (5 * USEC_PER_MSEC)
+#define POLL_MAX_USEC (200 * USEC_PER_MSEC)
+
+static bool ignore_proc(ProcSnapshot *s) {
+        _cleanup_free_ char *cmdline = NULL;
         uid_t uid;
         int r;
 
         /* We are PID 1, let's not commit suicide */
-        if (pid == 1)
+        if (proc_snapshot_get_pid(s) == 1)
                 return true;
 
-        r = get_process_uid(pid, &uid);
+        r = proc_snapshot_get_uid(s, &uid);
         if (r < 0)
                 return true; /* not really, but better safe than sorry */
 
@@ -53,29 +57,47 @@ static bool ignore_proc(pid_t pid) {
         if (uid != 0)
                 return false;
 
-        p = procfs_file_alloca(pid, "cmdline");
-        f = fopen(p, "re");
-        if (!f)
-                return true; /* not really, but has the desired effect */
-
-        count = fread(&c, 1, 1, f);
-
         /* Kernel threads have an empty cmdline */
-        if (count <= 0)
-                return true;
+        r = proc_snapshot_get_cmdline(s, &cmdline);
+        if (r < 0)
+                return true; /* not really, but has the desired effect */
 
         /* Processes with argv[0][0] = '@' we ignore from the killing
          * spree.
          *
          * http://www.freedesktop.org/wiki/Software/systemd/RootStorageDaemons */
-        if (count == 1 && c == '@')
+        if (cmdline[0] == '@')
                 return true;
 
         return false;
 }
 
+static bool pid_is_gone(pid_t pid, bool *ret_child) {
+        pid_t k;
+
+        /* A child that is still running will send us SIGCHLD when it
+         * exits. If it has exited, we reap it right here. */
+        k = waitpid(pid, NULL, WNOHANG);
+        if (k == 0) {
+                *ret_child = true;
+                return false;
+        }
+        if (k > 0)
+                return true;
+
+        *ret_child = false;
+
+        /* We misuse getpgid as a check whether a process still
+         * exists. Zombies are gone as well, it is up to their parent
+         * to reap them. */
+        if (getpgid(pid) < 0 && errno == ESRCH)
+                return true;
+
+        return get_process_state(pid) == 'Z';
+}
+
 static void wait_for_children(Set *pids, sigset_t *mask) {
-        usec_t until;
+        usec_t until, poll = POLL_MIN_USEC;
 
         assert(mask);
 
@@ -84,9 +106,10 @@ static void wait_for_children(Set *pids, sigset_t *mask) {
 
         until = now(CLOCK_MONOTONIC) + TIMEOUT_USEC;
         for (;;) {
+                bool others = false;
                 struct timespec ts;
                 int k;
-                usec_t n;
+                usec_t n, timeout;
                 void *p;
                 Iterator i;
 
@@ -114,16 +137,12 @@ static void wait_for_children(Set *pids, sigset_t *mask) {
                 /* Now explicitly check who might be remaining, who
                  * might not be our child. */
                 SET_FOREACH(p, pids, i) {
+                        bool child;
 
-                        /* We misuse getpgid as a check whether a
-                         * process still exists. */
-                        if (getpgid(PTR_TO_PID(p)) >= 0)
-                                continue;
-
-                        if (errno != ESRCH)
-                                continue;
-
-                        set_remove(pids, p);
+                        if (pid_is_gone(PTR_TO_PID(p), &child))
+                                set_remove(pids, p);
+                        else if (!child)
+                                others = true;
                 }
 
                 if (set_isempty(pids))
@@ -133,7 +152,15 @@ static void wait_for_children(Set *pids, sigset_t *mask) {
                 if (n >= until)
                         return;
 
-                timespec_store(&ts, until - n);
+                /* If all we wait for are our children, SIGCHLD wakes
+                 * us up in time, otherwise check again soon */
+                timeout = until - n;
+                if (others) {
+                        timeout = MIN(timeout, poll);
+                        poll = MIN(poll * 2, POLL_MAX_USEC);
+                }
+
+                timespec_store(&ts, timeout);
                 k = sigtimedwait(mask, NULL, &ts);
                 if (k != SIGCHLD) {
 
@@ -149,6 +176,7 @@ static void wait_for_children(Set *pids, sigset_t *mask) {
 }
 
 static int killall(int sig, Set *pids, bool send_sighup) {
+        _cleanup_proc_snapshot_free_ ProcSnapshot *s = NULL;
         _cleanup_closedir_ DIR *dir = NULL;
         struct dirent *d;
 
@@ -167,14 +195,22 @@ static int killall(int sig, Set *pids, bool send_sighup) {
                 if (parse_pid(d->d_name, &pid) < 0)
                         continue;
 
-                if (ignore_proc(pid))
+                /* One snapshot, and its buffers, for all processes */
+                if (s)
+                        r = proc_snapshot_open(s, pid);
+                else
+                        r = proc_snapshot_new(pid, &s);
+                if (r < 0)
+                        continue;
+
+                if (ignore_proc(s))
                         continue;
 
                 if (sig == SIGKILL) {
-                        _cleanup_free_ char *s = NULL;
+                        const char *comm = NULL;
 
-                        get_process_comm(pid, &s);
-                        log_notice("Sending SIGKILL to PID "PID_FMT" (%s).", pid, strna(s));
+                        (void) proc_snapshot_get_comm(s, &comm);
+                        log_notice("Sending SIGKILL to PID "PID_FMT" (%s).", pid, strna(comm));
                 }
 
                 if (kill(pid, sig) >= 0) {
@@ -29,6 +29,7 @@
 static inline int unit_find_dropin_paths(Unit *u, char ***paths) {
         return unit_file_find_dropin_paths(u->manager->lookup_paths.unit_path,
                                            u->manager->unit_path_cache,
+                                           u->manager->dir_cache,
                                            u->names,
                                            paths);
 }
@@ -1520,7 +1520,6 @@ int config_parse_path_spec(const char *unit,
         s->path = path_kill_slashes(k);
         k = NULL;
         s->type = b;
-        s->inotify_fd = -1;
 
         LIST_PREPEND(spec, p->specs, s);
 
@@ -3513,9 +3512,9 @@ static int load_from_path(Unit *u, const char *path) {
                         return r;
         }
 
-        free(u->fragment_path);
-        u->fragment_path = filename;
-        filename = NULL;
+        r = strintern_replace(&u->fragment_path, filename);
+        if (r < 0)
+                return r;
 
         u->fragment_mtime = timespec_load(&st.st_mtim);
 
@@ -3577,7 +3576,7 @@ int unit_load_fragment(Unit *u) {
                         /* Hmm, this didn't work? Then let's get rid
                          * of the fragment path stored for us, so that
                          * we don't point to an invalid location. */
-                        u->fragment_path = mfree(u->fragment_path);
+                        u->fragment_path = strintern_unref(u->fragment_path);
         }
 
         /* Look for a template */
@@ -109,6 +109,10 @@ static struct rlimit *arg_default_rlimit[_RLIMIT_MAX] = {};
 static uint64_t arg_capability_bounding_set_drop = 0;
 static nsec_t arg_timer_slack_nsec = NSEC_INFINITY;
 static usec_t arg_default_timer_accuracy_usec = 1 * USEC_PER_MINUTE;
+static usec_t arg_dbus_signal_batch_usec = 0;
+static usec_t arg_accounting_cache_usec = 0;
+static size_t arg_kdbus_bloom_size = 0;
+static unsigned arg_kdbus_bloom_n_hash = 0;
 static Set* arg_syscall_archs = NULL;
 static FILE* arg_serialization = NULL;
 static bool arg_default_cpu_accounting = false;
@@ -650,6 +654,10 @@ static int parse_config_file(void) {
 #endif
                 { "Manager", "TimerSlackNSec",            config_parse_nsec,             0, &arg_timer_slack_nsec                  },
                 { "Manager", "DefaultTimerAccuracySec",   config_parse_sec,              0, &arg_default_timer_accuracy_usec       },
+                { "Manager", "DBusSignalBatchSec",        config_parse_sec,              0, &arg_dbus_signal_batch_usec            },
+                { "Manager", "AccountingCacheSec",        config_parse_sec,              0, &arg_accounting_cache_usec             },
+                { "Manager", "KDBusBloomSize",            config_parse_iec_size,         0, &arg_kdbus_bloom_size                  },
+                { "Manager", "KDBusBloomHashes",          config_parse_unsigned,         0, &arg_kdbus_bloom_n_hash                },
                 { "Manager", "DefaultStandardOutput",     config_parse_output,           0, &arg_default_std_output                },
                 { "Manager", "DefaultStandardError",      config_parse_output,           0, &arg_default_std_error                 },
                 { "Manager", "DefaultTimeoutStartSec",    config_parse_sec,              0, &arg_default_timeout_start_usec        },
@@ -696,6 +704,10 @@ static void manager_set_defaults(Manager *m) {
         assert(m);
 
         m->default_timer_accuracy_usec = arg_default_timer_accuracy_usec;
+        m->dbus_signal_batch_usec = arg_dbus_signal_batch_usec;
+        m->accounting_cache_usec = arg_accounting_cache_usec;
+        m->kdbus_bloom_size = arg_kdbus_bloom_size;
+        m->kdbus_bloom_n_hash = arg_kdbus_bloom_n_hash;
         m->default_std_output = arg_default_std_output;
         m->default_std_error = arg_default_std_error;
         m->default_timeout_start_usec = arg_default_timeout_start_usec;
@@ -1538,6 +1550,9 @@ int main(int argc, char *argv[]) {
         /* Open the logging devices, if possible and necessary */
         log_open();
 
+        /* Don't let our own debug output hold up the main loop */
+        log_set_buffered(true);
+
         if (arg_show_status == _SHOW_STATUS_UNSET)
                 arg_show_status = SHOW_STATUS_YES;
 
@@ -1836,6 +1851,10 @@ int main(int argc, char *argv[]) {
 finish:
         pager_close();
 
+        /* Whatever comes next gets the messages out synchronously,
+         * before we exec something else */
+        log_set_buffered(false);
+
         if (m)
                 arg_shutdown_watchdog = m->shutdown_watchdog;
         m = manager_free(m);
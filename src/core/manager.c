@@ -68,6 +68,9 @@
 #include "process-util.h"
 #include "terminal-util.h"
 #include "signal-util.h"
+#include "siphash24.h"
+#include "fileio.h"
+#include "async.h"
 #include "dbus.h"
 #include "dbus-unit.h"
 #include "dbus-job.h"
@@ -86,6 +89,8 @@ static int manager_dispatch_time_change_fd(sd_event_source *source, int fd, uint
 static int manager_dispatch_idle_pipe_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_jobs_in_progress(sd_event_source *source, usec_t usec, void *userdata);
 static int manager_dispatch_run_queue(sd_event_source *source, void *userdata);
+static int manager_dispatch_sigchld_event(sd_event_source *source, void *userdata);
+static int manager_dispatch_gc_event(sd_event_source *source, void *userdata);
 static int manager_run_generators(Manager *m);
 static void manager_undo_generators(Manager *m);
 
@@ -572,7 +577,7 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
 
         m->pin_cgroupfs_fd = m->notify_fd = m->signal_fd = m->time_change_fd =
                 m->dev_autofs_fd = m->private_listen_fd = m->kdbus_fd = m->utab_inotify_fd =
-                m->cgroup_inotify_fd = -1;
+                m->cgroup_inotify_fd = m->path_inotify_fd = -1;
         m->current_job_id = 1; /* start as id #1, so that we can leave #0 around as "null-like" value */
 
         m->ask_password_inotify_fd = -1;
@@ -588,7 +593,7 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
         if (r < 0)
                 goto fail;
 
-        r = hashmap_ensure_allocated(&m->units, &string_hash_ops);
+        r = hashmap_ensure_allocated(&m->units, &fast_string_hash_ops);
         if (r < 0)
                 goto fail;
 
@@ -596,7 +601,7 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
         if (r < 0)
                 goto fail;
 
-        r = hashmap_ensure_allocated(&m->cgroup_unit, &string_hash_ops);
+        r = hashmap_ensure_allocated(&m->cgroup_unit, &fast_string_hash_ops);
         if (r < 0)
                 goto fail;
 
@@ -604,6 +609,12 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
         if (r < 0)
                 goto fail;
 
+        m->dir_cache = dir_cache_new();
+        if (!m->dir_cache) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
         r = sd_event_default(&m->event);
         if (r < 0)
                 goto fail;
@@ -622,6 +633,26 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
 
         (void) sd_event_source_set_description(m->run_queue_event_source, "manager-run-queue");
 
+        r = sd_event_add_defer(m->event, &m->sigchld_event_source, manager_dispatch_sigchld_event, m);
+        if (r < 0)
+                goto fail;
+
+        r = sd_event_source_set_enabled(m->sigchld_event_source, SD_EVENT_OFF);
+        if (r < 0)
+                goto fail;
+
+        (void) sd_event_source_set_description(m->sigchld_event_source, "manager-sigchld");
+
+        r = sd_event_add_defer(m->event, &m->gc_event_source, manager_dispatch_gc_event, m);
+        if (r < 0)
+                goto fail;
+
+        r = sd_event_source_set_enabled(m->gc_event_source, SD_EVENT_OFF);
+        if (r < 0)
+                goto fail;
+
+        (void) sd_event_source_set_description(m->gc_event_source, "manager-gc");
+
         r = manager_setup_signals(m);
         if (r < 0)
                 goto fail;
@@ -738,7 +769,17 @@ static int manager_setup_kdbus(Manager *m) {
 
         m->kdbus_fd = bus_kernel_create_bus(
                         m->running_as == MANAGER_SYSTEM ? "system" : "user",
-                        m->running_as == MANAGER_SYSTEM, &p);
+                        m->running_as == MANAGER_SYSTEM,
+                        m->kdbus_bloom_size, m->kdbus_bloom_n_hash, &p);
+        if (m->kdbus_fd == -EINVAL && (m->kdbus_bloom_size > 0 || m->kdbus_bloom_n_hash > 0)) {
+                /* Rather a bus with the default filter than none */
+                log_warning("Invalid bloom filter parameters configured, using defaults.");
+
+                m->kdbus_fd = bus_kernel_create_bus(
+                                m->running_as == MANAGER_SYSTEM ? "system" : "user",
+                                m->running_as == MANAGER_SYSTEM,
+                                0, 0, &p);
+        }
 
         if (m->kdbus_fd < 0)
                 return log_debug_errno(m->kdbus_fd, "Failed to set up kdbus: %m");
@@ -778,9 +819,18 @@ static unsigned manager_dispatch_cleanup_queue(Manager *m) {
                 n++;
         }
 
+        /* Nobody is iterating through dependency sets here, so now
+         * drop those that became empty. This doesn't count as work
+         * done, the units stay as they are. */
+        while ((u = m->release_queue))
+                unit_release_empty_dependencies(u);
+
         return n;
 }
 
+/* Units taken from the GC queue before yielding to the event loop */
+#define GC_DISPATCH_MAX 512U
+
 enum {
         GC_OFFSET_IN_PATH,  /* This one is on the path we were traveling */
         GC_OFFSET_UNSURE,   /* No clue */
@@ -845,11 +895,23 @@ static unsigned manager_dispatch_gc_queue(Manager *m) {
         Unit *u;
         unsigned n = 0;
         unsigned gc_marker;
+        int enabled;
 
         assert(m);
 
+        /* We took a break, and the event loop didn't get to run yet */
+        if (sd_event_source_get_enabled(m->gc_event_source, &enabled) >= 0 &&
+            enabled != SD_EVENT_OFF)
+                return 0;
+
+        if (!m->gc_queue)
+                return 0;
+
         /* log_debug("Running GC..."); */
 
+        /* Every run uses a new marker, hence it doesn't matter if
+         * units changed while we were interrupted. A unit is always
+         * swept completely within one run. */
         m->gc_marker += _GC_OFFSET_MAX;
         if (m->gc_marker + _GC_OFFSET_MAX <= _GC_OFFSET_MAX)
                 m->gc_marker = 1;
@@ -859,10 +921,17 @@ static unsigned manager_dispatch_gc_queue(Manager *m) {
         while ((u = m->gc_queue)) {
                 assert(u->in_gc_queue);
 
+                /* Don't block the event loop for too long if there
+                 * are lots of dead units to look at */
+                if (n >= GC_DISPATCH_MAX &&
+                    sd_event_source_set_enabled(m->gc_event_source, SD_EVENT_ONESHOT) >= 0)
+                        return n;
+
                 unit_gc_sweep(u, gc_marker);
 
                 LIST_REMOVE(gc_queue, m->gc_queue, u);
                 u->in_gc_queue = false;
+                m->n_in_gc_queue--;
 
                 n++;
 
@@ -880,6 +949,11 @@ static unsigned manager_dispatch_gc_queue(Manager *m) {
         return n;
 }
 
+static int manager_dispatch_gc_event(sd_event_source *source, void *userdata) {
+        /* Nothing to do, the main loop continues the GC run now */
+        return 0;
+}
+
 static void manager_clear_jobs_and_units(Manager *m) {
         Unit *u;
 
@@ -896,6 +970,7 @@ static void manager_clear_jobs_and_units(Manager *m) {
         assert(!m->dbus_job_queue);
         assert(!m->cleanup_queue);
         assert(!m->gc_queue);
+        assert(!m->release_queue);
 
         assert(hashmap_isempty(m->jobs));
         assert(hashmap_isempty(m->units));
@@ -939,6 +1014,11 @@ Manager* manager_free(Manager *m) {
         sd_event_source_unref(m->time_change_event_source);
         sd_event_source_unref(m->jobs_in_progress_event_source);
         sd_event_source_unref(m->run_queue_event_source);
+        sd_event_source_unref(m->sigchld_event_source);
+        sd_event_source_unref(m->dbus_batch_event_source);
+        sd_event_source_unref(m->gc_event_source);
+
+        free(m->notify_batch);
 
         safe_close(m->signal_fd);
         safe_close(m->notify_fd);
@@ -959,6 +1039,9 @@ Manager* manager_free(Manager *m) {
 
         hashmap_free(m->cgroup_unit);
         set_free_free(m->unit_path_cache);
+        dir_cache_free(m->dir_cache);
+        exec_env_file_cache_free(m->env_file_cache);
+        trace_ring_done(&m->trace);
 
         free(m->switch_root);
         free(m->switch_root_init);
@@ -1022,6 +1105,122 @@ static void manager_coldplug(Manager *m) {
         }
 }
 
+/* Unit files are parsed one by one on the main thread, as parsing
+ * links units to each other as it goes. But we can at least have
+ * the files read in from disk in parallel, while the main thread is
+ * busy parsing the ones that are already there. */
+#define PREFETCH_THREADS_MAX 4U
+#define PREFETCH_FILES_MIN 64U
+
+static void prefetch_path(const char *path, bool recurse) {
+        _cleanup_close_ int fd = -1;
+        struct stat st;
+
+        fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_NONBLOCK);
+        if (fd < 0)
+                return;
+
+        if (fstat(fd, &st) < 0)
+                return;
+
+        if (S_ISREG(st.st_mode))
+                (void) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+        else if (S_ISDIR(st.st_mode) && recurse) {
+                _cleanup_closedir_ DIR *d = NULL;
+                struct dirent *de;
+
+                /* Drop-in directories */
+                d = fdopendir(fd);
+                if (!d)
+                        return;
+                fd = -1;
+
+                FOREACH_DIRENT(de, d, return) {
+                        _cleanup_free_ char *p = NULL;
+
+                        if (!endswith(de->d_name, ".conf"))
+                                continue;
+
+                        p = strjoin(path, "/", de->d_name, NULL);
+                        if (!p)
+                                return;
+
+                        prefetch_path(p, false);
+                }
+        }
+}
+
+static void *prefetch_thread(void *p) {
+        char **l = p, **i;
+
+        STRV_FOREACH(i, l)
+                prefetch_path(*i, true);
+
+        strv_free(l);
+        return NULL;
+}
+
+static void manager_prefetch_unit_files(Manager *m) {
+        _cleanup_free_ char **all = NULL;
+        unsigned n, n_threads, k;
+        Iterator i;
+        char *p;
+        long c;
+
+        assert(m);
+
+        n = set_size(m->unit_path_cache);
+        if (n < PREFETCH_FILES_MIN)
+                return;
+
+        c = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = CLAMP(c > 0 ? (unsigned) c : 1U, 1U, PREFETCH_THREADS_MAX);
+
+        all = new0(char*, n + 1);
+        if (!all)
+                return;
+
+        k = 0;
+        SET_FOREACH(p, m->unit_path_cache, i) {
+                all[k] = strdup(p);
+                if (!all[k]) {
+                        all = strv_free(all);
+                        return;
+                }
+                k++;
+        }
+
+        /* Hand every thread an equal share, each of them frees its
+         * list when done */
+        for (k = 0; k < n_threads; k++) {
+                unsigned from = n * k / n_threads, to = n * (k + 1) / n_threads, j;
+                char **l;
+
+                l = new0(char*, to - from + 1);
+                if (!l)
+                        break;
+
+                memcpy(l, all + from, (to - from) * sizeof(char*));
+
+                if (asynchronous_job(prefetch_thread, l) < 0) {
+                        free(l);
+                        break;
+                }
+
+                for (j = from; j < to; j++)
+                        all[j] = NULL;
+        }
+
+        /* Free whatever we didn't manage to hand out */
+        for (; k < n_threads; k++) {
+                unsigned j;
+
+                for (j = n * k / n_threads; j < n * (k + 1) / n_threads; j++)
+                        free(all[j]);
+        }
+}
+
 static void manager_build_unit_path_cache(Manager *m) {
         char **i;
         _cleanup_closedir_ DIR *d = NULL;
@@ -1031,7 +1230,7 @@ static void manager_build_unit_path_cache(Manager *m) {
 
         set_free_free(m->unit_path_cache);
 
-        m->unit_path_cache = set_new(&string_hash_ops);
+        m->unit_path_cache = set_new(&fast_string_hash_ops);
         if (!m->unit_path_cache) {
                 log_error("Failed to allocate unit path cache.");
                 return;
@@ -1071,6 +1270,7 @@ static void manager_build_unit_path_cache(Manager *m) {
                 d = NULL;
         }
 
+        manager_prefetch_unit_files(m);
         return;
 
 fail:
@@ -1079,7 +1279,220 @@ fail:
         set_free_free(m->unit_path_cache);
         m->unit_path_cache = NULL;
 }
+static int digest_add(uint64_t *digest, const char *format, ...) _printf_(2, 3);
+
+static int digest_add(uint64_t *digest, const char *format, ...) {
+        static const uint8_t key[16] = {};
+        _cleanup_free_ char *s = NULL;
+        uint64_t h;
+        va_list ap;
+        int r;
+
+        va_start(ap, format);
+        r = vasprintf(&s, format, ap);
+        va_end(ap);
+        if (r < 0)
+                return -ENOMEM;
+
+        /* Entries are summed up, so that the result does not depend
+         * on the order directories are read in */
+        siphash24((uint8_t*) &h, s, r, key);
+        *digest += h;
+
+        return 0;
+}
+
+static int digest_file(uint64_t *digest, const char *path, const struct stat *st, bool by_content) {
+        _cleanup_free_ char *contents = NULL;
+        static const uint8_t key[16] = {};
+        uint64_t h;
+        size_t size;
+        int r;
+
+        if (!by_content)
+                return digest_add(digest, "%s f %llu %llu %llu " NSEC_FMT, path,
+                                  (unsigned long long) st->st_dev,
+                                  (unsigned long long) st->st_ino,
+                                  (unsigned long long) st->st_size,
+                                  timespec_load_nsec(&st->st_mtim));
+
+        r = read_full_file(path, &contents, &size);
+        if (r < 0)
+                return r;
+
+        siphash24((uint8_t*) &h, contents, size, key);
+        return digest_add(digest, "%s c %" PRIx64, path, h);
+}
+
+static int digest_includes(uint64_t *digest, const char *path) {
+        _cleanup_fclose_ FILE *f = NULL;
+        char l[LINE_MAX];
+        int r;
+
+        /* Unit files may pull in arbitrary other files with
+         * .include, which the directory walk cannot see. Included
+         * files cannot include further ones, hence one level is
+         * enough. */
+
+        f = fopen(path, "re");
+        if (!f)
+                return errno == ENOENT ? 0 : -errno;
+
+        FOREACH_LINE(l, f, return -errno) {
+                _cleanup_free_ char *fn = NULL;
+                struct stat st;
+                char *e;
+
+                e = strstrip(l);
+                if (!startswith(e, ".include "))
+                        continue;
+
+                fn = file_in_same_dir(path, strstrip(e + 9));
+                if (!fn)
+                        return -ENOMEM;
+
+                if (stat(fn, &st) < 0)
+                        r = digest_add(digest, "%s i -", fn);
+                else
+                        r = digest_file(digest, fn, &st, false);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int digest_dir(uint64_t *digest, const char *path, bool by_content, bool recurse) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int r;
+
+        d = opendir(path);
+        if (!d) {
+                if (errno == ENOENT)
+                        return digest_add(digest, "%s -", path);
+
+                return -errno;
+        }
+
+        FOREACH_DIRENT(de, d, return -errno) {
+                _cleanup_free_ char *p = NULL;
+                struct stat st;
+
+                p = strjoin(streq(path, "/") ? "" : path, "/", de->d_name, NULL);
+                if (!p)
+                        return -ENOMEM;
+
+                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                        if (errno == ENOENT)
+                                continue;
+
+                        return -errno;
+                }
 
+                if (S_ISLNK(st.st_mode)) {
+                        _cleanup_free_ char *target = NULL;
+
+                        r = readlinkat_malloc(dirfd(d), de->d_name, &target);
+                        if (r < 0)
+                                return r;
+
+                        r = digest_add(digest, "%s l %s", p, target);
+                        if (r < 0)
+                                return r;
+
+                        /* Generators link to units that are covered
+                         * on their own, but a "systemctl link"ed unit
+                         * may live anywhere */
+                        if (by_content || stat(p, &st) < 0 || !S_ISREG(st.st_mode))
+                                continue;
+
+                        r = digest_file(digest, p, &st, false);
+                        if (r < 0)
+                                return r;
+
+                        /* .include is relative to where the link
+                         * points to */
+                        if (recurse) {
+                                _cleanup_free_ char *resolved = NULL;
+
+                                resolved = canonicalize_file_name(p);
+                                if (resolved)
+                                        r = digest_includes(digest, resolved);
+                        }
+
+                } else if (S_ISREG(st.st_mode)) {
+                        r = digest_file(digest, p, &st, by_content);
+
+                        /* Drop-ins cannot .include, only unit files
+                         * at the top of a search path directory can */
+                        if (r >= 0 && recurse)
+                                r = digest_includes(digest, p);
+                }
+
+                else if (S_ISDIR(st.st_mode) && recurse) {
+                        /* The .wants/, .requires/ and .d/ directories */
+                        r = digest_add(digest, "%s d", p);
+                        if (r < 0)
+                                return r;
+
+                        r = digest_dir(digest, p, by_content, false);
+                } else
+                        continue;
+
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int manager_digest_unit_paths(Manager *m, uint64_t *ret) {
+        uint64_t digest = 0;
+        unsigned n = 0;
+        char **i;
+        int r;
+
+        assert(m);
+        assert(ret);
+
+        /* Calculates a fingerprint of everything that goes into
+         * loading units: the search path, the names, link targets
+         * and inode, size and mtime of all unit files and drop-ins
+         * in it. Generator output is recreated on every reload,
+         * hence is fingerprinted by contents instead. */
+
+        STRV_FOREACH(i, m->lookup_paths.unit_path) {
+                bool by_content;
+
+                by_content = (m->generator_unit_path && path_equal(*i, m->generator_unit_path)) ||
+                             (m->generator_unit_path_early && path_equal(*i, m->generator_unit_path_early)) ||
+                             (m->generator_unit_path_late && path_equal(*i, m->generator_unit_path_late));
+
+                r = digest_add(&digest, "%u %s", n++, *i);
+                if (r < 0)
+                        return r;
+
+                r = digest_dir(&digest, *i, by_content, true);
+                if (r < 0)
+                        return r;
+        }
+
+        *ret = digest;
+        return 0;
+}
+
+static void manager_update_unit_path_digest(Manager *m) {
+        int r;
+
+        assert(m);
+
+        r = manager_digest_unit_paths(m, &m->unit_path_digest);
+        if (r < 0)
+                log_debug_errno(r, "Failed to fingerprint unit search path, next reload will be a full one: %m");
+
+        m->unit_path_digest_valid = r >= 0;
+}
 
 static int manager_distribute_fds(Manager *m, FDSet *fds) {
         Unit *u;
@@ -1124,6 +1537,7 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
                 return r;
 
         manager_build_unit_path_cache(m);
+        manager_update_unit_path_digest(m);
 
         /* If we will deserialize make sure that during enumeration
          * this is already known, so we increase the counter here
@@ -1181,6 +1595,7 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
 int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool override, sd_bus_error *e, Job **_ret) {
         int r;
         Transaction *tr;
+        usec_t ts;
 
         assert(m);
         assert(type < _JOB_TYPE_MAX);
@@ -1197,10 +1612,14 @@ int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool ove
 
         type = job_type_collapse(type, unit);
 
+        ts = now(CLOCK_MONOTONIC);
+
         tr = transaction_new(mode == JOB_REPLACE_IRREVERSIBLY);
         if (!tr)
                 return -ENOMEM;
 
+        tr->isolate = mode == JOB_ISOLATE;
+
         r = transaction_add_job_and_dependencies(tr, type, unit, NULL, true, override, false,
                                                  mode == JOB_IGNORE_DEPENDENCIES || mode == JOB_IGNORE_REQUIREMENTS,
                                                  mode == JOB_IGNORE_DEPENDENCIES, e);
@@ -1225,11 +1644,75 @@ int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool ove
                 *_ret = tr->anchor_job;
 
         transaction_free(tr);
+        manager_trace(m, TRACE_PHASE_TRANSACTION, unit->id, ts);
+        return 0;
+
+tr_abort:
+        transaction_abort(tr);
+        transaction_free(tr);
+        manager_trace(m, TRACE_PHASE_TRANSACTION, unit->id, ts);
+        return r;
+}
+
+int manager_add_jobs(Manager *m, JobType type, Unit **units, unsigned n_units, JobMode mode, bool override, sd_bus_error *e, Job **jobs) {
+        Transaction *tr;
+        unsigned i;
+        usec_t ts;
+        int r;
+
+        assert(m);
+        assert(type < _JOB_TYPE_MAX);
+        assert(units);
+        assert(n_units > 0);
+        assert(mode < _JOB_MODE_MAX);
+        assert(jobs);
+
+        /* Like manager_add_job(), but enqueues jobs for all units in
+         * a single transaction, so that either all of them or none
+         * are. The first unit's job is the anchor, the others are
+         * pulled in by it as if it required them. */
+
+        if (mode == JOB_ISOLATE)
+                return sd_bus_error_setf(e, SD_BUS_ERROR_INVALID_ARGS, "Isolate is only valid for a single unit.");
+
+        ts = now(CLOCK_MONOTONIC);
+
+        tr = transaction_new(mode == JOB_REPLACE_IRREVERSIBLY);
+        if (!tr)
+                return -ENOMEM;
+
+        for (i = 0; i < n_units; i++) {
+                log_unit_debug(units[i], "Trying to enqueue job %s/%s/%s", units[i]->id, job_type_to_string(type), job_mode_to_string(mode));
+
+                r = transaction_add_job_and_dependencies(tr, job_type_collapse(type, units[i]), units[i], tr->anchor_job, true, override, false,
+                                                         mode == JOB_IGNORE_DEPENDENCIES || mode == JOB_IGNORE_REQUIREMENTS,
+                                                         mode == JOB_IGNORE_DEPENDENCIES, e);
+                if (r < 0)
+                        goto tr_abort;
+        }
+
+        r = transaction_activate(tr, m, mode, e);
+        if (r < 0)
+                goto tr_abort;
+
+        /* Jobs that turned out to be redundant have been dropped,
+         * those units have no job */
+        for (i = 0; i < n_units; i++) {
+                jobs[i] = units[i]->job;
+
+                if (jobs[i])
+                        log_unit_debug(units[i], "Enqueued job %s/%s as %u", units[i]->id,
+                                       job_type_to_string(jobs[i]->type), (unsigned) jobs[i]->id);
+        }
+
+        transaction_free(tr);
+        manager_trace(m, TRACE_PHASE_TRANSACTION, units[0]->id, ts);
         return 0;
 
 tr_abort:
         transaction_abort(tr);
         transaction_free(tr);
+        manager_trace(m, TRACE_PHASE_TRANSACTION, units[0]->id, ts);
         return r;
 }
 
@@ -1327,7 +1810,7 @@ int manager_load_unit_prepare(
                 return -ENOMEM;
 
         if (path) {
-                ret->fragment_path = strdup(path);
+                ret->fragment_path = strintern(path);
                 if (!ret->fragment_path) {
                         unit_free(ret);
                         return -ENOMEM;
@@ -1433,6 +1916,56 @@ static int manager_dispatch_run_queue(sd_event_source *source, void *userdata) {
         return 1;
 }
 
+static int manager_dispatch_dbus_batch(sd_event_source *source, usec_t usec, void *userdata) {
+        /* Nothing to do here, the main loop will dispatch the D-Bus
+         * queue now that we woke it up */
+        return 0;
+}
+
+static bool manager_dbus_queue_hold(Manager *m) {
+        usec_t n, next;
+        int r;
+
+        assert(m);
+
+        /* If signal batching is enabled, dispatch the queue at most
+         * once per interval, so that all state changes of a unit in
+         * the meantime are merged into a single signal. */
+
+        if (m->dbus_signal_batch_usec <= 0)
+                return false;
+
+        if (m->exit_code != MANAGER_OK)
+                return false;
+
+        if (!m->dbus_unit_queue && !m->dbus_job_queue)
+                return false;
+
+        n = now(CLOCK_MONOTONIC);
+        if (m->dbus_signal_batch_usec >= USEC_INFINITY - m->dbus_queue_dispatch_timestamp)
+                next = USEC_INFINITY;
+        else
+                next = m->dbus_queue_dispatch_timestamp + m->dbus_signal_batch_usec;
+        if (n >= next)
+                return false;
+
+        if (m->dbus_batch_event_source) {
+                r = sd_event_source_set_time(m->dbus_batch_event_source, next);
+                if (r >= 0)
+                        r = sd_event_source_set_enabled(m->dbus_batch_event_source, SD_EVENT_ONESHOT);
+        } else {
+                r = sd_event_add_time(m->event, &m->dbus_batch_event_source, CLOCK_MONOTONIC, next, 0, manager_dispatch_dbus_batch, m);
+                if (r >= 0)
+                        (void) sd_event_source_set_description(m->dbus_batch_event_source, "manager-dbus-batch");
+        }
+        if (r < 0) {
+                log_warning_errno(r, "Failed to arm D-Bus batch timer, sending signals right away: %m");
+                return false;
+        }
+
+        return true;
+}
+
 static unsigned manager_dispatch_dbus_queue(Manager *m) {
         Job *j;
         Unit *u;
@@ -1443,8 +1976,14 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
         if (m->dispatching_dbus_queue)
                 return 0;
 
+        if (manager_dbus_queue_hold(m))
+                return 0;
+
         m->dispatching_dbus_queue = true;
 
+        if (m->dbus_signal_batch_usec > 0 && (m->dbus_unit_queue || m->dbus_job_queue))
+                m->dbus_queue_dispatch_timestamp = now(CLOCK_MONOTONIC);
+
         while ((u = m->dbus_unit_queue)) {
                 assert(u->in_dbus_queue);
 
@@ -1473,29 +2012,226 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
         return n;
 }
 
-static void manager_invoke_notify_message(Manager *m, Unit *u, pid_t pid, char *buf, size_t n, FDSet *fds) {
-        _cleanup_strv_free_ char **tags = NULL;
+/* Datagrams read from the notification socket with a single system
+ * call, and the upper bound for datagrams handled per wakeup */
+#define NOTIFY_BATCH_MAX 16U
+#define NOTIFY_DISPATCH_MAX 256U
 
-        assert(m);
-        assert(u);
-        assert(buf);
-        assert(n > 0);
+typedef union NotifyControl {
+        struct cmsghdr cmsghdr;
+        uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
+                    CMSG_SPACE(sizeof(int) * NOTIFY_FD_MAX)];
+} NotifyControl;
 
-        tags = strv_split(buf, "\n\r");
-        if (!tags) {
-                log_oom();
-                return;
+struct NotifyBatch {
+        struct mmsghdr msgs[NOTIFY_BATCH_MAX];
+        struct iovec iovec[NOTIFY_BATCH_MAX];
+        NotifyControl control[NOTIFY_BATCH_MAX];
+        char buffer[NOTIFY_BATCH_MAX][NOTIFY_BUFFER_MAX + 1]; /* Leave room for trailing NUL */
+};
+
+typedef enum NotifyKind {
+        NOTIFY_OTHER,
+        NOTIFY_WATCHDOG,
+        NOTIFY_STATUS,
+} NotifyKind;
+
+static NotifyKind notify_kind(const char *buf, size_t n) {
+        const char *e;
+
+        /* Services sending keep-alives or status updates at a high
+         * rate send messages consisting of nothing else. Recognize
+         * those, so that we can skip parsing them and drop the ones
+         * superseded by a later one in the same batch. */
+
+        if (n > 0 && buf[n-1] == '\n')
+                n--;
+
+        if (n == strlen("WATCHDOG=1") && memcmp(buf, "WATCHDOG=1", n) == 0)
+                return NOTIFY_WATCHDOG;
+
+        if (n > strlen("STATUS=") && memcmp(buf, "STATUS=", strlen("STATUS=")) == 0) {
+                e = memchr(buf, '\n', n);
+                if (!e)
+                        e = memchr(buf, '\r', n);
+                if (!e && !memchr(buf, 0, n))
+                        return NOTIFY_STATUS;
         }
 
+        return NOTIFY_OTHER;
+}
+
+static struct ucred *notify_ucred(struct msghdr *msghdr, int **fd_array, unsigned *n_fds) {
+        struct ucred *ucred = NULL;
+        struct cmsghdr *cmsg;
+
+        assert(msghdr);
+
+        CMSG_FOREACH(cmsg, msghdr) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+
+                        if (fd_array) {
+                                *fd_array = (int*) CMSG_DATA(cmsg);
+                                *n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        }
+
+                } else if (cmsg->cmsg_level == SOL_SOCKET &&
+                           cmsg->cmsg_type == SCM_CREDENTIALS &&
+                           cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+
+                        ucred = (struct ucred*) CMSG_DATA(cmsg);
+                }
+        }
+
+        return ucred;
+}
+
+static bool notify_superseded(NotifyBatch *b, unsigned i, unsigned n, const NotifyKind kind[]) {
+        struct ucred *ucred, *other;
+        unsigned j;
+
+        /* A keep-alive or status-only message is redundant if the
+         * same process sends another one of the same kind later in
+         * this batch */
+
+        if (kind[i] == NOTIFY_OTHER)
+                return false;
+
+        ucred = notify_ucred(&b->msgs[i].msg_hdr, NULL, NULL);
+        if (!ucred || ucred->pid <= 0)
+                return false;
+
+        for (j = i + 1; j < n; j++) {
+                if (kind[j] != kind[i])
+                        continue;
+
+                other = notify_ucred(&b->msgs[j].msg_hdr, NULL, NULL);
+                if (other && other->pid == ucred->pid)
+                        return true;
+        }
+
+        return false;
+}
+
+static void manager_invoke_notify_message(Manager *m, Unit *u, pid_t pid, char **tags, FDSet *fds) {
+        assert(m);
+        assert(u);
+        assert(tags);
+
         if (UNIT_VTABLE(u)->notify_message)
                 UNIT_VTABLE(u)->notify_message(u, pid, tags, fds);
         else
                 log_unit_debug(u, "Got notification message for unit. Ignoring.");
 }
 
+static int manager_dispatch_notify_message(
+                Manager *m,
+                struct msghdr *msghdr,
+                char *buf,
+                size_t n,
+                NotifyKind kind,
+                pid_t *cached_pid,
+                Unit **cached_unit) {
+
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_strv_free_ char **split = NULL;
+        struct ucred *ucred;
+        bool found = false;
+        Unit *u1, *u2, *u3;
+        int *fd_array = NULL;
+        unsigned n_fds = 0;
+        char **tags;
+        int r;
+
+        assert(m);
+        assert(msghdr);
+        assert(buf);
+        assert(cached_pid);
+        assert(cached_unit);
+
+        ucred = notify_ucred(msghdr, &fd_array, &n_fds);
+
+        if (n_fds > 0) {
+                assert(fd_array);
+
+                r = fdset_new_array(&fds, fd_array, n_fds);
+                if (r < 0) {
+                        close_many(fd_array, n_fds);
+                        return log_oom();
+                }
+        }
+
+        if (!ucred || ucred->pid <= 0) {
+                log_warning("Received notify message without valid credentials. Ignoring.");
+                return 0;
+        }
+
+        if (msghdr->msg_flags & MSG_TRUNC) {
+                log_warning("Received notify message exceeded maximum size. Ignoring.");
+                return 0;
+        }
+
+        if (n == 0) {
+                log_debug("Received empty notify message from PID "PID_FMT". Ignoring.", ucred->pid);
+                return 0;
+        }
+
+        buf[n] = 0;
+
+        /* Keep-alives are by far the most common message, don't
+         * bother allocating anything for them */
+        if (kind == NOTIFY_WATCHDOG)
+                tags = STRV_MAKE("WATCHDOG=1");
+        else {
+                split = strv_split(buf, "\n\r");
+                if (!split)
+                        return log_oom();
+
+                tags = split;
+        }
+
+        /* The cgroup lookup needs to go to /proc, hence remember it
+         * for further messages from the same process in this batch. */
+        if (*cached_pid == ucred->pid)
+                u1 = *cached_unit;
+        else {
+                u1 = manager_get_unit_by_pid_cgroup(m, ucred->pid);
+                *cached_pid = ucred->pid;
+                *cached_unit = u1;
+        }
+
+        /* Notify every unit that might be interested, but try
+         * to avoid notifying the same one multiple times. */
+        if (u1) {
+                manager_invoke_notify_message(m, u1, ucred->pid, tags, fds);
+                found = true;
+        }
+
+        u2 = hashmap_get(m->watch_pids1, PID_TO_PTR(ucred->pid));
+        if (u2 && u2 != u1) {
+                manager_invoke_notify_message(m, u2, ucred->pid, tags, fds);
+                found = true;
+        }
+
+        u3 = hashmap_get(m->watch_pids2, PID_TO_PTR(ucred->pid));
+        if (u3 && u3 != u2 && u3 != u1) {
+                manager_invoke_notify_message(m, u3, ucred->pid, tags, fds);
+                found = true;
+        }
+
+        if (!found)
+                log_warning("Cannot find unit for notify message of PID "PID_FMT".", ucred->pid);
+
+        if (fdset_size(fds) > 0)
+                log_warning("Got auxiliary fds with notification message, closing all.");
+
+        return 0;
+}
+
 static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
         Manager *m = userdata;
-        ssize_t n;
+        NotifyBatch *b;
+        unsigned total = 0;
         int r;
 
         assert(m);
@@ -1506,100 +2242,73 @@ static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t
                 return 0;
         }
 
-        for (;;) {
-                _cleanup_fdset_free_ FDSet *fds = NULL;
-                char buf[NOTIFY_BUFFER_MAX+1];
-                struct iovec iovec = {
-                        .iov_base = buf,
-                        .iov_len = sizeof(buf)-1,
-                };
-                union {
-                        struct cmsghdr cmsghdr;
-                        uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
-                                    CMSG_SPACE(sizeof(int) * NOTIFY_FD_MAX)];
-                } control = {};
-                struct msghdr msghdr = {
-                        .msg_iov = &iovec,
-                        .msg_iovlen = 1,
-                        .msg_control = &control,
-                        .msg_controllen = sizeof(control),
-                };
-                struct cmsghdr *cmsg;
-                struct ucred *ucred = NULL;
-                bool found = false;
-                Unit *u1, *u2, *u3;
-                int *fd_array = NULL;
-                unsigned n_fds = 0;
-
-                n = recvmsg(m->notify_fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
-                if (n < 0) {
-                        if (errno == EAGAIN || errno == EINTR)
-                                break;
+        if (!m->notify_batch) {
+                m->notify_batch = new(NotifyBatch, 1);
+                if (!m->notify_batch)
+                        return log_oom();
+        }
 
-                        return -errno;
-                }
+        b = m->notify_batch;
 
-                CMSG_FOREACH(cmsg, &msghdr) {
-                        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        /* Read the datagrams in batches, but don't handle more than
+         * NOTIFY_DISPATCH_MAX of them per wakeup, so that processes
+         * flooding us don't starve the rest of the event loop. */
 
-                                fd_array = (int*) CMSG_DATA(cmsg);
-                                n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        while (total < NOTIFY_DISPATCH_MAX) {
+                NotifyKind kind[NOTIFY_BATCH_MAX];
+                Unit *cached_unit = NULL;
+                pid_t cached_pid = 0;
+                unsigned i;
+                int n;
 
-                        } else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                   cmsg->cmsg_type == SCM_CREDENTIALS &&
-                                   cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+                for (i = 0; i < NOTIFY_BATCH_MAX; i++) {
+                        b->iovec[i] = (struct iovec) {
+                                .iov_base = b->buffer[i],
+                                .iov_len = NOTIFY_BUFFER_MAX,
+                        };
 
-                                ucred = (struct ucred*) CMSG_DATA(cmsg);
-                        }
+                        b->msgs[i] = (struct mmsghdr) {
+                                .msg_hdr.msg_iov = &b->iovec[i],
+                                .msg_hdr.msg_iovlen = 1,
+                                .msg_hdr.msg_control = &b->control[i],
+                                .msg_hdr.msg_controllen = sizeof(b->control[i]),
+                        };
                 }
 
-                if (n_fds > 0) {
-                        assert(fd_array);
-
-                        r = fdset_new_array(&fds, fd_array, n_fds);
-                        if (r < 0) {
-                                close_many(fd_array, n_fds);
-                                return log_oom();
-                        }
-                }
+                n = recvmmsg(m->notify_fd, b->msgs, NOTIFY_BATCH_MAX, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+                if (n < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                break;
 
-                if (!ucred || ucred->pid <= 0) {
-                        log_warning("Received notify message without valid credentials. Ignoring.");
-                        continue;
+                        return -errno;
                 }
 
-                if ((size_t) n >= sizeof(buf)) {
-                        log_warning("Received notify message exceeded maximum size. Ignoring.");
-                        continue;
-                }
+                for (i = 0; i < (unsigned) n; i++) {
+                        int *fd_array = NULL;
+                        unsigned n_fds = 0;
 
-                buf[n] = 0;
+                        /* Messages carrying fds are never dropped,
+                         * as we need to close them */
+                        (void) notify_ucred(&b->msgs[i].msg_hdr, &fd_array, &n_fds);
 
-                /* Notify every unit that might be interested, but try
-                 * to avoid notifying the same one multiple times. */
-                u1 = manager_get_unit_by_pid_cgroup(m, ucred->pid);
-                if (u1) {
-                        manager_invoke_notify_message(m, u1, ucred->pid, buf, n, fds);
-                        found = true;
+                        kind[i] = n_fds > 0 ? NOTIFY_OTHER : notify_kind(b->buffer[i], b->msgs[i].msg_len);
                 }
 
-                u2 = hashmap_get(m->watch_pids1, PID_TO_PTR(ucred->pid));
-                if (u2 && u2 != u1) {
-                        manager_invoke_notify_message(m, u2, ucred->pid, buf, n, fds);
-                        found = true;
-                }
+                for (i = 0; i < (unsigned) n; i++) {
 
-                u3 = hashmap_get(m->watch_pids2, PID_TO_PTR(ucred->pid));
-                if (u3 && u3 != u2 && u3 != u1) {
-                        manager_invoke_notify_message(m, u3, ucred->pid, buf, n, fds);
-                        found = true;
+                        if (!(b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) &&
+                            notify_superseded(b, i, n, kind))
+                                continue;
+
+                        r = manager_dispatch_notify_message(m, &b->msgs[i].msg_hdr, b->buffer[i], b->msgs[i].msg_len, kind[i], &cached_pid, &cached_unit);
+                        if (r < 0)
+                                return r;
                 }
 
-                if (!found)
-                        log_warning("Cannot find unit for notify message of PID "PID_FMT".", ucred->pid);
+                total += n;
 
-                if (fdset_size(fds) > 0)
-                        log_warning("Got auxiliary fds with notification message, closing all.");
+                if ((unsigned) n < NOTIFY_BATCH_MAX)
+                        break;
         }
 
         return 0;
@@ -1616,12 +2325,22 @@ static void invoke_sigchld_event(Manager *m, Unit *u, siginfo_t *si) {
         UNIT_VTABLE(u)->sigchld_event(u, si->si_pid, si->si_code, si->si_status);
 }
 
+/* Don't starve everything else when lots of children exit at once */
+#define SIGCHLD_DISPATCH_MAX 128U
+
 static int manager_dispatch_sigchld(Manager *m) {
+        unsigned n = 0;
+
         assert(m);
 
         for (;;) {
                 siginfo_t si = {};
 
+                /* Leave the rest to the next event loop iteration */
+                if (n >= SIGCHLD_DISPATCH_MAX &&
+                    sd_event_source_set_enabled(m->sigchld_event_source, SD_EVENT_ONESHOT) >= 0)
+                        break;
+
                 /* First we call waitd() for a PID and do not reap the
                  * zombie. That way we can still access /proc/$PID for
                  * it while it is a zombie. */
@@ -1643,7 +2362,8 @@ static int manager_dispatch_sigchld(Manager *m) {
                         _cleanup_free_ char *name = NULL;
                         Unit *u1, *u2, *u3;
 
-                        get_process_comm(si.si_pid, &name);
+                        if (log_get_max_level() >= LOG_DEBUG)
+                                get_process_comm(si.si_pid, &name);
 
                         log_debug("Child "PID_FMT" (%s) died (code=%s, status=%i/%s)",
                                   si.si_pid, strna(name),
@@ -1673,11 +2393,22 @@ static int manager_dispatch_sigchld(Manager *m) {
 
                         return -errno;
                 }
+
+                n++;
         }
 
         return 0;
 }
 
+static int manager_dispatch_sigchld_event(sd_event_source *source, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        manager_dispatch_sigchld(m);
+        return 0;
+}
+
 static int manager_start_target(Manager *m, const char *name, JobMode mode) {
         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         int r;
@@ -2023,6 +2754,9 @@ int manager_loop(Manager *m) {
                 if (manager_dispatch_cgroup_queue(m) > 0)
                         continue;
 
+                if (manager_dispatch_cgroup_empty_queue(m) > 0)
+                        continue;
+
                 if (manager_dispatch_dbus_queue(m) > 0)
                         continue;
 
@@ -2486,45 +3220,47 @@ finish:
         return r;
 }
 
-int manager_reload(Manager *m) {
-        int r, q;
-        _cleanup_fclose_ FILE *f = NULL;
-        _cleanup_fdset_free_ FDSet *fds = NULL;
+static void manager_refresh_unit_mtimes(Manager *m) {
+        struct stat st;
+        Iterator i;
+        Unit *u;
 
         assert(m);
 
-        r = manager_open_serialization(m, &f);
-        if (r < 0)
-                return r;
+        /* The generators have just recreated their output, with the
+         * same contents but new timestamps. Don't let
+         * unit_need_daemon_reload() get confused by that. */
 
-        m->n_reloading ++;
-        bus_manager_send_reloading(m, true);
+        HASHMAP_FOREACH(u, m->units, i) {
+                if (u->fragment_path && u->fragment_mtime > 0 && stat(u->fragment_path, &st) >= 0)
+                        u->fragment_mtime = timespec_load(&st.st_mtim);
 
-        fds = fdset_new();
-        if (!fds) {
-                m->n_reloading --;
-                return -ENOMEM;
-        }
+                if (u->source_path && u->source_mtime > 0 && stat(u->source_path, &st) >= 0)
+                        u->source_mtime = timespec_load(&st.st_mtim);
 
-        r = manager_serialize(m, f, fds, false);
-        if (r < 0) {
-                m->n_reloading --;
-                return r;
+                if (!strv_isempty(u->dropin_paths))
+                        u->dropin_mtime = now(CLOCK_REALTIME);
         }
+}
 
-        if (fseeko(f, 0, SEEK_SET) < 0) {
-                m->n_reloading --;
-                return -errno;
-        }
+int manager_reload(Manager *m) {
+        int r = 0, q;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        uint64_t digest;
+        bool unchanged;
 
-        /* From here on there is no way back. */
-        manager_clear_jobs_and_units(m);
+        assert(m);
+
+        m->n_reloading ++;
+        bus_manager_send_reloading(m, true);
+
+        /* Find new unit paths */
         manager_undo_generators(m);
         lookup_paths_free(&m->lookup_paths);
 
-        /* Find new unit paths */
         q = manager_run_generators(m);
-        if (q < 0 && r >= 0)
+        if (q < 0)
                 r = q;
 
         q = lookup_paths_init(
@@ -2538,6 +3274,54 @@ int manager_reload(Manager *m) {
 
         manager_build_unit_path_cache(m);
 
+        /* If not a single unit file, drop-in or symlink changed,
+         * reloading all units from scratch would leave us exactly
+         * where we are, so don't bother. */
+        q = manager_digest_unit_paths(m, &digest);
+        unchanged = r >= 0 && q >= 0 && m->unit_path_digest_valid && digest == m->unit_path_digest;
+        m->unit_path_digest = digest;
+        m->unit_path_digest_valid = q >= 0;
+
+        if (unchanged) {
+                log_debug("Unit search path unchanged, not reloading units.");
+
+                manager_refresh_unit_mtimes(m);
+
+                m->n_reloading--;
+                m->send_reloading_done = true;
+                return 0;
+        }
+
+        q = manager_open_serialization(m, &f);
+        if (q < 0) {
+                m->unit_path_digest_valid = false;
+                m->n_reloading --;
+                return q;
+        }
+
+        fds = fdset_new();
+        if (!fds) {
+                m->unit_path_digest_valid = false;
+                m->n_reloading --;
+                return -ENOMEM;
+        }
+
+        q = manager_serialize(m, f, fds, false);
+        if (q < 0) {
+                m->unit_path_digest_valid = false;
+                m->n_reloading --;
+                return q;
+        }
+
+        if (fseeko(f, 0, SEEK_SET) < 0) {
+                m->unit_path_digest_valid = false;
+                m->n_reloading --;
+                return -errno;
+        }
+
+        /* From here on there is no way back. */
+        manager_clear_jobs_and_units(m);
+
         /* First, enumerate what we can from all config files */
         q = manager_enumerate(m);
         if (q < 0 && r >= 0)
@@ -2782,10 +3566,30 @@ static void trim_generator_dir(Manager *m, char **generator) {
         return;
 }
 
+/* Generators mostly wait for the disk, hence run a few more than
+ * there are CPUs, but not all of them at once */
+#define GENERATORS_PER_CPU 2U
+#define GENERATORS_PARALLEL_MIN 4U
+
+static void generator_done(const char *path, usec_t begin, usec_t wall, usec_t cpu, void *userdata) {
+        char buf_wall[FORMAT_TIMESPAN_MAX], buf_cpu[FORMAT_TIMESPAN_MAX];
+        Manager *m = userdata;
+
+        assert(m);
+
+        log_debug("Generator %s finished after %s, %s of CPU time.",
+                  path,
+                  format_timespan(buf_wall, sizeof(buf_wall), wall, USEC_PER_MSEC),
+                  format_timespan(buf_cpu, sizeof(buf_cpu), cpu, USEC_PER_MSEC));
+
+        manager_trace_duration(m, TRACE_PHASE_GENERATOR, basename(path), begin, wall);
+}
+
 static int manager_run_generators(Manager *m) {
         _cleanup_strv_free_ char **paths = NULL;
         const char *argv[5];
         char **path;
+        long n_cpus;
         int r;
 
         assert(m);
@@ -2827,8 +3631,12 @@ static int manager_run_generators(Manager *m) {
         argv[3] = m->generator_unit_path_late;
         argv[4] = NULL;
 
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
         RUN_WITH_UMASK(0022)
-                execute_directories((const char* const*) paths, DEFAULT_TIMEOUT_USEC, (char**) argv);
+                execute_directories_full((const char* const*) paths, DEFAULT_TIMEOUT_USEC,
+                                         n_cpus > 0 ? MAX((unsigned) n_cpus * GENERATORS_PER_CPU, GENERATORS_PARALLEL_MIN) : GENERATORS_PARALLEL_MIN,
+                                         (char**) argv, generator_done, m);
 
 finish:
         trim_generator_dir(m, &m->generator_unit_path);
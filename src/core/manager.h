@@ -31,11 +31,13 @@
 #include "hashmap.h"
 #include "list.h"
 #include "ratelimit.h"
+#include "dir-cache.h"
 
 /* Enforce upper limit how many names we allow */
 #define MANAGER_MAX_NAMES 131072 /* 128K */
 
 typedef struct Manager Manager;
+typedef struct NotifyBatch NotifyBatch;
 
 typedef enum ManagerState {
         MANAGER_INITIALIZING,
@@ -73,6 +75,7 @@ typedef enum StatusType {
 #include "execute.h"
 #include "unit-name.h"
 #include "show-status.h"
+#include "trace.h"
 
 struct Manager {
         /* Note that the set of units we know of is allowed to be
@@ -106,9 +109,15 @@ struct Manager {
         /* Units to check when doing GC */
         LIST_HEAD(Unit, gc_queue);
 
+        /* Units whose emptied dependency sets are to be freed */
+        LIST_HEAD(Unit, release_queue);
+
         /* Units that should be realized */
         LIST_HEAD(Unit, cgroup_queue);
 
+        /* Units whose cgroup might have become empty */
+        LIST_HEAD(Unit, cgroup_empty_queue);
+
         sd_event *event;
 
         /* We use two hash tables here, since the same PID might be
@@ -128,8 +137,18 @@ struct Manager {
 
         sd_event_source *run_queue_event_source;
 
+        /* Picks up reaping children where the last iteration
+         * stopped */
+        sd_event_source *sigchld_event_source;
+
+        /* Wakes us up when the D-Bus queue may be dispatched again
+         * if signals are batched */
+        sd_event_source *dbus_batch_event_source;
+        usec_t dbus_queue_dispatch_timestamp;
+
         char *notify_socket;
         int notify_fd;
+        NotifyBatch *notify_batch;
         sd_event_source *notify_event_source;
 
         int signal_fd;
@@ -145,6 +164,21 @@ struct Manager {
         LookupPaths lookup_paths;
         Set *unit_path_cache;
 
+        /* Contents of the drop-in and .wants/.requires directories,
+         * kept across reloads and revalidated by mtime */
+        DirCache *dir_cache;
+
+        /* Parsed EnvironmentFile= files, path => EnvFileCacheEntry */
+        Hashmap *env_file_cache;
+
+        /* Durations of internal phases, see manager_trace() */
+        TraceRing trace;
+
+        /* Fingerprint of the unit search path contents as of the
+         * last full load, see manager_digest_unit_paths() */
+        uint64_t unit_path_digest;
+        bool unit_path_digest_valid;
+
         char **environment;
 
         usec_t runtime_watchdog;
@@ -180,6 +214,14 @@ struct Manager {
         sd_event_source *mount_event_source;
         int utab_inotify_fd;
         sd_event_source *mount_utab_event_source;
+        sd_event_source *mount_rescan_event_source;
+        usec_t mount_rescan_timestamp;
+        Hashmap *mountinfo_entries;
+
+        /* Data specific to the path subsystem */
+        int path_inotify_fd;
+        sd_event_source *path_inotify_event_source;
+        Hashmap *path_watches;
 
         /* Data specific to the swap filesystem */
         FILE *proc_swaps;
@@ -224,6 +266,10 @@ struct Manager {
         sd_event_source *cgroup_inotify_event_source;
         Hashmap *cgroup_inotify_wd_unit;
 
+        /* Number of cgroup attribute files units keep open for
+         * reading their resource counters */
+        unsigned n_cgroup_metric_fds;
+
         /* Make sure the user cannot accidentally unmount our cgroup
          * file system */
         int pin_cgroupfs_fd;
@@ -231,6 +277,10 @@ struct Manager {
         int gc_marker;
         unsigned n_in_gc_queue;
 
+        /* Enabled while a GC run is interrupted, to continue it after
+         * the event loop had its turn */
+        sd_event_source *gc_event_source;
+
         /* Flags */
         ManagerRunningAs running_as;
         ManagerExitCode exit_code:5;
@@ -260,6 +310,13 @@ struct Manager {
 
         usec_t default_timer_accuracy_usec;
 
+        usec_t dbus_signal_batch_usec;
+        usec_t accounting_cache_usec;
+
+        /* Zero for the defaults, only used when creating the bus */
+        size_t kdbus_bloom_size;
+        unsigned kdbus_bloom_n_hash;
+
         struct rlimit *rlimit[_RLIMIT_MAX];
 
         /* non-zero if we are reloading or reexecuting, */
@@ -323,6 +380,7 @@ int manager_load_unit(Manager *m, const char *name, const char *path, sd_bus_err
 int manager_load_unit_from_dbus_path(Manager *m, const char *s, sd_bus_error *e, Unit **_u);
 
 int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool force, sd_bus_error *e, Job **_ret);
+int manager_add_jobs(Manager *m, JobType type, Unit **units, unsigned n_units, JobMode mode, bool force, sd_bus_error *e, Job **jobs);
 int manager_add_job_by_name(Manager *m, JobType type, const char *name, JobMode mode, bool force, sd_bus_error *e, Job **_ret);
 
 void manager_dump_units(Manager *s, FILE *f, const char *prefix);
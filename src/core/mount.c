@@ -44,6 +44,22 @@
 
 #define RETRY_UMOUNT_MAX 32
 
+/* Don't process /proc/self/mountinfo more often than this, changes
+ * in between are coalesced into one pass */
+#define MOUNT_RESCAN_INTERVAL_USEC (100 * USEC_PER_MSEC)
+
+/* What we saw for a mount ID in /proc/self/mountinfo the last time,
+ * as is. unit is the name of the mount unit set up for it, or NULL if
+ * the entry is ignored, unit_what the unescaped source it was passed. */
+typedef struct MountInfoEntry {
+        char *what;
+        char *where;
+        char *options;
+        char *fstype;
+        char *unit;
+        char *unit_what;
+} MountInfoEntry;
+
 DEFINE_TRIVIAL_CLEANUP_FUNC(struct libmnt_table*, mnt_free_table);
 DEFINE_TRIVIAL_CLEANUP_FUNC(struct libmnt_iter*, mnt_free_iter);
 
@@ -65,6 +81,8 @@ static const UnitActiveState state_translation_table[_MOUNT_STATE_MAX] = {
 
 static int mount_dispatch_timer(sd_event_source *source, usec_t usec, void *userdata);
 static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+static int mount_dispatch_rescan(sd_event_source *source, usec_t usec, void *userdata);
+static int mount_process_proc_self_mountinfo(Manager *m);
 
 static bool mount_needs_network(const char *options, const char *fstype) {
         if (fstab_test_option(options, "_netdev\0"))
@@ -1467,7 +1485,7 @@ static int mount_setup_unit(
         if (changed)
                 unit_add_to_dbus_queue(u);
 
-        return 0;
+        return 1;
 
 fail:
         log_warning_errno(r, "Failed to set up mount unit: %m");
@@ -1478,9 +1496,117 @@ fail:
         return r;
 }
 
+static MountInfoEntry *mount_info_entry_free(MountInfoEntry *e) {
+        if (!e)
+                return NULL;
+
+        free(e->what);
+        free(e->where);
+        free(e->options);
+        free(e->fstype);
+        free(e->unit);
+        free(e->unit_what);
+        free(e);
+
+        return NULL;
+}
+
+static void mount_info_entries_free(Hashmap *h) {
+        MountInfoEntry *e;
+
+        while ((e = hashmap_steal_first(h)))
+                mount_info_entry_free(e);
+
+        hashmap_free(h);
+}
+
+static bool mount_info_entry_unchanged(
+                Manager *m,
+                MountInfoEntry *e,
+                const char *device,
+                const char *path,
+                const char *options,
+                const char *fstype) {
+
+        MountParameters *p;
+        Unit *u;
+
+        assert(m);
+        assert(e);
+
+        if (!streq(e->what, device) ||
+            !streq(e->where, path) ||
+            !streq_ptr(e->options, options) ||
+            !streq_ptr(e->fstype, fstype))
+                return false;
+
+        /* Nothing to do for ignored entries */
+        if (!e->unit)
+                return true;
+
+        /* The unit might have been garbage collected or reloaded
+         * since. Or it picked up the parameters of another mount on
+         * the same mount point, which might be gone again now, in
+         * which case they need to be read from this entry again. */
+        u = manager_get_unit(m, e->unit);
+        if (!u || !MOUNT(u)->from_proc_self_mountinfo)
+                return false;
+
+        p = &MOUNT(u)->parameters_proc_self_mountinfo;
+        if (!streq_ptr(p->what, e->unit_what) ||
+            !streq_ptr(p->options, options) ||
+            !streq_ptr(p->fstype, fstype))
+                return false;
+
+        MOUNT(u)->is_mounted = true;
+        MOUNT(u)->just_mounted = false;
+        MOUNT(u)->just_changed = false;
+
+        return true;
+}
+
+static int mount_info_entry_new(
+                const char *device,
+                const char *path,
+                const char *options,
+                const char *fstype,
+                const char *unit_what,
+                MountInfoEntry **ret) {
+
+        MountInfoEntry *e;
+
+        e = new0(MountInfoEntry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->what = strdup(device);
+        e->where = strdup(path);
+        e->options = strdup(strempty(options));
+        e->fstype = strdup(strempty(fstype));
+        if (!e->what || !e->where || !e->options || !e->fstype)
+                goto fail;
+
+        if (unit_what) {
+                if (unit_name_from_path(path, ".mount", &e->unit) < 0)
+                        goto fail;
+
+                e->unit_what = strdup(unit_what);
+                if (!e->unit_what)
+                        goto fail;
+        }
+
+        *ret = e;
+        return 0;
+
+fail:
+        mount_info_entry_free(e);
+        return -ENOMEM;
+}
+
 static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
         _cleanup_(mnt_free_tablep) struct libmnt_table *t = NULL;
         _cleanup_(mnt_free_iterp) struct libmnt_iter *i = NULL;
+        Hashmap *entries = NULL;
         int r = 0;
 
         assert(m);
@@ -1497,18 +1623,29 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
         if (r < 0)
                 return log_error_errno(r, "Failed to parse /proc/self/mountinfo: %m");
 
+        entries = hashmap_new(NULL);
+        if (!entries)
+                return log_oom();
+
+        /* Entries are remembered by mount ID, so that on the next
+         * change of the table only new or modified ones need to be
+         * unescaped and looked at in detail. */
+
         r = 0;
         for (;;) {
                 const char *device, *path, *options, *fstype;
                 _cleanup_free_ char *d = NULL, *p = NULL;
                 struct libmnt_fs *fs;
-                int k;
+                MountInfoEntry *e;
+                int k, id;
 
                 k = mnt_table_next_fs(t, i, &fs);
                 if (k == 1)
                         break;
-                if (k < 0)
-                        return log_error_errno(k, "Failed to get next entry from /proc/self/mountinfo: %m");
+                if (k < 0) {
+                        r = log_error_errno(k, "Failed to get next entry from /proc/self/mountinfo: %m");
+                        goto finish;
+                }
 
                 device = mnt_fs_get_source(fs);
                 path = mnt_fs_get_target(fs);
@@ -1518,19 +1655,57 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
                 if (!device || !path)
                         continue;
 
-                if (cunescape(device, UNESCAPE_RELAX, &d) < 0)
-                        return log_oom();
+                id = mnt_fs_get_id(fs);
 
-                if (cunescape(path, UNESCAPE_RELAX, &p) < 0)
-                        return log_oom();
+                e = id > 0 ? hashmap_remove(m->mountinfo_entries, INT_TO_PTR(id)) : NULL;
+                if (e) {
+                        /* When set_flags is false we are (re-)enumerating, and every unit is set up from scratch */
+                        if (set_flags && mount_info_entry_unchanged(m, e, device, path, strempty(options), strempty(fstype))) {
+                                if (hashmap_put(entries, INT_TO_PTR(id), e) < 0)
+                                        mount_info_entry_free(e);
+                                continue;
+                        }
+
+                        e = mount_info_entry_free(e);
+                }
+
+                if (cunescape(device, UNESCAPE_RELAX, &d) < 0) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                if (cunescape(path, UNESCAPE_RELAX, &p) < 0) {
+                        r = log_oom();
+                        goto finish;
+                }
 
                 (void) device_found_node(m, d, true, DEVICE_FOUND_MOUNT, set_flags);
 
                 k = mount_setup_unit(m, d, p, options, fstype, set_flags);
-                if (r == 0 && k < 0)
-                        r = k;
+                if (k < 0) {
+                        if (r == 0)
+                                r = k;
+                        continue;
+                }
+
+                if (id <= 0)
+                        continue;
+
+                /* The comparison is done on the raw strings, hence store them */
+                if (mount_info_entry_new(device, path, options, fstype, k > 0 ? d : NULL, &e) < 0) {
+                        log_oom();
+                        continue;
+                }
+
+                if (hashmap_put(entries, INT_TO_PTR(id), e) < 0)
+                        mount_info_entry_free(e);
         }
 
+finish:
+        /* Whatever is left over is gone from the table */
+        mount_info_entries_free(m->mountinfo_entries);
+        m->mountinfo_entries = entries;
+
         return r;
 }
 
@@ -1540,8 +1715,13 @@ static void mount_shutdown(Manager *m) {
         m->mount_event_source = sd_event_source_unref(m->mount_event_source);
         m->mount_utab_event_source = sd_event_source_unref(m->mount_utab_event_source);
 
+        m->mount_rescan_event_source = sd_event_source_unref(m->mount_rescan_event_source);
+
         m->proc_self_mountinfo = safe_fclose(m->proc_self_mountinfo);
         m->utab_inotify_fd = safe_close(m->utab_inotify_fd);
+
+        mount_info_entries_free(m->mountinfo_entries);
+        m->mountinfo_entries = NULL;
 }
 
 static int mount_get_timeout(Unit *u, uint64_t *timeout) {
@@ -1621,11 +1801,8 @@ fail:
 }
 
 static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        _cleanup_set_free_ Set *around = NULL, *gone = NULL;
         Manager *m = userdata;
-        const char *what;
-        Iterator i;
-        Unit *u;
+        usec_t n;
         int r;
 
         assert(m);
@@ -1672,6 +1849,55 @@ static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
                         return 0;
         }
 
+        /* During mount storms (e.g. many containers being started
+         * at once) the table would be parsed for every single
+         * change, hence delay the next pass a bit after each. */
+        n = now(CLOCK_MONOTONIC);
+        if (m->mount_rescan_timestamp + MOUNT_RESCAN_INTERVAL_USEC > n) {
+                usec_t next = m->mount_rescan_timestamp + MOUNT_RESCAN_INTERVAL_USEC;
+
+                if (m->mount_rescan_event_source) {
+                        r = sd_event_source_set_time(m->mount_rescan_event_source, next);
+                        if (r >= 0)
+                                r = sd_event_source_set_enabled(m->mount_rescan_event_source, SD_EVENT_ONESHOT);
+                } else {
+                        r = sd_event_add_time(m->event, &m->mount_rescan_event_source, CLOCK_MONOTONIC, next, 0, mount_dispatch_rescan, m);
+                        if (r >= 0) {
+                                /* Same priority as the IO event sources, see mount_enumerate() */
+                                (void) sd_event_source_set_priority(m->mount_rescan_event_source, -10);
+                                (void) sd_event_source_set_description(m->mount_rescan_event_source, "mount-rescan");
+                        }
+                }
+                if (r >= 0)
+                        return 0;
+
+                log_warning_errno(r, "Failed to delay processing of /proc/self/mountinfo, doing it right away: %m");
+        }
+
+        return mount_process_proc_self_mountinfo(m);
+}
+
+static int mount_dispatch_rescan(sd_event_source *source, usec_t usec, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        return mount_process_proc_self_mountinfo(m);
+}
+
+static int mount_process_proc_self_mountinfo(Manager *m) {
+        _cleanup_set_free_ Set *around = NULL, *gone = NULL;
+        const char *what;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(m);
+
+        m->mount_rescan_timestamp = now(CLOCK_MONOTONIC);
+        if (m->mount_rescan_event_source)
+                (void) sd_event_source_set_enabled(m->mount_rescan_event_source, SD_EVENT_OFF);
+
         r = mount_load_proc_self_mountinfo(m, true);
         if (r < 0) {
                 /* Reset flags, just in case, for later calls */
@@ -43,7 +43,147 @@ static const UnitActiveState state_translation_table[_PATH_STATE_MAX] = {
 
 static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 
-int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
+static int path_inotify_setup(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (m->path_inotify_fd >= 0)
+                return 0;
+
+        m->path_inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (m->path_inotify_fd < 0)
+                return -errno;
+
+        r = sd_event_add_io(m->event, &m->path_inotify_event_source, m->path_inotify_fd, EPOLLIN, path_dispatch_io, m);
+        if (r < 0) {
+                m->path_inotify_fd = safe_close(m->path_inotify_fd);
+                return r;
+        }
+
+        (void) sd_event_source_set_description(m->path_inotify_event_source, "path");
+
+        return 0;
+}
+
+static void path_watch_forget(Manager *m, PathWatch *w) {
+        assert(m);
+        assert(w);
+
+        if (w->wd < 0)
+                return;
+
+        hashmap_remove(m->path_watches, INT_TO_PTR(w->wd));
+        w->wd = -1;
+}
+
+static void path_watch_ref_free(Manager *m, PathWatchRef *ref) {
+        PathWatch *w;
+
+        assert(m);
+        assert(ref);
+
+        w = ref->watch;
+
+        LIST_REMOVE(refs, w->refs, ref);
+
+        if (ref->spec->primary == ref)
+                ref->spec->primary = NULL;
+
+        free(ref);
+
+        if (w->refs)
+                return;
+
+        if (w->wd >= 0)
+                (void) inotify_rm_watch(m->path_inotify_fd, w->wd);
+
+        path_watch_forget(m, w);
+        free(w);
+}
+
+static int path_spec_add_watch(PathSpec *s, uint32_t mask, PathWatchRef **ret) {
+        Manager *m = s->unit->manager;
+        PathWatchRef *ref;
+        PathWatch *w;
+        int wd, r;
+
+        assert(s);
+
+        r = path_inotify_setup(m);
+        if (r < 0)
+                return r;
+
+        /* Other path units might be watching the same inode for
+         * other events already. */
+        wd = inotify_add_watch(m->path_inotify_fd, s->path, mask|IN_MASK_ADD);
+        if (wd < 0)
+                return -errno;
+
+        w = hashmap_get(m->path_watches, INT_TO_PTR(wd));
+        if (!w) {
+                r = hashmap_ensure_allocated(&m->path_watches, NULL);
+                if (r < 0)
+                        goto fail;
+
+                w = new0(PathWatch, 1);
+                if (!w) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                w->wd = wd;
+
+                r = hashmap_put(m->path_watches, INT_TO_PTR(wd), w);
+                if (r < 0) {
+                        free(w);
+                        goto fail;
+                }
+        }
+
+        ref = new0(PathWatchRef, 1);
+        if (!ref) {
+                if (!w->refs) {
+                        path_watch_forget(m, w);
+                        free(w);
+                }
+
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        ref->watch = w;
+        ref->spec = s;
+        ref->mask = mask;
+
+        LIST_PREPEND(refs, w->refs, ref);
+        LIST_PREPEND(spec_refs, s->watch_refs, ref);
+
+        if (ret)
+                *ret = ref;
+
+        return 0;
+
+fail:
+        if (!hashmap_get(m->path_watches, INT_TO_PTR(wd)))
+                (void) inotify_rm_watch(m->path_inotify_fd, wd);
+
+        return r;
+}
+
+static void path_spec_unwatch_refs(PathSpec *s, PathWatchRef **refs) {
+        PathWatchRef *ref;
+
+        assert(s);
+        assert(refs);
+
+        while ((ref = *refs)) {
+                LIST_REMOVE(spec_refs, *refs, ref);
+                path_watch_ref_free(s->unit->manager, ref);
+        }
+}
+
+int path_spec_watch(PathSpec *s) {
 
         static const int flags_table[_PATH_TYPE_MAX] = {
                 [PATH_EXISTS] = IN_DELETE_SELF|IN_MOVE_SELF|IN_ATTRIB,
@@ -53,27 +193,20 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
                 [PATH_DIRECTORY_NOT_EMPTY] = IN_DELETE_SELF|IN_MOVE_SELF|IN_ATTRIB|IN_CREATE|IN_MOVED_TO
         };
 
+        PathWatchRef *old, *ref, *parent = NULL;
         bool exists = false;
-        char *slash, *oldslash = NULL;
+        char *slash;
         int r;
 
         assert(s);
         assert(s->unit);
-        assert(handler);
 
-        path_spec_unwatch(s);
-
-        s->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
-        if (s->inotify_fd < 0) {
-                r = -errno;
-                goto fail;
-        }
-
-        r = sd_event_add_io(s->unit->manager->event, &s->event_source, s->inotify_fd, EPOLLIN, handler, s);
-        if (r < 0)
-                goto fail;
-
-        (void) sd_event_source_set_description(s->event_source, "path");
+        /* Keep the old watches until the new ones are in place, so
+         * that the ones we'd add again anyway stay around, instead of
+         * being removed and created again. */
+        old = s->watch_refs;
+        s->watch_refs = NULL;
+        s->primary = NULL;
 
         /* This assumes the path was passed through path_kill_slashes()! */
 
@@ -91,57 +224,44 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
                 } else
                         flags = flags_table[s->type];
 
-                r = inotify_add_watch(s->inotify_fd, s->path, flags);
+                r = path_spec_add_watch(s, flags, &ref);
+                if (cut)
+                        *cut = tmp;
                 if (r < 0) {
-                        if (errno == EACCES || errno == ENOENT) {
-                                if (cut)
-                                        *cut = tmp;
+                        if (r == -EACCES || r == -ENOENT)
                                 break;
-                        }
 
-                        r = log_warning_errno(errno, "Failed to add watch on %s: %s", s->path, errno == ENOSPC ? "too many watches" : strerror(-r));
-                        if (cut)
-                                *cut = tmp;
+                        log_warning_errno(r, "Failed to add watch on %s: %s", s->path, r == -ENOSPC ? "too many watches" : strerror(-r));
                         goto fail;
-                } else {
-                        exists = true;
-
-                        /* Path exists, we don't need to watch parent
-                           too closely. */
-                        if (oldslash) {
-                                char *cut2 = oldslash + (oldslash == s->path);
-                                char tmp2 = *cut2;
-                                *cut2 = '\0';
-
-                                inotify_add_watch(s->inotify_fd, s->path, IN_MOVE_SELF);
-                                /* Error is ignored, the worst can happen is
-                                   we get spurious events. */
-
-                                *cut2 = tmp2;
-                        }
                 }
 
-                if (cut)
-                        *cut = tmp;
+                exists = true;
+
+                /* Path exists, we don't need to watch parent
+                   too closely. */
+                if (parent)
+                        parent->mask = IN_MOVE_SELF;
 
-                if (slash)
-                        oldslash = slash;
-                else {
+                if (!slash) {
                         /* whole path has been iterated over */
-                        s->primary_wd = r;
+                        s->primary = ref;
                         break;
                 }
+
+                parent = ref;
         }
 
         if (!exists) {
-                r = log_error_errno(errno, "Failed to add watch on any of the components of %s: %m", s->path);
+                r = log_error_errno(r, "Failed to add watch on any of the components of %s: %m", s->path);
                 /* either EACCESS or ENOENT */
                 goto fail;
         }
 
+        path_spec_unwatch_refs(s, &old);
         return 0;
 
 fail:
+        path_spec_unwatch_refs(s, &old);
         path_spec_unwatch(s);
         return r;
 }
@@ -149,36 +269,8 @@ fail:
 void path_spec_unwatch(PathSpec *s) {
         assert(s);
 
-        s->event_source = sd_event_source_unref(s->event_source);
-        s->inotify_fd = safe_close(s->inotify_fd);
-}
-
-int path_spec_fd_event(PathSpec *s, uint32_t revents) {
-        union inotify_event_buffer buffer;
-        struct inotify_event *e;
-        ssize_t l;
-        int r = 0;
-
-        if (revents != EPOLLIN) {
-                log_error("Got invalid poll event on inotify.");
-                return -EINVAL;
-        }
-
-        l = read(s->inotify_fd, &buffer, sizeof(buffer));
-        if (l < 0) {
-                if (errno == EAGAIN || errno == EINTR)
-                        return 0;
-
-                return log_error_errno(errno, "Failed to read inotify event: %m");
-        }
-
-        FOREACH_INOTIFY_EVENT(e, buffer, l) {
-                if ((s->type == PATH_CHANGED || s->type == PATH_MODIFIED) &&
-                    s->primary_wd == e->wd)
-                        r = 1;
-        }
-
-        return r;
+        path_spec_unwatch_refs(s, &s->watch_refs);
+        s->primary = NULL;
 }
 
 static bool path_spec_check_good(PathSpec *s, bool initial) {
@@ -240,7 +332,7 @@ static void path_spec_dump(PathSpec *s, FILE *f, const char *prefix) {
 
 void path_spec_done(PathSpec *s) {
         assert(s);
-        assert(s->inotify_fd == -1);
+        assert(!s->watch_refs);
 
         free(s->path);
 }
@@ -406,7 +498,7 @@ static int path_watch(Path *p) {
         assert(p);
 
         LIST_FOREACH(spec, s, p->specs) {
-                r = path_spec_watch(s, path_dispatch_io);
+                r = path_spec_watch(s);
                 if (r < 0)
                         return r;
         }
@@ -634,35 +726,37 @@ _pure_ static const char *path_sub_state_to_string(Unit *u) {
         return path_state_to_string(PATH(u)->state);
 }
 
-static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        PathSpec *s = userdata;
-        Path *p;
-        int changed;
-
+static int path_spec_trigger(PathSpec *s, Set *paths, bool changed) {
         assert(s);
-        assert(s->unit);
-        assert(fd >= 0);
 
-        p = PATH(s->unit);
+        s->triggered = true;
+        s->changed = s->changed || changed;
 
-        if (p->state != PATH_WAITING &&
-            p->state != PATH_RUNNING)
-                return 0;
+        if (!paths)
+                return -ENOMEM;
 
-        /* log_debug("inotify wakeup on %s.", u->id); */
+        return set_put(paths, s->unit);
+}
 
-        LIST_FOREACH(spec, s, p->specs)
-                if (path_spec_owns_inotify_fd(s, fd))
-                        break;
+static void path_notify_path_event(Unit *u, bool lost) {
+        Path *p = PATH(u);
+        bool triggered = false, changed = false;
+        PathSpec *s;
 
-        if (!s) {
-                log_error("Got event on unknown fd.");
-                goto fail;
+        assert(p);
+
+        LIST_FOREACH(spec, s, p->specs) {
+                triggered = triggered || s->triggered || (lost && s->watch_refs);
+                changed = changed || s->changed;
+                s->triggered = s->changed = false;
         }
 
-        changed = path_spec_fd_event(s, revents);
-        if (changed < 0)
-                goto fail;
+        if (!triggered)
+                return;
+
+        if (p->state != PATH_WAITING &&
+            p->state != PATH_RUNNING)
+                return;
 
         /* If we are already running, then remember that one event was
          * dispatched so that we restart the service only if something
@@ -673,11 +767,90 @@ static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, v
                 path_enter_running(p);
         else
                 path_enter_waiting(p, false, true);
+}
 
-        return 0;
+static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        _cleanup_set_free_ Set *paths = NULL;
+        union inotify_event_buffer buffer;
+        struct inotify_event *e;
+        Manager *m = userdata;
+        bool overflow = false;
+        PathWatchRef *ref;
+        PathWatch *w;
+        Unit *u;
+        ssize_t l;
+
+        assert(m);
+        assert(fd == m->path_inotify_fd);
+
+        if (revents != EPOLLIN) {
+                log_error("Got invalid poll event on inotify.");
+                return 0;
+        }
+
+        l = read(fd, &buffer, sizeof(buffer));
+        if (l < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                        return 0;
+
+                return log_error_errno(errno, "Failed to read inotify event: %m");
+        }
+
+        /* First figure out which specs all of the events we just read
+         * concern, then let each unit look at its specs only once. */
+
+        paths = set_new(NULL);
+
+        FOREACH_INOTIFY_EVENT(e, buffer, l) {
+                if (e->mask & IN_Q_OVERFLOW) {
+                        overflow = true;
+                        continue;
+                }
+
+                w = hashmap_get(m->path_watches, INT_TO_PTR(e->wd));
+                if (!w)
+                        continue;
+
+                LIST_FOREACH(refs, ref, w->refs) {
+                        PathSpec *s = ref->spec;
+
+                        if (!(e->mask & (ref->mask|IN_IGNORED)))
+                                continue;
+
+                        /* If we can't remember the unit, look at all of them */
+                        if (path_spec_trigger(s, paths,
+                                              ref == s->primary &&
+                                              (s->type == PATH_CHANGED || s->type == PATH_MODIFIED)) < 0)
+                                overflow = true;
+                }
+
+                /* The watch is gone, it will be set up again when the
+                 * units recheck their paths, and the kernel might reuse
+                 * the descriptor for something else meanwhile */
+                if (e->mask & IN_IGNORED)
+                        path_watch_forget(m, w);
+        }
+
+        /* Not only path units watch paths, services watch their PID
+         * files too */
+        if (overflow) {
+                UnitType t;
+
+                /* We lost events, hence everybody has to look */
+                for (t = 0; t < _UNIT_TYPE_MAX; t++) {
+                        if (!unit_vtable[t]->notify_path_event)
+                                continue;
+
+                        LIST_FOREACH(units_by_type, u, m->units_by_type[t])
+                                unit_vtable[t]->notify_path_event(u, true);
+                }
+        } else {
+                Iterator i;
+
+                SET_FOREACH(u, paths, i)
+                        UNIT_VTABLE(u)->notify_path_event(u, false);
+        }
 
-fail:
-        path_enter_dead(p, PATH_FAILURE_RESOURCES);
         return 0;
 }
 
@@ -704,6 +877,17 @@ static void path_trigger_notify(Unit *u, Unit *other) {
         }
 }
 
+static void path_shutdown(Manager *m) {
+        assert(m);
+
+        /* All units are gone by now, hence so are their watches */
+        assert(hashmap_isempty(m->path_watches));
+
+        m->path_inotify_event_source = sd_event_source_unref(m->path_inotify_event_source);
+        m->path_inotify_fd = safe_close(m->path_inotify_fd);
+        m->path_watches = hashmap_free(m->path_watches);
+}
+
 static void path_reset_failed(Unit *u) {
         Path *p = PATH(u);
 
@@ -767,8 +951,11 @@ const UnitVTable path_vtable = {
         .sub_state_to_string = path_sub_state_to_string,
 
         .trigger_notify = path_trigger_notify,
+        .notify_path_event = path_notify_path_event,
 
         .reset_failed = path_reset_failed,
 
+        .shutdown = path_shutdown,
+
         .bus_vtable = bus_path_vtable
 };
@@ -23,6 +23,8 @@
 
 typedef struct Path Path;
 typedef struct PathSpec PathSpec;
+typedef struct PathWatch PathWatch;
+typedef struct PathWatchRef PathWatchRef;
 
 #include "unit.h"
 
@@ -45,31 +47,49 @@ typedef enum PathType {
         _PATH_TYPE_INVALID = -1
 } PathType;
 
+/* All path units, and services waiting for their PID files, share
+ * one inotify instance. Watching the same inode twice yields the same
+ * watch descriptor, which is hence reference counted, each reference
+ * carrying the events its spec cares about. */
+struct PathWatch {
+        /* -1 once the kernel dropped the watch */
+        int wd;
+
+        LIST_HEAD(PathWatchRef, refs);
+};
+
+struct PathWatchRef {
+        PathWatch *watch;
+        PathSpec *spec;
+        uint32_t mask;
+
+        LIST_FIELDS(PathWatchRef, refs);
+        LIST_FIELDS(PathWatchRef, spec_refs);
+};
+
 typedef struct PathSpec {
         Unit *unit;
 
         char *path;
 
-        sd_event_source *event_source;
-
         LIST_FIELDS(struct PathSpec, spec);
 
         PathType type;
-        int inotify_fd;
-        int primary_wd;
+
+        LIST_HEAD(PathWatchRef, watch_refs);
+        PathWatchRef *primary;
+
+        /* Set while dispatching a batch of events */
+        bool triggered:1;
+        bool changed:1;
 
         bool previous_exists;
 } PathSpec;
 
-int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler);
+int path_spec_watch(PathSpec *s);
 void path_spec_unwatch(PathSpec *s);
-int path_spec_fd_event(PathSpec *s, uint32_t events);
 void path_spec_done(PathSpec *s);
 
-static inline bool path_spec_owns_inotify_fd(PathSpec *s, int fd) {
-        return s->inotify_fd == fd;
-}
-
 typedef enum PathResult {
         PATH_SUCCESS,
         PATH_FAILURE_RESOURCES,
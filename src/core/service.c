@@ -89,7 +89,6 @@ static const UnitActiveState state_translation_table_idle[_SERVICE_STATE_MAX] =
         [SERVICE_AUTO_RESTART] = UNIT_ACTIVATING
 };
 
-static int service_dispatch_io(sd_event_source *source, int fd, uint32_t events, void *userdata);
 static int service_dispatch_timer(sd_event_source *source, usec_t usec, void *userdata);
 static int service_dispatch_watchdog(sd_event_source *source, usec_t usec, void *userdata);
 
@@ -2296,7 +2295,7 @@ static int service_watch_pid_file(Service *s) {
 
         log_unit_debug(UNIT(s), "Setting watch for PID file %s", s->pid_file_pathspec->path);
 
-        r = path_spec_watch(s->pid_file_pathspec, service_dispatch_io);
+        r = path_spec_watch(s->pid_file_pathspec);
         if (r < 0)
                 goto fail;
 
@@ -2333,44 +2332,42 @@ static int service_demand_pid_file(Service *s) {
         /* PATH_CHANGED would not be enough. There are daemons (sendmail) that
          * keep their PID file open all the time. */
         ps->type = PATH_MODIFIED;
-        ps->inotify_fd = -1;
 
         s->pid_file_pathspec = ps;
 
         return service_watch_pid_file(s);
 }
 
-static int service_dispatch_io(sd_event_source *source, int fd, uint32_t events, void *userdata) {
-        PathSpec *p = userdata;
-        Service *s;
+static void service_notify_path_event(Unit *u, bool lost) {
+        Service *s = SERVICE(u);
+        PathSpec *p;
 
-        assert(p);
+        assert(s);
 
-        s = SERVICE(p->unit);
+        p = s->pid_file_pathspec;
+        if (!p)
+                return;
 
-        assert(s);
-        assert(fd >= 0);
-        assert(s->state == SERVICE_START || s->state == SERVICE_START_POST);
-        assert(s->pid_file_pathspec);
-        assert(path_spec_owns_inotify_fd(s->pid_file_pathspec, fd));
+        if (!p->triggered && !lost)
+                return;
 
-        log_unit_debug(UNIT(s), "inotify event");
+        p->triggered = p->changed = false;
 
-        if (path_spec_fd_event(p, events) < 0)
-                goto fail;
+        assert(s->state == SERVICE_START || s->state == SERVICE_START_POST);
+
+        log_unit_debug(u, "inotify event");
 
         if (service_retry_pid_file(s) == 0)
-                return 0;
+                return;
 
         if (service_watch_pid_file(s) < 0)
                 goto fail;
 
-        return 0;
+        return;
 
 fail:
         service_unwatch_pid_file(s);
         service_enter_signal(s, SERVICE_STOP_SIGTERM, SERVICE_FAILURE_RESOURCES);
-        return 0;
 }
 
 static void service_notify_cgroup_empty_event(Unit *u) {
@@ -2832,7 +2829,10 @@ static void service_notify_message(Unit *u, pid_t pid, char **tags, FDSet *fds)
 
         assert(u);
 
-        cc = strv_join(tags, ", ");
+        /* Only needed for the debug message below, and this is called
+         * for every single keep-alive */
+        if (log_get_max_level() >= LOG_DEBUG)
+                cc = strv_join(tags, ", ");
 
         if (s->notify_access == NOTIFY_NONE) {
                 log_unit_warning(u, "Got notification message from PID "PID_FMT", but reception is disabled.", pid);
@@ -3216,6 +3216,7 @@ const UnitVTable service_vtable = {
 
         .notify_cgroup_empty = service_notify_cgroup_empty_event,
         .notify_message = service_notify_message,
+        .notify_path_event = service_notify_path_event,
 
         .bus_name_owner_change = service_bus_name_owner_change,
 
@@ -146,6 +146,13 @@ static int switch_root_initramfs(void) {
         return switch_root("/run/initramfs", "/oldroot", false, MS_BIND);
 }
 
+static void log_phase_done(const char *phase, usec_t start) {
+        char buf[FORMAT_TIMESPAN_MAX];
+
+        /* With the journal gone, this ends up in kmsg or on the
+         * console, and shows where shutdown spends its time */
+        log_info("%s took %s.", phase, format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - start, USEC_PER_MSEC));
+}
 
 int main(int argc, char *argv[]) {
         bool need_umount, need_swapoff, need_loop_detach, need_dm_detach;
@@ -153,6 +160,7 @@ int main(int argc, char *argv[]) {
         _cleanup_free_ char *cgroup = NULL;
         char *arguments[3];
         unsigned retries;
+        usec_t ts;
         int cmd, r;
         static const char* const dirs[] = {SYSTEM_SHUTDOWN_PATH, NULL};
 
@@ -196,11 +204,15 @@ int main(int argc, char *argv[]) {
         /* lock us into memory */
         mlockall(MCL_CURRENT|MCL_FUTURE);
 
+        ts = now(CLOCK_MONOTONIC);
         log_info("Sending SIGTERM to remaining processes...");
         broadcast_signal(SIGTERM, true, true);
+        log_phase_done("Terminating remaining processes", ts);
 
+        ts = now(CLOCK_MONOTONIC);
         log_info("Sending SIGKILL to remaining processes...");
         broadcast_signal(SIGKILL, true, false);
+        log_phase_done("Killing remaining processes", ts);
 
         in_container = detect_container() > 0;
 
@@ -224,8 +236,10 @@ int main(int argc, char *argv[]) {
                         cg_trim(SYSTEMD_CGROUP_CONTROLLER, cgroup, false);
 
                 if (need_umount) {
+                        ts = now(CLOCK_MONOTONIC);
                         log_info("Unmounting file systems.");
                         r = umount_all(&changed);
+                        log_phase_done("Unmounting file systems", ts);
                         if (r == 0) {
                                 need_umount = false;
                                 log_info("All filesystems unmounted.");
@@ -236,8 +250,10 @@ int main(int argc, char *argv[]) {
                 }
 
                 if (need_swapoff) {
+                        ts = now(CLOCK_MONOTONIC);
                         log_info("Deactivating swaps.");
                         r = swapoff_all(&changed);
+                        log_phase_done("Deactivating swaps", ts);
                         if (r == 0) {
                                 need_swapoff = false;
                                 log_info("All swaps deactivated.");
@@ -248,8 +264,10 @@ int main(int argc, char *argv[]) {
                 }
 
                 if (need_loop_detach) {
+                        ts = now(CLOCK_MONOTONIC);
                         log_info("Detaching loop devices.");
                         r = loopback_detach_all(&changed);
+                        log_phase_done("Detaching loop devices", ts);
                         if (r == 0) {
                                 need_loop_detach = false;
                                 log_info("All loop devices detached.");
@@ -260,8 +278,10 @@ int main(int argc, char *argv[]) {
                 }
 
                 if (need_dm_detach) {
+                        ts = now(CLOCK_MONOTONIC);
                         log_info("Detaching DM devices.");
                         r = dm_detach_all(&changed);
+                        log_phase_done("Detaching DM devices", ts);
                         if (r == 0) {
                                 need_dm_detach = false;
                                 log_info("All DM devices detached.");
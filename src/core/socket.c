@@ -67,6 +67,10 @@ static const UnitActiveState state_translation_table[_SOCKET_STATE_MAX] = {
         [SOCKET_FAILED] = UNIT_FAILED
 };
 
+/* Upper bound for the connections accepted per wakeup, so that a
+ * connection flood on one socket doesn't starve the event loop */
+#define SOCKET_ACCEPT_BATCH_MAX 16U
+
 static int socket_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int socket_dispatch_timer(sd_event_source *source, usec_t usec, void *userdata);
 
@@ -2304,6 +2308,16 @@ static int socket_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
         if (p->socket->accept &&
             p->type == SOCKET_SOCKET &&
             socket_address_can_accept(&p->address)) {
+                unsigned n = 0;
+                bool batch;
+                int flags;
+
+                /* Drain the backlog in one go, as far as the connection
+                 * limit allows, instead of waking up for every single
+                 * connection. If the listening socket isn't
+                 * non-blocking for some reason, stick to one. */
+                flags = fcntl(fd, F_GETFL);
+                batch = flags >= 0 && (flags & O_NONBLOCK);
 
                 for (;;) {
 
@@ -2313,17 +2327,31 @@ static int socket_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
                                 if (errno == EINTR)
                                         continue;
 
+                                if (n > 0 && errno == EAGAIN)
+                                        break;
+
                                 log_unit_error_errno(UNIT(p->socket), errno, "Failed to accept socket: %m");
                                 goto fail;
                         }
 
-                        break;
+                        socket_apply_socket_options(p->socket, cfd);
+                        socket_enter_running(p->socket, cfd);
+
+                        if (!batch ||
+                            ++n >= SOCKET_ACCEPT_BATCH_MAX ||
+                            p->socket->state != SOCKET_LISTENING ||
+                            p->fd != fd ||
+                            p->socket->n_connections >= p->socket->max_connections)
+                                break;
                 }
 
-                socket_apply_socket_options(p->socket, cfd);
+                if (n > 1)
+                        log_unit_debug(UNIT(p->socket), "Accepted %u connections.", n);
+
+                return 0;
         }
 
-        socket_enter_running(p->socket, cfd);
+        socket_enter_running(p->socket, -1);
         return 0;
 
 fail:
@@ -0,0 +1,92 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "manager.h"
+#include "trace.h"
+
+void manager_trace_duration(Manager *m, TracePhase phase, const char *unit, usec_t begin, usec_t duration) {
+        TraceRing *r;
+        TraceEvent *e;
+        char *s;
+
+        assert(m);
+        assert(phase >= 0 && phase < _TRACE_PHASE_MAX);
+        assert(unit);
+
+        r = &m->trace;
+
+        /* Tracing is best effort, simply drop the event if we can't
+         * allocate */
+        if (!r->events) {
+                r->events = new0(TraceEvent, TRACE_EVENTS_MAX);
+                if (!r->events)
+                        return;
+        }
+
+        s = strdup(unit);
+        if (!s)
+                return;
+
+        if (r->n_events < TRACE_EVENTS_MAX)
+                e = r->events + r->n_events++;
+        else {
+                e = r->events + r->head;
+                r->head = (r->head + 1) % TRACE_EVENTS_MAX;
+                free(e->unit);
+        }
+
+        e->phase = phase;
+        e->unit = s;
+        e->begin = begin;
+        e->duration = duration;
+}
+
+void manager_trace(Manager *m, TracePhase phase, const char *unit, usec_t begin) {
+        usec_t n;
+
+        n = now(CLOCK_MONOTONIC);
+        manager_trace_duration(m, phase, unit, begin, n > begin ? n - begin : 0);
+}
+
+void trace_ring_done(TraceRing *r) {
+        unsigned i;
+
+        assert(r);
+
+        if (!r->events)
+                return;
+
+        for (i = 0; i < r->n_events; i++)
+                free(r->events[i].unit);
+
+        r->events = mfree(r->events);
+        r->n_events = r->head = 0;
+}
+
+static const char* const trace_phase_table[_TRACE_PHASE_MAX] = {
+        [TRACE_PHASE_LOAD] = "load",
+        [TRACE_PHASE_TRANSACTION] = "transaction",
+        [TRACE_PHASE_JOB_RUN] = "job-run",
+        [TRACE_PHASE_SPAWN] = "spawn",
+        [TRACE_PHASE_CGROUP_REALIZE] = "cgroup-realize",
+        [TRACE_PHASE_GENERATOR] = "generator",
+};
+
+DEFINE_STRING_TABLE_LOOKUP(trace_phase, TracePhase);
@@ -0,0 +1,72 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "time-util.h"
+
+typedef struct Manager Manager;
+
+/* Internal phases of the manager whose duration we record for each
+ * unit, so that "systemd-analyze trace" can show where PID 1 itself
+ * spends its time */
+typedef enum TracePhase {
+        TRACE_PHASE_LOAD,
+        TRACE_PHASE_TRANSACTION,
+        TRACE_PHASE_JOB_RUN,
+        TRACE_PHASE_SPAWN,
+        TRACE_PHASE_CGROUP_REALIZE,
+        TRACE_PHASE_GENERATOR,
+        _TRACE_PHASE_MAX,
+        _TRACE_PHASE_INVALID = -1
+} TracePhase;
+
+typedef struct TraceEvent {
+        TracePhase phase;
+        char *unit;
+        usec_t begin;    /* CLOCK_MONOTONIC */
+        usec_t duration;
+} TraceEvent;
+
+/* The oldest events get overwritten once the ring is full */
+#define TRACE_EVENTS_MAX 4096U
+
+typedef struct TraceRing {
+        TraceEvent *events;
+        unsigned n_events;
+        unsigned head;
+} TraceRing;
+
+void manager_trace(Manager *m, TracePhase phase, const char *unit, usec_t begin);
+void manager_trace_duration(Manager *m, TracePhase phase, const char *unit, usec_t begin, usec_t duration);
+void trace_ring_done(TraceRing *r);
+
+/* Returns the i-th oldest event */
+static inline TraceEvent *trace_ring_get(TraceRing *r, unsigned i) {
+        if (i >= r->n_events)
+                return NULL;
+
+        if (r->n_events < TRACE_EVENTS_MAX)
+                return r->events + i;
+
+        return r->events + (r->head + i) % TRACE_EVENTS_MAX;
+}
+
+const char* trace_phase_to_string(TracePhase p) _const_;
+TracePhase trace_phase_from_string(const char *s) _pure_;
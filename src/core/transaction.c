@@ -826,6 +826,35 @@ static void transaction_unlink_job(Transaction *tr, Job *j, bool delete_dependen
         }
 }
 
+static bool transaction_job_is_settled(Transaction *tr, Job *j, Job *by) {
+        Unit *u = j->unit;
+
+        /* A unit that is pulled in by some other job and is already
+         * up, with nothing queued for it, needs no further look at
+         * its own dependencies: they were pulled in when it was
+         * started, and starting it again is a no-op that will be
+         * dropped as redundant anyway. This keeps us from walking
+         * all of sysinit.target and friends again and again, for
+         * every unit that is started with default dependencies.
+         *
+         * The anchor job is always expanded, so that an explicit
+         * start still pulls in everything that went away since. So
+         * is everything for isolation, which stops all units that
+         * are not part of the transaction, and everything during
+         * coldplug, when unit states may not be final yet. */
+
+        if (!by || tr->isolate)
+                return false;
+
+        if (j->type != JOB_START)
+                return false;
+
+        if (u->job || u->manager->n_reloading > 0)
+                return false;
+
+        return UNIT_IS_ACTIVE_OR_RELOADING(unit_active_state(u));
+}
+
 int transaction_add_job_and_dependencies(
                 Transaction *tr,
                 JobType type,
@@ -910,7 +939,7 @@ int transaction_add_job_and_dependencies(
                 tr->anchor_job = ret;
         }
 
-        if (is_new && !ignore_requirements && type != JOB_NOP) {
+        if (is_new && !ignore_requirements && type != JOB_NOP && !transaction_job_is_settled(tr, ret, by)) {
                 Set *following;
 
                 /* If we are following some other unit, make sure we
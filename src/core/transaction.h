@@ -33,6 +33,7 @@ struct Transaction {
         Hashmap *jobs;      /* Unit object => Job object list 1:1 */
         Job *anchor_job;      /* the job the user asked for */
         bool irreversible;
+        bool isolate;         /* needs the complete closure of the anchor job */
 };
 
 Transaction *transaction_new(bool irreversible);
@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/mount.h>
 #include <sys/swap.h>
 #include <linux/loop.h>
@@ -31,17 +32,45 @@
 #include "mount-setup.h"
 #include "umount.h"
 #include "path-util.h"
+#include "strv.h"
 #include "util.h"
 #include "virt.h"
 #include "libudev.h"
 #include "udev-util.h"
 
+/* Independent mounts and devices are released by this many threads in
+ * parallel at most */
+#define RELEASE_THREADS_MAX 16U
+
+/* The threads only issue a few system calls. Since the shutdown
+ * binary is mlockall()ed, the default stack size of 8M each would
+ * have to be backed by memory for real. */
+#define RELEASE_THREAD_STACK_SIZE (64U*1024U)
+
 typedef struct MountPoint {
         char *path;
         dev_t devnum;
+
+        /* For mounts the ids from mountinfo, for DM devices the
+         * names of the devices stacked on top */
+        int id, parent_id;
+        char **holders;
+
+        /* Result of the last attempt to release it */
+        int result;
+
         LIST_FIELDS(struct MountPoint, mount_point);
 } MountPoint;
 
+typedef struct ReleaseWork {
+        MountPoint **items;
+        unsigned n_items;
+        volatile unsigned next;
+
+        int (*release)(MountPoint *m, bool in_container);
+        bool in_container;
+} ReleaseWork;
+
 static void mount_point_free(MountPoint **head, MountPoint *m) {
         assert(head);
         assert(m);
@@ -49,6 +78,7 @@ static void mount_point_free(MountPoint **head, MountPoint *m) {
         LIST_REMOVE(mount_point, *head, m);
 
         free(m->path);
+        strv_free(m->holders);
         free(m);
 }
 
@@ -74,11 +104,11 @@ static int mount_points_list_get(MountPoint **head) {
                 _cleanup_free_ char *path = NULL;
                 char *p = NULL;
                 MountPoint *m;
-                int k;
+                int id, parent_id, k;
 
                 k = fscanf(proc_self_mountinfo,
-                           "%*s "       /* (1) mount id */
-                           "%*s "       /* (2) parent id */
+                           "%i "        /* (1) mount id */
+                           "%i "        /* (2) parent id */
                            "%*s "       /* (3) major:minor */
                            "%*s "       /* (4) root */
                            "%ms "       /* (5) mount point */
@@ -89,8 +119,10 @@ static int mount_points_list_get(MountPoint **head) {
                            "%*s"        /* (10) mount source */
                            "%*s"        /* (11) mount options 2 */
                            "%*[^\n]",   /* some rubbish at the end */
+                           &id,
+                           &parent_id,
                            &path);
-                if (k != 1) {
+                if (k != 3) {
                         if (k == EOF)
                                 break;
 
@@ -125,6 +157,8 @@ static int mount_points_list_get(MountPoint **head) {
                 }
 
                 m->path = p;
+                m->id = id;
+                m->parent_id = parent_id;
                 LIST_PREPEND(mount_point, *head, m);
         }
 
@@ -253,6 +287,34 @@ static int loopback_list_get(MountPoint **head) {
         return 0;
 }
 
+static int dm_read_holders(struct udev_device *d, char ***ret) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        _cleanup_strv_free_ char **l = NULL;
+        struct dirent *de;
+        const char *p;
+        int r;
+
+        p = strjoina(udev_device_get_syspath(d), "/holders");
+        dir = opendir(p);
+        if (!dir) {
+                if (errno == ENOENT)
+                        return 0;
+
+                return -errno;
+        }
+
+        FOREACH_DIRENT(de, dir, return -errno) {
+                r = strv_extend(&l, de->d_name);
+                if (r < 0)
+                        return r;
+        }
+
+        *ret = l;
+        l = NULL;
+
+        return 0;
+}
+
 static int dm_list_get(MountPoint **head) {
         _cleanup_udev_enumerate_unref_ struct udev_enumerate *e = NULL;
         struct udev_list_entry *item = NULL, *first = NULL;
@@ -302,7 +364,7 @@ static int dm_list_get(MountPoint **head) {
                 if (!node)
                         return -ENOMEM;
 
-                m = new(MountPoint, 1);
+                m = new0(MountPoint, 1);
                 if (!m) {
                         free(node);
                         return -ENOMEM;
@@ -311,6 +373,10 @@ static int dm_list_get(MountPoint **head) {
                 m->path = node;
                 m->devnum = devnum;
                 LIST_PREPEND(mount_point, *head, m);
+
+                r = dm_read_holders(d, &m->holders);
+                if (r < 0)
+                        return r;
         }
 
         return 0;
@@ -356,6 +422,143 @@ static int delete_dm(dev_t devnum) {
         return r >= 0 ? 0 : -errno;
 }
 
+static void release_work(ReleaseWork *w) {
+        unsigned i;
+
+        while ((i = __sync_fetch_and_add(&w->next, 1)) < w->n_items)
+                w->items[i]->result = w->release(w->items[i], w->in_container);
+}
+
+static void *release_thread(void *userdata) {
+        release_work(userdata);
+        return NULL;
+}
+
+/* Runs release() on all items, in parallel. The results are stored in
+ * the items. */
+static void release_all(MountPoint **items, unsigned n_items, int (*release)(MountPoint *m, bool in_container)) {
+        ReleaseWork w = {
+                .items = items,
+                .n_items = n_items,
+                .release = release,
+                .in_container = detect_container() > 0,
+        };
+        pthread_t threads[RELEASE_THREADS_MAX];
+        pthread_attr_t attr;
+        unsigned n_threads, i;
+
+        if (n_items == 0)
+                return;
+
+        /* If a thread cannot be started, the others pick up its
+         * share */
+        n_threads = MIN(n_items - 1, RELEASE_THREADS_MAX);
+        if (n_threads > 0) {
+                if (pthread_attr_init(&attr) != 0)
+                        n_threads = 0;
+                else if (pthread_attr_setstacksize(&attr, RELEASE_THREAD_STACK_SIZE) != 0) {
+                        (void) pthread_attr_destroy(&attr);
+                        n_threads = 0;
+                }
+        }
+
+        for (i = 0; i < n_threads; i++)
+                if (pthread_create(threads + i, &attr, release_thread, &w) != 0)
+                        break;
+
+        if (n_threads > 0)
+                (void) pthread_attr_destroy(&attr);
+
+        n_threads = i;
+
+        release_work(&w);
+
+        for (i = 0; i < n_threads; i++)
+                (void) pthread_join(threads[i], NULL);
+}
+
+static bool mount_point_is_root(MountPoint *m) {
+        return path_equal(m->path, "/")
+#ifndef HAVE_SPLIT_USR
+                || path_equal(m->path, "/usr")
+#endif
+                ;
+}
+
+static bool mount_point_has_children(MountPoint *head, MountPoint *m) {
+        MountPoint *c;
+
+        /* Includes mounts stacked on top of the same path */
+        LIST_FOREACH(mount_point, c, head)
+                if (c != m && c->parent_id == m->id)
+                        return true;
+
+        return false;
+}
+
+static int umount_one(MountPoint *m, bool in_container) {
+        /* See mount_points_list_umount() about the read-only
+         * remount */
+        if (!in_container)
+                (void) mount(NULL, m->path, NULL, MS_REMOUNT|MS_RDONLY, NULL);
+
+        if (umount2(m->path, 0) < 0)
+                return -errno;
+
+        return 0;
+}
+
+/* Unmounts all mounts that have no other mounts below them at the same
+ * time, then the ones that became free that way, and so on, until we
+ * make no progress anymore. Nothing is logged about failures, the
+ * mounts that are left are tried once more one by one. */
+static int mount_points_list_umount_leaves(MountPoint **head, bool *changed) {
+        _cleanup_free_ MountPoint **items = NULL;
+        size_t n_items, n_allocated = 0, i;
+        MountPoint *m;
+
+        assert(head);
+
+        for (;;) {
+                bool progress = false;
+
+                n_items = 0;
+
+                LIST_FOREACH(mount_point, m, *head) {
+                        if (mount_point_is_root(m))
+                                continue;
+
+                        if (mount_point_has_children(*head, m))
+                                continue;
+
+                        if (!GREEDY_REALLOC(items, n_allocated, n_items + 1))
+                                return -ENOMEM;
+
+                        items[n_items++] = m;
+                        log_info("Unmounting %s.", m->path);
+                }
+
+                if (n_items == 0)
+                        return 0;
+
+                release_all(items, n_items, umount_one);
+
+                for (i = 0; i < n_items; i++) {
+                        if (items[i]->result < 0)
+                                continue;
+
+                        mount_point_free(head, items[i]);
+                        progress = true;
+
+                        if (changed)
+                                *changed = true;
+                }
+
+                if (!progress)
+                        return 0;
+        }
+}
+
 static int mount_points_list_umount(MountPoint **head, bool *changed, bool log_error) {
         MountPoint *m, *n;
         int n_failed = 0;
@@ -438,17 +641,24 @@ static int swap_points_list_off(MountPoint **head, bool *changed) {
         return n_failed;
 }
 
+static int detach_loopback_one(MountPoint *m, bool in_container) {
+        return delete_loopback(m->path);
+}
+
 static int loopback_points_list_detach(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
+        _cleanup_free_ MountPoint **items = NULL;
+        size_t n_items = 0, n_allocated = 0, i;
         int n_failed = 0, k;
         struct stat root_st;
+        MountPoint *m;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
+        /* Loop devices do not depend on each other, detach them all
+         * at once */
+        LIST_FOREACH(mount_point, m, *head) {
                 struct stat loopback_st;
 
                 if (k >= 0 &&
@@ -459,15 +669,25 @@ static int loopback_points_list_detach(MountPoint **head, bool *changed) {
                         continue;
                 }
 
+                if (!GREEDY_REALLOC(items, n_allocated, n_items + 1))
+                        return -ENOMEM;
+
+                items[n_items++] = m;
                 log_info("Detaching loopback %s.", m->path);
-                r = delete_loopback(m->path);
-                if (r >= 0) {
-                        if (r > 0 && changed)
+        }
+
+        release_all(items, n_items, detach_loopback_one);
+
+        for (i = 0; i < n_items; i++) {
+                m = items[i];
+
+                if (m->result >= 0) {
+                        if (m->result > 0 && changed)
                                 *changed = true;
 
                         mount_point_free(head, m);
                 } else {
-                        log_warning_errno(errno, "Could not detach loopback %s: %m", m->path);
+                        log_warning_errno(m->result, "Could not detach loopback %s: %m", m->path);
                         n_failed++;
                 }
         }
@@ -475,38 +695,83 @@ static int loopback_points_list_detach(MountPoint **head, bool *changed) {
         return n_failed;
 }
 
+static int detach_dm_one(MountPoint *m, bool in_container) {
+        return delete_dm(m->devnum);
+}
+
+static bool dm_point_is_held(MountPoint *head, MountPoint *m) {
+        MountPoint *h;
+
+        LIST_FOREACH(mount_point, h, head)
+                if (h != m && strv_contains(m->holders, basename(h->path)))
+                        return true;
+
+        return false;
+}
+
 static int dm_points_list_detach(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
+        _cleanup_free_ MountPoint **items = NULL;
+        size_t n_items, n_allocated = 0, i;
         int n_failed = 0, k;
         struct stat root_st;
+        MountPoint *m, *n;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
-
+        LIST_FOREACH_SAFE(mount_point, m, n, *head)
                 if (k >= 0 &&
                     major(root_st.st_dev) != 0 &&
                     root_st.st_dev == m->devnum) {
+                        mount_point_free(head, m);
                         n_failed ++;
-                        continue;
                 }
 
-                log_info("Detaching DM %u:%u.", major(m->devnum), minor(m->devnum));
-                r = delete_dm(m->devnum);
-                if (r >= 0) {
-                        if (changed)
-                                *changed = true;
+        /* Devices stacked on top of others have to go first, all
+         * devices nothing is stacked on are removed at once */
+        for (;;) {
+                bool progress = false;
+
+                n_items = 0;
+
+                LIST_FOREACH(mount_point, m, *head) {
+                        if (dm_point_is_held(*head, m))
+                                continue;
+
+                        if (!GREEDY_REALLOC(items, n_allocated, n_items + 1))
+                                return -ENOMEM;
+
+                        items[n_items++] = m;
+                        log_info("Detaching DM %u:%u.", major(m->devnum), minor(m->devnum));
+                }
+
+                release_all(items, n_items, detach_dm_one);
+
+                for (i = 0; i < n_items; i++) {
+                        m = items[i];
+
+                        if (m->result < 0) {
+                                log_warning_errno(m->result, "Could not detach DM %s: %m", m->path);
+                                continue;
+                        }
 
                         mount_point_free(head, m);
-                } else {
-                        log_warning_errno(errno, "Could not detach DM %s: %m", m->path);
-                        n_failed++;
+                        progress = true;
+
+                        if (changed)
+                                *changed = true;
                 }
+
+                if (!progress)
+                        break;
         }
 
+        /* Whatever is left failed, or is held by something
+         * that failed */
+        LIST_FOREACH(mount_point, m, *head)
+                n_failed++;
+
         return n_failed;
 }
 
@@ -520,15 +785,10 @@ int umount_all(bool *changed) {
         if (r < 0)
                 goto end;
 
-        /* retry umount, until nothing can be umounted anymore */
-        do {
-                umount_changed = false;
-
-                mount_points_list_umount(&mp_list_head, &umount_changed, false);
-                if (umount_changed)
-                        *changed = true;
-
-        } while (umount_changed);
+        /* umount, until nothing can be umounted anymore */
+        r = mount_points_list_umount_leaves(&mp_list_head, changed);
+        if (r < 0)
+                goto end;
 
         /* umount one more time with logging enabled */
         r = mount_points_list_umount(&mp_list_head, &umount_changed, true);
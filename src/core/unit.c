@@ -70,6 +70,7 @@ const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX] = {
 static void maybe_warn_about_dependency(Unit *u, const char *other, UnitDependency dependency);
 
 Unit *unit_new(Manager *m, size_t size) {
+        CGroupMetric i;
         Unit *u;
 
         assert(m);
@@ -93,6 +94,9 @@ Unit *unit_new(Manager *m, size_t size) {
         u->on_failure_job_mode = JOB_REPLACE;
         u->cgroup_inotify_wd = -1;
 
+        for (i = 0; i < _CGROUP_METRIC_MAX; i++)
+                u->cgroup_metrics[i].fd = -1;
+
         RATELIMIT_INIT(u->auto_stop_ratelimit, 10 * USEC_PER_SEC, 16);
 
         return u;
@@ -378,6 +382,38 @@ void unit_add_to_dbus_queue(Unit *u) {
         u->in_dbus_queue = true;
 }
 
+static void unit_remove_dependency(Unit *u, UnitDependency d, Unit *other) {
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        /* Dependency sets are allocated lazily, hence release them
+         * again once they are empty, so that long-lived units don't
+         * keep one allocation around for every kind of dependency
+         * any of their short-lived peers ever had on them. Our
+         * caller or its callers may be iterating through the very
+         * set, hence only free it later, from the release queue. */
+
+        if (set_remove(u->dependencies[d], other) && set_isempty(u->dependencies[d]) && !u->in_release_queue) {
+                LIST_PREPEND(release_queue, u->manager->release_queue, u);
+                u->in_release_queue = true;
+        }
+}
+
+void unit_release_empty_dependencies(Unit *u) {
+        UnitDependency d;
+
+        assert(u);
+
+        if (u->in_release_queue) {
+                LIST_REMOVE(release_queue, u->manager->release_queue, u);
+                u->in_release_queue = false;
+        }
+
+        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                if (set_isempty(u->dependencies[d]))
+                        u->dependencies[d] = set_free(u->dependencies[d]);
+}
+
 static void bidi_set_free(Unit *u, Set *s) {
         Iterator i;
         Unit *other;
@@ -391,7 +427,7 @@ static void bidi_set_free(Unit *u, Set *s) {
                 UnitDependency d;
 
                 for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                        set_remove(other->dependencies[d], u);
+                        unit_remove_dependency(other, d, u);
 
                 unit_add_to_gc_queue(other);
         }
@@ -518,6 +554,9 @@ void unit_free(Unit *u) {
         if (u->in_cleanup_queue)
                 LIST_REMOVE(cleanup_queue, u->manager->cleanup_queue, u);
 
+        if (u->in_release_queue)
+                LIST_REMOVE(release_queue, u->manager->release_queue, u);
+
         if (u->in_gc_queue) {
                 LIST_REMOVE(gc_queue, u->manager->gc_queue, u);
                 u->manager->n_in_gc_queue--;
@@ -526,6 +565,9 @@ void unit_free(Unit *u) {
         if (u->in_cgroup_queue)
                 LIST_REMOVE(cgroup_queue, u->manager->cgroup_queue, u);
 
+        if (u->in_cgroup_empty_queue)
+                LIST_REMOVE(cgroup_empty_queue, u->manager->cgroup_empty_queue, u);
+
         unit_release_cgroup(u);
 
         (void) manager_update_failed_units(u->manager, u, false);
@@ -533,7 +575,7 @@ void unit_free(Unit *u) {
 
         free(u->description);
         strv_free(u->documentation);
-        free(u->fragment_path);
+        strintern_unref(u->fragment_path);
         free(u->source_path);
         strv_free(u->dropin_paths);
         free(u->instance);
@@ -852,12 +894,74 @@ const char *unit_description(Unit *u) {
         return strna(u->id);
 }
 
+static size_t strv_memory_usage(char **l) {
+        char **i;
+        size_t sz;
+
+        if (!l)
+                return 0;
+
+        sz = sizeof(char*);
+        STRV_FOREACH(i, l)
+                sz += sizeof(char*) + strlen(*i) + 1;
+
+        return sz;
+}
+
+size_t unit_memory_usage(Unit *u) {
+        UnitDependency d;
+        Condition *c;
+        Iterator i;
+        char *t;
+        size_t sz;
+
+        assert(u);
+
+        /* An estimate of the memory used by the unit object itself,
+         * excluding its jobs and what the unit type allocates on top
+         * of its fixed-size object. */
+
+        sz = UNIT_VTABLE(u)->object_size;
+
+        sz += set_memory_usage(u->names);
+        SET_FOREACH(t, u->names, i)
+                sz += strlen(t) + 1;
+
+        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                sz += set_memory_usage(u->dependencies[d]);
+
+        sz += set_memory_usage(u->pids);
+
+        if (u->instance)
+                sz += strlen(u->instance) + 1;
+        if (u->description)
+                sz += strlen(u->description) + 1;
+        if (u->source_path)
+                sz += strlen(u->source_path) + 1;
+        if (u->cgroup_path)
+                sz += strlen(u->cgroup_path) + 1;
+        if (u->job_timeout_reboot_arg)
+                sz += strlen(u->job_timeout_reboot_arg) + 1;
+
+        sz += strv_memory_usage(u->documentation);
+        sz += strv_memory_usage(u->dropin_paths);
+        sz += strv_memory_usage(u->requires_mounts_for);
+
+        LIST_FOREACH(conditions, c, u->conditions)
+                sz += sizeof(Condition) + (c->parameter ? strlen(c->parameter) + 1 : 0);
+        LIST_FOREACH(conditions, c, u->asserts)
+                sz += sizeof(Condition) + (c->parameter ? strlen(c->parameter) + 1 : 0);
+
+        return sz;
+}
+
 void unit_dump(Unit *u, FILE *f, const char *prefix) {
         char *t, **j;
         UnitDependency d;
         Iterator i;
         const char *prefix2;
         char
+                bytes[FORMAT_BYTES_MAX],
                 timestamp1[FORMAT_TIMESTAMP_MAX],
                 timestamp2[FORMAT_TIMESTAMP_MAX],
                 timestamp3[FORMAT_TIMESTAMP_MAX],
@@ -890,7 +994,8 @@ void unit_dump(Unit *u, FILE *f, const char *prefix) {
                 "%s\tCGroup: %s\n"
                 "%s\tCGroup realized: %s\n"
                 "%s\tCGroup mask: 0x%x\n"
-                "%s\tCGroup members mask: 0x%x\n",
+                "%s\tCGroup members mask: 0x%x\n"
+                "%s\tMemory Footprint: %s\n",
                 prefix, u->id,
                 prefix, unit_description(u),
                 prefix, strna(u->instance),
@@ -907,7 +1012,8 @@ void unit_dump(Unit *u, FILE *f, const char *prefix) {
                 prefix, strna(u->cgroup_path),
                 prefix, yes_no(u->cgroup_realized),
                 prefix, u->cgroup_realized_mask,
-                prefix, u->cgroup_members_mask);
+                prefix, u->cgroup_members_mask,
+                prefix, format_bytes(bytes, sizeof(bytes), unit_memory_usage(u)));
 
         SET_FOREACH(t, u->names, i)
                 fprintf(f, "%s\tName: %s\n", prefix, t);
@@ -1190,6 +1296,7 @@ static int unit_add_startup_units(Unit *u) {
 }
 
 int unit_load(Unit *u) {
+        usec_t ts;
         int r;
 
         assert(u);
@@ -1205,6 +1312,8 @@ int unit_load(Unit *u) {
         if (u->load_state != UNIT_STUB)
                 return 0;
 
+        ts = now(CLOCK_MONOTONIC);
+
         if (UNIT_VTABLE(u)->load) {
                 r = UNIT_VTABLE(u)->load(u);
                 if (r < 0)
@@ -1248,6 +1357,8 @@ int unit_load(Unit *u) {
         unit_add_to_dbus_queue(unit_follow_merge(u));
         unit_add_to_gc_queue(u);
 
+        manager_trace(u->manager, TRACE_PHASE_LOAD, u->id, ts);
+
         return 0;
 
 fail:
@@ -1256,6 +1367,8 @@ fail:
         unit_add_to_dbus_queue(u);
         unit_add_to_gc_queue(u);
 
+        manager_trace(u->manager, TRACE_PHASE_LOAD, u->id, ts);
+
         log_unit_debug_errno(u, r, "Failed to load configuration: %m");
 
         return r;
@@ -2201,13 +2314,13 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
 
 fail:
         if (q > 0)
-                set_remove(u->dependencies[d], other);
+                unit_remove_dependency(u, d, other);
 
         if (v > 0)
-                set_remove(other->dependencies[inverse_table[d]], u);
+                unit_remove_dependency(other, inverse_table[d], u);
 
         if (w > 0)
-                set_remove(u->dependencies[UNIT_REFERENCES], other);
+                unit_remove_dependency(u, UNIT_REFERENCES, other);
 
         return r;
 }
@@ -3178,6 +3291,12 @@ int unit_patch_contexts(Unit *u) {
 
                 if (ec->private_devices)
                         ec->capability_bounding_set_drop |= (uint64_t) 1ULL << (uint64_t) CAP_MKNOD;
+
+                /* Not fatal, the children will build the filters
+                 * themselves then */
+                r = exec_context_compile_seccomp(ec);
+                if (r < 0)
+                        log_unit_debug_errno(u, r, "Failed to precompile seccomp filters, ignoring: %m");
         }
 
         cc = unit_get_cgroup_context(u);
@@ -3414,7 +3533,7 @@ int unit_make_transient(Unit *u) {
         u->load_state = UNIT_STUB;
         u->load_error = 0;
         u->transient = true;
-        u->fragment_path = mfree(u->fragment_path);
+        u->fragment_path = strintern_unref(u->fragment_path);
 
         return 0;
 }
@@ -36,6 +36,7 @@ typedef struct UnitStatusMessageFormats UnitStatusMessageFormats;
 #include "install.h"
 #include "unit-name.h"
 #include "failure-action.h"
+#include "strintern.h"
 
 enum UnitActiveState {
         UNIT_ACTIVE,
@@ -56,6 +57,22 @@ typedef enum KillOperation {
         _KILL_OPERATION_INVALID = -1
 } KillOperation;
 
+typedef enum CGroupMetric {
+        CGROUP_METRIC_MEMORY_CURRENT,
+        CGROUP_METRIC_TASKS_CURRENT,
+        CGROUP_METRIC_CPU_USAGE,
+        _CGROUP_METRIC_MAX,
+        _CGROUP_METRIC_INVALID = -1
+} CGroupMetric;
+
+/* The attribute file of a resource counter, kept open while the unit
+ * has a cgroup, and the value last read from it */
+typedef struct CGroupMetricCache {
+        int fd;
+        uint64_t value;
+        usec_t timestamp;
+} CGroupMetricCache;
+
 static inline bool UNIT_IS_ACTIVE_OR_RELOADING(UnitActiveState t) {
         return t == UNIT_ACTIVE || t == UNIT_RELOADING;
 }
@@ -101,7 +118,7 @@ struct Unit {
         char *description;
         char **documentation;
 
-        char *fragment_path; /* if loaded from a config file this is the primary path to it */
+        const char *fragment_path; /* if loaded from a config file this is the primary path to it, interned as all instances of a template share it */
         char *source_path; /* if converted, the source file */
         char **dropin_paths;
 
@@ -158,9 +175,15 @@ struct Unit {
         /* GC queue */
         LIST_FIELDS(Unit, gc_queue);
 
+        /* Queue of units with empty dependency sets to release */
+        LIST_FIELDS(Unit, release_queue);
+
         /* CGroup realize members queue */
         LIST_FIELDS(Unit, cgroup_queue);
 
+        /* CGroups that might have become empty */
+        LIST_FIELDS(Unit, cgroup_empty_queue);
+
         /* PIDs we keep an eye on. Note that a unit might have many
          * more, but these are the ones we care enough about to
          * process SIGCHLD for */
@@ -189,6 +212,9 @@ struct Unit {
         CGroupMask cgroup_members_mask;
         int cgroup_inotify_wd;
 
+        /* Open attribute files of the resource counters */
+        CGroupMetricCache cgroup_metrics[_CGROUP_METRIC_MAX];
+
         /* How to start OnFailure units */
         JobMode on_failure_job_mode;
 
@@ -224,7 +250,9 @@ struct Unit {
         bool in_dbus_queue:1;
         bool in_cleanup_queue:1;
         bool in_gc_queue:1;
+        bool in_release_queue:1;
         bool in_cgroup_queue:1;
+        bool in_cgroup_empty_queue:1;
 
         bool sent_dbus_new_signal:1;
 
@@ -366,6 +394,11 @@ struct UnitVTable {
         /* Called whenever a process of this unit sends us a message */
         void (*notify_message)(Unit *u, pid_t pid, char **tags, FDSet *fds);
 
+        /* Called whenever inotify events for the PathSpecs of this
+         * unit came in, or when events were lost, in which case all
+         * of them need to be checked again */
+        void (*notify_path_event)(Unit *u, bool lost);
+
         /* Called whenever a name this Unit registered for comes or
          * goes away. */
         void (*bus_name_owner_change)(Unit *u, const char *name, const char *old_owner, const char *new_owner);
@@ -485,6 +518,7 @@ void unit_add_to_load_queue(Unit *u);
 void unit_add_to_dbus_queue(Unit *u);
 void unit_add_to_cleanup_queue(Unit *u);
 void unit_add_to_gc_queue(Unit *u);
+void unit_release_empty_dependencies(Unit *u);
 
 int unit_merge(Unit *u, Unit *other);
 int unit_merge_by_name(Unit *u, const char *other);
@@ -506,6 +540,7 @@ UnitActiveState unit_active_state(Unit *u);
 
 const char* unit_sub_state_to_string(Unit *u);
 
+size_t unit_memory_usage(Unit *u);
 void unit_dump(Unit *u, FILE *f, const char *prefix);
 
 bool unit_can_reload(Unit *u) _pure_;
@@ -70,7 +70,22 @@ int import_uncompress_detect(ImportCompress *c, const void *data, size_t size) {
         if (memcmp(data, xz_signature, sizeof(xz_signature)) == 0) {
                 lzma_ret xzr;
 
+#ifdef HAVE_LZMA_STREAM_DECODER_MT
+                /* Images are large, and xz files written with more
+                 * than one thread consist of independent blocks that
+                 * may be decoded in parallel. Single block files are
+                 * simply decoded in the calling thread. */
+                lzma_mt mt = {
+                        .flags = LZMA_TELL_UNSUPPORTED_CHECK,
+                        .threads = MAX(lzma_cputhreads(), 1U),
+                        .memlimit_threading = lzma_physmem() / 4,
+                        .memlimit_stop = UINT64_MAX,
+                };
+
+                xzr = lzma_stream_decoder_mt(&c->xz, &mt);
+#else
                 xzr = lzma_stream_decoder(&c->xz, UINT64_MAX, LZMA_TELL_UNSUPPORTED_CHECK);
+#endif
                 if (xzr != LZMA_OK)
                         return -EIO;
 
@@ -128,7 +143,7 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
                 c->xz.next_in = data;
                 c->xz.avail_in = size;
 
-                while (c->xz.avail_in > 0) {
+                for (;;) {
                         uint8_t buffer[16 * 1024];
                         lzma_ret lzr;
 
@@ -142,6 +157,15 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
                         r = callback(buffer, sizeof(buffer) - c->xz.avail_out, userdata);
                         if (r < 0)
                                 return r;
+
+                        if (lzr == LZMA_STREAM_END)
+                                break;
+
+                        /* A full buffer means there might be more
+                         * output pending, even if all input was
+                         * consumed */
+                        if (c->xz.avail_in == 0 && c->xz.avail_out > 0)
+                                break;
                 }
 
                 break;
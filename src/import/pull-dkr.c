@@ -28,6 +28,7 @@
 #include "btrfs-util.h"
 #include "utf8.h"
 #include "mkdir.h"
+#include "copy.h"
 #include "rm-rf.h"
 #include "path-util.h"
 #include "import-util.h"
@@ -64,6 +65,11 @@ struct DkrPull {
         PullJob *json_job;
         PullJob *layer_job;
 
+        /* The next layer to extract after the current one, fetched
+         * into a temporary file while the current one is extracted */
+        PullJob *prefetch_job;
+        unsigned prefetch_ancestry;
+
         char *name;
         char *reference;
         char *id;
@@ -112,6 +118,7 @@ DkrPull* dkr_pull_unref(DkrPull *i) {
         pull_job_unref(i->ancestry_job);
         pull_job_unref(i->json_job);
         pull_job_unref(i->layer_job);
+        pull_job_unref(i->prefetch_job);
 
         curl_glue_unref(i->glue);
         sd_event_unref(i->event);
@@ -458,6 +465,9 @@ static bool dkr_pull_is_done(DkrPull *i) {
         if (i->layer_job && i->layer_job->state != PULL_JOB_DONE)
                 return false;
 
+        if (i->prefetch_job)
+                return false;
+
         if (dkr_pull_current_layer(i))
                 return false;
 
@@ -506,20 +516,19 @@ static int dkr_pull_make_local_copy(DkrPull *i, DkrPullVersion version) {
         return 0;
 }
 
-static int dkr_pull_job_on_open_disk(PullJob *j) {
+static int dkr_pull_open_layer(DkrPull *i) {
         const char *base;
-        DkrPull *i;
         int r;
 
-        assert(j);
-        assert(j->userdata);
-
-        i = j->userdata;
-        assert(i->layer_job == j);
+        assert(i);
         assert(i->final_path);
         assert(!i->temp_path);
         assert(i->tar_pid <= 0);
 
+        /* Creates the tree for the current layer, on top of its
+         * base, and returns a pipe to the tar process unpacking into
+         * it */
+
         r = tempfn_random(i->final_path, NULL, &i->temp_path);
         if (r < 0)
                 return log_oom();
@@ -537,13 +546,108 @@ static int dkr_pull_job_on_open_disk(PullJob *j) {
         if (r < 0)
                 return log_error_errno(r, "Failed to make btrfs subvolume %s: %m", i->temp_path);
 
-        j->disk_fd = import_fork_tar_x(i->temp_path, &i->tar_pid);
+        return import_fork_tar_x(i->temp_path, &i->tar_pid);
+}
+
+static int dkr_pull_finish_layer(DkrPull *i) {
+        int r;
+
+        assert(i);
+        assert(i->temp_path);
+        assert(i->final_path);
+
+        if (i->tar_pid > 0) {
+                r = wait_for_terminate_and_warn("tar", i->tar_pid, true);
+                i->tar_pid = 0;
+                if (r < 0)
+                        return r;
+        }
+
+        r = aufs_resolve(i->temp_path);
+        if (r < 0)
+                return log_error_errno(r, "Failed to resolve aufs whiteouts: %m");
+
+        r = btrfs_subvol_set_read_only(i->temp_path, true);
+        if (r < 0)
+                return log_error_errno(r, "Failed to mark snapshot read-only: %m");
+
+        if (rename(i->temp_path, i->final_path) < 0)
+                return log_error_errno(errno, "Failed to rename snaphsot: %m");
+
+        log_info("Completed writing to layer %s.", i->final_path);
+
+        i->temp_path = mfree(i->temp_path);
+        i->final_path = mfree(i->final_path);
+
+        i->current_ancestry ++;
+
+        return 0;
+}
+
+static int dkr_pull_job_on_open_disk(PullJob *j) {
+        DkrPull *i;
+
+        assert(j);
+        assert(j->userdata);
+
+        i = j->userdata;
+        assert(i->layer_job == j);
+
+        j->disk_fd = dkr_pull_open_layer(i);
         if (j->disk_fd < 0)
                 return j->disk_fd;
 
         return 0;
 }
 
+static int dkr_pull_job_on_open_disk_prefetch(PullJob *j) {
+        DkrPull *i;
+
+        assert(j);
+        assert(j->userdata);
+
+        i = j->userdata;
+        assert(i->prefetch_job == j);
+
+        j->disk_fd = open_tmpfile(i->image_root, O_RDWR|O_CLOEXEC);
+        if (j->disk_fd < 0)
+                return log_error_errno(j->disk_fd, "Failed to create temporary file for layer: %m");
+
+        return 0;
+}
+
+static int dkr_pull_extract_prefetched(DkrPull *i) {
+        _cleanup_close_ int fd = -1;
+        PullJob *j;
+        int r;
+
+        assert(i);
+        assert(i->prefetch_job);
+        assert(i->prefetch_job->state == PULL_JOB_DONE);
+
+        j = i->prefetch_job;
+
+        log_info("Extracting prefetched layer %s...", dkr_pull_current_layer(i));
+
+        fd = dkr_pull_open_layer(i);
+        if (fd < 0)
+                return fd;
+
+        if (j->disk_fd >= 0) {
+                if (lseek(j->disk_fd, 0, SEEK_SET) == (off_t) -1)
+                        return log_error_errno(errno, "Failed to seek in layer file: %m");
+
+                r = copy_bytes(j->disk_fd, fd, (uint64_t) -1, false);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to pass layer to tar: %m");
+        }
+
+        fd = safe_close(fd);
+        i->prefetch_job = pull_job_unref(i->prefetch_job);
+
+        return dkr_pull_finish_layer(i);
+}
+
 static void dkr_pull_job_on_progress(PullJob *j) {
         DkrPull *i;
 
@@ -562,68 +666,87 @@ static void dkr_pull_job_on_progress(PullJob *j) {
 
 static void dkr_pull_job_on_finished_v2(PullJob *j);
 
-static int dkr_pull_pull_layer_v2(DkrPull *i) {
-        _cleanup_free_ char *path = NULL;
-        const char *url, *layer = NULL;
+static int dkr_pull_make_layer_job(DkrPull *i, const char *layer, DkrPullVersion version, PullJob **ret) {
+        _cleanup_(pull_job_unrefp) PullJob *j = NULL;
+        const char *url;
         int r;
 
         assert(i);
-        assert(!i->layer_job);
-        assert(!i->temp_path);
-        assert(!i->final_path);
+        assert(layer);
+        assert(ret);
 
-        for (;;) {
-                layer = dkr_pull_current_layer(i);
-                if (!layer)
-                        return 0; /* no more layers */
+        if (version == DKR_PULL_V1)
+                url = strjoina(PROTOCOL_PREFIX, i->response_registries[0], "/v1/images/", layer, "/layer");
+        else
+                url = strjoina(PROTOCOL_PREFIX, i->response_registries[0], "/v2/", i->name, "/blobs/", layer);
 
-                path = strjoin(i->image_root, "/.dkr-", layer, NULL);
-                if (!path)
-                        return log_oom();
+        r = pull_job_new(&j, url, i->glue, i);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate layer job: %m");
 
+        if (version == DKR_PULL_V1)
+                r = dkr_pull_add_token(i, j);
+        else
+                r = dkr_pull_add_bearer_token(i, j);
+        if (r < 0)
+                return log_oom();
+
+        j->on_finished = version == DKR_PULL_V1 ? dkr_pull_job_on_finished : dkr_pull_job_on_finished_v2;
+        j->on_open_disk = dkr_pull_job_on_open_disk;
+        j->on_progress = dkr_pull_job_on_progress;
+        j->grow_machine_directory = i->grow_machine_directory;
+
+        *ret = j;
+        j = NULL;
+
+        return 0;
+}
+
+static int dkr_pull_prefetch_layer(DkrPull *i, DkrPullVersion version) {
+        unsigned k;
+        int r;
+
+        assert(i);
+
+        if (i->prefetch_job)
+                return 0;
+
+        /* Download the next missing layer while the current one is
+         * processed, it is extracted once its base is complete */
+
+        for (k = i->current_ancestry + 1; k < i->n_ancestry; k++) {
+                const char *path;
+
+                path = strjoina(i->image_root, "/.dkr-", i->ancestry[k]);
                 if (laccess(path, F_OK) < 0) {
                         if (errno == ENOENT)
                                 break;
 
                         return log_error_errno(errno, "Failed to check for container: %m");
                 }
-
-                log_info("Layer %s already exists, skipping.", layer);
-
-                i->current_ancestry++;
-
-                path = mfree(path);
         }
 
-        log_info("Pulling layer %s...", layer);
-
-        i->final_path = path;
-        path = NULL;
+        if (k >= i->n_ancestry)
+                return 0;
 
-        url = strjoina(PROTOCOL_PREFIX, i->response_registries[0], "/v2/", i->name, "/blobs/", layer);
-        r = pull_job_new(&i->layer_job, url, i->glue, i);
-        if (r < 0)
-                return log_error_errno(r, "Failed to allocate layer job: %m");
+        log_info("Prefetching layer %s...", i->ancestry[k]);
 
-        r = dkr_pull_add_bearer_token(i, i->layer_job);
+        r = dkr_pull_make_layer_job(i, i->ancestry[k], version, &i->prefetch_job);
         if (r < 0)
-                return log_oom();
+                return r;
 
-        i->layer_job->on_finished = dkr_pull_job_on_finished_v2;
-        i->layer_job->on_open_disk = dkr_pull_job_on_open_disk;
-        i->layer_job->on_progress = dkr_pull_job_on_progress;
-        i->layer_job->grow_machine_directory = i->grow_machine_directory;
+        i->prefetch_job->on_open_disk = dkr_pull_job_on_open_disk_prefetch;
+        i->prefetch_ancestry = k;
 
-        r = pull_job_begin(i->layer_job);
+        r = pull_job_begin(i->prefetch_job);
         if (r < 0)
                 return log_error_errno(r, "Failed to start layer job: %m");
 
         return 0;
 }
 
-static int dkr_pull_pull_layer(DkrPull *i) {
-        _cleanup_free_ char *path = NULL;
-        const char *url, *layer = NULL;
+static int dkr_pull_pull_layer(DkrPull *i, DkrPullVersion version) {
+        const char *layer = NULL;
         int r;
 
         assert(i);
@@ -632,6 +755,8 @@ static int dkr_pull_pull_layer(DkrPull *i) {
         assert(!i->final_path);
 
         for (;;) {
+                _cleanup_free_ char *path = NULL;
+
                 layer = dkr_pull_current_layer(i);
                 if (!layer)
                         return 0; /* no more layers */
@@ -640,44 +765,62 @@ static int dkr_pull_pull_layer(DkrPull *i) {
                 if (!path)
                         return log_oom();
 
-                if (laccess(path, F_OK) < 0) {
-                        if (errno == ENOENT)
-                                break;
+                if (laccess(path, F_OK) >= 0) {
+                        log_info("Layer %s already exists, skipping.", layer);
 
-                        return log_error_errno(errno, "Failed to check for container: %m");
+                        i->current_ancestry++;
+                        continue;
                 }
 
-                log_info("Layer %s already exists, skipping.", layer);
+                if (errno != ENOENT)
+                        return log_error_errno(errno, "Failed to check for container: %m");
+
+                i->final_path = path;
+                path = NULL;
+
+                if (!i->prefetch_job || i->prefetch_ancestry != i->current_ancestry)
+                        break;
 
-                i->current_ancestry++;
+                /* If the prefetch is still running, we continue when it is done */
+                if (i->prefetch_job->state != PULL_JOB_DONE)
+                        return 0;
 
-                path = mfree(path);
+                r = dkr_pull_extract_prefetched(i);
+                if (r < 0)
+                        return r;
         }
 
         log_info("Pulling layer %s...", layer);
 
-        i->final_path = path;
-        path = NULL;
-
-        url = strjoina(PROTOCOL_PREFIX, i->response_registries[0], "/v1/images/", layer, "/layer");
-        r = pull_job_new(&i->layer_job, url, i->glue, i);
+        r = dkr_pull_make_layer_job(i, layer, version, &i->layer_job);
         if (r < 0)
-                return log_error_errno(r, "Failed to allocate layer job: %m");
+                return r;
 
-        r = dkr_pull_add_token(i, i->layer_job);
+        r = pull_job_begin(i->layer_job);
         if (r < 0)
-                return log_oom();
+                return log_error_errno(r, "Failed to start layer job: %m");
 
-        i->layer_job->on_finished = dkr_pull_job_on_finished;
-        i->layer_job->on_open_disk = dkr_pull_job_on_open_disk;
-        i->layer_job->on_progress = dkr_pull_job_on_progress;
-        i->layer_job->grow_machine_directory = i->grow_machine_directory;
+        return dkr_pull_prefetch_layer(i, version);
+}
 
-        r = pull_job_begin(i->layer_job);
+static int dkr_pull_prefetch_finished(DkrPull *i, DkrPullVersion version) {
+        int r;
+
+        assert(i);
+        assert(i->prefetch_job);
+
+        /* Nothing to do yet if the base of this layer is still being
+         * worked on */
+        if (i->layer_job ||
+            !i->final_path ||
+            i->prefetch_ancestry != i->current_ancestry)
+                return 0;
+
+        r = dkr_pull_extract_prefetched(i);
         if (r < 0)
-                return log_error_errno(r, "Failed to start layer job: %m");
+                return r;
 
-        return 0;
+        return dkr_pull_pull_layer(i, version);
 }
 
 static int dkr_pull_job_on_header(PullJob *j, const char *header, size_t sz)  {
@@ -947,50 +1090,25 @@ static void dkr_pull_job_on_finished_v2(PullJob *j) {
 
                 dkr_pull_report_progress(i, DKR_DOWNLOADING);
 
-                r = dkr_pull_pull_layer_v2(i);
+                r = dkr_pull_pull_layer(i, DKR_PULL_V2);
                 if (r < 0)
                         goto finish;
 
         } else if (i->layer_job == j) {
-                assert(i->temp_path);
-                assert(i->final_path);
-
                 j->disk_fd = safe_close(j->disk_fd);
 
-                if (i->tar_pid > 0) {
-                        r = wait_for_terminate_and_warn("tar", i->tar_pid, true);
-                        i->tar_pid = 0;
-                        if (r < 0)
-                                goto finish;
-                }
-
-                r = aufs_resolve(i->temp_path);
-                if (r < 0) {
-                        log_error_errno(r, "Failed to resolve aufs whiteouts: %m");
+                r = dkr_pull_finish_layer(i);
+                if (r < 0)
                         goto finish;
-                }
 
-                r = btrfs_subvol_set_read_only(i->temp_path, true);
-                if (r < 0) {
-                        log_error_errno(r, "Failed to mark snapshot read-only: %m");
-                        goto finish;
-                }
+                i->layer_job = pull_job_unref(i->layer_job);
 
-                if (rename(i->temp_path, i->final_path) < 0) {
-                        log_error_errno(errno, "Failed to rename snaphsot: %m");
+                r = dkr_pull_pull_layer(i, DKR_PULL_V2);
+                if (r < 0)
                         goto finish;
-                }
-
-                log_info("Completed writing to layer %s.", i->final_path);
-
-                i->layer_job = pull_job_unref(i->layer_job);
-                free(i->temp_path);
-                i->temp_path = NULL;
-                free(i->final_path);
-                i->final_path = NULL;
 
-                i->current_ancestry ++;
-                r = dkr_pull_pull_layer_v2(i);
+        } else if (i->prefetch_job == j) {
+                r = dkr_pull_prefetch_finished(i, DKR_PULL_V2);
                 if (r < 0)
                         goto finish;
 
@@ -1174,48 +1292,25 @@ static void dkr_pull_job_on_finished(PullJob *j) {
 
                 dkr_pull_report_progress(i, DKR_DOWNLOADING);
 
-                r = dkr_pull_pull_layer(i);
+                r = dkr_pull_pull_layer(i, DKR_PULL_V1);
                 if (r < 0)
                         goto finish;
 
         } else if (i->layer_job == j) {
-                assert(i->temp_path);
-                assert(i->final_path);
-
                 j->disk_fd = safe_close(j->disk_fd);
 
-                if (i->tar_pid > 0) {
-                        r = wait_for_terminate_and_warn("tar", i->tar_pid, true);
-                        i->tar_pid = 0;
-                        if (r < 0)
-                                goto finish;
-                }
-
-                r = aufs_resolve(i->temp_path);
-                if (r < 0) {
-                        log_error_errno(r, "Failed to resolve aufs whiteouts: %m");
+                r = dkr_pull_finish_layer(i);
+                if (r < 0)
                         goto finish;
-                }
 
-                r = btrfs_subvol_set_read_only(i->temp_path, true);
-                if (r < 0) {
-                        log_error_errno(r, "Failed to mark snapshot read-only: %m");
-                        goto finish;
-                }
+                i->layer_job = pull_job_unref(i->layer_job);
 
-                if (rename(i->temp_path, i->final_path) < 0) {
-                        log_error_errno(errno, "Failed to rename snaphsot: %m");
+                r = dkr_pull_pull_layer(i, DKR_PULL_V1);
+                if (r < 0)
                         goto finish;
-                }
-
-                log_info("Completed writing to layer %s.", i->final_path);
-
-                i->layer_job = pull_job_unref(i->layer_job);
-                i->temp_path = mfree(i->temp_path);
-                i->final_path = mfree(i->final_path);
 
-                i->current_ancestry ++;
-                r = dkr_pull_pull_layer(i);
+        } else if (i->prefetch_job == j) {
+                r = dkr_pull_prefetch_finished(i, DKR_PULL_V1);
                 if (r < 0)
                         goto finish;
 
@@ -23,8 +23,16 @@
 
 #include "strv.h"
 #include "machine-pool.h"
+#include "btrfs-util.h"
 #include "pull-job.h"
 
+/* The unit in which data is compared with the reference file, a
+ * multiple of the block size of all file systems that support
+ * cloning */
+#define PULL_JOB_BLOCK_SIZE (128U * 1024U)
+
+static int pull_job_flush_block(PullJob *j);
+
 PullJob* pull_job_unref(PullJob *j) {
         if (!j)
                 return NULL;
@@ -33,6 +41,7 @@ PullJob* pull_job_unref(PullJob *j) {
         curl_slist_free_all(j->request_header);
 
         safe_close(j->disk_fd);
+        safe_close(j->reference_fd);
 
         import_compress_free(&j->compress);
 
@@ -44,6 +53,7 @@ PullJob* pull_job_unref(PullJob *j) {
         strv_free(j->old_etags);
         free(j->payload);
         free(j->checksum);
+        free(j->block);
 
         free(j);
 
@@ -140,6 +150,16 @@ void pull_job_curl_on_finished(CurlGlue *g, CURL *curl, CURLcode result) {
                 log_debug("SHA256 of %s is %s.", j->url, j->checksum);
         }
 
+        r = pull_job_flush_block(j);
+        if (r < 0)
+                goto finish;
+
+        if (j->written_cloned > 0) {
+                char bytes[FORMAT_BYTES_MAX];
+
+                log_info("Reused %s of the previous version of %s.", format_bytes(bytes, sizeof(bytes), j->written_cloned), j->url);
+        }
+
         if (j->disk_fd >= 0 && j->allow_sparse) {
                 /* Make sure the file size is right, in case the file was
                  * sparse and we just seeked for the last part */
@@ -171,9 +191,103 @@ finish:
         pull_job_finish(j, r);
 }
 
+static int pull_job_write_disk(PullJob *j, const void *p, size_t sz) {
+        ssize_t n;
+
+        assert(j);
+        assert(j->disk_fd >= 0);
+
+        if (j->allow_sparse)
+                n = sparse_write(j->disk_fd, p, sz, 64);
+        else
+                n = write(j->disk_fd, p, sz);
+        if (n < 0)
+                return log_error_errno(errno, "Failed to write file: %m");
+        if ((size_t) n < sz) {
+                log_error("Short write");
+                return -EIO;
+        }
+
+        return 0;
+}
+
+static int pull_job_flush_block(PullJob *j) {
+        int r;
+
+        assert(j);
+
+        if (j->block_size <= 0)
+                return 0;
+
+        if (j->block_size == PULL_JOB_BLOCK_SIZE && j->reference_fd >= 0) {
+                uint8_t *old = j->block + PULL_JOB_BLOCK_SIZE;
+                ssize_t n;
+
+                n = pread(j->reference_fd, old, PULL_JOB_BLOCK_SIZE, j->block_offset);
+                if (n == PULL_JOB_BLOCK_SIZE && memcmp(j->block, old, PULL_JOB_BLOCK_SIZE) == 0) {
+
+                        r = btrfs_clone_range(j->reference_fd, j->block_offset, j->disk_fd, j->block_offset, PULL_JOB_BLOCK_SIZE);
+                        if (r >= 0) {
+                                if (lseek(j->disk_fd, j->block_offset + PULL_JOB_BLOCK_SIZE, SEEK_SET) == (off_t) -1)
+                                        return log_error_errno(errno, "Failed to seek on file descriptor: %m");
+
+                                j->written_cloned += PULL_JOB_BLOCK_SIZE;
+                                j->block_size = 0;
+                                return 0;
+                        }
+
+                        log_debug_errno(r, "Failed to clone data from previous version, writing everything: %m");
+                        j->reference_fd = safe_close(j->reference_fd);
+                }
+        }
+
+        r = pull_job_write_disk(j, j->block, j->block_size);
+        if (r < 0)
+                return r;
+
+        j->block_size = 0;
+        return 0;
+}
+
+static int pull_job_write_blocks(PullJob *j, const void *p, size_t sz) {
+        const uint8_t *q = p;
+        int r;
+
+        assert(j);
+
+        if (!j->block) {
+                /* One block collects the new data, the other one
+                 * receives the old data to compare with */
+                j->block = malloc(PULL_JOB_BLOCK_SIZE * 2);
+                if (!j->block)
+                        return log_oom();
+        }
+
+        while (sz > 0) {
+                size_t k;
+
+                if (j->block_size == 0)
+                        j->block_offset = j->written_uncompressed + (q - (const uint8_t*) p);
+
+                k = MIN(sz, PULL_JOB_BLOCK_SIZE - j->block_size);
+                memcpy(j->block + j->block_size, q, k);
+                j->block_size += k;
+                q += k;
+                sz -= k;
+
+                if (j->block_size >= PULL_JOB_BLOCK_SIZE) {
+                        r = pull_job_flush_block(j);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        return 0;
+}
+
 static int pull_job_write_uncompressed(const void *p, size_t sz, void *userdata) {
         PullJob *j = userdata;
-        ssize_t n;
+        int r;
 
         assert(j);
         assert(p);
@@ -198,16 +312,15 @@ static int pull_job_write_uncompressed(const void *p, size_t sz, void *userdata)
                         grow_machine_directory();
                 }
 
-                if (j->allow_sparse)
-                        n = sparse_write(j->disk_fd, p, sz, 64);
-                else
-                        n = write(j->disk_fd, p, sz);
-                if (n < 0)
-                        return log_error_errno(errno, "Failed to write file: %m");
-                if ((size_t) n < sz) {
-                        log_error("Short write");
-                        return -EIO;
+                if (j->reference_fd >= 0 && j->allow_sparse)
+                        r = pull_job_write_blocks(j, p, sz);
+                else {
+                        r = pull_job_flush_block(j);
+                        if (r >= 0)
+                                r = pull_job_write_disk(j, p, sz);
                 }
+                if (r < 0)
+                        return r;
         } else {
 
                 if (!GREEDY_REALLOC(j->payload, j->payload_allocated, j->payload_size + sz))
@@ -520,6 +633,7 @@ int pull_job_new(PullJob **ret, const char *url, CurlGlue *glue, void *userdata)
 
         j->state = PULL_JOB_INIT;
         j->disk_fd = -1;
+        j->reference_fd = -1;
         j->userdata = userdata;
         j->glue = glue;
         j->content_length = (uint64_t) -1;
@@ -105,6 +105,15 @@ struct PullJob {
 
         bool grow_machine_directory;
         uint64_t written_since_last_grow;
+
+        /* A previous version of the file being downloaded. Blocks
+         * that did not change are cloned from it, rather than
+         * written again. */
+        int reference_fd;
+        uint8_t *block;
+        size_t block_size;
+        uint64_t block_offset;
+        uint64_t written_cloned;
 };
 
 int pull_job_new(PullJob **job, const char *url, CurlGlue *glue, void *userdata);
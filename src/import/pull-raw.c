@@ -475,6 +475,57 @@ finish:
                 sd_event_exit(i->event, r);
 }
 
+static int raw_pull_open_reference(RawPull *i, PullJob *j) {
+        _cleanup_close_ int fd = -1;
+        usec_t newest = 0;
+        char **etag;
+        int r;
+
+        assert(i);
+        assert(j);
+
+        /* Find the most recent version of this image we already
+         * have. Most blocks of an image tend to stay in place from
+         * one version to the next, and on btrfs they can be shared
+         * with the new version rather than written out again. */
+
+        STRV_FOREACH(etag, j->old_etags) {
+                _cleanup_free_ char *p = NULL;
+                _cleanup_close_ int k = -1;
+                struct stat st;
+
+                r = pull_make_path(j->url, *etag, i->image_root, ".raw-", ".raw", &p);
+                if (r < 0)
+                        return log_oom();
+
+                k = open(p, O_RDONLY|O_NOCTTY|O_CLOEXEC);
+                if (k < 0)
+                        continue;
+
+                if (fstat(k, &st) < 0 || !S_ISREG(st.st_mode))
+                        continue;
+
+                if (fd >= 0 && timespec_load(&st.st_mtim) <= newest)
+                        continue;
+
+                if (btrfs_is_filesystem(k) <= 0)
+                        continue;
+
+                safe_close(fd);
+                fd = k;
+                k = -1;
+                newest = timespec_load(&st.st_mtim);
+        }
+
+        if (fd >= 0)
+                log_debug("Comparing download with a previous version of the image.");
+
+        j->reference_fd = fd;
+        fd = -1;
+
+        return 0;
+}
+
 static int raw_pull_job_on_open_disk_raw(PullJob *j) {
         RawPull *i;
         int r;
@@ -505,7 +556,7 @@ static int raw_pull_job_on_open_disk_raw(PullJob *j) {
         if (r < 0)
                 log_warning_errno(errno, "Failed to set file attributes on %s: %m", i->temp_path);
 
-        return 0;
+        return raw_pull_open_reference(i, j);
 }
 
 static int raw_pull_job_on_open_disk_settings(PullJob *j) {
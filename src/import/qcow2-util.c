@@ -79,32 +79,54 @@ static uint32_t HEADER_HEADER_LENGTH(const Header *h) {
         return be32toh(h->header_length);
 }
 
-static int copy_cluster(
+/* Clusters which are adjacent both in the image and in the file are
+ * copied in one go, up to this size */
+#define EXTENT_SIZE_MAX (1024ULL*1024ULL)
+
+static int write_sparse(int fd, uint64_t offset, const void *buffer, uint64_t size) {
+        ssize_t l;
+
+        /* The target file is empty, hence only write what is not
+         * zero and leave holes elsewhere */
+
+        if (lseek(fd, offset, SEEK_SET) == (off_t) -1)
+                return -errno;
+
+        l = sparse_write(fd, buffer, size, 64);
+        if (l < 0)
+                return (int) l;
+        if ((uint64_t) l != size)
+                return -EIO;
+
+        return 0;
+}
+
+static int copy_extent(
                 int sfd, uint64_t soffset,
                 int dfd, uint64_t doffset,
-                uint64_t cluster_size,
-                void *buffer) {
+                uint64_t size,
+                void *buffer,
+                bool *reflink) {
 
         ssize_t l;
         int r;
 
-        r = btrfs_clone_range(sfd, soffset, dfd, doffset, cluster_size);
-        if (r >= 0)
-                return r;
+        if (*reflink) {
+                r = btrfs_clone_range(sfd, soffset, dfd, doffset, size);
+                if (r >= 0)
+                        return r;
 
-        l = pread(sfd, buffer, cluster_size, soffset);
-        if (l < 0)
-                return -errno;
-        if ((uint64_t) l != cluster_size)
-                return -EIO;
+                /* If it failed once it will fail again, don't bother */
+                *reflink = false;
+        }
 
-        l = pwrite(dfd, buffer, cluster_size, doffset);
+        l = pread(sfd, buffer, size, soffset);
         if (l < 0)
                 return -errno;
-        if ((uint64_t) l != cluster_size)
+        if ((uint64_t) l != size)
                 return -EIO;
 
-        return 0;
+        return write_sparse(dfd, doffset, buffer, size);
 }
 
 static int decompress_cluster(
@@ -153,13 +175,7 @@ static int decompress_cluster(
         if (r != Z_STREAM_END || sz != cluster_size)
                 return -EIO;
 
-        l = pwrite(dfd, buffer2, cluster_size, doffset);
-        if (l < 0)
-                return -errno;
-        if ((uint64_t) l != cluster_size)
-                return -EIO;
-
-        return 0;
+        return write_sparse(dfd, doffset, buffer2, cluster_size);
 }
 
 static int normalize_offset(
@@ -248,7 +264,8 @@ static int verify_header(const Header *header) {
 int qcow2_convert(int qcow2_fd, int raw_fd) {
         _cleanup_free_ void *buffer1 = NULL, *buffer2 = NULL;
         _cleanup_free_ be64_t *l1_table = NULL, *l2_table = NULL;
-        uint64_t sz, i;
+        uint64_t sz, i, extent_max, extent_begin = 0, extent_offset = 0, extent_size = 0;
+        bool reflink = true;
         Header header;
         ssize_t l;
         int r;
@@ -271,7 +288,9 @@ int qcow2_convert(int qcow2_fd, int raw_fd) {
         if (!l2_table)
                 return -ENOMEM;
 
-        buffer1 = malloc(HEADER_CLUSTER_SIZE(&header));
+        extent_max = MAX(EXTENT_SIZE_MAX, HEADER_CLUSTER_SIZE(&header));
+
+        buffer1 = malloc(extent_max);
         if (!buffer1)
                 return -ENOMEM;
 
@@ -286,6 +305,9 @@ int qcow2_convert(int qcow2_fd, int raw_fd) {
         if (ftruncate(raw_fd, HEADER_SIZE(&header)) < 0)
                 return -errno;
 
+        /* Data clusters are mostly stored in ascending order */
+        (void) posix_fadvise(qcow2_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
         sz = sizeof(uint64_t) * HEADER_L1_SIZE(&header);
         l = pread(qcow2_fd, l1_table, sz, HEADER_L1_TABLE_OFFSET(&header));
         if (l < 0)
@@ -320,22 +342,54 @@ int qcow2_convert(int qcow2_fd, int raw_fd) {
                         if (r == 0)
                                 continue;
 
-                        if (compressed)
+                        if (!compressed &&
+                            extent_size > 0 &&
+                            extent_begin + extent_size == data_begin &&
+                            extent_offset + extent_size == p &&
+                            extent_size + HEADER_CLUSTER_SIZE(&header) <= extent_max) {
+                                /* Directly follows the previous cluster, copy them together */
+                                extent_size += HEADER_CLUSTER_SIZE(&header);
+                                continue;
+                        }
+
+                        if (extent_size > 0) {
+                                r = copy_extent(
+                                                qcow2_fd, extent_begin,
+                                                raw_fd, extent_offset,
+                                                extent_size, buffer1,
+                                                &reflink);
+                                if (r < 0)
+                                        return r;
+
+                                extent_size = 0;
+                        }
+
+                        if (compressed) {
                                 r = decompress_cluster(
                                                 qcow2_fd, data_begin,
                                                 raw_fd, p,
                                                 compressed_size, HEADER_CLUSTER_SIZE(&header),
                                                 buffer1, buffer2);
-                        else
-                                r = copy_cluster(
-                                                qcow2_fd, data_begin,
-                                                raw_fd, p,
-                                                HEADER_CLUSTER_SIZE(&header), buffer1);
-                        if (r < 0)
-                                return r;
+                                if (r < 0)
+                                        return r;
+                        } else {
+                                extent_begin = data_begin;
+                                extent_offset = p;
+                                extent_size = HEADER_CLUSTER_SIZE(&header);
+                        }
                 }
         }
 
+        if (extent_size > 0) {
+                r = copy_extent(
+                                qcow2_fd, extent_begin,
+                                raw_fd, extent_offset,
+                                extent_size, buffer1,
+                                &reflink);
+                if (r < 0)
+                        return r;
+        }
+
         return 0;
 }
 
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include <microhttpd.h>
 
@@ -70,6 +71,23 @@ typedef struct RequestMeta {
         bool n_fields_set;
 } RequestMeta;
 
+/* Opening the journal maps all files, which dominates short requests
+ * like the ones a dashboard polls with. Handles are hence kept once a
+ * request is done, and picked up by the next one, which may run in a
+ * different connection thread. The inotify watches keep the set of
+ * files up to date, but we don't rely on them for too long. */
+#define JOURNAL_POOL_MAX 16
+#define JOURNAL_POOL_IDLE_USEC (60 * USEC_PER_SEC)
+
+typedef struct PooledJournal {
+        sd_journal *journal;
+        usec_t released;
+} PooledJournal;
+
+static pthread_mutex_t journal_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static PooledJournal journal_pool[JOURNAL_POOL_MAX];
+static unsigned n_journal_pool = 0;
+
 static const char* const mime_types[_OUTPUT_MODE_MAX] = {
         [OUTPUT_SHORT] = "text/plain",
         [OUTPUT_JSON] = "application/json",
@@ -92,6 +110,27 @@ static RequestMeta *request_meta(void **connection_cls) {
         return m;
 }
 
+static void release_journal(sd_journal *j) {
+        if (!j)
+                return;
+
+        /* Matches are the only state a request leaves behind that
+         * the next one does not reset itself */
+        sd_journal_flush_matches(j);
+
+        assert_se(pthread_mutex_lock(&journal_pool_lock) == 0);
+        if (n_journal_pool < JOURNAL_POOL_MAX) {
+                journal_pool[n_journal_pool++] = (PooledJournal) {
+                        .journal = j,
+                        .released = now(CLOCK_MONOTONIC),
+                };
+                j = NULL;
+        }
+        assert_se(pthread_mutex_unlock(&journal_pool_lock) == 0);
+
+        sd_journal_close(j);
+}
+
 static void request_meta_free(
                 void *cls,
                 struct MHD_Connection *connection,
@@ -103,7 +142,7 @@ static void request_meta_free(
         if (!m)
                 return;
 
-        sd_journal_close(m->journal);
+        release_journal(m->journal);
 
         safe_fclose(m->tmp);
 
@@ -112,12 +151,59 @@ static void request_meta_free(
 }
 
 static int open_journal(RequestMeta *m) {
+        sd_journal *j = NULL;
+        usec_t n;
+        int r;
+
         assert(m);
 
         if (m->journal)
                 return 0;
 
-        return sd_journal_open(&m->journal, SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_SYSTEM);
+        n = now(CLOCK_MONOTONIC);
+
+        assert_se(pthread_mutex_lock(&journal_pool_lock) == 0);
+        while (n_journal_pool > 0) {
+                PooledJournal *p = &journal_pool[--n_journal_pool];
+
+                /* The most recently released one is the first to
+                 * try, if it is too old, so are all others */
+                if (p->released + JOURNAL_POOL_IDLE_USEC > n) {
+                        j = p->journal;
+                        break;
+                }
+
+                sd_journal_close(p->journal);
+        }
+        assert_se(pthread_mutex_unlock(&journal_pool_lock) == 0);
+
+        if (j) {
+                /* Catch up with files added, rotated or removed
+                 * since the handle was used last */
+                r = sd_journal_process(j);
+                if (r >= 0) {
+                        m->journal = j;
+                        return 0;
+                }
+
+                log_debug_errno(r, "Failed to process pooled journal, opening a new one: %m");
+                sd_journal_close(j);
+        }
+
+        r = sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_SYSTEM);
+        if (r < 0)
+                return r;
+
+        /* Set up the inotify watches right away, so that the handle
+         * can be brought up to date when it is reused */
+        r = sd_journal_get_fd(j);
+        if (r < 0) {
+                sd_journal_close(j);
+                return r;
+        }
+
+        m->journal = j;
+        return 0;
 }
 
 static int request_meta_ensure_tmp(RequestMeta *m) {
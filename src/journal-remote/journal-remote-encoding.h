@@ -0,0 +1,77 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#pragma once
+
+#include "macro.h"
+#include "util.h"
+#include "sparse-endian.h"
+#include "journal-def.h"
+
+/* A compressed upload body is a sequence of frames, each carrying a
+ * batch of the export format compressed with compress_blob_*(). A
+ * batch that doesn't compress is sent as is, with size == raw_size.
+ * Batches are cut at arbitrary points, not at entry boundaries. */
+typedef struct UploadFrameHeader {
+        le64_t size;       /* bytes of payload following the header */
+        le64_t raw_size;   /* bytes of export format once decompressed */
+} _packed_ UploadFrameHeader;
+
+#define UPLOAD_BATCH_SIZE (1024*1024u)
+#define UPLOAD_FRAME_RAW_MAX (16*1024*1024u)
+
+static inline const char *upload_encoding_to_string(int compression) {
+        switch (compression) {
+        case OBJECT_COMPRESSED_XZ:
+                return "x-journal-xz";
+        case OBJECT_COMPRESSED_LZ4:
+                return "x-journal-lz4";
+        case OBJECT_COMPRESSED_ZSTD:
+                return "x-journal-zstd";
+        default:
+                return NULL;
+        }
+}
+
+static inline int upload_encoding_from_string(const char *s) {
+        if (streq(s, "x-journal-xz"))
+                return OBJECT_COMPRESSED_XZ;
+        if (streq(s, "x-journal-lz4"))
+                return OBJECT_COMPRESSED_LZ4;
+        if (streq(s, "x-journal-zstd"))
+                return OBJECT_COMPRESSED_ZSTD;
+        return -EINVAL;
+}
+
+static inline bool upload_encoding_supported(int compression) {
+        switch (compression) {
+#ifdef HAVE_XZ
+        case OBJECT_COMPRESSED_XZ:
+#endif
+#ifdef HAVE_LZ4
+        case OBJECT_COMPRESSED_LZ4:
+#endif
+#ifdef HAVE_ZSTD
+        case OBJECT_COMPRESSED_ZSTD:
+#endif
+                return true;
+        default:
+                return false;
+        }
+}
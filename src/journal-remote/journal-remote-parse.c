@@ -20,10 +20,21 @@
 ***/
 
 #include "journal-remote-parse.h"
+#include "journal-remote-encoding.h"
 #include "journald-native.h"
+#include "compress.h"
 
 #define LINE_CHUNK 8*1024u
 
+static void free_retired_buffers(RemoteSource *source) {
+        size_t i;
+
+        for (i = 0; i < source->n_retired; i++)
+                free(source->retired[i]);
+
+        source->n_retired = 0;
+}
+
 void source_free(RemoteSource *source) {
         if (!source)
                 return;
@@ -35,6 +46,10 @@ void source_free(RemoteSource *source) {
 
         free(source->name);
         free(source->buf);
+        free(source->frame);
+        free(source->decoded);
+        free_retired_buffers(source);
+        free(source->retired);
         iovw_free_contents(&source->iovw);
 
         log_debug("Writer ref count %i", source->writer->n_ref);
@@ -71,21 +86,95 @@ RemoteSource* source_new(int fd, bool passive_fd, char *name, Writer *writer) {
         return source;
 }
 
-static char* realloc_buffer(RemoteSource *source, size_t size) {
-        char *b, *old = source->buf;
+static size_t needed_offset(RemoteSource *source) {
+
+        /* Returns the offset of the first byte in the buffer which
+         * we still need. The fields of the current entry which are
+         * complete are referenced by iovw, and stay where they
+         * are. A binary field is put together in place once its data
+         * is complete, so we need to keep its name and size around
+         * until then. */
+
+        switch (source->state) {
+        case STATE_DATA_START:
+                return source->offset - source->field_len;
+        case STATE_DATA:
+                return source->offset - source->field_len - sizeof(uint64_t);
+        default:
+                return source->offset;
+        }
+}
+
+static int reserve_buffer(RemoteSource *source, size_t n) {
+        size_t keep, live, size;
+        char *b;
+
+        assert(source);
+        assert(source->filled <= source->size);
 
-        b = GREEDY_REALLOC(source->buf, source->size, size);
+        /* Makes sure there are at least n bytes free at the end of
+         * the buffer. Instead of growing the buffer in place, which
+         * would move the data iovw points to, we start a new buffer
+         * with only the data we still need copied over, and keep the
+         * old one around until the entry is written. */
+
+        if (source->size - source->filled >= n)
+                return 0;
+
+        keep = source->buf ? needed_offset(source) : 0;
+        assert(keep <= source->filled);
+        live = source->filled - keep;
+
+        /* The entry may be spread over several buffers by now, make
+         * sure it stays within bounds in total */
+        if (iovw_size(&source->iovw) + live + n > ENTRY_SIZE_MAX)
+                return -E2BIG;
+
+        if (source->iovw.count == 0 && source->size - live >= n) {
+                /* Nothing points into the buffer, and there's enough
+                 * room if we just move things to the front */
+                memmove(source->buf, source->buf + keep, live);
+                goto rebase;
+        }
+
+        /* Grow exponentially while a single field is being read, so
+         * that the data we copy over is amortized. */
+        size = MAX3(live + n, (size_t) LINE_CHUNK, 2 * live);
+
+        b = malloc(size);
         if (!b)
-                return NULL;
+                return -ENOMEM;
+
+        if (live > 0)
+                memcpy(b, source->buf + keep, live);
+
+        if (source->buf) {
+                if (source->iovw.count > 0) {
+                        if (!GREEDY_REALLOC(source->retired, source->n_retired_allocated, source->n_retired + 1)) {
+                                free(b);
+                                return -ENOMEM;
+                        }
+
+                        source->retired[source->n_retired++] = source->buf;
+                } else
+                        free(source->buf);
+        }
 
-        iovw_rebase(&source->iovw, old, source->buf);
+        source->buf = b;
+        source->size = size;
 
-        return b;
+ rebase:
+        source->filled = live;
+        source->offset -= keep;
+        source->scanned = source->scanned > keep ? source->scanned - keep : 0;
+
+        return 0;
 }
 
 static int get_line(RemoteSource *source, char **line, size_t *size) {
         ssize_t n;
         char *c = NULL;
+        int r;
 
         assert(source);
         assert(source->state == STATE_LINE);
@@ -114,16 +203,16 @@ static int get_line(RemoteSource *source, char **line, size_t *size) {
                         /* we have to wait for some data to come to us */
                         return -EAGAIN;
 
-                /* We know that source->filled is at most DATA_SIZE_MAX, so if
-                   we reallocate it, we'll increase the size at least a bit. */
-                assert_cc(DATA_SIZE_MAX < ENTRY_SIZE_MAX);
-                if (source->size - source->filled < LINE_CHUNK &&
-                    !realloc_buffer(source, MIN(source->filled + LINE_CHUNK, ENTRY_SIZE_MAX)))
-                                return log_oom();
+                r = reserve_buffer(source, LINE_CHUNK);
+                if (r == -E2BIG) {
+                        log_error("Entry is bigger than %u bytes.", ENTRY_SIZE_MAX);
+                        return r;
+                }
+                if (r < 0)
+                        return log_oom();
 
                 assert(source->buf);
-                assert(source->size - source->filled >= LINE_CHUNK ||
-                       source->size == ENTRY_SIZE_MAX);
+                assert(source->size - source->filled >= LINE_CHUNK);
 
                 n = read(source->fd,
                          source->buf + source->filled,
@@ -148,10 +237,17 @@ static int get_line(RemoteSource *source, char **line, size_t *size) {
 }
 
 int push_data(RemoteSource *source, const char *data, size_t size) {
+        int r;
+
         assert(source);
         assert(source->state != STATE_EOF);
 
-        if (!realloc_buffer(source, source->filled + size)) {
+        r = reserve_buffer(source, size);
+        if (r == -E2BIG) {
+                log_error("Entry is bigger than %u bytes.", ENTRY_SIZE_MAX);
+                return r;
+        }
+        if (r < 0) {
                 log_error("Failed to store received data of size %zu "
                           "(in addition to existing %zu bytes with %zu filled): %s",
                           size, source->size, source->filled, strerror(ENOMEM));
@@ -164,6 +260,92 @@ int push_data(RemoteSource *source, const char *data, size_t size) {
         return 0;
 }
 
+static int push_frame(RemoteSource *source) {
+        const UploadFrameHeader *h;
+        const char *payload;
+        uint64_t size, raw_size;
+        size_t n;
+        int r;
+
+        h = (const UploadFrameHeader*) source->frame;
+        payload = source->frame + sizeof(UploadFrameHeader);
+        size = le64toh(h->size);
+        raw_size = le64toh(h->raw_size);
+
+        if (size == raw_size)
+                return push_data(source, payload, size);
+
+        /* LZ4 blobs carry their own idea of the decompressed size,
+         * which is what the buffer is allocated for */
+        if (source->encoding == OBJECT_COMPRESSED_LZ4 &&
+            (size <= 8 || le64toh(*(const le64_t*) payload) != raw_size))
+                return -EBADMSG;
+
+        r = decompress_blob(source->encoding, payload, size,
+                            &source->decoded, &source->decoded_allocated, &n, raw_size);
+        if (r < 0)
+                return r;
+        if (n != raw_size)
+                return -EBADMSG;
+
+        return push_data(source, source->decoded, n);
+}
+
+int push_encoded_data(RemoteSource *source, const char *data, size_t size) {
+        int r;
+
+        assert(source);
+        assert(source->encoding > 0);
+
+        while (size > 0) {
+                size_t need, n;
+
+                if (source->frame_filled < sizeof(UploadFrameHeader))
+                        need = sizeof(UploadFrameHeader);
+                else
+                        need = sizeof(UploadFrameHeader) +
+                                le64toh(((UploadFrameHeader*) source->frame)->size);
+
+                if (!GREEDY_REALLOC(source->frame, source->frame_allocated, need))
+                        return log_oom();
+
+                n = MIN(need - source->frame_filled, size);
+                memcpy(source->frame + source->frame_filled, data, n);
+                source->frame_filled += n;
+                data += n;
+                size -= n;
+
+                if (source->frame_filled < need)
+                        break;
+
+                if (need == sizeof(UploadFrameHeader)) {
+                        const UploadFrameHeader *h = (const UploadFrameHeader*) source->frame;
+
+                        if (le64toh(h->raw_size) > UPLOAD_FRAME_RAW_MAX) {
+                                log_error("Frame declares %"PRIu64" bytes of data, maximum is %u.",
+                                          le64toh(h->raw_size), UPLOAD_FRAME_RAW_MAX);
+                                return -E2BIG;
+                        }
+
+                        if (le64toh(h->size) == 0 ||
+                            le64toh(h->size) > le64toh(h->raw_size)) {
+                                log_error("Invalid frame header.");
+                                return -EBADMSG;
+                        }
+
+                        continue;
+                }
+
+                r = push_frame(source);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to decode frame: %m");
+
+                source->frame_filled = 0;
+        }
+
+        return 0;
+}
+
 static int fill_fixed_size(RemoteSource *source, void **data, size_t size) {
 
         assert(source);
@@ -179,13 +361,18 @@ static int fill_fixed_size(RemoteSource *source, void **data, size_t size) {
         assert(data);
 
         while (source->filled - source->offset < size) {
-                int n;
+                int n, r;
 
                 if (source->passive_fd)
                         /* we have to wait for some data to come to us */
                         return -EAGAIN;
 
-                if (!realloc_buffer(source, source->offset + size))
+                r = reserve_buffer(source, source->offset + size - source->filled);
+                if (r == -E2BIG) {
+                        log_error("Entry is bigger than %u bytes.", ENTRY_SIZE_MAX);
+                        return r;
+                }
+                if (r < 0)
                         return log_oom();
 
                 n = read(source->fd, source->buf + source->filled,
@@ -469,6 +656,7 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
 
  freeing:
         iovw_free_contents(&source->iovw);
+        free_retired_buffers(source);
 
         /* possibly reset buffer position */
         remain = source->filled - source->offset;
@@ -483,7 +671,7 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
         }
 
         target = source->size;
-        while (target > 16 * LINE_CHUNK && remain < target / 2)
+        while (target > 16 * LINE_CHUNK && source->filled < target / 2)
                 target /= 2;
         if (target < source->size) {
                 char *tmp;
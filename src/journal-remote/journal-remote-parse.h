@@ -43,6 +43,19 @@ typedef struct RemoteSource {
         size_t scanned;    /* number of bytes since the beginning of data without a newline */
         size_t filled;     /* total number of bytes in the buffer */
 
+        /* Earlier buffers that iovw still points into, they are
+         * freed once the entry has been written */
+        char **retired;
+        size_t n_retired, n_retired_allocated;
+
+        /* Content-Encoding of the upload, 0 for plain export format,
+         * and the frame being reassembled for the encoded case */
+        int encoding;
+        char *frame;
+        size_t frame_filled, frame_allocated;
+        void *decoded;
+        size_t decoded_allocated;
+
         size_t field_len;  /* used for binary fields: the field name length */
         size_t data_size;  /* and the size of the binary data chunk being processed */
 
@@ -52,6 +65,7 @@ typedef struct RemoteSource {
         dual_timestamp ts;
 
         Writer *writer;
+        RemoteServer *server; /* the one handling the connection */
 
         sd_event_source *event;
         sd_event_source *buffer_event;
@@ -62,9 +76,10 @@ RemoteSource* source_new(int fd, bool passive_fd, char *name, Writer *writer);
 static inline size_t source_non_empty(RemoteSource *source) {
         assert(source);
 
-        return source->filled;
+        return source->filled + source->frame_filled;
 }
 
 void source_free(RemoteSource *source);
 int push_data(RemoteSource *source, const char *data, size_t size);
+int push_encoded_data(RemoteSource *source, const char *data, size_t size);
 int process_source(RemoteSource *source, bool compress, bool seal);
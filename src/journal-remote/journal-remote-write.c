@@ -43,13 +43,6 @@ size_t iovw_size(struct iovec_wrapper *iovw) {
         return n;
 }
 
-void iovw_rebase(struct iovec_wrapper *iovw, char *old, char *new) {
-        size_t i;
-
-        for (i = 0; i < iovw->count; i++)
-                iovw->iovec[i].iov_base = (char*) iovw->iovec[i].iov_base - old + new;
-}
-
 /**********************************************************************
  **********************************************************************
  **********************************************************************/
@@ -66,6 +59,16 @@ static int do_rotate(JournalFile **f, bool compress, bool seal) {
         return r;
 }
 
+static pthread_mutex_t writers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void writers_lock(void) {
+        assert_se(pthread_mutex_lock(&writers_mutex) == 0);
+}
+
+void writers_unlock(void) {
+        assert_se(pthread_mutex_unlock(&writers_mutex) == 0);
+}
+
 Writer* writer_new(RemoteServer *server) {
         Writer *w;
 
@@ -81,6 +84,8 @@ Writer* writer_new(RemoteServer *server) {
                 return NULL;
         }
 
+        assert_se(pthread_mutex_init(&w->mutex, NULL) == 0);
+
         w->n_ref = 1;
         w->server = server;
 
@@ -96,38 +101,52 @@ Writer* writer_free(Writer *w) {
                 journal_file_close(w->journal);
         }
 
-        if (w->server && w->hashmap_key)
-                hashmap_remove(w->server->writers, w->hashmap_key);
-
         free(w->hashmap_key);
 
         if (w->mmap)
                 mmap_cache_unref(w->mmap);
 
+        pthread_mutex_destroy(&w->mutex);
         free(w);
 
         return NULL;
 }
 
 Writer* writer_unref(Writer *w) {
-        if (w && (-- w->n_ref <= 0))
+        bool last;
+
+        if (!w)
+                return NULL;
+
+        writers_lock();
+
+        last = -- w->n_ref <= 0;
+        if (last && w->server && w->hashmap_key)
+                hashmap_remove(w->server->writers, w->hashmap_key);
+
+        writers_unlock();
+
+        if (last)
                 writer_free(w);
 
         return NULL;
 }
 
 Writer* writer_ref(Writer *w) {
-        if (w)
+        if (w) {
+                writers_lock();
                 assert_se(++ w->n_ref >= 2);
+                writers_unlock();
+        }
 
         return w;
 }
 
-int writer_write(Writer *w,
-                 struct iovec_wrapper *iovw,
-                 dual_timestamp *ts,
-                 bool compress,
-                 bool seal) {
+static int writer_write_locked(Writer *w,
+                               struct iovec_wrapper *iovw,
+                               dual_timestamp *ts,
+                               bool compress,
+                               bool seal) {
         int r;
 
         assert(w);
@@ -146,7 +165,7 @@ int writer_write(Writer *w,
                                       &w->seqnum, NULL, NULL);
         if (r >= 0) {
                 if (w->server)
-                        w->server->event_count += 1;
+                        __sync_fetch_and_add(&w->server->event_count, 1);
                 return 1;
         }
 
@@ -164,6 +183,22 @@ int writer_write(Writer *w,
                 return r;
 
         if (w->server)
-                w->server->event_count += 1;
+                __sync_fetch_and_add(&w->server->event_count, 1);
         return 1;
 }
+
+int writer_write(Writer *w,
+                 struct iovec_wrapper *iovw,
+                 dual_timestamp *ts,
+                 bool compress,
+                 bool seal) {
+        int r;
+
+        assert(w);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        r = writer_write_locked(w, iovw, ts, compress, seal);
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        return r;
+}
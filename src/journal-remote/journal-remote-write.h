@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <pthread.h>
 
 #include "journal-file.h"
 
@@ -35,9 +36,13 @@ struct iovec_wrapper {
 int iovw_put(struct iovec_wrapper *iovw, void* data, size_t len);
 void iovw_free_contents(struct iovec_wrapper *iovw);
 size_t iovw_size(struct iovec_wrapper *iovw);
-void iovw_rebase(struct iovec_wrapper *iovw, char *old, char *new);
 
+/* Writers may be shared by the worker threads. Lookups and reference
+ * counting happen under writers_lock(), writing to the journal under
+ * the writer's own mutex. */
 typedef struct Writer {
+        pthread_mutex_t mutex;
+
         JournalFile *journal;
         JournalMetrics metrics;
 
@@ -53,6 +58,9 @@ typedef struct Writer {
 Writer* writer_new(RemoteServer* server);
 Writer* writer_free(Writer *w);
 
+void writers_lock(void);
+void writers_unlock(void);
+
 Writer* writer_ref(Writer *w);
 Writer* writer_unref(Writer *w);
 
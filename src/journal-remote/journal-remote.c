@@ -46,6 +46,7 @@
 
 #include "journal-remote.h"
 #include "journal-remote-write.h"
+#include "journal-remote-encoding.h"
 
 #define REMOTE_JOURNAL_PATH "/var/log/journal/remote"
 
@@ -67,6 +68,8 @@ static char** arg_gnutls_log = NULL;
 static JournalWriteSplitMode arg_split_mode = JOURNAL_WRITE_SPLIT_HOST;
 static char* arg_output = NULL;
 
+static unsigned arg_workers = 0;
+
 static char *arg_key = NULL;
 static char *arg_cert = NULL;
 static char *arg_trust = NULL;
@@ -164,18 +167,21 @@ static int spawn_getter(const char *getter, const char *url) {
 
 #define filename_escape(s) xescape((s), "/ ")
 
-static int open_output(Writer *w, const char* host) {
-        _cleanup_free_ char *_output = NULL;
-        const char *output;
-        int r;
+static int output_path(const char *host, char **ret) {
+        char *output;
+
+        assert(ret);
 
         switch (arg_split_mode) {
         case JOURNAL_WRITE_SPLIT_NONE:
-                output = arg_output ?: REMOTE_JOURNAL_PATH "/remote.journal";
+                output = strdup(arg_output ?: REMOTE_JOURNAL_PATH "/remote.journal");
+                if (!output)
+                        return log_oom();
                 break;
 
         case JOURNAL_WRITE_SPLIT_HOST: {
                 _cleanup_free_ char *name;
+                int r;
 
                 assert(host);
 
@@ -183,13 +189,12 @@ static int open_output(Writer *w, const char* host) {
                 if (!name)
                         return log_oom();
 
-                r = asprintf(&_output, "%s/remote-%s.journal",
+                r = asprintf(&output, "%s/remote-%s.journal",
                              arg_output ?: REMOTE_JOURNAL_PATH,
                              name);
                 if (r < 0)
                         return log_oom();
 
-                output = _output;
                 break;
         }
 
@@ -197,6 +202,13 @@ static int open_output(Writer *w, const char* host) {
                 assert_not_reached("what?");
         }
 
+        *ret = output;
+        return 0;
+}
+
+static int open_output(Writer *w, const char* output) {
+        int r;
+
         r = journal_file_open_reliably(output,
                                        O_RDWR|O_CREAT, 0640,
                                        arg_compress, arg_seal,
@@ -216,75 +228,67 @@ static int open_output(Writer *w, const char* host) {
  **********************************************************************/
 
 static int init_writer_hashmap(RemoteServer *s) {
-        static const struct hash_ops *hash_ops[] = {
-                [JOURNAL_WRITE_SPLIT_NONE] = NULL,
-                [JOURNAL_WRITE_SPLIT_HOST] = &string_hash_ops,
-        };
-
-        assert(arg_split_mode >= 0 && arg_split_mode < (int) ELEMENTSOF(hash_ops));
-
-        s->writers = hashmap_new(hash_ops[arg_split_mode]);
+        s->writers = hashmap_new(&string_hash_ops);
         if (!s->writers)
                 return log_oom();
 
         return 0;
 }
 
-static int get_writer(RemoteServer *s, const char *host,
-                      Writer **writer) {
-        const void *key;
+/* This should go away as soon as µhttpd allows state to be passed around. */
+static RemoteServer *server;
+
+static int get_writer(const char *host, Writer **writer) {
         _cleanup_writer_unref_ Writer *w = NULL;
+        _cleanup_free_ char *output = NULL;
         int r;
 
-        switch(arg_split_mode) {
-        case JOURNAL_WRITE_SPLIT_NONE:
-                key = "one and only";
-                break;
+        /* Writers are looked up by the file they write to, so that
+         * all connections of a host share one, regardless of how
+         * they came in, and of the thread that handles them. They
+         * all belong to the main server. */
 
-        case JOURNAL_WRITE_SPLIT_HOST:
-                assert(host);
-                key = host;
-                break;
+        r = output_path(host, &output);
+        if (r < 0)
+                return r;
 
-        default:
-                assert_not_reached("what split mode?");
-        }
+        writers_lock();
 
-        w = hashmap_get(s->writers, key);
+        w = hashmap_get(server->writers, output);
         if (w)
-                writer_ref(w);
+                w->n_ref++;
         else {
-                w = writer_new(s);
-                if (!w)
-                        return log_oom();
-
-                if (arg_split_mode == JOURNAL_WRITE_SPLIT_HOST) {
-                        w->hashmap_key = strdup(key);
-                        if (!w->hashmap_key)
-                                return log_oom();
+                w = writer_new(server);
+                if (!w) {
+                        r = log_oom();
+                        goto finish;
                 }
 
-                r = open_output(w, host);
+                r = open_output(w, output);
                 if (r < 0)
-                        return r;
+                        goto finish;
 
-                r = hashmap_put(s->writers, w->hashmap_key ?: key, w);
+                r = hashmap_put(server->writers, output, w);
                 if (r < 0)
-                        return r;
+                        goto finish;
+
+                w->hashmap_key = output;
+                output = NULL;
         }
 
         *writer = w;
         w = NULL;
-        return 0;
+        r = 0;
+
+finish:
+        writers_unlock();
+        return r;
 }
 
 /**********************************************************************
  **********************************************************************
  **********************************************************************/
 
-/* This should go away as soon as µhttpd allows state to be passed around. */
-static RemoteServer *server;
-
 static int dispatch_raw_source_event(sd_event_source *event,
                                      int fd,
                                      uint32_t revents,
@@ -315,7 +319,7 @@ static int get_source_for_fd(RemoteServer *s,
         if (!GREEDY_REALLOC0(s->sources, s->sources_size, fd + 1))
                 return log_oom();
 
-        r = get_writer(s, name, &writer);
+        r = get_writer(name, &writer);
         if (r < 0)
                 return log_warning_errno(r, "Failed to get writer for source %s: %m",
                                          name);
@@ -327,6 +331,8 @@ static int get_source_for_fd(RemoteServer *s,
                         return log_oom();
                 }
 
+                s->sources[fd]->server = s;
+
                 s->active++;
         }
 
@@ -459,7 +465,7 @@ static int request_meta(void **connection_cls, int fd, char *hostname) {
         if (*connection_cls)
                 return 0;
 
-        r = get_writer(server, hostname, &writer);
+        r = get_writer(hostname, &writer);
         if (r < 0)
                 return log_warning_errno(r, "Failed to get writer for source %s: %m",
                                          hostname);
@@ -470,6 +476,8 @@ static int request_meta(void **connection_cls, int fd, char *hostname) {
                 return log_oom();
         }
 
+        source->server = server;
+
         log_debug("Added RemoteSource as connection metadata %p", source);
 
         *connection_cls = source;
@@ -510,9 +518,21 @@ static int process_http_upload(
         if (*upload_data_size) {
                 log_trace("Received %zu bytes", *upload_data_size);
 
-                r = push_data(source, upload_data, *upload_data_size);
-                if (r < 0)
+                if (source->encoding > 0)
+                        r = push_encoded_data(source, upload_data, *upload_data_size);
+                else
+                        r = push_data(source, upload_data, *upload_data_size);
+                if (r == -ENOMEM)
                         return mhd_respond_oom(connection);
+                else if (r == -E2BIG)
+                        return mhd_respondf(connection,
+                                            MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                                            "Frame or entry is too large, maximum is %u bytes per frame and %u bytes per entry.\n",
+                                            UPLOAD_FRAME_RAW_MAX, ENTRY_SIZE_MAX);
+                else if (r < 0)
+                        return mhd_respondf(connection,
+                                            MHD_HTTP_UNPROCESSABLE_ENTITY,
+                                            "Failed to decode data: %s.", strerror(-r));
 
                 *upload_data_size = 0;
         } else
@@ -563,7 +583,7 @@ static int request_handler(
                 void **connection_cls) {
 
         const char *header;
-        int r, code, fd;
+        int r, code, fd, encoding = 0;
         _cleanup_free_ char *hostname = NULL;
 
         assert(connection);
@@ -593,6 +613,19 @@ static int request_handler(
                                    "Content-Type: application/vnd.fdo.journal"
                                    " is required.\n");
 
+        header = MHD_lookup_connection_value(connection,
+                                             MHD_HEADER_KIND, "Content-Encoding");
+        if (header && !streq(header, "identity")) {
+                encoding = upload_encoding_from_string(header);
+                if (encoding < 0 || !upload_encoding_supported(encoding))
+                        return mhd_respondf(connection, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE,
+                                            "Content-Encoding: %s is not supported, use one of:%s%s%s identity.\n",
+                                            header,
+                                            upload_encoding_supported(OBJECT_COMPRESSED_ZSTD) ? " x-journal-zstd" : "",
+                                            upload_encoding_supported(OBJECT_COMPRESSED_LZ4) ? " x-journal-lz4" : "",
+                                            upload_encoding_supported(OBJECT_COMPRESSED_XZ) ? " x-journal-xz" : "");
+        }
+
         {
                 const union MHD_ConnectionInfo *ci;
 
@@ -629,6 +662,7 @@ static int request_handler(
                                    strerror(-r));
 
         hostname = NULL;
+        ((RemoteSource*) *connection_cls)->encoding = encoding;
         return MHD_YES;
 }
 
@@ -962,7 +996,7 @@ static int remoteserver_init(RemoteServer *s,
                 /* In this case we know what the writer will be
                    called, so we can create it and verify that we can
                    create output as expected. */
-                r = get_writer(s, NULL, &s->_single_writer);
+                r = get_writer(NULL, &s->_single_writer);
                 if (r < 0)
                         return r;
         }
@@ -1002,6 +1036,193 @@ static void server_destroy(RemoteServer *s) {
  **********************************************************************
  **********************************************************************/
 
+typedef struct WorkerMessage {
+        int fd;
+        char *hostname;
+} WorkerMessage;
+
+static int dispatch_worker_message(sd_event_source *event,
+                                   int fd,
+                                   uint32_t revents,
+                                   void *userdata) {
+        RemoteServer *s = userdata;
+
+        for (;;) {
+                WorkerMessage m;
+                ssize_t n;
+
+                n = read(fd, &m, sizeof(m));
+                if (n < 0) {
+                        if (errno == EAGAIN)
+                                return 0;
+                        if (errno == EINTR)
+                                continue;
+
+                        return log_error_errno(errno, "Failed to read from worker pipe: %m");
+                }
+
+                /* Messages are smaller than PIPE_BUF, hence never split */
+                assert(n == 0 || n == sizeof(m));
+
+                if (n == 0 || m.fd < 0)
+                        /* We are being told to shut down */
+                        return sd_event_exit(s->events, 0);
+
+                /* This logs on its own, and failing one connection
+                 * shouldn't turn off the pipe */
+                (void) add_source(s, m.fd, m.hostname, true);
+        }
+}
+
+static void *worker_thread(void *p) {
+        RemoteWorker *w = p;
+        int r;
+
+        /* SIGINT and SIGTERM are blocked already, and are handled by
+         * the main thread */
+
+        prctl(PR_SET_NAME, (unsigned long) "remote-worker");
+
+        r = sd_event_loop(w->server.events);
+        if (r < 0)
+                log_error_errno(r, "Failed to run worker event loop: %m");
+
+        return NULL;
+}
+
+static void worker_done(RemoteWorker *w) {
+        assert(w);
+
+        w->server.writers = NULL;
+        server_destroy(&w->server);
+
+        safe_close(w->send_fd);
+        safe_close(w->receive_fd);
+}
+
+static int worker_init(RemoteWorker *w) {
+        int fds[2], r;
+
+        assert(w);
+
+        w->send_fd = w->receive_fd = -1;
+
+        r = sd_event_new(&w->server.events);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate worker event loop: %m");
+
+        /* Writers are shared with the main server */
+        w->server.writers = server->writers;
+
+        /* Only the receiving end is non-blocking, so that the main
+         * thread waits if a worker falls behind */
+        if (pipe2(fds, O_CLOEXEC) < 0)
+                return log_error_errno(errno, "Failed to create worker pipe: %m");
+
+        w->receive_fd = fds[0];
+        w->send_fd = fds[1];
+
+        r = fd_nonblock(w->receive_fd, true);
+        if (r < 0)
+                return log_error_errno(r, "Failed to make worker pipe non-blocking: %m");
+
+        r = sd_event_add_io(w->server.events, &w->server.listen_event,
+                            w->receive_fd, EPOLLIN,
+                            dispatch_worker_message, &w->server);
+        if (r < 0)
+                return log_error_errno(r, "Failed to register worker pipe: %m");
+
+        r = pthread_create(&w->thread, NULL, worker_thread, w);
+        if (r != 0)
+                return log_error_errno(r, "Failed to start worker thread: %m");
+
+        return 0;
+}
+
+static int setup_workers(RemoteServer *s, unsigned n) {
+        int r;
+
+        assert(s);
+        assert(!s->workers);
+
+        if (n <= 0)
+                return 0;
+
+        s->workers = new0(RemoteWorker, n);
+        if (!s->workers)
+                return log_oom();
+
+        while (s->n_workers < n) {
+                RemoteWorker *w = s->workers + s->n_workers;
+
+                r = worker_init(w);
+                if (r < 0) {
+                        worker_done(w);
+                        return r;
+                }
+
+                s->n_workers++;
+        }
+
+        log_debug("Started %u worker threads.", s->n_workers);
+        return 0;
+}
+
+static void stop_workers(RemoteServer *s) {
+        unsigned i;
+        int r;
+
+        assert(s);
+
+        for (i = 0; i < s->n_workers; i++) {
+                WorkerMessage m = { .fd = -1 };
+
+                r = loop_write(s->workers[i].send_fd, &m, sizeof(m), false);
+                if (r < 0)
+                        log_error_errno(r, "Failed to stop worker: %m");
+        }
+
+        for (i = 0; i < s->n_workers; i++) {
+                RemoteWorker *w = s->workers + i;
+
+                assert_se(pthread_join(w->thread, NULL) == 0);
+
+                worker_done(w);
+        }
+
+        s->workers = mfree(s->workers);
+        s->n_workers = 0;
+}
+
+static int hand_off_source(RemoteServer *s, int fd, char *hostname) {
+        static const uint8_t hash_key[HASH_KEY_SIZE] = {};
+        WorkerMessage m = {
+                .fd = fd,
+                .hostname = hostname,
+        };
+        RemoteWorker *w;
+        int r;
+
+        /* This takes ownership of fd and hostname, even on failure. */
+
+        assert(s);
+        assert(s->n_workers > 0);
+        assert(hostname);
+
+        /* All connections of a host go to the same worker, so that
+         * the workers don't contend for the lock of one writer. */
+        w = s->workers + string_hash_func(hostname, hash_key) % s->n_workers;
+
+        r = loop_write(w->send_fd, &m, sizeof(m), false);
+        if (r < 0) {
+                safe_close(fd);
+                free(hostname);
+                return log_error_errno(r, "Failed to hand connection over to worker: %m");
+        }
+
+        return 0;
+}
+
 static int handle_raw_source(sd_event_source *event,
                              int fd,
                              uint32_t revents,
@@ -1038,7 +1259,7 @@ static int handle_raw_source(sd_event_source *event,
                 return 0;
         } else if (r < 0) {
                 log_debug_errno(r, "Closing connection: %m");
-                remove_source(server, fd);
+                remove_source(s, fd);
                 return 0;
         } else
                 return 1;
@@ -1052,7 +1273,7 @@ static int dispatch_raw_source_until_block(sd_event_source *event,
         /* Make sure event stays around even if source is destroyed */
         sd_event_source_ref(event);
 
-        r = handle_raw_source(event, source->fd, EPOLLIN, server);
+        r = handle_raw_source(event, source->fd, EPOLLIN, source->server);
         if (r != 1)
                 /* No more data for now */
                 sd_event_source_set_enabled(event, SD_EVENT_OFF);
@@ -1072,7 +1293,7 @@ static int dispatch_raw_source_event(sd_event_source *event,
         assert(source->event);
         assert(source->buffer_event);
 
-        r = handle_raw_source(event, fd, EPOLLIN, server);
+        r = handle_raw_source(event, fd, EPOLLIN, source->server);
         if (r == 1)
                 /* Might have more data. We need to rerun the handler
                  * until we are sure the buffer is exhausted. */
@@ -1085,7 +1306,7 @@ static int dispatch_blocking_source_event(sd_event_source *event,
                                           void *userdata) {
         RemoteSource *source = userdata;
 
-        return handle_raw_source(event, source->fd, EPOLLIN, server);
+        return handle_raw_source(event, source->fd, EPOLLIN, source->server);
 }
 
 static int accept_connection(const char* type, int fd,
@@ -1151,6 +1372,9 @@ static int dispatch_raw_connection_event(sd_event_source *event,
         if (fd2 < 0)
                 return fd2;
 
+        if (s->n_workers > 0)
+                return hand_off_source(s, fd2, hostname);
+
         return add_source(s, fd2, hostname, true);
 }
 
@@ -1205,6 +1429,7 @@ static void help(void) {
                "     --gnutls-log=CATEGORY...\n"
                "                            Specify a list of gnutls logging categories\n"
                "     --split-mode=none|host How many output files to create\n"
+               "     --workers=N            Process raw connections in N threads\n"
                "\n"
                "Note: file descriptors from sd_listen_fds() will be consumed, too.\n"
                , program_invocation_short_name);
@@ -1225,6 +1450,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CERT,
                 ARG_TRUST,
                 ARG_GNUTLS_LOG,
+                ARG_WORKERS,
         };
 
         static const struct option options[] = {
@@ -1243,6 +1469,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "cert",         required_argument, NULL, ARG_CERT         },
                 { "trust",        required_argument, NULL, ARG_TRUST        },
                 { "gnutls-log",   required_argument, NULL, ARG_GNUTLS_LOG   },
+                { "workers",      required_argument, NULL, ARG_WORKERS      },
                 {}
         };
 
@@ -1429,6 +1656,15 @@ static int parse_argv(int argc, char *argv[]) {
 #endif
                 }
 
+                case ARG_WORKERS:
+                        r = safe_atou(optarg, &arg_workers);
+                        if (r < 0) {
+                                log_error("Failed to parse --workers= parameter: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -1470,6 +1706,11 @@ static int parse_argv(int argc, char *argv[]) {
                 return -EINVAL;
         }
 
+        if (arg_workers > 0 && arg_split_mode != JOURNAL_WRITE_SPLIT_HOST) {
+                log_error("Option --workers= requires SplitMode=host.");
+                return -EINVAL;
+        }
+
         log_debug("Full config: SplitMode=%s Key=%s Cert=%s Trust=%s",
                   journal_write_split_mode_to_string(arg_split_mode),
                   strna(arg_key),
@@ -1534,6 +1775,9 @@ int main(int argc, char **argv) {
         if (remoteserver_init(&s, key, cert, trust) < 0)
                 return EXIT_FAILURE;
 
+        if (setup_workers(&s, arg_workers) < 0)
+                return EXIT_FAILURE;
+
         r = sd_event_set_watchdog(s.events, true);
         if (r < 0)
                 log_error_errno(r, "Failed to enable watchdog: %m");
@@ -1560,6 +1804,8 @@ int main(int argc, char **argv) {
                 }
         }
 
+        stop_workers(&s);
+
         sd_notifyf(false,
                    "STOPPING=1\n"
                    "STATUS=Shutting down after writing %" PRIu64 " entries...", s.event_count);
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <pthread.h>
 
 #include "sd-event.h"
 #include "hashmap.h"
@@ -30,6 +31,7 @@
 #include "journal-remote-write.h"
 
 typedef struct MHDDaemonWrapper MHDDaemonWrapper;
+typedef struct RemoteWorker RemoteWorker;
 
 struct MHDDaemonWrapper {
         uint64_t fd;
@@ -52,4 +54,16 @@ struct RemoteServer {
 
         bool check_trust;
         Hashmap *daemons;
+
+        /* If set, raw connections are handed off to these */
+        RemoteWorker *workers;
+        unsigned n_workers;
+};
+
+/* A thread with its own event loop, sources and writers */
+struct RemoteWorker {
+        RemoteServer server;
+
+        pthread_t thread;
+        int send_fd, receive_fd;
 };
@@ -5,6 +5,8 @@
 #include "util.h"
 #include "log.h"
 #include "utf8.h"
+#include "compress.h"
+#include "journal-remote-encoding.h"
 #include "journal-upload.h"
 
 /**
@@ -223,25 +225,22 @@ static ssize_t write_entry(char *buf, size_t size, Uploader *u) {
         assert_not_reached("WTF?");
 }
 
-static size_t journal_input_callback(void *buf, size_t size, size_t nmemb, void *userp) {
-        Uploader *u = userp;
-        int r;
+static ssize_t fill_buffer(Uploader *u, char *buf, size_t size) {
         sd_journal *j;
         size_t filled = 0;
         ssize_t w;
+        int r;
 
         assert(u);
-        assert(nmemb <= SSIZE_MAX / size);
 
         j = u->journal;
 
-        while (j && filled < size * nmemb) {
+        while (j && filled < size) {
                 if (u->entry_state == ENTRY_DONE) {
                         r = sd_journal_next(j);
-                        if (r < 0) {
-                                log_error_errno(r, "Failed to move to next entry in journal: %m");
-                                return CURL_READFUNC_ABORT;
-                        } else if (r == 0) {
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to move to next entry in journal: %m");
+                        else if (r == 0) {
                                 if (u->input_event)
                                         log_debug("No more entries, waiting for journal.");
                                 else {
@@ -257,14 +256,14 @@ static size_t journal_input_callback(void *buf, size_t size, size_t nmemb, void
                         u->entry_state = ENTRY_CURSOR;
                 }
 
-                w = write_entry((char*)buf + filled, size * nmemb - filled, u);
+                w = write_entry(buf + filled, size - filled, u);
                 if (w < 0)
-                        return CURL_READFUNC_ABORT;
+                        return w;
                 filled += w;
 
                 if (filled == 0) {
                         log_error("Buffer space is too small to write entry.");
-                        return CURL_READFUNC_ABORT;
+                        return -ENOBUFS;
                 } else if (u->entry_state != ENTRY_DONE)
                         /* This means that all available space was used up */
                         break;
@@ -276,6 +275,149 @@ static size_t journal_input_callback(void *buf, size_t size, size_t nmemb, void
         return filled;
 }
 
+static size_t encode_frame(int compression, const char *raw, size_t n, char *out) {
+        UploadFrameHeader *h = (UploadFrameHeader*) out;
+        size_t size;
+
+        assert(n > 0);
+        assert(n <= UPLOAD_BATCH_SIZE);
+
+        if (compress_blob_explicit(compression, raw, n,
+                                   out + sizeof(UploadFrameHeader), &size) < 0) {
+                /* Does not compress, send it as is */
+                memcpy(out + sizeof(UploadFrameHeader), raw, n);
+                size = n;
+        }
+
+        h->size = htole64(size);
+        h->raw_size = htole64(n);
+
+        return sizeof(UploadFrameHeader) + size;
+}
+
+/* Collect up to UPLOAD_BATCH_SIZE bytes of export format and turn
+ * them into a single frame. Returns the size of the frame, 0 if there
+ * was nothing left to send. */
+static ssize_t fill_batch(Uploader *u) {
+        ssize_t n;
+
+        assert(u);
+        assert(u->compression > 0);
+
+        if (!u->batch) {
+                u->batch = malloc(sizeof(UploadFrameHeader) + UPLOAD_BATCH_SIZE);
+                if (!u->batch)
+                        return log_oom();
+        }
+
+        if (!GREEDY_REALLOC(u->raw, u->raw_allocated, UPLOAD_BATCH_SIZE))
+                return log_oom();
+
+        n = fill_buffer(u, u->raw, UPLOAD_BATCH_SIZE);
+        if (n <= 0)
+                return n;
+
+        u->batch_filled = encode_frame(u->compression, u->raw, n, u->batch);
+        u->batch_pos = 0;
+
+        return u->batch_filled;
+}
+
+ssize_t fill_upload_request(Uploader *u, char **body, size_t *allocated) {
+        size_t filled, size = 0, pos;
+        ssize_t n;
+
+        assert(u);
+        assert(body);
+        assert(allocated);
+
+        if (!GREEDY_REALLOC(u->raw, u->raw_allocated, UPLOAD_BATCH_SIZE))
+                return log_oom();
+
+        n = fill_buffer(u, u->raw, UPLOAD_BATCH_SIZE);
+        if (n < 0)
+                return n;
+        filled = n;
+
+        /* A request has to end on an entry boundary, finish the
+         * entry we stopped in the middle of */
+        while (u->entry_state != ENTRY_DONE) {
+                if (!GREEDY_REALLOC(u->raw, u->raw_allocated, filled + UPLOAD_BATCH_SIZE))
+                        return log_oom();
+
+                n = write_entry(u->raw + filled, UPLOAD_BATCH_SIZE, u);
+                if (n < 0)
+                        return n;
+                if (n == 0) {
+                        log_error("Buffer space is too small to write entry.");
+                        return -ENOBUFS;
+                }
+
+                filled += n;
+        }
+
+        if (filled == 0)
+                return 0;
+
+        if (u->compression <= 0) {
+                char *t;
+
+                /* Hand over the buffer, and keep the old body for
+                 * the next request */
+                t = *body;
+                *body = u->raw;
+                u->raw = t;
+
+                pos = *allocated;
+                *allocated = u->raw_allocated;
+                u->raw_allocated = pos;
+
+                return filled;
+        }
+
+        if (!GREEDY_REALLOC(*body, *allocated,
+                            filled + DIV_ROUND_UP(filled, UPLOAD_BATCH_SIZE) * sizeof(UploadFrameHeader)))
+                return log_oom();
+
+        for (pos = 0; pos < filled; pos += UPLOAD_BATCH_SIZE)
+                size += encode_frame(u->compression, u->raw + pos,
+                                     MIN(filled - pos, (size_t) UPLOAD_BATCH_SIZE),
+                                     *body + size);
+
+        return size;
+}
+
+static size_t journal_input_callback(void *buf, size_t size, size_t nmemb, void *userp) {
+        Uploader *u = userp;
+        size_t n;
+        ssize_t r;
+
+        assert(u);
+        assert(nmemb <= SSIZE_MAX / size);
+
+        if (u->compression <= 0) {
+                r = fill_buffer(u, buf, size * nmemb);
+                if (r < 0)
+                        return CURL_READFUNC_ABORT;
+
+                return r;
+        }
+
+        if (u->batch_pos >= u->batch_filled) {
+                r = fill_batch(u);
+                if (r < 0)
+                        return CURL_READFUNC_ABORT;
+                if (r == 0)
+                        return 0;
+        }
+
+        n = MIN(size * nmemb, u->batch_filled - u->batch_pos);
+        memcpy(buf, u->batch + u->batch_pos, n);
+        u->batch_pos += n;
+
+        return n;
+}
+
 void close_journal_input(Uploader *u) {
         assert(u);
 
@@ -299,6 +441,11 @@ static int process_journal_input(Uploader *u, int skip) {
 
         /* have data */
         u->entry_state = ENTRY_CURSOR;
+        u->batch_filled = u->batch_pos = 0;
+
+        if (u->parallel > 1)
+                return upload_requests(u);
+
         return start_upload(u, journal_input_callback, u);
 }
 
@@ -35,6 +35,7 @@
 #include "sigbus.h"
 #include "formats-util.h"
 #include "signal-util.h"
+#include "journal-remote-encoding.h"
 #include "journal-upload.h"
 
 #define PRIV_KEY_FILE CERTIFICATE_ROOT "/private/journal-upload.pem"
@@ -55,6 +56,8 @@ static const char *arg_machine = NULL;
 static bool arg_merge = false;
 static int arg_follow = -1;
 static const char *arg_save_state = NULL;
+static int arg_compression = 0;
+static unsigned arg_parallel = 1;
 
 static void close_fd_input(Uploader *u);
 
@@ -77,16 +80,16 @@ static size_t output_callback(char *buf,
                               size_t size,
                               size_t nmemb,
                               void *userp) {
-        Uploader *u = userp;
+        char **answer = userp;
 
-        assert(u);
+        assert(answer);
 
         log_debug("The server answers (%zu bytes): %.*s",
                   size*nmemb, (int)(size*nmemb), buf);
 
-        if (nmemb && !u->answer) {
-                u->answer = strndup(buf, size*nmemb);
-                if (!u->answer)
+        if (nmemb && !*answer) {
+                *answer = strndup(buf, size*nmemb);
+                if (!*answer)
                         log_warning_errno(ENOMEM, "Failed to store server answer (%zu bytes): %m",
                                           size*nmemb);
         }
@@ -176,6 +179,106 @@ static int load_cursor_state(Uploader *u) {
 
 
 
+static int build_header(Uploader *u, bool chunked, struct curl_slist **ret) {
+        struct curl_slist *h, *t;
+
+        assert(u);
+        assert(ret);
+
+        h = curl_slist_append(NULL, "Content-Type: application/vnd.fdo.journal");
+        if (!h)
+                return log_oom();
+
+        if (chunked) {
+                t = curl_slist_append(h, "Transfer-Encoding: chunked");
+                if (!t)
+                        goto oom;
+                h = t;
+        }
+
+        t = curl_slist_append(h, "Accept: text/plain");
+        if (!t)
+                goto oom;
+        h = t;
+
+        if (u->compression > 0) {
+                const char *e;
+
+                e = strjoina("Content-Encoding: ", upload_encoding_to_string(u->compression));
+                t = curl_slist_append(h, e);
+                if (!t)
+                        goto oom;
+                h = t;
+        }
+
+        *ret = h;
+        return 0;
+
+oom:
+        curl_slist_free_all(h);
+        return log_oom();
+}
+
+/* Options shared by all handles: where to, how to authenticate, and
+ * where the error message and the answer of the server go */
+static int setup_handle(Uploader *u,
+                        CURL *curl,
+                        struct curl_slist *header,
+                        char *error,
+                        char **answer) {
+        CURLcode code;
+
+        /* tell it to POST to the URL */
+        easy_setopt(curl, CURLOPT_POST, 1L,
+                    LOG_ERR, return -EXFULL);
+
+        easy_setopt(curl, CURLOPT_ERRORBUFFER, error,
+                    LOG_ERR, return -EXFULL);
+
+        /* set where to write to */
+        easy_setopt(curl, CURLOPT_WRITEFUNCTION, output_callback,
+                    LOG_ERR, return -EXFULL);
+
+        easy_setopt(curl, CURLOPT_WRITEDATA, answer,
+                    LOG_ERR, return -EXFULL);
+
+        /* use our special own mime type and chunked transfer */
+        easy_setopt(curl, CURLOPT_HTTPHEADER, header,
+                    LOG_ERR, return -EXFULL);
+
+        if (_unlikely_(log_get_max_level() >= LOG_DEBUG))
+                /* enable verbose for easier tracing */
+                easy_setopt(curl, CURLOPT_VERBOSE, 1L, LOG_WARNING, );
+
+        easy_setopt(curl, CURLOPT_USERAGENT,
+                    "systemd-journal-upload " PACKAGE_STRING,
+                    LOG_WARNING, );
+
+        if (arg_key || startswith(u->url, "https://")) {
+                easy_setopt(curl, CURLOPT_SSLKEY, arg_key ?: PRIV_KEY_FILE,
+                            LOG_ERR, return -EXFULL);
+                easy_setopt(curl, CURLOPT_SSLCERT, arg_cert ?: CERT_FILE,
+                            LOG_ERR, return -EXFULL);
+        }
+
+        if (streq_ptr(arg_trust, "all"))
+                easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0,
+                            LOG_ERR, return -EUCLEAN);
+        else if (arg_trust || startswith(u->url, "https://"))
+                easy_setopt(curl, CURLOPT_CAINFO, arg_trust ?: TRUST_FILE,
+                            LOG_ERR, return -EXFULL);
+
+        if (arg_key || arg_trust)
+                easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1,
+                            LOG_WARNING, );
+
+        /* upload to this place */
+        easy_setopt(curl, CURLOPT_URL, u->url,
+                    LOG_ERR, return -EXFULL);
+
+        return 0;
+}
+
 int start_upload(Uploader *u,
                  size_t (*input_callback)(void *ptr,
                                           size_t size,
@@ -183,30 +286,15 @@ int start_upload(Uploader *u,
                                           void *userdata),
                  void *data) {
         CURLcode code;
+        int r;
 
         assert(u);
         assert(input_callback);
 
         if (!u->header) {
-                struct curl_slist *h;
-
-                h = curl_slist_append(NULL, "Content-Type: application/vnd.fdo.journal");
-                if (!h)
-                        return log_oom();
-
-                h = curl_slist_append(h, "Transfer-Encoding: chunked");
-                if (!h) {
-                        curl_slist_free_all(h);
-                        return log_oom();
-                }
-
-                h = curl_slist_append(h, "Accept: text/plain");
-                if (!h) {
-                        curl_slist_free_all(h);
-                        return log_oom();
-                }
-
-                u->header = h;
+                r = build_header(u, true, &u->header);
+                if (r < 0)
+                        return r;
         }
 
         if (!u->easy) {
@@ -218,79 +306,289 @@ int start_upload(Uploader *u,
                         return -ENOSR;
                 }
 
-                /* tell it to POST to the URL */
-                easy_setopt(curl, CURLOPT_POST, 1L,
-                            LOG_ERR, return -EXFULL);
+                r = setup_handle(u, curl, u->header, u->error, &u->answer);
+                if (r < 0) {
+                        curl_easy_cleanup(curl);
+                        return r;
+                }
 
-                easy_setopt(curl, CURLOPT_ERRORBUFFER, u->error,
-                            LOG_ERR, return -EXFULL);
+                u->easy = curl;
+        } else {
+                /* truncate the potential old error message */
+                u->error[0] = '\0';
 
-                /* set where to write to */
-                easy_setopt(curl, CURLOPT_WRITEFUNCTION, output_callback,
-                            LOG_ERR, return -EXFULL);
+                u->answer = mfree(u->answer);
+        }
 
-                easy_setopt(curl, CURLOPT_WRITEDATA, data,
-                            LOG_ERR, return -EXFULL);
+        /* set where to read from */
+        easy_setopt(u->easy, CURLOPT_READFUNCTION, input_callback,
+                    LOG_ERR, return -EXFULL);
 
-                /* set where to read from */
-                easy_setopt(curl, CURLOPT_READFUNCTION, input_callback,
-                            LOG_ERR, return -EXFULL);
+        easy_setopt(u->easy, CURLOPT_READDATA, data,
+                    LOG_ERR, return -EXFULL);
 
-                easy_setopt(curl, CURLOPT_READDATA, data,
-                            LOG_ERR, return -EXFULL);
+        u->uploading = true;
 
-                /* use our special own mime type and chunked transfer */
-                easy_setopt(curl, CURLOPT_HTTPHEADER, u->header,
-                            LOG_ERR, return -EXFULL);
+        return 0;
+}
 
-                if (_unlikely_(log_get_max_level() >= LOG_DEBUG))
-                        /* enable verbose for easier tracing */
-                        easy_setopt(curl, CURLOPT_VERBOSE, 1L, LOG_WARNING, );
+static int submit_request(Uploader *u, UploadRequest *q) {
+        CURLMcode mcode;
+        CURLcode code;
+        int r;
 
-                easy_setopt(curl, CURLOPT_USERAGENT,
-                            "systemd-journal-upload " PACKAGE_STRING,
-                            LOG_WARNING, );
+        assert(u);
+        assert(q);
 
-                if (arg_key || startswith(u->url, "https://")) {
-                        easy_setopt(curl, CURLOPT_SSLKEY, arg_key ?: PRIV_KEY_FILE,
-                                    LOG_ERR, return -EXFULL);
-                        easy_setopt(curl, CURLOPT_SSLCERT, arg_cert ?: CERT_FILE,
-                                    LOG_ERR, return -EXFULL);
+        if (!q->easy) {
+                q->easy = curl_easy_init();
+                if (!q->easy) {
+                        log_error("Call to curl_easy_init failed.");
+                        return -ENOSR;
                 }
 
-                if (streq_ptr(arg_trust, "all"))
-                        easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0,
-                                    LOG_ERR, return -EUCLEAN);
-                else if (arg_trust || startswith(u->url, "https://"))
-                        easy_setopt(curl, CURLOPT_CAINFO, arg_trust ?: TRUST_FILE,
-                                    LOG_ERR, return -EXFULL);
+                r = setup_handle(u, q->easy, u->request_header, q->error, &q->answer);
+                if (r < 0)
+                        return r;
+
+#ifdef CURL_HTTP_VERSION_2TLS
+                /* Multiplex requests over one connection if the server
+                 * speaks HTTP/2, otherwise the connections are pooled */
+                easy_setopt(q->easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS,
+                            LOG_DEBUG, );
+                easy_setopt(q->easy, CURLOPT_PIPEWAIT, 1L,
+                            LOG_DEBUG, );
+#endif
+        } else {
+                q->error[0] = '\0';
+                q->answer = mfree(q->answer);
+        }
 
-                if (arg_key || arg_trust)
-                        easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1,
-                                    LOG_WARNING, );
+        /* The body is complete, no need for chunked encoding */
+        easy_setopt(q->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) q->body_size,
+                    LOG_ERR, return -EXFULL);
 
-                u->easy = curl;
-        } else {
-                /* truncate the potential old error message */
-                u->error[0] = '\0';
+        easy_setopt(q->easy, CURLOPT_POSTFIELDS, q->body,
+                    LOG_ERR, return -EXFULL);
 
-                free(u->answer);
-                u->answer = 0;
+        mcode = curl_multi_add_handle(u->multi, q->easy);
+        if (mcode) {
+                log_error("curl_multi_add_handle failed: %s",
+                          curl_multi_strerror(mcode));
+                return -EXFULL;
         }
 
-        /* upload to this place */
-        code = curl_easy_setopt(u->easy, CURLOPT_URL, u->url);
+        q->done = false;
+        return 0;
+}
+
+static int check_upload_result(Uploader *u,
+                               CURL *easy,
+                               CURLcode code,
+                               const char *error,
+                               const char *answer) {
+        long status;
+
+        assert(u);
+        assert(easy);
+
+        if (code) {
+                if (error[0])
+                        log_error("Upload to %s failed: %.*s",
+                                  u->url, (int) CURL_ERROR_SIZE, error);
+                else
+                        log_error("Upload to %s failed: %s",
+                                  u->url, curl_easy_strerror(code));
+                return -EIO;
+        }
+
+        code = curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
         if (code) {
-                log_error("curl_easy_setopt CURLOPT_URL failed: %s",
+                log_error("Failed to retrieve response code: %s",
                           curl_easy_strerror(code));
-                return -EXFULL;
+                return -EUCLEAN;
         }
 
-        u->uploading = true;
+        if (status >= 300) {
+                log_error("Upload to %s failed with code %ld: %s",
+                          u->url, status, strna(answer));
+                return -EIO;
+        } else if (status < 200) {
+                log_error("Upload to %s finished with unexpected code %ld: %s",
+                          u->url, status, strna(answer));
+                return -EIO;
+        } else
+                log_debug("Upload finished successfully with code %ld: %s",
+                          status, strna(answer));
+
+        return 0;
+}
+
+static int setup_requests(Uploader *u) {
+        int r;
+
+        assert(u);
+        assert(u->parallel > 1);
+
+        if (u->multi)
+                return 0;
+
+        r = build_header(u, false, &u->request_header);
+        if (r < 0)
+                return r;
+
+        u->requests = new0(UploadRequest, u->parallel);
+        if (!u->requests)
+                return log_oom();
+
+        u->multi = curl_multi_init();
+        if (!u->multi) {
+                log_error("Call to curl_multi_init failed.");
+                return -ENOSR;
+        }
+
+#ifdef CURLPIPE_MULTIPLEX
+        (void) curl_multi_setopt(u->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 
         return 0;
 }
 
+static void collect_finished_requests(Uploader *u) {
+        CURLMsg *msg;
+        int left;
+        unsigned i;
+
+        while ((msg = curl_multi_info_read(u->multi, &left))) {
+                if (msg->msg != CURLMSG_DONE)
+                        continue;
+
+                for (i = 0; i < u->parallel; i++) {
+                        UploadRequest *q = &u->requests[i];
+
+                        if (q->easy != msg->easy_handle)
+                                continue;
+
+                        q->done = true;
+                        q->code = msg->data.result;
+                        curl_multi_remove_handle(u->multi, q->easy);
+                        break;
+                }
+        }
+}
+
+/* Upload everything that is available as a sequence of complete
+ * requests, keeping up to u->parallel of them in flight. The cursor is
+ * only advanced past a request once it and all requests before it
+ * have been acknowledged. */
+int upload_requests(Uploader *u) {
+        bool more = true;
+        int r;
+
+        assert(u);
+
+        r = setup_requests(u);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                CURLMcode mcode;
+                int running;
+
+                while (more && u->n_requests < u->parallel) {
+                        UploadRequest *q;
+                        ssize_t n;
+
+                        q = &u->requests[(u->first_request + u->n_requests) % u->parallel];
+
+                        n = fill_upload_request(u, &q->body, &q->body_allocated);
+                        if (n < 0)
+                                return n;
+                        if (n == 0) {
+                                more = false;
+                                break;
+                        }
+
+                        q->body_size = n;
+
+                        free(q->cursor);
+                        q->cursor = u->current_cursor;
+                        u->current_cursor = NULL;
+
+                        r = submit_request(u, q);
+                        if (r < 0)
+                                return r;
+
+                        u->n_requests++;
+                }
+
+                if (u->n_requests == 0)
+                        break;
+
+                mcode = curl_multi_perform(u->multi, &running);
+                if (mcode) {
+                        log_error("curl_multi_perform failed: %s",
+                                  curl_multi_strerror(mcode));
+                        return -EIO;
+                }
+
+                collect_finished_requests(u);
+
+                while (u->n_requests > 0 && u->requests[u->first_request].done) {
+                        UploadRequest *q = &u->requests[u->first_request];
+
+                        r = check_upload_result(u, q->easy, q->code, q->error, q->answer);
+                        if (r < 0)
+                                return r;
+
+                        free(u->last_cursor);
+                        u->last_cursor = q->cursor;
+                        q->cursor = NULL;
+
+                        r = update_cursor_state(u);
+                        if (r < 0)
+                                return r;
+
+                        u->first_request = (u->first_request + 1) % u->parallel;
+                        u->n_requests--;
+                }
+
+                if (running > 0) {
+                        mcode = curl_multi_wait(u->multi, NULL, 0, 1000, NULL);
+                        if (mcode) {
+                                log_error("curl_multi_wait failed: %s",
+                                          curl_multi_strerror(mcode));
+                                return -EIO;
+                        }
+                }
+        }
+
+        return 0;
+}
+
+static void free_requests(Uploader *u) {
+        unsigned i;
+
+        if (!u->requests)
+                return;
+
+        for (i = 0; i < u->parallel; i++) {
+                UploadRequest *q = &u->requests[i];
+
+                if (q->easy) {
+                        if (u->multi)
+                                curl_multi_remove_handle(u->multi, q->easy);
+                        curl_easy_cleanup(q->easy);
+                }
+
+                free(q->answer);
+                free(q->body);
+                free(q->cursor);
+        }
+
+        u->requests = mfree(u->requests);
+}
+
 static size_t fd_input_callback(void *buf, size_t size, size_t nmemb, void *userp) {
         Uploader *u = userp;
 
@@ -469,6 +767,14 @@ static void destroy_uploader(Uploader *u) {
         curl_slist_free_all(u->header);
         free(u->answer);
 
+        free(u->raw);
+        free(u->batch);
+
+        free_requests(u);
+        if (u->multi)
+                curl_multi_cleanup(u->multi);
+        curl_slist_free_all(u->request_header);
+
         free(u->last_cursor);
         free(u->current_cursor);
 
@@ -486,39 +792,15 @@ static void destroy_uploader(Uploader *u) {
 
 static int perform_upload(Uploader *u) {
         CURLcode code;
-        long status;
+        int r;
 
         assert(u);
 
         code = curl_easy_perform(u->easy);
-        if (code) {
-                if (u->error[0])
-                        log_error("Upload to %s failed: %.*s",
-                                  u->url, (int) sizeof(u->error), u->error);
-                else
-                        log_error("Upload to %s failed: %s",
-                                  u->url, curl_easy_strerror(code));
-                return -EIO;
-        }
-
-        code = curl_easy_getinfo(u->easy, CURLINFO_RESPONSE_CODE, &status);
-        if (code) {
-                log_error("Failed to retrieve response code: %s",
-                          curl_easy_strerror(code));
-                return -EUCLEAN;
-        }
 
-        if (status >= 300) {
-                log_error("Upload to %s failed with code %ld: %s",
-                          u->url, status, strna(u->answer));
-                return -EIO;
-        } else if (status < 200) {
-                log_error("Upload to %s finished with unexpected code %ld: %s",
-                          u->url, status, strna(u->answer));
-                return -EIO;
-        } else
-                log_debug("Upload finished successfully with code %ld: %s",
-                          status, strna(u->answer));
+        r = check_upload_result(u, u->easy, code, u->error, u->answer);
+        if (r < 0)
+                return r;
 
         free(u->last_cursor);
         u->last_cursor = u->current_cursor;
@@ -527,12 +809,75 @@ static int perform_upload(Uploader *u) {
         return update_cursor_state(u);
 }
 
+static int parse_compression(const char *s) {
+        int c;
+
+        if (streq(s, "xz"))
+                c = OBJECT_COMPRESSED_XZ;
+        else if (streq(s, "lz4"))
+                c = OBJECT_COMPRESSED_LZ4;
+        else if (streq(s, "zstd"))
+                c = OBJECT_COMPRESSED_ZSTD;
+        else {
+                int b;
+
+                b = parse_boolean(s);
+                if (b < 0)
+                        return -EINVAL;
+                if (b == 0)
+                        return 0;
+
+#if defined(HAVE_ZSTD)
+                c = OBJECT_COMPRESSED_ZSTD;
+#elif defined(HAVE_LZ4)
+                c = OBJECT_COMPRESSED_LZ4;
+#else
+                c = OBJECT_COMPRESSED_XZ;
+#endif
+        }
+
+        if (!upload_encoding_supported(c))
+                return -EOPNOTSUPP;
+
+        return c;
+}
+
+static int config_parse_compression(const char* unit,
+                                    const char *filename,
+                                    unsigned line,
+                                    const char *section,
+                                    unsigned section_line,
+                                    const char *lvalue,
+                                    int ltype,
+                                    const char *rvalue,
+                                    void *data,
+                                    void *userdata) {
+
+        int *c = data, k;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(data);
+
+        k = parse_compression(rvalue);
+        if (k < 0) {
+                log_syntax(unit, LOG_ERR, filename, line, -k,
+                           "Failed to parse compression setting, ignoring: %s", rvalue);
+                return 0;
+        }
+
+        *c = k;
+        return 0;
+}
+
 static int parse_config(void) {
         const ConfigTableItem items[] = {
                 { "Upload",  "URL",                    config_parse_string, 0, &arg_url    },
                 { "Upload",  "ServerKeyFile",          config_parse_path,   0, &arg_key    },
                 { "Upload",  "ServerCertificateFile",  config_parse_path,   0, &arg_cert   },
                 { "Upload",  "TrustedCertificateFile", config_parse_path,   0, &arg_trust  },
+                { "Upload",  "Compression",            config_parse_compression, 0, &arg_compression },
                 {}};
 
         return config_parse_many(PKGSYSCONFDIR "/journal-upload.conf",
@@ -565,6 +910,10 @@ static void help(void) {
                "     --follow[=BOOL]        Do [not] wait for input\n"
                "     --save-state[=FILE]    Save uploaded cursors (default \n"
                "                            " STATE_FILE ")\n"
+               "     --compression=TYPE|BOOL\n"
+               "                            Compress journal entries during transfer\n"
+               "                            (xz, lz4, zstd)\n"
+               "     --parallel=N           Keep up to N requests in flight\n"
                "  -h --help                 Show this help and exit\n"
                "     --version              Print version string and exit\n"
                , program_invocation_short_name);
@@ -583,6 +932,8 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_AFTER_CURSOR,
                 ARG_FOLLOW,
                 ARG_SAVE_STATE,
+                ARG_COMPRESSION,
+                ARG_PARALLEL,
         };
 
         static const struct option options[] = {
@@ -602,6 +953,8 @@ static int parse_argv(int argc, char *argv[]) {
                 { "after-cursor", required_argument, NULL, ARG_AFTER_CURSOR   },
                 { "follow",       optional_argument, NULL, ARG_FOLLOW         },
                 { "save-state",   optional_argument, NULL, ARG_SAVE_STATE     },
+                { "compression",  required_argument, NULL, ARG_COMPRESSION    },
+                { "parallel",     required_argument, NULL, ARG_PARALLEL       },
                 {}
         };
 
@@ -732,6 +1085,28 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_save_state = optarg ?: STATE_FILE;
                         break;
 
+                case ARG_COMPRESSION:
+                        r = parse_compression(optarg);
+                        if (r == -EOPNOTSUPP) {
+                                log_error("Compression %s is not supported by this build.", optarg);
+                                return r;
+                        } else if (r < 0) {
+                                log_error("Failed to parse --compression= argument: %s", optarg);
+                                return r;
+                        }
+
+                        arg_compression = r;
+                        break;
+
+                case ARG_PARALLEL:
+                        r = safe_atou(optarg, &arg_parallel);
+                        if (r < 0 || arg_parallel < 1) {
+                                log_error("Failed to parse --parallel= argument: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        break;
+
                 case '?':
                         log_error("Unknown option %s.", argv[optind-1]);
                         return -EINVAL;
@@ -816,6 +1191,12 @@ int main(int argc, char **argv) {
                 r = open_journal(&j);
                 if (r < 0)
                         goto finish;
+
+                /* Only our own export format output is compressed,
+                 * files and stdin are forwarded verbatim */
+                u.compression = arg_compression;
+                u.parallel = arg_parallel;
+
                 r = open_journal_for_upload(&u, j,
                                             arg_cursor ?: u.last_cursor,
                                             arg_cursor ? arg_after_cursor : true,
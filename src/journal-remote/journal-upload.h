@@ -19,6 +19,21 @@ typedef enum {
         ENTRY_DONE,                 /* Need to move to a new field. */
 } entry_state;
 
+typedef struct UploadRequest {
+        CURL *easy;
+        char error[CURL_ERROR_SIZE];
+        char *answer;
+
+        char *body;
+        size_t body_size, body_allocated;
+
+        /* the last entry in the body */
+        char *cursor;
+
+        bool done;
+        CURLcode code;
+} UploadRequest;
+
 typedef struct Uploader {
         sd_event *events;
         sd_event_source *sigint_event, *sigterm_event;
@@ -43,6 +58,22 @@ typedef struct Uploader {
         const void *field_data;
         size_t field_pos, field_length;
 
+        /* compressed transport: the export format is collected in
+         * raw, then sent as frames out of batch */
+        int compression;
+        char *raw;
+        size_t raw_allocated;
+        char *batch;
+        size_t batch_filled, batch_pos;
+
+        /* parallel uploads: up to parallel requests are in flight,
+         * they are acknowledged in order */
+        unsigned parallel;
+        CURLM *multi;
+        struct curl_slist *request_header;
+        UploadRequest *requests;
+        unsigned first_request, n_requests;
+
         /* general metrics */
         const char *state_file;
 
@@ -64,5 +95,7 @@ int open_journal_for_upload(Uploader *u,
                             const char *cursor,
                             bool after_cursor,
                             bool follow);
+int upload_requests(Uploader *u);
+ssize_t fill_upload_request(Uploader *u, char **body, size_t *allocated);
 void close_journal_input(Uploader *u);
 int check_journal_input(Uploader *u);
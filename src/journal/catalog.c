@@ -20,6 +20,7 @@
 ***/
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
@@ -79,16 +80,19 @@ static unsigned long catalog_hash_func(const void *p, const uint8_t hash_key[HAS
         return (unsigned long) u;
 }
 
+static int catalog_id_compare_func(const void *a, const void *b) {
+        const sd_id128_t *i = a, *j = b;
+
+        return memcmp(i->bytes, j->bytes, sizeof(i->bytes));
+}
+
 static int catalog_compare_func(const void *a, const void *b) {
         const CatalogItem *i = a, *j = b;
-        unsigned k;
+        int r;
 
-        for (k = 0; k < ELEMENTSOF(j->id.bytes); k++) {
-                 if (i->id.bytes[k] < j->id.bytes[k])
-                        return -1;
-                 if (i->id.bytes[k] > j->id.bytes[k])
-                        return 1;
-        }
+        r = catalog_id_compare_func(&i->id, &j->id);
+        if (r != 0)
+                return r;
 
         return strcmp(i->language, j->language);
 }
@@ -98,6 +102,103 @@ const struct hash_ops catalog_hash_ops = {
         .compare = catalog_compare_func
 };
 
+static unsigned long catalog_id_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        uint64_t u;
+
+        siphash24((uint8_t*) &u, p, sizeof(sd_id128_t), hash_key);
+
+        return (unsigned long) u;
+}
+
+static const struct hash_ops catalog_id_hash_ops = {
+        .hash = catalog_id_hash_func,
+        .compare = catalog_id_compare_func
+};
+
+/* journalctl -x looks up the same few ids over and over, once for each
+ * line it shows. Hence the database stays mapped, and the texts
+ * resolved for the current locale are remembered, including the ids
+ * which have none. Whether the database was replaced is checked at
+ * most every CATALOG_CACHE_CHECK_USEC. */
+#define CATALOG_CACHE_CHECK_USEC (1 * USEC_PER_SEC)
+
+typedef struct CatalogText {
+        sd_id128_t id;
+        const char *text;  /* points into the mapping, NULL if not found */
+} CatalogText;
+
+typedef struct CatalogCache {
+        char *database;
+        void *p;
+        struct stat st;
+        usec_t checked;
+
+        char *locale;
+        Hashmap *texts;
+} CatalogCache;
+
+/* Each thread gets its own cache, which is released when the thread
+ * exits */
+static pthread_once_t catalog_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t catalog_cache_key;
+static bool catalog_cache_key_initialized = false;
+
+static thread_local CatalogCache *catalog_cache = NULL;
+
+static void catalog_cache_flush(CatalogCache *c) {
+        assert(c);
+
+        c->texts = hashmap_free_free(c->texts);
+        c->locale = mfree(c->locale);
+
+        if (c->p)
+                munmap(c->p, c->st.st_size);
+        c->p = NULL;
+
+        c->database = mfree(c->database);
+}
+
+static void catalog_cache_destroy(void *p) {
+        CatalogCache *c = p;
+
+        catalog_cache_flush(c);
+        free(c);
+
+        catalog_cache = NULL;
+}
+
+static void catalog_cache_key_init(void) {
+        catalog_cache_key_initialized = pthread_key_create(&catalog_cache_key, catalog_cache_destroy) == 0;
+}
+
+static void _destructor_ catalog_cache_key_done(void) {
+        if (catalog_cache_key_initialized)
+                pthread_key_delete(catalog_cache_key);
+}
+
+static CatalogCache *catalog_cache_get(void) {
+        CatalogCache *c;
+
+        if (catalog_cache)
+                return catalog_cache;
+
+        assert_se(pthread_once(&catalog_cache_once, catalog_cache_key_init) == 0);
+        if (!catalog_cache_key_initialized)
+                return NULL;
+
+        c = new0(CatalogCache, 1);
+        if (!c)
+                return NULL;
+
+        if (pthread_setspecific(catalog_cache_key, c) != 0) {
+                free(c);
+                return NULL;
+        }
+
+        catalog_cache = c;
+        return c;
+}
+
 static int finish_item(
                 Hashmap *h,
                 struct strbuf *sb,
@@ -453,10 +554,14 @@ int catalog_update(const char* database, const char* root, const char* const* di
         r = write_catalog(database, h, sb, items, n);
         if (r < 0)
                 log_error_errno(r, "Failed to write %s: %m", database);
-        else
+        else {
                 log_debug("%s: wrote %u items, with %zu bytes of strings, %ld total size.",
                           database, n, sb->len, r);
 
+                if (catalog_cache && streq_ptr(catalog_cache->database, database))
+                        catalog_cache_flush(catalog_cache);
+        }
+
 finish:
         if (sb)
                 strbuf_cleanup(sb);
@@ -514,78 +619,170 @@ static int open_mmap(const char *database, int *_fd, struct stat *_st, void **_p
 }
 
 static const char *find_id(void *p, sd_id128_t id) {
-        CatalogItem key, *f = NULL;
         const CatalogHeader *h = p;
+        const uint8_t *items, *end, *i, *f;
+        const CatalogItem *full = NULL, *lang = NULL, *fallback = NULL;
+        char language[32] = {}, *e;
+        size_t size;
         const char *loc;
 
-        zero(key);
-        key.id = id;
+        items = (const uint8_t*) p + le64toh(h->header_size);
+        size = le64toh(h->catalog_item_size);
+        end = items + le64toh(h->n_items) * size;
+
+        f = bsearch(&id, items, le64toh(h->n_items), size, catalog_id_compare_func);
+        if (!f)
+                return NULL;
+
+        /* Items are sorted by id first, all translations of this id
+         * are right next to each other. Go back to the first of them,
+         * and pick the best match in a single pass. */
+        while (f > items && sd_id128_equal(((const CatalogItem*) (f - size))->id, id))
+                f -= size;
 
         loc = setlocale(LC_MESSAGES, NULL);
         if (loc && loc[0] && !streq(loc, "C") && !streq(loc, "POSIX")) {
-                strncpy(key.language, loc, sizeof(key.language));
-                key.language[strcspn(key.language, ".@")] = 0;
+                strncpy(language, loc, sizeof(language) - 1);
+                language[strcspn(language, ".@")] = 0;
+        }
 
-                f = bsearch(&key, (const uint8_t*) p + le64toh(h->header_size), le64toh(h->n_items), le64toh(h->catalog_item_size), catalog_compare_func);
-                if (!f) {
-                        char *e;
+        e = strchr(language, '_');
 
-                        e = strchr(key.language, '_');
-                        if (e) {
-                                *e = 0;
-                                f = bsearch(&key, (const uint8_t*) p + le64toh(h->header_size), le64toh(h->n_items), le64toh(h->catalog_item_size), catalog_compare_func);
-                        }
-                }
-        }
+        for (i = f; i < end && sd_id128_equal(((const CatalogItem*) i)->id, id); i += size) {
+                const CatalogItem *c = (const CatalogItem*) i;
 
-        if (!f) {
-                zero(key.language);
-                f = bsearch(&key, (const uint8_t*) p + le64toh(h->header_size), le64toh(h->n_items), le64toh(h->catalog_item_size), catalog_compare_func);
+                if (c->language[0] == 0)
+                        fallback = c;
+                else if (language[0] && streq(c->language, language))
+                        full = c;
+                else if (e && strlen(c->language) == (size_t) (e - language) &&
+                         strneq(c->language, language, e - language))
+                        lang = c;
         }
 
+        f = (const uint8_t*) (full ?: lang ?: fallback);
         if (!f)
                 return NULL;
 
         return (const char*) p +
                 le64toh(h->header_size) +
                 le64toh(h->n_items) * le64toh(h->catalog_item_size) +
-                le64toh(f->offset);
+                le64toh(((const CatalogItem*) f)->offset);
+}
+
+static bool catalog_cache_valid(CatalogCache *c, const char *database) {
+        struct stat st;
+        usec_t n;
+
+        assert(c);
+
+        if (!c->p || !streq(c->database, database))
+                return false;
+
+        n = now(CLOCK_MONOTONIC);
+        if (c->checked + CATALOG_CACHE_CHECK_USEC > n)
+                return true;
+
+        /* catalog_update() replaces the file rather than writing to
+         * it, a changed inode is the main thing to look for */
+        if (stat(database, &st) < 0 ||
+            st.st_dev != c->st.st_dev ||
+            st.st_ino != c->st.st_ino ||
+            st.st_size != c->st.st_size ||
+            timespec_load(&st.st_mtim) != timespec_load(&c->st.st_mtim))
+                return false;
+
+        c->checked = n;
+        return true;
+}
+
+static int catalog_cache_open(CatalogCache *c, const char *database) {
+        const char *loc;
+        int r;
+
+        assert(c);
+        assert(database);
+
+        if (!catalog_cache_valid(c, database)) {
+                _cleanup_close_ int fd = -1;
+
+                catalog_cache_flush(c);
+
+                r = open_mmap(database, &fd, &c->st, &c->p);
+                if (r < 0)
+                        return r;
+
+                c->database = strdup(database);
+                if (!c->database) {
+                        catalog_cache_flush(c);
+                        return -ENOMEM;
+                }
+
+                c->checked = now(CLOCK_MONOTONIC);
+        }
+
+        loc = setlocale(LC_MESSAGES, NULL);
+        if (!streq_ptr(c->locale, loc)) {
+                hashmap_clear_free(c->texts);
+
+                free(c->locale);
+                c->locale = NULL;
+
+                if (loc) {
+                        c->locale = strdup(loc);
+                        if (!c->locale)
+                                return -ENOMEM;
+                }
+        }
+
+        r = hashmap_ensure_allocated(&c->texts, &catalog_id_hash_ops);
+        if (r < 0)
+                return r;
+
+        return 0;
 }
 
 int catalog_get(const char* database, sd_id128_t id, char **_text) {
-        _cleanup_close_ int fd = -1;
-        void *p = NULL;
-        struct stat st = {};
-        char *text = NULL;
+        CatalogCache *c;
+        CatalogText *t;
+        char *text;
         int r;
-        const char *s;
 
         assert(_text);
 
-        r = open_mmap(database, &fd, &st, &p);
+        c = catalog_cache_get();
+        if (!c)
+                return -ENOMEM;
+
+        r = catalog_cache_open(c, database);
         if (r < 0)
                 return r;
 
-        s = find_id(p, id);
-        if (!s) {
-                r = -ENOENT;
-                goto finish;
-        }
+        t = hashmap_get(c->texts, &id);
+        if (!t) {
+                t = new0(CatalogText, 1);
+                if (!t)
+                        return -ENOMEM;
 
-        text = strdup(s);
-        if (!text) {
-                r = -ENOMEM;
-                goto finish;
+                t->id = id;
+                t->text = find_id(c->p, id);
+
+                r = hashmap_put(c->texts, &t->id, t);
+                if (r < 0) {
+                        free(t);
+                        return r;
+                }
         }
 
-        *_text = text;
-        r = 0;
+        if (!t->text)
+                return -ENOENT;
 
-finish:
-        if (p)
-                munmap(p, st.st_size);
+        text = strdup(t->text);
+        if (!text)
+                return -ENOMEM;
 
-        return r;
+        *_text = text;
+        return 0;
 }
 
 static char *find_header(const char *s, const char *header) {
@@ -31,6 +31,10 @@
 #  include <lz4.h>
 #endif
 
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
 #include "compress.h"
 #include "macro.h"
 #include "util.h"
@@ -42,10 +46,18 @@
 static const char* const object_compressed_table[_OBJECT_COMPRESSED_MAX] = {
         [OBJECT_COMPRESSED_XZ] = "XZ",
         [OBJECT_COMPRESSED_LZ4] = "LZ4",
+        [OBJECT_COMPRESSED_ZSTD] = "ZSTD",
 };
 
 DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
 
+#ifdef HAVE_ZSTD
+/* Journal data objects are small, so favour speed over ratio */
+#define ZSTD_COMPRESSION_LEVEL 1
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_DCtx*, ZSTD_freeDCtx);
+#endif
+
 int compress_blob_xz(const void *src, uint64_t src_size, void *dst, size_t *dst_size) {
 #ifdef HAVE_XZ
         static const lzma_options_lzma opt = {
@@ -109,6 +121,83 @@ int compress_blob_lz4(const void *src, uint64_t src_size, void *dst, size_t *dst
 #endif
 }
 
+int compress_blob_zstd(const void *src, uint64_t src_size, void *dst, size_t *dst_size) {
+#ifdef HAVE_ZSTD
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_size);
+
+        /* Returns < 0 if we couldn't compress the data or the
+         * compressed result is longer than the original. The frame
+         * header records the uncompressed size, hence unlike for LZ4
+         * we don't need to store it separately. */
+
+        if (src_size < 9)
+                return -ENOBUFS;
+
+        k = ZSTD_compress(dst, src_size - 1, src, src_size, ZSTD_COMPRESSION_LEVEL);
+        if (ZSTD_isError(k))
+                return -ENOBUFS;
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_blob_explicit(int compression,
+                           const void *src, uint64_t src_size, void *dst, size_t *dst_size) {
+        if (compression == OBJECT_COMPRESSED_XZ)
+                return compress_blob_xz(src, src_size, dst, dst_size);
+        else if (compression == OBJECT_COMPRESSED_LZ4)
+                return compress_blob_lz4(src, src_size, dst, dst_size);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return compress_blob_zstd(src, src_size, dst, dst_size);
+        else
+                return -EOPNOTSUPP;
+}
+
+#ifdef HAVE_ZSTD
+static int zstd_decompress_prefix(const void *src, uint64_t src_size, void *dst, size_t size, size_t *ret) {
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        ZSTD_inBuffer input = {
+                .src = src,
+                .size = src_size,
+        };
+        ZSTD_outBuffer output = {
+                .dst = dst,
+                .size = size,
+        };
+
+        /* Decompresses at most size bytes of the frame in src */
+
+        dctx = ZSTD_createDCtx();
+        if (!dctx)
+                return -ENOMEM;
+
+        while (output.pos < output.size) {
+                size_t k;
+
+                k = ZSTD_decompressStream(dctx, &output, &input);
+                if (ZSTD_isError(k))
+                        return -EBADMSG;
+                if (k == 0)
+                        /* End of frame */
+                        break;
+                if (input.pos >= input.size && output.pos < output.size)
+                        /* Truncated frame */
+                        return -EBADMSG;
+        }
+
+        *ret = output.pos;
+        return 0;
+}
+#endif
+
 
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
@@ -210,6 +299,46 @@ int decompress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+
+#ifdef HAVE_ZSTD
+        unsigned long long size;
+        size_t k;
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (IN_SET(size, ZSTD_CONTENTSIZE_ERROR, ZSTD_CONTENTSIZE_UNKNOWN))
+                return -EBADMSG;
+
+        if (dst_max > 0 && size > dst_max)
+                size = dst_max;
+        if (size > SIZE_MAX)
+                return -E2BIG;
+
+        if (!greedy_realloc(dst, dst_alloc_size, MAX(size, 1u), 1))
+                return -ENOMEM;
+
+        r = zstd_decompress_prefix(src, src_size, *dst, size, &k);
+        if (r < 0)
+                return r;
+        if (k != size)
+                return -EBADMSG;
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
@@ -219,6 +348,9 @@ int decompress_blob(int compression,
         else if (compression == OBJECT_COMPRESSED_LZ4)
                 return decompress_blob_lz4(src, src_size,
                                            dst, dst_alloc_size, dst_size, dst_max);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_blob_zstd(src, src_size,
+                                            dst, dst_alloc_size, dst_size, dst_max);
         else
                 return -EBADMSG;
 }
@@ -323,6 +455,42 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra) {
+#ifdef HAVE_ZSTD
+        /* Checks whether the decompressed blob starts with the
+         * mentioned prefix. The byte extra needs to follow the
+         * prefix */
+
+        size_t k;
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+        assert(*buffer_size == 0 || *buffer);
+
+        if (!(greedy_realloc(buffer, buffer_size, ALIGN_8(prefix_len + 1), 1)))
+                return -ENOMEM;
+
+        r = zstd_decompress_prefix(src, src_size, *buffer, prefix_len + 1, &k);
+        if (r < 0)
+                return r;
+        if (k >= prefix_len + 1)
+                return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                        ((const uint8_t*) *buffer)[prefix_len] == extra;
+        else
+                return 0;
+
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
@@ -338,6 +506,11 @@ int decompress_startswith(int compression,
                                                  buffer, buffer_size,
                                                  prefix, prefix_len,
                                                  extra);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_startswith_zstd(src, src_size,
+                                                  buffer, buffer_size,
+                                                  prefix, prefix_len,
+                                                  extra);
         else
                 return -EBADMSG;
 }
@@ -352,7 +525,21 @@ int compress_stream_xz(int fdf, int fdt, uint64_t max_bytes) {
         assert(fdf >= 0);
         assert(fdt >= 0);
 
+#ifdef HAVE_LZMA_STREAM_ENCODER_MT
+        {
+                /* Large streams such as coredumps compress a
+                 * lot faster with all CPUs */
+                lzma_mt mt = {
+                        .threads = MAX(lzma_cputhreads(), 1U),
+                        .preset = LZMA_PRESET_DEFAULT,
+                        .check = LZMA_CHECK_CRC64,
+                };
+
+                ret = lzma_stream_encoder_mt(&s, &mt);
+        }
+#else
         ret = lzma_easy_encoder(&s, LZMA_PRESET_DEFAULT, LZMA_CHECK_CRC64);
+#endif
         if (ret != LZMA_OK) {
                 log_error("Failed to initialize XZ encoder: code %u", ret);
                 return -EINVAL;
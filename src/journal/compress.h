@@ -30,10 +30,17 @@ int object_compressed_from_string(const char *compression);
 
 int compress_blob_xz(const void *src, uint64_t src_size, void *dst, size_t *dst_size);
 int compress_blob_lz4(const void *src, uint64_t src_size, void *dst, size_t *dst_size);
+int compress_blob_zstd(const void *src, uint64_t src_size, void *dst, size_t *dst_size);
+int compress_blob_explicit(int compression,
+                           const void *src, uint64_t src_size, void *dst, size_t *dst_size);
 
 static inline int compress_blob(const void *src, uint64_t src_size, void *dst, size_t *dst_size) {
         int r;
-#ifdef HAVE_LZ4
+#if defined(HAVE_ZSTD)
+        r = compress_blob_zstd(src, src_size, dst, dst_size);
+        if (r == 0)
+                return OBJECT_COMPRESSED_ZSTD;
+#elif defined(HAVE_LZ4)
         r = compress_blob_lz4(src, src_size, dst, dst_size);
         if (r == 0)
                 return OBJECT_COMPRESSED_LZ4;
@@ -49,6 +56,8 @@ int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob_lz4(const void *src, uint64_t src_size,
                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
@@ -61,6 +70,10 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
                               void **buffer, size_t *buffer_size,
                               const void *prefix, size_t prefix_len,
                               uint8_t extra);
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra);
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
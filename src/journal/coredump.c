@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <fcntl.h>
 #include <sys/prctl.h>
 #include <sys/xattr.h>
 
@@ -49,6 +50,7 @@
 #include "journald-native.h"
 #include "coredump-vacuum.h"
 #include "process-util.h"
+#include "signal-util.h"
 
 /* The maximum size up to which we process coredumps */
 #define PROCESS_SIZE_MAX ((uint64_t) (2LLU*1024LLU*1024LLU*1024LLU))
@@ -65,6 +67,9 @@
  * size. See DATA_SIZE_MAX in journald-native.c. */
 assert_cc(JOURNAL_SIZE_MAX <= DATA_SIZE_MAX);
 
+/* The chunk size in which we read the coredump from the kernel */
+#define COREDUMP_BUFFER_SIZE (64*1024)
+
 enum {
         INFO_PID,
         INFO_UID,
@@ -97,6 +102,7 @@ static DEFINE_CONFIG_PARSE_ENUM(config_parse_coredump_storage, coredump_storage,
 
 static CoredumpStorage arg_storage = COREDUMP_STORAGE_EXTERNAL;
 static bool arg_compress = true;
+static bool arg_sparse = true;
 static uint64_t arg_process_size_max = PROCESS_SIZE_MAX;
 static uint64_t arg_external_size_max = EXTERNAL_SIZE_MAX;
 static size_t arg_journal_size_max = JOURNAL_SIZE_MAX;
@@ -107,6 +113,7 @@ static int parse_config(void) {
         static const ConfigTableItem items[] = {
                 { "Coredump", "Storage",          config_parse_coredump_storage,  0, &arg_storage           },
                 { "Coredump", "Compress",         config_parse_bool,              0, &arg_compress          },
+                { "Coredump", "Sparse",           config_parse_bool,              0, &arg_sparse            },
                 { "Coredump", "ProcessSizeMax",   config_parse_iec_uint64,        0, &arg_process_size_max  },
                 { "Coredump", "ExternalSizeMax",  config_parse_iec_uint64,        0, &arg_external_size_max },
                 { "Coredump", "JournalSizeMax",   config_parse_iec_size,          0, &arg_journal_size_max  },
@@ -280,6 +287,185 @@ static int make_filename(const char *info[_INFO_LEN], char **ret) {
         return 0;
 }
 
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+static int start_compressor(
+                const char *fn,
+                char **ret_filename,
+                char **ret_tmp,
+                int *ret_fd_compressed,
+                int *ret_fd_compressor,
+                pid_t *ret_pid) {
+
+        _cleanup_free_ char *fn_compressed = NULL, *tmp_compressed = NULL;
+        _cleanup_close_pair_ int pipefd[2] = { -1, -1 };
+        _cleanup_close_ int fd_compressed = -1;
+        pid_t pid;
+        int r;
+
+        assert(fn);
+        assert(ret_filename);
+        assert(ret_tmp);
+        assert(ret_fd_compressed);
+        assert(ret_fd_compressor);
+        assert(ret_pid);
+
+        /* Compresses everything written to the returned pipe into a
+         * temporary file, in a child process so that it runs in
+         * parallel to us reading the coredump */
+
+        fn_compressed = strappend(fn, COMPRESSED_EXT);
+        if (!fn_compressed)
+                return log_oom();
+
+        r = tempfn_random(fn_compressed, NULL, &tmp_compressed);
+        if (r < 0)
+                return log_error_errno(r, "Failed to determine temporary file name for %s: %m", fn_compressed);
+
+        if (pipe2(pipefd, O_CLOEXEC) < 0)
+                return log_error_errno(errno, "Failed to create pipe to compressor: %m");
+
+        fd_compressed = open(tmp_compressed, O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW, 0640);
+        if (fd_compressed < 0)
+                return log_error_errno(errno, "Failed to create file %s: %m", tmp_compressed);
+
+        /* Should the compressor die, we want to see EPIPE rather
+         * than being killed */
+        (void) ignore_signals(SIGPIPE, -1);
+
+        pid = fork();
+        if (pid < 0) {
+                r = log_error_errno(errno, "Failed to fork compressor: %m");
+                unlink_noerrno(tmp_compressed);
+                return r;
+        }
+        if (pid == 0) {
+                pipefd[1] = safe_close(pipefd[1]);
+
+                r = compress_stream(pipefd[0], fd_compressed, -1);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to compress coredump: %m");
+                        _exit(EXIT_FAILURE);
+                }
+
+                _exit(EXIT_SUCCESS);
+        }
+
+        *ret_filename = fn_compressed;
+        *ret_tmp = tmp_compressed;
+        *ret_fd_compressed = fd_compressed;
+        *ret_fd_compressor = pipefd[1];
+        *ret_pid = pid;
+
+        fn_compressed = tmp_compressed = NULL;
+        fd_compressed = pipefd[1] = -1;
+
+        return 0;
+}
+#endif
+
+static int read_coredump(int fd_uncompressed, int fd_compressor, uint64_t *ret_size) {
+        bool try_splice;
+        uint64_t size = 0;
+        int r;
+
+        assert(fd_uncompressed >= 0 || fd_compressor >= 0);
+        assert(ret_size);
+
+        /* Reads the coredump from stdin exactly once, and passes it
+         * on to the file on disk and the compressor at the same time,
+         * as far as they are wanted */
+
+        if (fd_compressor < 0 && !arg_sparse) {
+                struct stat st;
+
+                /* Only the file on disk, let the kernel do the work */
+                r = copy_bytes(STDIN_FILENO, fd_uncompressed, arg_process_size_max, false);
+                if (r < 0)
+                        return r;
+
+                if (fstat(fd_uncompressed, &st) < 0)
+                        return -errno;
+
+                *ret_size = (uint64_t) st.st_size;
+                return 0;
+        }
+
+        /* If the compressor is the only destination, move the data
+         * from pipe to pipe without copying it in and out */
+        try_splice = fd_uncompressed < 0;
+
+        for (;;) {
+                uint8_t buf[COREDUMP_BUFFER_SIZE];
+                ssize_t n;
+
+                if (try_splice) {
+                        n = splice(STDIN_FILENO, NULL, fd_compressor, NULL, COREDUMP_BUFFER_SIZE, SPLICE_F_MOVE);
+                        if (n < 0) {
+                                if (errno == EINTR)
+                                        continue;
+                                if (errno != EINVAL)
+                                        return -errno;
+
+                                try_splice = false;
+                                /* use fallback below */
+                        } else if (n == 0) /* EOF */
+                                break;
+                        else {
+                                size += n;
+                                if (size > arg_process_size_max)
+                                        return -EFBIG;
+
+                                continue;
+                        }
+                }
+
+                n = read(STDIN_FILENO, buf, sizeof(buf));
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -errno;
+                }
+                if (n == 0)
+                        break;
+
+                size += n;
+                if (size > arg_process_size_max)
+                        return -EFBIG;
+
+                if (fd_uncompressed >= 0) {
+                        /* Most of a core is usually zero pages,
+                         * leave holes for them */
+                        if (arg_sparse) {
+                                ssize_t k;
+
+                                k = sparse_write(fd_uncompressed, buf, n, 64);
+                                if (k < 0)
+                                        return (int) k;
+                        } else {
+                                r = loop_write(fd_uncompressed, buf, n, false);
+                                if (r < 0)
+                                        return r;
+                        }
+                }
+
+                if (fd_compressor >= 0) {
+                        r = loop_write(fd_compressor, buf, n, false);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        /* A trailing hole needs to be made part of the file
+         * explicitly */
+        if (arg_sparse && fd_uncompressed >= 0 &&
+            ftruncate(fd_uncompressed, size) < 0)
+                return -errno;
+
+        *ret_size = size;
+        return 0;
+}
+
 static int save_external_coredump(
                 const char *info[_INFO_LEN],
                 uid_t uid,
@@ -289,9 +475,16 @@ static int save_external_coredump(
 
         _cleanup_free_ char *fn = NULL, *tmp = NULL;
         _cleanup_close_ int fd = -1;
-        struct stat st;
+        bool keep_uncompressed = true;
+        uint64_t size;
         int r;
 
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        _cleanup_free_ char *fn_compressed = NULL, *tmp_compressed = NULL;
+        _cleanup_close_ int fd_compressed = -1, fd_compressor = -1;
+        pid_t compressor_pid = 0;
+#endif
+
         assert(info);
         assert(ret_filename);
         assert(ret_fd);
@@ -301,17 +494,44 @@ static int save_external_coredump(
         if (r < 0)
                 return log_error_errno(r, "Failed to determine coredump file name: %m");
 
-        r = tempfn_random(fn, NULL, &tmp);
-        if (r < 0)
-                return log_error_errno(r, "Failed to determine temporary file name: %m");
-
         mkdir_p_label("/var/lib/systemd/coredump", 0755);
 
-        fd = open(tmp, O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW, 0640);
-        if (fd < 0)
-                return log_error_errno(errno, "Failed to create coredump file %s: %m", tmp);
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        /* If we will remove the coredump anyway, do not compress. We
+         * don't know the size before we read it though, hence a
+         * coredump that turns out too large to keep is compressed in
+         * vain. */
+        if (arg_compress && IN_SET(arg_storage, COREDUMP_STORAGE_EXTERNAL, COREDUMP_STORAGE_BOTH))
+                (void) start_compressor(fn, &fn_compressed, &tmp_compressed, &fd_compressed, &fd_compressor, &compressor_pid);
+
+#ifndef HAVE_ELFUTILS
+        /* Without a stack trace to generate, nobody needs the
+         * uncompressed data on disk, unless it goes to the journal
+         * too */
+        if (fd_compressor >= 0 && arg_storage == COREDUMP_STORAGE_EXTERNAL)
+                keep_uncompressed = false;
+#endif
+#endif
+
+        if (keep_uncompressed) {
+                r = tempfn_random(fn, NULL, &tmp);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to determine temporary file name: %m");
+                        goto fail;
+                }
 
-        r = copy_bytes(STDIN_FILENO, fd, arg_process_size_max, false);
+                fd = open(tmp, O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW, 0640);
+                if (fd < 0) {
+                        r = log_error_errno(errno, "Failed to create coredump file %s: %m", tmp);
+                        goto fail;
+                }
+        }
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        r = read_coredump(fd, fd_compressor, &size);
+#else
+        r = read_coredump(fd, -1, &size);
+#endif
         if (r == -EFBIG) {
                 log_error("Coredump of %s (%s) is larger than configured processing limit, refusing.", info[INFO_PID], info[INFO_COMM]);
                 goto fail;
@@ -323,69 +543,49 @@ static int save_external_coredump(
                 goto fail;
         }
 
-        if (fstat(fd, &st) < 0) {
-                log_error_errno(errno, "Failed to fstat coredump %s: %m", tmp);
-                goto fail;
-        }
-
-        if (lseek(fd, 0, SEEK_SET) == (off_t) -1) {
-                log_error_errno(errno, "Failed to seek on %s: %m", tmp);
-                goto fail;
-        }
-
 #if defined(HAVE_XZ) || defined(HAVE_LZ4)
-        /* If we will remove the coredump anyway, do not compress. */
-        if (maybe_remove_external_coredump(NULL, st.st_size) == 0
-            && arg_compress) {
+        if (fd_compressor >= 0) {
+                fd_compressor = safe_close(fd_compressor);
 
-                _cleanup_free_ char *fn_compressed = NULL, *tmp_compressed = NULL;
-                _cleanup_close_ int fd_compressed = -1;
+                r = wait_for_terminate_and_warn("compressor", compressor_pid, true);
+                compressor_pid = 0;
+                if (r != 0) {
+                        if (!keep_uncompressed) {
+                                r = -EIO;
+                                goto fail;
+                        }
 
-                fn_compressed = strappend(fn, COMPRESSED_EXT);
-                if (!fn_compressed) {
-                        log_oom();
                         goto uncompressed;
                 }
 
-                r = tempfn_random(fn_compressed, NULL, &tmp_compressed);
+                r = fix_permissions(fd_compressed, tmp_compressed, fn_compressed, info, uid);
                 if (r < 0) {
-                        log_error_errno(r, "Failed to determine temporary file name for %s: %m", fn_compressed);
-                        goto uncompressed;
-                }
+                        if (!keep_uncompressed)
+                                goto fail;
 
-                fd_compressed = open(tmp_compressed, O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW, 0640);
-                if (fd_compressed < 0) {
-                        log_error_errno(errno, "Failed to create file %s: %m", tmp_compressed);
                         goto uncompressed;
                 }
 
-                r = compress_stream(fd, fd_compressed, -1);
-                if (r < 0) {
-                        log_error_errno(r, "Failed to compress %s: %m", tmp_compressed);
-                        goto fail_compressed;
-                }
-
-                r = fix_permissions(fd_compressed, tmp_compressed, fn_compressed, info, uid);
-                if (r < 0)
-                        goto fail_compressed;
-
                 /* OK, this worked, we can get rid of the uncompressed version now */
-                unlink_noerrno(tmp);
+                if (keep_uncompressed)
+                        unlink_noerrno(tmp);
 
                 *ret_filename = fn_compressed;     /* compressed */
-                *ret_fd = fd;                      /* uncompressed */
-                *ret_size = (uint64_t) st.st_size; /* uncompressed */
+                *ret_fd = keep_uncompressed ? fd : fd_compressed;
+                *ret_size = size;                  /* uncompressed */
 
                 fn_compressed = NULL;
-                fd = -1;
+                if (keep_uncompressed)
+                        fd = -1;
+                else
+                        fd_compressed = -1;
 
                 return 0;
-
-        fail_compressed:
-                unlink_noerrno(tmp_compressed);
         }
 
 uncompressed:
+        if (tmp_compressed)
+                unlink_noerrno(tmp_compressed);
 #endif
         r = fix_permissions(fd, tmp, fn, info, uid);
         if (r < 0)
@@ -393,7 +593,7 @@ uncompressed:
 
         *ret_filename = fn;
         *ret_fd = fd;
-        *ret_size = (uint64_t) st.st_size;
+        *ret_size = size;
 
         fn = NULL;
         fd = -1;
@@ -401,7 +601,16 @@ uncompressed:
         return 0;
 
 fail:
-        unlink_noerrno(tmp);
+        if (tmp)
+                unlink_noerrno(tmp);
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        if (compressor_pid > 0) {
+                fd_compressor = safe_close(fd_compressor);
+                (void) wait_for_terminate(compressor_pid, NULL);
+        }
+        if (fd_compressed >= 0)
+                unlink_noerrno(tmp_compressed);
+#endif
         return r;
 }
 
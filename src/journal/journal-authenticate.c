@@ -27,6 +27,11 @@
 #include "journal-authenticate.h"
 #include "fsprg.h"
 
+/* Evolving the key is one modular squaring, seeking costs about as
+ * much as several hundred of those. Hence walk forward to epochs that
+ * are close. */
+#define FSPRG_EVOLVE_MAX 128
+
 static uint64_t journal_file_tag_seqnum(JournalFile *f) {
         uint64_t r;
 
@@ -165,8 +170,16 @@ int journal_file_fsprg_evolve(JournalFile *f, uint64_t realtime) {
         }
 }
 
+static void fsprg_wipe(void *p, size_t l) {
+        volatile uint8_t *x = p;
+
+        /* Unlike memzero() this is not optimized away, even though
+         * the memory is freed right after */
+        while (l-- > 0)
+                *(x++) = 0;
+}
+
 int journal_file_fsprg_seek(JournalFile *f, uint64_t goal) {
-        void *msk;
         uint64_t epoch;
 
         assert(f);
@@ -183,8 +196,12 @@ int journal_file_fsprg_seek(JournalFile *f, uint64_t goal) {
                 if (goal == epoch)
                         return 0;
 
-                if (goal == epoch+1) {
-                        FSPRG_Evolve(f->fsprg_state);
+                if (goal > epoch && goal - epoch <= FSPRG_EVOLVE_MAX) {
+                        while (epoch < goal) {
+                                FSPRG_Evolve(f->fsprg_state);
+                                epoch++;
+                        }
+
                         return 0;
                 }
         } else {
@@ -197,9 +214,20 @@ int journal_file_fsprg_seek(JournalFile *f, uint64_t goal) {
 
         log_debug("Seeking FSPRG key to %"PRIu64".", goal);
 
-        msk = alloca(FSPRG_mskinbytes(FSPRG_RECOMMENDED_SECPAR));
-        FSPRG_GenMK(msk, NULL, f->fsprg_seed, f->fsprg_seed_size, FSPRG_RECOMMENDED_SECPAR);
-        FSPRG_Seek(f->fsprg_state, goal, msk, f->fsprg_seed, f->fsprg_seed_size);
+        if (!f->fsprg_msk) {
+                /* Deriving the secret key from the seed means
+                 * generating two large primes, which is far more
+                 * expensive than the seek itself, hence keep it for
+                 * the next seek on this file. */
+                f->fsprg_msk_size = FSPRG_mskinbytes(FSPRG_RECOMMENDED_SECPAR);
+                f->fsprg_msk = malloc(f->fsprg_msk_size);
+                if (!f->fsprg_msk)
+                        return -ENOMEM;
+
+                FSPRG_GenMK(f->fsprg_msk, NULL, f->fsprg_seed, f->fsprg_seed_size, FSPRG_RECOMMENDED_SECPAR);
+        }
+
+        FSPRG_Seek(f->fsprg_state, goal, f->fsprg_msk, f->fsprg_seed, f->fsprg_seed_size);
         return 0;
 }
 
@@ -424,6 +452,27 @@ finish:
         return r;
 }
 
+void journal_file_fss_free(JournalFile *f) {
+        assert(f);
+
+        if (f->fss_file)
+                munmap(f->fss_file, PAGE_ALIGN(f->fss_file_size));
+        else if (f->fsprg_state) {
+                fsprg_wipe(f->fsprg_state, f->fsprg_state_size);
+                free(f->fsprg_state);
+        }
+
+        if (f->fsprg_msk) {
+                fsprg_wipe(f->fsprg_msk, f->fsprg_msk_size);
+                free(f->fsprg_msk);
+        }
+
+        free(f->fsprg_seed);
+
+        if (f->hmac)
+                gcry_md_close(f->hmac);
+}
+
 static void initialize_libgcrypt(void) {
         const char *p;
 
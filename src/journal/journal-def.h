@@ -68,10 +68,11 @@ typedef enum ObjectType {
 enum {
         OBJECT_COMPRESSED_XZ = 1 << 0,
         OBJECT_COMPRESSED_LZ4 = 1 << 1,
+        OBJECT_COMPRESSED_ZSTD = 1 << 2,
         _OBJECT_COMPRESSED_MAX
 };
 
-#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4)
+#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4 | OBJECT_COMPRESSED_ZSTD)
 
 struct ObjectHeader {
         uint8_t type;
@@ -105,6 +106,12 @@ struct EntryItem {
         le64_t hash;
 } _packed_;
 
+/* In files with HEADER_INCOMPATIBLE_COMPACT set, entry items are only
+ * the 32bit offset of the data object, the hash is taken from the
+ * data object itself. Entry arrays list 32bit offsets too. Such files
+ * are never larger than 4G. */
+typedef le32_t EntryItemCompact;
+
 struct EntryObject {
         ObjectHeader object;
         le64_t seqnum;
@@ -161,20 +168,34 @@ enum {
 enum {
         HEADER_INCOMPATIBLE_COMPRESSED_XZ = 1 << 0,
         HEADER_INCOMPATIBLE_COMPRESSED_LZ4 = 1 << 1,
+        HEADER_INCOMPATIBLE_COMPRESSED_ZSTD = 1 << 2,
+        HEADER_INCOMPATIBLE_COMPACT = 1 << 3,
 };
 
-#define HEADER_INCOMPATIBLE_ANY (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4)
+#define HEADER_INCOMPATIBLE_ANY (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4|HEADER_INCOMPATIBLE_COMPRESSED_ZSTD|HEADER_INCOMPATIBLE_COMPACT)
+
+#ifdef HAVE_XZ
+#  define HEADER_INCOMPATIBLE_SUPPORTED_XZ HEADER_INCOMPATIBLE_COMPRESSED_XZ
+#else
+#  define HEADER_INCOMPATIBLE_SUPPORTED_XZ 0
+#endif
+
+#ifdef HAVE_LZ4
+#  define HEADER_INCOMPATIBLE_SUPPORTED_LZ4 HEADER_INCOMPATIBLE_COMPRESSED_LZ4
+#else
+#  define HEADER_INCOMPATIBLE_SUPPORTED_LZ4 0
+#endif
 
-#if defined(HAVE_XZ) && defined(HAVE_LZ4)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_ANY
-#elif defined(HAVE_XZ)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_XZ
-#elif defined(HAVE_LZ4)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_LZ4
+#ifdef HAVE_ZSTD
+#  define HEADER_INCOMPATIBLE_SUPPORTED_ZSTD HEADER_INCOMPATIBLE_COMPRESSED_ZSTD
 #else
-#  define HEADER_INCOMPATIBLE_SUPPORTED 0
+#  define HEADER_INCOMPATIBLE_SUPPORTED_ZSTD 0
 #endif
 
+#define HEADER_INCOMPATIBLE_SUPPORTED \
+        (HEADER_INCOMPATIBLE_SUPPORTED_XZ|HEADER_INCOMPATIBLE_SUPPORTED_LZ4|HEADER_INCOMPATIBLE_SUPPORTED_ZSTD| \
+         HEADER_INCOMPATIBLE_COMPACT)
+
 enum {
         HEADER_COMPATIBLE_SEALED = 1
 };
@@ -219,8 +240,11 @@ struct Header {
         /* Added in 189 */
         le64_t n_tags;
         le64_t n_entry_arrays;
+        /* Added in 226 */
+        le64_t data_hash_chain_depth;
+        le64_t field_hash_chain_depth;
 
-        /* Size: 240 */
+        /* Size: 256 */
 } _packed_;
 
 #define FSS_HEADER_SIGNATURE ((char[]) { 'K', 'S', 'H', 'H', 'R', 'H', 'L', 'P' })
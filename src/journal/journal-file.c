@@ -27,6 +27,9 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <linux/fs.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/eventfd.h>
 
 #include "btrfs-util.h"
 #include "journal-def.h"
@@ -39,8 +42,19 @@
 #define DEFAULT_DATA_HASH_TABLE_SIZE (2047ULL*sizeof(HashItem))
 #define DEFAULT_FIELD_HASH_TABLE_SIZE (333ULL*sizeof(HashItem))
 
+/* How many data objects to remember when copying entries between two files */
+#define COPY_MAP_MAX 65536U
+
+/* Never size a hash table above this fraction of the maximum file size */
+#define HASH_TABLE_SIZE_MAX_FRACTION 4
+
 #define COMPRESSION_SIZE_THRESHOLD (512ULL)
 
+/* Only hand compression off to worker threads if a batch has at
+ * least this much uncompressed data to compress */
+#define PARALLEL_COMPRESSION_SIZE_MIN (64ULL*1024ULL)
+#define COMPRESSION_THREADS_MAX 4U
+
 /* This is the minimum journal file size */
 #define JOURNAL_FILE_SIZE_MIN (4ULL*1024ULL*1024ULL)           /* 4 MiB */
 
@@ -66,6 +80,10 @@
 /* How many entries to keep in the entry array chain cache at max */
 #define CHAIN_CACHE_MAX 20
 
+/* Entry arrays double in size along a chain, hence no valid chain has
+ * anywhere near this many links */
+#define CHAIN_CACHE_ARRAYS_MAX 64
+
 /* How much to increase the journal file size at once each time we allocate something new. */
 #define FILE_SIZE_INCREASE (8ULL*1024ULL*1024ULL)              /* 8MB */
 
@@ -75,6 +93,9 @@
 /* The mmap context to use for the header we pick as one above the last defined typed */
 #define CONTEXT_HEADER _OBJECT_TYPE_MAX
 
+static void chain_cache_free(OrderedHashmap *h);
+static int journal_file_fstat(JournalFile *f);
+
 static int journal_file_set_online(JournalFile *f) {
         assert(f);
 
@@ -87,6 +108,24 @@ static int journal_file_set_online(JournalFile *f) {
         if (mmap_cache_got_sigbus(f->mmap, f->fd))
                 return -EIO;
 
+        /* If a sync is still running in the background, cancel it
+         * before it marks the file offline, or wait for it if it
+         * already is doing so. */
+        for (;;) {
+                int state = f->offline_state;
+
+                if (IN_SET(state, OFFLINE_SYNCING, OFFLINE_AGAIN)) {
+                        if (__sync_bool_compare_and_swap(&f->offline_state, state, OFFLINE_CANCEL))
+                                break;
+                        continue;
+                }
+
+                if (IN_SET(state, OFFLINE_OFFLINING, OFFLINE_DONE))
+                        journal_file_set_offline_join(f);
+
+                break;
+        }
+
         switch(f->header->state) {
                 case STATE_ONLINE:
                         return 0;
@@ -101,7 +140,85 @@ static int journal_file_set_online(JournalFile *f) {
         }
 }
 
-int journal_file_set_offline(JournalFile *f) {
+static void journal_file_fdatasync(JournalFile *f) {
+        usec_t start, t, m;
+
+        start = now(CLOCK_MONOTONIC);
+        (void) fdatasync(f->fd);
+        t = now(CLOCK_MONOTONIC) - start;
+
+        __sync_fetch_and_add(&f->n_syncs, 1);
+        __sync_fetch_and_add(&f->sync_usec, t);
+
+        do
+                m = f->sync_usec_max;
+        while (t > m && !__sync_bool_compare_and_swap(&f->sync_usec_max, m, t));
+}
+
+static void journal_file_set_offline_notify(JournalFile *f) {
+        if (f->offline_notify_fd >= 0)
+                (void) eventfd_write(f->offline_notify_fd, 1);
+}
+
+static void *journal_file_set_offline_thread(void *p) {
+        JournalFile *f = p;
+        sigset_t fullset;
+
+        /* No signals in this thread please, except for SIGBUS, so
+         * that an I/O error when writing the header is caught like
+         * in the main thread. mmap_cache_got_sigbus() isn't thread
+         * safe, hence it is checked when joining. */
+        assert_se(sigfillset(&fullset) == 0);
+        assert_se(sigdelset(&fullset, SIGBUS) == 0);
+        assert_se(pthread_sigmask(SIG_BLOCK, &fullset, NULL) == 0);
+
+        prctl(PR_SET_NAME, (unsigned long) "journal-offline");
+
+        for (;;) {
+                journal_file_fdatasync(f);
+
+                if (__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_SYNCING, OFFLINE_OFFLINING))
+                        break;
+
+                /* The file was written to while we synced, and
+                 * then asked to go offline again */
+                if (__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN, OFFLINE_SYNCING))
+                        continue;
+
+                /* Just written to, leave the header alone */
+                assert_se(__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_CANCEL, OFFLINE_DONE));
+                journal_file_set_offline_notify(f);
+                return NULL;
+        }
+
+        f->header->state = STATE_OFFLINE;
+        journal_file_fdatasync(f);
+
+        assert_se(__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_OFFLINING, OFFLINE_DONE));
+        journal_file_set_offline_notify(f);
+        return NULL;
+}
+
+void journal_file_set_offline_join(JournalFile *f) {
+        assert(f);
+
+        if (f->offline_state == OFFLINE_JOINED)
+                return;
+
+        (void) pthread_join(f->offline_thread, NULL);
+        f->offline_state = OFFLINE_JOINED;
+
+        /* Dispatch a SIGBUS the thread might have run into */
+        (void) mmap_cache_got_sigbus(f->mmap, f->fd);
+}
+
+bool journal_file_set_offline_done(JournalFile *f) {
+        assert(f);
+
+        return IN_SET(f->offline_state, OFFLINE_JOINED, OFFLINE_DONE);
+}
+
+int journal_file_set_offline(JournalFile *f, bool wait) {
         assert(f);
 
         if (!f->writable)
@@ -110,10 +227,38 @@ int journal_file_set_offline(JournalFile *f) {
         if (!(f->fd >= 0 && f->header))
                 return -EINVAL;
 
+        /* A sync that is still going covers everything written
+         * since, as writing would have cancelled it. One that was
+         * cancelled is told to start over. */
+        while (!wait) {
+                int state = f->offline_state;
+
+                if (IN_SET(state, OFFLINE_SYNCING, OFFLINE_OFFLINING, OFFLINE_AGAIN))
+                        return 0;
+
+                if (state != OFFLINE_CANCEL)
+                        break;
+
+                if (__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_CANCEL, OFFLINE_AGAIN))
+                        return 0;
+        }
+
+        journal_file_set_offline_join(f);
+
         if (f->header->state != STATE_ONLINE)
                 return 0;
 
-        fsync(f->fd);
+        if (!wait) {
+                f->offline_state = OFFLINE_SYNCING;
+
+                if (pthread_create(&f->offline_thread, NULL, journal_file_set_offline_thread, f) == 0)
+                        return 0;
+
+                /* Fall back to doing it inline */
+                f->offline_state = OFFLINE_JOINED;
+        }
+
+        journal_file_fdatasync(f);
 
         if (mmap_cache_got_sigbus(f->mmap, f->fd))
                 return -EIO;
@@ -123,11 +268,78 @@ int journal_file_set_offline(JournalFile *f) {
         if (mmap_cache_got_sigbus(f->mmap, f->fd))
                 return -EIO;
 
-        fsync(f->fd);
+        journal_file_fdatasync(f);
 
         return 0;
 }
 
+static bool journal_file_allocate_ahead_reap(JournalFile *f, bool wait) {
+        int r;
+
+        assert(f);
+
+        if (!f->allocate_ahead_running)
+                return true;
+
+        if (wait)
+                r = pthread_join(f->allocate_ahead_thread, NULL);
+        else
+                r = pthread_tryjoin_np(f->allocate_ahead_thread, NULL);
+        if (r == EBUSY)
+                return false;
+
+        f->allocate_ahead_running = false;
+
+        /* Don't bother again on file systems that would have to fall
+         * back to writing out the whole block */
+        if (f->allocate_ahead_state == ALLOCATE_AHEAD_UNSUPPORTED)
+                f->allocate_ahead_unsupported = true;
+
+        return true;
+}
+
+static void journal_file_trim(JournalFile *f) {
+        uint64_t p, end;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Archived files are never written to again, hence give the
+         * space allocated behind the last object back, so that it
+         * may be used for more history instead. */
+
+        p = le64toh(f->header->tail_object_offset);
+        if (p <= 0)
+                return;
+
+        r = journal_file_move_to_object(f, OBJECT_UNUSED, p, &o);
+        if (r < 0)
+                return;
+
+        end = PAGE_ALIGN(p + ALIGN64(le64toh(o->object.size)));
+
+        r = journal_file_fstat(f);
+        if (r < 0)
+                return;
+
+        if (end >= (uint64_t) f->last_stat.st_size)
+                return;
+
+        /* Shrink the arena first, so that nobody looks for objects
+         * beyond the end of the file */
+        if (end < le64toh(f->header->header_size) + le64toh(f->header->arena_size))
+                f->header->arena_size = htole64(end - le64toh(f->header->header_size));
+
+        if (ftruncate(f->fd, end) < 0) {
+                log_debug_errno(errno, "Failed to truncate %s, ignoring: %m", f->path);
+                return;
+        }
+
+        f->last_stat.st_size = end;
+        f->allocate_ahead_offset = f->allocate_ahead_size = 0;
+}
+
 void journal_file_close(JournalFile *f) {
         assert(f);
 
@@ -137,7 +349,13 @@ void journal_file_close(JournalFile *f) {
                 journal_file_append_tag(f);
 #endif
 
-        journal_file_set_offline(f);
+        journal_file_allocate_ahead_reap(f, true);
+        journal_file_set_offline_join(f);
+
+        if (f->writable && f->fd >= 0 && f->header && f->header->state == STATE_ARCHIVED)
+                journal_file_trim(f);
+
+        journal_file_set_offline(f, true);
 
         if (f->mmap && f->fd >= 0)
                 mmap_cache_close_fd(f->mmap, f->fd);
@@ -160,22 +378,15 @@ void journal_file_close(JournalFile *f) {
         if (f->mmap)
                 mmap_cache_unref(f->mmap);
 
-        ordered_hashmap_free_free(f->chain_cache);
+        chain_cache_free(f->chain_cache);
+        hashmap_free_free(f->match_cache);
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         free(f->compress_buffer);
 #endif
 
 #ifdef HAVE_GCRYPT
-        if (f->fss_file)
-                munmap(f->fss_file, PAGE_ALIGN(f->fss_file_size));
-        else
-                free(f->fsprg_state);
-
-        free(f->fsprg_seed);
-
-        if (f->hmac)
-                gcry_md_close(f->hmac);
+        journal_file_fss_free(f);
 #endif
 
         free(f);
@@ -193,7 +404,9 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
 
         h.incompatible_flags |= htole32(
                 f->compress_xz * HEADER_INCOMPATIBLE_COMPRESSED_XZ |
-                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4);
+                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4 |
+                f->compress_zstd * HEADER_INCOMPATIBLE_COMPRESSED_ZSTD |
+                f->compact * HEADER_INCOMPATIBLE_COMPACT);
 
         h.compatible_flags = htole32(
                 f->seal * HEADER_COMPATIBLE_SEALED);
@@ -330,6 +543,9 @@ static int journal_file_verify_header(JournalFile *f) {
 
         f->compress_xz = JOURNAL_HEADER_COMPRESSED_XZ(f->header);
         f->compress_lz4 = JOURNAL_HEADER_COMPRESSED_LZ4(f->header);
+        f->compress_zstd = JOURNAL_HEADER_COMPRESSED_ZSTD(f->header);
+
+        f->compact = JOURNAL_HEADER_COMPACT(f->header);
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
@@ -352,6 +568,86 @@ static int journal_file_fstat(JournalFile *f) {
         return 0;
 }
 
+static void *allocate_ahead_thread(void *p) {
+        JournalFile *f = p;
+        sigset_t fullset;
+
+        /* No signals in this thread please */
+        assert_se(sigfillset(&fullset) == 0);
+        assert_se(pthread_sigmask(SIG_BLOCK, &fullset, NULL) == 0);
+
+        prctl(PR_SET_NAME, (unsigned long) "journal-alloc");
+
+        /* This extends the file, but not the arena, which is only
+         * grown into the new space when it is needed. Unlike
+         * posix_fallocate(), fallocate() fails where the file system
+         * can't allocate natively, instead of writing zeros to the
+         * whole block behind our back. */
+        if (fallocate(f->fd, 0, f->allocate_ahead_offset, f->allocate_ahead_size) >= 0)
+                __sync_lock_test_and_set(&f->allocate_ahead_state, ALLOCATE_AHEAD_DONE);
+        else if (IN_SET(errno, EOPNOTSUPP, ENOSYS))
+                __sync_lock_test_and_set(&f->allocate_ahead_state, ALLOCATE_AHEAD_UNSUPPORTED);
+        else
+                __sync_lock_test_and_set(&f->allocate_ahead_state, ALLOCATE_AHEAD_FAILED);
+
+        return NULL;
+}
+
+static void journal_file_allocate_ahead(JournalFile *f, uint64_t offset) {
+        uint64_t size = FILE_SIZE_INCREASE;
+
+        assert(f);
+
+        /* Allocating the next block of the file can take a while on
+         * slow storage, and we'd otherwise do it in the middle of
+         * appending an entry. Hence allocate it in a thread right
+         * after the file grew, so that it is usually ready by the
+         * time we need it. */
+
+        if (!journal_file_allocate_ahead_reap(f, false))
+                return;
+
+        if (f->allocate_ahead_unsupported)
+                return;
+
+        if (f->metrics.max_size > 0) {
+                if (offset >= f->metrics.max_size)
+                        return;
+
+                size = MIN(size, f->metrics.max_size - offset);
+        }
+
+        if (f->compact) {
+                uint64_t limit = PAGE_ALIGN(UINT32_MAX) - page_size();
+
+                if (offset >= limit)
+                        return;
+
+                size = MIN(size, limit - offset);
+        }
+
+        if (f->metrics.keep_free > 0) {
+                struct statvfs svfs;
+
+                if (fstatvfs(f->fd, &svfs) < 0)
+                        return;
+
+                if ((uint64_t) svfs.f_bfree * svfs.f_bsize < f->metrics.keep_free + size)
+                        return;
+        }
+
+        f->allocate_ahead_offset = offset;
+        f->allocate_ahead_size = size;
+        f->allocate_ahead_state = ALLOCATE_AHEAD_RUNNING;
+
+        if (pthread_create(&f->allocate_ahead_thread, NULL, allocate_ahead_thread, f) != 0) {
+                f->allocate_ahead_state = ALLOCATE_AHEAD_FAILED;
+                return;
+        }
+
+        f->allocate_ahead_running = true;
+}
+
 static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size) {
         uint64_t old_size, new_size;
         int r;
@@ -392,6 +688,10 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
         if (f->metrics.max_size > 0 && new_size > f->metrics.max_size)
                 return -E2BIG;
 
+        /* Compact files store 32bit offsets only */
+        if (f->compact && new_size > UINT32_MAX)
+                return -E2BIG;
+
         if (new_size > f->metrics.min_size && f->metrics.keep_free > 0) {
                 struct statvfs svfs;
 
@@ -414,6 +714,8 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
         new_size = ((new_size+FILE_SIZE_INCREASE-1) / FILE_SIZE_INCREASE) * FILE_SIZE_INCREASE;
         if (f->metrics.max_size > 0 && new_size > f->metrics.max_size)
                 new_size = f->metrics.max_size;
+        if (f->compact && new_size > UINT32_MAX)
+                new_size = PAGE_ALIGN(UINT32_MAX) - page_size();
 
         /* Note that the glibc fallocate() fallback is very
            inefficient, hence we try to minimize the allocation area
@@ -424,7 +726,12 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
 
         f->header->arena_size = htole64(new_size - le64toh(f->header->header_size));
 
-        return journal_file_fstat(f);
+        r = journal_file_fstat(f);
+        if (r < 0)
+                return r;
+
+        journal_file_allocate_ahead(f, new_size);
+        return 0;
 }
 
 static unsigned type_to_context(ObjectType type) {
@@ -597,7 +904,24 @@ int journal_file_append_object(JournalFile *f, ObjectType type, uint64_t size, O
         return 0;
 }
 
-static int journal_file_setup_data_hash_table(JournalFile *f) {
+static uint64_t hash_table_size_from_template(JournalFile *f, uint64_t s, uint64_t n_template) {
+        uint64_t t;
+
+        assert(f);
+
+        /* Size the table so that the number of objects the file we
+         * rotate from ended up with fills it only half. This way
+         * journals with many distinct values don't grow the same long
+         * hash chains in every file. */
+
+        t = n_template * 2 * sizeof(HashItem);
+        if (f->metrics.max_size > 0 && t > f->metrics.max_size / HASH_TABLE_SIZE_MAX_FRACTION)
+                t = f->metrics.max_size / HASH_TABLE_SIZE_MAX_FRACTION / sizeof(HashItem) * sizeof(HashItem);
+
+        return MAX(s, t);
+}
+
+static int journal_file_setup_data_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -613,6 +937,9 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
                 s = DEFAULT_DATA_HASH_TABLE_SIZE;
 
+        if (template && JOURNAL_HEADER_CONTAINS(template->header, n_data))
+                s = hash_table_size_from_template(f, s, le64toh(template->header->n_data));
+
         log_debug("Reserving %"PRIu64" entries in hash table.", s / sizeof(HashItem));
 
         r = journal_file_append_object(f,
@@ -630,7 +957,7 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         return 0;
 }
 
-static int journal_file_setup_field_hash_table(JournalFile *f) {
+static int journal_file_setup_field_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -638,9 +965,14 @@ static int journal_file_setup_field_hash_table(JournalFile *f) {
         assert(f);
 
         /* We use a fixed size hash table for the fields as this
-         * number should grow very slowly only */
+         * number should grow very slowly only, unless the previous
+         * file showed otherwise */
 
         s = DEFAULT_FIELD_HASH_TABLE_SIZE;
+
+        if (template && JOURNAL_HEADER_CONTAINS(template->header, n_fields))
+                s = hash_table_size_from_template(f, s, le64toh(template->header->n_fields));
+
         r = journal_file_append_object(f,
                                        OBJECT_FIELD_HASH_TABLE,
                                        offsetof(Object, hash_table.items) + s,
@@ -803,7 +1135,7 @@ int journal_file_find_field_object_with_hash(
                 const void *field, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
         int r;
 
         assert(f);
@@ -847,8 +1179,14 @@ int journal_file_find_field_object_with_hash(
                 }
 
                 p = le64toh(o->field.next_hash_offset);
+                depth++;
         }
 
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            depth > le64toh(f->header->field_hash_chain_depth))
+                f->header->field_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -874,7 +1212,7 @@ int journal_file_find_data_object_with_hash(
                 const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
         int r;
 
         assert(f);
@@ -909,7 +1247,7 @@ int journal_file_find_data_object_with_hash(
                         goto next;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                         uint64_t l;
                         size_t rsize = 0;
 
@@ -952,8 +1290,16 @@ int journal_file_find_data_object_with_hash(
 
         next:
                 p = le64toh(o->data.next_hash_offset);
+                depth++;
         }
 
+        /* Remember the longest chain we had to walk in vain, the
+         * object we are about to add goes to its end */
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            depth > le64toh(f->header->data_hash_chain_depth))
+                f->header->data_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -1036,9 +1382,18 @@ static int journal_file_append_field(
         return 0;
 }
 
+typedef struct CompressedData {
+        bool prepared;
+        uint64_t hash;
+        int compression;
+        void *buffer;
+        size_t size;
+} CompressedData;
+
 static int journal_file_append_data(
                 JournalFile *f,
                 const void *data, uint64_t size,
+                const CompressedData *c,
                 Object **ret, uint64_t *offset) {
 
         uint64_t hash, p;
@@ -1050,7 +1405,13 @@ static int journal_file_append_data(
         assert(f);
         assert(data || size == 0);
 
-        hash = hash64(data, size);
+        /* If c is set and prepared, the data has already been
+         * hashed and compressed (or found not to be worth it) by one
+         * of the compression workers. */
+        if (c && !c->prepared)
+                c = NULL;
+
+        hash = c ? c->hash : hash64(data, size);
 
         r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
         if (r < 0)
@@ -1073,20 +1434,33 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
-        if (f->compress_xz &&
-            size >= COMPRESSION_SIZE_THRESHOLD) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+        if (c) {
+                compression = c->compression;
+
+                if (compression) {
+                        memcpy(o->data.payload, c->buffer, c->size);
+                        o->object.size = htole64(offsetof(Object, data.payload) + c->size);
+                        o->object.flags |= compression;
+
+                        log_debug("Compressed data object %"PRIu64" -> %zu using %s",
+                                  size, c->size, object_compressed_to_string(compression));
+                }
+        } else if (JOURNAL_FILE_COMPRESS(f) &&
+                   size >= COMPRESSION_SIZE_THRESHOLD) {
                 size_t rsize = 0;
 
                 compression = compress_blob(data, size, o->data.payload, &rsize);
 
-                if (compression) {
+                if (compression > 0) {
                         o->object.size = htole64(offsetof(Object, data.payload) + rsize);
                         o->object.flags |= compression;
 
                         log_debug("Compressed data object %"PRIu64" -> %zu using %s",
                                   size, rsize, object_compressed_to_string(compression));
-                }
+                } else
+                        /* Not compressible, store it as it is */
+                        compression = 0;
         }
 #endif
 
@@ -1136,22 +1510,35 @@ static int journal_file_append_data(
         return 0;
 }
 
-uint64_t journal_file_entry_n_items(Object *o) {
+uint64_t journal_file_entry_n_items(JournalFile *f, Object *o) {
+        assert(f);
         assert(o);
 
         if (o->object.type != OBJECT_ENTRY)
                 return 0;
 
-        return (le64toh(o->object.size) - offsetof(Object, entry.items)) / sizeof(EntryItem);
+        return (le64toh(o->object.size) - offsetof(Object, entry.items)) / journal_file_entry_item_size(f);
 }
 
-uint64_t journal_file_entry_array_n_items(Object *o) {
+uint64_t journal_file_entry_array_n_items(JournalFile *f, Object *o) {
+        assert(f);
         assert(o);
 
         if (o->object.type != OBJECT_ENTRY_ARRAY)
                 return 0;
 
-        return (le64toh(o->object.size) - offsetof(Object, entry_array.items)) / sizeof(uint64_t);
+        return (le64toh(o->object.size) - offsetof(Object, entry_array.items)) / journal_file_entry_array_item_size(f);
+}
+
+static void journal_file_entry_array_set_item(JournalFile *f, Object *o, uint64_t i, uint64_t p) {
+        assert(f);
+        assert(o);
+
+        if (f->compact) {
+                assert(p <= UINT32_MAX);
+                ((le32_t*) o->entry_array.items)[i] = htole32(p);
+        } else
+                o->entry_array.items[i] = htole64(p);
 }
 
 uint64_t journal_file_hash_table_n_items(Object *o) {
@@ -1167,6 +1554,8 @@ uint64_t journal_file_hash_table_n_items(Object *o) {
 static int link_entry_into_array(JournalFile *f,
                                  le64_t *first,
                                  le64_t *idx,
+                                 uint64_t *tail_offset,
+                                 uint64_t *tail_begin,
                                  uint64_t p) {
         int r;
         uint64_t n = 0, ap = 0, q, i, a, hidx;
@@ -1175,20 +1564,36 @@ static int link_entry_into_array(JournalFile *f,
         assert(f);
         assert(first);
         assert(idx);
+        assert(!tail_offset == !tail_begin);
         assert(p > 0);
 
         a = le64toh(*first);
         i = hidx = le64toh(*idx);
+
+        /* If we know where the last array of the chain is, start
+         * there, the new item is going to end up in it or right
+         * behind it anyway */
+        if (tail_offset && *tail_offset > 0 && hidx >= *tail_begin) {
+                a = *tail_offset;
+                i = hidx - *tail_begin;
+        }
+
         while (a > 0) {
 
                 r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
                 if (r < 0)
                         return r;
 
-                n = journal_file_entry_array_n_items(o);
+                n = journal_file_entry_array_n_items(f, o);
                 if (i < n) {
-                        o->entry_array.items[i] = htole64(p);
+                        journal_file_entry_array_set_item(f, o, i, p);
                         *idx = htole64(hidx + 1);
+
+                        if (tail_offset) {
+                                *tail_offset = a;
+                                *tail_begin = hidx - i;
+                        }
+
                         return 0;
                 }
 
@@ -1206,7 +1611,7 @@ static int link_entry_into_array(JournalFile *f,
                 n = 4;
 
         r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
-                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
+                                       offsetof(Object, entry_array.items) + n * journal_file_entry_array_item_size(f),
                                        &o, &q);
         if (r < 0)
                 return r;
@@ -1217,7 +1622,7 @@ static int link_entry_into_array(JournalFile *f,
                 return r;
 #endif
 
-        o->entry_array.items[i] = htole64(p);
+        journal_file_entry_array_set_item(f, o, i, p);
 
         if (ap == 0)
                 *first = htole64(q);
@@ -1234,6 +1639,11 @@ static int link_entry_into_array(JournalFile *f,
 
         *idx = htole64(hidx + 1);
 
+        if (tail_offset) {
+                *tail_offset = q;
+                *tail_begin = hidx - i;
+        }
+
         return 0;
 }
 
@@ -1257,7 +1667,7 @@ static int link_entry_into_array_plus_one(JournalFile *f,
                 le64_t i;
 
                 i = htole64(le64toh(*idx) - 1);
-                r = link_entry_into_array(f, first, &i, p);
+                r = link_entry_into_array(f, first, &i, NULL, NULL, p);
                 if (r < 0)
                         return r;
         }
@@ -1273,7 +1683,7 @@ static int journal_file_link_entry_item(JournalFile *f, Object *o, uint64_t offs
         assert(o);
         assert(offset > 0);
 
-        p = le64toh(o->entry.items[i].object_offset);
+        p = journal_file_entry_item_object_offset(f, o, i);
         if (p == 0)
                 return -EINVAL;
 
@@ -1305,6 +1715,8 @@ static int journal_file_link_entry(JournalFile *f, Object *o, uint64_t offset) {
         r = link_entry_into_array(f,
                                   &f->header->entry_array_offset,
                                   &f->header->n_entries,
+                                  &f->tail_entry_array_offset,
+                                  &f->tail_entry_array_begin,
                                   offset);
         if (r < 0)
                 return r;
@@ -1320,7 +1732,7 @@ static int journal_file_link_entry(JournalFile *f, Object *o, uint64_t offset) {
         f->tail_entry_monotonic_valid = true;
 
         /* Link up the items */
-        n = journal_file_entry_n_items(o);
+        n = journal_file_entry_n_items(f, o);
         for (i = 0; i < n; i++) {
                 r = journal_file_link_entry_item(f, o, offset, i);
                 if (r < 0)
@@ -1346,14 +1758,22 @@ static int journal_file_append_entry_internal(
         assert(items || n_items == 0);
         assert(ts);
 
-        osize = offsetof(Object, entry.items) + (n_items * sizeof(EntryItem));
+        osize = offsetof(Object, entry.items) + (n_items * journal_file_entry_item_size(f));
 
         r = journal_file_append_object(f, OBJECT_ENTRY, osize, &o, &np);
         if (r < 0)
                 return r;
 
         o->entry.seqnum = htole64(journal_file_entry_seqnum(f, seqnum));
-        memcpy(o->entry.items, items, n_items * sizeof(EntryItem));
+        if (f->compact) {
+                unsigned i;
+
+                for (i = 0; i < n_items; i++) {
+                        assert(le64toh(items[i].object_offset) <= UINT32_MAX);
+                        ((EntryItemCompact*) o->entry.items)[i] = htole32(le64toh(items[i].object_offset));
+                }
+        } else
+                memcpy(o->entry.items, items, n_items * sizeof(EntryItem));
         o->entry.realtime = htole64(ts->realtime);
         o->entry.monotonic = htole64(ts->monotonic);
         o->entry.xor_hash = htole64(xor_hash);
@@ -1379,6 +1799,8 @@ static int journal_file_append_entry_internal(
 }
 
 void journal_file_post_change(JournalFile *f) {
+        uint64_t size;
+
         assert(f);
 
         /* inotify() does not receive IN_MODIFY events from file
@@ -1388,7 +1810,15 @@ void journal_file_post_change(JournalFile *f) {
 
         __sync_synchronize();
 
-        if (ftruncate(f->fd, f->last_stat.st_size) < 0)
+        /* Don't cut off what was allocated in the background. But
+         * only if that actually succeeded, we'd extend the file
+         * sparsely otherwise. */
+        size = f->last_stat.st_size;
+        if (f->allocate_ahead_size > 0 &&
+            __sync_fetch_and_add(&f->allocate_ahead_state, 0) == ALLOCATE_AHEAD_DONE)
+                size = MAX(size, f->allocate_ahead_offset + f->allocate_ahead_size);
+
+        if (ftruncate(f->fd, size) < 0)
                 log_error_errno(errno, "Failed to truncate file to its own size: %m");
 }
 
@@ -1402,21 +1832,23 @@ static int entry_item_cmp(const void *_a, const void *_b) {
         return 0;
 }
 
-int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+static int journal_file_append_entry_no_post_change(
+                JournalFile *f,
+                const dual_timestamp *ts,
+                const struct iovec iovec[], unsigned n_iovec,
+                const CompressedData compressed[],
+                uint64_t *seqnum,
+                Object **ret, uint64_t *offset) {
+
         unsigned i;
         EntryItem *items;
         int r;
         uint64_t xor_hash = 0;
-        struct dual_timestamp _ts;
 
         assert(f);
+        assert(ts);
         assert(iovec || n_iovec == 0);
 
-        if (!ts) {
-                dual_timestamp_get(&_ts);
-                ts = &_ts;
-        }
-
         if (f->tail_entry_monotonic_valid &&
             ts->monotonic < le64toh(f->header->tail_entry_monotonic))
                 return -EINVAL;
@@ -1434,7 +1866,7 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
                 uint64_t p;
                 Object *o;
 
-                r = journal_file_append_data(f, iovec[i].iov_base, iovec[i].iov_len, &o, &p);
+                r = journal_file_append_data(f, iovec[i].iov_base, iovec[i].iov_len, compressed ? compressed + i : NULL, &o, &p);
                 if (r < 0)
                         return r;
 
@@ -1447,7 +1879,22 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
          * times for rotating media. */
         qsort_safe(items, n_iovec, sizeof(EntryItem), entry_item_cmp);
 
-        r = journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+        return journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+}
+
+int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+        struct dual_timestamp _ts;
+        int r;
+
+        assert(f);
+        assert(iovec || n_iovec == 0);
+
+        if (!ts) {
+                dual_timestamp_get(&_ts);
+                ts = &_ts;
+        }
+
+        r = journal_file_append_entry_no_post_change(f, ts, iovec, n_iovec, NULL, seqnum, ret, offset);
 
         /* If the memory mapping triggered a SIGBUS then we return an
          * IO error and ignore the error code passed down to us, since
@@ -1462,14 +1909,397 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
         return r;
 }
 
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+typedef struct CompressionPool {
+        const struct iovec **iovec;
+        CompressedData **data;
+        unsigned n_jobs;
+        unsigned next_job;
+} CompressionPool;
+
+static void compression_pool_run(CompressionPool *pool) {
+        unsigned k;
+
+        assert(pool);
+
+        /* Each job is picked up by exactly one thread, and only
+         * touches its own CompressedData, hence no locking beyond
+         * the job counter itself. */
+
+        while ((k = __sync_fetch_and_add(&pool->next_job, 1)) < pool->n_jobs) {
+                const struct iovec *iovec = pool->iovec[k];
+                CompressedData *c = pool->data[k];
+
+                /* The compressors fail if the result is not smaller
+                 * than the input, so this is enough space */
+                c->buffer = malloc(iovec->iov_len);
+                if (c->buffer) {
+                        c->compression = compress_blob(iovec->iov_base, iovec->iov_len, c->buffer, &c->size);
+                        if (c->compression <= 0) {
+                                c->compression = 0;
+                                c->buffer = mfree(c->buffer);
+                        }
+                }
+
+                /* If we failed to allocate memory, leave this one to
+                 * journal_file_append_data() */
+                c->prepared = c->buffer || c->compression == 0;
+        }
+}
+
+/* The worker threads are started once per process, on the first batch
+ * worth compressing in parallel, and then wait for the next batch. At
+ * most one batch is handed to them at a time. */
+static struct {
+        pthread_mutex_t mutex;
+        pthread_cond_t work, idle;
+        CompressionPool *pool;
+        unsigned generation;
+        unsigned n_threads, n_busy;
+        bool atfork_installed;
+} compression_workers = {
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .work = PTHREAD_COND_INITIALIZER,
+        .idle = PTHREAD_COND_INITIALIZER,
+};
+
+static void compression_workers_lock(void) {
+        assert_se(pthread_mutex_lock(&compression_workers.mutex) == 0);
+}
+
+static void compression_workers_unlock(void) {
+        assert_se(pthread_mutex_unlock(&compression_workers.mutex) == 0);
+}
+
+static void compression_workers_reset(void) {
+        /* The threads did not survive the fork(), start over in the
+         * child */
+        assert_se(pthread_mutex_init(&compression_workers.mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&compression_workers.work, NULL) == 0);
+        assert_se(pthread_cond_init(&compression_workers.idle, NULL) == 0);
+        compression_workers.pool = NULL;
+        compression_workers.n_threads = compression_workers.n_busy = 0;
+}
+
+static void *compression_thread(void *p) {
+        unsigned seen = 0;
+        sigset_t fullset;
+
+        /* No signals in this thread please */
+        assert_se(sigfillset(&fullset) == 0);
+        assert_se(pthread_sigmask(SIG_BLOCK, &fullset, NULL) == 0);
+
+        /* Assign a pretty name to this thread */
+        prctl(PR_SET_NAME, (unsigned long) "journal-compress");
+
+        compression_workers_lock();
+
+        for (;;) {
+                CompressionPool *pool;
+
+                while (!compression_workers.pool || compression_workers.generation == seen)
+                        assert_se(pthread_cond_wait(&compression_workers.work, &compression_workers.mutex) == 0);
+
+                pool = compression_workers.pool;
+                seen = compression_workers.generation;
+                compression_workers.n_busy++;
+
+                compression_workers_unlock();
+                compression_pool_run(pool);
+                compression_workers_lock();
+
+                if (--compression_workers.n_busy == 0)
+                        assert_se(pthread_cond_signal(&compression_workers.idle) == 0);
+        }
+
+        return NULL;
+}
+
+static unsigned compression_workers_start(unsigned n) {
+        pthread_attr_t attr;
+        pthread_t t;
+
+        /* Returns the number of worker threads available, with the
+         * mutex held */
+
+        compression_workers_lock();
+
+        if (!compression_workers.atfork_installed) {
+                if (pthread_atfork(compression_workers_lock, compression_workers_unlock, compression_workers_reset) != 0)
+                        return 0;
+
+                compression_workers.atfork_installed = true;
+        }
+
+        if (compression_workers.n_threads >= n)
+                return compression_workers.n_threads;
+
+        if (pthread_attr_init(&attr) != 0)
+                return compression_workers.n_threads;
+
+        if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0)
+                while (compression_workers.n_threads < n) {
+                        if (pthread_create(&t, &attr, compression_thread, NULL) != 0)
+                                break;
+
+                        compression_workers.n_threads++;
+                }
+
+        pthread_attr_destroy(&attr);
+
+        return compression_workers.n_threads;
+}
+
+static CompressedData *journal_file_compress_entries(JournalFile *f, const JournalEntry entries[], unsigned n_entries, unsigned *ret_n) {
+        _cleanup_free_ const struct iovec **iovec = NULL;
+        _cleanup_free_ CompressedData **data = NULL;
+        CompressionPool pool = {};
+        CompressedData *compressed = NULL;
+        unsigned i, j, k, n_iovec = 0, n_threads;
+        uint64_t total = 0;
+        long ncpus;
+
+        assert(f);
+        assert(entries || n_entries == 0);
+        assert(ret_n);
+
+        /* Compresses the large fields of a batch of entries in
+         * parallel, before they are appended to the file in order.
+         * Fields that are too small to compress, or that are already
+         * in the file, are skipped, and will be taken care of by
+         * journal_file_append_data() as usual. Returns NULL if
+         * nothing was compressed, otherwise an array with one
+         * CompressedData per field of the batch. */
+
+        if (!JOURNAL_FILE_COMPRESS(f))
+                return NULL;
+
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpus <= 1)
+                return NULL;
+
+        for (i = 0; i < n_entries; i++)
+                for (j = 0; j < entries[i].n_iovec; j++) {
+                        n_iovec++;
+
+                        if (entries[i].iovec[j].iov_len >= COMPRESSION_SIZE_THRESHOLD)
+                                total += entries[i].iovec[j].iov_len;
+                }
+
+        if (total < PARALLEL_COMPRESSION_SIZE_MIN)
+                return NULL;
+
+        compressed = new0(CompressedData, n_iovec);
+        iovec = new(const struct iovec*, n_iovec);
+        data = new(CompressedData*, n_iovec);
+        if (!compressed || !iovec || !data)
+                return mfree(compressed);
+
+        total = 0;
+        n_iovec = 0;
+        for (i = 0; i < n_entries; i++)
+                for (j = 0; j < entries[i].n_iovec; j++, n_iovec++) {
+                        const struct iovec *v = entries[i].iovec + j;
+                        uint64_t hash;
+                        int r;
+
+                        if (v->iov_len < COMPRESSION_SIZE_THRESHOLD)
+                                continue;
+
+                        /* Don't bother compressing what we'd only
+                         * deduplicate afterwards anyway */
+                        hash = hash64(v->iov_base, v->iov_len);
+                        r = journal_file_find_data_object_with_hash(f, v->iov_base, v->iov_len, hash, NULL, NULL);
+                        if (r != 0)
+                                continue;
+
+                        /* Same for fields repeated within the batch */
+                        for (k = 0; k < pool.n_jobs; k++)
+                                if (data[k]->hash == hash &&
+                                    iovec[k]->iov_len == v->iov_len &&
+                                    memcmp(iovec[k]->iov_base, v->iov_base, v->iov_len) == 0)
+                                        break;
+                        if (k < pool.n_jobs)
+                                continue;
+
+                        compressed[n_iovec].hash = hash;
+
+                        iovec[pool.n_jobs] = v;
+                        data[pool.n_jobs] = compressed + n_iovec;
+                        pool.n_jobs++;
+
+                        total += v->iov_len;
+                }
+
+        if (pool.n_jobs < 2 || total < PARALLEL_COMPRESSION_SIZE_MIN) {
+                /* Not worth the threads, just compress inline. */
+                free(compressed);
+                return NULL;
+        }
+
+        pool.iovec = iovec;
+        pool.data = data;
+
+        /* Hand the batch to the worker threads, unless another
+         * batch keeps them busy. This thread does its share of the
+         * work, too. */
+        n_threads = compression_workers_start(MIN((unsigned) ncpus, COMPRESSION_THREADS_MAX) - 1);
+        if (n_threads > 0 && !compression_workers.pool) {
+                compression_workers.pool = &pool;
+                compression_workers.generation++;
+                assert_se(pthread_cond_broadcast(&compression_workers.work) == 0);
+        } else
+                n_threads = 0;
+        compression_workers_unlock();
+
+        compression_pool_run(&pool);
+
+        /* All jobs were picked up at this point, wait until the
+         * workers finished theirs */
+        if (n_threads > 0) {
+                compression_workers_lock();
+                compression_workers.pool = NULL;
+                while (compression_workers.n_busy > 0)
+                        assert_se(pthread_cond_wait(&compression_workers.idle, &compression_workers.mutex) == 0);
+                compression_workers_unlock();
+        }
+
+        log_debug("Compressed %u data objects using %u threads.", pool.n_jobs, n_threads + 1);
+
+        *ret_n = n_iovec;
+        return compressed;
+}
+#else
+static CompressedData *journal_file_compress_entries(JournalFile *f, const JournalEntry entries[], unsigned n_entries, unsigned *ret_n) {
+        return NULL;
+}
+#endif
+
+static CompressedData *compressed_data_free(CompressedData *c, unsigned n) {
+        unsigned i;
+
+        if (!c)
+                return NULL;
+
+        for (i = 0; i < n; i++)
+                free(c[i].buffer);
+
+        free(c);
+        return NULL;
+}
+
+int journal_file_append_entries(JournalFile *f, const JournalEntry entries[], unsigned n_entries, uint64_t *seqnum, unsigned *n_written) {
+        CompressedData *compressed;
+        unsigned i, n_compressed = 0, k = 0;
+        int r = 0;
+
+        assert(f);
+        assert(entries || n_entries == 0);
+
+        /* Appends the entries in order, stopping at the first one
+         * that fails. The SIGBUS check and the inotify notification
+         * are done only once for the whole batch. Large fields are
+         * compressed in parallel up front, but still appended
+         * strictly in order. */
+
+        compressed = journal_file_compress_entries(f, entries, n_entries, &n_compressed);
+
+        for (i = 0; i < n_entries; i++) {
+                uint64_t reserved, *p = seqnum;
+
+                /* If the caller reserved a sequence number for this
+                 * entry already, use it, unless the file is already
+                 * past it. Then bump the external counter as usual. */
+                if (entries[i].seqnum > 0) {
+                        reserved = entries[i].seqnum - 1;
+                        p = &reserved;
+                }
+
+                r = journal_file_append_entry_no_post_change(f, &entries[i].ts, entries[i].iovec, entries[i].n_iovec,
+                                                             compressed ? compressed + k : NULL,
+                                                             p, NULL, NULL);
+                if (r < 0)
+                        break;
+
+                if (p != seqnum && seqnum && *seqnum < reserved)
+                        *seqnum = reserved;
+
+                k += entries[i].n_iovec;
+        }
+
+        compressed_data_free(compressed, n_compressed);
+
+        if (mmap_cache_got_sigbus(f->mmap, f->fd)) {
+                /* We cannot tell which of the entries were affected */
+                r = -EIO;
+                i = 0;
+        }
+
+        if (n_written)
+                *n_written = i;
+
+        journal_file_post_change(f);
+
+        return r < 0 ? r : 0;
+}
+
+typedef struct ChainCacheArray {
+        uint64_t offset; /* the array */
+        uint64_t begin; /* the first item in the array */
+        uint64_t total; /* the total number of items in all arrays before this one in the chain */
+        uint64_t n; /* the number of items in the array */
+} ChainCacheArray;
+
 typedef struct ChainCacheItem {
         uint64_t first; /* the array at the beginning of the chain */
         uint64_t array; /* the cached array */
         uint64_t begin; /* the first item in the cached array */
         uint64_t total; /* the total number of items in all arrays before this one in the chain */
         uint64_t last_index; /* the last index we looked at, to optimize locality when bisecting */
+
+        /* All arrays of the chain we know about, in chain order */
+        ChainCacheArray *arrays;
+        size_t n_arrays, n_arrays_allocated;
 } ChainCacheItem;
 
+static void chain_cache_free(OrderedHashmap *h) {
+        ChainCacheItem *ci;
+
+        while ((ci = ordered_hashmap_steal_first(h))) {
+                free(ci->arrays);
+                free(ci);
+        }
+
+        ordered_hashmap_free(h);
+}
+
+static ChainCacheItem *chain_cache_item_new(OrderedHashmap *h, uint64_t first) {
+        ChainCacheItem *ci;
+
+        if (ordered_hashmap_size(h) >= CHAIN_CACHE_MAX) {
+                ci = ordered_hashmap_steal_first(h);
+                assert(ci);
+                ci->n_arrays = 0;
+        } else {
+                ci = new0(ChainCacheItem, 1);
+                if (!ci)
+                        return NULL;
+        }
+
+        ci->first = first;
+        ci->array = 0;
+        ci->total = 0;
+        ci->last_index = (uint64_t) -1;
+
+        if (ordered_hashmap_put(h, &ci->first, ci) < 0) {
+                free(ci->arrays);
+                free(ci);
+                return NULL;
+        }
+
+        return ci;
+}
+
 static void chain_cache_put(
                 OrderedHashmap *h,
                 ChainCacheItem *ci,
@@ -1485,21 +2315,9 @@ static void chain_cache_put(
                 if (array == first)
                         return;
 
-                if (ordered_hashmap_size(h) >= CHAIN_CACHE_MAX) {
-                        ci = ordered_hashmap_steal_first(h);
-                        assert(ci);
-                } else {
-                        ci = new(ChainCacheItem, 1);
-                        if (!ci)
-                                return;
-                }
-
-                ci->first = first;
-
-                if (ordered_hashmap_put(h, &ci->first, ci) < 0) {
-                        free(ci);
+                ci = chain_cache_item_new(h, first);
+                if (!ci)
                         return;
-                }
         } else
                 assert(ci->first == first);
 
@@ -1509,6 +2327,100 @@ static void chain_cache_put(
         ci->last_index = last_index;
 }
 
+static int chain_cache_index(JournalFile *f, ChainCacheItem *ci, uint64_t n) {
+        uint64_t a, total;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(ci);
+
+        /* Entry arrays are never modified once they are full, and
+         * new ones are only added at the end of the chain. Hence,
+         * the arrays we learnt about stay valid, and we only need to
+         * look at the tail of the chain if it grew. */
+
+        if (ci->n_arrays > 0) {
+                ChainCacheArray *l = ci->arrays + ci->n_arrays - 1;
+
+                if (l->total + l->n >= n)
+                        return 0;
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, l->offset, &o);
+                if (r < 0)
+                        return r;
+
+                /* The last array might have been filled up further */
+                l->n = journal_file_entry_array_n_items(f, o);
+                total = l->total + l->n;
+                a = le64toh(o->entry_array.next_entry_array_offset);
+        } else {
+                a = ci->first;
+                total = 0;
+        }
+
+        /* Only learn about as many arrays as needed to cover the
+         * first n items, and don't follow a looping chain forever */
+        while (a > 0 && total < n) {
+                ChainCacheArray *c;
+                uint64_t k, p;
+
+                if (ci->n_arrays >= CHAIN_CACHE_ARRAYS_MAX)
+                        return -EBADMSG;
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+                if (r < 0)
+                        return r;
+
+                k = journal_file_entry_array_n_items(f, o);
+                if (k <= 0)
+                        return -EBADMSG;
+
+                p = journal_file_entry_array_item(f, o, 0);
+                if (p <= 0)
+                        return -EBADMSG;
+
+                if (!GREEDY_REALLOC(ci->arrays, ci->n_arrays_allocated, ci->n_arrays + 1))
+                        return -ENOMEM;
+
+                c = ci->arrays + ci->n_arrays++;
+                c->offset = a;
+                c->begin = p;
+                c->total = total;
+                c->n = k;
+
+                total += k;
+                a = le64toh(o->entry_array.next_entry_array_offset);
+        }
+
+        return 0;
+}
+
+static ChainCacheArray *chain_cache_find_index(ChainCacheItem *ci, uint64_t i) {
+        size_t left, right;
+
+        assert(ci);
+
+        /* Finds the last known array that begins at or before the
+         * specified index of the chain */
+
+        if (ci->n_arrays <= 0)
+                return NULL;
+
+        left = 0;
+        right = ci->n_arrays;
+        while (right - left > 1) {
+                size_t m = (left + right) / 2;
+
+                if (ci->arrays[m].total <= i)
+                        left = m;
+                else
+                        right = m;
+        }
+
+        return ci->arrays + left;
+}
+
 static int generic_array_get(
                 JournalFile *f,
                 uint64_t first,
@@ -1526,7 +2438,14 @@ static int generic_array_get(
 
         /* Try the chain cache first */
         ci = ordered_hashmap_get(f->chain_cache, &first);
-        if (ci && i > ci->total) {
+        if (ci && ci->n_arrays > 0) {
+                ChainCacheArray *c;
+
+                c = chain_cache_find_index(ci, i);
+                a = c->offset;
+                i -= c->total;
+                t = c->total;
+        } else if (ci && i > ci->total) {
                 a = ci->array;
                 i -= ci->total;
                 t = ci->total;
@@ -1539,9 +2458,9 @@ static int generic_array_get(
                 if (r < 0)
                         return r;
 
-                k = journal_file_entry_array_n_items(o);
+                k = journal_file_entry_array_n_items(f, o);
                 if (i < k) {
-                        p = le64toh(o->entry_array.items[i]);
+                        p = journal_file_entry_array_item(f, o, i);
                         goto found;
                 }
 
@@ -1554,7 +2473,7 @@ static int generic_array_get(
 
 found:
         /* Let's cache this item for the next invocation */
-        chain_cache_put(f->chain_cache, ci, first, a, le64toh(o->entry_array.items[0]), t, i);
+        chain_cache_put(f->chain_cache, ci, first, a, journal_file_entry_array_item(f, o, 0), t, i);
 
         r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
         if (r < 0)
@@ -1629,7 +2548,65 @@ static int generic_array_bisect(
         a = first;
 
         ci = ordered_hashmap_get(f->chain_cache, &first);
-        if (ci && n > ci->total) {
+        if (!ci && first > 0) {
+                /* Chains of a single array are bisected directly,
+                 * there's nothing to gain from an index for them */
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, first, &o);
+                if (r < 0)
+                        return r;
+
+                if (journal_file_entry_array_n_items(f, o) < n &&
+                    le64toh(o->entry_array.next_entry_array_offset) > 0) {
+                        ci = chain_cache_item_new(f->chain_cache, first);
+                        if (!ci)
+                                return -ENOMEM;
+                }
+        }
+
+        if (ci) {
+                r = chain_cache_index(f, ci, n);
+                if (r < 0)
+                        return r;
+        }
+
+        if (ci && ci->n_arrays > 1) {
+                size_t left = 1, right = ci->n_arrays;
+
+                /* Bisect the arrays of the chain we know first, by
+                 * looking at the first item of each. Then continue
+                 * with the last array that begins left of what we
+                 * are looking for, i.e. the one containing it. */
+
+                while (left < right) {
+                        size_t m = (left + right) / 2;
+
+                        if (ci->arrays[m].total >= n) {
+                                right = m;
+                                continue;
+                        }
+
+                        r = test_object(f, ci->arrays[m].begin, needle);
+                        if (r < 0)
+                                return r;
+
+                        if (r == TEST_LEFT)
+                                left = m + 1;
+                        else
+                                right = m;
+                }
+
+                if (left > 1) {
+                        ChainCacheArray *c = ci->arrays + left - 1;
+
+                        a = c->offset;
+                        n -= c->total;
+                        t = c->total;
+
+                        if (ci->array == a)
+                                last_index = ci->last_index;
+                }
+
+        } else if (ci && ci->array > 0 && n > ci->total) {
                 /* Ah, we have iterated this bisection array chain
                  * previously! Let's see if we can skip ahead in the
                  * chain, as far as the last time. But we can't jump
@@ -1660,13 +2637,13 @@ static int generic_array_bisect(
                 if (r < 0)
                         return r;
 
-                k = journal_file_entry_array_n_items(array);
+                k = journal_file_entry_array_n_items(f, array);
                 right = MIN(k, n);
                 if (right <= 0)
                         return 0;
 
                 i = right - 1;
-                lp = p = le64toh(array->entry_array.items[i]);
+                lp = p = journal_file_entry_array_item(f, array, i);
                 if (p <= 0)
                         return -EBADMSG;
 
@@ -1694,7 +2671,7 @@ static int generic_array_bisect(
                                 if (last_index > 0) {
                                         uint64_t x = last_index - 1;
 
-                                        p = le64toh(array->entry_array.items[x]);
+                                        p = journal_file_entry_array_item(f, array, x);
                                         if (p <= 0)
                                                 return -EBADMSG;
 
@@ -1714,7 +2691,7 @@ static int generic_array_bisect(
                                 if (last_index < right) {
                                         uint64_t y = last_index + 1;
 
-                                        p = le64toh(array->entry_array.items[y]);
+                                        p = journal_file_entry_array_item(f, array, y);
                                         if (p <= 0)
                                                 return -EBADMSG;
 
@@ -1744,7 +2721,7 @@ static int generic_array_bisect(
                                 assert(left < right);
                                 i = (left + right) / 2;
 
-                                p = le64toh(array->entry_array.items[i]);
+                                p = journal_file_entry_array_item(f, array, i);
                                 if (p <= 0)
                                         return -EBADMSG;
 
@@ -1787,14 +2764,14 @@ found:
                 return 0;
 
         /* Let's cache this item for the next invocation */
-        chain_cache_put(f->chain_cache, ci, first, a, le64toh(array->entry_array.items[0]), t, subtract_one ? (i > 0 ? i-1 : (uint64_t) -1) : i);
+        chain_cache_put(f->chain_cache, ci, first, a, journal_file_entry_array_item(f, array, 0), t, subtract_one ? (i > 0 ? i-1 : (uint64_t) -1) : i);
 
         if (subtract_one && i == 0)
                 p = last_p;
         else if (subtract_one)
-                p = le64toh(array->entry_array.items[i-1]);
+                p = journal_file_entry_array_item(f, array, i-1);
         else
-                p = le64toh(array->entry_array.items[i]);
+                p = journal_file_entry_array_item(f, array, i);
 
         r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
         if (r < 0)
@@ -2468,6 +3445,22 @@ static const char* format_timestamp_safe(char *buf, size_t l, usec_t t) {
         return " --- ";
 }
 
+static double hash_table_average_chain_depth(const HashItem *t, uint64_t m, uint64_t n) {
+        uint64_t i, used = 0;
+
+        if (!t)
+                return 0.0;
+
+        for (i = 0; i < m; i++)
+                if (t[i].head_hash_offset != 0)
+                        used++;
+
+        if (used <= 0)
+                return 0.0;
+
+        return (double) n / (double) used;
+}
+
 void journal_file_print_header(JournalFile *f) {
         char a[33], b[33], c[33], d[33];
         char x[FORMAT_TIMESTAMP_MAX], y[FORMAT_TIMESTAMP_MAX], z[FORMAT_TIMESTAMP_MAX];
@@ -2483,7 +3476,7 @@ void journal_file_print_header(JournalFile *f) {
                "Sequential Number ID: %s\n"
                "State: %s\n"
                "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s%s\n"
+               "Incompatible Flags:%s%s%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data Hash Table Size: %"PRIu64"\n"
@@ -2508,6 +3501,8 @@ void journal_file_print_header(JournalFile *f) {
                (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_ANY) ? " ???" : "",
                JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
                JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               JOURNAL_HEADER_COMPRESSED_ZSTD(f->header) ? " COMPRESSED-ZSTD" : "",
+               JOURNAL_HEADER_COMPACT(f->header) ? " COMPACT" : "",
                (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
                le64toh(f->header->arena_size),
@@ -2528,12 +3523,34 @@ void journal_file_print_header(JournalFile *f) {
                        le64toh(f->header->n_data),
                        100.0 * (double) le64toh(f->header->n_data) / ((double) (le64toh(f->header->data_hash_table_size) / sizeof(HashItem))));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_data) &&
+            journal_file_map_data_hash_table(f) >= 0)
+                printf("Data Hash Chain Depth Average: %.1f\n",
+                       hash_table_average_chain_depth(f->data_hash_table,
+                                                      le64toh(f->header->data_hash_table_size) / sizeof(HashItem),
+                                                      le64toh(f->header->n_data)));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth))
+                printf("Data Hash Chain Depth Maximum: %"PRIu64"\n",
+                       le64toh(f->header->data_hash_chain_depth));
+
         if (JOURNAL_HEADER_CONTAINS(f->header, n_fields))
                 printf("Field Objects: %"PRIu64"\n"
                        "Field Hash Table Fill: %.1f%%\n",
                        le64toh(f->header->n_fields),
                        100.0 * (double) le64toh(f->header->n_fields) / ((double) (le64toh(f->header->field_hash_table_size) / sizeof(HashItem))));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_fields) &&
+            journal_file_map_field_hash_table(f) >= 0)
+                printf("Field Hash Chain Depth Average: %.1f\n",
+                       hash_table_average_chain_depth(f->field_hash_table,
+                                                      le64toh(f->header->field_hash_table_size) / sizeof(HashItem),
+                                                      le64toh(f->header->n_fields)));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                printf("Field Hash Chain Depth Maximum: %"PRIu64"\n",
+                       le64toh(f->header->field_hash_chain_depth));
+
         if (JOURNAL_HEADER_CONTAINS(f->header, n_tags))
                 printf("Tag Objects: %"PRIu64"\n",
                        le64toh(f->header->n_tags));
@@ -2580,6 +3597,37 @@ static int journal_file_warn_btrfs(JournalFile *f) {
         return 1;
 }
 
+int journal_file_read_header(const char *fname, Header *ret) {
+        _cleanup_close_ int fd = -1;
+        ssize_t n;
+
+        assert(fname);
+        assert(ret);
+
+        /* Reads just the header of a journal file, without setting
+         * up a JournalFile and mapping anything, so that callers can
+         * cheaply decide whether the file is of interest at all. No
+         * verification beyond the signature is done. */
+
+        fd = open(fname, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        n = pread(fd, ret, sizeof(Header), 0);
+        if (n < 0)
+                return -errno;
+        if ((size_t) n < HEADER_SIZE_MIN)
+                return -EIO;
+
+        if (memcmp(ret->signature, HEADER_SIGNATURE, 8))
+                return -EBADMSG;
+
+        if ((size_t) n < sizeof(Header))
+                memzero((uint8_t*) ret + n, sizeof(Header) - n);
+
+        return 0;
+}
+
 int journal_file_open(
                 const char *fname,
                 int flags,
@@ -2612,12 +3660,15 @@ int journal_file_open(
                 return -ENOMEM;
 
         f->fd = -1;
+        f->offline_notify_fd = -1;
         f->mode = mode;
 
         f->flags = flags;
         f->prot = prot_from_flags(flags);
         f->writable = (flags & O_ACCMODE) != O_RDONLY;
-#if defined(HAVE_LZ4)
+#if defined(HAVE_ZSTD)
+        f->compress_zstd = compress;
+#elif defined(HAVE_LZ4)
         f->compress_lz4 = compress;
 #elif defined(HAVE_XZ)
         f->compress_xz = compress;
@@ -2684,6 +3735,19 @@ int journal_file_open(
                 }
 #endif
 
+                /* Older readers refuse files with compact entry
+                 * items, hence only create them on request, or when
+                 * rotating a file that already uses them. */
+                if (template)
+                        f->compact = template->compact;
+                else {
+                        const char *e;
+
+                        e = getenv("SYSTEMD_JOURNAL_COMPACT");
+                        if (e)
+                                f->compact = parse_boolean(e) > 0;
+                }
+
                 r = journal_file_init_header(f, template);
                 if (r < 0)
                         goto fail;
@@ -2739,11 +3803,11 @@ int journal_file_open(
 #endif
 
         if (newly_created) {
-                r = journal_file_setup_field_hash_table(f);
+                r = journal_file_setup_field_hash_table(f, template);
                 if (r < 0)
                         goto fail;
 
-                r = journal_file_setup_data_hash_table(f);
+                r = journal_file_setup_data_hash_table(f, template);
                 if (r < 0)
                         goto fail;
 
@@ -2804,6 +3868,7 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         if (r < 0 && errno != ENOENT)
                 return -errno;
 
+        journal_file_set_offline_join(old_file);
         old_file->header->state = STATE_ARCHIVED;
 
         /* Currently, btrfs is not very good with out write patterns
@@ -2812,6 +3877,12 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         old_file->defrag_on_close = true;
 
         r = journal_file_open(old_file->path, old_file->flags, old_file->mode, compress, seal, NULL, old_file->mmap, old_file, &new_file);
+        if (new_file) {
+                new_file->n_syncs = old_file->n_syncs;
+                new_file->sync_usec = old_file->sync_usec;
+                new_file->sync_usec_max = old_file->sync_usec_max;
+        }
+
         journal_file_close(old_file);
 
         *f = new_file;
@@ -2880,7 +3951,94 @@ int journal_file_open_reliably(
                                  metrics, mmap_cache, template, ret);
 }
 
+typedef struct CopyMapItem {
+        uint64_t from; /* the data object in the source file */
+        uint64_t to; /* its copy in the destination file */
+        uint64_t hash;
+} CopyMapItem;
+
+struct JournalCopyMap {
+        sd_id128_t from_id, to_id;
+        Hashmap *items;
+};
+
+JournalCopyMap *journal_copy_map_new(void) {
+        JournalCopyMap *m;
+
+        m = new0(JournalCopyMap, 1);
+        if (!m)
+                return NULL;
+
+        m->items = hashmap_new(&uint64_hash_ops);
+        if (!m->items)
+                return mfree(m);
+
+        return m;
+}
+
+static void journal_copy_map_clear(JournalCopyMap *m) {
+        CopyMapItem *i;
+
+        assert(m);
+
+        while ((i = hashmap_steal_first(m->items)))
+                free(i);
+}
+
+JournalCopyMap *journal_copy_map_free(JournalCopyMap *m) {
+        if (!m)
+                return NULL;
+
+        journal_copy_map_clear(m);
+        hashmap_free(m->items);
+        free(m);
+
+        return NULL;
+}
+
+static void journal_copy_map_bind(JournalCopyMap *m, JournalFile *from, JournalFile *to) {
+        assert(m);
+        assert(from);
+        assert(to);
+
+        /* Offsets are only meaningful for the pair of files they
+         * were recorded for, forget them if one of them changed,
+         * e.g. because the destination was rotated */
+
+        if (sd_id128_equal(m->from_id, from->header->file_id) &&
+            sd_id128_equal(m->to_id, to->header->file_id))
+                return;
+
+        journal_copy_map_clear(m);
+        m->from_id = from->header->file_id;
+        m->to_id = to->header->file_id;
+}
+
+static void journal_copy_map_put(JournalCopyMap *m, uint64_t from, uint64_t to, uint64_t hash) {
+        CopyMapItem *i;
+
+        assert(m);
+
+        if (hashmap_size(m->items) >= COPY_MAP_MAX)
+                return;
+
+        i = new(CopyMapItem, 1);
+        if (!i)
+                return;
+
+        i->from = from;
+        i->to = to;
+        i->hash = hash;
+
+        if (hashmap_put(m->items, &i->from, i) < 0)
+                free(i);
+}
+
 int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+        return journal_file_copy_entry_mapped(from, to, o, p, NULL, seqnum, ret, offset);
+}
+
+int journal_file_copy_entry_mapped(JournalFile *from, JournalFile *to, Object *o, uint64_t p, JournalCopyMap *m, uint64_t *seqnum, Object **ret, uint64_t *offset) {
         uint64_t i, n;
         uint64_t q, xor_hash = 0;
         int r;
@@ -2895,10 +4053,13 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         if (!to->writable)
                 return -EPERM;
 
+        if (m)
+                journal_copy_map_bind(m, from, to);
+
         ts.monotonic = le64toh(o->entry.monotonic);
         ts.realtime = le64toh(o->entry.realtime);
 
-        n = journal_file_entry_n_items(o);
+        n = journal_file_entry_n_items(from, o);
         /* alloca() can't take 0, hence let's allocate at least one */
         items = alloca(sizeof(EntryItem) * MAX(1u, n));
 
@@ -2909,14 +4070,28 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 void *data;
                 Object *u;
 
-                q = le64toh(o->entry.items[i].object_offset);
-                le_hash = o->entry.items[i].hash;
+                q = journal_file_entry_item_object_offset(from, o, i);
+                le_hash = from->compact ? 0 : o->entry.items[i].hash;
+
+                /* Copied this one before? Then there's no need to
+                 * look at it again, neither here nor there */
+                if (m) {
+                        CopyMapItem *c;
+
+                        c = hashmap_get(m->items, &q);
+                        if (c) {
+                                xor_hash ^= c->hash;
+                                items[i].object_offset = htole64(c->to);
+                                items[i].hash = htole64(c->hash);
+                                continue;
+                        }
+                }
 
                 r = journal_file_move_to_object(from, OBJECT_DATA, q, &o);
                 if (r < 0)
                         return r;
 
-                if (le_hash != o->data.hash)
+                if (!from->compact && le_hash != o->data.hash)
                         return -EBADMSG;
 
                 l = le64toh(o->object.size) - offsetof(Object, data.payload);
@@ -2927,7 +4102,7 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                         return -E2BIG;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                         size_t rsize = 0;
 
                         r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
@@ -2943,7 +4118,7 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 } else
                         data = o->data.payload;
 
-                r = journal_file_append_data(to, data, l, &u, &h);
+                r = journal_file_append_data(to, data, l, NULL, &u, &h);
                 if (r < 0)
                         return r;
 
@@ -2951,6 +4126,9 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 items[i].object_offset = htole64(h);
                 items[i].hash = u->data.hash;
 
+                if (m)
+                        journal_copy_map_put(m, q, h, le64toh(u->data.hash));
+
                 r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
                 if (r < 0)
                         return r;
@@ -22,6 +22,7 @@
 ***/
 
 #include <inttypes.h>
+#include <pthread.h>
 
 #ifdef HAVE_GCRYPT
 #include <gcrypt.h>
@@ -62,6 +63,26 @@ typedef enum LocationType {
         LOCATION_SEEK
 } LocationType;
 
+/* The state of the background sync of a file, see
+ * journal_file_set_offline() */
+enum {
+        OFFLINE_JOINED,
+        OFFLINE_SYNCING,
+        OFFLINE_OFFLINING,
+        OFFLINE_CANCEL,
+        OFFLINE_AGAIN,
+        OFFLINE_DONE,
+};
+
+/* The state of the background allocation of a file, see
+ * journal_file_allocate_ahead() */
+enum {
+        ALLOCATE_AHEAD_RUNNING,
+        ALLOCATE_AHEAD_DONE,
+        ALLOCATE_AHEAD_FAILED,
+        ALLOCATE_AHEAD_UNSUPPORTED,
+};
+
 typedef struct JournalFile {
         int fd;
 
@@ -72,6 +93,8 @@ typedef struct JournalFile {
         bool writable:1;
         bool compress_xz:1;
         bool compress_lz4:1;
+        bool compress_zstd:1;
+        bool compact:1;
         bool seal:1;
         bool defrag_on_close:1;
 
@@ -80,6 +103,7 @@ typedef struct JournalFile {
         direction_t last_direction;
         LocationType location_type;
         uint64_t last_n_entries;
+        uint64_t process_n_entries; /* as of the last sd_journal_process() */
 
         char *path;
         struct stat last_stat;
@@ -101,7 +125,38 @@ typedef struct JournalFile {
 
         OrderedHashmap *chain_cache;
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        /* Per-match lookup results, maintained by sd-journal.c */
+        Hashmap *match_cache;
+
+        /* The last array of the global entry array chain, and the
+         * index of its first item, so that appending does not need
+         * to walk the whole chain each time */
+        uint64_t tail_entry_array_offset;
+        uint64_t tail_entry_array_begin;
+
+        /* Syncing and marking the file offline in the background,
+         * see journal_file_set_offline() */
+        pthread_t offline_thread;
+        volatile int offline_state;
+        int offline_notify_fd; /* eventfd bumped when the thread is done, or -1 */
+
+        /* How many fdatasync() calls going offline took, and how
+         * long, carried over on rotation. Updated from the offline
+         * thread, hence only to be accessed atomically. */
+        uint64_t n_syncs;
+        usec_t sync_usec;
+        usec_t sync_usec_max;
+
+        /* The range we reserve in the background for the file to
+         * grow into next */
+        pthread_t allocate_ahead_thread;
+        bool allocate_ahead_running;
+        bool allocate_ahead_unsupported;
+        volatile int allocate_ahead_state;
+        uint64_t allocate_ahead_offset;
+        uint64_t allocate_ahead_size;
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         void *compress_buffer;
         size_t compress_buffer_size;
 #endif
@@ -121,6 +176,10 @@ typedef struct JournalFile {
 
         void *fsprg_seed;
         size_t fsprg_seed_size;
+
+        /* The secret key derived from the seed, when seeking */
+        void *fsprg_msk;
+        size_t fsprg_msk_size;
 #endif
 } JournalFile;
 
@@ -135,9 +194,13 @@ int journal_file_open(
                 JournalFile *template,
                 JournalFile **ret);
 
-int journal_file_set_offline(JournalFile *f);
+int journal_file_set_offline(JournalFile *f, bool wait);
+void journal_file_set_offline_join(JournalFile *f);
+bool journal_file_set_offline_done(JournalFile *f);
 void journal_file_close(JournalFile *j);
 
+int journal_file_read_header(const char *fname, Header *ret);
+
 int journal_file_open_reliably(
                 const char *fname,
                 int flags,
@@ -183,15 +246,54 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
 
+#define JOURNAL_HEADER_COMPRESSED_ZSTD(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD))
+
+#define JOURNAL_HEADER_COMPACT(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPACT))
+
+#define JOURNAL_FILE_COMPRESS(f) ((f)->compress_xz || (f)->compress_lz4 || (f)->compress_zstd)
+
 int journal_file_move_to_object(JournalFile *f, ObjectType type, uint64_t offset, Object **ret);
 
-uint64_t journal_file_entry_n_items(Object *o) _pure_;
-uint64_t journal_file_entry_array_n_items(Object *o) _pure_;
+uint64_t journal_file_entry_n_items(JournalFile *f, Object *o) _pure_;
+uint64_t journal_file_entry_array_n_items(JournalFile *f, Object *o) _pure_;
 uint64_t journal_file_hash_table_n_items(Object *o) _pure_;
 
+static inline size_t journal_file_entry_item_size(JournalFile *f) {
+        return f->compact ? sizeof(EntryItemCompact) : sizeof(EntryItem);
+}
+
+static inline size_t journal_file_entry_array_item_size(JournalFile *f) {
+        return f->compact ? sizeof(le32_t) : sizeof(le64_t);
+}
+
+static inline uint64_t journal_file_entry_item_object_offset(JournalFile *f, Object *o, uint64_t i) {
+        if (f->compact)
+                return le32toh(((EntryItemCompact*) o->entry.items)[i]);
+
+        return le64toh(o->entry.items[i].object_offset);
+}
+
+static inline uint64_t journal_file_entry_array_item(JournalFile *f, Object *o, uint64_t i) {
+        if (f->compact)
+                return le32toh(((le32_t*) o->entry_array.items)[i]);
+
+        return le64toh(o->entry_array.items[i]);
+}
+
 int journal_file_append_object(JournalFile *f, ObjectType type, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqno, Object **ret, uint64_t *offset);
 
+typedef struct JournalEntry {
+        dual_timestamp ts;
+        uint64_t seqnum; /* if non-zero, the sequence number reserved for this entry */
+        const struct iovec *iovec;
+        unsigned n_iovec;
+} JournalEntry;
+
+int journal_file_append_entries(JournalFile *f, const JournalEntry entries[], unsigned n_entries, uint64_t *seqno, unsigned *n_written);
+
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
@@ -216,6 +318,15 @@ int journal_file_move_to_entry_by_monotonic_for_data(JournalFile *f, uint64_t da
 
 int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, uint64_t *seqnum, Object **ret, uint64_t *offset);
 
+/* Remembers where the data objects of one file ended up in another,
+ * so that copying many entries looks at each data object only once */
+typedef struct JournalCopyMap JournalCopyMap;
+
+JournalCopyMap *journal_copy_map_new(void);
+JournalCopyMap *journal_copy_map_free(JournalCopyMap *m);
+
+int journal_file_copy_entry_mapped(JournalFile *from, JournalFile *to, Object *o, uint64_t p, JournalCopyMap *m, uint64_t *seqnum, Object **ret, uint64_t *offset);
+
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
 
@@ -31,6 +31,7 @@
 #include "list.h"
 #include "hashmap.h"
 #include "set.h"
+#include "prioq.h"
 #include "journal-file.h"
 #include "sd-journal.h"
 
@@ -90,6 +91,14 @@ struct sd_journal {
         OrderedHashmap *files;
         MMapCache *mmap;
 
+        /* Files that have a candidate entry in files_direction,
+         * ordered by it, and files that have reached their end but
+         * might still grow. Only valid if files_queued is set. */
+        Prioq *files_queue;
+        Set *files_exhausted;
+        direction_t files_direction;
+        bool files_queued;
+
         Location current_location;
 
         JournalFile *current_file;
@@ -106,6 +115,7 @@ struct sd_journal {
         char *unique_field;
         JournalFile *unique_file;
         uint64_t unique_offset;
+        Set *unique_values; /* UniqueValue objects returned so far */
 
         int flags;
 
@@ -118,6 +128,12 @@ struct sd_journal {
 
         size_t data_threshold;
 
+        /* If set, files that cannot contain entries from this time
+         * range are not opened at all. The time range of skipped
+         * files is still reported by the cutoff functions. */
+        usec_t since, until;
+        usec_t skipped_head_realtime, skipped_tail_realtime;
+
         Hashmap *directories_by_path;
         Hashmap *directories_by_wd;
 
@@ -125,6 +141,7 @@ struct sd_journal {
 };
 
 char *journal_make_match_string(sd_journal *j);
+int journal_open_bounded(sd_journal **ret, const char *directory, int flags, usec_t since, usec_t until);
 void journal_print_header(sd_journal *j);
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(sd_journal*, sd_journal_close);
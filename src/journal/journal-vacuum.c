@@ -20,6 +20,7 @@
 ***/
 
 #include <fcntl.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -28,6 +29,9 @@
 #include "journal-vacuum.h"
 #include "sd-id128.h"
 #include "util.h"
+#include "hashmap.h"
+#include "set.h"
+#include "prioq.h"
 
 struct vacuum_info {
         uint64_t usage;
@@ -38,6 +42,30 @@ struct vacuum_info {
         uint64_t seqnum;
 
         bool have_seqnum;
+        bool empty;
+
+        unsigned queue_idx;
+};
+
+struct VacuumDirectory {
+        char *path;
+        int fd;
+        int inotify_fd;
+        int wd;
+        bool watch;
+
+        /* Archived and corrupted files, i.e. the ones we may
+         * delete, by file name and oldest first */
+        Hashmap *archived;
+        Prioq *queue;
+        uint64_t archived_usage, empty_usage;
+
+        /* All other journal files in the directory. We only count
+         * their usage, and since they are in use, they're stat()ed
+         * each time. */
+        Set *active;
+
+        bool scanned;
 };
 
 static int vacuum_compare(const void *_a, const void *_b) {
@@ -66,6 +94,16 @@ static int vacuum_compare(const void *_a, const void *_b) {
                 return strcmp(a->filename, b->filename);
 }
 
+static int vacuum_queue_compare(const void *_a, const void *_b) {
+        const struct vacuum_info *a = _a, *b = _b;
+
+        /* Empty files go first, they are always deleted */
+        if (a->empty != b->empty)
+                return a->empty ? -1 : 1;
+
+        return vacuum_compare(a, b);
+}
+
 static void patch_realtime(
                 const char *dir,
                 const char *fn,
@@ -141,189 +179,541 @@ static int journal_file_empty(int dir_fd, const char *name) {
         return le64toh(n_entries) <= 0;
 }
 
-int journal_directory_vacuum(
-                const char *directory,
-                uint64_t max_use,
-                usec_t max_retention_usec,
-                usec_t *oldest_usec,
-                bool verbose) {
+static struct vacuum_info *vacuum_info_free(struct vacuum_info *v) {
+        if (!v)
+                return NULL;
 
-        _cleanup_closedir_ DIR *d = NULL;
-        int r = 0;
-        struct vacuum_info *list = NULL;
-        unsigned n_list = 0, i;
-        size_t n_allocated = 0;
-        uint64_t sum = 0, freed = 0;
-        usec_t retention_limit = 0;
-        char sbytes[FORMAT_BYTES_MAX];
+        free(v->filename);
+        free(v);
 
-        assert(directory);
+        return NULL;
+}
 
-        if (max_use <= 0 && max_retention_usec <= 0)
+static int parse_filename(
+                const char *fn,
+                sd_id128_t *seqnum_id,
+                unsigned long long *seqnum,
+                unsigned long long *realtime,
+                bool *have_seqnum) {
+
+        _cleanup_free_ char *n = NULL;
+        size_t q;
+
+        /* Returns 1 for archived or corrupted files, i.e. the ones we
+         * may vacuum, 0 for other journal files, and -EINVAL for
+         * files which aren't journal files at all. */
+
+        q = strlen(fn);
+
+        if (endswith(fn, ".journal")) {
+
+                /* Vacuum archived files */
+
+                if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
+                        return 0;
+
+                if (fn[q-8-16-1] != '-' ||
+                    fn[q-8-16-1-16-1] != '-' ||
+                    fn[q-8-16-1-16-1-32-1] != '@')
+                        return 0;
+
+                n = strdup(fn);
+                if (!n)
+                        return -ENOMEM;
+
+                n[q-8-16-1-16-1] = 0;
+                if (sd_id128_from_string(n + q-8-16-1-16-1-32, seqnum_id) < 0)
+                        return 0;
+
+                if (sscanf(fn + q-8-16-1-16, "%16llx-%16llx.journal", seqnum, realtime) != 2)
+                        return 0;
+
+                *have_seqnum = true;
+
+        } else if (endswith(fn, ".journal~")) {
+                unsigned long long tmp;
+
+                /* Vacuum corrupted files */
+
+                if (q < 1 + 16 + 1 + 16 + 8 + 1)
+                        return 0;
+
+                if (fn[q-1-8-16-1] != '-' ||
+                    fn[q-1-8-16-1-16-1] != '@')
+                        return 0;
+
+                if (sscanf(fn + q-1-8-16-1-16, "%16llx-%16llx.journal~", realtime, &tmp) != 2)
+                        return 0;
+
+                *seqnum = 0;
+                *have_seqnum = false;
+        } else
+                return -EINVAL;
+
+        return 1;
+}
+
+static void vacuum_directory_remove(VacuumDirectory *d, const char *fn) {
+        struct vacuum_info *v;
+
+        assert(d);
+        assert(fn);
+
+        free(set_remove(d->active, fn));
+
+        v = hashmap_remove(d->archived, fn);
+        if (!v)
+                return;
+
+        prioq_remove(d->queue, v, &v->queue_idx);
+
+        if (v->empty)
+                d->empty_usage -= v->usage;
+        else
+                d->archived_usage -= v->usage;
+
+        vacuum_info_free(v);
+}
+
+static int vacuum_directory_add(VacuumDirectory *d, const char *fn) {
+        struct vacuum_info *v = NULL;
+        unsigned long long seqnum = 0, realtime;
+        sd_id128_t seqnum_id = {};
+        bool have_seqnum;
+        struct stat st;
+        int r;
+
+        assert(d);
+        assert(fn);
+
+        /* Forget what we knew about the file, it might have been
+         * replaced */
+        vacuum_directory_remove(d, fn);
+
+        r = parse_filename(fn, &seqnum_id, &seqnum, &realtime, &have_seqnum);
+        if (r == -EINVAL)
                 return 0;
+        if (r < 0)
+                return r;
 
-        if (max_retention_usec > 0) {
-                retention_limit = now(CLOCK_REALTIME);
-                if (retention_limit > max_retention_usec)
-                        retention_limit -= max_retention_usec;
-                else
-                        max_retention_usec = retention_limit = 0;
+        if (fstatat(d->fd, fn, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return 0;
+
+        if (!S_ISREG(st.st_mode))
+                return 0;
+
+        if (r == 0) {
+                /* We do not vacuum active files or unknown files! */
+                char *n;
+
+                n = strdup(fn);
+                if (!n)
+                        return -ENOMEM;
+
+                r = set_consume(d->active, n);
+                return r < 0 ? r : 0;
         }
 
-        d = opendir(directory);
-        if (!d)
+        v = new0(struct vacuum_info, 1);
+        if (!v)
+                return -ENOMEM;
+
+        v->filename = strdup(fn);
+        if (!v->filename) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        /* Always vacuum empty non-online files. */
+        v->empty = journal_file_empty(d->fd, fn) > 0;
+
+        if (!v->empty)
+                patch_realtime(d->path, fn, &st, &realtime);
+
+        v->usage = 512UL * (uint64_t) st.st_blocks;
+        v->seqnum = seqnum;
+        v->realtime = realtime;
+        v->seqnum_id = seqnum_id;
+        v->have_seqnum = have_seqnum;
+        v->queue_idx = PRIOQ_IDX_NULL;
+
+        r = hashmap_put(d->archived, v->filename, v);
+        if (r < 0)
+                goto fail;
+
+        r = prioq_put(d->queue, v, &v->queue_idx);
+        if (r < 0) {
+                hashmap_remove(d->archived, v->filename);
+                goto fail;
+        }
+
+        if (v->empty)
+                d->empty_usage += v->usage;
+        else
+                d->archived_usage += v->usage;
+
+        return 1;
+
+fail:
+        vacuum_info_free(v);
+        return r;
+}
+
+static void vacuum_directory_flush(VacuumDirectory *d) {
+        struct vacuum_info *v;
+
+        assert(d);
+
+        while ((v = prioq_pop(d->queue)))
+                vacuum_info_free(v);
+
+        hashmap_clear(d->archived);
+        set_clear_free(d->active);
+        d->archived_usage = d->empty_usage = 0;
+        d->scanned = false;
+}
+
+static int vacuum_directory_scan(VacuumDirectory *d) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        int fd, r;
+
+        assert(d);
+
+        vacuum_directory_flush(d);
+
+        /* Make sure we can keep using the directory fd after
+         * readdir() is done with its copy */
+        fd = fcntl(d->fd, F_DUPFD_CLOEXEC, 3);
+        if (fd < 0)
                 return -errno;
 
+        dir = fdopendir(fd);
+        if (!dir) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        /* The duplicate shares the file offset with the original */
+        rewinddir(dir);
+
         for (;;) {
                 struct dirent *de;
-                size_t q;
-                struct stat st;
-                char *p;
-                unsigned long long seqnum = 0, realtime;
-                sd_id128_t seqnum_id;
-                bool have_seqnum;
 
                 errno = 0;
-                de = readdir(d);
-                if (!de && errno != 0) {
-                        r = -errno;
-                        goto finish;
-                }
+                de = readdir(dir);
+                if (!de && errno != 0)
+                        return -errno;
 
                 if (!de)
                         break;
 
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
-                        continue;
+                r = vacuum_directory_add(d, de->d_name);
+                if (r < 0)
+                        return r;
+        }
 
-                if (!S_ISREG(st.st_mode))
-                        continue;
+        d->scanned = true;
+        return 0;
+}
 
-                q = strlen(de->d_name);
+static int vacuum_directory_open(VacuumDirectory *d) {
+        assert(d);
 
-                if (endswith(de->d_name, ".journal")) {
+        if (d->fd >= 0)
+                return 0;
 
-                        /* Vacuum archived files */
+        d->fd = open(d->path, O_RDONLY|O_CLOEXEC|O_DIRECTORY|O_NOCTTY);
+        if (d->fd < 0)
+                return -errno;
 
-                        if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
-                                continue;
+        if (!d->watch)
+                return 0;
 
-                        if (de->d_name[q-8-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1-32-1] != '@')
-                                continue;
+        if (d->inotify_fd < 0) {
+                d->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+                if (d->inotify_fd < 0)
+                        return -errno;
+        }
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        /* If this fails we just rescan each time */
+        d->wd = inotify_add_watch(d->inotify_fd, d->path,
+                                  IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE|
+                                  IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR);
+        if (d->wd < 0)
+                log_debug_errno(errno, "Failed to watch journal directory %s, ignoring: %m", d->path);
 
-                        de->d_name[q-8-16-1-16-1] = 0;
-                        if (sd_id128_from_string(de->d_name + q-8-16-1-16-1-32, &seqnum_id) < 0) {
-                                free(p);
-                                continue;
-                        }
+        return 0;
+}
 
-                        if (sscanf(de->d_name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2) {
-                                free(p);
-                                continue;
-                        }
+static void vacuum_directory_close(VacuumDirectory *d) {
+        assert(d);
 
-                        have_seqnum = true;
+        if (d->wd >= 0) {
+                (void) inotify_rm_watch(d->inotify_fd, d->wd);
+                d->wd = -1;
+        }
+
+        d->fd = safe_close(d->fd);
+        vacuum_directory_flush(d);
+}
+
+static int vacuum_directory_process_inotify(VacuumDirectory *d) {
+        int r;
 
-                } else if (endswith(de->d_name, ".journal~")) {
-                        unsigned long long tmp;
+        assert(d);
 
-                        /* Vacuum corrupted files */
+        if (d->wd < 0) {
+                d->scanned = false;
+
+                if (d->inotify_fd < 0)
+                        return 0;
+        }
 
-                        if (q < 1 + 16 + 1 + 16 + 8 + 1)
+        for (;;) {
+                union inotify_event_buffer buffer;
+                struct inotify_event *e;
+                ssize_t l;
+
+                l = read(d->inotify_fd, &buffer, sizeof(buffer));
+                if (l < 0) {
+                        if (errno == EAGAIN)
+                                return 0;
+                        if (errno == EINTR)
                                 continue;
 
-                        if (de->d_name[q-1-8-16-1] != '-' ||
-                            de->d_name[q-1-8-16-1-16-1] != '@')
+                        return -errno;
+                }
+
+                FOREACH_INOTIFY_EVENT(e, buffer, l) {
+
+                        if (e->mask & IN_Q_OVERFLOW)
+                                d->scanned = false;
+
+                        else if (d->wd < 0 || e->wd != d->wd)
+                                /* Left over from an earlier watch */
                                 continue;
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+                        else if (e->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED))
+                                /* The directory is gone, open it again
+                                 * when we need it next. */
+                                vacuum_directory_close(d);
 
-                        if (sscanf(de->d_name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2) {
-                                free(p);
+                        else if (!d->scanned || e->len <= 0)
                                 continue;
+
+                        else if (e->mask & (IN_DELETE|IN_MOVED_FROM))
+                                vacuum_directory_remove(d, e->name);
+
+                        else if (e->mask & (IN_CREATE|IN_MOVED_TO|IN_CLOSE_WRITE)) {
+                                r = vacuum_directory_add(d, e->name);
+                                if (r < 0)
+                                        /* Try again from scratch later */
+                                        d->scanned = false;
                         }
+                }
+        }
+}
 
-                        have_seqnum = false;
-                } else
-                        /* We do not vacuum active files or unknown files! */
-                        continue;
+static int vacuum_directory_refresh(VacuumDirectory *d) {
+        int r;
+
+        assert(d);
+
+        /* Brings the inventory up-to-date, which is cheap if nothing
+         * changed since last time, and we are watching the
+         * directory. */
+
+        r = vacuum_directory_process_inotify(d);
+        if (r < 0)
+                return r;
+
+        r = vacuum_directory_open(d);
+        if (r < 0)
+                return r;
+
+        if (d->scanned)
+                return 0;
+
+        return vacuum_directory_scan(d);
+}
+
+int vacuum_directory_new(VacuumDirectory **ret, const char *path, bool watch) {
+        VacuumDirectory *d;
+        int r;
 
-                if (journal_file_empty(dirfd(d), p)) {
-                        /* Always vacuum empty non-online files. */
+        assert(ret);
+        assert(path);
 
-                        uint64_t size = 512UL * (uint64_t) st.st_blocks;
+        d = new0(VacuumDirectory, 1);
+        if (!d)
+                return -ENOMEM;
+
+        d->fd = d->inotify_fd = d->wd = -1;
+        d->watch = watch;
+
+        d->path = strdup(path);
+        if (!d->path) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        d->archived = hashmap_new(&string_hash_ops);
+        d->active = set_new(&string_hash_ops);
+        d->queue = prioq_new(vacuum_queue_compare);
+        if (!d->archived || !d->active || !d->queue) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        r = vacuum_directory_open(d);
+        if (r < 0)
+                goto fail;
+
+        *ret = d;
+        return 0;
+
+fail:
+        vacuum_directory_free(d);
+        return r;
+}
+
+VacuumDirectory* vacuum_directory_free(VacuumDirectory *d) {
+        if (!d)
+                return NULL;
 
-                        if (unlinkat(dirfd(d), p, 0) >= 0) {
-                                log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted empty archived journal %s/%s (%s).", directory, p, format_bytes(sbytes, sizeof(sbytes), size));
-                                freed += size;
-                        } else if (errno != ENOENT)
-                                log_warning_errno(errno, "Failed to delete empty archived journal %s/%s: %m", directory, p);
+        vacuum_directory_flush(d);
 
-                        free(p);
+        hashmap_free(d->archived);
+        set_free(d->active);
+        prioq_free(d->queue);
+
+        safe_close(d->fd);
+        safe_close(d->inotify_fd);
+        free(d->path);
+        free(d);
+
+        return NULL;
+}
+
+int vacuum_directory_get_usage(VacuumDirectory *d, uint64_t *ret) {
+        uint64_t sum;
+        Iterator i;
+        const char *fn;
+        int r;
+
+        assert(d);
+        assert(ret);
+
+        r = vacuum_directory_refresh(d);
+        if (r < 0)
+                return r;
+
+        /* Empty archived files are accounted for too, even though
+         * they will go away with the next vacuuming */
+        sum = d->archived_usage + d->empty_usage;
+
+        SET_FOREACH(fn, d->active, i) {
+                struct stat st;
+
+                if (fstatat(d->fd, fn, &st, AT_SYMLINK_NOFOLLOW) < 0)
                         continue;
-                }
 
-                patch_realtime(directory, p, &st, &realtime);
+                if (!S_ISREG(st.st_mode))
+                        continue;
 
-                if (!GREEDY_REALLOC(list, n_allocated, n_list + 1)) {
-                        free(p);
-                        r = -ENOMEM;
-                        goto finish;
-                }
+                sum += 512UL * (uint64_t) st.st_blocks;
+        }
+
+        *ret = sum;
+        return 0;
+}
 
-                list[n_list].filename = p;
-                list[n_list].usage = 512UL * (uint64_t) st.st_blocks;
-                list[n_list].seqnum = seqnum;
-                list[n_list].realtime = realtime;
-                list[n_list].seqnum_id = seqnum_id;
-                list[n_list].have_seqnum = have_seqnum;
+int vacuum_directory_vacuum(
+                VacuumDirectory *d,
+                uint64_t max_use,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec,
+                bool verbose) {
 
-                sum += list[n_list].usage;
+        struct vacuum_info *v;
+        uint64_t sum, freed = 0;
+        usec_t retention_limit = 0;
+        char sbytes[FORMAT_BYTES_MAX];
+        int r;
+
+        assert(d);
+
+        if (max_use <= 0 && max_retention_usec <= 0)
+                return 0;
 
-                n_list ++;
+        if (max_retention_usec > 0) {
+                retention_limit = now(CLOCK_REALTIME);
+                if (retention_limit > max_retention_usec)
+                        retention_limit -= max_retention_usec;
+                else
+                        max_retention_usec = retention_limit = 0;
         }
 
-        qsort_safe(list, n_list, sizeof(struct vacuum_info), vacuum_compare);
+        r = vacuum_directory_refresh(d);
+        if (r < 0)
+                return r;
+
+        sum = d->archived_usage;
 
-        for (i = 0; i < n_list; i++) {
-                if ((max_retention_usec <= 0 || list[i].realtime >= retention_limit) &&
+        while ((v = prioq_peek(d->queue))) {
+                if (!v->empty &&
+                    (max_retention_usec <= 0 || v->realtime >= retention_limit) &&
                     (max_use <= 0 || sum <= max_use))
                         break;
 
-                if (unlinkat(dirfd(d), list[i].filename, 0) >= 0) {
-                        log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted archived journal %s/%s (%s).", directory, list[i].filename, format_bytes(sbytes, sizeof(sbytes), list[i].usage));
-                        freed += list[i].usage;
-
-                        if (list[i].usage < sum)
-                                sum -= list[i].usage;
-                        else
-                                sum = 0;
+                if (unlinkat(d->fd, v->filename, 0) >= 0) {
+                        log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted %sarchived journal %s/%s (%s).",
+                                 v->empty ? "empty " : "",
+                                 d->path, v->filename, format_bytes(sbytes, sizeof(sbytes), v->usage));
+                        freed += v->usage;
+
+                        if (!v->empty)
+                                sum = LESS_BY(sum, v->usage);
+                } else if (errno != ENOENT) {
+                        log_warning_errno(errno, "Failed to delete %sarchived journal %s/%s: %m",
+                                          v->empty ? "empty " : "",
+                                          d->path, v->filename);
+
+                        /* Look at it again from scratch next time */
+                        d->scanned = false;
+                }
 
-                } else if (errno != ENOENT)
-                        log_warning_errno(errno, "Failed to delete archived journal %s/%s: %m", directory, list[i].filename);
+                /* The inotify event for this will find nothing to
+                 * remove anymore */
+                vacuum_directory_remove(d, v->filename);
         }
 
-        if (oldest_usec && i < n_list && (*oldest_usec == 0 || list[i].realtime < *oldest_usec))
-                *oldest_usec = list[i].realtime;
-
-finish:
-        for (i = 0; i < n_list; i++)
-                free(list[i].filename);
-        free(list);
+        if (oldest_usec && v && (*oldest_usec == 0 || v->realtime < *oldest_usec))
+                *oldest_usec = v->realtime;
 
         log_full(verbose ? LOG_INFO : LOG_DEBUG, "Vacuuming done, freed %s of archived journals on disk.", format_bytes(sbytes, sizeof(sbytes), freed));
 
-        return r;
+        return 0;
+}
+
+int journal_directory_vacuum(
+                const char *directory,
+                uint64_t max_use,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec,
+                bool verbose) {
+
+        _cleanup_vacuum_directory_free_ VacuumDirectory *d = NULL;
+        int r;
+
+        assert(directory);
+
+        if (max_use <= 0 && max_retention_usec <= 0)
+                return 0;
+
+        r = vacuum_directory_new(&d, directory, false);
+        if (r < 0)
+                return r;
+
+        return vacuum_directory_vacuum(d, max_use, max_retention_usec, oldest_usec, verbose);
 }
@@ -21,5 +21,25 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "macro.h"
+#include "time-util.h"
+
+/* An inventory of the journal files in a directory, so that vacuuming
+ * and usage checks don't have to look at every file each time. If
+ * watched, kept up-to-date via inotify, otherwise rescanned on each
+ * use. */
+typedef struct VacuumDirectory VacuumDirectory;
+
+int vacuum_directory_new(VacuumDirectory **ret, const char *path, bool watch);
+VacuumDirectory* vacuum_directory_free(VacuumDirectory *d);
+
+int vacuum_directory_get_usage(VacuumDirectory *d, uint64_t *ret);
+int vacuum_directory_vacuum(VacuumDirectory *d, uint64_t max_use, usec_t max_retention_usec, usec_t *oldest_usec, bool verbose);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(VacuumDirectory*, vacuum_directory_free);
+#define _cleanup_vacuum_directory_free_ _cleanup_(vacuum_directory_freep)
 
 int journal_directory_vacuum(const char *directory, uint64_t max_use, usec_t max_retention_usec, usec_t *oldest_usec, bool vacuum);
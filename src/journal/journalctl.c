@@ -33,6 +33,7 @@
 #include <poll.h>
 #include <sys/stat.h>
 #include <sys/inotify.h>
+#include <sys/wait.h>
 #include <linux/fs.h>
 
 #include "sd-journal.h"
@@ -61,9 +62,13 @@
 #include "bus-error.h"
 #include "terminal-util.h"
 #include "hostname-util.h"
+#include "signal-util.h"
 
 #define DEFAULT_FSS_INTERVAL_USEC (15*USEC_PER_MINUTE)
 
+/* Size of the stdout buffer for machine readable output modes */
+#define OUTPUT_BUFFER_SIZE (256U*1024U)
+
 enum {
         /* Special values for arg_lines */
         ARG_LINES_DEFAULT = -2,
@@ -122,6 +127,7 @@ static enum {
         ACTION_UPDATE_CATALOG,
         ACTION_LIST_BOOTS,
         ACTION_FLUSH,
+        ACTION_SYNC,
         ACTION_VACUUM,
 } arg_action = ACTION_SHOW;
 
@@ -237,6 +243,7 @@ static void help(void) {
                "     --vacuum-size=BYTES   Reduce disk usage below specified size\n"
                "     --vacuum-time=TIME    Remove journal files older than specified date\n"
                "     --flush               Flush all journal data from /run into /var\n"
+               "     --sync                Synchronize unwritten journal messages to disk\n"
                "     --header              Show journal header information\n"
                "     --list-catalog        Show all message IDs in the catalog\n"
                "     --dump-catalog        Show entries in the message catalog\n"
@@ -278,6 +285,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_FORCE,
                 ARG_UTC,
                 ARG_FLUSH,
+                ARG_SYNC,
                 ARG_VACUUM_SIZE,
                 ARG_VACUUM_TIME,
         };
@@ -331,6 +339,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "machine",        required_argument, NULL, 'M'                },
                 { "utc",            no_argument,       NULL, ARG_UTC            },
                 { "flush",          no_argument,       NULL, ARG_FLUSH          },
+                { "sync",           no_argument,       NULL, ARG_SYNC           },
                 { "vacuum-size",    required_argument, NULL, ARG_VACUUM_SIZE    },
                 { "vacuum-time",    required_argument, NULL, ARG_VACUUM_TIME    },
                 {}
@@ -699,6 +708,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = ACTION_FLUSH;
                         break;
 
+                case ARG_SYNC:
+                        arg_action = ACTION_SYNC;
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -861,83 +874,101 @@ static void boot_id_free_all(BootId *l) {
         }
 }
 
-static int discover_next_boot(
-                sd_journal *j,
-                BootId **boot,
-                bool advance_older,
-                bool read_realtime) {
+static int boot_id_compare(const void *a, const void *b) {
+        const BootId *x = *(BootId * const *) a, *y = *(BootId * const *) b;
 
-        int r;
-        char match[9+32+1] = "_BOOT_ID=";
-        _cleanup_free_ BootId *next_boot = NULL;
+        if (x->first < y->first)
+                return -1;
+        if (x->first > y->first)
+                return 1;
 
-        assert(j);
-        assert(boot);
+        return memcmp(&x->id, &y->id, sizeof(x->id));
+}
 
-        /* We expect the journal to be on the last position of a boot
-         * (in relation to the direction we are going), so that the next
-         * invocation of sd_journal_next/previous will be from a different
-         * boot. We then collect any information we desire and then jump
-         * to the last location of the new boot by using a _BOOT_ID match
-         * coming from the other journal direction. */
+static int add_file_boots(JournalFile *f, Hashmap *h) {
+        Object *o;
+        uint64_t p;
+        int r;
 
-        /* Make sure we aren't restricted by any _BOOT_ID matches, so that
-         * we can actually advance to a *different* boot. */
-        sd_journal_flush_matches(j);
+        assert(f);
+        assert(h);
 
-        if (advance_older)
-                r = sd_journal_previous(j);
-        else
-                r = sd_journal_next(j);
-        if (r < 0)
-                return r;
-        else if (r == 0)
-                return 0; /* End of journal, yay. */
-
-        next_boot = new0(BootId, 1);
-        if (!next_boot)
-                return -ENOMEM;
+        /* All _BOOT_ID= data objects of a file are linked from the
+         * field object, and each of them knows its first and last
+         * entry. Hence the boots of a file can be collected without
+         * looking at any other entry. */
 
-        r = sd_journal_get_monotonic_usec(j, NULL, &next_boot->id);
-        if (r < 0)
+        r = journal_file_find_field_object(f, "_BOOT_ID", strlen("_BOOT_ID"), &o, NULL);
+        if (r <= 0)
                 return r;
 
-        if (read_realtime) {
-                r = sd_journal_get_realtime_usec(j, &next_boot->first);
+        p = le64toh(o->field.head_data_offset);
+        while (p > 0) {
+                char hex[33], *k;
+                uint64_t next, first, last;
+                sd_id128_t id;
+                BootId *b;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
                 if (r < 0)
                         return r;
-        }
 
-        /* Now seek to the last occurrence of this boot ID. */
-        sd_id128_to_string(next_boot->id, match + 9);
-        r = sd_journal_add_match(j, match, sizeof(match) - 1);
-        if (r < 0)
-                return r;
+                next = le64toh(o->data.next_field_offset);
 
-        if (advance_older)
-                r = sd_journal_seek_head(j);
-        else
-                r = sd_journal_seek_tail(j);
-        if (r < 0)
-                return r;
+                if ((o->object.flags & OBJECT_COMPRESSION_MASK) ||
+                    le64toh(o->object.size) - offsetof(Object, data.payload) != strlen("_BOOT_ID=") + 32 ||
+                    memcmp(o->data.payload, "_BOOT_ID=", strlen("_BOOT_ID=")) != 0)
+                        goto next;
 
-        if (advance_older)
-                r = sd_journal_next(j);
-        else
-                r = sd_journal_previous(j);
-        if (r < 0)
-                return r;
-        else if (r == 0)
-                return -ENODATA; /* This shouldn't happen. We just came from this very boot ID. */
+                memcpy(hex, o->data.payload + strlen("_BOOT_ID="), 32);
+                hex[32] = 0;
+                if (sd_id128_from_string(hex, &id) < 0)
+                        goto next;
 
-        if (read_realtime) {
-                r = sd_journal_get_realtime_usec(j, &next_boot->last);
+                r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_DOWN, &o, NULL);
                 if (r < 0)
                         return r;
-        }
+                if (r == 0)
+                        goto next;
+                first = le64toh(o->entry.realtime);
 
-        *boot = next_boot;
-        next_boot = NULL;
+                r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_UP, &o, NULL);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        goto next;
+                last = le64toh(o->entry.realtime);
+
+                b = hashmap_get(h, hex);
+                if (b) {
+                        b->first = MIN(b->first, first);
+                        b->last = MAX(b->last, last);
+                } else {
+                        b = new0(BootId, 1);
+                        if (!b)
+                                return -ENOMEM;
+
+                        b->id = id;
+                        b->first = first;
+                        b->last = last;
+
+                        k = strdup(hex);
+                        if (!k) {
+                                free(b);
+                                return -ENOMEM;
+                        }
+
+                        r = hashmap_put(h, k, b);
+                        if (r < 0) {
+                                free(k);
+                                free(b);
+                                return r;
+                        }
+                }
+
+        next:
+                p = next;
+        }
 
         return 0;
 }
@@ -948,98 +979,75 @@ static int get_boots(
                 BootId *query_ref_boot,
                 int ref_boot_offset) {
 
-        bool skip_once;
+        _cleanup_hashmap_free_free_free_ Hashmap *h = NULL;
+        _cleanup_free_ BootId **all = NULL;
+        BootId *head = NULL, *tail = NULL, *b;
+        JournalFile *f;
+        Iterator i;
+        size_t n = 0, k;
+        char *key;
         int r, count = 0;
-        BootId *head = NULL, *tail = NULL;
-        const bool advance_older = query_ref_boot && ref_boot_offset <= 0;
 
         assert(j);
 
-        /* Adjust for the asymmetry that offset 0 is
-         * the last (and current) boot, while 1 is considered the
-         * (chronological) first boot in the journal. */
-        skip_once = query_ref_boot && sd_id128_is_null(query_ref_boot->id) && ref_boot_offset < 0;
-
-        /* Advance to the earliest/latest occurrence of our reference
-         * boot ID (taking our lookup direction into account), so that
-         * discover_next_boot() can do its job.
-         * If no reference is given, the journal head/tail will do,
-         * they're "virtual" boots after all. */
-        if (query_ref_boot && !sd_id128_is_null(query_ref_boot->id)) {
-                char match[9+32+1] = "_BOOT_ID=";
-
-                sd_journal_flush_matches(j);
+        h = hashmap_new(&string_hash_ops);
+        if (!h)
+                return -ENOMEM;
 
-                sd_id128_to_string(query_ref_boot->id, match + 9);
-                r = sd_journal_add_match(j, match, sizeof(match) - 1);
+        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                r = add_file_boots(f, h);
                 if (r < 0)
                         return r;
+        }
 
-                if (advance_older)
-                        r = sd_journal_seek_head(j);
-                else
-                        r = sd_journal_seek_tail(j);
-                if (r < 0)
-                        return r;
+        all = new(BootId*, MAX(hashmap_size(h), 1U));
+        if (!all)
+                return -ENOMEM;
 
-                if (advance_older)
-                        r = sd_journal_next(j);
-                else
-                        r = sd_journal_previous(j);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        goto finish;
-                else if (ref_boot_offset == 0) {
-                        count = 1;
-                        goto finish;
-                }
-        } else {
-                if (advance_older)
-                        r = sd_journal_seek_tail(j);
-                else
-                        r = sd_journal_seek_head(j);
-                if (r < 0)
-                        return r;
+        HASHMAP_FOREACH(b, h, i)
+                all[n++] = b;
 
-                /* No sd_journal_next/previous here. */
-        }
+        /* The array owns the boots now */
+        while ((key = hashmap_steal_first_key(h)))
+                free(key);
 
-        for (;;) {
-                _cleanup_free_ BootId *current = NULL;
+        qsort_safe(all, n, sizeof(BootId*), boot_id_compare);
 
-                r = discover_next_boot(j, &current, advance_older, !query_ref_boot);
-                if (r < 0) {
-                        boot_id_free_all(head);
-                        return r;
-                }
+        if (query_ref_boot) {
+                ssize_t idx = -1;
 
-                if (!current)
-                        break;
+                /* Without a boot ID, offset 0 is the last (and
+                 * current) boot, while 1 is considered the
+                 * (chronological) first boot in the journal. Relative
+                 * to a boot ID, the offset simply counts boots. */
+                if (sd_id128_is_null(query_ref_boot->id))
+                        idx = ref_boot_offset > 0 ? ref_boot_offset - 1 : (ssize_t) n - 1 + ref_boot_offset;
+                else
+                        for (k = 0; k < n; k++)
+                                if (sd_id128_equal(all[k]->id, query_ref_boot->id)) {
+                                        idx = (ssize_t) k + ref_boot_offset;
+                                        break;
+                                }
 
-                if (query_ref_boot) {
-                        if (!skip_once)
-                                ref_boot_offset += advance_older ? 1 : -1;
-                        skip_once = false;
+                if (idx >= 0 && (size_t) idx < n) {
+                        query_ref_boot->id = all[idx]->id;
+                        count = 1;
+                }
 
-                        if (ref_boot_offset == 0) {
-                                count = 1;
-                                query_ref_boot->id = current->id;
-                                break;
-                        }
-                } else {
-                        LIST_INSERT_AFTER(boot_list, head, tail, current);
-                        tail = current;
-                        current = NULL;
+                for (k = 0; k < n; k++)
+                        free(all[k]);
+        } else {
+                for (k = 0; k < n; k++) {
+                        LIST_INSERT_AFTER(boot_list, head, tail, all[k]);
+                        tail = all[k];
                         count++;
                 }
         }
 
-finish:
         if (boots)
                 *boots = head;
-
-        sd_journal_flush_matches(j);
+        else
+                boot_id_free_all(head);
 
         return count;
 }
@@ -1557,48 +1565,159 @@ finish:
 #endif
 }
 
+static int verify_file(JournalFile *f, bool show_progress) {
+        usec_t first = 0, validated = 0, last = 0;
+        int k;
+
+        assert(f);
+
+#ifdef HAVE_GCRYPT
+        if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
+                log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
+#endif
+
+        k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, show_progress);
+        if (k == -EINVAL)
+                /* If the key was invalid give up right-away. */
+                return k;
+        else if (k < 0)
+                log_warning("FAIL: %s (%s)", f->path, strerror(-k));
+        else {
+                char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
+                log_info("PASS: %s", f->path);
+
+                if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
+                        if (validated > 0) {
+                                log_info("=> Validated from %s to %s, final %s entries not sealed.",
+                                         format_timestamp_maybe_utc(a, sizeof(a), first),
+                                         format_timestamp_maybe_utc(b, sizeof(b), validated),
+                                         format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
+                        } else if (last > 0)
+                                log_info("=> No sealing yet, %s of entries not sealed.",
+                                         format_timespan(c, sizeof(c), last - first, 0));
+                        else
+                                log_info("=> No sealing yet, no entries in file.");
+                }
+        }
+
+        return k;
+}
+
+static int wait_for_verify_worker(pid_t *pids, JournalFile **files, unsigned n) {
+        siginfo_t status;
+        unsigned k;
+
+        assert(pids);
+        assert(files);
+
+        for (;;) {
+                zero(status);
+
+                if (waitid(P_ALL, 0, &status, WEXITED) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return log_error_errno(errno, "Failed to wait for verification process: %m");
+                }
+
+                for (k = 0; k < n; k++)
+                        if (pids[k] == status.si_pid)
+                                break;
+
+                /* Not one of ours? */
+                if (k < n)
+                        break;
+        }
+
+        pids[k] = 0;
+
+        if (status.si_code == CLD_EXITED)
+                return -status.si_status;
+
+        /* The worker didn't get around to report anything itself */
+        log_warning("FAIL: %s (verification process died with signal %s)",
+                    files[k]->path, signal_to_string(status.si_status));
+        return -EBADMSG;
+}
+
 static int verify(sd_journal *j) {
-        int r = 0;
+        _cleanup_free_ JournalFile **files = NULL;
+        _cleanup_free_ pid_t *pids = NULL;
+        unsigned n_workers, n_running = 0, k;
         Iterator i;
         JournalFile *f;
+        long ncpus;
+        int r = 0, q;
 
         assert(j);
 
         log_show_color(true);
 
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_workers = MIN((unsigned) ordered_hashmap_size(j->files), ncpus > 1 ? (unsigned) ncpus : 1U);
+
+        if (n_workers <= 1) {
+                ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                        q = verify_file(f, true);
+                        if (q == -EINVAL)
+                                return q;
+                        if (q < 0)
+                                r = q;
+                }
+
+                return r;
+        }
+
+        /* With more than one file and CPU, verify several files at
+         * once, each in a process of its own. That way they neither
+         * share the mmap cache nor the SIGBUS queue. There's no
+         * progress bar in this mode, the PASS/FAIL lines printed as
+         * each file is done have to do. */
+
+        pids = new0(pid_t, n_workers);
+        files = new0(JournalFile*, n_workers);
+        if (!pids || !files)
+                return log_oom();
+
+        fflush(stdout);
+
         ORDERED_HASHMAP_FOREACH(f, j->files, i) {
-                int k;
-                usec_t first = 0, validated = 0, last = 0;
+                pid_t pid;
 
-#ifdef HAVE_GCRYPT
-                if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
-                        log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
-#endif
+                if (n_running >= n_workers) {
+                        q = wait_for_verify_worker(pids, files, n_workers);
+                        n_running--;
+                        if (q < 0)
+                                r = q;
+                        if (q == -EINVAL)
+                                break;
+                }
 
-                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, true);
-                if (k == -EINVAL) {
-                        /* If the key was invalid give up right-away. */
-                        return k;
-                } else if (k < 0) {
-                        log_warning("FAIL: %s (%s)", f->path, strerror(-k));
-                        r = k;
-                } else {
-                        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
-                        log_info("PASS: %s", f->path);
-
-                        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
-                                if (validated > 0) {
-                                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
-                                                 format_timestamp_maybe_utc(a, sizeof(a), first),
-                                                 format_timestamp_maybe_utc(b, sizeof(b), validated),
-                                                 format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
-                                } else if (last > 0)
-                                        log_info("=> No sealing yet, %s of entries not sealed.",
-                                                 format_timespan(c, sizeof(c), last - first, 0));
-                                else
-                                        log_info("=> No sealing yet, no entries in file.");
-                        }
+                for (k = 0; k < n_workers; k++)
+                        if (pids[k] == 0)
+                                break;
+                assert(k < n_workers);
+
+                pid = fork();
+                if (pid < 0) {
+                        r = log_error_errno(errno, "Failed to fork: %m");
+                        break;
                 }
+                if (pid == 0) {
+                        q = verify_file(f, false);
+                        _exit(q < 0 ? -q : EXIT_SUCCESS);
+                }
+
+                pids[k] = pid;
+                files[k] = f;
+                n_running++;
+        }
+
+        while (n_running > 0) {
+                q = wait_for_verify_worker(pids, files, n_workers);
+                n_running--;
+                if (q < 0 && r != -EINVAL)
+                        r = q;
         }
 
         return r;
@@ -1772,6 +1891,82 @@ static int flush_to_var(void) {
         return 0;
 }
 
+static int read_synced(usec_t *ret) {
+        _cleanup_free_ char *line = NULL;
+        uint64_t u;
+        int r;
+
+        r = read_one_line_file("/run/systemd/journal/synced", &line);
+        if (r < 0)
+                return r;
+
+        r = safe_atou64(line, &u);
+        if (r < 0)
+                return r;
+
+        *ret = u;
+        return 0;
+}
+
+static int sync_journal(void) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_bus_flush_close_unref_ sd_bus *bus = NULL;
+        _cleanup_close_ int watch_fd = -1;
+        usec_t start, synced;
+        int r;
+
+        /* Set up the inotify watch first, so that we can't miss the
+         * daemon replacing the synced file, which contains the time
+         * of the last request it fully served */
+        mkdir_p("/run/systemd/journal", 0755);
+
+        watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (watch_fd < 0)
+                return log_error_errno(errno, "Failed to create inotify watch: %m");
+
+        r = inotify_add_watch(watch_fd, "/run/systemd/journal", IN_CREATE|IN_MOVED_TO|IN_DONT_FOLLOW|IN_ONLYDIR);
+        if (r < 0)
+                return log_error_errno(errno, "Failed to watch journal directory: %m");
+
+        start = now(CLOCK_MONOTONIC);
+
+        r = bus_open_system_systemd(&bus);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get D-Bus connection: %m");
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "KillUnit",
+                        &error,
+                        NULL,
+                        "ssi", "systemd-journald.service", "main", SIGRTMIN+1);
+        if (r < 0) {
+                log_error("Failed to kill journal service: %s", bus_error_message(&error, r));
+                return r;
+        }
+
+        for (;;) {
+                r = read_synced(&synced);
+                if (r >= 0 && synced >= start)
+                        break;
+                if (r < 0 && r != -ENOENT)
+                        return log_error_errno(r, "Failed to read /run/systemd/journal/synced: %m");
+
+                r = fd_wait_for_event(watch_fd, POLLIN, USEC_INFINITY);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to wait for event: %m");
+
+                r = flush_fd(watch_fd);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to flush inotify events: %m");
+        }
+
+        return 0;
+}
+
 int main(int argc, char *argv[]) {
         int r;
         _cleanup_journal_close_ sd_journal *j = NULL;
@@ -1780,6 +1975,7 @@ int main(int argc, char *argv[]) {
         bool previous_boot_id_valid = false, first_line = true;
         int n_shown = 0;
         bool ellipsized = false;
+        usec_t since = 0, until = USEC_INFINITY;
 
         setlocale(LC_ALL, "");
         log_parse_environment();
@@ -1792,6 +1988,13 @@ int main(int argc, char *argv[]) {
         signal(SIGWINCH, columns_lines_cache_reset);
         sigbus_install();
 
+        /* Machine readable output is usually piped somewhere for
+         * bulk processing, hence write it out in large chunks,
+         * instead of stdio's default of one page at a time. This
+         * needs to happen before anything is written to stdout. */
+        if (IN_SET(arg_output, OUTPUT_EXPORT, OUTPUT_JSON, OUTPUT_JSON_PRETTY, OUTPUT_JSON_SSE) && !on_tty())
+                (void) setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
         /* Increase max number of open files to 16K if we can, we
          * might needs this when browsing journal files, which might
          * be split up into many files. */
@@ -1807,6 +2010,11 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        if (arg_action == ACTION_SYNC) {
+                r = sync_journal();
+                goto finish;
+        }
+
         if (arg_action == ACTION_SETUP_KEYS) {
                 r = setup_keys();
                 goto finish;
@@ -1843,14 +2051,25 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        /* When only showing entries of a time range, we can skip
+         * files that lie entirely outside of it without opening
+         * them. Not if we need to look up boots however, since
+         * that requires all files. */
+        if (arg_action == ACTION_SHOW &&
+            (arg_since_set || arg_until_set) &&
+            !(arg_boot && (arg_boot_offset != 0 || !sd_id128_is_null(arg_boot_id)))) {
+                since = arg_since_set ? arg_since : 0;
+                until = arg_until_set ? arg_until : USEC_INFINITY;
+        }
+
         if (arg_directory)
-                r = sd_journal_open_directory(&j, arg_directory, arg_journal_type);
+                r = journal_open_bounded(&j, arg_directory, arg_journal_type, since, until);
         else if (arg_file)
                 r = sd_journal_open_files(&j, (const char**) arg_file, 0);
         else if (arg_machine)
                 r = sd_journal_open_container(&j, arg_machine, 0);
         else
-                r = sd_journal_open(&j, !arg_merge*SD_JOURNAL_LOCAL_ONLY + arg_journal_type);
+                r = journal_open_bounded(&j, NULL, !arg_merge*SD_JOURNAL_LOCAL_ONLY + arg_journal_type, since, until);
         if (r < 0) {
                 log_error_errno(r, "Failed to open %s: %m",
                                 arg_directory ? arg_directory : arg_file ? "files" : "journal");
@@ -2182,6 +2401,8 @@ int main(int argc, char *argv[]) {
                         break;
                 }
 
+                fflush(stdout);
+
                 r = sd_journal_wait(j, (uint64_t) -1);
                 if (r < 0) {
                         log_error_errno(r, "Couldn't wait for journal event: %m");
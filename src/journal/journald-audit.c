@@ -23,60 +23,88 @@
 #include "journald-audit.h"
 #include "audit-type.h"
 
-typedef struct MapField {
-        const char *audit_field;
-        const char *journal_field;
-        int (*map)(const char *field, const char **p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov);
-} MapField;
-
-static int map_simple_field(const char *field, const char **p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov) {
-        _cleanup_free_ char *c = NULL;
-        size_t l = 0, allocated = 0;
-        const char *e;
+/* The fields of one record being parsed. The values are decoded into
+ * the server's audit buffer, which is reused for all records. As it
+ * might move while it grows, the iovecs from first_field on point to
+ * offsets in it, until audit_record_relocate() fixes them up. */
+typedef struct AuditRecord {
+        Server *server;
+        size_t buffer_used;
+
+        struct iovec *iov;
+        size_t n_iov_allocated;
+        unsigned n_iov;
+        unsigned first_field;
+} AuditRecord;
+
+static char *audit_record_reserve(AuditRecord *r, const char *field, size_t n) {
+        Server *s = r->server;
+        size_t l;
 
-        assert(field);
-        assert(p);
-        assert(iov);
-        assert(n_iov);
+        /* Makes room for a field of the given name and a value of at
+         * most n bytes, and returns where the value goes */
 
         l = strlen(field);
-        allocated = l + 1;
-        c = malloc(allocated);
-        if (!c)
-                return -ENOMEM;
+        if (!GREEDY_REALLOC(s->audit_buffer, s->audit_buffer_allocated, r->buffer_used + l + n))
+                return NULL;
 
-        memcpy(c, field, l);
-        for (e = *p; *e != ' ' && *e != 0; e++) {
-                if (!GREEDY_REALLOC(c, allocated, l+2))
-                        return -ENOMEM;
+        return mempcpy(s->audit_buffer + r->buffer_used, field, l);
+}
 
-                c[l++] = *e;
-        }
+static int audit_record_push(AuditRecord *r, const char *end) {
+        size_t l;
 
-        c[l] = 0;
+        /* Adds what audit_record_reserve() was last called for and
+         * was written up to end */
 
-        if (!GREEDY_REALLOC(*iov, *n_iov_allocated, *n_iov + 1))
+        if (!GREEDY_REALLOC(r->iov, r->n_iov_allocated, r->n_iov + 1))
                 return -ENOMEM;
 
-        (*iov)[*n_iov].iov_base = c;
-        (*iov)[*n_iov].iov_len = l;
-        (*n_iov) ++;
+        l = end - (r->server->audit_buffer + r->buffer_used);
 
-        *p = e;
-        c = NULL;
+        r->iov[r->n_iov].iov_base = (void*) (uintptr_t) r->buffer_used;
+        r->iov[r->n_iov].iov_len = l;
+        r->n_iov++;
+
+        r->buffer_used += l;
 
         return 1;
 }
 
-static int map_string_field_internal(const char *field, const char **p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov, bool filter_printable) {
-        _cleanup_free_ char *c = NULL;
+static void audit_record_relocate(AuditRecord *r) {
+        unsigned k;
+
+        for (k = r->first_field; k < r->n_iov; k++)
+                r->iov[k].iov_base = r->server->audit_buffer + (uintptr_t) r->iov[k].iov_base;
+}
+
+static int map_simple_field(AuditRecord *r, const char *field, const char **p) {
+        const char *e;
+        char *c;
+
+        assert(r);
+        assert(field);
+        assert(p);
+
+        e = strchrnul(*p, ' ');
+
+        c = audit_record_reserve(r, field, e - *p);
+        if (!c)
+                return -ENOMEM;
+
+        c = mempcpy(c, *p, e - *p);
+
+        *p = e;
+        return audit_record_push(r, c);
+}
+
+static int map_string_field(AuditRecord *r, const char *field, const char **p, bool filter_printable) {
         const char *s, *e;
-        size_t l;
+        char *c;
 
+        assert(r);
         assert(field);
         assert(p);
-        assert(iov);
-        assert(n_iov);
 
         /* The kernel formats string fields in one of two formats. */
 
@@ -87,27 +115,26 @@ static int map_string_field_internal(const char *field, const char **p, struct i
                 if (!e)
                         return 0;
 
-                l = strlen(field) + (e - s);
-                c = malloc(l+1);
+                c = audit_record_reserve(r, field, e - s);
                 if (!c)
                         return -ENOMEM;
 
-                *((char*) mempcpy(stpcpy(c, field), s, e - s)) = 0;
+                c = mempcpy(c, s, e - s);
 
                 e += 1;
 
         } else if (unhexchar(**p) >= 0) {
-                /* Hexadecimal escaping */
-                size_t allocated = 0;
+                /* Hexadecimal escaping, which decodes to half the
+                 * length */
+                const char *end;
 
-                l = strlen(field);
-                allocated = l + 2;
-                c = malloc(allocated);
+                end = strchrnul(*p, ' ');
+
+                c = audit_record_reserve(r, field, (end - *p) / 2);
                 if (!c)
                         return -ENOMEM;
 
-                memcpy(c, field, l);
-                for (e = *p; *e != ' ' && *e != 0; e += 2) {
+                for (e = *p; e < end; e += 2) {
                         int a, b;
                         uint8_t x;
 
@@ -124,41 +151,37 @@ static int map_string_field_internal(const char *field, const char **p, struct i
                         if (filter_printable && x < (uint8_t) ' ')
                                 x = (uint8_t) ' ';
 
-                        if (!GREEDY_REALLOC(c, allocated, l+2))
-                                return -ENOMEM;
-
-                        c[l++] = (char) x;
+                        *(c++) = (char) x;
                 }
-
-                c[l] = 0;
         } else
                 return 0;
 
-        if (!GREEDY_REALLOC(*iov, *n_iov_allocated, *n_iov + 1))
-                return -ENOMEM;
+        *p = e;
+        return audit_record_push(r, c);
+}
 
-        (*iov)[*n_iov].iov_base = c;
-        (*iov)[*n_iov].iov_len = l;
-        (*n_iov) ++;
+static int map_field(AuditRecord *r, AuditFieldMap map, const char *field, const char **p) {
 
-        *p = e;
-        c = NULL;
+        switch (map) {
 
-        return 1;
-}
+        case AUDIT_FIELD_MAP_SIMPLE:
+                return map_simple_field(r, field, p);
 
-static int map_string_field(const char *field, const char **p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov) {
-        return map_string_field_internal(field, p, iov, n_iov_allocated, n_iov, false);
-}
+        case AUDIT_FIELD_MAP_STRING:
+                return map_string_field(r, field, p, false);
+
+        case AUDIT_FIELD_MAP_STRING_PRINTABLE:
+                return map_string_field(r, field, p, true);
 
-static int map_string_field_printable(const char *field, const char **p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov) {
-        return map_string_field_internal(field, p, iov, n_iov_allocated, n_iov, true);
+        default:
+                return 0;
+        }
 }
 
-static int map_generic_field(const char *prefix, const char **p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov) {
+static int map_generic_field(AuditRecord *r, const char *prefix, const char **p) {
         const char *e, *f;
         char *c, *t;
-        int r;
+        int k;
 
         /* Implements fallback mappings for all fields we don't know */
 
@@ -199,79 +222,28 @@ static int map_generic_field(const char *prefix, const char **p, struct iovec **
 
         e ++;
 
-        r = map_simple_field(c, &e, iov, n_iov_allocated, n_iov);
-        if (r < 0)
-                return r;
+        k = map_simple_field(r, c, &e);
+        if (k < 0)
+                return k;
 
         *p = e;
-        return r;
+        return k;
 }
 
 /* Kernel fields are those occurring in the audit string before
- * msg='. All of these fields are trusted, hence carry the "_" prefix.
- * We try to translate the fields we know into our native names. The
- * other's are generically mapped to _AUDIT_FIELD_XYZ= */
-static const MapField map_fields_kernel[] = {
-
-        /* First, we map certain well-known audit fields into native
-         * well-known fields */
-        { "pid=",       "_PID=",                   map_simple_field },
-        { "ppid=",      "_PPID=",                  map_simple_field },
-        { "uid=",       "_UID=",                   map_simple_field },
-        { "euid=",      "_EUID=",                  map_simple_field },
-        { "fsuid=",     "_FSUID=",                 map_simple_field },
-        { "gid=",       "_GID=",                   map_simple_field },
-        { "egid=",      "_EGID=",                  map_simple_field },
-        { "fsgid=",     "_FSGID=",                 map_simple_field },
-        { "tty=",       "_TTY=",                   map_simple_field },
-        { "ses=",       "_AUDIT_SESSION=",         map_simple_field },
-        { "auid=",      "_AUDIT_LOGINUID=",        map_simple_field },
-        { "subj=",      "_SELINUX_CONTEXT=",       map_simple_field },
-        { "comm=",      "_COMM=",                  map_string_field },
-        { "exe=",       "_EXE=",                   map_string_field },
-        { "proctitle=", "_CMDLINE=",               map_string_field_printable },
-
-        /* Some fields don't map to native well-known fields. However,
-         * we know that they are string fields, hence let's undo
-         * string field escaping for them, though we stick to the
-         * generic field names. */
-        { "path=",      "_AUDIT_FIELD_PATH=",      map_string_field },
-        { "dev=",       "_AUDIT_FIELD_DEV=",       map_string_field },
-        { "name=",      "_AUDIT_FIELD_NAME=",      map_string_field },
-        {}
-};
-
-/* Userspace fields are those occurring in the audit string after
- * msg='. All of these fields are untrusted, hence carry no "_"
- * prefix. We map the fields we don't know to AUDIT_FIELD_XYZ= */
-static const MapField map_fields_userspace[] = {
-        { "cwd=",       "AUDIT_FIELD_CWD=",  map_string_field },
-        { "cmd=",       "AUDIT_FIELD_CMD=",  map_string_field },
-        { "acct=",      "AUDIT_FIELD_ACCT=", map_string_field },
-        { "exe=",       "AUDIT_FIELD_EXE=",  map_string_field },
-        { "comm=",      "AUDIT_FIELD_COMM=", map_string_field },
-        {}
-};
-
-static int map_all_fields(
-                const char *p,
-                const MapField map_fields[],
-                const char *prefix,
-                bool handle_msg,
-                struct iovec **iov,
-                size_t *n_iov_allocated,
-                unsigned *n_iov) {
-
-        int r;
-
+ * msg='. All of these fields are trusted, hence carry the "_" prefix,
+ * and are generically mapped to _AUDIT_FIELD_XYZ= unless
+ * journald-audit-gperf.gperf knows a native name for them. Userspace
+ * fields are those occurring after msg=', they are untrusted, hence
+ * carry no "_" prefix, and are mapped to AUDIT_FIELD_XYZ=. */
+static int map_all_fields(AuditRecord *r, const char *p, bool userspace) {
+        int k;
+
+        assert(r);
         assert(p);
-        assert(iov);
-        assert(n_iov_allocated);
-        assert(n_iov);
 
         for (;;) {
-                bool mapped = false;
-                const MapField *m;
+                const struct AuditFieldMapping *m;
                 const char *v;
 
                 p += strspn(p, WHITESPACE);
@@ -279,7 +251,7 @@ static int map_all_fields(
                 if (*p == 0)
                         return 0;
 
-                if (handle_msg) {
+                if (!userspace) {
                         v = startswith(p, "msg='");
                         if (v) {
                                 const char *e;
@@ -298,46 +270,74 @@ static int map_all_fields(
                                         return 0; /* don't continue splitting up if the final quotation mark is missing */
 
                                 c = strndupa(v, e - v);
-                                return map_all_fields(c, map_fields_userspace, "AUDIT_FIELD_", false, iov, n_iov_allocated, n_iov);
+                                return map_all_fields(r, c, true);
                         }
                 }
 
-                /* Try to map the kernel fields to our own names */
-                for (m = map_fields; m->audit_field; m++) {
-                        v = startswith(p, m->audit_field);
-                        if (!v)
-                                continue;
-
-                        r = m->map(m->journal_field, &v, iov, n_iov_allocated, n_iov);
-                        if (r < 0)
-                                return log_debug_errno(r, "Failed to parse audit array: %m");
+                /* Try to map the fields to our own names */
+                v = p + strcspn(p, "= ");
+                m = *v == '=' ? journald_audit_field_lookup(p, v - p) : NULL;
+                if (m) {
+                        v++;
 
-                        if (r > 0) {
-                                mapped = true;
+                        if (userspace)
+                                k = map_field(r, m->userspace_map, m->userspace_field, &v);
+                        else
+                                k = map_field(r, m->kernel_map, m->kernel_field, &v);
+                        if (k < 0)
+                                return log_debug_errno(k, "Failed to parse audit array: %m");
+                        if (k > 0) {
                                 p = v;
-                                break;
+                                continue;
                         }
                 }
 
-                if (!mapped) {
-                        r = map_generic_field(prefix, &p, iov, n_iov_allocated, n_iov);
-                        if (r < 0)
-                                return log_debug_errno(r, "Failed to parse audit array: %m");
+                k = map_generic_field(r, userspace ? "AUDIT_FIELD_" : "_AUDIT_FIELD_", &p);
+                if (k < 0)
+                        return log_debug_errno(k, "Failed to parse audit array: %m");
 
-                        if (r == 0)
-                                /* Couldn't process as generic field, let's just skip over it */
-                                p += strcspn(p, WHITESPACE);
-                }
+                if (k == 0)
+                        /* Couldn't process as generic field, let's just skip over it */
+                        p += strcspn(p, WHITESPACE);
         }
 }
 
+int audit_map_fields(Server *s, const char *p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov) {
+        AuditRecord r = {
+                .server = s,
+                .iov = *iov,
+                .n_iov_allocated = *n_iov_allocated,
+                .n_iov = *n_iov,
+                .first_field = *n_iov,
+        };
+        int k;
+
+        assert(s);
+        assert(p);
+        assert(iov);
+        assert(n_iov_allocated);
+        assert(n_iov);
+
+        k = map_all_fields(&r, p, false);
+
+        /* The iovec array might have been reallocated while parsing,
+         * and even on failure it contains the fields mapped so far */
+        audit_record_relocate(&r);
+
+        *iov = r.iov;
+        *n_iov_allocated = r.n_iov_allocated;
+        *n_iov = r.n_iov;
+
+        return k;
+}
+
 static void process_audit_string(Server *s, int type, const char *data, size_t size) {
         _cleanup_free_ struct iovec *iov = NULL;
-        size_t n_iov_allocated = 0;
-        unsigned n_iov = 0, k;
+        size_t n_iov_allocated;
+        unsigned n_iov = 0;
         uint64_t seconds, msec, id;
         const char *p, *type_name;
-        unsigned z;
+        unsigned k;
         char id_field[sizeof("_AUDIT_ID=") + DECIMAL_STR_MAX(uint64_t)],
              type_field[sizeof("_AUDIT_TYPE=") + DECIMAL_STR_MAX(int)],
              source_time_field[sizeof("_SOURCE_REALTIME_TIMESTAMP=") + DECIMAL_STR_MAX(usec_t)];
@@ -373,6 +373,8 @@ static void process_audit_string(Server *s, int type, const char *data, size_t s
         if (isempty(p))
                 return;
 
+        server_statistics_audit(&s->statistics, type);
+
         n_iov_allocated = N_IOVEC_META_FIELDS + 7;
         iov = new(struct iovec, n_iov_allocated);
         if (!iov) {
@@ -401,23 +403,15 @@ static void process_audit_string(Server *s, int type, const char *data, size_t s
         m = strjoina("MESSAGE=", type_name, " ", p);
         IOVEC_SET_STRING(iov[n_iov++], m);
 
-        z = n_iov;
-
-        map_all_fields(p, map_fields_kernel, "_AUDIT_FIELD_", true, &iov, &n_iov_allocated, &n_iov);
+        (void) audit_map_fields(s, p, &iov, &n_iov_allocated, &n_iov);
 
         if (!GREEDY_REALLOC(iov, n_iov_allocated, n_iov + N_IOVEC_META_FIELDS)) {
                 log_oom();
-                goto finish;
+                return;
         }
 
+        s->statistics.n_messages[JOURNAL_SOURCE_AUDIT]++;
         server_dispatch_message(s, iov, n_iov, n_iov_allocated, NULL, NULL, NULL, 0, NULL, LOG_NOTICE, 0);
-
-finish:
-        /* free() all entries that map_all_fields() added. All others
-         * are allocated on the stack or are constant. */
-
-        for (; z < n_iov; z++)
-                free(iov[z].iov_base);
 }
 
 void server_process_audit_message(
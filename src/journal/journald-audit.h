@@ -24,6 +24,33 @@
 #include "socket-util.h"
 #include "journald-server.h"
 
+typedef enum AuditFieldMap {
+        AUDIT_FIELD_MAP_NONE,
+        AUDIT_FIELD_MAP_SIMPLE,
+        AUDIT_FIELD_MAP_STRING,
+        AUDIT_FIELD_MAP_STRING_PRINTABLE,
+} AuditFieldMap;
+
+/* How an audit field is mapped, depending on whether it occurs in
+ * the trusted kernel part of a record or in the userspace part after
+ * msg='. Fields without a mapping get a generic name. */
+struct AuditFieldMapping {
+        const char *name;
+        const char *kernel_field;
+        AuditFieldMap kernel_map;
+        const char *userspace_field;
+        AuditFieldMap userspace_map;
+};
+
+/* gperf lookup function */
+const struct AuditFieldMapping* journald_audit_field_lookup(const char *key, unsigned length);
+
+/* Maps the fields of an audit record (the part following the
+ * "audit(...):" prefix) to journal fields, appending them to the
+ * iovec array. The values are stored in s->audit_buffer, hence stay
+ * valid only until the next record is mapped. */
+int audit_map_fields(Server *s, const char *p, struct iovec **iov, size_t *n_iov_allocated, unsigned *n_iov);
+
 void server_process_audit_message(Server *s, const void *buffer, size_t buffer_size, const struct ucred *ucred, const union sockaddr_union *sa, socklen_t salen);
 
 int server_open_audit(Server*s);
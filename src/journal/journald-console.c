@@ -102,11 +102,14 @@ void server_forward_console(
         fd = open_terminal(tty, O_WRONLY|O_NOCTTY|O_CLOEXEC);
         if (fd < 0) {
                 log_debug_errno(errno, "Failed to open %s for logging: %m", tty);
+                s->n_forward_console_missed++;
                 return;
         }
 
-        if (writev(fd, iovec, n) < 0)
+        if (writev(fd, iovec, n) < 0) {
                 log_debug_errno(errno, "Failed to write to %s for logging: %m", tty);
+                s->n_forward_console_missed++;
+        }
 
         safe_close(fd);
 }
@@ -0,0 +1,285 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SELINUX
+#include <selinux/selinux.h>
+#endif
+
+#include "util.h"
+#include "hashmap.h"
+#include "audit.h"
+#include "cgroup-util.h"
+#include "process-util.h"
+#include "proc-snapshot.h"
+#include "selinux-util.h"
+#include "journald-context.h"
+
+/* Upper limit on the number of processes we keep metadata of */
+#define CLIENT_CONTEXTS_MAX 1024U
+
+struct ClientContextCache {
+        usec_t ttl;
+        Hashmap *contexts;
+
+        /* Reused for every process we read, along with its buffers */
+        ProcSnapshot *snapshot;
+};
+
+static void client_context_reset(ClientContext *c) {
+        assert(c);
+
+        c->comm = mfree(c->comm);
+        c->exe = mfree(c->exe);
+        c->cmdline = mfree(c->cmdline);
+        c->capeff = mfree(c->capeff);
+        c->cgroup = mfree(c->cgroup);
+        c->session = mfree(c->session);
+        c->unit = mfree(c->unit);
+        c->user_unit = mfree(c->user_unit);
+        c->slice = mfree(c->slice);
+        c->label = mfree(c->label);
+
+        c->uid_valid = c->gid_valid = false;
+        c->exe_id_valid = false;
+        c->audit_session_valid = c->audit_loginuid_valid = false;
+        c->owner_uid_valid = false;
+}
+
+static ClientContext *client_context_free(ClientContext *c) {
+        if (!c)
+                return NULL;
+
+        client_context_reset(c);
+        free(c);
+
+        return NULL;
+}
+
+ClientContextCache *client_context_cache_new(usec_t ttl) {
+        ClientContextCache *c;
+
+        c = new0(ClientContextCache, 1);
+        if (!c)
+                return NULL;
+
+        c->ttl = ttl;
+
+        return c;
+}
+
+ClientContextCache *client_context_cache_free(ClientContextCache *c) {
+        ClientContext *i;
+
+        if (!c)
+                return NULL;
+
+        while ((i = hashmap_steal_first(c->contexts)))
+                client_context_free(i);
+
+        hashmap_free(c->contexts);
+        proc_snapshot_free(c->snapshot);
+        free(c);
+
+        return NULL;
+}
+
+static int client_context_snapshot(ClientContextCache *cache, pid_t pid) {
+        assert(cache);
+
+        if (!cache->snapshot)
+                return proc_snapshot_new(pid, &cache->snapshot);
+
+        return proc_snapshot_open(cache->snapshot, pid);
+}
+
+static int client_context_exe_id(pid_t pid, dev_t *dev, ino_t *ino) {
+        struct stat st;
+        const char *p;
+
+        assert(dev);
+        assert(ino);
+
+        p = procfs_file_alloca(pid, "exe");
+        if (stat(p, &st) < 0)
+                return -errno;
+
+        *dev = st.st_dev;
+        *ino = st.st_ino;
+        return 0;
+}
+
+static bool client_context_exec_changed(ClientContext *c) {
+        dev_t dev;
+        ino_t ino;
+
+        assert(c);
+
+        /* If we cannot tell anymore (the process exited, or its exe
+         * is not accessible), what we have cached is the best we
+         * know */
+        if (client_context_exe_id(c->pid, &dev, &ino) < 0)
+                return false;
+
+        return !c->exe_id_valid || c->exe_dev != dev || c->exe_ino != ino;
+}
+
+static void client_context_read(ClientContextCache *cache, ClientContext *c, char *cgroup) {
+        const char *t;
+
+        assert(cache);
+        assert(c);
+
+        /* Takes possession of the cgroup path */
+
+        client_context_reset(c);
+
+        if (client_context_snapshot(cache, c->pid) >= 0) {
+                ProcSnapshot *s = cache->snapshot;
+
+                c->uid_valid = proc_snapshot_get_uid(s, &c->uid) >= 0;
+                c->gid_valid = proc_snapshot_get_gid(s, &c->gid) >= 0;
+
+                if (proc_snapshot_get_comm(s, &t) >= 0)
+                        c->comm = strdup(t);
+                if (proc_snapshot_get_exe(s, &t) >= 0)
+                        c->exe = strdup(t);
+                c->exe_id_valid = client_context_exe_id(c->pid, &c->exe_dev, &c->exe_ino) >= 0;
+                (void) proc_snapshot_get_cmdline(s, &c->cmdline);
+                (void) proc_snapshot_get_capeff(s, &c->capeff);
+        }
+
+#ifdef HAVE_AUDIT
+        c->audit_session_valid = audit_session_from_pid(c->pid, &c->audit_session) >= 0;
+        c->audit_loginuid_valid = audit_loginuid_from_pid(c->pid, &c->audit_loginuid) >= 0;
+#endif
+
+        c->cgroup = cgroup;
+        if (c->cgroup) {
+                (void) cg_path_get_session(c->cgroup, &c->session);
+                c->owner_uid_valid = cg_path_get_owner_uid(c->cgroup, &c->owner_uid) >= 0;
+                (void) cg_path_get_unit(c->cgroup, &c->unit);
+                (void) cg_path_get_user_unit(c->cgroup, &c->user_unit);
+                (void) cg_path_get_slice(c->cgroup, &c->slice);
+        }
+
+#ifdef HAVE_SELINUX
+        if (mac_selinux_use()) {
+                security_context_t con;
+
+                if (getpidcon(c->pid, &con) >= 0) {
+                        c->label = strdup(con);
+                        freecon(con);
+                }
+        }
+#endif
+}
+
+static void client_context_make_room(ClientContextCache *c, usec_t ts) {
+        ClientContext *i;
+        Iterator j;
+
+        assert(c);
+
+        if (hashmap_size(c->contexts) < CLIENT_CONTEXTS_MAX)
+                return;
+
+        /* First, get rid of everything that is out of date anyway */
+        HASHMAP_FOREACH(i, c->contexts, j)
+                if (i->timestamp + c->ttl <= ts) {
+                        hashmap_remove(c->contexts, PID_TO_PTR(i->pid));
+                        client_context_free(i);
+                }
+
+        /* Still full? Then drop an arbitrary entry */
+        if (hashmap_size(c->contexts) >= CLIENT_CONTEXTS_MAX)
+                client_context_free(hashmap_steal_first(c->contexts));
+}
+
+int client_context_get(ClientContextCache *c, pid_t pid, const char *cgroup_root, usec_t ts, ClientContext **ret) {
+        _cleanup_free_ char *cgroup = NULL;
+        ClientContext *i;
+        int r;
+
+        assert(c);
+        assert(pid > 0);
+        assert(ret);
+
+        /* Reading all the metadata of a process takes a good dozen of
+         * procfs accesses, which is too expensive to do for each
+         * message of a chatty client. Hence we cache it per PID for a
+         * short time. The cgroup path is checked on every lookup
+         * though: if the process was moved to another cgroup, or the
+         * PID got reused by a process elsewhere, it will differ, and
+         * we read everything again. The same goes for the binary
+         * behind /proc/$PID/exe, which changes on exec(), along with
+         * comm, exe and cmdline. */
+
+        (void) cg_pid_get_path_shifted(pid, cgroup_root, &cgroup);
+
+        i = hashmap_get(c->contexts, PID_TO_PTR(pid));
+        if (i) {
+                if (i->timestamp + c->ttl > ts &&
+                    (!cgroup || streq_ptr(i->cgroup, cgroup)) &&
+                    !client_context_exec_changed(i)) {
+                        *ret = i;
+                        return 0;
+                }
+        } else {
+                r = hashmap_ensure_allocated(&c->contexts, NULL);
+                if (r < 0)
+                        return r;
+
+                client_context_make_room(c, ts);
+
+                i = new0(ClientContext, 1);
+                if (!i)
+                        return -ENOMEM;
+
+                i->pid = pid;
+
+                r = hashmap_put(c->contexts, PID_TO_PTR(pid), i);
+                if (r < 0) {
+                        free(i);
+                        return r;
+                }
+        }
+
+        client_context_read(c, i, cgroup);
+        cgroup = NULL;
+
+        i->timestamp = ts;
+
+        *ret = i;
+        return 1;
+}
+
+void client_context_flush(ClientContextCache *c, pid_t pid) {
+        assert(c);
+
+        client_context_free(hashmap_remove(c->contexts, PID_TO_PTR(pid)));
+}
+
+unsigned client_context_cache_size(ClientContextCache *c) {
+        assert(c);
+
+        return hashmap_size(c->contexts);
+}
@@ -0,0 +1,74 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "time-util.h"
+
+typedef struct ClientContextCache ClientContextCache;
+
+/* Process metadata journald attaches to the messages of a client. Any
+ * of the strings may be NULL if the information was not available. */
+typedef struct ClientContext {
+        pid_t pid;
+        usec_t timestamp;
+
+        uid_t uid;
+        gid_t gid;
+        bool uid_valid:1;
+        bool gid_valid:1;
+
+        char *comm;
+        char *exe;
+        char *cmdline;
+
+        /* The binary the process ran when we read it, to notice exec() */
+        dev_t exe_dev;
+        ino_t exe_ino;
+        bool exe_id_valid:1;
+
+        char *capeff;
+
+        uint32_t audit_session;
+        uid_t audit_loginuid;
+        bool audit_session_valid:1;
+        bool audit_loginuid_valid:1;
+
+        char *cgroup;
+        char *session;
+        char *unit;
+        char *user_unit;
+        char *slice;
+
+        uid_t owner_uid;
+        bool owner_uid_valid:1;
+
+        char *label;
+} ClientContext;
+
+ClientContextCache *client_context_cache_new(usec_t ttl);
+ClientContextCache *client_context_cache_free(ClientContextCache *c);
+
+int client_context_get(ClientContextCache *c, pid_t pid, const char *cgroup_root, usec_t ts, ClientContext **ret);
+void client_context_flush(ClientContextCache *c, pid_t pid);
+
+unsigned client_context_cache_size(ClientContextCache *c);
@@ -33,6 +33,42 @@
 #include "journald-syslog.h"
 #include "formats-util.h"
 #include "process-util.h"
+#include "strv.h"
+
+/* The udev properties of devices kernel messages refer to are looked
+ * up once and then kept for a bit, a device that spews errors
+ * otherwise costs a udev database lookup per message. */
+#define KERNEL_DEVICE_TTL_USEC (5 * USEC_PER_SEC)
+#define KERNEL_DEVICES_MAX 1024
+
+/* How many records to read per wakeup, unless we are falling behind */
+#define DEV_KMSG_BATCH_MAX 64
+
+typedef struct KernelDevice {
+        char *id;
+        usec_t timestamp;
+        char **fields;
+} KernelDevice;
+
+static KernelDevice *kernel_device_free(KernelDevice *d) {
+        if (!d)
+                return NULL;
+
+        free(d->id);
+        strv_free(d->fields);
+        free(d);
+
+        return NULL;
+}
+
+void server_flush_kernel_devices(Server *s) {
+        KernelDevice *d;
+
+        assert(s);
+
+        while ((d = hashmap_steal_first(s->kernel_devices)))
+                kernel_device_free(d);
+}
 
 void server_forward_kmsg(
         Server *s,
@@ -88,8 +124,10 @@ void server_forward_kmsg(
         IOVEC_SET_STRING(iovec[n++], message);
         IOVEC_SET_STRING(iovec[n++], "\n");
 
-        if (writev(s->dev_kmsg_fd, iovec, n) < 0)
+        if (writev(s->dev_kmsg_fd, iovec, n) < 0) {
                 log_debug_errno(errno, "Failed to write to /dev/kmsg for logging: %m");
+                s->n_forward_kmsg_missed++;
+        }
 
         free(ident_buf);
 }
@@ -105,9 +143,119 @@ static bool is_us(const char *pid) {
         return t == getpid();
 }
 
+static int kernel_device_fields(struct udev_device *ud, char ***ret) {
+        _cleanup_strv_free_ char **l = NULL;
+        struct udev_list_entry *ll;
+        const char *g;
+        unsigned j = 0;
+        char *b;
+
+        assert(ud);
+        assert(ret);
+
+        g = udev_device_get_devnode(ud);
+        if (g) {
+                b = strappend("_UDEV_DEVNODE=", g);
+                if (!b || strv_consume(&l, b) < 0)
+                        return -ENOMEM;
+        }
+
+        g = udev_device_get_sysname(ud);
+        if (g) {
+                b = strappend("_UDEV_SYSNAME=", g);
+                if (!b || strv_consume(&l, b) < 0)
+                        return -ENOMEM;
+        }
+
+        ll = udev_device_get_devlinks_list_entry(ud);
+        udev_list_entry_foreach(ll, ll) {
+
+                if (j > N_IOVEC_UDEV_FIELDS)
+                        break;
+
+                g = udev_list_entry_get_name(ll);
+                if (g) {
+                        b = strappend("_UDEV_DEVLINK=", g);
+                        if (!b || strv_consume(&l, b) < 0)
+                                return -ENOMEM;
+                }
+
+                j++;
+        }
+
+        *ret = l;
+        l = NULL;
+
+        return 0;
+}
+
+static char **server_get_kernel_device(Server *s, const char *id) {
+        struct udev_device *ud;
+        KernelDevice *d;
+        usec_t ts;
+        int r;
+
+        assert(s);
+        assert(id);
+
+        if (sd_event_now(s->event, CLOCK_MONOTONIC, &ts) < 0)
+                ts = now(CLOCK_MONOTONIC);
+
+        d = hashmap_get(s->kernel_devices, id);
+        if (d) {
+                if (d->timestamp + KERNEL_DEVICE_TTL_USEC > ts)
+                        return d->fields;
+
+                hashmap_remove(s->kernel_devices, id);
+                kernel_device_free(d);
+        }
+
+        if (hashmap_size(s->kernel_devices) >= KERNEL_DEVICES_MAX)
+                server_flush_kernel_devices(s);
+
+        r = hashmap_ensure_allocated(&s->kernel_devices, &string_hash_ops);
+        if (r < 0)
+                return NULL;
+
+        d = new0(KernelDevice, 1);
+        if (!d)
+                return NULL;
+
+        d->id = strdup(id);
+        if (!d->id) {
+                kernel_device_free(d);
+                return NULL;
+        }
+
+        d->timestamp = ts;
+
+        /* A device udev doesn't know (yet) is remembered too, with
+         * no fields */
+        ud = udev_device_new_from_device_id(s->udev, id);
+        if (ud) {
+                r = kernel_device_fields(ud, &d->fields);
+                udev_device_unref(ud);
+                if (r < 0) {
+                        kernel_device_free(d);
+                        return NULL;
+                }
+        }
+
+        r = hashmap_put(s->kernel_devices, d->id, d);
+        if (r < 0) {
+                kernel_device_free(d);
+                return NULL;
+        }
+
+        return d->fields;
+}
+
 static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         struct iovec iovec[N_IOVEC_META_FIELDS + 7 + N_IOVEC_KERNEL_FIELDS + 2 + N_IOVEC_UDEV_FIELDS];
-        char *message = NULL, *syslog_priority = NULL, *syslog_pid = NULL, *syslog_facility = NULL, *syslog_identifier = NULL, *source_time = NULL;
+        char *message = NULL, *syslog_pid = NULL, *syslog_identifier = NULL;
+        char source_time[sizeof("_SOURCE_MONOTONIC_TIMESTAMP=") + DECIMAL_STR_MAX(unsigned long long)],
+             syslog_priority[sizeof("PRIORITY=") + DECIMAL_STR_MAX(int)],
+             syslog_facility[sizeof("SYSLOG_FACILITY=") + DECIMAL_STR_MAX(int)];
         int priority, r;
         unsigned n = 0, z = 0, j;
         unsigned long long usec;
@@ -217,65 +365,23 @@ static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         }
 
         if (kernel_device) {
-                struct udev_device *ud;
-
-                ud = udev_device_new_from_device_id(s->udev, kernel_device);
-                if (ud) {
-                        const char *g;
-                        struct udev_list_entry *ll;
-                        char *b;
-
-                        g = udev_device_get_devnode(ud);
-                        if (g) {
-                                b = strappend("_UDEV_DEVNODE=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        g = udev_device_get_sysname(ud);
-                        if (g) {
-                                b = strappend("_UDEV_SYSNAME=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        j = 0;
-                        ll = udev_device_get_devlinks_list_entry(ud);
-                        udev_list_entry_foreach(ll, ll) {
-
-                                if (j > N_IOVEC_UDEV_FIELDS)
-                                        break;
-
-                                g = udev_list_entry_get_name(ll);
-                                if (g) {
-                                        b = strappend("_UDEV_DEVLINK=", g);
-                                        if (b) {
-                                                IOVEC_SET_STRING(iovec[n++], b);
-                                                z++;
-                                        }
-                                }
-
-                                j++;
-                        }
-
-                        udev_device_unref(ud);
-                }
+                char **fields, **f;
+
+                fields = server_get_kernel_device(s, kernel_device);
+                STRV_FOREACH(f, fields)
+                        IOVEC_SET_STRING(iovec[n++], *f);
         }
 
-        if (asprintf(&source_time, "_SOURCE_MONOTONIC_TIMESTAMP=%llu", usec) >= 0)
-                IOVEC_SET_STRING(iovec[n++], source_time);
+        xsprintf(source_time, "_SOURCE_MONOTONIC_TIMESTAMP=%llu", usec);
+        IOVEC_SET_STRING(iovec[n++], source_time);
 
         IOVEC_SET_STRING(iovec[n++], "_TRANSPORT=kernel");
 
-        if (asprintf(&syslog_priority, "PRIORITY=%i", priority & LOG_PRIMASK) >= 0)
-                IOVEC_SET_STRING(iovec[n++], syslog_priority);
+        xsprintf(syslog_priority, "PRIORITY=%i", priority & LOG_PRIMASK);
+        IOVEC_SET_STRING(iovec[n++], syslog_priority);
 
-        if (asprintf(&syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority)) >= 0)
-                IOVEC_SET_STRING(iovec[n++], syslog_facility);
+        xsprintf(syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority));
+        IOVEC_SET_STRING(iovec[n++], syslog_facility);
 
         if ((priority & LOG_FACMASK) == LOG_KERN)
                 IOVEC_SET_STRING(iovec[n++], "SYSLOG_IDENTIFIER=kernel");
@@ -303,6 +409,7 @@ static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         if (cunescape_length_with_prefix(p, pl, "MESSAGE=", UNESCAPE_RELAX, &message) >= 0)
                 IOVEC_SET_STRING(iovec[n++], message);
 
+        s->statistics.n_messages[JOURNAL_SOURCE_KMSG]++;
         server_dispatch_message(s, iovec, n, ELEMENTSOF(iovec), NULL, NULL, NULL, 0, NULL, priority, 0);
 
 finish:
@@ -310,11 +417,8 @@ finish:
                 free(iovec[j].iov_base);
 
         free(message);
-        free(syslog_priority);
         free(syslog_identifier);
         free(syslog_pid);
-        free(syslog_facility);
-        free(source_time);
         free(identifier);
         free(pid);
 }
@@ -338,9 +442,17 @@ static int server_read_dev_kmsg(Server *s) {
                         return 0;
                 }
 
-                if (errno == EAGAIN || errno == EINTR || errno == EPIPE)
+                if (errno == EAGAIN)
                         return 0;
 
+                /* EPIPE tells us once that the kernel dropped records
+                 * we did not get to, the next read continues with the
+                 * oldest one still around. Hence, just like after
+                 * EINTR, there is more to read: return 1, so that
+                 * callers draining the buffer keep going. */
+                if (errno == EINTR || errno == EPIPE)
+                        return 1;
+
                 log_error_errno(errno, "Failed to read from kernel: %m");
                 return -errno;
         }
@@ -376,18 +488,31 @@ int server_flush_dev_kmsg(Server *s) {
 
 static int dispatch_dev_kmsg(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
         Server *s = userdata;
+        bool overrun;
+        unsigned i;
+        int r;
 
         assert(es);
         assert(fd == s->dev_kmsg_fd);
         assert(s);
 
-        if (revents & EPOLLERR)
+        overrun = revents & EPOLLERR;
+        if (overrun)
                 log_warning("/dev/kmsg buffer overrun, some messages lost.");
 
         if (!(revents & EPOLLIN))
                 log_error("Got invalid event from epoll for /dev/kmsg: %"PRIx32, revents);
 
-        return server_read_dev_kmsg(s);
+        /* Read a number of records at once, and when the kernel
+         * already had to drop some, everything it has, so that we
+         * catch up before the ring buffer wraps again. */
+        for (i = 0; overrun || i < DEV_KMSG_BATCH_MAX; i++) {
+                r = server_read_dev_kmsg(s);
+                if (r <= 0)
+                        return r;
+        }
+
+        return 1;
 }
 
 int server_open_dev_kmsg(Server *s) {
@@ -76,13 +76,13 @@ static bool allow_object_pid(const struct ucred *ucred) {
 
 void server_process_native_message(
                 Server *s,
-                const void *buffer, size_t buffer_size,
+                void *buffer, size_t buffer_size,
                 const struct ucred *ucred,
                 const struct timeval *tv,
                 const char *label, size_t label_len) {
 
         struct iovec *iovec = NULL;
-        unsigned n = 0, j, tn = (unsigned) -1;
+        unsigned n = 0;
         const char *p;
         size_t remaining, m = 0, entry_size = 0;
         int priority = LOG_INFO;
@@ -114,6 +114,7 @@ void server_process_native_message(
                                 continue;
                         }
 
+                        s->statistics.n_messages[JOURNAL_SOURCE_NATIVE]++;
                         server_dispatch_message(s, iovec, n, m, ucred, tv, label, label_len, NULL, priority, object_pid);
                         n = 0;
                         priority = LOG_INFO;
@@ -235,23 +236,21 @@ void server_process_native_message(
                                 break;
                         }
 
-                        k = malloc((e - p) + 1 + l);
-                        if (!k) {
-                                log_oom();
-                                break;
-                        }
-
-                        memcpy(k, p, e - p);
-                        k[e - p] = '=';
-                        memcpy(k + (e - p) + 1, e + 1 + sizeof(uint64_t), l);
-
                         if (valid_user_field(p, e - p, false)) {
+                                /* Turn "NAME\n<size>DATA" into
+                                 * "NAME=DATA" in place, by moving the
+                                 * (short) field name right in front
+                                 * of the data, which might be huge
+                                 * and hence is not copied. */
+                                k = (char*) p + sizeof(uint64_t);
+                                memmove(k, p, e - p);
+                                k[e - p] = '=';
+
                                 iovec[n].iov_base = k;
                                 iovec[n].iov_len = (e - p) + 1 + l;
                                 entry_size += iovec[n].iov_len;
                                 n++;
-                        } else
-                                free(k);
+                        }
 
                         remaining -= (e - p) + 1 + sizeof(uint64_t) + l + 1;
                         p = e + 1 + sizeof(uint64_t) + l + 1;
@@ -261,8 +260,7 @@ void server_process_native_message(
         if (n <= 0)
                 goto finish;
 
-        tn = n++;
-        IOVEC_SET_STRING(iovec[tn], "_TRANSPORT=journal");
+        IOVEC_SET_STRING(iovec[n++], "_TRANSPORT=journal");
         entry_size += strlen("_TRANSPORT=journal");
 
         if (entry_size + n + 1 > ENTRY_SIZE_MAX) { /* data + separators + trailer */
@@ -285,18 +283,12 @@ void server_process_native_message(
                         server_forward_wall(s, priority, identifier, message, ucred);
         }
 
+        s->statistics.n_messages[JOURNAL_SOURCE_NATIVE]++;
         server_dispatch_message(s, iovec, n, m, ucred, tv, label, label_len, NULL, priority, object_pid);
 
 finish:
-        for (j = 0; j < n; j++)  {
-                if (j == tn)
-                        continue;
-
-                if (iovec[j].iov_base < buffer ||
-                    (const uint8_t*) iovec[j].iov_base >= (const uint8_t*) buffer + buffer_size)
-                        free(iovec[j].iov_base);
-        }
-
+        /* All fields point into the buffer, only the array needs to
+         * be freed */
         free(iovec);
         free(identifier);
         free(message);
@@ -309,8 +301,10 @@ void server_process_native_file(
                 const struct timeval *tv,
                 const char *label, size_t label_len) {
 
+        _cleanup_free_ void *buf = NULL;
         struct stat st;
         bool sealed;
+        ssize_t n;
         int r;
 
         /* Data is in the passed fd, since it didn't fit in a
@@ -380,37 +374,37 @@ void server_process_native_file(
                 void *p;
                 size_t ps;
 
-                /* The file is sealed, we can just map it and use it. */
+                /* The file is sealed, we can just map it and use it. We
+                 * map it writable, but private, so that binary fields
+                 * can be rewritten in place. Only the touched pages get
+                 * copied. */
 
                 ps = PAGE_ALIGN(st.st_size);
-                p = mmap(NULL, ps, PROT_READ, MAP_PRIVATE, fd, 0);
-                if (p == MAP_FAILED) {
-                        log_error_errno(errno, "Failed to map memfd, ignoring: %m");
+                p = mmap(NULL, ps, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                        server_process_native_message(s, p, st.st_size, ucred, tv, label, label_len);
+                        assert_se(munmap(p, ps) >= 0);
                         return;
                 }
 
-                server_process_native_message(s, p, st.st_size, ucred, tv, label, label_len);
-                assert_se(munmap(p, ps) >= 0);
-        } else {
-                _cleanup_free_ void *p = NULL;
-                ssize_t n;
-
-                /* The file is not sealed, we can't map the file here, since
-                 * clients might then truncate it and trigger a SIGBUS for
-                 * us. So let's stupidly read it */
+                log_debug_errno(errno, "Failed to map memfd, reading it instead: %m");
+        }
 
-                p = malloc(st.st_size);
-                if (!p) {
-                        log_oom();
-                        return;
-                }
+        /* The file is not sealed, we can't map the file here, since
+         * clients might then truncate it and trigger a SIGBUS for
+         * us. So let's stupidly read it */
 
-                n = pread(fd, p, st.st_size, 0);
-                if (n < 0)
-                        log_error_errno(n, "Failed to read file, ignoring: %m");
-                else if (n > 0)
-                        server_process_native_message(s, p, n, ucred, tv, label, label_len);
+        buf = malloc(st.st_size);
+        if (!buf) {
+                log_oom();
+                return;
         }
+
+        n = pread(fd, buf, st.st_size, 0);
+        if (n < 0)
+                log_error_errno(n, "Failed to read file, ignoring: %m");
+        else if (n > 0)
+                server_process_native_message(s, buf, n, ucred, tv, label, label_len);
 }
 
 int server_open_native_socket(Server*s) {
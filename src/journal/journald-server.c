@@ -24,6 +24,7 @@
 #include <linux/sockios.h>
 #include <sys/statvfs.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #ifdef HAVE_SELINUX
 #include <selinux/selinux.h>
@@ -36,6 +37,7 @@
 #include "sd-daemon.h"
 #include "mkdir.h"
 #include "rm-rf.h"
+#include "fileio.h"
 #include "hashmap.h"
 #include "journal-file.h"
 #include "socket-util.h"
@@ -57,17 +59,42 @@
 #include "journald-stream.h"
 #include "journald-native.h"
 #include "journald-audit.h"
+#include "journald-statistics.h"
+#include "journald-context.h"
 #include "journald-server.h"
 
 #define USER_JOURNALS_MAX 1024
 
 #define DEFAULT_SYNC_INTERVAL_USEC (5*USEC_PER_MINUTE)
+
+/* How long a critical message waits for others to share its sync */
+#define SYNC_CRITICAL_DELAY_USEC (10*USEC_PER_MSEC)
+
 #define DEFAULT_RATE_LIMIT_INTERVAL (30*USEC_PER_SEC)
 #define DEFAULT_RATE_LIMIT_BURST 1000
 #define DEFAULT_MAX_FILE_USEC USEC_PER_MONTH
 
 #define RECHECK_AVAILABLE_SPACE_USEC (30*USEC_PER_SEC)
 
+/* Warn once every 30s per target if we missed forwarding messages */
+#define WARN_FORWARD_MISSED_USEC (30*USEC_PER_SEC)
+
+/* How long to trust the cached metadata of a client process */
+#define CLIENT_CONTEXT_TTL_USEC (1*USEC_PER_SEC)
+
+/* Limits for the entries we collect before writing them out in one
+ * batch. Anything bigger than PENDING_DATA_MAX is written right away */
+#define PENDING_ENTRIES_MAX 64U
+#define PENDING_DATA_MAX (256U*1024U)
+
+/* How many datagrams to read per wakeup, and how much space to reserve
+ * for each of them when receiving audit messages in one go */
+#define DATAGRAM_BATCH_MAX 16U
+#define DATAGRAM_BATCH_SLOT_SIZE (64U*1024U)
+
+/* How many entries to copy from /run to /var per event loop iteration */
+#define FLUSH_ENTRIES_MAX 1024U
+
 static const char* const storage_table[_STORAGE_MAX] = {
         [STORAGE_AUTO] = "auto",
         [STORAGE_VOLATILE] = "volatile",
@@ -87,6 +114,18 @@ static const char* const split_mode_table[_SPLIT_MAX] = {
 DEFINE_STRING_TABLE_LOOKUP(split_mode, SplitMode);
 DEFINE_CONFIG_PARSE_ENUM(config_parse_split_mode, split_mode, SplitMode, "Failed to parse split mode setting");
 
+static int get_vacuum_directory(VacuumDirectory **d, const char *path) {
+        assert(d);
+        assert(path);
+
+        /* The directory might not exist yet, in which case we try
+         * again next time. */
+        if (*d)
+                return 0;
+
+        return vacuum_directory_new(d, path, true);
+}
+
 static uint64_t available_space(Server *s, bool verbose) {
         char ids[33];
         _cleanup_free_ char *p = NULL;
@@ -94,10 +133,10 @@ static uint64_t available_space(Server *s, bool verbose) {
         struct statvfs ss;
         uint64_t sum = 0, ss_avail = 0, avail = 0;
         int r;
-        _cleanup_closedir_ DIR *d = NULL;
         usec_t ts;
         const char *f;
         JournalMetrics *m;
+        VacuumDirectory **d;
 
         ts = now(CLOCK_MONOTONIC);
 
@@ -112,9 +151,11 @@ static uint64_t available_space(Server *s, bool verbose) {
         if (s->system_journal) {
                 f = "/var/log/journal/";
                 m = &s->system_metrics;
+                d = &s->system_vacuum_directory;
         } else {
                 f = "/run/log/journal/";
                 m = &s->runtime_metrics;
+                d = &s->runtime_vacuum_directory;
         }
 
         assert(m);
@@ -123,37 +164,16 @@ static uint64_t available_space(Server *s, bool verbose) {
         if (!p)
                 return 0;
 
-        d = opendir(p);
-        if (!d)
+        r = get_vacuum_directory(d, p);
+        if (r < 0)
                 return 0;
 
-        if (fstatvfs(dirfd(d), &ss) < 0)
+        if (statvfs(p, &ss) < 0)
                 return 0;
 
-        for (;;) {
-                struct stat st;
-                struct dirent *de;
-
-                errno = 0;
-                de = readdir(d);
-                if (!de && errno != 0)
-                        return 0;
-
-                if (!de)
-                        break;
-
-                if (!endswith(de->d_name, ".journal") &&
-                    !endswith(de->d_name, ".journal~"))
-                        continue;
-
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
-                        continue;
-
-                if (!S_ISREG(st.st_mode))
-                        continue;
-
-                sum += (uint64_t) st.st_blocks * 512UL;
-        }
+        r = vacuum_directory_get_usage(*d, &sum);
+        if (r < 0)
+                return 0;
 
         ss_avail = ss.f_bsize * ss.f_bavail;
 
@@ -347,14 +367,18 @@ void server_sync(Server *s) {
         Iterator i;
         int r;
 
+        server_flush_pending(s);
+
         if (s->system_journal) {
-                r = journal_file_set_offline(s->system_journal);
+                s->system_journal->offline_notify_fd = s->sync_notify_fd;
+                r = journal_file_set_offline(s->system_journal, false);
                 if (r < 0)
                         log_error_errno(r, "Failed to sync system journal: %m");
         }
 
         ORDERED_HASHMAP_FOREACH_KEY(f, k, s->user_journals, i) {
-                r = journal_file_set_offline(f);
+                f->offline_notify_fd = s->sync_notify_fd;
+                r = journal_file_set_offline(f, false);
                 if (r < 0)
                         log_error_errno(r, "Failed to sync user journal: %m");
         }
@@ -373,7 +397,8 @@ static void do_vacuum(
                 const char *id,
                 JournalFile *f,
                 const char* path,
-                JournalMetrics *metrics) {
+                JournalMetrics *metrics,
+                VacuumDirectory **d) {
 
         const char *p;
         int r;
@@ -382,7 +407,10 @@ static void do_vacuum(
                 return;
 
         p = strjoina(path, id);
-        r = journal_directory_vacuum(p, metrics->max_use, s->max_retention_usec, &s->oldest_file_usec, false);
+
+        r = get_vacuum_directory(d, p);
+        if (r >= 0)
+                r = vacuum_directory_vacuum(*d, metrics->max_use, s->max_retention_usec, &s->oldest_file_usec, false);
         if (r < 0 && r != -ENOENT)
                 log_error_errno(r, "Failed to vacuum %s: %m", p);
 }
@@ -403,8 +431,8 @@ void server_vacuum(Server *s) {
         }
         sd_id128_to_string(machine, ids);
 
-        do_vacuum(s, ids, s->system_journal, "/var/log/journal/", &s->system_metrics);
-        do_vacuum(s, ids, s->runtime_journal, "/run/log/journal/", &s->runtime_metrics);
+        do_vacuum(s, ids, s->system_journal, "/var/log/journal/", &s->system_metrics, &s->system_vacuum_directory);
+        do_vacuum(s, ids, s->runtime_journal, "/run/log/journal/", &s->runtime_metrics, &s->runtime_vacuum_directory);
 
         s->cached_available_space_timestamp = 0;
 }
@@ -488,15 +516,28 @@ static bool shall_try_append_again(JournalFile *f, int r) {
         return true;
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+static void account_written(Server *s, const JournalEntry *entries, unsigned n) {
+        unsigned i;
+
+        s->statistics.n_entries_written += n;
+
+        for (i = 0; i < n; i++)
+                s->statistics.bytes_written += IOVEC_TOTAL_SIZE(entries[i].iovec, entries[i].n_iovec);
+}
+
+static void write_entries_to_journal(Server *s, uid_t uid, const JournalEntry *entries, unsigned n, int priority) {
         JournalFile *f;
-        bool vacuumed = false;
+        bool vacuumed = false, written = false;
+        unsigned k;
+        nsec_t start;
         int r;
 
         assert(s);
-        assert(iovec);
+        assert(entries);
         assert(n > 0);
 
+        start = now_nsec(CLOCK_MONOTONIC);
+
         f = find_journal(s, uid);
         if (!f)
                 return;
@@ -512,30 +553,259 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned
                         return;
         }
 
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r >= 0) {
+        while (n > 0) {
+                r = journal_file_append_entries(f, entries, n, &s->seqnum, &k);
+                if (k > 0) {
+                        account_written(s, entries, k);
+                        written = true;
+                }
+                if (r >= 0)
+                        break;
+
+                entries += k;
+                n -= k;
+
+                if (vacuumed || !shall_try_append_again(f, r)) {
+                        if (vacuumed)
+                                log_error_errno(r, "Failed to write entry (%u items, %zu bytes) despite vacuuming, ignoring: %m",
+                                                entries->n_iovec, IOVEC_TOTAL_SIZE(entries->iovec, entries->n_iovec));
+                        else
+                                log_error_errno(r, "Failed to write entry (%u items, %zu bytes), ignoring: %m",
+                                                entries->n_iovec, IOVEC_TOTAL_SIZE(entries->iovec, entries->n_iovec));
+
+                        entries++;
+                        n--;
+                        continue;
+                }
+
+                server_rotate(s);
+                server_vacuum(s);
+                vacuumed = true;
+
+                f = find_journal(s, uid);
+                if (!f)
+                        break;
+
+                log_debug("Retrying write.");
+        }
+
+        if (written)
                 server_schedule_sync(s, priority);
+
+        histogram_add(&s->statistics.write, now_nsec(CLOCK_MONOTONIC) - start);
+}
+
+static void pending_queue_done(PendingQueue *q) {
+        assert(q);
+
+        free(q->entries);
+        free(q->iovec);
+        free(q->data);
+        zero(*q);
+}
+
+static bool same_destination(Server *s, uid_t a, uid_t b) {
+        assert(s);
+
+        /* Whether find_journal() picks the same file for both UIDs,
+         * without opening any */
+        if (s->runtime_journal)
+                return true;
+
+        if (a <= SYSTEM_UID_MAX || b <= SYSTEM_UID_MAX)
+                return a <= SYSTEM_UID_MAX && b <= SYSTEM_UID_MAX;
+
+        return a == b;
+}
+
+void server_flush_pending(Server *s) {
+        PendingQueue q;
+        JournalEntry *entries;
+        size_t i, j;
+
+        assert(s);
+
+        if (s->pending.n_entries == 0 || s->flushing_pending)
                 return;
+
+        s->flushing_pending = true;
+
+        /* Take the queue over, entries that are queued while we
+         * write end up in the next batch and must not move the data
+         * we are writing from */
+        q = s->pending;
+        zero(s->pending);
+
+        /* Now that the data buffer will not move anymore, turn the
+         * offsets into pointers */
+        for (i = 0; i < q.n_iovec; i++)
+                q.iovec[i].iov_base = q.data + (uintptr_t) q.iovec[i].iov_base;
+
+        entries = newa(JournalEntry, q.n_entries);
+        for (i = 0; i < q.n_entries; i++) {
+                entries[i].ts = q.entries[i].ts;
+                entries[i].seqnum = q.entries[i].seqnum;
+                entries[i].iovec = q.iovec + q.entries[i].iovec_idx;
+                entries[i].n_iovec = q.entries[i].n_iovec;
         }
 
-        if (vacuumed || !shall_try_append_again(f, r)) {
-                log_error_errno(r, "Failed to write entry (%d items, %zu bytes), ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-                return;
+        /* Write the entries strictly in the order they arrived in:
+         * several UIDs may end up in the same file, and each file
+         * only takes entries with increasing timestamps. Each run of
+         * entries for the same file is written as one batch. */
+        for (i = 0; i < q.n_entries; i = j) {
+                int priority = q.entries[i].priority;
+
+                for (j = i + 1; j < q.n_entries; j++) {
+                        if (!same_destination(s, q.entries[i].uid, q.entries[j].uid))
+                                break;
+
+                        priority = MIN(priority, q.entries[j].priority);
+                }
+
+                write_entries_to_journal(s, q.entries[i].uid, entries + i, j - i, priority);
         }
 
-        server_rotate(s);
-        server_vacuum(s);
+        /* Keep the buffers around for the next burst */
+        if (s->pending.n_entries == 0) {
+                pending_queue_done(&s->pending);
+                s->pending = q;
+                s->pending.n_entries = s->pending.n_iovec = s->pending.data_size = 0;
+        } else
+                pending_queue_done(&q);
+
+        s->flushing_pending = false;
+
+        if (s->pending.n_entries == 0 && s->pending_event_source)
+                (void) sd_event_source_set_enabled(s->pending_event_source, SD_EVENT_OFF);
+}
+
+static int dispatch_pending(sd_event_source *es, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        server_flush_pending(s);
+        return 0;
+}
+
+static int schedule_pending(Server *s) {
+        int r;
+
+        assert(s);
+
+        if (!s->pending_event_source) {
+                r = sd_event_add_defer(s->event, &s->pending_event_source, dispatch_pending, s);
+                if (r < 0)
+                        return r;
+
+                /* Run only once the socket sources have nothing left
+                 * to read, so that a whole burst ends up in one
+                 * batch */
+                r = sd_event_source_set_priority(s->pending_event_source, SD_EVENT_PRIORITY_NORMAL+20);
+                if (r < 0)
+                        return r;
+        }
+
+        return sd_event_source_set_enabled(s->pending_event_source, SD_EVENT_ONESHOT);
+}
+
+static uint64_t reserve_seqnum(Server *s, uid_t uid) {
+        JournalFile *f;
+        uint64_t r;
+
+        assert(s);
+
+        /* Hand out the same number journal_file_append_entry() would
+         * have picked, had the entry been written right away */
+        r = s->seqnum + 1;
 
         f = find_journal(s, uid);
-        if (!f)
+        if (f && le64toh(f->header->tail_entry_seqnum) + 1 > r)
+                r = le64toh(f->header->tail_entry_seqnum) + 1;
+
+        s->seqnum = r;
+        return r;
+}
+
+static int queue_entry(Server *s, uid_t uid, const struct iovec *iovec, unsigned n, int priority) {
+        PendingQueue *q = &s->pending;
+        PendingEntry *e;
+        size_t size, i;
+
+        assert(s);
+
+        size = IOVEC_TOTAL_SIZE(iovec, n);
+
+        if (!GREEDY_REALLOC(q->entries, q->entries_allocated, q->n_entries + 1) ||
+            !GREEDY_REALLOC(q->iovec, q->iovec_allocated, q->n_iovec + n) ||
+            !GREEDY_REALLOC(q->data, q->data_allocated, q->data_size + size))
+                return -ENOMEM;
+
+        e = q->entries + q->n_entries++;
+        e->uid = uid;
+        e->priority = priority;
+        dual_timestamp_get(&e->ts);
+        e->seqnum = reserve_seqnum(s, uid);
+        e->iovec_idx = q->n_iovec;
+        e->n_iovec = n;
+
+        for (i = 0; i < n; i++) {
+                struct iovec *v = q->iovec + q->n_iovec++;
+
+                memcpy(q->data + q->data_size, iovec[i].iov_base, iovec[i].iov_len);
+                v->iov_base = (void*) (uintptr_t) q->data_size;
+                v->iov_len = iovec[i].iov_len;
+
+                q->data_size += iovec[i].iov_len;
+        }
+
+        return 0;
+}
+
+static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+        JournalEntry e = {};
+
+        assert(s);
+        assert(iovec);
+        assert(n > 0);
+
+        /* Queue the entry, so that a burst of messages is written in
+         * one go. Critical messages are written and synced right
+         * away, and very large ones are not worth copying. */
+        if (priority > LOG_CRIT &&
+            s->pending.data_size + IOVEC_TOTAL_SIZE(iovec, n) <= PENDING_DATA_MAX &&
+            queue_entry(s, uid, iovec, n, priority) >= 0) {
+
+                if (s->pending.n_entries >= PENDING_ENTRIES_MAX ||
+                    schedule_pending(s) < 0)
+                        server_flush_pending(s);
+
                 return;
+        }
 
-        log_debug("Retrying write.");
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r < 0)
-                log_error_errno(r, "Failed to write entry (%d items, %zu bytes) despite vacuuming, ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-        else
-                server_schedule_sync(s, priority);
+        server_flush_pending(s);
+
+        dual_timestamp_get(&e.ts);
+        e.iovec = iovec;
+        e.n_iovec = n;
+
+        write_entries_to_journal(s, uid, &e, 1, priority);
+}
+
+static int server_get_client_context(Server *s, pid_t pid, ClientContext **ret) {
+        usec_t ts;
+
+        assert(s);
+        assert(ret);
+
+        if (pid <= 0)
+                return -EINVAL;
+
+        if (sd_event_now(s->event, CLOCK_MONOTONIC, &ts) < 0)
+                ts = now(CLOCK_MONOTONIC);
+
+        return client_context_get(s->client_contexts, pid, s->cgroup_root, ts, ret);
 }
 
 static void dispatch_message_real(
@@ -556,11 +826,8 @@ static void dispatch_message_real(
                 o_uid[sizeof("OBJECT_UID=") + DECIMAL_STR_MAX(uid_t)],
                 o_gid[sizeof("OBJECT_GID=") + DECIMAL_STR_MAX(gid_t)],
                 o_owner_uid[sizeof("OBJECT_SYSTEMD_OWNER_UID=") + DECIMAL_STR_MAX(uid_t)];
-        uid_t object_uid;
-        gid_t object_gid;
+        ClientContext *context;
         char *x;
-        int r;
-        char *t, *c;
         uid_t realuid = 0, owner = 0, journal_uid;
         bool owner_valid = false;
 #ifdef HAVE_AUDIT
@@ -568,9 +835,6 @@ static void dispatch_message_real(
                 audit_loginuid[sizeof("_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)],
                 o_audit_session[sizeof("OBJECT_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
                 o_audit_loginuid[sizeof("OBJECT_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)];
-
-        uint32_t audit;
-        uid_t loginuid;
 #endif
 
         assert(s);
@@ -589,95 +853,79 @@ static void dispatch_message_real(
 
                 sprintf(gid, "_GID="GID_FMT, ucred->gid);
                 IOVEC_SET_STRING(iovec[n++], gid);
+        }
+
+        if (ucred && server_get_client_context(s, ucred->pid, &context) >= 0) {
 
-                r = get_process_comm(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_COMM=", t);
-                        free(t);
+                if (context->comm) {
+                        x = strjoina("_COMM=", context->comm);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_exe(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_EXE=", t);
-                        free(t);
+                if (context->exe) {
+                        x = strjoina("_EXE=", context->exe);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_cmdline(ucred->pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strjoina("_CMDLINE=", t);
-                        free(t);
+                if (context->cmdline) {
+                        x = strjoina("_CMDLINE=", context->cmdline);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_capeff(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_CAP_EFFECTIVE=", t);
-                        free(t);
+                if (context->capeff) {
+                        x = strjoina("_CAP_EFFECTIVE=", context->capeff);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
 #ifdef HAVE_AUDIT
-                r = audit_session_from_pid(ucred->pid, &audit);
-                if (r >= 0) {
-                        sprintf(audit_session, "_AUDIT_SESSION=%"PRIu32, audit);
+                if (context->audit_session_valid) {
+                        sprintf(audit_session, "_AUDIT_SESSION=%"PRIu32, context->audit_session);
                         IOVEC_SET_STRING(iovec[n++], audit_session);
                 }
 
-                r = audit_loginuid_from_pid(ucred->pid, &loginuid);
-                if (r >= 0) {
-                        sprintf(audit_loginuid, "_AUDIT_LOGINUID="UID_FMT, loginuid);
+                if (context->audit_loginuid_valid) {
+                        sprintf(audit_loginuid, "_AUDIT_LOGINUID="UID_FMT, context->audit_loginuid);
                         IOVEC_SET_STRING(iovec[n++], audit_loginuid);
                 }
 #endif
 
-                r = cg_pid_get_path_shifted(ucred->pid, s->cgroup_root, &c);
-                if (r >= 0) {
-                        char *session = NULL;
-
-                        x = strjoina("_SYSTEMD_CGROUP=", c);
+                if (context->cgroup) {
+                        x = strjoina("_SYSTEMD_CGROUP=", context->cgroup);
                         IOVEC_SET_STRING(iovec[n++], x);
 
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                session = strjoina("_SYSTEMD_SESSION=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], session);
+                        if (context->session) {
+                                x = strjoina("_SYSTEMD_SESSION=", context->session);
+                                IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
+                        if (context->owner_uid_valid) {
                                 owner_valid = true;
+                                owner = context->owner_uid;
 
                                 sprintf(owner_uid, "_SYSTEMD_OWNER_UID="UID_FMT, owner);
                                 IOVEC_SET_STRING(iovec[n++], owner_uid);
                         }
 
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_UNIT=", t);
-                                free(t);
+                        if (context->unit) {
+                                x = strjoina("_SYSTEMD_UNIT=", context->unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && !session) {
+                        } else if (unit_id && !context->session) {
                                 x = strjoina("_SYSTEMD_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_USER_UNIT=", t);
-                                free(t);
+                        if (context->user_unit) {
+                                x = strjoina("_SYSTEMD_USER_UNIT=", context->user_unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && session) {
+                        } else if (unit_id && context->session) {
                                 x = strjoina("_SYSTEMD_USER_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_slice(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_SLICE=", t);
-                                free(t);
+                        if (context->slice) {
+                                x = strjoina("_SYSTEMD_SLICE=", context->slice);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
-
-                        free(c);
                 } else if (unit_id) {
                         x = strjoina("_SYSTEMD_UNIT=", unit_id);
                         IOVEC_SET_STRING(iovec[n++], x);
@@ -690,99 +938,79 @@ static void dispatch_message_real(
 
                                 *((char*) mempcpy(stpcpy(x, "_SELINUX_CONTEXT="), label, label_len)) = 0;
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else {
-                                security_context_t con;
-
-                                if (getpidcon(ucred->pid, &con) >= 0) {
-                                        x = strjoina("_SELINUX_CONTEXT=", con);
-
-                                        freecon(con);
-                                        IOVEC_SET_STRING(iovec[n++], x);
-                                }
+                        } else if (context->label) {
+                                x = strjoina("_SELINUX_CONTEXT=", context->label);
+                                IOVEC_SET_STRING(iovec[n++], x);
                         }
                 }
 #endif
+        } else if (ucred && unit_id) {
+                x = strjoina("_SYSTEMD_UNIT=", unit_id);
+                IOVEC_SET_STRING(iovec[n++], x);
         }
         assert(n <= m);
 
-        if (object_pid) {
-                r = get_process_uid(object_pid, &object_uid);
-                if (r >= 0) {
-                        sprintf(o_uid, "OBJECT_UID="UID_FMT, object_uid);
+        if (object_pid && server_get_client_context(s, object_pid, &context) >= 0) {
+                if (context->uid_valid) {
+                        sprintf(o_uid, "OBJECT_UID="UID_FMT, context->uid);
                         IOVEC_SET_STRING(iovec[n++], o_uid);
                 }
 
-                r = get_process_gid(object_pid, &object_gid);
-                if (r >= 0) {
-                        sprintf(o_gid, "OBJECT_GID="GID_FMT, object_gid);
+                if (context->gid_valid) {
+                        sprintf(o_gid, "OBJECT_GID="GID_FMT, context->gid);
                         IOVEC_SET_STRING(iovec[n++], o_gid);
                 }
 
-                r = get_process_comm(object_pid, &t);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_COMM=", t);
-                        free(t);
+                if (context->comm) {
+                        x = strjoina("OBJECT_COMM=", context->comm);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_exe(object_pid, &t);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_EXE=", t);
-                        free(t);
+                if (context->exe) {
+                        x = strjoina("OBJECT_EXE=", context->exe);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_cmdline(object_pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_CMDLINE=", t);
-                        free(t);
+                if (context->cmdline) {
+                        x = strjoina("OBJECT_CMDLINE=", context->cmdline);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
 #ifdef HAVE_AUDIT
-                r = audit_session_from_pid(object_pid, &audit);
-                if (r >= 0) {
-                        sprintf(o_audit_session, "OBJECT_AUDIT_SESSION=%"PRIu32, audit);
+                if (context->audit_session_valid) {
+                        sprintf(o_audit_session, "OBJECT_AUDIT_SESSION=%"PRIu32, context->audit_session);
                         IOVEC_SET_STRING(iovec[n++], o_audit_session);
                 }
 
-                r = audit_loginuid_from_pid(object_pid, &loginuid);
-                if (r >= 0) {
-                        sprintf(o_audit_loginuid, "OBJECT_AUDIT_LOGINUID="UID_FMT, loginuid);
+                if (context->audit_loginuid_valid) {
+                        sprintf(o_audit_loginuid, "OBJECT_AUDIT_LOGINUID="UID_FMT, context->audit_loginuid);
                         IOVEC_SET_STRING(iovec[n++], o_audit_loginuid);
                 }
 #endif
 
-                r = cg_pid_get_path_shifted(object_pid, s->cgroup_root, &c);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_SYSTEMD_CGROUP=", c);
+                if (context->cgroup) {
+                        x = strjoina("OBJECT_SYSTEMD_CGROUP=", context->cgroup);
                         IOVEC_SET_STRING(iovec[n++], x);
 
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                x = strjoina("OBJECT_SYSTEMD_SESSION=", t);
-                                free(t);
+                        if (context->session) {
+                                x = strjoina("OBJECT_SYSTEMD_SESSION=", context->session);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
-                                sprintf(o_owner_uid, "OBJECT_SYSTEMD_OWNER_UID="UID_FMT, owner);
+                        if (context->owner_uid_valid) {
+                                sprintf(o_owner_uid, "OBJECT_SYSTEMD_OWNER_UID="UID_FMT, context->owner_uid);
                                 IOVEC_SET_STRING(iovec[n++], o_owner_uid);
                         }
 
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strjoina("OBJECT_SYSTEMD_UNIT=", t);
-                                free(t);
+                        if (context->unit) {
+                                x = strjoina("OBJECT_SYSTEMD_UNIT=", context->unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strjoina("OBJECT_SYSTEMD_USER_UNIT=", t);
-                                free(t);
+                        if (context->user_unit) {
+                                x = strjoina("OBJECT_SYSTEMD_USER_UNIT=", context->user_unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
-
-                        free(c);
                 }
         }
         assert(n <= m);
@@ -851,10 +1079,11 @@ void server_driver_message(Server *s, sd_id128_t message_id, const char *format,
         ucred.uid = getuid();
         ucred.gid = getgid();
 
+        s->statistics.n_messages[JOURNAL_SOURCE_DRIVER]++;
         dispatch_message_real(s, iovec, n, ELEMENTSOF(iovec), &ucred, NULL, NULL, 0, NULL, LOG_INFO, 0);
 }
 
-void server_dispatch_message(
+static void dispatch_message_rate_limited(
                 Server *s,
                 struct iovec *iovec, unsigned n, unsigned m,
                 const struct ucred *ucred,
@@ -868,20 +1097,6 @@ void server_dispatch_message(
         _cleanup_free_ char *path = NULL;
         char *c;
 
-        assert(s);
-        assert(iovec || n == 0);
-
-        if (n == 0)
-                return;
-
-        if (LOG_PRI(priority) > s->max_level_store)
-                return;
-
-        /* Stop early in case the information will not be stored
-         * in a journal. */
-        if (s->storage == STORAGE_NONE)
-                return;
-
         if (!ucred)
                 goto finish;
 
@@ -908,8 +1123,10 @@ void server_dispatch_message(
         rl = journal_rate_limit_test(s->rate_limit, path,
                                      priority & LOG_PRIMASK, available_space(s, false));
 
-        if (rl == 0)
+        if (rl == 0) {
+                s->statistics.n_rate_limited++;
                 return;
+        }
 
         /* Write a suppression message if we suppressed something */
         if (rl > 1)
@@ -920,6 +1137,37 @@ finish:
         dispatch_message_real(s, iovec, n, m, ucred, tv, label, label_len, unit_id, priority, object_pid);
 }
 
+void server_dispatch_message(
+                Server *s,
+                struct iovec *iovec, unsigned n, unsigned m,
+                const struct ucred *ucred,
+                const struct timeval *tv,
+                const char *label, size_t label_len,
+                const char *unit_id,
+                int priority,
+                pid_t object_pid) {
+
+        nsec_t start;
+
+        assert(s);
+        assert(iovec || n == 0);
+
+        if (n == 0)
+                return;
+
+        if (LOG_PRI(priority) > s->max_level_store)
+                return;
+
+        /* Stop early in case the information will not be stored
+         * in a journal. */
+        if (s->storage == STORAGE_NONE)
+                return;
+
+        start = now_nsec(CLOCK_MONOTONIC);
+        dispatch_message_rate_limited(s, iovec, n, m, ucred, tv, label, label_len, unit_id, priority, object_pid);
+        histogram_add(&s->statistics.dispatch, now_nsec(CLOCK_MONOTONIC) - start);
+}
+
 
 static int system_journal_open(Server *s, bool flush_requested) {
         int r;
@@ -1011,171 +1259,238 @@ static int system_journal_open(Server *s, bool flush_requested) {
         return r;
 }
 
-int server_flush_to_var(Server *s) {
-        sd_id128_t machine;
-        sd_journal *j = NULL;
-        char ts[FORMAT_TIMESPAN_MAX];
-        usec_t start;
-        unsigned n = 0;
-        int r;
-
+static void server_flush_to_var_done(Server *s) {
         assert(s);
 
-        if (s->storage != STORAGE_AUTO &&
-            s->storage != STORAGE_PERSISTENT)
-                return 0;
-
-        if (!s->runtime_journal)
-                return 0;
-
-        system_journal_open(s, true);
-
-        if (!s->system_journal)
-                return 0;
+        server_sync(s);
+        server_vacuum(s);
 
-        log_debug("Flushing to /var...");
+        touch("/run/systemd/journal/flushed");
+}
 
-        start = now(CLOCK_MONOTONIC);
+static int server_flush_to_var_step(Server *s, unsigned max) {
+        unsigned k;
+        int r;
 
-        r = sd_id128_get_machine(&machine);
-        if (r < 0)
-                return r;
+        assert(s);
+        assert(s->flush_journal);
 
-        r = sd_journal_open(&j, SD_JOURNAL_RUNTIME_ONLY);
-        if (r < 0)
-                return log_error_errno(r, "Failed to read runtime journal: %m");
+        /* Copies up to max entries, returns > 0 if there are more,
+         * 0 once we caught up with the runtime journal. */
 
-        sd_journal_set_data_threshold(j, 0);
+        /* Pick up runtime files that were rotated in the meantime */
+        (void) sd_journal_process(s->flush_journal);
 
-        SD_JOURNAL_FOREACH(j) {
+        for (k = 0; k < max; k++) {
                 Object *o = NULL;
                 JournalFile *f;
 
-                f = j->current_file;
+                r = sd_journal_next(s->flush_journal);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to iterate runtime journal: %m");
+                if (r == 0) {
+                        /* Messages that arrived while we were
+                         * flushing went to the runtime journal, or
+                         * are still queued for it. Write those out
+                         * and copy them too, before closing it. */
+                        if (s->pending.n_entries == 0)
+                                return 0;
+
+                        server_flush_pending(s);
+                        continue;
+                }
+
+                f = s->flush_journal->current_file;
                 assert(f && f->current_offset > 0);
 
-                n++;
+                s->flush_n_entries++;
 
                 r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
-                if (r < 0) {
-                        log_error_errno(r, "Can't read entry: %m");
-                        goto finish;
-                }
+                if (r < 0)
+                        return log_error_errno(r, "Can't read entry: %m");
 
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL, NULL, NULL);
+                r = journal_file_copy_entry_mapped(f, s->system_journal, o, f->current_offset, s->flush_copy_map, NULL, NULL, NULL);
                 if (r >= 0)
                         continue;
 
-                if (!shall_try_append_again(s->system_journal, r)) {
-                        log_error_errno(r, "Can't write entry: %m");
-                        goto finish;
-                }
+                if (!shall_try_append_again(s->system_journal, r))
+                        return log_error_errno(r, "Can't write entry: %m");
 
                 server_rotate(s);
                 server_vacuum(s);
 
                 if (!s->system_journal) {
                         log_notice("Didn't flush runtime journal since rotation of system journal wasn't successful.");
-                        r = -EIO;
-                        goto finish;
+                        return -EIO;
                 }
 
                 log_debug("Retrying write.");
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL, NULL, NULL);
-                if (r < 0) {
-                        log_error_errno(r, "Can't write entry: %m");
-                        goto finish;
-                }
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                if (r < 0)
+                        return log_error_errno(r, "Can't read entry: %m");
+
+                r = journal_file_copy_entry_mapped(f, s->system_journal, o, f->current_offset, s->flush_copy_map, NULL, NULL, NULL);
+                if (r < 0)
+                        return log_error_errno(r, "Can't write entry: %m");
         }
 
-finish:
-        journal_file_post_change(s->system_journal);
+        return 1;
+}
 
-        journal_file_close(s->runtime_journal);
-        s->runtime_journal = NULL;
+static void server_flush_to_var_finish(Server *s, int r) {
+        char ts[FORMAT_TIMESPAN_MAX];
 
-        if (r >= 0)
-                (void) rm_rf("/run/log/journal", REMOVE_ROOT);
+        assert(s);
 
-        sd_journal_close(j);
+        if (s->system_journal)
+                journal_file_post_change(s->system_journal);
 
-        server_driver_message(s, SD_ID128_NULL, "Time spent on flushing to /var is %s for %u entries.", format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - start, 0), n);
+        if (s->runtime_journal) {
+                journal_file_close(s->runtime_journal);
+                s->runtime_journal = NULL;
+        }
 
-        return r;
+        if (r >= 0)
+                (void) rm_rf("/run/log/journal", REMOVE_ROOT);
+
+        sd_journal_close(s->flush_journal);
+        s->flush_journal = NULL;
+        s->flush_copy_map = journal_copy_map_free(s->flush_copy_map);
+        s->flush_event_source = sd_event_source_unref(s->flush_event_source);
+
+        server_driver_message(s, SD_ID128_NULL, "Time spent on flushing to /var is %s for %u entries.", format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - s->flush_start, 0), s->flush_n_entries);
+
+        if (s->flush_requested) {
+                s->flush_requested = false;
+                server_flush_to_var_done(s);
+        }
 }
 
-int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+static int dispatch_flush_to_var(sd_event_source *es, void *userdata) {
         Server *s = userdata;
-        struct ucred *ucred = NULL;
-        struct timeval *tv = NULL;
-        struct cmsghdr *cmsg;
-        char *label = NULL;
-        size_t label_len = 0, m;
-        struct iovec iovec;
-        ssize_t n;
-        int *fds = NULL, v = 0;
-        unsigned n_fds = 0;
+        int r;
 
-        union {
-                struct cmsghdr cmsghdr;
-
-                /* We use NAME_MAX space for the SELinux label
-                 * here. The kernel currently enforces no
-                 * limit, but according to suggestions from
-                 * the SELinux people this will change and it
-                 * will probably be identical to NAME_MAX. For
-                 * now we use that, but this should be updated
-                 * one day when the final limit is known. */
-                uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
-                            CMSG_SPACE(sizeof(struct timeval)) +
-                            CMSG_SPACE(sizeof(int)) + /* fd */
-                            CMSG_SPACE(NAME_MAX)]; /* selinux label */
-        } control = {};
+        assert(s);
 
-        union sockaddr_union sa = {};
+        r = server_flush_to_var_step(s, FLUSH_ENTRIES_MAX);
+        if (r > 0)
+                return 0;
 
-        struct msghdr msghdr = {
-                .msg_iov = &iovec,
-                .msg_iovlen = 1,
-                .msg_control = &control,
-                .msg_controllen = sizeof(control),
-                .msg_name = &sa,
-                .msg_namelen = sizeof(sa),
-        };
+        server_flush_to_var_finish(s, r);
+        return 0;
+}
+
+int server_flush_to_var(Server *s) {
+        sd_id128_t machine;
+        int r;
 
         assert(s);
-        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
 
-        if (revents != EPOLLIN) {
-                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
-                return -EIO;
-        }
+        /* Copying a large runtime journal takes a while, hence we do
+         * it in chunks from the event loop, so that we keep
+         * processing messages in between. They are written to the
+         * runtime journal until the flush caught up with it. */
 
-        /* Try to get the right size, if we can. (Not all
-         * sockets support SIOCINQ, hence we just try, but
-         * don't rely on it. */
-        (void) ioctl(fd, SIOCINQ, &v);
+        if (s->flush_journal)
+                return 0;
 
-        /* Fix it up, if it is too small. We use the same fixed value as auditd here. Awful! */
-        m = PAGE_ALIGN(MAX3((size_t) v + 1,
-                            (size_t) LINE_MAX,
-                            ALIGN(sizeof(struct nlmsghdr)) + ALIGN((size_t) MAX_AUDIT_MESSAGE_LENGTH)) + 1);
+        if (s->storage != STORAGE_AUTO &&
+            s->storage != STORAGE_PERSISTENT)
+                return 0;
 
-        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, m))
+        if (!s->runtime_journal)
+                return 0;
+
+        server_flush_pending(s);
+
+        system_journal_open(s, true);
+
+        if (!s->system_journal)
+                return 0;
+
+        log_debug("Flushing to /var...");
+
+        r = sd_id128_get_machine(&machine);
+        if (r < 0)
+                return r;
+
+        r = sd_journal_open(&s->flush_journal, SD_JOURNAL_RUNTIME_ONLY);
+        if (r < 0)
+                return log_error_errno(r, "Failed to read runtime journal: %m");
+
+        sd_journal_set_data_threshold(s->flush_journal, 0);
+
+        /* Set up inotify, to notice rotation of the runtime journal
+         * while we are at it */
+        r = sd_journal_get_fd(s->flush_journal);
+        if (r < 0)
+                log_debug_errno(r, "Failed to watch runtime journal, ignoring: %m");
+
+        s->flush_copy_map = journal_copy_map_new();
+        if (!s->flush_copy_map) {
+                sd_journal_close(s->flush_journal);
+                s->flush_journal = NULL;
                 return log_oom();
+        }
 
-        iovec.iov_base = s->buffer;
-        iovec.iov_len = s->buffer_size - 1; /* Leave room for trailing NUL we add later */
+        s->flush_start = now(CLOCK_MONOTONIC);
+        s->flush_n_entries = 0;
 
-        n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
-        if (n < 0) {
-                if (errno == EINTR || errno == EAGAIN)
-                        return 0;
+        /* Same priority as the sockets, so that neither starves the
+         * other */
+        r = sd_event_add_defer(s->event, &s->flush_event_source, dispatch_flush_to_var, s);
+        if (r >= 0)
+                r = sd_event_source_set_priority(s->flush_event_source, SD_EVENT_PRIORITY_NORMAL);
+        if (r >= 0)
+                r = sd_event_source_set_enabled(s->flush_event_source, SD_EVENT_ON);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to schedule flushing in chunks, flushing in one go: %m");
 
-                return log_error_errno(errno, "recvmsg() failed: %m");
+                while ((r = server_flush_to_var_step(s, UINT_MAX)) > 0)
+                        ;
+
+                server_flush_to_var_finish(s, r);
+                return r;
         }
 
-        CMSG_FOREACH(cmsg, &msghdr) {
+        return 0;
+}
+
+/* We use NAME_MAX space for the SELinux label here. The kernel
+ * currently enforces no limit, but according to suggestions from the
+ * SELinux people this will change and it will probably be identical
+ * to NAME_MAX. For now we use that, but this should be updated one
+ * day when the final limit is known. */
+typedef union DatagramControl {
+        struct cmsghdr cmsghdr;
+        uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
+                    CMSG_SPACE(sizeof(struct timeval)) +
+                    CMSG_SPACE(sizeof(int)) + /* fd */
+                    CMSG_SPACE(NAME_MAX)]; /* selinux label */
+} DatagramControl;
+
+struct DatagramBatch {
+        struct mmsghdr msgs[DATAGRAM_BATCH_MAX];
+        struct iovec iovec[DATAGRAM_BATCH_MAX];
+        DatagramControl control[DATAGRAM_BATCH_MAX];
+        union sockaddr_union sa[DATAGRAM_BATCH_MAX];
+        char buffer[DATAGRAM_BATCH_MAX][DATAGRAM_BATCH_SLOT_SIZE + 1]; /* Leave room for trailing NUL we add later */
+};
+
+static void server_dispatch_datagram(Server *s, int fd, struct msghdr *msghdr, char *buffer, size_t n) {
+        struct ucred *ucred = NULL;
+        struct timeval *tv = NULL;
+        struct cmsghdr *cmsg;
+        char *label = NULL;
+        size_t label_len = 0;
+        int *fds = NULL;
+        unsigned n_fds = 0;
+
+        assert(s);
+        assert(msghdr);
+        assert(buffer);
+
+        CMSG_FOREACH(cmsg, msghdr) {
 
                 if (cmsg->cmsg_level == SOL_SOCKET &&
                     cmsg->cmsg_type == SCM_CREDENTIALS &&
@@ -1197,17 +1512,17 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
         }
 
         /* And a trailing NUL, just in case */
-        s->buffer[n] = 0;
+        buffer[n] = 0;
 
         if (fd == s->syslog_fd) {
                 if (n > 0 && n_fds == 0)
-                        server_process_syslog_message(s, strstrip(s->buffer), ucred, tv, label, label_len);
+                        server_process_syslog_message(s, strstrip(buffer), ucred, tv, label, label_len);
                 else if (n_fds > 0)
                         log_warning("Got file descriptors via syslog socket. Ignoring.");
 
         } else if (fd == s->native_fd) {
                 if (n > 0 && n_fds == 0)
-                        server_process_native_message(s, s->buffer, n, ucred, tv, label, label_len);
+                        server_process_native_message(s, buffer, n, ucred, tv, label, label_len);
                 else if (n == 0 && n_fds == 1)
                         server_process_native_file(s, fds[0], ucred, tv, label, label_len);
                 else if (n_fds > 0)
@@ -1217,12 +1532,142 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
                 assert(fd == s->audit_fd);
 
                 if (n > 0 && n_fds == 0)
-                        server_process_audit_message(s, s->buffer, n, ucred, &sa, msghdr.msg_namelen);
+                        server_process_audit_message(s, buffer, n, ucred, msghdr->msg_name, msghdr->msg_namelen);
                 else if (n_fds > 0)
                         log_warning("Got file descriptors via audit socket. Ignoring.");
         }
 
         close_many(fds, n_fds);
+}
+
+static int server_receive_datagram_batch(Server *s, int fd) {
+        DatagramBatch *b;
+        unsigned i;
+        int n;
+
+        assert(s);
+
+        /* Audit messages are bounded in size by the kernel, hence
+         * we can read them into fixed size slots, and receive a
+         * whole series of them with a single system call. */
+
+        if (!s->datagram_batch) {
+                s->datagram_batch = new(DatagramBatch, 1);
+                if (!s->datagram_batch)
+                        return log_oom();
+        }
+
+        b = s->datagram_batch;
+
+        for (i = 0; i < DATAGRAM_BATCH_MAX; i++) {
+                b->iovec[i] = (struct iovec) {
+                        .iov_base = b->buffer[i],
+                        .iov_len = DATAGRAM_BATCH_SLOT_SIZE,
+                };
+
+                b->msgs[i] = (struct mmsghdr) {
+                        .msg_hdr.msg_iov = &b->iovec[i],
+                        .msg_hdr.msg_iovlen = 1,
+                        .msg_hdr.msg_control = &b->control[i],
+                        .msg_hdr.msg_controllen = sizeof(b->control[i]),
+                        .msg_hdr.msg_name = &b->sa[i],
+                        .msg_hdr.msg_namelen = sizeof(b->sa[i]),
+                };
+        }
+
+        n = recvmmsg(fd, b->msgs, DATAGRAM_BATCH_MAX, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+        if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN)
+                        return 0;
+
+                return log_error_errno(errno, "recvmmsg() failed: %m");
+        }
+
+        for (i = 0; i < (unsigned) n; i++) {
+                if (b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                        log_debug("Datagram of more than %zu bytes received, truncating.", (size_t) DATAGRAM_BATCH_SLOT_SIZE);
+
+                server_dispatch_datagram(s, fd, &b->msgs[i].msg_hdr, b->buffer[i], b->msgs[i].msg_len);
+        }
+
+        return n;
+}
+
+static int server_receive_datagram(Server *s, int fd) {
+        union sockaddr_union sa = {};
+        DatagramControl control = {};
+        struct iovec iovec;
+        size_t m;
+        ssize_t n;
+        int v = 0;
+
+        struct msghdr msghdr = {
+                .msg_iov = &iovec,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+                .msg_name = &sa,
+                .msg_namelen = sizeof(sa),
+        };
+
+        assert(s);
+
+        /* Try to get the right size, if we can. (Not all
+         * sockets support SIOCINQ, hence we just try, but
+         * don't rely on it. */
+        (void) ioctl(fd, SIOCINQ, &v);
+
+        /* Fix it up, if it is too small. We use the same fixed value as auditd here. Awful! */
+        m = PAGE_ALIGN(MAX3((size_t) v + 1,
+                            (size_t) LINE_MAX,
+                            ALIGN(sizeof(struct nlmsghdr)) + ALIGN((size_t) MAX_AUDIT_MESSAGE_LENGTH)) + 1);
+
+        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, m))
+                return log_oom();
+
+        iovec.iov_base = s->buffer;
+        iovec.iov_len = s->buffer_size - 1; /* Leave room for trailing NUL we add later */
+
+        n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN)
+                        return 0;
+
+                return log_error_errno(errno, "recvmsg() failed: %m");
+        }
+
+        server_dispatch_datagram(s, fd, &msghdr, s->buffer, n);
+        return 1;
+}
+
+int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+        unsigned i;
+        int r;
+
+        assert(s);
+        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
+
+        if (revents != EPOLLIN) {
+                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
+                return -EIO;
+        }
+
+        if (fd == s->audit_fd) {
+                r = server_receive_datagram_batch(s, fd);
+                return r < 0 ? r : 0;
+        }
+
+        /* Native and syslog messages are only bounded by the send
+         * buffer of the client, hence we size the buffer for each of
+         * them individually, but still drain up to
+         * DATAGRAM_BATCH_MAX of them per wakeup. */
+        for (i = 0; i < DATAGRAM_BATCH_MAX; i++) {
+                r = server_receive_datagram(s, fd);
+                if (r <= 0)
+                        return r;
+        }
+
         return 0;
 }
 
@@ -1234,10 +1679,13 @@ static int dispatch_sigusr1(sd_event_source *es, const struct signalfd_siginfo *
         log_info("Received request to flush runtime journal from PID %"PRIu32, si->ssi_pid);
 
         server_flush_to_var(s);
-        server_sync(s);
-        server_vacuum(s);
 
-        touch("/run/systemd/journal/flushed");
+        /* If the flush is still in progress, we'll finish when it
+         * is done */
+        if (s->flush_journal)
+                s->flush_requested = true;
+        else
+                server_flush_to_var_done(s);
 
         return 0;
 }
@@ -1248,12 +1696,92 @@ static int dispatch_sigusr2(sd_event_source *es, const struct signalfd_siginfo *
         assert(s);
 
         log_info("Received request to rotate journal from PID %"PRIu32, si->ssi_pid);
+        server_flush_pending(s);
         server_rotate(s);
         server_vacuum(s);
 
         return 0;
 }
 
+static bool server_sync_done(Server *s) {
+        JournalFile *f;
+        Iterator i;
+        void *k;
+
+        assert(s);
+
+        if (s->system_journal && !journal_file_set_offline_done(s->system_journal))
+                return false;
+
+        ORDERED_HASHMAP_FOREACH_KEY(f, k, s->user_journals, i)
+                if (!journal_file_set_offline_done(f))
+                        return false;
+
+        return true;
+}
+
+static void server_sync_request_check(Server *s) {
+        char buf[DECIMAL_STR_MAX(usec_t)];
+        int r;
+
+        assert(s);
+
+        if (!s->sync_request_pending)
+                return;
+
+        if (!server_sync_done(s))
+                return;
+
+        s->sync_request_pending = false;
+
+        /* Everything logged before the last request is on disk now,
+         * tell the clients which request that was */
+        xsprintf(buf, USEC_FMT, s->sync_request_usec);
+
+        r = write_string_file("/run/systemd/journal/synced", buf, WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_ATOMIC);
+        if (r < 0)
+                log_warning_errno(r, "Failed to write /run/systemd/journal/synced, ignoring: %m");
+}
+
+static int dispatch_sync_notify(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+        eventfd_t x;
+
+        assert(s);
+
+        /* A background sync finished, see if that was the last one
+         * the pending request was waiting for */
+        (void) eventfd_read(fd, &x);
+
+        server_sync_request_check(s);
+        return 0;
+}
+
+static int dispatch_sigrtmin1(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
+        Server *s = userdata;
+        usec_t n;
+        int r;
+
+        assert(s);
+
+        log_debug("Received request to sync from PID %"PRIu32, si->ssi_pid);
+
+        r = sd_event_now(s->event, CLOCK_MONOTONIC, &n);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get current time: %m");
+
+        s->sync_request_usec = n;
+        s->sync_request_pending = true;
+
+        /* The sync itself happens in the background, and we are
+         * told when it is done, so that a client waiting for it
+         * doesn't hold up everybody else */
+        server_sync(s);
+        server_sync_request_check(s);
+
+        return 0;
+}
+
 static int dispatch_sigterm(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
         Server *s = userdata;
 
@@ -1265,12 +1793,24 @@ static int dispatch_sigterm(sd_event_source *es, const struct signalfd_siginfo *
         return 0;
 }
 
+static int dispatch_sigrtmin2(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        log_debug("Received request to dump statistics from PID %"PRIu32, si->ssi_pid);
+
+        (void) server_dump_statistics(s, "/run/systemd/journal/statistics");
+
+        return 0;
+}
+
 static int setup_signals(Server *s) {
         int r;
 
         assert(s);
 
-        assert(sigprocmask_many(SIG_SETMASK, NULL, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, -1) >= 0);
+        assert(sigprocmask_many(SIG_SETMASK, NULL, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, SIGRTMIN+1, SIGRTMIN+2, -1) >= 0);
 
         r = sd_event_add_signal(s->event, &s->sigusr1_event_source, SIGUSR1, dispatch_sigusr1, s);
         if (r < 0)
@@ -1280,6 +1820,14 @@ static int setup_signals(Server *s) {
         if (r < 0)
                 return r;
 
+        r = sd_event_add_signal(s->event, &s->sigrtmin1_event_source, SIGRTMIN+1, dispatch_sigrtmin1, s);
+        if (r < 0)
+                return r;
+
+        r = sd_event_add_signal(s->event, &s->sigrtmin2_event_source, SIGRTMIN+2, dispatch_sigrtmin2, s);
+        if (r < 0)
+                return r;
+
         r = sd_event_add_signal(s->event, &s->sigterm_event_source, SIGTERM, dispatch_sigterm, s);
         if (r < 0)
                 return r;
@@ -1362,52 +1910,73 @@ static int server_dispatch_sync(sd_event_source *es, usec_t t, void *userdata) {
 }
 
 int server_schedule_sync(Server *s, int priority) {
+        usec_t when, delay, accuracy;
         int r;
 
         assert(s);
 
         if (priority <= LOG_CRIT) {
-                /* Immediately sync to disk when this is of priority CRIT, ALERT, EMERG */
-                server_sync(s);
+                /* Sync to disk right away when this is of priority
+                 * CRIT, ALERT, EMERG, but give the rest of a burst a
+                 * moment to be written, so that it shares the sync */
+                delay = SYNC_CRITICAL_DELAY_USEC;
+                accuracy = 1;
+        } else if (s->sync_interval_usec > 0) {
+                delay = s->sync_interval_usec;
+                accuracy = 0;
+        } else
                 return 0;
-        }
 
-        if (s->sync_scheduled)
-                return 0;
+        r = sd_event_now(s->event, CLOCK_MONOTONIC, &when);
+        if (r < 0)
+                return r;
 
-        if (s->sync_interval_usec > 0) {
-                usec_t when;
+        when += delay;
 
-                r = sd_event_now(s->event, CLOCK_MONOTONIC, &when);
+        if (s->sync_scheduled) {
+                usec_t scheduled;
+
+                /* Only ever move a scheduled sync closer */
+                r = sd_event_source_get_time(s->sync_event_source, &scheduled);
                 if (r < 0)
                         return r;
 
-                when += s->sync_interval_usec;
+                if (scheduled <= when)
+                        return 0;
 
-                if (!s->sync_event_source) {
-                        r = sd_event_add_time(
-                                        s->event,
-                                        &s->sync_event_source,
-                                        CLOCK_MONOTONIC,
-                                        when, 0,
-                                        server_dispatch_sync, s);
-                        if (r < 0)
-                                return r;
+                r = sd_event_source_set_time_accuracy(s->sync_event_source, accuracy);
+                if (r < 0)
+                        return r;
 
-                        r = sd_event_source_set_priority(s->sync_event_source, SD_EVENT_PRIORITY_IMPORTANT);
-                } else {
-                        r = sd_event_source_set_time(s->sync_event_source, when);
-                        if (r < 0)
-                                return r;
+                return sd_event_source_set_time(s->sync_event_source, when);
+        }
 
-                        r = sd_event_source_set_enabled(s->sync_event_source, SD_EVENT_ONESHOT);
-                }
+        if (!s->sync_event_source) {
+                r = sd_event_add_time(
+                                s->event,
+                                &s->sync_event_source,
+                                CLOCK_MONOTONIC,
+                                when, accuracy,
+                                server_dispatch_sync, s);
+                if (r < 0)
+                        return r;
+
+                r = sd_event_source_set_priority(s->sync_event_source, SD_EVENT_PRIORITY_IMPORTANT);
+        } else {
+                r = sd_event_source_set_time(s->sync_event_source, when);
+                if (r < 0)
+                        return r;
+
+                r = sd_event_source_set_time_accuracy(s->sync_event_source, accuracy);
                 if (r < 0)
                         return r;
 
-                s->sync_scheduled = true;
+                r = sd_event_source_set_enabled(s->sync_event_source, SD_EVENT_ONESHOT);
         }
+        if (r < 0)
+                return r;
 
+        s->sync_scheduled = true;
         return 0;
 }
 
@@ -1457,7 +2026,7 @@ int server_init(Server *s) {
         assert(s);
 
         zero(*s);
-        s->syslog_fd = s->native_fd = s->stdout_fd = s->dev_kmsg_fd = s->audit_fd = s->hostname_fd = -1;
+        s->syslog_fd = s->native_fd = s->stdout_fd = s->dev_kmsg_fd = s->audit_fd = s->hostname_fd = s->sync_notify_fd = -1;
         s->compress = true;
         s->seal = true;
 
@@ -1504,6 +2073,10 @@ int server_init(Server *s) {
 
         sd_event_set_watchdog(s->event, true);
 
+        /* Under load we get many log sockets ready at once, handle
+         * them without going through a full loop iteration each. */
+        sd_event_set_dispatch_budget(s->event, 16);
+
         n = sd_listen_fds(true);
         if (n < 0)
                 return log_error_errno(n, "Failed to read listening file descriptors from environment: %m");
@@ -1598,6 +2171,18 @@ int server_init(Server *s) {
         if (r < 0)
                 return r;
 
+        s->sync_notify_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (s->sync_notify_fd < 0)
+                return log_error_errno(errno, "Failed to create sync eventfd: %m");
+
+        r = sd_event_add_io(s->event, &s->sync_notify_event_source, s->sync_notify_fd, EPOLLIN, dispatch_sync_notify, s);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add sync eventfd to event loop: %m");
+
+        r = sd_event_source_set_priority(s->sync_notify_event_source, SD_EVENT_PRIORITY_IMPORTANT);
+        if (r < 0)
+                return log_error_errno(r, "Failed to set priority of sync eventfd: %m");
+
         s->udev = udev_new();
         if (!s->udev)
                 return -ENOMEM;
@@ -1606,6 +2191,10 @@ int server_init(Server *s) {
         if (!s->rate_limit)
                 return -ENOMEM;
 
+        s->client_contexts = client_context_cache_new(CLIENT_CONTEXT_TTL_USEC);
+        if (!s->client_contexts)
+                return -ENOMEM;
+
         r = cg_get_root_path(&s->cgroup_root);
         if (r < 0)
                 return r;
@@ -1637,10 +2226,61 @@ void server_maybe_append_tags(Server *s) {
 #endif
 }
 
+static void maybe_warn_forward_missed(Server *s, const char *target, unsigned *n_missed, usec_t *last_warn, usec_t n) {
+        assert(s);
+        assert(target);
+        assert(n_missed);
+        assert(last_warn);
+
+        if (*n_missed <= 0)
+                return;
+
+        if (*last_warn + WARN_FORWARD_MISSED_USEC > n)
+                return;
+
+        server_driver_message(s, SD_ID128_NULL, "Forwarding to %s missed %u messages.", target, *n_missed);
+
+        *n_missed = 0;
+        *last_warn = n;
+}
+
+void server_maybe_warn_forward_missed(Server *s) {
+        usec_t n;
+
+        assert(s);
+
+        /* Syslog has its own message ID and catalog entry, the
+         * others are reported the same way, each on its own */
+        server_maybe_warn_forward_syslog_missed(s);
+
+        if (s->n_forward_kmsg_missed <= 0 &&
+            s->n_forward_console_missed <= 0 &&
+            s->n_forward_wall_missed <= 0)
+                return;
+
+        n = now(CLOCK_MONOTONIC);
+        maybe_warn_forward_missed(s, "kmsg", &s->n_forward_kmsg_missed, &s->last_warn_forward_kmsg_missed, n);
+        maybe_warn_forward_missed(s, "console", &s->n_forward_console_missed, &s->last_warn_forward_console_missed, n);
+        maybe_warn_forward_missed(s, "wall", &s->n_forward_wall_missed, &s->last_warn_forward_wall_missed, n);
+}
+
 void server_done(Server *s) {
         JournalFile *f;
         assert(s);
 
+        server_flush_pending(s);
+
+        /* Don't leave a partial copy behind, we'd flush it again
+         * on the next start */
+        if (s->flush_journal) {
+                int r;
+
+                while ((r = server_flush_to_var_step(s, UINT_MAX)) > 0)
+                        ;
+
+                server_flush_to_var_finish(s, r);
+        }
+
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
@@ -1655,6 +2295,9 @@ void server_done(Server *s) {
 
         ordered_hashmap_free(s->user_journals);
 
+        vacuum_directory_free(s->system_vacuum_directory);
+        vacuum_directory_free(s->runtime_vacuum_directory);
+
         sd_event_source_unref(s->syslog_event_source);
         sd_event_source_unref(s->native_event_source);
         sd_event_source_unref(s->stdout_event_source);
@@ -1663,9 +2306,13 @@ void server_done(Server *s) {
         sd_event_source_unref(s->sync_event_source);
         sd_event_source_unref(s->sigusr1_event_source);
         sd_event_source_unref(s->sigusr2_event_source);
+        sd_event_source_unref(s->sigrtmin1_event_source);
+        sd_event_source_unref(s->sigrtmin2_event_source);
+        sd_event_source_unref(s->sync_notify_event_source);
         sd_event_source_unref(s->sigterm_event_source);
         sd_event_source_unref(s->sigint_event_source);
         sd_event_source_unref(s->hostname_event_source);
+        sd_event_source_unref(s->pending_event_source);
         sd_event_unref(s->event);
 
         safe_close(s->syslog_fd);
@@ -1674,14 +2321,22 @@ void server_done(Server *s) {
         safe_close(s->dev_kmsg_fd);
         safe_close(s->audit_fd);
         safe_close(s->hostname_fd);
+        safe_close(s->sync_notify_fd);
 
         if (s->rate_limit)
                 journal_rate_limit_free(s->rate_limit);
 
+        client_context_cache_free(s->client_contexts);
+
         if (s->kernel_seqnum)
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
+        free(s->datagram_batch);
+
+        pending_queue_done(&s->pending);
+
         free(s->buffer);
+        free(s->audit_buffer);
         free(s->tty_path);
         free(s->cgroup_root);
         free(s->hostname_field);
@@ -1689,5 +2344,9 @@ void server_done(Server *s) {
         if (s->mmap)
                 mmap_cache_unref(s->mmap);
 
+        server_flush_kernel_devices(s);
+        hashmap_free(s->kernel_devices);
         udev_unref(s->udev);
+
+        server_statistics_done(&s->statistics);
 }
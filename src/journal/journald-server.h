@@ -25,10 +25,14 @@
 #include <sys/types.h>
 
 #include "sd-event.h"
+#include "sd-journal.h"
 #include "journal-file.h"
+#include "journal-vacuum.h"
 #include "hashmap.h"
 #include "audit.h"
 #include "journald-rate-limit.h"
+#include "journald-context.h"
+#include "journald-statistics.h"
 #include "list.h"
 
 typedef enum Storage {
@@ -49,6 +53,28 @@ typedef enum SplitMode {
 } SplitMode;
 
 typedef struct StdoutStream StdoutStream;
+typedef struct DatagramBatch DatagramBatch;
+
+typedef struct PendingEntry {
+        uid_t uid;
+        int priority;
+        dual_timestamp ts;
+        uint64_t seqnum;
+        size_t iovec_idx;
+        unsigned n_iovec;
+} PendingEntry;
+
+/* Entries collected while draining a burst of messages, in the order
+ * they arrived in. The iovecs point into data by offset until the
+ * entries are written. */
+typedef struct PendingQueue {
+        PendingEntry *entries;
+        size_t n_entries, entries_allocated;
+        struct iovec *iovec;
+        size_t n_iovec, iovec_allocated;
+        char *data;
+        size_t data_size, data_allocated;
+} PendingQueue;
 
 typedef struct Server {
         int syslog_fd;
@@ -57,6 +83,7 @@ typedef struct Server {
         int dev_kmsg_fd;
         int audit_fd;
         int hostname_fd;
+        int sync_notify_fd;
 
         sd_event *event;
 
@@ -68,20 +95,38 @@ typedef struct Server {
         sd_event_source *sync_event_source;
         sd_event_source *sigusr1_event_source;
         sd_event_source *sigusr2_event_source;
+        sd_event_source *sigrtmin1_event_source;
+        sd_event_source *sigrtmin2_event_source;
+        sd_event_source *sync_notify_event_source;
         sd_event_source *sigterm_event_source;
         sd_event_source *sigint_event_source;
         sd_event_source *hostname_event_source;
+        sd_event_source *pending_event_source;
 
         JournalFile *runtime_journal;
         JournalFile *system_journal;
         OrderedHashmap *user_journals;
 
+        /* The flush of the runtime journal to /var in progress */
+        sd_journal *flush_journal;
+        JournalCopyMap *flush_copy_map;
+        sd_event_source *flush_event_source;
+        usec_t flush_start;
+        unsigned flush_n_entries;
+        bool flush_requested;
+
         uint64_t seqnum;
 
+        PendingQueue pending;
+        bool flushing_pending;
+
         char *buffer;
         size_t buffer_size;
 
+        DatagramBatch *datagram_batch;
+
         JournalRateLimit *rate_limit;
+        ClientContextCache *client_contexts;
         usec_t sync_interval_usec;
         usec_t rate_limit_interval;
         unsigned rate_limit_burst;
@@ -100,9 +145,19 @@ typedef struct Server {
         unsigned n_forward_syslog_missed;
         usec_t last_warn_forward_syslog_missed;
 
+        unsigned n_forward_kmsg_missed;
+        usec_t last_warn_forward_kmsg_missed;
+        unsigned n_forward_console_missed;
+        usec_t last_warn_forward_console_missed;
+        unsigned n_forward_wall_missed;
+        usec_t last_warn_forward_wall_missed;
+
         uint64_t cached_available_space;
         usec_t cached_available_space_timestamp;
 
+        VacuumDirectory *system_vacuum_directory;
+        VacuumDirectory *runtime_vacuum_directory;
+
         uint64_t var_available_timestamp;
 
         usec_t max_retention_usec;
@@ -130,8 +185,11 @@ typedef struct Server {
         uint64_t *kernel_seqnum;
 
         struct udev *udev;
+        Hashmap *kernel_devices;
 
         bool sync_scheduled;
+        usec_t sync_request_usec;
+        bool sync_request_pending;
 
         char machine_id_field[sizeof("_MACHINE_ID=") + 32];
         char boot_id_field[sizeof("_BOOT_ID=") + 32];
@@ -139,6 +197,12 @@ typedef struct Server {
 
         /* Cached cgroup root, so that we don't have to query that all the time */
         char *cgroup_root;
+
+        /* What the fields of audit records are decoded into */
+        char *audit_buffer;
+        size_t audit_buffer_allocated;
+
+        ServerStatistics statistics;
 } Server;
 
 #define N_IOVEC_META_FIELDS 20
@@ -166,9 +230,11 @@ void server_fix_perms(Server *s, JournalFile *f, uid_t uid);
 int server_init(Server *s);
 void server_done(Server *s);
 void server_sync(Server *s);
+void server_flush_pending(Server *s);
 void server_vacuum(Server *s);
 void server_rotate(Server *s);
 int server_schedule_sync(Server *s, int priority);
 int server_flush_to_var(Server *s);
 void server_maybe_append_tags(Server *s);
+void server_maybe_warn_forward_missed(Server *s);
 int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata);
@@ -0,0 +1,242 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "util.h"
+#include "mmap-cache.h"
+#include "audit-type.h"
+#include "journald-server.h"
+#include "journald-statistics.h"
+
+static const char* const journal_source_table[_JOURNAL_SOURCE_MAX] = {
+        [JOURNAL_SOURCE_NATIVE] = "NATIVE",
+        [JOURNAL_SOURCE_SYSLOG] = "SYSLOG",
+        [JOURNAL_SOURCE_STDOUT] = "STDOUT",
+        [JOURNAL_SOURCE_KMSG] = "KMSG",
+        [JOURNAL_SOURCE_AUDIT] = "AUDIT",
+        [JOURNAL_SOURCE_DRIVER] = "DRIVER",
+};
+
+DEFINE_PRIVATE_STRING_TABLE_LOOKUP_TO_STRING(journal_source, JournalSource);
+
+void histogram_add(Histogram *h, nsec_t t) {
+        unsigned i;
+
+        assert(h);
+
+        i = t > 0 ? u64log2(t) : 0;
+        h->buckets[MIN(i, HISTOGRAM_BUCKETS - 1)]++;
+
+        h->n++;
+        h->total += t;
+        h->max = MAX(h->max, t);
+}
+
+void server_statistics_audit(ServerStatistics *s, int type) {
+        uint64_t *n;
+
+        assert(s);
+
+        /* Best effort, if we can't allocate the counter the record
+         * simply isn't counted */
+
+        n = hashmap_get(s->audit_types, INT_TO_PTR(type));
+        if (!n) {
+                if (hashmap_ensure_allocated(&s->audit_types, NULL) < 0)
+                        return;
+
+                n = new0(uint64_t, 1);
+                if (!n)
+                        return;
+
+                if (hashmap_put(s->audit_types, INT_TO_PTR(type), n) < 0) {
+                        free(n);
+                        return;
+                }
+        }
+
+        (*n)++;
+}
+
+void server_statistics_done(ServerStatistics *s) {
+        assert(s);
+
+        s->audit_types = hashmap_free_free(s->audit_types);
+}
+
+static int compare_int(const void *a, const void *b) {
+        const int *x = a, *y = b;
+
+        return *x < *y ? -1 : *x > *y ? 1 : 0;
+}
+
+static void audit_types_dump(FILE *f, Hashmap *h) {
+        _cleanup_free_ int *types = NULL;
+        unsigned n = 0, i;
+        Iterator it;
+        void *v, *k;
+
+        assert(f);
+
+        if (hashmap_isempty(h))
+                return;
+
+        types = new(int, hashmap_size(h));
+        if (!types)
+                return;
+
+        HASHMAP_FOREACH_KEY(v, k, h, it)
+                types[n++] = PTR_TO_INT(k);
+
+        qsort(types, n, sizeof(int), compare_int);
+
+        for (i = 0; i < n; i++) {
+                const char *name;
+
+                name = audit_type_to_string(types[i]);
+                if (name)
+                        fprintf(f, "AUDIT_%s=", name);
+                else
+                        fprintf(f, "AUDIT_%i=", types[i]);
+
+                fprintf(f, "%" PRIu64 "\n", *(uint64_t*) hashmap_get(h, INT_TO_PTR(types[i])));
+        }
+}
+
+static void histogram_dump(FILE *f, const char *prefix, const Histogram *h) {
+        bool space = false;
+        unsigned i;
+
+        assert(f);
+        assert(prefix);
+        assert(h);
+
+        fprintf(f,
+                "%s_COUNT=%" PRIu64 "\n"
+                "%s_AVG_NSEC=%" PRIu64 "\n"
+                "%s_MAX_NSEC=%" PRIu64 "\n",
+                prefix, h->n,
+                prefix, h->n > 0 ? h->total / h->n : 0,
+                prefix, h->max);
+
+        /* Only the buckets that are in use, as pairs of the upper
+         * bound in ns and the count; the last one has no bound */
+        fprintf(f, "%s_HISTOGRAM=", prefix);
+        for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+                if (h->buckets[i] == 0)
+                        continue;
+
+                if (space)
+                        fputc(' ', f);
+                space = true;
+
+                if (i < HISTOGRAM_BUCKETS - 1)
+                        fprintf(f, "%" PRIu64 ":%" PRIu64, UINT64_C(2) << i, h->buckets[i]);
+                else
+                        fprintf(f, "inf:%" PRIu64, h->buckets[i]);
+        }
+        fputc('\n', f);
+}
+
+static void sync_statistics_add(JournalFile *f, uint64_t *n, usec_t *total, usec_t *max) {
+        if (!f)
+                return;
+
+        *n += __sync_fetch_and_add(&f->n_syncs, 0);
+        *total += __sync_fetch_and_add(&f->sync_usec, 0);
+        *max = MAX(*max, __sync_fetch_and_add(&f->sync_usec_max, 0));
+}
+
+int server_dump_statistics(Server *s, const char *path) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        uint64_t n_syncs = 0;
+        usec_t sync_usec = 0, sync_usec_max = 0;
+        JournalSource i;
+        JournalFile *j;
+        Iterator it;
+        int r;
+
+        assert(s);
+        assert(path);
+
+        r = fopen_temporary(path, &f, &temp_path);
+        if (r < 0)
+                goto fail;
+
+        (void) fchmod(fileno(f), 0644);
+
+        for (i = 0; i < _JOURNAL_SOURCE_MAX; i++)
+                fprintf(f, "MESSAGES_%s=%" PRIu64 "\n", journal_source_to_string(i), s->statistics.n_messages[i]);
+
+        fprintf(f,
+                "RATE_LIMITED=%" PRIu64 "\n"
+                "ENTRIES_WRITTEN=%" PRIu64 "\n"
+                "BYTES_WRITTEN=%" PRIu64 "\n"
+                "STDOUT_STREAMS=%u\n",
+                s->statistics.n_rate_limited,
+                s->statistics.n_entries_written,
+                s->statistics.bytes_written,
+                s->n_stdout_streams);
+
+        histogram_dump(f, "DISPATCH", &s->statistics.dispatch);
+        histogram_dump(f, "WRITE", &s->statistics.write);
+
+        /* Only of the files currently open, closing one (other than
+         * when rotating) loses its numbers */
+        sync_statistics_add(s->system_journal, &n_syncs, &sync_usec, &sync_usec_max);
+        sync_statistics_add(s->runtime_journal, &n_syncs, &sync_usec, &sync_usec_max);
+        ORDERED_HASHMAP_FOREACH(j, s->user_journals, it)
+                sync_statistics_add(j, &n_syncs, &sync_usec, &sync_usec_max);
+
+        fprintf(f,
+                "SYNC_COUNT=%" PRIu64 "\n"
+                "SYNC_AVG_USEC=" USEC_FMT "\n"
+                "SYNC_MAX_USEC=" USEC_FMT "\n",
+                n_syncs,
+                n_syncs > 0 ? sync_usec / n_syncs : 0,
+                sync_usec_max);
+
+        audit_types_dump(f, s->statistics.audit_types);
+
+        if (s->mmap)
+                fprintf(f,
+                        "MMAP_CACHE_HIT=%u\n"
+                        "MMAP_CACHE_MISSED=%u\n",
+                        mmap_cache_get_hit(s->mmap),
+                        mmap_cache_get_missed(s->mmap));
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp_path, path) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        if (temp_path)
+                (void) unlink(temp_path);
+
+        return log_error_errno(r, "Failed to write statistics to %s: %m", path);
+}
@@ -0,0 +1,73 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include "time-util.h"
+#include "hashmap.h"
+
+typedef struct Server Server;
+
+typedef enum JournalSource {
+        JOURNAL_SOURCE_NATIVE,
+        JOURNAL_SOURCE_SYSLOG,
+        JOURNAL_SOURCE_STDOUT,
+        JOURNAL_SOURCE_KMSG,
+        JOURNAL_SOURCE_AUDIT,
+        JOURNAL_SOURCE_DRIVER,
+        _JOURNAL_SOURCE_MAX,
+        _JOURNAL_SOURCE_INVALID = -1
+} JournalSource;
+
+/* Bucket i counts the durations of less than 2^(i+1) ns, the last one
+ * everything longer */
+#define HISTOGRAM_BUCKETS 32
+
+typedef struct Histogram {
+        uint64_t buckets[HISTOGRAM_BUCKETS];
+        uint64_t n;
+        nsec_t total;
+        nsec_t max;
+} Histogram;
+
+/* Counters of what journald did since it was started, see
+ * server_dump_statistics() */
+typedef struct ServerStatistics {
+        uint64_t n_messages[_JOURNAL_SOURCE_MAX];
+        uint64_t n_rate_limited;
+        uint64_t n_entries_written;
+        uint64_t bytes_written;
+
+        /* Time spent in server_dispatch_message(), and writing the
+         * queued entries out */
+        Histogram dispatch;
+        Histogram write;
+
+        /* Audit records received, by audit type → count */
+        Hashmap *audit_types;
+} ServerStatistics;
+
+void histogram_add(Histogram *h, nsec_t t);
+
+void server_statistics_audit(ServerStatistics *s, int type);
+void server_statistics_done(ServerStatistics *s);
+
+int server_dump_statistics(Server *s, const char *path);
@@ -41,6 +41,14 @@
 
 #define STDOUT_STREAMS_MAX 4096
 
+/* The read buffer starts out large enough for one line, and grows
+ * while reads keep filling it up, so that a chatty service is read in
+ * fewer, larger chunks. Once a read no longer fills it, it shrinks
+ * back, as there may be thousands of mostly idle streams. Lines are
+ * still cut at LINE_MAX. */
+#define STDOUT_STREAM_BUFFER_MIN (LINE_MAX+1)
+#define STDOUT_STREAM_BUFFER_MAX (64U*1024U)
+
 typedef enum StdoutStreamState {
         STDOUT_STREAM_IDENTIFIER,
         STDOUT_STREAM_UNIT_ID,
@@ -60,6 +68,7 @@ struct StdoutStream {
 
         struct ucred ucred;
         char *label;
+        size_t label_len;
         char *identifier;
         char *unit_id;
         int priority;
@@ -70,8 +79,14 @@ struct StdoutStream {
 
         bool fdstore:1;
 
-        char buffer[LINE_MAX+1];
-        size_t length;
+        /* The fields that are the same for every line, built once */
+        char *syslog_identifier_field;
+        char syslog_priority_field[sizeof("PRIORITY=") + 1];
+        char syslog_facility_field[sizeof("SYSLOG_FACILITY=")-1 + DECIMAL_STR_MAX(int) + 1];
+        int fields_priority;
+
+        char *buffer;
+        size_t length, allocated;
 
         sd_event_source *event_source;
 
@@ -99,6 +114,8 @@ void stdout_stream_free(StdoutStream *s) {
         free(s->label);
         free(s->identifier);
         free(s->unit_id);
+        free(s->syslog_identifier_field);
+        free(s->buffer);
         free(s->state_file);
 
         free(s);
@@ -208,14 +225,30 @@ fail:
         return log_error_errno(r, "Failed to save stream data %s: %m", s->state_file);
 }
 
+static void stdout_stream_update_fields(StdoutStream *s, int priority) {
+        assert(s);
+
+        if (s->identifier && !s->syslog_identifier_field)
+                s->syslog_identifier_field = strappend("SYSLOG_IDENTIFIER=", s->identifier);
+
+        if (s->syslog_priority_field[0] && s->fields_priority == priority)
+                return;
+
+        xsprintf(s->syslog_priority_field, "PRIORITY=%i", LOG_PRI(priority));
+
+        if (priority & LOG_FACMASK)
+                xsprintf(s->syslog_facility_field, "SYSLOG_FACILITY=%i", LOG_FAC(priority));
+        else
+                s->syslog_facility_field[0] = 0;
+
+        s->fields_priority = priority;
+}
+
 static int stdout_stream_log(StdoutStream *s, const char *p) {
         struct iovec iovec[N_IOVEC_META_FIELDS + 5];
         int priority;
-        char syslog_priority[] = "PRIORITY=\0";
-        char syslog_facility[sizeof("SYSLOG_FACILITY=")-1 + DECIMAL_STR_MAX(int) + 1];
-        _cleanup_free_ char *message = NULL, *syslog_identifier = NULL;
+        char *message;
         unsigned n = 0;
-        size_t label_len;
 
         assert(s);
         assert(p);
@@ -240,28 +273,23 @@ static int stdout_stream_log(StdoutStream *s, const char *p) {
         if (s->server->forward_to_wall)
                 server_forward_wall(s->server, priority, s->identifier, p, &s->ucred);
 
-        IOVEC_SET_STRING(iovec[n++], "_TRANSPORT=stdout");
+        stdout_stream_update_fields(s, priority);
 
-        syslog_priority[strlen("PRIORITY=")] = '0' + LOG_PRI(priority);
-        IOVEC_SET_STRING(iovec[n++], syslog_priority);
+        IOVEC_SET_STRING(iovec[n++], "_TRANSPORT=stdout");
+        IOVEC_SET_STRING(iovec[n++], s->syslog_priority_field);
 
-        if (priority & LOG_FACMASK) {
-                xsprintf(syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority));
-                IOVEC_SET_STRING(iovec[n++], syslog_facility);
-        }
+        if (s->syslog_facility_field[0])
+                IOVEC_SET_STRING(iovec[n++], s->syslog_facility_field);
 
-        if (s->identifier) {
-                syslog_identifier = strappend("SYSLOG_IDENTIFIER=", s->identifier);
-                if (syslog_identifier)
-                        IOVEC_SET_STRING(iovec[n++], syslog_identifier);
-        }
+        if (s->syslog_identifier_field)
+                IOVEC_SET_STRING(iovec[n++], s->syslog_identifier_field);
 
-        message = strappend("MESSAGE=", p);
-        if (message)
-                IOVEC_SET_STRING(iovec[n++], message);
+        /* Lines are at most LINE_MAX long, hence this fits on the stack */
+        message = strjoina("MESSAGE=", p);
+        IOVEC_SET_STRING(iovec[n++], message);
 
-        label_len = s->label ? strlen(s->label) : 0;
-        server_dispatch_message(s->server, iovec, n, ELEMENTSOF(iovec), &s->ucred, NULL, s->label, label_len, s->unit_id, priority, 0);
+        s->server->statistics.n_messages[JOURNAL_SOURCE_STDOUT]++;
+        server_dispatch_message(s->server, iovec, n, ELEMENTSOF(iovec), &s->ucred, NULL, s->label, s->label_len, s->unit_id, priority, 0);
         return 0;
 }
 
@@ -378,18 +406,26 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
                 char *end;
                 size_t skip;
 
-                end = memchr(p, '\n', remaining);
-                if (end)
+                end = memchr(p, '\n', MIN(remaining, (size_t) LINE_MAX + 1));
+                if (end) {
+                        *end = 0;
                         skip = end - p + 1;
-                else if (remaining >= sizeof(s->buffer) - 1) {
-                        end = p + sizeof(s->buffer) - 1;
-                        skip = remaining;
-                } else
-                        break;
 
-                *end = 0;
+                        r = stdout_stream_line(s, p);
+                } else if (remaining >= LINE_MAX) {
+                        char c;
 
-                r = stdout_stream_line(s, p);
+                        /* Overlong line, cut it. The byte we
+                         * terminate at belongs to the next line. */
+                        end = p + LINE_MAX;
+                        skip = LINE_MAX;
+
+                        c = *end;
+                        *end = 0;
+                        r = stdout_stream_line(s, p);
+                        *end = c;
+                } else
+                        break;
                 if (r < 0)
                         return r;
 
@@ -417,6 +453,7 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
 
 static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
         StdoutStream *s = userdata;
+        bool full;
         ssize_t l;
         int r;
 
@@ -427,7 +464,7 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
                 goto terminate;
         }
 
-        l = read(s->fd, s->buffer+s->length, sizeof(s->buffer)-1-s->length);
+        l = read(s->fd, s->buffer+s->length, s->allocated-1-s->length);
         if (l < 0) {
 
                 if (errno == EAGAIN)
@@ -443,10 +480,36 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
         }
 
         s->length += l;
+        full = s->length == s->allocated-1;
+
+        if (full && s->allocated < STDOUT_STREAM_BUFFER_MAX) {
+                char *b;
+                size_t k;
+
+                /* There's probably more where this came from */
+                k = MIN(s->allocated * 2, STDOUT_STREAM_BUFFER_MAX);
+                b = realloc(s->buffer, k);
+                if (b) {
+                        s->buffer = b;
+                        s->allocated = k;
+                }
+        }
+
         r = stdout_stream_scan(s, false);
         if (r < 0)
                 goto terminate;
 
+        if (!full && s->allocated > STDOUT_STREAM_BUFFER_MIN && s->length < STDOUT_STREAM_BUFFER_MIN) {
+                char *b;
+
+                /* The burst is over, and what is left of it fits */
+                b = realloc(s->buffer, STDOUT_STREAM_BUFFER_MIN);
+                if (b) {
+                        s->buffer = b;
+                        s->allocated = STDOUT_STREAM_BUFFER_MIN;
+                }
+        }
+
         return 1;
 
 terminate:
@@ -468,6 +531,11 @@ static int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
         stream->fd = -1;
         stream->priority = LOG_INFO;
 
+        stream->buffer = malloc(STDOUT_STREAM_BUFFER_MIN);
+        if (!stream->buffer)
+                return log_oom();
+        stream->allocated = STDOUT_STREAM_BUFFER_MIN;
+
         r = getpeercred(fd, &stream->ucred);
         if (r < 0)
                 return log_error_errno(r, "Failed to determine peer credentials: %m");
@@ -476,6 +544,8 @@ static int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
                 r = getpeersec(fd, &stream->label);
                 if (r < 0 && r != -EOPNOTSUPP)
                         (void) log_warning_errno(r, "Failed to determine peer security context: %m");
+                if (stream->label)
+                        stream->label_len = strlen(stream->label);
         }
 
         (void) shutdown(fd, SHUT_WR);
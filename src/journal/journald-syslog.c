@@ -374,6 +374,7 @@ void server_process_syslog_message(
         if (message)
                 IOVEC_SET_STRING(iovec[n++], message);
 
+        s->statistics.n_messages[JOURNAL_SOURCE_SYSLOG]++;
         server_dispatch_message(s, iovec, n, ELEMENTSOF(iovec), ucred, tv, label, label_len, NULL, priority, 0);
 }
 
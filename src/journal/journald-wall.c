@@ -66,6 +66,8 @@ void server_forward_wall(
                 l = message;
 
         r = utmp_wall(l, "systemd-journald", NULL, NULL, NULL);
-        if (r < 0)
+        if (r < 0) {
                 log_debug_errno(r, "Failed to send wall message: %m");
+                s->n_forward_wall_missed++;
+        }
 }
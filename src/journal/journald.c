@@ -81,6 +81,7 @@ int main(int argc, char *argv[]) {
                         /* The retention time is reached, so let's vacuum! */
                         if (server.oldest_file_usec + server.max_retention_usec < n) {
                                 log_info("Retention time reached.");
+                                server_flush_pending(&server);
                                 server_rotate(&server);
                                 server_vacuum(&server);
                                 continue;
@@ -110,7 +111,7 @@ int main(int argc, char *argv[]) {
                 }
 
                 server_maybe_append_tags(&server);
-                server_maybe_warn_forward_syslog_missed(&server);
+                server_maybe_warn_forward_missed(&server);
         }
 
         log_debug("systemd-journald stopped as pid "PID_FMT, getpid());
@@ -60,6 +60,12 @@ struct Context {
         unsigned id;
         Window *window;
 
+        /* The file and range of the last window this context
+         * created, used to detect sequential access */
+        int last_fd;
+        uint64_t last_offset, last_end;
+        unsigned n_sequential;
+
         LIST_FIELDS(Context, by_window);
 };
 
@@ -74,8 +80,7 @@ struct MMapCache {
         int n_ref;
         unsigned n_windows;
 
-        unsigned n_hit, n_missed;
-
+        unsigned n_hit, n_missed, n_sequential;
 
         Hashmap *fds;
         Context *contexts[MMAP_CACHE_MAX_CONTEXTS];
@@ -93,6 +98,11 @@ struct MMapCache {
 # define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
 #endif
 
+/* When a context keeps asking for the range right behind its last
+ * window, each new window is twice the size of the previous one, up
+ * to WINDOW_SIZE << WINDOW_SHIFT_MAX. */
+#define WINDOW_SHIFT_MAX 3U
+
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
 
@@ -261,6 +271,7 @@ static Context *context_add(MMapCache *m, unsigned id) {
 
         c->cache = m;
         c->id = id;
+        c->last_fd = -1;
 
         assert(!m->contexts[id]);
         m->contexts[id] = c;
@@ -467,6 +478,7 @@ static int add_mmap(
                 void **ret) {
 
         uint64_t woffset, wsize;
+        bool sequential;
         Context *c;
         FileDescriptor *f;
         Window *w;
@@ -479,11 +491,38 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        c = context_add(m, context);
+        if (!c)
+                return -ENOMEM;
+
+        /* If the requested range starts within or right after the
+         * last window this context created, the context is most
+         * likely walking the file front to back, for example when
+         * iterating through entries. In that case grow the window and
+         * place it ahead of the requested offset, instead of centering
+         * it. Random lookups, such as hash table accesses, do not
+         * follow this pattern and keep getting the default size. */
+        sequential =
+                c->last_fd == fd &&
+                offset >= c->last_offset &&
+                offset + size > c->last_end &&
+                offset <= c->last_end + WINDOW_SIZE;
+
+        if (sequential) {
+                if (c->n_sequential < WINDOW_SHIFT_MAX)
+                        c->n_sequential++;
+        } else
+                c->n_sequential = 0;
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
+        if (sequential) {
+                if (wsize < WINDOW_SIZE << c->n_sequential)
+                        wsize = WINDOW_SIZE << c->n_sequential;
+
+        } else if (wsize < WINDOW_SIZE) {
                 uint64_t delta;
 
                 delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
@@ -522,9 +561,10 @@ static int add_mmap(
                         return -ENOMEM;
         }
 
-        c = context_add(m, context);
-        if (!c)
-                goto outofmem;
+        /* We are going to read through this window, let the kernel
+         * start reading it in right away */
+        if (sequential)
+                (void) madvise(d, wsize, MADV_WILLNEED);
 
         f = fd_add(m, fd);
         if (!f)
@@ -547,6 +587,12 @@ static int add_mmap(
         c->window = w;
         LIST_PREPEND(by_window, w->contexts, c);
 
+        c->last_fd = fd;
+        c->last_offset = woffset;
+        c->last_end = woffset + wsize;
+        if (sequential)
+                m->n_sequential++;
+
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         return 1;
 
@@ -607,6 +653,12 @@ unsigned mmap_cache_get_missed(MMapCache *m) {
         return m->n_missed;
 }
 
+unsigned mmap_cache_get_sequential(MMapCache *m) {
+        assert(m);
+
+        return m->n_sequential;
+}
+
 static void mmap_cache_process_sigbus(MMapCache *m) {
         bool found = false;
         FileDescriptor *f;
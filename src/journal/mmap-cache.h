@@ -47,5 +47,6 @@ void mmap_cache_close_fd(MMapCache *m, int fd);
 
 unsigned mmap_cache_get_hit(MMapCache *m);
 unsigned mmap_cache_get_missed(MMapCache *m);
+unsigned mmap_cache_get_sequential(MMapCache *m);
 
 bool mmap_cache_got_sigbus(MMapCache *m, int fd);
@@ -44,6 +44,7 @@
 #include "fileio.h"
 #include "formats-util.h"
 #include "hostname-util.h"
+#include "siphash24.h"
 
 #define JOURNAL_FILES_MAX 7168
 
@@ -79,6 +80,12 @@ static int set_put_error(sd_journal *j, int r) {
         return set_put(j->errors, INT_TO_PTR(r));
 }
 
+static void invalidate_files_queue(sd_journal *j) {
+        assert(j);
+
+        j->files_queued = false;
+}
+
 static void detach_location(sd_journal *j) {
         Iterator i;
         JournalFile *f;
@@ -88,6 +95,8 @@ static void detach_location(sd_journal *j) {
         j->current_file = NULL;
         j->current_field = 0;
 
+        invalidate_files_queue(j);
+
         ORDERED_HASHMAP_FOREACH(f, j->files, i)
                 journal_file_reset_location(f);
 }
@@ -402,10 +411,24 @@ char *journal_make_match_string(sd_journal *j) {
         return match_make_string(j->level0);
 }
 
+static void flush_match_caches(sd_journal *j) {
+        JournalFile *f;
+        Iterator i;
+
+        assert(j);
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i)
+                f->match_cache = hashmap_free_free(f->match_cache);
+}
+
 _public_ void sd_journal_flush_matches(sd_journal *j) {
         if (!j)
                 return;
 
+        /* The caches are keyed by the Match objects we are about to
+         * free */
+        flush_match_caches(j);
+
         if (j->level0)
                 match_free(j->level0);
 
@@ -465,6 +488,110 @@ _pure_ static int compare_with_location(JournalFile *f, Location *l) {
         return 0;
 }
 
+typedef struct MatchCacheItem {
+        /* The data object of the match, or if it doesn't exist, the
+         * number of data objects in the file when we last looked */
+        uint64_t data_offset;
+        uint64_t n_data;
+        bool missing:1;
+
+        /* The result of the last next_for_match() call for this
+         * match: the closest entry in direction from after_offset,
+         * or 0 if there was none when the file had n_entries
+         * entries. */
+        bool valid:1;
+        direction_t direction;
+        uint64_t after_offset;
+        uint64_t offset;
+        uint64_t n_entries;
+} MatchCacheItem;
+
+static MatchCacheItem *match_cache_get(JournalFile *f, Match *m) {
+        MatchCacheItem *c;
+
+        assert(f);
+        assert(m);
+
+        /* Returns NULL on OOM, in which case the caller just does
+         * the lookups uncached */
+
+        c = hashmap_get(f->match_cache, m);
+        if (c)
+                return c;
+
+        if (hashmap_ensure_allocated(&f->match_cache, NULL) < 0)
+                return NULL;
+
+        c = new0(MatchCacheItem, 1);
+        if (!c)
+                return NULL;
+
+        if (hashmap_put(f->match_cache, m, c) < 0) {
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+static int find_data_for_match(JournalFile *f, Match *m, MatchCacheItem *c, uint64_t *offset) {
+        uint64_t n_data = 0;
+        int r;
+
+        assert(f);
+        assert(m);
+        assert(m->type == MATCH_DISCRETE);
+        assert(offset);
+
+        /* Data objects never move, and if one didn't exist, it can
+         * only have been added since if the number of data objects
+         * changed. */
+
+        if (c && c->data_offset > 0) {
+                *offset = c->data_offset;
+                return 1;
+        }
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_data))
+                n_data = le64toh(f->header->n_data);
+
+        if (c && c->missing && n_data > 0 && c->n_data == n_data)
+                return 0;
+
+        r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, offset);
+        if (r < 0)
+                return r;
+
+        if (c) {
+                c->missing = r == 0;
+                c->n_data = n_data;
+                if (r > 0)
+                        c->data_offset = *offset;
+        }
+
+        return r;
+}
+
+static bool match_cache_covers(MatchCacheItem *c, JournalFile *f, uint64_t after_offset, direction_t direction) {
+        assert(f);
+
+        if (!c || !c->valid || c->direction != direction)
+                return false;
+
+        /* Entries are only ever appended, at increasing offsets, hence
+         * if there was no entry between the last after_offset and the
+         * entry we found then, there still is none. If we found
+         * nothing, that's only true as long as no entries were added. */
+
+        if (c->offset == 0)
+                return c->n_entries == le64toh(f->header->n_entries) &&
+                        (direction == DIRECTION_DOWN ? after_offset >= c->after_offset : after_offset <= c->after_offset);
+
+        return direction == DIRECTION_DOWN ?
+                c->after_offset <= after_offset && after_offset <= c->offset :
+                c->offset <= after_offset && after_offset <= c->after_offset;
+}
+
 static int next_for_match(
                 sd_journal *j,
                 Match *m,
@@ -483,13 +610,50 @@ static int next_for_match(
         assert(f);
 
         if (m->type == MATCH_DISCRETE) {
-                uint64_t dp;
+                MatchCacheItem *c;
+                uint64_t dp, cp = 0;
+
+                /* When ORing many matches, only the one that produced
+                 * the last entry needs to search its entry array
+                 * again, the others can reuse their previous result. */
+
+                c = match_cache_get(f, m);
+
+                if (match_cache_covers(c, f, after_offset, direction)) {
+                        if (c->offset == 0)
+                                return 0;
+
+                        if (ret) {
+                                r = journal_file_move_to_object(f, OBJECT_ENTRY, c->offset, ret);
+                                if (r < 0)
+                                        return r;
+                        }
+                        if (offset)
+                                *offset = c->offset;
+
+                        return 1;
+                }
 
-                r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &dp);
+                r = find_data_for_match(f, m, c, &dp);
                 if (r <= 0)
                         return r;
 
-                return journal_file_move_to_entry_by_offset_for_data(f, dp, after_offset, direction, ret, offset);
+                r = journal_file_move_to_entry_by_offset_for_data(f, dp, after_offset, direction, ret, &cp);
+                if (r < 0)
+                        return r;
+
+                if (c) {
+                        c->valid = true;
+                        c->direction = direction;
+                        c->after_offset = after_offset;
+                        c->offset = r > 0 ? cp : 0;
+                        c->n_entries = le64toh(f->header->n_entries);
+                }
+
+                if (r > 0 && offset)
+                        *offset = cp;
+
+                return r;
 
         } else if (m->type == MATCH_OR_TERM) {
                 Match *i;
@@ -574,7 +738,7 @@ static int find_location_for_match(
         if (m->type == MATCH_DISCRETE) {
                 uint64_t dp;
 
-                r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &dp);
+                r = find_data_for_match(f, m, match_cache_get(f, m), &dp);
                 if (r <= 0)
                         return r;
 
@@ -717,6 +881,30 @@ static int next_with_matches(
                               direction, ret, offset);
 }
 
+static bool file_outside_location(sd_journal *j, JournalFile *f, direction_t direction) {
+        usec_t from, to;
+
+        assert(j);
+        assert(f);
+
+        /* If we are seeking purely by wallclock time, files that end
+         * before (or start after) that time can contribute nothing,
+         * so let's not bother bisecting them. */
+
+        if (j->current_location.type != LOCATION_SEEK ||
+            !j->current_location.realtime_set ||
+            j->current_location.seqnum_set ||
+            j->current_location.monotonic_set)
+                return false;
+
+        if (journal_file_get_cutoff_realtime_usec(f, &from, &to) <= 0)
+                return false;
+
+        return direction == DIRECTION_DOWN ?
+                to < j->current_location.realtime :
+                from > j->current_location.realtime;
+}
+
 static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direction) {
         Object *c;
         uint64_t cp, n_entries;
@@ -749,6 +937,9 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         } else {
                 f->last_direction = direction;
 
+                if (file_outside_location(j, f, direction))
+                        return 0;
+
                 r = find_location_with_matches(j, f, direction, &c, &cp);
                 if (r <= 0)
                         return r;
@@ -785,48 +976,155 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *f, *new_file = NULL;
+static int file_location_compare_down(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) a, (JournalFile*) b);
+}
+
+static int file_location_compare_up(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) b, (JournalFile*) a);
+}
+
+static int queue_file(sd_journal *j, JournalFile *f, direction_t direction) {
+        int r;
+
+        assert(j);
+        assert(f);
+
+        /* Moves f beyond the current location, and then queues it by
+         * its new candidate entry, or if there is none, remembers it
+         * for later, unless it is archived and hence cannot grow
+         * anymore. Returns 0 if f had to be removed. */
+
+        r = next_beyond_location(j, f, direction);
+        if (r < 0) {
+                log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
+                remove_file_real(j, f);
+                return 0;
+        } else if (r == 0) {
+                f->location_type = LOCATION_TAIL;
+
+                if (f->header->state == STATE_ARCHIVED)
+                        return 1;
+
+                r = set_ensure_allocated(&j->files_exhausted, NULL);
+                if (r < 0)
+                        return r;
+
+                r = set_put(j->files_exhausted, f);
+        } else
+                r = prioq_put(j->files_queue, f, NULL);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+static int rebuild_files_queue(sd_journal *j, direction_t direction) {
+        JournalFile *f;
         Iterator i;
-        Object *o;
         int r;
 
-        assert_return(j, -EINVAL);
-        assert_return(!journal_pid_changed(j), -ECHILD);
+        assert(j);
+
+        j->files_queue = prioq_free(j->files_queue);
+        set_clear(j->files_exhausted);
+
+        r = prioq_ensure_allocated(&j->files_queue,
+                                   direction == DIRECTION_DOWN ? file_location_compare_down : file_location_compare_up);
+        if (r < 0)
+                return r;
 
         ORDERED_HASHMAP_FOREACH(f, j->files, i) {
-                bool found;
+                r = queue_file(j, f, direction);
+                if (r < 0)
+                        return r;
+        }
 
-                r = next_beyond_location(j, f, direction);
-                if (r < 0) {
-                        log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
-                        remove_file_real(j, f);
-                        continue;
-                } else if (r == 0) {
-                        f->location_type = LOCATION_TAIL;
+        j->files_direction = direction;
+        j->files_queued = true;
+
+        return 0;
+}
+
+static int update_files_queue(sd_journal *j, direction_t direction) {
+        JournalFile *f;
+        Iterator i;
+        int r;
+
+        assert(j);
+
+        /* Instead of advancing every file on every step, only advance
+         * the one that produced the previous entry, plus the ones that
+         * have the very same entry, and those that ran out of entries
+         * earlier, in case they grew in the meantime. */
+
+        if (!j->files_queued ||
+            j->files_direction != direction ||
+            j->current_location.type != LOCATION_DISCRETE ||
+            !j->current_file)
+                return rebuild_files_queue(j, direction);
+
+        SET_FOREACH(f, j->files_exhausted, i) {
+                if (le64toh(f->header->n_entries) == f->last_n_entries)
                         continue;
-                }
 
-                if (!new_file)
-                        found = true;
-                else {
-                        int k;
+                assert_se(set_remove(j->files_exhausted, f) == f);
 
-                        k = journal_file_compare_locations(f, new_file);
+                r = queue_file(j, f, direction);
+                if (r <= 0)
+                        return r < 0 ? r : rebuild_files_queue(j, direction);
+        }
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
-                }
+        /* The file we picked the last time was taken off the queue */
+        r = queue_file(j, j->current_file, direction);
+        if (r <= 0)
+                return r < 0 ? r : rebuild_files_queue(j, direction);
 
-                if (found)
-                        new_file = f;
+        for (;;) {
+                int k;
+
+                f = prioq_peek(j->files_queue);
+                if (!f)
+                        return 0;
+
+                k = compare_with_location(f, &j->current_location);
+                if (direction == DIRECTION_DOWN ? k > 0 : k < 0)
+                        return 0;
+
+                /* This file has the entry we already returned,
+                 * too. Skip over it. */
+                assert_se(prioq_pop(j->files_queue) == f);
+
+                r = queue_file(j, f, direction);
+                if (r <= 0)
+                        return r < 0 ? r : rebuild_files_queue(j, direction);
+        }
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        JournalFile *new_file;
+        Object *o;
+        int r;
+
+        assert_return(j, -EINVAL);
+        assert_return(!journal_pid_changed(j), -ECHILD);
+
+        r = update_files_queue(j, direction);
+        if (r < 0) {
+                invalidate_files_queue(j);
+                return r;
         }
 
+        new_file = prioq_pop(j->files_queue);
         if (!new_file)
                 return 0;
 
         r = journal_file_move_to_object(new_file, OBJECT_ENTRY, new_file->current_offset, &o);
-        if (r < 0)
+        if (r < 0) {
+                /* new_file is neither queued nor current now */
+                invalidate_files_queue(j);
                 return r;
+        }
 
         set_location(j, new_file, o);
 
@@ -1195,6 +1493,52 @@ static bool file_type_wanted(int flags, const char *filename) {
         return false;
 }
 
+static bool file_outside_bounds(sd_journal *j, const char *path) {
+        usec_t head, tail;
+        Header h;
+
+        assert(j);
+        assert(path);
+
+        if (j->since == 0 && j->until == USEC_INFINITY)
+                return false;
+
+        /* If we can't read the header, let journal_file_open()
+         * deal with it, and report it properly */
+        if (journal_file_read_header(path, &h) < 0)
+                return false;
+
+        head = le64toh(h.head_entry_realtime);
+        tail = le64toh(h.tail_entry_realtime);
+        if (head == 0 || tail == 0)
+                return false;
+
+        /* The bounds only hold if the clock behaved while the file
+         * was written, and the file was closed properly. If they look
+         * off, open the file and go by the entries themselves. */
+        if (head > tail ||
+            tail > now(CLOCK_REALTIME) ||
+            head < TIME_EPOCH * USEC_PER_SEC ||
+            !IN_SET(h.state, STATE_ONLINE, STATE_OFFLINE, STATE_ARCHIVED)) {
+                log_debug("File %s has implausible time bounds in its header, not skipping.", path);
+                return false;
+        }
+
+        /* Only archived files are guaranteed not to grow beyond
+         * their current tail. The head of a file never changes once
+         * it has one. */
+        if (!((h.state == STATE_ARCHIVED && tail < j->since) || head > j->until))
+                return false;
+
+        if (j->skipped_head_realtime == 0 || head < j->skipped_head_realtime)
+                j->skipped_head_realtime = head;
+        if (tail > j->skipped_tail_realtime)
+                j->skipped_tail_realtime = tail;
+
+        log_debug("File %s has no entries in the requested time range, not opening.", path);
+        return true;
+}
+
 static int add_any_file(sd_journal *j, const char *path) {
         JournalFile *f = NULL;
         int r;
@@ -1205,6 +1549,9 @@ static int add_any_file(sd_journal *j, const char *path) {
         if (ordered_hashmap_get(j->files, path))
                 return 0;
 
+        if (file_outside_bounds(j, path))
+                return 0;
+
         if (ordered_hashmap_size(j->files) >= JOURNAL_FILES_MAX) {
                 log_warning("Too many open journal files, not adding %s.", path);
                 return set_put_error(j, -ETOOMANYREFS);
@@ -1226,6 +1573,8 @@ static int add_any_file(sd_journal *j, const char *path) {
 
         check_network(j, f->fd);
 
+        invalidate_files_queue(j);
+
         j->current_invalidate_counter ++;
 
         return 0;
@@ -1294,6 +1643,9 @@ static void remove_file_real(sd_journal *j, JournalFile *f) {
                         j->unique_file_lost = true;
         }
 
+        invalidate_files_queue(j);
+        set_remove(j->files_exhausted, f);
+
         journal_file_close(f);
 
         j->current_invalidate_counter ++;
@@ -1594,6 +1946,7 @@ static sd_journal *journal_new(int flags, const char *path) {
         j->inotify_fd = -1;
         j->flags = flags;
         j->data_threshold = DEFAULT_DATA_THRESHOLD;
+        j->until = USEC_INFINITY;
 
         if (path) {
                 j->path = strdup(path);
@@ -1614,18 +1967,36 @@ fail:
         return NULL;
 }
 
-_public_ int sd_journal_open(sd_journal **ret, int flags) {
+int journal_open_bounded(sd_journal **ret, const char *directory, int flags, usec_t since, usec_t until) {
         sd_journal *j;
         int r;
 
-        assert_return(ret, -EINVAL);
-        assert_return((flags & ~(SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_RUNTIME_ONLY|SD_JOURNAL_SYSTEM|SD_JOURNAL_CURRENT_USER)) == 0, -EINVAL);
+        assert(ret);
+        assert(since <= until);
 
-        j = journal_new(flags, NULL);
+        if (directory && flags != 0)
+                return -EINVAL;
+
+        /* Like sd_journal_open() or, if directory is set,
+         * sd_journal_open_directory(), but skips files which we can
+         * tell from their header contain no entries in the time range
+         * from since to until. Note that this means that entries
+         * outside of the time range might or might not be returned
+         * later on. */
+
+        j = journal_new(flags, directory);
         if (!j)
                 return -ENOMEM;
 
-        r = add_search_paths(j);
+        j->since = since;
+        j->until = until;
+
+        if (directory) {
+                r = add_root_directory(j, directory);
+                if (r < 0)
+                        set_put_error(j, r);
+        } else
+                r = add_search_paths(j);
         if (r < 0)
                 goto fail;
 
@@ -1638,6 +2009,13 @@ fail:
         return r;
 }
 
+_public_ int sd_journal_open(sd_journal **ret, int flags) {
+        assert_return(ret, -EINVAL);
+        assert_return((flags & ~(SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_RUNTIME_ONLY|SD_JOURNAL_SYSTEM|SD_JOURNAL_CURRENT_USER)) == 0, -EINVAL);
+
+        return journal_open_bounded(ret, NULL, flags, 0, USEC_INFINITY);
+}
+
 _public_ int sd_journal_open_container(sd_journal **ret, const char *machine, int flags) {
         _cleanup_free_ char *root = NULL, *class = NULL;
         sd_journal *j;
@@ -1681,30 +2059,11 @@ fail:
 }
 
 _public_ int sd_journal_open_directory(sd_journal **ret, const char *path, int flags) {
-        sd_journal *j;
-        int r;
-
         assert_return(ret, -EINVAL);
         assert_return(path, -EINVAL);
         assert_return(flags == 0, -EINVAL);
 
-        j = journal_new(flags, path);
-        if (!j)
-                return -ENOMEM;
-
-        r = add_root_directory(j, path);
-        if (r < 0) {
-                set_put_error(j, r);
-                goto fail;
-        }
-
-        *ret = j;
-        return 0;
-
-fail:
-        sd_journal_close(j);
-
-        return r;
+        return journal_open_bounded(ret, path, flags, 0, USEC_INFINITY);
 }
 
 _public_ int sd_journal_open_files(sd_journal **ret, const char **paths, int flags) {
@@ -1764,14 +2123,18 @@ _public_ void sd_journal_close(sd_journal *j) {
         safe_close(j->inotify_fd);
 
         if (j->mmap) {
-                log_debug("mmap cache statistics: %u hit, %u miss", mmap_cache_get_hit(j->mmap), mmap_cache_get_missed(j->mmap));
+                log_debug("mmap cache statistics: %u hit, %u miss, %u sequential",
+                          mmap_cache_get_hit(j->mmap), mmap_cache_get_missed(j->mmap), mmap_cache_get_sequential(j->mmap));
                 mmap_cache_unref(j->mmap);
         }
 
         free(j->path);
         free(j->prefix);
         free(j->unique_field);
+        set_free_free(j->unique_values);
         set_free(j->errors);
+        prioq_free(j->files_queue);
+        set_free(j->files_exhausted);
         free(j);
 }
 
@@ -1891,27 +2254,27 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
         field_length = strlen(field);
 
-        n = journal_file_entry_n_items(o);
+        n = journal_file_entry_n_items(f, o);
         for (i = 0; i < n; i++) {
                 uint64_t p, l;
                 le64_t le_hash;
                 size_t t;
                 int compression;
 
-                p = le64toh(o->entry.items[i].object_offset);
-                le_hash = o->entry.items[i].hash;
+                p = journal_file_entry_item_object_offset(f, o, i);
+                le_hash = f->compact ? 0 : o->entry.items[i].hash;
                 r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
                 if (r < 0)
                         return r;
 
-                if (le_hash != o->data.hash)
+                if (!f->compact && le_hash != o->data.hash)
                         return -EBADMSG;
 
                 l = le64toh(o->object.size) - offsetof(Object, data.payload);
 
                 compression = o->object.flags & OBJECT_COMPRESSION_MASK;
                 if (compression) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                         if (decompress_startswith(compression,
                                                   o->data.payload, l,
                                                   &f->compress_buffer, &f->compress_buffer_size,
@@ -1971,7 +2334,7 @@ static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **da
 
         compression = o->object.flags & OBJECT_COMPRESSION_MASK;
         if (compression) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                 size_t rsize;
                 int r;
 
@@ -2017,17 +2380,17 @@ _public_ int sd_journal_enumerate_data(sd_journal *j, const void **data, size_t
         if (r < 0)
                 return r;
 
-        n = journal_file_entry_n_items(o);
+        n = journal_file_entry_n_items(f, o);
         if (j->current_field >= n)
                 return 0;
 
-        p = le64toh(o->entry.items[j->current_field].object_offset);
-        le_hash = o->entry.items[j->current_field].hash;
+        p = journal_file_entry_item_object_offset(f, o, j->current_field);
+        le_hash = f->compact ? 0 : o->entry.items[j->current_field].hash;
         r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
         if (r < 0)
                 return r;
 
-        if (le_hash != o->data.hash)
+        if (!f->compact && le_hash != o->data.hash)
                 return -EBADMSG;
 
         r = return_data(j, f, o, data, size);
@@ -2170,14 +2533,33 @@ static void process_inotify_event(sd_journal *j, struct inotify_event *e) {
 }
 
 static int determine_change(sd_journal *j) {
-        bool b;
+        JournalFile *f;
+        Iterator i;
+        bool b, appended = false;
 
         assert(j);
 
         b = j->current_invalidate_counter != j->last_invalidate_counter;
         j->last_invalidate_counter = j->current_invalidate_counter;
 
-        return b ? SD_JOURNAL_INVALIDATE : SD_JOURNAL_APPEND;
+        /* journald touches files for more than appending entries,
+         * and each of those wakes us up. Only report an append if a
+         * file actually gained entries, so that followers don't go
+         * looking for entries that aren't there. */
+        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                uint64_t n;
+
+                n = le64toh(f->header->n_entries);
+                if (n != f->process_n_entries) {
+                        f->process_n_entries = n;
+                        appended = true;
+                }
+        }
+
+        if (b)
+                return SD_JOURNAL_INVALIDATE;
+
+        return appended ? SD_JOURNAL_APPEND : SD_JOURNAL_NOP;
 }
 
 _public_ int sd_journal_process(sd_journal *j) {
@@ -2287,6 +2669,18 @@ _public_ int sd_journal_get_cutoff_realtime_usec(sd_journal *j, uint64_t *from,
                 }
         }
 
+        /* Also account for the files we didn't bother to open */
+        if (j->skipped_head_realtime > 0) {
+                if (first) {
+                        fmin = j->skipped_head_realtime;
+                        tmax = j->skipped_tail_realtime;
+                        first = false;
+                } else {
+                        fmin = MIN(j->skipped_head_realtime, fmin);
+                        tmax = MAX(j->skipped_tail_realtime, tmax);
+                }
+        }
+
         if (from)
                 *from = fmin;
         if (to)
@@ -2390,10 +2784,69 @@ _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
         j->unique_file = NULL;
         j->unique_offset = 0;
         j->unique_file_lost = false;
+        j->unique_values = set_free_free(j->unique_values);
 
         return 0;
 }
 
+/* A value sd_journal_enumerate_unique() returned already. The hash is
+ * the one stored in the data object, which is the same in all files. */
+typedef struct UniqueValue {
+        uint64_t hash;
+        size_t size;
+        uint8_t data[];
+} UniqueValue;
+
+static unsigned long unique_value_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        const UniqueValue *v = p;
+        uint64_t u;
+
+        siphash24((uint8_t*) &u, &v->hash, sizeof(v->hash), hash_key);
+        return (unsigned long) u;
+}
+
+static int unique_value_compare_func(const void *a, const void *b) {
+        const UniqueValue *x = a, *y = b;
+
+        if (x->hash != y->hash)
+                return x->hash < y->hash ? -1 : 1;
+        if (x->size != y->size)
+                return x->size < y->size ? -1 : 1;
+
+        return memcmp(x->data, y->data, x->size);
+}
+
+static const struct hash_ops unique_value_hash_ops = {
+        .hash = unique_value_hash_func,
+        .compare = unique_value_compare_func,
+};
+
+static int unique_value_add(sd_journal *j, uint64_t hash, const void *data, size_t size) {
+        UniqueValue *v;
+        int r;
+
+        assert(j);
+
+        r = set_ensure_allocated(&j->unique_values, &unique_value_hash_ops);
+        if (r < 0)
+                return r;
+
+        v = malloc(offsetof(UniqueValue, data) + size);
+        if (!v)
+                return -ENOMEM;
+
+        v->hash = hash;
+        v->size = size;
+        memcpy(v->data, data, size);
+
+        /* Returns 0 if we had it already */
+        r = set_put(j->unique_values, v);
+        if (r <= 0)
+                free(v);
+
+        return r;
+}
+
 _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_t *l) {
         size_t k;
 
@@ -2417,12 +2870,9 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
         }
 
         for (;;) {
-                JournalFile *of;
-                Iterator i;
                 Object *o;
                 const void *odata;
                 size_t ol;
-                bool found;
                 int r;
 
                 /* Proceed to next data object in the field's linked list */
@@ -2483,32 +2933,14 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                         return -EBADMSG;
                 }
 
-                /* OK, now let's see if we already returned this data
-                 * object by checking if it exists in the earlier
-                 * traversed files. */
-                found = false;
-                ORDERED_HASHMAP_FOREACH(of, j->files, i) {
-                        Object *oo;
-                        uint64_t op;
-
-                        if (of == j->unique_file)
-                                break;
-
-                        /* Skip this file it didn't have any fields
-                         * indexed */
-                        if (JOURNAL_HEADER_CONTAINS(of->header, n_fields) &&
-                            le64toh(of->header->n_fields) <= 0)
-                                continue;
-
-                        r = journal_file_find_data_object_with_hash(of, odata, ol, le64toh(o->data.hash), &oo, &op);
-                        if (r < 0)
-                                return r;
-
-                        if (r > 0)
-                                found = true;
-                }
-
-                if (found)
+                /* OK, now let's see if we already returned this
+                 * value, from this file or an earlier one. Looking
+                 * it up in each earlier file instead gets expensive
+                 * with many files. */
+                r = unique_value_add(j, le64toh(o->data.hash), odata, ol);
+                if (r < 0)
+                        return r;
+                if (r == 0)
                         continue;
 
                 r = return_data(j, j->unique_file, o, data, l);
@@ -2526,6 +2958,7 @@ _public_ void sd_journal_restart_unique(sd_journal *j) {
         j->unique_file = NULL;
         j->unique_offset = 0;
         j->unique_file_lost = false;
+        j->unique_values = set_free_free(j->unique_values);
 }
 
 _public_ int sd_journal_reliable_fd(sd_journal *j) {
@@ -24,11 +24,14 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "log.h"
 #include "macro.h"
 #include "sd-messages.h"
+#include "fileio.h"
+#include "rm-rf.h"
 #include "catalog.h"
 
 static const char *catalog_dirs[] = {
@@ -122,6 +125,82 @@ static void test_catalog_update(void) {
         assert_se(r >= 0);
 }
 
+#define ID_TRANSLATED "cb64f5fc4b9c4e38b4a9f2a6c317e1ad"
+#define ID_MISSING SD_ID128_MAKE(e1,74,26,c4,0b,15,4f,5c,8d,3e,0a,35,b5,f2,a9,91)
+
+static void *catalog_get_thread(void *p) {
+        char *text;
+
+        /* Uses a cache of its own, released when the thread exits */
+        assert_se(catalog_get(p, ID_MISSING, &text) == -ENOENT);
+        assert_se(catalog_get(p, ID_MISSING, &text) == -ENOENT);
+
+        return NULL;
+}
+
+static void test_catalog_get(void) {
+        char dir[] = "/tmp/test-catalog-get.XXXXXX";
+        char db[] = "/tmp/test-catalog-get-db.XXXXXX";
+        const char *dirs[] = { dir, NULL };
+        _cleanup_free_ char *old_locale = NULL;
+        const char *c, *d;
+        sd_id128_t id;
+        char *text;
+        pthread_t t;
+        int fd;
+
+        assert_se(old_locale = strdup(setlocale(LC_MESSAGES, NULL)));
+
+        assert_se(mkdtemp(dir));
+        fd = mkostemp_safe(db, O_RDWR|O_CLOEXEC);
+        assert_se(fd >= 0);
+        safe_close(fd);
+
+        assert_se(sd_id128_from_string(ID_TRANSLATED, &id) >= 0);
+
+        c = strjoina(dir, "/test.catalog");
+        d = strjoina(dir, "/test.de.catalog");
+        assert_se(write_string_file(c, "-- " ID_TRANSLATED "\nSubject: default\n\nfirst\n",
+                                    WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(write_string_file(d, "-- " ID_TRANSLATED "\nSubject: deutsch\n\nerste\n",
+                                    WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(catalog_update(db, NULL, dirs) >= 0);
+
+        /* The translation is picked for de_DE, and the cached text
+         * is dropped once the locale changes */
+        if (setlocale(LC_MESSAGES, "de_DE.UTF-8")) {
+                assert_se(catalog_get(db, id, &text) >= 0);
+                assert_se(startswith(text, "Subject: deutsch"));
+                free(text);
+        } else
+                log_info("de_DE.UTF-8 locale not available, not checking translations.");
+
+        assert_se(setlocale(LC_MESSAGES, "C"));
+        assert_se(catalog_get(db, id, &text) >= 0);
+        assert_se(startswith(text, "Subject: default"));
+        free(text);
+
+        /* Twice, the second time from the cache */
+        assert_se(catalog_get(db, ID_MISSING, &text) == -ENOENT);
+        assert_se(catalog_get(db, ID_MISSING, &text) == -ENOENT);
+
+        assert_se(pthread_create(&t, NULL, catalog_get_thread, db) == 0);
+        assert_se(pthread_join(t, NULL) == 0);
+
+        /* A rebuilt database is picked up right away */
+        assert_se(write_string_file(c, "-- " ID_TRANSLATED "\nSubject: changed\n\nsecond\n",
+                                    WRITE_STRING_FILE_CREATE) >= 0);
+        assert_se(catalog_update(db, NULL, dirs) >= 0);
+        assert_se(catalog_get(db, id, &text) >= 0);
+        assert_se(startswith(text, "Subject: changed"));
+        free(text);
+
+        assert_se(setlocale(LC_MESSAGES, old_locale));
+
+        unlink(db);
+        assert_se(rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
 static void test_catalog_file_lang(void) {
         _cleanup_free_ char *lang = NULL, *lang2 = NULL, *lang3 = NULL, *lang4 = NULL;
 
@@ -165,6 +244,8 @@ int main(int argc, char *argv[]) {
 
         test_catalog_update();
 
+        test_catalog_get();
+
         r = catalog_list(stdout, database, true);
         assert_se(r >= 0);
 
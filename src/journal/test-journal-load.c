@@ -0,0 +1,393 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <syslog.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+#include "util.h"
+#include "strv.h"
+#include "time-util.h"
+
+/* Generates log traffic for the journald of the running system, from
+ * a number of clients at a fixed rate each, and tells how fast they
+ * got rid of it. To see what journald made of it send it SIGRTMIN+2
+ * afterwards, and look at /run/systemd/journal/statistics. */
+
+typedef enum LoadSource {
+        LOAD_SOURCE_NATIVE,
+        LOAD_SOURCE_SYSLOG,
+        LOAD_SOURCE_STDOUT,
+        _LOAD_SOURCE_MAX,
+        _LOAD_SOURCE_INVALID = -1
+} LoadSource;
+
+static const char* const load_source_table[_LOAD_SOURCE_MAX] = {
+        [LOAD_SOURCE_NATIVE] = "native",
+        [LOAD_SOURCE_SYSLOG] = "syslog",
+        [LOAD_SOURCE_STDOUT] = "stdout",
+};
+
+DEFINE_PRIVATE_STRING_TABLE_LOOKUP(load_source, LoadSource);
+
+/* What a client reports back to the parent, small enough to be
+ * written to the pipe atomically */
+typedef struct LoadResult {
+        LoadSource source;
+        uint64_t n_sent;
+        uint64_t n_failed;
+        nsec_t send_nsec;
+        nsec_t send_nsec_max;
+} LoadResult;
+
+static unsigned arg_clients = 4;
+static unsigned arg_rate = 1000;
+static usec_t arg_time = 10 * USEC_PER_SEC;
+static size_t arg_size = 80;
+static bool arg_sources[_LOAD_SOURCE_MAX] = { true, true, true };
+
+static void help(void) {
+        printf("%s [OPTIONS...]\n\n"
+               "Generate log traffic for journald.\n\n"
+               "  -h --help             Show this help\n"
+               "  -n --clients=N        Number of clients (default: %u)\n"
+               "  -r --rate=N           Messages per second per client, 0 for as\n"
+               "                        many as possible (default: %u)\n"
+               "  -t --time=SEC         Duration of the run (default: %s)\n"
+               "  -s --size=BYTES       Length of each message (default: %zu)\n"
+               "     --source=SOURCES   Comma separated list of native, syslog\n"
+               "                        and stdout; clients are assigned to them\n"
+               "                        in turn (default: all)\n",
+               program_invocation_short_name,
+               arg_clients, arg_rate, "10s", arg_size);
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_SOURCE = 0x100,
+        };
+
+        static const struct option options[] = {
+                { "help",    no_argument,       NULL, 'h'        },
+                { "clients", required_argument, NULL, 'n'        },
+                { "rate",    required_argument, NULL, 'r'        },
+                { "time",    required_argument, NULL, 't'        },
+                { "size",    required_argument, NULL, 's'        },
+                { "source",  required_argument, NULL, ARG_SOURCE },
+                {}
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "hn:r:t:s:", options, NULL)) >= 0)
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case 'n':
+                        r = safe_atou(optarg, &arg_clients);
+                        if (r < 0 || arg_clients == 0) {
+                                log_error("Failed to parse number of clients: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case 'r':
+                        r = safe_atou(optarg, &arg_rate);
+                        if (r < 0) {
+                                log_error("Failed to parse rate: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case 't':
+                        r = parse_sec(optarg, &arg_time);
+                        if (r < 0 || arg_time == 0) {
+                                log_error("Failed to parse duration: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case 's': {
+                        uint64_t sz;
+
+                        r = parse_size(optarg, 1024, &sz);
+                        if (r < 0 || sz == 0 || sz > LINE_MAX) {
+                                log_error("Failed to parse message size: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        arg_size = (size_t) sz;
+                        break;
+                }
+
+                case ARG_SOURCE: {
+                        _cleanup_strv_free_ char **l = NULL;
+                        char **p;
+
+                        l = strv_split(optarg, ",");
+                        if (!l)
+                                return log_oom();
+
+                        zero(arg_sources);
+
+                        STRV_FOREACH(p, l) {
+                                LoadSource t;
+
+                                t = load_source_from_string(*p);
+                                if (t < 0) {
+                                        log_error("Unknown source: %s", *p);
+                                        return -EINVAL;
+                                }
+
+                                arg_sources[t] = true;
+                        }
+
+                        if (strv_isempty(l)) {
+                                log_error("No source specified.");
+                                return -EINVAL;
+                        }
+                        break;
+                }
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        assert_not_reached("Unhandled option");
+                }
+
+        return 1;
+}
+
+static LoadSource source_of_client(unsigned k) {
+        unsigned n = 0;
+        LoadSource t;
+
+        for (t = 0; t < _LOAD_SOURCE_MAX; t++)
+                n += arg_sources[t];
+
+        k %= n;
+
+        for (t = 0; t < _LOAD_SOURCE_MAX; t++)
+                if (arg_sources[t] && k-- == 0)
+                        return t;
+
+        assert_not_reached("No sources");
+}
+
+static int run_client(unsigned k, LoadSource source, int result_fd) {
+        _cleanup_close_ int stream_fd = -1;
+        _cleanup_free_ char *buf = NULL;
+        char identifier[sizeof("journal-load-") + DECIMAL_STR_MAX(unsigned)];
+        LoadResult result = {
+                .source = source,
+        };
+        nsec_t start, end;
+        uint64_t i;
+
+        xsprintf(identifier, "journal-load-%u", k);
+
+        switch (source) {
+
+        case LOAD_SOURCE_SYSLOG:
+                openlog(identifier, LOG_NDELAY, LOG_USER);
+                break;
+
+        case LOAD_SOURCE_STDOUT:
+                stream_fd = sd_journal_stream_fd(identifier, LOG_INFO, false);
+                if (stream_fd < 0)
+                        return log_error_errno(stream_fd, "Failed to create stream fd: %m");
+                break;
+
+        default:
+                break;
+        }
+
+        /* Room for the text, a newline and the NUL */
+        buf = malloc(arg_size + 2);
+        if (!buf)
+                return log_oom();
+
+        start = now_nsec(CLOCK_MONOTONIC);
+        end = start + arg_time * NSEC_PER_USEC;
+
+        for (i = 0;; i++) {
+                nsec_t before, t;
+                size_t l;
+                int r;
+
+                if (arg_rate > 0) {
+                        struct timespec ts;
+
+                        /* Keep to the schedule, rather than sleeping
+                         * a fixed time after each message */
+                        t = start + i * NSEC_PER_SEC / arg_rate;
+                        if (t >= end)
+                                break;
+
+                        ts.tv_sec = t / NSEC_PER_SEC;
+                        ts.tv_nsec = t % NSEC_PER_SEC;
+                        (void) clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                }
+
+                before = now_nsec(CLOCK_MONOTONIC);
+                if (arg_rate == 0 && before >= end)
+                        break;
+
+                l = snprintf(buf, arg_size + 1, "Load client %u message %" PRIu64 " ", k, i);
+                l = MIN(l, arg_size);
+                memset(buf + l, 'x', arg_size - l);
+                buf[arg_size] = 0;
+
+                switch (source) {
+
+                case LOAD_SOURCE_NATIVE:
+                        r = sd_journal_send("MESSAGE=%s", buf,
+                                            "PRIORITY=6",
+                                            "SYSLOG_IDENTIFIER=%s", identifier,
+                                            "LOAD_SEQNUM=%" PRIu64, i,
+                                            NULL);
+                        break;
+
+                case LOAD_SOURCE_SYSLOG:
+                        syslog(LOG_INFO, "%s", buf);
+                        r = 0;
+                        break;
+
+                case LOAD_SOURCE_STDOUT:
+                        buf[arg_size] = '\n';
+                        r = loop_write(stream_fd, buf, arg_size + 1, true);
+                        break;
+
+                default:
+                        assert_not_reached("Unknown source");
+                }
+
+                t = now_nsec(CLOCK_MONOTONIC) - before;
+
+                if (r < 0)
+                        result.n_failed++;
+                else
+                        result.n_sent++;
+
+                result.send_nsec += t;
+                result.send_nsec_max = MAX(result.send_nsec_max, t);
+        }
+
+        if (source == LOAD_SOURCE_SYSLOG)
+                closelog();
+
+        return loop_write(result_fd, &result, sizeof(result), false);
+}
+
+int main(int argc, char *argv[]) {
+        LoadResult totals[_LOAD_SOURCE_MAX] = {};
+        unsigned n_clients[_LOAD_SOURCE_MAX] = {};
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        LoadResult result;
+        LoadSource t;
+        unsigned k, n_running = 0;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        if (pipe2(pair, O_CLOEXEC) < 0) {
+                log_error_errno(errno, "Failed to create pipe: %m");
+                return EXIT_FAILURE;
+        }
+
+        for (k = 0; k < arg_clients; k++) {
+                pid_t pid;
+
+                pid = fork();
+                if (pid < 0) {
+                        log_error_errno(errno, "Failed to fork: %m");
+                        break;
+                }
+
+                if (pid == 0) {
+                        pair[0] = safe_close(pair[0]);
+                        r = run_client(k, source_of_client(k), pair[1]);
+                        _exit(r < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+                }
+
+                n_running++;
+        }
+
+        pair[1] = safe_close(pair[1]);
+
+        /* The results arrive as the clients finish */
+        while (loop_read_exact(pair[0], &result, sizeof(result), true) >= 0) {
+                LoadResult *s;
+
+                assert_se(result.source >= 0 && result.source < _LOAD_SOURCE_MAX);
+
+                s = totals + result.source;
+                s->n_sent += result.n_sent;
+                s->n_failed += result.n_failed;
+                s->send_nsec += result.send_nsec;
+                s->send_nsec_max = MAX(s->send_nsec_max, result.send_nsec_max);
+                n_clients[result.source]++;
+        }
+
+        for (; n_running > 0; n_running--)
+                (void) wait(NULL);
+
+        printf("%-8s %8s %12s %10s %12s %12s %12s\n",
+               "SOURCE", "CLIENTS", "SENT", "FAILED", "MSG/S", "AVG SEND", "MAX SEND");
+
+        for (t = 0; t < _LOAD_SOURCE_MAX; t++) {
+                char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX];
+                LoadResult *s = totals + t;
+                uint64_t n;
+
+                if (n_clients[t] == 0)
+                        continue;
+
+                n = s->n_sent + s->n_failed;
+
+                printf("%-8s %8u %12" PRIu64 " %10" PRIu64 " %12.0f %12s %12s\n",
+                       load_source_to_string(t),
+                       n_clients[t],
+                       s->n_sent,
+                       s->n_failed,
+                       (double) s->n_sent * USEC_PER_SEC / arg_time,
+                       format_timespan(a, sizeof(a), n > 0 ? s->send_nsec / n / NSEC_PER_USEC : 0, 1),
+                       format_timespan(b, sizeof(b), s->send_nsec_max / NSEC_PER_USEC, 1));
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -81,6 +81,9 @@ int main(int argc, char *argv[]) {
         const void *data;
         size_t l;
         dual_timestamp previous_ts = DUAL_TIMESTAMP_NULL;
+        usec_t middle_realtime = 0, from, to, bounded_from, bounded_to;
+        le64_t future;
+        int fd;
 
         /* journal_file_open requires a valid machine id */
         if (access("/etc/machine-id", F_OK) != 0)
@@ -110,6 +113,9 @@ int main(int argc, char *argv[]) {
 
                 previous_ts = ts;
 
+                if (i == N_ENTRIES / 2)
+                        middle_realtime = ts.realtime;
+
                 assert_se(asprintf(&p, "NUMBER=%u", i) >= 0);
                 iovec[0].iov_base = p;
                 iovec[0].iov_len = strlen(p);
@@ -185,10 +191,82 @@ int main(int argc, char *argv[]) {
 
         verify_contents(j, 0);
 
+        printf("NEXT TEST\n");
+        sd_journal_flush_matches(j);
+        for (i = 0; i < N_ENTRIES; i += 8) {
+                char *p;
+
+                assert_se(asprintf(&p, "NUMBER=%u", i) >= 0);
+                assert_se(sd_journal_add_match(j, p, 0) >= 0);
+                free(p);
+        }
+
+        verify_contents(j, 8);
+
+        /* And the same again backwards, after changing direction */
+        i = 0;
+        SD_JOURNAL_FOREACH_BACKWARDS(j)
+                i++;
+        assert_se(i == N_ENTRIES / 8);
+
+        verify_contents(j, 8);
+
+        /* Seeking by time, and continuing from there, in both directions */
+        sd_journal_flush_matches(j);
+        assert_se(sd_journal_seek_realtime_usec(j, middle_realtime) >= 0);
+        for (i = 0; sd_journal_next(j) > 0; i++) {
+                unsigned u;
+
+                assert_se(sd_journal_get_data(j, "NUMBER", &data, &l) >= 0);
+                assert_se(safe_atou(strndupa((const char*) data + 7, l - 7), &u) >= 0);
+                assert_se(u == N_ENTRIES / 2 + i);
+        }
+        assert_se(i == N_ENTRIES / 2);
+
+        assert_se(sd_journal_seek_realtime_usec(j, middle_realtime) >= 0);
+        for (i = 0; sd_journal_previous(j) > 0; i++)
+                ;
+        assert_se(i == N_ENTRIES / 2 + 1);
+
         assert_se(sd_journal_query_unique(j, "NUMBER") >= 0);
         SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
                 printf("%.*s\n", (int) l, (const char*) data);
 
+        /* Files entirely after the requested time range are not
+         * opened, but still show up in the cutoff */
+        assert_se(sd_journal_get_cutoff_realtime_usec(j, &from, &to) > 0);
+        sd_journal_close(j);
+
+        assert_se(journal_open_bounded(&j, t, 0, 0, from - 1) >= 0);
+        assert_se(ordered_hashmap_isempty(j->files));
+        assert_se(sd_journal_next(j) == 0);
+        assert_se(sd_journal_get_cutoff_realtime_usec(j, &bounded_from, &bounded_to) > 0);
+        assert_se(bounded_from == from);
+        assert_se(bounded_to == to);
+        sd_journal_close(j);
+
+        assert_se(journal_open_bounded(&j, t, 0, from, to) >= 0);
+        assert_se(ordered_hashmap_size(j->files) == 3);
+        i = 0;
+        SD_JOURNAL_FOREACH(j)
+                i++;
+        assert_se(i == N_ENTRIES);
+        sd_journal_close(j);
+        j = NULL;
+
+        /* A tail in the future means the clock was off, such files
+         * are opened anyway */
+        fd = open("three.journal", O_WRONLY|O_CLOEXEC);
+        assert_se(fd >= 0);
+        future = htole64(now(CLOCK_REALTIME) + USEC_PER_DAY);
+        assert_se(pwrite(fd, &future, sizeof(future), offsetof(Header, tail_entry_realtime)) == sizeof(future));
+        fd = safe_close(fd);
+
+        assert_se(journal_open_bounded(&j, t, 0, 0, from - 1) >= 0);
+        assert_se(ordered_hashmap_size(j->files) == 1);
+        sd_journal_close(j);
+        j = NULL;
+
         assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
 
         return 0;
@@ -66,11 +66,10 @@ static int raw_verify(const char *fn, const char *verification_key) {
         return r;
 }
 
-int main(int argc, char *argv[]) {
+static void test_verify(const char *verification_key, bool compact) {
         char t[] = "/tmp/journal-XXXXXX";
         unsigned n;
         JournalFile *f;
-        const char *verification_key = argv[1];
         usec_t from = 0, to = 0, total = 0;
         char a[FORMAT_TIMESTAMP_MAX];
         char b[FORMAT_TIMESTAMP_MAX];
@@ -78,11 +77,10 @@ int main(int argc, char *argv[]) {
         struct stat st;
         uint64_t p;
 
-        /* journal_file_open requires a valid machine id */
-        if (access("/etc/machine-id", F_OK) != 0)
-                return EXIT_TEST_SKIP;
-
-        log_set_max_level(LOG_DEBUG);
+        if (compact)
+                assert_se(setenv("SYSTEMD_JOURNAL_COMPACT", "1", 1) >= 0);
+        else
+                assert_se(unsetenv("SYSTEMD_JOURNAL_COMPACT") >= 0);
 
         assert_se(mkdtemp(t));
         assert_se(chdir(t) >= 0);
@@ -90,6 +88,7 @@ int main(int argc, char *argv[]) {
         log_info("Generating...");
 
         assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, !!verification_key, NULL, NULL, NULL, &f) == 0);
+        assert_se(f->compact == compact);
 
         for (n = 0; n < N_ENTRIES; n++) {
                 struct iovec iovec;
@@ -113,6 +112,7 @@ int main(int argc, char *argv[]) {
         log_info("Verifying...");
 
         assert_se(journal_file_open("test.journal", O_RDONLY, 0666, true, !!verification_key, NULL, NULL, NULL, &f) == 0);
+        assert_se(JOURNAL_HEADER_COMPACT(f->header) == compact);
         /* journal_file_print_header(f); */
         journal_file_dump(f);
 
@@ -143,9 +143,22 @@ int main(int argc, char *argv[]) {
                 }
         }
 
-        log_info("Exiting...");
-
         assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        const char *verification_key = argv[1];
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        log_set_max_level(LOG_DEBUG);
+
+        test_verify(verification_key, false);
+        test_verify(verification_key, true);
+
+        log_info("Exiting...");
 
         return 0;
 }
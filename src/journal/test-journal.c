@@ -27,6 +27,7 @@
 #include "journal-file.h"
 #include "journal-authenticate.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
 
 static bool arg_keep = false;
 
@@ -166,6 +167,348 @@ static void test_empty(void) {
         journal_file_close(f4);
 }
 
+static void test_append_entries(void) {
+        JournalEntry entries[500];
+        struct iovec iovec[2];
+        static const char test[] = "TEST1=1", test2[] = "TEST2=2";
+        JournalFile *f;
+        Object *o;
+        uint64_t p, seqnum = 0, i;
+        unsigned n;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+
+        iovec[0].iov_base = (void*) test;
+        iovec[0].iov_len = strlen(test);
+        iovec[1].iov_base = (void*) test2;
+        iovec[1].iov_len = strlen(test2);
+
+        for (i = 0; i < ELEMENTSOF(entries); i++) {
+                dual_timestamp_get(&entries[i].ts);
+                entries[i].seqnum = 0;
+                entries[i].iovec = iovec;
+                entries[i].n_iovec = 1 + (i % 2);
+        }
+
+        assert_se(journal_file_append_entries(f, entries, ELEMENTSOF(entries), &seqnum, &n) == 0);
+        assert_se(n == ELEMENTSOF(entries));
+        assert_se(seqnum == ELEMENTSOF(entries));
+
+        /* Single entries and batches must link up the same way */
+        assert_se(journal_file_append_entry(f, NULL, iovec, 2, &seqnum, NULL, NULL) == 0);
+        assert_se(journal_file_append_entries(f, entries, 2, &seqnum, &n) == -EINVAL);
+        assert_se(n == 0);
+
+        dual_timestamp_get(&entries[0].ts);
+        assert_se(journal_file_append_entries(f, entries, 1, &seqnum, &n) == 0);
+        assert_se(n == 1);
+
+        /* Reserved sequence numbers are honoured and bump the counter */
+        dual_timestamp_get(&entries[0].ts);
+        entries[0].seqnum = 1000;
+        assert_se(journal_file_append_entries(f, entries, 1, &seqnum, &n) == 0);
+        assert_se(n == 1);
+        assert_se(seqnum == 1000);
+
+        assert_se(le64toh(f->header->n_entries) == ELEMENTSOF(entries) + 3);
+
+        p = 0;
+        for (i = 1; i <= ELEMENTSOF(entries) + 2; i++) {
+                assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+                assert_se(le64toh(o->entry.seqnum) == i);
+        }
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 1000);
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 0);
+
+        assert_se(journal_file_find_data_object(f, test2, strlen(test2), NULL, &p) == 1);
+        assert_se(journal_file_move_to_object(f, OBJECT_DATA, p, &o) == 0);
+        assert_se(le64toh(o->data.n_entries) == ELEMENTSOF(entries) / 2 + 1);
+
+        journal_file_close(f);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_append_entries_compressed(void) {
+        JournalEntry entries[8];
+        struct iovec iovec[ELEMENTSOF(entries)][3];
+        char *data[ELEMENTSOF(entries)][2];
+        _cleanup_free_ char *common = NULL;
+        JournalFile *f;
+        Object *o;
+        uint64_t p, seqnum = 0;
+        unsigned i, j, n;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        /* One field shared by all entries, and two large ones unique
+         * to each, so that the batch is compressed in parallel */
+        common = malloc(16 * 1024 + 1);
+        assert_se(common);
+        memcpy(common, "COMMON=", 7);
+        memset(common + 7, 'c', 16 * 1024 - 7);
+        common[16 * 1024] = 0;
+
+        for (i = 0; i < ELEMENTSOF(entries); i++) {
+                for (j = 0; j < 2; j++) {
+                        data[i][j] = malloc(16 * 1024 + 1);
+                        assert_se(data[i][j]);
+                        assert_se(snprintf(data[i][j], 32, "LARGE%u=%u", j, i) > 0);
+                        memset(data[i][j] + strlen(data[i][j]), 'a' + i, 16 * 1024 - strlen(data[i][j]));
+                        data[i][j][16 * 1024] = 0;
+
+                        iovec[i][j].iov_base = data[i][j];
+                        iovec[i][j].iov_len = 16 * 1024;
+                }
+
+                iovec[i][2].iov_base = common;
+                iovec[i][2].iov_len = 16 * 1024;
+
+                dual_timestamp_get(&entries[i].ts);
+                entries[i].seqnum = 0;
+                entries[i].iovec = iovec[i];
+                entries[i].n_iovec = 3;
+        }
+
+        assert_se(journal_file_append_entries(f, entries, ELEMENTSOF(entries), &seqnum, &n) == 0);
+        assert_se(n == ELEMENTSOF(entries));
+        assert_se(seqnum == ELEMENTSOF(entries));
+
+        p = 0;
+        for (i = 0; i < ELEMENTSOF(entries); i++) {
+                assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+                assert_se(le64toh(o->entry.seqnum) == i + 1);
+                assert_se(journal_file_entry_n_items(f, o) == 3);
+        }
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 0);
+
+        for (i = 0; i < ELEMENTSOF(entries); i++)
+                for (j = 0; j < 2; j++) {
+                        assert_se(journal_file_find_data_object(f, data[i][j], 16 * 1024, &o, NULL) == 1);
+                        assert_se(le64toh(o->data.n_entries) == 1);
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+                        assert_se(o->object.flags & OBJECT_COMPRESSION_MASK);
+#endif
+                        free(data[i][j]);
+                }
+
+        assert_se(journal_file_find_data_object(f, common, 16 * 1024, &o, NULL) == 1);
+        assert_se(le64toh(o->data.n_entries) == ELEMENTSOF(entries));
+        assert_se(le64toh(f->header->n_data) == 2 * ELEMENTSOF(entries) + 1);
+
+        journal_file_close(f);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void append_entries(JournalFile *f, unsigned n) {
+        static const char test[] = "TEST1=1";
+        struct iovec iovec[2];
+        char buf[sizeof("TEST2=") + DECIMAL_STR_MAX(unsigned)];
+        dual_timestamp ts;
+        unsigned i;
+
+        iovec[0].iov_base = (void*) test;
+        iovec[0].iov_len = strlen(test);
+
+        for (i = 0; i < n; i++) {
+                xsprintf(buf, "TEST2=%u", i % 7);
+                iovec[1].iov_base = buf;
+                iovec[1].iov_len = strlen(buf);
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, iovec, 2, NULL, NULL, NULL) == 0);
+        }
+}
+
+static void check_entries(JournalFile *f, unsigned n) {
+        static const char test[] = "TEST1=1";
+        Object *o, *d;
+        uint64_t p = 0, q, last = 0, l;
+        unsigned i, j;
+
+        for (i = 0; i < n; i++) {
+                char buf[sizeof("TEST2=") + DECIMAL_STR_MAX(unsigned)];
+                bool found = false;
+
+                assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+                assert_se(journal_file_entry_n_items(f, o) == 2);
+
+                xsprintf(buf, "TEST2=%u", i % 7);
+
+                for (j = 0; j < 2; j++) {
+                        q = journal_file_entry_item_object_offset(f, o, j);
+                        assert_se(journal_file_move_to_object(f, OBJECT_DATA, q, &d) == 0);
+
+                        if (le64toh(d->object.size) - offsetof(Object, data.payload) == strlen(buf) &&
+                            memcmp(d->data.payload, buf, strlen(buf)) == 0)
+                                found = true;
+
+                        assert_se(journal_file_move_to_object(f, OBJECT_ENTRY, p, &o) == 0);
+                }
+
+                assert_se(found);
+                last = p;
+        }
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 0);
+
+        assert_se(journal_file_find_data_object(f, test, strlen(test), NULL, &q) == 1);
+        assert_se(journal_file_next_entry_for_data(f, NULL, 0, q, DIRECTION_UP, &o, &l) == 1);
+        assert_se(l == last);
+        assert_se(journal_file_move_to_object(f, OBJECT_DATA, q, &d) == 0);
+        assert_se(le64toh(d->data.n_entries) == n);
+}
+
+static void copy_entries(JournalFile *from, JournalFile *to) {
+        Object *o;
+        uint64_t p = 0;
+
+        while (journal_file_next_entry(from, p, DIRECTION_DOWN, &o, &p) > 0)
+                assert_se(journal_file_copy_entry(from, to, o, p, NULL, NULL, NULL) >= 0);
+}
+
+static void test_compact(void) {
+        JournalFile *f, *g, *h;
+        char t[] = "/tmp/journal-XXXXXX";
+        const unsigned n = 1000;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* Writing and reading back */
+        assert_se(setenv("SYSTEMD_JOURNAL_COMPACT", "1", 1) >= 0);
+        assert_se(journal_file_open("compact.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(f->compact);
+        assert_se(JOURNAL_HEADER_COMPACT(f->header));
+
+        append_entries(f, n);
+        check_entries(f, n);
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+
+        /* Copying from compact to regular and back again */
+        assert_se(unsetenv("SYSTEMD_JOURNAL_COMPACT") >= 0);
+        assert_se(journal_file_open("regular.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &g) == 0);
+        assert_se(!g->compact);
+        assert_se(!JOURNAL_HEADER_COMPACT(g->header));
+
+        copy_entries(f, g);
+        check_entries(g, n);
+        assert_se(journal_file_verify(g, NULL, NULL, NULL, NULL, false) >= 0);
+
+        assert_se(journal_file_open("copy.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, f, &h) == 0);
+        assert_se(h->compact);
+
+        copy_entries(g, h);
+        check_entries(h, n);
+        assert_se(journal_file_verify(h, NULL, NULL, NULL, NULL, false) >= 0);
+
+        journal_file_close(f);
+        journal_file_close(g);
+        journal_file_close(h);
+
+        /* The flag is picked up again when opening an existing file */
+        assert_se(journal_file_open("compact.journal", O_RDONLY, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(f->compact);
+        check_entries(f, n);
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+        journal_file_close(f);
+
+        /* Rotated files stay compact */
+        assert_se(journal_file_open("copy.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &h) == 0);
+        assert_se(journal_file_rotate(&h, true, false) >= 0);
+        assert_se(h->compact);
+        journal_file_close(h);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static unsigned count_journal_files(const char *path) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        unsigned n = 0;
+
+        assert_se(d = opendir(path));
+
+        FOREACH_DIRENT(de, d, assert_not_reached("readdir() failed"))
+                if (endswith(de->d_name, ".journal"))
+                        n++;
+
+        return n;
+}
+
+static void test_vacuum_directory(void) {
+        _cleanup_vacuum_directory_free_ VacuumDirectory *d = NULL;
+        static const char test[] = "TEST1=1";
+        char t[] = "/tmp/journal-vacuum-XXXXXX";
+        struct iovec iovec;
+        dual_timestamp ts;
+        JournalFile *f;
+        uint64_t before, after;
+        unsigned i;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+
+        assert_se(vacuum_directory_new(&d, t, true) >= 0);
+        assert_se(vacuum_directory_get_usage(d, &before) >= 0);
+        assert_se(before > 0);
+
+        /* The inventory has to pick these up via inotify */
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+        for (i = 0; i < 3; i++) {
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+                assert_se(journal_file_rotate(&f, false, false) >= 0);
+        }
+
+        /* And an empty one */
+        assert_se(journal_file_rotate(&f, false, false) >= 0);
+        assert_se(count_journal_files(t) == 5);
+
+        assert_se(vacuum_directory_get_usage(d, &after) >= 0);
+        assert_se(after > before);
+
+        /* Within the limits only the empty file is removed */
+        assert_se(vacuum_directory_vacuum(d, after * 2, 0, NULL, true) >= 0);
+        assert_se(count_journal_files(t) == 4);
+
+        assert_se(vacuum_directory_vacuum(d, 1, 0, NULL, true) >= 0);
+        assert_se(count_journal_files(t) == 1);
+
+        assert_se(vacuum_directory_get_usage(d, &after) >= 0);
+        assert_se(after <= before * 2);
+
+        journal_file_close(f);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
 int main(int argc, char *argv[]) {
         arg_keep = argc > 1;
 
@@ -175,6 +518,10 @@ int main(int argc, char *argv[]) {
 
         test_non_empty();
         test_empty();
+        test_append_entries();
+        test_append_entries_compressed();
+        test_compact();
+        test_vacuum_directory();
 
         return 0;
 }
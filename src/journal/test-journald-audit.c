@@ -0,0 +1,146 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdarg.h>
+
+#include "util.h"
+#include "journald-audit.h"
+
+static Server server;
+
+/* Maps the given record, and checks that exactly the fields listed
+ * in the NULL terminated arguments came out of it, in order */
+static void test_map(const char *record, ...) {
+        _cleanup_free_ struct iovec *iov = NULL;
+        size_t n_iov_allocated = 0;
+        unsigned n_iov = 0, i;
+        const char *field;
+        va_list ap;
+
+        log_info("Mapping: %s", record);
+
+        assert_se(audit_map_fields(&server, record, &iov, &n_iov_allocated, &n_iov) >= 0);
+
+        for (i = 0; i < n_iov; i++)
+                log_info("        %.*s", (int) iov[i].iov_len, (const char*) iov[i].iov_base);
+
+        va_start(ap, record);
+        for (i = 0; (field = va_arg(ap, const char*)); i++) {
+                assert_se(i < n_iov);
+                assert_se(iov[i].iov_len == strlen(field));
+                assert_se(memcmp(iov[i].iov_base, field, iov[i].iov_len) == 0);
+        }
+        va_end(ap);
+
+        assert_se(i == n_iov);
+}
+
+static void test_kernel_fields(void) {
+        test_map("pid=1 uid=0 auid=4294967295 ses=4294967295 subj=system_u:system_r:init_t:s0",
+                 "_PID=1",
+                 "_UID=0",
+                 "_AUDIT_LOGINUID=4294967295",
+                 "_AUDIT_SESSION=4294967295",
+                 "_SELINUX_CONTEXT=system_u:system_r:init_t:s0",
+                 NULL);
+
+        /* Quoted values may contain spaces */
+        test_map("comm=\"systemd\" exe=\"/usr/lib/systemd/my systemd\" key=(null)",
+                 "_COMM=systemd",
+                 "_EXE=/usr/lib/systemd/my systemd",
+                 "_AUDIT_FIELD_KEY=(null)",
+                 NULL);
+
+        /* Unknown fields are mapped generically, as far as their
+         * names are short and sane enough */
+        test_map("  arch=c000003e  syscall=59 success=yes new-ses=3 a.b=c averyveryverylongname=1 =x",
+                 "_AUDIT_FIELD_ARCH=c000003e",
+                 "_AUDIT_FIELD_SYSCALL=59",
+                 "_AUDIT_FIELD_SUCCESS=yes",
+                 "_AUDIT_FIELD_NEW_SES=3",
+                 NULL);
+
+        test_map("", NULL);
+}
+
+static void test_hex_fields(void) {
+        /* Hex escaped values are decoded, for the command line with
+         * the NUL separators replaced */
+        test_map("comm=6C73 proctitle=2F62696E2F7368002D630074727565",
+                 "_COMM=ls",
+                 "_CMDLINE=/bin/sh -c true",
+                 NULL);
+
+        /* Odd length and invalid hex is kept as it is */
+        test_map("comm=6C7 exe=2F6G69 proctitle=2F62696E2",
+                 "_AUDIT_FIELD_COMM=6C7",
+                 "_AUDIT_FIELD_EXE=2F6G69",
+                 "_AUDIT_FIELD_PROCTITLE=2F62696E2",
+                 NULL);
+
+        /* So is a value with a missing closing quote */
+        test_map("exe=\"/usr/bin/foo pid=1",
+                 "_AUDIT_FIELD_EXE=\"/usr/bin/foo",
+                 "_PID=1",
+                 NULL);
+}
+
+static void test_userspace_fields(void) {
+        /* Fields after msg=' are untrusted, and only get the mapping
+         * for userspace, if any */
+        test_map("pid=1 uid=0 msg='unit=foo.service comm=\"systemd\" exe=\"/usr/lib/systemd/systemd\" pid=42 cwd=\"/\" hostname=? res=success'",
+                 "_PID=1",
+                 "_UID=0",
+                 "AUDIT_FIELD_UNIT=foo.service",
+                 "AUDIT_FIELD_COMM=systemd",
+                 "AUDIT_FIELD_EXE=/usr/lib/systemd/systemd",
+                 "AUDIT_FIELD_PID=42",
+                 "AUDIT_FIELD_CWD=/",
+                 "AUDIT_FIELD_HOSTNAME=?",
+                 "AUDIT_FIELD_RES=success",
+                 NULL);
+
+        /* A userspace message can't smuggle in a closing quote and
+         * trusted fields after it */
+        test_map("pid=1 msg='op=start' pid=2 comm=\"evil\"'",
+                 "_PID=1",
+                 "AUDIT_FIELD_OP=start'",
+                 "AUDIT_FIELD_PID=2",
+                 "AUDIT_FIELD_COMM=evil",
+                 NULL);
+
+        /* Without the final quotation mark the message is dropped */
+        test_map("pid=1 msg='op=start res=success",
+                 "_PID=1",
+                 NULL);
+
+        test_map("msg=''", NULL);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+
+        test_kernel_fields();
+        test_hex_fields();
+        test_userspace_fields();
+
+        free(server.audit_buffer);
+
+        return 0;
+}
@@ -0,0 +1,61 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <unistd.h>
+
+#include "journald-context.h"
+#include "macro.h"
+#include "util.h"
+
+int main(void) {
+        ClientContextCache *c;
+        ClientContext *a, *b;
+
+        assert_se(c = client_context_cache_new(USEC_PER_SEC));
+
+        /* The first lookup reads from /proc, the second is a hit */
+        assert_se(client_context_get(c, getpid(), NULL, USEC_PER_SEC, &a) == 1);
+        assert_se(a->pid == getpid());
+        assert_se(a->uid_valid && a->uid == getuid());
+        assert_se(a->gid_valid && a->gid == getgid());
+        assert_se(a->comm);
+
+        assert_se(client_context_get(c, getpid(), NULL, USEC_PER_SEC + 10, &b) == 0);
+        assert_se(a == b);
+        assert_se(client_context_cache_size(c) == 1);
+
+        /* Once the TTL passed, the entry is refreshed */
+        assert_se(client_context_get(c, getpid(), NULL, 2*USEC_PER_SEC, &b) == 1);
+        assert_se(a == b);
+
+        /* A different binary behind /proc/$PID/exe means the process
+         * called exec() in the meantime */
+        assert_se(a->exe_id_valid);
+        a->exe_ino++;
+        assert_se(client_context_get(c, getpid(), NULL, 2*USEC_PER_SEC + 10, &b) == 1);
+        assert_se(a == b);
+        assert_se(client_context_get(c, getpid(), NULL, 2*USEC_PER_SEC + 20, &b) == 0);
+
+        client_context_flush(c, getpid());
+        assert_se(client_context_cache_size(c) == 0);
+
+        client_context_cache_free(c);
+
+        return 0;
+}
@@ -32,6 +32,7 @@ int main(int argc, char *argv[]) {
         int x, y, z, r;
         char px[] = "/tmp/testmmapXXXXXXX", py[] = "/tmp/testmmapYXXXXXX", pz[] = "/tmp/testmmapZXXXXXX";
         MMapCache *m;
+        uint64_t o;
         void *p, *q;
 
         assert_se(m = mmap_cache_new());
@@ -71,6 +72,20 @@ int main(int argc, char *argv[]) {
 
         mmap_cache_unref(m);
 
+        /* Walking a file front to back should result in growing windows */
+        assert_se(m = mmap_cache_new());
+        assert_se(ftruncate(y, 64ULL*1024ULL*1024ULL) >= 0);
+
+        for (o = 0; o < 64ULL*1024ULL*1024ULL; o += 1024ULL*1024ULL) {
+                r = mmap_cache_get(m, y, PROT_READ, 0, false, o, 2, NULL, &p);
+                assert_se(r >= 0);
+        }
+
+        assert_se(mmap_cache_get_missed(m) < 8);
+        assert_se(mmap_cache_get_sequential(m) > 0);
+
+        mmap_cache_unref(m);
+
         safe_close(x);
         safe_close(y);
         safe_close(z);
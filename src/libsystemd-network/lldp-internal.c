@@ -28,6 +28,9 @@
 /* Maximum Ports can be attached to any chassis */
 #define LLDP_MIB_MAX_PORT_PER_CHASSIS 32
 
+/* Maximum neighbours, i.e. ports of all chassis, we keep per local port */
+#define LLDP_MIB_MAX_NEIGHBOURS 256
+
 int lldp_read_chassis_id(tlv_packet *tlv,
                          uint8_t *type,
                          uint16_t *length,
@@ -259,8 +262,16 @@ int lldp_mib_update_objects(lldp_chassis *c, tlv_packet *tlv) {
 
                         p->until = ttl * USEC_PER_SEC + now(clock_boottime_or_monotonic());
 
-                        tlv_packet_free(p->packet);
-                        p->packet = tlv;
+                        /* Neighbours mostly resend the same information to
+                         * refresh it, in that case keep the parsed packet
+                         * we already have */
+                        if (tlv->length == p->packet->length &&
+                            memcmp(tlv->pdu, p->packet->pdu, tlv->length) == 0)
+                                tlv_packet_free(tlv);
+                        else {
+                                tlv_packet_free(p->packet);
+                                p->packet = tlv;
+                        }
 
                         prioq_reshuffle(p->c->by_expiry, p, &p->prioq_idx);
 
@@ -336,6 +347,12 @@ int lldp_mib_add_objects(Prioq *by_expiry,
                 }
 
                 /* Admission Control: Can we store this packet ? */
+                if (prioq_size(by_expiry) >= LLDP_MIB_MAX_NEIGHBOURS) {
+                        log_lldp("Exceeding number of neighbours: %u. Dropping ...",
+                                 prioq_size(by_expiry));
+                        goto drop;
+                }
+
                 if (hashmap_size(neighbour_mib) >= LLDP_MIB_MAX_CHASSIS) {
 
                         log_lldp("Exceeding number of chassie: %d. Dropping ...",
@@ -380,6 +397,14 @@ int lldp_mib_add_objects(Prioq *by_expiry,
                         c = NULL;
                         goto drop;
                 }
+
+                if (prioq_size(by_expiry) >= LLDP_MIB_MAX_NEIGHBOURS) {
+                        log_lldp("Exceeding number of neighbours: %u. Dropping ...",
+                                 prioq_size(by_expiry));
+
+                        c = NULL;
+                        goto drop;
+                }
         }
 
         /* This is a new port */
@@ -694,6 +694,33 @@ static int get_pool_offset(sd_dhcp_server *server, be32_t requested_ip) {
         return be32toh(requested_ip & ~server->netmask) - server->pool_offset;
 }
 
+/* Returns true if the address at the given offset in the pool may be
+   handed out, dropping the lease that held it if it expired. */
+static bool server_pool_offset_is_free(sd_dhcp_server *server, unsigned pool_offset, usec_t time_now) {
+        DHCPLease *lease;
+
+        assert(server);
+        assert(pool_offset < server->pool_size);
+
+        lease = server->bound_leases[pool_offset];
+        if (!lease)
+                return true;
+
+        if (lease == &server->invalid_lease)
+                return false;
+
+        if (lease->expiration > time_now)
+                return false;
+
+        log_dhcp_server(server, "reclaiming expired lease at pool offset %u", pool_offset);
+
+        server->bound_leases[pool_offset] = NULL;
+        hashmap_remove(server->leases_by_client_id, &lease->client_id);
+        dhcp_lease_free(lease);
+
+        return true;
+}
+
 #define HASH_KEY SD_ID128_MAKE(0d,1d,fe,bd,f1,24,bd,b3,47,f1,dd,6e,73,21,93,30)
 
 int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
@@ -744,6 +771,11 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                         address = existing_lease->address;
                 else {
                         uint32_t next_offer;
+                        usec_t time_now;
+
+                        r = sd_event_now(server->event, clock_boottime_or_monotonic(), &time_now);
+                        if (r < 0)
+                                return r;
 
                         /* even with no persistence of leases, we try to offer the same client
                            the same IP address. we do this by using the hash of the client id
@@ -752,7 +784,7 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                         next_offer = client_id_hash_func(&req->client_id, HASH_KEY.bytes) % server->pool_size;
 
                         for (i = 0; i < server->pool_size; i++) {
-                                if (!server->bound_leases[next_offer]) {
+                                if (server_pool_offset_is_free(server, next_offer, time_now)) {
                                         address = server->subnet | htobe32(server->pool_offset + next_offer);
                                         break;
                                 } else
@@ -837,6 +869,17 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                 }
 
                 pool_offset = get_pool_offset(server, address);
+                if (pool_offset >= 0 &&
+                    server->bound_leases[pool_offset] != existing_lease) {
+                        usec_t time_now;
+
+                        r = sd_event_now(server->event, clock_boottime_or_monotonic(), &time_now);
+                        if (r < 0)
+                                return r;
+
+                        /* the address may still be held by a lease that expired */
+                        server_pool_offset_is_free(server, pool_offset, time_now);
+                }
 
                 /* verify that the requested address is from the pool, and either
                    owned by the current client or free */
@@ -939,11 +982,13 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
         return 0;
 }
 
-static int server_receive_message(sd_event_source *s, int fd,
-                                  uint32_t revents, void *userdata) {
+/* the maximum number of datagrams handled per wakeup, so that a flood of
+   requests does not starve the other event sources */
+#define RECEIVE_BATCH_MAX 16
+
+static int server_receive_one(sd_dhcp_server *server, int fd) {
         _cleanup_free_ DHCPMessage *message = NULL;
         uint8_t cmsgbuf[CMSG_LEN(sizeof(struct in_pktinfo))];
-        sd_dhcp_server *server = userdata;
         struct iovec iov = {};
         struct msghdr msg = {
                 .msg_iov = &iov,
@@ -960,6 +1005,13 @@ static int server_receive_message(sd_event_source *s, int fd,
                 return -errno;
         if (buflen < 0)
                 return -EIO;
+        if (buflen == 0) {
+                /* either the queue is empty, or there is an empty datagram to drop */
+                if (recv(fd, NULL, 0, MSG_DONTWAIT) < 0)
+                        return errno == EAGAIN ? -EAGAIN : 0;
+
+                return 0;
+        }
 
         message = malloc0(buflen);
         if (!message)
@@ -968,7 +1020,9 @@ static int server_receive_message(sd_event_source *s, int fd,
         iov.iov_base = message;
         iov.iov_len = buflen;
 
-        len = recvmsg(fd, &msg, 0);
+        len = recvmsg(fd, &msg, MSG_DONTWAIT);
+        if (len < 0 && errno == EAGAIN)
+                return -EAGAIN;
         if (len < buflen)
                 return 0;
         else if ((size_t)len < sizeof(DHCPMessage))
@@ -992,6 +1046,27 @@ static int server_receive_message(sd_event_source *s, int fd,
         return dhcp_server_handle_message(server, message, (size_t)len);
 }
 
+static int server_receive_message(sd_event_source *s, int fd,
+                                  uint32_t revents, void *userdata) {
+        sd_dhcp_server *server = userdata;
+        unsigned i;
+        int r;
+
+        assert(server);
+
+        /* handle whatever is queued up to a limit, any remaining requests
+           are picked up on the next iteration of the event loop */
+        for (i = 0; i < RECEIVE_BATCH_MAX; i++) {
+                r = server_receive_one(server, fd);
+                if (r == -EAGAIN)
+                        break;
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 int sd_dhcp_server_start(sd_dhcp_server *server) {
         int r;
 
@@ -428,8 +428,7 @@ int sd_lldp_save(sd_lldp *lldp, const char *lldp_file) {
         _cleanup_fclose_ FILE *f = NULL;
         uint8_t *mac, *port_id, type;
         lldp_neighbour_port *p;
-        uint16_t data = 0, length = 0;
-        char buf[LINE_MAX];
+        uint16_t data, length;
         lldp_chassis *c;
         usec_t time;
         Iterator i;
@@ -444,105 +443,45 @@ int sd_lldp_save(sd_lldp *lldp, const char *lldp_file) {
 
         fchmod(fileno(f), 0644);
 
+        time = now(clock_boottime_or_monotonic());
+
         HASHMAP_FOREACH(c, lldp->neighbour_mib, i) {
                 LIST_FOREACH(port, p, c->ports) {
-                        _cleanup_free_ char *s = NULL;
-                        char *k, *t;
+                        char *name;
+
+                        /* Don't write expired packets */
+                        if (p->until <= time)
+                                continue;
 
                         r = lldp_read_chassis_id(p->packet, &type, &length, &mac);
                         if (r < 0)
                                 continue;
 
-                        sprintf(buf, "'_Chassis=%02x:%02x:%02x:%02x:%02x:%02x' '_CType=%d' ",
-                                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], type);
-
-                        s = strdup(buf);
-                        if (!s) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
                         r = lldp_read_port_id(p->packet, &type, &length, &port_id);
                         if (r < 0)
                                 continue;
 
-                        if (type != LLDP_PORT_SUBTYPE_MAC_ADDRESS) {
-                                k = strndup((char *) port_id, length -1);
-                                if (!k) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
-                                sprintf(buf, "'_Port=%s' '_PType=%d' ", k , type);
-                                free(k);
-                        } else {
-                                mac = port_id;
-                                sprintf(buf, "'_Port=%02x:%02x:%02x:%02x:%02x:%02x' '_PType=%d' ",
-                                        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], type);
-                        }
-
-                        k = strappend(s, buf);
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+                        fprintf(f, "'_Chassis=%02x:%02x:%02x:%02x:%02x:%02x' '_CType=%d' ",
+                                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], c->chassis_id.type);
 
-                        free(s);
-                        s = k;
+                        if (type != LLDP_PORT_SUBTYPE_MAC_ADDRESS)
+                                fprintf(f, "'_Port=%.*s' '_PType=%d' ", length - 1, (char *) port_id, type);
+                        else
+                                fprintf(f, "'_Port=%02x:%02x:%02x:%02x:%02x:%02x' '_PType=%d' ",
+                                        port_id[0], port_id[1], port_id[2], port_id[3], port_id[4], port_id[5], type);
 
-                        time = now(clock_boottime_or_monotonic());
-
-                        /* Don't write expired packets */
-                        if (time - p->until <= 0)
-                                continue;
+                        fprintf(f, "'_TTL="USEC_FMT"' ", p->until);
 
-                        sprintf(buf, "'_TTL="USEC_FMT"' ", p->until);
-
-                        k = strappend(s, buf);
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
-                        free(s);
-                        s = k;
-
-                        r = lldp_read_system_name(p->packet, &length, &k);
+                        r = lldp_read_system_name(p->packet, &length, &name);
                         if (r < 0)
-                                k = strappend(s, "'_NAME=N/A' ");
-                        else {
-                                t = strndup(k, length);
-                                if (!t) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
-                                k = strjoin(s, "'_NAME=", t, "' ", NULL);
-                                free(t);
-                        }
-
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
-                        free(s);
-                        s = k;
+                                fputs("'_NAME=N/A' ", f);
+                        else
+                                fprintf(f, "'_NAME=%.*s' ", length, name);
 
+                        data = 0;
                         (void) lldp_read_system_capability(p->packet, &data);
 
-                        sprintf(buf, "'_CAP=%x'", data);
-
-                        k = strappend(s, buf);
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
-                        free(s);
-                        s = k;
-
-                        fprintf(f, "%s\n", s);
+                        fprintf(f, "'_CAP=%x'\n", data);
                 }
         }
 
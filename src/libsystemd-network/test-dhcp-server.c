@@ -234,6 +234,72 @@ static void test_client_id_hash(void) {
         free(b.data);
 }
 
+static void test_lease_expiry(void) {
+        _cleanup_dhcp_server_unref_ sd_dhcp_server *server = NULL;
+        struct {
+                DHCPMessage message;
+                struct {
+                        uint8_t code;
+                        uint8_t length;
+                        uint8_t type;
+                } _packed_ option_type;
+                struct {
+                        uint8_t code;
+                        uint8_t length;
+                        be32_t address;
+                } _packed_ option_requested_ip;
+                struct {
+                        uint8_t code;
+                        uint8_t length;
+                        be32_t address;
+                } _packed_ option_server_id;
+                uint8_t end;
+        } _packed_ test = {
+                .message.op = BOOTREQUEST,
+                .message.htype = ARPHRD_ETHER,
+                .message.hlen = ETHER_ADDR_LEN,
+                .message.xid = htobe32(0x12345678),
+                .message.chaddr = { 'A', 'B', 'C', 'D', 'E', 'F' },
+                .option_type.code = DHCP_OPTION_MESSAGE_TYPE,
+                .option_type.length = 1,
+                .option_type.type = DHCP_REQUEST,
+                .option_requested_ip.code = DHCP_OPTION_REQUESTED_IP_ADDRESS,
+                .option_requested_ip.length = 4,
+                .option_requested_ip.address = htobe32(INADDR_LOOPBACK + 1),
+                .option_server_id.code = DHCP_OPTION_SERVER_IDENTIFIER,
+                .option_server_id.length = 4,
+                .option_server_id.address = htobe32(INADDR_LOOPBACK),
+                .end = DHCP_OPTION_END,
+        };
+        struct in_addr address_lo = {
+                .s_addr = htonl(INADDR_LOOPBACK),
+        };
+
+        /* a pool with room for a single lease */
+        assert_se(sd_dhcp_server_new(&server, 1) >= 0);
+        assert_se(sd_dhcp_server_configure_pool(server, &address_lo, 8, 2, 1) >= 0);
+        assert_se(sd_dhcp_server_attach_event(server, NULL, 0) >= 0);
+        assert_se(sd_dhcp_server_start(server) >= 0);
+
+        assert_se(dhcp_server_handle_message(server, (DHCPMessage*)&test, sizeof(test)) == DHCP_ACK);
+        assert_se(server->bound_leases[0]);
+
+        /* another client finds the pool exhausted */
+        test.message.chaddr[5] = 'G';
+        test.option_type.type = DHCP_DISCOVER;
+        assert_se(dhcp_server_handle_message(server, (DHCPMessage*)&test, sizeof(test)) == 0);
+        test.option_type.type = DHCP_REQUEST;
+        assert_se(dhcp_server_handle_message(server, (DHCPMessage*)&test, sizeof(test)) == 0);
+
+        /* until the lease held by the first one expires */
+        server->bound_leases[0]->expiration = 1;
+        test.option_type.type = DHCP_DISCOVER;
+        assert_se(dhcp_server_handle_message(server, (DHCPMessage*)&test, sizeof(test)) == DHCP_OFFER);
+        test.option_type.type = DHCP_REQUEST;
+        assert_se(dhcp_server_handle_message(server, (DHCPMessage*)&test, sizeof(test)) == DHCP_ACK);
+        assert_se(hashmap_size(server->leases_by_client_id) == 1);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_event_unref_ sd_event *e;
         int r;
@@ -249,6 +315,7 @@ int main(int argc, char *argv[]) {
                 return r;
 
         test_message_handler();
+        test_lease_expiry();
         test_client_id_hash();
 
         return 0;
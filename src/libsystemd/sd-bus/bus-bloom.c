@@ -87,7 +87,7 @@ static void bloom_add_data(
         /* log_debug("bloom: adding <%.*s>", (int) n, (char*) data); */
 }
 
-void bloom_add_pair(uint64_t filter[], size_t size, unsigned k, const char *a, const char *b) {
+unsigned bloom_add_pair(uint64_t filter[], size_t size, unsigned k, const char *a, const char *b) {
         size_t n;
         char *c;
 
@@ -100,9 +100,11 @@ void bloom_add_pair(uint64_t filter[], size_t size, unsigned k, const char *a, c
         strcpy(stpcpy(stpcpy(c, a), ":"), b);
 
         bloom_add_data(filter, size, k, c, n);
+        return 1;
 }
 
-void bloom_add_prefixes(uint64_t filter[], size_t size, unsigned k, const char *a, const char *b, char sep) {
+unsigned bloom_add_prefixes(uint64_t filter[], size_t size, unsigned k, const char *a, const char *b, char sep) {
+        unsigned added = 1;
         size_t n;
         char *c, *p;
 
@@ -127,20 +129,24 @@ void bloom_add_prefixes(uint64_t filter[], size_t size, unsigned k, const char *
 
                 *(e + 1) = 0;
                 bloom_add_data(filter, size, k, c, e - c + 1);
+                added++;
 
                 if (e == p)
                         break;
 
                 *e = 0;
                 bloom_add_data(filter, size, k, c, e - c);
+                added++;
         }
+
+        return added;
 }
 
 bool bloom_validate_parameters(size_t size, unsigned k) {
         uint64_t m;
         unsigned w;
 
-        if (size <= 0)
+        if (size <= 0 || size % 8 != 0)
                 return false;
 
         if (k <= 0)
@@ -156,3 +162,85 @@ bool bloom_validate_parameters(size_t size, unsigned k) {
 
         return true;
 }
+
+unsigned bloom_count_bits(const uint64_t filter[], size_t size) {
+        unsigned n = 0;
+        size_t i;
+
+        assert(filter);
+
+        for (i = 0; i < size / 8; i++)
+                n += __builtin_popcountll(filter[i]);
+
+        return n;
+}
+
+static double pow_uint(double x, uint64_t n) {
+        double r = 1.0;
+
+        /* Saves us from pulling in libm for pow() */
+        for (; n > 0; n >>= 1) {
+                if (n & 1)
+                        r *= x;
+                x *= x;
+        }
+
+        return r;
+}
+
+double bloom_false_positive_rate(size_t size, unsigned k, unsigned n_elements) {
+        uint64_t m;
+        double zero;
+
+        assert(size > 0);
+        assert(k > 0);
+
+        /* The bit index is masked with m - 1 in bloom_add_data(), so
+         * of a filter that isn't sized to a power of two only the
+         * power of two below the size is actually used */
+        m = UINT64_C(1) << u64log2(size * 8);
+
+        /* The probability that a given bit is still unset after
+         * adding n elements with k hash functions each, and then that
+         * all k bits of an element that was not added are set
+         * nonetheless */
+        zero = pow_uint(1.0 - 1.0 / (double) m, (uint64_t) k * n_elements);
+
+        return pow_uint(1.0 - zero, k);
+}
+
+int bloom_pick_parameters(unsigned n_elements, double max_rate, size_t *ret_size, unsigned *ret_k) {
+        size_t size;
+
+        assert(ret_size);
+        assert(ret_k);
+
+        if (n_elements <= 0)
+                n_elements = 1;
+
+        /* Finds the smallest filter that stays below max_rate for
+         * messages with n_elements entries, and the number of hash
+         * functions that works best with it */
+        for (size = BLOOM_SIZE_MIN; size <= BLOOM_SIZE_MAX; size *= 2) {
+                double best = 1.0;
+                unsigned k, best_k = 0;
+
+                for (k = 1; bloom_validate_parameters(size, k); k++) {
+                        double rate;
+
+                        rate = bloom_false_positive_rate(size, k, n_elements);
+                        if (rate < best) {
+                                best = rate;
+                                best_k = k;
+                        }
+                }
+
+                if (best_k > 0 && best <= max_rate) {
+                        *ret_size = size;
+                        *ret_k = best_k;
+                        return 0;
+                }
+        }
+
+        return -ERANGE;
+}
@@ -38,7 +38,19 @@
 #define DEFAULT_BLOOM_SIZE (512/8) /* m: filter size */
 #define DEFAULT_BLOOM_N_HASH 8     /* k: number of hash functions */
 
-void bloom_add_pair(uint64_t filter[], size_t size, unsigned n_hash, const char *a, const char *b);
-void bloom_add_prefixes(uint64_t filter[], size_t size, unsigned n_hash, const char *a, const char *b, char sep);
+/* The filter sizes in bytes kdbus accepts */
+#define BLOOM_SIZE_MIN 8
+#define BLOOM_SIZE_MAX 4096
+
+/* These return the number of elements added to the filter */
+unsigned bloom_add_pair(uint64_t filter[], size_t size, unsigned n_hash, const char *a, const char *b);
+unsigned bloom_add_prefixes(uint64_t filter[], size_t size, unsigned n_hash, const char *a, const char *b, char sep);
 
 bool bloom_validate_parameters(size_t size, unsigned n_hash);
+
+unsigned bloom_count_bits(const uint64_t filter[], size_t size);
+
+/* The expected rate of false positives of a single element match on
+ * a filter that n_elements were added to */
+double bloom_false_positive_rate(size_t size, unsigned n_hash, unsigned n_elements);
+int bloom_pick_parameters(unsigned n_elements, double max_rate, size_t *ret_size, unsigned *ret_n_hash);
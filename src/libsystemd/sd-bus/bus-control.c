@@ -726,7 +726,7 @@ int bus_get_name_creds_kdbus(
         if (r < 0)
                 goto fail;
 
-        r = bus_creds_add_more(c, mask, 0, 0);
+        r = bus_creds_add_more(bus, c, mask, 0, 0);
         if (r < 0)
                 goto fail;
 
@@ -883,7 +883,7 @@ static int bus_get_name_creds_dbus1(
                         }
                 }
 
-                r = bus_creds_add_more(c, mask, pid, 0);
+                r = bus_creds_add_more(bus, c, mask, pid, 0);
                 if (r < 0)
                         return r;
         }
@@ -964,7 +964,7 @@ static int bus_get_owner_creds_kdbus(sd_bus *bus, uint64_t mask, sd_bus_creds **
         if (r < 0)
                 return r;
 
-        r = bus_creds_add_more(c, mask, pid, 0);
+        r = bus_creds_add_more(bus, c, mask, pid, 0);
         if (r < 0)
                 return r;
 
@@ -1012,7 +1012,7 @@ static int bus_get_owner_creds_dbus1(sd_bus *bus, uint64_t mask, sd_bus_creds **
                 c->mask |= SD_BUS_CREDS_SELINUX_CONTEXT;
         }
 
-        r = bus_creds_add_more(c, mask, pid, 0);
+        r = bus_creds_add_more(bus, c, mask, pid, 0);
         if (r < 0)
                 return r;
 
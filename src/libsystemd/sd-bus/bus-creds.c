@@ -20,6 +20,7 @@
 ***/
 
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <linux/capability.h>
 
 #include "util.h"
@@ -35,6 +36,7 @@
 #include "strv.h"
 #include "bus-creds.h"
 #include "bus-label.h"
+#include "bus-internal.h"
 
 enum {
         CAP_OFFSET_INHERITABLE = 0,
@@ -165,7 +167,7 @@ _public_ int sd_bus_creds_new_from_pid(sd_bus_creds **ret, pid_t pid, uint64_t m
         if (!c)
                 return -ENOMEM;
 
-        r = bus_creds_add_more(c, mask | SD_BUS_CREDS_AUGMENT, pid, 0);
+        r = bus_creds_add_more(NULL, c, mask | SD_BUS_CREDS_AUGMENT, pid, 0);
         if (r < 0) {
                 sd_bus_creds_unref(c);
                 return r;
@@ -760,8 +762,226 @@ static int parse_caps(sd_bus_creds *c, unsigned offset, const char *p) {
         return 0;
 }
 
-int bus_creds_add_more(sd_bus_creds *c, uint64_t mask, pid_t pid, pid_t tid) {
-        uint64_t missing;
+/* The fields we remember per peer process. They only change when the
+ * process executes another binary, or when it changes them itself,
+ * in which case they can't be trusted anyway. Everything else may be
+ * changed by the process or by others at any time, and is read again
+ * for every message. */
+#define CREDS_CACHE_MASK (SD_BUS_CREDS_COMM|SD_BUS_CREDS_EXE|SD_BUS_CREDS_CMDLINE)
+
+/* Upper bound for the number of processes we remember. When it is hit
+ * we simply start from scratch. */
+#define CREDS_CACHE_MAX 1024U
+
+/* For this long after a process was last identified we trust its
+ * entry without looking at /proc again, as a peer usually sends many
+ * messages in a row */
+#define CREDS_CACHE_FRESH_USEC (1*USEC_PER_SEC)
+
+typedef struct CredsCacheId {
+        /* The start time tells a recycled PID apart, the inode of
+         * the binary an execve() */
+        uint64_t starttime;
+        dev_t exe_dev;
+        ino_t exe_ino;
+} CredsCacheId;
+
+struct creds_cache_entry {
+        CredsCacheId id;
+        usec_t identified;
+
+        uint64_t mask;
+        char *comm;
+        char *exe;
+        char *cmdline;
+        size_t cmdline_size;
+};
+
+static void creds_cache_entry_free(struct creds_cache_entry *e) {
+        if (!e)
+                return;
+
+        free(e->comm);
+        free(e->exe);
+        free(e->cmdline);
+        free(e);
+}
+
+void bus_creds_cache_flush(sd_bus *bus) {
+        struct creds_cache_entry *e;
+
+        assert(bus);
+
+        while ((e = hashmap_steal_first(bus->creds_cache)))
+                creds_cache_entry_free(e);
+}
+
+static int creds_cache_identify(pid_t pid, CredsCacheId *ret) {
+        _cleanup_free_ char *line = NULL;
+        unsigned long long starttime;
+        struct stat st;
+        const char *p;
+        int r;
+
+        assert(pid > 0);
+        assert(ret);
+
+        p = procfs_file_alloca(pid, "stat");
+        r = read_one_line_file(p, &line);
+        if (r < 0)
+                return r;
+
+        /* The comm field may contain anything, hence continue after
+         * the last closing parenthesis. The start time is the 20th
+         * field from there. */
+        p = strrchr(line, ')');
+        if (!p)
+                return -EIO;
+
+        if (sscanf(p + 1,
+                   " %*c "                /* state */
+                   "%*d %*d %*d %*d %*d " /* ppid, pgrp, session, tty_nr, tpgid */
+                   "%*u %*u %*u %*u %*u " /* flags, minflt, cminflt, majflt, cmajflt */
+                   "%*u %*u %*d %*d "     /* utime, stime, cutime, cstime */
+                   "%*d %*d %*d %*d "     /* priority, nice, num_threads, itrealvalue */
+                   "%llu",                /* starttime */
+                   &starttime) != 1)
+                return -EIO;
+
+        /* Fails for kernel threads, which we don't cache anything for */
+        p = procfs_file_alloca(pid, "exe");
+        if (stat(p, &st) < 0)
+                return -errno;
+
+        ret->starttime = starttime;
+        ret->exe_dev = st.st_dev;
+        ret->exe_ino = st.st_ino;
+
+        return 0;
+}
+
+static uint64_t creds_cache_get(sd_bus *bus, sd_bus_creds *c, pid_t pid, const CredsCacheId *id, uint64_t mask) {
+        struct creds_cache_entry *e;
+        uint64_t found;
+        usec_t n;
+
+        assert(bus);
+        assert(c);
+
+        /* Without an id only an entry that was identified recently
+         * is used */
+
+        e = hashmap_get(bus->creds_cache, PID_TO_PTR(pid));
+        if (!e)
+                return 0;
+
+        n = now(CLOCK_MONOTONIC);
+
+        if (!id) {
+                if (e->identified + CREDS_CACHE_FRESH_USEC <= n)
+                        return 0;
+        } else if (memcmp(&e->id, id, sizeof(CredsCacheId)) != 0) {
+                hashmap_remove(bus->creds_cache, PID_TO_PTR(pid));
+                creds_cache_entry_free(e);
+                return 0;
+        } else
+                e->identified = n;
+
+        found = e->mask & mask;
+
+        if (found & SD_BUS_CREDS_COMM) {
+                c->comm = strdup(e->comm);
+                if (!c->comm)
+                        found &= ~SD_BUS_CREDS_COMM;
+        }
+
+        if ((found & SD_BUS_CREDS_EXE) && e->exe) {
+                c->exe = strdup(e->exe);
+                if (!c->exe)
+                        found &= ~SD_BUS_CREDS_EXE;
+        }
+
+        if ((found & SD_BUS_CREDS_CMDLINE) && e->cmdline) {
+                c->cmdline = memdup(e->cmdline, e->cmdline_size);
+                if (!c->cmdline)
+                        found &= ~SD_BUS_CREDS_CMDLINE;
+                else
+                        c->cmdline_size = e->cmdline_size;
+        }
+
+        c->mask |= found;
+        return found;
+}
+
+static void creds_cache_put(sd_bus *bus, sd_bus_creds *c, pid_t pid, const CredsCacheId *id, uint64_t mask) {
+        struct creds_cache_entry *e;
+        int r;
+
+        assert(bus);
+        assert(c);
+        assert(id);
+
+        /* Caching is only an optimization, hence on failure we
+         * simply don't remember things */
+
+        mask &= c->mask & CREDS_CACHE_MASK;
+        if (mask == 0)
+                return;
+
+        e = hashmap_get(bus->creds_cache, PID_TO_PTR(pid));
+        if (e && memcmp(&e->id, id, sizeof(CredsCacheId)) != 0) {
+                hashmap_remove(bus->creds_cache, PID_TO_PTR(pid));
+                creds_cache_entry_free(e);
+                e = NULL;
+        }
+
+        if (!e) {
+                if (hashmap_size(bus->creds_cache) >= CREDS_CACHE_MAX)
+                        bus_creds_cache_flush(bus);
+
+                r = hashmap_ensure_allocated(&bus->creds_cache, NULL);
+                if (r < 0)
+                        return;
+
+                e = new0(struct creds_cache_entry, 1);
+                if (!e)
+                        return;
+
+                e->id = *id;
+                e->identified = now(CLOCK_MONOTONIC);
+
+                r = hashmap_put(bus->creds_cache, PID_TO_PTR(pid), e);
+                if (r < 0) {
+                        creds_cache_entry_free(e);
+                        return;
+                }
+        }
+
+        if ((mask & SD_BUS_CREDS_COMM) && !(e->mask & SD_BUS_CREDS_COMM)) {
+                e->comm = strdup(c->comm);
+                if (e->comm)
+                        e->mask |= SD_BUS_CREDS_COMM;
+        }
+
+        if ((mask & SD_BUS_CREDS_EXE) && !(e->mask & SD_BUS_CREDS_EXE)) {
+                e->exe = c->exe ? strdup(c->exe) : NULL;
+                if (e->exe || !c->exe)
+                        e->mask |= SD_BUS_CREDS_EXE;
+        }
+
+        if ((mask & SD_BUS_CREDS_CMDLINE) && !(e->mask & SD_BUS_CREDS_CMDLINE)) {
+                e->cmdline = c->cmdline ? memdup(c->cmdline, c->cmdline_size) : NULL;
+                if (e->cmdline || !c->cmdline) {
+                        e->cmdline_size = c->cmdline ? c->cmdline_size : 0;
+                        e->mask |= SD_BUS_CREDS_CMDLINE;
+                }
+        }
+}
+
+int bus_creds_add_more(sd_bus *bus, sd_bus_creds *c, uint64_t mask, pid_t pid, pid_t tid) {
+        uint64_t missing, cached = 0;
+        CredsCacheId id;
+        bool have_id = false;
         int r;
 
         assert(c);
@@ -794,6 +1014,18 @@ int bus_creds_add_more(sd_bus_creds *c, uint64_t mask, pid_t pid, pid_t tid) {
                 c->mask |= SD_BUS_CREDS_TID;
         }
 
+        /* Identify the process before reading anything, so that if
+         * it executes something else meanwhile we won't remember what
+         * we read under the new identity */
+        if (bus && (missing & CREDS_CACHE_MASK)) {
+                cached = creds_cache_get(bus, c, pid, NULL, missing & CREDS_CACHE_MASK);
+
+                if ((missing & CREDS_CACHE_MASK & ~cached) && creds_cache_identify(pid, &id) >= 0) {
+                        have_id = true;
+                        cached |= creds_cache_get(bus, c, pid, &id, missing & CREDS_CACHE_MASK & ~cached);
+                }
+        }
+
         if (missing & (SD_BUS_CREDS_PPID |
                        SD_BUS_CREDS_UID | SD_BUS_CREDS_EUID | SD_BUS_CREDS_SUID | SD_BUS_CREDS_FSUID |
                        SD_BUS_CREDS_GID | SD_BUS_CREDS_EGID | SD_BUS_CREDS_SGID | SD_BUS_CREDS_FSGID |
@@ -974,7 +1206,7 @@ int bus_creds_add_more(sd_bus_creds *c, uint64_t mask, pid_t pid, pid_t tid) {
                         c->mask |= SD_BUS_CREDS_SELINUX_CONTEXT;
         }
 
-        if (missing & SD_BUS_CREDS_COMM) {
+        if ((missing & ~cached) & SD_BUS_CREDS_COMM) {
                 r = get_process_comm(pid, &c->comm);
                 if (r < 0) {
                         if (r != -EPERM && r != -EACCES)
@@ -983,7 +1215,7 @@ int bus_creds_add_more(sd_bus_creds *c, uint64_t mask, pid_t pid, pid_t tid) {
                         c->mask |= SD_BUS_CREDS_COMM;
         }
 
-        if (missing & SD_BUS_CREDS_EXE) {
+        if ((missing & ~cached) & SD_BUS_CREDS_EXE) {
                 r = get_process_exe(pid, &c->exe);
                 if (r == -ESRCH) {
                         /* Unfortunately we cannot really distinguish
@@ -1002,7 +1234,7 @@ int bus_creds_add_more(sd_bus_creds *c, uint64_t mask, pid_t pid, pid_t tid) {
                         c->mask |= SD_BUS_CREDS_EXE;
         }
 
-        if (missing & SD_BUS_CREDS_CMDLINE) {
+        if ((missing & ~cached) & SD_BUS_CREDS_CMDLINE) {
                 const char *p;
 
                 p = procfs_file_alloca(pid, "cmdline");
@@ -1106,12 +1338,15 @@ int bus_creds_add_more(sd_bus_creds *c, uint64_t mask, pid_t pid, pid_t tid) {
         if (tid > 0 && tid != pid && !pid_is_unwaited(tid))
                 return -ESRCH;
 
+        if (have_id)
+                creds_cache_put(bus, c, pid, &id, missing & ~cached);
+
         c->augmented = missing & c->mask;
 
         return 0;
 }
 
-int bus_creds_extend_by_pid(sd_bus_creds *c, uint64_t mask, sd_bus_creds **ret) {
+int bus_creds_extend_by_pid(sd_bus *bus, sd_bus_creds *c, uint64_t mask, sd_bus_creds **ret) {
         _cleanup_bus_creds_unref_ sd_bus_creds *n = NULL;
         int r;
 
@@ -1333,7 +1568,7 @@ int bus_creds_extend_by_pid(sd_bus_creds *c, uint64_t mask, sd_bus_creds **ret)
 
         /* Get more data */
 
-        r = bus_creds_add_more(n, mask, 0, 0);
+        r = bus_creds_add_more(bus, n, mask, 0, 0);
         if (r < 0)
                 return r;
 
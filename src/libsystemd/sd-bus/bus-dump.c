@@ -508,62 +508,41 @@ int bus_creds_dump(sd_bus_creds *c, FILE *f, bool terse) {
         return 0;
 }
 
-/*
- * For details about the file format, see:
- *
- * http://wiki.wireshark.org/Development/LibpcapFileFormat
- */
-
-typedef struct _packed_ pcap_hdr_s {
-        uint32_t magic_number;   /* magic number */
-        uint16_t version_major;  /* major version number */
-        uint16_t version_minor;  /* minor version number */
-        int32_t  thiszone;       /* GMT to local correction */
-        uint32_t sigfigs;        /* accuracy of timestamps */
-        uint32_t snaplen;        /* max length of captured packets, in octets */
-        uint32_t network;        /* data link type */
-} pcap_hdr_t ;
-
-typedef struct  _packed_ pcaprec_hdr_s {
-        uint32_t ts_sec;         /* timestamp seconds */
-        uint32_t ts_usec;        /* timestamp microseconds */
-        uint32_t incl_len;       /* number of octets of packet saved in file */
-        uint32_t orig_len;       /* actual length of packet */
-} pcaprec_hdr_t;
+static void pcap_header(size_t snaplen, pcap_hdr_t *hdr) {
 
-int bus_pcap_header(size_t snaplen, FILE *f) {
+        assert(snaplen > 0);
+        assert((size_t) (uint32_t) snaplen == snaplen);
 
-        pcap_hdr_t hdr = {
+        *hdr = (pcap_hdr_t) {
                 .magic_number = 0xa1b2c3d4U,
                 .version_major = 2,
                 .version_minor = 4,
                 .thiszone = 0, /* UTC */
                 .sigfigs = 0,
+                .snaplen = (uint32_t) snaplen,
                 .network = 231, /* D-Bus */
         };
+}
+
+int bus_pcap_header(size_t snaplen, FILE *f) {
+        pcap_hdr_t hdr;
 
         if (!f)
                 f = stdout;
 
-        assert(snaplen > 0);
-        assert((size_t) (uint32_t) snaplen == snaplen);
-
-        hdr.snaplen = (uint32_t) snaplen;
+        pcap_header(snaplen, &hdr);
 
         fwrite(&hdr, 1, sizeof(hdr), f);
 
         return fflush_and_check(f);
 }
 
-int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
-        struct bus_body_part *part;
-        pcaprec_hdr_t hdr = {};
-        struct timeval tv;
-        unsigned i;
-        size_t w;
+void bus_pcap_header_to_buffer(size_t snaplen, void *buf) {
+        pcap_header(snaplen, buf);
+}
 
-        if (!f)
-                f = stdout;
+static void pcap_frame_header(sd_bus_message *m, size_t snaplen, pcaprec_hdr_t *hdr) {
+        struct timeval tv;
 
         assert(m);
         assert(snaplen > 0);
@@ -574,10 +553,23 @@ int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
         else
                 assert_se(gettimeofday(&tv, NULL) >= 0);
 
-        hdr.ts_sec = tv.tv_sec;
-        hdr.ts_usec = tv.tv_usec;
-        hdr.orig_len = BUS_MESSAGE_SIZE(m);
-        hdr.incl_len = MIN(hdr.orig_len, snaplen);
+        zero(*hdr);
+        hdr->ts_sec = tv.tv_sec;
+        hdr->ts_usec = tv.tv_usec;
+        hdr->orig_len = BUS_MESSAGE_SIZE(m);
+        hdr->incl_len = MIN(hdr->orig_len, snaplen);
+}
+
+int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
+        struct bus_body_part *part;
+        pcaprec_hdr_t hdr;
+        unsigned i;
+        size_t w;
+
+        if (!f)
+                f = stdout;
+
+        pcap_frame_header(m, snaplen, &hdr);
 
         /* write the pcap header */
         fwrite(&hdr, 1, sizeof(hdr), f);
@@ -599,3 +591,34 @@ int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
 
         return fflush_and_check(f);
 }
+
+size_t bus_message_pcap_frame_size(sd_bus_message *m, size_t snaplen) {
+        assert(m);
+
+        return sizeof(pcaprec_hdr_t) + MIN(BUS_MESSAGE_SIZE(m), snaplen);
+}
+
+void bus_message_pcap_frame_to_buffer(sd_bus_message *m, size_t snaplen, void *buf) {
+        struct bus_body_part *part;
+        uint8_t *p = buf;
+        unsigned i;
+        size_t w;
+
+        assert(buf);
+
+        pcap_frame_header(m, snaplen, buf);
+        p += sizeof(pcaprec_hdr_t);
+
+        w = MIN(BUS_MESSAGE_BODY_BEGIN(m), snaplen);
+        p = mempcpy(p, m->header, w);
+        snaplen -= w;
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (snaplen <= 0)
+                        break;
+
+                w = MIN(part->size, snaplen);
+                p = mempcpy(p, part->data, w);
+                snaplen -= w;
+        }
+}
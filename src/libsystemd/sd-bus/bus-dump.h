@@ -25,6 +25,7 @@
 #include <stdbool.h>
 
 #include "sd-bus.h"
+#include "macro.h"
 
 enum {
         BUS_MESSAGE_DUMP_WITH_HEADER = 1,
@@ -35,5 +36,34 @@ int bus_message_dump(sd_bus_message *m, FILE *f, unsigned flags);
 
 int bus_creds_dump(sd_bus_creds *c, FILE *f, bool terse);
 
+/*
+ * For details about the file format, see:
+ *
+ * http://wiki.wireshark.org/Development/LibpcapFileFormat
+ */
+
+typedef struct _packed_ pcap_hdr_s {
+        uint32_t magic_number;   /* magic number */
+        uint16_t version_major;  /* major version number */
+        uint16_t version_minor;  /* minor version number */
+        int32_t  thiszone;       /* GMT to local correction */
+        uint32_t sigfigs;        /* accuracy of timestamps */
+        uint32_t snaplen;        /* max length of captured packets, in octets */
+        uint32_t network;        /* data link type */
+} pcap_hdr_t ;
+
+typedef struct  _packed_ pcaprec_hdr_s {
+        uint32_t ts_sec;         /* timestamp seconds */
+        uint32_t ts_usec;        /* timestamp microseconds */
+        uint32_t incl_len;       /* number of octets of packet saved in file */
+        uint32_t orig_len;       /* actual length of packet */
+} pcaprec_hdr_t;
+
 int bus_pcap_header(size_t snaplen, FILE *f);
 int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f);
+
+/* The same, but into memory. The buffer needs to be
+ * sizeof(pcap_hdr_t), or bus_message_pcap_frame_size() bytes long. */
+void bus_pcap_header_to_buffer(size_t snaplen, void *buf);
+size_t bus_message_pcap_frame_size(sd_bus_message *m, size_t snaplen);
+void bus_message_pcap_frame_to_buffer(sd_bus_message *m, size_t snaplen, void *buf);
@@ -19,11 +19,96 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "util.h"
 #include "bus-type.h"
 #include "bus-gvariant.h"
 #include "bus-signature.h"
 
+/* Layouts of recently used signatures. Nearly all traffic repeats a
+ * small set of signatures, hence a tiny direct-mapped cache per thread
+ * is enough to avoid walking the same signatures over and over. */
+#define LAYOUT_CACHE_SIZE 64U
+#define LAYOUT_SIGNATURE_MAX 32U
+
+struct gvariant_layout {
+        char signature[LAYOUT_SIGNATURE_MAX];
+        bool valid:1;
+        int alignment;
+        int size;
+        int fixed_size;
+};
+
+static thread_local struct gvariant_layout layout_cache[LAYOUT_CACHE_SIZE];
+
+static int compute_size(const char *signature);
+static int compute_alignment(const char *signature);
+static int compute_is_fixed_size(const char *signature);
+
+static const struct gvariant_layout *layout_get(const char *signature) {
+        struct gvariant_layout *l;
+        unsigned hash = 0;
+        size_t n;
+        int alignment, size, fixed_size;
+
+        for (n = 0; signature[n] != 0; n++) {
+                if (n >= LAYOUT_SIGNATURE_MAX - 1)
+                        return NULL;
+
+                hash = hash * 31 + (unsigned char) signature[n];
+        }
+
+        l = layout_cache + (hash % LAYOUT_CACHE_SIZE);
+        if (l->valid && streq(l->signature, signature))
+                return l;
+
+        /* Calculate everything before touching the entry, the
+         * recursion might end up using the very same one. */
+        alignment = compute_alignment(signature);
+        fixed_size = compute_is_fixed_size(signature);
+        size = fixed_size > 0 ? compute_size(signature) : -EINVAL;
+
+        memcpy(l->signature, signature, n + 1);
+        l->alignment = alignment;
+        l->size = size;
+        l->fixed_size = fixed_size;
+        l->valid = true;
+
+        return l;
+}
+
 int bus_gvariant_get_size(const char *signature) {
+        const struct gvariant_layout *l;
+
+        l = layout_get(signature);
+        if (!l)
+                return compute_size(signature);
+
+        return l->size;
+}
+
+int bus_gvariant_get_alignment(const char *signature) {
+        const struct gvariant_layout *l;
+
+        l = layout_get(signature);
+        if (!l)
+                return compute_alignment(signature);
+
+        return l->alignment;
+}
+
+int bus_gvariant_is_fixed_size(const char *signature) {
+        const struct gvariant_layout *l;
+
+        assert(signature);
+
+        l = layout_get(signature);
+        if (!l)
+                return compute_is_fixed_size(signature);
+
+        return l->fixed_size;
+}
+
+static int compute_size(const char *signature) {
         const char *p;
         int sum = 0, r;
 
@@ -42,7 +127,9 @@ int bus_gvariant_get_size(const char *signature) {
                         memcpy(t, p, n);
                         t[n] = 0;
 
-                        r = bus_gvariant_get_alignment(t);
+                        /* Not via the cache, the element might be
+                         * the very signature we are computing */
+                        r = compute_alignment(t);
                         if (r < 0)
                                 return r;
 
@@ -107,14 +194,14 @@ int bus_gvariant_get_size(const char *signature) {
                 p += n;
         }
 
-        r = bus_gvariant_get_alignment(signature);
+        r = compute_alignment(signature);
         if (r < 0)
                 return r;
 
         return ALIGN_TO(sum, r);
 }
 
-int bus_gvariant_get_alignment(const char *signature) {
+static int compute_alignment(const char *signature) {
         size_t alignment = 1;
         const char *p;
         int r;
@@ -194,7 +281,7 @@ int bus_gvariant_get_alignment(const char *signature) {
         return alignment;
 }
 
-int bus_gvariant_is_fixed_size(const char *signature) {
+static int compute_is_fixed_size(const char *signature) {
         const char *p;
         int r;
 
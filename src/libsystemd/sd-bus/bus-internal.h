@@ -27,6 +27,7 @@
 #include "hashmap.h"
 #include "prioq.h"
 #include "list.h"
+#include "mempool.h"
 #include "util.h"
 #include "refcnt.h"
 #include "socket-util.h"
@@ -110,6 +111,13 @@ struct node_vtable {
         const sd_bus_vtable *vtable;
         sd_bus_object_find_t find;
 
+        /* Interface XML, generated on first Introspect() */
+        char *introspection;
+
+        /* GetAll() replies covering this vtable may be cached */
+        bool cache_properties;
+        uint64_t generation;
+
         unsigned last_iteration;
 
         LIST_FIELDS(struct node_vtable, vtables);
@@ -177,6 +185,8 @@ enum bus_auth {
         BUS_AUTH_ANONYMOUS
 };
 
+#define BUS_DATA_POOLS 3
+
 struct sd_bus {
         /* We use atomic ref counting here since sd_bus_message
            objects retain references to their originating sd_bus but
@@ -195,6 +205,8 @@ struct sd_bus {
 
         bool is_kernel:1;
         bool can_fds:1;
+        bool accept_memfd:1;
+        bool can_memfd:1;
         bool bus_client:1;
         bool ucred_valid:1;
         bool is_server:1;
@@ -240,6 +252,16 @@ struct sd_bus {
         Hashmap *vtable_methods;
         Hashmap *vtable_properties;
 
+        /* object path → cached GetAll() replies */
+        Hashmap *properties_cache;
+        uint64_t vtable_generation;
+
+        /* PID → what we read from /proc about peers */
+        Hashmap *creds_cache;
+
+        /* Only allocated if statistics collection is enabled */
+        struct bus_statistics *statistics;
+
         union sockaddr_union sockaddr;
         socklen_t sockaddr_size;
 
@@ -276,6 +298,11 @@ struct sd_bus {
 
         void *kdbus_buffer;
 
+        /* Slices of the kdbus pool we currently hold on to for
+         * received messages, and their total size */
+        unsigned n_pool_slices;
+        uint64_t pool_bytes;
+
         /* We do locking around the memfd cache, since we want to
          * allow people to process a sd_bus_message in a different
          * thread then it was generated on and free it there. Since
@@ -322,6 +349,13 @@ struct sd_bus {
         sd_bus_track *track_queue;
 
         LIST_HEAD(sd_bus_slot, slots);
+
+        /* Recycled memory for the messages of this connection,
+         * see bus_message_pools_init() */
+        pthread_mutex_t pools_mutex;
+        struct mempool message_pool;
+        struct mempool part_pool;
+        struct mempool data_pools[BUS_DATA_POOLS];
 };
 
 #define BUS_DEFAULT_TIMEOUT ((usec_t) (25 * USEC_PER_SEC))
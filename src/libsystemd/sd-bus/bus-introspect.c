@@ -173,6 +173,41 @@ int introspect_write_interface(struct introspect *i, const sd_bus_vtable *v) {
         return 0;
 }
 
+int introspect_format_interface(const sd_bus_vtable *v, bool trusted, char **ret) {
+        struct introspect i = {
+                .trusted = trusted,
+        };
+        int r;
+
+        assert(v);
+        assert(ret);
+
+        /* Formats just the members of one interface, so that the
+         * result may be reused for every object the vtable is
+         * registered for. */
+
+        i.f = open_memstream(&i.introspection, &i.size);
+        if (!i.f)
+                return -ENOMEM;
+
+        r = introspect_write_interface(&i, v);
+        if (r < 0)
+                goto finish;
+
+        r = fflush_and_check(i.f);
+        if (r < 0)
+                goto finish;
+
+        i.f = safe_fclose(i.f);
+
+        *ret = i.introspection;
+        i.introspection = NULL;
+
+finish:
+        introspect_free(&i);
+        return r;
+}
+
 int introspect_finish(struct introspect *i, sd_bus *bus, sd_bus_message *m, sd_bus_message **reply) {
         sd_bus_message *q;
         int r;
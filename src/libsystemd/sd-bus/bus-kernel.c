@@ -47,6 +47,7 @@
 #include "bus-bloom.h"
 #include "bus-util.h"
 #include "bus-label.h"
+#include "bus-statistics.h"
 
 #define UNIQUE_NAME_MAX (3+DECIMAL_STR_MAX(uint64_t))
 
@@ -142,8 +143,9 @@ static void append_fds(struct kdbus_item **d, const int fds[], unsigned n_fds) {
         *d = (struct kdbus_item *) ((uint8_t*) *d + (*d)->size);
 }
 
-static void add_bloom_arg(void *data, size_t size, unsigned n_hash, unsigned i, const char *t) {
+static unsigned add_bloom_arg(void *data, size_t size, unsigned n_hash, unsigned i, const char *t) {
         char buf[sizeof("arg")-1 + 2 + sizeof("-slash-prefix")];
+        unsigned n;
         char *e;
 
         assert(data);
@@ -160,15 +162,17 @@ static void add_bloom_arg(void *data, size_t size, unsigned n_hash, unsigned i,
         }
 
         *e = 0;
-        bloom_add_pair(data, size, n_hash, buf, t);
+        n = bloom_add_pair(data, size, n_hash, buf, t);
 
         strcpy(e, "-dot-prefix");
-        bloom_add_prefixes(data, size, n_hash, buf, t, '.');
+        n += bloom_add_prefixes(data, size, n_hash, buf, t, '.');
         strcpy(e, "-slash-prefix");
-        bloom_add_prefixes(data, size, n_hash, buf, t, '/');
+        n += bloom_add_prefixes(data, size, n_hash, buf, t, '/');
+
+        return n;
 }
 
-static void add_bloom_arg_has(void *data, size_t size, unsigned n_hash, unsigned i, const char *t) {
+static unsigned add_bloom_arg_has(void *data, size_t size, unsigned n_hash, unsigned i, const char *t) {
         char buf[sizeof("arg")-1 + 2 + sizeof("-has")];
         char *e;
 
@@ -186,12 +190,12 @@ static void add_bloom_arg_has(void *data, size_t size, unsigned n_hash, unsigned
         }
 
         strcpy(e, "-has");
-        bloom_add_pair(data, size, n_hash, buf, t);
+        return bloom_add_pair(data, size, n_hash, buf, t);
 }
 
 static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter *bloom) {
+        unsigned i, n;
         void *data;
-        unsigned i;
         int r;
 
         assert(m);
@@ -201,16 +205,16 @@ static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter
         memzero(data, m->bus->bloom_size);
         bloom->generation = 0;
 
-        bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "message-type", bus_message_type_to_string(m->header->type));
+        n = bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "message-type", bus_message_type_to_string(m->header->type));
 
         if (m->interface)
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "interface", m->interface);
+                n += bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "interface", m->interface);
         if (m->member)
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "member", m->member);
+                n += bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "member", m->member);
         if (m->path) {
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path", m->path);
-                bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path-slash-prefix", m->path);
-                bloom_add_prefixes(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path-slash-prefix", m->path, '/');
+                n += bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path", m->path);
+                n += bloom_add_pair(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path-slash-prefix", m->path);
+                n += bloom_add_prefixes(data, m->bus->bloom_size, m->bus->bloom_n_hash, "path-slash-prefix", m->path, '/');
         }
 
         r = sd_bus_message_rewind(m, true);
@@ -232,7 +236,7 @@ static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter
                         if (r < 0)
                                 return r;
 
-                        add_bloom_arg(data, m->bus->bloom_size, m->bus->bloom_n_hash, i, t);
+                        n += add_bloom_arg(data, m->bus->bloom_size, m->bus->bloom_n_hash, i, t);
                 }
 
                 if (type == SD_BUS_TYPE_ARRAY && STR_IN_SET(contents, "s", "o", "g")) {
@@ -243,7 +247,7 @@ static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter
                                 return r;
 
                         while ((r = sd_bus_message_read_basic(m, contents[0], &t)) > 0)
-                                add_bloom_arg_has(data, m->bus->bloom_size, m->bus->bloom_n_hash, i, t);
+                                n += add_bloom_arg_has(data, m->bus->bloom_size, m->bus->bloom_n_hash, i, t);
                         if (r < 0)
                                 return r;
 
@@ -258,6 +262,8 @@ static int bus_message_setup_bloom(sd_bus_message *m, struct kdbus_bloom_filter
                         break;
         }
 
+        bus_statistics_bloom(m->bus, n, data);
+
         return 0;
 }
 
@@ -1090,6 +1096,29 @@ int bus_kernel_cmd_free(sd_bus *bus, uint64_t offset) {
         return 0;
 }
 
+static void acquire_kdbus_msg(sd_bus *bus, struct kdbus_msg *k) {
+        assert(bus);
+        assert(k);
+
+        /* Until it is released the slice is ours, and the kernel
+         * can't queue further messages for us in that space */
+        bus->n_pool_slices++;
+        bus->pool_bytes += k->size;
+        bus_statistics_pool(bus);
+}
+
+void bus_kernel_release_msg(sd_bus *bus, struct kdbus_msg *k) {
+        assert(bus);
+        assert(k);
+        assert(bus->n_pool_slices > 0);
+        assert(bus->pool_bytes >= k->size);
+
+        bus->n_pool_slices--;
+        bus->pool_bytes -= k->size;
+
+        (void) bus_kernel_cmd_free(bus, (uint8_t*) k - (uint8_t*) bus->kdbus_buffer);
+}
+
 static void close_kdbus_msg(sd_bus *bus, struct kdbus_msg *k) {
         struct kdbus_item *d;
 
@@ -1103,7 +1132,7 @@ static void close_kdbus_msg(sd_bus *bus, struct kdbus_msg *k) {
                         safe_close(d->memfd.fd);
         }
 
-        bus_kernel_cmd_free(bus, (uint8_t*) k - (uint8_t*) bus->kdbus_buffer);
+        bus_kernel_release_msg(bus, k);
 }
 
 int bus_kernel_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call) {
@@ -1188,6 +1217,7 @@ int bus_kernel_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call
 
                 k = (struct kdbus_msg *)((uint8_t *)bus->kdbus_buffer + cmd.reply.offset);
                 assert(k);
+                acquire_kdbus_msg(bus, k);
 
                 if (k->payload_type == KDBUS_PAYLOAD_DBUS) {
 
@@ -1399,6 +1429,8 @@ int bus_kernel_read_message(sd_bus *bus, bool hint_priority, int64_t priority) {
         }
 
         k = (struct kdbus_msg *)((uint8_t *)bus->kdbus_buffer + recv.msg.offset);
+        acquire_kdbus_msg(bus, k);
+
         if (k->payload_type == KDBUS_PAYLOAD_DBUS) {
                 r = bus_kernel_make_message(bus, k);
 
@@ -1580,7 +1612,7 @@ uint64_t attach_flags_to_kdbus(uint64_t mask) {
         return m;
 }
 
-int bus_kernel_create_bus(const char *name, bool world, char **s) {
+int bus_kernel_create_bus(const char *name, bool world, size_t bloom_size, unsigned bloom_n_hash, char **s) {
         struct kdbus_cmd *make;
         struct kdbus_item *n;
         size_t l;
@@ -1589,6 +1621,19 @@ int bus_kernel_create_bus(const char *name, bool world, char **s) {
         assert(name);
         assert(s);
 
+        /* Zero picks the defaults. Everybody on the bus uses the
+         * parameters we set here, bus_kernel_take_fd() gets them
+         * from the kernel. */
+        if (bloom_size == 0)
+                bloom_size = DEFAULT_BLOOM_SIZE;
+        if (bloom_n_hash == 0)
+                bloom_n_hash = DEFAULT_BLOOM_N_HASH;
+
+        if (bloom_size < BLOOM_SIZE_MIN || bloom_size > BLOOM_SIZE_MAX ||
+            (bloom_size & (bloom_size - 1)) != 0 ||
+            !bloom_validate_parameters(bloom_size, bloom_n_hash))
+                return -EINVAL;
+
         fd = open("/sys/fs/kdbus/control", O_RDWR|O_NOCTTY|O_CLOEXEC);
         if (fd < 0)
                 return -errno;
@@ -1607,11 +1652,8 @@ int bus_kernel_create_bus(const char *name, bool world, char **s) {
         n->size = offsetof(struct kdbus_item, bloom_parameter) +
                   sizeof(struct kdbus_bloom_parameter);
         n->type = KDBUS_ITEM_BLOOM_PARAMETER;
-        n->bloom_parameter.size = DEFAULT_BLOOM_SIZE;
-        n->bloom_parameter.n_hash = DEFAULT_BLOOM_N_HASH;
-
-        assert_cc(DEFAULT_BLOOM_SIZE > 0);
-        assert_cc(DEFAULT_BLOOM_N_HASH > 0);
+        n->bloom_parameter.size = bloom_size;
+        n->bloom_parameter.n_hash = bloom_n_hash;
 
         make->size += ALIGN8(n->size);
 
@@ -56,6 +56,10 @@
  * the kernel places our incoming messages */
 #define KDBUS_POOL_SIZE (16*1024*1024)
 
+/* How many messages to process per wakeup at most on kdbus, see
+ * io_callback() */
+#define KDBUS_DISPATCH_BATCH 16
+
 struct memfd_cache {
         int fd;
         void *address;
@@ -71,7 +75,7 @@ int bus_kernel_read_message(sd_bus *bus, bool hint_priority, int64_t priority);
 
 int bus_kernel_open_bus_fd(const char *bus, char **path);
 
-int bus_kernel_create_bus(const char *name, bool world, char **s);
+int bus_kernel_create_bus(const char *name, bool world, size_t bloom_size, unsigned bloom_n_hash, char **s);
 int bus_kernel_create_endpoint(const char *bus_name, const char *ep_name, char **path);
 
 int bus_kernel_pop_memfd(sd_bus *bus, void **address, size_t *mapped, size_t *allocated);
@@ -93,3 +97,6 @@ int bus_kernel_realize_attach_flags(sd_bus *bus);
 int bus_kernel_get_bus_name(sd_bus *bus, char **name);
 
 int bus_kernel_cmd_free(sd_bus *bus, uint64_t offset);
+
+struct kdbus_msg;
+void bus_kernel_release_msg(sd_bus *bus, struct kdbus_msg *k);
@@ -23,6 +23,7 @@
 #include "bus-message.h"
 #include "bus-match.h"
 #include "bus-util.h"
+#include "bus-statistics.h"
 #include "strv.h"
 
 /* Example:
@@ -40,16 +41,18 @@
  *  BUS_MATCH_ROOT
  *  + BUS_MATCH_MESSAGE_TYPE
  *  | ` BUS_MATCH_VALUE: value == signal
- *  |   + DBUS_MATCH_SENDER
- *  |   | + BUS_MATCH_VALUE: value == foo
- *  |   | | ` DBUS_MATCH_INTERFACE
- *  |   | |   ` BUS_MATCH_VALUE: value == bar
+ *  |   + DBUS_MATCH_INTERFACE
+ *  |   | + BUS_MATCH_VALUE: value == bar
+ *  |   | | ` DBUS_MATCH_SENDER
+ *  |   | |   ` BUS_MATCH_VALUE: value == foo
  *  |   | |     ` BUS_MATCH_LEAF: A
- *  |   | ` BUS_MATCH_VALUE: value == quux
- *  |   |   ` DBUS_MATCH_INTERFACE
- *  |   |     | BUS_MATCH_VALUE: value == fips
- *  |   |     | ` BUS_MATCH_LEAF: B
- *  |   |     ` BUS_MATCH_VALUE: value == waldo
+ *  |   | + BUS_MATCH_VALUE: value == fips
+ *  |   | | ` DBUS_MATCH_SENDER
+ *  |   | |   ` BUS_MATCH_VALUE: value == quux
+ *  |   | |     ` BUS_MATCH_LEAF: B
+ *  |   | ` BUS_MATCH_VALUE: value == waldo
+ *  |   |   ` DBUS_MATCH_SENDER
+ *  |   |     ` BUS_MATCH_VALUE: value == quux
  *  |   |       ` BUS_MATCH_LEAF: C
  *  |   + DBUS_MATCH_MEMBER
  *  |   | ` BUS_MATCH_VALUE: value == test
@@ -59,18 +62,26 @@
  *  ` BUS_MATCH_SENDER
  *    ` BUS_MATCH_VALUE: value == miau
  *      ` BUS_MATCH_LEAF: E
+ *
+ *  The value nodes below each compare node are kept in a hash table,
+ *  keyed by the value. Namespace and path prefix matches are found by
+ *  looking up the prefixes of the tested value in it. Components are
+ *  ordered by match_component_rank(), which puts the sender last.
  */
 
 static inline bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
         return t >= BUS_MATCH_SENDER && t <= BUS_MATCH_ARG_HAS_LAST;
 }
 
-static inline bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
-        return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
-                (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST) ||
-                (t >= BUS_MATCH_ARG_HAS && t <= BUS_MATCH_ARG_HAS_LAST);
+static inline bool BUS_MATCH_IS_PREFIX(enum bus_match_node_type t) {
+        return t == BUS_MATCH_PATH_NAMESPACE ||
+                (t >= BUS_MATCH_ARG_PATH && t <= BUS_MATCH_ARG_PATH_LAST) ||
+                (t >= BUS_MATCH_ARG_NAMESPACE && t <= BUS_MATCH_ARG_NAMESPACE_LAST);
 }
 
+/* Prefixes shorter than this are looked up on the stack */
+#define BUS_MATCH_PREFIX_STACK_MAX 1024
+
 static void bus_match_node_free(struct bus_match_node *node) {
         assert(node);
         assert(node->parent);
@@ -99,7 +110,7 @@ static void bus_match_node_free(struct bus_match_node *node) {
 
                 if (node->parent->type == BUS_MATCH_MESSAGE_TYPE)
                         hashmap_remove(node->parent->compare.children, UINT_TO_PTR(node->value.u8));
-                else if (BUS_MATCH_CAN_HASH(node->parent->type) && node->value.str)
+                else if (node->value.str)
                         hashmap_remove(node->parent->compare.children, node->value.str);
 
                 free(node->value.str);
@@ -129,127 +140,162 @@ static bool bus_match_node_maybe_free(struct bus_match_node *node) {
         return true;
 }
 
-static bool value_node_test(
+static int bus_match_run_value(
+                sd_bus *bus,
                 struct bus_match_node *node,
-                enum bus_match_node_type parent_type,
-                uint8_t value_u8,
-                const char *value_str,
-                char **value_strv,
+                const char *value,
                 sd_bus_message *m) {
 
+        struct bus_match_node *found;
+
         assert(node);
-        assert(node->type == BUS_MATCH_VALUE);
+        assert(BUS_MATCH_IS_COMPARE(node->type));
 
-        /* Tests parameters against this value node, doing prefix
-         * magic and stuff. */
+        if (!value)
+                return 0;
 
-        switch (parent_type) {
+        found = hashmap_get(node->compare.children, value);
+        if (!found)
+                return 0;
 
-        case BUS_MATCH_MESSAGE_TYPE:
-                return node->value.u8 == value_u8;
+        return bus_match_run(bus, found, m);
+}
 
-        case BUS_MATCH_SENDER:
-                if (streq_ptr(node->value.str, value_str))
-                        return true;
+static int bus_match_run_sender(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value,
+                sd_bus_message *m) {
 
-                if (m->creds.mask & SD_BUS_CREDS_WELL_KNOWN_NAMES) {
-                        char **i;
+        struct bus_match_node *c;
+        Iterator i;
+        char **n;
+        int r;
 
-                        /* on kdbus we have the well known names list
-                         * in the credentials, let's make use of that
-                         * for an accurate match */
+        assert(node);
+        assert(node->type == BUS_MATCH_SENDER);
 
-                        STRV_FOREACH(i, m->creds.well_known_names)
-                                if (streq_ptr(node->value.str, *i))
-                                        return true;
+        r = bus_match_run_value(bus, node, value, m);
+        if (r != 0)
+                return r;
 
-                } else {
+        if (m->creds.mask & SD_BUS_CREDS_WELL_KNOWN_NAMES) {
 
-                        /* If we don't have kdbus, we don't know the
-                         * well-known names of the senders. In that,
-                         * let's just hope that dbus-daemon doesn't
-                         * send us stuff we didn't want. */
+                /* on kdbus we have the well known names list
+                 * in the credentials, let's make use of that
+                 * for an accurate match */
 
-                        if (node->value.str[0] != ':' && value_str && value_str[0] == ':')
-                                return true;
+                STRV_FOREACH(n, m->creds.well_known_names) {
+                        r = bus_match_run_value(bus, node, *n, m);
+                        if (r != 0)
+                                return r;
                 }
 
-                return false;
-
-        case BUS_MATCH_DESTINATION:
-        case BUS_MATCH_INTERFACE:
-        case BUS_MATCH_MEMBER:
-        case BUS_MATCH_PATH:
-        case BUS_MATCH_ARG ... BUS_MATCH_ARG_LAST:
+                return 0;
+        }
 
-                if (value_str)
-                        return streq_ptr(node->value.str, value_str);
+        /* If we don't have kdbus, we don't know the well-known
+         * names of the senders. In that, let's just hope that
+         * dbus-daemon doesn't send us stuff we didn't want, and run
+         * everything matching on well-known names. */
 
-                return false;
+        if (!value || value[0] != ':')
+                return 0;
 
-        case BUS_MATCH_ARG_HAS ... BUS_MATCH_ARG_HAS_LAST: {
-                char **i;
+        HASHMAP_FOREACH(c, node->compare.children, i) {
+                if (c->value.str[0] == ':')
+                        continue;
 
-                STRV_FOREACH(i, value_strv)
-                        if (streq_ptr(node->value.str, *i))
-                                return true;
+                r = bus_match_run(bus, c, m);
+                if (r != 0)
+                        return r;
 
-                return false;
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
         }
 
-        case BUS_MATCH_ARG_NAMESPACE ... BUS_MATCH_ARG_NAMESPACE_LAST:
-                if (value_str)
-                        return namespace_simple_pattern(node->value.str, value_str);
+        return 0;
+}
 
-                return false;
+static int bus_match_run_prefixes(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value,
+                char separator,
+                bool complex,
+                sd_bus_message *m) {
 
-        case BUS_MATCH_PATH_NAMESPACE:
-                return path_simple_pattern(node->value.str, value_str);
+        _cleanup_free_ char *buffer = NULL;
+        struct bus_match_node *c;
+        Iterator i;
+        size_t l, n;
+        char *p;
+        int r;
 
-        case BUS_MATCH_ARG_PATH ... BUS_MATCH_ARG_PATH_LAST:
-                if (value_str)
-                        return path_complex_pattern(node->value.str, value_str);
+        assert(node);
+        assert(BUS_MATCH_IS_PREFIX(node->type));
 
-                return false;
+        /* Instead of testing every value node, look up all prefixes
+         * of the value that could possibly match in the hash table,
+         * see simple_pattern_check() and complex_pattern_check() for
+         * the rules. */
 
-        default:
-                assert_not_reached("Invalid node type");
+        if (!value)
+                return 0;
+
+        n = strlen(value);
+        if (n < BUS_MATCH_PREFIX_STACK_MAX)
+                p = strdupa(value);
+        else {
+                p = buffer = strdup(value);
+                if (!p)
+                        return -ENOMEM;
         }
-}
 
-static bool value_node_same(
-                struct bus_match_node *node,
-                enum bus_match_node_type parent_type,
-                uint8_t value_u8,
-                const char *value_str) {
+        for (l = 0; l <= n; l++) {
+                struct bus_match_node *found;
+                char saved;
 
-        /* Tests parameters against this value node, not doing prefix
-         * magic and stuff, i.e. this one actually compares the match
-         * itself. */
+                if (l < n &&
+                    !(l > 0 && p[l-1] == separator) &&
+                    (complex || p[l] != separator))
+                        continue;
 
-        assert(node);
-        assert(node->type == BUS_MATCH_VALUE);
+                saved = p[l];
+                p[l] = 0;
+                found = hashmap_get(node->compare.children, p);
+                p[l] = saved;
 
-        switch (parent_type) {
+                if (!found)
+                        continue;
 
-        case BUS_MATCH_MESSAGE_TYPE:
-                return node->value.u8 == value_u8;
+                r = bus_match_run(bus, found, m);
+                if (r != 0)
+                        return r;
 
-        case BUS_MATCH_SENDER:
-        case BUS_MATCH_DESTINATION:
-        case BUS_MATCH_INTERFACE:
-        case BUS_MATCH_MEMBER:
-        case BUS_MATCH_PATH:
-        case BUS_MATCH_ARG ... BUS_MATCH_ARG_LAST:
-        case BUS_MATCH_ARG_HAS ... BUS_MATCH_ARG_HAS_LAST:
-        case BUS_MATCH_ARG_NAMESPACE ... BUS_MATCH_ARG_NAMESPACE_LAST:
-        case BUS_MATCH_PATH_NAMESPACE:
-        case BUS_MATCH_ARG_PATH ... BUS_MATCH_ARG_PATH_LAST:
-                return streq(node->value.str, value_str);
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
+        }
 
-        default:
-                assert_not_reached("Invalid node type");
+        /* Complex patterns also match if the value is a prefix of
+         * them ending in a separator. Values like that are rare, so
+         * just look through all patterns then. */
+        if (!complex || n <= 0 || value[n-1] != separator)
+                return 0;
+
+        HASHMAP_FOREACH(c, node->compare.children, i) {
+                if (strlen(c->value.str) <= n || !startswith(c->value.str, value))
+                        continue;
+
+                r = bus_match_run(bus, c, m);
+                if (r != 0)
+                        return r;
+
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
         }
+
+        return 0;
 }
 
 int bus_match_run(
@@ -258,8 +304,8 @@ int bus_match_run(
                 sd_bus_message *m) {
 
         _cleanup_strv_free_ char **test_strv = NULL;
+        struct bus_match_node *found;
         const char *test_str = NULL;
-        uint8_t test_u8 = 0;
         int r;
 
         assert(m);
@@ -317,6 +363,9 @@ int bus_match_run(
 
                         slot = container_of(node->leaf.callback, sd_bus_slot, match_callback);
                         if (bus) {
+                                if (bus->statistics)
+                                        bus->statistics->n_match_callbacks++;
+
                                 bus->current_slot = sd_bus_slot_ref(slot);
                                 bus->current_handler = node->leaf.callback->callback;
                                 bus->current_userdata = slot->userdata;
@@ -339,96 +388,72 @@ int bus_match_run(
                 return bus_match_run(bus, node->next, m);
 
         case BUS_MATCH_MESSAGE_TYPE:
-                test_u8 = m->header->type;
+                found = hashmap_get(node->compare.children, UINT_TO_PTR(m->header->type));
+                r = found ? bus_match_run(bus, found, m) : 0;
                 break;
 
         case BUS_MATCH_SENDER:
-                test_str = m->sender;
-                /* FIXME: resolve test_str from a well-known to a unique name first */
+                /* FIXME: resolve m->sender from a well-known to a unique name first */
+                r = bus_match_run_sender(bus, node, m->sender, m);
                 break;
 
         case BUS_MATCH_DESTINATION:
-                test_str = m->destination;
+                r = bus_match_run_value(bus, node, m->destination, m);
                 break;
 
         case BUS_MATCH_INTERFACE:
-                test_str = m->interface;
+                r = bus_match_run_value(bus, node, m->interface, m);
                 break;
 
         case BUS_MATCH_MEMBER:
-                test_str = m->member;
+                r = bus_match_run_value(bus, node, m->member, m);
                 break;
 
         case BUS_MATCH_PATH:
+                r = bus_match_run_value(bus, node, m->path, m);
+                break;
+
         case BUS_MATCH_PATH_NAMESPACE:
-                test_str = m->path;
+                r = bus_match_run_prefixes(bus, node, m->path, '/', false, m);
                 break;
 
         case BUS_MATCH_ARG ... BUS_MATCH_ARG_LAST:
                 (void) bus_message_get_arg(m, node->type - BUS_MATCH_ARG, &test_str);
+                r = bus_match_run_value(bus, node, test_str, m);
                 break;
 
         case BUS_MATCH_ARG_PATH ... BUS_MATCH_ARG_PATH_LAST:
                 (void) bus_message_get_arg(m, node->type - BUS_MATCH_ARG_PATH, &test_str);
+                r = bus_match_run_prefixes(bus, node, test_str, '/', true, m);
                 break;
 
         case BUS_MATCH_ARG_NAMESPACE ... BUS_MATCH_ARG_NAMESPACE_LAST:
                 (void) bus_message_get_arg(m, node->type - BUS_MATCH_ARG_NAMESPACE, &test_str);
+                r = bus_match_run_prefixes(bus, node, test_str, '.', false, m);
                 break;
 
-        case BUS_MATCH_ARG_HAS ... BUS_MATCH_ARG_HAS_LAST:
-                (void) bus_message_get_arg_strv(m, node->type - BUS_MATCH_ARG_HAS, &test_strv);
-                break;
-
-        default:
-                assert_not_reached("Unknown match type.");
-        }
-
-        if (BUS_MATCH_CAN_HASH(node->type)) {
-                struct bus_match_node *found;
-
-                /* Lookup via hash table, nice! So let's jump directly. */
-
-                if (test_str)
-                        found = hashmap_get(node->compare.children, test_str);
-                else if (test_strv) {
-                        char **i;
-
-                        STRV_FOREACH(i, test_strv) {
-                                found = hashmap_get(node->compare.children, *i);
-                                if (found) {
-                                        r = bus_match_run(bus, found, m);
-                                        if (r != 0)
-                                                return r;
-                                }
-                        }
+        case BUS_MATCH_ARG_HAS ... BUS_MATCH_ARG_HAS_LAST: {
+                char **i;
 
-                        found = NULL;
-                } else if (node->type == BUS_MATCH_MESSAGE_TYPE)
-                        found = hashmap_get(node->compare.children, UINT_TO_PTR(test_u8));
-                else
-                        found = NULL;
+                (void) bus_message_get_arg_strv(m, node->type - BUS_MATCH_ARG_HAS, &test_strv);
 
-                if (found) {
-                        r = bus_match_run(bus, found, m);
+                r = 0;
+                STRV_FOREACH(i, test_strv) {
+                        r = bus_match_run_value(bus, node, *i, m);
                         if (r != 0)
-                                return r;
+                                break;
                 }
-        } else {
-                struct bus_match_node *c;
-
-                /* No hash table, so let's iterate manually... */
 
-                for (c = node->child; c; c = c->next) {
-                        if (!value_node_test(c, node->type, test_u8, test_str, test_strv, m))
-                                continue;
+                break;
+        }
 
-                        r = bus_match_run(bus, c, m);
-                        if (r != 0)
-                                return r;
-                }
+        default:
+                assert_not_reached("Unknown match type.");
         }
 
+        if (r != 0)
+                return r;
+
         if (bus && bus->match_callbacks_modified)
                 return 0;
 
@@ -460,12 +485,8 @@ static int bus_match_add_compare_value(
 
                 if (t == BUS_MATCH_MESSAGE_TYPE)
                         n = hashmap_get(c->compare.children, UINT_TO_PTR(value_u8));
-                else if (BUS_MATCH_CAN_HASH(t))
+                else
                         n = hashmap_get(c->compare.children, value_str);
-                else {
-                        for (n = c->child; n && !value_node_same(n, t, value_u8, value_str); n = n->next)
-                                ;
-                }
 
                 if (n) {
                         *ret = n;
@@ -488,18 +509,10 @@ static int bus_match_add_compare_value(
                         c->next->prev = c;
                 where->child = c;
 
-                if (t == BUS_MATCH_MESSAGE_TYPE) {
-                        c->compare.children = hashmap_new(NULL);
-                        if (!c->compare.children) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-                } else if (BUS_MATCH_CAN_HASH(t)) {
-                        c->compare.children = hashmap_new(&string_hash_ops);
-                        if (!c->compare.children) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+                c->compare.children = hashmap_new(t == BUS_MATCH_MESSAGE_TYPE ? NULL : &string_hash_ops);
+                if (!c->compare.children) {
+                        r = -ENOMEM;
+                        goto fail;
                 }
         }
 
@@ -520,21 +533,13 @@ static int bus_match_add_compare_value(
         }
 
         n->parent = c;
-        if (c->compare.children) {
 
-                if (t == BUS_MATCH_MESSAGE_TYPE)
-                        r = hashmap_put(c->compare.children, UINT_TO_PTR(value_u8), n);
-                else
-                        r = hashmap_put(c->compare.children, n->value.str, n);
-
-                if (r < 0)
-                        goto fail;
-        } else {
-                n->next = c->child;
-                if (n->next)
-                        n->next->prev = n;
-                c->child = n;
-        }
+        if (t == BUS_MATCH_MESSAGE_TYPE)
+                r = hashmap_put(c->compare.children, UINT_TO_PTR(value_u8), n);
+        else
+                r = hashmap_put(c->compare.children, n->value.str, n);
+        if (r < 0)
+                goto fail;
 
         *ret = n;
         return 1;
@@ -573,12 +578,8 @@ static int bus_match_find_compare_value(
 
         if (t == BUS_MATCH_MESSAGE_TYPE)
                 n = hashmap_get(c->compare.children, UINT_TO_PTR(value_u8));
-        else if (BUS_MATCH_CAN_HASH(t))
+        else
                 n = hashmap_get(c->compare.children, value_str);
-        else {
-                for (n = c->child; n && !value_node_same(n, t, value_u8, value_str); n = n->next)
-                        ;
-        }
 
         if (n) {
                 *ret = n;
@@ -769,8 +770,34 @@ enum bus_match_node_type bus_match_node_type_from_string(const char *k, size_t n
         return -EINVAL;
 }
 
+static int match_component_rank(enum bus_match_node_type t) {
+
+        /* Components that can be looked up directly go first, then
+         * the ones that need a lookup per prefix, and the sender
+         * last, since without kdbus matches on well-known names
+         * cannot be resolved and are run for every unique sender.
+         * That way messages descend only into subtrees of rules
+         * that really match them. */
+
+        if (t == BUS_MATCH_SENDER)
+                return 2;
+
+        if (BUS_MATCH_IS_PREFIX(t))
+                return 1;
+
+        return 0;
+}
+
 static int match_component_compare(const void *a, const void *b) {
         const struct bus_match_component *x = a, *y = b;
+        int p, q;
+
+        p = match_component_rank(x->type);
+        q = match_component_rank(y->type);
+        if (p < q)
+                return -1;
+        if (p > q)
+                return 1;
 
         if (x->type < y->type)
                 return -1;
@@ -1073,7 +1100,7 @@ void bus_match_free(struct bus_match_node *node) {
         if (!node)
                 return;
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
+        if (BUS_MATCH_IS_COMPARE(node->type)) {
                 Iterator i;
 
                 HASHMAP_FOREACH(c, node->compare.children, i)
@@ -1166,7 +1193,7 @@ void bus_match_dump(struct bus_match_node *node, unsigned level) {
         else
                 putchar('\n');
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
+        if (BUS_MATCH_IS_COMPARE(node->type)) {
                 Iterator i;
 
                 HASHMAP_FOREACH(c, node->compare.children, i)
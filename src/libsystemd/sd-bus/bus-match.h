@@ -63,7 +63,7 @@ struct bus_match_node {
                         struct match_callback *callback;
                 } leaf;
                 struct {
-                        /* If this is set, then the child is NULL */
+                        /* The value nodes, keyed by value, child is always NULL */
                         Hashmap *children;
                 } compare;
         };
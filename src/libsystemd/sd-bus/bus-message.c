@@ -56,6 +56,146 @@ static void *adjust_pointer(const void *p, void *old_base, size_t sz, void *new_
         return (uint8_t*) new_base + ((uint8_t*) p - (uint8_t*) old_base);
 }
 
+/* Messages are carved out of per-connection pools, together with
+ * enough room for the header fields of most messages. Small body
+ * parts come from a few size classes. Everything is recycled through
+ * the freelists of the pools and only returned when the bus is
+ * freed. Since a message pins its bus, the pools outlive all
+ * messages allocated from them. Much like the memfd cache, the pools
+ * are locked, since messages may be unreferenced from other threads
+ * than the one they were created in. */
+
+#define BUS_MESSAGE_HEADER_INLINE 256
+
+static const size_t data_pool_size[BUS_DATA_POOLS] = { 256, 1024, 4096 };
+
+void bus_message_pools_init(sd_bus *bus) {
+        unsigned i;
+
+        assert(bus);
+
+        bus->message_pool = (struct mempool) {
+                .tile_size = ALIGN(sizeof(sd_bus_message)) + BUS_MESSAGE_HEADER_INLINE,
+                .at_least = 16,
+        };
+
+        bus->part_pool = (struct mempool) {
+                .tile_size = sizeof(struct bus_body_part),
+                .at_least = 64,
+        };
+
+        for (i = 0; i < BUS_DATA_POOLS; i++)
+                bus->data_pools[i] = (struct mempool) {
+                        .tile_size = data_pool_size[i],
+                        .at_least = 16,
+                };
+}
+
+void bus_message_pools_done(sd_bus *bus) {
+        unsigned i;
+
+        assert(bus);
+
+        mempool_drop(&bus->message_pool);
+        mempool_drop(&bus->part_pool);
+
+        for (i = 0; i < BUS_DATA_POOLS; i++)
+                mempool_drop(&bus->data_pools[i]);
+}
+
+static void *pool_alloc_tile(sd_bus *bus, struct mempool *mp) {
+        void *p;
+
+        assert(bus);
+        assert(mp);
+
+        assert_se(pthread_mutex_lock(&bus->pools_mutex) == 0);
+        p = mempool_alloc_tile(mp);
+        assert_se(pthread_mutex_unlock(&bus->pools_mutex) == 0);
+
+        return p;
+}
+
+static void *pool_alloc0_tile(sd_bus *bus, struct mempool *mp) {
+        void *p;
+
+        p = pool_alloc_tile(bus, mp);
+        if (p)
+                memzero(p, mp->tile_size);
+
+        return p;
+}
+
+static void pool_free_tile(sd_bus *bus, struct mempool *mp, void *p) {
+        assert(bus);
+        assert(mp);
+        assert(p);
+
+        assert_se(pthread_mutex_lock(&bus->pools_mutex) == 0);
+        mempool_free_tile(mp, p);
+        assert_se(pthread_mutex_unlock(&bus->pools_mutex) == 0);
+}
+
+static sd_bus_message *message_alloc0(sd_bus *bus, size_t sz) {
+        sd_bus_message *m;
+
+        assert(bus);
+
+        if (sz > bus->message_pool.tile_size)
+                return malloc0(sz);
+
+        m = pool_alloc0_tile(bus, &bus->message_pool);
+        if (!m)
+                return NULL;
+
+        m->from_pool = true;
+        return m;
+}
+
+static void message_release(sd_bus *bus, sd_bus_message *m) {
+        assert(bus);
+
+        if (!m)
+                return;
+
+        if (m->from_pool)
+                pool_free_tile(bus, &bus->message_pool, m);
+        else
+                free(m);
+}
+
+static size_t message_header_inline_size(sd_bus_message *m) {
+        assert(m);
+
+        if ((uint8_t*) m->header != (uint8_t*) m + ALIGN(sizeof(sd_bus_message)))
+                return 0;
+
+        return m->from_pool ? BUS_MESSAGE_HEADER_INLINE : sizeof(struct bus_header);
+}
+
+static int data_pool_find(size_t sz) {
+        unsigned i;
+
+        for (i = 0; i < BUS_DATA_POOLS; i++)
+                if (sz <= data_pool_size[i])
+                        return i;
+
+        return -1;
+}
+
+static void part_release_data(sd_bus *bus, struct bus_body_part *part) {
+        int i;
+
+        assert(bus);
+        assert(part);
+        assert(part->pool_this);
+
+        i = data_pool_find(part->allocated);
+        assert(i >= 0 && data_pool_size[i] == part->allocated);
+
+        pool_free_tile(bus, &bus->data_pools[i], part->data);
+}
+
 static void message_free_part(sd_bus_message *m, struct bus_body_part *part) {
         assert(m);
         assert(part);
@@ -77,11 +217,13 @@ static void message_free_part(sd_bus_message *m, struct bus_body_part *part) {
 
         } else if (part->munmap_this)
                 munmap(part->mmap_begin, part->mapped);
+        else if (part->pool_this)
+                part_release_data(m->bus, part);
         else if (part->free_this)
                 free(part->data);
 
         if (part != &m->body)
-                free(part);
+                pool_free_tile(m->bus, &m->bus->part_pool, part);
 }
 
 static void message_reset_parts(sd_bus_message *m) {
@@ -120,6 +262,8 @@ static void message_reset_containers(sd_bus_message *m) {
 }
 
 static void message_free(sd_bus_message *m) {
+        sd_bus *bus;
+
         assert(m);
 
         if (m->free_header)
@@ -128,13 +272,11 @@ static void message_free(sd_bus_message *m) {
         message_reset_parts(m);
 
         if (m->release_kdbus)
-                bus_kernel_cmd_free(m->bus, (uint8_t *) m->kdbus - (uint8_t *) m->bus->kdbus_buffer);
+                bus_kernel_release_msg(m->bus, m->kdbus);
 
         if (m->free_kdbus)
                 free(m->kdbus);
 
-        sd_bus_unref(m->bus);
-
         if (m->free_fds) {
                 close_many(m->fds, m->n_fds);
                 free(m->fds);
@@ -151,7 +293,11 @@ static void message_free(sd_bus_message *m) {
         free(m->root_container.peeked_signature);
 
         bus_creds_done(&m->creds);
-        free(m);
+
+        /* Release the bus last, the message's memory belongs to it */
+        bus = m->bus;
+        message_release(bus, m);
+        sd_bus_unref(bus);
 }
 
 static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, bool add_offset) {
@@ -178,16 +324,30 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
                 np = realloc(m->header, ALIGN8(new_size));
                 if (!np)
                         goto poison;
+        } else if (ALIGN8(new_size) <= message_header_inline_size(m)) {
+                /* Still fits into the room allocated along with the
+                 * message, which was zeroed already */
+                m->fields_size = new_size - sizeof(struct bus_header);
+
+                if (add_offset) {
+                        if (m->n_header_offsets >= ELEMENTSOF(m->header_offsets))
+                                goto poison;
+
+                        m->header_offsets[m->n_header_offsets++] = new_size - sizeof(struct bus_header);
+                }
+
+                return (uint8_t*) m->header + start;
         } else {
                 /* Initially, the header is allocated as part of of
                  * the sd_bus_message itself, let's replace it by
-                 * dynamic data */
+                 * dynamic data. The fields that fit into the inline
+                 * room so far come along. */
 
                 np = malloc(ALIGN8(new_size));
                 if (!np)
                         goto poison;
 
-                memcpy(np, m->header, sizeof(struct bus_header));
+                memcpy(np, m->header, old_size);
         }
 
         /* Zero out padding */
@@ -434,9 +594,10 @@ int bus_message_from_header(
                 size_t extra,
                 sd_bus_message **ret) {
 
-        _cleanup_free_ sd_bus_message *m = NULL;
+        sd_bus_message *m;
         struct bus_header *h;
         size_t a, label_sz;
+        int r;
 
         assert(bus);
         assert(header || header_accessible <= 0);
@@ -471,7 +632,7 @@ int bus_message_from_header(
                 a += label_sz + 1;
         }
 
-        m = malloc0(a);
+        m = message_alloc0(bus, a);
         if (!m)
                 return -ENOMEM;
 
@@ -485,8 +646,10 @@ int bus_message_from_header(
         if (BUS_MESSAGE_IS_GVARIANT(m)) {
                 size_t ws;
 
-                if (h->dbus2.cookie == 0)
-                        return -EBADMSG;
+                if (h->dbus2.cookie == 0) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 /* dbus2 derives the sizes from the message size and
                 the offset table at the end, since it is formatted as
@@ -496,27 +659,34 @@ int bus_message_from_header(
                 end of the fields array. */
 
                 ws = bus_gvariant_determine_word_size(message_size, 0);
-                if (footer_accessible < ws)
-                        return -EBADMSG;
+                if (footer_accessible < ws) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 m->fields_size = bus_gvariant_read_word_le((uint8_t*) footer + footer_accessible - ws, ws);
-                if (ALIGN8(m->fields_size) > message_size - ws)
-                        return -EBADMSG;
-                if (m->fields_size < sizeof(struct bus_header))
-                        return -EBADMSG;
+                if (ALIGN8(m->fields_size) > message_size - ws ||
+                    m->fields_size < sizeof(struct bus_header)) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 m->fields_size -= sizeof(struct bus_header);
                 m->body_size = message_size - (sizeof(struct bus_header) + ALIGN8(m->fields_size));
         } else {
-                if (h->dbus1.serial == 0)
-                        return -EBADMSG;
+                if (h->dbus1.serial == 0) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 /* dbus1 has the sizes in the header */
                 m->fields_size = BUS_MESSAGE_BSWAP32(m, h->dbus1.fields_size);
                 m->body_size = BUS_MESSAGE_BSWAP32(m, h->dbus1.body_size);
 
-                if (sizeof(struct bus_header) + ALIGN8(m->fields_size) + m->body_size != message_size)
-                        return -EBADMSG;
+                if (sizeof(struct bus_header) + ALIGN8(m->fields_size) + m->body_size != message_size) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
         }
 
         m->fds = fds;
@@ -531,28 +701,56 @@ int bus_message_from_header(
 
         m->bus = sd_bus_ref(bus);
         *ret = m;
-        m = NULL;
 
         return 0;
+
+fail:
+        message_release(bus, m);
+        return r;
 }
 
-int bus_message_from_malloc(
+static int message_from_malloc(
                 sd_bus *bus,
                 void *buffer,
                 size_t length,
+                const struct bus_body_segment *segments,
+                unsigned n_segments,
                 int *fds,
                 unsigned n_fds,
+                bool pool,
                 const char *label,
+                unsigned *ret_n_memfds,
                 sd_bus_message **ret) {
 
+        struct bus_body_part *part;
         sd_bus_message *m;
-        size_t sz;
+        size_t sz, header_size;
+        unsigned i, j, n_memfds = 0;
         int r;
 
+        assert(!segments || pool);
+
+        /* Without segments the buffer contains the whole message,
+         * otherwise only the header, and the body is put together
+         * from the inline segments and the memfds following the
+         * regular fds in the pool. */
+
+        if (segments) {
+                struct bus_header *h = buffer;
+
+                if (length < sizeof(struct bus_header) || h->version != 1)
+                        return -EBADMSG;
+
+                header_size = sizeof(struct bus_header) + ALIGN8(h->endian == BUS_NATIVE_ENDIAN ? h->dbus1.fields_size : bswap_32(h->dbus1.fields_size));
+                if (header_size > length)
+                        return -EBADMSG;
+        } else
+                header_size = length;
+
         r = bus_message_from_header(
                         bus,
-                        buffer, length, /* in this case the initial bytes and the final bytes are the same */
-                        buffer, length,
+                        buffer, header_size, /* in this case the initial bytes and the final bytes are the same */
+                        buffer, header_size,
                         length,
                         fds, n_fds,
                         label,
@@ -560,42 +758,186 @@ int bus_message_from_malloc(
         if (r < 0)
                 return r;
 
-        sz = length - sizeof(struct bus_header) - ALIGN8(m->fields_size);
-        if (sz > 0) {
-                m->n_body_parts = 1;
-                m->body.data = (uint8_t*) buffer + sizeof(struct bus_header) + ALIGN8(m->fields_size);
-                m->body.size = sz;
-                m->body.sealed = true;
-                m->body.memfd = -1;
+        if (segments) {
+                for (i = 0; i < n_segments; i++) {
+                        part = message_append_part(m);
+                        if (!part) {
+                                r = -ENOMEM;
+                                goto fail;
+                        }
+
+                        part->data = segments[i].data;
+                        part->size = segments[i].size;
+                        part->sealed = true;
+
+                        if (!segments[i].data) {
+                                part->memfd_offset = segments[i].memfd_offset;
+                                n_memfds++;
+                        }
+                }
+        } else {
+                sz = length - sizeof(struct bus_header) - ALIGN8(m->fields_size);
+                if (sz > 0) {
+                        m->n_body_parts = 1;
+                        m->body.data = (uint8_t*) buffer + sizeof(struct bus_header) + ALIGN8(m->fields_size);
+                        m->body.size = sz;
+                        m->body.sealed = true;
+                        m->body.memfd = -1;
+                }
+
+                m->n_iovec = 1;
+                m->iovec = m->iovec_fixed;
+                m->iovec[0].iov_base = buffer;
+                m->iovec[0].iov_len = length;
         }
 
-        m->n_iovec = 1;
-        m->iovec = m->iovec_fixed;
-        m->iovec[0].iov_base = buffer;
-        m->iovec[0].iov_len = length;
+        m->fds_pool = pool;
 
         r = bus_message_parse_fields(m);
         if (r < 0)
                 goto fail;
 
+        if (n_memfds > 0) {
+                /* The memfds are passed right after the regular
+                 * fds. Only accept them if they are sealed and
+                 * large enough, so that what we validate is what we
+                 * will read later on. */
+
+                if (m->n_fds + n_memfds > n_fds) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
+                j = m->n_fds;
+                MESSAGE_FOREACH_PART(part, i, m) {
+                        uint64_t real_size;
+
+                        if (part->data || part->is_zero)
+                                continue;
+
+                        r = memfd_get_sealed(fds[j]);
+                        if (r < 0)
+                                goto fail;
+                        if (r == 0) {
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        r = memfd_get_size(fds[j], &real_size);
+                        if (r < 0)
+                                goto fail;
+
+                        if (part->memfd_offset > real_size ||
+                            part->size > real_size - part->memfd_offset) {
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        part->memfd = fds[j++];
+                }
+        }
+
+        if (pool) {
+                /* Only keep the fds the header asked for, the
+                 * rest belongs to the messages following */
+                if (m->n_fds <= 0)
+                        m->fds = NULL;
+                else if (m->n_fds < n_fds) {
+                        m->fds = newdup(int, fds, m->n_fds);
+                        if (!m->fds) {
+                                r = -ENOMEM;
+                                goto fail;
+                        }
+                }
+
+                m->fds_pool = false;
+        }
+
         /* We take possession of the memory and fds now */
         m->free_header = true;
         m->free_fds = true;
 
+        if (ret_n_memfds)
+                *ret_n_memfds = n_memfds;
+
         *ret = m;
         return 0;
 
 fail:
+        /* The memfds stay in the pool then */
+        MESSAGE_FOREACH_PART(part, i, m)
+                part->memfd = -1;
+
         message_free(m);
         return r;
 }
 
+int bus_message_from_malloc(
+                sd_bus *bus,
+                void *buffer,
+                size_t length,
+                int *fds,
+                unsigned n_fds,
+                const char *label,
+                sd_bus_message **ret) {
+
+        return message_from_malloc(bus, buffer, length, NULL, 0, fds, n_fds, false, label, NULL, ret);
+}
+
+int bus_message_from_malloc_pool(
+                sd_bus *bus,
+                void *buffer,
+                size_t length,
+                const struct bus_body_segment *segments,
+                unsigned n_segments,
+                int **fds,
+                unsigned *n_fds,
+                sd_bus_message **ret) {
+
+        sd_bus_message *m;
+        unsigned n = 0;
+        int r;
+
+        assert(fds);
+        assert(n_fds);
+        assert(ret);
+
+        /* Takes as many fds from the front of the pool as the
+         * UNIX_FDS header field of the message declares, plus the
+         * memfds of its body segments, and leaves the rest in the
+         * pool. On stream sockets fds are received no later than
+         * the first byte of the message they are sent with, hence a
+         * message read off the stream always finds its fds at the
+         * front of the pool. */
+
+        r = message_from_malloc(bus, buffer, length, segments, n_segments, *fds, *n_fds, true, NULL, &n, &m);
+        if (r < 0)
+                return r;
+
+        n += m->n_fds;
+
+        if (n > 0 && n == *n_fds) {
+                /* The pool is empty now, and possibly the message
+                 * took over the whole array */
+                if (m->fds != *fds)
+                        free(*fds);
+                *fds = NULL;
+                *n_fds = 0;
+        } else if (n > 0) {
+                memmove(*fds, *fds + n, sizeof(int) * (*n_fds - n));
+                *n_fds -= n;
+        }
+
+        *ret = m;
+        return 0;
+}
+
 static sd_bus_message *message_new(sd_bus *bus, uint8_t type) {
         sd_bus_message *m;
 
         assert(bus);
 
-        m = malloc0(ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
+        m = message_alloc0(bus, ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
         if (!m)
                 return NULL;
 
@@ -1183,7 +1525,7 @@ struct bus_body_part *message_append_part(sd_bus_message *m) {
         } else {
                 assert(m->body_end);
 
-                part = new0(struct bus_body_part, 1);
+                part = pool_alloc0_tile(m->bus, &m->bus->part_pool);
                 if (!part) {
                         m->poisoned = true;
                         return NULL;
@@ -1272,17 +1614,37 @@ static int part_make_space(
         } else {
                 if (part->allocated == 0 || sz > part->allocated) {
                         size_t new_allocated;
+                        bool pooled;
+                        int i;
 
                         new_allocated = sz > 0 ? 2 * sz : 64;
-                        n = realloc(part->data, new_allocated);
+
+                        /* Small parts are taken from the pools of
+                         * the bus, once they outgrow them from the
+                         * heap */
+                        i = data_pool_find(new_allocated);
+                        pooled = i >= 0 && (!part->data || part->pool_this);
+                        if (pooled) {
+                                n = pool_alloc_tile(m->bus, &m->bus->data_pools[i]);
+                                new_allocated = data_pool_size[i];
+                        } else if (part->pool_this)
+                                n = malloc(new_allocated);
+                        else
+                                n = realloc(part->data, new_allocated);
                         if (!n) {
                                 m->poisoned = true;
                                 return -ENOMEM;
                         }
 
+                        if (part->pool_this) {
+                                memcpy(n, part->data, part->size);
+                                part_release_data(m->bus, part);
+                        }
+
                         part->data = n;
                         part->allocated = new_allocated;
-                        part->free_this = true;
+                        part->pool_this = pooled;
+                        part->free_this = !pooled;
                 }
         }
 
@@ -3346,11 +3708,12 @@ static bool validate_nul(const char *s, size_t l) {
 
 static bool validate_string(const char *s, size_t l) {
 
-        if (!validate_nul(s, l))
+        /* Check for NUL termination */
+        if (s[l] != 0)
                 return false;
 
-        /* Check if valid UTF8 */
-        if (!utf8_is_valid(s))
+        /* Check if valid UTF8 without embedded NUL chars, in one go */
+        if (!utf8_is_valid_n(s, l))
                 return false;
 
         return true;
@@ -5466,8 +5829,12 @@ int bus_message_parse_fields(sd_bus_message *m) {
                 i++;
         }
 
-        if (m->n_fds != unix_fds)
-                return -EBADMSG;
+        if (m->n_fds != unix_fds) {
+                if (!m->fds_pool || m->n_fds < unix_fds)
+                        return -EBADMSG;
+
+                m->n_fds = unix_fds;
+        }
 
         switch (m->header->type) {
 
@@ -5569,6 +5936,96 @@ int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz) {
         return 0;
 }
 
+int bus_message_dup_body(sd_bus_message *m, void **buffer, size_t *sz) {
+        struct bus_body_part *part;
+        unsigned i;
+        void *p;
+        uint8_t *e;
+
+        assert(m);
+        assert(buffer);
+        assert(sz);
+
+        /* Returns a copy of the marshalled body of a message that is
+         * complete, i.e. has no open containers anymore. Only
+         * supported for dbus1 marshalling, where the body of one
+         * message can be appended to another as is. */
+
+        if (m->n_containers > 0)
+                return -EBUSY;
+        if (BUS_MESSAGE_IS_GVARIANT(m))
+                return -EOPNOTSUPP;
+
+        p = malloc(MAX(m->body_size, 1u));
+        if (!p)
+                return -ENOMEM;
+
+        e = p;
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (part->is_zero)
+                        memzero(e, part->size);
+                else {
+                        if (part->memfd >= 0 || !part->data) {
+                                free(p);
+                                return -EOPNOTSUPP;
+                        }
+
+                        memcpy(e, part->data, part->size);
+                }
+
+                e += part->size;
+        }
+
+        assert((size_t) (e - (uint8_t*) p) == m->body_size);
+
+        *buffer = p;
+        *sz = m->body_size;
+
+        return 0;
+}
+
+int bus_message_append_body(sd_bus_message *m, const char *signature, const void *p, size_t sz) {
+        char *s;
+        void *a;
+
+        assert(m);
+        assert(signature);
+        assert(p || sz == 0);
+
+        /* Fills the body of an empty message with data previously
+         * returned by bus_message_dup_body() */
+
+        assert_return(!m->sealed, -EPERM);
+        assert_return(m->n_containers == 0 && m->body_size == 0, -EBUSY);
+        assert_return(isempty(m->root_container.signature), -EBUSY);
+        assert_return(!BUS_MESSAGE_IS_GVARIANT(m), -EOPNOTSUPP);
+
+        if (m->poisoned)
+                return -ESTALE;
+
+        s = strdup(signature);
+        if (!s) {
+                m->poisoned = true;
+                return -ENOMEM;
+        }
+
+        if (sz > 0) {
+                a = message_extend_body(m, 1, sz, false, false);
+                if (!a) {
+                        free(s);
+                        return -ENOMEM;
+                }
+
+                memcpy(a, p, sz);
+        }
+
+        free(m->root_container.signature);
+        m->root_container.signature = s;
+        m->root_container.index = strlen(s);
+
+        return 0;
+}
+
 int bus_message_read_strv_extend(sd_bus_message *m, char ***l) {
         const char *s;
         int r;
@@ -61,11 +61,20 @@ struct bus_body_part {
         uint64_t memfd_offset;
         int memfd;
         bool free_this:1;
+        bool pool_this:1;
         bool munmap_this:1;
         bool sealed:1;
         bool is_zero:1;
 };
 
+/* A piece of a received body, either inline data or a range of the
+ * next memfd passed along with the message */
+struct bus_body_segment {
+        void *data;
+        uint64_t memfd_offset;
+        size_t size;
+};
+
 struct sd_bus_message {
         unsigned n_ref;
 
@@ -89,12 +98,18 @@ struct sd_bus_message {
         int64_t priority;
         uint64_t verify_destination_id;
 
+        /* When the message was put into rqueue or wqueue, if
+         * statistics are collected */
+        usec_t queued;
+
         bool sealed:1;
         bool dont_send:1;
         bool allow_fds:1;
         bool free_header:1;
         bool free_kdbus:1;
         bool free_fds:1;
+        bool fds_pool:1;
+        bool from_pool:1;
         bool release_kdbus:1;
         bool poisoned:1;
 
@@ -194,8 +209,13 @@ static inline bool BUS_MESSAGE_IS_GVARIANT(sd_bus_message *m) {
 
 int bus_message_seal(sd_bus_message *m, uint64_t serial, usec_t timeout);
 int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz);
+int bus_message_dup_body(sd_bus_message *m, void **buffer, size_t *sz);
+int bus_message_append_body(sd_bus_message *m, const char *signature, const void *p, size_t sz);
 int bus_message_read_strv_extend(sd_bus_message *m, char ***l);
 
+void bus_message_pools_init(sd_bus *bus);
+void bus_message_pools_done(sd_bus *bus);
+
 int bus_message_from_header(
                 sd_bus *bus,
                 void *header,
@@ -218,6 +238,16 @@ int bus_message_from_malloc(
                 const char *label,
                 sd_bus_message **ret);
 
+int bus_message_from_malloc_pool(
+                sd_bus *bus,
+                void *buffer,
+                size_t length,
+                const struct bus_body_segment *segments,
+                unsigned n_segments,
+                int **fds,
+                unsigned *n_fds,
+                sd_bus_message **ret);
+
 int bus_message_get_arg(sd_bus_message *m, unsigned i, const char **str);
 int bus_message_get_arg_strv(sd_bus_message *m, unsigned i, char ***strv);
 
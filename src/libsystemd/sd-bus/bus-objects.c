@@ -29,6 +29,7 @@
 #include "bus-util.h"
 #include "bus-slot.h"
 #include "bus-objects.h"
+#include "bus-statistics.h"
 
 static int node_vtable_get_userdata(
                 sd_bus *bus,
@@ -409,9 +410,13 @@ static int method_callbacks_run(
 
         if (c->vtable->x.method.handler) {
                 sd_bus_slot *slot;
+                usec_t begin = 0;
 
                 slot = container_of(c->parent, sd_bus_slot, node_vtable);
 
+                if (bus->statistics)
+                        begin = now(CLOCK_MONOTONIC);
+
                 bus->current_slot = sd_bus_slot_ref(slot);
                 bus->current_handler = c->vtable->x.method.handler;
                 bus->current_userdata = u;
@@ -420,6 +425,9 @@ static int method_callbacks_run(
                 bus->current_handler = NULL;
                 bus->current_slot = sd_bus_slot_unref(slot);
 
+                if (begin > 0)
+                        bus_statistics_method(bus, m, now(CLOCK_MONOTONIC) - begin);
+
                 return bus_maybe_reply_error(m, r, &error);
         }
 
@@ -570,6 +578,217 @@ static int invoke_property_set(
         return 1;
 }
 
+/* Upper bound for the number of objects we keep GetAll() replies
+ * for. When it is hit we simply start from scratch. */
+#define PROPERTIES_CACHE_MAX 4096U
+
+/* The vtable is identified by its generation too, since a vtable
+ * registered later might end up at the same address */
+struct properties_cache_object {
+        struct node_vtable *vtable;
+        uint64_t generation;
+        void *userdata;
+};
+
+struct properties_cache_entry {
+        /* NULL when the reply covers all interfaces */
+        char *interface;
+
+        /* The vtables and objects the reply was generated from */
+        struct properties_cache_object *objects;
+        unsigned n_objects;
+
+        void *body;
+        size_t body_size;
+
+        LIST_FIELDS(struct properties_cache_entry, entries);
+};
+
+struct properties_cache {
+        char *path;
+        LIST_HEAD(struct properties_cache_entry, entries);
+};
+
+static void properties_cache_entry_free(struct properties_cache_entry *e) {
+        if (!e)
+                return;
+
+        free(e->interface);
+        free(e->objects);
+        free(e->body);
+        free(e);
+}
+
+static void properties_cache_free(struct properties_cache *p) {
+        struct properties_cache_entry *e;
+
+        if (!p)
+                return;
+
+        while ((e = p->entries)) {
+                LIST_REMOVE(entries, p->entries, e);
+                properties_cache_entry_free(e);
+        }
+
+        free(p->path);
+        free(p);
+}
+
+void bus_properties_cache_flush(sd_bus *bus) {
+        struct properties_cache *p;
+
+        assert(bus);
+
+        while ((p = hashmap_steal_first(bus->properties_cache)))
+                properties_cache_free(p);
+}
+
+static void properties_cache_invalidate(sd_bus *bus, const char *path, const char *interface) {
+        struct properties_cache_entry *e, *n;
+        struct properties_cache *p;
+
+        assert(bus);
+        assert(path);
+
+        /* Drops the replies for the specified interface and the
+         * replies covering all interfaces of the object. A NULL
+         * interface drops everything cached for the object. */
+
+        p = hashmap_get(bus->properties_cache, path);
+        if (!p)
+                return;
+
+        LIST_FOREACH_SAFE(entries, e, n, p->entries) {
+                if (interface && e->interface && !streq(e->interface, interface))
+                        continue;
+
+                LIST_REMOVE(entries, p->entries, e);
+                properties_cache_entry_free(e);
+        }
+
+        if (!p->entries) {
+                hashmap_remove(bus->properties_cache, path);
+                properties_cache_free(p);
+        }
+}
+
+static struct properties_cache_entry *properties_cache_find(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const struct properties_cache_object *objects,
+                unsigned n_objects) {
+
+        struct properties_cache_entry *e;
+        struct properties_cache *p;
+        unsigned i;
+
+        assert(bus);
+        assert(path);
+
+        p = hashmap_get(bus->properties_cache, path);
+        if (!p)
+                return NULL;
+
+        LIST_FOREACH(entries, e, p->entries) {
+                if (!streq_ptr(e->interface, interface))
+                        continue;
+
+                /* If a different set of objects implements the
+                 * interfaces now, the reply is out of date. */
+                if (e->n_objects != n_objects)
+                        return NULL;
+
+                for (i = 0; i < n_objects; i++)
+                        if (e->objects[i].vtable != objects[i].vtable ||
+                            e->objects[i].generation != objects[i].generation ||
+                            e->objects[i].userdata != objects[i].userdata)
+                                return NULL;
+
+                return e;
+        }
+
+        return NULL;
+}
+
+static int properties_cache_add(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const struct properties_cache_object *objects,
+                unsigned n_objects,
+                sd_bus_message *reply) {
+
+        struct properties_cache_entry *e = NULL;
+        struct properties_cache *p;
+        int r;
+
+        assert(bus);
+        assert(path);
+        assert(reply);
+
+        properties_cache_invalidate(bus, path, interface);
+
+        r = hashmap_ensure_allocated(&bus->properties_cache, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        p = hashmap_get(bus->properties_cache, path);
+        if (!p) {
+                if (hashmap_size(bus->properties_cache) >= PROPERTIES_CACHE_MAX)
+                        bus_properties_cache_flush(bus);
+
+                p = new0(struct properties_cache, 1);
+                if (!p)
+                        return -ENOMEM;
+
+                p->path = strdup(path);
+                if (!p->path) {
+                        free(p);
+                        return -ENOMEM;
+                }
+
+                r = hashmap_put(bus->properties_cache, p->path, p);
+                if (r < 0) {
+                        properties_cache_free(p);
+                        return r;
+                }
+        }
+
+        e = new0(struct properties_cache_entry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        if (interface) {
+                e->interface = strdup(interface);
+                if (!e->interface) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+        }
+
+        if (n_objects > 0) {
+                e->objects = newdup(struct properties_cache_object, objects, n_objects);
+                if (!e->objects) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+        }
+
+        e->n_objects = n_objects;
+
+        r = bus_message_dup_body(reply, &e->body, &e->body_size);
+        if (r < 0)
+                goto fail;
+
+        LIST_PREPEND(entries, p->entries, e);
+        return 0;
+
+fail:
+        properties_cache_entry_free(e);
+        return r;
+}
+
 static int property_get_set_callbacks_run(
                 sd_bus *bus,
                 sd_bus_message *m,
@@ -664,6 +883,8 @@ static int property_get_set_callbacks_run(
                 if (r < 0)
                         return bus_maybe_reply_error(m, r, &error);
 
+                properties_cache_invalidate(bus, m->path, c->interface);
+
                 r = invoke_property_set(bus, slot, c->vtable, m->path, c->interface, c->member, m, u, &error);
                 if (r < 0)
                         return bus_maybe_reply_error(m, r, &error);
@@ -780,22 +1001,18 @@ static int property_get_all_callbacks_run(
                 bool *found_object) {
 
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_free_ struct properties_cache_object *objects = NULL;
+        unsigned n_objects = 0, i;
+        size_t n_allocated = 0;
+        struct properties_cache_entry *e;
         struct node_vtable *c;
-        bool found_interface;
+        bool found_interface, cacheable;
         int r;
 
         assert(bus);
         assert(m);
         assert(found_object);
 
-        r = sd_bus_message_new_method_return(m, &reply);
-        if (r < 0)
-                return r;
-
-        r = sd_bus_message_open_container(reply, 'a', "{sv}");
-        if (r < 0)
-                return r;
-
         found_interface = !iface ||
                 streq(iface, "org.freedesktop.DBus.Properties") ||
                 streq(iface, "org.freedesktop.DBus.Peer") ||
@@ -822,11 +1039,14 @@ static int property_get_all_callbacks_run(
                         continue;
                 found_interface = true;
 
-                r = vtable_append_all_properties(bus, reply, m->path, c, u, &error);
-                if (r < 0)
-                        return bus_maybe_reply_error(m, r, &error);
-                if (bus->nodes_modified)
-                        return 0;
+                if (!GREEDY_REALLOC(objects, n_allocated, n_objects + 1))
+                        return -ENOMEM;
+
+                objects[n_objects++] = (struct properties_cache_object) {
+                        .vtable = c,
+                        .generation = c->generation,
+                        .userdata = u,
+                };
         }
 
         if (!found_interface) {
@@ -840,10 +1060,49 @@ static int property_get_all_callbacks_run(
                 return 1;
         }
 
+        r = sd_bus_message_new_method_return(m, &reply);
+        if (r < 0)
+                return r;
+
+        /* The reply may only be cached if all vtables involved
+         * promise to signal every change of their properties. */
+        cacheable = !BUS_MESSAGE_IS_GVARIANT(reply);
+        for (i = 0; cacheable && i < n_objects; i++)
+                cacheable = objects[i].vtable->cache_properties;
+
+        if (cacheable) {
+                e = properties_cache_find(bus, m->path, iface, objects, n_objects);
+                if (e) {
+                        r = bus_message_append_body(reply, "a{sv}", e->body, e->body_size);
+                        if (r < 0)
+                                return r;
+
+                        goto send;
+                }
+        }
+
+        r = sd_bus_message_open_container(reply, 'a', "{sv}");
+        if (r < 0)
+                return r;
+
+        for (i = 0; i < n_objects; i++) {
+                _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+
+                r = vtable_append_all_properties(bus, reply, m->path, objects[i].vtable, objects[i].userdata, &error);
+                if (r < 0)
+                        return bus_maybe_reply_error(m, r, &error);
+                if (bus->nodes_modified)
+                        return 0;
+        }
+
         r = sd_bus_message_close_container(reply);
         if (r < 0)
                 return r;
 
+        if (cacheable)
+                (void) properties_cache_add(bus, m->path, iface, objects, n_objects, reply);
+
+send:
         r = sd_bus_send(bus, reply, NULL);
         if (r < 0)
                 return r;
@@ -960,9 +1219,13 @@ static int process_introspect(
                         fprintf(intro.f, " <interface name=\"%s\">\n", c->interface);
                 }
 
-                r = introspect_write_interface(&intro, c->vtable);
-                if (r < 0)
-                        goto finish;
+                if (!c->introspection) {
+                        r = introspect_format_interface(c->vtable, bus->trusted, &c->introspection);
+                        if (r < 0)
+                                goto finish;
+                }
+
+                fputs(c->introspection, intro.f);
 
                 previous_interface = c->interface;
         }
@@ -1688,6 +1951,8 @@ static int add_object_vtable_internal(
         s->node_vtable.is_fallback = fallback;
         s->node_vtable.vtable = vtable;
         s->node_vtable.find = find;
+        s->node_vtable.cache_properties = true;
+        s->node_vtable.generation = ++bus->vtable_generation;
 
         s->node_vtable.interface = strdup(interface);
         if (!s->node_vtable.interface) {
@@ -1760,6 +2025,17 @@ static int add_object_vtable_internal(
                                 goto fail;
                         }
 
+                        /* Properties that show up in GetAll() may
+                         * only be cached if changes are signalled */
+                        if (!((vtable[0].flags | v->flags) & (SD_BUS_VTABLE_HIDDEN|SD_BUS_VTABLE_PROPERTY_EXPLICIT))) {
+                                if (!(vtable[0].flags & SD_BUS_VTABLE_CACHE_PROPERTIES))
+                                        s->node_vtable.cache_properties = false;
+                                else if (!(v->flags & (SD_BUS_VTABLE_PROPERTY_CONST|SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE|SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION))) {
+                                        r = -EINVAL;
+                                        goto fail;
+                                }
+                        }
+
                         m = new0(struct vtable_member, 1);
                         if (!m) {
                                 r = -ENOMEM;
@@ -1801,6 +2077,7 @@ static int add_object_vtable_internal(
         s->node_vtable.node = n;
         LIST_INSERT_AFTER(vtables, n->vtables, existing, &s->node_vtable);
         bus->nodes_modified = true;
+        bus_properties_cache_flush(bus);
 
         if (slot)
                 *slot = s;
@@ -2114,6 +2391,8 @@ _public_ int sd_bus_emit_properties_changed_strv(
         if (names && names[0] == NULL)
                 return 0;
 
+        properties_cache_invalidate(bus, path, interface);
+
         do {
                 bus->nodes_modified = false;
 
@@ -2336,6 +2615,10 @@ _public_ int sd_bus_emit_object_added(sd_bus *bus, const char *path) {
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        /* A new object may live where an old one did, don't mix up
+         * their cached properties */
+        properties_cache_invalidate(bus, path, NULL);
+
         r = bus_find_parent_object_manager(bus, &object_manager, path);
         if (r < 0)
                 return r;
@@ -2506,6 +2789,8 @@ _public_ int sd_bus_emit_object_removed(sd_bus *bus, const char *path) {
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        properties_cache_invalidate(bus, path, NULL);
+
         r = bus_find_parent_object_manager(bus, &object_manager, path);
         if (r < 0)
                 return r;
@@ -2659,6 +2944,8 @@ _public_ int sd_bus_emit_interfaces_added_strv(sd_bus *bus, const char *path, ch
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        properties_cache_invalidate(bus, path, NULL);
+
         if (strv_isempty(interfaces))
                 return 0;
 
@@ -2742,6 +3029,8 @@ _public_ int sd_bus_emit_interfaces_removed_strv(sd_bus *bus, const char *path,
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        properties_cache_invalidate(bus, path, NULL);
+
         if (strv_isempty(interfaces))
                 return 0;
 
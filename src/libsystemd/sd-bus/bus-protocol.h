@@ -77,6 +77,10 @@ enum {
         BUS_MESSAGE_NO_REPLY_EXPECTED = 1,
         BUS_MESSAGE_NO_AUTO_START = 2,
         BUS_MESSAGE_ALLOW_INTERACTIVE_AUTHORIZATION = 4,
+
+        /* sd-bus extension, only used on socket connections that
+         * negotiated it: parts of the body are passed as memfds */
+        BUS_MESSAGE_MEMFD_PAYLOAD = 0x80,
 };
 
 /* Header fields */
@@ -171,10 +171,12 @@ void bus_slot_disconnect(sd_bus_slot *slot) {
                 }
 
                 free(slot->node_vtable.interface);
+                free(slot->node_vtable.introspection);
 
                 if (slot->node_vtable.node) {
                         LIST_REMOVE(vtables, slot->node_vtable.node->vtables, &slot->node_vtable);
                         slot->bus->nodes_modified = true;
+                        bus_properties_cache_flush(slot->bus);
 
                         bus_node_gc(slot->bus, slot->node_vtable.node);
                 }
@@ -39,6 +39,22 @@
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* How many iovecs to hand to the kernel at most when sending queued
+ * messages in one go, and how much to read at least in one go */
+#define BUS_SOCKET_IOVEC_MAX 128
+#define BUS_SOCKET_READ_SIZE (64*1024)
+
+/* On connections that negotiated EXTENSION_NEGOTIATE_MEMFD, messages
+ * flagged with BUS_MESSAGE_MEMFD_PAYLOAD carry a segment table after
+ * the header: a uint64_t count, followed by that many pairs of
+ * uint64_t size and memfd offset, the latter UINT64_MAX for inline
+ * data, all in the byte order of the message. The inline segments
+ * follow the table, each padded so that its alignment matches its
+ * position in the body. The memfd segments are passed as fds in
+ * order, right after the regular fds of the message. */
+#define BUS_SOCKET_MEMFD_SEGMENTS_MAX 64
+#define BUS_SOCKET_SEGMENT_INLINE ((uint64_t) -1)
+
 static void iovec_advance(struct iovec iov[], unsigned *idx, size_t size) {
 
         while (size > 0) {
@@ -118,6 +134,130 @@ fail:
         return r;
 }
 
+static bool part_pass_memfd(struct bus_body_part *part) {
+        assert(part);
+
+        return part->memfd >= 0 && part->sealed;
+}
+
+static size_t segment_padding(size_t body_offset, size_t wire_offset) {
+        /* Inline segments are placed on the wire so that they end
+         * up with the same alignment as in the body */
+        return (body_offset - wire_offset) & 7;
+}
+
+static bool message_use_memfd(sd_bus *bus, sd_bus_message *m) {
+        struct bus_body_part *part;
+        unsigned i, n = 0;
+
+        assert(bus);
+        assert(m);
+
+        if (!bus->can_memfd || BUS_MESSAGE_IS_GVARIANT(m))
+                return false;
+
+        if (m->n_body_parts > BUS_SOCKET_MEMFD_SEGMENTS_MAX)
+                return false;
+
+        MESSAGE_FOREACH_PART(part, i, m)
+                if (part_pass_memfd(part))
+                        n++;
+
+        return n > 0 && m->n_fds + n <= BUS_FDS_MAX;
+}
+
+size_t bus_socket_message_size(sd_bus *bus, sd_bus_message *m) {
+        struct bus_body_part *part;
+        size_t body = 0, wire = 0;
+        unsigned i;
+
+        assert(bus);
+        assert(m);
+
+        if (!message_use_memfd(bus, m))
+                return BUS_MESSAGE_SIZE(m);
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (!part_pass_memfd(part))
+                        wire += segment_padding(body, wire) + part->size;
+
+                body += part->size;
+        }
+
+        return BUS_MESSAGE_BODY_BEGIN(m) + sizeof(uint64_t) * (1 + 2 * m->n_body_parts) + wire;
+}
+
+static int message_setup_memfd_iovec(
+                sd_bus_message *m,
+                struct bus_header *header,
+                uint64_t *table,
+                struct iovec *iov,
+                unsigned *n_iovec,
+                int *fds,
+                unsigned *n_fds) {
+
+        static const uint8_t padding[7] = {};
+        struct bus_body_part *part;
+        size_t body = 0, wire = 0;
+        unsigned i, n = 0;
+        int r;
+
+        assert(m);
+        assert(header);
+        assert(table);
+        assert(iov);
+        assert(n_iovec);
+        assert(fds);
+        assert(n_fds);
+
+        /* The table needs space for 1 + 2 * n_body_parts entries, the
+         * iovec array for 3 + 2 * n_body_parts, and the fd array for
+         * the regular fds plus the memfds. */
+
+        *header = *m->header;
+        header->flags |= BUS_MESSAGE_MEMFD_PAYLOAD;
+
+        iov[n++] = (struct iovec) { header, sizeof(struct bus_header) };
+        iov[n++] = (struct iovec) { (uint8_t*) m->header + sizeof(struct bus_header), BUS_MESSAGE_BODY_BEGIN(m) - sizeof(struct bus_header) };
+        iov[n++] = (struct iovec) { table, sizeof(uint64_t) * (1 + 2 * m->n_body_parts) };
+
+        memcpy(fds, m->fds, sizeof(int) * m->n_fds);
+        *n_fds = m->n_fds;
+
+        table[0] = BUS_MESSAGE_BSWAP64(m, m->n_body_parts);
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                size_t pad;
+
+                table[1 + 2 * i] = BUS_MESSAGE_BSWAP64(m, part->size);
+
+                if (part_pass_memfd(part)) {
+                        table[2 + 2 * i] = BUS_MESSAGE_BSWAP64(m, part->memfd_offset);
+                        fds[(*n_fds)++] = part->memfd;
+                } else {
+                        table[2 + 2 * i] = BUS_SOCKET_SEGMENT_INLINE;
+
+                        r = bus_body_part_map(part);
+                        if (r < 0)
+                                return r;
+
+                        pad = segment_padding(body, wire);
+                        if (pad > 0)
+                                iov[n++] = (struct iovec) { (void*) padding, pad };
+
+                        if (part->size > 0)
+                                iov[n++] = (struct iovec) { part->data, part->size };
+
+                        wire += pad + part->size;
+                }
+
+                body += part->size;
+        }
+
+        *n_iovec = n;
+        return 0;
+}
+
 bool bus_socket_auth_needs_write(sd_bus *b) {
 
         unsigned i;
@@ -168,15 +308,15 @@ static int bus_socket_write_auth(sd_bus *b) {
 }
 
 static int bus_socket_auth_verify_client(sd_bus *b) {
-        char *e, *f, *start;
+        char *e, *f, *g, *start;
         sd_id128_t peer;
         unsigned i;
         int r;
 
         assert(b);
 
-        /* We expect two response lines: "OK" and possibly
-         * "AGREE_UNIX_FD" */
+        /* We expect up to three response lines: "OK", and possibly
+         * "AGREE_UNIX_FD" and "EXTENSION_AGREE_MEMFD" */
 
         e = memmem_safe(b->rbuffer, b->rbuffer_size, "\r\n", 2);
         if (!e)
@@ -193,6 +333,15 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                 start = e + 2;
         }
 
+        if (f && b->accept_memfd) {
+                g = memmem(f + 2, b->rbuffer_size - (f - (char*) b->rbuffer) - 2, "\r\n", 2);
+                if (!g)
+                        return 0;
+
+                start = g + 2;
+        } else
+                g = NULL;
+
         /* Nice! We got all the lines we need. First check the OK
          * line */
 
@@ -229,6 +378,13 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                         (f - e == strlen("\r\nAGREE_UNIX_FD")) &&
                         memcmp(e + 2, "AGREE_UNIX_FD", strlen("AGREE_UNIX_FD")) == 0;
 
+        /* Servers that don't know the extension reply with ERROR */
+        if (g)
+                b->can_memfd =
+                        b->can_fds &&
+                        (g - f == strlen("\r\nEXTENSION_AGREE_MEMFD")) &&
+                        memcmp(f + 2, "EXTENSION_AGREE_MEMFD", strlen("EXTENSION_AGREE_MEMFD")) == 0;
+
         b->rbuffer_size -= (start - (char*) b->rbuffer);
         memmove(b->rbuffer, start, b->rbuffer_size);
 
@@ -474,6 +630,13 @@ static int bus_socket_auth_verify_server(sd_bus *b) {
                                 b->can_fds = true;
                                 r = bus_socket_auth_write(b, "AGREE_UNIX_FD\r\n");
                         }
+                } else if (line_equals(line, l, "EXTENSION_NEGOTIATE_MEMFD")) {
+                        if (b->auth == _BUS_AUTH_INVALID || !b->can_fds || !b->accept_memfd)
+                                r = bus_socket_auth_write(b, "ERROR\r\n");
+                        else {
+                                b->can_memfd = true;
+                                r = bus_socket_auth_write(b, "EXTENSION_AGREE_MEMFD\r\n");
+                        }
                 } else
                         r = bus_socket_auth_write(b, "ERROR\r\n");
 
@@ -633,7 +796,9 @@ static int bus_socket_start_auth_client(sd_bus *b) {
         if (!b->auth_buffer)
                 return -ENOMEM;
 
-        if (b->hello_flags & KDBUS_HELLO_ACCEPT_FD)
+        if ((b->hello_flags & KDBUS_HELLO_ACCEPT_FD) && b->accept_memfd)
+                auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nEXTENSION_NEGOTIATE_MEMFD\r\nBEGIN\r\n";
+        else if (b->hello_flags & KDBUS_HELLO_ACCEPT_FD)
                 auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nBEGIN\r\n";
         else
                 auth_suffix = "\r\nBEGIN\r\n";
@@ -759,54 +924,102 @@ int bus_socket_take_fd(sd_bus *b) {
         return bus_socket_start_auth(b);
 }
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+int bus_socket_write_messages(sd_bus *bus, sd_bus_message **m, unsigned n, size_t *idx) {
+        struct bus_header header;
         struct iovec *iov;
         ssize_t k;
-        size_t n;
-        unsigned j;
+        unsigned i, j, n_iovec = 0, n_fds, c = 0;
+        int *fds;
         int r;
 
         assert(bus);
         assert(m);
+        assert(n > 0);
         assert(idx);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (*idx >= BUS_MESSAGE_SIZE(m))
+        if (*idx >= bus_socket_message_size(bus, m[0]))
                 return 0;
 
-        r = bus_message_setup_iovec(m);
-        if (r < 0)
-                return r;
+        if (message_use_memfd(bus, m[0])) {
+                uint64_t *table;
+
+                /* Sent on its own, with memfd payload. The layout
+                 * is recalculated on each call, which is cheap and
+                 * always comes out the same. */
+
+                table = alloca(sizeof(uint64_t) * (1 + 2 * m[0]->n_body_parts));
+                iov = alloca(sizeof(struct iovec) * (3 + 2 * m[0]->n_body_parts));
+                fds = alloca(sizeof(int) * (m[0]->n_fds + m[0]->n_body_parts));
+
+                r = message_setup_memfd_iovec(m[0], &header, table, iov, &n_iovec, fds, &n_fds);
+                if (r < 0)
+                        return r;
+        } else {
+                r = bus_message_setup_iovec(m[0]);
+                if (r < 0)
+                        return r;
 
-        n = m->n_iovec * sizeof(struct iovec);
-        iov = alloca(n);
-        memcpy(iov, m->iovec, n);
+                n_iovec = m[0]->n_iovec;
+
+                /* Queue up as many of the following messages as fit
+                 * into one iovec set. Messages carrying fds are
+                 * always sent on their own, so that the fds go out
+                 * with the first byte of the message they belong
+                 * to. */
+                if (m[0]->n_fds <= 0)
+                        for (i = 1; i < n; i++) {
+                                if (m[i]->n_fds > 0 || message_use_memfd(bus, m[i]))
+                                        break;
+
+                                if (bus_message_setup_iovec(m[i]) < 0)
+                                        break;
+
+                                if (n_iovec + m[i]->n_iovec > BUS_SOCKET_IOVEC_MAX)
+                                        break;
+
+                                n_iovec += m[i]->n_iovec;
+                        }
+                else
+                        i = 1;
+
+                iov = alloca(n_iovec * sizeof(struct iovec));
+                for (j = 0; j < i; j++) {
+                        memcpy(iov + c, m[j]->iovec, m[j]->n_iovec * sizeof(struct iovec));
+                        c += m[j]->n_iovec;
+                }
+
+                fds = m[0]->fds;
+                n_fds = m[0]->n_fds;
+        }
 
         j = 0;
         iovec_advance(iov, &j, *idx);
 
         if (bus->prefer_writev)
-                k = writev(bus->output_fd, iov, m->n_iovec);
+                k = writev(bus->output_fd, iov, n_iovec);
         else {
                 struct msghdr mh = {
                         .msg_iov = iov,
-                        .msg_iovlen = m->n_iovec,
+                        .msg_iovlen = n_iovec,
                 };
 
-                if (m->n_fds > 0) {
+                /* If the message was partially written before, its
+                 * fds are already on their way */
+                if (n_fds > 0 && *idx <= 0) {
                         struct cmsghdr *control;
 
-                        mh.msg_control = control = alloca(CMSG_SPACE(sizeof(int) * m->n_fds));
-                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m->n_fds);
+                        mh.msg_control = control = alloca(CMSG_SPACE(sizeof(int) * n_fds));
+                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
                         control->cmsg_level = SOL_SOCKET;
                         control->cmsg_type = SCM_RIGHTS;
-                        memcpy(CMSG_DATA(control), m->fds, sizeof(int) * m->n_fds);
+                        memcpy(CMSG_DATA(control), fds, sizeof(int) * n_fds);
                 }
 
                 k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
                 if (k < 0 && errno == ENOTSOCK) {
                         bus->prefer_writev = true;
-                        k = writev(bus->output_fd, iov, m->n_iovec);
+                        k = writev(bus->output_fd, iov, n_iovec);
                 }
         }
 
@@ -817,16 +1030,108 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
-static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+        assert(m);
+
+        return bus_socket_write_messages(bus, &m, 1, idx);
+}
+
+static uint64_t read_uint64(uint8_t endian, const void *p) {
+        uint64_t u;
+
+        memcpy(&u, p, sizeof(u));
+
+        return endian == BUS_NATIVE_ENDIAN ? u : bswap_64(u);
+}
+
+static int bus_socket_read_memfd_layout(
+                const void *p,
+                size_t size,
+                uint8_t endian,
+                size_t fields_size,
+                size_t body_size,
+                struct bus_body_segment *segments,
+                unsigned *n_segments,
+                size_t *need) {
+
+        size_t begin, data, body = 0, wire = 0;
+        uint64_t n, i;
+
+        assert(p);
+        assert(need);
+
+        /* Determines how many bytes of a message with memfd payload
+         * are on the stream, and optionally fills in where its body
+         * segments are. */
+
+        begin = sizeof(struct bus_header) + fields_size;
+        if (size < begin + sizeof(uint64_t)) {
+                *need = begin + sizeof(uint64_t);
+                return 0;
+        }
+
+        n = read_uint64(endian, (const uint8_t*) p + begin);
+        if (n <= 0 || n > BUS_SOCKET_MEMFD_SEGMENTS_MAX)
+                return -EBADMSG;
+
+        data = begin + sizeof(uint64_t) * (1 + 2 * n);
+        if (size < data) {
+                *need = data;
+                return 0;
+        }
+
+        for (i = 0; i < n; i++) {
+                uint64_t sz, offset;
+
+                sz = read_uint64(endian, (const uint8_t*) p + begin + sizeof(uint64_t) * (1 + 2 * i));
+                offset = read_uint64(endian, (const uint8_t*) p + begin + sizeof(uint64_t) * (2 + 2 * i));
+
+                if (sz > body_size - body)
+                        return -EBADMSG;
+
+                if (offset == BUS_SOCKET_SEGMENT_INLINE) {
+                        wire += segment_padding(body, wire);
+
+                        if (segments)
+                                segments[i] = (struct bus_body_segment) {
+                                        .data = (uint8_t*) p + data + wire,
+                                        .size = sz,
+                                };
+
+                        wire += sz;
+                } else if (segments)
+                        segments[i] = (struct bus_body_segment) {
+                                .memfd_offset = offset,
+                                .size = sz,
+                        };
+
+                body += sz;
+        }
+
+        if (body != body_size)
+                return -EBADMSG;
+
+        if (data + wire >= BUS_MESSAGE_SIZE_MAX)
+                return -ENOBUFS;
+
+        if (n_segments)
+                *n_segments = n;
+
+        *need = data + wire;
+        return 0;
+}
+
+static int bus_socket_read_message_need(sd_bus *bus, const void *p, size_t size, size_t *need) {
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
 
         assert(bus);
+        assert(p || size <= 0);
         assert(need);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (size < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -848,10 +1153,12 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
+        /* Messages following the first one in the buffer are not
+         * necessarily aligned */
+        memcpy(&a, (const uint8_t*) p + 4, sizeof(a));
+        memcpy(&b, (const uint8_t*) p + 12, sizeof(b));
 
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        e = ((const uint8_t*) p)[0];
         if (e == BUS_LITTLE_ENDIAN) {
                 a = le32toh(a);
                 b = le32toh(b);
@@ -861,6 +1168,9 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         } else
                 return -EBADMSG;
 
+        if (bus->can_memfd && (((const uint8_t*) p)[2] & BUS_MESSAGE_MEMFD_PAYLOAD))
+                return bus_socket_read_memfd_layout(p, size, e, ALIGN_TO(b, 8), a, NULL, NULL, need);
+
         sum = (uint64_t) sizeof(struct bus_header) + (uint64_t) ALIGN_TO(b, 8) + (uint64_t) a;
         if (sum >= BUS_MESSAGE_SIZE_MAX)
                 return -ENOBUFS;
@@ -869,53 +1179,121 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         return 0;
 }
 
-static int bus_socket_make_message(sd_bus *bus, size_t size) {
-        sd_bus_message *t;
-        void *b;
+static int bus_socket_make_memfd_message(sd_bus *bus, void *b, size_t size, sd_bus_message **ret) {
+        struct bus_body_segment segments[BUS_SOCKET_MEMFD_SEGMENTS_MAX];
+        struct bus_header *h = b;
+        unsigned n_segments = 0;
+        size_t fields_size, body_size, need;
         int r;
 
         assert(bus);
-        assert(bus->rbuffer_size >= size);
-        assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
+        assert(b);
+        assert(ret);
+
+        fields_size = ALIGN8(h->endian == BUS_NATIVE_ENDIAN ? h->dbus1.fields_size : bswap_32(h->dbus1.fields_size));
+        body_size = h->endian == BUS_NATIVE_ENDIAN ? h->dbus1.body_size : bswap_32(h->dbus1.body_size);
 
-        r = bus_rqueue_make_room(bus);
+        r = bus_socket_read_memfd_layout(b, size, h->endian, fields_size, body_size, segments, &n_segments, &need);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
-                if (!b)
-                        return -ENOMEM;
-        } else
-                b = NULL;
+        assert(need == size);
 
-        r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
-                                    bus->fds, bus->n_fds,
-                                    NULL,
-                                    &t);
-        if (r < 0) {
-                free(b);
-                return r;
+        /* From here on it's a regular message whose body happens to
+         * be split up, and may be forwarded as such */
+        h->flags &= ~BUS_MESSAGE_MEMFD_PAYLOAD;
+
+        return bus_message_from_malloc_pool(
+                        bus,
+                        b, sizeof(struct bus_header) + fields_size + body_size,
+                        segments, n_segments,
+                        &bus->fds, &bus->n_fds,
+                        ret);
+}
+
+static int bus_socket_make_messages(sd_bus *bus) {
+        size_t offset = 0, need;
+        int r, ret = 0;
+
+        assert(bus);
+        assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
+
+        /* Split off all complete messages from the front of the
+         * read buffer. Each message gets a copy of its own, since
+         * only the first one is suitably aligned, except for large
+         * messages that fill the buffer on their own, which simply
+         * take it over. */
+
+        for (;;) {
+                sd_bus_message *t;
+                void *b;
+
+                r = bus_socket_read_message_need(bus, (uint8_t*) bus->rbuffer + offset, bus->rbuffer_size - offset, &need);
+                if (r < 0)
+                        break;
+
+                if (bus->rbuffer_size - offset < need)
+                        break;
+
+                r = bus_rqueue_make_room(bus);
+                if (r < 0)
+                        break;
+
+                if (offset == 0 && need == bus->rbuffer_size && need >= BUS_SOCKET_READ_SIZE)
+                        b = bus->rbuffer;
+                else {
+                        b = memdup((const uint8_t*) bus->rbuffer + offset, need);
+                        if (!b) {
+                                r = -ENOMEM;
+                                break;
+                        }
+                }
+
+                if (bus->can_memfd && (((struct bus_header*) b)->flags & BUS_MESSAGE_MEMFD_PAYLOAD))
+                        r = bus_socket_make_memfd_message(bus, b, need, &t);
+                else
+                        r = bus_message_from_malloc_pool(bus, b, need, NULL, 0, &bus->fds, &bus->n_fds, &t);
+                if (r < 0) {
+                        if (b != bus->rbuffer)
+                                free(b);
+                        break;
+                }
+
+                bus->rqueue[bus->rqueue_size++] = t;
+                ret = 1;
+
+                if (b == bus->rbuffer) {
+                        bus->rbuffer = NULL;
+                        bus->rbuffer_size = 0;
+                        break;
+                }
+
+                offset += need;
         }
 
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        if (offset > 0) {
+                bus->rbuffer_size -= offset;
+                memmove(bus->rbuffer, (uint8_t*) bus->rbuffer + offset, bus->rbuffer_size);
+        }
 
-        bus->fds = NULL;
-        bus->n_fds = 0;
+        /* Don't keep the read buffer around on idle connections */
+        if (bus->rbuffer_size <= 0)
+                bus->rbuffer = mfree(bus->rbuffer);
 
-        bus->rqueue[bus->rqueue_size++] = t;
+        /* If we got at least one message let the caller dispatch
+         * it first, the error will be hit again on the next
+         * iteration. */
+        if (ret > 0)
+                return ret;
 
-        return 1;
+        return r;
 }
 
 int bus_socket_read_message(sd_bus *bus) {
         struct msghdr mh;
         struct iovec iov = {};
         ssize_t k;
-        size_t need;
+        size_t need, n;
         int r;
         void *b;
         union {
@@ -927,21 +1305,26 @@ int bus_socket_read_message(sd_bus *bus) {
         assert(bus);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        r = bus_socket_read_message_need(bus, &need);
+        r = bus_socket_read_message_need(bus, bus->rbuffer, bus->rbuffer_size, &need);
         if (r < 0)
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
+
+        /* Read more than we need for the next message, so that a
+         * burst of small messages is picked up with a single
+         * syscall. */
+        n = MAX(need, BUS_SOCKET_READ_SIZE);
 
-        b = realloc(bus->rbuffer, need);
+        b = realloc(bus->rbuffer, n);
         if (!b)
                 return -ENOMEM;
 
         bus->rbuffer = b;
 
         iov.iov_base = (uint8_t*) bus->rbuffer + bus->rbuffer_size;
-        iov.iov_len = need - bus->rbuffer_size;
+        iov.iov_len = n - bus->rbuffer_size;
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -972,39 +1355,39 @@ int bus_socket_read_message(sd_bus *bus) {
                 CMSG_FOREACH(cmsg, &mh)
                         if (cmsg->cmsg_level == SOL_SOCKET &&
                             cmsg->cmsg_type == SCM_RIGHTS) {
-                                int n, *f;
+                                int n_cmsg_fds, *f;
 
-                                n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                                n_cmsg_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
 
                                 if (!bus->can_fds) {
                                         /* Whut? We received fds but this
                                          * isn't actually enabled? Close them,
                                          * and fail */
 
-                                        close_many((int*) CMSG_DATA(cmsg), n);
+                                        close_many((int*) CMSG_DATA(cmsg), n_cmsg_fds);
                                         return -EIO;
                                 }
 
-                                f = realloc(bus->fds, sizeof(int) + (bus->n_fds + n));
+                                f = realloc(bus->fds, sizeof(int) * (bus->n_fds + n_cmsg_fds));
                                 if (!f) {
-                                        close_many((int*) CMSG_DATA(cmsg), n);
+                                        close_many((int*) CMSG_DATA(cmsg), n_cmsg_fds);
                                         return -ENOMEM;
                                 }
 
-                                memcpy(f + bus->n_fds, CMSG_DATA(cmsg), n * sizeof(int));
+                                memcpy(f + bus->n_fds, CMSG_DATA(cmsg), n_cmsg_fds * sizeof(int));
                                 bus->fds = f;
-                                bus->n_fds += n;
+                                bus->n_fds += n_cmsg_fds;
                         } else
                                 log_debug("Got unexpected auxiliary data with level=%d and type=%d",
                                           cmsg->cmsg_level, cmsg->cmsg_type);
         }
 
-        r = bus_socket_read_message_need(bus, &need);
+        r = bus_socket_read_message_need(bus, bus->rbuffer, bus->rbuffer_size, &need);
         if (r < 0)
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
 
         return 1;
 }
@@ -0,0 +1,422 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+#include "bus-kernel.h"
+#include "bus-bloom.h"
+#include "bus-statistics.h"
+
+/* Don't let a client calling random members blow up our memory */
+#define BUS_STATISTICS_MEMBERS_MAX 1024
+
+void bus_histogram_add(struct bus_histogram *h, uint64_t v) {
+        unsigned i;
+
+        assert(h);
+
+        i = v == 0 ? 0 : MIN(64U - (unsigned) __builtin_clzll(v), BUS_HISTOGRAM_BUCKETS - 1U);
+
+        h->n++;
+        h->sum += v;
+        h->max = MAX(h->max, v);
+        h->buckets[i]++;
+}
+
+struct bus_statistics *bus_statistics_new(void) {
+        struct bus_statistics *s;
+
+        s = new0(struct bus_statistics, 1);
+        if (!s)
+                return NULL;
+
+        s->since = now(CLOCK_MONOTONIC);
+
+        return s;
+}
+
+static void bus_member_statistics_free(struct bus_member_statistics *ms) {
+        if (!ms)
+                return;
+
+        free(ms->name);
+        free(ms->slowest_sender);
+        free(ms);
+}
+
+struct bus_statistics *bus_statistics_free(struct bus_statistics *s) {
+        struct bus_member_statistics *ms;
+
+        if (!s)
+                return NULL;
+
+        while ((ms = hashmap_steal_first(s->members)))
+                bus_member_statistics_free(ms);
+
+        hashmap_free(s->members);
+        free(s);
+
+        return NULL;
+}
+
+void bus_statistics_received(sd_bus *bus, sd_bus_message *m) {
+        struct bus_statistics *s;
+
+        assert(bus);
+        assert(m);
+
+        s = bus->statistics;
+        if (!s)
+                return;
+
+        s->n_received++;
+        s->bytes_received += BUS_MESSAGE_SIZE(m);
+        s->rqueue_max = MAX(s->rqueue_max, bus->rqueue_size);
+
+        m->queued = now(CLOCK_MONOTONIC);
+}
+
+void bus_statistics_pool(sd_bus *bus) {
+        struct bus_statistics *s;
+
+        assert(bus);
+
+        s = bus->statistics;
+        if (!s)
+                return;
+
+        s->pool_slices_max = MAX(s->pool_slices_max, bus->n_pool_slices);
+        s->pool_bytes_max = MAX(s->pool_bytes_max, bus->pool_bytes);
+}
+
+void bus_statistics_bloom(sd_bus *bus, unsigned n_elements, const uint64_t *filter) {
+        struct bus_statistics *s;
+
+        assert(bus);
+        assert(filter);
+
+        s = bus->statistics;
+        if (!s)
+                return;
+
+        bus_histogram_add(&s->bloom_elements, n_elements);
+        bus_histogram_add(&s->bloom_fill, (uint64_t) bloom_count_bits(filter, bus->bloom_size) * 100 / (bus->bloom_size * 8));
+}
+
+void bus_statistics_matched(sd_bus *bus, sd_bus_message *m) {
+        struct bus_statistics *s;
+
+        assert(bus);
+        assert(m);
+
+        s = bus->statistics;
+        if (!s)
+                return;
+
+        bus_histogram_add(&s->match_callbacks, s->n_match_callbacks);
+
+        /* Only kdbus filters broadcasts for us, anywhere else we
+         * don't know what was filtered */
+        if (!m->kdbus || m->kdbus->dst_id != KDBUS_DST_ID_BROADCAST || m->header->type != SD_BUS_MESSAGE_SIGNAL)
+                return;
+
+        s->n_broadcasts++;
+        if (s->n_match_callbacks == 0)
+                s->n_broadcasts_unmatched++;
+}
+
+void bus_statistics_dispatched(sd_bus *bus, sd_bus_message *m) {
+        assert(bus);
+        assert(m);
+
+        if (bus->statistics && m->queued > 0)
+                bus_histogram_add(&bus->statistics->rqueue_wait, now(CLOCK_MONOTONIC) - m->queued);
+
+        m->queued = 0;
+}
+
+void bus_statistics_queued(sd_bus *bus, sd_bus_message *m) {
+        struct bus_statistics *s;
+
+        assert(bus);
+        assert(m);
+
+        s = bus->statistics;
+        if (!s)
+                return;
+
+        s->wqueue_max = MAX(s->wqueue_max, bus->wqueue_size);
+
+        m->queued = now(CLOCK_MONOTONIC);
+}
+
+void bus_statistics_sent(sd_bus *bus, sd_bus_message *m) {
+        struct bus_statistics *s;
+
+        assert(bus);
+        assert(m);
+
+        s = bus->statistics;
+        if (!s)
+                return;
+
+        s->n_sent++;
+        s->bytes_sent += BUS_MESSAGE_SIZE(m);
+
+        /* Only messages that actually went through the wqueue have
+         * a timestamp, everything else was written right away. */
+        if (m->queued > 0) {
+                bus_histogram_add(&s->wqueue_wait, now(CLOCK_MONOTONIC) - m->queued);
+                m->queued = 0;
+        }
+}
+
+void bus_statistics_method(sd_bus *bus, sd_bus_message *m, usec_t duration) {
+        struct bus_member_statistics *ms;
+        struct bus_statistics *s;
+        const char *name;
+
+        assert(bus);
+        assert(m);
+
+        s = bus->statistics;
+        if (!s)
+                return;
+
+        if (m->interface)
+                name = strjoina(m->interface, ".", m->member);
+        else
+                name = m->member;
+
+        ms = hashmap_get(s->members, name);
+        if (!ms) {
+                /* Statistics are best effort, if we can't allocate
+                 * the entry we simply don't account this call. */
+                if (hashmap_size(s->members) >= BUS_STATISTICS_MEMBERS_MAX)
+                        return;
+
+                if (hashmap_ensure_allocated(&s->members, &string_hash_ops) < 0)
+                        return;
+
+                ms = new0(struct bus_member_statistics, 1);
+                if (!ms)
+                        return;
+
+                ms->name = strdup(name);
+                if (!ms->name || hashmap_put(s->members, ms->name, ms) < 0) {
+                        bus_member_statistics_free(ms);
+                        return;
+                }
+        }
+
+        if (duration >= ms->latency.max && m->sender) {
+                char *t;
+
+                t = strdup(m->sender);
+                if (t) {
+                        free(ms->slowest_sender);
+                        ms->slowest_sender = t;
+                }
+        }
+
+        bus_histogram_add(&ms->latency, duration);
+}
+
+static int append_histogram(sd_bus_message *reply, const char *name, const struct bus_histogram *h) {
+        int r;
+
+        assert(reply);
+        assert(name);
+        assert(h);
+
+        r = sd_bus_message_open_container(reply, 'e', "sv");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "s", name);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'v', BUS_HISTOGRAM_SIGNATURE);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'r', BUS_HISTOGRAM_CONTENTS);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "ttt", h->n, h->sum, h->max);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append_array(reply, 't', h->buckets, sizeof(h->buckets));
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_close_container(reply);
+}
+
+static int append_methods(sd_bus_message *reply, Hashmap *members) {
+        struct bus_member_statistics *ms;
+        Iterator i;
+        int r;
+
+        assert(reply);
+
+        r = sd_bus_message_open_container(reply, 'e', "sv");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "s", "Methods");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'v', "a(s" BUS_HISTOGRAM_SIGNATURE "s)");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(s" BUS_HISTOGRAM_SIGNATURE "s)");
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH(ms, members, i) {
+                r = sd_bus_message_open_container(reply, 'r', "s" BUS_HISTOGRAM_SIGNATURE "s");
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "s", ms->name);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_open_container(reply, 'r', BUS_HISTOGRAM_CONTENTS);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "ttt", ms->latency.n, ms->latency.sum, ms->latency.max);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append_array(reply, 't', ms->latency.buckets, sizeof(ms->latency.buckets));
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_close_container(reply);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "s", strempty(ms->slowest_sender));
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_close_container(reply);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_close_container(reply);
+}
+
+int bus_statistics_append(sd_bus *bus, sd_bus_message *reply) {
+        struct bus_statistics *s;
+        int r;
+
+        assert(bus);
+        assert(reply);
+
+        s = bus->statistics;
+        if (!s)
+                return -ENODATA;
+
+        r = sd_bus_message_open_container(reply, 'a', "{sv}");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "{sv}{sv}{sv}{sv}{sv}{sv}{sv}",
+                                  "Elapsed", "t", (uint64_t) (now(CLOCK_MONOTONIC) - s->since),
+                                  "MessagesReceived", "t", s->n_received,
+                                  "MessagesSent", "t", s->n_sent,
+                                  "BytesReceived", "t", s->bytes_received,
+                                  "BytesSent", "t", s->bytes_sent,
+                                  "ReadQueueMax", "t", (uint64_t) s->rqueue_max,
+                                  "WriteQueueMax", "t", (uint64_t) s->wqueue_max);
+        if (r < 0)
+                return r;
+
+        if (bus->is_kernel) {
+                r = sd_bus_message_append(reply, "{sv}{sv}{sv}{sv}{sv}{sv}{sv}{sv}{sv}",
+                                          "PoolSize", "t", (uint64_t) KDBUS_POOL_SIZE,
+                                          "PoolSlices", "t", (uint64_t) bus->n_pool_slices,
+                                          "PoolSlicesMax", "t", (uint64_t) s->pool_slices_max,
+                                          "PoolBytes", "t", bus->pool_bytes,
+                                          "PoolBytesMax", "t", s->pool_bytes_max,
+                                          "BloomSize", "t", (uint64_t) bus->bloom_size,
+                                          "BloomHashes", "t", (uint64_t) bus->bloom_n_hash,
+                                          "BroadcastsReceived", "t", s->n_broadcasts,
+                                          "BroadcastsUnmatched", "t", s->n_broadcasts_unmatched);
+                if (r < 0)
+                        return r;
+
+                r = append_histogram(reply, "BloomElements", &s->bloom_elements);
+                if (r < 0)
+                        return r;
+
+                r = append_histogram(reply, "BloomFill", &s->bloom_fill);
+                if (r < 0)
+                        return r;
+        }
+
+        r = append_histogram(reply, "ReadQueueWait", &s->rqueue_wait);
+        if (r < 0)
+                return r;
+
+        r = append_histogram(reply, "WriteQueueWait", &s->wqueue_wait);
+        if (r < 0)
+                return r;
+
+        r = append_histogram(reply, "MatchTime", &s->match_time);
+        if (r < 0)
+                return r;
+
+        r = append_histogram(reply, "MatchCallbacks", &s->match_callbacks);
+        if (r < 0)
+                return r;
+
+        r = append_methods(reply, s->members);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_close_container(reply);
+}
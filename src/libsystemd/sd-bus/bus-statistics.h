@@ -0,0 +1,97 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "sd-bus.h"
+#include "hashmap.h"
+#include "time-util.h"
+
+#define BUS_HISTOGRAM_BUCKETS 24
+
+/* Bucket 0 counts zero samples, bucket i counts samples in
+ * [2^(i-1), 2^i), the last bucket everything bigger than that. */
+struct bus_histogram {
+        uint64_t n;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t buckets[BUS_HISTOGRAM_BUCKETS];
+};
+
+struct bus_member_statistics {
+        char *name;
+        struct bus_histogram latency;
+        char *slowest_sender;
+};
+
+struct bus_statistics {
+        usec_t since;
+
+        uint64_t n_received, n_sent;
+        uint64_t bytes_received, bytes_sent;
+
+        size_t rqueue_max, wqueue_max;
+
+        /* kdbus only, high-watermarks of what we held of the pool */
+        unsigned pool_slices_max;
+        uint64_t pool_bytes_max;
+
+        /* kdbus only, broadcast signals the kernel passed to us, and
+         * of those the ones no match callback wanted after all, which
+         * got through as bloom filter false positives */
+        uint64_t n_broadcasts, n_broadcasts_unmatched;
+
+        /* kdbus only, of the signals we sent the number of elements
+         * added to the bloom filter, and the percentage of its bits
+         * that ended up set */
+        struct bus_histogram bloom_elements;
+        struct bus_histogram bloom_fill;
+
+        /* All times in µs */
+        struct bus_histogram rqueue_wait;
+        struct bus_histogram wqueue_wait;
+        struct bus_histogram match_time;
+
+        /* Number of match callbacks run per message */
+        struct bus_histogram match_callbacks;
+        unsigned n_match_callbacks;
+
+        /* "interface.member" → struct bus_member_statistics */
+        Hashmap *members;
+};
+
+#define BUS_STATISTICS_INTERFACE "org.freedesktop.DBus.Debug.Stats"
+#define BUS_HISTOGRAM_CONTENTS "tttat"
+#define BUS_HISTOGRAM_SIGNATURE "(" BUS_HISTOGRAM_CONTENTS ")"
+
+void bus_histogram_add(struct bus_histogram *h, uint64_t v);
+
+struct bus_statistics *bus_statistics_new(void);
+struct bus_statistics *bus_statistics_free(struct bus_statistics *s);
+
+void bus_statistics_received(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_pool(sd_bus *bus);
+void bus_statistics_bloom(sd_bus *bus, unsigned n_elements, const uint64_t *filter);
+void bus_statistics_matched(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_dispatched(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_queued(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_sent(sd_bus *bus, sd_bus_message *m);
+void bus_statistics_method(sd_bus *bus, sd_bus_message *m, usec_t duration);
+
+int bus_statistics_append(sd_bus *bus, sd_bus_message *reply);
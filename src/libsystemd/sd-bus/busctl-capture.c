@@ -0,0 +1,458 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
+
+#include "util.h"
+#include "time-util.h"
+#include "bus-dump.h"
+#include "busctl-capture.h"
+
+/* The writer waits for this much data to collect, or for this long,
+ * whatever comes first */
+#define CAPTURE_BATCH_MIN (64U*1024U)
+#define CAPTURE_FLUSH_USEC (100*USEC_PER_MSEC)
+
+struct CaptureRing {
+        uint8_t *buffer;
+        size_t size;
+
+        /* Each frame is stored in one piece. If there is no room
+         * left at the end of the buffer, the next one starts at the
+         * beginning again, and the data before it ends at end. Only
+         * the main thread moves head and sets wrapped, only the
+         * writer moves tail and clears it. */
+        size_t head, tail, end;
+        bool wrapped;
+
+        size_t snaplen;
+        uint64_t n_dropped;
+
+        char *path;
+        uint64_t max_file_size;
+        unsigned max_files;
+        unsigned n_file;
+        uint64_t file_size;
+        int fd;
+
+        pthread_t writer;
+        bool writer_running;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        bool stopping;
+        int error;
+};
+
+int capture_ring_new(CaptureRing **ret, size_t size, size_t snaplen, const char *path, uint64_t max_file_size, unsigned max_files) {
+        _cleanup_capture_ring_free_ CaptureRing *r = NULL;
+        pthread_condattr_t attr;
+
+        assert(ret);
+        assert(size > 0);
+        assert(snaplen > 0);
+        assert(path || max_file_size == 0);
+
+        r = new0(CaptureRing, 1);
+        if (!r)
+                return -ENOMEM;
+
+        r->fd = -1;
+        r->size = size;
+        r->snaplen = snaplen;
+        r->max_file_size = max_file_size;
+        r->max_files = max_files;
+
+        r->buffer = malloc(size);
+        if (!r->buffer)
+                return -ENOMEM;
+
+        if (path) {
+                r->path = strdup(path);
+                if (!r->path)
+                        return -ENOMEM;
+        }
+
+        assert_se(pthread_mutex_init(&r->mutex, NULL) == 0);
+
+        assert_se(pthread_condattr_init(&attr) == 0);
+        assert_se(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+        assert_se(pthread_cond_init(&r->cond, &attr) == 0);
+        assert_se(pthread_condattr_destroy(&attr) == 0);
+
+        *ret = r;
+        r = NULL;
+
+        return 0;
+}
+
+CaptureRing *capture_ring_free(CaptureRing *r) {
+        if (!r)
+                return NULL;
+
+        if (r->writer_running)
+                (void) capture_ring_finish(r, NULL);
+
+        if (r->fd != STDOUT_FILENO)
+                safe_close(r->fd);
+
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->mutex);
+
+        free(r->path);
+        free(r->buffer);
+        free(r);
+
+        return NULL;
+}
+
+static size_t capture_ring_used(CaptureRing *r) {
+        return r->wrapped ? r->end - r->tail + r->head : r->head - r->tail;
+}
+
+static int capture_ring_open(CaptureRing *r) {
+        uint8_t header[sizeof(pcap_hdr_t)];
+        _cleanup_free_ char *p = NULL;
+        int fd, k;
+
+        bus_pcap_header_to_buffer(r->snaplen, header);
+
+        if (!r->path) {
+                r->fd = STDOUT_FILENO;
+                r->file_size = sizeof(header);
+
+                return loop_write(r->fd, header, sizeof(header), false);
+        }
+
+        if (r->n_file > 0 && asprintf(&p, "%s.%u", r->path, r->n_file) < 0)
+                return -ENOMEM;
+
+        /* Captures may contain anything that went over the bus,
+         * passwords included */
+        fd = open(p ?: r->path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NOCTTY, 0600);
+        if (fd < 0)
+                return -errno;
+
+        k = loop_write(fd, header, sizeof(header), false);
+        if (k < 0) {
+                safe_close(fd);
+                return k;
+        }
+
+        safe_close(r->fd);
+        r->fd = fd;
+        r->file_size = sizeof(header);
+
+        /* Keep only the most recent files */
+        if (r->max_files > 0 && r->n_file >= r->max_files) {
+                unsigned old = r->n_file - r->max_files;
+
+                free(p);
+                p = NULL;
+
+                if (old > 0 && asprintf(&p, "%s.%u", r->path, old) < 0)
+                        return -ENOMEM;
+
+                (void) unlink(p ?: r->path);
+        }
+
+        return 0;
+}
+
+static int writev_all(int fd, struct iovec *iov, unsigned n) {
+
+        while (n > 0) {
+                ssize_t k;
+
+                k = writev(fd, iov, n);
+                if (k < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -errno;
+                }
+
+                /* Skip what was written, the rest again */
+                while (n > 0 && (size_t) k >= iov->iov_len) {
+                        k -= iov->iov_len;
+                        iov++;
+                        n--;
+                }
+
+                if (n > 0) {
+                        iov->iov_base = (uint8_t*) iov->iov_base + k;
+                        iov->iov_len -= k;
+                }
+        }
+
+        return 0;
+}
+
+static int capture_ring_write(CaptureRing *r, const struct iovec segments[2]) {
+        size_t total, pos = 0;
+
+        total = segments[0].iov_len + segments[1].iov_len;
+
+        while (pos < total) {
+                struct iovec iov[2];
+                unsigned n = 0;
+                size_t stop;
+                bool full = false;
+                int k;
+
+                /* Frames never span the two segments, so a new file
+                 * can be started between any two of them */
+                if (r->max_file_size == 0)
+                        stop = total;
+                else
+                        for (stop = pos; stop < total; ) {
+                                const pcaprec_hdr_t *h;
+                                size_t l;
+
+                                if (stop < segments[0].iov_len)
+                                        h = (const pcaprec_hdr_t*) ((uint8_t*) segments[0].iov_base + stop);
+                                else
+                                        h = (const pcaprec_hdr_t*) ((uint8_t*) segments[1].iov_base + stop - segments[0].iov_len);
+
+                                l = sizeof(pcaprec_hdr_t) + h->incl_len;
+
+                                /* Every file gets at least one frame */
+                                if (r->file_size + (stop - pos) + l > r->max_file_size &&
+                                    r->file_size + (stop - pos) > sizeof(pcap_hdr_t)) {
+                                        full = true;
+                                        break;
+                                }
+
+                                stop += l;
+                        }
+
+                if (pos < segments[0].iov_len) {
+                        iov[n].iov_base = (uint8_t*) segments[0].iov_base + pos;
+                        iov[n].iov_len = MIN(stop, segments[0].iov_len) - pos;
+                        n++;
+                }
+
+                if (stop > segments[0].iov_len) {
+                        size_t b = MAX(pos, segments[0].iov_len) - segments[0].iov_len;
+
+                        iov[n].iov_base = (uint8_t*) segments[1].iov_base + b;
+                        iov[n].iov_len = stop - segments[0].iov_len - b;
+                        n++;
+                }
+
+                k = writev_all(r->fd, iov, n);
+                if (k < 0)
+                        return k;
+
+                r->file_size += stop - pos;
+                pos = stop;
+
+                if (full) {
+                        r->n_file++;
+
+                        k = capture_ring_open(r);
+                        if (k < 0)
+                                return k;
+                }
+        }
+
+        return 0;
+}
+
+static void *capture_ring_writer(void *p) {
+        CaptureRing *r = p;
+        sigset_t fullset;
+
+        /* No signals in this thread please, they are for the main
+         * thread to finish the capture */
+        assert_se(sigfillset(&fullset) == 0);
+        assert_se(pthread_sigmask(SIG_BLOCK, &fullset, NULL) == 0);
+
+        prctl(PR_SET_NAME, (unsigned long) "busctl-capture");
+
+        assert_se(pthread_mutex_lock(&r->mutex) == 0);
+
+        for (;;) {
+                struct iovec segments[2] = {};
+                size_t done;
+                int k;
+
+                /* Wait for enough data to make the write worth it */
+                while (!r->stopping && capture_ring_used(r) < CAPTURE_BATCH_MIN) {
+                        struct timespec ts;
+
+                        if (capture_ring_used(r) == 0) {
+                                assert_se(pthread_cond_wait(&r->cond, &r->mutex) == 0);
+                                continue;
+                        }
+
+                        timespec_store(&ts, now(CLOCK_MONOTONIC) + CAPTURE_FLUSH_USEC);
+                        if (pthread_cond_timedwait(&r->cond, &r->mutex, &ts) == ETIMEDOUT)
+                                break;
+                }
+
+                if (capture_ring_used(r) == 0) {
+                        if (r->stopping)
+                                break;
+
+                        continue;
+                }
+
+                segments[0].iov_base = r->buffer + r->tail;
+                segments[0].iov_len = (r->wrapped ? r->end : r->head) - r->tail;
+                if (r->wrapped) {
+                        segments[1].iov_base = r->buffer;
+                        segments[1].iov_len = r->head;
+                }
+
+                /* The main thread keeps adding frames meanwhile, but
+                 * won't touch the part we write */
+                assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+                k = capture_ring_write(r, segments);
+                assert_se(pthread_mutex_lock(&r->mutex) == 0);
+
+                if (k < 0) {
+                        r->error = k;
+                        break;
+                }
+
+                done = segments[0].iov_len;
+                r->tail += done;
+
+                if (r->wrapped && r->tail == r->end) {
+                        r->tail = segments[1].iov_len;
+                        r->wrapped = false;
+                }
+        }
+
+        assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+
+        return NULL;
+}
+
+int capture_ring_start(CaptureRing *r) {
+        int k;
+
+        assert(r);
+        assert(!r->writer_running);
+
+        k = capture_ring_open(r);
+        if (k < 0)
+                return k;
+
+        k = pthread_create(&r->writer, NULL, capture_ring_writer, r);
+        if (k != 0)
+                return -k;
+
+        r->writer_running = true;
+        return 0;
+}
+
+int capture_ring_put(CaptureRing *r, sd_bus_message *m) {
+        size_t l, pos, used;
+        bool wrap = false;
+        int k;
+
+        assert(r);
+        assert(m);
+        assert(r->writer_running);
+
+        l = bus_message_pcap_frame_size(m, r->snaplen);
+
+        assert_se(pthread_mutex_lock(&r->mutex) == 0);
+
+        k = r->error;
+        if (k < 0)
+                goto finish;
+
+        /* Start over at the beginning when everything is written */
+        if (!r->wrapped && r->tail == r->head)
+                r->head = r->tail = 0;
+
+        /* Never block, rather lose the message, which is what would
+         * happen to a client that doesn't read in time too. */
+        if (!r->wrapped && r->size - r->head >= l)
+                pos = r->head;
+        else if (!r->wrapped && r->tail > l) {
+                pos = 0;
+                wrap = true;
+        } else if (r->wrapped && r->tail - r->head > l)
+                pos = r->head;
+        else {
+                r->n_dropped++;
+                k = 0;
+                goto finish;
+        }
+
+        /* The writer doesn't look at unused parts, hence the copy
+         * can be made without holding the lock */
+        assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+        bus_message_pcap_frame_to_buffer(m, r->snaplen, r->buffer + pos);
+        assert_se(pthread_mutex_lock(&r->mutex) == 0);
+
+        used = capture_ring_used(r);
+
+        if (wrap) {
+                r->end = r->head;
+                r->wrapped = true;
+                r->head = l;
+        } else
+                r->head += l;
+
+        /* Wake the writer when there is a reason to */
+        if (used == 0 || (used < CAPTURE_BATCH_MIN && used + l >= CAPTURE_BATCH_MIN))
+                assert_se(pthread_cond_signal(&r->cond) == 0);
+
+        k = 0;
+
+finish:
+        assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+        return k;
+}
+
+int capture_ring_finish(CaptureRing *r, uint64_t *ret_dropped) {
+        int k;
+
+        assert(r);
+
+        if (r->writer_running) {
+                assert_se(pthread_mutex_lock(&r->mutex) == 0);
+                r->stopping = true;
+                assert_se(pthread_cond_signal(&r->cond) == 0);
+                assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+
+                assert_se(pthread_join(r->writer, NULL) == 0);
+                r->writer_running = false;
+        }
+
+        k = r->error;
+
+        if (r->fd >= 0 && r->fd != STDOUT_FILENO && close(r->fd) < 0 && k >= 0)
+                k = -errno;
+        r->fd = -1;
+
+        if (ret_dropped)
+                *ret_dropped = r->n_dropped;
+
+        return k;
+}
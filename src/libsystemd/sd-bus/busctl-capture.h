@@ -0,0 +1,41 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include "sd-bus.h"
+#include "macro.h"
+
+typedef struct CaptureRing CaptureRing;
+
+/* If path is NULL the capture goes to stdout, otherwise to path. If
+ * max_file_size is non-zero a new file is started when the current
+ * one would grow bigger, named path.1, path.2, and so on, and of those
+ * the newest max_files are kept, all of them if it is zero. */
+int capture_ring_new(CaptureRing **ret, size_t size, size_t snaplen, const char *path, uint64_t max_file_size, unsigned max_files);
+CaptureRing *capture_ring_free(CaptureRing *r);
+
+int capture_ring_start(CaptureRing *r);
+int capture_ring_put(CaptureRing *r, sd_bus_message *m);
+int capture_ring_finish(CaptureRing *r, uint64_t *ret_dropped);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(CaptureRing*, capture_ring_free);
+#define _cleanup_capture_ring_free_ _cleanup_(capture_ring_freep)
@@ -20,6 +20,8 @@
 ***/
 
 #include <getopt.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 
 #include "strv.h"
 #include "util.h"
@@ -28,6 +30,7 @@
 #include "pager.h"
 #include "path-util.h"
 #include "set.h"
+#include "signal-util.h"
 
 #include "sd-bus.h"
 #include "bus-internal.h"
@@ -35,7 +38,10 @@
 #include "bus-dump.h"
 #include "bus-signature.h"
 #include "bus-type.h"
+#include "bus-statistics.h"
+#include "bus-bloom.h"
 #include "busctl-introspect.h"
+#include "busctl-capture.h"
 #include "terminal-util.h"
 
 static bool arg_no_pager = false;
@@ -50,6 +56,10 @@ static BusTransport arg_transport = BUS_TRANSPORT_LOCAL;
 static char *arg_host = NULL;
 static bool arg_user = false;
 static size_t arg_snaplen = 4096;
+static size_t arg_capture_buffer = 16 * 1024 * 1024;
+static const char *arg_capture_file = NULL;
+static uint64_t arg_capture_file_size = 0;
+static unsigned arg_capture_files = 0;
 static bool arg_list = false;
 static bool arg_quiet = false;
 static bool arg_verbose = false;
@@ -1075,7 +1085,7 @@ static int message_pcap(sd_bus_message *m, FILE *f) {
         return bus_message_pcap_frame(m, arg_snaplen, f);
 }
 
-static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FILE *f)) {
+static int add_matches(sd_bus *bus, char *argv[], sd_bus_message_handler_t callback, void *userdata) {
         bool added_something = false;
         char **i;
         int r;
@@ -1092,7 +1102,7 @@ static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FIL
                 if (!m)
                         return log_oom();
 
-                r = sd_bus_add_match(bus, NULL, m, NULL, NULL);
+                r = sd_bus_add_match(bus, NULL, m, callback, userdata);
                 if (r < 0)
                         return log_error_errno(r, "Failed to add match: %m");
 
@@ -1100,7 +1110,7 @@ static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FIL
         }
 
         STRV_FOREACH(i, arg_matches) {
-                r = sd_bus_add_match(bus, NULL, *i, NULL, NULL);
+                r = sd_bus_add_match(bus, NULL, *i, callback, userdata);
                 if (r < 0)
                         return log_error_errno(r, "Failed to add match: %m");
 
@@ -1113,6 +1123,16 @@ static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FIL
                         return log_error_errno(r, "Failed to add match: %m");
         }
 
+        return added_something;
+}
+
+static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FILE *f)) {
+        int r;
+
+        r = add_matches(bus, argv, NULL, NULL);
+        if (r < 0)
+                return r;
+
         log_info("Monitoring bus message stream.");
 
         for (;;) {
@@ -1143,26 +1163,146 @@ static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FIL
         }
 }
 
-static int capture(sd_bus *bus, char *argv[]) {
-        int r;
+static int capture_select(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        sd_bus_message **selected = userdata;
+
+        /* The match rules are checked before the message is handed
+         * out, remember that this is one to keep */
+        *selected = m;
+        return 0;
+}
+
+static int capture_wait(sd_bus *bus, int signal_fd) {
+        struct pollfd p[3] = {};
+        struct timespec ts;
+        usec_t until, m = USEC_INFINITY;
+        int r, e, n;
+
+        if (bus->state == BUS_CLOSING)
+                return 0;
+
+        e = sd_bus_get_events(bus);
+        if (e < 0)
+                return e;
+
+        r = sd_bus_get_timeout(bus, &until);
+        if (r < 0)
+                return r;
+        if (r > 0 && until != USEC_INFINITY) {
+                usec_t nw;
+
+                nw = now(CLOCK_MONOTONIC);
+                m = until > nw ? until - nw : 0;
+        }
+
+        p[0].fd = signal_fd;
+        p[0].events = POLLIN;
+
+        p[1].fd = bus->input_fd;
+        if (bus->output_fd == bus->input_fd) {
+                p[1].events = e;
+                n = 2;
+        } else {
+                p[1].events = e & POLLIN;
+                p[2].fd = bus->output_fd;
+                p[2].events = e & POLLOUT;
+                n = 3;
+        }
+
+        r = ppoll(p, n, m == USEC_INFINITY ? NULL : timespec_store(&ts, m), NULL);
+        if (r < 0)
+                return errno == EINTR ? 0 : -errno;
+
+        return p[0].revents != 0;
+}
 
-        if (isatty(fileno(stdout)) > 0) {
+static int capture(sd_bus *bus, char *argv[]) {
+        _cleanup_capture_ring_free_ CaptureRing *ring = NULL;
+        _cleanup_close_ int signal_fd = -1;
+        sd_bus_message *selected = NULL;
+        uint64_t n_dropped;
+        sigset_t mask;
+        bool all;
+        int r, k;
+
+        if (!arg_capture_file && isatty(fileno(stdout)) > 0) {
                 log_error("Refusing to write message data to console, please redirect output to a file.");
                 return -EINVAL;
         }
 
-        bus_pcap_header(arg_snaplen, stdout);
-
-        r = monitor(bus, argv, message_pcap);
+        /* Without any rules everything is captured, otherwise only
+         * what matches one of them */
+        r = add_matches(bus, argv, capture_select, &selected);
         if (r < 0)
                 return r;
+        all = r == 0;
+
+        /* Write out what is still buffered when interrupted */
+        assert_se(sigemptyset(&mask) == 0);
+        sigset_add_many(&mask, SIGINT, SIGTERM, -1);
+        assert_se(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
+
+        signal_fd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+        if (signal_fd < 0)
+                return log_error_errno(errno, "Failed to allocate signal fd: %m");
+
+        r = capture_ring_new(&ring, arg_capture_buffer, arg_snaplen, arg_capture_file, arg_capture_file_size, arg_capture_files);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate capture buffer: %m");
+
+        r = capture_ring_start(ring);
+        if (r < 0)
+                return log_error_errno(r, "Failed to start capture: %m");
+
+        log_info("Capturing bus message stream.");
+
+        for (;;) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                r = sd_bus_process(bus, &m);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to process bus: %m");
+                        break;
+                }
+
+                if (m) {
+                        if ((all || selected == m) && capture_ring_put(ring, m) < 0)
+                                break;
+
+                        selected = NULL;
+
+                        if (sd_bus_message_is_signal(m, "org.freedesktop.DBus.Local", "Disconnected") > 0) {
+                                log_info("Connection terminated, exiting.");
+                                break;
+                        }
+
+                        continue;
+                }
 
-        if (ferror(stdout)) {
-                log_error("Couldn't write capture file.");
-                return -EIO;
+                selected = NULL;
+
+                if (r > 0)
+                        continue;
+
+                r = capture_wait(bus, signal_fd);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to wait for bus: %m");
+                        break;
+                }
+                if (r > 0) {
+                        r = 0;
+                        break;
+                }
         }
 
-        return r;
+        k = capture_ring_finish(ring, &n_dropped);
+        if (k < 0 && r >= 0)
+                r = log_error_errno(k, "Couldn't write capture file: %m");
+
+        if (n_dropped > 0)
+                log_warning("Lost %" PRIu64 " messages, the capture buffer was full.", n_dropped);
+
+        return r < 0 ? r : 0;
 }
 
 static int status(sd_bus *bus, char *argv[]) {
@@ -1667,6 +1807,365 @@ static int set_property(sd_bus *bus, char *argv[]) {
         return 0;
 }
 
+struct method_stats {
+        const char *name;
+        struct bus_histogram latency;
+        const char *slowest_sender;
+};
+
+static int method_stats_compare(const void *a, const void *b) {
+        const struct method_stats *x = a, *y = b;
+
+        /* Most expensive first */
+        if (x->latency.sum > y->latency.sum)
+                return -1;
+        if (x->latency.sum < y->latency.sum)
+                return 1;
+
+        return strcmp(x->name, y->name);
+}
+
+static int read_histogram(sd_bus_message *m, struct bus_histogram *h) {
+        const void *buckets;
+        size_t sz;
+        int r;
+
+        assert(m);
+        assert(h);
+
+        r = sd_bus_message_enter_container(m, 'r', BUS_HISTOGRAM_CONTENTS);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read(m, "ttt", &h->n, &h->sum, &h->max);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_array(m, 't', &buckets, &sz);
+        if (r < 0)
+                return r;
+
+        memzero(h->buckets, sizeof(h->buckets));
+        memcpy(h->buckets, buckets, MIN(sz, sizeof(h->buckets)));
+
+        return sd_bus_message_exit_container(m);
+}
+
+static uint64_t histogram_percentile(const struct bus_histogram *h, unsigned percent) {
+        uint64_t seen = 0;
+        unsigned i;
+
+        assert(h);
+
+        /* Returns the upper bound of the bucket the percentile falls in */
+        for (i = 0; i < BUS_HISTOGRAM_BUCKETS; i++) {
+                seen += h->buckets[i];
+                if (seen * 100 >= h->n * percent)
+                        return i == 0 ? 0 : MIN(UINT64_C(1) << i, h->max);
+        }
+
+        return h->max;
+}
+
+static void print_histogram(const char *title, const struct bus_histogram *h, bool timespan) {
+        char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX], c[FORMAT_TIMESPAN_MAX];
+        uint64_t avg;
+
+        assert(title);
+        assert(h);
+
+        if (h->n == 0) {
+                printf("%s: -\n", title);
+                return;
+        }
+
+        avg = h->sum / h->n;
+
+        if (timespan)
+                printf("%s: %" PRIu64 " samples, avg %s, p99 <%s, max %s\n", title, h->n,
+                       format_timespan(a, sizeof(a), avg, 1),
+                       format_timespan(b, sizeof(b), histogram_percentile(h, 99), 1),
+                       format_timespan(c, sizeof(c), h->max, 1));
+        else
+                printf("%s: %" PRIu64 " samples, avg %" PRIu64 ", p99 <%" PRIu64 ", max %" PRIu64 "\n", title, h->n,
+                       avg, histogram_percentile(h, 99), h->max);
+}
+
+static void print_bloom(
+                uint64_t size,
+                uint64_t n_hash,
+                uint64_t n_broadcasts,
+                uint64_t n_unmatched,
+                const struct bus_histogram *elements,
+                const struct bus_histogram *fill) {
+
+        unsigned n, k;
+        size_t s;
+
+        assert(elements);
+        assert(fill);
+
+        if (size == 0 || n_hash == 0)
+                return;
+
+        printf("Bloom filter: %" PRIu64 " bytes, %" PRIu64 " hash functions\n", size, n_hash);
+        printf("Broadcasts received: %" PRIu64 ", of those matched nothing: %" PRIu64 " (%.1f%%)\n",
+               n_broadcasts, n_unmatched,
+               n_broadcasts > 0 ? (double) n_unmatched * 100.0 / n_broadcasts : 0.0);
+        print_histogram("Bloom elements per signal sent", elements, false);
+        print_histogram("Bloom bits set per signal sent (%)", fill, false);
+
+        if (elements->n == 0 || !bloom_validate_parameters(size, n_hash))
+                return;
+
+        /* What a match is up against for nearly all the signals we
+         * send, and what would do better against that */
+        n = (unsigned) MIN(histogram_percentile(elements, 99), (uint64_t) UINT_MAX);
+
+        printf("Expected false positive rate at p99: %.2f%%\n",
+               bloom_false_positive_rate(size, n_hash, n) * 100.0);
+
+        if (bloom_pick_parameters(n, 0.01, &s, &k) >= 0)
+                printf("Parameters for at most 1%% at p99: KDBusBloomSize=%zu KDBusBloomHashes=%u (%.2f%%)\n",
+                       s, k, bloom_false_positive_rate(s, k, n) * 100.0);
+        else
+                printf("No parameters for at most 1%% at p99.\n");
+}
+
+static int read_methods(sd_bus_message *m, struct method_stats **ret, size_t *ret_n) {
+        _cleanup_free_ struct method_stats *methods = NULL;
+        size_t n = 0, allocated = 0;
+        int r;
+
+        assert(m);
+        assert(ret);
+        assert(ret_n);
+
+        r = sd_bus_message_enter_container(m, 'a', "(s" BUS_HISTOGRAM_SIGNATURE "s)");
+        if (r < 0)
+                return r;
+
+        while ((r = sd_bus_message_enter_container(m, 'r', "s" BUS_HISTOGRAM_SIGNATURE "s")) > 0) {
+                if (!GREEDY_REALLOC(methods, allocated, n + 1))
+                        return -ENOMEM;
+
+                r = sd_bus_message_read(m, "s", &methods[n].name);
+                if (r < 0)
+                        return r;
+
+                r = read_histogram(m, &methods[n].latency);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_read(m, "s", &methods[n].slowest_sender);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_exit_container(m);
+                if (r < 0)
+                        return r;
+
+                n++;
+        }
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_exit_container(m);
+        if (r < 0)
+                return r;
+
+        *ret = methods;
+        *ret_n = n;
+        methods = NULL;
+
+        return 0;
+}
+
+static int stats(sd_bus *bus, char *argv[]) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_free_ struct method_stats *methods = NULL;
+        struct bus_histogram rqueue_wait = {}, wqueue_wait = {}, match_time = {}, match_callbacks = {};
+        uint64_t elapsed = 0, n_received = 0, n_sent = 0, bytes_received = 0, bytes_sent = 0, rqueue_max = 0, wqueue_max = 0;
+        uint64_t pool_size = 0, pool_slices = 0, pool_slices_max = 0, pool_bytes = 0, pool_bytes_max = 0;
+        uint64_t bloom_size = 0, bloom_n_hash = 0, n_broadcasts = 0, n_unmatched = 0;
+        struct bus_histogram bloom_elements = {}, bloom_fill = {};
+        char ts[FORMAT_TIMESPAN_MAX], b1[FORMAT_BYTES_MAX], b2[FORMAT_BYTES_MAX];
+        size_t n_methods = 0, k;
+        double seconds;
+        unsigned n;
+        int r;
+
+        assert(bus);
+
+        n = strv_length(argv);
+        if (n < 2 || n > 3) {
+                log_error("Expects one or two arguments.");
+                return -EINVAL;
+        }
+
+        r = sd_bus_call_method(bus, argv[1], argv[2] ?: "/", BUS_STATISTICS_INTERFACE, "GetStats", &error, &reply, "");
+        if (r < 0) {
+                log_error("Failed to get statistics: %s", bus_error_message(&error, r));
+                return r;
+        }
+
+        if (arg_verbose) {
+                pager_open_if_enabled();
+                return bus_message_dump(reply, stdout, 0);
+        }
+
+        r = sd_bus_message_enter_container(reply, 'a', "{sv}");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        while ((r = sd_bus_message_enter_container(reply, 'e', "sv")) > 0) {
+                const char *name, *contents;
+                uint64_t *u = NULL;
+                struct bus_histogram *h = NULL;
+
+                r = sd_bus_message_read(reply, "s", &name);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                r = sd_bus_message_peek_type(reply, NULL, &contents);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                if (streq(name, "Elapsed"))
+                        u = &elapsed;
+                else if (streq(name, "MessagesReceived"))
+                        u = &n_received;
+                else if (streq(name, "MessagesSent"))
+                        u = &n_sent;
+                else if (streq(name, "BytesReceived"))
+                        u = &bytes_received;
+                else if (streq(name, "BytesSent"))
+                        u = &bytes_sent;
+                else if (streq(name, "ReadQueueMax"))
+                        u = &rqueue_max;
+                else if (streq(name, "WriteQueueMax"))
+                        u = &wqueue_max;
+                else if (streq(name, "PoolSize"))
+                        u = &pool_size;
+                else if (streq(name, "PoolSlices"))
+                        u = &pool_slices;
+                else if (streq(name, "PoolSlicesMax"))
+                        u = &pool_slices_max;
+                else if (streq(name, "PoolBytes"))
+                        u = &pool_bytes;
+                else if (streq(name, "PoolBytesMax"))
+                        u = &pool_bytes_max;
+                else if (streq(name, "BloomSize"))
+                        u = &bloom_size;
+                else if (streq(name, "BloomHashes"))
+                        u = &bloom_n_hash;
+                else if (streq(name, "BroadcastsReceived"))
+                        u = &n_broadcasts;
+                else if (streq(name, "BroadcastsUnmatched"))
+                        u = &n_unmatched;
+                else if (streq(name, "ReadQueueWait"))
+                        h = &rqueue_wait;
+                else if (streq(name, "WriteQueueWait"))
+                        h = &wqueue_wait;
+                else if (streq(name, "MatchTime"))
+                        h = &match_time;
+                else if (streq(name, "MatchCallbacks"))
+                        h = &match_callbacks;
+                else if (streq(name, "BloomElements"))
+                        h = &bloom_elements;
+                else if (streq(name, "BloomFill"))
+                        h = &bloom_fill;
+
+                if (u && streq(contents, "t"))
+                        r = sd_bus_message_read(reply, "v", "t", u);
+                else if (h && streq(contents, BUS_HISTOGRAM_SIGNATURE)) {
+                        r = sd_bus_message_enter_container(reply, 'v', contents);
+                        if (r >= 0)
+                                r = read_histogram(reply, h);
+                        if (r >= 0)
+                                r = sd_bus_message_exit_container(reply);
+                } else if (streq(name, "Methods") && streq(contents, "a(s" BUS_HISTOGRAM_SIGNATURE "s)")) {
+                        methods = mfree(methods);
+
+                        r = sd_bus_message_enter_container(reply, 'v', contents);
+                        if (r >= 0)
+                                r = read_methods(reply, &methods, &n_methods);
+                        if (r >= 0)
+                                r = sd_bus_message_exit_container(reply);
+                } else
+                        /* Ignore what we don't know, for compatibility */
+                        r = sd_bus_message_skip(reply, "v");
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                r = sd_bus_message_exit_container(reply);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+        }
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        r = sd_bus_message_exit_container(reply);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        pager_open_if_enabled();
+
+        seconds = MAX((double) elapsed / USEC_PER_SEC, 1.0);
+
+        printf("Collecting for: %s\n", format_timespan(ts, sizeof(ts), elapsed, USEC_PER_SEC));
+        printf("Received: %" PRIu64 " messages (%.1f/s), %s (%s/s)\n",
+               n_received, n_received / seconds,
+               format_bytes(b1, sizeof(b1), bytes_received),
+               format_bytes(b2, sizeof(b2), (uint64_t) (bytes_received / seconds)));
+        printf("Sent: %" PRIu64 " messages (%.1f/s), %s (%s/s)\n",
+               n_sent, n_sent / seconds,
+               format_bytes(b1, sizeof(b1), bytes_sent),
+               format_bytes(b2, sizeof(b2), (uint64_t) (bytes_sent / seconds)));
+        printf("Read queue high-watermark: %" PRIu64 "\n", rqueue_max);
+        printf("Write queue high-watermark: %" PRIu64 "\n", wqueue_max);
+        if (pool_size > 0) {
+                char b3[FORMAT_BYTES_MAX];
+
+                printf("Pool in use: %" PRIu64 " slices, %s of %s\n",
+                       pool_slices,
+                       format_bytes(b1, sizeof(b1), pool_bytes),
+                       format_bytes(b3, sizeof(b3), pool_size));
+                printf("Pool high-watermark: %" PRIu64 " slices, %s\n",
+                       pool_slices_max,
+                       format_bytes(b2, sizeof(b2), pool_bytes_max));
+        }
+        print_histogram("Read queue wait", &rqueue_wait, true);
+        print_histogram("Write queue wait", &wqueue_wait, true);
+        print_histogram("Match time", &match_time, true);
+        print_histogram("Match callbacks", &match_callbacks, false);
+        print_bloom(bloom_size, bloom_n_hash, n_broadcasts, n_unmatched, &bloom_elements, &bloom_fill);
+
+        if (n_methods == 0)
+                return 0;
+
+        qsort(methods, n_methods, sizeof(struct method_stats), method_stats_compare);
+
+        if (arg_legend)
+                printf("\n%-60s %10s %10s %10s %10s %s\n", "METHOD", "CALLS", "AVG", "P99", "MAX", "SLOWEST-CALLER");
+
+        for (k = 0; k < n_methods; k++) {
+                char a[FORMAT_TIMESPAN_MAX], p[FORMAT_TIMESPAN_MAX], m[FORMAT_TIMESPAN_MAX];
+                const struct bus_histogram *h = &methods[k].latency;
+
+                printf("%-60s %10" PRIu64 " %10s %10s %10s %s\n",
+                       methods[k].name,
+                       h->n,
+                       format_timespan(a, sizeof(a), h->n > 0 ? h->sum / h->n : 0, 1),
+                       format_timespan(p, sizeof(p), histogram_percentile(h, 99), 1),
+                       format_timespan(m, sizeof(m), h->max, 1),
+                       isempty(methods[k].slowest_sender) ? "-" : methods[k].slowest_sender);
+        }
+
+        return 0;
+}
+
 static int help(void) {
         printf("%s [OPTIONS...] {COMMAND} ...\n\n"
                "Introspect the bus.\n\n"
@@ -1685,6 +2184,12 @@ static int help(void) {
                "     --activatable        Only show activatable names\n"
                "     --match=MATCH        Only show matching messages\n"
                "     --size=SIZE          Maximum length of captured packet\n"
+               "     --capture-buffer=SIZE\n"
+               "                          Buffer captured packets in memory up to SIZE\n"
+               "     --capture-file=PATH  Write capture to PATH instead of stdout\n"
+               "     --capture-file-size=SIZE\n"
+               "                          Start a new capture file when SIZE is reached\n"
+               "     --capture-files=N    Keep only the N most recent capture files\n"
                "     --list               Don't show tree, but simple object path list\n"
                "     --quiet              Don't show method call reply\n"
                "     --verbose            Show result values in long format\n"
@@ -1707,6 +2212,7 @@ static int help(void) {
                "                          Get property value\n"
                "  set-property SERVICE OBJECT INTERFACE PROPERTY SIGNATURE ARGUMENT...\n"
                "                          Set property value\n"
+               "  stats SERVICE [OBJECT]  Show bus connection statistics of service\n"
                "  help                    Show this help\n"
                , program_invocation_short_name);
 
@@ -1735,6 +2241,10 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_ALLOW_INTERACTIVE_AUTHORIZATION,
                 ARG_TIMEOUT,
                 ARG_AUGMENT_CREDS,
+                ARG_CAPTURE_BUFFER,
+                ARG_CAPTURE_FILE,
+                ARG_CAPTURE_FILE_SIZE,
+                ARG_CAPTURE_FILES,
         };
 
         static const struct option options[] = {
@@ -1761,6 +2271,10 @@ static int parse_argv(int argc, char *argv[]) {
                 { "allow-interactive-authorization", required_argument, NULL, ARG_ALLOW_INTERACTIVE_AUTHORIZATION },
                 { "timeout",      required_argument, NULL, ARG_TIMEOUT      },
                 { "augment-creds",required_argument, NULL, ARG_AUGMENT_CREDS},
+                { "capture-buffer",    required_argument, NULL, ARG_CAPTURE_BUFFER    },
+                { "capture-file",      required_argument, NULL, ARG_CAPTURE_FILE      },
+                { "capture-file-size", required_argument, NULL, ARG_CAPTURE_FILE_SIZE },
+                { "capture-files",     required_argument, NULL, ARG_CAPTURE_FILES     },
                 {},
         };
 
@@ -1913,6 +2427,44 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_augment_creds = !!r;
                         break;
 
+                case ARG_CAPTURE_BUFFER: {
+                        uint64_t sz;
+
+                        r = parse_size(optarg, 1024, &sz);
+                        if (r < 0 || sz == 0) {
+                                log_error("Failed to parse --capture-buffer= parameter.");
+                                return r < 0 ? r : -EINVAL;
+                        }
+
+                        if ((uint64_t) (size_t) sz != sz) {
+                                log_error("Size out of range.");
+                                return -E2BIG;
+                        }
+
+                        arg_capture_buffer = (size_t) sz;
+                        break;
+                }
+
+                case ARG_CAPTURE_FILE:
+                        arg_capture_file = optarg;
+                        break;
+
+                case ARG_CAPTURE_FILE_SIZE:
+                        r = parse_size(optarg, 1024, &arg_capture_file_size);
+                        if (r < 0) {
+                                log_error("Failed to parse --capture-file-size= parameter.");
+                                return r;
+                        }
+                        break;
+
+                case ARG_CAPTURE_FILES:
+                        r = safe_atou(optarg, &arg_capture_files);
+                        if (r < 0) {
+                                log_error("Failed to parse --capture-files= parameter.");
+                                return r;
+                        }
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -1920,6 +2472,11 @@ static int parse_argv(int argc, char *argv[]) {
                         assert_not_reached("Unhandled option");
                 }
 
+        if ((arg_capture_file_size > 0 || arg_capture_files > 0) && !arg_capture_file) {
+                log_error("--capture-file-size= and --capture-files= require --capture-file=.");
+                return -EINVAL;
+        }
+
         return 1;
 }
 
@@ -1954,6 +2511,9 @@ static int busctl_main(sd_bus *bus, int argc, char *argv[]) {
         if (streq(argv[optind], "set-property"))
                 return set_property(bus, argv + optind);
 
+        if (streq(argv[optind], "stats"))
+                return stats(bus, argv + optind);
+
         if (streq(argv[optind], "help"))
                 return help();
 
@@ -49,6 +49,7 @@
 #include "bus-protocol.h"
 #include "bus-track.h"
 #include "bus-slot.h"
+#include "bus-statistics.h"
 
 #define log_debug_bus_message(m)                                         \
         do {                                                             \
@@ -154,6 +155,12 @@ static void bus_free(sd_bus *b) {
         hashmap_free_free(b->vtable_methods);
         hashmap_free_free(b->vtable_properties);
 
+        bus_properties_cache_flush(b);
+        hashmap_free(b->properties_cache);
+        bus_creds_cache_flush(b);
+        hashmap_free(b->creds_cache);
+        bus_statistics_free(b->statistics);
+
         assert(hashmap_isempty(b->nodes));
         hashmap_free(b->nodes);
 
@@ -161,6 +168,9 @@ static void bus_free(sd_bus *b) {
 
         assert_se(pthread_mutex_destroy(&b->memfd_cache_mutex) == 0);
 
+        bus_message_pools_done(b);
+        assert_se(pthread_mutex_destroy(&b->pools_mutex) == 0);
+
         free(b);
 }
 
@@ -183,6 +193,9 @@ _public_ int sd_bus_new(sd_bus **ret) {
 
         assert_se(pthread_mutex_init(&r->memfd_cache_mutex, NULL) == 0);
 
+        assert_se(pthread_mutex_init(&r->pools_mutex, NULL) == 0);
+        bus_message_pools_init(r);
+
         /* We guarantee that wqueue always has space for at least one
          * entry */
         if (!GREEDY_REALLOC(r->wqueue, r->wqueue_allocated, 1)) {
@@ -279,6 +292,15 @@ _public_ int sd_bus_negotiate_fds(sd_bus *bus, int b) {
         return 0;
 }
 
+_public_ int sd_bus_negotiate_memfd(sd_bus *bus, int b) {
+        assert_return(bus, -EINVAL);
+        assert_return(bus->state == BUS_UNSET, -EPERM);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        bus->accept_memfd = b;
+        return 0;
+}
+
 _public_ int sd_bus_negotiate_timestamp(sd_bus *bus, int b) {
         uint64_t new_flags;
         assert_return(bus, -EINVAL);
@@ -378,6 +400,32 @@ _public_ int sd_bus_get_allow_interactive_authorization(sd_bus *bus) {
         return bus->allow_interactive_authorization;
 }
 
+_public_ int sd_bus_set_statistics(sd_bus *bus, int b) {
+        assert_return(bus, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        if (!b) {
+                bus->statistics = bus_statistics_free(bus->statistics);
+                return 0;
+        }
+
+        if (bus->statistics)
+                return 0;
+
+        bus->statistics = bus_statistics_new();
+        if (!bus->statistics)
+                return -ENOMEM;
+
+        return 0;
+}
+
+_public_ int sd_bus_get_statistics(sd_bus *bus) {
+        assert_return(bus, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        return !!bus->statistics;
+}
+
 static int hello_callback(sd_bus_message *reply, void *userdata, sd_bus_error *error) {
         const char *s;
         sd_bus *bus;
@@ -1605,6 +1653,21 @@ int bus_seal_synthetic_message(sd_bus *b, sd_bus_message *m) {
         return bus_message_seal(m, 0xFFFFFFFFULL, 0);
 }
 
+static void bus_log_sent_message(sd_bus_message *m) {
+        assert(m);
+
+        log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
+                  bus_message_type_to_string(m->header->type),
+                  strna(sd_bus_message_get_sender(m)),
+                  strna(sd_bus_message_get_destination(m)),
+                  strna(sd_bus_message_get_path(m)),
+                  strna(sd_bus_message_get_interface(m)),
+                  strna(sd_bus_message_get_member(m)),
+                  BUS_MESSAGE_COOKIE(m),
+                  m->reply_cookie,
+                  strna(m->error.message));
+}
+
 static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call, size_t *idx) {
         int r;
 
@@ -1619,17 +1682,10 @@ static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call
         if (r <= 0)
                 return r;
 
-        if (bus->is_kernel || *idx >= BUS_MESSAGE_SIZE(m))
-                log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
-                          bus_message_type_to_string(m->header->type),
-                          strna(sd_bus_message_get_sender(m)),
-                          strna(sd_bus_message_get_destination(m)),
-                          strna(sd_bus_message_get_path(m)),
-                          strna(sd_bus_message_get_interface(m)),
-                          strna(sd_bus_message_get_member(m)),
-                          BUS_MESSAGE_COOKIE(m),
-                          m->reply_cookie,
-                          strna(m->error.message));
+        if (bus->is_kernel || *idx >= bus_socket_message_size(bus, m)) {
+                bus_log_sent_message(m);
+                bus_statistics_sent(bus, m);
+        }
 
         return r;
 }
@@ -1641,28 +1697,55 @@ static int dispatch_wqueue(sd_bus *bus) {
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
         while (bus->wqueue_size > 0) {
+                unsigned n = 0, i;
 
-                r = bus_write_message(bus, bus->wqueue[0], false, &bus->windex);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        /* Didn't do anything this time */
-                        return ret;
-                else if (bus->is_kernel || bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[0])) {
-                        /* Fully written. Let's drop the entry from
-                         * the queue.
+                if (bus->is_kernel) {
+                        r = bus_write_message(bus, bus->wqueue[0], false, &bus->windex);
+                        if (r < 0)
+                                return r;
+                        else if (r == 0)
+                                /* Didn't do anything this time */
+                                return ret;
+
+                        n = 1;
+                } else {
+                        /* On sockets several queued messages are
+                         * written with a single syscall, and the
+                         * index may point into any of them
+                         * afterwards. */
+                        r = bus_socket_write_messages(bus, bus->wqueue, bus->wqueue_size, &bus->windex);
+                        if (r < 0)
+                                return r;
+                        else if (r == 0)
+                                return ret;
+
+                        while (n < bus->wqueue_size && bus->windex >= bus_socket_message_size(bus, bus->wqueue[n])) {
+                                bus->windex -= bus_socket_message_size(bus, bus->wqueue[n]);
+                                bus_log_sent_message(bus->wqueue[n]);
+                                bus_statistics_sent(bus, bus->wqueue[n]);
+                                n++;
+                        }
+                }
+
+                if (n > 0) {
+                        /* Fully written. Let's drop the entries
+                         * from the queue.
                          *
                          * This isn't particularly optimized, but
-                         * well, this is supposed to be our worst-case
-                         * buffer only, and the socket buffer is
-                         * supposed to be our primary buffer, and if
-                         * it got full, then all bets are off
-                         * anyway. */
+                         * well, this is supposed to be our
+                         * worst-case buffer only, and the socket
+                         * buffer is supposed to be our primary
+                         * buffer, and if it got full, then all bets
+                         * are off anyway. */
+
+                        for (i = 0; i < n; i++)
+                                sd_bus_message_unref(bus->wqueue[i]);
 
-                        bus->wqueue_size --;
-                        sd_bus_message_unref(bus->wqueue[0]);
-                        memmove(bus->wqueue, bus->wqueue + 1, sizeof(sd_bus_message*) * bus->wqueue_size);
-                        bus->windex = 0;
+                        bus->wqueue_size -= n;
+                        memmove(bus->wqueue, bus->wqueue + n, sizeof(sd_bus_message*) * bus->wqueue_size);
+
+                        if (bus->is_kernel)
+                                bus->windex = 0;
 
                         ret = 1;
                 }
@@ -1672,12 +1755,23 @@ static int dispatch_wqueue(sd_bus *bus) {
 }
 
 static int bus_read_message(sd_bus *bus, bool hint_priority, int64_t priority) {
+        size_t n;
+        int r;
+
         assert(bus);
 
+        n = bus->rqueue_size;
+
         if (bus->is_kernel)
-                return bus_kernel_read_message(bus, hint_priority, priority);
+                r = bus_kernel_read_message(bus, hint_priority, priority);
         else
-                return bus_socket_read_message(bus);
+                r = bus_socket_read_message(bus);
+
+        if (r > 0 && bus->statistics)
+                for (; n < bus->rqueue_size; n++)
+                        bus_statistics_received(bus, bus->rqueue[n]);
+
+        return r;
 }
 
 int bus_rqueue_make_room(sd_bus *bus) {
@@ -1710,6 +1804,7 @@ static int dispatch_rqueue(sd_bus *bus, bool hint_priority, int64_t priority, sd
                         *m = bus->rqueue[0];
                         bus->rqueue_size --;
                         memmove(bus->rqueue, bus->rqueue + 1, sizeof(sd_bus_message*) * bus->rqueue_size);
+                        bus_statistics_dispatched(bus, *m);
                         return 1;
                 }
 
@@ -1780,7 +1875,7 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
                         return r;
                 }
 
-                if (!bus->is_kernel && idx < BUS_MESSAGE_SIZE(m))  {
+                if (!bus->is_kernel && idx < bus_socket_message_size(bus, m))  {
                         /* Wasn't fully written. So let's remember how
                          * much was written. Note that the first entry
                          * of the wqueue array is always allocated so
@@ -1789,6 +1884,7 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
                         bus->wqueue[0] = sd_bus_message_ref(m);
                         bus->wqueue_size = 1;
                         bus->windex = idx;
+                        bus_statistics_queued(bus, m);
                 }
 
         } else {
@@ -1801,6 +1897,7 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
                         return -ENOMEM;
 
                 bus->wqueue[bus->wqueue_size ++] = sd_bus_message_ref(m);
+                bus_statistics_queued(bus, m);
         }
 
 finish:
@@ -2421,21 +2518,81 @@ static int process_filter(sd_bus *bus, sd_bus_message *m) {
 }
 
 static int process_match(sd_bus *bus, sd_bus_message *m) {
+        usec_t begin = 0;
         int r;
 
         assert(bus);
         assert(m);
 
+        if (bus->statistics) {
+                bus->statistics->n_match_callbacks = 0;
+                begin = now(CLOCK_MONOTONIC);
+        }
+
         do {
                 bus->match_callbacks_modified = false;
 
                 r = bus_match_run(bus, &bus->match_callbacks, m);
                 if (r != 0)
-                        return r;
+                        break;
 
         } while (bus->match_callbacks_modified);
 
-        return 0;
+        /* The callbacks might have turned statistics off */
+        if (bus->statistics && begin > 0) {
+                bus_histogram_add(&bus->statistics->match_time, now(CLOCK_MONOTONIC) - begin);
+                bus_statistics_matched(bus, m);
+        }
+
+        return r;
+}
+
+static int process_builtin_statistics(sd_bus *bus, sd_bus_message *m) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        int r;
+
+        assert(bus);
+        assert(m);
+
+        /* Mirrors the interface of the same name dbus-daemon
+         * implements, so that the same tools work on the bus and
+         * on peers. Answered on any object path. */
+
+        if (m->header->flags & BUS_MESSAGE_NO_REPLY_EXPECTED)
+                return 1;
+
+        if (streq_ptr(m->member, "GetStats")) {
+                /* The statistics name callers and reveal call
+                 * patterns, hence only hand them out to privileged
+                 * peers */
+                r = sd_bus_query_sender_privilege(m, -1);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        r = sd_bus_message_new_method_errorf(
+                                        m, &reply,
+                                        SD_BUS_ERROR_ACCESS_DENIED,
+                                        "Access to statistics denied.");
+                else {
+                        r = sd_bus_message_new_method_return(m, &reply);
+                        if (r < 0)
+                                return r;
+
+                        r = bus_statistics_append(bus, reply);
+                }
+        } else
+                r = sd_bus_message_new_method_errorf(
+                                m, &reply,
+                                SD_BUS_ERROR_UNKNOWN_METHOD,
+                                "Unknown method '%s' on interface '%s'.", m->member, m->interface);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_send(bus, reply, NULL);
+        if (r < 0)
+                return r;
+
+        return 1;
 }
 
 static int process_builtin(sd_bus *bus, sd_bus_message *m) {
@@ -2454,6 +2611,9 @@ static int process_builtin(sd_bus *bus, sd_bus_message *m) {
         if (m->header->type != SD_BUS_MESSAGE_METHOD_CALL)
                 return 0;
 
+        if (bus->statistics && streq_ptr(m->interface, BUS_STATISTICS_INTERFACE))
+                return process_builtin_statistics(bus, m);
+
         if (!streq_ptr(m->interface, "org.freedesktop.DBus.Peer"))
                 return 0;
 
@@ -3069,13 +3229,35 @@ bool bus_pid_changed(sd_bus *bus) {
 
 static int io_callback(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         sd_bus *bus = userdata;
+        unsigned n = 0;
         int r;
 
         assert(bus);
 
-        r = sd_bus_process(bus, NULL);
-        if (r < 0)
-                return r;
+        BUS_DONT_DESTROY(bus);
+
+        /* On kdbus each message costs a RECV ioctl and a FREE
+         * ioctl, so don't add a full event loop iteration on top of
+         * that for every single one of them: while there is more to
+         * do keep going, but only for a few rounds, so that the other
+         * event sources still get their turn. */
+        for (;;) {
+                int code;
+
+                r = sd_bus_process(bus, NULL);
+                if (r < 0)
+                        return r;
+                if (r == 0 || !bus->is_kernel || bus->state != BUS_RUNNING)
+                        break;
+
+                if (++n >= KDBUS_DISPATCH_BATCH)
+                        break;
+
+                /* The callbacks might have detached us, or asked the
+                 * event loop to exit */
+                if (!bus->event || sd_event_get_exit_code(bus->event, &code) >= 0)
+                        break;
+        }
 
         return 1;
 }
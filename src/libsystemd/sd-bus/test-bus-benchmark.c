@@ -278,7 +278,7 @@ int main(int argc, char *argv[]) {
         if (type == TYPE_KDBUS) {
                 assert_se(asprintf(&name, "deine-mutter-%u", (unsigned) getpid()) >= 0);
 
-                bus_ref = bus_kernel_create_bus(name, false, &bus_name);
+                bus_ref = bus_kernel_create_bus(name, false, 0, 0, &bus_name);
                 if (bus_ref == -ENOENT)
                         exit(EXIT_TEST_SKIP);
 
@@ -0,0 +1,106 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "log.h"
+#include "macro.h"
+
+#include "bus-bloom.h"
+
+static void test_bloom_add(void) {
+        uint64_t filter[DEFAULT_BLOOM_SIZE / 8] = {};
+        unsigned n;
+
+        assert_se(bloom_add_pair(filter, sizeof(filter), DEFAULT_BLOOM_N_HASH, "member", "Foo") == 1);
+        n = bloom_count_bits(filter, sizeof(filter));
+        assert_se(n > 0 && n <= DEFAULT_BLOOM_N_HASH);
+
+        /* The whole path, and each prefix with and without the
+         * trailing slash: "/a/b/c", "/a/b/", "/a/b", "/a/", "/a", "/" */
+        assert_se(bloom_add_prefixes(filter, sizeof(filter), DEFAULT_BLOOM_N_HASH, "path-slash-prefix", "/a/b/c", '/') == 6);
+        assert_se(bloom_count_bits(filter, sizeof(filter)) >= n);
+}
+
+static void test_bloom_rate(void) {
+        double a, b;
+
+        /* Nothing added, nothing falsely matches */
+        assert_se(bloom_false_positive_rate(DEFAULT_BLOOM_SIZE, DEFAULT_BLOOM_N_HASH, 0) == 0.0);
+
+        /* More elements, more false positives */
+        a = bloom_false_positive_rate(DEFAULT_BLOOM_SIZE, DEFAULT_BLOOM_N_HASH, 10);
+        b = bloom_false_positive_rate(DEFAULT_BLOOM_SIZE, DEFAULT_BLOOM_N_HASH, 100);
+        assert_se(a > 0.0 && a < b && b < 1.0);
+
+        /* A bigger filter, fewer */
+        assert_se(bloom_false_positive_rate(DEFAULT_BLOOM_SIZE * 4, DEFAULT_BLOOM_N_HASH, 100) < b);
+
+        /* A filter not sized to a power of two is only as good as
+         * the power of two below */
+        assert_se(bloom_false_positive_rate(DEFAULT_BLOOM_SIZE + 8, DEFAULT_BLOOM_N_HASH, 100) == b);
+
+        log_info("m=%u k=%u: n=10 %.4f%%, n=100 %.4f%%",
+                 DEFAULT_BLOOM_SIZE * 8, DEFAULT_BLOOM_N_HASH, a * 100.0, b * 100.0);
+}
+
+static void test_bloom_pick(unsigned n_elements, double max_rate) {
+        size_t size;
+        unsigned k;
+        double rate;
+
+        assert_se(bloom_pick_parameters(n_elements, max_rate, &size, &k) >= 0);
+        assert_se(size >= BLOOM_SIZE_MIN && size <= BLOOM_SIZE_MAX);
+        assert_se((size & (size - 1)) == 0);
+        assert_se(bloom_validate_parameters(size, k));
+
+        rate = bloom_false_positive_rate(size, k, n_elements);
+        assert_se(rate <= max_rate);
+
+        /* The smallest filter that does it */
+        if (size > BLOOM_SIZE_MIN) {
+                unsigned j;
+
+                for (j = 1; bloom_validate_parameters(size / 2, j); j++)
+                        assert_se(bloom_false_positive_rate(size / 2, j, n_elements) > max_rate);
+        }
+
+        log_info("n=%u p<=%.2f%%: m=%zu k=%u (%.4f%%)", n_elements, max_rate * 100.0, size * 8, k, rate * 100.0);
+}
+
+int main(int argc, char *argv[]) {
+        size_t size;
+        unsigned k;
+
+        log_set_max_level(LOG_DEBUG);
+
+        test_bloom_add();
+        test_bloom_rate();
+
+        test_bloom_pick(1, 0.01);
+        test_bloom_pick(20, 0.01);
+        test_bloom_pick(100, 0.01);
+        test_bloom_pick(100, 0.001);
+        test_bloom_pick(500, 0.01);
+
+        /* Not even the biggest filter keeps thousands of elements
+         * apart that well */
+        assert_se(bloom_pick_parameters(100000, 0.0001, &size, &k) == -ERANGE);
+
+        return 0;
+}
@@ -0,0 +1,219 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/socket.h>
+
+#include "util.h"
+#include "log.h"
+#include "fileio.h"
+#include "rm-rf.h"
+
+#include "sd-bus.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+#include "bus-util.h"
+#include "bus-dump.h"
+#include "busctl-capture.h"
+
+#define N_MESSAGES 200U
+#define SNAPLEN 65536U
+
+static sd_bus_message *messages[N_MESSAGES];
+
+static void make_messages(sd_bus *bus) {
+        char payload[512];
+        unsigned i;
+
+        for (i = 0; i < N_MESSAGES; i++) {
+                size_t l = 16 + (i * 37) % 400;
+
+                memset(payload, 'a' + i % 26, l);
+                payload[l] = 0;
+
+                assert_se(sd_bus_message_new_signal(bus, messages + i, "/foo/bar", "org.freedesktop.systemd.test", "Capture") >= 0);
+                assert_se(sd_bus_message_append(messages[i], "us", i, payload) >= 0);
+                assert_se(bus_message_seal(messages[i], i + 1, 0) >= 0);
+        }
+}
+
+static void free_messages(void) {
+        unsigned i;
+
+        for (i = 0; i < N_MESSAGES; i++)
+                messages[i] = sd_bus_message_unref(messages[i]);
+}
+
+/* Checks one pcap file, and returns the number of frames in it. All
+ * frames must be some of our messages, in the order they were put,
+ * and after the one with index *next. */
+static unsigned check_file(const char *path, uint64_t max_file_size, unsigned *next) {
+        _cleanup_free_ char *contents = NULL;
+        const pcap_hdr_t *h;
+        size_t size, pos;
+        unsigned n = 0;
+
+        assert_se(read_full_file(path, &contents, &size) >= 0);
+
+        assert_se(size >= sizeof(pcap_hdr_t));
+        h = (const pcap_hdr_t*) contents;
+        assert_se(h->magic_number == 0xa1b2c3d4U);
+        assert_se(h->snaplen == SNAPLEN);
+
+        /* Files are only allowed to grow bigger than the limit if
+         * they contain a single frame */
+        pos = sizeof(pcap_hdr_t);
+        while (pos < size) {
+                const pcaprec_hdr_t *r;
+                _cleanup_free_ void *expected = NULL;
+                size_t l;
+
+                assert_se(size - pos >= sizeof(pcaprec_hdr_t));
+                r = (const pcaprec_hdr_t*) (contents + pos);
+                assert_se(r->incl_len == r->orig_len);
+                assert_se(size - pos - sizeof(pcaprec_hdr_t) >= r->incl_len);
+
+                /* Find the message this is, they are all of
+                 * different or at least distinctly filled sizes */
+                for (; *next < N_MESSAGES; (*next)++) {
+                        l = bus_message_pcap_frame_size(messages[*next], SNAPLEN);
+                        if (l != sizeof(pcaprec_hdr_t) + r->incl_len)
+                                continue;
+
+                        expected = malloc(l);
+                        assert_se(expected);
+                        bus_message_pcap_frame_to_buffer(messages[*next], SNAPLEN, expected);
+
+                        /* Timestamps differ */
+                        if (memcmp((uint8_t*) expected + sizeof(pcaprec_hdr_t), contents + pos + sizeof(pcaprec_hdr_t), r->incl_len) == 0)
+                                break;
+
+                        expected = mfree(expected);
+                }
+                assert_se(*next < N_MESSAGES);
+                (*next)++;
+
+                pos += sizeof(pcaprec_hdr_t) + r->incl_len;
+                n++;
+        }
+
+        assert_se(n > 0);
+        assert_se(size <= max_file_size || n == 1);
+
+        return n;
+}
+
+static void test_capture(const char *dir, size_t buffer_size, uint64_t max_file_size, unsigned max_files, bool may_drop) {
+        _cleanup_capture_ring_free_ CaptureRing *ring = NULL;
+        _cleanup_free_ char *path = NULL;
+        unsigned i, n_files, n_frames = 0, next = 0;
+        uint64_t n_dropped = (uint64_t) -1;
+
+        log_info("Capturing with a buffer of %zu bytes into files of %"PRIu64" bytes, keeping %u.", buffer_size, max_file_size, max_files);
+
+        assert_se(path = strjoin(dir, "/capture.pcap", NULL));
+
+        assert_se(capture_ring_new(&ring, buffer_size, SNAPLEN, path, max_file_size, max_files) >= 0);
+        assert_se(capture_ring_start(ring) >= 0);
+
+        for (i = 0; i < N_MESSAGES; i++)
+                assert_se(capture_ring_put(ring, messages[i]) >= 0);
+
+        assert_se(capture_ring_finish(ring, &n_dropped) >= 0);
+        assert_se(n_dropped < N_MESSAGES);
+        assert_se(may_drop || n_dropped == 0);
+
+        /* Find the last file. Older ones might be gone already, but
+         * there can't be more files than frames. */
+        n_files = 1;
+        for (i = 1; i <= N_MESSAGES; i++) {
+                _cleanup_free_ char *p = NULL;
+
+                assert_se(asprintf(&p, "%s.%u", path, i) >= 0);
+                if (access(p, F_OK) >= 0)
+                        n_files = i + 1;
+        }
+
+        for (i = 0; i < n_files; i++) {
+                _cleanup_free_ char *p = NULL;
+
+                if (i > 0)
+                        assert_se(asprintf(&p, "%s.%u", path, i) >= 0);
+
+                if (max_files > 0 && i + max_files < n_files) {
+                        /* Rotated away */
+                        assert_se(access(p ?: path, F_OK) < 0 && errno == ENOENT);
+                        continue;
+                }
+
+                n_frames += check_file(p ?: path, max_file_size, &next);
+        }
+
+        log_info("%u files, %u frames, %"PRIu64" dropped.", n_files, n_frames, n_dropped);
+
+        assert_se(n_files > 1);
+
+        if (max_files == 0)
+                assert_se(n_frames + n_dropped == N_MESSAGES);
+        else
+                assert_se(n_frames + n_dropped < N_MESSAGES);
+
+        for (i = 0; i < n_files; i++) {
+                _cleanup_free_ char *p = NULL;
+
+                if (i > 0)
+                        assert_se(asprintf(&p, "%s.%u", path, i) >= 0);
+
+                (void) unlink(p ?: path);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_bus_unref_ sd_bus *bus = NULL;
+        char t[] = "/tmp/test-bus-capture-XXXXXX";
+        int fds[2];
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) >= 0);
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        make_messages(bus);
+
+        assert_se(mkdtemp(t));
+
+        /* Everything fits into the buffer, nothing may be lost */
+        test_capture(t, 1024 * 1024, 4096, 0, false);
+
+        /* Smaller than the whole capture, the messages come in
+         * faster than they are written, some may get lost */
+        test_capture(t, 2048, 1024, 0, true);
+
+        /* Only the three most recent files are kept */
+        test_capture(t, 1024 * 1024, 4096, 3, false);
+
+        free_messages();
+        safe_close(fds[1]);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        return 0;
+}
@@ -213,11 +213,31 @@ static void test_marshal(void) {
         assert_se(bus_message_dump(m, NULL, BUS_MESSAGE_DUMP_WITH_HEADER) >= 0);
 }
 
+static void test_bus_gvariant_layout_cache(void) {
+        /* Longer than what the layout cache holds */
+        const char *l = "((u)yyy(b(iiii))(u)yyy(b(iiii))(t))";
+        unsigned i;
+
+        assert_se(strlen(l) >= 32);
+
+        for (i = 0; i < 2; i++) {
+                assert_se(bus_gvariant_is_fixed_size(l) > 0);
+                assert_se(bus_gvariant_get_size(l) == 64);
+                assert_se(bus_gvariant_get_alignment(l) == 8);
+        }
+
+        /* Everything again, answered from the cache this time */
+        test_bus_gvariant_is_fixed_size();
+        test_bus_gvariant_get_size();
+        test_bus_gvariant_get_alignment();
+}
+
 int main(int argc, char *argv[]) {
 
         test_bus_gvariant_is_fixed_size();
         test_bus_gvariant_get_size();
         test_bus_gvariant_get_alignment();
+        test_bus_gvariant_layout_cache();
         test_marshal();
 
         return 0;
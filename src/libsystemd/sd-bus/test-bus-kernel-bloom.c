@@ -51,7 +51,7 @@ static void test_one(
 
         assert_se(asprintf(&name, "deine-mutter-%u", (unsigned) getpid()) >= 0);
 
-        bus_ref = bus_kernel_create_bus(name, false, &bus_name);
+        bus_ref = bus_kernel_create_bus(name, false, 0, 0, &bus_name);
         if (bus_ref == -ENOENT)
                 exit(EXIT_TEST_SKIP);
 
@@ -43,7 +43,7 @@ int main(int argc, char *argv[]) {
 
         assert_se(asprintf(&name, "deine-mutter-%u", (unsigned) getpid()) >= 0);
 
-        bus_ref = bus_kernel_create_bus(name, false, &bus_name);
+        bus_ref = bus_kernel_create_bus(name, false, 0, 0, &bus_name);
         if (bus_ref == -ENOENT)
                 return EXIT_TEST_SKIP;
 
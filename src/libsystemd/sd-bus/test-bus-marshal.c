@@ -89,6 +89,31 @@ static void test_bus_label_escape(void) {
         test_bus_label_escape_one(":1", "_3a1");
 }
 
+static void test_bus_message_long_fields(sd_bus *bus) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        char path[301], member[201];
+
+        /* The fields outgrow the room allocated along with the
+         * message, and must survive the move to the heap */
+
+        memset(path, 'a', sizeof(path) - 1);
+        path[0] = '/';
+        path[sizeof(path) - 1] = 0;
+        memset(member, 'b', sizeof(member) - 1);
+        member[sizeof(member) - 1] = 0;
+
+        assert_se(sd_bus_message_new_method_call(bus, &m, "foobar.waldo", path, "foobar.waldo", member) >= 0);
+
+        assert_se(streq(sd_bus_message_get_destination(m), "foobar.waldo"));
+        assert_se(streq(sd_bus_message_get_path(m), path));
+        assert_se(streq(sd_bus_message_get_interface(m), "foobar.waldo"));
+        assert_se(streq(sd_bus_message_get_member(m), member));
+
+        assert_se(bus_message_seal(m, 4711, 0) >= 0);
+        assert_se(streq(sd_bus_message_get_path(m), path));
+        assert_se(streq(sd_bus_message_get_member(m), member));
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *copy = NULL;
         int r, boolean;
@@ -110,6 +135,8 @@ int main(int argc, char *argv[]) {
         if (r < 0)
                 return EXIT_TEST_SKIP;
 
+        test_bus_message_long_fields(bus);
+
         r = sd_bus_message_new_method_call(bus, &m, "foobar.waldo", "/", "foobar.waldo", "Piep");
         assert_se(r >= 0);
 
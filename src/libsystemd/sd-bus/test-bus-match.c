@@ -77,6 +77,84 @@ static int match_add(sd_bus_slot *slots, struct bus_match_node *root, const char
         return r;
 }
 
+static unsigned n_bench_hits = 0;
+
+static int bench_filter(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        n_bench_hits++;
+        return 0;
+}
+
+#define N_BENCH_MATCHES 5000
+#define N_BENCH_MESSAGES 10000
+
+static void bench_add(struct bus_match_node *root, sd_bus_slot *s, const char *match) {
+        struct bus_match_component *components = NULL;
+        unsigned n_components = 0;
+
+        assert_se(bus_match_parse(match, &components, &n_components) >= 0);
+
+        s->match_callback.callback = bench_filter;
+        assert_se(bus_match_add(root, components, n_components, &s->match_callback) >= 0);
+        bus_match_parse_free(components, n_components);
+}
+
+static void test_match_benchmark(sd_bus *bus) {
+        struct bus_match_node root = {
+                .type = BUS_MATCH_ROOT,
+        };
+
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        _cleanup_free_ sd_bus_slot *slots = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        unsigned i;
+        usec_t t;
+
+        /* The time to match a message should not depend on the
+         * number of registered rules, only on the matching ones,
+         * four in this case */
+
+        slots = new0(sd_bus_slot, N_BENCH_MATCHES * 4);
+        assert_se(slots);
+
+        for (i = 0; i < N_BENCH_MATCHES; i++) {
+                char match[256];
+
+                xsprintf(match, "type='signal',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',path='/org/freedesktop/systemd1/unit/u%u'", i);
+                bench_add(&root, slots + i * 4, match);
+
+                xsprintf(match, "type='signal',path_namespace='/org/freedesktop/systemd1/unit/u%u'", i);
+                bench_add(&root, slots + i * 4 + 1, match);
+
+                xsprintf(match, "type='signal',arg0namespace='org.example.n%u'", i);
+                bench_add(&root, slots + i * 4 + 2, match);
+
+                xsprintf(match, "type='signal',arg1path='/org/example/p%u/'", i);
+                bench_add(&root, slots + i * 4 + 3, match);
+        }
+
+        assert_se(sd_bus_message_new_signal(bus, &m, "/org/freedesktop/systemd1/unit/u42", "org.freedesktop.DBus.Properties", "PropertiesChanged") >= 0);
+        assert_se(sd_bus_message_append(m, "ss", "org.example.n7.foo", "/org/example/p3/sub") >= 0);
+        assert_se(bus_message_seal(m, 1, 0) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < N_BENCH_MESSAGES; i++)
+                assert_se(bus_match_run(NULL, &root, m) == 0);
+
+        t = now(CLOCK_MONOTONIC) - t;
+
+        assert_se(n_bench_hits == 4 * N_BENCH_MESSAGES);
+        log_info("Matched %u messages against %u rules in %s, %.2fus per message",
+                 N_BENCH_MESSAGES, N_BENCH_MATCHES * 4,
+                 format_timespan(ts, sizeof(ts), t, USEC_PER_MSEC),
+                 (double) t / N_BENCH_MESSAGES);
+
+        for (i = 0; i < N_BENCH_MATCHES * 4; i++)
+                assert_se(bus_match_remove(&root, &slots[i].match_callback) > 0);
+
+        bus_match_free(&root);
+}
+
 static void test_match_scope(const char *match, enum bus_match_scope scope) {
         struct bus_match_component *components = NULL;
         unsigned n_components = 0;
@@ -151,6 +229,8 @@ int main(int argc, char *argv[]) {
 
         bus_match_free(&root);
 
+        test_match_benchmark(bus);
+
         test_match_scope("interface='foobar'", BUS_MATCH_GENERIC);
         test_match_scope("", BUS_MATCH_GENERIC);
         test_match_scope("interface='org.freedesktop.DBus.Local'", BUS_MATCH_LOCAL);
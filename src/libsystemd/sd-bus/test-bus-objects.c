@@ -39,6 +39,8 @@ struct context {
         char *something;
         char *automatic_string_property;
         uint32_t automatic_integer_property;
+        uint32_t cached_value;
+        unsigned n_cached_gets;
 };
 
 static int something_handler(sd_bus_message *m, void *userdata, sd_bus_error *error) {
@@ -195,6 +197,24 @@ static int emit_object_removed(sd_bus_message *m, void *userdata, sd_bus_error *
         return 1;
 }
 
+static int cached_get_handler(sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+        struct context *c = userdata;
+
+        c->n_cached_gets++;
+
+        return sd_bus_message_append(reply, "u", c->cached_value);
+}
+
+static int bump_handler(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        struct context *c = userdata;
+
+        c->cached_value++;
+
+        assert_se(sd_bus_emit_properties_changed(sd_bus_message_get_bus(m), sd_bus_message_get_path(m), "org.freedesktop.systemd.CacheTest", "Value", NULL) >= 0);
+
+        return sd_bus_reply_method_return(m, "");
+}
+
 static const sd_bus_vtable vtable[] = {
         SD_BUS_VTABLE_START(0),
         SD_BUS_METHOD("AlterSomething", "s", "s", something_handler, 0),
@@ -222,6 +242,20 @@ static const sd_bus_vtable vtable2[] = {
         SD_BUS_VTABLE_END
 };
 
+static const sd_bus_vtable cache_vtable[] = {
+        SD_BUS_VTABLE_START(SD_BUS_VTABLE_CACHE_PROPERTIES),
+        SD_BUS_METHOD("Bump", "", "", bump_handler, 0),
+        SD_BUS_PROPERTY("Value", "u", cached_get_handler, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+        SD_BUS_PROPERTY("Constant", "s", NULL, offsetof(struct context, something), SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable bad_cache_vtable[] = {
+        SD_BUS_VTABLE_START(SD_BUS_VTABLE_CACHE_PROPERTIES),
+        SD_BUS_PROPERTY("Value", "u", cached_get_handler, 0, 0),
+        SD_BUS_VTABLE_END
+};
+
 static int enumerator_callback(sd_bus *bus, const char *path, void *userdata, char ***nodes, sd_bus_error *error) {
 
         if (object_path_startswith("/value", path))
@@ -251,6 +285,8 @@ static void *server(void *p) {
         assert_se(sd_bus_new(&bus) >= 0);
         assert_se(sd_bus_set_fd(bus, c->fds[0], c->fds[0]) >= 0);
         assert_se(sd_bus_set_server(bus, 1, id) >= 0);
+        assert_se(sd_bus_set_statistics(bus, true) >= 0);
+        assert_se(sd_bus_get_statistics(bus) > 0);
 
         assert_se(sd_bus_add_object_vtable(bus, NULL, "/foo", "org.freedesktop.systemd.test", vtable, c) >= 0);
         assert_se(sd_bus_add_object_vtable(bus, NULL, "/foo", "org.freedesktop.systemd.test2", vtable, c) >= 0);
@@ -259,6 +295,8 @@ static void *server(void *p) {
         assert_se(sd_bus_add_node_enumerator(bus, NULL, "/value/a", enumerator2_callback, NULL) >= 0);
         assert_se(sd_bus_add_object_manager(bus, NULL, "/value") >= 0);
         assert_se(sd_bus_add_object_manager(bus, NULL, "/value/a") >= 0);
+        assert_se(sd_bus_add_object_vtable(bus, NULL, "/cache", "org.freedesktop.systemd.CacheTest", cache_vtable, c) >= 0);
+        assert_se(sd_bus_add_object_vtable(bus, NULL, "/cache", "org.freedesktop.systemd.BadCacheTest", bad_cache_vtable, c) == -EINVAL);
 
         assert_se(sd_bus_start(bus) >= 0);
 
@@ -295,6 +333,74 @@ fail:
         return INT_TO_PTR(r);
 }
 
+static uint32_t get_all_cached_value(sd_bus *bus, const char *interface) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        uint32_t value = (uint32_t) -1;
+        const char *name;
+
+        assert_se(sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/cache", "org.freedesktop.DBus.Properties", "GetAll", NULL, &reply, "s", interface) >= 0);
+
+        assert_se(sd_bus_message_enter_container(reply, 'a', "{sv}") >= 0);
+        while (sd_bus_message_enter_container(reply, 'e', "sv") > 0) {
+                assert_se(sd_bus_message_read(reply, "s", &name) >= 0);
+
+                if (streq(name, "Value"))
+                        assert_se(sd_bus_message_read(reply, "v", "u", &value) >= 0);
+                else
+                        assert_se(sd_bus_message_skip(reply, "v") >= 0);
+
+                assert_se(sd_bus_message_exit_container(reply) >= 0);
+        }
+        assert_se(sd_bus_message_exit_container(reply) >= 0);
+
+        return value;
+}
+
+static uint64_t get_method_calls(sd_bus *bus, const char *member) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        uint64_t n, sum, max, calls = 0;
+        const char *name, *sender;
+        bool found = false;
+
+        assert_se(sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/", "org.freedesktop.DBus.Debug.Stats", "GetStats", NULL, &reply, "") >= 0);
+
+        assert_se(sd_bus_message_enter_container(reply, 'a', "{sv}") > 0);
+        while (sd_bus_message_enter_container(reply, 'e', "sv") > 0) {
+                assert_se(sd_bus_message_read(reply, "s", &name) > 0);
+
+                if (!streq(name, "Methods")) {
+                        assert_se(sd_bus_message_skip(reply, "v") > 0);
+                        assert_se(sd_bus_message_exit_container(reply) > 0);
+                        continue;
+                }
+
+                assert_se(sd_bus_message_enter_container(reply, 'v', "a(s(tttat)s)") > 0);
+                assert_se(sd_bus_message_enter_container(reply, 'a', "(s(tttat)s)") > 0);
+                while (sd_bus_message_enter_container(reply, 'r', "s(tttat)s") > 0) {
+                        assert_se(sd_bus_message_read(reply, "s", &name) > 0);
+                        assert_se(sd_bus_message_enter_container(reply, 'r', "tttat") > 0);
+                        assert_se(sd_bus_message_read(reply, "ttt", &n, &sum, &max) > 0);
+                        assert_se(max <= sum);
+                        assert_se(sd_bus_message_skip(reply, "at") > 0);
+                        assert_se(sd_bus_message_exit_container(reply) > 0);
+                        assert_se(sd_bus_message_read(reply, "s", &sender) > 0);
+                        assert_se(sd_bus_message_exit_container(reply) > 0);
+
+                        if (streq(name, member)) {
+                                calls = n;
+                                found = true;
+                        }
+                }
+                assert_se(sd_bus_message_exit_container(reply) > 0);
+                assert_se(sd_bus_message_exit_container(reply) > 0);
+                assert_se(sd_bus_message_exit_container(reply) > 0);
+        }
+        assert_se(sd_bus_message_exit_container(reply) > 0);
+
+        assert_se(found);
+        return calls;
+}
+
 static int client(struct context *c) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_bus_unref_ sd_bus *bus = NULL;
@@ -427,6 +533,31 @@ static int client(struct context *c) {
         assert_se(sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_INTERFACE));
         sd_bus_error_free(&error);
 
+        /* The second GetAll() is answered from the cache, until the
+         * change is signalled */
+        assert_se(get_all_cached_value(bus, "org.freedesktop.systemd.CacheTest") == 0);
+        assert_se(get_all_cached_value(bus, "org.freedesktop.systemd.CacheTest") == 0);
+        assert_se(get_all_cached_value(bus, "") == 0);
+        assert_se(c->n_cached_gets == 2);
+
+        r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/cache", "org.freedesktop.systemd.CacheTest", "Bump", &error, NULL, "");
+        assert_se(r >= 0);
+
+        r = sd_bus_process(bus, &reply);
+        assert_se(r > 0);
+
+        assert_se(sd_bus_message_is_signal(reply, "org.freedesktop.DBus.Properties", "PropertiesChanged"));
+
+        sd_bus_message_unref(reply);
+        reply = NULL;
+
+        assert_se(get_all_cached_value(bus, "org.freedesktop.systemd.CacheTest") == 1);
+        assert_se(get_all_cached_value(bus, "") == 1);
+        assert_se(get_all_cached_value(bus, "") == 1);
+
+        /* One more for the PropertiesChanged signal itself */
+        assert_se(c->n_cached_gets == 5);
+
         r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects", &error, &reply, "");
         assert_se(r < 0);
         assert_se(sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD));
@@ -512,6 +643,9 @@ static int client(struct context *c) {
         sd_bus_message_unref(reply);
         reply = NULL;
 
+        /* Only the well-formed AlterSomething() call reached the handler */
+        assert_se(get_method_calls(bus, "org.freedesktop.systemd.test.AlterSomething") == 1);
+
         r = sd_bus_call_method(bus, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "Exit", &error, NULL, "");
         assert_se(r >= 0);
 
@@ -21,15 +21,20 @@
 
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/mman.h>
 
 #include "log.h"
 #include "util.h"
 #include "macro.h"
+#include "memfd-util.h"
 
 #include "sd-bus.h"
 #include "bus-internal.h"
+#include "bus-message.h"
 #include "bus-util.h"
 
+#define PAYLOAD_SIZE (1024*1024)
+
 struct context {
         int fds[2];
 
@@ -38,8 +43,36 @@ struct context {
 
         bool client_anonymous_auth;
         bool server_anonymous_auth;
+
+        bool client_negotiate_memfd;
+        bool server_negotiate_memfd;
 };
 
+static void verify_payload(struct context *c, sd_bus_message *m) {
+        struct bus_body_part *part;
+        const uint8_t *p;
+        const char *s;
+        bool memfd = false;
+        size_t l, i;
+        unsigned j;
+
+        assert_se(sd_bus_message_read_array(m, 'y', (const void**) &p, &l) > 0);
+        assert_se(l == PAYLOAD_SIZE);
+        for (i = 0; i < l; i++)
+                assert_se(p[i] == (uint8_t) i);
+
+        assert_se(sd_bus_message_read(m, "s", &s) > 0);
+        assert_se(streq(s, "trailer"));
+
+        /* The payload only arrives as memfd if both sides agreed */
+        MESSAGE_FOREACH_PART(part, j, m)
+                if (part->memfd >= 0)
+                        memfd = true;
+
+        assert_se(memfd == (c->client_negotiate_unix_fds && c->server_negotiate_unix_fds &&
+                            c->client_negotiate_memfd && c->server_negotiate_memfd));
+}
+
 static void *server(void *p) {
         struct context *c = p;
         sd_bus *bus = NULL;
@@ -54,6 +87,7 @@ static void *server(void *p) {
         assert_se(sd_bus_set_server(bus, 1, id) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->server_anonymous_auth) >= 0);
         assert_se(sd_bus_negotiate_fds(bus, c->server_negotiate_unix_fds) >= 0);
+        assert_se(sd_bus_negotiate_memfd(bus, c->server_negotiate_memfd) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
         while (!quit) {
@@ -84,6 +118,8 @@ static void *server(void *p) {
 
                         assert_se((sd_bus_can_send(bus, 'h') >= 1) == (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
 
+                        verify_payload(c, m);
+
                         r = sd_bus_message_new_method_return(m, &reply);
                         if (r < 0) {
                                 log_error_errno(r, "Failed to allocate return: %m");
@@ -127,11 +163,15 @@ static int client(struct context *c) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
         _cleanup_bus_unref_ sd_bus *bus = NULL;
         sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_close_ int memfd = -1;
+        uint8_t *p;
+        size_t i;
         int r;
 
         assert_se(sd_bus_new(&bus) >= 0);
         assert_se(sd_bus_set_fd(bus, c->fds[1], c->fds[1]) >= 0);
         assert_se(sd_bus_negotiate_fds(bus, c->client_negotiate_unix_fds) >= 0);
+        assert_se(sd_bus_negotiate_memfd(bus, c->client_negotiate_memfd) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->client_anonymous_auth) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
@@ -145,6 +185,15 @@ static int client(struct context *c) {
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate method call: %m");
 
+        memfd = memfd_new_and_map(NULL, PAYLOAD_SIZE, (void**) &p);
+        assert_se(memfd >= 0);
+        for (i = 0; i < PAYLOAD_SIZE; i++)
+                p[i] = (uint8_t) i;
+        assert_se(munmap(p, PAYLOAD_SIZE) >= 0);
+
+        assert_se(sd_bus_message_append_array_memfd(m, 'y', memfd, 0, PAYLOAD_SIZE) >= 0);
+        assert_se(sd_bus_message_append(m, "s", "trailer") >= 0);
+
         r = sd_bus_call(bus, m, 0, &error, &reply);
         if (r < 0) {
                 log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
@@ -155,7 +204,8 @@ static int client(struct context *c) {
 }
 
 static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_fds,
-                    bool client_anonymous_auth, bool server_anonymous_auth) {
+                    bool client_anonymous_auth, bool server_anonymous_auth,
+                    bool client_negotiate_memfd, bool server_negotiate_memfd) {
 
         struct context c;
         pthread_t s;
@@ -170,6 +220,8 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
         c.server_negotiate_unix_fds = server_negotiate_unix_fds;
         c.client_anonymous_auth = client_anonymous_auth;
         c.server_anonymous_auth = server_anonymous_auth;
+        c.client_negotiate_memfd = client_negotiate_memfd;
+        c.server_negotiate_memfd = server_negotiate_memfd;
 
         r = pthread_create(&s, NULL, server, &c);
         if (r != 0)
@@ -193,26 +245,38 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
 int main(int argc, char *argv[]) {
         int r;
 
-        r = test_one(true, true, false, false);
+        r = test_one(true, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, false, false, false);
+        r = test_one(true, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, true, false, false);
+        r = test_one(false, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, false, false, false);
+        r = test_one(false, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, true);
+        r = test_one(true, true, true, true, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, false, true);
+        r = test_one(true, true, false, true, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, false);
+        r = test_one(true, true, true, false, false, false);
         assert_se(r == -EPERM);
 
+        r = test_one(true, true, false, false, true, true);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, false, false, true, false);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, false, false, false, true);
+        assert_se(r >= 0);
+
+        r = test_one(false, true, false, false, true, true);
+        assert_se(r >= 0);
+
         return EXIT_SUCCESS;
 }
@@ -32,8 +32,10 @@
 #include <stddef.h>
 #include <limits.h>
 #include <mqueue.h>
+#include <pthread.h>
 
 #include "util.h"
+#include "strv.h"
 #include "path-util.h"
 #include "socket-util.h"
 #include "sd-daemon.h"
@@ -338,6 +340,69 @@ _public_ int sd_is_mq(int fd, const char *path) {
         return 1;
 }
 
+/* The socket kept open by sd_notify_persistent(), and the process
+ * that opened it. A child only inherits a copy of it and opens its
+ * own on the first notification after fork(). */
+static pthread_mutex_t notify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool notify_persistent = false;
+static int notify_fd = -1;
+static pid_t notify_fd_pid = 0;
+
+static void notify_atfork_prepare(void) {
+        assert_se(pthread_mutex_lock(&notify_mutex) == 0);
+}
+
+static void notify_atfork_release(void) {
+        assert_se(pthread_mutex_unlock(&notify_mutex) == 0);
+}
+
+static void notify_atfork_init(void) {
+        assert_se(pthread_atfork(notify_atfork_prepare, notify_atfork_release, notify_atfork_release) == 0);
+}
+
+static void notify_lock(void) {
+        static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+        /* Another thread might fork() while we hold the lock, which
+         * would leave it taken forever in the child. Hence, take it
+         * around fork() too. */
+        assert_se(pthread_once(&atfork_once, notify_atfork_init) == 0);
+        assert_se(pthread_mutex_lock(&notify_mutex) == 0);
+}
+
+static int notify_fd_acquire(void) {
+        pid_t pid;
+
+        /* Must be called with notify_mutex held */
+
+        pid = getpid();
+
+        if (notify_fd >= 0 && notify_fd_pid != pid)
+                notify_fd = safe_close(notify_fd);
+
+        if (notify_fd < 0) {
+                notify_fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+                if (notify_fd < 0)
+                        return -errno;
+
+                notify_fd_pid = pid;
+        }
+
+        return notify_fd;
+}
+
+_public_ int sd_notify_persistent(int b) {
+        notify_lock();
+
+        notify_persistent = b;
+        if (!b)
+                notify_fd = safe_close(notify_fd);
+
+        assert_se(pthread_mutex_unlock(&notify_mutex) == 0);
+
+        return 0;
+}
+
 _public_ int sd_pid_notify_with_fds(pid_t pid, int unset_environment, const char *state, const int *fds, unsigned n_fds) {
         union sockaddr_union sockaddr = {
                 .sa.sa_family = AF_UNIX,
@@ -352,9 +417,9 @@ _public_ int sd_pid_notify_with_fds(pid_t pid, int unset_environment, const char
         };
         _cleanup_close_ int fd = -1;
         struct cmsghdr *cmsg = NULL;
+        bool have_pid, locked = false;
         const char *e;
-        bool have_pid;
-        int r;
+        int r, sock;
 
         if (!state) {
                 r = -EINVAL;
@@ -376,10 +441,26 @@ _public_ int sd_pid_notify_with_fds(pid_t pid, int unset_environment, const char
                 goto finish;
         }
 
-        fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
-        if (fd < 0) {
-                r = -errno;
-                goto finish;
+        notify_lock();
+        locked = true;
+
+        if (notify_persistent) {
+                /* The lock stays taken until the message is sent, so
+                 * that nobody closes the socket under our feet */
+                sock = notify_fd_acquire();
+                if (sock < 0) {
+                        r = sock;
+                        goto finish;
+                }
+        } else {
+                assert_se(pthread_mutex_unlock(&notify_mutex) == 0);
+                locked = false;
+
+                sock = fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+                if (fd < 0) {
+                        r = -errno;
+                        goto finish;
+                }
         }
 
         iovec.iov_len = strlen(state);
@@ -427,7 +508,7 @@ _public_ int sd_pid_notify_with_fds(pid_t pid, int unset_environment, const char
         }
 
         /* First try with fake ucred data, as requested */
-        if (sendmsg(fd, &msghdr, MSG_NOSIGNAL) >= 0) {
+        if (sendmsg(sock, &msghdr, MSG_NOSIGNAL) >= 0) {
                 r = 1;
                 goto finish;
         }
@@ -438,7 +519,7 @@ _public_ int sd_pid_notify_with_fds(pid_t pid, int unset_environment, const char
                 if (msghdr.msg_controllen == 0)
                         msghdr.msg_control = NULL;
 
-                if (sendmsg(fd, &msghdr, MSG_NOSIGNAL) >= 0) {
+                if (sendmsg(sock, &msghdr, MSG_NOSIGNAL) >= 0) {
                         r = 1;
                         goto finish;
                 }
@@ -447,6 +528,14 @@ _public_ int sd_pid_notify_with_fds(pid_t pid, int unset_environment, const char
         r = -errno;
 
 finish:
+        if (locked) {
+                /* Nothing will be sent anymore */
+                if (unset_environment)
+                        notify_fd = safe_close(notify_fd);
+
+                assert_se(pthread_mutex_unlock(&notify_mutex) == 0);
+        }
+
         if (unset_environment)
                 unsetenv("NOTIFY_SOCKET");
 
@@ -497,6 +586,47 @@ _public_ int sd_notifyf(int unset_environment, const char *format, ...) {
         return sd_pid_notify(0, unset_environment, p);
 }
 
+static int pid_notify_many_ap(pid_t pid, int unset_environment, const char *state, va_list ap) {
+        _cleanup_strv_free_ char **l = NULL;
+        _cleanup_free_ char *p = NULL;
+
+        if (!state)
+                return sd_pid_notify(pid, unset_environment, NULL);
+
+        l = strv_new_ap(state, ap);
+        if (!l)
+                return -ENOMEM;
+
+        /* All assignments go into a single datagram */
+        p = strv_join(l, "\n");
+        if (!p)
+                return -ENOMEM;
+
+        return sd_pid_notify(pid, unset_environment, p);
+}
+
+_public_ int sd_pid_notify_many(pid_t pid, int unset_environment, const char *state, ...) {
+        va_list ap;
+        int r;
+
+        va_start(ap, state);
+        r = pid_notify_many_ap(pid, unset_environment, state, ap);
+        va_end(ap);
+
+        return r;
+}
+
+_public_ int sd_notify_many(int unset_environment, const char *state, ...) {
+        va_list ap;
+        int r;
+
+        va_start(ap, state);
+        r = pid_notify_many_ap(0, unset_environment, state, ap);
+        va_end(ap);
+
+        return r;
+}
+
 _public_ int sd_booted(void) {
         struct stat st;
 
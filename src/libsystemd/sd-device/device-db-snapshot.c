@@ -0,0 +1,655 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "macro.h"
+#include "fileio.h"
+#include "strv.h"
+#include "time-util.h"
+
+#include "device-db-snapshot.h"
+
+#define SNAPSHOT_SIG { 'U', 'D', 'E', 'V', 'D', 'B', 'S', 'N' }
+
+/* how long readers wait, before they look for a new snapshot again */
+#define SNAPSHOT_RETRY_USEC USEC_PER_SEC
+
+/* The snapshot is only read on the machine that wrote it, hence it is
+ * stored in host byte order. All offsets are relative to the start of
+ * the file, except for string offsets, which are relative to the
+ * string section. */
+struct snapshot_header {
+        uint8_t signature[8];
+        uint64_t file_size;
+        uint64_t header_size;
+
+        /* set before the database is changed, or the snapshot is replaced */
+        uint64_t stale;
+
+        /* array of struct snapshot_device, sorted by id */
+        uint64_t devices_off;
+        uint64_t devices_count;
+
+        /* array of struct snapshot_tag, sorted by name */
+        uint64_t tags_off;
+        uint64_t tags_count;
+
+        /* array of string offsets of device ids, in runs per tag */
+        uint64_t tag_devices_off;
+        uint64_t tag_devices_count;
+
+        uint64_t strings_off;
+        uint64_t strings_len;
+};
+
+struct snapshot_device {
+        uint64_t id_off;
+        uint64_t data_off;
+        uint64_t data_len;
+};
+
+struct snapshot_tag {
+        uint64_t name_off;
+        uint64_t devices_first;
+        uint64_t devices_count;
+};
+
+/* Every thread maps the snapshot on its own, the mapping is released
+ * when the thread exits */
+struct snapshot_mapping {
+        void *map;
+        size_t size;
+        usec_t checked;
+};
+
+static pthread_once_t snapshot_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t snapshot_key;
+static bool snapshot_key_initialized = false;
+
+static thread_local struct snapshot_mapping *snapshot = NULL;
+
+static void snapshot_mapping_free(void *p) {
+        struct snapshot_mapping *m = p;
+
+        if (m->map)
+                munmap(m->map, m->size);
+        free(m);
+
+        snapshot = NULL;
+}
+
+static void snapshot_key_init(void) {
+        snapshot_key_initialized = pthread_key_create(&snapshot_key, snapshot_mapping_free) == 0;
+}
+
+static void _destructor_ snapshot_key_done(void) {
+        if (snapshot_key_initialized)
+                pthread_key_delete(snapshot_key);
+}
+
+static struct snapshot_mapping *snapshot_mapping_get(void) {
+        struct snapshot_mapping *m;
+
+        if (snapshot)
+                return snapshot;
+
+        assert_se(pthread_once(&snapshot_key_once, snapshot_key_init) == 0);
+        if (!snapshot_key_initialized)
+                return NULL;
+
+        m = new0(struct snapshot_mapping, 1);
+        if (!m)
+                return NULL;
+
+        if (pthread_setspecific(snapshot_key, m) != 0) {
+                free(m);
+                return NULL;
+        }
+
+        snapshot = m;
+        return m;
+}
+
+static const char *snapshot_str(const struct snapshot_header *h, uint64_t off) {
+        if (off >= h->strings_len)
+                return NULL;
+
+        return (const char *) h + h->strings_off + off;
+}
+
+static bool snapshot_section_valid(uint64_t off, uint64_t count, size_t size, uint64_t file_size) {
+        if (off % 8 != 0 || off > file_size)
+                return false;
+
+        return count <= (file_size - off) / size;
+}
+
+static bool snapshot_valid(const void *map, size_t size) {
+        const char sig[] = SNAPSHOT_SIG;
+        const struct snapshot_header *h = map;
+
+        if (memcmp(h->signature, sig, sizeof(h->signature)) != 0 ||
+            h->file_size != size ||
+            h->header_size != sizeof(struct snapshot_header) ||
+            h->stale != 0)
+                return false;
+
+        if (!snapshot_section_valid(h->devices_off, h->devices_count, sizeof(struct snapshot_device), size) ||
+            !snapshot_section_valid(h->tags_off, h->tags_count, sizeof(struct snapshot_tag), size) ||
+            !snapshot_section_valid(h->tag_devices_off, h->tag_devices_count, sizeof(uint64_t), size) ||
+            !snapshot_section_valid(h->strings_off, h->strings_len, 1, size))
+                return false;
+
+        /* all strings are terminated, the last one at the end of the file */
+        return h->strings_len > 0 && ((const char *) map)[h->strings_off + h->strings_len - 1] == '\0';
+}
+
+static const struct snapshot_header *snapshot_get(void) {
+        _cleanup_close_ int fd = -1;
+        struct snapshot_mapping *m;
+        struct stat st;
+        void *map;
+        usec_t n;
+
+        m = snapshot_mapping_get();
+        if (!m)
+                return NULL;
+
+        if (m->map) {
+                const struct snapshot_header *h = m->map;
+
+                if (*(volatile const uint64_t *) &h->stale == 0)
+                        return h;
+
+                /* the database is changing or the snapshot was
+                 * replaced, look for a new one right away */
+                munmap(m->map, m->size);
+                m->map = NULL;
+                m->checked = 0;
+        }
+
+        n = now(CLOCK_MONOTONIC);
+        if (m->checked > 0 && n < m->checked + SNAPSHOT_RETRY_USEC)
+                return NULL;
+        m->checked = n;
+
+        fd = open(DEVICE_DB_SNAPSHOT_PATH, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+                return NULL;
+
+        if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct snapshot_header))
+                return NULL;
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+                return NULL;
+
+        if (!snapshot_valid(map, st.st_size)) {
+                munmap(map, st.st_size);
+                return NULL;
+        }
+
+        m->map = map;
+        m->size = st.st_size;
+
+        return map;
+}
+
+static const struct snapshot_device *snapshot_find_device(const struct snapshot_header *h, const char *id) {
+        const struct snapshot_device *devices = (const struct snapshot_device *) ((const uint8_t *) h + h->devices_off);
+        size_t lo = 0, hi = h->devices_count;
+
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                const char *s;
+                int c;
+
+                s = snapshot_str(h, devices[mid].id_off);
+                if (!s)
+                        return NULL;
+
+                c = strcmp(id, s);
+                if (c == 0)
+                        return &devices[mid];
+                if (c < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+
+        return NULL;
+}
+
+static const struct snapshot_tag *snapshot_find_tag(const struct snapshot_header *h, const char *name) {
+        const struct snapshot_tag *tags = (const struct snapshot_tag *) ((const uint8_t *) h + h->tags_off);
+        size_t lo = 0, hi = h->tags_count;
+
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                const char *s;
+                int c;
+
+                s = snapshot_str(h, tags[mid].name_off);
+                if (!s)
+                        return NULL;
+
+                c = strcmp(name, s);
+                if (c == 0)
+                        return &tags[mid];
+                if (c < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+
+        return NULL;
+}
+
+int device_db_read(const char *id, char **ret, size_t *ret_len) {
+        const struct snapshot_header *h;
+        char *path;
+
+        assert(id);
+        assert(ret);
+        assert(ret_len);
+
+        h = snapshot_get();
+        if (h) {
+                const struct snapshot_device *d;
+                char *data;
+
+                d = snapshot_find_device(h, id);
+                if (!d)
+                        return -ENOENT;
+
+                if (d->data_len < h->strings_len &&
+                    d->data_off < h->strings_len - d->data_len) {
+                        /* copy the terminating NUL too */
+                        data = memdup(snapshot_str(h, d->data_off), d->data_len + 1);
+                        if (!data)
+                                return -ENOMEM;
+
+                        *ret = data;
+                        *ret_len = d->data_len;
+                        return 0;
+                }
+        }
+
+        path = strjoina("/run/udev/data/", id);
+
+        return read_full_file(path, ret, ret_len);
+}
+
+int device_db_snapshot_get_tag(const char *tag, char ***ret) {
+        const struct snapshot_header *h;
+        const struct snapshot_tag *t;
+        const uint64_t *tag_devices;
+        char **ids;
+        uint64_t i;
+
+        assert(tag);
+        assert(ret);
+
+        h = snapshot_get();
+        if (!h)
+                return 0;
+
+        t = snapshot_find_tag(h, tag);
+        if (!t) {
+                ids = strv_new(NULL, NULL);
+                if (!ids)
+                        return -ENOMEM;
+
+                *ret = ids;
+                return 1;
+        }
+
+        if (t->devices_first > h->tag_devices_count ||
+            t->devices_count > h->tag_devices_count - t->devices_first)
+                return 0;
+
+        ids = new0(char *, t->devices_count + 1);
+        if (!ids)
+                return -ENOMEM;
+
+        tag_devices = (const uint64_t *) ((const uint8_t *) h + h->tag_devices_off) + t->devices_first;
+        for (i = 0; i < t->devices_count; i++) {
+                const char *id;
+
+                id = snapshot_str(h, tag_devices[i]);
+                if (!id) {
+                        strv_free(ids);
+                        return 0;
+                }
+
+                ids[i] = strdup(id);
+                if (!ids[i]) {
+                        strv_free(ids);
+                        return -ENOMEM;
+                }
+        }
+
+        *ret = ids;
+        return 1;
+}
+
+void device_db_snapshot_invalidate(void) {
+        static const uint64_t stale = 1;
+        _cleanup_close_ int fd = -1;
+
+        fd = open(DEVICE_DB_SNAPSHOT_PATH, O_WRONLY|O_CLOEXEC);
+        if (fd < 0) {
+                if (errno != ENOENT)
+                        log_debug_errno(errno, "sd-device: could not open "DEVICE_DB_SNAPSHOT_PATH": %m");
+                return;
+        }
+
+        if (pwrite(fd, &stale, sizeof(stale), offsetof(struct snapshot_header, stale)) != sizeof(stale))
+                log_debug_errno(errno, "sd-device: could not invalidate "DEVICE_DB_SNAPSHOT_PATH": %m");
+}
+
+struct device_entry {
+        char *id;
+        char *data;
+        size_t data_len;
+};
+
+struct tag_entry {
+        char *name;
+        char **ids;
+};
+
+struct string_buffer {
+        char *buf;
+        size_t len, allocated;
+};
+
+/* Appends the string and its terminating NUL, returns its offset */
+static ssize_t string_buffer_add(struct string_buffer *b, const char *s, size_t len) {
+        size_t off = b->len;
+
+        if (!GREEDY_REALLOC(b->buf, b->allocated, b->len + len + 1))
+                return -ENOMEM;
+
+        memcpy(b->buf + off, s, len);
+        b->buf[off + len] = '\0';
+        b->len += len + 1;
+
+        return off;
+}
+
+static int device_entry_compare(const void *_a, const void *_b) {
+        const struct device_entry *a = _a, *b = _b;
+
+        return strcmp(a->id, b->id);
+}
+
+static int tag_entry_compare(const void *_a, const void *_b) {
+        const struct tag_entry *a = _a, *b = _b;
+
+        return strcmp(a->name, b->name);
+}
+
+static int snapshot_read_devices(struct device_entry **devices, size_t *n_devices, size_t *n_allocated) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        struct dirent *dent;
+
+        dir = opendir("/run/udev/data");
+        if (!dir)
+                return errno == ENOENT ? 0 : -errno;
+
+        FOREACH_DIRENT_ALL(dent, dir, return -errno) {
+                struct device_entry *e;
+                char *path;
+                int r;
+
+                /* skip files in the process of being written */
+                if (dent->d_name[0] == '.')
+                        continue;
+
+                if (!GREEDY_REALLOC(*devices, *n_allocated, *n_devices + 1))
+                        return -ENOMEM;
+
+                e = &(*devices)[*n_devices];
+                zero(*e);
+
+                path = strjoina("/run/udev/data/", dent->d_name);
+                r = read_full_file(path, &e->data, &e->data_len);
+                if (r == -ENOENT)
+                        continue;
+                if (r < 0)
+                        return r;
+
+                e->id = strdup(dent->d_name);
+                if (!e->id) {
+                        free(e->data);
+                        return -ENOMEM;
+                }
+
+                (*n_devices)++;
+        }
+
+        return 0;
+}
+
+static int snapshot_read_tags(struct tag_entry **tags, size_t *n_tags, size_t *n_allocated) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        struct dirent *dent;
+
+        dir = opendir("/run/udev/tags");
+        if (!dir)
+                return errno == ENOENT ? 0 : -errno;
+
+        FOREACH_DIRENT_ALL(dent, dir, return -errno) {
+                _cleanup_closedir_ DIR *tag_dir = NULL;
+                struct tag_entry *e;
+                struct dirent *tag_dent;
+                int fd;
+
+                if (dent->d_name[0] == '.')
+                        continue;
+
+                fd = openat(dirfd(dir), dent->d_name, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC);
+                if (fd < 0)
+                        continue;
+
+                tag_dir = fdopendir(fd);
+                if (!tag_dir) {
+                        safe_close(fd);
+                        return -errno;
+                }
+
+                if (!GREEDY_REALLOC(*tags, *n_allocated, *n_tags + 1))
+                        return -ENOMEM;
+
+                e = &(*tags)[*n_tags];
+                zero(*e);
+
+                e->name = strdup(dent->d_name);
+                if (!e->name)
+                        return -ENOMEM;
+                (*n_tags)++;
+
+                FOREACH_DIRENT_ALL(tag_dent, tag_dir, return -errno) {
+                        if (tag_dent->d_name[0] == '.')
+                                continue;
+
+                        if (strv_extend(&e->ids, tag_dent->d_name) < 0)
+                                return -ENOMEM;
+                }
+
+                strv_sort(e->ids);
+        }
+
+        return 0;
+}
+
+int device_db_snapshot_write(void) {
+        struct snapshot_header h = {
+                .signature = SNAPSHOT_SIG,
+                .header_size = sizeof(struct snapshot_header),
+        };
+        static const uint8_t padding[8] = {};
+        struct device_entry *devices = NULL;
+        struct tag_entry *tags = NULL;
+        size_t n_devices = 0, n_devices_allocated = 0, n_tags = 0, n_tags_allocated = 0;
+        struct snapshot_device *devices_f = NULL;
+        struct snapshot_tag *tags_f = NULL;
+        uint64_t *tag_devices_f = NULL;
+        struct string_buffer strings = {};
+        _cleanup_free_ char *path_tmp = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t i, j, k;
+        int r;
+
+        r = snapshot_read_devices(&devices, &n_devices, &n_devices_allocated);
+        if (r < 0)
+                goto finish;
+
+        r = snapshot_read_tags(&tags, &n_tags, &n_tags_allocated);
+        if (r < 0)
+                goto finish;
+
+        qsort_safe(devices, n_devices, sizeof(struct device_entry), device_entry_compare);
+        qsort_safe(tags, n_tags, sizeof(struct tag_entry), tag_entry_compare);
+
+        h.devices_count = n_devices;
+        h.tags_count = n_tags;
+        for (i = 0; i < n_tags; i++)
+                h.tag_devices_count += strv_length(tags[i].ids);
+
+        devices_f = new0(struct snapshot_device, n_devices);
+        tags_f = new0(struct snapshot_tag, n_tags);
+        tag_devices_f = new0(uint64_t, h.tag_devices_count);
+        if ((n_devices > 0 && !devices_f) ||
+            (n_tags > 0 && !tags_f) ||
+            (h.tag_devices_count > 0 && !tag_devices_f)) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        for (i = 0; i < n_devices; i++) {
+                ssize_t id_off, data_off;
+
+                id_off = string_buffer_add(&strings, devices[i].id, strlen(devices[i].id));
+                data_off = string_buffer_add(&strings, devices[i].data, devices[i].data_len);
+                if (id_off < 0 || data_off < 0) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                devices_f[i].id_off = id_off;
+                devices_f[i].data_off = data_off;
+                devices_f[i].data_len = devices[i].data_len;
+        }
+
+        for (i = 0, k = 0; i < n_tags; i++) {
+                ssize_t name_off;
+
+                name_off = string_buffer_add(&strings, tags[i].name, strlen(tags[i].name));
+                if (name_off < 0) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                tags_f[i].name_off = name_off;
+                tags_f[i].devices_first = k;
+                tags_f[i].devices_count = strv_length(tags[i].ids);
+
+                for (j = 0; j < tags_f[i].devices_count; j++, k++) {
+                        ssize_t id_off;
+
+                        id_off = string_buffer_add(&strings, tags[i].ids[j], strlen(tags[i].ids[j]));
+                        if (id_off < 0) {
+                                r = -ENOMEM;
+                                goto finish;
+                        }
+
+                        tag_devices_f[k] = id_off;
+                }
+        }
+
+        h.devices_off = ALIGN8(sizeof(struct snapshot_header));
+        h.tags_off = ALIGN8(h.devices_off + n_devices * sizeof(struct snapshot_device));
+        h.tag_devices_off = ALIGN8(h.tags_off + n_tags * sizeof(struct snapshot_tag));
+        h.strings_off = ALIGN8(h.tag_devices_off + h.tag_devices_count * sizeof(uint64_t));
+        h.strings_len = strings.len;
+        h.file_size = h.strings_off + h.strings_len;
+
+        r = fopen_temporary(DEVICE_DB_SNAPSHOT_PATH, &f, &path_tmp);
+        if (r < 0)
+                goto finish;
+        fchmod(fileno(f), 0644);
+
+        fwrite(&h, sizeof(struct snapshot_header), 1, f);
+        fwrite(padding, 1, h.devices_off - sizeof(struct snapshot_header), f);
+        fwrite(devices_f, sizeof(struct snapshot_device), n_devices, f);
+        fwrite(padding, 1, h.tags_off - (h.devices_off + n_devices * sizeof(struct snapshot_device)), f);
+        fwrite(tags_f, sizeof(struct snapshot_tag), n_tags, f);
+        fwrite(padding, 1, h.tag_devices_off - (h.tags_off + n_tags * sizeof(struct snapshot_tag)), f);
+        fwrite(tag_devices_f, sizeof(uint64_t), h.tag_devices_count, f);
+        fwrite(padding, 1, h.strings_off - (h.tag_devices_off + h.tag_devices_count * sizeof(uint64_t)), f);
+        fwrite(strings.buf, 1, strings.len, f);
+
+        r = fflush_and_check(f);
+        if (r < 0) {
+                unlink_noerrno(path_tmp);
+                goto finish;
+        }
+
+        /* readers of the old snapshot look for the new one */
+        device_db_snapshot_invalidate();
+
+        if (rename(path_tmp, DEVICE_DB_SNAPSHOT_PATH) < 0) {
+                r = -errno;
+                unlink_noerrno(path_tmp);
+                goto finish;
+        }
+
+        log_debug("sd-device: wrote "DEVICE_DB_SNAPSHOT_PATH" with %zu devices and %zu tags, %"PRIu64" bytes",
+                  n_devices, n_tags, h.file_size);
+        r = 0;
+
+finish:
+        for (i = 0; i < n_devices; i++) {
+                free(devices[i].id);
+                free(devices[i].data);
+        }
+        free(devices);
+
+        for (i = 0; i < n_tags; i++) {
+                free(tags[i].name);
+                strv_free(tags[i].ids);
+        }
+        free(tags);
+
+        free(devices_f);
+        free(tags_f);
+        free(tag_devices_f);
+        free(strings.buf);
+
+        return r;
+}
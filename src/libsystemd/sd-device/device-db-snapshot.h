@@ -0,0 +1,44 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stddef.h>
+
+/*
+ * The files in /run/udev/data/ and /run/udev/tags/ are the udev
+ * database. When udevd is idle, it may store a copy of all of it in
+ * a single file, which readers map once instead of opening a file per
+ * device. Every writer of the database marks the copy stale before
+ * changing any file, readers then fall back to the files.
+ */
+
+#define DEVICE_DB_SNAPSHOT_PATH "/run/udev/data.bin"
+
+/* Reads the database entry of the device with the given id, from the
+ * snapshot if it is current, from /run/udev/data/ otherwise. Returns
+ * -ENOENT if the device has no entry. */
+int device_db_read(const char *id, char **ret, size_t *ret_len);
+
+/* Returns 1 and the ids of all devices with the tag, if the snapshot
+ * is current, 0 otherwise. */
+int device_db_snapshot_get_tag(const char *tag, char ***ret);
+
+void device_db_snapshot_invalidate(void);
+int device_db_snapshot_write(void);
@@ -27,6 +27,7 @@
 
 #include "device-util.h"
 #include "device-enumerator-private.h"
+#include "device-db-snapshot.h"
 
 #define DEVICE_ENUMERATE_MAX_DEPTH 256
 
@@ -462,6 +463,45 @@ static bool match_sysname(sd_device_enumerator *enumerator, const char *sysname)
         return false;
 }
 
+/* Returns > 0 if the device must be skipped because udev did not
+ * handle it yet. Only looks at the device when uninitialized devices
+ * are not wanted, which saves reading its uevent file and its database
+ * entry otherwise. */
+static int device_is_unwanted_uninitialized(sd_device_enumerator *enumerator, sd_device *device) {
+        dev_t devnum;
+        int ifindex, initialized, r;
+
+        assert(enumerator);
+        assert(device);
+
+        if (enumerator->match_allow_uninitialized)
+                return 0;
+
+        r = sd_device_get_devnum(device, &devnum);
+        if (r < 0)
+                return r;
+
+        r = sd_device_get_ifindex(device, &ifindex);
+        if (r < 0)
+                return r;
+
+        r = sd_device_get_is_initialized(device, &initialized);
+        if (r < 0)
+                return r;
+
+        /*
+         * All devices with a device node or network interfaces
+         * possibly need udev to adjust the device node permission
+         * or context, or rename the interface before it can be
+         * reliably used from other processes.
+         *
+         * For now, we can only check these types of devices, we
+         * might not store a database, and have no way to find out
+         * for all other types of devices.
+         */
+        return !initialized && (major(devnum) > 0 || ifindex > 0);
+}
+
 static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator, const char *basedir, const char *subdir1, const char *subdir2) {
         _cleanup_closedir_ DIR *dir = NULL;
         char *path;
@@ -486,8 +526,7 @@ static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator,
         FOREACH_DIRENT_ALL(dent, dir, return -errno) {
                 _cleanup_device_unref_ sd_device *device = NULL;
                 char syspath[strlen(path) + 1 + strlen(dent->d_name) + 1];
-                dev_t devnum;
-                int ifindex, initialized, k;
+                int k;
 
                 if (dent->d_name[0] == '.')
                         continue;
@@ -506,40 +545,15 @@ static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator,
                         continue;
                 }
 
-                k = sd_device_get_devnum(device, &devnum);
-                if (k < 0) {
-                        r = k;
-                        continue;
-                }
-
-                k = sd_device_get_ifindex(device, &ifindex);
-                if (k < 0) {
-                        r = k;
+                if (!match_parent(enumerator, device))
                         continue;
-                }
 
-                k = sd_device_get_is_initialized(device, &initialized);
+                k = device_is_unwanted_uninitialized(enumerator, device);
                 if (k < 0) {
                         r = k;
                         continue;
                 }
-
-                /*
-                 * All devices with a device node or network interfaces
-                 * possibly need udev to adjust the device node permission
-                 * or context, or rename the interface before it can be
-                 * reliably used from other processes.
-                 *
-                 * For now, we can only check these types of devices, we
-                 * might not store a database, and have no way to find out
-                 * for all other types of devices.
-                 */
-                if (!enumerator->match_allow_uninitialized &&
-                    !initialized &&
-                    (major(devnum) > 0 || ifindex > 0))
-                        continue;
-
-                if (!match_parent(enumerator, device))
+                if (k > 0)
                         continue;
 
                 if (!match_tag(enumerator, device))
@@ -613,15 +627,69 @@ static int enumerator_scan_dir(sd_device_enumerator *enumerator, const char *bas
         return r;
 }
 
+static int enumerator_add_tagged_device(sd_device_enumerator *enumerator, const char *id) {
+        _cleanup_device_unref_ sd_device *device = NULL;
+        const char *subsystem, *sysname;
+        int r;
+
+        r = sd_device_new_from_device_id(&device, id);
+        if (r == -ENODEV)
+                /* this is necessarily racy, so ignore missing devices */
+                return 0;
+        if (r < 0)
+                return r;
+
+        r = sd_device_get_sysname(device, &sysname);
+        if (r < 0)
+                return r;
+
+        if (!match_sysname(enumerator, sysname))
+                return 0;
+
+        r = sd_device_get_subsystem(device, &subsystem);
+        if (r < 0)
+                return r;
+
+        if (!match_subsystem(enumerator, subsystem))
+                return 0;
+
+        if (!match_parent(enumerator, device))
+                return 0;
+
+        if (!match_property(enumerator, device))
+                return 0;
+
+        if (!match_sysattr(enumerator, device))
+                return 0;
+
+        return device_enumerator_add_device(enumerator, device);
+}
+
 static int enumerator_scan_devices_tag(sd_device_enumerator *enumerator, const char *tag) {
         _cleanup_closedir_ DIR *dir = NULL;
-        char *path;
+        _cleanup_strv_free_ char **ids = NULL;
+        char *path, **id;
         struct dirent *dent;
-        int r = 0;
+        int r = 0, k;
 
         assert(enumerator);
         assert(tag);
 
+        /* TODO: filter away subsystems? */
+
+        k = device_db_snapshot_get_tag(tag, &ids);
+        if (k < 0)
+                return k;
+        if (k > 0) {
+                STRV_FOREACH(id, ids) {
+                        k = enumerator_add_tagged_device(enumerator, *id);
+                        if (k < 0)
+                                r = k;
+                }
+
+                return r;
+        }
+
         path = strjoina("/run/udev/tags/", tag);
 
         dir = opendir(path);
@@ -634,57 +702,13 @@ static int enumerator_scan_devices_tag(sd_device_enumerator *enumerator, const c
                 }
         }
 
-        /* TODO: filter away subsystems? */
-
         FOREACH_DIRENT_ALL(dent, dir, return -errno) {
-                _cleanup_device_unref_ sd_device *device = NULL;
-                const char *subsystem, *sysname;
-                int k;
-
                 if (dent->d_name[0] == '.')
                         continue;
 
-                k = sd_device_new_from_device_id(&device, dent->d_name);
-                if (k < 0) {
-                        if (k != -ENODEV)
-                                /* this is necessarily racy, so ignore missing devices */
-                                r = k;
-
-                        continue;
-                }
-
-                k = sd_device_get_subsystem(device, &subsystem);
-                if (k < 0) {
-                        r = k;
-                        continue;
-                }
-
-                if (!match_subsystem(enumerator, subsystem))
-                        continue;
-
-                k = sd_device_get_sysname(device, &sysname);
-                if (k < 0) {
-                        r = k;
-                        continue;
-                }
-
-                if (!match_sysname(enumerator, sysname))
-                        continue;
-
-                if (!match_parent(enumerator, device))
-                        continue;
-
-                if (!match_property(enumerator, device))
-                        continue;
-
-                if (!match_sysattr(enumerator, device))
-                        continue;
-
-                k = device_enumerator_add_device(enumerator, device);
-                if (k < 0) {
+                k = enumerator_add_tagged_device(enumerator, dent->d_name);
+                if (k < 0)
                         r = k;
-                        continue;
-                }
         }
 
         return r;
@@ -718,20 +742,20 @@ static int parent_add_child(sd_device_enumerator *enumerator, const char *path)
         else if (r < 0)
                 return r;
 
-        r = sd_device_get_subsystem(device, &subsystem);
-        if (r == -ENOENT)
-                return 0;
+        r = sd_device_get_sysname(device, &sysname);
         if (r < 0)
                 return r;
 
-        if (!match_subsystem(enumerator, subsystem))
+        if (!match_sysname(enumerator, sysname))
                 return 0;
 
-        r = sd_device_get_sysname(device, &sysname);
+        r = sd_device_get_subsystem(device, &subsystem);
+        if (r == -ENOENT)
+                return 0;
         if (r < 0)
                 return r;
 
-        if (!match_sysname(enumerator, sysname))
+        if (!match_subsystem(enumerator, subsystem))
                 return 0;
 
         if (!match_property(enumerator, device))
@@ -38,6 +38,7 @@
 #include "device-util.h"
 #include "device-internal.h"
 #include "device-private.h"
+#include "device-db-snapshot.h"
 
 int device_add_property(sd_device *device, const char *key, const char *value) {
         int r;
@@ -170,7 +171,6 @@ int device_ensure_usec_initialized(sd_device *device, sd_device *device_old) {
 
 static int device_read_db(sd_device *device) {
         _cleanup_free_ char *db = NULL;
-        char *path;
         const char *id, *value;
         char key;
         size_t db_len;
@@ -194,14 +194,12 @@ static int device_read_db(sd_device *device) {
         if (r < 0)
                 return r;
 
-        path = strjoina("/run/udev/data/", id);
-
-        r = read_full_file(path, &db, &db_len);
+        r = device_db_read(id, &db, &db_len);
         if (r < 0) {
                 if (r == -ENOENT)
                         return 0;
                 else {
-                        log_debug("sd-device: failed to read db '%s': %s", path, strerror(-r));
+                        log_debug("sd-device: failed to read db '%s': %s", id, strerror(-r));
                         return r;
                 }
         }
@@ -938,6 +936,8 @@ int device_tag_index(sd_device *device, sd_device *device_old, bool add) {
         const char *tag;
         int r = 0, k;
 
+        device_db_snapshot_invalidate();
+
         if (add && device_old) {
                 /* delete possible left-over tags */
                 FOREACH_DEVICE_TAG(device_old, tag) {
@@ -1003,6 +1003,8 @@ int device_update_db(sd_device *device) {
 
         path = strjoina("/run/udev/data/", id);
 
+        device_db_snapshot_invalidate();
+
         /* do not store anything for otherwise empty devices */
         if (!has_info && major(device->devnum) == 0 && device->ifindex == 0) {
                 r = unlink(path);
@@ -1101,6 +1103,8 @@ int device_delete_db(sd_device *device) {
 
         path = strjoina("/run/udev/data/", id);
 
+        device_db_snapshot_invalidate();
+
         r = unlink(path);
         if (r < 0 && errno != ENOENT)
                 return -errno;
@@ -36,6 +36,7 @@
 #include "device-util.h"
 #include "device-private.h"
 #include "device-internal.h"
+#include "device-db-snapshot.h"
 
 int device_new_aux(sd_device **ret) {
         _cleanup_device_unref_ sd_device *device = NULL;
@@ -1241,7 +1242,6 @@ int device_get_id_filename(sd_device *device, const char **ret) {
 
 int device_read_db_aux(sd_device *device, bool force) {
         _cleanup_free_ char *db = NULL;
-        char *path;
         const char *id, *value;
         char key;
         size_t db_len;
@@ -1265,14 +1265,12 @@ int device_read_db_aux(sd_device *device, bool force) {
         if (r < 0)
                 return r;
 
-        path = strjoina("/run/udev/data/", id);
-
-        r = read_full_file(path, &db, &db_len);
+        r = device_db_read(id, &db, &db_len);
         if (r < 0) {
                 if (r == -ENOENT)
                         return 0;
                 else {
-                        log_debug("sd-device: failed to read db '%s': %s", path, strerror(-r));
+                        log_debug("sd-device: failed to read db '%s': %s", id, strerror(-r));
                         return r;
                 }
         }
@@ -0,0 +1,502 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+
+#include "list.h"
+#include "event-executor.h"
+
+typedef struct EventQueueEntry EventQueueEntry;
+
+struct EventQueueEntry {
+        EventQueueEntry *next;
+        event_queue_handler_t handler;
+        void *userdata;
+};
+
+struct EventQueue {
+        sd_event_source *source;
+        int fd;
+
+        /* Pushed to by any thread, taken as a whole by the loop */
+        EventQueueEntry *head;
+
+        /* Taken from head, in posting order, being dispatched */
+        EventQueueEntry *ready;
+
+        bool dispatching:1;
+};
+
+typedef struct EventWork EventWork;
+
+struct EventWork {
+        /* Must be first, the queue frees the entry when done */
+        EventQueueEntry entry;
+
+        event_work_handler_t work;
+        event_work_done_t done;
+        void *userdata;
+        int result;
+
+        LIST_FIELDS(EventWork, work);
+};
+
+struct EventExecutor {
+        EventQueue *completions;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        /* Protected by the mutex */
+        LIST_HEAD(EventWork, work);
+        EventWork *work_tail;
+        unsigned n_queued;
+        unsigned n_idle;
+        bool shutdown;
+
+        pthread_t *threads;
+        unsigned n_threads, n_threads_max;
+};
+
+static void queue_push(EventQueue *q, EventQueueEntry *entry) {
+        EventQueueEntry *head;
+
+        head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        do
+                entry->next = head;
+        while (!__atomic_compare_exchange_n(&q->head, &head, entry, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        /* Only the first entry on an empty list needs to wake up the
+         * loop, everything after it will be picked up together with
+         * it. The write can only fail if the counter is about to
+         * overflow, in which case the fd is readable anyway. */
+        if (!head)
+                (void) eventfd_write(q->fd, 1);
+}
+
+static void queue_flush(EventQueue *q) {
+        EventQueueEntry *list, *entry;
+        eventfd_t v;
+
+        assert(q);
+
+        /* Reset the counter before taking the list, so that an entry
+         * pushed in between is never left without a wake-up */
+        (void) eventfd_read(q->fd, &v);
+
+        /* The list is pushed to in LIFO order, turn it around, and
+         * put it behind what is left over from a previous round */
+        list = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+        if (list) {
+                EventQueueEntry *reversed = NULL, **tail;
+
+                while (list) {
+                        entry = list;
+                        list = entry->next;
+                        entry->next = reversed;
+                        reversed = entry;
+                }
+
+                for (tail = &q->ready; *tail; tail = &(*tail)->next)
+                        ;
+                *tail = reversed;
+        }
+
+        q->dispatching = true;
+
+        while ((entry = q->ready)) {
+                q->ready = entry->next;
+
+                entry->handler(entry->userdata);
+                free(entry);
+        }
+
+        q->dispatching = false;
+}
+
+static int queue_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        EventQueue *q = userdata;
+
+        assert(q);
+
+        queue_flush(q);
+        return 0;
+}
+
+int event_queue_new(sd_event *e, EventQueue **ret) {
+        _cleanup_event_queue_free_ EventQueue *q = NULL;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(ret, -EINVAL);
+
+        q = new0(EventQueue, 1);
+        if (!q)
+                return -ENOMEM;
+
+        q->fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (q->fd < 0) {
+                q->fd = -1;
+                return -errno;
+        }
+
+        r = sd_event_add_io(e, &q->source, q->fd, EPOLLIN, queue_io_handler, q);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(q->source, "event-queue");
+
+        *ret = q;
+        q = NULL;
+
+        return 0;
+}
+
+EventQueue *event_queue_free(EventQueue *q) {
+        EventQueueEntry *list, *entry;
+
+        if (!q)
+                return NULL;
+
+        /* Entries that were never dispatched are dropped. Callers
+         * have to make sure nobody posts anymore at this point. */
+        assert(!q->dispatching);
+
+        list = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+        while ((entry = list)) {
+                list = entry->next;
+                free(entry);
+        }
+
+        while ((entry = q->ready)) {
+                q->ready = entry->next;
+                free(entry);
+        }
+
+        sd_event_source_unref(q->source);
+        safe_close(q->fd);
+        free(q);
+
+        return NULL;
+}
+
+int event_queue_set_priority(EventQueue *q, int64_t priority) {
+        assert_return(q, -EINVAL);
+
+        return sd_event_source_set_priority(q->source, priority);
+}
+
+int event_queue_post(EventQueue *q, event_queue_handler_t handler, void *userdata) {
+        EventQueueEntry *entry;
+
+        assert_return(q, -EINVAL);
+        assert_return(handler, -EINVAL);
+
+        entry = new(EventQueueEntry, 1);
+        if (!entry)
+                return -ENOMEM;
+
+        entry->handler = handler;
+        entry->userdata = userdata;
+
+        queue_push(q, entry);
+
+        return 0;
+}
+
+static void work_complete(void *userdata) {
+        EventWork *w = userdata;
+
+        /* The entry itself is freed by the queue */
+        if (w->done)
+                w->done(w->result, w->userdata);
+}
+
+static void *executor_thread(void *p) {
+        EventExecutor *x = p;
+        sigset_t fullset;
+
+        /* No signals in this thread please, they are handled by the
+         * loop through signalfd */
+        assert_se(sigfillset(&fullset) == 0);
+        assert_se(pthread_sigmask(SIG_BLOCK, &fullset, NULL) == 0);
+
+        prctl(PR_SET_NAME, (unsigned long) "sd-executor");
+
+        assert_se(pthread_mutex_lock(&x->mutex) == 0);
+
+        for (;;) {
+                EventWork *w;
+
+                while (!x->work && !x->shutdown) {
+                        x->n_idle++;
+                        assert_se(pthread_cond_wait(&x->cond, &x->mutex) == 0);
+                        x->n_idle--;
+                }
+
+                /* On shutdown, finish what was submitted first */
+                w = x->work;
+                if (!w)
+                        break;
+
+                LIST_REMOVE(work, x->work, w);
+                if (x->work_tail == w)
+                        x->work_tail = NULL;
+                x->n_queued--;
+
+                assert_se(pthread_mutex_unlock(&x->mutex) == 0);
+
+                w->result = w->work(w->userdata);
+                queue_push(x->completions, &w->entry);
+
+                assert_se(pthread_mutex_lock(&x->mutex) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&x->mutex) == 0);
+
+        return NULL;
+}
+
+int event_executor_new(sd_event *e, unsigned n_threads, EventExecutor **ret) {
+        _cleanup_event_executor_free_ EventExecutor *x = NULL;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(n_threads > 0, -EINVAL);
+        assert_return(ret, -EINVAL);
+
+        x = new0(EventExecutor, 1);
+        if (!x)
+                return -ENOMEM;
+
+        x->n_threads_max = n_threads;
+
+        assert_se(pthread_mutex_init(&x->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&x->cond, NULL) == 0);
+
+        x->threads = new(pthread_t, n_threads);
+        if (!x->threads)
+                return -ENOMEM;
+
+        r = event_queue_new(e, &x->completions);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(x->completions->source, "event-executor");
+
+        *ret = x;
+        x = NULL;
+
+        return 0;
+}
+
+EventExecutor *event_executor_free(EventExecutor *x) {
+        unsigned i;
+
+        if (!x)
+                return NULL;
+
+        assert_se(pthread_mutex_lock(&x->mutex) == 0);
+        x->shutdown = true;
+        assert_se(pthread_cond_broadcast(&x->cond) == 0);
+        assert_se(pthread_mutex_unlock(&x->mutex) == 0);
+
+        for (i = 0; i < x->n_threads; i++)
+                assert_se(pthread_join(x->threads[i], NULL) == 0);
+
+        /* All work has been done by now, let the callers know, so
+         * that they can release whatever they passed in. This means
+         * the executor may not be freed from a completion handler. */
+        if (x->completions) {
+                queue_flush(x->completions);
+                event_queue_free(x->completions);
+        }
+
+        pthread_cond_destroy(&x->cond);
+        pthread_mutex_destroy(&x->mutex);
+
+        free(x->threads);
+        free(x);
+
+        return NULL;
+}
+
+int event_executor_set_priority(EventExecutor *x, int64_t priority) {
+        assert_return(x, -EINVAL);
+
+        return event_queue_set_priority(x->completions, priority);
+}
+
+int event_executor_submit(EventExecutor *x, event_work_handler_t work, event_work_done_t done, void *userdata) {
+        EventWork *w;
+        int r = 0;
+
+        assert_return(x, -EINVAL);
+        assert_return(work, -EINVAL);
+
+        w = new0(EventWork, 1);
+        if (!w)
+                return -ENOMEM;
+
+        w->entry.handler = work_complete;
+        w->entry.userdata = w;
+        w->work = work;
+        w->done = done;
+        w->userdata = userdata;
+
+        assert_se(pthread_mutex_lock(&x->mutex) == 0);
+
+        LIST_INSERT_AFTER(work, x->work, x->work_tail, w);
+        x->work_tail = w;
+        x->n_queued++;
+
+        /* Threads are started lazily, when there is more work queued
+         * than there are threads waiting for it */
+        if (x->n_queued > x->n_idle && x->n_threads < x->n_threads_max) {
+                r = -pthread_create(&x->threads[x->n_threads], NULL, executor_thread, x);
+                if (r == 0)
+                        x->n_threads++;
+                else if (x->n_threads > 0)
+                        /* The existing threads will get to it */
+                        r = 0;
+                else {
+                        LIST_REMOVE(work, x->work, w);
+                        x->work_tail = NULL;
+                        x->n_queued--;
+                }
+        }
+
+        if (r == 0)
+                assert_se(pthread_cond_signal(&x->cond) == 0);
+
+        assert_se(pthread_mutex_unlock(&x->mutex) == 0);
+
+        if (r < 0)
+                free(w);
+
+        return r;
+}
+
+typedef enum FileOpType {
+        FILE_OP_PREAD,
+        FILE_OP_PWRITE,
+        FILE_OP_FSYNC,
+        FILE_OP_FDATASYNC,
+} FileOpType;
+
+typedef struct FileOp {
+        FileOpType type;
+        int fd;
+        void *buf;
+        size_t size;
+        off_t offset;
+
+        event_work_done_t done;
+        void *userdata;
+} FileOp;
+
+static int file_op_work(void *userdata) {
+        FileOp *op = userdata;
+        ssize_t l;
+
+        switch (op->type) {
+
+        case FILE_OP_PREAD:
+                l = pread(op->fd, op->buf, op->size, op->offset);
+                break;
+
+        case FILE_OP_PWRITE:
+                l = pwrite(op->fd, op->buf, op->size, op->offset);
+                break;
+
+        case FILE_OP_FSYNC:
+                l = fsync(op->fd);
+                break;
+
+        case FILE_OP_FDATASYNC:
+                l = fdatasync(op->fd);
+                break;
+
+        default:
+                assert_not_reached("Unknown file operation");
+        }
+
+        if (l < 0)
+                return -errno;
+
+        /* Transfers are limited to INT_MAX bytes by the callers */
+        return (int) l;
+}
+
+static void file_op_done(int result, void *userdata) {
+        FileOp *op = userdata;
+
+        if (op->done)
+                op->done(result, op->userdata);
+
+        free(op);
+}
+
+static int file_op_submit(EventExecutor *x, FileOpType type, int fd, void *buf, size_t size, off_t offset, event_work_done_t done, void *userdata) {
+        FileOp *op;
+        int r;
+
+        assert_return(x, -EINVAL);
+        assert_return(fd >= 0, -EBADF);
+        assert_return(size <= INT_MAX, -EINVAL);
+
+        op = new(FileOp, 1);
+        if (!op)
+                return -ENOMEM;
+
+        *op = (FileOp) {
+                .type = type,
+                .fd = fd,
+                .buf = buf,
+                .size = size,
+                .offset = offset,
+                .done = done,
+                .userdata = userdata,
+        };
+
+        r = event_executor_submit(x, file_op_work, file_op_done, op);
+        if (r < 0)
+                free(op);
+
+        return r;
+}
+
+int event_executor_pread(EventExecutor *x, int fd, void *buf, size_t size, off_t offset, event_work_done_t done, void *userdata) {
+        assert_return(buf || size == 0, -EINVAL);
+
+        return file_op_submit(x, FILE_OP_PREAD, fd, buf, size, offset, done, userdata);
+}
+
+int event_executor_pwrite(EventExecutor *x, int fd, const void *buf, size_t size, off_t offset, event_work_done_t done, void *userdata) {
+        assert_return(buf || size == 0, -EINVAL);
+
+        return file_op_submit(x, FILE_OP_PWRITE, fd, (void*) buf, size, offset, done, userdata);
+}
+
+int event_executor_fsync(EventExecutor *x, int fd, bool data_only, event_work_done_t done, void *userdata) {
+        return file_op_submit(x, data_only ? FILE_OP_FDATASYNC : FILE_OP_FSYNC, fd, NULL, 0, 0, done, userdata);
+}
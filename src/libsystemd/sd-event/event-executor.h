@@ -0,0 +1,63 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "sd-event.h"
+
+/* An EventQueue is consumed by the event loop it was created on, and
+ * may be posted to from any thread, including ones running other
+ * event loops. Handlers run on the owning loop, in posting order. */
+typedef struct EventQueue EventQueue;
+
+typedef void (*event_queue_handler_t)(void *userdata);
+
+int event_queue_new(sd_event *e, EventQueue **ret);
+EventQueue *event_queue_free(EventQueue *q);
+
+int event_queue_set_priority(EventQueue *q, int64_t priority);
+int event_queue_post(EventQueue *q, event_queue_handler_t handler, void *userdata);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(EventQueue*, event_queue_free);
+#define _cleanup_event_queue_free_ _cleanup_(event_queue_freep)
+
+/* An EventExecutor runs blocking work on a small pool of threads,
+ * and calls the completion handler with the work's return value on
+ * the event loop it was created on. */
+typedef struct EventExecutor EventExecutor;
+
+typedef int (*event_work_handler_t)(void *userdata);
+typedef void (*event_work_done_t)(int result, void *userdata);
+
+int event_executor_new(sd_event *e, unsigned n_threads, EventExecutor **ret);
+EventExecutor *event_executor_free(EventExecutor *x);
+
+int event_executor_set_priority(EventExecutor *x, int64_t priority);
+int event_executor_submit(EventExecutor *x, event_work_handler_t work, event_work_done_t done, void *userdata);
+
+/* File operations that may block on storage. The fd and buffer must
+ * stay valid until the completion handler is called with the number
+ * of bytes transferred (or 0 for fsync) or a negative errno. */
+int event_executor_pread(EventExecutor *x, int fd, void *buf, size_t size, off_t offset, event_work_done_t done, void *userdata);
+int event_executor_pwrite(EventExecutor *x, int fd, const void *buf, size_t size, off_t offset, event_work_done_t done, void *userdata);
+int event_executor_fsync(EventExecutor *x, int fd, bool data_only, event_work_done_t done, void *userdata);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(EventExecutor*, event_executor_free);
+#define _cleanup_event_executor_free_ _cleanup_(event_executor_freep)
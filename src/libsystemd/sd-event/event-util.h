@@ -29,3 +29,8 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(sd_event_source*, sd_event_source_unref);
 
 #define _cleanup_event_unref_ _cleanup_(sd_event_unrefp)
 #define _cleanup_event_source_unref_ _cleanup_(sd_event_source_unrefp)
+
+/* Number of wakeups caused by timers, and of time sources that
+ * elapsed. Their difference is the number of wakeups saved by
+ * dispatching several time sources at once. */
+void event_get_timer_statistics(sd_event *e, uint64_t *wakeups, uint64_t *elapses);
@@ -34,11 +34,19 @@
 #include "set.h"
 #include "list.h"
 #include "signal-util.h"
+#include "mempool.h"
 
 #include "sd-event.h"
+#include "event-util.h"
 
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
 
+/* Upper bound for the number of sources sd_event_dispatch() will run
+ * in one go, so that a flood of events at one priority cannot delay
+ * the timer, watchdog and prepare processing of the next iteration
+ * for too long. */
+#define DISPATCH_BUDGET_MAX 256U
+
 typedef enum EventSourceType {
         SOURCE_IO,
         SOURCE_TIME_REALTIME,
@@ -94,6 +102,9 @@ struct sd_event_source {
 
         LIST_FIELDS(sd_event_source, sources);
 
+        /* Time sources only, see clock_data_flush() */
+        LIST_FIELDS(sd_event_source, dirty);
+
         union {
                 struct {
                         sd_event_io_handler_t callback;
@@ -107,6 +118,14 @@ struct sd_event_source {
                         usec_t next, accuracy;
                         unsigned earliest_index;
                         unsigned latest_index;
+
+                        /* What the prioqs are ordered by. Changes
+                         * to the fields above are only copied here,
+                         * and the prioqs reshuffled, right before
+                         * the prioqs are looked at. */
+                        usec_t queued_earliest, queued_latest;
+                        unsigned queued_class:2;
+                        bool queued_dirty:1;
                 } time;
                 struct {
                         sd_event_signal_handler_t callback;
@@ -147,6 +166,9 @@ struct clock_data {
         Prioq *latest;
         usec_t next;
 
+        /* Sources whose position in the prioqs is out of date */
+        LIST_HEAD(sd_event_source, dirty);
+
         bool needs_rearm:1;
 };
 
@@ -200,6 +222,10 @@ struct sd_event {
         usec_t timestamp_boottime;
         int state;
 
+        /* Wakeups caused by timers, and time sources that elapsed */
+        uint64_t n_timer_wakeups;
+        uint64_t n_timer_elapses;
+
         bool exit_requested:1;
         bool need_process_child:1;
         bool watchdog:1;
@@ -212,12 +238,18 @@ struct sd_event {
         usec_t watchdog_last, watchdog_period;
 
         unsigned n_sources;
+        unsigned dispatch_budget;
+
+        struct epoll_event *event_queue;
+        size_t event_queue_allocated;
 
         LIST_HEAD(sd_event_source, sources);
 };
 
 static void source_disconnect(sd_event_source *s);
 
+static DEFINE_MEMPOOL_THREADED(source_pool, sd_event_source, 64);
+
 static int pending_prioq_compare(const void *a, const void *b) {
         const sd_event_source *x = a, *y = b;
 
@@ -292,22 +324,17 @@ static int earliest_time_prioq_compare(const void *a, const void *b) {
         assert(EVENT_SOURCE_IS_TIME(x->type));
         assert(x->type == y->type);
 
-        /* Enabled ones first */
-        if (x->enabled != SD_EVENT_OFF && y->enabled == SD_EVENT_OFF)
+        /* Enabled ones first, then the pending ones, disabled ones
+         * at the end */
+        if (x->time.queued_class < y->time.queued_class)
                 return -1;
-        if (x->enabled == SD_EVENT_OFF && y->enabled != SD_EVENT_OFF)
-                return 1;
-
-        /* Move the pending ones to the end */
-        if (!x->pending && y->pending)
-                return -1;
-        if (x->pending && !y->pending)
+        if (x->time.queued_class > y->time.queued_class)
                 return 1;
 
         /* Order by time */
-        if (x->time.next < y->time.next)
+        if (x->time.queued_earliest < y->time.queued_earliest)
                 return -1;
-        if (x->time.next > y->time.next)
+        if (x->time.queued_earliest > y->time.queued_earliest)
                 return 1;
 
         /* Stability for the rest */
@@ -325,22 +352,17 @@ static int latest_time_prioq_compare(const void *a, const void *b) {
         assert(EVENT_SOURCE_IS_TIME(x->type));
         assert(x->type == y->type);
 
-        /* Enabled ones first */
-        if (x->enabled != SD_EVENT_OFF && y->enabled == SD_EVENT_OFF)
-                return -1;
-        if (x->enabled == SD_EVENT_OFF && y->enabled != SD_EVENT_OFF)
-                return 1;
-
-        /* Move the pending ones to the end */
-        if (!x->pending && y->pending)
+        /* Enabled ones first, then the pending ones, disabled ones
+         * at the end */
+        if (x->time.queued_class < y->time.queued_class)
                 return -1;
-        if (x->pending && !y->pending)
+        if (x->time.queued_class > y->time.queued_class)
                 return 1;
 
         /* Order by time */
-        if (x->time.next + x->time.accuracy < y->time.next + y->time.accuracy)
+        if (x->time.queued_latest < y->time.queued_latest)
                 return -1;
-        if (x->time.next + x->time.accuracy > y->time.next + y->time.accuracy)
+        if (x->time.queued_latest > y->time.queued_latest)
                 return 1;
 
         /* Stability for the rest */
@@ -352,6 +374,47 @@ static int latest_time_prioq_compare(const void *a, const void *b) {
         return 0;
 }
 
+static void time_source_sync(sd_event_source *s) {
+        assert(s);
+        assert(EVENT_SOURCE_IS_TIME(s->type));
+
+        s->time.queued_class = s->enabled == SD_EVENT_OFF ? 2 : s->pending ? 1 : 0;
+        s->time.queued_earliest = s->time.next;
+        s->time.queued_latest = s->time.next + s->time.accuracy;
+}
+
+static void time_source_changed(struct clock_data *d, sd_event_source *s) {
+        assert(d);
+        assert(s);
+
+        /* Time sources are often changed several times before the
+         * event loop looks at them again, for example when a timer
+         * is re-armed and re-enabled. Hence, don't reshuffle the
+         * prioqs right away, but only once, in clock_data_flush(). */
+
+        if (!s->time.queued_dirty) {
+                LIST_PREPEND(dirty, d->dirty, s);
+                s->time.queued_dirty = true;
+        }
+
+        d->needs_rearm = true;
+}
+
+static void clock_data_flush(struct clock_data *d) {
+        sd_event_source *s;
+
+        assert(d);
+
+        while ((s = d->dirty)) {
+                LIST_REMOVE(dirty, d->dirty, s);
+                s->time.queued_dirty = false;
+
+                time_source_sync(s);
+                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
+                prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        }
+}
+
 static int exit_prioq_compare(const void *a, const void *b) {
         const sd_event_source *x = a, *y = b;
 
@@ -422,6 +485,7 @@ static void event_free(sd_event *e) {
 
         hashmap_free(e->child_sources);
         set_free(e->post_sources);
+        free(e->event_queue);
         free(e);
 }
 
@@ -441,6 +505,7 @@ _public_ int sd_event_new(sd_event** ret) {
         e->realtime.wakeup = e->boottime.wakeup = e->monotonic.wakeup = e->realtime_alarm.wakeup = e->boottime_alarm.wakeup = WAKEUP_CLOCK_DATA;
         e->original_pid = getpid();
         e->perturb = USEC_INFINITY;
+        e->dispatch_budget = 1;
 
         e->pending = prioq_new(pending_prioq_compare);
         if (!e->pending) {
@@ -811,6 +876,11 @@ static void source_disconnect(sd_event_source *s) {
                 d = event_get_clock_data(s->event, s->type);
                 assert(d);
 
+                if (s->time.queued_dirty) {
+                        LIST_REMOVE(dirty, d->dirty, s);
+                        s->time.queued_dirty = false;
+                }
+
                 prioq_remove(d->earliest, s, &s->time.earliest_index);
                 prioq_remove(d->latest, s, &s->time.latest_index);
                 d->needs_rearm = true;
@@ -879,7 +949,7 @@ static void source_free(sd_event_source *s) {
 
         source_disconnect(s);
         free(s->description);
-        free(s);
+        mempool_threaded_free_tile(&source_pool, s);
 }
 
 static int source_set_pending(sd_event_source *s, bool b) {
@@ -910,9 +980,7 @@ static int source_set_pending(sd_event_source *s, bool b) {
                 d = event_get_clock_data(s->event, s->type);
                 assert(d);
 
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
+                time_source_changed(d, s);
         }
 
         if (s->type == SOURCE_SIGNAL && !b) {
@@ -931,7 +999,7 @@ static sd_event_source *source_new(sd_event *e, bool floating, EventSourceType t
 
         assert(e);
 
-        s = new0(sd_event_source, 1);
+        s = mempool_threaded_alloc0_tile(&source_pool);
         if (!s)
                 return NULL;
 
@@ -1105,6 +1173,7 @@ _public_ int sd_event_add_time(
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
+        time_source_sync(s);
         d->needs_rearm = true;
 
         r = prioq_put(d->earliest, s, &s->time.earliest_index);
@@ -1625,9 +1694,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         d = event_get_clock_data(s->event, s->type);
                         assert(d);
 
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        time_source_changed(d, s);
                         break;
                 }
 
@@ -1682,9 +1749,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         d = event_get_clock_data(s->event, s->type);
                         assert(d);
 
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        time_source_changed(d, s);
                         break;
                 }
 
@@ -1768,9 +1833,7 @@ _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
         d = event_get_clock_data(s->event, s->type);
         assert(d);
 
-        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        time_source_changed(d, s);
 
         return 0;
 }
@@ -1804,8 +1867,7 @@ _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec
         d = event_get_clock_data(s->event, s->type);
         assert(d);
 
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        time_source_changed(d, s);
 
         return 0;
 }
@@ -1957,13 +2019,62 @@ static usec_t sleep_between(sd_event *e, usec_t a, usec_t b) {
         return b;
 }
 
+static bool clock_data_window(struct clock_data *d, usec_t *a, usec_t *b) {
+        sd_event_source *x, *y;
+
+        assert(d);
+        assert(a);
+        assert(b);
+
+        /* Returns the window we may wake up in for this clock, if
+         * anything is scheduled on it */
+
+        clock_data_flush(d);
+
+        x = prioq_peek(d->earliest);
+        if (!x || x->enabled == SD_EVENT_OFF)
+                return false;
+
+        y = prioq_peek(d->latest);
+        assert_se(y && y->enabled != SD_EVENT_OFF);
+
+        *a = x->time.next;
+        *b = y->time.next + y->time.accuracy;
+        return true;
+}
+
+static int clock_data_arm(struct clock_data *d, usec_t t) {
+        struct itimerspec its = {};
+        int r;
+
+        assert(d);
+
+        if (d->next == t)
+                return 0;
+
+        assert_se(d->fd >= 0);
+
+        if (t == 0) {
+                /* We don' want to disarm here, just mean some time looooong ago. */
+                its.it_value.tv_sec = 0;
+                its.it_value.tv_nsec = 1;
+        } else
+                timespec_store(&its.it_value, t);
+
+        r = timerfd_settime(d->fd, TFD_TIMER_ABSTIME, &its, NULL);
+        if (r < 0)
+                return -errno;
+
+        d->next = t;
+        return 0;
+}
+
 static int event_arm_timer(
                 sd_event *e,
                 struct clock_data *d) {
 
         struct itimerspec its = {};
-        sd_event_source *a, *b;
-        usec_t t;
+        usec_t a, b;
         int r;
 
         assert(e);
@@ -1974,8 +2085,7 @@ static int event_arm_timer(
         else
                 d->needs_rearm = false;
 
-        a = prioq_peek(d->earliest);
-        if (!a || a->enabled == SD_EVENT_OFF) {
+        if (!clock_data_window(d, &a, &b)) {
 
                 if (d->fd < 0)
                         return 0;
@@ -1992,28 +2102,66 @@ static int event_arm_timer(
                 return 0;
         }
 
-        b = prioq_peek(d->latest);
-        assert_se(b && b->enabled != SD_EVENT_OFF);
+        return clock_data_arm(d, sleep_between(e, a, b));
+}
 
-        t = sleep_between(e, a->time.next, b->time.next + b->time.accuracy);
-        if (d->next == t)
+static int event_arm_realtime_and_monotonic(sd_event *e) {
+        usec_t ra, rb, ma, mb, offset, a, b, t;
+        int r;
+
+        assert(e);
+
+        /* Time sources on the same clock already share their
+         * wakeups. If both the realtime and the monotonic windows
+         * overlap, let's also wake up for both at the same time,
+         * instead of once for each clock. Calendar timers use the
+         * former, everything else the latter. */
+
+        if (!e->realtime.needs_rearm && !e->monotonic.needs_rearm)
                 return 0;
 
-        assert_se(d->fd >= 0);
+        e->realtime.needs_rearm = e->monotonic.needs_rearm = true;
 
-        if (t == 0) {
-                /* We don' want to disarm here, just mean some time looooong ago. */
-                its.it_value.tv_sec = 0;
-                its.it_value.tv_nsec = 1;
-        } else
-                timespec_store(&its.it_value, t);
+        if (!clock_data_window(&e->realtime, &ra, &rb) ||
+            !clock_data_window(&e->monotonic, &ma, &mb))
+                goto separately;
 
-        r = timerfd_settime(d->fd, TFD_TIMER_ABSTIME, &its, NULL);
+        if (ra <= 0 || ma <= 0 ||
+            ra == USEC_INFINITY || ma == USEC_INFINITY ||
+            rb < ra || mb < ma)
+                goto separately;
+
+        /* Translate the realtime window into monotonic time */
+        offset = now(CLOCK_REALTIME);
+        t = now(CLOCK_MONOTONIC);
+        if (offset <= t)
+                goto separately;
+        offset -= t;
+
+        if (ra <= offset)
+                goto separately;
+
+        a = MAX(ra - offset, ma);
+        b = MIN(rb - offset, mb);
+        if (a > b)
+                goto separately;
+
+        t = sleep_between(e, a, b);
+
+        e->realtime.needs_rearm = e->monotonic.needs_rearm = false;
+
+        r = clock_data_arm(&e->monotonic, t);
         if (r < 0)
-                return -errno;
+                return r;
 
-        d->next = t;
-        return 0;
+        return clock_data_arm(&e->realtime, t + offset);
+
+separately:
+        r = event_arm_timer(e, &e->realtime);
+        if (r < 0)
+                return r;
+
+        return event_arm_timer(e, &e->monotonic);
 }
 
 static int process_io(sd_event *e, sd_event_source *s, uint32_t revents) {
@@ -2073,6 +2221,8 @@ static int process_timer(
         assert(d);
 
         for (;;) {
+                clock_data_flush(d);
+
                 s = prioq_peek(d->earliest);
                 if (!s ||
                     s->time.next > n ||
@@ -2084,9 +2234,7 @@ static int process_timer(
                 if (r < 0)
                         return r;
 
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
+                e->n_timer_elapses++;
         }
 
         return 0;
@@ -2463,7 +2611,7 @@ _public_ int sd_event_prepare(sd_event *e) {
         if (r < 0)
                 return r;
 
-        r = event_arm_timer(e, &e->realtime);
+        r = event_arm_realtime_and_monotonic(e);
         if (r < 0)
                 return r;
 
@@ -2471,10 +2619,6 @@ _public_ int sd_event_prepare(sd_event *e) {
         if (r < 0)
                 return r;
 
-        r = event_arm_timer(e, &e->monotonic);
-        if (r < 0)
-                return r;
-
         r = event_arm_timer(e, &e->realtime_alarm);
         if (r < 0)
                 return r;
@@ -2500,7 +2644,7 @@ pending:
 }
 
 _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
-        struct epoll_event *ev_queue;
+        bool timer_woke = false;
         unsigned ev_queue_max;
         int r, m, i;
 
@@ -2514,10 +2658,22 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
                 return 1;
         }
 
+        /* The queue is kept around between iterations and only grows
+         * when sources are added, instead of being put on the stack
+         * anew each time, which for loops with many sources is
+         * both slow and a lot of stack. */
         ev_queue_max = MAX(e->n_sources, 1u);
-        ev_queue = newa(struct epoll_event, ev_queue_max);
+        if (!GREEDY_REALLOC(e->event_queue, e->event_queue_allocated, ev_queue_max)) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        /* Before going to sleep, hand out whatever log messages
+         * were queued in this iteration */
+        if (timeout != 0)
+                (void) log_flush();
 
-        m = epoll_wait(e->epoll_fd, ev_queue, ev_queue_max,
+        m = epoll_wait(e->epoll_fd, e->event_queue, ev_queue_max,
                        timeout == (uint64_t) -1 ? -1 : (int) ((timeout + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
         if (m < 0) {
                 if (errno == EINTR) {
@@ -2534,25 +2690,26 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
 
         for (i = 0; i < m; i++) {
 
-                if (ev_queue[i].data.ptr == INT_TO_PTR(SOURCE_WATCHDOG))
-                        r = flush_timer(e, e->watchdog_fd, ev_queue[i].events, NULL);
+                if (e->event_queue[i].data.ptr == INT_TO_PTR(SOURCE_WATCHDOG))
+                        r = flush_timer(e, e->watchdog_fd, e->event_queue[i].events, NULL);
                 else {
-                        WakeupType *t = ev_queue[i].data.ptr;
+                        WakeupType *t = e->event_queue[i].data.ptr;
 
                         switch (*t) {
 
                         case WAKEUP_EVENT_SOURCE:
-                                r = process_io(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                                r = process_io(e, e->event_queue[i].data.ptr, e->event_queue[i].events);
                                 break;
 
                         case WAKEUP_CLOCK_DATA: {
-                                struct clock_data *d = ev_queue[i].data.ptr;
-                                r = flush_timer(e, d->fd, ev_queue[i].events, &d->next);
+                                struct clock_data *d = e->event_queue[i].data.ptr;
+                                r = flush_timer(e, d->fd, e->event_queue[i].events, &d->next);
+                                timer_woke = true;
                                 break;
                         }
 
                         case WAKEUP_SIGNAL_DATA:
-                                r = process_signal(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                                r = process_signal(e, e->event_queue[i].data.ptr, e->event_queue[i].events);
                                 break;
 
                         default:
@@ -2563,6 +2720,9 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
                         goto finish;
         }
 
+        if (timer_woke)
+                e->n_timer_wakeups++;
+
         r = process_watchdog(e);
         if (r < 0)
                 goto finish;
@@ -2621,10 +2781,37 @@ _public_ int sd_event_dispatch(sd_event *e) {
 
         p = event_next_pending(e);
         if (p) {
+                unsigned n = 0;
+                int64_t priority = p->priority;
+
                 sd_event_ref(e);
 
+                /* Sources that become pending while we dispatch are
+                 * stamped with the new iteration counter, and hence
+                 * are left for the next round. */
+                if (e->dispatch_budget > 1)
+                        e->iteration++;
+
                 e->state = SD_EVENT_RUNNING;
-                r = source_dispatch(p);
+
+                for (;;) {
+                        r = source_dispatch(p);
+                        if (r < 0 || ++n >= e->dispatch_budget || e->exit_requested)
+                                break;
+
+                        /* Continue only with sources that were
+                         * already pending when we started, of the
+                         * same priority as the first one. Defer
+                         * sources stay pending after dispatching,
+                         * hence always end the batch. */
+                        p = event_next_pending(e);
+                        if (!p ||
+                            p->priority != priority ||
+                            p->pending_iteration >= e->iteration ||
+                            p->type == SOURCE_DEFER)
+                                break;
+                }
+
                 e->state = SD_EVENT_INITIAL;
 
                 sd_event_unref(e);
@@ -2851,3 +3038,30 @@ _public_ int sd_event_get_watchdog(sd_event *e) {
 
         return e->watchdog;
 }
+
+_public_ int sd_event_set_dispatch_budget(sd_event *e, unsigned budget) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+        assert_return(budget > 0, -EINVAL);
+
+        e->dispatch_budget = MIN(budget, DISPATCH_BUDGET_MAX);
+        return 0;
+}
+
+_public_ int sd_event_get_dispatch_budget(sd_event *e, unsigned *budget) {
+        assert_return(e, -EINVAL);
+        assert_return(budget, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        *budget = e->dispatch_budget;
+        return 0;
+}
+
+void event_get_timer_statistics(sd_event *e, uint64_t *wakeups, uint64_t *elapses) {
+        assert(e);
+
+        if (wakeups)
+                *wakeups = e->n_timer_wakeups;
+        if (elapses)
+                *elapses = e->n_timer_elapses;
+}
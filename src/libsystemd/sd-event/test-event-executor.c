@@ -0,0 +1,184 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pthread.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "event-util.h"
+#include "event-executor.h"
+
+#define N_POSTERS 4
+#define N_POSTS 10000
+
+static unsigned n_received = 0;
+static unsigned last_received[N_POSTERS];
+
+static void post_handler(void *userdata) {
+        unsigned v = PTR_TO_UINT(userdata), poster = v % N_POSTERS, seq = v / N_POSTERS;
+
+        /* Posts from one thread arrive in order */
+        assert_se(seq == last_received[poster]);
+        last_received[poster]++;
+
+        n_received++;
+}
+
+static void *poster_thread(void *p) {
+        EventQueue *q = p;
+        static unsigned next_poster = 0;
+        unsigned poster, i;
+
+        poster = __atomic_fetch_add(&next_poster, 1, __ATOMIC_RELAXED);
+
+        for (i = 0; i < N_POSTS; i++)
+                assert_se(event_queue_post(q, post_handler, UINT_TO_PTR(i * N_POSTERS + poster)) >= 0);
+
+        return NULL;
+}
+
+static void test_queue(void) {
+        _cleanup_event_unref_ sd_event *e = NULL;
+        _cleanup_event_queue_free_ EventQueue *q = NULL;
+        pthread_t threads[N_POSTERS];
+        unsigned i;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(event_queue_new(e, &q) >= 0);
+
+        for (i = 0; i < N_POSTERS; i++)
+                assert_se(pthread_create(&threads[i], NULL, poster_thread, q) == 0);
+
+        while (n_received < N_POSTERS * N_POSTS)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        for (i = 0; i < N_POSTERS; i++) {
+                assert_se(pthread_join(threads[i], NULL) == 0);
+                assert_se(last_received[i] == N_POSTS);
+        }
+
+        /* Nothing is left behind */
+        assert_se(sd_event_run(e, 0) == 0);
+}
+
+#define N_WORK 64
+#define N_THREADS 4
+
+static unsigned n_running = 0, n_running_max = 0, n_done = 0;
+static pthread_t loop_thread;
+
+static int work_handler(void *userdata) {
+        unsigned n;
+
+        assert_se(!pthread_equal(pthread_self(), loop_thread));
+
+        n = __atomic_add_fetch(&n_running, 1, __ATOMIC_SEQ_CST);
+        if (n > __atomic_load_n(&n_running_max, __ATOMIC_SEQ_CST))
+                __atomic_store_n(&n_running_max, n, __ATOMIC_SEQ_CST);
+
+        usleep(1000);
+
+        __atomic_sub_fetch(&n_running, 1, __ATOMIC_SEQ_CST);
+
+        return PTR_TO_INT(userdata) * 2;
+}
+
+static void done_handler(int result, void *userdata) {
+        assert_se(pthread_equal(pthread_self(), loop_thread));
+        assert_se(result == PTR_TO_INT(userdata) * 2);
+
+        n_done++;
+}
+
+static void test_executor(void) {
+        _cleanup_event_unref_ sd_event *e = NULL;
+        EventExecutor *x = NULL;
+        int i;
+
+        loop_thread = pthread_self();
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(event_executor_new(e, 0, &x) == -EINVAL);
+        assert_se(event_executor_new(e, N_THREADS, &x) >= 0);
+
+        for (i = 0; i < N_WORK; i++)
+                assert_se(event_executor_submit(x, work_handler, done_handler, INT_TO_PTR(i)) >= 0);
+
+        while (n_done < N_WORK)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        log_info("%u jobs ran on at most %u threads at once", n_done, n_running_max);
+        assert_se(n_running_max <= N_THREADS);
+
+        /* Freeing waits for outstanding work and completes it */
+        for (i = 0; i < N_WORK; i++)
+                assert_se(event_executor_submit(x, work_handler, done_handler, INT_TO_PTR(i)) >= 0);
+
+        x = event_executor_free(x);
+        assert_se(n_done == 2 * N_WORK);
+}
+
+static int file_result[4];
+static unsigned n_file_done = 0;
+
+static void file_done(int result, void *userdata) {
+        file_result[PTR_TO_UINT(userdata)] = result;
+        n_file_done++;
+}
+
+static void test_file_ops(void) {
+        _cleanup_event_unref_ sd_event *e = NULL;
+        _cleanup_event_executor_free_ EventExecutor *x = NULL;
+        char name[] = "/tmp/test-event-executor.XXXXXX";
+        _cleanup_close_ int fd = -1;
+        char buf[6] = {};
+
+        fd = mkostemp_safe(name, O_RDWR|O_CLOEXEC);
+        assert_se(fd >= 0);
+        unlink(name);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(event_executor_new(e, 1, &x) >= 0);
+
+        /* With a single thread, operations run in submission order */
+        assert_se(event_executor_pwrite(x, fd, "foobar", 6, 0, file_done, UINT_TO_PTR(0)) >= 0);
+        assert_se(event_executor_fsync(x, fd, true, file_done, UINT_TO_PTR(1)) >= 0);
+        assert_se(event_executor_pread(x, fd, buf, sizeof(buf), 0, file_done, UINT_TO_PTR(2)) >= 0);
+        assert_se(event_executor_fsync(x, -1, false, file_done, UINT_TO_PTR(3)) == -EBADF);
+
+        while (n_file_done < 3)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        assert_se(file_result[0] == 6);
+        assert_se(file_result[1] == 0);
+        assert_se(file_result[2] == 6);
+        assert_se(memcmp(buf, "foobar", 6) == 0);
+}
+
+int main(int argc, char *argv[]) {
+        log_parse_environment();
+        log_open();
+
+        test_queue();
+        test_executor();
+        test_file_ops();
+
+        return 0;
+}
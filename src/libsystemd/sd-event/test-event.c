@@ -20,6 +20,7 @@
 ***/
 
 #include "sd-event.h"
+#include "event-util.h"
 #include "log.h"
 #include "util.h"
 #include "macro.h"
@@ -304,10 +305,201 @@ static void test_rtqueue(void) {
         sd_event_unref(e);
 }
 
+#define N_REARM 1000
+
+static unsigned n_rearm_fired = 0;
+
+static int rearm_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        uint64_t next;
+
+        assert_se(sd_event_source_get_time(s, &next) >= 0);
+        assert_se(usec >= next);
+        assert_se(PTR_TO_UINT(userdata) % 3 != 0);
+
+        n_rearm_fired++;
+        return 0;
+}
+
+static void test_rearm(void) {
+        sd_event_source *s[N_REARM];
+        unsigned i, n_expected = 0;
+        sd_event *e = NULL;
+        uint64_t b;
+
+        assert_se(sd_event_default(&e) >= 0);
+        assert_se(sd_event_now(e, CLOCK_MONOTONIC, &b) >= 0);
+
+        for (i = 0; i < N_REARM; i++)
+                assert_se(sd_event_add_time(e, &s[i], CLOCK_MONOTONIC, b + USEC_PER_HOUR, 0, rearm_handler, UINT_TO_PTR(i)) >= 0);
+
+        /* Change every source a couple of times before the loop gets
+         * to look at them again, and disable or drop a few. */
+        for (i = 0; i < N_REARM; i++) {
+                assert_se(sd_event_source_set_enabled(s[i], SD_EVENT_OFF) >= 0);
+                assert_se(sd_event_source_set_time(s[i], b + USEC_PER_MINUTE) >= 0);
+                assert_se(sd_event_source_set_time(s[i], b + (N_REARM - i) * 10) >= 0);
+                assert_se(sd_event_source_set_time_accuracy(s[i], 1) >= 0);
+
+                if (i % 3 != 0)
+                        assert_se(sd_event_source_set_enabled(s[i], SD_EVENT_ONESHOT) >= 0);
+
+                if (i % 7 == 1) {
+                        assert_se(sd_event_source_set_time(s[i], b + USEC_PER_HOUR) >= 0);
+                        s[i] = sd_event_source_unref(s[i]);
+                } else if (i % 3 != 0)
+                        n_expected++;
+        }
+
+        while (n_rearm_fired < n_expected)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        /* Nothing else is due */
+        assert_se(sd_event_run(e, 10 * USEC_PER_MSEC) == 0);
+        assert_se(n_rearm_fired == n_expected);
+
+        for (i = 0; i < N_REARM; i++)
+                sd_event_source_unref(s[i]);
+
+        sd_event_unref(e);
+}
+
+#define N_BUDGET_SOURCES 64
+#define N_BUDGET_EVENTS 200000
+
+static unsigned n_budget_fired = 0, n_budget_low_fired = 0;
+static unsigned budget_fired[N_BUDGET_SOURCES];
+
+static int budget_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        /* We never drain the pipe, so the source stays ready */
+        budget_fired[PTR_TO_UINT(userdata)]++;
+        n_budget_fired++;
+        return 0;
+}
+
+static int budget_low_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        n_budget_low_fired++;
+        return 0;
+}
+
+static void bench_budget(sd_event *e, unsigned budget) {
+        usec_t t;
+
+        assert_se(sd_event_set_dispatch_budget(e, budget) >= 0);
+
+        n_budget_fired = 0;
+        t = now(CLOCK_MONOTONIC);
+        while (n_budget_fired < N_BUDGET_EVENTS)
+                assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_info("dispatch budget %3u: %llu events/s", budget,
+                 (unsigned long long) (n_budget_fired * USEC_PER_SEC / MAX(t, 1u)));
+}
+
+static void test_dispatch_budget(void) {
+        sd_event_source *s[N_BUDGET_SOURCES], *low;
+        int p[N_BUDGET_SOURCES][2], q[2];
+        sd_event *e = NULL;
+        unsigned i, budget;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(sd_event_get_dispatch_budget(e, &budget) >= 0);
+        assert_se(budget == 1);
+        assert_se(sd_event_set_dispatch_budget(e, 0) == -EINVAL);
+        assert_se(sd_event_set_dispatch_budget(e, (unsigned) -1) >= 0);
+        assert_se(sd_event_get_dispatch_budget(e, &budget) >= 0);
+        assert_se(budget >= N_BUDGET_SOURCES && budget < (unsigned) -1);
+
+        for (i = 0; i < N_BUDGET_SOURCES; i++) {
+                assert_se(pipe2(p[i], O_CLOEXEC|O_NONBLOCK) >= 0);
+                assert_se(write(p[i][1], "x", 1) == 1);
+                assert_se(sd_event_add_io(e, &s[i], p[i][0], EPOLLIN, budget_handler, UINT_TO_PTR(i)) >= 0);
+        }
+
+        assert_se(pipe2(q, O_CLOEXEC|O_NONBLOCK) >= 0);
+        assert_se(write(q[1], "x", 1) == 1);
+        assert_se(sd_event_add_io(e, &low, q[0], EPOLLIN, budget_low_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_priority(low, SD_EVENT_PRIORITY_IDLE) >= 0);
+
+        /* One iteration runs every ready source of the top priority
+         * exactly once, and nothing of lower priority */
+        assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        assert_se(n_budget_fired == N_BUDGET_SOURCES);
+        assert_se(n_budget_low_fired == 0);
+        for (i = 0; i < N_BUDGET_SOURCES; i++)
+                assert_se(budget_fired[i] == 1);
+
+        /* With a smaller budget, the sources still take turns. Sources
+         * that became pending in the same iteration are ordered by
+         * address, hence a batch crossing the end of a round may
+         * reorder a few, but nobody gets more than one turn ahead. */
+        assert_se(sd_event_set_dispatch_budget(e, 5) >= 0);
+        n_budget_fired = 0;
+        for (i = 0; i < N_BUDGET_SOURCES; i++)
+                assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        assert_se(n_budget_fired == N_BUDGET_SOURCES * 5);
+        for (i = 0; i < N_BUDGET_SOURCES; i++)
+                assert_se(budget_fired[i] >= 5 && budget_fired[i] <= 7);
+        assert_se(n_budget_low_fired == 0);
+
+        bench_budget(e, 1);
+        bench_budget(e, 16);
+        bench_budget(e, N_BUDGET_SOURCES);
+
+        /* Once the busy sources are gone the idle one gets its turn */
+        for (i = 0; i < N_BUDGET_SOURCES; i++) {
+                sd_event_source_unref(s[i]);
+                safe_close_pair(p[i]);
+        }
+        assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        assert_se(n_budget_low_fired == 1);
+
+        sd_event_source_unref(low);
+        safe_close_pair(q);
+        sd_event_unref(e);
+}
+
+static int clock_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        return 0;
+}
+
+static void test_clock_alignment(void) {
+        sd_event_source *rt, *mono;
+        uint64_t wakeups, elapses;
+        sd_event *e = NULL;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        /* Overlapping windows on the realtime and monotonic clocks are
+         * served by a single wakeup */
+        assert_se(sd_event_add_time(e, &rt, CLOCK_REALTIME, now(CLOCK_REALTIME) + 10 * USEC_PER_MSEC, 200 * USEC_PER_MSEC, clock_handler, NULL) >= 0);
+        assert_se(sd_event_add_time(e, &mono, CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + 50 * USEC_PER_MSEC, 200 * USEC_PER_MSEC, clock_handler, NULL) >= 0);
+
+        assert_se(sd_event_prepare(e) == 0);
+        assert_se(sd_event_wait(e, (uint64_t) -1) > 0);
+
+        assert_se(sd_event_source_get_pending(rt) > 0);
+        assert_se(sd_event_source_get_pending(mono) > 0);
+
+        event_get_timer_statistics(e, &wakeups, &elapses);
+        assert_se(wakeups == 1);
+        assert_se(elapses == 2);
+
+        assert_se(sd_event_dispatch(e) > 0);
+
+        sd_event_source_unref(rt);
+        sd_event_source_unref(mono);
+        sd_event_unref(e);
+}
+
 int main(int argc, char *argv[]) {
 
         test_basic();
         test_rtqueue();
+        test_rearm();
+        test_dispatch_budget();
+        test_clock_alignment();
 
         return 0;
 }
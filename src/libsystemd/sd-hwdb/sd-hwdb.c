@@ -35,6 +35,19 @@
 #include "hwdb-util.h"
 #include "hwdb-internal.h"
 
+/* Number of modalias lookups whose results are remembered. udev
+ * looks up the same modalias for every interface of a device, and
+ * several builtins look up the same device in turn. */
+#define HWDB_CACHE_MAX 8U
+
+typedef struct HwdbCacheEntry {
+        char *modalias;
+        /* key and value pairs as they were added to the properties,
+         * pointing into the mapped file */
+        const char **properties;
+        size_t n_properties;
+} HwdbCacheEntry;
+
 struct sd_hwdb {
         RefCount n_ref;
         int refcount;
@@ -51,6 +64,10 @@ struct sd_hwdb {
         OrderedHashmap *properties;
         Iterator properties_iterator;
         bool properties_modified;
+
+        /* most recently used first */
+        HwdbCacheEntry cache[HWDB_CACHE_MAX];
+        unsigned n_cache;
 };
 
 struct linebuf {
@@ -332,6 +349,101 @@ _public_ int sd_hwdb_new(sd_hwdb **ret) {
         return 0;
 }
 
+static void hwdb_cache_clear(sd_hwdb *hwdb) {
+        unsigned i;
+
+        for (i = 0; i < hwdb->n_cache; i++) {
+                free(hwdb->cache[i].modalias);
+                free(hwdb->cache[i].properties);
+        }
+
+        hwdb->n_cache = 0;
+}
+
+static void hwdb_cache_promote(sd_hwdb *hwdb, unsigned i) {
+        HwdbCacheEntry e;
+
+        assert(i < hwdb->n_cache);
+
+        e = hwdb->cache[i];
+        memmove(hwdb->cache + 1, hwdb->cache, i * sizeof(HwdbCacheEntry));
+        hwdb->cache[0] = e;
+}
+
+/* Makes the properties of a cached lookup the current ones. Returns 0
+ * if the modalias was not looked up recently. */
+static int hwdb_cache_load(sd_hwdb *hwdb, const char *modalias) {
+        HwdbCacheEntry *e;
+        unsigned i;
+        size_t n;
+        int r;
+
+        for (i = 0; i < hwdb->n_cache; i++)
+                if (streq(hwdb->cache[i].modalias, modalias))
+                        break;
+        if (i >= hwdb->n_cache)
+                return 0;
+
+        hwdb_cache_promote(hwdb, i);
+        e = hwdb->cache;
+
+        if (e->n_properties > 0) {
+                r = ordered_hashmap_ensure_allocated(&hwdb->properties, &string_hash_ops);
+                if (r < 0)
+                        return r;
+        }
+
+        for (n = 0; n < e->n_properties; n++) {
+                r = ordered_hashmap_put(hwdb->properties, e->properties[2*n], (char*) e->properties[2*n+1]);
+                if (r < 0)
+                        return r;
+        }
+
+        return 1;
+}
+
+static int hwdb_cache_store(sd_hwdb *hwdb, const char *modalias) {
+        _cleanup_free_ const char **properties = NULL;
+        _cleanup_free_ char *mod = NULL;
+        HwdbCacheEntry *e;
+        Iterator i;
+        const char *key;
+        char *value;
+        size_t n = 0;
+
+        mod = strdup(modalias);
+        if (!mod)
+                return -ENOMEM;
+
+        properties = new(const char*, ordered_hashmap_size(hwdb->properties) * 2);
+        if (!properties)
+                return -ENOMEM;
+
+        ORDERED_HASHMAP_FOREACH_KEY(value, key, hwdb->properties, i) {
+                properties[n++] = key;
+                properties[n++] = value;
+        }
+
+        if (hwdb->n_cache < HWDB_CACHE_MAX)
+                hwdb->n_cache++;
+        else {
+                e = hwdb->cache + hwdb->n_cache - 1;
+                free(e->modalias);
+                free(e->properties);
+        }
+
+        e = hwdb->cache + hwdb->n_cache - 1;
+        e->modalias = mod;
+        e->properties = properties;
+        e->n_properties = n / 2;
+        mod = NULL;
+        properties = NULL;
+
+        hwdb_cache_promote(hwdb, hwdb->n_cache - 1);
+
+        return 0;
+}
+
 _public_ sd_hwdb *sd_hwdb_ref(sd_hwdb *hwdb) {
         assert_return(hwdb, NULL);
 
@@ -347,6 +459,7 @@ _public_ sd_hwdb *sd_hwdb_unref(sd_hwdb *hwdb) {
                 safe_fclose(hwdb->f);
                 free(hwdb->modalias);
                 ordered_hashmap_free(hwdb->properties);
+                hwdb_cache_clear(hwdb);
                 free(hwdb);
         }
 
@@ -396,9 +509,17 @@ static int properties_prepare(sd_hwdb *hwdb, const char *modalias) {
 
         hwdb->properties_modified = true;
 
-        r = trie_search_f(hwdb, modalias);
+        r = hwdb_cache_load(hwdb, modalias);
         if (r < 0)
                 return r;
+        if (r == 0) {
+                r = trie_search_f(hwdb, modalias);
+                if (r < 0)
+                        return r;
+
+                /* a failure to remember the result is not fatal */
+                (void) hwdb_cache_store(hwdb, modalias);
+        }
 
         free(hwdb->modalias);
         hwdb->modalias = mod;
@@ -23,7 +23,9 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/inotify.h>
+#include <sys/stat.h>
 #include <poll.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "cgroup-util.h"
@@ -45,6 +47,197 @@
  *    requested metadata on object is missing → -ENODATA
  */
 
+/* logind and machined replace their state files atomically whenever
+ * something changes. Callers like polkit ask for several fields of the
+ * same session or user in a row, hence remember the last few files we
+ * parsed, and only parse them again when stat() tells us that they
+ * were replaced. */
+#define STATE_FILE_CACHE_SIZE 8
+
+typedef struct StateFile {
+        char *path;
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+        off_t size;
+        char **pairs;
+} StateFile;
+
+/* One cache per thread, released when the thread exits */
+typedef struct StateFileCache {
+        StateFile files[STATE_FILE_CACHE_SIZE];
+        unsigned next;
+} StateFileCache;
+
+static pthread_once_t state_file_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t state_file_cache_key;
+static bool state_file_cache_key_initialized = false;
+
+static thread_local StateFileCache *state_file_cache = NULL;
+
+static void state_file_cache_free(void *p) {
+        StateFileCache *c = p;
+        unsigned i;
+
+        for (i = 0; i < STATE_FILE_CACHE_SIZE; i++) {
+                free(c->files[i].path);
+                strv_free(c->files[i].pairs);
+        }
+
+        free(c);
+
+        state_file_cache = NULL;
+}
+
+static void state_file_cache_key_init(void) {
+        state_file_cache_key_initialized = pthread_key_create(&state_file_cache_key, state_file_cache_free) == 0;
+}
+
+static void _destructor_ state_file_cache_key_done(void) {
+        if (state_file_cache_key_initialized)
+                pthread_key_delete(state_file_cache_key);
+}
+
+static StateFileCache *state_file_cache_get(void) {
+        StateFileCache *c;
+
+        if (state_file_cache)
+                return state_file_cache;
+
+        assert_se(pthread_once(&state_file_cache_once, state_file_cache_key_init) == 0);
+        if (!state_file_cache_key_initialized)
+                return NULL;
+
+        c = new0(StateFileCache, 1);
+        if (!c)
+                return NULL;
+
+        if (pthread_setspecific(state_file_cache_key, c) != 0) {
+                free(c);
+                return NULL;
+        }
+
+        state_file_cache = c;
+        return c;
+}
+
+static bool state_file_matches(const StateFile *c, const struct stat *st) {
+        return c->dev == st->st_dev &&
+                c->ino == st->st_ino &&
+                c->size == st->st_size &&
+                c->mtime.tv_sec == st->st_mtim.tv_sec &&
+                c->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static int state_file_get(const char *path, char ***ret) {
+        _cleanup_strv_free_ char **pairs = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        StateFileCache *cache;
+        StateFile *c = NULL;
+        struct stat st;
+        unsigned i;
+        int r;
+
+        assert(path);
+        assert(ret);
+
+        cache = state_file_cache_get();
+        if (!cache)
+                return -ENOMEM;
+
+        if (stat(path, &st) < 0)
+                return -errno;
+
+        for (i = 0; i < STATE_FILE_CACHE_SIZE; i++)
+                if (streq_ptr(cache->files[i].path, path)) {
+                        c = cache->files + i;
+                        break;
+                }
+
+        if (c && state_file_matches(c, &st)) {
+                *ret = c->pairs;
+                return 0;
+        }
+
+        f = fopen(path, "re");
+        if (!f)
+                return -errno;
+
+        /* Remember what we actually read, not what we checked
+         * above, the file might have been replaced in between */
+        if (fstat(fileno(f), &st) < 0)
+                return -errno;
+
+        r = load_env_file_pairs(f, path, NEWLINE, &pairs);
+        if (r < 0)
+                return r;
+
+        if (!c) {
+                c = cache->files + cache->next;
+                cache->next = (cache->next + 1) % STATE_FILE_CACHE_SIZE;
+
+                free(c->path);
+                c->path = strdup(path);
+                if (!c->path) {
+                        c->pairs = strv_free(c->pairs);
+                        return -ENOMEM;
+                }
+        }
+
+        strv_free(c->pairs);
+        c->pairs = pairs;
+        pairs = NULL;
+
+        c->dev = st.st_dev;
+        c->ino = st.st_ino;
+        c->size = st.st_size;
+        c->mtime = st.st_mtim;
+
+        *ret = c->pairs;
+        return 0;
+}
+
+/* Like parse_env_file(), but served from the cache above */
+static int parse_state_file(const char *path, ...) {
+        const char *key;
+        char **pairs;
+        va_list ap;
+        int r, n = 0;
+
+        r = state_file_get(path, &pairs);
+        if (r < 0)
+                return r;
+
+        va_start(ap, path);
+        while ((key = va_arg(ap, const char*))) {
+                char **value, **k, **v;
+
+                value = va_arg(ap, char**);
+
+                STRV_FOREACH_PAIR(k, v, pairs) {
+                        char *t = NULL;
+
+                        if (!streq(*k, key))
+                                continue;
+
+                        if (!isempty(*v)) {
+                                t = strdup(*v);
+                                if (!t) {
+                                        va_end(ap);
+                                        return -ENOMEM;
+                                }
+                        }
+
+                        free(*value);
+                        *value = t;
+                        n++;
+                }
+        }
+        va_end(ap);
+
+        return n;
+}
+
 _public_ int sd_pid_get_session(pid_t pid, char **session) {
 
         assert_return(pid >= 0, -EINVAL);
@@ -261,7 +454,7 @@ _public_ int sd_uid_get_state(uid_t uid, char**state) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "STATE", &s, NULL);
+        r = parse_state_file(p, "STATE", &s, NULL);
         if (r == -ENOENT) {
                 free(s);
                 s = strdup("offline");
@@ -292,7 +485,7 @@ _public_ int sd_uid_get_display(uid_t uid, char **session) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "DISPLAY", &s, NULL);
+        r = parse_state_file(p, "DISPLAY", &s, NULL);
         if (r == -ENOENT)
                 return -ENODATA;
         if (r < 0)
@@ -349,7 +542,7 @@ _public_ int sd_uid_is_on_seat(uid_t uid, int require_active, const char *seat)
 
         variable = require_active ? "ACTIVE_UID" : "UIDS";
 
-        r = parse_env_file(p, NEWLINE, variable, &s, NULL);
+        r = parse_state_file(p, variable, &s, NULL);
         if (r == -ENOENT)
                 return 0;
         if (r < 0)
@@ -378,7 +571,7 @@ static int uid_get_array(uid_t uid, const char *variable, char ***array) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, variable, &s, NULL);
+        r = parse_state_file(p, variable, &s, NULL);
         if (r == -ENOENT || (r >= 0 && isempty(s))) {
                 if (array)
                         *array = NULL;
@@ -456,7 +649,7 @@ _public_ int sd_session_is_active(const char *session) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "ACTIVE", &s, NULL);
+        r = parse_state_file(p, "ACTIVE", &s, NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -475,7 +668,7 @@ _public_ int sd_session_is_remote(const char *session) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "REMOTE", &s, NULL);
+        r = parse_state_file(p, "REMOTE", &s, NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -496,7 +689,7 @@ _public_ int sd_session_get_state(const char *session, char **state) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "STATE", &s, NULL);
+        r = parse_state_file(p, "STATE", &s, NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -520,7 +713,7 @@ _public_ int sd_session_get_uid(const char *session, uid_t *uid) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "UID", &s, NULL);
+        r = parse_state_file(p, "UID", &s, NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -542,7 +735,7 @@ static int session_get_string(const char *session, const char *field, char **val
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, field, &s, NULL);
+        r = parse_state_file(p, field, &s, NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -635,10 +828,10 @@ _public_ int sd_seat_get_active(const char *seat, char **session, uid_t *uid) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE,
-                           "ACTIVE", &s,
-                           "ACTIVE_UID", &t,
-                           NULL);
+        r = parse_state_file(p,
+                             "ACTIVE", &s,
+                             "ACTIVE_UID", &t,
+                             NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -675,10 +868,10 @@ _public_ int sd_seat_get_sessions(const char *seat, char ***sessions, uid_t **ui
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE,
-                           "SESSIONS", &s,
-                           "ACTIVE_SESSIONS", &t,
-                           NULL);
+        r = parse_state_file(p,
+                             "SESSIONS", &s,
+                             "ACTIVE_SESSIONS", &t,
+                             NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -748,9 +941,9 @@ static int seat_get_can(const char *seat, const char *variable) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE,
-                           variable, &s,
-                           NULL);
+        r = parse_state_file(p,
+                             variable, &s,
+                             NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -879,7 +1072,7 @@ _public_ int sd_machine_get_class(const char *machine, char **class) {
         assert_return(class, -EINVAL);
 
         p = strjoina("/run/systemd/machines/", machine);
-        r = parse_env_file(p, NEWLINE, "CLASS", &c, NULL);
+        r = parse_state_file(p, "CLASS", &c, NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
@@ -904,7 +1097,7 @@ _public_ int sd_machine_get_ifindices(const char *machine, int **ifindices) {
         assert_return(ifindices, -EINVAL);
 
         p = strjoina("/run/systemd/machines/", machine);
-        r = parse_env_file(p, NEWLINE, "NETIF", &netif, NULL);
+        r = parse_state_file(p, "NETIF", &netif, NULL);
         if (r == -ENOENT)
                 return -ENXIO;
         if (r < 0)
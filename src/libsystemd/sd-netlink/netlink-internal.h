@@ -34,6 +34,10 @@
 #define RTNL_DEFAULT_TIMEOUT ((usec_t) (25 * USEC_PER_SEC))
 
 #define RTNL_WQUEUE_MAX 1024
+#define RTNL_WBATCH_SIZE_MAX (32U * 1024U)
+
+/* The receive buffer is grown up to this on overruns */
+#define RTNL_RCVBUF_MAX (128U * 1024U * 1024U)
 #define RTNL_RQUEUE_MAX 64*1024
 
 #define RTNL_CONTAINER_DEPTH 32
@@ -72,10 +76,16 @@ struct sd_netlink {
         unsigned rqueue_partial_size;
         size_t rqueue_partial_allocated;
 
+        /* Messages held back while corked, written in one go */
+        sd_netlink_message **wqueue;
+        unsigned wqueue_size;
+        size_t wqueue_allocated;
+
         struct nlmsghdr *rbuffer;
         size_t rbuffer_allocated;
 
         bool processing:1;
+        bool corked:1;
 
         uint32_t serial;
 
@@ -84,6 +94,9 @@ struct sd_netlink {
 
         LIST_HEAD(struct match_callback, match_callbacks);
 
+        sd_netlink_overrun_handler_t overrun_callback;
+        void *overrun_userdata;
+
         pid_t original_pid;
 
         sd_event_source *io_event_source;
@@ -126,6 +139,7 @@ int socket_open(int family);
 int socket_bind(sd_netlink *nl);
 int socket_join_broadcast_group(sd_netlink *nl, unsigned group);
 int socket_write_message(sd_netlink *nl, sd_netlink_message *m);
+int socket_writev_message(sd_netlink *nl, sd_netlink_message **m, unsigned n);
 int socket_read_message(sd_netlink *nl);
 
 int rtnl_rqueue_make_room(sd_netlink *rtnl);
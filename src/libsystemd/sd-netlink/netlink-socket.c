@@ -103,6 +103,52 @@ int socket_write_message(sd_netlink *nl, sd_netlink_message *m) {
         return k;
 }
 
+int socket_writev_message(sd_netlink *nl, sd_netlink_message **m, unsigned n) {
+        static const uint8_t padding[NLMSG_ALIGNTO] = {};
+        union {
+                struct sockaddr sa;
+                struct sockaddr_nl nl;
+        } addr = {
+                .nl.nl_family = AF_NETLINK,
+        };
+        struct msghdr mh = {
+                .msg_name = &addr.sa,
+                .msg_namelen = sizeof(addr),
+        };
+        struct iovec *iov;
+        unsigned i;
+        ssize_t k;
+
+        assert(nl);
+        assert(m);
+        assert(n > 0);
+
+        /* The kernel processes all messages in a datagram one after
+         * the other, as long as each one starts aligned. */
+
+        iov = newa(struct iovec, n * 2);
+
+        for (i = 0; i < n; i++) {
+                size_t l;
+
+                assert(m[i]->hdr);
+
+                l = m[i]->hdr->nlmsg_len;
+                iov[mh.msg_iovlen++] = (struct iovec) { .iov_base = m[i]->hdr, .iov_len = l };
+
+                if (i + 1 < n && NLMSG_ALIGN(l) > l)
+                        iov[mh.msg_iovlen++] = (struct iovec) { .iov_base = (void*) padding, .iov_len = NLMSG_ALIGN(l) - l };
+        }
+
+        mh.msg_iov = iov;
+
+        k = sendmsg(nl->fd, &mh, 0);
+        if (k < 0)
+                return -errno;
+
+        return k;
+}
+
 static int socket_recv_message(int fd, struct iovec *iov, uint32_t *_group, bool peek) {
         union sockaddr_union sender;
         uint8_t cmsg_buffer[CMSG_SPACE(sizeof(struct nl_pktinfo))];
@@ -173,6 +173,10 @@ sd_netlink *sd_netlink_unref(sd_netlink *rtnl) {
                         sd_netlink_message_unref(rtnl->rqueue_partial[i]);
                 free(rtnl->rqueue_partial);
 
+                for (i = 0; i < rtnl->wqueue_size; i++)
+                        sd_netlink_message_unref(rtnl->wqueue[i]);
+                free(rtnl->wqueue);
+
                 free(rtnl->rbuffer);
 
                 hashmap_free_free(rtnl->reply_callbacks);
@@ -209,6 +213,91 @@ static void rtnl_seal_message(sd_netlink *rtnl, sd_netlink_message *m) {
         return;
 }
 
+static int rtnl_fail_message(sd_netlink *rtnl, sd_netlink_message *m, int error) {
+        _cleanup_netlink_message_unref_ sd_netlink_message *reply = NULL;
+        int r;
+
+        assert(rtnl);
+        assert(m);
+
+        /* Write errors of held back messages only turn up when the
+         * caller believes them sent already, hence queue an error
+         * reply for them, like the kernel would */
+
+        r = rtnl_message_new_synthetic_error(error, rtnl_message_get_serial(m), &reply);
+        if (r < 0)
+                return r;
+
+        r = rtnl_rqueue_make_room(rtnl);
+        if (r < 0)
+                return r;
+
+        rtnl->rqueue[rtnl->rqueue_size++] = reply;
+        reply = NULL;
+
+        return 0;
+}
+
+static int rtnl_wqueue_flush(sd_netlink *rtnl) {
+        unsigned i, j;
+        int r, ret = 0;
+
+        assert(rtnl);
+
+        for (i = 0; i < rtnl->wqueue_size; i = j) {
+                size_t size = 0;
+
+                /* Write as many messages per datagram as fit */
+                for (j = i; j < rtnl->wqueue_size; j++) {
+                        size_t l;
+
+                        l = NLMSG_ALIGN(rtnl->wqueue[j]->hdr->nlmsg_len);
+                        if (j > i && size + l > RTNL_WBATCH_SIZE_MAX)
+                                break;
+
+                        size += l;
+                }
+
+                r = socket_writev_message(rtnl, rtnl->wqueue + i, j - i);
+                if (r >= 0)
+                        continue;
+
+                log_debug_errno(r, "rtnl: failed to write %u batched messages, writing them one by one: %m", j - i);
+
+                for (; i < j; i++) {
+                        r = socket_write_message(rtnl, rtnl->wqueue[i]);
+                        if (r >= 0)
+                                continue;
+
+                        if (ret == 0)
+                                ret = r;
+
+                        r = rtnl_fail_message(rtnl, rtnl->wqueue[i], r);
+                        if (r < 0)
+                                log_debug_errno(r, "rtnl: failed to queue error reply: %m");
+                }
+        }
+
+        for (i = 0; i < rtnl->wqueue_size; i++)
+                sd_netlink_message_unref(rtnl->wqueue[i]);
+
+        rtnl->wqueue_size = 0;
+
+        return ret;
+}
+
+int sd_netlink_cork(sd_netlink *nl, int b) {
+        assert_return(nl, -EINVAL);
+        assert_return(!rtnl_pid_changed(nl), -ECHILD);
+
+        nl->corked = b;
+
+        if (!b)
+                return rtnl_wqueue_flush(nl);
+
+        return 0;
+}
+
 int sd_netlink_send(sd_netlink *nl,
                  sd_netlink_message *message,
                  uint32_t *serial) {
@@ -221,9 +310,20 @@ int sd_netlink_send(sd_netlink *nl,
 
         rtnl_seal_message(nl, message);
 
-        r = socket_write_message(nl, message);
-        if (r < 0)
-                return r;
+        if (nl->corked) {
+                /* Failures are reported through error replies */
+                if (nl->wqueue_size >= RTNL_WQUEUE_MAX)
+                        (void) rtnl_wqueue_flush(nl);
+
+                if (!GREEDY_REALLOC(nl->wqueue, nl->wqueue_allocated, nl->wqueue_size + 1))
+                        return -ENOMEM;
+
+                nl->wqueue[nl->wqueue_size++] = sd_netlink_message_ref(message);
+        } else {
+                r = socket_write_message(nl, message);
+                if (r < 0)
+                        return r;
+        }
 
         if (serial)
                 *serial = rtnl_message_get_serial(message);
@@ -260,6 +360,37 @@ int rtnl_rqueue_partial_make_room(sd_netlink *rtnl) {
         return 0;
 }
 
+static int process_overrun(sd_netlink *rtnl) {
+        socklen_t l = sizeof(int);
+        int r, value;
+
+        assert(rtnl);
+
+        /* Either the kernel or we had to drop messages. Make room
+         * for more next time, and tell the owner, who will have to
+         * find out what they missed. */
+
+        if (getsockopt(rtnl->fd, SOL_SOCKET, SO_RCVBUF, &value, &l) >= 0 &&
+            value > 0 && (unsigned) value < RTNL_RCVBUF_MAX) {
+
+                /* The kernel reports twice what was set, hence
+                 * setting the reported size doubles the buffer */
+                r = fd_inc_rcvbuf(rtnl->fd, MIN((unsigned) value, RTNL_RCVBUF_MAX));
+                if (r < 0)
+                        log_debug_errno(r, "rtnl: failed to grow receive buffer: %m");
+                else
+                        log_debug("rtnl: receive buffer overrun, doubled receive buffer of %i bytes", value / 2);
+        }
+
+        if (rtnl->overrun_callback) {
+                r = rtnl->overrun_callback(rtnl, rtnl->overrun_userdata);
+                if (r < 0)
+                        log_debug_errno(r, "sd-netlink: overrun callback failed: %m");
+        }
+
+        return 1;
+}
+
 static int dispatch_rqueue(sd_netlink *rtnl, sd_netlink_message **message) {
         int r;
 
@@ -269,6 +400,8 @@ static int dispatch_rqueue(sd_netlink *rtnl, sd_netlink_message **message) {
         if (rtnl->rqueue_size <= 0) {
                 /* Try to read a new message */
                 r = socket_read_message(rtnl);
+                if (r == -ENOBUFS)
+                        return process_overrun(rtnl);
                 if (r <= 0)
                         return r;
         }
@@ -607,6 +740,11 @@ int sd_netlink_call(sd_netlink *rtnl,
         if (r < 0)
                 return r;
 
+        /* We are about to wait for the reply, so it has to go out
+         * now. If that fails, we find an error reply below. */
+        if (rtnl->corked)
+                (void) rtnl_wqueue_flush(rtnl);
+
         timeout = calc_elapse(usec);
 
         for (;;) {
@@ -652,6 +790,11 @@ int sd_netlink_call(sd_netlink *rtnl,
                 }
 
                 r = socket_read_message(rtnl);
+                if (r == -ENOBUFS) {
+                        /* Our reply might still be queued, continue */
+                        (void) process_overrun(rtnl);
+                        continue;
+                }
                 if (r < 0)
                         return r;
                 if (r > 0)
@@ -835,6 +978,18 @@ int sd_netlink_detach_event(sd_netlink *rtnl) {
         return 0;
 }
 
+int sd_netlink_set_overrun_handler(sd_netlink *rtnl,
+                                   sd_netlink_overrun_handler_t callback,
+                                   void *userdata) {
+        assert_return(rtnl, -EINVAL);
+        assert_return(!rtnl_pid_changed(rtnl), -ECHILD);
+
+        rtnl->overrun_callback = callback;
+        rtnl->overrun_userdata = userdata;
+
+        return 0;
+}
+
 int sd_netlink_add_match(sd_netlink *rtnl,
                       uint16_t type,
                       sd_netlink_message_handler_t callback,
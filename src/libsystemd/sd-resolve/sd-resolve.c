@@ -40,6 +40,10 @@
 
 #define WORKERS_MIN 1U
 #define WORKERS_MAX 16U
+
+/* How long workers beyond WORKERS_MIN wait for a request before they
+ * go away again */
+#define WORKERS_IDLE_USEC (5U * USEC_PER_SEC)
 #define QUERIES_MAX 256U
 #define BUFSIZE 10240U
 
@@ -71,6 +75,10 @@ struct sd_resolve {
         pthread_t workers[WORKERS_MAX];
         unsigned n_valid_workers;
 
+        /* The workers that did not retire yet. Workers decrement
+         * this themselves, hence it is only accessed atomically. */
+        unsigned n_live_workers;
+
         unsigned current_id;
         sd_resolve_query* query_array[QUERIES_MAX];
         unsigned n_queries, n_done, n_outstanding;
@@ -394,6 +402,21 @@ static int handle_request(int out_fd, const Packet *packet, size_t length) {
         return 0;
 }
 
+static bool worker_retire(sd_resolve *resolve) {
+        unsigned n;
+
+        /* Several workers might time out at the same time, but we
+         * always keep WORKERS_MIN of them around */
+        for (;;) {
+                n = __sync_fetch_and_add(&resolve->n_live_workers, 0);
+                if (n <= WORKERS_MIN)
+                        return false;
+
+                if (__sync_bool_compare_and_swap(&resolve->n_live_workers, n, n - 1))
+                        return true;
+        }
+}
+
 static void* thread_worker(void *p) {
         sd_resolve *resolve = p;
         sigset_t fullset;
@@ -410,11 +433,39 @@ static void* thread_worker(void *p) {
                         Packet packet;
                         uint8_t space[BUFSIZE];
                 } buf;
+                struct pollfd pollfd = {
+                        .fd = resolve->fds[REQUEST_RECV_FD],
+                        .events = POLLIN,
+                };
                 ssize_t length;
+                int r;
+
+                /* Only the workers beyond the minimum wait with a
+                 * timeout, so that an idle pool doesn't wake up */
+                r = poll(&pollfd, 1,
+                         __sync_fetch_and_add(&resolve->n_live_workers, 0) > WORKERS_MIN ?
+                         (int) (WORKERS_IDLE_USEC / USEC_PER_MSEC) : -1);
+                if (r < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        break;
+                }
+                if (r == 0) {
+                        /* Nothing to do for a while, the main
+                         * thread collects us with
+                         * pthread_tryjoin_np() */
+                        if (worker_retire(resolve))
+                                return NULL;
+
+                        continue;
+                }
 
-                length = recv(resolve->fds[REQUEST_RECV_FD], &buf, sizeof(buf), 0);
+                /* All waiting workers are woken up, but only one
+                 * gets the request */
+                length = recv(resolve->fds[REQUEST_RECV_FD], &buf, sizeof(buf), MSG_DONTWAIT);
                 if (length < 0) {
-                        if (errno == EINTR)
+                        if (errno == EINTR || errno == EAGAIN)
                                 continue;
 
                         break;
@@ -429,23 +480,49 @@ static void* thread_worker(void *p) {
                         break;
         }
 
+        __sync_fetch_and_sub(&resolve->n_live_workers, 1);
         send_died(resolve->fds[RESPONSE_SEND_FD]);
 
         return NULL;
 }
 
+static void reap_threads(sd_resolve *resolve) {
+        unsigned i;
+
+        /* Collect the workers that retired. The ones that are still
+         * on their way out are collected next time. */
+        for (i = 0; i < resolve->n_valid_workers; ) {
+                if (pthread_tryjoin_np(resolve->workers[i], NULL) == 0) {
+                        resolve->workers[i] = resolve->workers[--resolve->n_valid_workers];
+                        continue;
+                }
+
+                i++;
+        }
+}
+
 static int start_threads(sd_resolve *resolve, unsigned extra) {
         unsigned n;
         int r;
 
+        /* One worker per query that is queued or being worked on,
+         * idle workers go away again by themselves */
         n = resolve->n_outstanding + extra;
         n = CLAMP(n, WORKERS_MIN, WORKERS_MAX);
 
-        while (resolve->n_valid_workers < n) {
+        if (resolve->n_valid_workers > __sync_fetch_and_add(&resolve->n_live_workers, 0))
+                reap_threads(resolve);
+
+        while (__sync_fetch_and_add(&resolve->n_live_workers, 0) < n &&
+               resolve->n_valid_workers < WORKERS_MAX) {
+
+                __sync_fetch_and_add(&resolve->n_live_workers, 1);
 
                 r = pthread_create(&resolve->workers[resolve->n_valid_workers], NULL, thread_worker, resolve);
-                if (r != 0)
+                if (r != 0) {
+                        __sync_fetch_and_sub(&resolve->n_live_workers, 1);
                         return -r;
+                }
 
                 resolve->n_valid_workers ++;
         }
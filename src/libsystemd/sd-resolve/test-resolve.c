@@ -27,7 +27,9 @@
 #include <netinet/in.h>
 #include <resolv.h>
 #include <errno.h>
+#include <dirent.h>
 
+#include "util.h"
 #include "socket-util.h"
 #include "sd-resolve.h"
 #include "resolve-util.h"
@@ -67,6 +69,90 @@ static int getnameinfo_handler(sd_resolve_query *q, int ret, const char *host, c
         return 0;
 }
 
+#define N_QUERIES 8U
+
+static unsigned count_threads(void) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        unsigned n = 0;
+
+        d = opendir("/proc/self/task");
+        assert_se(d);
+
+        FOREACH_DIRENT(de, d, assert_not_reached("readdir() failed"))
+                n++;
+
+        return n;
+}
+
+/* Threads might linger in /proc for a moment after they exited */
+static void wait_threads(unsigned n) {
+        unsigned i;
+
+        for (i = 0; count_threads() > n; i++) {
+                assert_se(i < 200);
+                usleep(100 * USEC_PER_MSEC);
+        }
+
+        assert_se(count_threads() == n);
+}
+
+static int numeric_handler(sd_resolve_query *q, int ret, const struct addrinfo *ai, void *userdata) {
+        unsigned *n_done = userdata;
+
+        assert_se(q);
+        assert_se(ret == 0);
+        assert_se(ai && ai->ai_family == AF_INET);
+
+        (*n_done)++;
+        return 0;
+}
+
+static void start_queries(sd_resolve *resolve, unsigned *n_done) {
+        struct addrinfo hints = {
+                .ai_family = AF_INET,
+                .ai_socktype = SOCK_STREAM,
+                .ai_flags = AI_NUMERICHOST|AI_NUMERICSERV,
+        };
+        unsigned i;
+
+        for (i = 0; i < N_QUERIES; i++)
+                assert_se(sd_resolve_getaddrinfo(resolve, NULL, "127.0.0.1", "80", &hints, numeric_handler, n_done) >= 0);
+}
+
+static void wait_queries(sd_resolve *resolve, unsigned *n_done) {
+        while (*n_done < N_QUERIES)
+                assert_se(sd_resolve_wait(resolve, (uint64_t) -1) >= 0);
+
+        *n_done = 0;
+}
+
+static void test_workers(void) {
+        _cleanup_resolve_unref_ sd_resolve *resolve = NULL;
+        unsigned base, n_done = 0;
+
+        base = count_threads();
+
+        assert_se(sd_resolve_new(&resolve) >= 0);
+        assert_se(count_threads() == base);
+
+        /* One worker for each query that is waiting */
+        start_queries(resolve, &n_done);
+        assert_se(count_threads() == base + N_QUERIES);
+        wait_queries(resolve, &n_done);
+
+        /* Once idle, all but one go away again */
+        wait_threads(base + 1);
+
+        /* And come back when needed */
+        start_queries(resolve, &n_done);
+        assert_se(count_threads() == base + N_QUERIES);
+        wait_queries(resolve, &n_done);
+
+        resolve = sd_resolve_unref(resolve);
+        wait_threads(base);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_resolve_query_unref_ sd_resolve_query *q1 = NULL, *q2 = NULL;
         _cleanup_resolve_unref_ sd_resolve *resolve = NULL;
@@ -83,6 +169,8 @@ int main(int argc, char *argv[]) {
                 .sin_port = htons(80)
         };
 
+        test_workers();
+
         assert_se(sd_resolve_default(&resolve) >= 0);
 
         /* Test a floating resolver query */
@@ -23,6 +23,7 @@
 #include <string.h>
 
 #include "libudev-private.h"
+#include "mempool.h"
 
 /**
  * SECTION:libudev-list
@@ -138,6 +139,9 @@ static int list_search(struct udev_list *list, const char *name)
         return -(first+1);
 }
 
+/* Every device carries a few lists of properties, tags and links */
+static DEFINE_MEMPOOL_THREADED(entry_pool, struct udev_list_entry, 256);
+
 struct udev_list_entry *udev_list_entry_add(struct udev_list *list, const char *name, const char *value)
 {
         struct udev_list_entry *entry;
@@ -162,19 +166,19 @@ struct udev_list_entry *udev_list_entry_add(struct udev_list *list, const char *
         }
 
         /* add new name */
-        entry = new0(struct udev_list_entry, 1);
+        entry = mempool_threaded_alloc0_tile(&entry_pool);
         if (entry == NULL)
                 return NULL;
         entry->name = strdup(name);
         if (entry->name == NULL) {
-                free(entry);
+                mempool_threaded_free_tile(&entry_pool, entry);
                 return NULL;
         }
         if (value != NULL) {
                 entry->value = strdup(value);
                 if (entry->value == NULL) {
                         free(entry->name);
-                        free(entry);
+                        mempool_threaded_free_tile(&entry_pool, entry);
                         return NULL;
                 }
         }
@@ -192,7 +196,7 @@ struct udev_list_entry *udev_list_entry_add(struct udev_list *list, const char *
                         if (entries == NULL) {
                                 free(entry->name);
                                 free(entry->value);
-                                free(entry);
+                                mempool_threaded_free_tile(&entry_pool, entry);
                                 return NULL;
                         }
                         list->entries = entries;
@@ -238,7 +242,7 @@ void udev_list_entry_delete(struct udev_list_entry *entry)
         udev_list_node_remove(&entry->node);
         free(entry->name);
         free(entry->value);
-        free(entry);
+        mempool_threaded_free_tile(&entry_pool, entry);
 }
 
 void udev_list_cleanup(struct udev_list *list)
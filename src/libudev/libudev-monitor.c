@@ -56,6 +56,7 @@ struct udev_monitor {
         socklen_t addrlen;
         struct udev_list filter_subsystem_list;
         struct udev_list filter_tag_list;
+        struct udev_list filter_property_list;
         bool bound;
 };
 
@@ -66,6 +67,9 @@ enum udev_monitor_netlink_group {
 };
 
 #define UDEV_MONITOR_MAGIC                0xfeedcafe
+/* 256 bits, the typical device has a few dozen properties */
+#define UDEV_MONITOR_PROPERTY_BLOOM_WORDS 8U
+
 struct udev_monitor_netlink_header {
         /* "libudev" prefix to distinguish libudev and kernel messages */
         char prefix[8];
@@ -87,6 +91,11 @@ struct udev_monitor_netlink_header {
         unsigned int filter_devtype_hash;
         unsigned int filter_tag_bloom_hi;
         unsigned int filter_tag_bloom_lo;
+        /*
+         * bloom filter of all "KEY=value" property strings, only present
+         * if header_size covers it; words need to be stored in network order
+         */
+        unsigned int filter_property_bloom[UDEV_MONITOR_PROPERTY_BLOOM_WORDS];
 };
 
 static struct udev_monitor *udev_monitor_new(struct udev *udev)
@@ -100,6 +109,7 @@ static struct udev_monitor *udev_monitor_new(struct udev *udev)
         udev_monitor->udev = udev;
         udev_list_init(udev, &udev_monitor->filter_subsystem_list, false);
         udev_list_init(udev, &udev_monitor->filter_tag_list, true);
+        udev_list_init(udev, &udev_monitor->filter_property_list, false);
         return udev_monitor;
 }
 
@@ -270,6 +280,29 @@ static inline void bpf_jmp(struct sock_filter *inss, unsigned int *i,
         (*i)++;
 }
 
+/*
+ * Every property string sets four bits in the property bloom filter,
+ * each selected by eight bits of its hash: three for the word, five for
+ * the bit in the word.
+ */
+static void property_bloom_bits(const char *key, const char *value, unsigned bits[4]) {
+        char buf[UTIL_LINE_SIZE];
+        unsigned int hash;
+        unsigned i;
+
+        strscpyl(buf, sizeof(buf), key, "=", value, NULL);
+        hash = util_string_hash32(buf);
+
+        for (i = 0; i < 4; i++)
+                bits[i] = (hash >> (i * 8)) & 0xff;
+}
+
+#define PROPERTY_BLOOM_WORD(bit) ((bit) >> 5)
+#define PROPERTY_BLOOM_MASK(bit) (1U << ((bit) & 31))
+
+/* instructions per property match in the socket filter */
+#define PROPERTY_MATCH_INSNS 12
+
 /**
  * udev_monitor_filter_update:
  * @udev_monitor: monitor
@@ -288,7 +321,8 @@ _public_ int udev_monitor_filter_update(struct udev_monitor *udev_monitor)
         int err;
 
         if (udev_list_get_entry(&udev_monitor->filter_subsystem_list) == NULL &&
-            udev_list_get_entry(&udev_monitor->filter_tag_list) == NULL)
+            udev_list_get_entry(&udev_monitor->filter_tag_list) == NULL &&
+            udev_list_get_entry(&udev_monitor->filter_property_list) == NULL)
                 return 0;
 
         memzero(ins, sizeof(ins));
@@ -335,6 +369,54 @@ _public_ int udev_monitor_filter_update(struct udev_monitor *udev_monitor)
                 bpf_stmt(ins, &i, BPF_RET|BPF_K, 0);
         }
 
+        if (udev_list_get_entry(&udev_monitor->filter_property_list) != NULL) {
+                int property_matches;
+
+                /* count property matches, to calculate end of property match block */
+                property_matches = 0;
+                udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_property_list))
+                        property_matches++;
+
+                /* jumps are limited to 255 instructions */
+                if (property_matches * PROPERTY_MATCH_INSNS + 1 > 255)
+                        return -E2BIG;
+
+                /* load header size in A; it is stored in host order, the filter loads in network order */
+                bpf_stmt(ins, &i, BPF_LD|BPF_W|BPF_ABS, offsetof(struct udev_monitor_netlink_header, header_size));
+                /* skip the property matches unless the sender uses the same header, older ones lack the bloom filter */
+                bpf_jmp(ins, &i, BPF_JMP|BPF_JEQ|BPF_K, htonl(sizeof(struct udev_monitor_netlink_header)),
+                        0, property_matches * PROPERTY_MATCH_INSNS + 1);
+
+                /* add all property matches */
+                udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_property_list)) {
+                        unsigned bits[4], k;
+
+                        property_bloom_bits(udev_list_entry_get_name(list_entry), udev_list_entry_get_value(list_entry), bits);
+                        property_matches--;
+
+                        for (k = 0; k < 4; k++) {
+                                uint32_t mask = PROPERTY_BLOOM_MASK(bits[k]);
+
+                                /* load device bloom word in A */
+                                bpf_stmt(ins, &i, BPF_LD|BPF_W|BPF_ABS,
+                                         offsetof(struct udev_monitor_netlink_header, filter_property_bloom) +
+                                         PROPERTY_BLOOM_WORD(bits[k]) * sizeof(unsigned int));
+                                /* clear bits (property bit & bloom bits) */
+                                bpf_stmt(ins, &i, BPF_ALU|BPF_AND|BPF_K, mask);
+                                if (k < 3)
+                                        /* jump to next property if it does not match */
+                                        bpf_jmp(ins, &i, BPF_JMP|BPF_JEQ|BPF_K, mask, 0, (3 - k) * 3);
+                                else
+                                        /* jump behind end of property match block if property matches */
+                                        bpf_jmp(ins, &i, BPF_JMP|BPF_JEQ|BPF_K, mask,
+                                                1 + property_matches * PROPERTY_MATCH_INSNS, 0);
+                        }
+                }
+
+                /* nothing matched, drop packet */
+                bpf_stmt(ins, &i, BPF_RET|BPF_K, 0);
+        }
+
         /* add all subsystem matches */
         if (udev_list_get_entry(&udev_monitor->filter_subsystem_list) != NULL) {
                 udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_subsystem_list)) {
@@ -484,6 +566,7 @@ _public_ struct udev_monitor *udev_monitor_unref(struct udev_monitor *udev_monit
                 close(udev_monitor->sock);
         udev_list_cleanup(&udev_monitor->filter_subsystem_list);
         udev_list_cleanup(&udev_monitor->filter_tag_list);
+        udev_list_cleanup(&udev_monitor->filter_property_list);
         free(udev_monitor);
         return NULL;
 }
@@ -546,11 +629,23 @@ static int passes_filter(struct udev_monitor *udev_monitor, struct udev_device *
 
 tag:
         if (udev_list_get_entry(&udev_monitor->filter_tag_list) == NULL)
-                return 1;
+                goto property;
         udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_tag_list)) {
                 const char *tag = udev_list_entry_get_name(list_entry);
 
                 if (udev_device_has_tag(udev_device, tag))
+                        goto property;
+        }
+        return 0;
+
+property:
+        if (udev_list_get_entry(&udev_monitor->filter_property_list) == NULL)
+                return 1;
+        udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_property_list)) {
+                const char *key = udev_list_entry_get_name(list_entry);
+                const char *value = udev_device_get_property_value(udev_device, key);
+
+                if (streq_ptr(value, udev_list_entry_get_value(list_entry)))
                         return 1;
         }
         return 0;
@@ -723,6 +818,8 @@ int udev_monitor_send_device(struct udev_monitor *udev_monitor,
         };
         struct udev_list_entry *list_entry;
         uint64_t tag_bloom_bits;
+        unsigned int property_bloom[UDEV_MONITOR_PROPERTY_BLOOM_WORDS] = {};
+        unsigned k;
 
         blen = udev_device_get_properties_monitor_buf(udev_device, &buf);
         if (blen < 32) {
@@ -747,6 +844,17 @@ int udev_monitor_send_device(struct udev_monitor *udev_monitor,
                 nlh.filter_tag_bloom_lo = htonl(tag_bloom_bits & 0xffffffff);
         }
 
+        /* add property bloom filter */
+        udev_list_entry_foreach(list_entry, udev_device_get_properties_list_entry(udev_device)) {
+                unsigned bits[4];
+
+                property_bloom_bits(udev_list_entry_get_name(list_entry), udev_list_entry_get_value(list_entry), bits);
+                for (k = 0; k < 4; k++)
+                        property_bloom[PROPERTY_BLOOM_WORD(bits[k])] |= PROPERTY_BLOOM_MASK(bits[k]);
+        }
+        for (k = 0; k < UDEV_MONITOR_PROPERTY_BLOOM_WORDS; k++)
+                nlh.filter_property_bloom[k] = htonl(property_bloom[k]);
+
         /* add properties list */
         nlh.properties_off = iov[0].iov_len;
         nlh.properties_len = blen;
@@ -824,6 +932,30 @@ _public_ int udev_monitor_filter_add_match_tag(struct udev_monitor *udev_monitor
         return 0;
 }
 
+/**
+ * udev_monitor_filter_add_match_property:
+ * @udev_monitor: the monitor
+ * @property: the name of a property
+ * @value: the value the property must have
+ *
+ * This filter is efficiently executed inside the kernel, and libudev subscribers
+ * will usually not be woken up for devices which do not match.
+ *
+ * The filter must be installed before the monitor is switched to listening mode.
+ *
+ * Returns: 0 on success, otherwise a negative error value.
+ */
+_public_ int udev_monitor_filter_add_match_property(struct udev_monitor *udev_monitor, const char *property, const char *value)
+{
+        if (udev_monitor == NULL)
+                return -EINVAL;
+        if (property == NULL || value == NULL)
+                return -EINVAL;
+        if (udev_list_entry_add(&udev_monitor->filter_property_list, property, value) == NULL)
+                return -ENOMEM;
+        return 0;
+}
+
 /**
  * udev_monitor_filter_remove:
  * @udev_monitor: monitor
@@ -837,5 +969,6 @@ _public_ int udev_monitor_filter_remove(struct udev_monitor *udev_monitor)
         static struct sock_fprog filter = { 0, NULL };
 
         udev_list_cleanup(&udev_monitor->filter_subsystem_list);
+        udev_list_cleanup(&udev_monitor->filter_property_list);
         return setsockopt(udev_monitor->sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter));
 }
@@ -129,6 +129,7 @@ struct udev_device *udev_monitor_receive_device(struct udev_monitor *udev_monito
 int udev_monitor_filter_add_match_subsystem_devtype(struct udev_monitor *udev_monitor,
                                                     const char *subsystem, const char *devtype);
 int udev_monitor_filter_add_match_tag(struct udev_monitor *udev_monitor, const char *tag);
+int udev_monitor_filter_add_match_property(struct udev_monitor *udev_monitor, const char *property, const char *value);
 int udev_monitor_filter_update(struct udev_monitor *udev_monitor);
 int udev_monitor_filter_remove(struct udev_monitor *udev_monitor);
 
@@ -26,6 +26,7 @@
 #include "formats-util.h"
 #include "acl-util.h"
 #include "set.h"
+#include "hashmap.h"
 #include "logind-acl.h"
 #include "udev-util.h"
 
@@ -171,7 +172,220 @@ finish:
         return r;
 }
 
+/* A device node tagged "uaccess", as far as we know from udev */
+typedef struct AclDevice {
+        char *syspath;
+        char *node;
+        char *seat;
+
+        /* The user we last gave access to the node, 0 if we took it
+         * away from everybody, UID_INVALID if we don't know, for
+         * example because udev just applied its own ACLs */
+        uid_t uid;
+} AclDevice;
+
+struct AclCache {
+        /* syspath → AclDevice */
+        Hashmap *devices;
+        bool enumerated;
+};
+
+static AclDevice *acl_device_free(AclDevice *d) {
+        if (!d)
+                return NULL;
+
+        free(d->syspath);
+        free(d->node);
+        free(d->seat);
+        free(d);
+
+        return NULL;
+}
+
+AclCache *acl_cache_free(AclCache *c) {
+        AclDevice *d;
+
+        if (!c)
+                return NULL;
+
+        while ((d = hashmap_steal_first(c->devices)))
+                acl_device_free(d);
+
+        hashmap_free(c->devices);
+        free(c);
+
+        return NULL;
+}
+
+static int acl_cache_add(AclCache *c, struct udev_device *dev) {
+        const char *syspath, *node, *sn;
+        AclDevice *d;
+        int r;
+
+        assert(c);
+        assert(dev);
+
+        syspath = udev_device_get_syspath(dev);
+        if (!syspath)
+                return 0;
+
+        /* In case people mistag devices with nodes, we need to ignore this */
+        node = udev_device_get_devnode(dev);
+        if (!node) {
+                acl_device_free(hashmap_remove(c->devices, syspath));
+                return 0;
+        }
+
+        sn = udev_device_get_property_value(dev, "ID_SEAT");
+        if (isempty(sn))
+                sn = "seat0";
+
+        d = hashmap_get(c->devices, syspath);
+        if (!d) {
+                d = new0(AclDevice, 1);
+                if (!d)
+                        return -ENOMEM;
+
+                d->syspath = strdup(syspath);
+                if (!d->syspath) {
+                        acl_device_free(d);
+                        return -ENOMEM;
+                }
+
+                r = hashmap_put(c->devices, d->syspath, d);
+                if (r < 0) {
+                        acl_device_free(d);
+                        return r;
+                }
+        }
+
+        r = free_and_strdup(&d->node, node);
+        if (r < 0)
+                return r;
+
+        r = free_and_strdup(&d->seat, sn);
+        if (r < 0)
+                return r;
+
+        d->uid = UID_INVALID;
+
+        return 1;
+}
+
+void acl_cache_process_device(AclCache *c, struct udev_device *dev) {
+        const char *syspath;
+
+        assert(dev);
+
+        /* Until the first enumeration there is nothing to update */
+        if (!c || !c->enumerated)
+                return;
+
+        /* We see the events of all devices, so that we notice
+         * devices losing the tag too */
+        if (streq_ptr(udev_device_get_action(dev), "remove") ||
+            !udev_device_has_tag(dev, "uaccess")) {
+                syspath = udev_device_get_syspath(dev);
+                if (syspath)
+                        acl_device_free(hashmap_remove(c->devices, syspath));
+
+                return;
+        }
+
+        /* Added or changed, udev ran the uaccess builtin on it again,
+         * so we don't know what its ACL is anymore */
+        if (acl_cache_add(c, dev) < 0) {
+                /* Start over next time, rather than missing a node */
+                log_oom();
+                c->enumerated = false;
+        }
+}
+
+void acl_cache_invalidate(AclCache *c) {
+
+        /* We might have missed events, enumerate again when the
+         * cache is used next */
+        if (c)
+                c->enumerated = false;
+}
+
+static int acl_cache_enumerate(AclCache *c, struct udev *udev) {
+        _cleanup_udev_enumerate_unref_ struct udev_enumerate *e = NULL;
+        struct udev_list_entry *item = NULL, *first = NULL;
+        AclDevice *d;
+        int r;
+
+        assert(c);
+        assert(udev);
+
+        while ((d = hashmap_steal_first(c->devices)))
+                acl_device_free(d);
+
+        e = udev_enumerate_new(udev);
+        if (!e)
+                return -ENOMEM;
+
+        /* We can only match by one tag in libudev. We choose
+         * "uaccess" for that, and remember the seat of each device,
+         * so that the devices of all seats can be kept up-to-date by
+         * the same monitor.*/
+        r = udev_enumerate_add_match_tag(e, "uaccess");
+        if (r < 0)
+                return r;
+
+        r = udev_enumerate_add_match_is_initialized(e);
+        if (r < 0)
+                return r;
+
+        r = udev_enumerate_scan_devices(e);
+        if (r < 0)
+                return r;
+
+        first = udev_enumerate_get_list_entry(e);
+        udev_list_entry_foreach(item, first) {
+                _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
+
+                dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(item));
+                if (!dev)
+                        return -ENOMEM;
+
+                r = acl_cache_add(c, dev);
+                if (r < 0)
+                        return r;
+        }
+
+        c->enumerated = true;
+        return 0;
+}
+
+static bool acl_device_unchanged(AclDevice *d, bool flush, bool add, uid_t new_uid) {
+        assert(d);
+
+        /* Uses what we know about the ACL to skip nodes that are
+         * already the way we want them. Anything else we'd have
+         * removed is already gone in that case, as we only know the
+         * ACL after having set it ourselves. */
+
+        if (flush || d->uid == UID_INVALID)
+                return false;
+
+        return d->uid == (add ? new_uid : 0);
+}
+
+static void acl_device_applied(AclDevice *d, bool flush, bool del, uid_t old_uid, bool add, uid_t new_uid) {
+        assert(d);
+
+        if (flush || (del && old_uid == d->uid))
+                /* Whoever had access before doesn't anymore */
+                d->uid = add ? new_uid : 0;
+        else if (add && (d->uid == 0 || d->uid == new_uid))
+                d->uid = new_uid;
+        else
+                d->uid = UID_INVALID;
+}
+
 int devnode_acl_all(struct udev *udev,
+                    AclCache **cache,
                     const char *seat,
                     bool flush,
                     bool del, uid_t old_uid,
@@ -182,6 +396,8 @@ int devnode_acl_all(struct udev *udev,
         _cleanup_set_free_free_ Set *nodes = NULL;
         _cleanup_closedir_ DIR *dir = NULL;
         struct dirent *dent;
+        unsigned n_unchanged = 0;
+        AclDevice *d;
         Iterator i;
         char *n;
         int r;
@@ -192,13 +408,52 @@ int devnode_acl_all(struct udev *udev,
         if (!nodes)
                 return -ENOMEM;
 
+        if (isempty(seat))
+                seat = "seat0";
+
+        if (cache) {
+                if (!*cache) {
+                        *cache = new0(AclCache, 1);
+                        if (!*cache)
+                                return -ENOMEM;
+
+                        (*cache)->devices = hashmap_new(&string_hash_ops);
+                        if (!(*cache)->devices) {
+                                *cache = mfree(*cache);
+                                return -ENOMEM;
+                        }
+                }
+
+                if (!(*cache)->enumerated) {
+                        r = acl_cache_enumerate(*cache, udev);
+                        if (r < 0)
+                                return r;
+                }
+
+                /* The nodes of the seat we know about, changed
+                 * separately below, so that we can remember what we
+                 * did to them. The static nodes are added to the set
+                 * as usual, unless they are one of these. */
+                HASHMAP_FOREACH(d, (*cache)->devices, i) {
+                        if (!streq(d->seat, seat))
+                                continue;
+
+                        n = strdup(d->node);
+                        if (!n)
+                                return -ENOMEM;
+
+                        r = set_consume(nodes, n);
+                        if (r < 0 && r != -EEXIST)
+                                return r;
+                }
+
+                goto static_nodes;
+        }
+
         e = udev_enumerate_new(udev);
         if (!e)
                 return -ENOMEM;
 
-        if (isempty(seat))
-                seat = "seat0";
-
         /* We can only match by one tag in libudev. We choose
          * "uaccess" for that. If we could match for two tags here we
          * could add the seat name as second match tag, but this would
@@ -218,21 +473,21 @@ int devnode_acl_all(struct udev *udev,
 
         first = udev_enumerate_get_list_entry(e);
         udev_list_entry_foreach(item, first) {
-                _cleanup_udev_device_unref_ struct udev_device *d = NULL;
+                _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
                 const char *node, *sn;
 
-                d = udev_device_new_from_syspath(udev, udev_list_entry_get_name(item));
-                if (!d)
+                dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(item));
+                if (!dev)
                         return -ENOMEM;
 
-                sn = udev_device_get_property_value(d, "ID_SEAT");
+                sn = udev_device_get_property_value(dev, "ID_SEAT");
                 if (isempty(sn))
                         sn = "seat0";
 
                 if (!streq(seat, sn))
                         continue;
 
-                node = udev_device_get_devnode(d);
+                node = udev_device_get_devnode(dev);
                 /* In case people mistag devices with nodes, we need to ignore this */
                 if (!node)
                         continue;
@@ -247,6 +502,7 @@ int devnode_acl_all(struct udev *udev,
                         return r;
         }
 
+static_nodes:
         /* udev exports "dead" device nodes to allow module on-demand loading,
          * these devices are not known to the kernel at this moment */
         dir = opendir("/run/udev/static_node-tags/uaccess");
@@ -271,6 +527,38 @@ int devnode_acl_all(struct udev *udev,
         }
 
         r = 0;
+
+        if (cache)
+                HASHMAP_FOREACH(d, (*cache)->devices, i) {
+                        int k;
+
+                        if (!streq(d->seat, seat))
+                                continue;
+
+                        free(set_remove(nodes, d->node));
+
+                        if (acl_device_unchanged(d, flush, add, new_uid)) {
+                                n_unchanged++;
+                                continue;
+                        }
+
+                        log_debug("Changing ACLs at %s for seat %s (uid "UID_FMT"→"UID_FMT"%s%s)",
+                                  d->node, seat, old_uid, new_uid,
+                                  del ? " del" : "", add ? " add" : "");
+
+                        k = devnode_acl(d->node, flush, del, old_uid, add, new_uid);
+                        if (k >= 0)
+                                acl_device_applied(d, flush, del, old_uid, add, new_uid);
+                        else {
+                                d->uid = UID_INVALID;
+
+                                if (k == -ENOENT)
+                                        log_debug("Device %s disappeared while setting ACLs", d->node);
+                                else if (r == 0)
+                                        r = k;
+                        }
+                }
+
         SET_FOREACH(n, nodes, i) {
                 int k;
 
@@ -285,5 +573,8 @@ int devnode_acl_all(struct udev *udev,
                         r = k;
         }
 
+        if (n_unchanged > 0)
+                log_debug("Left ACLs of %u nodes of seat %s unchanged", n_unchanged, seat);
+
         return r;
 }
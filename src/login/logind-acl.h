@@ -25,6 +25,10 @@
 #include <stdbool.h>
 #include <libudev.h>
 
+/* The device nodes tagged "uaccess" and what we last did to their
+ * ACLs, kept up-to-date from udev events */
+typedef struct AclCache AclCache;
+
 #ifdef HAVE_ACL
 
 int devnode_acl(const char *path,
@@ -32,11 +36,19 @@ int devnode_acl(const char *path,
                 bool del, uid_t old_uid,
                 bool add, uid_t new_uid);
 
+/* If cache is NULL all devices of the seat are enumerated, otherwise
+ * the cache is allocated and filled as needed, and nodes whose ACL is
+ * already right are left alone */
 int devnode_acl_all(struct udev *udev,
+                    AclCache **cache,
                     const char *seat,
                     bool flush,
                     bool del, uid_t old_uid,
                     bool add, uid_t new_uid);
+
+AclCache *acl_cache_free(AclCache *c);
+void acl_cache_process_device(AclCache *c, struct udev_device *d);
+void acl_cache_invalidate(AclCache *c);
 #else
 
 static inline int devnode_acl(const char *path,
@@ -47,6 +59,7 @@ static inline int devnode_acl(const char *path,
 }
 
 static inline int devnode_acl_all(struct udev *udev,
+                                  AclCache **cache,
                                   const char *seat,
                                   bool flush,
                                   bool del, uid_t old_uid,
@@ -54,4 +67,14 @@ static inline int devnode_acl_all(struct udev *udev,
         return 0;
 }
 
+static inline AclCache *acl_cache_free(AclCache *c) {
+        return NULL;
+}
+
+static inline void acl_cache_process_device(AclCache *c, struct udev_device *d) {
+}
+
+static inline void acl_cache_invalidate(AclCache *c) {
+}
+
 #endif
@@ -29,6 +29,7 @@
 #include "logind-acl.h"
 #include "util.h"
 #include "mkdir.h"
+#include "fileio.h"
 #include "formats-util.h"
 #include "terminal-util.h"
 
@@ -82,8 +83,9 @@ void seat_free(Seat *s) {
 }
 
 int seat_save(Seat *s) {
-        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_free_ char *content = NULL;
         _cleanup_fclose_ FILE *f = NULL;
+        size_t size;
         int r;
 
         assert(s);
@@ -95,11 +97,11 @@ int seat_save(Seat *s) {
         if (r < 0)
                 goto fail;
 
-        r = fopen_temporary(s->state_file, &f, &temp_path);
-        if (r < 0)
+        f = open_memstream(&content, &size);
+        if (!f) {
+                r = -ENOMEM;
                 goto fail;
-
-        fchmod(fileno(f), 0644);
+        }
 
         fprintf(f,
                 "# This is private data. Do not parse.\n"
@@ -145,19 +147,17 @@ int seat_save(Seat *s) {
         if (r < 0)
                 goto fail;
 
-        if (rename(temp_path, s->state_file) < 0) {
-                r = -errno;
+        r = write_string_file(s->state_file, content,
+                              WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_ATOMIC|
+                              WRITE_STRING_FILE_AVOID_NEWLINE|WRITE_STRING_FILE_ONLY_IF_CHANGED);
+        if (r < 0)
                 goto fail;
-        }
 
         return 0;
 
 fail:
         (void) unlink(s->state_file);
 
-        if (temp_path)
-                (void) unlink(temp_path);
-
         return log_error_errno(r, "Failed to save seat data %s: %m", s->state_file);
 }
 
@@ -217,6 +217,7 @@ int seat_apply_acls(Seat *s, Session *old_active) {
         assert(s);
 
         r = devnode_acl_all(s->manager->udev,
+                            &s->manager->acl_cache,
                             s->id,
                             false,
                             !!old_active, old_active ? old_active->user->uid : 0,
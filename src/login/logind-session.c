@@ -151,8 +151,9 @@ void session_set_user(Session *s, User *u) {
 }
 
 int session_save(Session *s) {
-        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_free_ char *content = NULL;
         _cleanup_fclose_ FILE *f = NULL;
+        size_t size;
         int r = 0;
 
         assert(s);
@@ -167,14 +168,14 @@ int session_save(Session *s) {
         if (r < 0)
                 goto fail;
 
-        r = fopen_temporary(s->state_file, &f, &temp_path);
-        if (r < 0)
+        f = open_memstream(&content, &size);
+        if (!f) {
+                r = -ENOMEM;
                 goto fail;
+        }
 
         assert(s->user);
 
-        fchmod(fileno(f), 0644);
-
         fprintf(f,
                 "# This is private data. Do not parse.\n"
                 "UID="UID_FMT"\n"
@@ -286,19 +287,17 @@ int session_save(Session *s) {
         if (r < 0)
                 goto fail;
 
-        if (rename(temp_path, s->state_file) < 0) {
-                r = -errno;
+        r = write_string_file(s->state_file, content,
+                              WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_ATOMIC|
+                              WRITE_STRING_FILE_AVOID_NEWLINE|WRITE_STRING_FILE_ONLY_IF_CHANGED);
+        if (r < 0)
                 goto fail;
-        }
 
         return 0;
 
 fail:
         (void) unlink(s->state_file);
 
-        if (temp_path)
-                (void) unlink(temp_path);
-
         return log_error_errno(r, "Failed to save session data %s: %m", s->state_file);
 }
 
@@ -776,6 +775,39 @@ static int get_process_ctty_atime(pid_t pid, usec_t *atime) {
         return get_tty_atime(p, atime);
 }
 
+static int session_get_tty_atime(Session *s, usec_t *atime) {
+        usec_t n;
+        int r = -ENOENT;
+
+        assert(s);
+        assert(atime);
+
+        /* The kernel only updates the atime of a TTY every 8s, hence
+         * don't look at it more often than configured */
+        n = now(CLOCK_MONOTONIC);
+        if (s->tty_atime_timestamp > 0 &&
+            s->tty_atime_timestamp + s->manager->idle_hint_cache_usec > n) {
+                *atime = s->tty_atime;
+                return s->tty_atime_result;
+        }
+
+        /* For sessions with an explicitly configured tty, let's check
+         * its atime */
+        if (s->tty)
+                r = get_tty_atime(s->tty, atime);
+
+        /* For sessions with a leader but no explicitly configured
+         * tty, let's check the controlling tty of the leader */
+        if (r < 0 && s->leader > 0)
+                r = get_process_ctty_atime(s->leader, atime);
+
+        s->tty_atime = r >= 0 ? *atime : 0;
+        s->tty_atime_result = r;
+        s->tty_atime_timestamp = n;
+
+        return r;
+}
+
 int session_get_idle_hint(Session *s, dual_timestamp *t) {
         usec_t atime = 0, n;
         int r;
@@ -795,21 +827,9 @@ int session_get_idle_hint(Session *s, dual_timestamp *t) {
         if (s->display)
                 goto dont_know;
 
-        /* For sessions with an explicitly configured tty, let's check
-         * its atime */
-        if (s->tty) {
-                r = get_tty_atime(s->tty, &atime);
-                if (r >= 0)
-                        goto found_atime;
-        }
-
-        /* For sessions with a leader but no explicitly configured
-         * tty, let's check the controlling tty of the leader */
-        if (s->leader > 0) {
-                r = get_process_ctty_atime(s->leader, &atime);
-                if (r >= 0)
-                        goto found_atime;
-        }
+        r = session_get_tty_atime(s, &atime);
+        if (r >= 0)
+                goto found_atime;
 
 dont_know:
         if (t)
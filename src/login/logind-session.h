@@ -107,6 +107,12 @@ struct Session {
         bool idle_hint;
         dual_timestamp idle_hint_timestamp;
 
+        /* The last atime read from the TTY of the session, the
+         * result of reading it, and when that was */
+        usec_t tty_atime;
+        int tty_atime_result;
+        usec_t tty_atime_timestamp;
+
         bool in_gc_queue:1;
         bool started:1;
         bool stopping:1;
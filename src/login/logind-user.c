@@ -107,8 +107,9 @@ void user_free(User *u) {
 }
 
 static int user_save_internal(User *u) {
-        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_free_ char *content = NULL;
         _cleanup_fclose_ FILE *f = NULL;
+        size_t size;
         int r;
 
         assert(u);
@@ -118,11 +119,11 @@ static int user_save_internal(User *u) {
         if (r < 0)
                 goto fail;
 
-        r = fopen_temporary(u->state_file, &f, &temp_path);
-        if (r < 0)
+        f = open_memstream(&content, &size);
+        if (!f) {
+                r = -ENOMEM;
                 goto fail;
-
-        fchmod(fileno(f), 0644);
+        }
 
         fprintf(f,
                 "# This is private data. Do not parse.\n"
@@ -245,19 +246,17 @@ static int user_save_internal(User *u) {
         if (r < 0)
                 goto fail;
 
-        if (rename(temp_path, u->state_file) < 0) {
-                r = -errno;
+        r = write_string_file(u->state_file, content,
+                              WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_ATOMIC|
+                              WRITE_STRING_FILE_AVOID_NEWLINE|WRITE_STRING_FILE_ONLY_IF_CHANGED);
+        if (r < 0)
                 goto fail;
-        }
 
         return 0;
 
 fail:
         (void) unlink(u->state_file);
 
-        if (temp_path)
-                (void) unlink(temp_path);
-
         return log_error_errno(r, "Failed to save user data %s: %m", u->state_file);
 }
 
@@ -61,6 +61,7 @@ static Manager *manager_new(void) {
         m->holdoff_timeout_usec = 30 * USEC_PER_SEC;
 
         m->idle_action_usec = 30 * USEC_PER_MINUTE;
+        m->idle_hint_cache_usec = 5 * USEC_PER_SEC;
         m->idle_action = HANDLE_IGNORE;
         m->idle_action_not_before_usec = now(CLOCK_MONOTONIC);
 
@@ -149,6 +150,7 @@ static void manager_free(Manager *m) {
         sd_event_source_unref(m->udev_device_event_source);
         sd_event_source_unref(m->udev_vcsa_event_source);
         sd_event_source_unref(m->udev_button_event_source);
+        sd_event_source_unref(m->udev_uaccess_event_source);
         sd_event_source_unref(m->lid_switch_ignore_event_source);
 
         safe_close(m->console_active_fd);
@@ -157,6 +159,9 @@ static void manager_free(Manager *m) {
         udev_monitor_unref(m->udev_device_monitor);
         udev_monitor_unref(m->udev_vcsa_monitor);
         udev_monitor_unref(m->udev_button_monitor);
+        udev_monitor_unref(m->udev_uaccess_monitor);
+
+        acl_cache_free(m->acl_cache);
 
         udev_unref(m->udev);
 
@@ -543,6 +548,26 @@ static int manager_dispatch_button_udev(sd_event_source *s, int fd, uint32_t rev
         return 0;
 }
 
+static int manager_dispatch_uaccess_udev(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        _cleanup_udev_device_unref_ struct udev_device *d = NULL;
+        Manager *m = userdata;
+
+        assert(m);
+
+        d = udev_monitor_receive_device(m->udev_uaccess_monitor);
+        if (!d) {
+                /* Not necessarily out of memory, the event might
+                 * have been lost in the socket buffer, or been
+                 * malformed. Either way we can't trust the cache
+                 * anymore. */
+                acl_cache_invalidate(m->acl_cache);
+                return 0;
+        }
+
+        acl_cache_process_device(m->acl_cache, d);
+        return 0;
+}
+
 static int manager_dispatch_console(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         Manager *m = userdata;
 
@@ -588,6 +613,10 @@ static int manager_connect_bus(Manager *m) {
         if (r < 0)
                 return log_error_errno(r, "Failed to connect to system bus: %m");
 
+        r = sd_bus_set_statistics(m->bus, true);
+        if (r < 0)
+                log_warning_errno(r, "Failed to enable bus statistics, ignoring: %m");
+
         r = sd_bus_add_object_vtable(m->bus, NULL, "/org/freedesktop/login1", "org.freedesktop.login1.Manager", manager_vtable, m);
         if (r < 0)
                 return log_error_errno(r, "Failed to add manager object vtable: %m");
@@ -784,6 +813,7 @@ static int manager_connect_udev(Manager *m) {
         assert(!m->udev_device_monitor);
         assert(!m->udev_vcsa_monitor);
         assert(!m->udev_button_monitor);
+        assert(!m->udev_uaccess_monitor);
 
         m->udev_seat_monitor = udev_monitor_new_from_netlink(m->udev, "udev");
         if (!m->udev_seat_monitor)
@@ -853,6 +883,24 @@ static int manager_connect_udev(Manager *m) {
                         return r;
         }
 
+#ifdef HAVE_ACL
+        /* Keeps the list of devices whose ACLs we manage current, so
+         * that we don't have to ask udev for it on every seat
+         * switch. This doesn't filter by the "uaccess" tag, as the
+         * events of devices that just lost it would not pass. */
+        m->udev_uaccess_monitor = udev_monitor_new_from_netlink(m->udev, "udev");
+        if (!m->udev_uaccess_monitor)
+                return -ENOMEM;
+
+        r = udev_monitor_enable_receiving(m->udev_uaccess_monitor);
+        if (r < 0)
+                return r;
+
+        r = sd_event_add_io(m->event, &m->udev_uaccess_event_source, udev_monitor_get_fd(m->udev_uaccess_monitor), EPOLLIN, manager_dispatch_uaccess_udev, m);
+        if (r < 0)
+                return r;
+#endif
+
         /* Don't bother watching VCSA devices, if nobody cares */
         if (m->n_autovts > 0 && m->console_active_fd >= 0) {
 
@@ -36,6 +36,7 @@ typedef struct Manager Manager;
 #include "logind-inhibit.h"
 #include "logind-button.h"
 #include "logind-action.h"
+#include "logind-acl.h"
 
 struct Manager {
         sd_event *event;
@@ -53,13 +54,16 @@ struct Manager {
         LIST_HEAD(User, user_gc_queue);
 
         struct udev *udev;
-        struct udev_monitor *udev_seat_monitor, *udev_device_monitor, *udev_vcsa_monitor, *udev_button_monitor;
+        struct udev_monitor *udev_seat_monitor, *udev_device_monitor, *udev_vcsa_monitor, *udev_button_monitor, *udev_uaccess_monitor;
 
         sd_event_source *console_active_event_source;
         sd_event_source *udev_seat_event_source;
         sd_event_source *udev_device_event_source;
         sd_event_source *udev_vcsa_event_source;
         sd_event_source *udev_button_event_source;
+        sd_event_source *udev_uaccess_event_source;
+
+        AclCache *acl_cache;
 
         int console_active_fd;
 
@@ -111,6 +115,7 @@ struct Manager {
 
         sd_event_source *idle_action_event_source;
         usec_t idle_action_usec;
+        usec_t idle_hint_cache_usec;
         usec_t idle_action_not_before_usec;
         HandleAction idle_action;
 
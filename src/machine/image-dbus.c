@@ -19,12 +19,18 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
 #include "bus-label.h"
 #include "strv.h"
 #include "bus-util.h"
 #include "machine-image.h"
 #include "image-dbus.h"
 
+/* How long the usage of images is trusted, see image_inventory_get() */
+#define IMAGE_INVENTORY_MAX_AGE_USEC (5 * USEC_PER_SEC)
+
 static BUS_DEFINE_PROPERTY_GET_ENUM(property_get_type, image_type, ImageType);
 
 int bus_image_method_remove(
@@ -57,6 +63,8 @@ int bus_image_method_remove(
         if (r < 0)
                 return r;
 
+        image_inventory_flush(m);
+
         return sd_bus_reply_method_return(message, NULL);
 }
 
@@ -98,6 +106,8 @@ int bus_image_method_rename(
         if (r < 0)
                 return r;
 
+        image_inventory_flush(m);
+
         return sd_bus_reply_method_return(message, NULL);
 }
 
@@ -139,6 +149,8 @@ int bus_image_method_clone(
         if (r < 0)
                 return r;
 
+        image_inventory_flush(m);
+
         return sd_bus_reply_method_return(message, NULL);
 }
 
@@ -175,6 +187,8 @@ int bus_image_method_mark_read_only(
         if (r < 0)
                 return r;
 
+        image_inventory_flush(m);
+
         return sd_bus_reply_method_return(message, NULL);
 }
 
@@ -212,6 +226,8 @@ int bus_image_method_set_limit(
         if (r < 0)
                 return r;
 
+        image_inventory_flush(m);
+
         return sd_bus_reply_method_return(message, NULL);
 }
 
@@ -321,8 +337,9 @@ char *image_bus_path(const char *name) {
 }
 
 int image_node_enumerator(sd_bus *bus, const char *path, void *userdata, char ***nodes, sd_bus_error *error) {
-        _cleanup_(image_hashmap_freep) Hashmap *images = NULL;
         _cleanup_strv_free_ char **l = NULL;
+        Manager *m = userdata;
+        Hashmap *images;
         Image *image;
         Iterator i;
         int r;
@@ -331,11 +348,7 @@ int image_node_enumerator(sd_bus *bus, const char *path, void *userdata, char **
         assert(path);
         assert(nodes);
 
-        images = hashmap_new(&string_hash_ops);
-        if (!images)
-                return -ENOMEM;
-
-        r = image_discover(images);
+        r = image_inventory_get(m, &images);
         if (r < 0)
                 return r;
 
@@ -356,3 +369,99 @@ int image_node_enumerator(sd_bus *bus, const char *path, void *userdata, char **
 
         return 1;
 }
+
+void image_inventory_flush(Manager *m) {
+        Image *i;
+
+        assert(m);
+
+        m->image_inventory_event_source = sd_event_source_unref(m->image_inventory_event_source);
+        m->image_inventory_inotify_fd = safe_close(m->image_inventory_inotify_fd);
+
+        while ((i = hashmap_steal_first(m->image_inventory)))
+                image_unref(i);
+
+        m->image_inventory = hashmap_free(m->image_inventory);
+        m->image_inventory_timestamp = 0;
+}
+
+static int image_inventory_on_inotify(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        /* Something changed in one of the image directories, we
+         * don't care what exactly, and simply discover everything
+         * again the next time we are asked */
+        image_inventory_flush(m);
+
+        return 0;
+}
+
+static int image_inventory_watch(Manager *m) {
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        assert(m);
+
+        fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        r = image_discover_watch(fd);
+        if (r < 0)
+                return r;
+
+        r = sd_event_add_io(m->event, &m->image_inventory_event_source, fd, EPOLLIN, image_inventory_on_inotify, m);
+        if (r < 0)
+                return r;
+
+        m->image_inventory_inotify_fd = fd;
+        fd = -1;
+
+        return 0;
+}
+
+int image_inventory_get(Manager *m, Hashmap **ret) {
+        int r;
+
+        assert(m);
+        assert(ret);
+
+        /* Returns all images. They are owned by the manager and
+         * stay valid until we return to the event loop. The
+         * inotify watches only notice images being added, removed,
+         * or written to directly, not changes deep inside of an
+         * image tree, hence the usage of directory and subvolume
+         * images is queried again after a short while. */
+
+        if (m->image_inventory &&
+            m->image_inventory_timestamp + IMAGE_INVENTORY_MAX_AGE_USEC > now(CLOCK_MONOTONIC)) {
+                *ret = m->image_inventory;
+                return 0;
+        }
+
+        image_inventory_flush(m);
+
+        /* Establish the watches first, so that we don't miss any
+         * change that happens while we discover the images */
+        r = image_inventory_watch(m);
+        if (r < 0)
+                log_debug_errno(r, "Failed to watch image directories, not caching images: %m");
+
+        m->image_inventory = hashmap_new(&string_hash_ops);
+        if (!m->image_inventory)
+                return -ENOMEM;
+
+        r = image_discover(m->image_inventory);
+        if (r < 0) {
+                image_inventory_flush(m);
+                return r;
+        }
+
+        if (m->image_inventory_event_source)
+                m->image_inventory_timestamp = now(CLOCK_MONOTONIC);
+
+        *ret = m->image_inventory;
+        return 0;
+}
@@ -59,6 +59,8 @@ Manager *manager_new(void) {
 
         sd_event_set_watchdog(m->event, true);
 
+        m->image_inventory_inotify_fd = -1;
+
         return m;
 }
 
@@ -82,6 +84,8 @@ void manager_free(Manager *m) {
 
         sd_event_source_unref(m->image_cache_defer_event);
 
+        image_inventory_flush(m);
+
         bus_verify_polkit_async_registry_free(m->polkit_registry);
 
         sd_bus_unref(m->bus);
@@ -47,6 +47,13 @@ struct Manager {
         Hashmap *image_cache;
         sd_event_source *image_cache_defer_event;
 
+        /* All discovered images, kept until inotify tells us one of
+         * the image directories changed */
+        Hashmap *image_inventory;
+        usec_t image_inventory_timestamp;
+        int image_inventory_inotify_fd;
+        sd_event_source *image_inventory_event_source;
+
         LIST_HEAD(Machine, machine_gc_queue);
 
         Machine *host_machine;
@@ -23,6 +23,7 @@
 
 #include "utf8.h"
 #include "util.h"
+#include "siphash24.h"
 #include "conf-parser.h"
 #include "firewall-util.h"
 #include "netlink-util.h"
@@ -587,49 +588,88 @@ int config_parse_label(const char *unit,
         return 0;
 }
 
-bool address_equal(Address *a1, Address *a2) {
-        /* same object */
-        if (a1 == a2)
-                return true;
+static uint32_t address_ipv4_prefix(const Address *a) {
+        /* make sure we don't try to shift by 32.
+         * See ISO/IEC 9899:TC3 § 6.5.7.3. */
+        if (a->prefixlen == 0)
+                return 0;
 
-        /* one, but not both, is NULL */
-        if (!a1 || !a2)
-                return false;
+        return be32toh(a->in_addr.in.s_addr) >> (32 - a->prefixlen);
+}
+
+static unsigned long address_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        const Address *a = p;
+        struct {
+                int family;
+                uint32_t prefixlen;
+                union in_addr_union in_addr;
+        } key = {
+                .family = a->family,
+        };
+        uint64_t u;
+
+        /* Hashes exactly what address_compare_func() looks at */
+
+        switch (a->family) {
+        case AF_INET:
+                key.prefixlen = a->prefixlen;
+                key.in_addr.in.s_addr = address_ipv4_prefix(a);
+                break;
+
+        case AF_INET6:
+                key.in_addr.in6 = a->in_addr.in6;
+                break;
+        }
+
+        siphash24((uint8_t*) &u, &key, sizeof(key), hash_key);
+
+        return (unsigned long) u;
+}
+
+static int address_compare_func(const void *c1, const void *c2) {
+        const Address *a1 = c1, *a2 = c2;
 
         if (a1->family != a2->family)
-                return false;
+                return a1->family < a2->family ? -1 : 1;
 
         switch (a1->family) {
         /* use the same notion of equality as the kernel does */
         case AF_UNSPEC:
-                return true;
+                return 0;
 
-        case AF_INET:
-                if (a1->prefixlen != a2->prefixlen)
-                        return false;
-                else if (a1->prefixlen == 0)
-                        /* make sure we don't try to shift by 32.
-                         * See ISO/IEC 9899:TC3 § 6.5.7.3. */
-                        return true;
-                else {
-                        uint32_t b1, b2;
-
-                        b1 = be32toh(a1->in_addr.in.s_addr);
-                        b2 = be32toh(a2->in_addr.in.s_addr);
-
-                        return (b1 >> (32 - a1->prefixlen)) == (b2 >> (32 - a1->prefixlen));
-                }
+        case AF_INET: {
+                uint32_t b1, b2;
 
-        case AF_INET6: {
-                uint64_t *b1, *b2;
+                if (a1->prefixlen != a2->prefixlen)
+                        return a1->prefixlen < a2->prefixlen ? -1 : 1;
 
-                b1 = (uint64_t*)&a1->in_addr.in6;
-                b2 = (uint64_t*)&a2->in_addr.in6;
+                b1 = address_ipv4_prefix(a1);
+                b2 = address_ipv4_prefix(a2);
 
-                return (((b1[0] ^ b2[0]) | (b1[1] ^ b2[1])) == 0UL);
+                return b1 < b2 ? -1 : (b1 > b2 ? 1 : 0);
         }
 
+        case AF_INET6:
+                return memcmp(&a1->in_addr.in6, &a2->in_addr.in6, sizeof(struct in6_addr));
+
         default:
                 assert_not_reached("Invalid address family");
         }
 }
+
+const struct hash_ops address_hash_ops = {
+        .hash = address_hash_func,
+        .compare = address_compare_func
+};
+
+bool address_equal(Address *a1, Address *a2) {
+        /* same object */
+        if (a1 == a2)
+                return true;
+
+        /* one, but not both, is NULL */
+        if (!a1 || !a2)
+                return false;
+
+        return address_compare_func(a1, a2) == 0;
+}
@@ -65,6 +65,9 @@ int address_establish(Address *address, Link *link);
 int address_release(Address *address, Link *link);
 bool address_equal(Address *a1, Address *a2);
 
+/* Hashes and compares addresses by address_equal() */
+extern const struct hash_ops address_hash_ops;
+
 DEFINE_TRIVIAL_CLEANUP_FUNC(Address*, address_free);
 #define _cleanup_address_free_ _cleanup_(address_freep)
 
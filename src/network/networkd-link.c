@@ -27,6 +27,7 @@
 #include "virt.h"
 #include "fileio.h"
 #include "socket-util.h"
+#include "set.h"
 #include "bus-util.h"
 #include "udev-util.h"
 #include "netlink-util.h"
@@ -201,7 +202,7 @@ static int link_update_flags(Link *link, sd_netlink_message *m) {
         link->flags = flags;
         link->kernel_operstate = operstate;
 
-        link_save(link);
+        link_dirty(link);
 
         return 0;
 }
@@ -295,6 +296,7 @@ static void link_free(Link *link) {
                 LIST_REMOVE(addresses, link->addresses, address);
                 address_free(address);
         }
+        set_free(link->addresses_by_key);
 
         while ((address = link->pool_addresses)) {
                 LIST_REMOVE(addresses, link->pool_addresses, address);
@@ -385,7 +387,7 @@ static void link_enter_unmanaged(Link *link) {
 
         link_set_state(link, LINK_STATE_UNMANAGED);
 
-        link_save(link);
+        link_dirty(link);
 }
 
 static int link_stop_clients(Link *link) {
@@ -443,7 +445,7 @@ void link_enter_failed(Link *link) {
 
         link_stop_clients(link);
 
-        link_save(link);
+        link_dirty(link);
 }
 
 static Address* link_find_dhcp_server_address(Link *link) {
@@ -484,7 +486,7 @@ static int link_enter_configured(Link *link) {
 
         link_set_state(link, LINK_STATE_CONFIGURED);
 
-        link_save(link);
+        link_dirty(link);
 
         return 0;
 }
@@ -547,10 +549,14 @@ static int link_enter_set_routes(Link *link) {
 
         link_set_state(link, LINK_STATE_SETTING_ROUTES);
 
+        /* Write all routes in as few datagrams as possible */
+        (void) sd_netlink_cork(link->manager->rtnl, true);
+
         LIST_FOREACH(routes, rt, link->network->static_routes) {
                 r = route_configure(rt, link, &route_handler);
                 if (r < 0) {
                         log_link_warning_errno(link, r, "Could not set routes: %m");
+                        (void) sd_netlink_cork(link->manager->rtnl, false);
                         link_enter_failed(link);
                         return r;
                 }
@@ -558,6 +564,10 @@ static int link_enter_set_routes(Link *link) {
                 link->link_messages ++;
         }
 
+        r = sd_netlink_cork(link->manager->rtnl, false);
+        if (r < 0)
+                log_link_debug_errno(link, r, "Could not write some routes: %m");
+
         if (link->link_messages == 0) {
                 link->static_configured = true;
                 link_client_handler(link);
@@ -716,10 +726,14 @@ static int link_enter_set_addresses(Link *link) {
 
         link_set_state(link, LINK_STATE_SETTING_ADDRESSES);
 
+        /* Write all addresses in as few datagrams as possible */
+        (void) sd_netlink_cork(link->manager->rtnl, true);
+
         LIST_FOREACH(addresses, ad, link->network->static_addresses) {
                 r = address_configure(ad, link, &address_handler);
                 if (r < 0) {
                         log_link_warning_errno(link, r, "Could not set addresses: %m");
+                        (void) sd_netlink_cork(link->manager->rtnl, false);
                         link_enter_failed(link);
                         return r;
                 }
@@ -727,6 +741,10 @@ static int link_enter_set_addresses(Link *link) {
                 link->link_messages ++;
         }
 
+        r = sd_netlink_cork(link->manager->rtnl, false);
+        if (r < 0)
+                log_link_debug_errno(link, r, "Could not write some addresses: %m");
+
         /* now that we can figure out a default address for the dhcp server,
            start it */
         if (link_dhcp4_server_enabled(link)) {
@@ -1424,14 +1442,14 @@ static int link_new_bound_by_list(Link *link) {
         }
 
         if (list_updated)
-                link_save(link);
+                link_dirty(link);
 
         HASHMAP_FOREACH (carrier, link->bound_by_links, i) {
                 r = link_put_carrier(carrier, link, &carrier->bound_to_links);
                 if (r < 0)
                         return r;
 
-                link_save(carrier);
+                link_dirty(carrier);
         }
 
         return 0;
@@ -1466,14 +1484,14 @@ static int link_new_bound_to_list(Link *link) {
         }
 
         if (list_updated)
-                link_save(link);
+                link_dirty(link);
 
         HASHMAP_FOREACH (carrier, link->bound_to_links, i) {
                 r = link_put_carrier(carrier, link, &carrier->bound_by_links);
                 if (r < 0)
                         return r;
 
-                link_save(carrier);
+                link_dirty(carrier);
         }
 
         return 0;
@@ -1509,7 +1527,7 @@ static void link_free_bound_to_list(Link *link) {
                 hashmap_remove(link->bound_to_links, INT_TO_PTR(bound_to->ifindex));
 
                 if (hashmap_remove(bound_to->bound_by_links, INT_TO_PTR(link->ifindex)))
-                        link_save(bound_to);
+                        link_dirty(bound_to);
         }
 
         return;
@@ -1523,7 +1541,7 @@ static void link_free_bound_by_list(Link *link) {
                 hashmap_remove(link->bound_by_links, INT_TO_PTR(bound_by->ifindex));
 
                 if (hashmap_remove(bound_by->bound_to_links, INT_TO_PTR(link->ifindex))) {
-                        link_save(bound_by);
+                        link_dirty(bound_by);
                         link_handle_bound_to_list(bound_by);
                 }
         }
@@ -1547,7 +1565,7 @@ static void link_free_carrier_maps(Link *link) {
         }
 
         if (list_updated)
-                link_save(link);
+                link_dirty(link);
 
         return;
 }
@@ -1631,7 +1649,7 @@ static int link_enter_join_netdev(Link *link) {
 
         link_set_state(link, LINK_STATE_ENSLAVING);
 
-        link_save(link);
+        link_dirty(link);
 
         if (!link->network->bridge &&
             !link->network->bond &&
@@ -1961,16 +1979,10 @@ int link_initialized(Link *link, struct udev_device *device) {
 }
 
 static Address* link_get_equal_address(Link *link, Address *needle) {
-        Address *i;
-
         assert(link);
         assert(needle);
 
-        LIST_FOREACH(addresses, i, link->addresses)
-                if (address_equal(i, needle))
-                        return i;
-
-        return NULL;
+        return set_get(link->addresses_by_key, needle);
 }
 
 int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, void *userdata) {
@@ -2105,12 +2117,20 @@ int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, voi
                 } else {
                         log_link_debug(link, "Adding address: %s/%u (valid for %s)", buf, address->prefixlen, valid_str);
 
+                        r = set_ensure_allocated(&link->addresses_by_key, &address_hash_ops);
+                        if (r < 0)
+                                return log_oom();
+
+                        r = set_put(link->addresses_by_key, address);
+                        if (r < 0)
+                                return log_oom();
+
                         LIST_PREPEND(addresses, link->addresses, address);
                         address_establish(address, link);
 
                         address = NULL;
 
-                        link_save(link);
+                        link_dirty(link);
                 }
 
                 break;
@@ -2120,6 +2140,7 @@ int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, voi
                 if (existing) {
                         log_link_debug(link, "Removing address: %s/%u (valid for %s)", buf, address->prefixlen, valid_str);
                         address_release(existing, link);
+                        set_remove(link->addresses_by_key, existing);
                         LIST_REMOVE(addresses, link->addresses, existing);
                         address_free(existing);
                 } else
@@ -2404,6 +2425,37 @@ static void link_update_operstate(Link *link) {
         }
 }
 
+void link_dirty(Link *link) {
+        int r;
+
+        assert(link);
+        assert(link->manager);
+
+        /* The operational state is exposed on the bus right away,
+         * the state files are written once the event loop
+         * iteration is done, however often this is called until
+         * then. */
+
+        link_update_operstate(link);
+        manager_dirty(link->manager);
+
+        r = set_ensure_allocated(&link->manager->dirty_links, NULL);
+        if (r < 0) {
+                log_oom();
+                return;
+        }
+
+        r = set_put(link->manager->dirty_links, link);
+        if (r <= 0) {
+                /* already dirty, or out of memory */
+                if (r < 0)
+                        log_oom();
+                return;
+        }
+
+        link_ref(link);
+}
+
 int link_save(Link *link) {
         _cleanup_free_ char *temp_path = NULL;
         _cleanup_fclose_ FILE *f = NULL;
@@ -2417,10 +2469,6 @@ int link_save(Link *link) {
 
         link_update_operstate(link);
 
-        r = manager_save(link->manager);
-        if (r < 0)
-                return r;
-
         if (link->state == LINK_STATE_LINGER) {
                 unlink(link->state_file);
                 return 0;
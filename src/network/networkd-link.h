@@ -84,6 +84,7 @@ struct Link {
         unsigned enslaving;
 
         LIST_HEAD(Address, addresses);
+        Set *addresses_by_key; /* the same, indexed by address_hash_ops */
 
         sd_dhcp_client *dhcp_client;
         sd_dhcp_lease *dhcp_lease;
@@ -131,6 +132,7 @@ int link_update(Link *link, sd_netlink_message *message);
 int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, void *userdata);
 
 int link_save(Link *link);
+void link_dirty(Link *link);
 
 int link_carrier_reset(Link *link);
 bool link_has_carrier(Link *link);
@@ -381,6 +381,49 @@ static int systemd_netlink_fd(void) {
         return rtnl_fd;
 }
 
+static int on_rtnl_resync(sd_event_source *s, void *userdata) {
+        Manager *m = userdata;
+        int r;
+
+        assert(m);
+
+        m->rtnl_resync_event_source = sd_event_source_unref(m->rtnl_resync_event_source);
+
+        /* We only keep track of links and their addresses, hence
+         * these are all we need to dump again */
+
+        log_debug("rtnl: Lost notifications, enumerating links and addresses again.");
+
+        r = manager_rtnl_enumerate_links(m);
+        if (r < 0)
+                log_warning_errno(r, "rtnl: Could not enumerate links: %m");
+
+        r = manager_rtnl_enumerate_addresses(m);
+        if (r < 0)
+                log_warning_errno(r, "rtnl: Could not enumerate addresses: %m");
+
+        return 0;
+}
+
+static int manager_rtnl_overrun(sd_netlink *rtnl, void *userdata) {
+        Manager *m = userdata;
+        int r;
+
+        assert(m);
+
+        /* Resynchronize once we are done with what is queued */
+        if (m->rtnl_resync_event_source)
+                return 0;
+
+        r = sd_event_add_defer(m->event, &m->rtnl_resync_event_source, on_rtnl_resync, m);
+        if (r < 0)
+                return log_warning_errno(r, "rtnl: Could not schedule enumeration: %m");
+
+        (void) sd_event_source_set_priority(m->rtnl_resync_event_source, SD_EVENT_PRIORITY_IDLE);
+
+        return 0;
+}
+
 static int manager_connect_rtnl(Manager *m) {
         int fd, r;
 
@@ -402,6 +445,10 @@ static int manager_connect_rtnl(Manager *m) {
         if (r < 0)
                 return r;
 
+        r = sd_netlink_set_overrun_handler(m->rtnl, &manager_rtnl_overrun, m);
+        if (r < 0)
+                return r;
+
         r = sd_netlink_add_match(m->rtnl, RTM_NEWLINK, &manager_rtnl_process_link, m);
         if (r < 0)
                 return r;
@@ -421,6 +468,32 @@ static int manager_connect_rtnl(Manager *m) {
         return 0;
 }
 
+static int manager_dirty_handler(sd_event_source *s, void *userdata) {
+        Manager *m = userdata;
+        Link *link;
+        int r;
+
+        assert(m);
+
+        if (m->dirty) {
+                m->dirty = false;
+
+                r = manager_save(m);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to save manager state: %m");
+        }
+
+        while ((link = set_steal_first(m->dirty_links))) {
+                r = link_save(link);
+                if (r < 0)
+                        log_link_warning_errno(link, r, "Failed to save link state: %m");
+
+                link_unref(link);
+        }
+
+        return 0;
+}
+
 int manager_new(Manager **ret) {
         _cleanup_manager_free_ Manager *m = NULL;
         int r;
@@ -442,6 +515,10 @@ int manager_new(Manager **ret) {
         sd_event_add_signal(m->event, NULL, SIGTERM, NULL, NULL);
         sd_event_add_signal(m->event, NULL, SIGINT, NULL, NULL);
 
+        r = sd_event_add_post(m->event, NULL, manager_dirty_handler, m);
+        if (r < 0)
+                return r;
+
         r = manager_connect_rtnl(m);
         if (r < 0)
                 return r;
@@ -484,6 +561,11 @@ void manager_free(Manager *m) {
         sd_bus_unref(m->bus);
         sd_bus_slot_unref(m->prepare_for_sleep_slot);
         sd_event_source_unref(m->bus_retry_event_source);
+        sd_event_source_unref(m->rtnl_resync_event_source);
+
+        while ((link = set_steal_first(m->dirty_links)))
+                link_unref(link);
+        set_free(m->dirty_links);
 
         while ((link = hashmap_first(m->links)))
                 link_unref(link);
@@ -696,6 +778,12 @@ static void print_string_set(FILE *f, const char *field, Set *s) {
         fputc('\n', f);
 }
 
+void manager_dirty(Manager *m) {
+        assert(m);
+
+        m->dirty = true;
+}
+
 int manager_save(Manager *m) {
         _cleanup_set_free_free_ Set *dns = NULL, *ntp = NULL, *domains = NULL;
         Link *link;
@@ -367,11 +367,8 @@ int network_apply(Manager *manager, Network *network, Link *link) {
                 route->protocol = RTPROT_STATIC;
         }
 
-        if (network->dns || network->ntp) {
-                r = link_save(link);
-                if (r < 0)
-                        return r;
-        }
+        if (network->dns || network->ntp)
+                link_dirty(link);
 
         return 0;
 }
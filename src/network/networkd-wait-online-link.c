@@ -73,6 +73,11 @@ Link *link_free(Link *l) {
                 return NULL;
 
         if (l->manager) {
+                if (l->pending)
+                        l->manager->n_pending--;
+                if (l->ready)
+                        l->manager->n_ready--;
+
                 hashmap_remove(l->manager->links, INT_TO_PTR(l->ifindex));
                 hashmap_remove(l->manager->links_by_name, l->ifname);
         }
@@ -35,6 +35,10 @@ struct Link {
 
         char *operational_state;
         char *state;
+
+        /* how this link is accounted for in the counters of the manager */
+        bool pending;
+        bool ready;
 };
 
 int link_new(Manager *m, Link **ret, int ifindex, const char *ifname);
@@ -54,49 +54,68 @@ bool manager_ignore_link(Manager *m, Link *link) {
         return false;
 }
 
+void manager_evaluate_link(Manager *m, Link *l) {
+        bool pending = false, ready = false;
+
+        assert(m);
+        assert(l);
+
+        if (manager_ignore_link(m, l))
+                log_debug("ignoring: %s", l->ifname);
+        else if (!l->state) {
+                log_debug("link %s has not yet been processed by udev",
+                          l->ifname);
+                pending = true;
+        } else if (STR_IN_SET(l->state, "configuring", "pending")) {
+                log_debug("link %s is being processed by networkd",
+                          l->ifname);
+                pending = true;
+        } else if (l->operational_state &&
+                   STR_IN_SET(l->operational_state, "degraded", "routable"))
+                /* we wait for at least one link to be ready,
+                   regardless of who manages it */
+                ready = true;
+
+        if (pending != l->pending) {
+                if (pending)
+                        m->n_pending++;
+                else
+                        m->n_pending--;
+
+                l->pending = pending;
+        }
+
+        if (ready != l->ready) {
+                if (ready)
+                        m->n_ready++;
+                else
+                        m->n_ready--;
+
+                l->ready = ready;
+        }
+}
+
 bool manager_all_configured(Manager *m) {
-        Iterator i;
-        Link *l;
         char **ifname;
-        bool one_ready = false;
+
+        assert(m);
+
+        /* with --any, the first link to become ready is enough */
+        if (m->any)
+                return m->n_ready > 0;
 
         /* wait for all the links given on the command line to appear */
         STRV_FOREACH(ifname, m->interfaces) {
-                l = hashmap_get(m->links_by_name, *ifname);
-                if (!l) {
+                if (!hashmap_get(m->links_by_name, *ifname)) {
                         log_debug("still waiting for %s", *ifname);
                         return false;
                 }
         }
 
         /* wait for all links networkd manages to be in admin state 'configured'
-           and at least one link to gain a carrier */
-        HASHMAP_FOREACH(l, m->links, i) {
-                if (manager_ignore_link(m, l)) {
-                        log_info("ignoring: %s", l->ifname);
-                        continue;
-                }
-
-                if (!l->state) {
-                        log_debug("link %s has not yet been processed by udev",
-                                  l->ifname);
-                        return false;
-                }
-
-                if (STR_IN_SET(l->state, "configuring", "pending")) {
-                        log_debug("link %s is being processed by networkd",
-                                  l->ifname);
-                        return false;
-                }
-
-                if (l->operational_state &&
-                    STR_IN_SET(l->operational_state, "degraded", "routable"))
-                        /* we wait for at least one link to be ready,
-                           regardless of who manages it */
-                        one_ready = true;
-        }
-
-        return one_ready;
+           and at least one link to gain a carrier, the links are evaluated one
+           by one as they change, see manager_evaluate_link() */
+        return m->n_pending == 0 && m->n_ready > 0;
 }
 
 static int manager_process_link(sd_netlink *rtnl, sd_netlink_message *mm, void *userdata) {
@@ -133,15 +152,21 @@ static int manager_process_link(sd_netlink *rtnl, sd_netlink_message *mm, void *
                         r = link_new(m, &l, ifindex, ifname);
                         if (r < 0)
                                 goto fail;
+                }
+
+                r = link_update_rtnl(l, mm);
+                if (r < 0)
+                        goto fail;
 
+                /* the state files of ignored links are not read, do so
+                   once a link is no longer ignored, e.g. after a rename */
+                if (!l->state && !manager_ignore_link(m, l)) {
                         r = link_update_monitor(l);
                         if (r < 0)
                                 goto fail;
                 }
 
-                r = link_update_rtnl(l, mm);
-                if (r < 0)
-                        goto fail;
+                manager_evaluate_link(m, l);
 
                 break;
 
@@ -232,9 +257,14 @@ static int on_network_event(sd_event_source *s, int fd, uint32_t revents, void *
         sd_network_monitor_flush(m->network_monitor);
 
         HASHMAP_FOREACH(l, m->links, i) {
+                if (manager_ignore_link(m, l))
+                        continue;
+
                 r = link_update_monitor(l);
                 if (r < 0)
                         log_warning_errno(r, "Failed to update monitor information for %i: %m", l->ifindex);
+
+                manager_evaluate_link(m, l);
         }
 
         if (manager_all_configured(m))
@@ -268,7 +298,7 @@ static int manager_network_monitor_listen(Manager *m) {
         return 0;
 }
 
-int manager_new(Manager **ret, char **interfaces, char **ignore, usec_t timeout) {
+int manager_new(Manager **ret, char **interfaces, char **ignore, bool any, usec_t timeout) {
         _cleanup_(manager_freep) Manager *m = NULL;
         int r;
 
@@ -280,6 +310,7 @@ int manager_new(Manager **ret, char **interfaces, char **ignore, usec_t timeout)
 
         m->interfaces = interfaces;
         m->ignore = ignore;
+        m->any = any;
 
         r = sd_event_default(&m->event);
         if (r < 0)
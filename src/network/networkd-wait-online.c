@@ -30,6 +30,7 @@ static bool arg_quiet = false;
 static usec_t arg_timeout = 120 * USEC_PER_SEC;
 static char **arg_interfaces = NULL;
 static char **arg_ignore = NULL;
+static bool arg_any = false;
 
 static void help(void) {
         printf("%s [OPTIONS...]\n\n"
@@ -39,6 +40,7 @@ static void help(void) {
                "  -q --quiet                Do not show status information\n"
                "  -i --interface=INTERFACE  Block until at least these interfaces have appeared\n"
                "     --ignore=INTERFACE     Don't take these interfaces into account\n"
+               "     --any                  Wait until at least one interface is online\n"
                "     --timeout=SECS         Maximum time to wait for network connectivity\n"
                , program_invocation_short_name);
 }
@@ -49,6 +51,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_VERSION = 0x100,
                 ARG_IGNORE,
                 ARG_TIMEOUT,
+                ARG_ANY,
         };
 
         static const struct option options[] = {
@@ -58,6 +61,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "interface",       required_argument, NULL, 'i'         },
                 { "ignore",          required_argument, NULL, ARG_IGNORE  },
                 { "timeout",         required_argument, NULL, ARG_TIMEOUT  },
+                { "any",             no_argument,       NULL, ARG_ANY     },
                 {}
         };
 
@@ -95,6 +99,10 @@ static int parse_argv(int argc, char *argv[]) {
 
                         break;
 
+                case ARG_ANY:
+                        arg_any = true;
+                        break;
+
                 case ARG_TIMEOUT:
                         r = parse_sec(optarg, &arg_timeout);
                         if (r < 0)
@@ -131,7 +139,7 @@ int main(int argc, char *argv[]) {
 
         assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGTERM, SIGINT, -1) >= 0);
 
-        r = manager_new(&m, arg_interfaces, arg_ignore, arg_timeout);
+        r = manager_new(&m, arg_interfaces, arg_ignore, arg_any, arg_timeout);
         if (r < 0) {
                 log_error_errno(r, "Could not create manager: %m");
                 goto finish;
@@ -37,6 +37,12 @@ struct Manager {
 
         char **interfaces;
         char **ignore;
+        bool any;
+
+        /* links still being set up, and links set up with at least a
+           carrier, updated whenever a single link changes */
+        unsigned n_pending;
+        unsigned n_ready;
 
         sd_netlink *rtnl;
         sd_event_source *rtnl_event_source;
@@ -48,9 +54,10 @@ struct Manager {
 };
 
 void manager_free(Manager *m);
-int manager_new(Manager **ret, char **interfaces, char **ignore, usec_t timeout);
+int manager_new(Manager **ret, char **interfaces, char **ignore, bool any, usec_t timeout);
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(Manager*, manager_free);
 
 bool manager_all_configured(Manager *m);
 bool manager_ignore_link(Manager *m, Link *link);
+void manager_evaluate_link(Manager *m, Link *link);
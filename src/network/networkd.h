@@ -40,6 +40,7 @@ typedef struct Manager Manager;
 
 struct Manager {
         sd_netlink *rtnl;
+        sd_event_source *rtnl_resync_event_source;
         sd_event *event;
         sd_event_source *bus_retry_event_source;
         sd_bus *bus;
@@ -60,6 +61,11 @@ struct Manager {
         LIST_HEAD(AddressPool, address_pools);
 
         usec_t network_dirs_ts_usec;
+
+        /* State files that need to be written out, once the current
+         * event loop iteration is done */
+        bool dirty;
+        Set *dirty_links;
 };
 
 extern const char* const network_dirs[];
@@ -82,6 +88,7 @@ int manager_rtnl_enumerate_addresses(Manager *m);
 
 int manager_send_changed(Manager *m, const char *property, ...) _sentinel_;
 int manager_save(Manager *m);
+void manager_dirty(Manager *m);
 
 int manager_address_pool_acquire(Manager *m, int family, unsigned prefixlen, union in_addr_union *found);
 
@@ -140,6 +140,18 @@ static void test_network_get(Manager *manager, struct udev_device *loopback) {
         assert_se(!network);
 }
 
+static bool address_equal_and_hash(Address *a1, Address *a2) {
+        static const uint8_t hash_key[HASH_KEY_SIZE] = {};
+
+        if (!address_equal(a1, a2))
+                return false;
+
+        /* equal addresses must end up in the same bucket */
+        assert_se(address_hash_ops.hash(a1, hash_key) == address_hash_ops.hash(a2, hash_key));
+
+        return true;
+}
+
 static void test_address_equality(void) {
         _cleanup_address_free_ Address *a1 = NULL, *a2 = NULL;
 
@@ -149,25 +161,25 @@ static void test_address_equality(void) {
         assert_se(address_equal(NULL, NULL));
         assert_se(!address_equal(a1, NULL));
         assert_se(!address_equal(NULL, a2));
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
 
         a1->family = AF_INET;
         assert_se(!address_equal(a1, a2));
 
         a2->family = AF_INET;
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
 
         assert_se(inet_pton(AF_INET, "192.168.3.9", &a1->in_addr.in));
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
         assert_se(inet_pton(AF_INET, "192.168.3.9", &a2->in_addr.in));
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
         a1->prefixlen = 10;
         assert_se(!address_equal(a1, a2));
         a2->prefixlen = 10;
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
 
         assert_se(inet_pton(AF_INET, "192.168.3.10", &a2->in_addr.in));
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
 
         a1->family = AF_INET6;
         assert_se(!address_equal(a1, a2));
@@ -175,10 +187,10 @@ static void test_address_equality(void) {
         a2->family = AF_INET6;
         assert_se(inet_pton(AF_INET6, "2001:4ca0:4f01::2", &a1->in_addr.in6));
         assert_se(inet_pton(AF_INET6, "2001:4ca0:4f01::2", &a2->in_addr.in6));
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
 
         a2->prefixlen = 8;
-        assert_se(address_equal(a1, a2));
+        assert_se(address_equal_and_hash(a1, a2));
 
         assert_se(inet_pton(AF_INET6, "2001:4ca0:4f01::1", &a2->in_addr.in6));
         assert_se(!address_equal(a1, a2));
@@ -491,6 +491,64 @@ static int mount_overlay(const char *dest, CustomMount *m) {
         return 0;
 }
 
+bool overlayfs_supported(void) {
+        _cleanup_fclose_ FILE *f = NULL;
+        char line[LINE_MAX];
+
+        /* The file system might also be provided by a module that is
+         * not loaded yet, in that case we err on the safe side */
+
+        f = fopen("/proc/filesystems", "re");
+        if (!f)
+                return false;
+
+        FOREACH_LINE(line, f, return false) {
+                truncate_nl(line);
+
+                if (endswith(line, "\toverlay"))
+                        return true;
+        }
+
+        return false;
+}
+
+int mount_ephemeral_overlay(const char *directory, const char *overlay_dir) {
+        _cleanup_free_ char *escaped_lower = NULL, *escaped_upper = NULL, *escaped_work = NULL;
+        const char *upper, *work, *options;
+        int r;
+
+        assert(directory);
+        assert(overlay_dir);
+
+        /* Puts an overlay with a throw-away upper directory on top of
+         * the container directory, so that the container may change
+         * anything without the original tree being copied first. */
+
+        upper = strjoina(overlay_dir, "/upper");
+        work = strjoina(overlay_dir, "/work");
+
+        r = mkdir_label(upper, 0755);
+        if (r < 0 && r != -EEXIST)
+                return log_error_errno(r, "Failed to create %s: %m", upper);
+
+        r = mkdir_label(work, 0700);
+        if (r < 0 && r != -EEXIST)
+                return log_error_errno(r, "Failed to create %s: %m", work);
+
+        escaped_lower = shell_escape(directory, ",:");
+        escaped_upper = shell_escape(upper, ",:");
+        escaped_work = shell_escape(work, ",:");
+        if (!escaped_lower || !escaped_upper || !escaped_work)
+                return log_oom();
+
+        options = strjoina("lowerdir=", escaped_lower, ",upperdir=", escaped_upper, ",workdir=", escaped_work);
+
+        if (mount("overlay", directory, "overlay", 0, options) < 0)
+                return log_error_errno(errno, "Failed to mount ephemeral overlay to %s: %m", directory);
+
+        return 0;
+}
+
 int mount_custom(
                 const char *dest,
                 CustomMount *mounts, unsigned n,
@@ -152,6 +152,7 @@ static bool arg_quiet = false;
 static bool arg_share_system = false;
 static bool arg_register = true;
 static bool arg_keep_unit = false;
+static bool arg_timing = false;
 static char **arg_network_interfaces = NULL;
 static char **arg_network_macvlan = NULL;
 static char **arg_network_ipvlan = NULL;
@@ -240,10 +241,31 @@ static void help(void) {
                "                            the service unit nspawn is running in\n"
                "     --volatile[=MODE]      Run the system in volatile mode\n"
                "     --settings=BOOLEAN     Load additional settings from .nspawn file\n"
+               "     --timing               Show how long each setup step took\n"
                , program_invocation_short_name);
 }
 
 
+static void log_timing(const char *step) {
+        static usec_t last = 0;
+        char buf[FORMAT_TIMESPAN_MAX];
+        usec_t n;
+
+        /* The outer child inherits the timestamp from the parent
+         * when it is forked, and the parent starts over once the
+         * outer child is done, hence this works across both */
+
+        if (!arg_timing)
+                return;
+
+        n = now(CLOCK_MONOTONIC);
+
+        if (step)
+                log_info("%s took %s.", step, format_timespan(buf, sizeof(buf), n - last, 1));
+
+        last = n;
+}
+
 static int custom_mounts_prepare(void) {
         unsigned i;
         int r;
@@ -352,6 +374,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_PRIVATE_USERS,
                 ARG_KILL_SIGNAL,
                 ARG_SETTINGS,
+                ARG_TIMING,
         };
 
         static const struct option options[] = {
@@ -395,6 +418,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "private-users",         optional_argument, NULL, ARG_PRIVATE_USERS     },
                 { "kill-signal",           required_argument, NULL, ARG_KILL_SIGNAL       },
                 { "settings",              required_argument, NULL, ARG_SETTINGS          },
+                { "timing",                no_argument,       NULL, ARG_TIMING            },
                 {}
         };
 
@@ -730,6 +754,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_keep_unit = true;
                         break;
 
+                case ARG_TIMING:
+                        arg_timing = true;
+                        break;
+
                 case ARG_PERSONALITY:
 
                         arg_personality = personality_from_string(optarg);
@@ -2623,6 +2651,7 @@ static int inner_child(
 static int outer_child(
                 Barrier *barrier,
                 const char *directory,
+                const char *ephemeral_overlay,
                 const char *console,
                 const char *root_device, bool root_device_rw,
                 const char *home_device, bool home_device_rw,
@@ -2680,6 +2709,12 @@ static int outer_child(
         if (mount(NULL, "/", NULL, MS_SLAVE|MS_REC, NULL) < 0)
                 return log_error_errno(errno, "MS_SLAVE|MS_REC failed: %m");
 
+        if (ephemeral_overlay) {
+                r = mount_ephemeral_overlay(directory, ephemeral_overlay);
+                if (r < 0)
+                        return r;
+        }
+
         r = mount_devices(directory,
                           root_device, root_device_rw,
                           home_device, home_device_rw,
@@ -2687,6 +2722,8 @@ static int outer_child(
         if (r < 0)
                 return r;
 
+        log_timing("Mounting image");
+
         r = determine_uid_shift(directory);
         if (r < 0)
                 return r;
@@ -2727,6 +2764,8 @@ static int outer_child(
         if (r < 0)
                 return r;
 
+        log_timing("Mounting file systems");
+
         r = copy_devnodes(directory);
         if (r < 0)
                 return r;
@@ -2745,6 +2784,8 @@ static int outer_child(
         if (r < 0)
                 return r;
 
+        log_timing("Setting up /dev");
+
         r = setup_seccomp();
         if (r < 0)
                 return r;
@@ -2761,6 +2802,8 @@ static int outer_child(
         if (r < 0)
                 return r;
 
+        log_timing("Copying host configuration and linking journal");
+
         r = mount_custom(directory, arg_custom_mounts, arg_n_custom_mounts, arg_userns, arg_uid_shift, arg_uid_range, arg_selinux_apifs_context);
         if (r < 0)
                 return r;
@@ -2773,6 +2816,8 @@ static int outer_child(
         if (r < 0)
                 return log_error_errno(r, "Failed to move root directory: %m");
 
+        log_timing("Applying custom mounts and cgroups");
+
         pid = raw_clone(SIGCHLD|CLONE_NEWNS|
                         (arg_share_system ? 0 : CLONE_NEWIPC|CLONE_NEWPID|CLONE_NEWUTS) |
                         (arg_private_network ? CLONE_NEWNET : 0) |
@@ -2795,6 +2840,8 @@ static int outer_child(
                 _exit(EXIT_SUCCESS);
         }
 
+        log_timing("Forking container");
+
         l = send(pid_socket, &pid, sizeof(pid), MSG_NOSIGNAL);
         if (l < 0)
                 return log_error_errno(errno, "Failed to send PID: %m");
@@ -3034,11 +3081,13 @@ int main(int argc, char *argv[]) {
         int r, n_fd_passed, loop_nr = -1;
         char veth_name[IFNAMSIZ];
         bool secondary = false, remove_subvol = false;
+        char *ephemeral_overlay = NULL;
         sigset_t mask_chld;
         pid_t pid = 0;
         int ret = EXIT_SUCCESS;
         union in_addr_union exposed = {};
         _cleanup_release_lock_file_ LockFile tree_global_lock = LOCK_FILE_INIT, tree_local_lock = LOCK_FILE_INIT;
+        _cleanup_release_lock_file_ LockFile lower_global_lock = LOCK_FILE_INIT, lower_local_lock = LOCK_FILE_INIT;
         bool interactive;
 
         log_parse_environment();
@@ -3085,6 +3134,7 @@ int main(int argc, char *argv[]) {
 
                 if (arg_ephemeral) {
                         _cleanup_free_ char *np = NULL;
+                        bool use_overlay = false;
 
                         /* If the specified path is a mount point we
                          * generate the new snapshot immediately
@@ -3097,6 +3147,22 @@ int main(int argc, char *argv[]) {
                                 log_error_errno(r, "Failed to determine whether directory %s is mount point: %m", arg_directory);
                                 goto finish;
                         }
+
+                        /* Snapshots are cheap on btrfs only, on
+                         * other file systems they are a full
+                         * copy. There, put an overlay on top of the
+                         * directory instead, with the upper
+                         * directory where the snapshot would
+                         * go. That must not be inside the tree
+                         * itself, hence don't bother for mount
+                         * points. */
+                        if (r == 0 && overlayfs_supported()) {
+                                _cleanup_close_ int fd = -1;
+
+                                fd = open(arg_directory, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+                                use_overlay = fd >= 0 && btrfs_is_filesystem(fd) == 0;
+                        }
+
                         if (r > 0)
                                 r = tempfn_random_child(arg_directory, "machine.", &np);
                         else
@@ -3112,17 +3178,41 @@ int main(int argc, char *argv[]) {
                                 goto finish;
                         }
 
-                        r = btrfs_subvol_snapshot(arg_directory, np, (arg_read_only ? BTRFS_SNAPSHOT_READ_ONLY : 0) | BTRFS_SNAPSHOT_FALLBACK_COPY | BTRFS_SNAPSHOT_RECURSIVE);
-                        if (r < 0) {
-                                log_error_errno(r, "Failed to create snapshot %s from %s: %m", np, arg_directory);
-                                goto finish;
-                        }
+                        if (use_overlay) {
+                                /* overlayfs doesn't cope with the lower
+                                 * tree changing below it, hence keep
+                                 * others from writing to it for as long
+                                 * as the overlay exists */
+                                r = image_path_lock(arg_directory, LOCK_SH|LOCK_NB, &lower_global_lock, &lower_local_lock);
+                                if (r == -EBUSY) {
+                                        log_error_errno(r, "Directory tree %s is currently busy.", arg_directory);
+                                        goto finish;
+                                }
+                                if (r < 0) {
+                                        log_error_errno(r, "Failed to lock %s: %m", arg_directory);
+                                        goto finish;
+                                }
+
+                                if (mkdir(np, 0700) < 0) {
+                                        r = log_error_errno(errno, "Failed to create overlay directory %s: %m", np);
+                                        goto finish;
+                                }
+
+                                ephemeral_overlay = np;
+                                np = NULL;
+                        } else {
+                                r = btrfs_subvol_snapshot(arg_directory, np, (arg_read_only ? BTRFS_SNAPSHOT_READ_ONLY : 0) | BTRFS_SNAPSHOT_FALLBACK_COPY | BTRFS_SNAPSHOT_RECURSIVE);
+                                if (r < 0) {
+                                        log_error_errno(r, "Failed to create snapshot %s from %s: %m", np, arg_directory);
+                                        goto finish;
+                                }
 
-                        free(arg_directory);
-                        arg_directory = np;
-                        np = NULL;
+                                free(arg_directory);
+                                arg_directory = np;
+                                np = NULL;
 
-                        remove_subvol = true;
+                                remove_subvol = true;
+                        }
 
                 } else {
                         r = image_path_lock(arg_directory, (arg_read_only ? LOCK_SH : LOCK_EX) | LOCK_NB, &tree_global_lock, &tree_local_lock);
@@ -3308,6 +3398,8 @@ int main(int argc, char *argv[]) {
                         goto finish;
                 }
 
+                log_timing(NULL);
+
                 pid = raw_clone(SIGCHLD|CLONE_NEWNS, NULL);
                 if (pid < 0) {
                         if (errno == EINVAL)
@@ -3334,6 +3426,7 @@ int main(int argc, char *argv[]) {
 
                         r = outer_child(&barrier,
                                         arg_directory,
+                                        ephemeral_overlay,
                                         console,
                                         root_device, root_device_rw,
                                         home_device, home_device_rw,
@@ -3385,6 +3478,10 @@ int main(int argc, char *argv[]) {
 
                 log_debug("Init process invoked as PID " PID_FMT, pid);
 
+                /* The outer child reported its own steps, start
+                 * counting again from here */
+                log_timing(NULL);
+
                 if (arg_userns) {
                         if (!barrier_place_and_sync(&barrier)) { /* #1 */
                                 log_error("Child died too early.");
@@ -3439,6 +3536,8 @@ int main(int argc, char *argv[]) {
                         r = setup_ipvlan(arg_machine, pid, arg_network_ipvlan);
                         if (r < 0)
                                 goto finish;
+
+                        log_timing("Setting up network");
                 }
 
                 if (arg_register) {
@@ -3455,6 +3554,8 @@ int main(int argc, char *argv[]) {
                                         arg_keep_unit);
                         if (r < 0)
                                 goto finish;
+
+                        log_timing("Registering machine");
                 }
 
                 r = sync_cgroup(pid, arg_unified_cgroup_hierarchy);
@@ -3495,6 +3596,8 @@ int main(int argc, char *argv[]) {
                         goto finish;
                 }
 
+                log_timing("Setting up cgroups and waiting for container");
+
                 sd_notifyf(false,
                            "READY=1\n"
                            "STATUS=Container running.\n"
@@ -3613,6 +3716,16 @@ finish:
                         log_warning_errno(k, "Cannot remove subvolume '%s', ignoring: %m", arg_directory);
         }
 
+        if (ephemeral_overlay) {
+                int k;
+
+                k = rm_rf(ephemeral_overlay, REMOVE_ROOT|REMOVE_PHYSICAL);
+                if (k < 0)
+                        log_warning_errno(k, "Cannot remove overlay directory '%s', ignoring: %m", ephemeral_overlay);
+
+                free(ephemeral_overlay);
+        }
+
         if (arg_machine) {
                 const char *p;
 
@@ -31,11 +31,120 @@
 #include "bus-common-errors.h"
 #include "in-addr-util.h"
 #include "hostname-util.h"
+#include "fileio.h"
+#include "strv.h"
 
 NSS_GETHOSTBYNAME_PROTOTYPES(mymachines);
 NSS_GETPW_PROTOTYPES(mymachines);
 NSS_GETGR_PROTOTYPES(mymachines);
 
+/* How long to trust the last user or group mapping we got from
+ * machined, before asking again */
+#define MAPPING_CACHE_USEC (5 * USEC_PER_SEC)
+
+typedef struct MappingCache {
+        char name[sizeof("vu-") + HOST_NAME_MAX + 1 + DECIMAL_STR_MAX(uid_t)];
+        uid_t id;
+        usec_t timestamp;
+} MappingCache;
+
+static thread_local MappingCache user_cache = {}, group_cache = {};
+
+static bool mapping_cache_valid(const MappingCache *c) {
+        return c->timestamp > 0 && c->timestamp + MAPPING_CACHE_USEC > now(CLOCK_MONOTONIC);
+}
+
+static void mapping_cache_put(MappingCache *c, const char *name, uid_t id) {
+        if (strlen(name) >= sizeof(c->name))
+                return;
+
+        strcpy(c->name, name);
+        c->id = id;
+        c->timestamp = now(CLOCK_MONOTONIC);
+}
+
+static int machine_is_container(const char *machine) {
+        _cleanup_free_ char *class = NULL;
+        int r;
+
+        r = sd_machine_get_class(machine, &class);
+        if (r == -ENXIO)
+                return 0;
+        if (r < 0)
+                return r;
+
+        return streq(class, "container");
+}
+
+static int container_maps_id(const char *map, uid_t id) {
+        _cleanup_strv_free_ char **machines = NULL;
+        char **m;
+        int r;
+
+        /* Checks whether any of the running containers has the host
+         * UID or GID in its user namespace, the same way machined
+         * does, but from the state files and /proc, so that IDs that
+         * belong to no container are refused without talking to
+         * machined. Returns a negative error if we can't tell. */
+
+        r = sd_get_machine_names(&machines);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return r;
+
+        STRV_FOREACH(m, machines) {
+                _cleanup_free_ char *class = NULL, *leader = NULL;
+                _cleanup_fclose_ FILE *f = NULL;
+                char q[strlen("/proc//uid_map") + DECIMAL_STR_MAX(pid_t) + 1];
+                const char *p;
+                pid_t pid;
+
+                p = strjoina("/run/systemd/machines/", *m);
+                r = parse_env_file(p, NEWLINE, "CLASS", &class, "LEADER", &leader, NULL);
+                if (r == -ENOENT)
+                        continue;
+                if (r < 0)
+                        return r;
+
+                if (!streq_ptr(class, "container"))
+                        continue;
+
+                if (!leader)
+                        return -EIO;
+
+                r = parse_pid(leader, &pid);
+                if (r < 0)
+                        return r;
+
+                xsprintf(q, "/proc/" PID_FMT "/%s", pid, map);
+                f = fopen(q, "re");
+                if (!f)
+                        return -errno;
+
+                for (;;) {
+                        uid_t uid_base, uid_shift, uid_range;
+                        int k;
+
+                        errno = 0;
+                        k = fscanf(f, UID_FMT " " UID_FMT " " UID_FMT, &uid_base, &uid_shift, &uid_range);
+                        if (k < 0 && feof(f))
+                                break;
+                        if (k != 3) {
+                                if (ferror(f) && errno != 0)
+                                        return -errno;
+
+                                return -EIO;
+                        }
+
+                        if (id >= uid_shift && id < uid_shift + uid_range)
+                                return 1;
+                }
+        }
+
+        return 0;
+}
+
 static int count_addresses(sd_bus_message *m, int af, unsigned *ret) {
         unsigned c = 0;
         int r;
@@ -420,29 +529,38 @@ enum nss_status _nss_mymachines_getpwnam_r(
         if (!machine_name_is_valid(machine))
                 goto not_found;
 
-        r = sd_bus_open_system(&bus);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_call_method(bus,
-                               "org.freedesktop.machine1",
-                               "/org/freedesktop/machine1",
-                               "org.freedesktop.machine1.Manager",
-                               "MapFromMachineUser",
-                               &error,
-                               &reply,
-                               "su",
-                               machine, (uint32_t) uid);
-        if (r < 0) {
-                if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_USER_MAPPING))
+        if (mapping_cache_valid(&user_cache) && streq(user_cache.name, name))
+                mapped = user_cache.id;
+        else {
+                if (machine_is_container(machine) == 0)
                         goto not_found;
 
-                goto fail;
-        }
+                r = sd_bus_open_system(&bus);
+                if (r < 0)
+                        goto fail;
 
-        r = sd_bus_message_read(reply, "u", &mapped);
-        if (r < 0)
-                goto fail;
+                r = sd_bus_call_method(bus,
+                                       "org.freedesktop.machine1",
+                                       "/org/freedesktop/machine1",
+                                       "org.freedesktop.machine1.Manager",
+                                       "MapFromMachineUser",
+                                       &error,
+                                       &reply,
+                                       "su",
+                                       machine, (uint32_t) uid);
+                if (r < 0) {
+                        if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_USER_MAPPING))
+                                goto not_found;
+
+                        goto fail;
+                }
+
+                r = sd_bus_message_read(reply, "u", &mapped);
+                if (r < 0)
+                        goto fail;
+
+                mapping_cache_put(&user_cache, name, mapped);
+        }
 
         l = strlen(name);
         if (buflen < l+1) {
@@ -494,33 +612,47 @@ enum nss_status _nss_mymachines_getpwuid_r(
         if (uid < 0x10000)
                 goto not_found;
 
-        r = sd_bus_open_system(&bus);
-        if (r < 0)
-                goto fail;
+        if (mapping_cache_valid(&user_cache) && user_cache.id == uid) {
+                if (strlen(user_cache.name) >= buflen) {
+                        *errnop = ENOMEM;
+                        return NSS_STATUS_TRYAGAIN;
+                }
 
-        r = sd_bus_call_method(bus,
-                               "org.freedesktop.machine1",
-                               "/org/freedesktop/machine1",
-                               "org.freedesktop.machine1.Manager",
-                               "MapToMachineUser",
-                               &error,
-                               &reply,
-                               "u",
-                               (uint32_t) uid);
-        if (r < 0) {
-                if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_USER_MAPPING))
+                strcpy(buffer, user_cache.name);
+        } else {
+                if (container_maps_id("uid_map", uid) == 0)
                         goto not_found;
 
-                goto fail;
-        }
+                r = sd_bus_open_system(&bus);
+                if (r < 0)
+                        goto fail;
 
-        r = sd_bus_message_read(reply, "sou", &machine, &object, &mapped);
-        if (r < 0)
-                goto fail;
+                r = sd_bus_call_method(bus,
+                                       "org.freedesktop.machine1",
+                                       "/org/freedesktop/machine1",
+                                       "org.freedesktop.machine1.Manager",
+                                       "MapToMachineUser",
+                                       &error,
+                                       &reply,
+                                       "u",
+                                       (uint32_t) uid);
+                if (r < 0) {
+                        if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_USER_MAPPING))
+                                goto not_found;
 
-        if (snprintf(buffer, buflen, "vu-%s-" UID_FMT, machine, (uid_t) mapped) >= (int) buflen) {
-                *errnop = ENOMEM;
-                return NSS_STATUS_TRYAGAIN;
+                        goto fail;
+                }
+
+                r = sd_bus_message_read(reply, "sou", &machine, &object, &mapped);
+                if (r < 0)
+                        goto fail;
+
+                if (snprintf(buffer, buflen, "vu-%s-" UID_FMT, machine, (uid_t) mapped) >= (int) buflen) {
+                        *errnop = ENOMEM;
+                        return NSS_STATUS_TRYAGAIN;
+                }
+
+                mapping_cache_put(&user_cache, buffer, uid);
         }
 
         pwd->pw_name = buffer;
@@ -577,29 +709,38 @@ enum nss_status _nss_mymachines_getgrnam_r(
         if (!machine_name_is_valid(machine))
                 goto not_found;
 
-        r = sd_bus_open_system(&bus);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_call_method(bus,
-                               "org.freedesktop.machine1",
-                               "/org/freedesktop/machine1",
-                               "org.freedesktop.machine1.Manager",
-                               "MapFromMachineGroup",
-                               &error,
-                               &reply,
-                               "su",
-                               machine, (uint32_t) gid);
-        if (r < 0) {
-                if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_GROUP_MAPPING))
+        if (mapping_cache_valid(&group_cache) && streq(group_cache.name, name))
+                mapped = group_cache.id;
+        else {
+                if (machine_is_container(machine) == 0)
                         goto not_found;
 
-                goto fail;
-        }
+                r = sd_bus_open_system(&bus);
+                if (r < 0)
+                        goto fail;
 
-        r = sd_bus_message_read(reply, "u", &mapped);
-        if (r < 0)
-                goto fail;
+                r = sd_bus_call_method(bus,
+                                       "org.freedesktop.machine1",
+                                       "/org/freedesktop/machine1",
+                                       "org.freedesktop.machine1.Manager",
+                                       "MapFromMachineGroup",
+                                       &error,
+                                       &reply,
+                                       "su",
+                                       machine, (uint32_t) gid);
+                if (r < 0) {
+                        if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_GROUP_MAPPING))
+                                goto not_found;
+
+                        goto fail;
+                }
+
+                r = sd_bus_message_read(reply, "u", &mapped);
+                if (r < 0)
+                        goto fail;
+
+                mapping_cache_put(&group_cache, name, mapped);
+        }
 
         l = sizeof(char*) + strlen(name) + 1;
         if (buflen < l) {
@@ -611,7 +752,7 @@ enum nss_status _nss_mymachines_getgrnam_r(
         strcpy(buffer + sizeof(char*), name);
 
         gr->gr_name = buffer + sizeof(char*);
-        gr->gr_gid = gid;
+        gr->gr_gid = mapped;
         gr->gr_passwd = (char*) "*"; /* locked */
         gr->gr_mem = (char**) buffer;
 
@@ -649,39 +790,54 @@ enum nss_status _nss_mymachines_getgrgid_r(
         if (gid < 0x10000)
                 goto not_found;
 
-        r = sd_bus_open_system(&bus);
-        if (r < 0)
-                goto fail;
-
-        r = sd_bus_call_method(bus,
-                               "org.freedesktop.machine1",
-                               "/org/freedesktop/machine1",
-                               "org.freedesktop.machine1.Manager",
-                               "MapToMachineGroup",
-                               &error,
-                               &reply,
-                               "u",
-                               (uint32_t) gid);
-        if (r < 0) {
-                if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_GROUP_MAPPING))
-                        goto not_found;
-
-                goto fail;
-        }
-
-        r = sd_bus_message_read(reply, "sou", &machine, &object, &mapped);
-        if (r < 0)
-                goto fail;
-
         if (buflen < sizeof(char*) + 1) {
                 *errnop = ENOMEM;
                 return NSS_STATUS_TRYAGAIN;
         }
 
         memzero(buffer, sizeof(char*));
-        if (snprintf(buffer + sizeof(char*), buflen - sizeof(char*), "vg-%s-" GID_FMT, machine, (gid_t) mapped) >= (int) buflen) {
-                *errnop = ENOMEM;
-                return NSS_STATUS_TRYAGAIN;
+
+        if (mapping_cache_valid(&group_cache) && group_cache.id == gid) {
+                if (strlen(group_cache.name) >= buflen - sizeof(char*)) {
+                        *errnop = ENOMEM;
+                        return NSS_STATUS_TRYAGAIN;
+                }
+
+                strcpy(buffer + sizeof(char*), group_cache.name);
+        } else {
+                if (container_maps_id("gid_map", gid) == 0)
+                        goto not_found;
+
+                r = sd_bus_open_system(&bus);
+                if (r < 0)
+                        goto fail;
+
+                r = sd_bus_call_method(bus,
+                                       "org.freedesktop.machine1",
+                                       "/org/freedesktop/machine1",
+                                       "org.freedesktop.machine1.Manager",
+                                       "MapToMachineGroup",
+                                       &error,
+                                       &reply,
+                                       "u",
+                                       (uint32_t) gid);
+                if (r < 0) {
+                        if (sd_bus_error_has_name(&error, BUS_ERROR_NO_SUCH_GROUP_MAPPING))
+                                goto not_found;
+
+                        goto fail;
+                }
+
+                r = sd_bus_message_read(reply, "sou", &machine, &object, &mapped);
+                if (r < 0)
+                        goto fail;
+
+                if (snprintf(buffer + sizeof(char*), buflen - sizeof(char*), "vg-%s-" GID_FMT, machine, (gid_t) mapped) >= (int) (buflen - sizeof(char*))) {
+                        *errnop = ENOMEM;
+                        return NSS_STATUS_TRYAGAIN;
+                }
+
+                mapping_cache_put(&group_cache, buffer + sizeof(char*), gid);
         }
 
         gr->gr_name = buffer + sizeof(char*);
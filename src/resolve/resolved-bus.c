@@ -641,8 +641,102 @@ static int bus_method_resolve_record(sd_bus_message *message, void *userdata, sd
         return 1;
 }
 
+static int bus_property_get_cache_statistics(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Manager *m = userdata;
+        uint64_t n_hit = 0, n_miss = 0, n_evicted = 0;
+        DnsScope *s;
+
+        assert(reply);
+        assert(m);
+
+        LIST_FOREACH(scopes, s, m->dns_scopes) {
+                n_hit += s->cache.n_hit;
+                n_miss += s->cache.n_miss;
+                n_evicted += s->cache.n_evicted;
+        }
+
+        return sd_bus_message_append(reply, "(ttt)", n_hit, n_miss, n_evicted);
+}
+
+static int append_server_statistics(sd_bus_message *reply, DnsServer *first, int ifindex) {
+        DnsServer *s;
+        int r;
+
+        LIST_FOREACH(servers, s, first) {
+                r = sd_bus_message_open_container(reply, 'r', "iiayttt");
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "ii", ifindex, s->family);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append_array(reply, 'y', &s->address, FAMILY_ADDRESS_SIZE(s->family));
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "ttt", s->srtt, s->n_received, s->n_lost);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_close_container(reply);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int bus_property_get_server_statistics(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Manager *m = userdata;
+        Iterator i;
+        Link *l;
+        int r;
+
+        assert(reply);
+        assert(m);
+
+        r = sd_bus_message_open_container(reply, 'a', "(iiayttt)");
+        if (r < 0)
+                return r;
+
+        r = append_server_statistics(reply, m->dns_servers, 0);
+        if (r < 0)
+                return r;
+
+        r = append_server_statistics(reply, m->fallback_dns_servers, 0);
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH(l, m->links, i) {
+                r = append_server_statistics(reply, l->dns_servers, l->ifindex);
+                if (r < 0)
+                        return r;
+        }
+
+        return sd_bus_message_close_container(reply);
+}
+
 static const sd_bus_vtable resolve_vtable[] = {
         SD_BUS_VTABLE_START(0),
+        SD_BUS_PROPERTY("CacheStatistics", "(ttt)", bus_property_get_cache_statistics, 0, 0),
+        SD_BUS_PROPERTY("DNSServerStatistics", "a(iiayttt)", bus_property_get_server_statistics, 0, 0),
         SD_BUS_METHOD("ResolveHostname", "isit", "a(iiay)st", bus_method_resolve_hostname, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ResolveAddress", "iiayt", "a(is)t", bus_method_resolve_address, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ResolveRecord", "isqqt", "a(iqqay)t", bus_method_resolve_record, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -143,11 +143,22 @@ int config_parse_support(
 }
 
 int manager_parse_config_file(Manager *m) {
+        DnsScope *s;
+        int r;
+
         assert(m);
 
-        return config_parse_many("/etc/systemd/resolved.conf",
-                                 CONF_DIRS_NULSTR("systemd/resolved.conf"),
-                                 "Resolve\0",
-                                 config_item_perf_lookup, resolved_gperf_lookup,
-                                 false, m);
+        r = config_parse_many("/etc/systemd/resolved.conf",
+                              CONF_DIRS_NULSTR("systemd/resolved.conf"),
+                              "Resolve\0",
+                              config_item_perf_lookup, resolved_gperf_lookup,
+                              false, m);
+        if (r < 0)
+                return r;
+
+        /* The unicast scope exists already, apply the cache size to it */
+        LIST_FOREACH(scopes, s, m->dns_scopes)
+                s->cache.max_bytes = m->cache_size;
+
+        return 0;
 }
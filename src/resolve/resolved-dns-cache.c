@@ -19,17 +19,15 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "strv.h"
+#include "sparse-endian.h"
 #include "resolved-dns-cache.h"
 #include "resolved-dns-packet.h"
 
-/* Never cache more than 1K entries */
-#define CACHE_MAX 1024
-
 /* We never keep any item longer than 10min in our cache */
 #define CACHE_TTL_MAX_USEC (10 * USEC_PER_MINUTE)
 
 typedef enum DnsCacheItemType DnsCacheItemType;
-typedef struct DnsCacheItem DnsCacheItem;
 
 enum DnsCacheItemType {
         DNS_CACHE_POSITIVE,
@@ -41,13 +39,110 @@ struct DnsCacheItem {
         DnsResourceKey *key;
         DnsResourceRecord *rr;
         usec_t until;
+        usec_t lifetime;
+        unsigned n_hit;
         DnsCacheItemType type;
         unsigned prioq_idx;
         int owner_family;
         union in_addr_union owner_address;
+        size_t size;
         LIST_FIELDS(DnsCacheItem, by_key);
+        LIST_FIELDS(DnsCacheItem, by_lru);
 };
 
+/* An estimate of the memory an item holds on to, the key and the RR
+ * may be shared with others, so this errs on the high side. */
+static size_t dns_cache_item_size(DnsResourceKey *key, DnsResourceRecord *rr) {
+        size_t n;
+        char **s;
+
+        n = sizeof(DnsCacheItem) + sizeof(DnsResourceKey) + strlen(DNS_RESOURCE_KEY_NAME(key)) + 1;
+        if (!rr)
+                return n;
+
+        n += sizeof(DnsResourceRecord);
+
+        switch (rr->key->type) {
+
+        case DNS_TYPE_SRV:
+                n += strlen(rr->srv.name) + 1;
+                break;
+
+        case DNS_TYPE_PTR:
+        case DNS_TYPE_NS:
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_DNAME:
+                n += strlen(rr->ptr.name) + 1;
+                break;
+
+        case DNS_TYPE_HINFO:
+                n += strlen(rr->hinfo.cpu) + strlen(rr->hinfo.os) + 2;
+                break;
+
+        case DNS_TYPE_TXT:
+        case DNS_TYPE_SPF:
+                STRV_FOREACH(s, rr->txt.strings)
+                        n += sizeof(char*) + strlen(*s) + 1;
+                break;
+
+        case DNS_TYPE_SOA:
+                n += strlen(rr->soa.mname) + strlen(rr->soa.rname) + 2;
+                break;
+
+        case DNS_TYPE_MX:
+                n += strlen(rr->mx.exchange) + 1;
+                break;
+
+        case DNS_TYPE_DS:
+                n += rr->ds.digest_size;
+                break;
+
+        case DNS_TYPE_SSHFP:
+                n += rr->sshfp.fingerprint_size;
+                break;
+
+        case DNS_TYPE_DNSKEY:
+                n += rr->dnskey.key_size;
+                break;
+
+        case DNS_TYPE_RRSIG:
+                n += strlen(rr->rrsig.signer) + 1 + rr->rrsig.signature_size;
+                break;
+
+        case DNS_TYPE_NSEC:
+                n += strlen(rr->nsec.next_domain_name) + 1;
+                break;
+
+        case DNS_TYPE_NSEC3:
+                n += rr->nsec3.salt_size + rr->nsec3.next_hashed_name_size;
+                break;
+
+        case DNS_TYPE_LOC:
+        case DNS_TYPE_A:
+        case DNS_TYPE_AAAA:
+                break;
+
+        default:
+                n += rr->generic.size;
+        }
+
+        return n;
+}
+
+static void dns_cache_item_touch(DnsCache *c, DnsCacheItem *i) {
+        assert(c);
+        assert(i);
+
+        if (c->by_lru == i)
+                return;
+
+        if (c->lru_tail == i)
+                c->lru_tail = i->by_lru_prev;
+
+        LIST_REMOVE(by_lru, c->by_lru, i);
+        LIST_PREPEND(by_lru, c->by_lru, i);
+}
+
 static void dns_cache_item_free(DnsCacheItem *i) {
         if (!i)
                 return;
@@ -77,6 +172,13 @@ static void dns_cache_item_remove_and_free(DnsCache *c, DnsCacheItem *i) {
 
         prioq_remove(c->by_expiry, i, &i->prioq_idx);
 
+        if (c->lru_tail == i)
+                c->lru_tail = i->by_lru_prev;
+        LIST_REMOVE(by_lru, c->by_lru, i);
+
+        assert(c->n_bytes >= i->size);
+        c->n_bytes -= i->size;
+
         dns_cache_item_free(i);
 }
 
@@ -90,6 +192,8 @@ void dns_cache_flush(DnsCache *c) {
 
         assert(hashmap_size(c->by_key) == 0);
         assert(prioq_size(c->by_expiry) == 0);
+        assert(!c->by_lru && !c->lru_tail);
+        assert(c->n_bytes == 0);
 
         c->by_key = hashmap_free(c->by_key);
         c->by_expiry = prioq_free(c->by_expiry);
@@ -110,34 +214,40 @@ static bool dns_cache_remove(DnsCache *c, DnsResourceKey *key) {
         return exist;
 }
 
-static void dns_cache_make_space(DnsCache *c, unsigned add) {
+static void dns_cache_make_space(DnsCache *c, size_t add) {
         assert(c);
 
         if (add <= 0)
                 return;
 
-        /* Makes space for n new entries. Note that we actually allow
-         * the cache to grow beyond CACHE_MAX, but only when we shall
-         * add more RRs to the cache than CACHE_MAX at once. In that
-         * case the cache will be emptied completely otherwise. */
+        /* Makes space for new entries of the given size, first by
+         * dropping what expired, then by dropping the entries that
+         * were not used for the longest time. If more than the limit
+         * is added at once, the cache is emptied and then grows
+         * beyond the limit until the next call. */
+
+        if (c->n_bytes + add <= c->max_bytes)
+                return;
+
+        dns_cache_prune(c);
 
         for (;;) {
                 _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
-                DnsCacheItem *i;
+                unsigned n;
 
-                if (prioq_size(c->by_expiry) <= 0)
+                if (!c->lru_tail)
                         break;
 
-                if (prioq_size(c->by_expiry) + add < CACHE_MAX)
+                if (c->n_bytes + add <= c->max_bytes)
                         break;
 
-                i = prioq_peek(c->by_expiry);
-                assert(i);
-
                 /* Take an extra reference to the key so that it
                  * doesn't go away in the middle of the remove call */
-                key = dns_resource_key_ref(i->key);
+                key = dns_resource_key_ref(c->lru_tail->key);
+
+                n = prioq_size(c->by_expiry);
                 dns_cache_remove(c, key);
+                c->n_evicted += n - prioq_size(c->by_expiry);
         }
 }
 
@@ -218,6 +328,12 @@ static int dns_cache_link_item(DnsCache *c, DnsCacheItem *i) {
                 }
         }
 
+        LIST_PREPEND(by_lru, c->by_lru, i);
+        if (!c->lru_tail)
+                c->lru_tail = i;
+
+        c->n_bytes += i->size;
+
         return 0;
 }
 
@@ -254,9 +370,15 @@ static void dns_cache_item_update_positive(DnsCache *c, DnsCacheItem *i, DnsReso
         dns_resource_key_unref(i->key);
         i->key = dns_resource_key_ref(rr->key);
 
-        i->until = timestamp + MIN(rr->ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
+        i->lifetime = MIN(rr->ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
+        i->until = timestamp + i->lifetime;
+
+        c->n_bytes -= i->size;
+        i->size = dns_cache_item_size(i->key, rr);
+        c->n_bytes += i->size;
 
         prioq_reshuffle(c->by_expiry, i, &i->prioq_idx);
+        dns_cache_item_touch(c, i);
 }
 
 static int dns_cache_put_positive(
@@ -305,7 +427,7 @@ static int dns_cache_put_positive(
         if (r < 0)
                 return r;
 
-        dns_cache_make_space(c, 1);
+        dns_cache_make_space(c, dns_cache_item_size(rr->key, rr));
 
         i = new0(DnsCacheItem, 1);
         if (!i)
@@ -314,7 +436,9 @@ static int dns_cache_put_positive(
         i->type = DNS_CACHE_POSITIVE;
         i->key = dns_resource_key_ref(rr->key);
         i->rr = dns_resource_record_ref(rr);
-        i->until = timestamp + MIN(i->rr->ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
+        i->lifetime = MIN(i->rr->ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
+        i->until = timestamp + i->lifetime;
+        i->size = dns_cache_item_size(i->key, i->rr);
         i->prioq_idx = PRIOQ_IDX_NULL;
         i->owner_family = owner_family;
         i->owner_address = *owner_address;
@@ -373,7 +497,7 @@ static int dns_cache_put_negative(
         if (r < 0)
                 return r;
 
-        dns_cache_make_space(c, 1);
+        dns_cache_make_space(c, dns_cache_item_size(key, NULL));
 
         i = new0(DnsCacheItem, 1);
         if (!i)
@@ -381,7 +505,9 @@ static int dns_cache_put_negative(
 
         i->type = rcode == DNS_RCODE_SUCCESS ? DNS_CACHE_NODATA : DNS_CACHE_NXDOMAIN;
         i->key = dns_resource_key_ref(key);
-        i->until = timestamp + MIN(soa_ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
+        i->lifetime = MIN(soa_ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
+        i->until = timestamp + i->lifetime;
+        i->size = dns_cache_item_size(i->key, NULL);
         i->prioq_idx = PRIOQ_IDX_NULL;
         i->owner_family = owner_family;
         i->owner_address = *owner_address;
@@ -410,7 +536,8 @@ int dns_cache_put(
                 int owner_family,
                 const union in_addr_union *owner_address) {
 
-        unsigned cache_keys, i;
+        size_t cache_size = 0;
+        unsigned i;
         int r;
 
         assert(c);
@@ -435,13 +562,15 @@ int dns_cache_put(
         if (!IN_SET(rcode, DNS_RCODE_SUCCESS, DNS_RCODE_NXDOMAIN))
                 return 0;
 
-        cache_keys = answer->n_rrs;
+        for (i = 0; i < MIN(max_rrs, answer->n_rrs); i++)
+                cache_size += dns_cache_item_size(answer->items[i].rr->key, answer->items[i].rr);
 
         if (q)
-                cache_keys += q->n_keys;
+                for (i = 0; i < q->n_keys; i++)
+                        cache_size += dns_cache_item_size(q->keys[i], NULL);
 
         /* Make some space for our new entries */
-        dns_cache_make_space(c, cache_keys);
+        dns_cache_make_space(c, cache_size);
 
         if (timestamp <= 0)
                 timestamp = now(clock_boottime_or_monotonic());
@@ -537,16 +666,23 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, int *rcode, DnsAnswer **r
 
                 log_debug("Cache miss for %s", key_str);
 
+                c->n_miss++;
+
                 *ret = NULL;
                 *rcode = DNS_RCODE_SUCCESS;
                 return 0;
         }
 
+        c->n_hit++;
+
         LIST_FOREACH(by_key, j, first) {
                 if (j->rr)
                         n++;
                 else if (j->type == DNS_CACHE_NXDOMAIN)
                         nxdomain = true;
+
+                dns_cache_item_touch(c, j);
+                j->n_hit++;
         }
 
         r = dns_resource_key_to_string(key, &key_str);
@@ -584,6 +720,30 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, int *rcode, DnsAnswer **r
         return n;
 }
 
+bool dns_cache_prefetch_due(DnsCache *c, DnsResourceKey *key, usec_t ts) {
+        DnsCacheItem *i;
+
+        assert(c);
+        assert(key);
+
+        /* Returns true if the positive entries for the key were
+         * looked up often enough to be worth refreshing before they
+         * expire, and are about to. Short-lived entries are left
+         * alone, they'd be refreshed all the time. */
+
+        i = hashmap_get(c->by_key, key);
+        if (!i || !i->rr)
+                return false;
+
+        if (i->n_hit < DNS_CACHE_PREFETCH_HITS)
+                return false;
+
+        if (i->lifetime < DNS_CACHE_PREFETCH_LIFETIME_MIN_USEC)
+                return false;
+
+        return i->until <= ts + i->lifetime / 10;
+}
+
 int dns_cache_check_conflicts(DnsCache *cache, DnsResourceRecord *rr, int owner_family, const union in_addr_union *owner_address) {
         DnsCacheItem *i, *first;
         bool same_owner = true;
@@ -620,6 +780,246 @@ int dns_cache_check_conflicts(DnsCache *cache, DnsResourceRecord *rr, int owner_
         return 1;
 }
 
+/* One record of the cache file: the positive entries of a scope,
+ * encoded as the answer section of a DNS packet, followed by the
+ * CLOCK_REALTIME expiry of each of them */
+typedef struct _packed_ DnsCacheFileRecord {
+        le32_t ifindex;
+        le32_t family;
+        union in_addr_union address;
+        le32_t n_rrs;
+        le32_t size;
+} DnsCacheFileRecord;
+
+static int dns_cache_write_record(FILE *f, int ifindex, DnsServer *server, DnsPacket *p, const le64_t *until, unsigned n) {
+        DnsCacheFileRecord record = {
+                .ifindex = htole32(ifindex),
+                .family = htole32(server->family),
+                .address = server->address,
+                .n_rrs = htole32(n),
+        };
+
+        assert(f);
+        assert(p);
+
+        DNS_PACKET_HEADER(p)->ancount = htobe16(n);
+        record.size = htole32(p->size);
+
+        fwrite(&record, sizeof(record), 1, f);
+        fwrite(DNS_PACKET_DATA(p), p->size, 1, f);
+        fwrite(until, sizeof(le64_t), n, f);
+
+        return ferror(f) ? -EIO : 0;
+}
+
+static int dns_cache_append_rrset(DnsPacket *p, DnsCacheItem *first, usec_t ts, usec_t ts_realtime, le64_t **until, size_t *n_allocated, unsigned *n) {
+        DnsCacheItem *j;
+        int r;
+
+        assert(p);
+        assert(first);
+        assert(until);
+        assert(n_allocated);
+        assert(n);
+
+        LIST_FOREACH(by_key, j, first) {
+                if (j->type != DNS_CACHE_POSITIVE || j->until <= ts)
+                        continue;
+
+                r = dns_packet_append_rr(p, j->rr, NULL);
+                if (r < 0)
+                        return r;
+
+                if (!GREEDY_REALLOC(*until, *n_allocated, *n + 1))
+                        return -ENOMEM;
+
+                (*until)[(*n)++] = htole64(ts_realtime + (j->until - ts));
+        }
+
+        return 0;
+}
+
+int dns_cache_save(DnsCache *c, FILE *f, int ifindex, DnsServer *server) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        _cleanup_free_ le64_t *until = NULL;
+        size_t n_allocated = 0;
+        usec_t ts, ts_realtime;
+        Iterator iterator;
+        DnsCacheItem *i;
+        unsigned n = 0;
+        int r;
+
+        assert(c);
+        assert(f);
+        assert(server);
+
+        ts = now(clock_boottime_or_monotonic());
+        ts_realtime = now(CLOCK_REALTIME);
+
+        /* Loading a record replaces whatever is cached for the keys
+         * in it, hence an RRset must never be split across two
+         * records, or only its second half would survive */
+        HASHMAP_FOREACH(i, c->by_key, iterator) {
+                size_t saved_size;
+                unsigned saved_n;
+
+                if (!p) {
+                        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, 0);
+                        if (r < 0)
+                                return r;
+                }
+
+                saved_size = p->size;
+                saved_n = n;
+
+                r = dns_cache_append_rrset(p, i, ts, ts_realtime, &until, &n_allocated, &n);
+                if (r == -EMSGSIZE && saved_n > 0) {
+                        /* The packet is full, write out what came
+                         * before this RRset, and continue with it in
+                         * a new one */
+                        dns_packet_truncate(p, saved_size);
+
+                        r = dns_cache_write_record(f, ifindex, server, p, until, saved_n);
+                        if (r < 0)
+                                return r;
+
+                        p = dns_packet_unref(p);
+                        n = 0;
+
+                        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, 0);
+                        if (r < 0)
+                                return r;
+
+                        r = dns_cache_append_rrset(p, i, ts, ts_realtime, &until, &n_allocated, &n);
+                }
+                if (r == -EMSGSIZE) {
+                        /* Doesn't fit into a packet on its own,
+                         * don't save it at all */
+                        dns_packet_truncate(p, saved_size);
+                        n = saved_n;
+                        continue;
+                }
+                if (r < 0)
+                        return r;
+        }
+
+        if (n <= 0)
+                return 0;
+
+        return dns_cache_write_record(f, ifindex, server, p, until, n);
+}
+
+int dns_cache_read_record(FILE *f, int *ifindex, int *family, union in_addr_union *address, DnsAnswer **ret) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        _cleanup_free_ DnsResourceRecord **rrs = NULL;
+        _cleanup_free_ le64_t *until = NULL;
+        DnsCacheFileRecord record;
+        usec_t ts_realtime;
+        unsigned n, i, j;
+        size_t size;
+        int r;
+
+        assert(f);
+        assert(ifindex);
+        assert(family);
+        assert(address);
+        assert(ret);
+
+        /* Returns 0 at the end of the file, 1 and the entries of a
+         * record that did not expire yet otherwise, with their TTLs
+         * adjusted to the time left. RRsets are restored as a whole,
+         * or not at all. */
+
+        if (fread(&record, sizeof(record), 1, f) != 1)
+                return ferror(f) ? -EIO : 0;
+
+        n = le32toh(record.n_rrs);
+        size = le32toh(record.size);
+
+        if (size < DNS_PACKET_HEADER_SIZE || size > DNS_PACKET_SIZE_MAX || n > UINT16_MAX)
+                return -EBADMSG;
+
+        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, size);
+        if (r < 0)
+                return r;
+
+        if (fread(DNS_PACKET_DATA(p), size, 1, f) != 1)
+                return -EBADMSG;
+        p->size = size;
+
+        until = new(le64_t, n);
+        if (!until)
+                return -ENOMEM;
+
+        if (n > 0 && fread(until, sizeof(le64_t), n, f) != n)
+                return -EBADMSG;
+
+        if (DNS_PACKET_QDCOUNT(p) != 0 || DNS_PACKET_RRCOUNT(p) != n)
+                return -EBADMSG;
+
+        rrs = new0(DnsResourceRecord*, n);
+        if (!rrs)
+                return -ENOMEM;
+
+        dns_packet_rewind(p, DNS_PACKET_HEADER_SIZE);
+
+        for (i = 0; i < n; i++) {
+                r = dns_packet_read_rr(p, &rrs[i], NULL);
+                if (r < 0)
+                        goto finish;
+        }
+
+        answer = dns_answer_new(n);
+        if (!answer) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        ts_realtime = now(CLOCK_REALTIME);
+
+        /* The members of an RRset were saved next to each other */
+        for (i = 0; i < n; i = j) {
+                usec_t u = le64toh(until[i]);
+                unsigned k;
+
+                for (j = i + 1; j < n; j++) {
+                        r = dns_resource_key_equal(rrs[i]->key, rrs[j]->key);
+                        if (r < 0)
+                                goto finish;
+                        if (r == 0)
+                                break;
+
+                        u = MIN(u, le64toh(until[j]));
+                }
+
+                if (u <= ts_realtime)
+                        continue;
+
+                for (k = i; k < j; k++) {
+                        rrs[k]->ttl = (uint32_t) DIV_ROUND_UP(u - ts_realtime, USEC_PER_SEC);
+
+                        r = dns_answer_add(answer, rrs[k], 0);
+                        if (r < 0)
+                                goto finish;
+                }
+        }
+
+        *ifindex = le32toh(record.ifindex);
+        *family = le32toh(record.family);
+        *address = record.address;
+        *ret = answer;
+        answer = NULL;
+
+        r = 1;
+
+finish:
+        for (i = 0; i < n; i++)
+                dns_resource_record_unref(rrs[i]);
+
+        return r;
+}
+
 void dns_cache_dump(DnsCache *cache, FILE *f) {
         Iterator iterator;
         DnsCacheItem *i;
@@ -631,6 +1031,9 @@ void dns_cache_dump(DnsCache *cache, FILE *f) {
         if (!f)
                 f = stdout;
 
+        fprintf(f, "\t%zu of %zu bytes, %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evicted\n",
+                cache->n_bytes, cache->max_bytes, cache->n_hit, cache->n_miss, cache->n_evicted);
+
         HASHMAP_FOREACH(i, cache->by_key, iterator) {
                 DnsCacheItem *j;
 
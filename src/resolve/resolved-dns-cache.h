@@ -27,22 +27,49 @@
 #include "time-util.h"
 #include "list.h"
 
+/* The memory a cache may use by default, see CacheSize= */
+#define DNS_CACHE_SIZE_DEFAULT (1024U*1024U)
+
+/* Entries hit this often are refreshed in the last tenth of their
+ * lifetime, in the background */
+#define DNS_CACHE_PREFETCH_HITS 3U
+#define DNS_CACHE_PREFETCH_LIFETIME_MIN_USEC (30 * USEC_PER_SEC)
+
+typedef struct DnsCacheItem DnsCacheItem;
+
 typedef struct DnsCache {
         Hashmap *by_key;
         Prioq *by_expiry;
+
+        /* most recently used first */
+        LIST_HEAD(DnsCacheItem, by_lru);
+        DnsCacheItem *lru_tail;
+
+        /* estimated memory use of the items, and its limit */
+        size_t n_bytes;
+        size_t max_bytes;
+
+        uint64_t n_hit;
+        uint64_t n_miss;
+        uint64_t n_evicted;
 } DnsCache;
 
 #include "resolved-dns-rr.h"
 #include "resolved-dns-question.h"
 #include "resolved-dns-answer.h"
+#include "resolved-dns-server.h"
 
 void dns_cache_flush(DnsCache *c);
 void dns_cache_prune(DnsCache *c);
 
 int dns_cache_put(DnsCache *c, DnsQuestion *q, int rcode, DnsAnswer *answer, unsigned max_rrs, usec_t timestamp, int owner_family, const union in_addr_union *owner_address);
 int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, int *rcode, DnsAnswer **answer);
+bool dns_cache_prefetch_due(DnsCache *c, DnsResourceKey *key, usec_t ts);
 
 int dns_cache_check_conflicts(DnsCache *cache, DnsResourceRecord *rr, int owner_family, const union in_addr_union *owner_address);
 
+int dns_cache_save(DnsCache *c, FILE *f, int ifindex, DnsServer *server);
+int dns_cache_read_record(FILE *f, int *ifindex, int *family, union in_addr_union *address, DnsAnswer **ret);
+
 void dns_cache_dump(DnsCache *cache, FILE *f);
 bool dns_cache_is_empty(DnsCache *cache);
@@ -116,6 +116,7 @@ static void dns_packet_free(DnsPacket *p) {
 
         dns_question_unref(p->question);
         dns_answer_unref(p->answer);
+        dns_resource_key_unref(p->last_key);
 
         while ((s = hashmap_steal_first_key(p->names)))
                 free(s);
@@ -265,7 +266,7 @@ static int dns_packet_extend(DnsPacket *p, size_t add, void **ret, size_t *start
         return 0;
 }
 
-static void dns_packet_truncate(DnsPacket *p, size_t sz) {
+void dns_packet_truncate(DnsPacket *p, size_t sz) {
         Iterator i;
         char *s;
         void *n;
@@ -284,6 +285,9 @@ static void dns_packet_truncate(DnsPacket *p, size_t sz) {
                 free(s);
         }
 
+        if (p->last_key && p->last_key_start + p->last_key_size > sz)
+                p->last_key = dns_resource_key_unref(p->last_key);
+
         p->size = sz;
 }
 
@@ -450,7 +454,9 @@ int dns_packet_append_name(
                 if (r < 0)
                         goto fail;
 
-                if (allow_compression) {
+                /* Compression pointers only have 14 bits, don't
+                 * remember names we could not point to anyway */
+                if (allow_compression && n < 0x4000) {
                         r = hashmap_ensure_allocated(&p->names, &dns_name_hash_ops);
                         if (r < 0)
                                 goto fail;
@@ -1092,7 +1098,6 @@ int dns_packet_read_name(
                         /* End of name */
                         break;
                 else if (c <= 63) {
-                        _cleanup_free_ char *t = NULL;
                         const char *label;
 
                         /* Literal label */
@@ -1100,11 +1105,9 @@ int dns_packet_read_name(
                         if (r < 0)
                                 goto fail;
 
-                        r = dns_label_escape(label, c, &t);
-                        if (r < 0)
-                                goto fail;
-
-                        if (!GREEDY_REALLOC(ret, allocated, n + !first + strlen(t) + 1)) {
+                        /* Escape right into the name, reserving
+                         * room for the worst case */
+                        if (!GREEDY_REALLOC(ret, allocated, n + !first + c * 4 + 1)) {
                                 r = -ENOMEM;
                                 goto fail;
                         }
@@ -1114,7 +1117,10 @@ int dns_packet_read_name(
                         else
                                 first = false;
 
-                        memcpy(ret + n, t, r);
+                        r = dns_label_escape_buffer(label, c, ret + n, allocated - n);
+                        if (r < 0)
+                                goto fail;
+
                         n += r;
                         continue;
                 } else if (allow_compression && (c & 0xc0) == 0xc0) {
@@ -1275,6 +1281,59 @@ fail:
         return r;
 }
 
+static int dns_packet_skip_name(DnsPacket *p) {
+        int r;
+
+        assert(p);
+
+        /* Skips over the wire encoding of a name, without following
+         * compression pointers. */
+
+        for (;;) {
+                uint8_t c;
+
+                r = dns_packet_read_uint8(p, &c, NULL);
+                if (r < 0)
+                        return r;
+
+                if (c == 0)
+                        return 0;
+                else if (c <= 63) {
+                        r = dns_packet_read(p, c, NULL, NULL);
+                        if (r < 0)
+                                return r;
+                } else if ((c & 0xc0) == 0xc0)
+                        return dns_packet_read(p, 1, NULL, NULL);
+                else
+                        return -EBADMSG;
+        }
+}
+
+static bool dns_packet_reuse_key(DnsPacket *p, size_t saved_rindex) {
+        assert(p);
+
+        /* The records of an RRset directly follow each other, and
+         * usually carry the very same compressed owner name. If the
+         * encoding of this key is byte-for-byte the one we decoded
+         * last, it must decode to the same key too, and we can
+         * share that instead of building a new one. */
+
+        if (!p->last_key)
+                return false;
+
+        if (dns_packet_skip_name(p) < 0 ||
+            dns_packet_read(p, 4, NULL, NULL) < 0 ||
+            p->rindex - saved_rindex != p->last_key_size ||
+            memcmp(DNS_PACKET_DATA(p) + saved_rindex,
+                   DNS_PACKET_DATA(p) + p->last_key_start,
+                   p->last_key_size) != 0) {
+                dns_packet_rewind(p, saved_rindex);
+                return false;
+        }
+
+        return true;
+}
+
 int dns_packet_read_key(DnsPacket *p, DnsResourceKey **ret, size_t *start) {
         _cleanup_free_ char *name = NULL;
         uint16_t class, type;
@@ -1287,6 +1346,15 @@ int dns_packet_read_key(DnsPacket *p, DnsResourceKey **ret, size_t *start) {
 
         saved_rindex = p->rindex;
 
+        if (dns_packet_reuse_key(p, saved_rindex)) {
+                *ret = dns_resource_key_ref(p->last_key);
+
+                if (start)
+                        *start = saved_rindex;
+
+                return 0;
+        }
+
         r = dns_packet_read_name(p, &name, true, NULL);
         if (r < 0)
                 goto fail;
@@ -1306,6 +1374,12 @@ int dns_packet_read_key(DnsPacket *p, DnsResourceKey **ret, size_t *start) {
         }
 
         name = NULL;
+
+        dns_resource_key_unref(p->last_key);
+        p->last_key = dns_resource_key_ref(key);
+        p->last_key_start = saved_rindex;
+        p->last_key_size = p->rindex - saved_rindex;
+
         *ret = key;
 
         if (start)
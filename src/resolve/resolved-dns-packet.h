@@ -78,6 +78,11 @@ struct DnsPacket {
         DnsQuestion *question;
         DnsAnswer *answer;
 
+        /* The key read last, and where its encoding is, for sharing
+         * it with the following records of the same RRset */
+        DnsResourceKey *last_key;
+        size_t last_key_start, last_key_size;
+
         /* Packet reception metadata */
         int ifindex;
         int family, ipproto;
@@ -161,6 +166,8 @@ int dns_packet_append_name(DnsPacket *p, const char *name,
 int dns_packet_append_key(DnsPacket *p, const DnsResourceKey *key, size_t *start);
 int dns_packet_append_rr(DnsPacket *p, const DnsResourceRecord *rr, size_t *start);
 
+void dns_packet_truncate(DnsPacket *p, size_t sz);
+
 int dns_packet_read(DnsPacket *p, size_t sz, const void **ret, size_t *start);
 int dns_packet_read_blob(DnsPacket *p, void *d, size_t sz, size_t *start);
 int dns_packet_read_uint8(DnsPacket *p, uint8_t *ret, size_t *start);
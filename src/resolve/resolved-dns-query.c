@@ -57,6 +57,9 @@ DnsQuery *dns_query_free(DnsQuery *q) {
         sd_bus_message_unref(q->request);
         sd_bus_track_unref(q->bus_track);
 
+        dns_packet_unref(q->request_dns_packet);
+        dns_answer_unref(q->reply_dns_answer);
+
         if (q->manager) {
                 LIST_REMOVE(queries, q->manager->dns_queries, q);
                 q->manager->n_dns_queries--;
@@ -151,7 +154,7 @@ static int dns_query_add_transaction(DnsQuery *q, DnsScope *s, DnsResourceKey *k
 
         t = dns_scope_find_transaction(s, key, true);
         if (!t) {
-                r = dns_transaction_new(&t, s, key);
+                r = dns_transaction_new(&t, s, key, false);
                 if (r < 0)
                         return r;
         }
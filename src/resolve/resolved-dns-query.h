@@ -55,6 +55,11 @@ struct DnsQuery {
         const char *request_hostname;
         union in_addr_union request_address;
 
+        /* DNS stub information */
+        DnsPacket *request_dns_packet;
+        DnsStream *request_dns_stream;
+        DnsAnswer *reply_dns_answer;
+
         /* Completion callback */
         void (*complete)(DnsQuery* q);
         unsigned block_ready;
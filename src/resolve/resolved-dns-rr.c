@@ -22,6 +22,7 @@
 #include <math.h>
 
 #include "strv.h"
+#include "mempool.h"
 
 #include "dns-domain.h"
 #include "resolved-dns-rr.h"
@@ -48,12 +49,16 @@ DnsResourceKey* dns_resource_key_new(uint16_t class, uint16_t type, const char *
         return k;
 }
 
+/* Keys with a separately allocated name are what each record parsed
+ * from a packet comes with, hence take them from a pool */
+static DEFINE_MEMPOOL_THREADED(key_pool, DnsResourceKey, 64);
+
 DnsResourceKey* dns_resource_key_new_consume(uint16_t class, uint16_t type, char *name) {
         DnsResourceKey *k;
 
         assert(name);
 
-        k = new0(DnsResourceKey, 1);
+        k = mempool_threaded_alloc0_tile(&key_pool);
         if (!k)
                 return NULL;
 
@@ -83,20 +88,39 @@ DnsResourceKey* dns_resource_key_unref(DnsResourceKey *k) {
         assert(k->n_ref > 0);
 
         if (k->n_ref == 1) {
-                free(k->_name);
-                free(k);
+                if (k->_name) {
+                        free(k->_name);
+                        mempool_threaded_free_tile(&key_pool, k);
+                } else
+                        free(k);
         } else
                 k->n_ref--;
 
         return NULL;
 }
 
+static int dns_resource_key_name_equal(const DnsResourceKey *a, const DnsResourceKey *b) {
+        const char *x, *y;
+
+        x = DNS_RESOURCE_KEY_NAME(a);
+        y = DNS_RESOURCE_KEY_NAME(b);
+
+        /* Names read from the same packet are usually spelled the
+         * same way, and then there is no need to unescape them
+         * label by label. Escaped names are plain ASCII, hence
+         * strcasecmp() agrees with dns_name_equal() on them, but
+         * only in the positive case. */
+        if (x == y || strcasecmp(x, y) == 0)
+                return 1;
+
+        return dns_name_equal(x, y);
+}
+
 int dns_resource_key_equal(const DnsResourceKey *a, const DnsResourceKey *b) {
         int r;
 
-        r = dns_name_equal(DNS_RESOURCE_KEY_NAME(a), DNS_RESOURCE_KEY_NAME(b));
-        if (r <= 0)
-                return r;
+        if (a == b)
+                return 1;
 
         if (a->class != b->class)
                 return 0;
@@ -104,6 +128,10 @@ int dns_resource_key_equal(const DnsResourceKey *a, const DnsResourceKey *b) {
         if (a->type != b->type)
                 return 0;
 
+        r = dns_resource_key_name_equal(a, b);
+        if (r <= 0)
+                return r;
+
         return 1;
 }
 
@@ -117,7 +145,7 @@ int dns_resource_key_match_rr(const DnsResourceKey *key, const DnsResourceRecord
         if (rr->key->type != key->type && key->type != DNS_TYPE_ANY)
                 return 0;
 
-        return dns_name_equal(DNS_RESOURCE_KEY_NAME(rr->key), DNS_RESOURCE_KEY_NAME(key));
+        return dns_resource_key_name_equal(rr->key, key);
 }
 
 int dns_resource_key_match_cname(const DnsResourceKey *key, const DnsResourceRecord *rr) {
@@ -194,10 +222,13 @@ int dns_resource_key_to_string(const DnsResourceKey *key, char **ret) {
         return 0;
 }
 
+/* The cache and every packet parsed churn through records */
+static DEFINE_MEMPOOL_THREADED(rr_pool, DnsResourceRecord, 64);
+
 DnsResourceRecord* dns_resource_record_new(DnsResourceKey *key) {
         DnsResourceRecord *rr;
 
-        rr = new0(DnsResourceRecord, 1);
+        rr = mempool_threaded_alloc0_tile(&rr_pool);
         if (!rr)
                 return NULL;
 
@@ -311,7 +342,7 @@ DnsResourceRecord* dns_resource_record_unref(DnsResourceRecord *rr) {
                 dns_resource_key_unref(rr->key);
         }
 
-        free(rr);
+        mempool_threaded_free_tile(&rr_pool, rr);
 
         return NULL;
 }
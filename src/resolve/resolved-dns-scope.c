@@ -53,6 +53,7 @@ int dns_scope_new(Manager *m, DnsScope **ret, Link *l, DnsProtocol protocol, int
         s->protocol = protocol;
         s->family = family;
         s->resend_timeout = MULTICAST_RESEND_TIMEOUT_MIN_USEC;
+        s->cache.max_bytes = m->cache_size;
 
         LIST_PREPEND(scopes, m->dns_scopes, s);
 
@@ -91,6 +92,11 @@ DnsScope* dns_scope_free(DnsScope *s) {
 
         hashmap_free(s->transactions);
 
+        while ((t = hashmap_steal_first(s->prefetch_transactions)))
+                dns_transaction_free(t);
+
+        hashmap_free(s->prefetch_transactions);
+
         while ((rr = ordered_hashmap_steal_first(s->conflict_queue)))
                 dns_resource_record_unref(rr);
 
@@ -312,8 +318,10 @@ static int dns_scope_socket(DnsScope *s, int type, int family, const union in_ad
         return ret;
 }
 
-int dns_scope_udp_dns_socket(DnsScope *s, DnsServer **server) {
-        return dns_scope_socket(s, SOCK_DGRAM, AF_UNSPEC, NULL, 53, server);
+int dns_scope_udp_dns_socket(DnsScope *s, DnsServer *server) {
+        assert(server);
+
+        return dns_scope_socket(s, SOCK_DGRAM, server->family, &server->address, 53, NULL);
 }
 
 int dns_scope_tcp_socket(DnsScope *s, int family, const union in_addr_union *address, uint16_t port, DnsServer **server) {
@@ -61,6 +61,7 @@ struct DnsScope {
         usec_t max_rtt;
 
         Hashmap *transactions;
+        Hashmap *prefetch_transactions;
 
         LIST_FIELDS(DnsScope, scopes);
 };
@@ -73,7 +74,7 @@ void dns_scope_packet_lost(DnsScope *s, usec_t usec);
 
 int dns_scope_emit(DnsScope *s, int fd, DnsPacket *p);
 int dns_scope_tcp_socket(DnsScope *s, int family, const union in_addr_union *address, uint16_t port, DnsServer **server);
-int dns_scope_udp_dns_socket(DnsScope *s, DnsServer **server);
+int dns_scope_udp_dns_socket(DnsScope *s, DnsServer *server);
 
 DnsScopeMatch dns_scope_good_domain(DnsScope *s, int ifindex, uint64_t flags, const char *domain);
 int dns_scope_good_key(DnsScope *s, DnsResourceKey *key);
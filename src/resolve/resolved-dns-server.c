@@ -22,11 +22,15 @@
 #include "siphash24.h"
 
 #include "resolved-dns-server.h"
+#include "resolved-dns-transaction.h"
 
 /* After how much time to repeat classic DNS requests */
 #define DNS_TIMEOUT_MIN_USEC (500 * USEC_PER_MSEC)
 #define DNS_TIMEOUT_MAX_USEC (5 * USEC_PER_SEC)
 
+/* How many replies to read from a socket per wakeup */
+#define DNS_SERVER_SOCKET_READ_MAX 16U
+
 int dns_server_new(
                 Manager *m,
                 DnsServer **ret,
@@ -91,6 +95,122 @@ DnsServer* dns_server_ref(DnsServer *s)  {
         return s;
 }
 
+DnsServerSocket* dns_server_socket_unref(DnsServerSocket *u) {
+        if (!u)
+                return NULL;
+
+        assert(u->n_ref > 0);
+
+        u->n_ref--;
+        if (u->n_ref > 0)
+                return NULL;
+
+        sd_event_source_unref(u->event_source);
+        safe_close(u->fd);
+        free(u);
+
+        return NULL;
+}
+
+static int on_server_socket_packet(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        DnsServerSocket *u = userdata;
+        Manager *m;
+        unsigned n;
+        int r = 0;
+
+        assert(u);
+        assert(u->server);
+
+        m = u->server->manager;
+
+        /* Handling a reply might release the last reference to the
+         * socket, keep it around until we are done with it */
+        u->n_ref++;
+
+        for (n = 0; n < DNS_SERVER_SOCKET_READ_MAX; n++) {
+                _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+                DnsTransaction *t;
+
+                r = manager_recv(m, fd, DNS_PROTOCOL_DNS, &p);
+                if (r <= 0)
+                        break;
+
+                if (dns_packet_validate_reply(p) <= 0) {
+                        log_debug("Invalid DNS packet.");
+                        continue;
+                }
+
+                t = hashmap_get(m->dns_transactions, UINT_TO_PTR(DNS_PACKET_ID(p)));
+                if (!t || t->server_socket != u) {
+                        log_debug("Received DNS reply for unknown transaction.");
+                        continue;
+                }
+
+                /* Matching the id and port is guesswork for an
+                 * attacker, but not impossible, hence ignore
+                 * replies that don't answer what we asked,
+                 * instead of failing the transaction on them */
+                if (dns_packet_extract(p) < 0 ||
+                    !p->question || p->question->n_keys != 1 ||
+                    dns_resource_key_equal(p->question->keys[0], t->key) <= 0) {
+                        log_debug("Received DNS reply with unexpected question, ignoring.");
+                        continue;
+                }
+
+                dns_transaction_process_reply(t, p);
+        }
+
+        dns_server_socket_unref(u);
+
+        return r < 0 ? r : 0;
+}
+
+static int dns_server_socket_new(DnsServer *s, DnsScope *scope, DnsServerSocket **ret) {
+        DnsServerSocket *u;
+        int r;
+
+        assert(s);
+        assert(scope);
+        assert(ret);
+
+        u = new0(DnsServerSocket, 1);
+        if (!u)
+                return -ENOMEM;
+
+        u->n_ref = 1;
+
+        u->fd = dns_scope_udp_dns_socket(scope, s);
+        if (u->fd < 0) {
+                r = u->fd;
+                free(u);
+                return r;
+        }
+
+        r = sd_event_add_io(s->manager->event, &u->event_source, u->fd, EPOLLIN, on_server_socket_packet, u);
+        if (r < 0) {
+                dns_server_socket_unref(u);
+                return r;
+        }
+
+        u->server = s;
+
+        *ret = u;
+        return 0;
+}
+
+int dns_server_socket_acquire(DnsServer *s, DnsScope *scope, DnsServerSocket **ret) {
+        assert(s);
+        assert(scope);
+        assert(ret);
+
+        /* Every transaction gets a socket of its own, and with it a
+         * fresh random source port. Reusing sockets would let an
+         * off-path attacker who learned one port spoof replies to
+         * all transactions sharing it, guessing only the id. */
+
+        return dns_server_socket_new(s, scope, ret);
+}
+
 static DnsServer* dns_server_free(DnsServer *s)  {
         if (!s)
                 return NULL;
@@ -120,9 +240,22 @@ DnsServer* dns_server_unref(DnsServer *s)  {
         return NULL;
 }
 
+static void dns_server_add_rtt_sample(DnsServer *s, usec_t rtt) {
+        assert(s);
+
+        /* Same smoothing as for TCP, see RFC 6298 */
+        if (s->srtt <= 0)
+                s->srtt = rtt;
+        else
+                s->srtt = (s->srtt * 7 + rtt) / 8;
+}
+
 void dns_server_packet_received(DnsServer *s, usec_t rtt) {
         assert(s);
 
+        s->n_received++;
+        dns_server_add_rtt_sample(s, rtt);
+
         if (rtt > s->max_rtt) {
                 s->max_rtt = rtt;
                 s->resend_timeout = MIN(MAX(DNS_TIMEOUT_MIN_USEC, s->max_rtt * 2),
@@ -133,10 +266,31 @@ void dns_server_packet_received(DnsServer *s, usec_t rtt) {
 void dns_server_packet_lost(DnsServer *s, usec_t usec) {
         assert(s);
 
+        s->n_lost++;
+        dns_server_add_rtt_sample(s, usec);
+
         if (s->resend_timeout <= usec)
                 s->resend_timeout = MIN(s->resend_timeout * 2, DNS_TIMEOUT_MAX_USEC);
 }
 
+DnsServer *dns_server_find_fastest(DnsServer *first, DnsServer *exclude) {
+        DnsServer *s, *best = NULL;
+
+        /* Returns the server of the list with the lowest smoothed
+         * RTT, other than the one excluded. Servers we never talked
+         * to come first, so that each of them is given a chance. */
+
+        LIST_FOREACH(servers, s, first) {
+                if (s == exclude)
+                        continue;
+
+                if (!best || s->srtt < best->srtt)
+                        best = s;
+        }
+
+        return best;
+}
+
 static unsigned long dns_server_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
         const DnsServer *s = p;
         uint64_t u;
@@ -24,6 +24,7 @@
 #include "in-addr-util.h"
 
 typedef struct DnsServer DnsServer;
+typedef struct DnsServerSocket DnsServerSocket;
 typedef enum DnsServerSource DnsServerSource;
 
 typedef enum DnsServerType {
@@ -34,6 +35,18 @@ typedef enum DnsServerType {
 
 #include "resolved-link.h"
 
+/* A UDP socket connected to a server, used by a single transaction
+ * so that every transaction has a source port of its own. Replies
+ * are matched to the transaction by id, socket and question. */
+struct DnsServerSocket {
+        DnsServer *server;
+
+        unsigned n_ref;
+
+        int fd;
+        sd_event_source *event_source;
+};
+
 struct DnsServer {
         Manager *manager;
 
@@ -49,6 +62,12 @@ struct DnsServer {
         usec_t resend_timeout;
         usec_t max_rtt;
 
+        /* Smoothed round-trip time, 0 if not measured yet. Losses
+         * count as samples as long as the timeout. */
+        usec_t srtt;
+        uint64_t n_received;
+        uint64_t n_lost;
+
         bool marked:1;
 
         LIST_FIELDS(DnsServer, servers);
@@ -65,9 +84,14 @@ int dns_server_new(
 DnsServer* dns_server_ref(DnsServer *s);
 DnsServer* dns_server_unref(DnsServer *s);
 
+int dns_server_socket_acquire(DnsServer *s, DnsScope *scope, DnsServerSocket **ret);
+DnsServerSocket* dns_server_socket_unref(DnsServerSocket *u);
+
 void dns_server_packet_received(DnsServer *s, usec_t rtt);
 void dns_server_packet_lost(DnsServer *s, usec_t usec);
 
+DnsServer *dns_server_find_fastest(DnsServer *first, DnsServer *exclude);
+
 DEFINE_TRIVIAL_CLEANUP_FUNC(DnsServer*, dns_server_unref);
 
 extern const struct hash_ops dns_server_hash_ops;
@@ -225,8 +225,18 @@ static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *use
                 } else
                         s->n_written += ss;
 
-                /* Are we done? If so, disable the event source for EPOLLOUT */
+                /* Are we done? If so, start on the next queued packet,
+                 * or disable the event source for EPOLLOUT */
                 if (s->n_written >= sizeof(s->write_size) + s->write_packet->size) {
+                        if (s->n_write_queue > 0) {
+                                dns_packet_unref(s->write_packet);
+                                s->write_packet = s->write_queue[0];
+                                s->write_size = htobe16(s->write_packet->size);
+                                s->n_written = 0;
+
+                                memmove(s->write_queue, s->write_queue + 1, --s->n_write_queue * sizeof(DnsPacket*));
+                        }
+
                         r = dns_stream_update_io(s);
                         if (r < 0)
                                 return dns_stream_complete(s, -r);
@@ -336,6 +346,10 @@ DnsStream *dns_stream_free(DnsStream *s) {
         dns_packet_unref(s->write_packet);
         dns_packet_unref(s->read_packet);
 
+        while (s->n_write_queue > 0)
+                dns_packet_unref(s->write_queue[--s->n_write_queue]);
+        free(s->write_queue);
+
         free(s);
 
         return 0;
@@ -391,13 +405,43 @@ int dns_stream_new(Manager *m, DnsStream **ret, DnsProtocol protocol, int fd) {
 
 int dns_stream_write_packet(DnsStream *s, DnsPacket *p) {
         assert(s);
+        assert(p);
 
-        if (s->write_packet)
-                return -EBUSY;
+        /* If the previous packet is still being written, queue this
+         * one behind it, so that replies to pipelined queries go out
+         * in order */
+        if (s->write_packet && s->n_written < sizeof(s->write_size) + s->write_packet->size) {
+                if (!GREEDY_REALLOC(s->write_queue, s->n_write_queue_allocated, s->n_write_queue + 1))
+                        return -ENOMEM;
 
+                s->write_queue[s->n_write_queue++] = dns_packet_ref(p);
+                return 0;
+        }
+
+        dns_packet_unref(s->write_packet);
         s->write_packet = dns_packet_ref(p);
         s->write_size = htobe16(p->size);
         s->n_written = 0;
 
         return dns_stream_update_io(s);
 }
+
+DnsPacket *dns_stream_take_read_packet(DnsStream *s) {
+        DnsPacket *p;
+
+        assert(s);
+
+        /* Takes ownership of the packet just read, and starts reading
+         * the next one on the same connection */
+
+        if (!s->read_packet || s->n_read < sizeof(s->read_size) + s->read_packet->size)
+                return NULL;
+
+        p = s->read_packet;
+        s->read_packet = NULL;
+        s->n_read = 0;
+
+        (void) dns_stream_update_io(s);
+
+        return p;
+}
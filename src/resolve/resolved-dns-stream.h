@@ -49,6 +49,9 @@ struct DnsStream {
         DnsPacket *write_packet, *read_packet;
         size_t n_written, n_read;
 
+        DnsPacket **write_queue;
+        size_t n_write_queue, n_write_queue_allocated;
+
         int (*on_packet)(DnsStream *s);
         int (*complete)(DnsStream *s, int error);
 
@@ -61,3 +64,4 @@ int dns_stream_new(Manager *m, DnsStream **s, DnsProtocol protocol, int fd);
 DnsStream *dns_stream_free(DnsStream *s);
 
 int dns_stream_write_packet(DnsStream *s, DnsPacket *p);
+DnsPacket *dns_stream_take_read_packet(DnsStream *s);
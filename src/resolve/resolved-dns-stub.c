@@ -0,0 +1,523 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <netinet/in.h>
+
+#include "resolved-dns-stub.h"
+
+#define DNS_STUB_PORT 53
+
+/* The largest UDP reply we are willing to send to clients that
+ * advertise a bigger EDNS0 buffer */
+#define DNS_STUB_UDP_SIZE_MAX 4096
+
+static int dns_stub_make_reply_packet(
+                DnsPacket *request,
+                int rcode,
+                DnsAnswer *answer,
+                bool truncated,
+                uint16_t edns0_size,
+                DnsPacket **ret) {
+
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        unsigned i;
+        int r;
+
+        assert(request);
+        assert(ret);
+
+        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, 0);
+        if (r < 0)
+                return r;
+
+        DNS_PACKET_HEADER(p)->id = DNS_PACKET_HEADER(request)->id;
+        DNS_PACKET_HEADER(p)->flags = htobe16(DNS_PACKET_MAKE_FLAGS(
+                                                              1 /* qr */,
+                                                              0 /* opcode */,
+                                                              0 /* aa */,
+                                                              truncated /* tc */,
+                                                              DNS_PACKET_RD(request) /* rd */,
+                                                              1 /* ra */,
+                                                              0 /* ad */,
+                                                              0 /* cd */,
+                                                              rcode));
+
+        if (request->question) {
+                for (i = 0; i < request->question->n_keys; i++) {
+                        r = dns_packet_append_key(p, request->question->keys[i], NULL);
+                        if (r < 0)
+                                return r;
+                }
+
+                DNS_PACKET_HEADER(p)->qdcount = htobe16(request->question->n_keys);
+        }
+
+        if (answer && !truncated) {
+                for (i = 0; i < answer->n_rrs; i++) {
+                        r = dns_packet_append_rr(p, answer->items[i].rr, NULL);
+                        if (r < 0)
+                                return r;
+                }
+
+                DNS_PACKET_HEADER(p)->ancount = htobe16(answer->n_rrs);
+        }
+
+        /* RFC 6891, Section 6.1.1: if the request carried an OPT
+         * pseudo-RR, so must the reply */
+        if (edns0_size > 0) {
+                r = dns_packet_append_uint8(p, 0, NULL); /* root domain */
+                if (r < 0)
+                        return r;
+                r = dns_packet_append_uint16(p, DNS_TYPE_OPT, NULL);
+                if (r < 0)
+                        return r;
+                r = dns_packet_append_uint16(p, DNS_STUB_UDP_SIZE_MAX, NULL);
+                if (r < 0)
+                        return r;
+                r = dns_packet_append_uint32(p, 0, NULL); /* extended rcode, version, flags */
+                if (r < 0)
+                        return r;
+                r = dns_packet_append_uint16(p, 0, NULL); /* rdlength */
+                if (r < 0)
+                        return r;
+
+                DNS_PACKET_HEADER(p)->arcount = htobe16(1);
+        }
+
+        *ret = p;
+        p = NULL;
+
+        return 0;
+}
+
+static uint16_t dns_stub_edns0_size(DnsPacket *p) {
+        unsigned i;
+
+        assert(p);
+
+        /* Returns the UDP payload size the client advertised in its
+         * EDNS0 OPT pseudo-RR, or 0 if it sent none. The OPT RR ends
+         * up in the answer list when the packet is extracted, its
+         * class field carries the size. */
+
+        if (!p->answer)
+                return 0;
+
+        for (i = 0; i < p->answer->n_rrs; i++) {
+                const DnsResourceKey *key = p->answer->items[i].rr->key;
+
+                if (key->type == DNS_TYPE_OPT)
+                        return CLAMP(key->class, DNS_PACKET_UNICAST_SIZE_MAX, DNS_STUB_UDP_SIZE_MAX);
+        }
+
+        return 0;
+}
+
+static int dns_stub_send(Manager *m, DnsStream *s, DnsPacket *p, int rcode, DnsAnswer *answer) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *reply = NULL;
+        uint16_t edns0_size;
+        int r;
+
+        assert(m);
+        assert(p);
+
+        edns0_size = dns_stub_edns0_size(p);
+
+        r = dns_stub_make_reply_packet(p, rcode, answer, false, edns0_size, &reply);
+        if (r < 0)
+                return log_debug_errno(r, "Failed to build reply packet: %m");
+
+        if (s)
+                r = dns_stream_write_packet(s, reply);
+        else {
+                /* A UDP reply must fit into the buffer the client
+                 * advertised via EDNS0, or 512 bytes without it. Tell
+                 * the client to ask again via TCP otherwise. */
+                if (reply->size > MAX(edns0_size, DNS_PACKET_UNICAST_SIZE_MAX)) {
+                        reply = dns_packet_unref(reply);
+
+                        r = dns_stub_make_reply_packet(p, rcode, NULL, true, edns0_size, &reply);
+                        if (r < 0)
+                                return log_debug_errno(r, "Failed to build truncated reply packet: %m");
+                }
+
+                r = manager_send(m, m->dns_stub_udp_fd, p->ifindex, p->family, &p->sender, p->sender_port, reply);
+        }
+        if (r < 0)
+                return log_debug_errno(r, "Failed to send reply packet: %m");
+
+        return 0;
+}
+
+static int dns_stub_follow_cname(DnsQuery *q) {
+        DnsResourceRecord *cname = NULL;
+        DnsAnswer *merged;
+        unsigned i;
+        int r;
+
+        assert(q);
+
+        /* Unlike the bus clients, DNS clients expect the full chain
+         * in the reply. If the answer only has a CNAME for the
+         * question, remember it and restart the query with the new
+         * name. Returns > 0 if the query was restarted. */
+
+        if (!q->answer)
+                return 0;
+
+        for (i = 0; i < q->answer->n_rrs; i++) {
+                r = dns_question_matches_rr(q->question, q->answer->items[i].rr);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        return 0;
+
+                r = dns_question_matches_cname(q->question, q->answer->items[i].rr);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        cname = q->answer->items[i].rr;
+        }
+
+        if (!cname)
+                return 0;
+
+        merged = dns_answer_merge(q->reply_dns_answer, q->answer);
+        if (!merged)
+                return -ENOMEM;
+
+        dns_answer_unref(q->reply_dns_answer);
+        q->reply_dns_answer = merged;
+
+        r = dns_query_cname_redirect(q, cname->cname.name);
+        if (r < 0)
+                return r;
+
+        r = dns_query_go(q);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+static void dns_stub_query_complete(DnsQuery *q) {
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        int r;
+
+        assert(q);
+        assert(q->request_dns_packet);
+
+        switch (q->state) {
+
+        case DNS_TRANSACTION_SUCCESS:
+                r = dns_stub_follow_cname(q);
+                if (r > 0)
+                        return;
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to follow CNAME: %m");
+                        (void) dns_stub_send(q->manager, q->request_dns_stream, q->request_dns_packet, DNS_RCODE_SERVFAIL, NULL);
+                        break;
+                }
+
+                /* fall through */
+
+        case DNS_TRANSACTION_FAILURE:
+                answer = dns_answer_merge(q->reply_dns_answer, q->answer);
+
+                (void) dns_stub_send(q->manager, q->request_dns_stream, q->request_dns_packet,
+                                     q->state == DNS_TRANSACTION_SUCCESS ? DNS_RCODE_SUCCESS : q->answer_rcode,
+                                     answer);
+                break;
+
+        case DNS_TRANSACTION_ABORTED:
+                break;
+
+        default:
+                (void) dns_stub_send(q->manager, q->request_dns_stream, q->request_dns_packet, DNS_RCODE_SERVFAIL, NULL);
+                break;
+        }
+
+        dns_query_free(q);
+}
+
+/* Returns > 0 if a reply was sent or will be sent once the query
+ * completes, 0 if the packet was ignored */
+static int dns_stub_process_query(Manager *m, DnsStream *s, DnsPacket *p) {
+        DnsQuery *q = NULL;
+        int r;
+
+        assert(m);
+        assert(p);
+
+        if (dns_packet_validate_query(p) <= 0) {
+                log_debug("Got invalid DNS stub query packet, ignoring.");
+                return 0;
+        }
+
+        r = dns_packet_extract(p);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to extract resources from DNS stub query packet: %m");
+                (void) dns_stub_send(m, s, p, DNS_RCODE_FORMERR, NULL);
+                return 1;
+        }
+
+        if (!p->question || p->question->n_keys != 1) {
+                log_debug("Got DNS stub query packet without exactly one question, refusing.");
+                (void) dns_stub_send(m, s, p, DNS_RCODE_FORMERR, NULL);
+                return 1;
+        }
+
+        log_debug("Got DNS stub query packet for id %u", DNS_PACKET_ID(p));
+
+        r = dns_query_new(m, &q, p->question, 0, SD_RESOLVED_FLAGS_DEFAULT);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to create DNS stub query: %m");
+                (void) dns_stub_send(m, s, p, r == -EBUSY ? DNS_RCODE_REFUSED : DNS_RCODE_SERVFAIL, NULL);
+                return 1;
+        }
+
+        q->request_dns_packet = dns_packet_ref(p);
+        q->request_dns_stream = s;
+        q->complete = dns_stub_query_complete;
+
+        r = dns_query_go(q);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to start DNS stub query: %m");
+                (void) dns_stub_send(m, s, p, DNS_RCODE_SERVFAIL, NULL);
+                dns_query_free(q);
+        }
+
+        return 1;
+}
+
+static int on_dns_stub_packet(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        Manager *m = userdata;
+        int r;
+
+        r = manager_recv(m, fd, DNS_PROTOCOL_DNS, &p);
+        if (r <= 0)
+                return r;
+
+        (void) dns_stub_process_query(m, NULL, p);
+
+        return 0;
+}
+
+static int on_dns_stub_stream_complete(DnsStream *s, int error) {
+        DnsQuery *q, *n;
+
+        assert(s);
+
+        /* The client went away, or sent garbage. Either way no
+         * query may refer to the stream anymore. */
+        LIST_FOREACH_SAFE(queries, q, n, s->manager->dns_queries)
+                if (q->request_dns_stream == s)
+                        dns_query_free(q);
+
+        dns_stream_free(s);
+        return 0;
+}
+
+static int on_dns_stub_stream_packet(DnsStream *s) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+
+        assert(s);
+
+        /* Clients may send further queries on the same connection
+         * before they got the replies to the earlier ones, hence
+         * take the packet and keep reading. The stream is only
+         * completed when the client closes it, or on timeout. */
+        p = dns_stream_take_read_packet(s);
+        assert(p);
+
+        if (dns_stub_process_query(s->manager, s, p) > 0)
+                return 0;
+
+        return on_dns_stub_stream_complete(s, EBADMSG);
+}
+
+static int on_dns_stub_stream(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        DnsStream *stream;
+        Manager *m = userdata;
+        int cfd, r;
+
+        cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (cfd < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                        return 0;
+
+                return -errno;
+        }
+
+        r = dns_stream_new(m, &stream, DNS_PROTOCOL_DNS, cfd);
+        if (r < 0) {
+                safe_close(cfd);
+                return r;
+        }
+
+        stream->on_packet = on_dns_stub_stream_packet;
+        stream->complete = on_dns_stub_stream_complete;
+        return 0;
+}
+
+static int manager_dns_stub_udp_fd(Manager *m) {
+        union sockaddr_union sa = {
+                .in.sin_family = AF_INET,
+                .in.sin_addr.s_addr = htobe32(INADDR_DNS_STUB),
+                .in.sin_port = htobe16(DNS_STUB_PORT),
+        };
+        static const int one = 1;
+        int r;
+
+        assert(m);
+
+        if (m->dns_stub_udp_fd >= 0)
+                return m->dns_stub_udp_fd;
+
+        m->dns_stub_udp_fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+        if (m->dns_stub_udp_fd < 0)
+                return -errno;
+
+        r = setsockopt(m->dns_stub_udp_fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = setsockopt(m->dns_stub_udp_fd, IPPROTO_IP, IP_RECVTTL, &one, sizeof(one));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = bind(m->dns_stub_udp_fd, &sa.sa, sizeof(sa.in));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = sd_event_add_io(m->event, &m->dns_stub_udp_event_source, m->dns_stub_udp_fd, EPOLLIN, on_dns_stub_packet, m);
+        if (r < 0)
+                goto fail;
+
+        return m->dns_stub_udp_fd;
+
+fail:
+        m->dns_stub_udp_fd = safe_close(m->dns_stub_udp_fd);
+        return r;
+}
+
+static int manager_dns_stub_tcp_fd(Manager *m) {
+        union sockaddr_union sa = {
+                .in.sin_family = AF_INET,
+                .in.sin_addr.s_addr = htobe32(INADDR_DNS_STUB),
+                .in.sin_port = htobe16(DNS_STUB_PORT),
+        };
+        static const int one = 1;
+        int r;
+
+        assert(m);
+
+        if (m->dns_stub_tcp_fd >= 0)
+                return m->dns_stub_tcp_fd;
+
+        m->dns_stub_tcp_fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+        if (m->dns_stub_tcp_fd < 0)
+                return -errno;
+
+        r = setsockopt(m->dns_stub_tcp_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = setsockopt(m->dns_stub_tcp_fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = setsockopt(m->dns_stub_tcp_fd, IPPROTO_IP, IP_RECVTTL, &one, sizeof(one));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = bind(m->dns_stub_tcp_fd, &sa.sa, sizeof(sa.in));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = listen(m->dns_stub_tcp_fd, SOMAXCONN);
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = sd_event_add_io(m->event, &m->dns_stub_tcp_event_source, m->dns_stub_tcp_fd, EPOLLIN, on_dns_stub_stream, m);
+        if (r < 0)
+                goto fail;
+
+        return m->dns_stub_tcp_fd;
+
+fail:
+        m->dns_stub_tcp_fd = safe_close(m->dns_stub_tcp_fd);
+        return r;
+}
+
+void manager_dns_stub_stop(Manager *m) {
+        assert(m);
+
+        m->dns_stub_udp_event_source = sd_event_source_unref(m->dns_stub_udp_event_source);
+        m->dns_stub_udp_fd = safe_close(m->dns_stub_udp_fd);
+
+        m->dns_stub_tcp_event_source = sd_event_source_unref(m->dns_stub_tcp_event_source);
+        m->dns_stub_tcp_fd = safe_close(m->dns_stub_tcp_fd);
+}
+
+int manager_dns_stub_start(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (!m->dns_stub_listener)
+                return 0;
+
+        r = manager_dns_stub_udp_fd(m);
+        if (r == -EADDRINUSE)
+                goto eaddrinuse;
+        if (r < 0)
+                return r;
+
+        r = manager_dns_stub_tcp_fd(m);
+        if (r == -EADDRINUSE)
+                goto eaddrinuse;
+        if (r < 0)
+                return r;
+
+        return 0;
+
+eaddrinuse:
+        log_warning("Another process is already listening on the DNS stub address. Turning off the DNS stub listener.");
+        manager_dns_stub_stop(m);
+
+        return 0;
+}
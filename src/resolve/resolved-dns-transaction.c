@@ -39,14 +39,12 @@ DnsTransaction* dns_transaction_free(DnsTransaction *t) {
         dns_packet_unref(t->received);
         dns_answer_unref(t->cached);
 
-        sd_event_source_unref(t->dns_udp_event_source);
-        safe_close(t->dns_udp_fd);
-
+        dns_server_socket_unref(t->server_socket);
         dns_server_unref(t->server);
         dns_stream_free(t->stream);
 
         if (t->scope) {
-                hashmap_remove(t->scope->transactions, t->key);
+                hashmap_remove_value(t->prefetch ? t->scope->prefetch_transactions : t->scope->transactions, t->key, t);
 
                 if (t->id != 0)
                         hashmap_remove(t->scope->manager->dns_transactions, UINT_TO_PTR(t->id));
@@ -78,8 +76,9 @@ void dns_transaction_gc(DnsTransaction *t) {
                 dns_transaction_free(t);
 }
 
-int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key) {
+int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key, bool prefetch) {
         _cleanup_(dns_transaction_freep) DnsTransaction *t = NULL;
+        Hashmap **transactions;
         int r;
 
         assert(ret);
@@ -90,7 +89,9 @@ int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key)
         if (r < 0)
                 return r;
 
-        r = hashmap_ensure_allocated(&s->transactions, &dns_resource_key_hash_ops);
+        transactions = prefetch ? &s->prefetch_transactions : &s->transactions;
+
+        r = hashmap_ensure_allocated(transactions, &dns_resource_key_hash_ops);
         if (r < 0)
                 return r;
 
@@ -98,8 +99,8 @@ int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key)
         if (!t)
                 return -ENOMEM;
 
-        t->dns_udp_fd = -1;
         t->key = dns_resource_key_ref(key);
+        t->prefetch = prefetch;
 
         /* Find a fresh, unused transaction id */
         do
@@ -113,7 +114,7 @@ int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key)
                 return r;
         }
 
-        r = hashmap_put(s->transactions, t->key, t);
+        r = hashmap_put(*transactions, t->key, t);
         if (r < 0) {
                 hashmap_remove(s->manager->dns_transactions, UINT_TO_PTR(t->id));
                 return r;
@@ -327,9 +328,8 @@ static int dns_transaction_open_tcp(DnsTransaction *t) {
 static void dns_transaction_next_dns_server(DnsTransaction *t) {
         assert(t);
 
+        t->server_socket = dns_server_socket_unref(t->server_socket);
         t->server = dns_server_unref(t->server);
-        t->dns_udp_event_source = sd_event_source_unref(t->dns_udp_event_source);
-        t->dns_udp_fd = safe_close(t->dns_udp_fd);
 
         dns_scope_next_dns_server(t->scope);
 }
@@ -466,50 +466,26 @@ void dns_transaction_process_reply(DnsTransaction *t, DnsPacket *p) {
                 dns_transaction_complete(t, DNS_TRANSACTION_FAILURE);
 }
 
-static int on_dns_packet(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
-        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
-        DnsTransaction *t = userdata;
-        int r;
-
-        assert(t);
-        assert(t->scope);
-
-        r = manager_recv(t->scope->manager, fd, DNS_PROTOCOL_DNS, &p);
-        if (r <= 0)
-                return r;
-
-        if (dns_packet_validate_reply(p) > 0 &&
-            DNS_PACKET_ID(p) == t->id)
-                dns_transaction_process_reply(t, p);
-        else
-                log_debug("Invalid DNS packet.");
-
-        return 0;
-}
-
 static int dns_transaction_emit(DnsTransaction *t) {
         int r;
 
         assert(t);
 
         if (t->scope->protocol == DNS_PROTOCOL_DNS && !t->server) {
-                DnsServer *server = NULL;
-                _cleanup_close_ int fd = -1;
+                DnsServer *server;
 
-                fd = dns_scope_udp_dns_socket(t->scope, &server);
-                if (fd < 0)
-                        return fd;
+                server = dns_scope_get_dns_server(t->scope);
+                if (!server)
+                        return -ESRCH;
 
-                r = sd_event_add_io(t->scope->manager->event, &t->dns_udp_event_source, fd, EPOLLIN, on_dns_packet, t);
+                r = dns_server_socket_acquire(server, t->scope, &t->server_socket);
                 if (r < 0)
                         return r;
 
-                t->dns_udp_fd = fd;
-                fd = -1;
                 t->server = dns_server_ref(server);
         }
 
-        r = dns_scope_emit(t->scope, t->dns_udp_fd, t->sent);
+        r = dns_scope_emit(t->scope, t->server_socket ? t->server_socket->fd : -1, t->sent);
         if (r < 0)
                 return r;
 
@@ -523,15 +499,16 @@ static int on_transaction_timeout(sd_event_source *s, usec_t usec, void *userdat
         assert(s);
         assert(t);
 
-        /* Timeout reached? Try again, with a new server */
-        dns_transaction_next_dns_server(t);
-
-        /* ... and possibly increased timeout */
+        /* Timeout reached? Account for it, possibly increasing the
+         * timeout... */
         if (t->server)
                 dns_server_packet_lost(t->server, usec - t->start_usec);
         else
                 dns_scope_packet_lost(t->scope, usec - t->start_usec);
 
+        /* ... and try again, with a new server */
+        dns_transaction_next_dns_server(t);
+
         r = dns_transaction_go(t);
         if (r < 0)
                 dns_transaction_complete(t, DNS_TRANSACTION_RESOURCES);
@@ -588,6 +565,33 @@ static usec_t transaction_get_resend_timeout(DnsTransaction *t) {
         }
 }
 
+static void dns_transaction_prefetch(DnsScope *s, DnsResourceKey *key) {
+        DnsTransaction *t;
+        int r;
+
+        assert(s);
+        assert(key);
+
+        if (hashmap_get(s->prefetch_transactions, key))
+                return;
+
+        r = dns_transaction_new(&t, s, key, true);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to create prefetch transaction: %m");
+                return;
+        }
+
+        log_debug("Refreshing cache entry in the background.");
+
+        /* If this completes right-away the transaction is already
+         * gone afterwards */
+        r = dns_transaction_go(t);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to start prefetch transaction: %m");
+                dns_transaction_free(t);
+        }
+}
+
 int dns_transaction_go(DnsTransaction *t) {
         bool had_stream;
         usec_t ts;
@@ -625,8 +629,9 @@ int dns_transaction_go(DnsTransaction *t) {
         t->cached_rcode = 0;
 
         /* Check the cache, but only if this transaction is not used
-         * for probing or verifying a zone item. */
-        if (set_isempty(t->zone_items)) {
+         * for probing or verifying a zone item, or for refreshing the
+         * cache itself. */
+        if (set_isempty(t->zone_items) && !t->prefetch) {
 
                 /* Before trying the cache, let's make sure we figured out a
                  * server to use. Should this cause a change of server this
@@ -640,6 +645,13 @@ int dns_transaction_go(DnsTransaction *t) {
                 if (r < 0)
                         return r;
                 if (r > 0) {
+                        /* Popular entries are refreshed before they
+                         * expire, so that their users never have to
+                         * wait for the network */
+                        if (t->scope->protocol == DNS_PROTOCOL_DNS &&
+                            dns_cache_prefetch_due(&t->scope->cache, t->key, ts))
+                                dns_transaction_prefetch(t->scope, t->key);
+
                         if (t->cached_rcode == DNS_RCODE_SUCCESS)
                                 dns_transaction_complete(t, DNS_TRANSACTION_SUCCESS);
                         else
@@ -54,6 +54,11 @@ struct DnsTransaction {
 
         bool initial_jitter;
 
+        /* Refreshes a cache entry in the background, nobody waits
+         * for it. Not registered in the scope's transactions, but in
+         * its prefetch_transactions. */
+        bool prefetch;
+
         DnsPacket *sent, *received;
         DnsAnswer *cached;
         int cached_rcode;
@@ -62,11 +67,9 @@ struct DnsTransaction {
         sd_event_source *timeout_event_source;
         unsigned n_attempts;
 
-        int dns_udp_fd;
-        sd_event_source *dns_udp_event_source;
-
-        /* The active server */
+        /* The active server, and the socket we talk to it on */
         DnsServer *server;
+        DnsServerSocket *server_socket;
 
         /* TCP connection logic, if we need it */
         DnsStream *stream;
@@ -84,7 +87,7 @@ struct DnsTransaction {
         LIST_FIELDS(DnsTransaction, transactions_by_scope);
 };
 
-int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key);
+int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key, bool prefetch);
 DnsTransaction* dns_transaction_free(DnsTransaction *t);
 
 void dns_transaction_gc(DnsTransaction *t);
@@ -177,7 +177,7 @@ static int dns_zone_item_probe_start(DnsZoneItem *i)  {
 
         t = dns_scope_find_transaction(i->scope, key, false);
         if (!t) {
-                r = dns_transaction_new(&t, i->scope, key);
+                r = dns_transaction_new(&t, i->scope, key, false);
                 if (r < 0)
                         return r;
         }
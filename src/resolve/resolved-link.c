@@ -341,17 +341,16 @@ DnsServer *link_get_dns_server(Link *l) {
 }
 
 void link_next_dns_server(Link *l) {
+        DnsServer *s;
+
         assert(l);
 
         if (!l->current_dns_server)
                 return;
 
-        if (l->current_dns_server->servers_next) {
-                link_set_dns_server(l, l->current_dns_server->servers_next);
-                return;
-        }
-
-        link_set_dns_server(l, l->dns_servers);
+        s = dns_server_find_fastest(l->dns_servers, l->current_dns_server);
+        if (s)
+                link_set_dns_server(l, s);
 }
 
 int link_address_new(Link *l, LinkAddress **ret, int family, const union in_addr_union *in_addr) {
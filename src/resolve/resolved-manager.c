@@ -39,9 +39,16 @@
 #include "resolved-bus.h"
 #include "resolved-manager.h"
 #include "resolved-llmnr.h"
+#include "resolved-dns-stub.h"
 
 #define SEND_TIMEOUT_USEC (200 * USEC_PER_MSEC)
 
+#define CACHE_FILE "/run/systemd/resolve/cache"
+#define CACHE_FILE_SIGNATURE "RSLVCACH"
+
+/* How often to save the cache, if PersistentCache= is on */
+#define CACHE_SAVE_INTERVAL_USEC (5 * USEC_PER_MINUTE)
+
 static int manager_process_link(sd_netlink *rtnl, sd_netlink_message *mm, void *userdata) {
         Manager *m = userdata;
         uint16_t type;
@@ -467,9 +474,12 @@ int manager_new(Manager **ret) {
 
         m->llmnr_ipv4_udp_fd = m->llmnr_ipv6_udp_fd = -1;
         m->llmnr_ipv4_tcp_fd = m->llmnr_ipv6_tcp_fd = -1;
+        m->dns_stub_udp_fd = m->dns_stub_tcp_fd = -1;
         m->hostname_fd = -1;
 
         m->llmnr_support = SUPPORT_YES;
+        m->cache_size = DNS_CACHE_SIZE_DEFAULT;
+        m->dns_stub_listener = true;
         m->read_resolv_conf = true;
 
         r = manager_parse_dns_server(m, DNS_SERVER_FALLBACK, DNS_SERVERS);
@@ -513,15 +523,49 @@ int manager_new(Manager **ret) {
         return 0;
 }
 
+static int on_cache_save(sd_event_source *s, usec_t usec, void *userdata) {
+        Manager *m = userdata;
+        int r;
+
+        assert(m);
+
+        r = manager_save_cache(m);
+        if (r < 0)
+                log_warning_errno(r, "Failed to save DNS cache, ignoring: %m");
+
+        r = sd_event_source_set_time(s, usec + CACHE_SAVE_INTERVAL_USEC);
+        if (r < 0)
+                return r;
+
+        return sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+}
+
 int manager_start(Manager *m) {
         int r;
 
         assert(m);
 
+        if (m->persistent_cache) {
+                r = manager_load_cache(m);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to load DNS cache, ignoring: %m");
+
+                r = sd_event_add_time(m->event, &m->cache_save_event_source,
+                                      clock_boottime_or_monotonic(),
+                                      now(clock_boottime_or_monotonic()) + CACHE_SAVE_INTERVAL_USEC, 0,
+                                      on_cache_save, m);
+                if (r < 0)
+                        return r;
+        }
+
         r = manager_llmnr_start(m);
         if (r < 0)
                 return r;
 
+        r = manager_dns_stub_start(m);
+        if (r < 0)
+                return r;
+
         return 0;
 }
 
@@ -549,12 +593,14 @@ Manager *manager_free(Manager *m) {
         sd_network_monitor_unref(m->network_monitor);
 
         manager_llmnr_stop(m);
+        manager_dns_stub_stop(m);
 
         sd_bus_slot_unref(m->prepare_for_sleep_slot);
         sd_event_source_unref(m->bus_retry_event_source);
         sd_bus_unref(m->bus);
 
         sd_event_source_unref(m->sigusr1_event_source);
+        sd_event_source_unref(m->cache_save_event_source);
 
         sd_event_unref(m->event);
 
@@ -859,6 +905,120 @@ fail:
         return r;
 }
 
+int manager_save_cache(Manager *m) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        DnsScope *s;
+        int r;
+
+        assert(m);
+
+        if (!m->persistent_cache)
+                return 0;
+
+        r = fopen_temporary(CACHE_FILE, &f, &temp_path);
+        if (r < 0)
+                return r;
+
+        (void) fchmod(fileno(f), 0600);
+
+        fwrite(CACHE_FILE_SIGNATURE, strlen(CACHE_FILE_SIGNATURE), 1, f);
+
+        /* Only save what we got from the servers we currently use,
+         * the cache is flushed anyway when switching */
+        LIST_FOREACH(scopes, s, m->dns_scopes) {
+                DnsServer *server;
+
+                if (s->protocol != DNS_PROTOCOL_DNS)
+                        continue;
+
+                server = s->link ? s->link->current_dns_server : m->current_dns_server;
+                if (!server)
+                        continue;
+
+                r = dns_cache_save(&s->cache, f, s->link ? s->link->ifindex : 0, server);
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp_path, CACHE_FILE) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        (void) unlink(temp_path);
+        return r;
+}
+
+int manager_load_cache(Manager *m) {
+        _cleanup_fclose_ FILE *f = NULL;
+        char signature[strlen(CACHE_FILE_SIGNATURE)];
+        unsigned n = 0;
+        int r;
+
+        assert(m);
+
+        f = fopen(CACHE_FILE, "re");
+        if (!f)
+                return errno == ENOENT ? 0 : -errno;
+
+        if (fread(signature, sizeof(signature), 1, f) != 1 ||
+            memcmp(signature, CACHE_FILE_SIGNATURE, sizeof(signature)) != 0)
+                return -EBADMSG;
+
+        for (;;) {
+                _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+                union in_addr_union address;
+                DnsScope *scope = NULL;
+                DnsServer *server;
+                int ifindex, family;
+
+                r = dns_cache_read_record(f, &ifindex, &family, &address, &answer);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        break;
+
+                if (ifindex == 0)
+                        scope = m->unicast_scope;
+                else {
+                        Link *l;
+
+                        l = hashmap_get(m->links, INT_TO_PTR(ifindex));
+                        if (l)
+                                scope = l->unicast_scope;
+                }
+                if (!scope)
+                        continue;
+
+                /* Pick the server now, so that it doesn't flush
+                 * what we restore later, and only restore entries
+                 * from the same server */
+                server = dns_scope_get_dns_server(scope);
+                if (!server ||
+                    server->family != family ||
+                    !in_addr_equal(family, &server->address, &address))
+                        continue;
+
+                r = dns_cache_put(&scope->cache, NULL, DNS_RCODE_SUCCESS, answer, answer->n_rrs, 0, server->family, &server->address);
+                if (r < 0)
+                        return r;
+
+                n += answer->n_rrs;
+        }
+
+        log_debug("Restored %u cache entries.", n);
+
+        return 0;
+}
+
 int manager_recv(Manager *m, int fd, DnsProtocol protocol, DnsPacket **ret) {
         _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
         union {
@@ -1236,6 +1396,8 @@ DnsServer *manager_get_dns_server(Manager *m) {
 }
 
 void manager_next_dns_server(Manager *m) {
+        DnsServer *s;
+
         assert(m);
 
         /* If there's currently no DNS server set, then the next
@@ -1243,18 +1405,12 @@ void manager_next_dns_server(Manager *m) {
         if (!m->current_dns_server)
                 return;
 
-        /* Change to the next one */
-        if (m->current_dns_server->servers_next) {
-                manager_set_dns_server(m, m->current_dns_server->servers_next);
-                return;
-        }
-
-        /* If there was no next one, then start from the beginning of
-         * the list */
-        if (m->current_dns_server->type == DNS_SERVER_FALLBACK)
-                manager_set_dns_server(m, m->fallback_dns_servers);
-        else
-                manager_set_dns_server(m, m->dns_servers);
+        /* Change to the fastest of the others in the same list, if
+         * there are any */
+        s = dns_server_find_fastest(m->current_dns_server->type == DNS_SERVER_FALLBACK ? m->fallback_dns_servers : m->dns_servers,
+                                    m->current_dns_server);
+        if (s)
+                manager_set_dns_server(m, s);
 }
 
 uint32_t manager_find_mtu(Manager *m) {
@@ -46,6 +46,9 @@ struct Manager {
         sd_event *event;
 
         Support llmnr_support;
+        size_t cache_size;
+        bool dns_stub_listener;
+        bool persistent_cache;
 
         /* Network */
         Hashmap *links;
@@ -86,6 +89,13 @@ struct Manager {
         sd_event_source *llmnr_ipv4_tcp_event_source;
         sd_event_source *llmnr_ipv6_tcp_event_source;
 
+        /* DNS stub listener on 127.0.0.53 */
+        int dns_stub_udp_fd;
+        int dns_stub_tcp_fd;
+
+        sd_event_source *dns_stub_udp_event_source;
+        sd_event_source *dns_stub_tcp_event_source;
+
         /* dbus */
         sd_bus *bus;
         sd_event_source *bus_retry_event_source;
@@ -104,6 +114,8 @@ struct Manager {
         sd_bus_slot *prepare_for_sleep_slot;
 
         sd_event_source *sigusr1_event_source;
+
+        sd_event_source *cache_save_event_source;
 };
 
 /* Manager */
@@ -115,6 +127,9 @@ int manager_start(Manager *m);
 int manager_read_resolv_conf(Manager *m);
 int manager_write_resolv_conf(Manager *m);
 
+int manager_save_cache(Manager *m);
+int manager_load_cache(Manager *m);
+
 DnsServer *manager_set_dns_server(Manager *m, DnsServer *s);
 DnsServer *manager_find_dns_server(Manager *m, int family, const union in_addr_union *in_addr);
 DnsServer *manager_get_dns_server(Manager *m);
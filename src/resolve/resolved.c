@@ -67,7 +67,8 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
-        r = drop_privileges(uid, gid, 0);
+        /* Keep the right to bind the DNS stub listener to port 53 */
+        r = drop_privileges(uid, gid, (1ULL << CAP_NET_BIND_SERVICE));
         if (r < 0)
                 goto finish;
 
@@ -107,6 +108,8 @@ int main(int argc, char *argv[]) {
 
         sd_event_get_exit_code(m->event, &r);
 
+        (void) manager_save_cache(m);
+
 finish:
         sd_notify(false,
                   "STOPPING=1\n"
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "formats-util.h"
@@ -32,6 +33,25 @@
 #include "cgroup-util.h"
 #include "cgroup-show.h"
 #include "terminal-util.h"
+#include "proc-snapshot.h"
+
+/* Below this many processes reading their command lines in threads
+ * is not worth it */
+#define PARALLEL_PIDS_MIN 256U
+#define PARALLEL_THREADS_MAX 16U
+
+typedef struct PidLine {
+        pid_t pid;
+        char *line;
+        bool kernel_thread;
+} PidLine;
+
+typedef struct PidLineWork {
+        PidLine *lines;
+        unsigned n_lines;
+        volatile unsigned next;
+        size_t max_length;
+} PidLineWork;
 
 static int compare(const void *a, const void *b) {
         const pid_t *p = a, *q = b;
@@ -43,12 +63,93 @@ static int compare(const void *a, const void *b) {
         return 0;
 }
 
-static void show_pid_array(pid_t pids[], unsigned n_pids, const char *prefix, unsigned n_columns, bool extra, bool more, bool kernel_threads, OutputFlags flags) {
-        unsigned i, j, pid_width;
+static void pid_line_read(ProcSnapshot **s, PidLine *l, size_t max_length) {
+        const char *comm;
+        char *t;
+        int r;
 
-        if (n_pids == 0)
+        if (*s)
+                r = proc_snapshot_open(*s, l->pid);
+        else
+                r = proc_snapshot_new(l->pid, s);
+        if (r < 0)
                 return;
 
+        r = proc_snapshot_get_cmdline(*s, &t);
+        if (r >= 0) {
+                /* Same as get_process_cmdline() does, leave room
+                 * for the ellipsis */
+                if (max_length > 0 && strlen(t) >= max_length) {
+                        if (max_length > 4)
+                                strcpy(t + max_length - 4, "...");
+                        else
+                                t[max_length - 1] = 0;
+                }
+
+                l->line = t;
+                return;
+        }
+
+        /* Kernel threads have no argv[], show their name instead */
+        if (r == -ENOENT) {
+                l->kernel_thread = l->pid != 1;
+
+                if (proc_snapshot_get_comm(*s, &comm) >= 0)
+                        l->line = strjoin("[", comm, "]", NULL);
+        }
+}
+
+static void pid_line_work(PidLineWork *w) {
+        _cleanup_proc_snapshot_free_ ProcSnapshot *s = NULL;
+        unsigned i;
+
+        /* The procfs snapshot and its buffers are reused for all
+         * processes this thread picks up */
+        while ((i = __sync_fetch_and_add(&w->next, 1)) < w->n_lines)
+                pid_line_read(&s, w->lines + i, w->max_length);
+}
+
+static void *pid_line_thread(void *userdata) {
+        pid_line_work(userdata);
+        return NULL;
+}
+
+static void pid_lines_read(PidLine *lines, unsigned n_lines, size_t max_length) {
+        PidLineWork w = {
+                .lines = lines,
+                .n_lines = n_lines,
+                .max_length = max_length,
+        };
+        pthread_t threads[PARALLEL_THREADS_MAX];
+        unsigned n_threads = 0, i;
+        long n_cpus;
+
+        if (n_lines >= PARALLEL_PIDS_MIN) {
+                n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                if (n_cpus > 1)
+                        n_threads = MIN((unsigned) n_cpus - 1, PARALLEL_THREADS_MAX);
+        }
+
+        /* If we cannot start a thread, we just do its share
+         * ourselves */
+        for (i = 0; i < n_threads; i++)
+                if (pthread_create(threads + i, NULL, pid_line_thread, &w) != 0)
+                        break;
+        n_threads = i;
+
+        pid_line_work(&w);
+
+        for (i = 0; i < n_threads; i++)
+                (void) pthread_join(threads[i], NULL);
+}
+
+static int show_pid_array(pid_t pids[], unsigned n_pids, const char *prefix, unsigned n_columns, bool extra, bool more, bool kernel_threads, OutputFlags flags) {
+        _cleanup_free_ PidLine *lines = NULL;
+        unsigned i, j, n_lines, pid_width;
+
+        if (n_pids == 0)
+                return 0;
+
         qsort(pids, n_pids, sizeof(pid_t), compare);
 
         /* Filter duplicates */
@@ -58,7 +159,19 @@ static void show_pid_array(pid_t pids[], unsigned n_pids, const char *prefix, un
                 pids[++j] = pids[i];
         }
         n_pids = j + 1;
-        pid_width = DECIMAL_STR_WIDTH(pids[j]);
+
+        lines = new0(PidLine, n_pids);
+        if (!lines)
+                return -ENOMEM;
+
+        for (i = 0; i < n_pids; i++)
+                lines[i].pid = pids[i];
+
+        /* The width is not known yet, since it depends on the
+         * largest pid we end up showing, but it only ever shrinks
+         * by removing kernel threads. Cut for the widest pid, and
+         * cut again below. */
+        pid_width = DECIMAL_STR_WIDTH(pids[n_pids-1]);
 
         if (flags & OUTPUT_FULL_WIDTH)
                 n_columns = 0;
@@ -68,18 +181,34 @@ static void show_pid_array(pid_t pids[], unsigned n_pids, const char *prefix, un
                 else
                         n_columns = 20;
         }
-        for (i = 0; i < n_pids; i++) {
-                _cleanup_free_ char *t = NULL;
 
-                get_process_cmdline(pids[i], n_columns, true, &t);
+        pid_lines_read(lines, n_pids, n_columns);
+
+        for (i = 0, n_lines = 0; i < n_pids; i++) {
+                if (!kernel_threads && lines[i].kernel_thread) {
+                        free(lines[i].line);
+                        continue;
+                }
+
+                lines[n_lines++] = lines[i];
+        }
+
+        if (n_lines == 0)
+                return 0;
+
+        pid_width = DECIMAL_STR_WIDTH(lines[n_lines-1].pid);
 
+        for (i = 0; i < n_lines; i++) {
                 if (extra)
                         printf("%s%s ", prefix, draw_special_char(DRAW_TRIANGULAR_BULLET));
                 else
-                        printf("%s%s", prefix, draw_special_char(((more || i < n_pids-1) ? DRAW_TREE_BRANCH : DRAW_TREE_RIGHT)));
+                        printf("%s%s", prefix, draw_special_char(((more || i < n_lines-1) ? DRAW_TREE_BRANCH : DRAW_TREE_RIGHT)));
 
-                printf("%*"PID_PRI" %s\n", pid_width, pids[i], strna(t));
+                printf("%*"PID_PRI" %s\n", pid_width, lines[i].pid, strna(lines[i].line));
+                free(lines[i].line);
         }
+
+        return 0;
 }
 
 
@@ -101,11 +230,10 @@ static int show_cgroup_one_by_path(const char *path, const char *prefix, unsigne
         if (!f)
                 return -errno;
 
+        /* Kernel threads are filtered out while showing, since that
+         * needs the command line of each process anyway */
         while ((r = cg_read_pid(f, &pid)) > 0) {
 
-                if (!kernel_threads && is_kernel_thread(pid) > 0)
-                        continue;
-
                 if (!GREEDY_REALLOC(pids, n_allocated, n + 1))
                         return -ENOMEM;
 
@@ -116,12 +244,10 @@ static int show_cgroup_one_by_path(const char *path, const char *prefix, unsigne
         if (r < 0)
                 return r;
 
-        show_pid_array(pids, n, prefix, n_columns, false, more, kernel_threads, flags);
-
-        return 0;
+        return show_pid_array(pids, n, prefix, n_columns, false, more, kernel_threads, flags);
 }
 
-int show_cgroup_by_path(const char *path, const char *prefix, unsigned n_columns, bool kernel_threads, OutputFlags flags) {
+int show_cgroup_by_path(const char *path, const char *prefix, unsigned n_columns, bool kernel_threads, unsigned max_depth, OutputFlags flags) {
         _cleanup_free_ char *fn = NULL, *p1 = NULL, *last = NULL, *p2 = NULL;
         _cleanup_closedir_ DIR *d = NULL;
         char *gn = NULL;
@@ -136,6 +262,11 @@ int show_cgroup_by_path(const char *path, const char *prefix, unsigned n_columns
         if (!prefix)
                 prefix = "";
 
+        /* Below the requested depth neither processes nor subgroups
+         * are read, the parent only shows the name of the group */
+        if (max_depth == 0)
+                return 0;
+
         r = cg_mangle_path(path, &fn);
         if (r < 0)
                 return r;
@@ -169,7 +300,7 @@ int show_cgroup_by_path(const char *path, const char *prefix, unsigned n_columns
                                         return -ENOMEM;
                         }
 
-                        show_cgroup_by_path(last, p1, n_columns-2, kernel_threads, flags);
+                        show_cgroup_by_path(last, p1, n_columns-2, kernel_threads, max_depth == (unsigned) -1 ? max_depth : max_depth - 1, flags);
                         free(last);
                 }
 
@@ -192,13 +323,13 @@ int show_cgroup_by_path(const char *path, const char *prefix, unsigned n_columns
                                 return -ENOMEM;
                 }
 
-                show_cgroup_by_path(last, p2, n_columns-2, kernel_threads, flags);
+                show_cgroup_by_path(last, p2, n_columns-2, kernel_threads, max_depth == (unsigned) -1 ? max_depth : max_depth - 1, flags);
         }
 
         return 0;
 }
 
-int show_cgroup(const char *controller, const char *path, const char *prefix, unsigned n_columns, bool kernel_threads, OutputFlags flags) {
+int show_cgroup(const char *controller, const char *path, const char *prefix, unsigned n_columns, bool kernel_threads, unsigned max_depth, OutputFlags flags) {
         _cleanup_free_ char *p = NULL;
         int r;
 
@@ -208,7 +339,7 @@ int show_cgroup(const char *controller, const char *path, const char *prefix, un
         if (r < 0)
                 return r;
 
-        return show_cgroup_by_path(p, prefix, n_columns, kernel_threads, flags);
+        return show_cgroup_by_path(p, prefix, n_columns, kernel_threads, max_depth, flags);
 }
 
 static int show_extra_pids(const char *controller, const char *path, const char *prefix, unsigned n_columns, const pid_t pids[], unsigned n_pids, OutputFlags flags) {
@@ -243,9 +374,7 @@ static int show_extra_pids(const char *controller, const char *path, const char
                 copy[j++] = pids[i];
         }
 
-        show_pid_array(copy, j, prefix, n_columns, true, false, false, flags);
-
-        return 0;
+        return show_pid_array(copy, j, prefix, n_columns, true, false, true, flags);
 }
 
 int show_cgroup_and_extra(const char *controller, const char *path, const char *prefix, unsigned n_columns, bool kernel_threads, const pid_t extra_pids[], unsigned n_extra_pids, OutputFlags flags) {
@@ -253,7 +382,7 @@ int show_cgroup_and_extra(const char *controller, const char *path, const char *
 
         assert(path);
 
-        r = show_cgroup(controller, path, prefix, n_columns, kernel_threads, flags);
+        r = show_cgroup(controller, path, prefix, n_columns, kernel_threads, (unsigned) -1, flags);
         if (r < 0)
                 return r;
 
@@ -32,6 +32,7 @@
 #include "log.h"
 #include "utf8.h"
 #include "path-util.h"
+#include "fileio.h"
 #include "signal-util.h"
 #include "conf-parser.h"
 
@@ -162,7 +163,7 @@ static int parse_line(const char* unit,
                       const void *table,
                       bool relaxed,
                       bool allow_include,
-                      char **section,
+                      const char **section,
                       unsigned *section_line,
                       bool *section_ignored,
                       char *l,
@@ -221,9 +222,10 @@ static int parse_line(const char* unit,
                         return -EBADMSG;
                 }
 
-                n = strndup(l+1, k-2);
-                if (!n)
-                        return -ENOMEM;
+                /* The line buffer lives as long as the file is
+                 * parsed, hence refer to the section name in there */
+                l[k-1] = 0;
+                n = l + 1;
 
                 if (sections && !nulstr_contains(sections, n)) {
 
@@ -231,12 +233,10 @@ static int parse_line(const char* unit,
                                 log_syntax(unit, LOG_WARNING, filename, line, EINVAL,
                                            "Unknown section '%s'. Ignoring.", n);
 
-                        free(n);
-                        *section = mfree(*section);
+                        *section = NULL;
                         *section_line = 0;
                         *section_ignored = true;
                 } else {
-                        free(*section);
                         *section = n;
                         *section_line = line;
                         *section_ignored = false;
@@ -288,10 +288,13 @@ int config_parse(const char *unit,
                  bool warn,
                  void *userdata) {
 
-        _cleanup_free_ char *section = NULL, *continuation = NULL;
         _cleanup_fclose_ FILE *ours = NULL;
+        _cleanup_free_ char *buf = NULL;
+        const char *section = NULL;
         unsigned line = 0, section_line = 0;
         bool section_ignored = false;
+        char *p, *end;
+        size_t size;
         int r;
 
         assert(filename);
@@ -311,56 +314,55 @@ int config_parse(const char *unit,
 
         fd_warn_permissions(filename, fileno(f));
 
-        while (!feof(f)) {
-                char l[LINE_MAX], *p, *c = NULL, *e;
-                bool escaped = false;
-
-                if (!fgets(l, sizeof(l), f)) {
-                        if (feof(f))
-                                break;
+        /* Read the file in one go and tokenize it in place: lines,
+         * continuations and section names all stay in this buffer,
+         * so that nothing is allocated per line. */
+        r = read_full_stream(f, &buf, &size);
+        if (r < 0) {
+                if (warn)
+                        log_error_errno(r, "Failed to read configuration file '%s': %m", filename);
+                return r;
+        }
 
-                        log_error_errno(errno, "Failed to read configuration file '%s': %m", filename);
-                        return -errno;
-                }
+        end = buf + size;
+        p = buf;
 
-                truncate_nl(l);
+        while (p < end) {
+                char *l = p, *w = p;
+                bool escaped = false;
 
-                if (continuation) {
-                        c = strappend(continuation, l);
-                        if (!c) {
-                                if (warn)
-                                        log_oom();
-                                return -ENOMEM;
+                /* Join continuation lines by moving them down over
+                 * the preceding newline, the trailing backslash
+                 * becomes a space. */
+                for (;;) {
+                        char *eol, *e;
+
+                        eol = memchr(p, '\n', end - p);
+                        if (!eol)
+                                eol = end;
+                        *eol = 0;
+                        truncate_nl(p);
+
+                        escaped = false;
+                        for (e = p; *e; e++) {
+                                escaped = !escaped && *e == '\\';
+                                *(w++) = *e;
                         }
 
-                        continuation = mfree(continuation);
-                        p = c;
-                } else
-                        p = l;
+                        p = eol < end ? eol + 1 : end;
+
+                        if (!escaped || p >= end)
+                                break;
 
-                for (e = p; *e; e++) {
-                        if (escaped)
-                                escaped = false;
-                        else if (*e == '\\')
-                                escaped = true;
+                        *(w-1) = ' ';
                 }
 
-                if (escaped) {
-                        *(e-1) = ' ';
-
-                        if (c)
-                                continuation = c;
-                        else {
-                                continuation = strdup(l);
-                                if (!continuation) {
-                                        if (warn)
-                                                log_oom();
-                                        return -ENOMEM;
-                                }
-                        }
+                /* A continuation at the very end of the file is
+                 * dropped, like it always was */
+                if (escaped)
+                        break;
 
-                        continue;
-                }
+                *w = 0;
 
                 r = parse_line(unit,
                                filename,
@@ -373,10 +375,8 @@ int config_parse(const char *unit,
                                &section,
                                &section_line,
                                &section_ignored,
-                               p,
+                               l,
                                userdata);
-                free(c);
-
                 if (r < 0) {
                         if (warn)
                                 log_warning_errno(r, "Failed to parse file '%s': %m",
@@ -24,6 +24,7 @@
 #include <stringprep.h>
 #endif
 
+#include "siphash24.h"
 #include "dns-domain.h"
 
 int dns_label_unescape(const char **name, char *dest, size_t sz) {
@@ -176,22 +177,20 @@ int dns_label_unescape_suffix(const char *name, const char **label_terminal, cha
         return r;
 }
 
-int dns_label_escape(const char *p, size_t l, char **ret) {
-        _cleanup_free_ char *s = NULL;
+int dns_label_escape_buffer(const char *p, size_t l, char *dest, size_t sz) {
         char *q;
-        int r;
 
         assert(p);
-        assert(ret);
+        assert(dest);
 
         if (l > DNS_LABEL_MAX)
                 return -EINVAL;
 
-        s = malloc(l * 4 + 1);
-        if (!s)
-                return -ENOMEM;
+        /* Escaping expands each character to at most four */
+        if (sz < l * 4 + 1)
+                return -ENOSPC;
 
-        q = s;
+        q = dest;
         while (l > 0) {
 
                 if (*p == '.' || *p == '\\') {
@@ -224,8 +223,29 @@ int dns_label_escape(const char *p, size_t l, char **ret) {
         }
 
         *q = 0;
+
+        return (int) (q - dest);
+}
+
+int dns_label_escape(const char *p, size_t l, char **ret) {
+        _cleanup_free_ char *s = NULL;
+        int r;
+
+        assert(p);
+        assert(ret);
+
+        if (l > DNS_LABEL_MAX)
+                return -EINVAL;
+
+        s = malloc(l * 4 + 1);
+        if (!s)
+                return -ENOMEM;
+
+        r = dns_label_escape_buffer(p, l, s, l * 4 + 1);
+        if (r < 0)
+                return r;
+
         *ret = s;
-        r = q - s;
         s = NULL;
 
         return r;
@@ -380,18 +400,25 @@ int dns_name_concat(const char *a, const char *b, char **_ret) {
 }
 
 unsigned long dns_name_hash_func(const void *s, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        uint8_t buffer[DNS_NAME_MAX];
         const char *p = s;
         unsigned long ul = hash_key[0];
+        size_t n = 0;
+        uint64_t u;
         int r;
 
         assert(p);
 
+        /* Hash the canonical wire format, i.e. the length-prefixed
+         * lower-case labels, in one go rather than label by
+         * label. Overly long names are hashed piecewise. */
+
         while (*p) {
                 char label[DNS_LABEL_MAX+1];
                 int k;
 
                 r = dns_label_unescape(&p, label, sizeof(label));
-                if (r < 0)
+                if (r <= 0)
                         break;
 
                 k = dns_label_undo_idna(label, r, label, sizeof(label));
@@ -400,12 +427,23 @@ unsigned long dns_name_hash_func(const void *s, const uint8_t hash_key[HASH_KEY_
                 if (k > 0)
                         r = k;
 
+                if (n + 1 + r > sizeof(buffer)) {
+                        siphash24((uint8_t*) &u, buffer, n, hash_key);
+                        ul = ul * hash_key[1] + ul + (unsigned long) u;
+                        n = 0;
+                }
+
                 label[r] = 0;
                 ascii_strlower(label);
 
-                ul = ul * hash_key[1] + ul + string_hash_func(label, hash_key);
+                buffer[n++] = (uint8_t) r;
+                memcpy(buffer + n, label, r);
+                n += r;
         }
 
+        siphash24((uint8_t*) &u, buffer, n, hash_key);
+        ul = ul * hash_key[1] + ul + (unsigned long) u;
+
         return ul;
 }
 
@@ -451,12 +489,67 @@ const struct hash_ops dns_name_hash_ops = {
         .compare = dns_name_compare_func
 };
 
+static bool dns_name_is_plain(const char *s, size_t *ret_len) {
+        const char *label = s, *p;
+
+        assert(s);
+        assert(ret_len);
+
+        /* Checks whether the name consists of nothing but letters,
+         * digits, dashes and underscores, in labels that are neither
+         * empty nor IDNA encoded. Such names need no unescaping, and
+         * may be compared byte by byte, ignoring case. Returns the
+         * length without the trailing dot. */
+
+        if (streq(s, ".")) {
+                *ret_len = 0;
+                return true;
+        }
+
+        for (p = s;; p++) {
+
+                if (*p == '.' || *p == 0) {
+                        if (p == label) {
+                                /* Only the root name and a trailing
+                                 * dot may leave an empty label */
+                                if (*p != 0)
+                                        return false;
+
+                                *ret_len = p == s ? 0 : (size_t) (p - s - 1);
+                                return true;
+                        }
+
+                        if (p - label > DNS_LABEL_MAX)
+                                return false;
+
+                        if (p - label >= 4 && strncasecmp(label, "xn--", 4) == 0)
+                                return false;
+
+                        if (*p == 0) {
+                                *ret_len = p - s;
+                                return true;
+                        }
+
+                        label = p + 1;
+
+                } else if (!(*p == '-' || *p == '_' ||
+                             (*p >= '0' && *p <= '9') ||
+                             (*p >= 'a' && *p <= 'z') ||
+                             (*p >= 'A' && *p <= 'Z')))
+                        return false;
+        }
+}
+
 int dns_name_equal(const char *x, const char *y) {
+        size_t lx, ly;
         int r, q, k, w;
 
         assert(x);
         assert(y);
 
+        if (dns_name_is_plain(x, &lx) && dns_name_is_plain(y, &ly))
+                return lx == ly && strncasecmp(x, y, lx) == 0;
+
         for (;;) {
                 char la[DNS_LABEL_MAX+1], lb[DNS_LABEL_MAX+1];
 
@@ -490,11 +583,23 @@ int dns_name_equal(const char *x, const char *y) {
 
 int dns_name_endswith(const char *name, const char *suffix) {
         const char *n, *s, *saved_n = NULL;
+        size_t ln, ls;
         int r, q, k, w;
 
         assert(name);
         assert(suffix);
 
+        if (dns_name_is_plain(name, &ln) && dns_name_is_plain(suffix, &ls)) {
+                if (ls == 0)
+                        return true;
+                if (ls > ln)
+                        return false;
+                if (ls < ln && name[ln - ls - 1] != '.')
+                        return false;
+
+                return strncasecmp(name + ln - ls, suffix, ls) == 0;
+        }
+
         n = name;
         s = suffix;
 
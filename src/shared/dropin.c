@@ -104,6 +104,7 @@ int write_drop_in_format(const char *dir, const char *unit, unsigned level,
 }
 
 static int iterate_dir(
+                DirCache *dir_cache,
                 const char *path,
                 UnitDependency dependency,
                 dependency_consumer_t consumer,
@@ -127,6 +128,42 @@ static int iterate_dir(
 
         assert(consumer);
 
+        if (dir_cache) {
+                _cleanup_strv_free_ char **names = NULL;
+                const DirCacheEntry *entries;
+                size_t n, i;
+                char **name;
+
+                r = dir_cache_get(dir_cache, path, &entries, &n);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to open directory %s: %m", path);
+
+                /* The consumer may load further units, which look
+                 * into the cache again, hence work on a copy */
+                for (i = 0; i < n; i++) {
+                        if (hidden_file(entries[i].name))
+                                continue;
+
+                        r = strv_extend(&names, entries[i].name);
+                        if (r < 0)
+                                return log_oom();
+                }
+
+                STRV_FOREACH(name, names) {
+                        _cleanup_free_ char *f = NULL;
+
+                        f = strjoin(path, "/", *name, NULL);
+                        if (!f)
+                                return log_oom();
+
+                        r = consumer(dependency, *name, f, arg);
+                        if (r < 0)
+                                return r;
+                }
+
+                return 0;
+        }
+
         d = opendir(path);
         if (!d) {
                 if (errno == ENOENT)
@@ -165,6 +202,7 @@ static int iterate_dir(
 
 int unit_file_process_dir(
                 Set *unit_path_cache,
+                DirCache *dir_cache,
                 const char *unit_path,
                 const char *name,
                 const char *suffix,
@@ -185,7 +223,7 @@ int unit_file_process_dir(
                 return log_oom();
 
         if (!unit_path_cache || set_get(unit_path_cache, path))
-                (void) iterate_dir(path, dependency, consumer, arg, strv);
+                (void) iterate_dir(dir_cache, path, dependency, consumer, arg, strv);
 
         if (unit_name_is_valid(name, UNIT_NAME_INSTANCE)) {
                 _cleanup_free_ char *template = NULL, *p = NULL;
@@ -200,7 +238,7 @@ int unit_file_process_dir(
                         return log_oom();
 
                 if (!unit_path_cache || set_get(unit_path_cache, p))
-                        (void) iterate_dir(p, dependency, consumer, arg, strv);
+                        (void) iterate_dir(dir_cache, p, dependency, consumer, arg, strv);
         }
 
         return 0;
@@ -209,6 +247,7 @@ int unit_file_process_dir(
 int unit_file_find_dropin_paths(
                 char **lookup_path,
                 Set *unit_path_cache,
+                DirCache *dir_cache,
                 Set *names,
                 char ***paths) {
 
@@ -223,13 +262,13 @@ int unit_file_find_dropin_paths(
                 char **p;
 
                 STRV_FOREACH(p, lookup_path)
-                        unit_file_process_dir(unit_path_cache, *p, t, ".d", _UNIT_DEPENDENCY_INVALID, NULL, NULL, &strv);
+                        unit_file_process_dir(unit_path_cache, dir_cache, *p, t, ".d", _UNIT_DEPENDENCY_INVALID, NULL, NULL, &strv);
         }
 
         if (strv_isempty(strv))
                 return 0;
 
-        r = conf_files_list_strv(&ans, ".conf", NULL, (const char**) strv);
+        r = conf_files_list_strv_cached(&ans, ".conf", NULL, (const char**) strv, dir_cache);
         if (r < 0)
                 return log_warning_errno(r, "Failed to get list of configuration files: %m");
 
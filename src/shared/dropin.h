@@ -23,6 +23,7 @@
 
 #include "macro.h"
 #include "set.h"
+#include "dir-cache.h"
 #include "unit-name.h"
 
 int drop_in_file(const char *dir, const char *unit, unsigned level,
@@ -46,7 +47,8 @@ typedef int (*dependency_consumer_t)(UnitDependency dependency,
                                      void *arg);
 
 int unit_file_process_dir(
-                Set * unit_path_cache,
+                Set *unit_path_cache,
+                DirCache *dir_cache,
                 const char *unit_path,
                 const char *name,
                 const char *suffix,
@@ -58,5 +60,6 @@ int unit_file_process_dir(
 int unit_file_find_dropin_paths(
                 char **lookup_path,
                 Set *unit_path_cache,
+                DirCache *dir_cache,
                 Set *names,
                 char ***paths);
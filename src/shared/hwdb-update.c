@@ -0,0 +1,915 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2012 Kay Sievers <kay@vrfy.org>
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "strbuf.h"
+#include "conf-files.h"
+#include "strv.h"
+#include "mkdir.h"
+#include "mempool.h"
+#include "prioq.h"
+
+#include "hwdb-internal.h"
+#include "hwdb-update.h"
+
+/*
+ * Generic udev properties, key/value database based on modalias strings.
+ * Uses a Patricia/radix trie to index all matches for efficient lookup.
+ *
+ * The files are parsed in parallel, each into a run of match/key/value
+ * entries sorted by match. The runs are then merged into the trie,
+ * which sees every match only once, in order.
+ */
+
+#define IMPORT_THREADS_MAX 16U
+
+static const char * const conf_file_dirs[] = {
+        "/etc/udev/hwdb.d",
+        UDEVLIBEXECDIR "/hwdb.d",
+        NULL
+};
+
+/* in-memory trie objects */
+struct trie {
+        struct trie_node *root;
+        struct strbuf *strings;
+
+        /* all nodes, freed at once with the trie */
+        struct mempool node_pool;
+
+        size_t nodes_count;
+        size_t children_count;
+        size_t values_count;
+};
+
+struct trie_node {
+        /* prefix, common part for all children of this node */
+        size_t prefix_off;
+
+        /* array of pointers to children nodes, sorted when stored */
+        struct trie_child_entry *children;
+        size_t children_allocated;
+        uint8_t children_count;
+
+        /* array of key/value pairs, sorted when stored */
+        struct trie_value_entry *values;
+        size_t values_allocated;
+        size_t values_count;
+};
+
+/* children array item with char (0-255) index */
+struct trie_child_entry {
+        uint8_t c;
+        struct trie_node *child;
+};
+
+/* value array item with key/value pairs */
+struct trie_value_entry {
+        size_t key_off;
+        size_t value_off;
+};
+
+/* one property for one match, pointing into the file contents */
+struct hwdb_entry {
+        const char *match;
+        const char *key;
+        const char *value;
+        size_t seq;
+};
+
+/* a parsed file */
+struct hwdb_import {
+        const char *filename;
+        unsigned index;
+
+        char *contents;
+
+        struct hwdb_entry *entries;
+        size_t n_entries;
+        size_t n_allocated;
+
+        /* the next entry to merge */
+        size_t pos;
+
+        int r;
+};
+
+struct hwdb_import_work {
+        struct hwdb_import *imports;
+        unsigned n_imports;
+        unsigned next;
+};
+
+static int trie_children_cmp(const void *v1, const void *v2) {
+        const struct trie_child_entry *n1 = v1;
+        const struct trie_child_entry *n2 = v2;
+
+        return n1->c - n2->c;
+}
+
+static struct trie_node *trie_node_new(struct trie *trie) {
+        return mempool_alloc0_tile(&trie->node_pool);
+}
+
+static int node_add_child(struct trie *trie, struct trie_node *node, struct trie_node *node_child, uint8_t c) {
+
+        /* extend array, add new entry; the array is only sorted when
+         * the trie is written out */
+        if (!GREEDY_REALLOC(node->children, node->children_allocated, node->children_count + 1))
+                return -ENOMEM;
+
+        trie->children_count++;
+        node->children[node->children_count].c = c;
+        node->children[node->children_count].child = node_child;
+        node->children_count++;
+        trie->nodes_count++;
+
+        return 0;
+}
+
+static struct trie_node *node_lookup(const struct trie_node *node, uint8_t c) {
+        size_t i;
+
+        /* Most nodes have few children, scanning them is as fast as
+         * a bisection would be */
+        for (i = 0; i < node->children_count; i++)
+                if (node->children[i].c == c)
+                        return node->children[i].child;
+
+        return NULL;
+}
+
+static void trie_node_cleanup(struct trie_node *node) {
+        size_t i;
+
+        for (i = 0; i < node->children_count; i++)
+                trie_node_cleanup(node->children[i].child);
+        free(node->children);
+        free(node->values);
+}
+
+static void trie_free(struct trie *trie) {
+        if (!trie)
+                return;
+
+        if (trie->root)
+                trie_node_cleanup(trie->root);
+
+        mempool_drop(&trie->node_pool);
+        strbuf_cleanup(trie->strings);
+        free(trie);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(struct trie*, trie_free);
+
+static int trie_values_cmp(const void *v1, const void *v2, void *arg) {
+        const struct trie_value_entry *val1 = v1;
+        const struct trie_value_entry *val2 = v2;
+        struct trie *trie = arg;
+
+        return strcmp(trie->strings->buf + val1->key_off,
+                      trie->strings->buf + val2->key_off);
+}
+
+static int trie_node_add_value(struct trie *trie, struct trie_node *node,
+                          const char *key, const char *value) {
+        ssize_t k, v;
+        size_t i;
+
+        v = strbuf_add_string(trie->strings, value, strlen(value));
+        if (v < 0)
+                return v;
+
+        for (i = 0; i < node->values_count; i++)
+                if (streq(trie->strings->buf + node->values[i].key_off, key)) {
+                        /* replace existing earlier key with new value */
+                        node->values[i].value_off = v;
+                        return 0;
+                }
+
+        k = strbuf_add_string(trie->strings, key, strlen(key));
+        if (k < 0)
+                return k;
+
+        /* extend array, add new entry */
+        if (!GREEDY_REALLOC(node->values, node->values_allocated, node->values_count + 1))
+                return -ENOMEM;
+
+        trie->values_count++;
+        node->values[node->values_count].key_off = k;
+        node->values[node->values_count].value_off = v;
+        node->values_count++;
+        return 0;
+}
+
+/* Cuts the prefix of node after p characters, the rest goes to a new
+ * child, together with the values and children */
+static int trie_node_split(struct trie *trie, struct trie_node *node, size_t p) {
+        _cleanup_free_ char *s = NULL;
+        struct trie_child_entry *children;
+        struct trie_node *new_child;
+        ssize_t off;
+        uint8_t c;
+
+        c = trie->strings->buf[node->prefix_off + p];
+
+        /* update parent; use strdup() because the source gets realloc()d */
+        s = strndup(trie->strings->buf + node->prefix_off, p);
+        if (!s)
+                return -ENOMEM;
+
+        off = strbuf_add_string(trie->strings, s, p);
+        if (off < 0)
+                return off;
+
+        children = new(struct trie_child_entry, 1);
+        if (!children)
+                return -ENOMEM;
+
+        new_child = trie_node_new(trie);
+        if (!new_child) {
+                free(children);
+                return -ENOMEM;
+        }
+
+        /* move values from parent to child */
+        *new_child = *node;
+        new_child->prefix_off = node->prefix_off + p+1;
+
+        children[0].c = c;
+        children[0].child = new_child;
+
+        *node = (struct trie_node) {
+                .prefix_off = off,
+                .children = children,
+                .children_allocated = 1,
+                .children_count = 1,
+        };
+
+        trie->children_count++;
+        trie->nodes_count++;
+
+        return 0;
+}
+
+/* Finds the node for search, creating it if needed */
+static int trie_insert(struct trie *trie, const char *search, struct trie_node **ret) {
+        struct trie_node *node = trie->root;
+        size_t i = 0;
+        int err = 0;
+
+        for (;;) {
+                size_t p;
+                uint8_t c;
+                struct trie_node *child;
+
+                for (p = 0; (c = trie->strings->buf[node->prefix_off + p]); p++) {
+                        if (c == search[i + p])
+                                continue;
+
+                        err = trie_node_split(trie, node, p);
+                        if (err < 0)
+                                return err;
+
+                        break;
+                }
+                i += p;
+
+                c = search[i];
+                if (c == '\0') {
+                        *ret = node;
+                        return 0;
+                }
+
+                child = node_lookup(node, c);
+                if (!child) {
+                        ssize_t off;
+
+                        /* new child */
+                        child = trie_node_new(trie);
+                        if (!child)
+                                return -ENOMEM;
+
+                        off = strbuf_add_string(trie->strings, search + i+1, strlen(search + i+1));
+                        if (off < 0) {
+                                mempool_free_tile(&trie->node_pool, child);
+                                return off;
+                        }
+
+                        child->prefix_off = off;
+                        err = node_add_child(trie, node, child, c);
+                        if (err < 0) {
+                                mempool_free_tile(&trie->node_pool, child);
+                                return err;
+                        }
+
+                        *ret = child;
+                        return 0;
+                }
+
+                node = child;
+                i++;
+        }
+}
+
+struct trie_f {
+        FILE *f;
+        struct trie *trie;
+        uint64_t strings_off;
+
+        uint64_t nodes_count;
+        uint64_t children_count;
+        uint64_t values_count;
+};
+
+/* calculate the storage space for the nodes, children arrays, value arrays */
+static void trie_store_nodes_size(struct trie_f *trie, struct trie_node *node) {
+        uint64_t i;
+
+        for (i = 0; i < node->children_count; i++)
+                trie_store_nodes_size(trie, node->children[i].child);
+
+        trie->strings_off += sizeof(struct trie_node_f);
+        for (i = 0; i < node->children_count; i++)
+                trie->strings_off += sizeof(struct trie_child_entry_f);
+        for (i = 0; i < node->values_count; i++)
+                trie->strings_off += sizeof(struct trie_value_entry_f);
+}
+
+static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
+        uint64_t i;
+        struct trie_node_f n = {
+                .prefix_off = htole64(trie->strings_off + node->prefix_off),
+                .children_count = node->children_count,
+                .values_count = htole64(node->values_count),
+        };
+        struct trie_child_entry_f *children = NULL;
+        int64_t node_off;
+
+        /* sort for bisection by the readers */
+        qsort_safe(node->children, node->children_count, sizeof(struct trie_child_entry), trie_children_cmp);
+        if (node->values_count > 1)
+                qsort_r(node->values, node->values_count, sizeof(struct trie_value_entry), trie_values_cmp, trie->trie);
+
+        if (node->children_count) {
+                children = new0(struct trie_child_entry_f, node->children_count);
+                if (!children)
+                        return -ENOMEM;
+        }
+
+        /* post-order recursion */
+        for (i = 0; i < node->children_count; i++) {
+                int64_t child_off;
+
+                child_off = trie_store_nodes(trie, node->children[i].child);
+                if (child_off < 0) {
+                        free(children);
+                        return child_off;
+                }
+                children[i].c = node->children[i].c;
+                children[i].child_off = htole64(child_off);
+        }
+
+        /* write node */
+        node_off = ftello(trie->f);
+        fwrite(&n, sizeof(struct trie_node_f), 1, trie->f);
+        trie->nodes_count++;
+
+        /* append children array */
+        if (node->children_count) {
+                fwrite(children, sizeof(struct trie_child_entry_f), node->children_count, trie->f);
+                trie->children_count += node->children_count;
+                free(children);
+        }
+
+        /* append values array */
+        for (i = 0; i < node->values_count; i++) {
+                struct trie_value_entry_f v = {
+                        .key_off = htole64(trie->strings_off + node->values[i].key_off),
+                        .value_off = htole64(trie->strings_off + node->values[i].value_off),
+                };
+
+                fwrite(&v, sizeof(struct trie_value_entry_f), 1, trie->f);
+                trie->values_count++;
+        }
+
+        return node_off;
+}
+
+static int trie_store(struct trie *trie, const char *filename) {
+        struct trie_f t = {
+                .trie = trie,
+        };
+        _cleanup_free_ char *filename_tmp = NULL;
+        int64_t pos;
+        int64_t root_off;
+        int64_t size;
+        struct trie_header_f h = {
+                .signature = HWDB_SIG,
+                .tool_version = htole64(atoi(VERSION)),
+                .header_size = htole64(sizeof(struct trie_header_f)),
+                .node_size = htole64(sizeof(struct trie_node_f)),
+                .child_entry_size = htole64(sizeof(struct trie_child_entry_f)),
+                .value_entry_size = htole64(sizeof(struct trie_value_entry_f)),
+        };
+        int err;
+
+        /* calculate size of header, nodes, children entries, value entries */
+        t.strings_off = sizeof(struct trie_header_f);
+        trie_store_nodes_size(&t, trie->root);
+
+        err = fopen_temporary(filename , &t.f, &filename_tmp);
+        if (err < 0)
+                return err;
+        fchmod(fileno(t.f), 0444);
+
+        /* write nodes */
+        err = fseeko(t.f, sizeof(struct trie_header_f), SEEK_SET);
+        if (err < 0) {
+                fclose(t.f);
+                unlink_noerrno(filename_tmp);
+                return -errno;
+        }
+        root_off = trie_store_nodes(&t, trie->root);
+        if (root_off < 0) {
+                fclose(t.f);
+                unlink_noerrno(filename_tmp);
+                return root_off;
+        }
+        h.nodes_root_off = htole64(root_off);
+        pos = ftello(t.f);
+        h.nodes_len = htole64(pos - sizeof(struct trie_header_f));
+
+        /* write string buffer */
+        fwrite(trie->strings->buf, trie->strings->len, 1, t.f);
+        h.strings_len = htole64(trie->strings->len);
+
+        /* write header */
+        size = ftello(t.f);
+        h.file_size = htole64(size);
+        err = fseeko(t.f, 0, SEEK_SET);
+        if (err < 0) {
+                fclose(t.f);
+                unlink_noerrno(filename_tmp);
+                return -errno;
+        }
+        fwrite(&h, sizeof(struct trie_header_f), 1, t.f);
+        err = ferror(t.f);
+        if (err)
+                err = -errno;
+        fclose(t.f);
+        if (err < 0 || rename(filename_tmp, filename) < 0) {
+                unlink_noerrno(filename_tmp);
+                return err < 0 ? err : -errno;
+        }
+
+        log_debug("=== trie on-disk ===");
+        log_debug("size:             %8"PRIi64" bytes", size);
+        log_debug("header:           %8zu bytes", sizeof(struct trie_header_f));
+        log_debug("nodes:            %8"PRIu64" bytes (%8"PRIu64")",
+                  t.nodes_count * sizeof(struct trie_node_f), t.nodes_count);
+        log_debug("child pointers:   %8"PRIu64" bytes (%8"PRIu64")",
+                  t.children_count * sizeof(struct trie_child_entry_f), t.children_count);
+        log_debug("value pointers:   %8"PRIu64" bytes (%8"PRIu64")",
+                  t.values_count * sizeof(struct trie_value_entry_f), t.values_count);
+        log_debug("string store:     %8zu bytes", trie->strings->len);
+        log_debug("strings start:    %8"PRIu64, t.strings_off);
+
+        return 0;
+}
+
+static int insert_data(struct hwdb_import *im, char **match_list, size_t n_matches, char *line) {
+        char *value;
+        size_t i;
+
+        value = strchr(line, '=');
+        if (!value) {
+                log_error("Error, key/value pair expected but got '%s' in '%s':", line, im->filename);
+                return -EINVAL;
+        }
+
+        value[0] = '\0';
+        value++;
+
+        /* libudev requires properties to start with a space */
+        while (isblank(line[0]) && isblank(line[1]))
+                line++;
+
+        if (line[0] == '\0' || value[0] == '\0') {
+                log_error("Error, empty key or value '%s' in '%s':", line, im->filename);
+                return -EINVAL;
+        }
+
+        if (!GREEDY_REALLOC(im->entries, im->n_allocated, im->n_entries + n_matches))
+                return -ENOMEM;
+
+        for (i = 0; i < n_matches; i++) {
+                im->entries[im->n_entries] = (struct hwdb_entry) {
+                        .match = match_list[i],
+                        .key = line,
+                        .value = value,
+                        .seq = im->n_entries,
+                };
+                im->n_entries++;
+        }
+
+        return 0;
+}
+
+static int hwdb_entry_cmp(const void *v1, const void *v2) {
+        const struct hwdb_entry *e1 = v1, *e2 = v2;
+        int r;
+
+        /* The same match and key may appear more than once, and the
+         * last one has to win, hence the stable order */
+        r = strcmp(e1->match, e2->match);
+        if (r != 0)
+                return r;
+
+        return e1->seq < e2->seq ? -1 : e1->seq > e2->seq ? 1 : 0;
+}
+
+static int read_file(const char *filename, char **ret) {
+        _cleanup_close_ int fd = -1;
+        _cleanup_free_ char *buf = NULL;
+        struct stat st;
+        ssize_t n;
+
+        /* Not read_full_file(), the biggest of the files are well
+         * beyond its limit */
+
+        fd = open(filename, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        buf = malloc(st.st_size + 1);
+        if (!buf)
+                return -ENOMEM;
+
+        n = loop_read(fd, buf, st.st_size, true);
+        if (n < 0)
+                return (int) n;
+
+        buf[n] = '\0';
+
+        *ret = buf;
+        buf = NULL;
+
+        return 0;
+}
+
+static int import_file(struct hwdb_import *im) {
+        enum {
+                HW_NONE,
+                HW_MATCH,
+                HW_DATA,
+        } state = HW_NONE;
+        _cleanup_free_ char **match_list = NULL;
+        size_t n_matches = 0, n_matches_allocated = 0;
+        char *line, *next;
+        int r;
+
+        /* The lines are cut up in place, and the entries point into
+         * the contents, which stay around until the trie is built */
+        r = read_file(im->filename, &im->contents);
+        if (r < 0)
+                return r;
+
+        for (line = im->contents; line; line = next) {
+                size_t len;
+                char *pos;
+
+                next = strchr(line, '\n');
+                if (next)
+                        *(next++) = '\0';
+
+                /* comment line */
+                if (line[0] == '#')
+                        continue;
+
+                /* strip trailing comment */
+                pos = strchr(line, '#');
+                if (pos)
+                        pos[0] = '\0';
+
+                /* strip trailing whitespace */
+                len = strlen(line);
+                while (len > 0 && isspace(line[len-1]))
+                        len--;
+                line[len] = '\0';
+
+                switch (state) {
+                case HW_NONE:
+                        if (len == 0)
+                                break;
+
+                        if (line[0] == ' ') {
+                                log_error("Error, MATCH expected but got '%s' in '%s':", line, im->filename);
+                                break;
+                        }
+
+                        /* start of record, first match */
+                        state = HW_MATCH;
+
+                        if (!GREEDY_REALLOC(match_list, n_matches_allocated, n_matches + 1))
+                                return -ENOMEM;
+
+                        match_list[n_matches++] = line;
+                        break;
+
+                case HW_MATCH:
+                        if (len == 0) {
+                                log_error("Error, DATA expected but got empty line in '%s':", im->filename);
+                                state = HW_NONE;
+                                n_matches = 0;
+                                break;
+                        }
+
+                        /* another match */
+                        if (line[0] != ' ') {
+                                if (!GREEDY_REALLOC(match_list, n_matches_allocated, n_matches + 1))
+                                        return -ENOMEM;
+
+                                match_list[n_matches++] = line;
+                                break;
+                        }
+
+                        /* first data */
+                        state = HW_DATA;
+                        r = insert_data(im, match_list, n_matches, line);
+                        if (r == -ENOMEM)
+                                return r;
+                        break;
+
+                case HW_DATA:
+                        /* end of record */
+                        if (len == 0) {
+                                state = HW_NONE;
+                                n_matches = 0;
+                                break;
+                        }
+
+                        if (line[0] != ' ') {
+                                log_error("Error, DATA expected but got '%s' in '%s':", line, im->filename);
+                                state = HW_NONE;
+                                n_matches = 0;
+                                break;
+                        }
+
+                        r = insert_data(im, match_list, n_matches, line);
+                        if (r == -ENOMEM)
+                                return r;
+                        break;
+                };
+        }
+
+        qsort_safe(im->entries, im->n_entries, sizeof(struct hwdb_entry), hwdb_entry_cmp);
+
+        return 0;
+}
+
+static void import_work(struct hwdb_import_work *w) {
+        unsigned i;
+
+        while ((i = __sync_fetch_and_add(&w->next, 1)) < w->n_imports) {
+                struct hwdb_import *im = w->imports + i;
+
+                log_debug("reading file '%s'", im->filename);
+                im->r = import_file(im);
+        }
+}
+
+static void *import_thread(void *userdata) {
+        import_work(userdata);
+        return NULL;
+}
+
+static void import_files(struct hwdb_import *imports, unsigned n_imports) {
+        struct hwdb_import_work w = {
+                .imports = imports,
+                .n_imports = n_imports,
+        };
+        pthread_t threads[IMPORT_THREADS_MAX];
+        unsigned n_threads = 0, i;
+        long n_cpus;
+
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_cpus > 1 && n_imports > 1)
+                n_threads = MIN3((unsigned) n_cpus - 1, n_imports - 1, IMPORT_THREADS_MAX);
+
+        /* If we cannot start a thread, we just do its share
+         * ourselves */
+        for (i = 0; i < n_threads; i++)
+                if (pthread_create(threads + i, NULL, import_thread, &w) != 0)
+                        break;
+        n_threads = i;
+
+        import_work(&w);
+
+        for (i = 0; i < n_threads; i++)
+                (void) pthread_join(threads[i], NULL);
+}
+
+static int import_cmp(const void *a, const void *b) {
+        const struct hwdb_import *x = a, *y = b;
+        int r;
+
+        /* Of equal matches those of later files go in later, so that
+         * they override the earlier ones */
+        r = strcmp(x->entries[x->pos].match, y->entries[y->pos].match);
+        if (r != 0)
+                return r;
+
+        return x->index < y->index ? -1 : x->index > y->index ? 1 : 0;
+}
+
+static int trie_merge(struct trie *trie, struct hwdb_import *imports, unsigned n_imports) {
+        struct trie_node *node = NULL;
+        const char *match = NULL;
+        struct hwdb_import *im;
+        unsigned i;
+        Prioq *q;
+        int r = 0;
+
+        q = prioq_new(import_cmp);
+        if (!q)
+                return -ENOMEM;
+
+        for (i = 0; i < n_imports; i++) {
+                if (imports[i].n_entries == 0)
+                        continue;
+
+                r = prioq_put(q, imports + i, NULL);
+                if (r < 0)
+                        goto finish;
+        }
+
+        while ((im = prioq_peek(q))) {
+                const struct hwdb_entry *e = im->entries + im->pos;
+
+                /* All properties of a match come in a row, it is
+                 * looked up only for the first one */
+                if (!match || !streq(match, e->match)) {
+                        r = trie_insert(trie, e->match, &node);
+                        if (r < 0)
+                                goto finish;
+
+                        match = e->match;
+                }
+
+                r = trie_node_add_value(trie, node, e->key, e->value);
+                if (r < 0)
+                        goto finish;
+
+                /* Still the smallest, or else it moves down */
+                im->pos++;
+                if (im->pos < im->n_entries) {
+                        r = prioq_reshuffle(q, im, NULL);
+                        if (r < 0)
+                                goto finish;
+
+                        continue;
+                }
+
+                /* Everything of the file made it into the trie, its
+                 * contents are not needed anymore */
+                assert_se(prioq_pop(q) == im);
+
+                im->contents = mfree(im->contents);
+                im->entries = mfree(im->entries);
+                im->n_entries = im->n_allocated = 0;
+                match = NULL;
+        }
+
+finish:
+        prioq_free(q);
+        return r;
+}
+
+static void hwdb_imports_free(struct hwdb_import *imports, unsigned n_imports) {
+        unsigned i;
+
+        for (i = 0; i < n_imports; i++) {
+                free(imports[i].contents);
+                free(imports[i].entries);
+        }
+
+        free(imports);
+}
+
+int hwdb_update(const char *root, const char *hwdb_bin_dir) {
+        _cleanup_free_ char *hwdb_bin = NULL;
+        _cleanup_(trie_freep) struct trie *trie = NULL;
+        _cleanup_strv_free_ char **files = NULL;
+        struct hwdb_import *imports;
+        unsigned n_imports, i;
+        int r;
+
+        assert(root);
+        assert(hwdb_bin_dir);
+
+        trie = new0(struct trie, 1);
+        if (!trie)
+                return log_oom();
+
+        trie->node_pool.tile_size = sizeof(struct trie_node);
+        trie->node_pool.at_least = 1024;
+
+        /* string store */
+        trie->strings = strbuf_new();
+        if (!trie->strings)
+                return log_oom();
+
+        /* index */
+        trie->root = trie_node_new(trie);
+        if (!trie->root)
+                return log_oom();
+
+        trie->nodes_count++;
+
+        r = conf_files_list_strv(&files, ".hwdb", root, conf_file_dirs);
+        if (r < 0)
+                return log_error_errno(r, "failed to enumerate hwdb files: %m");
+
+        n_imports = strv_length(files);
+        imports = new0(struct hwdb_import, MAX(n_imports, 1U));
+        if (!imports)
+                return log_oom();
+
+        for (i = 0; i < n_imports; i++) {
+                imports[i].filename = files[i];
+                imports[i].index = i;
+        }
+
+        import_files(imports, n_imports);
+
+        for (i = 0; i < n_imports; i++) {
+                if (imports[i].r == -ENOMEM) {
+                        hwdb_imports_free(imports, n_imports);
+                        return log_oom();
+                }
+
+                if (imports[i].r < 0)
+                        log_warning_errno(imports[i].r, "Failed to read %s, ignoring: %m", imports[i].filename);
+        }
+
+        r = trie_merge(trie, imports, n_imports);
+        hwdb_imports_free(imports, n_imports);
+        if (r < 0)
+                return log_error_errno(r, "Failed to build hwdb index: %m");
+
+        strbuf_complete(trie->strings);
+
+        log_debug("=== trie in-memory ===");
+        log_debug("nodes:            %8zu bytes (%8zu)",
+                  trie->nodes_count * sizeof(struct trie_node), trie->nodes_count);
+        log_debug("children arrays:  %8zu bytes (%8zu)",
+                  trie->children_count * sizeof(struct trie_child_entry), trie->children_count);
+        log_debug("values arrays:    %8zu bytes (%8zu)",
+                  trie->values_count * sizeof(struct trie_value_entry), trie->values_count);
+        log_debug("strings:          %8zu bytes",
+                  trie->strings->len);
+        log_debug("strings incoming: %8zu bytes (%8zu)",
+                  trie->strings->in_len, trie->strings->in_count);
+        log_debug("strings dedup'ed: %8zu bytes (%8zu)",
+                  trie->strings->dedup_len, trie->strings->dedup_count);
+
+        hwdb_bin = strjoin(root, "/", hwdb_bin_dir, "/hwdb.bin", NULL);
+        if (!hwdb_bin)
+                return log_oom();
+
+        mkdir_parents(hwdb_bin, 0755);
+        r = trie_store(trie, hwdb_bin);
+        if (r < 0)
+                return log_error_errno(r, "Failure writing database %s: %m", hwdb_bin);
+
+        return 0;
+}
@@ -440,9 +440,207 @@ static int find_symlinks_fd(
         }
 }
 
+/* The result of find_symlinks() for every unit name at once, for
+ * callers that query a lot of units */
+typedef struct SymlinkIndex {
+        char *config_path;
+
+        /* unit name → SYMLINK_FOUND|SYMLINK_SAME_NAME */
+        Hashmap *names;
+
+        /* The first error hit while walking the tree */
+        int error;
+} SymlinkIndex;
+
+enum {
+        SYMLINK_FOUND = 1,
+        SYMLINK_SAME_NAME = 2,
+};
+
+static SymlinkIndex *symlink_index_free(SymlinkIndex *idx) {
+        char *k;
+
+        if (!idx)
+                return NULL;
+
+        while ((k = hashmap_steal_first_key(idx->names)))
+                free(k);
+
+        hashmap_free(idx->names);
+        free(idx->config_path);
+        free(idx);
+
+        return NULL;
+}
+
+static void symlink_index_cache_free(Hashmap *cache) {
+        SymlinkIndex *idx;
+
+        while ((idx = hashmap_steal_first(cache)))
+                symlink_index_free(idx);
+
+        hashmap_free(cache);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(Hashmap*, symlink_index_cache_free);
+
+static int symlink_index_add(SymlinkIndex *idx, const char *name, int flag) {
+        char *k;
+        int v, r;
+
+        v = PTR_TO_INT(hashmap_get(idx->names, name));
+        if (v != 0)
+                return hashmap_update(idx->names, name, INT_TO_PTR(v | flag));
+
+        k = strdup(name);
+        if (!k)
+                return -ENOMEM;
+
+        r = hashmap_put(idx->names, k, INT_TO_PTR(flag));
+        if (r < 0)
+                free(k);
+
+        return r;
+}
+
+static int symlink_index_add_fd(SymlinkIndex *idx, int fd, const char *path) {
+        _cleanup_closedir_ DIR *d = NULL;
+        int r;
+
+        assert(idx);
+        assert(fd >= 0);
+        assert(path);
+
+        /* This follows find_symlinks_fd(), see there */
+
+        d = fdopendir(fd);
+        if (!d) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        for (;;) {
+                struct dirent *de;
+
+                errno = 0;
+                de = readdir(d);
+                if (!de && errno != 0)
+                        return -errno;
+
+                if (!de)
+                        return 0;
+
+                if (hidden_file(de->d_name))
+                        continue;
+
+                dirent_ensure_type(d, de);
+
+                if (de->d_type == DT_DIR) {
+                        _cleanup_free_ char *p = NULL;
+                        int nfd;
+
+                        nfd = openat(fd, de->d_name, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+                        if (nfd < 0) {
+                                if (errno == ENOENT)
+                                        continue;
+
+                                if (idx->error == 0)
+                                        idx->error = -errno;
+                                continue;
+                        }
+
+                        p = path_make_absolute(de->d_name, path);
+                        if (!p) {
+                                safe_close(nfd);
+                                return -ENOMEM;
+                        }
+
+                        /* This will close nfd, regardless whether it succeeds or not */
+                        r = symlink_index_add_fd(idx, nfd, p);
+                        if (r == -ENOMEM)
+                                return r;
+                        if (r < 0 && idx->error == 0)
+                                idx->error = r;
+
+                } else if (de->d_type == DT_LNK) {
+                        _cleanup_free_ char *p = NULL, *dest = NULL, *t = NULL;
+
+                        p = path_make_absolute(de->d_name, path);
+                        if (!p)
+                                return -ENOMEM;
+
+                        r = readlink_and_canonicalize(p, &dest);
+                        if (r < 0) {
+                                if (r == -ENOENT)
+                                        continue;
+
+                                if (idx->error == 0)
+                                        idx->error = r;
+                                continue;
+                        }
+
+                        if (!streq(de->d_name, basename(dest))) {
+                                r = symlink_index_add(idx, de->d_name, SYMLINK_FOUND);
+                                if (r >= 0)
+                                        r = symlink_index_add(idx, basename(dest), SYMLINK_FOUND);
+                                if (r < 0)
+                                        return r;
+
+                                continue;
+                        }
+
+                        t = path_make_absolute(de->d_name, idx->config_path);
+                        if (!t)
+                                return -ENOMEM;
+
+                        r = symlink_index_add(idx, de->d_name, path_equal(t, p) ? SYMLINK_SAME_NAME : SYMLINK_FOUND);
+                        if (r < 0)
+                                return r;
+                }
+        }
+}
+
+static int symlink_index_new(const char *config_path, SymlinkIndex **ret) {
+        SymlinkIndex *idx;
+        int fd, r;
+
+        assert(config_path);
+        assert(ret);
+
+        idx = new0(SymlinkIndex, 1);
+        if (!idx)
+                return -ENOMEM;
+
+        idx->config_path = strdup(config_path);
+        idx->names = hashmap_new(&string_hash_ops);
+        if (!idx->config_path || !idx->names) {
+                symlink_index_free(idx);
+                return -ENOMEM;
+        }
+
+        fd = open(config_path, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+        if (fd < 0) {
+                if (errno != ENOENT)
+                        idx->error = -errno;
+        } else {
+                /* This takes possession of fd and closes it */
+                r = symlink_index_add_fd(idx, fd, config_path);
+                if (r == -ENOMEM) {
+                        symlink_index_free(idx);
+                        return r;
+                }
+                if (r < 0 && idx->error == 0)
+                        idx->error = r;
+        }
+
+        *ret = idx;
+        return 0;
+}
+
 static int find_symlinks(
                 const char *name,
                 const char *config_path,
+                Hashmap *cache,
                 bool *same_name_link) {
 
         int fd;
@@ -451,6 +649,35 @@ static int find_symlinks(
         assert(config_path);
         assert(same_name_link);
 
+        /* If a cache is passed, the tree is indexed once and looked
+         * up from then on. Absolute paths are rare, and matched by
+         * walking the tree. */
+        if (cache && !path_is_absolute(name)) {
+                SymlinkIndex *idx;
+                int v, r;
+
+                idx = hashmap_get(cache, config_path);
+                if (!idx) {
+                        r = symlink_index_new(config_path, &idx);
+                        if (r < 0)
+                                return r;
+
+                        r = hashmap_put(cache, idx->config_path, idx);
+                        if (r < 0) {
+                                symlink_index_free(idx);
+                                return r;
+                        }
+                }
+
+                v = PTR_TO_INT(hashmap_get(idx->names, name));
+                if (v & SYMLINK_FOUND)
+                        return 1;
+                if (v & SYMLINK_SAME_NAME)
+                        *same_name_link = true;
+
+                return idx->error;
+        }
+
         fd = open(config_path, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
         if (fd < 0) {
                 if (errno == ENOENT)
@@ -466,6 +693,7 @@ static int find_symlinks_in_scope(
                 UnitFileScope scope,
                 const char *root_dir,
                 const char *name,
+                Hashmap *cache,
                 UnitFileState *state) {
 
         int r;
@@ -481,7 +709,7 @@ static int find_symlinks_in_scope(
         if (r < 0)
                 return r;
 
-        r = find_symlinks(name, normal_path, &same_name_link_runtime);
+        r = find_symlinks(name, normal_path, cache, &same_name_link_runtime);
         if (r < 0)
                 return r;
         else if (r > 0) {
@@ -494,7 +722,7 @@ static int find_symlinks_in_scope(
         if (r < 0)
                 return r;
 
-        r = find_symlinks(name, runtime_path, &same_name_link);
+        r = find_symlinks(name, runtime_path, cache, &same_name_link);
         if (r < 0)
                 return r;
         else if (r > 0) {
@@ -1839,7 +2067,7 @@ UnitFileState unit_file_lookup_state(
                         }
                 }
 
-                r = find_symlinks_in_scope(scope, root_dir, name, &state);
+                r = find_symlinks_in_scope(scope, root_dir, name, NULL, &state);
                 if (r < 0)
                         return r;
                 else if (r > 0)
@@ -1882,14 +2110,40 @@ UnitFileState unit_file_get_state(
         return unit_file_lookup_state(scope, root_dir, &paths, name);
 }
 
-int unit_file_query_preset(UnitFileScope scope, const char *root_dir, const char *name) {
+typedef struct PresetRule {
+        char *pattern;
+        bool enable;
+} PresetRule;
+
+typedef struct Presets {
+        PresetRule *rules;
+        size_t n_rules;
+} Presets;
+
+static void presets_free(Presets *p) {
+        size_t i;
+
+        if (!p)
+                return;
+
+        for (i = 0; i < p->n_rules; i++)
+                free(p->rules[i].pattern);
+
+        free(p->rules);
+        p->rules = NULL;
+        p->n_rules = 0;
+}
+
+static int read_presets(UnitFileScope scope, const char *root_dir, Presets *presets) {
+        _cleanup_(presets_free) Presets ps = {};
         _cleanup_strv_free_ char **files = NULL;
+        size_t n_allocated = 0;
         char **p;
         int r;
 
         assert(scope >= 0);
         assert(scope < _UNIT_FILE_SCOPE_MAX);
-        assert(name);
+        assert(presets);
 
         if (scope == UNIT_FILE_SYSTEM)
                 r = conf_files_list(&files, ".preset", root_dir,
@@ -1906,8 +2160,10 @@ int unit_file_query_preset(UnitFileScope scope, const char *root_dir, const char
                                     "/usr/local/lib/systemd/user-preset",
                                     "/usr/lib/systemd/user-preset",
                                     NULL);
-        else
-                return 1;
+        else {
+                *presets = (Presets) {};
+                return 0;
+        }
 
         if (r < 0)
                 return r;
@@ -1925,6 +2181,7 @@ int unit_file_query_preset(UnitFileScope scope, const char *root_dir, const char
 
                 for (;;) {
                         char line[LINE_MAX], *l;
+                        PresetRule rule = {};
 
                         if (!fgets(line, sizeof(line), f))
                                 break;
@@ -1938,32 +2195,67 @@ int unit_file_query_preset(UnitFileScope scope, const char *root_dir, const char
 
                         if (first_word(l, "enable")) {
                                 l += 6;
-                                l += strspn(l, WHITESPACE);
+                                rule.enable = true;
+                        } else if (first_word(l, "disable"))
+                                l += 7;
+                        else {
+                                log_debug("Couldn't parse line '%s'", l);
+                                continue;
+                        }
 
-                                if (fnmatch(l, name, FNM_NOESCAPE) == 0) {
-                                        log_debug("Preset file says enable %s.", name);
-                                        return 1;
-                                }
+                        l += strspn(l, WHITESPACE);
 
-                        } else if (first_word(l, "disable")) {
-                                l += 7;
-                                l += strspn(l, WHITESPACE);
+                        rule.pattern = strdup(l);
+                        if (!rule.pattern)
+                                return -ENOMEM;
 
-                                if (fnmatch(l, name, FNM_NOESCAPE) == 0) {
-                                        log_debug("Preset file says disable %s.", name);
-                                        return 0;
-                                }
+                        if (!GREEDY_REALLOC(ps.rules, n_allocated, ps.n_rules + 1)) {
+                                free(rule.pattern);
+                                return -ENOMEM;
+                        }
 
-                        } else
-                                log_debug("Couldn't parse line '%s'", l);
+                        ps.rules[ps.n_rules++] = rule;
                 }
         }
 
+        *presets = ps;
+        ps = (Presets) {};
+
+        return 0;
+}
+
+static int query_presets(const char *name, const Presets *presets) {
+        size_t i;
+
+        assert(name);
+        assert(presets);
+
+        for (i = 0; i < presets->n_rules; i++)
+                if (fnmatch(presets->rules[i].pattern, name, FNM_NOESCAPE) == 0) {
+                        log_debug("Preset file says %s %s.", presets->rules[i].enable ? "enable" : "disable", name);
+                        return presets->rules[i].enable;
+                }
+
         /* Default is "enable" */
         log_debug("Preset file doesn't say anything about %s, enabling.", name);
         return 1;
 }
 
+int unit_file_query_preset(UnitFileScope scope, const char *root_dir, const char *name) {
+        _cleanup_(presets_free) Presets presets = {};
+        int r;
+
+        assert(scope >= 0);
+        assert(scope < _UNIT_FILE_SCOPE_MAX);
+        assert(name);
+
+        r = read_presets(scope, root_dir, &presets);
+        if (r < 0)
+                return r;
+
+        return query_presets(name, &presets);
+}
+
 int unit_file_preset(
                 UnitFileScope scope,
                 bool runtime,
@@ -1977,6 +2269,7 @@ int unit_file_preset(
         _cleanup_(install_context_done) InstallContext plus = {}, minus = {};
         _cleanup_lookup_paths_free_ LookupPaths paths = {};
         _cleanup_free_ char *config_path = NULL;
+        _cleanup_(presets_free) Presets presets = {};
         char **i;
         int r, q;
 
@@ -1992,12 +2285,16 @@ int unit_file_preset(
         if (r < 0)
                 return r;
 
+        r = read_presets(scope, root_dir, &presets);
+        if (r < 0)
+                return r;
+
         STRV_FOREACH(i, files) {
 
                 if (!unit_name_is_valid(*i, UNIT_NAME_ANY))
                         return -EINVAL;
 
-                r = unit_file_query_preset(scope, root_dir, *i);
+                r = query_presets(*i, &presets);
                 if (r < 0)
                         return r;
 
@@ -2045,6 +2342,7 @@ int unit_file_preset_all(
         _cleanup_(install_context_done) InstallContext plus = {}, minus = {};
         _cleanup_lookup_paths_free_ LookupPaths paths = {};
         _cleanup_free_ char *config_path = NULL;
+        _cleanup_(presets_free) Presets presets = {};
         char **i;
         int r, q;
 
@@ -2060,6 +2358,10 @@ int unit_file_preset_all(
         if (r < 0)
                 return r;
 
+        r = read_presets(scope, root_dir, &presets);
+        if (r < 0)
+                return r;
+
         STRV_FOREACH(i, paths.unit_path) {
                 _cleanup_closedir_ DIR *d = NULL;
                 _cleanup_free_ char *units_dir;
@@ -2098,7 +2400,7 @@ int unit_file_preset_all(
                         if (de->d_type != DT_REG)
                                 continue;
 
-                        r = unit_file_query_preset(scope, root_dir, de->d_name);
+                        r = query_presets(de->d_name, &presets);
                         if (r < 0)
                                 return r;
 
@@ -2149,6 +2451,7 @@ int unit_file_get_list(
                 const char *root_dir,
                 Hashmap *h) {
 
+        _cleanup_(symlink_index_cache_freep) Hashmap *symlinks = NULL;
         _cleanup_lookup_paths_free_ LookupPaths paths = {};
         char **i;
         int r;
@@ -2170,6 +2473,10 @@ int unit_file_get_list(
         if (r < 0)
                 return r;
 
+        symlinks = hashmap_new(&string_hash_ops);
+        if (!symlinks)
+                return -ENOMEM;
+
         STRV_FOREACH(i, paths.unit_path) {
                 _cleanup_closedir_ DIR *d = NULL;
                 _cleanup_free_ char *units_dir;
@@ -2232,7 +2539,7 @@ int unit_file_get_list(
                                 goto found;
                         }
 
-                        r = find_symlinks_in_scope(scope, root_dir, de->d_name, &f->state);
+                        r = find_symlinks_in_scope(scope, root_dir, de->d_name, symlinks, &f->state);
                         if (r < 0)
                                 return r;
                         else if (r > 0) {
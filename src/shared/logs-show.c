@@ -565,6 +565,10 @@ static int output_export(
         return 0;
 }
 
+static inline bool json_needs_escape(char c) {
+        return c == '"' || c == '\\' || (uint8_t) c < ' ';
+}
+
 void json_escape(
                 FILE *f,
                 const char* p,
@@ -599,15 +603,28 @@ void json_escape(
                 fputc('\"', f);
 
                 while (l > 0) {
+                        size_t n;
+
+                        /* Most data needs no escaping at all, hence
+                         * look for the next character that does, and
+                         * write everything up to it in one go. */
+                        for (n = 0; n < l && !json_needs_escape(p[n]); n++)
+                                ;
+
+                        if (n > 0) {
+                                fwrite(p, 1, n, f);
+                                p += n;
+                                l -= n;
+                                continue;
+                        }
+
                         if (*p == '"' || *p == '\\') {
                                 fputc('\\', f);
                                 fputc(*p, f);
                         } else if (*p == '\n')
                                 fputs("\\n", f);
-                        else if ((uint8_t) *p < ' ')
-                                fprintf(f, "\\u%04x", (uint8_t) *p);
                         else
-                                fputc(*p, f);
+                                fprintf(f, "\\u%04x", (uint8_t) *p);
 
                         p++;
                         l--;
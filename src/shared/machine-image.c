@@ -21,6 +21,7 @@
 
 #include <fcntl.h>
 #include <linux/fs.h>
+#include <sys/inotify.h>
 #include <sys/statfs.h>
 
 #include "btrfs-util.h"
@@ -130,11 +131,68 @@ static int image_new(
         return 0;
 }
 
+/* The quota of all subvolumes of the file system a search path
+ * directory is on, so that discovering many images only needs a
+ * single pass over the quota tree */
+typedef struct ImageQuotaTable {
+        sd_id128_t fsid;
+        Hashmap *entries;
+} ImageQuotaTable;
+
+static void image_quota_table_done(ImageQuotaTable *t) {
+        assert(t);
+
+        hashmap_free_free(t->entries);
+        t->entries = NULL;
+}
+
+static void image_quota_table_load(ImageQuotaTable *t, int dfd) {
+        int r;
+
+        assert(t);
+        assert(dfd >= 0);
+
+        /* Failures are not fatal, we simply query each subvolume
+         * individually then */
+
+        r = btrfs_is_filesystem(dfd);
+        if (r <= 0)
+                return;
+
+        if (btrfs_get_fsid_fd(dfd, &t->fsid) < 0)
+                return;
+
+        (void) btrfs_quota_get_all_fd(dfd, &t->entries);
+}
+
+static int image_quota_table_get(ImageQuotaTable *t, int fd, uint64_t subvol_id, BtrfsQuotaInfo *ret) {
+        const BtrfsQuotaEntry *e;
+        sd_id128_t fsid;
+
+        assert(fd >= 0);
+        assert(ret);
+
+        /* Images may be symlinks to or mounts of other file
+         * systems, only use the table for those on the same one */
+        if (!t || !t->entries ||
+            btrfs_get_fsid_fd(fd, &fsid) < 0 ||
+            !sd_id128_equal(fsid, t->fsid))
+                return btrfs_subvol_get_quota_fd(fd, ret);
+
+        e = hashmap_get(t->entries, &subvol_id);
+        if (!e)
+                return -ENODATA;
+
+        *ret = e->quota;
+        return 0;
+}
+
 static int image_make(
                 const char *pretty,
                 int dfd,
                 const char *path,
                 const char *filename,
+                ImageQuotaTable *quota_table,
                 Image **ret) {
 
         struct stat st;
@@ -195,7 +253,7 @@ static int image_make(
                                 if (r < 0)
                                         return r;
 
-                                r = btrfs_subvol_get_quota_fd(fd, &quota);
+                                r = image_quota_table_get(quota_table, fd, info.subvol_id, &quota);
                                 if (r >= 0) {
                                         (*ret)->usage = quota.referenced;
                                         (*ret)->usage_exclusive = quota.exclusive;
@@ -281,7 +339,7 @@ int image_find(const char *name, Image **ret) {
                         return -errno;
                 }
 
-                r = image_make(NULL, dirfd(d), path, name, ret);
+                r = image_make(NULL, dirfd(d), path, name, NULL, ret);
                 if (r == 0 || r == -ENOENT) {
                         _cleanup_free_ char *raw = NULL;
 
@@ -289,7 +347,7 @@ int image_find(const char *name, Image **ret) {
                         if (!raw)
                                 return -ENOMEM;
 
-                        r = image_make(NULL, dirfd(d), path, raw, ret);
+                        r = image_make(NULL, dirfd(d), path, raw, NULL, ret);
                         if (r == 0 || r == -ENOENT)
                                 continue;
                 }
@@ -300,7 +358,7 @@ int image_find(const char *name, Image **ret) {
         }
 
         if (streq(name, ".host"))
-                return image_make(".host", AT_FDCWD, NULL, "/", ret);
+                return image_make(".host", AT_FDCWD, NULL, "/", NULL, ret);
 
         return 0;
 };
@@ -312,6 +370,7 @@ int image_discover(Hashmap *h) {
         assert(h);
 
         NULSTR_FOREACH(path, image_search_path) {
+                _cleanup_(image_quota_table_done) ImageQuotaTable quota_table = {};
                 _cleanup_closedir_ DIR *d = NULL;
                 struct dirent *de;
 
@@ -323,6 +382,8 @@ int image_discover(Hashmap *h) {
                         return -errno;
                 }
 
+                image_quota_table_load(&quota_table, dirfd(d));
+
                 FOREACH_DIRENT_ALL(de, d, return -errno) {
                         _cleanup_(image_unrefp) Image *image = NULL;
 
@@ -332,7 +393,7 @@ int image_discover(Hashmap *h) {
                         if (hashmap_contains(h, de->d_name))
                                 continue;
 
-                        r = image_make(NULL, dirfd(d), path, de->d_name, &image);
+                        r = image_make(NULL, dirfd(d), path, de->d_name, &quota_table, &image);
                         if (r == 0 || r == -ENOENT)
                                 continue;
                         if (r < 0)
@@ -349,7 +410,7 @@ int image_discover(Hashmap *h) {
         if (!hashmap_contains(h, ".host")) {
                 _cleanup_(image_unrefp) Image *image = NULL;
 
-                r = image_make(".host", AT_FDCWD, NULL, "/", &image);
+                r = image_make(".host", AT_FDCWD, NULL, "/", NULL, &image);
                 if (r < 0)
                         return r;
 
@@ -364,6 +425,51 @@ int image_discover(Hashmap *h) {
         return 0;
 }
 
+int image_discover_watch(int inotify_fd) {
+        const char *path;
+
+        assert(inotify_fd >= 0);
+
+        /* Adds watches to the inotify object that trigger whenever
+         * the result of image_discover() might change. For search
+         * path directories that do not exist yet, the closest
+         * existing parent directory is watched for their creation
+         * instead. */
+
+        NULSTR_FOREACH(path, image_search_path) {
+                _cleanup_free_ char *p = NULL;
+
+                if (inotify_add_watch(inotify_fd, path,
+                                      IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ATTRIB|IN_MODIFY|
+                                      IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR) >= 0)
+                        continue;
+                if (errno != ENOENT)
+                        return -errno;
+
+                p = strdup(path);
+                if (!p)
+                        return -ENOMEM;
+
+                for (;;) {
+                        char *parent;
+
+                        parent = dirname_malloc(p);
+                        if (!parent)
+                                return -ENOMEM;
+
+                        free(p);
+                        p = parent;
+
+                        if (inotify_add_watch(inotify_fd, p, IN_CREATE|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR) >= 0)
+                                break;
+                        if (errno != ENOENT || path_equal(p, "/"))
+                                return -errno;
+                }
+        }
+
+        return 0;
+}
+
 void image_hashmap_free(Hashmap *map) {
         Image *i;
 
@@ -58,6 +58,7 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(Hashmap*, image_hashmap_free);
 
 int image_find(const char *name, Image **ret);
 int image_discover(Hashmap *map);
+int image_discover_watch(int inotify_fd);
 
 int image_remove(Image *i);
 int image_rename(Image *i, const char *new_name);
@@ -27,6 +27,12 @@
 #include "util.h"
 #include "ptyfwd.h"
 
+/* Output of the other side is read until there is no more or the
+ * buffer is full, and only then written out, so that a lot of output
+ * (think build logs) results in fewer, larger writes to the terminal.
+ * A read from a PTY never returns more than 4K. */
+#define OUT_BUFFER_SIZE (64U*1024U)
+
 struct PTYForward {
         sd_event *event;
 
@@ -60,7 +66,7 @@ struct PTYForward {
         bool last_char_set:1;
         char last_char;
 
-        char in_buffer[LINE_MAX], out_buffer[LINE_MAX];
+        char in_buffer[LINE_MAX], out_buffer[OUT_BUFFER_SIZE];
         size_t in_buffer_full, out_buffer_full;
 
         usec_t escape_timestamp;
@@ -76,6 +82,13 @@ static bool look_for_escape(PTYForward *f, const char *buffer, size_t n) {
         assert(buffer);
         assert(n > 0);
 
+        /* Most of the time there's no ^] at all */
+        if (!memchr(buffer, 0x1D, n)) {
+                f->escape_timestamp = 0;
+                f->escape_counter = 0;
+                return false;
+        }
+
         for (p = buffer; p < buffer + n; p++) {
 
                 /* Check for ^] */
@@ -167,9 +180,9 @@ static int shovel(PTYForward *f) {
                         }
                 }
 
-                if (f->master_readable && f->out_buffer_full < LINE_MAX) {
+                if (f->master_readable && f->out_buffer_full < OUT_BUFFER_SIZE) {
 
-                        k = read(f->master, f->out_buffer + f->out_buffer_full, LINE_MAX - f->out_buffer_full);
+                        k = read(f->master, f->out_buffer + f->out_buffer_full, OUT_BUFFER_SIZE - f->out_buffer_full);
                         if (k < 0) {
 
                                 /* Note that EIO on the master device
@@ -194,7 +207,8 @@ static int shovel(PTYForward *f) {
                                 f->out_buffer_full += (size_t) k;
                 }
 
-                if (f->stdout_writable && f->out_buffer_full > 0) {
+                if (f->stdout_writable && f->out_buffer_full > 0 &&
+                    (!f->master_readable || f->out_buffer_full >= OUT_BUFFER_SIZE)) {
 
                         k = write(STDOUT_FILENO, f->out_buffer, f->out_buffer_full);
                         if (k < 0) {
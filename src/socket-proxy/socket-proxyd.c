@@ -26,6 +26,7 @@
 #include <string.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -42,15 +43,26 @@
 
 #define BUFFER_SIZE (256 * 1024)
 #define CONNECTIONS_MAX 256
+#define THREADS_MAX 256U
+
+/* How long to reuse the result of resolving the remote host name */
+#define REMOTE_ADDRESS_CACHE_USEC (30 * USEC_PER_SEC)
 
 static const char *arg_remote_host = NULL;
+static unsigned arg_threads = 1;
 
+/* There is one context per thread, each with its own event loop,
+ * all of them watching the same listening sockets. */
 typedef struct Context {
         sd_event *event;
         sd_resolve *resolve;
 
         Set *listen;
         Set *connections;
+
+        union sockaddr_union remote_address;
+        socklen_t remote_address_size;
+        usec_t remote_address_timestamp;
 } Context;
 
 typedef struct Connection {
@@ -66,11 +78,20 @@ typedef struct Connection {
         sd_event_source *server_event_source, *client_event_source;
 
         sd_resolve_query *resolve_query;
+
+        usec_t timestamp;
+        uint64_t server_to_client_bytes, client_to_server_bytes;
 } Connection;
 
 static void connection_free(Connection *c) {
+        char buf[FORMAT_TIMESPAN_MAX];
+
         assert(c);
 
+        log_debug("Connection closed after %s, %" PRIu64 " bytes forwarded to remote host, %" PRIu64 " bytes back.",
+                  format_timespan(buf, sizeof(buf), now(CLOCK_MONOTONIC) - c->timestamp, USEC_PER_MSEC),
+                  c->server_to_client_bytes, c->client_to_server_bytes);
+
         if (c->context)
                 set_remove(c->context->connections, c);
 
@@ -137,6 +158,7 @@ static int connection_shovel(
                 Connection *c,
                 int *from, int buffer[2], int *to,
                 size_t *full, size_t *sz,
+                uint64_t *bytes,
                 sd_event_source **from_source, sd_event_source **to_source) {
 
         bool shoveled;
@@ -149,6 +171,7 @@ static int connection_shovel(
         assert(to);
         assert(full);
         assert(sz);
+        assert(bytes);
         assert(from_source);
         assert(to_source);
 
@@ -173,6 +196,7 @@ static int connection_shovel(
                         z = splice(buffer[0], NULL, *to, NULL, *full, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
                         if (z > 0) {
                                 *full -= z;
+                                *bytes += z;
                                 shoveled = true;
                         } else if (z == 0 || errno == EPIPE || errno == ECONNRESET) {
                                 *to_source = sd_event_source_unref(*to_source);
@@ -198,6 +222,7 @@ static int traffic_cb(sd_event_source *s, int fd, uint32_t revents, void *userda
         r = connection_shovel(c,
                               &c->server_fd, c->server_to_client_buffer, &c->client_fd,
                               &c->server_to_client_buffer_full, &c->server_to_client_buffer_size,
+                              &c->server_to_client_bytes,
                               &c->server_event_source, &c->client_event_source);
         if (r < 0)
                 goto quit;
@@ -205,6 +230,7 @@ static int traffic_cb(sd_event_source *s, int fd, uint32_t revents, void *userda
         r = connection_shovel(c,
                               &c->client_fd, c->client_to_server_buffer, &c->server_fd,
                               &c->client_to_server_buffer_full, &c->client_to_server_buffer_size,
+                              &c->client_to_server_bytes,
                               &c->client_event_source, &c->server_event_source);
         if (r < 0)
                 goto quit;
@@ -313,6 +339,9 @@ static int connect_cb(sd_event_source *s, int fd, uint32_t revents, void *userda
 
         if (error != 0) {
                 log_error_errno(error, "Failed to connect to remote host: %m");
+
+                /* Maybe the host moved, look it up again next time */
+                c->context->remote_address_timestamp = 0;
                 goto fail;
         }
 
@@ -382,6 +411,12 @@ static int resolve_cb(sd_resolve_query *q, int ret, const struct addrinfo *ai, v
 
         c->resolve_query = sd_resolve_query_unref(c->resolve_query);
 
+        if (ai->ai_addrlen <= sizeof(c->context->remote_address)) {
+                memcpy(&c->context->remote_address, ai->ai_addr, ai->ai_addrlen);
+                c->context->remote_address_size = ai->ai_addrlen;
+                c->context->remote_address_timestamp = now(CLOCK_MONOTONIC);
+        }
+
         return connection_start(c, ai->ai_addr, ai->ai_addrlen);
 
 fail:
@@ -423,6 +458,12 @@ static int resolve_remote(Connection *c) {
                 return connection_start(c, &sa.sa, salen);
         }
 
+        if (c->context->remote_address_timestamp > 0 &&
+            c->context->remote_address_timestamp + REMOTE_ADDRESS_CACHE_USEC > now(CLOCK_MONOTONIC)) {
+                sa = c->context->remote_address;
+                return connection_start(c, &sa.sa, c->context->remote_address_size);
+        }
+
         service = strrchr(arg_remote_host, ':');
         if (service) {
                 node = strndupa(arg_remote_host, service - arg_remote_host);
@@ -472,6 +513,7 @@ static int add_connection_socket(Context *context, int fd) {
         }
 
         c->context = context;
+        c->timestamp = now(CLOCK_MONOTONIC);
         c->server_fd = fd;
         c->client_fd = -1;
         c->server_to_client_buffer[0] = c->server_to_client_buffer[1] = -1;
@@ -499,7 +541,7 @@ static int accept_cb(sd_event_source *s, int fd, uint32_t revents, void *userdat
 
         nfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
         if (nfd < 0) {
-                if (errno != -EAGAIN)
+                if (errno != EAGAIN)
                         log_warning_errno(errno, "Failed to accept() socket: %m");
         } else {
                 getpeername_pretty(nfd, &peer);
@@ -572,7 +614,8 @@ static void help(void) {
                "%1$s [SOCKET]\n\n"
                "Bidirectionally proxy local sockets to another (possibly remote) socket.\n\n"
                "  -h --help              Show this help\n"
-               "     --version           Show package version\n",
+               "     --version           Show package version\n"
+               "     --threads=N         Serve connections from N threads\n",
                program_invocation_short_name);
 }
 
@@ -580,16 +623,18 @@ static int parse_argv(int argc, char *argv[]) {
 
         enum {
                 ARG_VERSION = 0x100,
-                ARG_IGNORE_ENV
+                ARG_IGNORE_ENV,
+                ARG_THREADS,
         };
 
         static const struct option options[] = {
-                { "help",       no_argument, NULL, 'h'           },
-                { "version",    no_argument, NULL, ARG_VERSION   },
+                { "help",       no_argument,       NULL, 'h'           },
+                { "version",    no_argument,       NULL, ARG_VERSION   },
+                { "threads",    required_argument, NULL, ARG_THREADS   },
                 {}
         };
 
-        int c;
+        int c, r;
 
         assert(argc >= 0);
         assert(argv);
@@ -607,6 +652,14 @@ static int parse_argv(int argc, char *argv[]) {
                         puts(SYSTEMD_FEATURES);
                         return 0;
 
+                case ARG_THREADS:
+                        r = safe_atou(optarg, &arg_threads);
+                        if (r < 0 || arg_threads < 1 || arg_threads > THREADS_MAX) {
+                                log_error("Invalid number of threads: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -628,9 +681,56 @@ static int parse_argv(int argc, char *argv[]) {
         return 1;
 }
 
+static int context_run(Context *context, int n_fds) {
+        int r, fd;
+
+        assert(context);
+
+        if (!context->event) {
+                r = sd_event_default(&context->event);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to allocate event loop: %m");
+        }
+
+        r = sd_resolve_default(&context->resolve);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate resolver: %m");
+
+        r = sd_resolve_attach_event(context->resolve, context->event, 0);
+        if (r < 0)
+                return log_error_errno(r, "Failed to attach resolver: %m");
+
+        for (fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + n_fds; fd++) {
+                r = add_listen_socket(context, fd);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_event_loop(context->event);
+        if (r < 0)
+                return log_error_errno(r, "Failed to run event loop: %m");
+
+        return 0;
+}
+
+static void *thread_main(void *p) {
+        Context context = {};
+        int r;
+
+        r = context_run(&context, PTR_TO_INT(p));
+        context_free(&context);
+
+        /* If one thread can't serve, we are not in a good state, let the service manager decide */
+        if (r < 0)
+                exit(EXIT_FAILURE);
+
+        return NULL;
+}
+
 int main(int argc, char *argv[]) {
         Context context = {};
-        int r, n, fd;
+        unsigned i;
+        int r, n;
 
         log_parse_environment();
         log_open();
@@ -639,26 +739,6 @@ int main(int argc, char *argv[]) {
         if (r <= 0)
                 goto finish;
 
-        r = sd_event_default(&context.event);
-        if (r < 0) {
-                log_error_errno(r, "Failed to allocate event loop: %m");
-                goto finish;
-        }
-
-        r = sd_resolve_default(&context.resolve);
-        if (r < 0) {
-                log_error_errno(r, "Failed to allocate resolver: %m");
-                goto finish;
-        }
-
-        r = sd_resolve_attach_event(context.resolve, context.event, 0);
-        if (r < 0) {
-                log_error_errno(r, "Failed to attach resolver: %m");
-                goto finish;
-        }
-
-        sd_event_set_watchdog(context.event, true);
-
         n = sd_listen_fds(1);
         if (n < 0) {
                 log_error("Failed to receive sockets from parent.");
@@ -670,18 +750,30 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
-        for (fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + n; fd++) {
-                r = add_listen_socket(&context, fd);
-                if (r < 0)
+        /* The default event loop is per-thread, the watchdog is
+         * only handled by the main thread's */
+        for (i = 1; i < arg_threads; i++) {
+                pthread_t t;
+
+                r = pthread_create(&t, NULL, thread_main, INT_TO_PTR(n));
+                if (r != 0) {
+                        r = log_error_errno(r, "Failed to start thread: %m");
                         goto finish;
+                }
+
+                (void) pthread_detach(t);
         }
 
-        r = sd_event_loop(context.event);
+        r = sd_event_default(&context.event);
         if (r < 0) {
-                log_error_errno(r, "Failed to run event loop: %m");
+                log_error_errno(r, "Failed to allocate event loop: %m");
                 goto finish;
         }
 
+        sd_event_set_watchdog(context.event, true);
+
+        r = context_run(&context, n);
+
 finish:
         context_free(&context);
 
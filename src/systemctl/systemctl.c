@@ -515,19 +515,21 @@ static int get_unit_list(
         size_t size = c;
         int r;
         UnitInfo u;
+        bool fallback = false;
 
         assert(bus);
         assert(unit_infos);
         assert(_reply);
 
+        /* Let the manager do the matching on names, types and states,
+         * so that only what is shown is sent over */
         r = sd_bus_message_new_method_call(
                         bus,
                         &m,
                         "org.freedesktop.systemd1",
                         "/org/freedesktop/systemd1",
                         "org.freedesktop.systemd1.Manager",
-                        "ListUnitsFiltered");
-
+                        "ListUnitsByPatterns");
         if (r < 0)
                 return bus_log_create_error(r);
 
@@ -535,7 +537,43 @@ static int get_unit_list(
         if (r < 0)
                 return bus_log_create_error(r);
 
+        r = sd_bus_message_append_strv(m, patterns);
+        if (r < 0)
+                return bus_log_create_error(r);
+
+        r = sd_bus_message_append_strv(m, arg_types);
+        if (r < 0)
+                return bus_log_create_error(r);
+
+        /* All of it in one go, we need a single reply here */
+        r = sd_bus_message_append(m, "st", "", UINT64_C(0));
+        if (r < 0)
+                return bus_log_create_error(r);
+
         r = sd_bus_call(bus, m, 0, &error, &reply);
+        if (r < 0 && sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD)) {
+                /* Fall back to the old method, in case we talk to an
+                 * older manager, for example in a container */
+                fallback = true;
+                sd_bus_error_free(&error);
+                m = sd_bus_message_unref(m);
+
+                r = sd_bus_message_new_method_call(
+                                bus,
+                                &m,
+                                "org.freedesktop.systemd1",
+                                "/org/freedesktop/systemd1",
+                                "org.freedesktop.systemd1.Manager",
+                                "ListUnitsFiltered");
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_message_append_strv(m, arg_states);
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_call(bus, m, 0, &error, &reply);
+        }
         if (r < 0)
                 return log_error_errno(r, "Failed to list units: %s", bus_error_message(&error, r));
 
@@ -546,7 +584,7 @@ static int get_unit_list(
         while ((r = bus_parse_unit_info(reply, &u)) > 0) {
                 u.machine = machine;
 
-                if (!output_show_unit(&u, patterns))
+                if (!output_show_unit(&u, fallback ? patterns : NULL))
                         continue;
 
                 if (!GREEDY_REALLOC(*unit_infos, size, c+1))
@@ -2364,7 +2402,7 @@ static int unit_find_paths(
                 }
 
                 if (dropin_paths) {
-                        r = unit_file_find_dropin_paths(lp->unit_path, NULL, names, &dropins);
+                        r = unit_file_find_dropin_paths(lp->unit_path, NULL, NULL, names, &dropins);
                         if (r < 0)
                                 return r;
                 }
@@ -4270,16 +4308,13 @@ static int print_property(const char *name, sd_bus_message *m, const char *conte
         return 0;
 }
 
-static int show_one(
+static int show_one_reply(
                 const char *verb,
-                sd_bus *bus,
-                const char *path,
+                sd_bus_message *reply,
                 bool show_properties,
                 bool *new_line,
                 bool *ellipsized) {
 
-        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
-        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         UnitStatusInfo info = {
                 .memory_current = (uint64_t) -1,
                 .memory_limit = (uint64_t) -1,
@@ -4290,22 +4325,15 @@ static int show_one(
         ExecStatusInfo *p;
         int r;
 
-        assert(path);
+        assert(reply);
         assert(new_line);
 
-        log_debug("Showing one %s", path);
+        if (sd_bus_message_is_method_error(reply, NULL)) {
+                const sd_bus_error *error = sd_bus_message_get_error(reply);
 
-        r = sd_bus_call_method(
-                        bus,
-                        "org.freedesktop.systemd1",
-                        path,
-                        "org.freedesktop.DBus.Properties",
-                        "GetAll",
-                        &error,
-                        &reply,
-                        "s", "");
-        if (r < 0)
-                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(&error, r));
+                r = sd_bus_message_get_errno(reply);
+                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(error, r));
+        }
 
         r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "{sv}");
         if (r < 0)
@@ -4390,6 +4418,145 @@ static int show_one(
         return r;
 }
 
+static int show_one(
+                const char *verb,
+                sd_bus *bus,
+                const char *path,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        assert(path);
+
+        log_debug("Showing one %s", path);
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "GetAll",
+                        &error,
+                        &reply,
+                        "s", "");
+        if (r < 0)
+                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(&error, r));
+
+        return show_one_reply(verb, reply, show_properties, new_line, ellipsized);
+}
+
+/* How many GetAll() calls to keep in flight when showing many
+ * units. Replies are still shown in order. */
+#define SHOW_CALLS_IN_FLIGHT 64
+
+typedef struct ShowCall {
+        sd_bus_slot *slot;
+        sd_bus_message *reply;
+} ShowCall;
+
+static int show_call_callback(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        ShowCall *c = userdata;
+
+        assert(c);
+
+        c->reply = sd_bus_message_ref(m);
+        c->slot = sd_bus_slot_unref(c->slot);
+
+        return 0;
+}
+
+static void show_calls_free(ShowCall *calls, size_t n) {
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+                sd_bus_slot_unref(calls[i].slot);
+                sd_bus_message_unref(calls[i].reply);
+        }
+
+        free(calls);
+}
+
+static int show_many(
+                const char *verb,
+                sd_bus *bus,
+                char **paths,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        ShowCall *calls;
+        size_t n, i, sent = 0;
+        int r, ret = 0;
+
+        assert(bus);
+
+        n = strv_length(paths);
+        if (n == 0)
+                return 0;
+        if (n == 1)
+                return show_one(verb, bus, paths[0], show_properties, new_line, ellipsized);
+
+        calls = new0(ShowCall, n);
+        if (!calls)
+                return log_oom();
+
+        for (i = 0; i < n; i++) {
+
+                /* Keep the pipeline filled */
+                for (; sent < n && sent < i + SHOW_CALLS_IN_FLIGHT; sent++) {
+                        log_debug("Showing one %s", paths[sent]);
+
+                        r = sd_bus_call_method_async(
+                                        bus,
+                                        &calls[sent].slot,
+                                        "org.freedesktop.systemd1",
+                                        paths[sent],
+                                        "org.freedesktop.DBus.Properties",
+                                        "GetAll",
+                                        show_call_callback,
+                                        calls + sent,
+                                        "s", "");
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to issue method call: %m");
+                                goto finish;
+                        }
+                }
+
+                while (!calls[i].reply) {
+                        r = sd_bus_process(bus, NULL);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to process bus: %m");
+                                goto finish;
+                        }
+                        if (r > 0)
+                                continue;
+
+                        r = sd_bus_wait(bus, (uint64_t) -1);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to wait for bus: %m");
+                                goto finish;
+                        }
+                }
+
+                r = show_one_reply(verb, calls[i].reply, show_properties, new_line, ellipsized);
+                calls[i].reply = sd_bus_message_unref(calls[i].reply);
+                if (r < 0)
+                        goto finish;
+                else if (r > 0 && ret == 0)
+                        ret = r;
+        }
+
+        r = ret;
+
+finish:
+        show_calls_free(calls, n);
+        return r;
+}
+
 static int get_unit_dbus_path_by_pid(
                 sd_bus *bus,
                 uint32_t pid,
@@ -4435,9 +4602,10 @@ static int show_all(
 
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_free_ UnitInfo *unit_infos = NULL;
+        _cleanup_strv_free_ char **paths = NULL;
         const UnitInfo *u;
         unsigned c;
-        int r, ret = 0;
+        int r;
 
         r = get_unit_list(bus, NULL, NULL, &unit_infos, 0, &reply);
         if (r < 0)
@@ -4449,21 +4617,17 @@ static int show_all(
 
         qsort_safe(unit_infos, c, sizeof(UnitInfo), compare_unit_info);
 
-        for (u = unit_infos; u < unit_infos + c; u++) {
-                _cleanup_free_ char *p = NULL;
+        paths = new0(char*, c + 1);
+        if (!paths)
+                return log_oom();
 
-                p = unit_dbus_path_from_name(u->id);
-                if (!p)
+        for (u = unit_infos; u < unit_infos + c; u++) {
+                paths[u - unit_infos] = unit_dbus_path_from_name(u->id);
+                if (!paths[u - unit_infos])
                         return log_oom();
-
-                r = show_one(verb, bus, p, show_properties, new_line, ellipsized);
-                if (r < 0)
-                        return r;
-                else if (r > 0 && ret == 0)
-                        ret = r;
         }
 
-        return ret;
+        return show_many(verb, bus, paths, show_properties, new_line, ellipsized);
 }
 
 static int show_system_status(sd_bus *bus) {
@@ -4515,7 +4679,7 @@ static int show_system_status(sd_bus *bus) {
                 else
                         c = 0;
 
-                show_cgroup(SYSTEMD_CGROUP_CONTROLLER, strempty(mi.control_group), prefix, c, false, get_output_flags());
+                show_cgroup(SYSTEMD_CGROUP_CONTROLLER, strempty(mi.control_group), prefix, c, false, (unsigned) -1, get_output_flags());
         }
 
         return 0;
@@ -4557,6 +4721,7 @@ static int show(sd_bus *bus, char **args) {
         } else {
                 _cleanup_free_ char **patterns = NULL;
                 char **name;
+                size_t i;
 
                 STRV_FOREACH(name, args + 1) {
                         _cleanup_free_ char *unit = NULL;
@@ -4590,26 +4755,28 @@ static int show(sd_bus *bus, char **args) {
                 }
 
                 if (!strv_isempty(patterns)) {
-                        _cleanup_strv_free_ char **names = NULL;
+                        _cleanup_strv_free_ char **names = NULL, **units = NULL;
 
                         r = expand_names(bus, patterns, NULL, &names);
                         if (r < 0)
                                 log_error_errno(r, "Failed to expand names: %m");
 
-                        STRV_FOREACH(name, names) {
-                                _cleanup_free_ char *unit;
+                        units = new0(char*, strv_length(names) + 1);
+                        if (!units)
+                                return log_oom();
 
-                                unit = unit_dbus_path_from_name(*name);
-                                if (!unit)
+                        for (i = 0; names && names[i]; i++) {
+                                units[i] = unit_dbus_path_from_name(names[i]);
+                                if (!units[i])
                                         return log_oom();
-
-                                r = show_one(args[0], bus, unit, show_properties,
-                                             &new_line, &ellipsized);
-                                if (r < 0)
-                                        return r;
-                                else if (r > 0 && ret == 0)
-                                        ret = r;
                         }
+
+                        r = show_many(args[0], bus, units, show_properties,
+                                      &new_line, &ellipsized);
+                        if (r < 0)
+                                return r;
+                        else if (r > 0 && ret == 0)
+                                ret = r;
                 }
         }
 
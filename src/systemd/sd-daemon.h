@@ -255,6 +255,36 @@ int sd_pid_notifyf(pid_t pid, int unset_environment, const char *format, ...) _s
 */
 int sd_pid_notify_with_fds(pid_t pid, int unset_environment, const char *state, const int *fds, unsigned n_fds);
 
+/*
+  Similar to sd_notify(), but takes a NULL-terminated list of
+  variable assignments, which are sent together in a single
+  message. Example:
+
+     sd_notify_many(0, "READY=1", "STATUS=Processing requests...", NULL);
+
+  See sd_notify_many(3) for more information.
+*/
+int sd_notify_many(int unset_environment, const char *state, ...) _sd_sentinel_;
+
+/*
+  Similar to sd_notify_many(), but send the message on behalf of
+  another process, if the appropriate permissions are available.
+*/
+int sd_pid_notify_many(pid_t pid, int unset_environment, const char *state, ...) _sd_sentinel_;
+
+/*
+  If b is non-zero, the notification functions above keep the
+  socket they send on open, and reuse it for all later messages of
+  the process, instead of opening a new one for each message. This
+  is useful for services that send notifications at a high rate,
+  like frequent WATCHDOG=1 or STATUS= updates. A child process
+  inherits the setting, but opens its own socket. If b is zero, the
+  socket is closed.
+
+  See sd_notify_persistent(3) for more information.
+*/
+int sd_notify_persistent(int b);
+
 /*
   Returns > 0 if the system was booted with systemd. Returns < 0 on
   error. Returns 0 if the system was not booted with systemd. Note
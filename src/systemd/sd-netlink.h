@@ -39,6 +39,7 @@ typedef struct sd_netlink_message sd_netlink_message;
 /* callback */
 
 typedef int (*sd_netlink_message_handler_t)(sd_netlink *nl, sd_netlink_message *m, void *userdata);
+typedef int (*sd_netlink_overrun_handler_t)(sd_netlink *nl, void *userdata);
 
 /* bus */
 int sd_netlink_new_from_netlink(sd_netlink **nl, int fd);
@@ -54,6 +55,7 @@ int sd_netlink_call_async(sd_netlink *nl, sd_netlink_message *message,
                        sd_netlink_message_handler_t callback,
                        void *userdata, uint64_t usec, uint32_t *serial);
 int sd_netlink_call_async_cancel(sd_netlink *nl, uint32_t serial);
+int sd_netlink_cork(sd_netlink *nl, int b);
 int sd_netlink_call(sd_netlink *nl, sd_netlink_message *message, uint64_t timeout,
                  sd_netlink_message **reply);
 
@@ -65,6 +67,10 @@ int sd_netlink_wait(sd_netlink *nl, uint64_t timeout);
 int sd_netlink_add_match(sd_netlink *nl, uint16_t match, sd_netlink_message_handler_t c, void *userdata);
 int sd_netlink_remove_match(sd_netlink *nl, uint16_t match, sd_netlink_message_handler_t c, void *userdata);
 
+/* Called when messages were lost, because the receive buffer or the
+ * read queue overflowed. The receive buffer is grown in that case. */
+int sd_netlink_set_overrun_handler(sd_netlink *nl, sd_netlink_overrun_handler_t c, void *userdata);
+
 int sd_netlink_attach_event(sd_netlink *nl, sd_event *e, int priority);
 int sd_netlink_detach_event(sd_netlink *nl);
 
@@ -76,6 +76,12 @@ static Hashmap *members = NULL;
 static Hashmap *database_uid = NULL, *database_user = NULL;
 static Hashmap *database_gid = NULL, *database_group = NULL;
 
+/* Results of NSS lookups by numeric ID, mapped to the name found, or
+ * to "" if there was none. NSS might go over the network, and the same
+ * ID is usually checked both as uid and as gid, hence every ID is
+ * looked up at most once. */
+static Hashmap *nss_users = NULL, *nss_groups = NULL;
+
 static uid_t search_uid = UID_INVALID;
 static UidRange *uid_range = NULL;
 static unsigned n_uid_range = 0;
@@ -748,11 +754,77 @@ finish:
         return r;
 }
 
-static int uid_is_ok(uid_t uid, const char *name) {
+static int nss_cache_put(Hashmap **h, void *key, const char *name, char **ret) {
+        _cleanup_free_ char *n = NULL;
+        int r;
+
+        r = hashmap_ensure_allocated(h, NULL);
+        if (r < 0)
+                return r;
+
+        n = strdup(strempty(name));
+        if (!n)
+                return -ENOMEM;
+
+        r = hashmap_put(*h, key, n);
+        if (r < 0)
+                return r;
+
+        *ret = n;
+        n = NULL;
+        return 0;
+}
+
+static int nss_user_by_uid(uid_t uid, const char **ret) {
         struct passwd *p;
+        char *n;
+        int r;
+
+        n = hashmap_get(nss_users, UID_TO_PTR(uid));
+        if (!n) {
+                errno = 0;
+                p = getpwuid(uid);
+                if (!p && !IN_SET(errno, 0, ENOENT))
+                        return -errno;
+
+                r = nss_cache_put(&nss_users, UID_TO_PTR(uid), p ? p->pw_name : NULL, &n);
+                if (r < 0)
+                        return r;
+        }
+
+        if (ret)
+                *ret = n;
+
+        return !isempty(n);
+}
+
+static int nss_group_by_gid(gid_t gid, const char **ret) {
         struct group *g;
+        char *n;
+        int r;
+
+        n = hashmap_get(nss_groups, GID_TO_PTR(gid));
+        if (!n) {
+                errno = 0;
+                g = getgrgid(gid);
+                if (!g && !IN_SET(errno, 0, ENOENT))
+                        return -errno;
+
+                r = nss_cache_put(&nss_groups, GID_TO_PTR(gid), g ? g->gr_name : NULL, &n);
+                if (r < 0)
+                        return r;
+        }
+
+        if (ret)
+                *ret = n;
+
+        return !isempty(n);
+}
+
+static int uid_is_ok(uid_t uid, const char *name) {
         const char *n;
         Item *i;
+        int r;
 
         /* Let's see if we already have assigned the UID a second time */
         if (hashmap_get(todo_uids, UID_TO_PTR(uid)))
@@ -774,20 +846,15 @@ static int uid_is_ok(uid_t uid, const char *name) {
 
         /* Let's also check via NSS, to avoid UID clashes over LDAP and such, just in case */
         if (!arg_root) {
-                errno = 0;
-                p = getpwuid(uid);
-                if (p)
-                        return 0;
-                if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_user_by_uid(uid, NULL);
+                if (r != 0)
+                        return r < 0 ? r : 0;
 
-                errno = 0;
-                g = getgrgid((gid_t) uid);
-                if (g) {
-                        if (!streq(g->gr_name, name))
-                                return 0;
-                } else if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_group_by_gid((gid_t) uid, &n);
+                if (r < 0)
+                        return r;
+                if (r > 0 && !streq(n, name))
+                        return 0;
         }
 
         return 1;
@@ -975,8 +1042,7 @@ static int add_user(Item *i) {
 }
 
 static int gid_is_ok(gid_t gid) {
-        struct group *g;
-        struct passwd *p;
+        int r;
 
         if (hashmap_get(todo_gids, GID_TO_PTR(gid)))
                 return 0;
@@ -992,19 +1058,13 @@ static int gid_is_ok(gid_t gid) {
                 return 0;
 
         if (!arg_root) {
-                errno = 0;
-                g = getgrgid(gid);
-                if (g)
-                        return 0;
-                if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_group_by_gid(gid, NULL);
+                if (r != 0)
+                        return r < 0 ? r : 0;
 
-                errno = 0;
-                p = getpwuid((uid_t) gid);
-                if (p)
-                        return 0;
-                if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_user_by_uid((uid_t) gid, NULL);
+                if (r != 0)
+                        return r < 0 ? r : 0;
         }
 
         return 1;
@@ -1901,6 +1961,9 @@ finish:
         free_database(database_user, database_uid);
         free_database(database_group, database_gid);
 
+        hashmap_free_free(nss_users);
+        hashmap_free_free(nss_groups);
+
         free(arg_root);
 
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
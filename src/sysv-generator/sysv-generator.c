@@ -26,6 +26,7 @@
 #include <unistd.h>
 
 #include "util.h"
+#include "fileio.h"
 #include "mkdir.h"
 #include "strv.h"
 #include "path-util.h"
@@ -67,6 +68,19 @@ static const struct {
 
 const char *arg_dest = "/tmp";
 
+/* The metadata read from the scripts is kept from one run to the
+ * next. The copy in /run is there for daemon reloads, the one in
+ * /var/cache for boots, if /var is around early enough. */
+static const char * const sysv_cache_paths[] = {
+        "/run/systemd/sysv-generator.cache",
+        "/var/cache/systemd/sysv-generator.cache",
+};
+
+/* What is cached is what the scripts translated to, and the
+ * translation tables are part of this binary, hence a cache written
+ * by a different systemd version is not used */
+#define SYSV_CACHE_HEADER "# systemd-sysv-generator cache, version 1, systemd " VERSION
+
 typedef struct SysvStub {
         char *name;
         char *path;
@@ -78,8 +92,18 @@ typedef struct SysvStub {
         char **wants;
         char **wanted_by;
         char **conflicts;
+        char **aliases;
         bool has_lsb;
         bool reload;
+
+        /* Identify the version of the script the metadata above was
+         * read from, so that the cache can tell when it changed */
+        bool loaded;
+        dev_t dev;
+        ino_t ino;
+        uint64_t size;
+        nsec_t mtime;
+        nsec_t ctime;
 } SysvStub;
 
 static void free_sysvstub(SysvStub *s) {
@@ -92,6 +116,7 @@ static void free_sysvstub(SysvStub *s) {
         strv_free(s->wants);
         strv_free(s->wanted_by);
         strv_free(s->conflicts);
+        strv_free(s->aliases);
         free(s);
 }
 
@@ -355,10 +380,11 @@ static int handle_provides(SysvStub *s, unsigned line, const char *full_text, co
 
                 t = unit_name_to_type(m);
                 if (t == UNIT_SERVICE) {
-                        log_debug("Adding Provides: alias '%s' for '%s'", m, s->name);
-                        r = add_alias(s->name, m);
+                        /* The links are created together with those
+                         * of scripts loaded from the cache */
+                        r = strv_extend(&s->aliases, m);
                         if (r < 0)
-                                log_warning_errno(r, "[%s:%u] Failed to add LSB Provides name %s, ignoring: %m", s->path, line, m);
+                                return log_oom();
                 } else if (t == UNIT_TARGET) {
                         /* NB: SysV targets which are provided by a
                          * service are pulled in by the services, as
@@ -672,6 +698,363 @@ static int load_sysv(SysvStub *s) {
                 s->description = d;
         }
 
+        s->loaded = true;
+
+        return 0;
+}
+
+static void add_aliases(SysvStub *s) {
+        char **p;
+        int r;
+
+        assert(s);
+
+        STRV_FOREACH(p, s->aliases) {
+                log_debug("Adding Provides: alias '%s' for '%s'", *p, s->name);
+
+                r = add_alias(s->name, *p);
+                if (r < 0)
+                        log_warning_errno(r, "[%s] Failed to add LSB Provides name %s, ignoring: %m", s->path, *p);
+        }
+}
+
+static bool sysv_cache_matches(const SysvStub *cached, const SysvStub *s) {
+        assert(cached);
+        assert(s);
+
+        /* The ctime changes with every write, and cannot be set
+         * back by anyone, unlike the mtime */
+        return cached->dev == s->dev &&
+               cached->ino == s->ino &&
+               cached->size == s->size &&
+               cached->mtime == s->mtime &&
+               cached->ctime == s->ctime;
+}
+
+static int sysv_cache_apply(SysvStub *s, const SysvStub *cached) {
+        int r;
+
+        assert(s);
+        assert(cached);
+
+        s->has_lsb = cached->has_lsb;
+        s->reload = cached->reload;
+
+        r = free_and_strdup(&s->description, cached->description);
+        if (r < 0)
+                return r;
+
+        r = free_and_strdup(&s->pid_file, cached->pid_file);
+        if (r < 0)
+                return r;
+
+        r = strv_extend_strv(&s->before, cached->before);
+        if (r < 0)
+                return r;
+
+        r = strv_extend_strv(&s->after, cached->after);
+        if (r < 0)
+                return r;
+
+        r = strv_extend_strv(&s->wants, cached->wants);
+        if (r < 0)
+                return r;
+
+        r = strv_extend_strv(&s->aliases, cached->aliases);
+        if (r < 0)
+                return r;
+
+        s->loaded = true;
+
+        return 0;
+}
+
+static int sysv_cache_parse_line(SysvStub *s, const char *l) {
+        const char *v;
+        int r;
+
+        if ((v = startswith(l, "FILE="))) {
+                unsigned long long dev, ino, size, mtime, ctime;
+
+                if (sscanf(v, "%llu %llu %llu %llu %llu", &dev, &ino, &size, &mtime, &ctime) != 5)
+                        return -EBADMSG;
+
+                s->dev = (dev_t) dev;
+                s->ino = (ino_t) ino;
+                s->size = size;
+                s->mtime = mtime;
+                s->ctime = ctime;
+
+        } else if ((v = startswith(l, "LSB=")))
+                s->has_lsb = streq(v, "1");
+        else if ((v = startswith(l, "RELOAD=")))
+                s->reload = streq(v, "1");
+        else if ((v = startswith(l, "DESCRIPTION="))) {
+                free(s->description);
+                r = cunescape(v, 0, &s->description);
+                if (r < 0)
+                        return r;
+
+        } else if ((v = startswith(l, "PIDFILE="))) {
+                free(s->pid_file);
+                r = cunescape(v, 0, &s->pid_file);
+                if (r < 0)
+                        return r;
+
+        } else {
+                char ***l_strv;
+
+                if ((v = startswith(l, "BEFORE=")))
+                        l_strv = &s->before;
+                else if ((v = startswith(l, "AFTER=")))
+                        l_strv = &s->after;
+                else if ((v = startswith(l, "WANTS=")))
+                        l_strv = &s->wants;
+                else if ((v = startswith(l, "ALIASES=")))
+                        l_strv = &s->aliases;
+                else
+                        /* Something we don't know about, but it
+                         * doesn't hurt either */
+                        return 0;
+
+                strv_free(*l_strv);
+                *l_strv = strv_split(v, WHITESPACE);
+                if (!*l_strv)
+                        return -ENOMEM;
+        }
+
+        return 0;
+}
+
+static int sysv_cache_put(Hashmap *cache, SysvStub **s) {
+        int r;
+
+        if (!*s)
+                return 0;
+
+        r = hashmap_put(cache, (*s)->path, *s);
+        if (r < 0)
+                return r;
+
+        *s = NULL;
+        return 0;
+}
+
+static int sysv_cache_load(const char *path, Hashmap *cache) {
+        _cleanup_(free_sysvstubp) SysvStub *s = NULL;
+        _cleanup_strv_free_ char **lines = NULL;
+        _cleanup_free_ char *contents = NULL;
+        char **l;
+        int r;
+
+        assert(path);
+        assert(cache);
+
+        r = read_full_file(path, &contents, NULL);
+        if (r < 0)
+                return r;
+
+        lines = strv_split_newlines(contents);
+        if (!lines)
+                return -ENOMEM;
+
+        if (!streq_ptr(lines[0], SYSV_CACHE_HEADER))
+                return -EBADMSG;
+
+        /* One block of lines per script, each starting with its
+         * path */
+        STRV_FOREACH(l, lines + 1) {
+                const char *v;
+
+                v = startswith(*l, "PATH=");
+                if (v) {
+                        r = sysv_cache_put(cache, &s);
+                        if (r < 0)
+                                return r;
+
+                        s = new0(SysvStub, 1);
+                        if (!s)
+                                return -ENOMEM;
+
+                        s->sysv_start_priority = -1;
+
+                        r = cunescape(v, 0, &s->path);
+                        if (r < 0)
+                                return r;
+
+                        continue;
+                }
+
+                if (!s)
+                        return -EBADMSG;
+
+                r = sysv_cache_parse_line(s, *l);
+                if (r < 0)
+                        return r;
+        }
+
+        return sysv_cache_put(cache, &s);
+}
+
+static int sysv_cache_write_one(FILE *f, const SysvStub *s) {
+        _cleanup_free_ char *path = NULL, *description = NULL, *pid_file = NULL,
+                *before = NULL, *after = NULL, *wants = NULL, *aliases = NULL;
+
+        path = cescape(s->path);
+        description = cescape(strempty(s->description));
+        pid_file = cescape(strempty(s->pid_file));
+        before = strv_join(s->before, " ");
+        after = strv_join(s->after, " ");
+        wants = strv_join(s->wants, " ");
+        aliases = strv_join(s->aliases, " ");
+        if (!path || !description || !pid_file || !before || !after || !wants || !aliases)
+                return -ENOMEM;
+
+        fprintf(f,
+                "PATH=%s\n"
+                "FILE=%llu %llu %" PRIu64 " " NSEC_FMT " " NSEC_FMT "\n"
+                "LSB=%i\n"
+                "RELOAD=%i\n",
+                path,
+                (unsigned long long) s->dev, (unsigned long long) s->ino, s->size, s->mtime, s->ctime,
+                s->has_lsb,
+                s->reload);
+
+        if (s->description)
+                fprintf(f, "DESCRIPTION=%s\n", description);
+        if (s->pid_file)
+                fprintf(f, "PIDFILE=%s\n", pid_file);
+
+        fprintf(f,
+                "BEFORE=%s\n"
+                "AFTER=%s\n"
+                "WANTS=%s\n"
+                "ALIASES=%s\n"
+                "\n",
+                before, after, wants, aliases);
+
+        return 0;
+}
+
+static int sysv_cache_save(const char *path, Hashmap *all_services) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        SysvStub *s;
+        Iterator i;
+        int r;
+
+        assert(path);
+
+        r = mkdir_parents(path, 0755);
+        if (r < 0)
+                return r;
+
+        r = fopen_temporary(path, &f, &temp_path);
+        if (r < 0)
+                return r;
+
+        (void) fchmod(fileno(f), 0644);
+
+        fputs(SYSV_CACHE_HEADER "\n", f);
+
+        HASHMAP_FOREACH(s, all_services, i) {
+                if (!s->loaded)
+                        continue;
+
+                r = sysv_cache_write_one(f, s);
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp_path, path) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        (void) unlink(temp_path);
+        return r;
+}
+
+static int load_all_sysv(Hashmap *all_services) {
+        _cleanup_(free_sysvstub_hashmapp) Hashmap *cache = NULL;
+        const char *e, *paths[ELEMENTSOF(sysv_cache_paths)];
+        unsigned n_paths = 0, n_cached = 0, n_parsed = 0, source, k;
+        SysvStub *service;
+        Iterator j;
+        int r;
+
+        e = getenv("SYSTEMD_SYSV_GENERATOR_CACHE");
+        if (e) {
+                /* For testing */
+                if (!isempty(e))
+                        paths[n_paths++] = e;
+        } else
+                for (k = 0; k < ELEMENTSOF(sysv_cache_paths); k++)
+                        paths[n_paths++] = sysv_cache_paths[k];
+
+        cache = hashmap_new(&string_hash_ops);
+        if (!cache)
+                return log_oom();
+
+        /* The first cache that can be read wins */
+        for (k = 0; k < n_paths; k++) {
+                r = sysv_cache_load(paths[k], cache);
+                if (r >= 0)
+                        break;
+
+                if (r != -ENOENT)
+                        log_debug_errno(r, "Cannot read %s, ignoring: %m", paths[k]);
+
+                free_sysvstub_hashmapp(&cache);
+                cache = hashmap_new(&string_hash_ops);
+                if (!cache)
+                        return log_oom();
+        }
+        source = k;
+
+        HASHMAP_FOREACH(service, all_services, j) {
+                SysvStub *cached;
+
+                cached = hashmap_get(cache, service->path);
+                if (cached && sysv_cache_matches(cached, service)) {
+                        log_debug("Using cached metadata of SysV script %s", service->path);
+
+                        r = sysv_cache_apply(service, cached);
+                        if (r < 0)
+                                return log_oom();
+
+                        n_cached++;
+                } else {
+                        if (load_sysv(service) < 0)
+                                continue;
+
+                        n_parsed++;
+                }
+
+                add_aliases(service);
+        }
+
+        /* Only write the cache if something changed, including
+         * scripts that went away, or if it was not found where we
+         * look first */
+        if (source == 0 && n_parsed == 0 && n_cached == hashmap_size(cache))
+                return 0;
+
+        for (k = 0; k < n_paths; k++) {
+                r = sysv_cache_save(paths[k], all_services);
+                if (r < 0)
+                        log_debug_errno(r, "Cannot write %s, ignoring: %m", paths[k]);
+        }
+
+        log_debug("Parsed %u SysV scripts, %u unchanged.", n_parsed, n_cached);
+
         return 0;
 }
 
@@ -773,6 +1156,11 @@ static int enumerate_sysv(const LookupPaths *lp, Hashmap *all_services) {
                         service->sysv_start_priority = -1;
                         service->name = name;
                         service->path = fpath;
+                        service->dev = st.st_dev;
+                        service->ino = st.st_ino;
+                        service->size = st.st_size;
+                        service->mtime = timespec_load_nsec(&st.st_mtim);
+                        service->ctime = timespec_load_nsec(&st.st_ctim);
 
                         r = hashmap_put(all_services, service->name, service);
                         if (r < 0)
@@ -955,16 +1343,19 @@ int main(int argc, char *argv[]) {
                 return EXIT_FAILURE;
         }
 
-        r = set_dependencies_from_rcnd(&lp, all_services);
+        /* Before the runlevel links are looked at, so that what
+         * goes into the cache is only what was read from the
+         * scripts */
+        r = load_all_sysv(all_services);
         if (r < 0) {
-                log_error("Failed to read runlevels from rcnd links.");
+                log_error("Failed to load init scripts.");
                 return EXIT_FAILURE;
         }
 
-        HASHMAP_FOREACH(service, all_services, j) {
-                q = load_sysv(service);
-                if (q < 0)
-                        continue;
+        r = set_dependencies_from_rcnd(&lp, all_services);
+        if (r < 0) {
+                log_error("Failed to read runlevels from rcnd links.");
+                return EXIT_FAILURE;
         }
 
         HASHMAP_FOREACH(service, all_services, j) {
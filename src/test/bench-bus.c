@@ -0,0 +1,170 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "util.h"
+#include "sd-bus.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+#include "bus-util.h"
+#include "bench.h"
+
+static int append_properties(sd_bus_message *m) {
+        int r;
+
+        /* Roughly what a PropertiesChanged signal of a unit carries */
+        r = sd_bus_message_append(m, "s", "org.freedesktop.systemd1.Unit");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(m, "a{sv}", 4,
+                                  "ActiveState", "s", "active",
+                                  "SubState", "s", "running",
+                                  "ActiveEnterTimestamp", "t", (uint64_t) 1442779180000000,
+                                  "Conditions", "a(sbbsi)", 1, "ConditionPathExists", false, false, "/etc/foo.conf", 1);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_append(m, "as", 2, "Names", "Wants");
+}
+
+static void bench_marshal(Bench *b, uint64_t n, void *userdata) {
+        sd_bus *bus = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                assert_se(sd_bus_message_new_signal(bus, &m, "/org/freedesktop/systemd1/unit/foo_2eservice", "org.freedesktop.DBus.Properties", "PropertiesChanged") >= 0);
+                assert_se(append_properties(m) >= 0);
+                assert_se(bus_message_seal(m, i + 1, 0) >= 0);
+        }
+}
+
+static void bench_demarshal(Bench *b, uint64_t n, void *userdata) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        sd_bus *bus = userdata;
+        uint64_t i;
+
+        bench_pause(b);
+        assert_se(sd_bus_message_new_signal(bus, &m, "/org/freedesktop/systemd1/unit/foo_2eservice", "org.freedesktop.DBus.Properties", "PropertiesChanged") >= 0);
+        assert_se(append_properties(m) >= 0);
+        assert_se(bus_message_seal(m, 1, 0) >= 0);
+        bench_resume(b);
+
+        for (i = 0; i < n; i++) {
+                const char *s;
+
+                assert_se(sd_bus_message_rewind(m, true) >= 0);
+                assert_se(sd_bus_message_read(m, "s", &s) > 0);
+
+                assert_se(sd_bus_message_enter_container(m, 'a', "{sv}") > 0);
+                while (sd_bus_message_enter_container(m, 'e', "sv") > 0) {
+                        assert_se(sd_bus_message_read(m, "s", &s) > 0);
+                        assert_se(sd_bus_message_skip(m, "v") >= 0);
+                        assert_se(sd_bus_message_exit_container(m) >= 0);
+                }
+                assert_se(sd_bus_message_exit_container(m) >= 0);
+
+                assert_se(sd_bus_message_skip(m, "as") >= 0);
+        }
+}
+
+static void *server_thread(void *p) {
+        sd_bus *bus = p;
+        int r;
+
+        for (;;) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                r = sd_bus_process(bus, &m);
+                assert_se(r >= 0);
+
+                if (r == 0) {
+                        r = sd_bus_wait(bus, USEC_INFINITY);
+                        assert_se(r >= 0);
+                        continue;
+                }
+
+                if (!m)
+                        continue;
+
+                if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd1.Bench", "Ping"))
+                        assert_se(sd_bus_reply_method_return(m, "s", "pong") >= 0);
+                else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd1.Bench", "Exit")) {
+                        assert_se(sd_bus_reply_method_return(m, NULL) >= 0);
+                        assert_se(sd_bus_flush(bus) >= 0);
+                        return NULL;
+                }
+        }
+}
+
+static void bench_round_trip(Bench *b, uint64_t n, void *userdata) {
+        sd_bus *bus = userdata;
+        uint64_t i;
+
+        /* The allocations of the server thread count too, it is the
+         * cost of a whole round trip */
+        for (i = 0; i < n; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+                const char *s;
+
+                assert_se(sd_bus_call_method(bus, NULL, "/", "org.freedesktop.systemd1.Bench", "Ping", NULL, &reply, "s", "ping") >= 0);
+                assert_se(sd_bus_message_read(reply, "s", &s) > 0);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        sd_bus *client, *server;
+        int pair[2], r;
+        pthread_t t;
+        sd_id128_t id;
+
+        r = bench_parse_argv(argc, argv);
+        if (r != 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        assert_se(sd_bus_new(&server) >= 0);
+        assert_se(sd_bus_set_fd(server, pair[0], pair[0]) >= 0);
+        assert_se(sd_bus_set_server(server, true, id) >= 0);
+        assert_se(sd_bus_start(server) >= 0);
+
+        assert_se(sd_bus_new(&client) >= 0);
+        assert_se(sd_bus_set_fd(client, pair[1], pair[1]) >= 0);
+        assert_se(sd_bus_start(client) >= 0);
+
+        assert_se(pthread_create(&t, NULL, server_thread, server) == 0);
+
+        bench_run("bus-marshal", bench_marshal, client);
+        bench_run("bus-demarshal", bench_demarshal, client);
+        bench_run("bus-round-trip", bench_round_trip, client);
+
+        assert_se(sd_bus_call_method(client, NULL, "/", "org.freedesktop.systemd1.Bench", "Exit", NULL, NULL, NULL) >= 0);
+        assert_se(pthread_join(t, NULL) == 0);
+
+        sd_bus_flush_close_unref(client);
+        sd_bus_flush_close_unref(server);
+
+        return bench_finish();
+}
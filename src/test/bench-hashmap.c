@@ -0,0 +1,160 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "util.h"
+#include "strv.h"
+#include "hashmap.h"
+#include "set.h"
+#include "prioq.h"
+#include "random-util.h"
+#include "bench.h"
+
+/* The number of entries of the prefilled tables the lookups run
+ * against */
+#define N_ENTRIES 65536
+
+static char **keys = NULL;
+
+static void bench_hashmap_put(Bench *b, uint64_t n, void *userdata) {
+        Hashmap *h = NULL;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                if (i % N_ENTRIES == 0) {
+                        bench_pause(b);
+                        hashmap_free(h);
+                        assert_se(h = hashmap_new(NULL));
+                        bench_resume(b);
+                }
+
+                assert_se(hashmap_put(h, UINT64_TO_PTR(i + 1), UINT64_TO_PTR(i + 1)) > 0);
+        }
+
+        bench_pause(b);
+        hashmap_free(h);
+}
+
+static void bench_hashmap_get(Bench *b, uint64_t n, void *userdata) {
+        Hashmap *h = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++)
+                assert_se(hashmap_get(h, UINT64_TO_PTR((i % N_ENTRIES) + 1)));
+}
+
+static void bench_hashmap_get_string(Bench *b, uint64_t n, void *userdata) {
+        Hashmap *h = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++)
+                assert_se(hashmap_get(h, keys[i % N_ENTRIES]));
+}
+
+static void bench_hashmap_iterate(Bench *b, uint64_t n, void *userdata) {
+        Hashmap *h = userdata;
+        uint64_t i = 0;
+        Iterator it;
+        void *v;
+
+        for (;;)
+                HASHMAP_FOREACH(v, h, it)
+                        if (++i >= n)
+                                return;
+}
+
+static void bench_set_put_remove(Bench *b, uint64_t n, void *userdata) {
+        Set *s = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                assert_se(set_put(s, UINT64_TO_PTR(N_ENTRIES + 1)) > 0);
+                assert_se(set_remove(s, UINT64_TO_PTR(N_ENTRIES + 1)));
+        }
+}
+
+static void bench_set_contains(Bench *b, uint64_t n, void *userdata) {
+        Set *s = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++)
+                assert_se(set_contains(s, UINT64_TO_PTR((i % N_ENTRIES) + 1)));
+}
+
+static int compare_uint(const void *a, const void *b) {
+        unsigned x = PTR_TO_UINT(a), y = PTR_TO_UINT(b);
+
+        return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void bench_prioq_put_pop(Bench *b, uint64_t n, void *userdata) {
+        Prioq *q = userdata;
+        uint64_t i;
+
+        /* Keep the queue at its size, every operation is one
+         * insertion plus one removal */
+        for (i = 0; i < n; i++) {
+                assert_se(prioq_put(q, UINT_TO_PTR(random_u32() | 1), NULL) >= 0);
+                assert_se(prioq_pop(q));
+        }
+}
+
+int main(int argc, char *argv[]) {
+        Hashmap *h, *hs;
+        Prioq *q;
+        Set *s;
+        unsigned i;
+        int r;
+
+        r = bench_parse_argv(argc, argv);
+        if (r != 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        assert_se(keys = new0(char*, N_ENTRIES + 1));
+        assert_se(h = hashmap_new(NULL));
+        assert_se(hs = hashmap_new(&string_hash_ops));
+        assert_se(s = set_new(NULL));
+        assert_se(q = prioq_new(compare_uint));
+
+        for (i = 0; i < N_ENTRIES; i++) {
+                assert_se(asprintf(&keys[i], "key-%u-%08x", i, random_u32()) >= 0);
+
+                assert_se(hashmap_put(h, UINT_TO_PTR(i + 1), UINT_TO_PTR(i + 1)) > 0);
+                assert_se(hashmap_put(hs, keys[i], keys[i]) > 0);
+                assert_se(set_put(s, UINT_TO_PTR(i + 1)) > 0);
+                assert_se(prioq_put(q, UINT_TO_PTR(random_u32() | 1), NULL) >= 0);
+        }
+
+        bench_run("hashmap-put", bench_hashmap_put, NULL);
+        bench_run("hashmap-get", bench_hashmap_get, h);
+        bench_run("hashmap-get-string", bench_hashmap_get_string, hs);
+        bench_run("hashmap-iterate", bench_hashmap_iterate, h);
+        bench_run("set-put-remove", bench_set_put_remove, s);
+        bench_run("set-contains", bench_set_contains, s);
+        bench_run("prioq-put-pop", bench_prioq_put_pop, q);
+
+        prioq_free(q);
+        set_free(s);
+        hashmap_free(hs);
+        hashmap_free(h);
+        strv_free(keys);
+
+        return bench_finish();
+}
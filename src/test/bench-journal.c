@@ -0,0 +1,240 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+#include "sd-event.h"
+#include "util.h"
+#include "rm-rf.h"
+#include "cgroup-util.h"
+#include "journal-file.h"
+#include "journald-server.h"
+#include "bench.h"
+
+/* A file is replaced by a new one after this many entries, so that
+ * long runs measure appending, not a huge file */
+#define ENTRIES_PER_FILE 100000U
+
+/* Native messages are sent in bursts of this size, like a busy client
+ * queues them up before journald gets to read */
+#define INGEST_BURST 16U
+
+static char dir[] = "/tmp/bench-journal-XXXXXX";
+
+static void open_journal(const char *name, JournalFile **f) {
+        const char *p;
+
+        p = strjoina(dir, "/", name);
+
+        if (*f) {
+                journal_file_close(*f);
+                *f = NULL;
+        }
+        (void) unlink(p);
+
+        assert_se(journal_file_open(p, O_RDWR|O_CREAT, 0644, true, false, NULL, NULL, NULL, f) >= 0);
+}
+
+static void append_one(JournalFile *f, uint64_t i) {
+        char message[sizeof("MESSAGE=Handled request ") + DECIMAL_STR_MAX(uint64_t)];
+        struct iovec iovec[5];
+        dual_timestamp ts;
+
+        /* One field that is different for every entry, plus the usual
+         * ones that repeat */
+        xsprintf(message, "MESSAGE=Handled request %" PRIu64, i);
+
+        IOVEC_SET_STRING(iovec[0], message);
+        IOVEC_SET_STRING(iovec[1], "PRIORITY=6");
+        IOVEC_SET_STRING(iovec[2], "SYSLOG_IDENTIFIER=bench-journal");
+        IOVEC_SET_STRING(iovec[3], "_SYSTEMD_UNIT=bench.service");
+        IOVEC_SET_STRING(iovec[4], "CODE_FUNC=append_one");
+
+        dual_timestamp_get(&ts);
+        assert_se(journal_file_append_entry(f, &ts, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL) >= 0);
+}
+
+static void bench_append(Bench *b, uint64_t n, void *userdata) {
+        JournalFile *f = NULL;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                if (i % ENTRIES_PER_FILE == 0) {
+                        bench_pause(b);
+                        open_journal("append.journal", &f);
+                        bench_resume(b);
+                }
+
+                append_one(f, i);
+        }
+
+        bench_pause(b);
+        journal_file_close(f);
+}
+
+static void bench_read_file(Bench *b, uint64_t n, void *userdata) {
+        JournalFile *f = userdata;
+        uint64_t i, p = 0;
+        Object *o;
+
+        for (i = 0; i < n; i++) {
+                int r;
+
+                r = journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p);
+                assert_se(r >= 0);
+
+                /* Start over at the end */
+                if (r == 0)
+                        assert_se(journal_file_next_entry(f, 0, DIRECTION_DOWN, &o, &p) > 0);
+        }
+}
+
+static void bench_read(Bench *b, uint64_t n, void *userdata) {
+        sd_journal *j = userdata;
+        uint64_t i;
+
+        assert_se(sd_journal_seek_head(j) >= 0);
+
+        for (i = 0; i < n; i++) {
+                const void *data;
+                size_t size;
+                int r;
+
+                r = sd_journal_next(j);
+                assert_se(r >= 0);
+
+                if (r == 0) {
+                        assert_se(sd_journal_seek_head(j) >= 0);
+                        assert_se(sd_journal_next(j) > 0);
+                }
+
+                assert_se(sd_journal_get_data(j, "MESSAGE", &data, &size) >= 0);
+        }
+}
+
+static void server_setup(Server *s, int fd) {
+        sd_id128_t id;
+
+        /* Just enough of a journald to take native messages from fd,
+         * with all forwarding turned off */
+        zero(*s);
+        s->syslog_fd = s->stdout_fd = s->dev_kmsg_fd = s->audit_fd = s->hostname_fd = -1;
+        s->native_fd = fd;
+        s->storage = STORAGE_VOLATILE;
+        s->compress = true;
+        s->max_level_store = LOG_DEBUG;
+
+        assert_se(sd_event_new(&s->event) >= 0);
+        assert_se(s->client_contexts = client_context_cache_new(USEC_PER_SEC));
+        (void) cg_get_root_path(&s->cgroup_root);
+
+        if (sd_id128_get_machine(&id) >= 0)
+                sd_id128_to_string(id, stpcpy(s->machine_id_field, "_MACHINE_ID="));
+        if (sd_id128_get_boot(&id) >= 0)
+                sd_id128_to_string(id, stpcpy(s->boot_id_field, "_BOOT_ID="));
+}
+
+static void bench_ingest(Bench *b, uint64_t n, void *userdata) {
+        int *pair = userdata;
+        uint64_t i;
+        Server s;
+
+        bench_pause(b);
+        server_setup(&s, pair[0]);
+        bench_resume(b);
+
+        for (i = 0; i < n; i++) {
+                char message[sizeof("MESSAGE=Handled request \nPRIORITY=6\nSYSLOG_IDENTIFIER=bench-journal\n") + DECIMAL_STR_MAX(uint64_t)];
+
+                if (i % ENTRIES_PER_FILE == 0) {
+                        bench_pause(b);
+                        server_flush_pending(&s);
+                        open_journal("ingest.journal", &s.runtime_journal);
+                        bench_resume(b);
+                }
+
+                xsprintf(message,
+                         "MESSAGE=Handled request %" PRIu64 "\n"
+                         "PRIORITY=6\n"
+                         "SYSLOG_IDENTIFIER=bench-journal\n", i);
+
+                assert_se(send(pair[1], message, strlen(message), MSG_NOSIGNAL) >= 0);
+
+                /* Read and write the burst, like the event loop would */
+                if ((i + 1) % INGEST_BURST == 0 || i + 1 == n) {
+                        assert_se(server_process_datagram(NULL, pair[0], EPOLLIN, &s) >= 0);
+                        server_flush_pending(&s);
+                }
+        }
+
+        bench_pause(b);
+
+        /* The socket is reused by the next run */
+        s.native_fd = -1;
+        server_done(&s);
+}
+
+int main(int argc, char *argv[]) {
+        JournalFile *f = NULL;
+        sd_journal *j;
+        const char *p;
+        uint64_t i;
+        int pair[2], one = 1, r;
+
+        r = bench_parse_argv(argc, argv);
+        if (r != 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        log_set_max_level(LOG_WARNING);
+
+        assert_se(mkdtemp(dir));
+
+        bench_run("journal-append", bench_append, NULL);
+
+        /* The read benchmarks share one file, in a directory of its
+         * own */
+        p = strjoina(dir, "/read");
+        assert_se(mkdir(p, 0755) >= 0);
+
+        open_journal("read/read.journal", &f);
+        for (i = 0; i < ENTRIES_PER_FILE; i++)
+                append_one(f, i);
+
+        bench_run("journal-read-file", bench_read_file, f);
+
+        assert_se(sd_journal_open_directory(&j, p, 0) >= 0);
+        bench_run("journal-read", bench_read, j);
+
+        sd_journal_close(j);
+        journal_file_close(f);
+
+        assert_se(socketpair(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, pair) >= 0);
+        assert_se(setsockopt(pair[0], SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) >= 0);
+
+        bench_run("journald-ingest", bench_ingest, pair);
+
+        safe_close_pair(pair);
+        (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+
+        return bench_finish();
+}
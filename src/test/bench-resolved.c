@@ -0,0 +1,131 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <netinet/in.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "in-addr-util.h"
+#include "resolved-dns-cache.h"
+#include "bench.h"
+
+/* Fewer names than fit into a cache of the default size, so that
+ * nothing is evicted */
+#define N_NAMES 1024U
+
+typedef struct Context {
+        DnsCache cache;
+        DnsQuestion *questions[N_NAMES];
+        DnsAnswer *answers[N_NAMES];
+        DnsResourceKey *missing[N_NAMES];
+        union in_addr_union owner;
+} Context;
+
+static void cache_put(Context *c, unsigned k) {
+        assert_se(dns_cache_put(&c->cache, c->questions[k], DNS_RCODE_SUCCESS, c->answers[k], c->answers[k]->n_rrs, 0, AF_INET, &c->owner) >= 0);
+}
+
+static void bench_cache_put(Bench *b, uint64_t n, void *userdata) {
+        Context *c = userdata;
+        uint64_t i;
+
+        /* Every put replaces the entries of a name */
+        for (i = 0; i < n; i++)
+                cache_put(c, i % N_NAMES);
+}
+
+static void bench_cache_lookup(Bench *b, uint64_t n, void *userdata) {
+        Context *c = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+                int rcode;
+
+                assert_se(dns_cache_lookup(&c->cache, c->questions[i % N_NAMES]->keys[0], &rcode, &answer) > 0);
+                assert_se(answer);
+        }
+}
+
+static void bench_cache_lookup_miss(Bench *b, uint64_t n, void *userdata) {
+        Context *c = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+                int rcode;
+
+                assert_se(dns_cache_lookup(&c->cache, c->missing[i % N_NAMES], &rcode, &answer) == 0);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        Context c = {};
+        unsigned i;
+        int r;
+
+        r = bench_parse_argv(argc, argv);
+        if (r != 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        log_set_max_level(LOG_WARNING);
+
+        c.cache.max_bytes = DNS_CACHE_SIZE_DEFAULT;
+        c.owner.in.s_addr = htobe32(0xc0000201); /* 192.0.2.1 */
+
+        for (i = 0; i < N_NAMES; i++) {
+                _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+                _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+                char name[sizeof("host-.example.com") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(name, "host-%u.example.com", i);
+
+                assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, name));
+                assert_se(c.questions[i] = dns_question_new(1));
+                assert_se(dns_question_add(c.questions[i], key) >= 0);
+
+                assert_se(rr = dns_resource_record_new(key));
+                rr->ttl = 3600;
+                rr->a.in_addr.s_addr = htobe32(0xc6336400 | (i & 0xff)); /* 198.51.100.x */
+
+                assert_se(c.answers[i] = dns_answer_new(1));
+                assert_se(dns_answer_add(c.answers[i], rr, 0) >= 0);
+
+                xsprintf(name, "host-%u.example.net", i);
+                assert_se(c.missing[i] = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, name));
+        }
+
+        bench_run("dns-cache-put", bench_cache_put, &c);
+
+        for (i = 0; i < N_NAMES; i++)
+                cache_put(&c, i);
+
+        bench_run("dns-cache-lookup", bench_cache_lookup, &c);
+        bench_run("dns-cache-lookup-miss", bench_cache_lookup_miss, &c);
+
+        dns_cache_flush(&c.cache);
+
+        for (i = 0; i < N_NAMES; i++) {
+                dns_question_unref(c.questions[i]);
+                dns_answer_unref(c.answers[i]);
+                dns_resource_key_unref(c.missing[i]);
+        }
+
+        return bench_finish();
+}
@@ -0,0 +1,90 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "util.h"
+#include "udev.h"
+#include "udev-util.h"
+#include "bench.h"
+
+/* The benchmarks run against the rules installed on the system, so
+ * numbers are only comparable between runs on the same machine. The
+ * device must exist, and shouldn't have rules that run programs. */
+#define BENCH_SYSPATH "/sys/devices/virtual/mem/null"
+
+typedef struct Context {
+        struct udev *udev;
+        struct udev_rules *rules;
+        struct udev_device *dev;
+} Context;
+
+static void bench_rules_load(Bench *b, uint64_t n, void *userdata) {
+        Context *c = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                struct udev_rules *rules;
+
+                assert_se(rules = udev_rules_new(c->udev, 1));
+                udev_rules_unref(rules);
+        }
+}
+
+static void bench_rules_apply(Bench *b, uint64_t n, void *userdata) {
+        Context *c = userdata;
+        uint64_t i;
+
+        for (i = 0; i < n; i++) {
+                _cleanup_udev_event_unref_ struct udev_event *event = NULL;
+
+                assert_se(event = udev_event_new(c->dev));
+                assert_se(udev_rules_apply_to_event(c->rules, event, USEC_INFINITY, USEC_INFINITY, NULL) >= 0);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        Context c = {};
+        int r;
+
+        r = bench_parse_argv(argc, argv);
+        if (r != 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        log_set_max_level(LOG_WARNING);
+
+        assert_se(c.udev = udev_new());
+
+        c.dev = udev_device_new_from_synthetic_event(c.udev, BENCH_SYSPATH, "change");
+        if (!c.dev) {
+                log_error_errno(errno, "Failed to open " BENCH_SYSPATH ": %m");
+                return EXIT_TEST_SKIP;
+        }
+
+        bench_run("udev-rules-load", bench_rules_load, &c);
+
+        assert_se(c.rules = udev_rules_new(c.udev, 1));
+        bench_run("udev-rules-apply", bench_rules_apply, &c);
+
+        udev_rules_unref(c.rules);
+        udev_device_unref(c.dev);
+        udev_unref(c.udev);
+
+        return bench_finish();
+}
@@ -0,0 +1,237 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fnmatch.h>
+#include <getopt.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "strv.h"
+#include "time-util.h"
+#include "bench.h"
+
+/* The first runs warm up caches and the allocator, and estimate how
+ * many iterations the measured run needs */
+#define BENCH_WARMUP_DIVISOR 10
+#define BENCH_N_MAX ((uint64_t) 1000000000)
+
+struct Bench {
+        uint64_t start_nsec, elapsed_nsec;
+        uint64_t start_allocs, allocs;
+        bool paused;
+};
+
+static bool arg_json = false;
+static usec_t arg_time = 500 * USEC_PER_MSEC;
+static char **arg_patterns = NULL;
+
+/* Allocations are counted by wrapping the allocator of the C library.
+ * This only works if nothing else (valgrind, a sanitizer) replaces
+ * it, which is fine for benchmarks. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static uint64_t n_allocs = 0;
+
+void *malloc(size_t size) {
+        __sync_fetch_and_add(&n_allocs, 1);
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+        __sync_fetch_and_add(&n_allocs, 1);
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *p, size_t size) {
+        __sync_fetch_and_add(&n_allocs, 1);
+        return __libc_realloc(p, size);
+}
+
+void bench_pause(Bench *b) {
+        assert(b);
+
+        if (b->paused)
+                return;
+
+        b->elapsed_nsec += now_nsec(CLOCK_MONOTONIC) - b->start_nsec;
+        b->allocs += __sync_fetch_and_add(&n_allocs, 0) - b->start_allocs;
+        b->paused = true;
+}
+
+void bench_resume(Bench *b) {
+        assert(b);
+
+        if (!b->paused)
+                return;
+
+        b->paused = false;
+        b->start_allocs = __sync_fetch_and_add(&n_allocs, 0);
+        b->start_nsec = now_nsec(CLOCK_MONOTONIC);
+}
+
+static void bench_run_once(Bench *b, bench_func_t func, uint64_t n, void *userdata) {
+        zero(*b);
+        b->paused = true;
+
+        bench_resume(b);
+        func(b, n, userdata);
+        bench_pause(b);
+}
+
+static uint64_t bench_predict(uint64_t n, uint64_t elapsed_nsec, uint64_t target_nsec) {
+        uint64_t m;
+
+        /* Aim a bit higher than needed, but grow by at most a factor
+         * of 100 per run, the first runs are not representative */
+        if (elapsed_nsec == 0)
+                m = n * 100;
+        else
+                m = n * target_nsec / elapsed_nsec;
+
+        m += m / 5;
+        m = CLAMP(m, n + 1, n * 100);
+
+        return MIN(m, BENCH_N_MAX);
+}
+
+static bool bench_selected(const char *name) {
+        char **p;
+
+        if (strv_isempty(arg_patterns))
+                return true;
+
+        STRV_FOREACH(p, arg_patterns)
+                if (fnmatch(*p, name, 0) == 0)
+                        return true;
+
+        return false;
+}
+
+void bench_run(const char *name, bench_func_t func, void *userdata) {
+        uint64_t n = 1, target_nsec;
+        Bench b;
+
+        assert(name);
+        assert(!strchr(name, '"'));
+        assert(func);
+
+        if (!bench_selected(name))
+                return;
+
+        target_nsec = arg_time * NSEC_PER_USEC;
+
+        /* Warm up */
+        for (;;) {
+                bench_run_once(&b, func, n, userdata);
+
+                if (b.elapsed_nsec >= target_nsec / BENCH_WARMUP_DIVISOR || n >= BENCH_N_MAX)
+                        break;
+
+                n = bench_predict(n, b.elapsed_nsec, target_nsec / BENCH_WARMUP_DIVISOR);
+        }
+
+        /* The measured run */
+        n = MIN(n * BENCH_WARMUP_DIVISOR, BENCH_N_MAX);
+        bench_run_once(&b, func, n, userdata);
+
+        if (arg_json)
+                printf("{\"suite\":\"%s\",\"name\":\"%s\",\"iterations\":%" PRIu64 ",\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f}\n",
+                       program_invocation_short_name, name, n,
+                       (double) b.elapsed_nsec / n,
+                       (double) b.allocs / n);
+        else
+                printf("%-40s %12" PRIu64 " %12.1f ns/op %10.2f allocs/op\n",
+                       name, n,
+                       (double) b.elapsed_nsec / n,
+                       (double) b.allocs / n);
+
+        fflush(stdout);
+}
+
+static void help(void) {
+        printf("%s [OPTIONS...] [PATTERN...]\n\n"
+               "Run benchmarks.\n\n"
+               "  -h --help        Show this help\n"
+               "     --json        Output one JSON object per benchmark\n"
+               "     --time=SEC    Minimum duration of each measured run\n",
+               program_invocation_short_name);
+}
+
+int bench_parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_JSON = 0x100,
+                ARG_TIME,
+        };
+
+        static const struct option options[] = {
+                { "help", no_argument,       NULL, 'h'      },
+                { "json", no_argument,       NULL, ARG_JSON },
+                { "time", required_argument, NULL, ARG_TIME },
+                {}
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0)
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 1;
+
+                case ARG_JSON:
+                        arg_json = true;
+                        break;
+
+                case ARG_TIME:
+                        r = parse_sec(optarg, &arg_time);
+                        if (r < 0 || arg_time == 0) {
+                                log_error("Failed to parse duration: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        assert_not_reached("Unhandled option");
+                }
+
+        if (optind < argc) {
+                arg_patterns = strv_copy(argv + optind);
+                if (!arg_patterns)
+                        return log_oom();
+        }
+
+        return 0;
+}
+
+int bench_finish(void) {
+        arg_patterns = strv_free(arg_patterns);
+
+        return EXIT_SUCCESS;
+}
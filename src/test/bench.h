@@ -0,0 +1,51 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdint.h>
+
+typedef struct Bench Bench;
+
+/* Runs the operation under test n times. The runner calls it with a
+ * growing n until a run takes long enough to be measured, and reports
+ * the time and the number of allocations per operation of the last
+ * run. Setup that should not be measured may be done before the loop,
+ * or between bench_pause() and bench_resume(). */
+typedef void (*bench_func_t)(Bench *b, uint64_t n, void *userdata);
+
+/* Parses the common command line of all benchmark programs:
+ *
+ *   --json      print one JSON object per benchmark instead of a table
+ *   --time=SEC  minimum duration of a measured run (default: 0.5s)
+ *   PATTERN...  only run benchmarks whose name matches one of the
+ *               shell patterns
+ *
+ * Returns 0 if the benchmarks shall run, > 0 if the program shall
+ * exit successfully (after --help), < 0 on error. */
+int bench_parse_argv(int argc, char *argv[]);
+
+void bench_run(const char *name, bench_func_t func, void *userdata);
+
+void bench_pause(Bench *b);
+void bench_resume(Bench *b);
+
+/* Frees what bench_parse_argv() allocated, and returns the exit code
+ * of the program. */
+int bench_finish(void);
@@ -33,8 +33,9 @@ int main(int argc, char *argv[]) {
         if (fd < 0)
                 log_error_errno(errno, "Failed to open root directory: %m");
         else {
-                BtrfsSubvolInfo info;
+                BtrfsSubvolInfo info = {};
                 BtrfsQuotaInfo quota;
+                Hashmap *all;
                 char ts[FORMAT_TIMESTAMP_MAX], bs[FORMAT_BYTES_MAX];
 
                 r = btrfs_subvol_get_info_fd(fd, &info);
@@ -55,6 +56,18 @@ int main(int argc, char *argv[]) {
                         log_info("exclusive_max: %s", strna(format_bytes(bs, sizeof(bs), quota.exclusive_max)));
                 }
 
+                r = btrfs_quota_get_all_fd(fd, &all);
+                if (r < 0)
+                        log_error_errno(r, "Failed to get quota info of all subvolumes: %m");
+                else {
+                        BtrfsQuotaEntry *e;
+
+                        e = hashmap_get(all, &info.subvol_id);
+                        log_info("qgroups: %u", hashmap_size(all));
+                        log_info("referenced (all): %s", e ? strna(format_bytes(bs, sizeof(bs), e->quota.referenced)) : "n/a");
+                        hashmap_free_free(all);
+                }
+
                 r = btrfs_subvol_get_read_only_fd(fd);
                 if (r < 0)
                         log_error_errno(r, "Failed to get read only flag: %m");
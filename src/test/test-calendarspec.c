@@ -50,6 +50,220 @@ static void test_one(const char *input, const char *output) {
         assert_se(streq(q, p));
 }
 
+static void test_next(const char *input, const char *new_tz, usec_t after, usec_t expect) {
+        CalendarSpec *c;
+        usec_t u;
+        char *old_tz;
+        int r;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        if (new_tz)
+                assert_se(setenv("TZ", new_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+
+        printf("\"%s\", after %"PRIu64": ", input, after);
+
+        r = calendar_spec_next_usec(c, after, &u);
+        if (r < 0)
+                printf("%s\n", strerror(-r));
+        else
+                printf("%"PRIu64"\n", u);
+
+        if (expect != (usec_t) -1)
+                assert_se(r >= 0 && u == expect);
+        else
+                assert_se(r == -ENOENT);
+
+        calendar_spec_free(c);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static bool chain_matches(const CalendarComponent *c, int v) {
+        if (!c)
+                return true;
+
+        for (; c; c = c->next)
+                if (v == c->value || (c->repeat > 0 && v > c->value && (v - c->value) % c->repeat == 0))
+                        return true;
+
+        return false;
+}
+
+/* Walks forward day by day and second by second, as obviously
+ * correct reference for calendar_spec_next_usec() in UTC */
+static int next_brute_force(const CalendarSpec *spec, usec_t usec, usec_t *next) {
+        const CalendarComponent *k;
+        int year_max = spec->year ? 0 : 9999;
+        struct tm tm;
+        time_t t, day;
+
+        for (k = spec->year; k; k = k->next)
+                year_max = MAX(year_max, k->repeat > 0 ? 9999 : k->value);
+
+        t = (time_t) (usec / USEC_PER_SEC) + 1;
+        assert_se(gmtime_r(&t, &tm));
+
+        for (day = t - (tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec); ; day += 24 * 3600) {
+                struct tm d;
+                int h, m, s;
+
+                assert_se(gmtime_r(&day, &d));
+
+                if (d.tm_year + 1900 > year_max)
+                        return -ENOENT;
+
+                if (!chain_matches(spec->year, d.tm_year + 1900) ||
+                    !chain_matches(spec->month, d.tm_mon + 1) ||
+                    !chain_matches(spec->day, d.tm_mday))
+                        continue;
+
+                if (spec->weekdays_bits > 0 && spec->weekdays_bits < 127 &&
+                    !(spec->weekdays_bits & (1 << ((d.tm_wday + 6) % 7))))
+                        continue;
+
+                for (h = 0; h < 24; h++) {
+                        if (!chain_matches(spec->hour, h))
+                                continue;
+
+                        for (m = 0; m < 60; m++) {
+                                if (!chain_matches(spec->minute, m))
+                                        continue;
+
+                                for (s = 0; s < 60; s++) {
+                                        if (!chain_matches(spec->second, s))
+                                                continue;
+
+                                        if (day + h * 3600 + m * 60 + s >= t) {
+                                                *next = (usec_t) (day + h * 3600 + m * 60 + s) * USEC_PER_SEC;
+                                                return 0;
+                                        }
+                                }
+                        }
+                }
+        }
+}
+
+static void random_chain(FILE *f, int from, int to) {
+        unsigned n;
+
+        switch (random() % 4) {
+
+        case 0:
+                fputc('*', f);
+                return;
+
+        case 1:
+                fprintf(f, "%i/%i", from + (int) (random() % (to - from + 1) / 2), 1 + (int) (random() % ((to - from) / 2 + 1)));
+                return;
+
+        default:
+                for (n = 1 + random() % 3; n > 0; n--)
+                        fprintf(f, "%i%s", from + (int) (random() % (to - from + 1)), n > 1 ? "," : "");
+        }
+}
+
+static void test_fuzz(void) {
+        static const char *const days[] = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" };
+        unsigned i, j;
+
+        assert_se(setenv("TZ", "UTC", 1) >= 0);
+        tzset();
+
+        srandom(4711);
+
+        for (i = 0; i < 2000; i++) {
+                _cleanup_free_ char *p = NULL;
+                CalendarSpec *c;
+                size_t size;
+                FILE *f;
+
+                f = open_memstream(&p, &size);
+                assert_se(f);
+
+                if (random() % 3 == 0)
+                        fprintf(f, "%s,%s ", days[random() % 7], days[random() % 7]);
+
+                if (random() % 4 == 0)
+                        fprintf(f, "%i", 2015 + (int) (random() % 30));
+                else
+                        fputc('*', f);
+                fputc('-', f);
+                random_chain(f, 1, 12);
+                fputc('-', f);
+                random_chain(f, 1, 31);
+                fputc(' ', f);
+                random_chain(f, 0, 23);
+                fputc(':', f);
+                random_chain(f, 0, 59);
+                fputc(':', f);
+                random_chain(f, 0, 59);
+
+                assert_se(fclose(f) == 0);
+
+                if (calendar_spec_from_string(p, &c) < 0)
+                        continue;
+
+                for (j = 0; j < 5; j++) {
+                        usec_t after, a = 0, b = 0;
+                        int ra, rb;
+
+                        after = (UINT64_C(1420070400) + random() % (10 * 365 * 24 * 3600)) * USEC_PER_SEC + random() % USEC_PER_SEC;
+
+                        ra = calendar_spec_next_usec(c, after, &a);
+                        rb = next_brute_force(c, after, &b);
+
+                        if (ra != rb || a != b) {
+                                log_error("\"%s\" after %"PRIu64": got %i/%"PRIu64", expected %i/%"PRIu64, p, after, ra, a, rb, b);
+                                assert_not_reached("calendar_spec_next_usec() mismatch");
+                        }
+                }
+
+                calendar_spec_free(c);
+        }
+
+        assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static void test_benchmark(void) {
+        static const char *const specs[] = {
+                "*-*-* *:*:00",
+                "*-*-* 00:00:00",
+                "Mon *-*-* 05:40:00",
+                "Fri *-*-13 12:00:00",
+                "*-02-29 03:04:05",
+        };
+        unsigned i, j;
+
+        for (i = 0; i < ELEMENTSOF(specs); i++) {
+                CalendarSpec *c;
+                usec_t u, ts;
+
+                assert_se(calendar_spec_from_string(specs[i], &c) >= 0);
+
+                ts = now(CLOCK_MONOTONIC);
+
+                for (j = 0; j < 10000; j++)
+                        assert_se(calendar_spec_next_usec(c, (UINT64_C(1420070400) + j * 7 * 60) * USEC_PER_SEC, &u) >= 0);
+
+                log_info("\"%s\": %"PRIu64" ns per calculation", specs[i], (now(CLOCK_MONOTONIC) - ts) * NSEC_PER_USEC / 10000);
+
+                calendar_spec_free(c);
+        }
+}
+
 int main(int argc, char* argv[]) {
         CalendarSpec *c;
 
@@ -88,5 +302,15 @@ int main(int argc, char* argv[]) {
         assert_se(calendar_spec_from_string("7", &c) < 0);
         assert_se(calendar_spec_from_string("121212:1:2", &c) < 0);
 
+        test_next("2016-03-27 03:17:00", "", 12345, 1459048620000000);
+        test_next("2016-03-27 03:17:00", "CET-1CEST,M3.5.0,M10.5.0/3", 12345, 1459041420000000);
+        test_next("2016-03-27 03:17:00", "EET-2EEST,M3.5.0/3,M10.5.0/4", 12345, -1);
+        test_next("Fri *-*-13 12:00:00", "UTC", 1445990400000000, 1447416000000000);
+        test_next("*-02-29 00:00:00", "UTC", 1456790400000000, 1582934400000000);
+        test_next("*-02-30 00:00:00", "UTC", 0, -1);
+
+        test_fuzz();
+        test_benchmark();
+
         return 0;
 }
@@ -21,6 +21,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "conf-files.h"
 #include "macro.h"
@@ -77,8 +79,74 @@ static void test_conf_files_list(bool use_root) {
         assert_se(rm_rf(tmp_dir, REMOVE_ROOT|REMOVE_PHYSICAL) == 0);
 }
 
+static void test_conf_files_list_cached(void) {
+        char tmp_dir[] = "/tmp/test-conf-files-XXXXXX";
+        _cleanup_dir_cache_free_ DirCache *cache = NULL;
+        const DirCacheEntry *entries, *again;
+        struct timespec ts[2] = {
+                { .tv_sec = 1000000000 },
+                { .tv_sec = 1000000000 },
+        };
+        const char *dir1, *dir2, *missing, *a, *b, *c;
+        size_t n;
+
+        setup_test_dir(tmp_dir,
+                       "/dir1/a.conf",
+                       "/dir2/a.conf",
+                       "/dir2/b.conf",
+                       "/dir2/b.conf~",
+                       NULL);
+
+        dir1 = strjoina(tmp_dir, "/dir1");
+        dir2 = strjoina(tmp_dir, "/dir2");
+        missing = strjoina(tmp_dir, "/missing");
+        a = strjoina(dir1, "/a.conf");
+        b = strjoina(dir2, "/b.conf");
+        c = strjoina(dir2, "/c.conf");
+
+        /* Pretend the directories were last changed long ago, so
+         * that the cache trusts their mtime */
+        assert_se(utimensat(AT_FDCWD, dir1, ts, 0) == 0);
+        assert_se(utimensat(AT_FDCWD, dir2, ts, 0) == 0);
+
+        cache = dir_cache_new();
+        assert_se(cache);
+
+        assert_se(dir_cache_get(cache, missing, &entries, &n) == 0);
+        assert_se(!entries && n == 0);
+
+        assert_se(dir_cache_get(cache, dir2, &entries, &n) == 1);
+        assert_se(n == 3);
+        assert_se(dir_cache_get(cache, dir2, &again, &n) == 1);
+        assert_se(again == entries && n == 3);
+
+        {
+                _cleanup_strv_free_ char **found_files = NULL;
+
+                assert_se(conf_files_list_strv_cached(&found_files, ".conf", NULL, (const char* const*) STRV_MAKE(dir1, dir2, missing), cache) == 0);
+                assert_se(strv_equal(found_files, STRV_MAKE(a, b)));
+        }
+
+        /* A new file changes the mtime of the directory */
+        assert_se(touch(c) >= 0);
+        ts[0].tv_sec = ts[1].tv_sec = 1000000001;
+        assert_se(utimensat(AT_FDCWD, dir2, ts, 0) == 0);
+
+        {
+                _cleanup_strv_free_ char **found_files = NULL;
+
+                assert_se(conf_files_list_strv_cached(&found_files, ".conf", NULL, (const char* const*) STRV_MAKE(dir1, dir2), cache) == 0);
+                assert_se(strv_equal(found_files, STRV_MAKE(a, b, c)));
+        }
+
+        assert_se(rm_rf(tmp_dir, REMOVE_ROOT|REMOVE_PHYSICAL) == 0);
+
+        assert_se(dir_cache_get(cache, dir2, &entries, &n) == 0);
+}
+
 int main(int argc, char **argv) {
         test_conf_files_list(false);
         test_conf_files_list(true);
+        test_conf_files_list_cached();
         return 0;
 }
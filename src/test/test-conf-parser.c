@@ -22,6 +22,7 @@
 #include "util.h"
 #include "strv.h"
 #include "log.h"
+#include "fileio.h"
 
 static void test_config_parse_path_one(const char *rvalue, const char *expected) {
         char *path = NULL;
@@ -214,6 +215,47 @@ static void test_config_parse_nsec(void) {
         test_config_parse_nsec_one("garbage", 0);
 }
 
+static void test_config_parse_file(void) {
+        char name[] = "/tmp/test-conf-parser.XXXXXX";
+        _cleanup_close_ int fd = -1;
+        _cleanup_free_ char *a = NULL, *b = NULL, *c = NULL;
+        _cleanup_strv_free_ char **d = NULL;
+        const ConfigTableItem items[] = {
+                { "Section", "A", config_parse_string, 0, &a },
+                { "Section", "B", config_parse_string, 0, &b },
+                { "Other",   "C", config_parse_string, 0, &c },
+                { "Other",   "D", config_parse_strv,   0, &d },
+                {}
+        };
+
+        fd = mkostemp_safe(name, O_RDWR|O_CLOEXEC);
+        assert_se(fd >= 0);
+        assert_se(write_string_file(name,
+                                    "# comment\n"
+                                    "[Section]\n"
+                                    "  A =  foo  \n"
+                                    "B=bar\r\n"
+                                    "[Ignored]\n"
+                                    "C=ignored\n"
+                                    "[Other]\n"
+                                    "C=one \\\n"
+                                    "two\\\n"
+                                    "three\n"
+                                    "D=x y\n"
+                                    "D=z\n"
+                                    "B=dangling \\", 0) >= 0);
+
+        assert_se(config_parse(NULL, name, NULL, "Section\0Other\0",
+                               config_item_table_lookup, items, true, false, true, NULL) == 0);
+
+        assert_se(streq_ptr(a, "foo"));
+        assert_se(streq_ptr(b, "bar"));
+        assert_se(streq_ptr(c, "one  two three"));
+        assert_se(strv_equal(d, STRV_MAKE("x", "y", "z")));
+
+        unlink(name);
+}
+
 int main(int argc, char **argv) {
         log_parse_environment();
         log_open();
@@ -229,6 +271,7 @@ int main(int argc, char **argv) {
         test_config_parse_mode();
         test_config_parse_sec();
         test_config_parse_nsec();
+        test_config_parse_file();
 
         return 0;
 }
@@ -133,6 +133,50 @@ static void test_copy_tree(void) {
         (void) rm_rf(original_dir, REMOVE_ROOT|REMOVE_PHYSICAL);
 }
 
+static void test_copy_tree_sparse(void) {
+        char original_dir[] = "/tmp/test-copy_tree_sparse/";
+        char copy_dir[] = "/tmp/test-copy_tree_sparse-copy/";
+        _cleanup_close_ int fd = -1;
+        char buf[4096], *f, *c;
+        struct stat st;
+        size_t i;
+
+        (void) rm_rf(copy_dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+        (void) rm_rf(original_dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+
+        f = strjoina(original_dir, "sparse");
+        assert_se(mkdir_parents(f, 0755) >= 0);
+
+        /* Data, then a hole, then data, then a trailing hole */
+        fd = open(f, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+        assert_se(fd >= 0);
+        assert_se(write(fd, "head", 4) == 4);
+        assert_se(lseek(fd, 4*1024*1024, SEEK_SET) >= 0);
+        assert_se(write(fd, "tail", 4) == 4);
+        assert_se(ftruncate(fd, 8*1024*1024) >= 0);
+        fd = safe_close(fd);
+
+        assert_se(copy_tree(original_dir, copy_dir, false) == 0);
+
+        c = strjoina(copy_dir, "sparse");
+        assert_se(stat(c, &st) >= 0);
+        assert_se(st.st_size == 8*1024*1024);
+
+        fd = open(c, O_RDONLY|O_CLOEXEC);
+        assert_se(fd >= 0);
+        assert_se(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        assert_se(memcmp(buf, "head", 4) == 0);
+        for (i = 4; i < sizeof(buf); i++)
+                assert_se(buf[i] == 0);
+        assert_se(pread(fd, buf, sizeof(buf), 4*1024*1024) == sizeof(buf));
+        assert_se(memcmp(buf, "tail", 4) == 0);
+        for (i = 4; i < sizeof(buf); i++)
+                assert_se(buf[i] == 0);
+
+        (void) rm_rf(copy_dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+        (void) rm_rf(original_dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+}
+
 static void test_copy_bytes(void) {
         _cleanup_close_pair_ int pipefd[2] = {-1, -1};
         _cleanup_close_ int infd = -1;
@@ -173,6 +217,7 @@ int main(int argc, char *argv[]) {
         test_copy_file();
         test_copy_file_fd();
         test_copy_tree();
+        test_copy_tree_sparse();
         test_copy_bytes();
 
         return 0;
@@ -0,0 +1,283 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <netinet/in.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "in-addr-util.h"
+#include "resolved-dns-cache.h"
+
+#define N_NAMES 8U
+
+/* Large enough for the RRsets of all names together not to fit into
+ * a single DNS packet */
+#define N_RRSET 600U
+
+static DnsQuestion *questions[N_NAMES];
+static DnsAnswer *answers[N_NAMES];
+static union in_addr_union owner;
+
+static void setup(void) {
+        unsigned i;
+
+        owner.in.s_addr = htobe32(0xc0000201); /* 192.0.2.1 */
+
+        for (i = 0; i < N_NAMES; i++) {
+                _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+                _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+                char name[sizeof("host-.example.com") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(name, "host-%u.example.com", i);
+
+                assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, name));
+                assert_se(questions[i] = dns_question_new(1));
+                assert_se(dns_question_add(questions[i], key) >= 0);
+
+                assert_se(rr = dns_resource_record_new(key));
+                rr->ttl = 3600;
+                rr->a.in_addr.s_addr = htobe32(0xc6336400 | i); /* 198.51.100.x */
+
+                assert_se(answers[i] = dns_answer_new(1));
+                assert_se(dns_answer_add(answers[i], rr, 0) >= 0);
+        }
+}
+
+static void teardown(void) {
+        unsigned i;
+
+        for (i = 0; i < N_NAMES; i++) {
+                questions[i] = dns_question_unref(questions[i]);
+                answers[i] = dns_answer_unref(answers[i]);
+        }
+}
+
+static void cache_put(DnsCache *c, unsigned k) {
+        assert_se(dns_cache_put(c, questions[k], DNS_RCODE_SUCCESS, answers[k], answers[k]->n_rrs, 0, AF_INET, &owner) >= 0);
+}
+
+static bool cache_has(DnsCache *c, unsigned k) {
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        int rcode, r;
+
+        r = dns_cache_lookup(c, questions[k]->keys[0], &rcode, &answer);
+        assert_se(r >= 0);
+
+        if (r == 0)
+                return false;
+
+        assert_se(rcode == DNS_RCODE_SUCCESS);
+        assert_se(answer && answer->n_rrs == 1);
+        assert_se(answer->items[0].rr->a.in_addr.s_addr == htobe32(0xc6336400 | k));
+
+        return true;
+}
+
+static void test_lookup(void) {
+        DnsCache c = {
+                .max_bytes = DNS_CACHE_SIZE_DEFAULT,
+        };
+
+        assert_se(dns_cache_is_empty(&c));
+        assert_se(!cache_has(&c, 0));
+        assert_se(c.n_miss == 1 && c.n_hit == 0);
+
+        cache_put(&c, 0);
+        assert_se(!dns_cache_is_empty(&c));
+        assert_se(c.n_bytes > 0);
+
+        assert_se(cache_has(&c, 0));
+        assert_se(!cache_has(&c, 1));
+        assert_se(c.n_hit == 1 && c.n_miss == 2);
+
+        /* Putting the same answer again only refreshes it */
+        cache_put(&c, 0);
+        assert_se(cache_has(&c, 0));
+        assert_se(c.n_evicted == 0);
+
+        dns_cache_flush(&c);
+        assert_se(dns_cache_is_empty(&c));
+        assert_se(c.n_bytes == 0);
+}
+
+static void test_lru(void) {
+        DnsCache c = {
+                .max_bytes = DNS_CACHE_SIZE_DEFAULT,
+        };
+        size_t size;
+        unsigned i;
+
+        /* Find out what one entry costs, all of them are the same
+         * size. Room is made for the negative entry of the question
+         * too, which is less than that, hence this fits exactly
+         * three. */
+        cache_put(&c, 0);
+        size = c.n_bytes;
+        dns_cache_flush(&c);
+
+        c.max_bytes = size * 4 - 1;
+
+        cache_put(&c, 0);
+        cache_put(&c, 1);
+        cache_put(&c, 2);
+        assert_se(c.n_bytes == size * 3);
+        assert_se(c.n_evicted == 0);
+
+        /* Using 0 makes 1 the least recently used one */
+        assert_se(cache_has(&c, 0));
+
+        cache_put(&c, 3);
+        assert_se(c.n_evicted == 1);
+        assert_se(c.n_bytes == size * 3);
+
+        assert_se(cache_has(&c, 0));
+        assert_se(!cache_has(&c, 1));
+        assert_se(cache_has(&c, 2));
+        assert_se(cache_has(&c, 3));
+
+        /* Now 0 is the oldest again */
+        for (i = 4; i < N_NAMES; i++)
+                cache_put(&c, i);
+        assert_se(c.n_evicted == 1 + N_NAMES - 4);
+
+        for (i = 0; i < N_NAMES - 3; i++)
+                assert_se(!cache_has(&c, i));
+        for (; i < N_NAMES; i++)
+                assert_se(cache_has(&c, i));
+
+        dns_cache_flush(&c);
+        assert_se(c.n_bytes == 0);
+}
+
+static DnsAnswer *make_rrset(unsigned k) {
+        DnsAnswer *answer;
+        char name[sizeof("set-.example.com") + DECIMAL_STR_MAX(unsigned)];
+        unsigned i;
+
+        xsprintf(name, "set-%u.example.com", k);
+
+        assert_se(answer = dns_answer_new(N_RRSET));
+
+        for (i = 0; i < N_RRSET; i++) {
+                _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+
+                assert_se(rr = dns_resource_record_new_full(DNS_CLASS_IN, DNS_TYPE_A, name));
+                rr->ttl = 3600;
+                rr->a.in_addr.s_addr = htobe32(0x0a000000 | (k << 16) | i); /* 10.k.x.y */
+
+                assert_se(dns_answer_add(answer, rr, 0) >= 0);
+        }
+
+        return answer;
+}
+
+static void test_save_load(void) {
+        DnsCache c = {
+                .max_bytes = 64U*1024U*1024U,
+        }, d = {
+                .max_bytes = 64U*1024U*1024U,
+        };
+        DnsServer server = {
+                .family = AF_INET,
+        };
+        _cleanup_fclose_ FILE *f = NULL;
+        unsigned k, n_records = 0, n_rrs = 0;
+
+        server.address = owner;
+
+        for (k = 0; k < N_NAMES; k++) {
+                _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+
+                answer = make_rrset(k);
+                assert_se(dns_cache_put(&c, NULL, DNS_RCODE_SUCCESS, answer, answer->n_rrs, 0, AF_INET, &owner) >= 0);
+        }
+
+        assert_se(f = tmpfile());
+        assert_se(dns_cache_save(&c, f, 0, &server) >= 0);
+        assert_se(fflush(f) == 0);
+        rewind(f);
+
+        for (;;) {
+                _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+                union in_addr_union address;
+                int ifindex, family, r;
+                unsigned i;
+
+                r = dns_cache_read_record(f, &ifindex, &family, &address, &answer);
+                assert_se(r >= 0);
+                if (r == 0)
+                        break;
+
+                assert_se(ifindex == 0);
+                assert_se(family == AF_INET);
+                assert_se(in_addr_equal(AF_INET, &address, &owner));
+
+                /* Every RRset in a record must be complete */
+                for (i = 0; i < answer->n_rrs; i++) {
+                        unsigned j, n = 0;
+
+                        for (j = 0; j < answer->n_rrs; j++)
+                                if (dns_resource_key_equal(answer->items[i].rr->key, answer->items[j].rr->key) > 0)
+                                        n++;
+
+                        assert_se(n == N_RRSET);
+                        assert_se(answer->items[i].rr->ttl > 0 && answer->items[i].rr->ttl <= 3600);
+                }
+
+                assert_se(dns_cache_put(&d, NULL, DNS_RCODE_SUCCESS, answer, answer->n_rrs, 0, AF_INET, &owner) >= 0);
+
+                n_rrs += answer->n_rrs;
+                n_records++;
+        }
+
+        assert_se(n_records > 1);
+        assert_se(n_rrs == N_NAMES * N_RRSET);
+
+        for (k = 0; k < N_NAMES; k++) {
+                _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+                _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+                char name[sizeof("set-.example.com") + DECIMAL_STR_MAX(unsigned)];
+                int rcode;
+
+                xsprintf(name, "set-%u.example.com", k);
+                assert_se(key = dns_resource_key_new(DNS_CLASS_IN, DNS_TYPE_A, name));
+
+                assert_se(dns_cache_lookup(&d, key, &rcode, &answer) > 0);
+                assert_se(rcode == DNS_RCODE_SUCCESS);
+                assert_se(answer->n_rrs == N_RRSET);
+        }
+
+        dns_cache_flush(&c);
+        dns_cache_flush(&d);
+}
+
+int main(int argc, char *argv[]) {
+        log_parse_environment();
+        log_open();
+
+        setup();
+
+        test_lookup();
+        test_lru();
+        test_save_load();
+
+        teardown();
+
+        return 0;
+}
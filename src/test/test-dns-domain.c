@@ -92,6 +92,7 @@ static void test_dns_label_unescape_suffix(void) {
 
 static void test_dns_label_escape_one(const char *what, size_t l, const char *expect, int ret) {
         _cleanup_free_ char *t = NULL;
+        char buffer[DNS_LABEL_MAX * 4 + 1];
         int r;
 
         r = dns_label_escape(what, l, &t);
@@ -101,6 +102,11 @@ static void test_dns_label_escape_one(const char *what, size_t l, const char *ex
                 return;
 
         assert_se(streq_ptr(expect, t));
+
+        assert_se(dns_label_escape_buffer(what, l, buffer, sizeof(buffer)) == ret);
+        assert_se(streq(expect, buffer));
+
+        assert_se(dns_label_escape_buffer(what, l, buffer, l * 4) == -ENOSPC);
 }
 
 static void test_dns_label_escape(void) {
@@ -158,6 +164,22 @@ static void test_dns_name_equal(void) {
         test_dns_name_equal_one(".", "", true);
         test_dns_name_equal_one(".", ".", true);
         test_dns_name_equal_one("..", "..", -EINVAL);
+        test_dns_name_equal_one("foo-bar", "foo\\045bar", true);
+        test_dns_name_equal_one("abc.def.", "ABC.DEF", true);
+        test_dns_name_equal_one("abc.def", "abc.de", false);
+}
+
+static void test_dns_name_hash_func_one(const char *a, const char *b) {
+        uint8_t hash_key[HASH_KEY_SIZE] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+
+        assert_se(dns_name_equal(a, b) > 0);
+        assert_se(dns_name_hash_func(a, hash_key) == dns_name_hash_func(b, hash_key));
+}
+
+static void test_dns_name_hash_func(void) {
+        test_dns_name_hash_func_one("", ".");
+        test_dns_name_hash_func_one("x", "X.");
+        test_dns_name_hash_func_one("foo-bar.example", "FOO\\045bar.example.");
 }
 
 static void test_dns_name_between_one(const char *a, const char *b, const char *c, int ret) {
@@ -212,6 +234,10 @@ static void test_dns_name_endswith(void) {
         test_dns_name_endswith_one("x.y.z.u.v.w", "y.z", false);
         test_dns_name_endswith_one("x.y.z.u.v.w", "u.v.w", true);
         test_dns_name_endswith_one("x.y\001.z", "waldo", -EINVAL);
+        test_dns_name_endswith_one("foo.example.com.", "Example.com", true);
+        test_dns_name_endswith_one("fooexample.com", "example.com", false);
+        test_dns_name_endswith_one("foo\\.bar", "bar", false);
+        test_dns_name_endswith_one("foo.bar", "foo\\.bar", false);
 }
 
 static void test_dns_name_root(void) {
@@ -291,6 +317,7 @@ int main(int argc, char *argv[]) {
         test_dns_label_escape();
         test_dns_name_normalize();
         test_dns_name_equal();
+        test_dns_name_hash_func();
         test_dns_name_endswith();
         test_dns_name_between();
         test_dns_name_root();
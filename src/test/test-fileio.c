@@ -377,10 +377,12 @@ static void test_load_env_file_pairs(void) {
                         "ANSI_COLOR=\"0;36\"\n"
                         "HOME_URL=\"https://www.archlinux.org/\"\n"
                         "SUPPORT_URL=\"https://bbs.archlinux.org/\"\n"
-                        "BUG_REPORT_URL=\"https://bugs.archlinux.org/\"\n",
+                        "BUG_REPORT_URL=\"https://bugs.archlinux.org/\"\n"
+                        "BROKEN=\"\xfe\xff\"\n",
                         WRITE_STRING_FILE_CREATE);
         assert_se(r == 0);
 
+        /* The assignment with invalid UTF-8 is skipped, not the file */
         f = fdopen(fd, "r");
         assert_se(f);
 
@@ -556,6 +556,8 @@ static void test_hashmap_merge(void) {
         hashmap_put(n, "Key 3", val3);
         hashmap_put(n, "Key 4", val4);
 
+        assert_se(hashmap_merge(m, (Hashmap*) NULL) == 0);
+        assert_se(hashmap_size(m) == 2);
         assert_se(hashmap_merge(m, n) == 0);
         r = hashmap_get(m, "Key 3");
         assert_se(r && streq(r, "my val3"));
@@ -634,6 +636,29 @@ static void test_hashmap_size(void) {
         hashmap_free_free(m);
 }
 
+static void test_hashmap_memory_usage(void) {
+        Hashmap *m;
+        size_t direct;
+        unsigned i;
+
+        assert_se(hashmap_memory_usage(NULL) == 0);
+
+        m = hashmap_new(NULL);
+        assert_se(m);
+
+        direct = hashmap_memory_usage(m);
+        assert_se(direct > 0);
+
+        assert_se(hashmap_put(m, UINT_TO_PTR(1), UINT_TO_PTR(1)) == 1);
+        assert_se(hashmap_memory_usage(m) == direct);
+
+        for (i = 2; i < 100; i++)
+                assert_se(hashmap_put(m, UINT_TO_PTR(i), UINT_TO_PTR(i)) == 1);
+        assert_se(hashmap_memory_usage(m) > direct);
+
+        hashmap_free(m);
+}
+
 static void test_hashmap_get(void) {
         Hashmap *m;
         char *r;
@@ -860,6 +885,7 @@ void test_hashmap_funcs(void) {
         test_hashmap_get();
         test_hashmap_get2();
         test_hashmap_size();
+        test_hashmap_memory_usage();
         test_hashmap_many();
         test_hashmap_first();
         test_hashmap_first_key();
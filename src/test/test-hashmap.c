@@ -19,6 +19,7 @@
 
 #include "util.h"
 #include "hashmap.h"
+#include "set.h"
 
 void test_hashmap_funcs(void);
 void test_ordered_hashmap_funcs(void);
@@ -56,6 +57,99 @@ static void test_string_compare_func(void) {
         assert_se(string_compare_func("fred", "fred") == 0);
 }
 
+static void test_fast_string_hash_func(void) {
+        uint8_t k1[HASH_KEY_SIZE] = {}, k2[HASH_KEY_SIZE] = { 1 };
+
+        assert_se(fast_string_hash_func("foo", k1) == fast_string_hash_func("foo", k1));
+        assert_se(fast_string_hash_func("foo", k1) != fast_string_hash_func("foo", k2));
+        assert_se(fast_string_hash_func("foo", k1) != fast_string_hash_func("bar", k1));
+        assert_se(fast_string_hash_func("foo", k1) != string_hash_func("foo", k1));
+}
+
+#define N_LOOKUPS 200000
+
+#define BENCH_LOOKUPS(get, h, keys, n)                                  \
+        ({                                                              \
+                usec_t _t = now(CLOCK_MONOTONIC);                       \
+                unsigned _i;                                            \
+                for (_i = 0; _i < N_LOOKUPS; _i++)                      \
+                        assert_se(get(h, keys[_i % (n)]));              \
+                now(CLOCK_MONOTONIC) - _t;                              \
+        })
+
+static void test_hash_ops_benchmark(void) {
+        static const struct {
+                const char *name;
+                const struct hash_ops *ops;
+        } ops[] = {
+                { "siphash24", &string_hash_ops      },
+                { "siphash13", &fast_string_hash_ops },
+        };
+        unsigned n, i, j;
+
+        for (n = 1000; n <= 1000000; n *= 10) {
+                char **keys;
+
+                keys = new(char*, n);
+                assert_se(keys);
+                for (i = 0; i < n; i++)
+                        assert_se(asprintf(&keys[i], "/sys/devices/virtual/net/dev%u.device", i) >= 0);
+
+                for (j = 0; j < ELEMENTSOF(ops); j++) {
+                        _cleanup_hashmap_free_ Hashmap *h = NULL;
+                        _cleanup_ordered_hashmap_free_ OrderedHashmap *o = NULL;
+                        _cleanup_set_free_ Set *s = NULL;
+                        uint8_t hash_key[HASH_KEY_SIZE] = {};
+                        volatile unsigned long x = 0;
+                        usec_t tf, th, to, ts;
+
+                        assert_se(h = hashmap_new(ops[j].ops));
+                        assert_se(o = ordered_hashmap_new(ops[j].ops));
+                        assert_se(s = set_new(ops[j].ops));
+
+                        for (i = 0; i < n; i++) {
+                                assert_se(hashmap_put(h, keys[i], keys[i]) == 1);
+                                assert_se(ordered_hashmap_put(o, keys[i], keys[i]) == 1);
+                                assert_se(set_put(s, keys[i]) == 1);
+                        }
+
+                        tf = now(CLOCK_MONOTONIC);
+                        for (i = 0; i < N_LOOKUPS; i++)
+                                x ^= ops[j].ops->hash(keys[i % n], hash_key);
+                        tf = now(CLOCK_MONOTONIC) - tf;
+
+                        th = BENCH_LOOKUPS(hashmap_get, h, keys, n);
+                        to = BENCH_LOOKUPS(ordered_hashmap_get, o, keys, n);
+                        ts = BENCH_LOOKUPS(set_get, s, keys, n);
+
+                        log_info("%s, %7u entries: hash %3llu ns, Hashmap %3llu ns, OrderedHashmap %3llu ns, Set %3llu ns per lookup",
+                                 ops[j].name, n,
+                                 (unsigned long long) (tf * NSEC_PER_USEC / N_LOOKUPS),
+                                 (unsigned long long) (th * NSEC_PER_USEC / N_LOOKUPS),
+                                 (unsigned long long) (to * NSEC_PER_USEC / N_LOOKUPS),
+                                 (unsigned long long) (ts * NSEC_PER_USEC / N_LOOKUPS));
+                }
+
+                /* Sets of pointers, like the unit dependency sets */
+                {
+                        _cleanup_set_free_ Set *s = NULL;
+                        usec_t ts;
+
+                        assert_se(s = set_new(NULL));
+                        for (i = 0; i < n; i++)
+                                assert_se(set_put(s, keys[i]) == 1);
+
+                        ts = BENCH_LOOKUPS(set_get, s, keys, n);
+                        log_info("trivial,   %7u entries: Set %3llu ns per lookup",
+                                 n, (unsigned long long) (ts * NSEC_PER_USEC / N_LOOKUPS));
+                }
+
+                for (i = 0; i < n; i++)
+                        free(keys[i]);
+                free(keys);
+        }
+}
+
 int main(int argc, const char *argv[]) {
         test_hashmap_funcs();
         test_ordered_hashmap_funcs();
@@ -64,4 +158,6 @@ int main(int argc, const char *argv[]) {
         test_uint64_compare_func();
         test_trivial_compare_func();
         test_string_compare_func();
+        test_fast_string_hash_func();
+        test_hash_ops_benchmark();
 }
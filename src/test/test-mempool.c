@@ -0,0 +1,172 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pthread.h>
+
+#include "util.h"
+#include "mempool.h"
+#include "process-util.h"
+
+typedef struct Tile {
+        unsigned owner;
+        unsigned value;
+        uint8_t padding[48];
+} Tile;
+
+static DEFINE_MEMPOOL_THREADED(tile_pool, Tile, 16);
+
+#define N_THREADS 4U
+#define N_ROUNDS 200U
+#define N_TILES 500U
+
+/* Every thread allocates tiles and hands them to its neighbour, which
+ * checks them and frees them, so that magazines travel between
+ * threads through the depot. */
+static Tile *handoff[N_THREADS][N_TILES];
+static pthread_barrier_t barrier;
+
+static void *worker(void *p) {
+        unsigned id = PTR_TO_UINT(p), peer = (id + 1) % N_THREADS, r, i;
+
+        for (r = 0; r < N_ROUNDS; r++) {
+                for (i = 0; i < N_TILES; i++) {
+                        Tile *t;
+
+                        t = mempool_threaded_alloc0_tile(&tile_pool);
+                        assert_se(t);
+                        assert_se(t->owner == 0 && t->value == 0);
+
+                        t->owner = id + 1;
+                        t->value = r * N_TILES + i;
+                        handoff[id][i] = t;
+                }
+
+                assert_se(IN_SET(pthread_barrier_wait(&barrier), 0, PTHREAD_BARRIER_SERIAL_THREAD));
+
+                for (i = 0; i < N_TILES; i++) {
+                        Tile *t = handoff[peer][i];
+
+                        assert_se(t->owner == peer + 1);
+                        assert_se(t->value == r * N_TILES + i);
+                        mempool_threaded_free_tile(&tile_pool, t);
+                }
+
+                assert_se(IN_SET(pthread_barrier_wait(&barrier), 0, PTHREAD_BARRIER_SERIAL_THREAD));
+        }
+
+        return NULL;
+}
+
+static void test_cross_thread(void) {
+        pthread_t threads[N_THREADS];
+        unsigned i;
+
+        assert_se(pthread_barrier_init(&barrier, NULL, N_THREADS) == 0);
+
+        for (i = 0; i < N_THREADS; i++)
+                assert_se(pthread_create(threads + i, NULL, worker, UINT_TO_PTR(i)) == 0);
+
+        for (i = 0; i < N_THREADS; i++)
+                assert_se(pthread_join(threads[i], NULL) == 0);
+
+        assert_se(pthread_barrier_destroy(&barrier) == 0);
+}
+
+static void test_reuse(void) {
+        Tile *tiles[MEMPOOL_MAGAZINE_SIZE * 3];
+        unsigned i, j;
+
+        /* Tiles come back in the same thread without growing the
+         * underlying pool, including those the exited threads above
+         * left in the depot */
+
+        for (i = 0; i < ELEMENTSOF(tiles); i++) {
+                tiles[i] = mempool_threaded_alloc0_tile(&tile_pool);
+                assert_se(tiles[i]);
+
+                for (j = 0; j < i; j++)
+                        assert_se(tiles[i] != tiles[j]);
+        }
+
+        for (i = 0; i < ELEMENTSOF(tiles); i++)
+                mempool_threaded_free_tile(&tile_pool, tiles[i]);
+}
+
+static volatile bool churn_stop = false;
+
+static void *churn(void *p) {
+        Tile *tiles[MEMPOOL_MAGAZINE_SIZE * 3];
+        unsigned i;
+
+        /* Keeps going through the depot, so that forks happen while
+         * its mutex is taken */
+        while (!churn_stop) {
+                for (i = 0; i < ELEMENTSOF(tiles); i++)
+                        assert_se(tiles[i] = mempool_threaded_alloc_tile(&tile_pool));
+
+                for (i = 0; i < ELEMENTSOF(tiles); i++)
+                        mempool_threaded_free_tile(&tile_pool, tiles[i]);
+        }
+
+        return NULL;
+}
+
+static void test_fork(void) {
+        pthread_t thread;
+        unsigned i;
+
+        assert_se(pthread_create(&thread, NULL, churn, NULL) == 0);
+
+        for (i = 0; i < 50; i++) {
+                siginfo_t status;
+                pid_t pid;
+
+                pid = fork();
+                assert_se(pid >= 0);
+
+                if (pid == 0) {
+                        Tile *tiles[MEMPOOL_MAGAZINE_SIZE * 3];
+                        unsigned j;
+
+                        for (j = 0; j < ELEMENTSOF(tiles); j++)
+                                if (!(tiles[j] = mempool_threaded_alloc_tile(&tile_pool)))
+                                        _exit(EXIT_FAILURE);
+
+                        for (j = 0; j < ELEMENTSOF(tiles); j++)
+                                mempool_threaded_free_tile(&tile_pool, tiles[j]);
+
+                        _exit(EXIT_SUCCESS);
+                }
+
+                assert_se(wait_for_terminate(pid, &status) >= 0);
+                assert_se(status.si_code == CLD_EXITED);
+                assert_se(status.si_status == EXIT_SUCCESS);
+        }
+
+        churn_stop = true;
+        assert_se(pthread_join(thread, NULL) == 0);
+}
+
+int main(int argc, const char *argv[]) {
+        test_cross_thread();
+        test_reuse();
+        test_fork();
+
+        return 0;
+}
@@ -166,10 +166,70 @@ static void test_struct(void) {
         set_free(s);
 }
 
+#define BENCH_OPS (1024*1024)
+
+static void test_benchmark(void) {
+        unsigned n;
+
+        /* The patterns sd-event puts its queues through: sources
+         * whose time changes, and the earliest one being dispatched
+         * and rearmed */
+        for (n = 16; n <= 64*1024; n *= 16) {
+                struct test *t;
+                usec_t ts, tr, tp;
+                Prioq *q;
+                unsigned i;
+
+                q = prioq_new(test_compare);
+                assert_se(q);
+
+                t = new0(struct test, n);
+                assert_se(t);
+
+                srand(0);
+
+                ts = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n; i++) {
+                        t[i].value = (unsigned) rand();
+                        assert_se(prioq_put(q, t + i, &t[i].idx) >= 0);
+                }
+                ts = now(CLOCK_MONOTONIC) - ts;
+
+                tr = now(CLOCK_MONOTONIC);
+                for (i = 0; i < BENCH_OPS; i++) {
+                        struct test *x = t + (unsigned) rand() % n;
+
+                        x->value = (unsigned) rand();
+                        assert_se(prioq_reshuffle(q, x, &x->idx) > 0);
+                }
+                tr = now(CLOCK_MONOTONIC) - tr;
+
+                tp = now(CLOCK_MONOTONIC);
+                for (i = 0; i < BENCH_OPS; i++) {
+                        struct test *x;
+
+                        x = prioq_peek(q);
+                        x->value += (unsigned) rand() % (1024*1024);
+                        assert_se(prioq_reshuffle(q, x, &x->idx) > 0);
+                }
+                tp = now(CLOCK_MONOTONIC) - tp;
+
+                log_info("%6u items: put %3llu ns, random reshuffle %3llu ns, rearm top %3llu ns",
+                         n,
+                         (unsigned long long) (ts * NSEC_PER_USEC / n),
+                         (unsigned long long) (tr * NSEC_PER_USEC / BENCH_OPS),
+                         (unsigned long long) (tp * NSEC_PER_USEC / BENCH_OPS));
+
+                prioq_free(q);
+                free(t);
+        }
+}
+
 int main(int argc, char* argv[]) {
 
         test_unsigned();
         test_struct();
+        test_benchmark();
 
         return 0;
 }
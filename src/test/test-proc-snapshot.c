@@ -0,0 +1,110 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "macro.h"
+#include "cgroup-util.h"
+#include "process-util.h"
+#include "proc-snapshot.h"
+
+static void test_proc_snapshot_self(void) {
+        _cleanup_proc_snapshot_free_ ProcSnapshot *s = NULL;
+        _cleanup_free_ char *comm = NULL, *exe = NULL, *cmdline = NULL, *capeff = NULL, *capeff2 = NULL, *cmdline2 = NULL;
+        _cleanup_free_ char *cwd = NULL, *cwd2 = NULL, *cgroup = NULL, *cgroup2 = NULL, *env = NULL;
+        const char *c;
+        uint64_t t, t2;
+        uid_t u;
+        gid_t g;
+
+        assert_se(proc_snapshot_new(getpid(), &s) >= 0);
+        assert_se(proc_snapshot_get_pid(s) == getpid());
+
+        assert_se(get_process_comm(getpid(), &comm) >= 0);
+        assert_se(proc_snapshot_get_comm(s, &c) >= 0);
+        assert_se(streq(c, comm));
+
+        /* Asking again is served from the snapshot */
+        assert_se(proc_snapshot_get_comm(s, &c) >= 0);
+        assert_se(streq(c, comm));
+
+        assert_se(get_process_exe(getpid(), &exe) >= 0);
+        assert_se(proc_snapshot_get_exe(s, &c) >= 0);
+        assert_se(streq(c, exe));
+
+        assert_se(get_process_cmdline(getpid(), 0, false, &cmdline) >= 0);
+        assert_se(proc_snapshot_get_cmdline(s, &cmdline2) >= 0);
+        assert_se(streq(cmdline, cmdline2));
+
+        assert_se(proc_snapshot_get_uid(s, &u) >= 0);
+        assert_se(u == getuid());
+        assert_se(proc_snapshot_get_gid(s, &g) >= 0);
+        assert_se(g == getgid());
+
+        assert_se(get_process_capeff(getpid(), &capeff) >= 0);
+        assert_se(proc_snapshot_get_capeff(s, &capeff2) >= 0);
+        assert_se(streq(capeff, capeff2));
+
+        assert_se(get_process_cwd(getpid(), &cwd) >= 0);
+        assert_se(proc_snapshot_get_cwd(s, &cwd2) >= 0);
+        assert_se(streq(cwd, cwd2));
+
+        if (cg_pid_get_path(NULL, getpid(), &cgroup) >= 0) {
+                assert_se(proc_snapshot_get_cgroup(s, NULL, &cgroup2) >= 0);
+                assert_se(streq(cgroup, cgroup2));
+        }
+
+        assert_se(proc_snapshot_get_environ(s, &env) >= 0);
+
+        assert_se(proc_snapshot_get_starttime(s, &t) >= 0);
+        assert_se(proc_snapshot_open(s, getpid()) >= 0);
+        assert_se(proc_snapshot_get_starttime(s, &t2) >= 0);
+        assert_se(t == t2);
+}
+
+static void test_proc_snapshot_dead(void) {
+        _cleanup_proc_snapshot_free_ ProcSnapshot *s = NULL;
+        const char *c;
+        pid_t pid;
+
+        pid = fork();
+        assert_se(pid >= 0);
+        if (pid == 0) {
+                pause();
+                _exit(EXIT_SUCCESS);
+        }
+
+        assert_se(proc_snapshot_new(pid, &s) >= 0);
+
+        assert_se(kill(pid, SIGKILL) >= 0);
+        assert_se(wait_for_terminate(pid, NULL) >= 0);
+
+        /* Whatever now has the PID, we never see it */
+        assert_se(proc_snapshot_get_comm(s, &c) == -ESRCH);
+        assert_se(proc_snapshot_get_exe(s, &c) == -ESRCH);
+}
+
+int main(int argc, char *argv[]) {
+        test_proc_snapshot_self();
+        test_proc_snapshot_dead();
+
+        return 0;
+}
@@ -55,9 +55,67 @@ static void test_set_put(void) {
         assert_se(set_put(m, (void*) "22") == 0);
 }
 
+static void test_set_put_many(void) {
+        _cleanup_set_free_ Set *m = NULL, *o = NULL;
+        void *keys[1000];
+        unsigned i;
+
+        for (i = 0; i < ELEMENTSOF(keys); i++)
+                keys[i] = UINT_TO_PTR(i + 1);
+
+        m = set_new(NULL);
+        assert_se(m);
+
+        assert_se(set_put(m, keys[10]) == 1);
+        assert_se(set_put_many(m, keys, ELEMENTSOF(keys)) == ELEMENTSOF(keys) - 1);
+        assert_se(set_put_many(m, keys, ELEMENTSOF(keys)) == 0);
+        assert_se(set_put_many(m, NULL, 0) == 0);
+        assert_se(set_size(m) == ELEMENTSOF(keys));
+
+        o = set_new(NULL);
+        assert_se(o);
+        assert_se(set_put(o, UINT_TO_PTR(5000)) == 1);
+        assert_se(set_merge(o, NULL) >= 0);
+        assert_se(set_size(o) == 1);
+        assert_se(set_merge(o, m) >= 0);
+        assert_se(set_size(o) == ELEMENTSOF(keys) + 1);
+        for (i = 0; i < ELEMENTSOF(keys); i++)
+                assert_se(set_contains(o, keys[i]));
+}
+
+static void test_set_merge(void) {
+        _cleanup_set_free_ Set *m = NULL, *n = NULL;
+
+        m = set_new(NULL);
+        assert_se(m);
+        n = set_new(NULL);
+        assert_se(n);
+
+        /* Merging nothing into an empty set changes nothing */
+        assert_se(set_merge(m, NULL) == 0);
+        assert_se(set_isempty(m));
+
+        assert_se(set_put(m, UINT_TO_PTR(1)) == 1);
+        assert_se(set_put(m, UINT_TO_PTR(2)) == 1);
+        assert_se(set_put(n, UINT_TO_PTR(2)) == 1);
+        assert_se(set_put(n, UINT_TO_PTR(3)) == 1);
+
+        assert_se(set_merge(m, NULL) == 0);
+        assert_se(set_size(m) == 2);
+
+        assert_se(set_merge(m, n) == 0);
+        assert_se(set_size(m) == 3);
+        assert_se(set_contains(m, UINT_TO_PTR(1)));
+        assert_se(set_contains(m, UINT_TO_PTR(2)));
+        assert_se(set_contains(m, UINT_TO_PTR(3)));
+        assert_se(set_size(n) == 2);
+}
+
 int main(int argc, const char *argv[]) {
         test_set_steal_first();
         test_set_put();
+        test_set_put_many();
+        test_set_merge();
 
         return 0;
 }
@@ -0,0 +1,95 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "strintern.h"
+
+static void test_strintern(void) {
+        _cleanup_free_ char *copy = NULL;
+        const char *a, *b, *c;
+
+        assert_se(strintern(NULL) == NULL);
+        assert_se(strintern_lookup("foo.service") == NULL);
+
+        a = strintern("foo.service");
+        assert_se(a);
+        assert_se(streq(a, "foo.service"));
+
+        copy = strdup("foo.service");
+        assert_se(copy);
+        b = strintern(copy);
+        assert_se(b == a);
+        assert_se(strintern_lookup(copy) == a);
+
+        c = strintern("bar.service");
+        assert_se(c && c != a);
+        assert_se(strintern_size() == 2);
+
+        assert_se(strintern_unref(b) == NULL);
+        assert_se(strintern_lookup("foo.service") == a);
+        assert_se(strintern_unref(a) == NULL);
+        assert_se(strintern_lookup("foo.service") == NULL);
+        assert_se(strintern_size() == 1);
+
+        assert_se(strintern_ref(c) == c);
+        strintern_unref(c);
+        strintern_unref(c);
+        assert_se(strintern_size() == 0);
+}
+
+static void test_strintern_replace(void) {
+        const char *p = NULL, *q;
+
+        assert_se(strintern_replace(&p, "/usr/lib/systemd/system/getty@.service") == 1);
+        assert_se(streq(p, "/usr/lib/systemd/system/getty@.service"));
+
+        q = strintern("/usr/lib/systemd/system/getty@.service");
+        assert_se(q == p);
+
+        assert_se(strintern_replace(&p, "/usr/lib/systemd/system/getty@.service") == 0);
+        assert_se(p == q);
+
+        assert_se(strintern_replace(&p, "/etc/systemd/system/getty@.service") == 1);
+        assert_se(p != q);
+        assert_se(strintern_lookup("/usr/lib/systemd/system/getty@.service") == q);
+
+        assert_se(strintern_replace(&p, NULL) == 1);
+        assert_se(p == NULL);
+        assert_se(strintern_lookup("/etc/systemd/system/getty@.service") == NULL);
+
+        strintern_unref(q);
+        assert_se(strintern_size() == 0);
+}
+
+static void test_strintern_cleanup(void) {
+        {
+                _cleanup_strintern_unref_ const char *a = strintern("baz.socket");
+                assert_se(strintern_size() == 1);
+        }
+
+        assert_se(strintern_size() == 0);
+}
+
+int main(int argc, const char *argv[]) {
+        test_strintern();
+        test_strintern_replace();
+        test_strintern_cleanup();
+
+        return 0;
+}
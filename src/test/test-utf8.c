@@ -35,6 +35,102 @@ static void test_utf8_is_valid(void) {
         assert_se(!utf8_is_valid("\341\204"));
 }
 
+static void test_utf8_is_valid_n(void) {
+        char buf[64];
+        size_t i;
+
+        assert_se(utf8_is_valid_n("", 0));
+        assert_se(utf8_is_valid_n("ascii is valid unicode, a bit longer than a word", 48));
+        assert_se(utf8_is_valid_n("\342\204\242", 3));
+        assert_se(!utf8_is_valid_n("\342\204\242", 2));
+        assert_se(!utf8_is_valid_n("\341\204", 2));
+        assert_se(!utf8_is_valid_n("abc\0def", 7));
+        assert_se(utf8_is_valid_n("abc\0def", 3));
+
+        /* Put a NUL, a non-ASCII char and a broken sequence at
+         * every offset, so that they end up in every word position */
+        for (i = 0; i < sizeof(buf) - 3; i++) {
+                memset(buf, 'x', sizeof(buf));
+                assert_se(utf8_is_valid_n(buf, sizeof(buf)));
+
+                buf[i] = 0;
+                assert_se(!utf8_is_valid_n(buf, sizeof(buf)));
+                assert_se(utf8_is_valid_n(buf, i));
+
+                memcpy(buf + i, "\342\204\242", 3);
+                assert_se(utf8_is_valid_n(buf, sizeof(buf)));
+                assert_se(!utf8_is_valid_n(buf, i + 2));
+
+                buf[i + 2] = 'x';
+                assert_se(!utf8_is_valid_n(buf, sizeof(buf)));
+
+                buf[i] = buf[i + 1] = buf[i + 2] = 'x';
+                buf[i] = '\177';
+                assert_se(utf8_is_valid_n(buf, sizeof(buf)));
+                assert_se(!utf8_is_printable(buf, sizeof(buf)));
+                buf[i] = '\n';
+                assert_se(utf8_is_printable(buf, sizeof(buf)));
+                assert_se(!utf8_is_printable_newline(buf, sizeof(buf), false));
+        }
+}
+
+/* The character by character loop utf8_is_valid() used to be */
+static const char *utf8_is_valid_scalar(const char *str) {
+        const char *p;
+
+        for (p = str; *p; ) {
+                int len;
+
+                len = utf8_encoded_valid_unichar(p);
+                if (len < 0)
+                        return NULL;
+
+                p += len;
+        }
+
+        return str;
+}
+
+static void test_utf8_is_valid_benchmark(void) {
+        _cleanup_free_ char *s = NULL;
+        const size_t size = 1024 * 1024;
+        unsigned i, n = 20;
+        usec_t t;
+        size_t k;
+
+        /* Mostly ASCII, with a non-ASCII char every now and then,
+         * similar to unit lists and environment blocks */
+        s = new(char, size + 1);
+        assert_se(s);
+        for (k = 0; k + 2 < size; k++)
+                if (k % 97 == 0) {
+                        memcpy(s + k, "\302\256", 2);
+                        k++;
+                } else
+                        s[k] = 'a' + k % 26;
+        for (; k < size; k++)
+                s[k] = 'z';
+        s[size] = 0;
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++)
+                assert_se(utf8_is_valid_scalar(s));
+        t = now(CLOCK_MONOTONIC) - t;
+        log_info("scalar: %.1f MB/s", (double) size * n / t);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++)
+                assert_se(utf8_is_valid(s));
+        t = now(CLOCK_MONOTONIC) - t;
+        log_info("utf8_is_valid(): %.1f MB/s", (double) size * n / t);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++)
+                assert_se(utf8_is_valid_n(s, size));
+        t = now(CLOCK_MONOTONIC) - t;
+        log_info("utf8_is_valid_n(): %.1f MB/s", (double) size * n / t);
+}
+
 static void test_ascii_is_valid(void) {
         assert_se(ascii_is_valid("alsdjf\t\vbarr\nba z"));
         assert_se(!ascii_is_valid("\342\204\242"));
@@ -107,6 +203,8 @@ static void test_utf16_to_utf8(void) {
 
 int main(int argc, char *argv[]) {
         test_utf8_is_valid();
+        test_utf8_is_valid_n();
+        test_utf8_is_valid_benchmark();
         test_utf8_is_printable();
         test_ascii_is_valid();
         test_utf8_encoded_valid_unichar();
@@ -39,6 +39,7 @@
 #include "virt.h"
 #include "process-util.h"
 #include "signal-util.h"
+#include "path-util.h"
 
 static void test_streq_ptr(void) {
         assert_se(streq_ptr(NULL, NULL));
@@ -1449,11 +1450,23 @@ static void test_glob_exists(void) {
         assert_se(r == 0);
 }
 
+static void execute_done_count(const char *path, usec_t begin, usec_t wall, usec_t cpu, void *userdata) {
+        char ts[FORMAT_TIMESPAN_MAX];
+        unsigned *n = userdata;
+
+        log_debug("%s took %s.", path, strna(format_timespan(ts, sizeof(ts), wall, 1)));
+
+        assert_se(path_is_absolute(path));
+        assert_se(begin > 0);
+        (*n)++;
+}
+
 static void test_execute_directory(void) {
         char template_lo[] = "/tmp/test-readlink_and_make_absolute-lo.XXXXXXX";
         char template_hi[] = "/tmp/test-readlink_and_make_absolute-hi.XXXXXXX";
         const char * dirs[] = {template_hi, template_lo, NULL};
-        const char *name, *name2, *name3, *overridden, *override, *masked, *mask;
+        const char *name, *name2, *name3, *overridden, *override, *masked, *mask, *works, *failed;
+        unsigned n_done = 0;
 
         assert_se(mkdtemp(template_lo));
         assert_se(mkdtemp(template_hi));
@@ -1465,6 +1478,8 @@ static void test_execute_directory(void) {
         override = strjoina(template_hi, "/overridden");
         masked = strjoina(template_lo, "/masked");
         mask = strjoina(template_hi, "/masked");
+        works = strjoina(template_lo, "/it_works");
+        failed = strjoina(template_lo, "/failed");
 
         assert_se(write_string_file(name, "#!/bin/sh\necho 'Executing '$0\ntouch $(dirname $0)/it_works", WRITE_STRING_FILE_CREATE) == 0);
         assert_se(write_string_file(name2, "#!/bin/sh\necho 'Executing '$0\ntouch $(dirname $0)/it_works2", WRITE_STRING_FILE_CREATE) == 0);
@@ -1489,6 +1504,15 @@ static void test_execute_directory(void) {
         assert_se(access("it_works2", F_OK) >= 0);
         assert_se(access("failed", F_OK) < 0);
 
+        /* script, script2 and the overriding one, one at a time,
+         * the empty files are masks */
+        assert_se(unlink(works) >= 0);
+        execute_directories_full(dirs, DEFAULT_TIMEOUT_USEC, 1, NULL, execute_done_count, &n_done);
+        assert_se(n_done == 3);
+
+        assert_se(access(works, F_OK) >= 0);
+        assert_se(access(failed, F_OK) < 0);
+
         (void) rm_rf(template_lo, REMOVE_ROOT|REMOVE_PHYSICAL);
         (void) rm_rf(template_hi, REMOVE_ROOT|REMOVE_PHYSICAL);
 }
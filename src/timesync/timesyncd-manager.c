@@ -30,6 +30,8 @@
 #include <sys/socket.h>
 #include <resolv.h>
 #include <sys/types.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include "missing.h"
 #include "util.h"
@@ -49,6 +51,10 @@
 #define ADJ_SETOFFSET                   0x0100  /* add 'time' to current time */
 #endif
 
+#ifndef SOF_TIMESTAMPING_OPT_TSONLY
+#define SOF_TIMESTAMPING_OPT_TSONLY     (1<<11)
+#endif
+
 /* expected accuracy of time synchronization; used to adjust the poll interval */
 #define NTP_ACCURACY_SEC                0.2
 
@@ -150,6 +156,60 @@ static int manager_timeout(sd_event_source *source, usec_t usec, void *userdata)
         return manager_connect(m);
 }
 
+static int manager_receive_tx_timestamp(Manager *m, int fd) {
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                            CMSG_SPACE(sizeof(struct sock_extended_err))];
+        } control;
+        struct ntp_msg ntpmsg;
+        struct iovec iov = {
+                .iov_base = &ntpmsg,
+                .iov_len = sizeof(ntpmsg),
+        };
+        struct msghdr msghdr = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+        bool found = false;
+
+        assert(m);
+
+        /* With SO_TIMESTAMPING the kernel queues the time it sent our
+         * request at on the error queue of the socket. */
+
+        for (;;) {
+                msghdr.msg_controllen = sizeof(control);
+
+                if (recvmsg(fd, &msghdr, MSG_ERRQUEUE|MSG_DONTWAIT) < 0) {
+                        if (errno == EAGAIN)
+                                return found;
+
+                        return -errno;
+                }
+
+                CMSG_FOREACH(cmsg, &msghdr) {
+                        struct scm_timestamping *tss;
+
+                        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING)
+                                continue;
+
+                        found = true;
+
+                        tss = (struct scm_timestamping *) CMSG_DATA(cmsg);
+
+                        /* Only use it if it plausibly belongs to the request in flight */
+                        if (m->pending &&
+                            timespec_load(&tss->ts[0]) >= timespec_load(&m->trans_time) &&
+                            timespec_load(&tss->ts[0]) < timespec_load(&m->trans_time) + USEC_PER_SEC)
+                                m->trans_time_kernel = tss->ts[0];
+                }
+        }
+}
+
 static int manager_send_request(Manager *m) {
         _cleanup_free_ char *pretty = NULL;
         struct ntp_msg ntpmsg = {
@@ -183,6 +243,11 @@ static int manager_send_request(Manager *m) {
          * The actual value does not matter, We do not care about the correct
          * NTP UINT_MAX fraction; we just pass the plain nanosecond value.
          */
+        if (m->server_socket_timestamping)
+                (void) manager_receive_tx_timestamp(m, m->server_socket);
+        m->trans_time_kernel = (struct timespec) {};
+        m->pending = false;
+
         assert_se(clock_gettime(clock_boottime_or_monotonic(), &m->trans_time_mon) >= 0);
         assert_se(clock_gettime(CLOCK_REALTIME, &m->trans_time) >= 0);
         ntpmsg.trans_time.sec = htobe32(m->trans_time.tv_sec + OFFSET_1900_1970);
@@ -476,7 +541,7 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
         };
         union {
                 struct cmsghdr cmsghdr;
-                uint8_t buf[CMSG_SPACE(sizeof(struct timeval))];
+                uint8_t buf[CMSG_SPACE(MAX(sizeof(struct timespec), sizeof(struct scm_timestamping)))];
         } control;
         union sockaddr_union server_addr;
         struct msghdr msghdr = {
@@ -500,6 +565,15 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
         assert(source);
         assert(m);
 
+        if ((revents & EPOLLERR) && m->server_socket_timestamping) {
+                r = manager_receive_tx_timestamp(m, fd);
+                if (r > 0) {
+                        revents &= ~EPOLLERR;
+                        if (!(revents & EPOLLIN))
+                                return 0;
+                }
+        }
+
         if (revents & (EPOLLHUP|EPOLLERR)) {
                 log_warning("Server connection returned error.");
                 return manager_connect(m);
@@ -536,6 +610,10 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
                 case SCM_TIMESTAMPNS:
                         recv_time = (struct timespec *) CMSG_DATA(cmsg);
                         break;
+                case SCM_TIMESTAMPING:
+                        /* The software timestamp comes first */
+                        recv_time = &((struct scm_timestamping *) CMSG_DATA(cmsg))->ts[0];
+                        break;
                 }
         }
         if (!recv_time) {
@@ -613,7 +691,7 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
          *  The round-trip delay, d, and system clock offset, t, are defined as:
          *  d = (T4 - T1) - (T3 - T2)     t = ((T2 - T1) + (T3 - T4)) / 2"
          */
-        origin = ts_to_d(&m->trans_time) + OFFSET_1900_1970;
+        origin = ts_to_d(m->trans_time_kernel.tv_sec > 0 ? &m->trans_time_kernel : &m->trans_time) + OFFSET_1900_1970;
         receive = ntp_ts_to_d(&ntpmsg.recv_time);
         trans = ntp_ts_to_d(&ntpmsg.trans_time);
         dest = ts_to_d(recv_time) + OFFSET_1900_1970;
@@ -690,6 +768,11 @@ static int manager_listen_setup(Manager *m) {
         union sockaddr_union addr = {};
         static const int tos = IPTOS_LOWDELAY;
         static const int on = 1;
+        static const int ts_flags_compat =
+                SOF_TIMESTAMPING_SOFTWARE |
+                SOF_TIMESTAMPING_RX_SOFTWARE |
+                SOF_TIMESTAMPING_TX_SOFTWARE;
+        static const int ts_flags = ts_flags_compat | SOF_TIMESTAMPING_OPT_TSONLY;
         int r;
 
         assert(m);
@@ -710,9 +793,19 @@ static int manager_listen_setup(Manager *m) {
         if (r < 0)
                 return -errno;
 
-        r = setsockopt(m->server_socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
-        if (r < 0)
-                return -errno;
+        /* Let the kernel timestamp the request too, so that the
+         * time spent in sendto() and the network stack doesn't count
+         * as network delay. Older kernels don't know the TSONLY flag,
+         * and without SO_TIMESTAMPING we fall back to receive
+         * timestamps only. */
+        m->server_socket_timestamping =
+                setsockopt(m->server_socket, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof(ts_flags)) >= 0 ||
+                setsockopt(m->server_socket, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags_compat, sizeof(ts_flags_compat)) >= 0;
+        if (!m->server_socket_timestamping) {
+                r = setsockopt(m->server_socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+                if (r < 0)
+                        return -errno;
+        }
 
         (void) setsockopt(m->server_socket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
 
@@ -52,6 +52,7 @@ struct Manager {
         ServerName *current_server_name;
         ServerAddress *current_server_address;
         int server_socket;
+        bool server_socket_timestamping;
         int missed_replies;
         uint64_t packet_count;
         sd_event_source *event_timeout;
@@ -60,6 +61,7 @@ struct Manager {
         /* last sent packet */
         struct timespec trans_time_mon;
         struct timespec trans_time;
+        struct timespec trans_time_kernel; /* when the kernel sent it, if it told us */
         usec_t retry_interval;
         bool pending;
 
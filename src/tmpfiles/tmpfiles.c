@@ -202,6 +202,15 @@ static struct Item* find_glob(OrderedHashmap *h, const char *match) {
 
                 for (n = 0; n < j->count; n++) {
                         Item *item = j->items + n;
+                        size_t k;
+
+                        /* This is called for every file we look at
+                         * while cleaning up, hence rule out most
+                         * globs by their literal prefix before
+                         * calling fnmatch() */
+                        k = strcspn(item->path, GLOB_CHARS "\\");
+                        if (strncmp(item->path, match, k) != 0)
+                                continue;
 
                         if (fnmatch(item->path, match, FNM_PATHNAME|FNM_PERIOD) == 0)
                                 return item;
@@ -287,17 +296,25 @@ static bool unix_socket_alive(const char *fn) {
         return true;
 }
 
-static int dir_is_mount_point(DIR *d, const char *subdir) {
+static int dir_get_mount_id(DIR *d, int *ret) {
+        union file_handle_union h = FILE_HANDLE_INIT;
+
+        if (name_to_handle_at(dirfd(d), ".", &h.handle, ret, 0) < 0)
+                return -errno;
+
+        return 0;
+}
+
+static int dir_is_mount_point(DIR *d, int r_p, int mount_id_parent, const char *subdir) {
 
         union file_handle_union h = FILE_HANDLE_INIT;
-        int mount_id_parent, mount_id;
-        int r_p, r;
+        int mount_id;
+        int r;
 
-        r_p = name_to_handle_at(dirfd(d), ".", &h.handle, &mount_id_parent, 0);
-        if (r_p < 0)
-                r_p = -errno;
+        /* The result of dir_get_mount_id() for the directory itself
+         * is passed in, so that it is queried only once and not for
+         * every subdirectory */
 
-        h.handle.handle_bytes = MAX_HANDLE_SZ;
         r = name_to_handle_at(dirfd(d), subdir, &h.handle, &mount_id, 0);
         if (r < 0)
                 r = -errno;
@@ -357,6 +374,7 @@ static int dir_cleanup(
         struct dirent *dent;
         struct timespec times[2];
         bool deleted = false;
+        int mount_id_parent = 0, r_mount_id = 1;
         int r = 0;
 
         while ((dent = readdir(d))) {
@@ -389,10 +407,15 @@ static int dir_cleanup(
                 /* Try to detect bind mounts of the same filesystem instance; they
                  * do not differ in device major/minors. This type of query is not
                  * supported on all kernels or filesystem types though. */
-                if (S_ISDIR(s.st_mode) && dir_is_mount_point(d, dent->d_name) > 0) {
-                        log_debug("Ignoring \"%s/%s\": different mount of the same filesystem.",
-                                  p, dent->d_name);
-                        continue;
+                if (S_ISDIR(s.st_mode)) {
+                        if (r_mount_id > 0)
+                                r_mount_id = dir_get_mount_id(d, &mount_id_parent);
+
+                        if (dir_is_mount_point(d, r_mount_id, mount_id_parent, dent->d_name) > 0) {
+                                log_debug("Ignoring \"%s/%s\": different mount of the same filesystem.",
+                                          p, dent->d_name);
+                                continue;
+                        }
                 }
 
                 /* Do not delete read-only files owned by root */
@@ -365,12 +365,45 @@ static int get_mac(struct udev_device *device, bool want_random,
         return 0;
 }
 
+/* Drops the properties the link already has from the request, every
+ * change costs a round trip to the kernel, and some drivers reset the
+ * hardware when the MTU or the address is set, even to the old value. */
+static void link_drop_unchanged(struct udev_device *device, const char **alias,
+                                struct ether_addr **mac, unsigned *mtu) {
+        const char *s;
+
+        if (*alias) {
+                s = udev_device_get_sysattr_value(device, "ifalias");
+                if (streq_ptr(s, *alias))
+                        *alias = NULL;
+        }
+
+        if (*mac) {
+                struct ether_addr current;
+
+                s = udev_device_get_sysattr_value(device, "address");
+                if (s && ether_aton_r(s, &current) &&
+                    memcmp(&current, *mac, sizeof(current)) == 0)
+                        *mac = NULL;
+        }
+
+        if (*mtu > 0) {
+                unsigned current;
+
+                s = udev_device_get_sysattr_value(device, "mtu");
+                if (s && safe_atou(s, &current) >= 0 && current == *mtu)
+                        *mtu = 0;
+        }
+}
+
 int link_config_apply(link_config_ctx *ctx, link_config *config,
                       struct udev_device *device, const char **name) {
         const char *old_name;
         const char *new_name = NULL;
         struct ether_addr generated_mac;
         struct ether_addr *mac = NULL;
+        const char *alias;
+        unsigned mtu;
         bool respect_predictable = false;
         int r, ifindex;
 
@@ -464,7 +497,11 @@ int link_config_apply(link_config_ctx *ctx, link_config *config,
                         mac = config->mac;
         }
 
-        r = rtnl_set_link_properties(&ctx->rtnl, ifindex, config->alias, mac, config->mtu);
+        alias = config->alias;
+        mtu = config->mtu;
+        link_drop_unchanged(device, &alias, &mac, &mtu);
+
+        r = rtnl_set_link_properties(&ctx->rtnl, ifindex, alias, mac, mtu);
         if (r < 0)
                 return log_warning_errno(r, "Could not set Alias, MACAddress or MTU on %s: %m", old_name);
 
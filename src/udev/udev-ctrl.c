@@ -35,8 +35,14 @@ enum udev_ctrl_msg_type {
         UDEV_CTRL_SET_CHILDREN_MAX,
         UDEV_CTRL_PING,
         UDEV_CTRL_EXIT,
+        UDEV_CTRL_SETTLE,
 };
 
+/* sent by the daemon before it closes a SETTLE connection, so that
+ * the client can tell it apart from a daemon not knowing SETTLE */
+#define UDEV_CTRL_SETTLED 'S'
+
+
 struct udev_ctrl_msg_wire {
         char version[16];
         unsigned int magic;
@@ -279,8 +285,17 @@ static int ctrl_send(struct udev_ctrl *uctrl, enum udev_ctrl_msg_type type, int
                         break;
                 }
 
-                if (r == 0)
+                if (r == 0) {
                         err = -ETIMEDOUT;
+                        break;
+                }
+
+                if (type == UDEV_CTRL_SETTLE) {
+                        char c;
+
+                        if (recv(uctrl->sock, &c, 1, MSG_DONTWAIT) != 1 || c != UDEV_CTRL_SETTLED)
+                                err = -EOPNOTSUPP;
+                }
                 break;
         }
 out:
@@ -319,6 +334,22 @@ int udev_ctrl_send_exit(struct udev_ctrl *uctrl, int timeout) {
         return ctrl_send(uctrl, UDEV_CTRL_EXIT, 0, NULL, timeout);
 }
 
+/* Returns when the queue is empty, or when no event for the given
+ * devpath is queued or running, counting the uevents the kernel sent
+ * up to now. Returns -EOPNOTSUPP if the daemon does not support it. */
+int udev_ctrl_send_settle(struct udev_ctrl *uctrl, const char *devpath, int timeout) {
+        return ctrl_send(uctrl, UDEV_CTRL_SETTLE, 0, devpath ?: "", timeout);
+}
+
+int udev_ctrl_connection_notify_settled(struct udev_ctrl_connection *conn) {
+        static const char c = UDEV_CTRL_SETTLED;
+
+        if (send(conn->sock, &c, 1, MSG_NOSIGNAL) != 1)
+                return -errno;
+
+        return 0;
+}
+
 struct udev_ctrl_msg *udev_ctrl_receive_msg(struct udev_ctrl_connection *conn) {
         struct udev_ctrl_msg *uctrl_msg;
         ssize_t size;
@@ -458,3 +489,9 @@ int udev_ctrl_get_exit(struct udev_ctrl_msg *ctrl_msg) {
                 return 1;
         return -1;
 }
+
+const char *udev_ctrl_get_settle(struct udev_ctrl_msg *ctrl_msg) {
+        if (ctrl_msg->ctrl_msg_wire.type == UDEV_CTRL_SETTLE)
+                return ctrl_msg->ctrl_msg_wire.buf;
+        return NULL;
+}
@@ -56,6 +56,7 @@ struct udev_event *udev_event_new(struct udev_device *dev) {
         event->udev = udev;
         udev_list_init(udev, &event->run_list, false);
         udev_list_init(udev, &event->seclabel_list, false);
+        udev_list_init(udev, &event->program_results, true);
         event->birth_usec = clock_boottime_or_monotonic();
         return event;
 }
@@ -66,6 +67,7 @@ void udev_event_unref(struct udev_event *event) {
         sd_netlink_unref(event->rtnl);
         udev_list_cleanup(&event->run_list);
         udev_list_cleanup(&event->seclabel_list);
+        udev_list_cleanup(&event->program_results);
         free(event->program_result);
         free(event->name);
         free(event);
@@ -717,6 +719,33 @@ out:
         return 0;
 }
 
+/*
+ * The probing helpers shipped with udev print the same for the same
+ * arguments as long as the device does not change, i.e. during one
+ * event. Rules often run them several times per event, e.g. scsi_id in
+ * the rules of every multipath or storage vendor, so remember their
+ * output for the rest of the event instead of forking them again.
+ */
+static bool program_is_cacheable(const char *cmd) {
+        static const char helpers[] =
+                "ata_id\0"
+                "cdrom_id\0"
+                "mtd_probe\0"
+                "scsi_id\0"
+                "v4l_id\0";
+        const char *h;
+        size_t len;
+
+        cmd = startswith(cmd, UDEVLIBEXECDIR "/") ?: cmd;
+        len = strcspn(cmd, " \t");
+
+        NULSTR_FOREACH(h, helpers)
+                if (strlen(h) == len && strneq(cmd, h, len))
+                        return true;
+
+        return false;
+}
+
 int udev_event_spawn(struct udev_event *event,
                      usec_t timeout_usec,
                      usec_t timeout_warn_usec,
@@ -725,9 +754,20 @@ int udev_event_spawn(struct udev_event *event,
                      char *result, size_t ressize) {
         int outpipe[2] = {-1, -1};
         int errpipe[2] = {-1, -1};
+        struct udev_list_entry *cached = NULL;
+        bool cacheable;
         pid_t pid;
         int err = 0;
 
+        cacheable = result != NULL && program_is_cacheable(cmd);
+        if (cacheable)
+                cached = udev_list_entry_get_by_name(udev_list_get_entry(&event->program_results), cmd);
+        if (cached) {
+                log_debug("using earlier output of '%s'", cmd);
+                strscpy(result, ressize, udev_list_entry_get_value(cached));
+                return 0;
+        }
+
         /* pipes from child to parent */
         if (result != NULL || log_get_max_level() >= LOG_INFO) {
                 if (pipe2(outpipe, O_NONBLOCK) != 0) {
@@ -786,6 +826,10 @@ int udev_event_spawn(struct udev_event *event,
                            result, ressize);
 
                 err = spawn_wait(event, timeout_usec, timeout_warn_usec, cmd, pid, accept_failure);
+
+                /* failures are not remembered, a later run may succeed */
+                if (err == 0 && cacheable)
+                        udev_list_entry_add(&event->program_results, cmd, result);
         }
 
 out:
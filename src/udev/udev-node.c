@@ -122,6 +122,29 @@ exit:
         return err;
 }
 
+/*
+ * Every device claiming a link leaves an entry in the stack directory of
+ * the link, /run/udev/links/<escaped link>/<device id>. The entry is a
+ * symlink to "<priority>:<device node>", so that picking the device with
+ * the highest priority costs a readlink() per claiming device instead of
+ * reading its database and its uevent file. Entries written by earlier
+ * versions are empty files, for those the database is still read.
+ */
+static bool link_stack_entry_parse(char *s, int *priority, const char **devnode) {
+        char *colon;
+
+        colon = strchr(s, ':');
+        if (!colon || colon[1] != '/')
+                return false;
+
+        *colon = '\0';
+        if (safe_atoi(s, priority) < 0)
+                return false;
+
+        *devnode = colon + 1;
+        return true;
+}
+
 /* find device node of device with highest priority */
 static const char *link_find_prioritized(struct udev_device *dev, bool add, const char *stackdir, char *buf, size_t bufsize) {
         struct udev *udev = udev_device_get_udev(dev);
@@ -141,6 +164,10 @@ static const char *link_find_prioritized(struct udev_device *dev, bool add, cons
         for (;;) {
                 struct udev_device *dev_db;
                 struct dirent *dent;
+                char entry[UTIL_PATH_SIZE];
+                const char *devnode;
+                int prio;
+                ssize_t len;
 
                 dent = readdir(dir);
                 if (dent == NULL || dent->d_name[0] == '\0')
@@ -154,10 +181,23 @@ static const char *link_find_prioritized(struct udev_device *dev, bool add, cons
                 if (streq(dent->d_name, udev_device_get_id_filename(dev)))
                         continue;
 
+                len = readlinkat(dirfd(dir), dent->d_name, entry, sizeof(entry) - 1);
+                if (len >= 0) {
+                        entry[len] = '\0';
+                        if (!link_stack_entry_parse(entry, &prio, &devnode))
+                                continue;
+
+                        if (target == NULL || prio > priority) {
+                                log_debug("'%s' claims priority %i for '%s'", dent->d_name, prio, stackdir);
+                                priority = prio;
+                                strscpy(buf, bufsize, devnode);
+                                target = buf;
+                        }
+                        continue;
+                }
+
                 dev_db = udev_device_new_from_device_id(udev, dent->d_name);
                 if (dev_db != NULL) {
-                        const char *devnode;
-
                         devnode = udev_device_get_devnode(dev_db);
                         if (devnode != NULL) {
                                 if (target == NULL || udev_device_get_devlink_priority(dev_db) > priority) {
@@ -179,6 +219,7 @@ static const char *link_find_prioritized(struct udev_device *dev, bool add, cons
 static void link_update(struct udev_device *dev, const char *slink, bool add) {
         char name_enc[UTIL_PATH_SIZE];
         char filename[UTIL_PATH_SIZE * 2];
+        char filename_tmp[UTIL_PATH_SIZE * 2 + 8];
         char dirname[UTIL_PATH_SIZE];
         const char *target;
         char buf[UTIL_PATH_SIZE];
@@ -201,20 +242,31 @@ static void link_update(struct udev_device *dev, const char *slink, bool add) {
         }
 
         if (add) {
+                char entry[DECIMAL_STR_MAX(int) + 1 + UTIL_PATH_SIZE];
                 int err;
 
-                do {
-                        int fd;
+                xsprintf(entry, "%i:%s", udev_device_get_devlink_priority(dev), udev_device_get_devnode(dev));
+
+                /* events of one device are never handled in parallel,
+                 * the temporary name does not need to be unique */
+                strscpyl(filename_tmp, sizeof(filename_tmp), dirname, "/.", udev_device_get_id_filename(dev), ".tmp", NULL);
 
+                do {
                         err = mkdir_parents(filename, 0755);
                         if (err != 0 && err != -ENOENT)
                                 break;
-                        fd = open(filename, O_WRONLY|O_CREAT|O_CLOEXEC|O_TRUNC|O_NOFOLLOW, 0444);
-                        if (fd >= 0)
-                                close(fd);
-                        else
+
+                        err = 0;
+                        (void) unlink(filename_tmp);
+                        if (symlink(entry, filename_tmp) < 0 ||
+                            rename(filename_tmp, filename) < 0) {
                                 err = -errno;
+                                (void) unlink(filename_tmp);
+                        }
                 } while (err == -ENOENT);
+
+                if (err < 0)
+                        log_debug_errno(err, "could not add '%s' to '%s': %m", udev_device_get_id_filename(dev), dirname);
         }
 }
 
@@ -28,16 +28,22 @@
 #include <dirent.h>
 #include <fnmatch.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "udev.h"
 #include "path-util.h"
 #include "conf-files.h"
+#include "hashmap.h"
 #include "strbuf.h"
 #include "strv.h"
 #include "util.h"
 #include "sysctl-util.h"
 
 #define PREALLOC_TOKEN          2048
+#define SKIP_INDEX_MAX          128
+#define RULES_CACHE_PATH        "/run/udev/rules.bin"
+#define RULES_CACHE_SIG         { 'U', 'D', 'E', 'V', 'R', 'U', 'L', 'S' }
 
 struct uid_gid {
         unsigned int name_off;
@@ -53,6 +59,13 @@ static const char* const rules_dirs[] = {
         UDEVLIBEXECDIR "/rules.d",
         NULL};
 
+/* besides the rules files, the tokens depend on the user and group
+ * databases, when names are resolved while parsing */
+static const char* const rules_cache_extra_sources[] = {
+        "/etc/passwd",
+        "/etc/group",
+        NULL};
+
 struct udev_rules {
         struct udev *udev;
         usec_t dirs_ts_usec;
@@ -66,6 +79,18 @@ struct udev_rules {
         /* all key strings are copied and de-duplicated in a single continuous string buffer */
         struct strbuf *strbuf;
 
+        /* when loaded from the precompiled rules, tokens and strings point into the mapping */
+        void *map;
+        size_t map_size;
+        const char *strings;
+
+        /* token index of every rule, followed by the one of the final TK_END */
+        unsigned int *rule_tokens;
+        unsigned int rule_cur;
+
+        /* per ACTION and SUBSYSTEM, the next rule that can match at all, see rules_get_skip() */
+        Hashmap *skip_index;
+
         /* during rule parsing, uid/gid lookup results are cached */
         struct uid_gid *uids;
         unsigned int uids_cur;
@@ -76,6 +101,9 @@ struct udev_rules {
 };
 
 static char *rules_str(struct udev_rules *rules, unsigned int off) {
+        if (!rules->strbuf)
+                return (char *) rules->strings + off;
+
         return rules->strbuf->buf + off;
 }
 
@@ -83,6 +111,23 @@ static unsigned int rules_add_string(struct udev_rules *rules, const char *s) {
         return strbuf_add_string(rules->strbuf, s, strlen(s));
 }
 
+/* Whether the first n bytes of s are free of glob special chars and
+ * of backslashes, which fnmatch() would treat as escapes */
+static bool string_is_literal(const char *s, size_t n) {
+        size_t i;
+
+        for (i = 0; i < n; i++)
+                switch (s[i]) {
+                case '*':
+                case '?':
+                case '[':
+                case '\\':
+                        return false;
+                }
+
+        return true;
+}
+
 /* KEY=="", KEY!="", KEY+="", KEY-="", KEY="", KEY:="" */
 enum operation_type {
         OP_UNSET,
@@ -104,6 +149,8 @@ enum string_glob_type {
         GL_SPLIT,                       /* multi-value A|B */
         GL_SPLIT_GLOB,                  /* multi-value with glob A*|B* */
         GL_SOMETHING,                   /* commonly used "?*" */
+        GL_PREFIX,                      /* glob of the form "abc*" */
+        GL_SUFFIX,                      /* glob of the form "*abc" */
 };
 
 enum string_subst_type {
@@ -244,6 +291,8 @@ static const char *string_glob_str(enum string_glob_type type) {
                 [GL_SPLIT] =            "split",
                 [GL_SPLIT_GLOB] =       "split-glob",
                 [GL_SOMETHING] =        "split-glob",
+                [GL_PREFIX] =           "prefix",
+                [GL_SUFFIX] =           "suffix",
         };
 
         return string_glob_strs[type];
@@ -928,8 +977,14 @@ static int rule_add_key(struct rule_tmp *rule_tmp, enum token_type type,
                 } else if (has_split) {
                         glob = GL_SPLIT;
                 } else if (has_glob) {
+                        size_t len = strlen(value);
+
                         if (streq(value, "?*"))
                                 glob = GL_SOMETHING;
+                        else if (value[len-1] == '*' && string_is_literal(value, len-1))
+                                glob = GL_PREFIX;
+                        else if (value[0] == '*' && string_is_literal(value+1, len-1))
+                                glob = GL_SUFFIX;
                         else
                                 glob = GL_GLOB;
                 } else {
@@ -1628,11 +1683,239 @@ static int parse_file(struct udev_rules *rules, const char *filename) {
         return 0;
 }
 
+static void rules_build_rule_index(struct udev_rules *rules) {
+        unsigned int i, n = 0;
+
+        for (i = 0; i < rules->token_cur; i++)
+                if (IN_SET(rules->tokens[i].type, TK_RULE, TK_END))
+                        n++;
+
+        if (n == 0 || rules->tokens[rules->token_cur-1].type != TK_END)
+                return;
+
+        /* Without the index we simply don't skip anything */
+        rules->rule_tokens = new(unsigned int, n);
+        if (!rules->rule_tokens)
+                return;
+
+        for (i = 0; i < rules->token_cur; i++)
+                if (IN_SET(rules->tokens[i].type, TK_RULE, TK_END))
+                        rules->rule_tokens[rules->rule_cur++] = i;
+
+        /* the final TK_END is not a rule */
+        rules->rule_cur--;
+}
+
+/*
+ * The precompiled rules are only read by the udev version which wrote
+ * them, on the same machine, hence the tokens are stored in host byte
+ * order, exactly as they are in memory.
+ */
+struct rules_cache_header {
+        uint8_t signature[8];
+
+        /* version of tool which created the file */
+        uint64_t tool_version;
+        uint64_t file_size;
+
+        /* size of structures and number of token types */
+        uint32_t header_size;
+        uint32_t source_size;
+        uint32_t token_size;
+        uint32_t token_types;
+
+        int32_t resolve_names;
+        uint32_t padding;
+
+        uint64_t sources_off;
+        uint64_t sources_count;
+        uint64_t tokens_off;
+        uint64_t tokens_count;
+        uint64_t strings_off;
+        uint64_t strings_len;
+};
+
+/* a file the rules were compiled from, as it was before parsing */
+struct rules_cache_source {
+        uint64_t path_off;
+        uint64_t size;
+        uint64_t mtime_nsec;
+};
+
+static bool rules_cache_source_matches(const struct rules_cache_source *source, const char *path) {
+        struct stat st;
+
+        if (stat(path, &st) < 0)
+                return false;
+
+        return source->size == (uint64_t) st.st_size &&
+               source->mtime_nsec == timespec_load_nsec(&st.st_mtim);
+}
+
+static bool rules_cache_section_valid(uint64_t off, uint64_t count, size_t size, uint64_t file_size) {
+        if (off % 8 != 0 || off > file_size)
+                return false;
+
+        return count <= (file_size - off) / size;
+}
+
+static bool rules_cache_valid(const void *map, size_t map_size, int resolve_names, char **sources) {
+        const char sig[] = RULES_CACHE_SIG;
+        const struct rules_cache_header *h = map;
+        const struct rules_cache_source *s;
+        const struct token *tokens;
+        const char *strings;
+        unsigned int i;
+
+        if (memcmp(h->signature, sig, sizeof(h->signature)) != 0 ||
+            h->tool_version != (uint64_t) atoi(VERSION) ||
+            h->file_size != map_size ||
+            h->header_size != sizeof(struct rules_cache_header) ||
+            h->source_size != sizeof(struct rules_cache_source) ||
+            h->token_size != sizeof(struct token) ||
+            h->token_types != TK_END ||
+            h->resolve_names != resolve_names)
+                return false;
+
+        if (!rules_cache_section_valid(h->sources_off, h->sources_count, sizeof(struct rules_cache_source), map_size) ||
+            !rules_cache_section_valid(h->tokens_off, h->tokens_count, sizeof(struct token), map_size) ||
+            !rules_cache_section_valid(h->strings_off, h->strings_len, 1, map_size))
+                return false;
+
+        tokens = (const struct token *) ((const uint8_t *) map + h->tokens_off);
+        if (h->tokens_count == 0 || h->tokens_count > UINT_MAX ||
+            tokens[h->tokens_count-1].type != TK_END)
+                return false;
+
+        strings = (const char *) map + h->strings_off;
+        if (h->strings_len == 0 || h->strings_len > UINT_MAX ||
+            strings[h->strings_len-1] != '\0')
+                return false;
+
+        if (h->sources_count != strv_length(sources))
+                return false;
+
+        s = (const struct rules_cache_source *) ((const uint8_t *) map + h->sources_off);
+        for (i = 0; i < h->sources_count; i++) {
+                if (s[i].path_off >= h->strings_len ||
+                    !streq(strings + s[i].path_off, sources[i]))
+                        return false;
+
+                if (!rules_cache_source_matches(&s[i], sources[i])) {
+                        log_debug("%s changed, not using " RULES_CACHE_PATH, sources[i]);
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+/* Returns 1 if the precompiled rules match the given sources and were
+ * mapped, 0 if the rules need to be parsed. */
+static int rules_cache_load(struct udev_rules *rules, char **sources) {
+        const struct rules_cache_header *h;
+        _cleanup_close_ int fd = -1;
+        struct stat st;
+        void *map;
+
+        fd = open(RULES_CACHE_PATH, O_RDONLY|O_CLOEXEC);
+        if (fd < 0) {
+                if (errno != ENOENT)
+                        log_debug_errno(errno, "error opening " RULES_CACHE_PATH ": %m");
+                return 0;
+        }
+
+        if (fstat(fd, &st) < 0) {
+                log_debug_errno(errno, "error reading " RULES_CACHE_PATH ": %m");
+                return 0;
+        }
+
+        if ((size_t) st.st_size < sizeof(struct rules_cache_header))
+                return 0;
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+                log_debug_errno(errno, "error mapping " RULES_CACHE_PATH ": %m");
+                return 0;
+        }
+
+        if (!rules_cache_valid(map, st.st_size, rules->resolve_names, sources)) {
+                munmap(map, st.st_size);
+                return 0;
+        }
+
+        h = map;
+        rules->map = map;
+        rules->map_size = st.st_size;
+        rules->tokens = (struct token *) ((uint8_t *) map + h->tokens_off);
+        rules->token_cur = h->tokens_count;
+        rules->token_max = h->tokens_count;
+        rules->strings = (const char *) map + h->strings_off;
+
+        log_debug("using precompiled rules from " RULES_CACHE_PATH ", %u tokens, %"PRIu64" bytes strings",
+                  rules->token_cur, h->strings_len);
+
+        return 1;
+}
+
+static void rules_cache_write(struct udev_rules *rules, const struct rules_cache_source *sources, size_t n_sources) {
+        struct rules_cache_header h = {
+                .signature = RULES_CACHE_SIG,
+                .tool_version = atoi(VERSION),
+                .header_size = sizeof(struct rules_cache_header),
+                .source_size = sizeof(struct rules_cache_source),
+                .token_size = sizeof(struct token),
+                .token_types = TK_END,
+                .resolve_names = rules->resolve_names,
+        };
+        static const uint8_t padding[8] = {};
+        _cleanup_free_ char *path_tmp = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        int r;
+
+        h.sources_off = ALIGN8(sizeof(struct rules_cache_header));
+        h.sources_count = n_sources;
+        h.tokens_off = ALIGN8(h.sources_off + n_sources * sizeof(struct rules_cache_source));
+        h.tokens_count = rules->token_cur;
+        h.strings_off = ALIGN8(h.tokens_off + rules->token_cur * sizeof(struct token));
+        h.strings_len = rules->strbuf->len;
+        h.file_size = h.strings_off + h.strings_len;
+
+        r = fopen_temporary(RULES_CACHE_PATH, &f, &path_tmp);
+        if (r < 0) {
+                log_debug_errno(r, "cannot create " RULES_CACHE_PATH ": %m");
+                return;
+        }
+        fchmod(fileno(f), 0644);
+
+        fwrite(&h, sizeof(struct rules_cache_header), 1, f);
+        fwrite(padding, 1, h.sources_off - sizeof(struct rules_cache_header), f);
+        fwrite(sources, sizeof(struct rules_cache_source), n_sources, f);
+        fwrite(padding, 1, h.tokens_off - (h.sources_off + n_sources * sizeof(struct rules_cache_source)), f);
+        fwrite(rules->tokens, sizeof(struct token), rules->token_cur, f);
+        fwrite(padding, 1, h.strings_off - (h.tokens_off + rules->token_cur * sizeof(struct token)), f);
+        fwrite(rules->strbuf->buf, 1, rules->strbuf->len, f);
+
+        r = fflush_and_check(f);
+        if (r >= 0 && rename(path_tmp, RULES_CACHE_PATH) < 0)
+                r = -errno;
+        if (r < 0) {
+                log_debug_errno(r, "cannot write " RULES_CACHE_PATH ": %m");
+                unlink_noerrno(path_tmp);
+                return;
+        }
+
+        log_debug("precompiled rules written to " RULES_CACHE_PATH ", %"PRIu64" bytes", h.file_size);
+}
+
 struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         struct udev_rules *rules;
-        struct udev_list file_list;
         struct token end_token;
-        char **files, **f;
+        _cleanup_strv_free_ char **files = NULL, **sources = NULL;
+        _cleanup_free_ struct rules_cache_source *stamps = NULL;
+        bool cacheable = true;
+        unsigned int i, n_sources;
+        char **f;
         int r;
 
         rules = new0(struct udev_rules, 1);
@@ -1640,7 +1923,29 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
                 return NULL;
         rules->udev = udev;
         rules->resolve_names = resolve_names;
-        udev_list_init(udev, &file_list, true);
+
+        udev_rules_check_timestamp(rules);
+
+        r = conf_files_list_strv(&files, ".rules", NULL, rules_dirs);
+        if (r < 0) {
+                log_error_errno(r, "failed to enumerate rules files: %m");
+                return udev_rules_unref(rules);
+        }
+
+        sources = strv_copy(files);
+        if (!sources)
+                return udev_rules_unref(rules);
+        if (resolve_names > 0 &&
+            strv_extend_strv(&sources, (char **) rules_cache_extra_sources) < 0)
+                return udev_rules_unref(rules);
+        n_sources = strv_length(sources);
+
+        /* skip parsing, when nothing changed since the rules were last compiled */
+        if (rules_cache_load(rules, sources) > 0) {
+                rules_build_rule_index(rules);
+                dump_rules(rules);
+                return rules;
+        }
 
         /* init token array and string buffer */
         rules->tokens = malloc(PREALLOC_TOKEN * sizeof(struct token));
@@ -1652,13 +1957,9 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         if (!rules->strbuf)
                 return udev_rules_unref(rules);
 
-        udev_rules_check_timestamp(rules);
-
-        r = conf_files_list_strv(&files, ".rules", NULL, rules_dirs);
-        if (r < 0) {
-                log_error_errno(r, "failed to enumerate rules files: %m");
+        stamps = new0(struct rules_cache_source, n_sources);
+        if (!stamps)
                 return udev_rules_unref(rules);
-        }
 
         /*
          * The offset value in the rules strct is limited; add all
@@ -1667,11 +1968,24 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         STRV_FOREACH(f, files)
                 rules_add_string(rules, *f);
 
+        /* remember the sources as they are before parsing them, a
+         * change while we parse makes the next start parse again */
+        for (i = 0; i < n_sources; i++) {
+                struct stat st;
+
+                if (stat(sources[i], &st) < 0) {
+                        cacheable = false;
+                        continue;
+                }
+
+                stamps[i].path_off = rules_add_string(rules, sources[i]);
+                stamps[i].size = st.st_size;
+                stamps[i].mtime_nsec = timespec_load_nsec(&st.st_mtim);
+        }
+
         STRV_FOREACH(f, files)
                 parse_file(rules, *f);
 
-        strv_free(files);
-
         memzero(&end_token, sizeof(struct token));
         end_token.type = TK_END;
         add_token(rules, &end_token);
@@ -1692,6 +2006,11 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         rules->gids_cur = 0;
         rules->gids_max = 0;
 
+        if (cacheable)
+                rules_cache_write(rules, stamps, n_sources);
+
+        rules_build_rule_index(rules);
+
         dump_rules(rules);
         return rules;
 }
@@ -1699,8 +2018,13 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
 struct udev_rules *udev_rules_unref(struct udev_rules *rules) {
         if (rules == NULL)
                 return NULL;
-        free(rules->tokens);
+        if (rules->map)
+                munmap(rules->map, rules->map_size);
+        else
+                free(rules->tokens);
         strbuf_cleanup(rules->strbuf);
+        free(rules->rule_tokens);
+        hashmap_free_free_free(rules->skip_index);
         free(rules->uids);
         free(rules->gids);
         free(rules);
@@ -1714,9 +2038,28 @@ bool udev_rules_check_timestamp(struct udev_rules *rules) {
         return paths_check_timestamp(rules_dirs, &rules->dirs_ts_usec, true);
 }
 
+/* Matches one alternative of a GL_SPLIT_GLOB value, which is not NUL
+ * terminated, handling the frequent prefix and suffix patterns
+ * without fnmatch(). Other patterns are copied to buf, which has to
+ * have room for n+1 bytes, to terminate them for fnmatch(). */
+static bool match_alternative(const char *pattern, size_t n, const char *val, size_t len, char *buf) {
+        if (n > 0 && pattern[n-1] == '*' && string_is_literal(pattern, n-1))
+                return len >= n-1 && memcmp(val, pattern, n-1) == 0;
+
+        if (n > 0 && pattern[0] == '*' && string_is_literal(pattern+1, n-1))
+                return len >= n-1 && memcmp(val+len-(n-1), pattern+1, n-1) == 0;
+
+        if (string_is_literal(pattern, n))
+                return len == n && memcmp(val, pattern, n) == 0;
+
+        memcpy(buf, pattern, n);
+        buf[n] = '\0';
+
+        return fnmatch(buf, val, 0) == 0;
+}
+
 static int match_key(struct udev_rules *rules, struct token *token, const char *val) {
         char *key_value = rules_str(rules, token->key.value_off);
-        char *pos;
         bool match = false;
 
         if (val == NULL)
@@ -1756,26 +2099,35 @@ static int match_key(struct udev_rules *rules, struct token *token, const char *
                 }
         case GL_SPLIT_GLOB:
                 {
-                        char value[UTIL_PATH_SIZE];
+                        const char *s;
+                        size_t len;
+                        char *buf;
 
-                        strscpy(value, sizeof(value), rules_str(rules, token->key.value_off));
-                        key_value = value;
-                        while (key_value != NULL) {
-                                pos = strchr(key_value, '|');
-                                if (pos != NULL) {
-                                        pos[0] = '\0';
-                                        pos = &pos[1];
-                                }
-                                match = (fnmatch(key_value, val, 0) == 0);
-                                if (match)
+                        /* Room for the longest alternative, once for
+                         * all of them */
+                        s = key_value;
+                        buf = alloca(strlen(s) + 1);
+                        len = strlen(val);
+                        for (;;) {
+                                size_t n;
+
+                                n = strcspn(s, "|");
+                                match = match_alternative(s, n, val, len, buf);
+                                if (match || s[n] == '\0')
                                         break;
-                                key_value = pos;
+                                s += n + 1;
                         }
                         break;
                 }
         case GL_SOMETHING:
                 match = (val[0] != '\0');
                 break;
+        case GL_PREFIX:
+                match = strneq(key_value, val, strlen(key_value) - 1);
+                break;
+        case GL_SUFFIX:
+                match = endswith(val, key_value + 1);
+                break;
         case GL_UNSET:
                 return -1;
         }
@@ -1841,6 +2193,79 @@ enum escape_type {
         ESCAPE_REPLACE,
 };
 
+/* Whether the ACTION== and SUBSYSTEM== keys of the rule allow it to
+ * match. Both sort before all keys with side effects, like PROGRAM or
+ * IMPORT, hence a rule they reject never does anything. */
+static bool rule_may_match(struct udev_rules *rules, unsigned int rule_no, const char *action, const char *subsystem) {
+        struct token *rule, *cur;
+
+        rule = &rules->tokens[rules->rule_tokens[rule_no]];
+
+        for (cur = rule + 1; cur < rule + rule->rule.token_count; cur++) {
+                if (cur->type > TK_M_SUBSYSTEM)
+                        break;
+
+                if (cur->type == TK_M_ACTION && match_key(rules, cur, action) != 0)
+                        return false;
+
+                if (cur->type == TK_M_SUBSYSTEM && match_key(rules, cur, subsystem) != 0)
+                        return false;
+        }
+
+        return true;
+}
+
+/* Returns an array mapping every rule to the first rule at or after it
+ * that may match an event with the given ACTION and SUBSYSTEM. It is
+ * computed on first use for each combination, of which there are only
+ * a few dozen in practice. */
+static const unsigned int *rules_get_skip(struct udev_rules *rules, const char *action, const char *subsystem) {
+        _cleanup_free_ unsigned int *skip = NULL;
+        _cleanup_free_ char *key = NULL;
+        unsigned int *found;
+        unsigned int i;
+        int r;
+
+        if (!rules->rule_tokens)
+                return NULL;
+
+        action = strempty(action);
+        subsystem = strempty(subsystem);
+
+        key = strjoin(action, " ", subsystem, NULL);
+        if (!key)
+                return NULL;
+
+        found = hashmap_get(rules->skip_index, key);
+        if (found)
+                return found;
+
+        if (hashmap_size(rules->skip_index) >= SKIP_INDEX_MAX)
+                return NULL;
+
+        r = hashmap_ensure_allocated(&rules->skip_index, &string_hash_ops);
+        if (r < 0)
+                return NULL;
+
+        skip = new(unsigned int, rules->rule_cur + 1);
+        if (!skip)
+                return NULL;
+
+        skip[rules->rule_cur] = rules->rule_cur;
+        for (i = rules->rule_cur; i > 0; i--)
+                skip[i-1] = rule_may_match(rules, i-1, action, subsystem) ? i-1 : skip[i];
+
+        r = hashmap_put(rules->skip_index, key, skip);
+        if (r < 0)
+                return NULL;
+
+        key = NULL;
+        found = skip;
+        skip = NULL;
+
+        return found;
+}
+
 int udev_rules_apply_to_event(struct udev_rules *rules,
                               struct udev_event *event,
                               usec_t timeout_usec,
@@ -1849,6 +2274,8 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
         struct token *cur;
         struct token *rule;
         enum escape_type esc = ESCAPE_UNSET;
+        const unsigned int *skip;
+        unsigned int rule_no = 0;
         bool can_set_name;
 
         if (rules->tokens == NULL)
@@ -1858,6 +2285,8 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
                         (major(udev_device_get_devnum(event->dev)) > 0 ||
                          udev_device_get_ifindex(event->dev) > 0));
 
+        skip = rules_get_skip(rules, udev_device_get_action(event->dev), udev_device_get_subsystem(event->dev));
+
         /* loop through token list, match, run actions or forward to next rule */
         cur = &rules->tokens[0];
         rule = cur;
@@ -1865,6 +2294,21 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
                 dump_token(rules, cur);
                 switch (cur->type) {
                 case TK_RULE:
+                        if (skip) {
+                                unsigned int idx = cur - rules->tokens;
+
+                                /* GOTO only ever jumps forward */
+                                while (rules->rule_tokens[rule_no] < idx)
+                                        rule_no++;
+
+                                /* jump over rules that cannot match this ACTION and SUBSYSTEM */
+                                if (skip[rule_no] != rule_no) {
+                                        rule_no = skip[rule_no];
+                                        cur = &rules->tokens[rules->rule_tokens[rule_no]];
+                                        continue;
+                                }
+                        }
+
                         /* current rule */
                         rule = cur;
                         /* possibly skip rules which want to set NAME, SYMLINK, OWNER, GROUP, MODE */
@@ -2482,6 +2926,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
                         const char *key_name = rules_str(rules, cur->key.attr_off);
                         char attr[UTIL_PATH_SIZE];
                         char value[UTIL_NAME_SIZE];
+                        const char *sysattr;
                         FILE *f;
 
                         if (util_resolve_subsys_kernel(event->udev, key_name, attr, sizeof(attr), 0) != 0)
@@ -2500,6 +2945,12 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
                         } else {
                                 log_error_errno(errno, "error opening ATTR{%s} for writing: %m", attr);
                         }
+
+                        /* values are cached by the device, drop the old one
+                         * so that later ATTR{} matches read the new value */
+                        sysattr = startswith(attr, udev_device_get_syspath(event->dev));
+                        if (sysattr && sysattr[0] == '/')
+                                udev_device_set_sysattr_value(event->dev, sysattr + 1, NULL);
                         break;
                 }
                 case TK_A_SYSCTL: {
@@ -29,6 +29,7 @@
 #include "udev.h"
 #include "udev-util.h"
 #include "udevadm-util.h"
+#include "device-db-snapshot.h"
 
 static bool skip_attribute(const char *name) {
         static const char* const skip[] = {
@@ -222,6 +223,10 @@ static void cleanup_db(struct udev *udev) {
 
         unlink("/run/udev/queue.bin");
 
+        /* readers which still map the snapshot must not trust it */
+        device_db_snapshot_invalidate();
+        unlink(DEVICE_DB_SNAPSHOT_PATH);
+
         dir = opendir("/run/udev/data");
         if (dir != NULL) {
                 cleanup_dir(dir, S_ISVTX, 1);
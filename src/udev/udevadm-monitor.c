@@ -67,6 +67,7 @@ static void help(void) {
                "  -u --udev                                Print udev events\n"
                "  -s --subsystem-match=SUBSYSTEM[/DEVTYPE] Filter events by subsystem\n"
                "  -t --tag-match=TAG                       Filter events by tag\n"
+               "     --property-match=KEY=VALUE            Filter events by property\n"
                , program_invocation_short_name);
 }
 
@@ -78,6 +79,7 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[]) {
         bool print_udev = false;
         _cleanup_udev_list_cleanup_ struct udev_list subsystem_match_list;
         _cleanup_udev_list_cleanup_ struct udev_list tag_match_list;
+        _cleanup_udev_list_cleanup_ struct udev_list property_match_list;
         _cleanup_udev_monitor_unref_ struct udev_monitor *udev_monitor = NULL;
         _cleanup_udev_monitor_unref_ struct udev_monitor *kernel_monitor = NULL;
         _cleanup_close_ int fd_ep = -1;
@@ -85,6 +87,10 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[]) {
         struct epoll_event ep_kernel, ep_udev;
         int c;
 
+        enum {
+                ARG_PROPERTY_MATCH = 0x100,
+        };
+
         static const struct option options[] = {
                 { "property",        no_argument,       NULL, 'p' },
                 { "environment",     no_argument,       NULL, 'e' }, /* alias for -p */
@@ -92,12 +98,14 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[]) {
                 { "udev",            no_argument,       NULL, 'u' },
                 { "subsystem-match", required_argument, NULL, 's' },
                 { "tag-match",       required_argument, NULL, 't' },
+                { "property-match",  required_argument, NULL, ARG_PROPERTY_MATCH },
                 { "help",            no_argument,       NULL, 'h' },
                 {}
         };
 
         udev_list_init(udev, &subsystem_match_list, true);
         udev_list_init(udev, &tag_match_list, true);
+        udev_list_init(udev, &property_match_list, false);
 
         while((c = getopt_long(argc, argv, "pekus:t:h", options, NULL)) >= 0)
                 switch (c) {
@@ -128,6 +136,22 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[]) {
                 case 't':
                         udev_list_entry_add(&tag_match_list, optarg, NULL);
                         break;
+                case ARG_PROPERTY_MATCH:
+                        {
+                                char key[UTIL_NAME_SIZE];
+                                char *value;
+
+                                strscpy(key, sizeof(key), optarg);
+                                value = strchr(key, '=');
+                                if (value == NULL) {
+                                        fprintf(stderr, "error: expected KEY=VALUE, got '%s'\n", optarg);
+                                        return 1;
+                                }
+                                value[0] = '\0';
+                                value++;
+                                udev_list_entry_add(&property_match_list, key, value);
+                                break;
+                        }
                 case 'h':
                         help();
                         return 0;
@@ -183,6 +207,14 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[]) {
                                 fprintf(stderr, "error: unable to apply tag filter '%s'\n", tag);
                 }
 
+                udev_list_entry_foreach(entry, udev_list_get_entry(&property_match_list)) {
+                        const char *key = udev_list_entry_get_name(entry);
+                        const char *value = udev_list_entry_get_value(entry);
+
+                        if (udev_monitor_filter_add_match_property(udev_monitor, key, value) < 0)
+                                fprintf(stderr, "error: unable to apply property filter '%s=%s'\n", key, value);
+                }
+
                 if (udev_monitor_enable_receiving(udev_monitor) < 0) {
                         fprintf(stderr, "error: unable to subscribe to udev events\n");
                         return 2;
@@ -28,6 +28,9 @@
 
 #include "udev.h"
 #include "util.h"
+#include "path-util.h"
+#include "udev-util.h"
+#include "udevadm-util.h"
 
 static void help(void) {
         printf("%s settle OPTIONS\n\n"
@@ -36,13 +39,19 @@ static void help(void) {
                "     --version              Show package version\n"
                "  -t --timeout=SECONDS      Maximum time to wait for events\n"
                "  -E --exit-if-exists=FILE  Stop waiting if file exists\n"
+               "     --device=DEVICE        Only wait for the events of the device\n"
                , program_invocation_short_name);
 }
 
 static int adm_settle(struct udev *udev, int argc, char *argv[]) {
+        enum {
+                ARG_DEVICE = 0x100,
+        };
+
         static const struct option options[] = {
                 { "timeout",        required_argument, NULL, 't' },
                 { "exit-if-exists", required_argument, NULL, 'E' },
+                { "device",         required_argument, NULL, ARG_DEVICE },
                 { "help",           no_argument,       NULL, 'h' },
                 { "seq-start",      required_argument, NULL, 's' }, /* removed */
                 { "seq-end",        required_argument, NULL, 'e' }, /* removed */
@@ -51,6 +60,7 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
         };
         usec_t deadline;
         const char *exists = NULL;
+        _cleanup_free_ char *devpath = NULL;
         unsigned int timeout = 120;
         struct pollfd pfd[1] = { {.fd = -1}, };
         int c;
@@ -76,6 +86,27 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
                         exists = optarg;
                         break;
 
+                case ARG_DEVICE: {
+                        _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
+                        const char *p;
+
+                        /* the device does not need to exist yet */
+                        p = path_startswith(optarg, "/sys");
+                        if (p)
+                                devpath = strappend("/", p);
+                        else {
+                                dev = find_device(udev, optarg, NULL);
+                                if (!dev) {
+                                        fprintf(stderr, "Unknown device '%s'\n", optarg);
+                                        return EXIT_FAILURE;
+                                }
+                                devpath = strdup(udev_device_get_devpath(dev));
+                        }
+                        if (!devpath)
+                                return log_oom();
+                        break;
+                }
+
                 case 'h':
                         help();
                         return EXIT_SUCCESS;
@@ -107,12 +138,32 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
 
                 uctrl = udev_ctrl_new(udev);
                 if (uctrl != NULL) {
+                        int r;
+
                         if (udev_ctrl_send_ping(uctrl, MAX(5U, timeout)) < 0) {
                                 log_debug("no connection to daemon");
                                 udev_ctrl_unref(uctrl);
                                 return EXIT_SUCCESS;
                         }
                         udev_ctrl_unref(uctrl);
+
+                        /* let the daemon tell us when it is done, unless
+                         * we need to look for a file in the meantime, or
+                         * only check once */
+                        if (!exists && timeout > 0) {
+                                uctrl = udev_ctrl_new(udev);
+                                if (uctrl != NULL) {
+                                        r = udev_ctrl_send_settle(uctrl, devpath, timeout);
+                                        udev_ctrl_unref(uctrl);
+
+                                        if (r >= 0)
+                                                return EXIT_SUCCESS;
+                                        if (r == -ETIMEDOUT)
+                                                return EXIT_FAILURE;
+
+                                        log_debug_errno(r, "daemon does not support settle requests, watching the queue: %m");
+                                }
+                        }
                 }
         }
 
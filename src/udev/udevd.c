@@ -39,6 +39,8 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include "sd-daemon.h"
 #include "sd-event.h"
@@ -56,6 +58,8 @@
 #include "udev-util.h"
 #include "formats-util.h"
 #include "hashmap.h"
+#include "list.h"
+#include "device-db-snapshot.h"
 
 static bool arg_debug = false;
 static int arg_daemonize = false;
@@ -64,6 +68,15 @@ static unsigned arg_children_max;
 static int arg_exec_delay;
 static usec_t arg_event_timeout_usec = 180 * USEC_PER_SEC;
 static usec_t arg_event_timeout_warn_usec = 180 * USEC_PER_SEC / 3;
+static bool arg_db_snapshot = false;
+
+/* minimum time between two snapshots of the database */
+#define DB_SNAPSHOT_INTERVAL_USEC (5 * USEC_PER_SEC)
+
+/* events handed to a worker before it is done with the one it runs */
+#define WORKER_QUEUE_MAX 8
+/* libudev-monitor receives devices into a buffer of the same size */
+#define WORKER_SLOT_SIZE 8192
 
 typedef struct Manager {
         struct udev *udev;
@@ -71,6 +84,12 @@ typedef struct Manager {
         Hashmap *workers;
         struct udev_list_node events;
         const char *cgroup;
+
+        /* queued and running events, by devpath, by device number and by ifindex, see is_devpath_busy() */
+        Hashmap *devpaths;
+        Hashmap *devnums;
+        Hashmap *ifindexes;
+
         pid_t pid; /* the process that originally allocated the manager object */
 
         struct udev_rules *rules;
@@ -79,14 +98,19 @@ typedef struct Manager {
         struct udev_monitor *monitor;
         struct udev_ctrl *ctrl;
         struct udev_ctrl_connection *ctrl_conn_blocking;
+        LIST_HEAD(struct settle_waiter, settle_waiters);
         int fd_inotify;
         int worker_watch[2];
 
         sd_event_source *ctrl_event;
         sd_event_source *uevent_event;
         sd_event_source *inotify_event;
+        sd_event_source *db_snapshot_event;
 
         usec_t last_usec;
+        usec_t db_snapshot_usec;
+
+        bool db_dirty:1;
 
         bool stop_exec_queue:1;
         bool exit:1;
@@ -98,6 +122,24 @@ enum event_state {
         EVENT_RUNNING,
 };
 
+struct event_link;
+
+/* A devpath, or one of its parents, which a queued event refers to.
+ * Events are linked in the order they were queued, so the first one
+ * is the earliest. */
+struct devpath_node {
+        char *path;
+        struct devpath_node *parent;
+        unsigned n_ref;
+
+        /* events for exactly this devpath */
+        LIST_HEAD(struct event, events);
+
+        /* events for devices below this devpath */
+        LIST_HEAD(struct event_link, below);
+        struct event_link *below_tail;
+};
+
 struct event {
         struct udev_list_node node;
         Manager *manager;
@@ -106,7 +148,6 @@ struct event {
         struct udev_device *dev_kernel;
         struct worker *worker;
         enum event_state state;
-        unsigned long long int delaying_seqnum;
         unsigned long long int seqnum;
         const char *devpath;
         size_t devpath_len;
@@ -116,6 +157,31 @@ struct event {
         bool is_block;
         sd_event_source *timeout_warning;
         sd_event_source *timeout;
+        LIST_FIELDS(struct event, worker_events);
+
+        struct devpath_node *devpath_node;
+        LIST_FIELDS(struct event, same_devpath);
+        LIST_FIELDS(struct event, same_devnum);
+        LIST_FIELDS(struct event, same_ifindex);
+
+        /* one link into the parent nodes of devpath_node each */
+        struct event_link *links;
+        unsigned n_links;
+};
+
+struct event_link {
+        struct event *event;
+        struct devpath_node *node;
+        LIST_FIELDS(struct event_link, below);
+};
+
+/* A client of the control socket waiting for the queue, or for the
+ * events of one devpath, to be processed. Its connection is closed
+ * when they are. */
+struct settle_waiter {
+        struct udev_ctrl_connection *conn;
+        char *devpath; /* NULL for the whole queue */
+        LIST_FIELDS(struct settle_waiter, waiters);
 };
 
 static inline struct event *node_to_event(struct udev_list_node *node) {
@@ -131,6 +197,20 @@ enum worker_state {
         WORKER_KILLED,
 };
 
+/* Shared with one worker. The manager copies the properties of an
+ * event into the next free slot and bumps head, the worker takes the
+ * events in order, bumps taken when it starts one and done when it
+ * processed it. */
+struct worker_ring {
+        unsigned head;
+        unsigned taken;
+        unsigned done;
+        struct {
+                size_t size;
+                char buf[WORKER_SLOT_SIZE];
+        } slots[WORKER_QUEUE_MAX];
+};
+
 struct worker {
         Manager *manager;
         struct udev_list_node node;
@@ -138,30 +218,228 @@ struct worker {
         pid_t pid;
         struct udev_monitor *monitor;
         enum worker_state state;
-        struct event *event;
+        struct worker_ring *ring;
+        int fd_kick;
+        /* handed to the worker, in order, the first one is running */
+        LIST_HEAD(struct event, events);
+        unsigned n_events;
+        /* completions taken from the ring */
+        unsigned n_done;
 };
 
 /* passed from worker to main process */
 struct worker_message {
 };
 
+static struct devpath_node *devpath_node_unref(Manager *manager, struct devpath_node *node) {
+        struct devpath_node *parent;
+
+        for (; node; node = parent) {
+                parent = node->parent;
+
+                assert(node->n_ref > 0);
+                node->n_ref--;
+                if (node->n_ref > 0)
+                        continue;
+
+                assert(!node->events);
+                assert(!node->below);
+
+                hashmap_remove(manager->devpaths, node->path);
+                free(node->path);
+                free(node);
+        }
+
+        return NULL;
+}
+
+/* Takes a reference on the node for the first len bytes of devpath,
+ * and on all of its parents */
+static struct devpath_node *devpath_node_ref(Manager *manager, const char *devpath, size_t len) {
+        struct devpath_node *node, *parent = NULL;
+        const char *p;
+        int r;
+
+        node = hashmap_get(manager->devpaths, strndupa(devpath, len));
+        if (node) {
+                struct devpath_node *n;
+
+                for (n = node; n; n = n->parent)
+                        n->n_ref++;
+
+                return node;
+        }
+
+        /* the parent is the devpath without its last element, if any is left */
+        for (p = devpath + len - 1; p > devpath && *p != '/'; p--)
+                ;
+        if (p > devpath) {
+                parent = devpath_node_ref(manager, devpath, p - devpath);
+                if (!parent)
+                        return NULL;
+        }
+
+        r = hashmap_ensure_allocated(&manager->devpaths, &string_hash_ops);
+        if (r < 0)
+                goto fail;
+
+        node = new0(struct devpath_node, 1);
+        if (!node)
+                goto fail;
+
+        node->path = strndup(devpath, len);
+        if (!node->path)
+                goto fail;
+
+        node->parent = parent;
+        node->n_ref = 1;
+
+        r = hashmap_put(manager->devpaths, node->path, node);
+        if (r < 0)
+                goto fail;
+
+        return node;
+
+fail:
+        if (node)
+                free(node->path);
+        free(node);
+        devpath_node_unref(manager, parent);
+        return NULL;
+}
+
+static int event_index_add(Manager *manager, struct event *event) {
+        struct devpath_node *node, *n;
+        struct event *head;
+        unsigned i;
+        int r;
+
+        assert(manager);
+        assert(event);
+
+        if (major(event->devnum) != 0) {
+                r = hashmap_ensure_allocated(&manager->devnums, &devt_hash_ops);
+                if (r < 0)
+                        return r;
+        }
+
+        if (event->ifindex != 0) {
+                r = hashmap_ensure_allocated(&manager->ifindexes, NULL);
+                if (r < 0)
+                        return r;
+        }
+
+        node = devpath_node_ref(manager, event->devpath, event->devpath_len);
+        if (!node)
+                return -ENOMEM;
+
+        for (n = node->parent; n; n = n->parent)
+                event->n_links++;
+
+        event->links = new0(struct event_link, event->n_links);
+        if (!event->links) {
+                event->n_links = 0;
+                devpath_node_unref(manager, node);
+                return -ENOMEM;
+        }
+
+        /* nothing can fail from here on */
+        event->devpath_node = node;
+        LIST_APPEND(same_devpath, node->events, event);
+
+        for (n = node->parent, i = 0; n; n = n->parent, i++) {
+                struct event_link *link = &event->links[i];
+
+                link->event = event;
+                link->node = n;
+                LIST_INSERT_AFTER(below, n->below, n->below_tail, link);
+                n->below_tail = link;
+        }
+
+        if (major(event->devnum) != 0) {
+                head = hashmap_get(manager->devnums, &event->devnum);
+                if (head)
+                        LIST_APPEND(same_devnum, head, event);
+                else
+                        assert_se(hashmap_put(manager->devnums, &event->devnum, event) > 0);
+        }
+
+        if (event->ifindex != 0) {
+                head = hashmap_get(manager->ifindexes, INT_TO_PTR(event->ifindex));
+                if (head)
+                        LIST_APPEND(same_ifindex, head, event);
+                else
+                        assert_se(hashmap_put(manager->ifindexes, INT_TO_PTR(event->ifindex), event) > 0);
+        }
+
+        return 0;
+}
+
+static void event_index_remove(Manager *manager, struct event *event) {
+        struct event *head;
+        unsigned i;
+
+        assert(manager);
+        assert(event);
+
+        if (!event->devpath_node)
+                return;
+
+        if (major(event->devnum) != 0) {
+                head = hashmap_get(manager->devnums, &event->devnum);
+                if (head == event) {
+                        if (event->same_devnum_next)
+                                hashmap_remove_and_replace(manager->devnums, &event->devnum,
+                                                           &event->same_devnum_next->devnum, event->same_devnum_next);
+                        else
+                                hashmap_remove(manager->devnums, &event->devnum);
+                }
+                LIST_REMOVE(same_devnum, head, event);
+        }
+
+        if (event->ifindex != 0) {
+                head = hashmap_get(manager->ifindexes, INT_TO_PTR(event->ifindex));
+                LIST_REMOVE(same_ifindex, head, event);
+                if (head)
+                        hashmap_replace(manager->ifindexes, INT_TO_PTR(event->ifindex), head);
+                else
+                        hashmap_remove(manager->ifindexes, INT_TO_PTR(event->ifindex));
+        }
+
+        for (i = 0; i < event->n_links; i++) {
+                struct event_link *link = &event->links[i];
+
+                if (link->node->below_tail == link)
+                        link->node->below_tail = link->below_prev;
+                LIST_REMOVE(below, link->node->below, link);
+        }
+        event->links = mfree(event->links);
+        event->n_links = 0;
+
+        LIST_REMOVE(same_devpath, event->devpath_node->events, event);
+        event->devpath_node = devpath_node_unref(manager, event->devpath_node);
+}
+
 static void event_free(struct event *event) {
         int r;
 
         if (!event)
                 return;
 
+        assert(event->manager);
+
         udev_list_node_remove(&event->node);
+        event_index_remove(event->manager, event);
         udev_device_unref(event->dev);
         udev_device_unref(event->dev_kernel);
 
         sd_event_source_unref(event->timeout_warning);
         sd_event_source_unref(event->timeout);
 
-        if (event->worker)
-                event->worker->event = NULL;
-
-        assert(event->manager);
+        if (event->worker) {
+                LIST_REMOVE(worker_events, event->worker->events, event);
+                event->worker->n_events--;
+        }
 
         if (udev_list_node_is_empty(&event->manager->events)) {
                 /* only clean up the queue from the process that created it */
@@ -183,7 +461,13 @@ static void worker_free(struct worker *worker) {
 
         hashmap_remove(worker->manager->workers, UINT_TO_PTR(worker->pid));
         udev_monitor_unref(worker->monitor);
-        event_free(worker->event);
+
+        while (worker->events)
+                event_free(worker->events);
+
+        if (worker->ring)
+                munmap(worker->ring, sizeof(struct worker_ring));
+        safe_close(worker->fd_kick);
 
         free(worker);
 }
@@ -200,13 +484,16 @@ static void manager_workers_free(Manager *manager) {
         manager->workers = hashmap_free(manager->workers);
 }
 
-static int worker_new(struct worker **ret, Manager *manager, struct udev_monitor *worker_monitor, pid_t pid) {
-        _cleanup_free_ struct worker *worker = NULL;
+static int worker_new(struct worker **ret, Manager *manager, struct udev_monitor *worker_monitor,
+                      struct worker_ring *ring, int fd_kick, pid_t pid) {
+        struct worker *worker;
         int r;
 
         assert(ret);
         assert(manager);
         assert(worker_monitor);
+        assert(ring);
+        assert(fd_kick >= 0);
         assert(pid > 1);
 
         worker = new0(struct worker, 1);
@@ -219,19 +506,26 @@ static int worker_new(struct worker **ret, Manager *manager, struct udev_monitor
         udev_monitor_disconnect(worker_monitor);
         worker->monitor = udev_monitor_ref(worker_monitor);
         worker->pid = pid;
+        worker->ring = ring;
+        worker->fd_kick = fd_kick;
 
         r = hashmap_ensure_allocated(&manager->workers, NULL);
         if (r < 0)
-                return r;
+                goto fail;
 
         r = hashmap_put(manager->workers, UINT_TO_PTR(pid), worker);
         if (r < 0)
-                return r;
+                goto fail;
 
         *ret = worker;
-        worker = NULL;
 
         return 0;
+
+fail:
+        /* the ring and the fd are the caller's again */
+        udev_monitor_unref(worker->monitor);
+        free(worker);
+        return r;
 }
 
 static int on_event_timeout(sd_event_source *s, uint64_t usec, void *userdata) {
@@ -258,20 +552,17 @@ static int on_event_timeout_warning(sd_event_source *s, uint64_t usec, void *use
         return 1;
 }
 
-static void worker_attach_event(struct worker *worker, struct event *event) {
+/* the timeouts of an event only start when it is the first in the worker's queue */
+static void worker_start_event(struct worker *worker) {
+        struct event *event = worker->events;
         sd_event *e;
         uint64_t usec;
 
         assert(worker);
         assert(worker->manager);
-        assert(event);
-        assert(!event->worker);
-        assert(!worker->event);
 
-        worker->state = WORKER_RUNNING;
-        worker->event = event;
-        event->state = EVENT_RUNNING;
-        event->worker = worker;
+        if (!event || event->timeout)
+                return;
 
         e = worker->manager->event;
 
@@ -284,6 +575,142 @@ static void worker_attach_event(struct worker *worker, struct event *event) {
                                  usec + arg_event_timeout_usec, USEC_PER_SEC, on_event_timeout, event);
 }
 
+static int worker_ring_put(struct worker_ring *ring, struct event *event) {
+        const char *buf;
+        ssize_t size;
+        unsigned slot;
+
+        assert(ring);
+        assert(event);
+
+        size = udev_device_get_properties_monitor_buf(event->dev, &buf);
+        if (size < 0)
+                return size;
+        if ((size_t) size > WORKER_SLOT_SIZE)
+                return -E2BIG;
+
+        slot = ring->head % WORKER_QUEUE_MAX;
+        memcpy(ring->slots[slot].buf, buf, size);
+        ring->slots[slot].size = size;
+
+        /* the slot must be written before the worker sees the new head */
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+        return 0;
+}
+
+static struct udev_device *worker_ring_take(struct udev *udev, struct worker_ring *ring, unsigned n) {
+        char buf[WORKER_SLOT_SIZE];
+        struct udev_device *dev;
+        size_t size;
+
+        /* parsing modifies the buffer, and the slot is not ours to change */
+        size = MIN(ring->slots[n % WORKER_QUEUE_MAX].size, sizeof(buf));
+        memcpy(buf, ring->slots[n % WORKER_QUEUE_MAX].buf, size);
+
+        dev = udev_device_new_from_nulstr(udev, buf, size);
+        if (dev)
+                udev_device_set_is_initialized(dev);
+
+        return dev;
+}
+
+/* the event is in the worker's ring already */
+static void worker_link_event(struct worker *worker, struct event *event) {
+        assert(worker);
+        assert(event);
+        assert(!event->worker);
+        assert(worker->n_events < WORKER_QUEUE_MAX);
+
+        worker->state = WORKER_RUNNING;
+        LIST_APPEND(worker_events, worker->events, event);
+        worker->n_events++;
+        event->state = EVENT_RUNNING;
+        event->worker = worker;
+
+        worker_start_event(worker);
+}
+
+static int worker_attach_event(struct worker *worker, struct event *event) {
+        int r;
+
+        assert(worker);
+
+        r = worker_ring_put(worker->ring, event);
+        if (r < 0)
+                return r;
+
+        /* wake it up, if it is waiting */
+        (void) eventfd_write(worker->fd_kick, 1);
+
+        worker_link_event(worker, event);
+
+        return 0;
+}
+
+/* drop the events the worker processed, and notice those that are left */
+static void worker_collect_events(struct worker *worker) {
+        unsigned done;
+
+        assert(worker);
+
+        done = __atomic_load_n(&worker->ring->done, __ATOMIC_ACQUIRE);
+
+        while (worker->n_done != done && worker->events) {
+                event_free(worker->events);
+                worker->n_done++;
+        }
+
+        if (!worker->events) {
+                if (worker->state != WORKER_KILLED)
+                        worker->state = WORKER_IDLE;
+        } else
+                worker_start_event(worker);
+}
+
+static void worker_requeue_events(struct worker *worker) {
+        struct event *event, *next;
+        unsigned taken;
+
+        assert(worker);
+
+        taken = __atomic_load_n(&worker->ring->taken, __ATOMIC_ACQUIRE);
+
+        /* of those left after worker_collect_events(), only the
+         * first one can have been started */
+        event = worker->events;
+        if (event && taken != worker->n_done)
+                event = event->worker_events_next;
+
+        for (; event; event = next) {
+                next = event->worker_events_next;
+
+                LIST_REMOVE(worker_events, worker->events, event);
+                worker->n_events--;
+                event->worker = NULL;
+                event->state = EVENT_QUEUED;
+                event->timeout_warning = sd_event_source_unref(event->timeout_warning);
+                event->timeout = sd_event_source_unref(event->timeout);
+        }
+}
+
+static struct settle_waiter *settle_waiter_free(Manager *manager, struct settle_waiter *waiter) {
+        if (!waiter)
+                return NULL;
+
+        LIST_REMOVE(waiters, manager->settle_waiters, waiter);
+        udev_ctrl_connection_unref(waiter->conn);
+        free(waiter->devpath);
+        free(waiter);
+
+        return NULL;
+}
+
+static void manager_settle_waiters_free(Manager *manager) {
+        while (manager->settle_waiters)
+                settle_waiter_free(manager, manager->settle_waiters);
+}
+
 static void manager_free(Manager *manager) {
         if (!manager)
                 return;
@@ -293,15 +720,22 @@ static void manager_free(Manager *manager) {
         sd_event_source_unref(manager->ctrl_event);
         sd_event_source_unref(manager->uevent_event);
         sd_event_source_unref(manager->inotify_event);
+        sd_event_source_unref(manager->db_snapshot_event);
 
         udev_unref(manager->udev);
         sd_event_unref(manager->event);
         manager_workers_free(manager);
         event_queue_cleanup(manager, EVENT_UNDEF);
 
+        assert(hashmap_isempty(manager->devpaths));
+        hashmap_free(manager->devpaths);
+        hashmap_free(manager->devnums);
+        hashmap_free(manager->ifindexes);
+
         udev_monitor_unref(manager->monitor);
         udev_ctrl_unref(manager->ctrl);
         udev_ctrl_connection_unref(manager->ctrl_conn_blocking);
+        manager_settle_waiters_free(manager);
 
         udev_list_cleanup(&manager->properties);
         udev_rules_unref(manager->rules);
@@ -323,34 +757,54 @@ static int worker_send_message(int fd) {
 static void worker_spawn(Manager *manager, struct event *event) {
         struct udev *udev = event->udev;
         _cleanup_udev_monitor_unref_ struct udev_monitor *worker_monitor = NULL;
+        struct worker_ring *ring;
+        int fd_kick;
         pid_t pid;
         int r = 0;
 
-        /* listen for new events */
+        /* the processed events are sent to libudev listeners from the worker */
         worker_monitor = udev_monitor_new_from_netlink(udev, NULL);
         if (worker_monitor == NULL)
                 return;
-        /* allow the main daemon netlink address to send devices to the worker */
-        udev_monitor_allow_unicast_sender(worker_monitor, manager->monitor);
         r = udev_monitor_enable_receiving(worker_monitor);
         if (r < 0)
                 log_error_errno(r, "worker: could not enable receiving of device: %m");
 
+        /* the events are passed through memory shared with the worker,
+         * which the manager can keep filling while the worker is busy */
+        ring = mmap(NULL, sizeof(struct worker_ring), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+                log_error_errno(errno, "could not allocate worker ring: %m");
+                return;
+        }
+
+        fd_kick = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (fd_kick < 0) {
+                log_error_errno(errno, "could not create eventfd: %m");
+                munmap(ring, sizeof(struct worker_ring));
+                return;
+        }
+
+        /* the initial device */
+        r = worker_ring_put(ring, event);
+        if (r < 0) {
+                log_error_errno(r, "seq %llu could not be passed to a new worker: %m", udev_device_get_seqnum(event->dev));
+                munmap(ring, sizeof(struct worker_ring));
+                safe_close(fd_kick);
+                return;
+        }
+
         pid = fork();
         switch (pid) {
         case 0: {
                 struct udev_device *dev = NULL;
                 _cleanup_netlink_unref_ sd_netlink *rtnl = NULL;
-                int fd_monitor;
                 _cleanup_close_ int fd_signal = -1, fd_ep = -1;
                 struct epoll_event ep_signal = { .events = EPOLLIN };
-                struct epoll_event ep_monitor = { .events = EPOLLIN };
+                struct epoll_event ep_kick = { .events = EPOLLIN };
+                unsigned n_taken = 0;
                 sigset_t mask;
 
-                /* take initial device from queue */
-                dev = event->dev;
-                event->dev = NULL;
-
                 unsetenv("NOTIFY_SOCKET");
 
                 manager_workers_free(manager);
@@ -360,6 +814,7 @@ static void worker_spawn(Manager *manager, struct event *event) {
                 manager->ctrl_conn_blocking = udev_ctrl_connection_unref(manager->ctrl_conn_blocking);
                 manager->ctrl = udev_ctrl_unref(manager->ctrl);
                 manager->ctrl_conn_blocking = udev_ctrl_connection_unref(manager->ctrl_conn_blocking);
+                manager_settle_waiters_free(manager);
                 manager->worker_watch[READ_END] = safe_close(manager->worker_watch[READ_END]);
 
                 manager->ctrl_event = sd_event_source_unref(manager->ctrl_event);
@@ -376,8 +831,7 @@ static void worker_spawn(Manager *manager, struct event *event) {
                 }
                 ep_signal.data.fd = fd_signal;
 
-                fd_monitor = udev_monitor_get_fd(worker_monitor);
-                ep_monitor.data.fd = fd_monitor;
+                ep_kick.data.fd = fd_kick;
 
                 fd_ep = epoll_create1(EPOLL_CLOEXEC);
                 if (fd_ep < 0) {
@@ -386,7 +840,7 @@ static void worker_spawn(Manager *manager, struct event *event) {
                 }
 
                 if (epoll_ctl(fd_ep, EPOLL_CTL_ADD, fd_signal, &ep_signal) < 0 ||
-                    epoll_ctl(fd_ep, EPOLL_CTL_ADD, fd_monitor, &ep_monitor) < 0) {
+                    epoll_ctl(fd_ep, EPOLL_CTL_ADD, fd_kick, &ep_kick) < 0) {
                         r = log_error_errno(errno, "fail to add fds to epoll: %m");
                         goto out;
                 }
@@ -401,7 +855,54 @@ static void worker_spawn(Manager *manager, struct event *event) {
                         struct udev_event *udev_event;
                         int fd_lock = -1;
 
-                        assert(dev);
+                        /* take the next device from the ring, or wait for one, or the term signal */
+                        while (dev == NULL) {
+                                struct epoll_event ev[4];
+                                int fdcount;
+                                int i;
+
+                                /* don't sleep while events are waiting, but look for
+                                 * the term signal between any two of them */
+                                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev),
+                                                     __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != n_taken ? 0 : -1);
+                                if (fdcount < 0) {
+                                        if (errno == EINTR)
+                                                continue;
+                                        r = log_error_errno(errno, "failed to poll: %m");
+                                        goto out;
+                                }
+
+                                for (i = 0; i < fdcount; i++) {
+                                        if (ev[i].data.fd == fd_kick && ev[i].events & EPOLLIN) {
+                                                eventfd_t value;
+
+                                                (void) eventfd_read(fd_kick, &value);
+                                        } else if (ev[i].data.fd == fd_signal && ev[i].events & EPOLLIN) {
+                                                struct signalfd_siginfo fdsi;
+                                                ssize_t size;
+
+                                                size = read(fd_signal, &fdsi, sizeof(struct signalfd_siginfo));
+                                                if (size != sizeof(struct signalfd_siginfo))
+                                                        continue;
+                                                switch (fdsi.ssi_signo) {
+                                                case SIGTERM:
+                                                        goto out;
+                                                }
+                                        }
+                                }
+
+                                if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == n_taken)
+                                        continue;
+
+                                dev = worker_ring_take(udev, ring, n_taken++);
+                                __atomic_store_n(&ring->taken, n_taken, __ATOMIC_RELEASE);
+                                if (!dev) {
+                                        log_error_errno(errno, "could not create device from worker ring: %m");
+                                        /* still tell the main daemon, so the event is not waited for forever */
+                                        __atomic_store_n(&ring->done, n_taken, __ATOMIC_RELEASE);
+                                        (void) worker_send_message(manager->worker_watch[WRITE_END]);
+                                }
+                        }
 
                         log_debug("seq %llu running", udev_device_get_seqnum(dev));
                         udev_event = udev_event_new(dev);
@@ -471,6 +972,7 @@ skip:
                         log_debug("seq %llu processed", udev_device_get_seqnum(dev));
 
                         /* send udevd the result of the event execution */
+                        __atomic_store_n(&ring->done, n_taken, __ATOMIC_RELEASE);
                         r = worker_send_message(manager->worker_watch[WRITE_END]);
                         if (r < 0)
                                 log_error_errno(r, "failed to send result of seq %llu to main daemon: %m",
@@ -480,39 +982,6 @@ skip:
                         dev = NULL;
 
                         udev_event_unref(udev_event);
-
-                        /* wait for more device messages from main udevd, or term signal */
-                        while (dev == NULL) {
-                                struct epoll_event ev[4];
-                                int fdcount;
-                                int i;
-
-                                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
-                                if (fdcount < 0) {
-                                        if (errno == EINTR)
-                                                continue;
-                                        r = log_error_errno(errno, "failed to poll: %m");
-                                        goto out;
-                                }
-
-                                for (i = 0; i < fdcount; i++) {
-                                        if (ev[i].data.fd == fd_monitor && ev[i].events & EPOLLIN) {
-                                                dev = udev_monitor_receive_device(worker_monitor);
-                                                break;
-                                        } else if (ev[i].data.fd == fd_signal && ev[i].events & EPOLLIN) {
-                                                struct signalfd_siginfo fdsi;
-                                                ssize_t size;
-
-                                                size = read(fd_signal, &fdsi, sizeof(struct signalfd_siginfo));
-                                                if (size != sizeof(struct signalfd_siginfo))
-                                                        continue;
-                                                switch (fdsi.ssi_signo) {
-                                                case SIGTERM:
-                                                        goto out;
-                                                }
-                                        }
-                                }
-                        }
                 }
 out:
                 udev_device_unref(dev);
@@ -523,16 +992,23 @@ out:
         case -1:
                 event->state = EVENT_QUEUED;
                 log_error_errno(errno, "fork of child failed: %m");
+                munmap(ring, sizeof(struct worker_ring));
+                safe_close(fd_kick);
                 break;
         default:
         {
                 struct worker *worker;
 
-                r = worker_new(&worker, manager, worker_monitor, pid);
-                if (r < 0)
+                r = worker_new(&worker, manager, worker_monitor, ring, fd_kick, pid);
+                if (r < 0) {
+                        /* it is not tracked, and would not be told about anything */
+                        kill(pid, SIGKILL);
+                        munmap(ring, sizeof(struct worker_ring));
+                        safe_close(fd_kick);
                         return;
+                }
 
-                worker_attach_event(worker, event);
+                worker_link_event(worker, event);
 
                 log_debug("seq %llu forked new worker ["PID_FMT"]", udev_device_get_seqnum(event->dev), pid);
                 break;
@@ -540,39 +1016,52 @@ out:
         }
 }
 
-static void event_run(Manager *manager, struct event *event) {
-        struct worker *worker;
+/* Returns false if no worker is available to run the event */
+static bool event_run(Manager *manager, struct event *event) {
+        struct worker *worker, *least_busy = NULL;
         Iterator i;
+        int r;
 
         assert(manager);
         assert(event);
 
         HASHMAP_FOREACH(worker, manager->workers, i) {
-                ssize_t count;
+                if (worker->state == WORKER_RUNNING && worker->n_events < WORKER_QUEUE_MAX &&
+                    (!least_busy || worker->n_events < least_busy->n_events))
+                        least_busy = worker;
 
                 if (worker->state != WORKER_IDLE)
                         continue;
 
-                count = udev_monitor_send_device(manager->monitor, worker->monitor, event->dev);
-                if (count < 0) {
-                        log_error_errno(errno, "worker ["PID_FMT"] did not accept message %zi (%m), kill it",
-                                        worker->pid, count);
-                        kill(worker->pid, SIGKILL);
-                        worker->state = WORKER_KILLED;
-                        continue;
-                }
-                worker_attach_event(worker, event);
-                return;
+                r = worker_attach_event(worker, event);
+                if (r < 0)
+                        log_error_errno(r, "seq %llu could not be passed to worker ["PID_FMT"]: %m",
+                                        udev_device_get_seqnum(event->dev), worker->pid);
+                return true;
         }
 
-        if (hashmap_size(manager->workers) >= arg_children_max) {
-                if (arg_children_max > 1)
-                        log_debug("maximum number (%i) of children reached", hashmap_size(manager->workers));
-                return;
+        /* an idle worker of its own is better than waiting for another event */
+        if (hashmap_size(manager->workers) < arg_children_max) {
+                /* start new worker and pass initial device */
+                worker_spawn(manager, event);
+                return true;
         }
 
-        /* start new worker and pass initial device */
-        worker_spawn(manager, event);
+        /* All workers are busy. The event does not depend on any event
+         * before it, see is_devpath_busy(), so it can be queued behind
+         * those of the least busy worker, which takes it as soon as it
+         * is done with them. */
+        if (least_busy) {
+                r = worker_attach_event(least_busy, event);
+                if (r < 0)
+                        log_error_errno(r, "seq %llu could not be passed to worker ["PID_FMT"]: %m",
+                                        udev_device_get_seqnum(event->dev), least_busy->pid);
+                return true;
+        }
+
+        if (arg_children_max > 1)
+                log_debug("maximum number (%i) of children reached", hashmap_size(manager->workers));
+        return false;
 }
 
 static int event_queue_insert(Manager *manager, struct udev_device *dev) {
@@ -609,6 +1098,14 @@ static int event_queue_insert(Manager *manager, struct udev_device *dev) {
              udev_device_get_action(dev), udev_device_get_subsystem(dev));
 
         event->state = EVENT_QUEUED;
+        manager->db_dirty = true;
+
+        r = event_index_add(manager, event);
+        if (r < 0) {
+                udev_device_unref(event->dev_kernel);
+                free(event);
+                return r;
+        }
 
         if (udev_list_node_is_empty(&manager->events)) {
                 r = touch("/run/udev/queue");
@@ -636,74 +1133,55 @@ static void manager_kill_workers(Manager *manager) {
         }
 }
 
-/* lookup event for identical, parent, child device */
+/* lookup earlier event for identical, parent, child device */
 static bool is_devpath_busy(Manager *manager, struct event *event) {
-        struct udev_list_node *loop;
-        size_t common;
+        struct devpath_node *node = event->devpath_node, *n;
+        struct event *e;
 
-        /* check if queue contains events we depend on */
-        udev_list_node_foreach(loop, &manager->events) {
-                struct event *loop_event = node_to_event(loop);
+        assert(node);
 
-                /* we already found a later event, earlier can not block us, no need to check again */
-                if (loop_event->seqnum < event->delaying_seqnum)
-                        continue;
+        /* check major/minor */
+        if (major(event->devnum) != 0)
+                for (e = hashmap_get(manager->devnums, &event->devnum); e && e != event; e = e->same_devnum_next)
+                        if (e->is_block == event->is_block && e->seqnum < event->seqnum)
+                                return true;
 
-                /* event we checked earlier still exists, no need to check again */
-                if (loop_event->seqnum == event->delaying_seqnum)
-                        return true;
-
-                /* found ourself, no later event can block us */
-                if (loop_event->seqnum >= event->seqnum)
-                        break;
-
-                /* check major/minor */
-                if (major(event->devnum) != 0 && event->devnum == loop_event->devnum && event->is_block == loop_event->is_block)
-                        return true;
-
-                /* check network device ifindex */
-                if (event->ifindex != 0 && event->ifindex == loop_event->ifindex)
+        /* check network device ifindex */
+        if (event->ifindex != 0) {
+                e = hashmap_get(manager->ifindexes, INT_TO_PTR(event->ifindex));
+                if (e && e != event && e->seqnum < event->seqnum)
                         return true;
+        }
 
-                /* check our old name */
-                if (event->devpath_old != NULL && streq(loop_event->devpath, event->devpath_old)) {
-                        event->delaying_seqnum = loop_event->seqnum;
+        /* check our old name */
+        if (event->devpath_old != NULL) {
+                n = hashmap_get(manager->devpaths, event->devpath_old);
+                if (n && n->events && n->events != event && n->events->seqnum < event->seqnum)
                         return true;
-                }
+        }
 
-                /* compare devpath */
-                common = MIN(loop_event->devpath_len, event->devpath_len);
+        /* identical device event found */
+        LIST_FOREACH(same_devpath, e, node->events) {
+                if (e == event || e->seqnum >= event->seqnum)
+                        break;
 
-                /* one devpath is contained in the other? */
-                if (memcmp(loop_event->devpath, event->devpath, common) != 0)
+                /* devices names might have changed/swapped in the meantime */
+                if (major(event->devnum) != 0 && (event->devnum != e->devnum || event->is_block != e->is_block))
+                        continue;
+                if (event->ifindex != 0 && event->ifindex != e->ifindex)
                         continue;
 
-                /* identical device event found */
-                if (loop_event->devpath_len == event->devpath_len) {
-                        /* devices names might have changed/swapped in the meantime */
-                        if (major(event->devnum) != 0 && (event->devnum != loop_event->devnum || event->is_block != loop_event->is_block))
-                                continue;
-                        if (event->ifindex != 0 && event->ifindex != loop_event->ifindex)
-                                continue;
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
-
-                /* parent device event found */
-                if (event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
+                return true;
+        }
 
-                /* child device event found */
-                if (loop_event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
+        /* parent device event found */
+        for (n = node->parent; n; n = n->parent)
+                if (n->events && n->events->seqnum < event->seqnum)
                         return true;
-                }
 
-                /* no matching device */
-                continue;
-        }
+        /* child device event found */
+        if (node->below && node->below->event->seqnum < event->seqnum)
+                return true;
 
         return false;
 }
@@ -811,7 +1289,9 @@ static void event_queue_start(Manager *manager) {
                 if (is_devpath_busy(manager, event))
                         continue;
 
-                event_run(manager, event);
+                /* all workers are busy, the remaining events have to wait */
+                if (!event_run(manager, event))
+                        break;
         }
 }
 
@@ -887,11 +1367,8 @@ static int on_worker(sd_event_source *s, int fd, uint32_t revents, void *userdat
                         continue;
                 }
 
-                if (worker->state != WORKER_KILLED)
-                        worker->state = WORKER_IDLE;
-
-                /* worker returned */
-                event_free(worker->event);
+                /* worker processed one or more events, the count is in the ring */
+                worker_collect_events(worker);
         }
 
         /* we have free workers, try to schedule events */
@@ -921,13 +1398,65 @@ static int on_uevent(sd_event_source *s, int fd, uint32_t revents, void *userdat
         return 1;
 }
 
+static bool settle_waiter_done(Manager *manager, struct settle_waiter *waiter) {
+        struct devpath_node *node;
+
+        /* The kernel's uevent seqnum also counts uevents of other
+         * network namespaces, which never reach us, so it can't tell
+         * whether everything has arrived. Go by our own queue. */
+        if (!waiter->devpath)
+                return udev_list_node_is_empty(&manager->events);
+
+        node = hashmap_get(manager->devpaths, waiter->devpath);
+        return !node || !node->events;
+}
+
+static void manager_check_settle_waiters(Manager *manager) {
+        struct settle_waiter *waiter, *next;
+        int r;
+
+        LIST_FOREACH_SAFE(waiters, waiter, next, manager->settle_waiters) {
+                if (!settle_waiter_done(manager, waiter))
+                        continue;
+
+                r = udev_ctrl_connection_notify_settled(waiter->conn);
+                if (r < 0)
+                        log_debug_errno(r, "could not notify settle client: %m");
+
+                settle_waiter_free(manager, waiter);
+        }
+}
+
+static int manager_add_settle_waiter(Manager *manager, struct udev_ctrl_connection *conn, const char *devpath) {
+        struct settle_waiter *waiter;
+
+        waiter = new0(struct settle_waiter, 1);
+        if (!waiter)
+                return -ENOMEM;
+
+        if (!isempty(devpath)) {
+                waiter->devpath = strdup(devpath);
+                if (!waiter->devpath) {
+                        free(waiter);
+                        return -ENOMEM;
+                }
+        }
+
+        waiter->conn = udev_ctrl_connection_ref(conn);
+        LIST_PREPEND(waiters, manager->settle_waiters, waiter);
+
+        manager_check_settle_waiters(manager);
+
+        return 0;
+}
+
 /* receive the udevd message from userspace */
 static int on_ctrl_msg(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         Manager *manager = userdata;
         _cleanup_udev_ctrl_connection_unref_ struct udev_ctrl_connection *ctrl_conn = NULL;
         _cleanup_udev_ctrl_msg_unref_ struct udev_ctrl_msg *ctrl_msg = NULL;
         const char *str;
-        int i;
+        int i, r;
 
         assert(manager);
 
@@ -996,6 +1525,14 @@ static int on_ctrl_msg(sd_event_source *s, int fd, uint32_t revents, void *userd
         if (udev_ctrl_get_ping(ctrl_msg) > 0)
                 log_debug("udevd message (SYNC) received");
 
+        str = udev_ctrl_get_settle(ctrl_msg);
+        if (str != NULL) {
+                log_debug("udevd message (SETTLE) received, devpath='%s'", str);
+                r = manager_add_settle_waiter(manager, ctrl_conn, str);
+                if (r < 0)
+                        log_error_errno(r, "could not add settle client: %m");
+        }
+
         if (udev_ctrl_get_exit(ctrl_msg) > 0) {
                 log_debug("udevd message (EXIT) received");
                 manager_exit(manager);
@@ -1207,14 +1744,20 @@ static int on_sigchld(sd_event_source *s, const struct signalfd_siginfo *si, voi
                 } else
                         log_warning("worker ["PID_FMT"] exit with status 0x%04x", pid, status);
 
+                /* what it finished before its message could be read */
+                worker_collect_events(worker);
+
+                /* the events it did not start yet go to another worker */
+                worker_requeue_events(worker);
+
                 if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-                        if (worker->event) {
-                                log_error("worker ["PID_FMT"] failed while handling '%s'", pid, worker->event->devpath);
+                        if (worker->events) {
+                                log_error("worker ["PID_FMT"] failed while handling '%s'", pid, worker->events->devpath);
                                 /* delete state from disk */
-                                udev_device_delete_db(worker->event->dev);
-                                udev_device_tag_index(worker->event->dev, NULL, false);
+                                udev_device_delete_db(worker->events->dev);
+                                udev_device_tag_index(worker->events->dev, NULL, false);
                                 /* forward kernel event without amending it */
-                                udev_monitor_send_device(manager->monitor, NULL, worker->event->dev_kernel);
+                                udev_monitor_send_device(manager->monitor, NULL, worker->events->dev_kernel);
                         }
                 }
 
@@ -1227,14 +1770,59 @@ static int on_sigchld(sd_event_source *s, const struct signalfd_siginfo *si, voi
         return 1;
 }
 
+static int on_db_snapshot(sd_event_source *s, uint64_t usec, void *userdata) {
+        Manager *manager = userdata;
+        int r;
+
+        assert(manager);
+
+        manager->db_snapshot_event = sd_event_source_unref(manager->db_snapshot_event);
+
+        /* new events arrived meanwhile, on_post() rearms us */
+        if (!udev_list_node_is_empty(&manager->events))
+                return 1;
+
+        r = device_db_snapshot_write();
+        if (r < 0)
+                log_debug_errno(r, "could not write database snapshot: %m");
+
+        manager->db_dirty = false;
+        manager->db_snapshot_usec = now(CLOCK_MONOTONIC);
+
+        return 1;
+}
+
+static void manager_schedule_db_snapshot(Manager *manager) {
+        usec_t usec;
+        int r;
+
+        assert(manager);
+
+        if (!arg_db_snapshot || !manager->db_dirty || manager->db_snapshot_event)
+                return;
+
+        /* written when the queue drained, but not more often than
+         * every few seconds while events keep trickling in */
+        usec = MAX(now(CLOCK_MONOTONIC), manager->db_snapshot_usec + DB_SNAPSHOT_INTERVAL_USEC);
+
+        r = sd_event_add_time(manager->event, &manager->db_snapshot_event, CLOCK_MONOTONIC,
+                              usec, USEC_PER_SEC / 10, on_db_snapshot, manager);
+        if (r < 0)
+                log_debug_errno(r, "could not schedule database snapshot: %m");
+}
+
 static int on_post(sd_event_source *s, void *userdata) {
         Manager *manager = userdata;
         int r;
 
         assert(manager);
 
+        manager_check_settle_waiters(manager);
+
         if (udev_list_node_is_empty(&manager->events)) {
                 /* no pending events */
+                manager_schedule_db_snapshot(manager);
+
                 if (!hashmap_isempty(manager->workers)) {
                         /* there are idle workers */
                         log_debug("cleanup idle workers");
@@ -1407,10 +1995,15 @@ static void help(void) {
                "     --event-timeout=SECONDS  Seconds to wait before terminating an event\n"
                "     --resolve-names=early|late|never\n"
                "                              When to resolve users and groups\n"
+               "     --db-snapshot            Store a copy of the database in a single file\n"
                , program_invocation_short_name);
 }
 
 static int parse_argv(int argc, char *argv[]) {
+        enum {
+                ARG_DB_SNAPSHOT = 0x100,
+        };
+
         static const struct option options[] = {
                 { "daemon",             no_argument,            NULL, 'd' },
                 { "debug",              no_argument,            NULL, 'D' },
@@ -1418,6 +2011,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "exec-delay",         required_argument,      NULL, 'e' },
                 { "event-timeout",      required_argument,      NULL, 't' },
                 { "resolve-names",      required_argument,      NULL, 'N' },
+                { "db-snapshot",        no_argument,            NULL, ARG_DB_SNAPSHOT },
                 { "help",               no_argument,            NULL, 'h' },
                 { "version",            no_argument,            NULL, 'V' },
                 {}
@@ -1470,6 +2064,9 @@ static int parse_argv(int argc, char *argv[]) {
                                 return 0;
                         }
                         break;
+                case ARG_DB_SNAPSHOT:
+                        arg_db_snapshot = true;
+                        break;
                 case 'h':
                         help();
                         return 0;
@@ -1518,6 +2115,9 @@ static int manager_new(Manager **ret, int fd_ctrl, int fd_uevent, const char *cg
 
         manager->cgroup = cgroup;
 
+        /* a snapshot left behind by an earlier instance is not trusted */
+        manager->db_dirty = arg_db_snapshot;
+
         manager->ctrl = udev_ctrl_new_from_fd(manager->udev, fd_ctrl);
         if (!manager->ctrl)
                 return log_error_errno(EINVAL, "error taking over udev control socket");
@@ -1570,6 +2170,10 @@ static int manager_new(Manager **ret, int fd_ctrl, int fd_uevent, const char *cg
         if (r < 0)
                 return log_error_errno(r, "error creating watchdog event source: %m");
 
+        r = sd_event_set_dispatch_budget(manager->event, 16);
+        if (r < 0)
+                return log_error_errno(r, "could not set event dispatch budget: %m");
+
         r = sd_event_add_io(manager->event, &manager->ctrl_event, fd_ctrl, EPOLLIN, on_ctrl_msg, manager);
         if (r < 0)
                 return log_error_errno(r, "error creating ctrl event source: %m");
@@ -1745,6 +2349,10 @@ int main(int argc, char *argv[]) {
                 write_string_file("/proc/self/oom_score_adj", "-1000", 0);
         }
 
+        /* Only now, since the queue stays behind with the parent
+         * when we daemonize */
+        log_set_buffered(true);
+
         r = run(fd_ctrl, fd_uevent, cgroup);
 
 exit:
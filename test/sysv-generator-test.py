@@ -64,6 +64,7 @@ class SysvGeneratorTest(unittest.TestCase):
         env['SYSTEMD_SYSVINIT_PATH'] = self.init_d_dir
         env['SYSTEMD_SYSVRCND_PATH'] = self.rcnd_dir
         env['SYSTEMD_UNIT_PATH'] = self.unit_dir
+        env['SYSTEMD_SYSV_GENERATOR_CACHE'] = os.path.join(self.workdir, 'cache')
         gen = subprocess.Popen(
             [sysv_generator, 'ignored', 'ignored', self.out_dir],
             stdout=subprocess.PIPE, stderr=subprocess.PIPE,
@@ -406,6 +407,39 @@ class SysvGeneratorTest(unittest.TestCase):
         # no enablement or alias links, as native unit is disabled
         self.assertEqual(os.listdir(self.out_dir), [])
 
+    def test_cache(self):
+        '''unchanged scripts are taken from the cache'''
+
+        self.add_sysv('foo', {'Provides': 'foo bar', 'Required-Start': '$network'}, enable=True)
+        err, results = self.run_generator()
+        self.assertNotIn('cached', err)
+        unit = sorted(results['foo.service'].items('Unit'))
+
+        shutil.rmtree(self.out_dir)
+        os.mkdir(self.out_dir)
+
+        err, results = self.run_generator()
+        self.assertIn('Using cached metadata', err)
+        self.assertEqual(sorted(results['foo.service'].items('Unit')), unit)
+        self.assertEqual(os.readlink(os.path.join(self.out_dir, 'bar.service')),
+                         'foo.service')
+        self.assert_enabled('foo.service', ['multi-user', 'graphical'])
+
+    def test_cache_changed_script(self):
+        '''changed scripts are read again'''
+
+        self.add_sysv('foo', {})
+        self.run_generator()
+
+        self.add_sysv('foo', {'Short-Description': 'changed foo'})
+        shutil.rmtree(self.out_dir)
+        os.mkdir(self.out_dir)
+
+        err, results = self.run_generator()
+        self.assertNotIn('cached', err)
+        self.assertEqual(results['foo.service'].get('Unit', 'Description'),
+                         'LSB: changed foo')
+
 
 if __name__ == '__main__':
     unittest.main(testRunner=unittest.TextTestRunner(stream=sys.stdout, verbosity=2))